@@ -0,0 +1,490 @@
+#include "AmbientOcclusion.h"
+#include "FullscreenTriangle.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+const char* commonShaderSource = R"(
+/**
+ * Same as AmbientOcclusion::Uniforms
+ */
+struct OcclusionUniforms {
+	reprojection: mat4x4f,
+	projection: vec4f,
+	depthParameters: vec2f,
+	sceneSize: vec2u,
+	occlusionSize: vec2u,
+	historySize: vec2u,
+	radius: f32,
+	intensity: f32,
+	baseLevel: u32,
+	levelCount: u32,
+	downscale: u32,
+	frameIndex: u32,
+};
+
+@group(0) @binding(0) var<uniform> uOcclusion: OcclusionUniforms;
+
+// Distances of the background and beyond, within the range of the history
+const MaxDistance = 60000.0;
+
+fn viewDistance(depth: f32) -> f32 {
+	let a = uOcclusion.depthParameters.x;
+	let b = uOcclusion.depthParameters.y;
+	return min(b / max(depth + a, 1e-20), MaxDistance);
+}
+)";
+
+const char* occlusionShaderSource = R"(
+// At the resolution of the occlusion from uOcclusion.baseLevel
+@group(0) @binding(1) var depthPyramid: texture_2d<f32>;
+// Occlusion, view distance and number of frames averaged of each texel
+@group(0) @binding(2) var history: texture_2d<f32>;
+@group(0) @binding(3) var nextHistory: texture_storage_2d<rgba16float, write>;
+
+const SampleCount = 12u;
+// Same as AmbientOcclusion::MaxHistoryFrames
+const MaxHistoryFrames = 8.0;
+// Turns of the spiral of samples, prime to the sample count for them not to line up
+const SpiralTurns = 7.0;
+const PI = 3.14159265359;
+
+// Depth of the texel of `level` covering the occlusion texel `pixel`
+fn pyramidDepth(pixel: vec2i, level: u32) -> f32 {
+	let size = vec2i(textureDimensions(depthPyramid, level));
+	let texel = clamp(pixel >> vec2u(level - uOcclusion.baseLevel), vec2i(0), size - 1);
+	return textureLoad(depthPyramid, texel, level).r;
+}
+
+// Of the center of the occlusion texel `pixel`, at a view distance of `distance`
+fn viewPosition(pixel: vec2f, distance: f32) -> vec3f {
+	let uv = pixel * f32(uOcclusion.downscale) / vec2f(uOcclusion.sceneSize);
+	let ndc = vec2f(2.0 * uv.x - 1.0, 1.0 - 2.0 * uv.y);
+	return vec3f((ndc + uOcclusion.projection.zw) / uOcclusion.projection.xy * distance, -distance);
+}
+
+fn positionAt(pixel: vec2i) -> vec3f {
+	return viewPosition(vec2f(pixel) + 0.5, viewDistance(pyramidDepth(pixel, uOcclusion.baseLevel)));
+}
+
+// From the difference with the neighbour on either side that is nearer in depth, which stays on
+// the surface of the pixel at its edges
+fn viewNormal(pixel: vec2i, position: vec3f) -> vec3f {
+	let right = positionAt(pixel + vec2i(1, 0)) - position;
+	let left = position - positionAt(pixel - vec2i(1, 0));
+	let down = positionAt(pixel + vec2i(0, 1)) - position;
+	let up = position - positionAt(pixel - vec2i(0, 1));
+	let dx = select(left, right, abs(right.z) < abs(left.z));
+	let dy = select(up, down, abs(down.z) < abs(up.z));
+	let normal = normalize(cross(dy, dx));
+	return select(normal, -normal, dot(normal, position) > 0.0);
+}
+
+// Interleaved gradient noise (Jimenez), in [0, 1)
+fn rotationNoise(pixel: vec2i) -> f32 {
+	return fract(52.9829189 * fract(dot(vec2f(pixel), vec2f(0.06711056, 0.00583715))));
+}
+
+// Fraction of the ambient light that reaches the surface at `pixel`
+fn estimateOcclusion(pixel: vec2i, position: vec3f, normal: vec3f) -> f32 {
+	let distance = -position.z;
+	let radius = uOcclusion.radius;
+	// Occlusion texels the radius spans at the distance of the surface, capped for the samples
+	// to stay in the cache
+	let pixelsPerUnit = uOcclusion.projection.y * 0.5 * f32(uOcclusion.sceneSize.y) / (f32(uOcclusion.downscale) * distance);
+	let projectedRadius = min(radius * pixelsPerUnit, 64.0);
+	if (projectedRadius < 1.0) {
+		return 1.0;
+	}
+
+	let rotation = 2.0 * PI * (rotationNoise(pixel) + 0.618034 * f32(uOcclusion.frameIndex % 64u));
+	let radius2 = radius * radius;
+	let bias = 0.05 * radius;
+	let epsilon = 0.01 * radius2;
+	let center = vec2f(pixel) + 0.5;
+	var occlusion = 0.0;
+	for (var i = 0u; i < SampleCount; i++) {
+		let alpha = (f32(i) + 0.5) / f32(SampleCount);
+		let angle = alpha * SpiralTurns * 2.0 * PI + rotation;
+		let offset = alpha * projectedRadius;
+		let texel = vec2i(floor(center + offset * vec2f(cos(angle), sin(angle))));
+		if (any(texel < vec2i(0)) || any(texel >= vec2i(uOcclusion.occlusionSize))) {
+			continue;
+		}
+		// Samples farther from the pixel read coarser levels, as they skip over texels anyway
+		let level = min(uOcclusion.baseLevel + u32(max(log2(offset) - 2.0, 0.0)), uOcclusion.levelCount - 1u);
+		let samplePosition = viewPosition(vec2f(texel) + 0.5, viewDistance(pyramidDepth(texel, level)));
+		let v = samplePosition - position;
+		let vv = dot(v, v);
+		let falloff = max(radius2 - vv, 0.0);
+		occlusion += falloff * falloff * falloff * max((dot(v, normal) - bias) / (vv + epsilon), 0.0);
+	}
+	return max(0.0, 1.0 - occlusion * uOcclusion.intensity * 5.0 / (radius2 * radius2 * radius2 * f32(SampleCount)));
+}
+
+// One invocation per texel of the occlusion
+@compute @workgroup_size(8, 8, 1)
+fn estimate(@builtin(global_invocation_id) id: vec3u) {
+	if (any(id.xy >= uOcclusion.occlusionSize)) {
+		return;
+	}
+	let pixel = vec2i(id.xy);
+	let depth = pyramidDepth(pixel, uOcclusion.baseLevel);
+	let distance = viewDistance(depth);
+	if (distance >= MaxDistance) {
+		textureStore(nextHistory, id.xy, vec4f(1.0, MaxDistance, 0.0, 0.0));
+		return;
+	}
+	let position = viewPosition(vec2f(pixel) + 0.5, distance);
+	let occlusion = estimateOcclusion(pixel, position, viewNormal(pixel, position));
+
+	// Where the surface seen at the center of the texel was in the previous frame, the history
+	// holding another surface where this one was hidden
+	let uv = (vec2f(pixel) + 0.5) * f32(uOcclusion.downscale) / vec2f(uOcclusion.sceneSize);
+	let ndc = vec2f(2.0 * uv.x - 1.0, 1.0 - 2.0 * uv.y);
+	let previous = uOcclusion.reprojection * vec4f(ndc, depth, 1.0);
+	let previousUv = vec2f(0.5, -0.5) * previous.xy / previous.w + 0.5;
+	// The reprojected position is divided by the w of the frame, its view distance
+	let previousDistance = previous.w * distance;
+	var frames = 0.0;
+	var accumulated = 0.0;
+	if (all(uOcclusion.historySize > vec2u(0u)) && previous.w > 0.0 && all(previousUv >= vec2f(0.0)) && all(previousUv <= vec2f(1.0))) {
+		let historyPixel = min(vec2u(previousUv * vec2f(uOcclusion.historySize)), uOcclusion.historySize - 1u);
+		let texel = textureLoad(history, historyPixel, 0);
+		if (abs(texel.g - previousDistance) <= 0.05 * max(texel.g, previousDistance)) {
+			accumulated = texel.r;
+			frames = texel.b;
+		}
+	}
+	let blended = mix(accumulated, occlusion, 1.0 / (frames + 1.0));
+	textureStore(nextHistory, id.xy, vec4f(blended, distance, min(frames + 1.0, MaxHistoryFrames), 0.0));
+}
+)";
+
+// Sample 0 of multisampled depths, which is enough to tell edges apart
+const char* depthLoadSource = R"(
+@group(0) @binding(2) var depthTexture: texture_depth_2d;
+
+fn loadDepth(pixel: vec2u) -> f32 {
+	return textureLoad(depthTexture, pixel, 0);
+}
+)";
+
+const char* multisampledDepthLoadSource = R"(
+@group(0) @binding(2) var depthTexture: texture_depth_multisampled_2d;
+
+fn loadDepth(pixel: vec2u) -> f32 {
+	return textureLoad(depthTexture, pixel, 0);
+}
+)";
+
+const char* applyShaderSource = R"(
+@group(0) @binding(1) var occlusionHistory: texture_2d<f32>;
+
+// The occlusion of the pixel, multiplying the scene by blending
+@fragment
+fn fs_apply(@builtin(position) position: vec4f) -> @location(0) vec4f {
+	let distance = viewDistance(loadDepth(vec2u(position.xy)));
+	// The 2x2 texels whose centers surround the pixel, bilinearly weighed and the more so as
+	// their distance is near that of the pixel
+	let coordinate = position.xy / f32(uOcclusion.downscale) - 0.5;
+	let base = vec2i(floor(coordinate));
+	let fraction = coordinate - vec2f(base);
+	var occlusion = 0.0;
+	var weight = 0.0;
+	for (var y = 0; y <= 1; y++) {
+		for (var x = 0; x <= 1; x++) {
+			let texel = clamp(base + vec2i(x, y), vec2i(0), vec2i(uOcclusion.occlusionSize) - 1);
+			let history = textureLoad(occlusionHistory, texel, 0);
+			let bilinear = select(1.0 - fraction.x, fraction.x, x == 1) * select(1.0 - fraction.y, fraction.y, y == 1);
+			let texelWeight = bilinear / (1e-3 + abs(history.g - distance) / max(distance, 1e-4));
+			occlusion += texelWeight * history.r;
+			weight += texelWeight;
+		}
+	}
+	return vec4f(vec3f(occlusion / max(weight, 1e-8)), 1.0);
+}
+)";
+
+} // anonymous namespace
+
+AmbientOcclusion::AmbientOcclusion(Device device, PipelineCache& pipelineCache, TextureFormat sceneFormat, uint32_t sampleCount, uint32_t downscale)
+	: mDevice(device)
+{
+	mUniforms.downscale = downscale == 4 ? 4 : 2;
+	mUniforms.baseLevel = mUniforms.downscale == 4 ? 1 : 0;
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Ambient occlusion uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "AmbientOcclusion");
+	if (!mUniformBuffer) return;
+	GpuHandle<Queue>(device.getQueue())->writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+
+	// Estimate: uniforms, the pyramid, then the history read and the one written
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(4, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[2].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[3].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[3].storageTexture.format = HistoryFormat;
+	bindingLayoutEntries[3].storageTexture.viewDimension = TextureViewDimension::_2D;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mOcclusionLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mOcclusionLayout;
+	ComputePipelineDescriptor computePipelineDesc{};
+	computePipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	computePipelineDesc.compute.module = pipelineCache.shaderModule(std::string(commonShaderSource) + occlusionShaderSource);
+	computePipelineDesc.compute.entryPoint = "estimate";
+	computePipelineDesc.compute.constantCount = 0;
+	computePipelineDesc.compute.constants = nullptr;
+	mOcclusionPipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+
+	// Apply: uniforms, the history just written, then the depths of the scene
+	bindingLayoutEntries.assign(3, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Fragment;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].texture.sampleType = TextureSampleType::Depth;
+	bindingLayoutEntries[2].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].texture.multisampled = sampleCount > 1;
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mApplyLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	std::string depthSource = sampleCount > 1 ? multisampledDepthLoadSource : depthLoadSource;
+	ShaderModule shaderModule = pipelineCache.shaderModule(std::string(FullscreenTriangle::VertexShaderSource) + commonShaderSource + depthSource + applyShaderSource);
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mApplyLayout;
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	FullscreenTriangle::setPipelineStates(pipelineDesc, shaderModule);
+
+	// The scene times the occlusion, its alpha left as it is
+	BlendState blendState{};
+	blendState.color.srcFactor = BlendFactor::Zero;
+	blendState.color.dstFactor = BlendFactor::Src;
+	blendState.color.operation = BlendOperation::Add;
+	blendState.alpha.srcFactor = BlendFactor::Zero;
+	blendState.alpha.dstFactor = BlendFactor::One;
+	blendState.alpha.operation = BlendOperation::Add;
+	ColorTargetState colorTarget{};
+	colorTarget.format = sceneFormat;
+	colorTarget.blend = &blendState;
+	colorTarget.writeMask = ColorWriteMask::All;
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = "fs_apply";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+	mApplyPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+AmbientOcclusion::~AmbientOcclusion() {
+	terminateHistory();
+	if (mUniformBuffer) {
+		destroyTracked(mUniformBuffer);
+		mUniformBuffer.release();
+	}
+}
+
+void AmbientOcclusion::createHistory(const glm::uvec2& size) {
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Ambient occlusion history";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = HistoryFormat;
+	textureDesc.size = { size.x, size.y, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::StorageBinding | TextureUsage::TextureBinding;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	for (uint32_t i = 0; i < 2; ++i) {
+		mHistoryTextures[i] = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::RenderTargets, "AmbientOcclusion");
+		mHistoryViews[i] = mHistoryTextures[i].createView();
+	}
+	mHistoryTextureSize = size;
+}
+
+void AmbientOcclusion::terminateHistory() {
+	for (uint32_t i = 0; i < 2; ++i) {
+		for (BindGroup* bindGroup : { &mOcclusionBindGroups[i], &mApplyBindGroups[i] }) {
+			if (*bindGroup) bindGroup->release();
+			*bindGroup = nullptr;
+		}
+		if (mHistoryViews[i]) mHistoryViews[i].release();
+		mHistoryViews[i] = nullptr;
+		if (mHistoryTextures[i]) retireTracked(mHistoryTextures[i]);
+		mHistoryTextures[i] = nullptr;
+	}
+	mDepthPyramidView = nullptr;
+	mDepthView = nullptr;
+	mHistoryTextureSize = { 0, 0 };
+}
+
+void AmbientOcclusion::update(
+	Queue queue, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+	const glm::uvec2& sceneSize, const glm::uvec2& sceneTextureSize, uint32_t levelCount
+) {
+	// The history does not survive resizes
+	uint32_t downscale = mUniforms.downscale;
+	glm::uvec2 historyTextureSize = (sceneTextureSize + downscale - 1u) / downscale;
+	if (historyTextureSize != mHistoryTextureSize) {
+		terminateHistory();
+		createHistory(historyTextureSize);
+		mHistoryWritten = false;
+	}
+
+	glm::mat4 viewProjection = projection * view * model;
+	Uniforms uniforms = mUniforms;
+	uniforms.reprojection = mPreviousViewProjection * glm::inverse(viewProjection);
+	uniforms.projection = { projection[0][0], projection[1][1], projection[2][0], projection[2][1] };
+	uniforms.depthParameters = { projection[2][2], projection[3][2] };
+	uniforms.sceneSize = glm::max(sceneSize, glm::uvec2(1));
+	uniforms.occlusionSize = (uniforms.sceneSize + downscale - 1u) / downscale;
+	uniforms.historySize = mHistoryWritten && ready() ? mPreviousOcclusionSize : glm::uvec2(0);
+	uniforms.radius = mRadius;
+	uniforms.intensity = mIntensity;
+	uniforms.levelCount = std::max(levelCount, uniforms.baseLevel + 1);
+	uniforms.frameIndex = mFrameIndex++;
+	mPreviousViewProjection = viewProjection;
+	mPreviousOcclusionSize = uniforms.occlusionSize;
+	mHistoryWritten = false;
+
+	// The noise rotates every frame, so the uniforms always change
+	mUniforms = uniforms;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+bool AmbientOcclusion::encode(CommandEncoder encoder, TextureView depthPyramidView, const ComputePassTimestampWrites* timestampWrites) {
+	if (!ready() || !mHistoryViews[0]) return false;
+
+	if (depthPyramidView != mDepthPyramidView) {
+		for (BindGroup& bindGroup : mOcclusionBindGroups) {
+			if (bindGroup) bindGroup.release();
+			bindGroup = nullptr;
+		}
+		mDepthPyramidView = depthPyramidView;
+	}
+	uint32_t next = 1 - mHistoryIndex;
+	BindGroup& bindGroup = mOcclusionBindGroups[mHistoryIndex];
+	if (!bindGroup) {
+		std::vector<BindGroupEntry> bindings(4);
+		bindings[0].binding = 0;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(Uniforms);
+		bindings[1].binding = 1;
+		bindings[1].textureView = depthPyramidView;
+		bindings[2].binding = 2;
+		bindings[2].textureView = mHistoryViews[mHistoryIndex];
+		bindings[3].binding = 3;
+		bindings[3].textureView = mHistoryViews[next];
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mOcclusionLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		bindGroup = mDevice.createBindGroup(bindGroupDesc);
+	}
+
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Ambient occlusion";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mOcclusionPipeline->pipeline);
+	computePass.setBindGroup(0, bindGroup, 0, nullptr);
+	const glm::uvec2& size = mUniforms.occlusionSize;
+	computePass.dispatchWorkgroups((size.x + 7) / 8, (size.y + 7) / 8, 1);
+	computePass.end();
+	computePass.release();
+
+	mHistoryIndex = next;
+	mHistoryWritten = true;
+	++mSettlingFrames;
+	return true;
+}
+
+bool AmbientOcclusion::apply(CommandEncoder encoder, TextureView depthView, TextureView sceneView, const RenderPassTimestampWrites* timestampWrites) {
+	if (!ready() || !mHistoryWritten) return false;
+
+	if (depthView != mDepthView) {
+		for (BindGroup& bindGroup : mApplyBindGroups) {
+			if (bindGroup) bindGroup.release();
+			bindGroup = nullptr;
+		}
+		mDepthView = depthView;
+	}
+	// What the last encode() wrote
+	BindGroup& bindGroup = mApplyBindGroups[mHistoryIndex];
+	if (!bindGroup) {
+		std::vector<BindGroupEntry> bindings(3);
+		bindings[0].binding = 0;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(Uniforms);
+		bindings[1].binding = 1;
+		bindings[1].textureView = mHistoryViews[mHistoryIndex];
+		bindings[2].binding = 2;
+		bindings[2].textureView = depthView;
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mApplyLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		bindGroup = mDevice.createBindGroup(bindGroupDesc);
+	}
+
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = sceneView;
+	colorAttachment.resolveTarget = nullptr;
+	colorAttachment.loadOp = LoadOp::Load;
+	colorAttachment.storeOp = StoreOp::Store;
+	colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Ambient occlusion upsample";
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &colorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = timestampWrites;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	const glm::uvec2& size = mUniforms.sceneSize;
+	FullscreenTriangle::draw(renderPass, mApplyPipeline->pipeline, bindGroup, size.x, size.y);
+	renderPass.end();
+	renderPass.release();
+	return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Screen-space ambient occlusion at half or quarter resolution, estimated from the
+ * depth pyramid (see DepthPyramid) rather than from a depth buffer downsampled for
+ * it: the level of the resolution gives the positions and normals, and samples far
+ * from the pixel read coarser levels, as in Scalable Ambient Obscurance (McGuire et
+ * al.), which keeps a dozen samples cache friendly whichever the radius.
+ *
+ * Samples spiral around each pixel with a rotation that varies from pixel to pixel
+ * and from frame to frame, and the estimate is blended into a history reprojected
+ * from the previous frame, averaging up to MaxHistoryFrames frames where the
+ * surface reprojected to it is at the distance the history holds. A full resolution
+ * pass then multiplies the scene by the occlusion, upsampled from the 2x2 texels
+ * around each pixel weighed by how near their distance is to that of the pixel, so
+ * that the occlusion of a surface does not bleed over the edges of another.
+ *
+ * The pyramid holds the farthest depth of the texels it covers, which thins the
+ * occlusion along silhouettes a little at its lower resolutions.
+ */
+class AmbientOcclusion {
+public:
+	static constexpr wgpu::TextureFormat HistoryFormat = wgpu::TextureFormat::RGBA16Float;
+	static constexpr uint32_t MaxHistoryFrames = 8;
+
+	/**
+	 * The OcclusionUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		// From the clip space of the frame to the one of the previous frame
+		glm::mat4 reprojection;
+		// Scales and offsets of x and y from view space to NDC, at a distance of 1
+		glm::vec4 projection;
+		// A view distance is b / (depth + a) for (a, b) of the projection matrix, in both depth
+		// conventions
+		glm::vec2 depthParameters;
+		// Region of the depth buffer the scene covers, and of the occlusion texture
+		glm::uvec2 sceneSize;
+		glm::uvec2 occlusionSize;
+		// Region of the history holding the previous frame, 0 x 0 when there is none
+		glm::uvec2 historySize;
+		// In view space units
+		float radius;
+		float intensity;
+		// Level of the depth pyramid at the resolution of the occlusion, and its level count
+		uint32_t baseLevel;
+		uint32_t levelCount;
+		// Depth texels per occlusion texel along each axis
+		uint32_t downscale;
+		uint32_t frameIndex;
+		uint32_t _pad[2];
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	// Occlusion of a scene of `sceneFormat` drawn with a depth buffer of `sampleCount` samples,
+	// at 1 / `downscale` of its resolution, 2 or 4
+	AmbientOcclusion(wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureFormat sceneFormat, uint32_t sampleCount, uint32_t downscale);
+	~AmbientOcclusion();
+
+	AmbientOcclusion(const AmbientOcclusion&) = delete;
+	AmbientOcclusion& operator=(const AmbientOcclusion&) = delete;
+
+	bool valid() const { return mUniformBuffer != nullptr; }
+	// Whether the pipelines are built, before which encode() and apply() record nothing
+	bool ready() const { return mOcclusionPipeline->ready() && mApplyPipeline->ready(); }
+	uint32_t downscale() const { return mUniforms.downscale; }
+
+	// Whether the history averages as many frames as it can since the last restartSettling(),
+	// before which the frames should keep coming even when nothing changes
+	bool settled() const { return mSettlingFrames >= MaxHistoryFrames; }
+	void restartSettling() { mSettlingFrames = 0; }
+
+	// Distance within which surfaces occlude each other, in view space units, and how dark
+	// their occlusion gets
+	void setParameters(float radius, float intensity) { mRadius = radius; mIntensity = intensity; }
+
+	// Matrices and region of the scene drawn this frame in a texture of `sceneTextureSize`, whose
+	// pyramid has `levelCount` levels, before its passes, reprojecting into those of the previous call
+	void update(
+		wgpu::Queue queue, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+		const glm::uvec2& sceneSize, const glm::uvec2& sceneTextureSize, uint32_t levelCount
+	);
+	// Estimate the occlusion from the pyramid of the depths of the frame, built at this point of
+	// it, into the next history, or return false if not ready
+	bool encode(wgpu::CommandEncoder encoder, wgpu::TextureView depthPyramidView, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr);
+	// Multiply the scene region of `sceneView` by the occlusion encode() estimated, upsampled
+	// along `depthView`, or return false if not ready
+	bool apply(
+		wgpu::CommandEncoder encoder, wgpu::TextureView depthView, wgpu::TextureView sceneView,
+		const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr
+	);
+
+private:
+	void createHistory(const glm::uvec2& size);
+	void terminateHistory();
+
+private:
+	wgpu::Device mDevice;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mOcclusionLayout = nullptr;
+	wgpu::BindGroupLayout mApplyLayout = nullptr;
+	PipelineCache::AsyncComputePipeline mOcclusionPipeline;
+	PipelineCache::AsyncRenderPipeline mApplyPipeline;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	Uniforms mUniforms{};
+	float mRadius = 0.25f;
+	float mIntensity = 1.0f;
+	uint32_t mFrameIndex = 0;
+	uint32_t mSettlingFrames = 0;
+	// Of the last update()
+	glm::mat4 mPreviousViewProjection = glm::mat4(1.0f);
+	glm::uvec2 mPreviousOcclusionSize = { 0, 0 };
+	// Whether the last frame was estimated into the history at mHistoryIndex
+	bool mHistoryWritten = false;
+
+	// Read from mHistoryIndex and written to the other one, swapped by each encode()
+	glm::uvec2 mHistoryTextureSize = { 0, 0 };
+	std::array<wgpu::Texture, 2> mHistoryTextures = {};
+	std::array<wgpu::TextureView, 2> mHistoryViews = {};
+	uint32_t mHistoryIndex = 0;
+
+	// Bind groups reading each history, of the last pyramid and depth views, which keep them alive
+	wgpu::TextureView mDepthPyramidView = nullptr;
+	wgpu::TextureView mDepthView = nullptr;
+	std::array<wgpu::BindGroup, 2> mOcclusionBindGroups = {};
+	std::array<wgpu::BindGroup, 2> mApplyBindGroups = {};
+};
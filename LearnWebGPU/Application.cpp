@@ -1,88 +1,149 @@
 #include "Application.h"
 #include "ResourceManager.h"
+#include "ParallelFor.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+#include "DeviceEvents.h"
+#include "webgpu-utils.h"
+#include "LimitsNegotiator.h"
+#include "StartupProfiler.h"
+#include "AssetBundle.h"
+#include "MappedFile.h"
+#include "StaticBatcher.h"
+#include "Log.h"
+#include "HeapManifest.h"
+#include "DecodeHeap.h"
+#include "MemoryProfiler.h"
 
 #include <glfw3webgpu.h>
 #include <GLFW/glfw3.h>
 
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
-#define GLM_FORCE_LEFT_HANDED
-#include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
 #include <iostream>
+#include <iomanip>
 #include <cassert>
 #include <filesystem>
 #include <sstream>
 #include <string>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <type_traits>
 
 using namespace wgpu;
 
-bool Application::onInit()
-{
-  // Initialization battery test
-  if (!initWindowAndDevice()) return false;
-	configSurface();
-  if (!initDepthBuffer()) return false;
-  if (!initRenderPipeline()) return false;
-  if (!initTexture()) return false;
-  if (!initGeometry()) return false;
-  if (!initUniforms()) return false;
-  if (!initBindGroup()) return false;
-  return true;
+namespace {
+
+// Geometry larger than this is streamed rather than uploaded before its first frame
+constexpr uint64_t geometryStreamThreshold = 64 << 20;
+// Occlusion query results in a row after which a resource no batch showed is deemed hidden,
+// the camera moving in between
+constexpr uint32_t occlusionHiddenResultCount = 4;
+// Frames between the passes of TextureFeedback, each of whose results is a round of eviction
+constexpr uint32_t textureFeedbackInterval = 30;
+// The same with virtual textures, whose tiles must follow the camera
+constexpr uint32_t virtualTextureFeedbackInterval = 4;
+// Distance between the eyes in stereo, in the units of the scene, which the camera orbits at
+// about 3 units from its center
+constexpr float stereoEyeSeparation = 0.02f;
+// Recorded in the resource directory, so that it ships with them, in the bundle if any
+constexpr const char* pipelineManifestPath = RESOURCE_DIR "/pipelines.manifest";
+// Workgroup sizes measured on each adapter so far
+constexpr const char* workgroupSizesPath = RESOURCE_DIR "/workgroups.sizes";
+
+// With a unit prefix and 3 significant digits or so, e.g. "12.3 MB"
+std::string formatWithPrefix(double value, const char* unit, double base) {
+	const char* prefixes[] = { "", "K", "M", "G", "T" };
+	size_t prefix = 0;
+	while (value >= base && prefix + 1 < std::size(prefixes)) {
+		value /= base;
+		++prefix;
+	}
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(prefix == 0 || value >= 100.0 ? 0 : 1) << value << ' ' << prefixes[prefix] << unit;
+	return out.str();
 }
 
-void Application::onFrame()
-{
-	glfwPollEvents();
-	updateDragInertia();
-
-	// Update any uniforms that require new values each frame.
-	float time = static_cast<float>(glfwGetTime());
-	// Only update the 1-st float of the buffer
-	mQueue.writeBuffer(mUniformBuffer, offsetof(BasicShaderUniforms, time), &time, sizeof(float));
-
-	//Update the model  Matrix
-	float angle1 = time;
-	glm::mat4 M(1.0f);
-	M = glm::rotate(M, angle1, glm::vec3(0.0f, 0.0f, 1.0f));
-	M = glm::translate(M, glm::vec3(0.0f, 0.0f, 0.0f));
-	M = glm::scale(M, glm::vec3(0.3f));
-	mUniforms.modelMatrix = M;
-
-	mQueue.writeBuffer(mUniformBuffer, offsetof(BasicShaderUniforms, modelMatrix), &mUniforms.modelMatrix, sizeof(BasicShaderUniforms::modelMatrix));
-
-	//float viewZ = glm::mix(0.0f, 0.25f, glm::cos(2 * glm::pi<float>() * time / 4.0f) * 0.5f + 0.5f);
-	//mUniforms.viewMatrix = glm::lookAt(glm::vec3(-0.5f, -1.5f, viewZ + 0.25f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	//mQueue.writeBuffer(mUniformBuffer, offsetof(BasicShaderUniforms, viewMatrix), &mUniforms.viewMatrix, sizeof(BasicShaderUniforms::viewMatrix));
-	
-	TextureView nextTexture = getNextSurfaceTextureView();
-	if (!nextTexture) {
-		std::cerr << "Cannot acquire next swap chain texture" << std::endl;
-		return;
+// Whether WebGPU guarantees 4x multisampling of a color format with resolve, see the
+// "Plain color formats" table of the specification, RG11B10Ufloat being only chosen with
+// the feature that makes it so. Depth formats are all multisampled.
+bool supportsMultisampleResolve(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::R8Unorm:
+	case TextureFormat::RG8Unorm:
+	case TextureFormat::RGBA8Unorm:
+	case TextureFormat::RGBA8UnormSrgb:
+	case TextureFormat::BGRA8Unorm:
+	case TextureFormat::BGRA8UnormSrgb:
+	case TextureFormat::R16Float:
+	case TextureFormat::RG16Float:
+	case TextureFormat::RGBA16Float:
+	case TextureFormat::RGB10A2Unorm:
+	case TextureFormat::RG11B10Ufloat:
+		return true;
+	default:
+		return false;
 	}
+}
 
-	CommandEncoderDescriptor commandEncoderDesc{};
-	commandEncoderDesc.label = "Command Encoder";
-	CommandEncoder encoder = mDevice.createCommandEncoder(commandEncoderDesc);
+// Of the formats the scene may be drawn in, for the HUD
+const char* sceneFormatName(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::RG11B10Ufloat:
+		return "RG11B10Ufloat";
+	case TextureFormat::RGBA16Float:
+		return "RGBA16Float";
+	case TextureFormat::BGRA8Unorm:
+		return "BGRA8Unorm";
+	case TextureFormat::BGRA8UnormSrgb:
+		return "BGRA8UnormSrgb";
+	case TextureFormat::RGBA8Unorm:
+		return "RGBA8Unorm";
+	case TextureFormat::RGBA8UnormSrgb:
+		return "RGBA8UnormSrgb";
+	default:
+		return "other format";
+	}
+}
 
-	RenderPassDescriptor renderPassDesc{};
+// Depth attachment of the passes drawing the scene, stored for the depth pyramid
+// Bits of a float as a u32 in the same order: the sign bit flipped for positive floats,
+// all bits for negative ones
+uint32_t orderedFloatBits(float value) {
+	uint32_t bits = std::bit_cast<uint32_t>(value);
+	return bits ^ ((bits >> 31) != 0 ? 0xffffffffu : 0x80000000u);
+}
 
-	RenderPassColorAttachment renderPassColorAttachment{};
-	renderPassColorAttachment.view = nextTexture;
-	renderPassColorAttachment.resolveTarget = nullptr;
-	renderPassColorAttachment.loadOp = LoadOp::Clear;
-	renderPassColorAttachment.storeOp = StoreOp::Store;
-	renderPassColorAttachment.clearValue = Color{ 0.30, 0.30, 0.30, 1.0 };
-#ifndef WEBGPU_BACKEND_WGPU
-	renderPassColorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
-#endif // ! WGPU BACKEND
-	renderPassDesc.colorAttachmentCount = 1;
-	renderPassDesc.colorAttachments = &renderPassColorAttachment;
+// Stable least significant digit radix sort of 64-bit items by their upper 32 bits, a byte
+// per pass, through `scratch`, which is kept for the next sort
+void radixSortHigh32(std::vector<uint64_t>& items, std::vector<uint64_t>& scratch) {
+	scratch.resize(items.size());
+	for (uint32_t shift = 32; shift < 64; shift += 8) {
+		std::array<size_t, 257> offsets = {};
+		for (uint64_t item : items) ++offsets[(item >> shift & 0xff) + 1];
+		for (size_t digit = 1; digit < offsets.size(); ++digit) offsets[digit] += offsets[digit - 1];
+		for (uint64_t item : items) scratch[offsets[item >> shift & 0xff]++] = item;
+		items.swap(scratch);
+	}
+}
 
+RenderPassDepthStencilAttachment depthAttachment(TextureView view, LoadOp depthLoadOp, float clearDepth) {
 	RenderPassDepthStencilAttachment depthStencilAttachment{};
-	depthStencilAttachment.view = mDepthTextureView;
-  depthStencilAttachment.depthClearValue = 1.0f; // clear to "far"
-	depthStencilAttachment.depthLoadOp = LoadOp::Clear;
+	depthStencilAttachment.view = view;
+	depthStencilAttachment.depthClearValue = clearDepth; // clear to "far"
+	depthStencilAttachment.depthLoadOp = depthLoadOp;
 	depthStencilAttachment.depthStoreOp = StoreOp::Store;
 	depthStencilAttachment.depthReadOnly = false;
 	depthStencilAttachment.stencilClearValue = 0;
@@ -94,645 +155,6108 @@ void Application::onFrame()
 	depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
 #endif // ! WGPU BACKEND
 	depthStencilAttachment.stencilReadOnly = true;
+	return depthStencilAttachment;
+}
 
-	renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
-	renderPassDesc.timestampWrites = nullptr;
-
-	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-
-	renderPass.setPipeline(mPipeline);
-
-	renderPass.setVertexBuffer(0, mVertexBuffer, 0, mVertexCount * sizeof(ResourceManager::VertexAttributes));
-
-	// Set binding group
-	renderPass.setBindGroup(0, mBindGroup, 0, nullptr);
-
-	renderPass.draw(mVertexCount, 1, 0, 0);
-  //renderPass.drawIndexed(mVertexCount, 1, 0, 0, 0); // <- Alternative for indexed
-
-	renderPass.end();
-	renderPass.release();
-
-	nextTexture.release();
-
-	CommandBufferDescriptor cmdBufferDescriptor{};
-	cmdBufferDescriptor.label = "Command buffer";
-	CommandBuffer command = encoder.finish(cmdBufferDescriptor);
-	encoder.release();
-	mQueue.submit(command);
-	command.release();
+} // anonymous namespace
 
-#ifndef __EMSCRIPTEN__
-	mSurface.present();
-#endif // ! __EMSCRIPTEN__
+bool Application::onInit()
+{
+	// Record a CPU trace of the whole run when LEARNWEBGPU_TRACE names the file to write it to
+	if (const char* tracePath = std::getenv("LEARNWEBGPU_TRACE")) {
+		mTracePath = tracePath;
+		Trace::start();
+	}
+	if (const char* metricsPath = std::getenv("LEARNWEBGPU_METRICS")) {
+		mMetricsPath = metricsPath;
+	}
+	if (const char* hitchMs = std::getenv("LEARNWEBGPU_HITCH_MS")) {
+		uint32_t budgetMs = 0;
+		auto result = std::from_chars(hitchMs, hitchMs + std::strlen(hitchMs), budgetMs);
+		if (result.ec == std::errc() && *result.ptr == '\0' && budgetMs > 0) {
+			// Two seconds at 60 Hz, the CPU markers of which the latest chunks of the trace hold
+			mHitchDetector = std::make_unique<HitchDetector>(120, budgetMs, "hitch-");
+			if (!Trace::recording()) {
+				Trace::setChunkLimit(8);
+				Trace::start();
+			}
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_HITCH_MS '" << hitchMs << "', expected a positive frame time in milliseconds" << std::endl;
+		}
+	}
+	Trace::setThreadName("Main thread");
+	TRACE_SCOPE("onInit");
+	// Until the first frame that shows the whole scene, see updateStartupReport()
+	StartupProfiler::start();
+#ifdef LEARNWEBGPU_ASSET_BUNDLE
+	// Resources are then read from the bundle rather than from loose files
+	{
+		STARTUP_STAGE("Asset bundle");
+		// Before the bundle is fetched into the heap, which then grows in a single copy
+		if (uint64_t reserved = HeapManifest::reserve(RESOURCE_DIR ".manifest")) {
+			std::cout << "Reserved " << (reserved >> 20) << " MiB of heap for the resources" << std::endl;
+		}
+		if (!AssetBundle::mount(RESOURCE_DIR ".bundle", RESOURCE_DIR)) {
+			std::cerr << "No asset bundle, loading loose resources" << std::endl;
+		}
+	}
+#endif // LEARNWEBGPU_ASSET_BUNDLE
 
-#if defined(WEBGPU_BACKEND_DAWN)
-	device.tick();
-#elif defined(WEBGPU_BACKEND_WGPU)
-	mDevice.poll(false);
-#endif
+	// What does not need the device first, so that files load while it is requested
+	if (!initInstanceAndWindow()) return false;
+	if (!initAssetLoading()) return false;
+	requestDevice();
 
+	// wgpu-native answers right away, other backends and browsers over the next frames
+	if (mInitState == InitState::DeviceReady) return initDeviceResources();
+	return mInitState != InitState::Failed;
 }
 
-void Application::onFinish()
+bool Application::initDeviceResources()
 {
-  // Each part of the renderer takes care of cleaning up after itself, call in reverse order
-  terminateBindGroup();
-  terminateUniforms();
-  terminateGeometry();
-  terminateTexture();
-  terminateRenderPipeline();
-  terminateDepthBuffer();
-  terminateSurfaceConfig();
-  terminateWindowAndDevice();
-}
+	TRACE_SCOPE("initDeviceResources");
+	// Until everything succeeded
+	mInitState = InitState::Failed;
 
-bool Application::isRunning()
-{
-  return !glfwWindowShouldClose(mWindow);
+  // Initialization battery test
+  if (!initDevice()) return false;
+  if (!initFrameCapture()) return false;
+	configSurface();
+  if (!initDepthBuffer()) return false;
+  if (!initDepthPyramid()) return false;
+  if (!initShadowMaps()) return false;
+  if (!initPointLights()) return false;
+  if (!initEnvironmentLighting()) return false;
+  if (!initLightBaker()) return false;
+  if (!initDeferredShading()) return false;
+  if (!initPicking()) return false;
+  if (!initOcclusionQueries()) return false;
+  if (!initParticles()) return false;
+  if (!initTerrain()) return false;
+  if (!initPointCloud()) return false;
+  if (!initImposters()) return false;
+  if (!initVirtualTextures()) return false;
+  if (!initTextureFeedback()) return false;
+  if (!initShadingRate()) return false;
+  if (!initTemporalAA()) return false;
+  if (!initAmbientOcclusion()) return false;
+  if (!initViews()) return false;
+  if (!initRenderPipeline()) return false;
+  if (!initTexture()) return false;
+  if (!initUniforms()) return false;
+  if (!initInstances()) return false;
+  if (!initCulling()) return false;
+  if (!initBindGroup()) return false;
+  if (!initHud()) return false;
+
+	mInitState = InitState::Ready;
+	return true;
 }
 
-// When resizing, we need to re-create the swap chain and depth buffer with the new size.
-void Application::onResize()
+void Application::onFrame()
 {
-	// Add a ward
-	if (mWindowWidth <= 0 || mWindowHeight <= 0) return;
-
-	// Terminate in reverse order
-	terminateDepthBuffer();
-	terminateSurfaceConfig();
+	if (mDeviceLost) {
+		recoverFromDeviceLoss();
+		return;
+	}
+	if (mInitState != InitState::Ready) {
+		if (mInitState != InitState::Failed) updateInit();
+		return;
+	}
 
-	// Re-init
-	configSurface();
-	initDepthBuffer();
+	// Frames capped below the refresh rate by the governor wait for their turn
+	if (!paceFrame()) return;
 
-  updateProjectionMatrix();
-}
+	TRACE_SCOPE("Frame");
+	mFrameArena.beginFrame();
 
-void Application::onMouseMove(double xpos, double ypos)
-{
-	if (mDragState.active) {
-		glm::vec2 currentMouse = glm::vec2(-(float)xpos, (float)ypos);
-		glm::vec2 delta = (currentMouse - mDragState.startMouse) * mDragState.sensitivity;
-		mCameraState.angles = mDragState.startCameraState.angles + delta;
-		// Clamp to avoid going too far when orbiting up/down
-		mCameraState.angles.y = glm::clamp(mCameraState.angles.y, -glm::pi<float>() / 2 + 1e-5f, glm::pi<float>() / 2 - 1e-5f);
+	// In low latency mode, wait for the GPU before sampling input rather than before
+	// submitting, so that the frame reflects the latest events
+	if (mLowLatency) {
+		TRACE_SCOPE("Wait for frame slot");
+		mFramePacer->waitForFrameSlot();
+	}
+	updateFrameCounters();
+	updateHud();
+	mFrameStats.allocationCountStart = StartupProfiler::now().allocationCount;
+
+	// Also idle while waiting to acquire the surface texture again
+	auto now = std::chrono::steady_clock::now();
+	bool acquireBackoff = now < mAcquireRetryTime;
+	// A replay has no event to wait for
+	bool idle = ((renderingOnDemand() && !needsRedraw()) || acquireBackoff) && !mInputReplay;
+	if (mWindow && idle) {
+		TRACE_SCOPE("Wait for events");
+		mFrameStats.idle = true;
+#ifdef __EMSCRIPTEN__
+		glfwPollEvents();
+#else
+		// Woken up by input and by finished asset jobs, and regularly to watch shaders
+		// and process device callbacks, the main thread doing the waiting in render
+		// thread mode
+		if (mRenderThread) mInputQueue.waitForEvents();
+		else glfwWaitEventsTimeout(acquireBackoff ? std::min(0.25, std::chrono::duration<double>(mAcquireRetryTime - now).count()) : 0.25);
+#endif // __EMSCRIPTEN__
+	}
+	else if (mWindow && !mRenderThread) {
+		TRACE_SCOPE("Poll events");
+		glfwPollEvents();
+	}
+	processInputEvents();
+	if (mInputReplay) replayInputFrame();
+	mFrameClock.advance(currentTime());
+	if (mInputRecorder) recordInputFrame();
+	updateDragInertia();
+	mCameraPredictor.update(mCameraState.zoom, mFrameClock.frameDelta());
+	// Once for all the input of the frame
+	if (mViewDirty) {
 		updateViewMatrix();
-
-		// Inertia
-		mDragState.velocity = delta - mDragState.previousDelta;
-		mDragState.previousDelta = delta;
+		mViewDirty = false;
 	}
-}
 
-void Application::onMouseButton(int button, int action, int /*mods*/)
-{
-	if (button == GLFW_MOUSE_BUTTON_LEFT) {
-		switch (action) {
-		case GLFW_PRESS:
-			mDragState.active = true;
-			double xpos, ypos;
-			glfwGetCursorPos(mWindow, &xpos, &ypos);
-			mDragState.startMouse = glm::vec2(-(float)xpos, (float)ypos);
-			mDragState.startCameraState = mCameraState;
-			break;
-		case GLFW_RELEASE:
-			mDragState.active = false;
-			break;
+	// Upload the assets that finished loading since the last frame
+	{
+		TRACE_SCOPE("Process asset completions");
+		if (mAssetLoader->processCompletions() > 0) mFrameDirty = true;
+	}
+	// Then some more of the geometry being streamed, which cullInstances draws as far as uploaded,
+	// and of the textures, which are bound again with levels up to the finest uploaded, down to
+	// the resolutions they were last seen at
+	updateTextureFeedback();
+	if (mVirtualTextures && mVirtualTextures->update()) mFrameDirty = true;
+	if (mResourceCache->streamingCount() > 0) {
+		// Frames measured while streaming adjust the bytes streamed per frame
+		uint64_t measuredFrameCount = mGpuProfiler->measuredFrameCount();
+		if (measuredFrameCount != mUploadMeasuredFrameCount) {
+			mUploadMeasuredFrameCount = measuredFrameCount;
+			mUploadBudget->update(mGpuProfiler->lastFrameMs());
+		}
+		updateStreamPriorities();
+		ResourceCache::StreamProgress progress = mResourceCache->updateStreams(mUploadBudget->bytes());
+		if (progress.textures) {
+			invalidateRenderBundles();
+			initBindGroup();
+		}
+		if (progress.geometry || progress.textures) mFrameDirty = true;
+		// Casters draw the uploaded part of their geometry
+		if (progress.geometry && mShadowMaps) mShadowMaps->invalidateStaticCasters();
+	}
+	// Reported once each time the budget is exceeded, loads having been cut down to it meanwhile
+	bool overGpuMemoryBudget = GpuMemoryTracker::overBudget();
+	if (overGpuMemoryBudget && !mOverGpuMemoryBudget) {
+		std::cerr << "Over the GPU memory budget!" << std::endl;
+		GpuMemoryTracker::printReport(std::cerr);
+	}
+	mOverGpuMemoryBudget = overGpuMemoryBudget;
+	updateAssetSync();
+	updateShaderReload();
+
+	updateResize();
+	updatePassBudget();
+	updateRenderScale();
+	updatePicking();
+	if (mFrameCapture) mFrameCapture->poll();
+
+	if ((renderingOnDemand() && !needsRedraw()) || std::chrono::steady_clock::now() < mAcquireRetryTime) {
+		DeviceEvents::dispatch(mDevice);
+		return;
+	}
+	// A change only shows in full once the history caught up with it
+	if (mFrameDirty && mTemporalAA) mTemporalAA->restartSettling();
+	if (mFrameDirty && mAmbientOcclusion) mAmbientOcclusion->restartSettling();
+	mFrameDirty = false;
+
+	// Benchmark frames start once everything is loaded, their camera following a fixed path
+	if (mBenchmark && sceneSettled()) {
+		mBenchmark->beginFrame();
+		// Unless the camera follows the input of a replay
+		if (!mInputReplay) {
+			CameraPath::Pose pose = mBenchmarkCameraPath.poseAt(mBenchmark->time());
+			mCameraState.angles = pose.angles;
+			mCameraState.zoom = pose.zoom;
+			updateViewMatrix();
 		}
 	}
-}
 
-void Application::onScroll(double /*xoffset*/, double yoffset)
-{
-	mCameraState.zoom += mDragState.scrollSensitivity * static_cast<float>(yoffset);
-	mCameraState.zoom = glm::clamp(mCameraState.zoom, -2.0f, 2.0f);
-	updateViewMatrix();
-}
+	updateUniforms();
 
-bool Application::initWindowAndDevice()
-{
+	TextureView nextTexture = nullptr;
+	auto acquireStart = std::chrono::steady_clock::now();
+	{
+		TRACE_SCOPE("Acquire surface texture");
+		nextTexture = getNextSurfaceTextureView();
+	}
+	auto acquireEnd = std::chrono::steady_clock::now();
+	// Reported by getNextSurfaceTextureView, which takes care of acquiring again
+	if (!nextTexture) return;
+	if (!mViews.empty()) updateViews();
 
-#ifdef __EMSCRIPTEN__
-	Instance instance = createInstance();
-#else
-	InstanceDescriptor instanceDesc{};
-	Instance instance = createInstance(instanceDesc);
-#endif // ! __EMSCRIPTEN__
+	FrameVector<CommandBuffer> commands = encodeFrame(nextTexture);
+	nextTexture.release();
+#ifndef WEBGPU_BACKEND_WGPU
+	if (!mBenchmark) mSurfaceTexture.release();
+#endif // WEBGPU_BACKEND_WGPU
+	mSurfaceTexture = nullptr;
+	mFrameStats.cpuDuration = std::chrono::steady_clock::now() - mFrameStats.start - (acquireEnd - acquireStart);
 
-	// Check if the instance was created successfully
-	if (!instance) {
-		std::cerr << "Failed to create WebGPU instance. Could not initialize WebGPU" << std::endl;
-		return false;
+	if (!mLowLatency) {
+		TRACE_SCOPE("Wait for frame slot");
+		mFramePacer->waitForFrameSlot();
+	}
+	{
+		TRACE_SCOPE("Submit");
+		mFramePacer->submit(commands);
+		for (CommandBuffer& command : commands) {
+			command.release();
+		}
+		mGpuProfiler->readBack();
+		mWorkgroupTuner->readBack();
+		mPipelineStatistics->readBack();
+		if (mObjectPicker) mObjectPicker->readBack();
+		if (mOcclusionQueries) mOcclusionQueries->readBack();
+		if (mTextureFeedback) mTextureFeedback->readBack();
+		if (mFrameCapture) mFrameCapture->readBack();
+		DeviceEvents::notify();
 	}
 
-	if (!glfwInit()) {
-		std::cerr << "Could not initialize GLFW!" << std::endl;
-		return false;
+#ifndef __EMSCRIPTEN__
+	if (mSurface) {
+		TRACE_SCOPE("Present");
+		mSurface.present();
+	}
+	for (std::unique_ptr<View>& view : mViews) {
+		view->present();
 	}
+#endif // ! __EMSCRIPTEN__
+	if (StartupProfiler::recording()) updateStartupReport();
+	if (mRecoveryStart >= 0) updateRecoveryReport();
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // NO_API bc We don't want OpenGL in the back, we'll use WebGPU instead.
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE); 
+	// Completions of the previous frames, the GPU being pumped by DeviceEvents in the meantime
+	DeviceEvents::dispatch(mDevice);
+}
 
-	mWindow = glfwCreateWindow(mWindowWidth, mWindowHeight, "[WebGPU] 3D Playground", NULL, NULL);
-	if (!mWindow) {
-		std::cerr << "Could not open window!" << std::endl;
-		return false;
+void Application::updateUniforms()
+{
+	TRACE_SCOPE("Update uniforms");
+
+	// Animation time only moves forward while the animation is not paused
+	float deltaTime = mAnimate ? static_cast<float>(mFrameClock.frameDelta()) : 0.0f;
+	if (mAnimate) {
+		mFrameUniforms.time += deltaTime;
+		markUniformDirty(mFrameUniforms.time);
+
+		// Update the model matrix
+		mTransforms.setRotation(mModelTransform, glm::angleAxis(mFrameUniforms.time, glm::vec3(0.0f, 0.0f, 1.0f)));
+		mTransforms.update();
+		mFrameUniforms.modelMatrix = mTransforms.world(mModelTransform);
+		markUniformDirty(mFrameUniforms.modelMatrix);
+		// The whole scene turns, static casters included
+		if (mShadowMaps) mShadowMaps->invalidateStaticCasters();
+
+		// Dynamic objects of the synthetic scene move by themselves, uploaded as moved instances
+		for (auto [instance, object] : mStressDynamicInstances) {
+			mScene.setInstanceTransform(instance, mSceneGenerator->modelMatrix(mSceneGenerator->objects()[object], mFrameUniforms.time));
+		}
 	}
 
-	// Capture surface here so we can use in the main loop
-	mSurface = glfwGetWGPUSurface(instance, mWindow);
+	updatePointLights();
+	if (mParticles) {
+		mParticles->update(mQueue, deltaTime, mViewUniforms.viewMatrix, mViewUniforms.projectionMatrix);
+	}
+	if (mTerrain) {
+		// lightDirection1 of shader.wgsl
+		mTerrain->update(mQueue, mViewUniforms.viewMatrix, mViewUniforms.projectionMatrix, glm::vec3(0.5f, -0.9f, 0.1f));
+	}
 
-	std::cout << "Requesting adapter..." << std::endl;
-	RequestAdapterOptions adapterOpts{};
-	adapterOpts.compatibleSurface = mSurface;
+	// Batches are sorted again whenever the scene changed, e.g. when an asset finished loading
+	if (mScene.drawListDirty()) {
+		if (!updateDrawList()) std::cerr << "Could not update the draw list!" << std::endl;
+	}
+	// Otherwise only the instances that moved are uploaded again
+	else if (!mScene.movedInstances().empty()) {
+		uploadMovedInstances();
+	}
 
-	Adapter adapter = instance.requestAdapter(adapterOpts);
-	std::cout << "Got adapter: " << adapter << std::endl;
+	// Only the instances in view are drawn, nothing is uploaded while they stay the same
+	if (!mScene.batches().empty()) cullInstances();
 
-	// It is good practice to release the instance as soon as we have the adapter.
-	instance.release();
+	// Samples move within their pixel from frame to frame, which alone does not make a frame
+	// worth drawing
+	if (mTemporalAA) {
+		mViewUniforms.jitter = mTemporalAA->nextJitter(renderSize());
+		mUniformRing->write((uint32_t)BindGroupSlot::View, offsetof(ViewUniforms, jitter), &mViewUniforms.jitter, sizeof(glm::vec2));
+	}
 
-	std::cout << "Requesting device..." << std::endl;
-	DeviceDescriptor deviceDesc{};
-	deviceDesc.requiredFeatureCount = 0;
-	deviceDesc.defaultQueue.nextInChain = nullptr;
-	
-	// A function that is invoked whenever the device stops being available.
-	deviceDesc.deviceLostCallback = [](WGPUDeviceLostReason reason, char const* message, void* /* pUserData */) {
-		std::cout << "Device lost: reason " << reason;
-		if (message) std::cout << " (" << message << ")";
-		std::cout << std::endl;
-		};
+	if (mStereo) updateStereoUniforms();
 
-#ifdef __EMSCRIPTEN__
-	deviceDesc.requiredLimits = nullptr;
-#else
-	RequiredLimits requiredLimits = getRequiredLimits(adapter);
-	deviceDesc.requiredLimits = &requiredLimits;
-#endif
+	// Upload the uniforms that changed, if any, in a single write to the next slice of the ring
+	mUniformRing->flush(mQueue);
 
-	mDevice = adapter.requestDevice(deviceDesc);
-	std::cout << "Got device: " << mDevice << std::endl;
+	//float viewZ = glm::mix(0.0f, 0.25f, glm::cos(2 * glm::pi<float>() * time / 4.0f) * 0.5f + 0.5f);
+	//mViewUniforms.viewMatrix = glm::lookAt(glm::vec3(-0.5f, -1.5f, viewZ + 0.25f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	//mViewUniforms.viewMatrix is uploaded with the rest of the frame's uniforms
+}
 
-	// A function that is invoked whenever there is an error in the use of the device
-	mUncapturedErrorCallbackHandle = mDevice.setUncapturedErrorCallback([](ErrorType type, char const* message) {
-		std::cout << "Uncaptured device error: type " << type;
-		if (message) std::cout << " (" << message << ")";
-		std::cout << std::endl;
+FrameVector<CommandBuffer> Application::encodeFrame(TextureView targetView)
+{
+	TRACE_SCOPE("Encode commands");
+	mGpuProfiler->beginFrame();
+	mWorkgroupTuner->beginFrame();
+	mPipelineStatistics->beginFrame();
+
+	// The culling pass writes the draw arguments before the render passes read them, in a
+	// command buffer of its own recorded by a worker meanwhile
+	bool culled = !mScene.batches().empty() && mGpuCulling && cullingDispatchNeeded();
+	// Shared with the task by reference, for its captures to fit in a Task without allocating
+	struct {
+		const ComputePassTimestampWrites* timestampWrites = nullptr;
+		uint32_t statisticsQuery = PipelineStatistics::NoQuery;
+		// Those of the frame, the kernel switching to its tuned size between frames
+		ComputePipeline pipeline = nullptr;
+		uint32_t workgroupSize = 0;
+		std::vector<WorkgroupTuner::Measurement> measurements;
+		CommandBuffer command = nullptr;
+	} culling;
+	JobSystem::TaskGroup cullingEncoding;
+	ComputePassTimestampWrites cullingTimestampWrites;
+	if (culled) {
+		mCullingDispatchNeeded = false;
+		// Queries are allocated in the order of the passes, from this thread
+		culling.timestampWrites = mGpuProfiler->computePass("Culling", cullingTimestampWrites);
+		culling.statisticsQuery = mPipelineStatistics->allocate("Culling");
+		culling.pipeline = mCullingKernel->pipeline()->pipeline;
+		culling.workgroupSize = mCullingKernel->workgroupSize();
+		culling.measurements = mWorkgroupTuner->measure(*mCullingKernel);
+		JobSystem::instance().run(cullingEncoding, [this, &culling]() {
+			CommandEncoderDescriptor cullingEncoderDesc{};
+			cullingEncoderDesc.label = "Culling command encoder";
+			GpuHandle<CommandEncoder> cullingEncoder = mDevice.createCommandEncoder(cullingEncoderDesc);
+			// While the workgroup size is tuned, the arguments are also written with each candidate size
+			for (const WorkgroupTuner::Measurement& measurement : culling.measurements) {
+				encodeCulling(cullingEncoder, &measurement.timestampWrites, PipelineStatistics::NoQuery, measurement.pipeline, measurement.workgroupSize);
+			}
+			encodeCulling(cullingEncoder, culling.timestampWrites, culling.statisticsQuery, culling.pipeline, culling.workgroupSize);
+			CommandBufferDescriptor cullingCommandDesc{};
+			cullingCommandDesc.label = "Culling command buffer";
+			culling.command = cullingEncoder->finish(cullingCommandDesc);
 		});
+	}
 
-	mQueue = mDevice.getQueue();
+	// Compute passes depending only on uploads, not on the passes of this frame, go to a command
+	// buffer of their own too, submitted after the culling one and before the render one, so
+	// that the backend may overlap them with the end of the previous frame
+	GpuHandle<CommandEncoder> computeEncoder;
+	auto compute = [this, &computeEncoder]() {
+		if (!computeEncoder) {
+			CommandEncoderDescriptor computeEncoderDesc{};
+			computeEncoderDesc.label = "Compute command encoder";
+			computeEncoder.reset(mDevice.createCommandEncoder(computeEncoderDesc));
+		}
+		return computeEncoder.get();
+	};
 
-#ifdef WEBGPU_BACKEND_WGPU
-	mSurfaceFormat = mSurface.getPreferredFormat(adapter);
-#else
-	mSurfaceFormat = TextureFormat::BGRA8Unorm;
-#endif
+	CommandEncoderDescriptor commandEncoderDesc{};
+	commandEncoderDesc.label = "Command Encoder";
+	GpuHandle<CommandEncoder> encoder = mDevice.createCommandEncoder(commandEncoderDesc);
+
+	bool draw = readyToDraw();
+	bool depthPrePass = draw && mDepthPrePass;
+	// Shared with the passes by reference, for their captures to fit in an Execute without
+	// allocating. While resizing or at a lower resolution, the scene is drawn to the top left
+	// corner of a larger transient target, and blitted to the surface texture. With
+	// post-processing, it is always drawn to a transient HDR target.
+	struct {
+		bool draw = false;
+		bool depthPrePass = false;
+		bool sceneTarget = false;
+		glm::uvec2 sceneSize = { 0, 0 };
+		glm::uvec2 sceneTextureSize = { 0, 0 };
+		FrameGraph::TextureHandle surface = 0;
+		FrameGraph::TextureHandle depth = 0;
+		FrameGraph::TextureHandle scene = 0;
+		// With adaptive shading, what the main pass draws before its skipped pixels are upsampled
+		FrameGraph::TextureHandle sparseScene = 0;
+		// What post-processing reads, the scene blended with its history by the temporal
+		// resolve or the scene itself
+		FrameGraph::TextureHandle resolvedScene = 0;
+		FrameGraph::TextureHandle multisampledColor = 0;
+		FrameGraph::TextureHandle objectIds = 0;
+		// With deferred shading, what the opaque instances write for the lighting pass to read
+		FrameGraph::TextureHandle gbufferNormals = 0;
+		FrameGraph::TextureHandle gbufferAlbedo = 0;
+		// Weighted blended transparency, resolved from the multisampled versions with MSAA
+		FrameGraph::TextureHandle accumulation = 0;
+		FrameGraph::TextureHandle revealage = 0;
+		FrameGraph::TextureHandle multisampledAccumulation = 0;
+		FrameGraph::TextureHandle multisampledRevealage = 0;
+		bool picking = false;
+		bool particles = false;
+		bool terrain = false;
+		bool pointCloud = false;
+		bool imposters = false;
+		bool sortedTransparency = false;
+		bool weightedTransparency = false;
+		bool shadingRate = false;
+		bool temporal = false;
+		bool ambientOcclusion = false;
+		bool deferred = false;
+		// Whether the occlusion is estimated again, rather than applied as last estimated
+		bool ambientOcclusionEstimated = false;
+		// Whether the bloom is built again, rather than composited as last built
+		bool bloom = false;
+
+		void restrictToWindow(RenderPassEncoder pass) const {
+			if (!sceneTarget) return;
+			pass.setViewport(0.0f, 0.0f, static_cast<float>(sceneSize.x), static_cast<float>(sceneSize.y), 0.0f, 1.0f);
+			pass.setScissorRect(0, 0, sceneSize.x, sceneSize.y);
+		}
+	} frame;
+	frame.draw = draw;
+	frame.depthPrePass = depthPrePass;
+	frame.sceneSize = renderSize();
+	// Tiles are back to full rate when adaptive shading is switched off, the rates being read all
+	// the same
+	if (mShadingRate && mShadingRateResetNeeded) {
+		mShadingRate->reset(encoder);
+		mShadingRateResetNeeded = false;
+	}
+	frame.shadingRate = draw && mShadingRate && mAdaptiveShading && mShadingRate->ready();
+	if (frame.shadingRate) {
+		mShadingRate->update(mQueue, mViewUniforms.projectionMatrix * mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix, frame.sceneSize);
+	}
+	frame.temporal = draw && mTemporalAA && mTemporalAA->ready();
+	if (frame.temporal) {
+		mTemporalAA->update(
+			mQueue, mViewUniforms.projectionMatrix, mViewUniforms.viewMatrix, mFrameUniforms.modelMatrix,
+			frame.sceneSize, { mDepthTexture.getWidth(), mDepthTexture.getHeight() }
+		);
+	}
+	// The pyramid of the depths of the last frame is stale while resizing
+	frame.ambientOcclusion = draw && mAmbientOcclusion && mAmbientOcclusionEnabled && mAmbientOcclusion->ready()
+		&& mDepthPyramid->ready() && !mLiveResize;
+	frame.ambientOcclusionEstimated = frame.ambientOcclusion && passDue(mBudgetedWork.ambientOcclusion);
+	if (frame.ambientOcclusionEstimated) {
+		mAmbientOcclusion->update(
+			mQueue, mViewUniforms.projectionMatrix, mViewUniforms.viewMatrix, mFrameUniforms.modelMatrix,
+			frame.sceneSize, { mDepthTexture.getWidth(), mDepthTexture.getHeight() }, mDepthPyramid->mipLevelCount()
+		);
+	}
+	// Until it can draw, the main pass only clears the scene, as in forward mode
+	frame.deferred = draw && mDeferredShading;
+	// The classification and the temporal resolve read the scene, which the surface texture
+	// cannot be, the occlusion multiplies it by blending and the lighting pass stores to it
+	frame.sceneTarget = mSceneTarget || mPostProcess || frame.shadingRate || frame.temporal || frame.ambientOcclusion || frame.deferred;
+	frame.sceneTextureSize = { mDepthTexture.getWidth(), mDepthTexture.getHeight() };
+
+	// Transients share the size of the depth buffer, as all attachments of a pass must
+	TextureDescriptor colorTargetDesc{};
+	colorTargetDesc.dimension = TextureDimension::_2D;
+	colorTargetDesc.format = mSceneFormat;
+	colorTargetDesc.mipLevelCount = 1;
+	colorTargetDesc.size = { frame.sceneTextureSize.x, frame.sceneTextureSize.y, 1 };
+	colorTargetDesc.viewFormatCount = 0;
+	colorTargetDesc.viewFormats = nullptr;
+
+	FrameGraph& graph = *mFrameGraph;
+	frame.surface = graph.importTexture("Surface texture", targetView);
+	frame.depth = graph.importTexture("Depth buffer", mDepthTextureView);
+	frame.scene = frame.surface;
+	if (frame.sceneTarget) {
+		colorTargetDesc.label = "Scene render target";
+		colorTargetDesc.sampleCount = 1;
+		colorTargetDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+		if (frame.deferred) colorTargetDesc.usage |= TextureUsage::StorageBinding;
+		frame.scene = graph.createTexture("Scene color", colorTargetDesc);
+		colorTargetDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+	}
+	if (frame.shadingRate) {
+		colorTargetDesc.label = "Sparse scene target";
+		frame.sparseScene = graph.createTexture("Sparse scene color", colorTargetDesc);
+	}
+	frame.resolvedScene = frame.scene;
+	if (frame.temporal) {
+		colorTargetDesc.label = "Resolved scene target";
+		frame.resolvedScene = graph.createTexture("Resolved scene color", colorTargetDesc);
+	}
+	// With MSAA, samples are resolved into the scene target at the end of the main pass and
+	// need not be stored
+	if (mSampleCount > 1) {
+		colorTargetDesc.label = "Multisampled color target";
+		colorTargetDesc.sampleCount = mSampleCount;
+		colorTargetDesc.usage = TextureUsage::RenderAttachment;
+		frame.multisampledColor = graph.createTexture("Multisampled color", colorTargetDesc);
+	}
+	// Stored only in frames that pick, the picking pass reading them
+	if (mObjectPicker) {
+		colorTargetDesc.label = "Object ID target";
+		colorTargetDesc.format = ObjectPicker::IdFormat;
+		colorTargetDesc.sampleCount = mSampleCount;
+		colorTargetDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+		frame.objectIds = graph.createTexture("Object IDs", colorTargetDesc);
+		frame.picking = draw && mObjectPicker->encodeNeeded() && mObjectPicker->ready();
+	}
+	if (frame.deferred) {
+		colorTargetDesc.sampleCount = 1;
+		colorTargetDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+		colorTargetDesc.label = "G-buffer normal target";
+		colorTargetDesc.format = DeferredShading::NormalFormat;
+		frame.gbufferNormals = graph.createTexture("G-buffer normals", colorTargetDesc);
+		colorTargetDesc.label = "G-buffer albedo target";
+		colorTargetDesc.format = DeferredShading::AlbedoFormat;
+		frame.gbufferAlbedo = graph.createTexture("G-buffer albedo", colorTargetDesc);
+	}
+	frame.particles = draw && mParticles && mParticles->ready();
+	frame.terrain = draw && mTerrain && mTerrain->ready();
+	if (draw && mPointCloud) {
+		mPointCloud->update(mQueue, mViewUniforms.viewMatrix, mViewUniforms.projectionMatrix, frame.sceneSize);
+		frame.pointCloud = mPointCloud->ready() && mPointCloud->nodeCount() > 0;
+	}
+	frame.imposters = draw && mImposters && mImposters->ready() && mImposters->instanceCount() > 0;
+
+	// Transparent batches, once their pipelines are built, either sorted for the main pass or
+	// accumulated into targets of their own
+	bool transparency = draw && mScene.opaqueBatchCount() < mScene.batches().size();
+	frame.sortedTransparency = transparency && !mWeightedTransparency && mPipelines[(size_t)DrawPass::Transparent]->ready();
+	frame.weightedTransparency = transparency && mWeightedTransparency && mPipelines[(size_t)DrawPass::WeightedTransparent]->ready() && mWeightedBlendedOit->ready();
+	if (frame.sortedTransparency) sortTransparentBatches();
+	if (frame.weightedTransparency) {
+		mTransparentOrder.resize(mScene.batches().size() - mScene.opaqueBatchCount());
+		std::iota(mTransparentOrder.begin(), mTransparentOrder.end(), mScene.opaqueBatchCount());
+		colorTargetDesc.sampleCount = 1;
+		colorTargetDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+		colorTargetDesc.label = "Transparency accumulation";
+		colorTargetDesc.format = WeightedBlendedOit::AccumulationFormat;
+		frame.accumulation = graph.createTexture("Transparency accumulation", colorTargetDesc);
+		colorTargetDesc.label = "Transparency revealage";
+		colorTargetDesc.format = WeightedBlendedOit::RevealageFormat;
+		frame.revealage = graph.createTexture("Transparency revealage", colorTargetDesc);
+		if (mSampleCount > 1) {
+			colorTargetDesc.sampleCount = mSampleCount;
+			colorTargetDesc.usage = TextureUsage::RenderAttachment;
+			colorTargetDesc.label = "Multisampled transparency accumulation";
+			colorTargetDesc.format = WeightedBlendedOit::AccumulationFormat;
+			frame.multisampledAccumulation = graph.createTexture("Multisampled transparency accumulation", colorTargetDesc);
+			colorTargetDesc.label = "Multisampled transparency revealage";
+			colorTargetDesc.format = WeightedBlendedOit::RevealageFormat;
+			frame.multisampledRevealage = graph.createTexture("Multisampled transparency revealage", colorTargetDesc);
+		}
+	}
 
-  // Store a pointer to the application in the GLFW window, so we can access it in callbacks if needed
-  glfwSetWindowUserPointer(mWindow, this);
-	
+	// Timed on their own, whatever the scene draws
+	if (mPrimitivesBenchmark && mPrimitivesBenchmark->ready()) {
+		graph.addPass("Primitives benchmark", [this](CommandEncoder encoder, const FrameGraph&) {
+			mPrimitivesBenchmark->encode(encoder, *mGpuProfiler);
+		}, true);
+	}
+	if (mScenarioBenchmark && mScenarioBenchmark->ready()) {
+		graph.addPass("GPU scenarios", [this](CommandEncoder encoder, const FrameGraph&) {
+			mScenarioBenchmark->encode(encoder, *mGpuProfiler);
+		}, true);
+	}
 
-#ifndef __EMSCRIPTEN__
-	glfwSetFramebufferSizeCallback(mWindow, [](GLFWwindow* window, int width, int height) {
-		//std::cout << "[GLFW] framebuffer resize: " << width << " x " << height << std::endl;
-		Application* that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
-		if (that != nullptr) {
-			that->handleResize(width, height);
+	// Lights are binned again when they or the camera moved, before the passes shading them
+	if (draw && mClusteredLights) {
+		mClusteredLights->update(mQueue, mViewUniforms.viewMatrix, mViewUniforms.projectionMatrix, frame.sceneSize);
+		if (mClusteredLights->binningNeeded() && mClusteredLights->ready()) {
+			ComputePassTimestampWrites binningTimestampWrites;
+			mClusteredLights->bin(compute(), mGpuProfiler->computePass("Light binning", binningTimestampWrites));
 		}
-	});
+	}
 
-	glfwSetCursorPosCallback(mWindow, [](GLFWwindow* window, double xpos, double ypos) {
-		auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
-		if (that != nullptr) that->onMouseMove(xpos, ypos);
-	});
+	// Shadow casters are drawn before the passes that sample the shadow maps, only into the
+	// cascades that changed, unless the pass budget defers them
+	if (draw && mShadowMaps && mPipelines[(size_t)DrawPass::Shadow]->ready() && passDue(mBudgetedWork.shadows)) {
+		const glm::mat4& M = mFrameUniforms.modelMatrix;
+		float scale = std::max({ glm::length(glm::vec3(M[0])), glm::length(glm::vec3(M[1])), glm::length(glm::vec3(M[2])) });
+		glm::vec4 sceneSphere(glm::vec3(M * glm::vec4(glm::vec3(mSceneBounds), 1.0f)), mSceneBounds.w * scale);
+		mShadowMaps->update(mQueue, mViewUniforms.viewMatrix, mViewUniforms.projectionMatrix, sceneSphere);
+		graph.addPass("Shadows", [this](CommandEncoder encoder, const FrameGraph&) {
+			mShadowMaps->encode(encoder, [this](RenderPassEncoder pass, uint32_t cascade, bool staticCasters) {
+				drawShadowCasters(pass, cascade, staticCasters);
+			}, *mGpuProfiler);
+		}, true);
+	}
 
-	glfwSetMouseButtonCallback(mWindow, [](GLFWwindow* window, int button, int action, int mods) {
-		auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
-		if (that != nullptr) that->onMouseButton(button, action, mods);
-	});
+	// Normals of the heights streamed in by the last update, before the passes drawing them
+	if (frame.terrain && mTerrain->normalsDirty()) {
+		ComputePassTimestampWrites normalTimestampWrites;
+		mTerrain->encodeNormals(compute(), mGpuProfiler->computePass("Terrain normals", normalTimestampWrites));
+	}
 
-	glfwSetScrollCallback(mWindow, [](GLFWwindow* window, double xoffset, double yoffset) {
-		auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
-		if (that != nullptr) that->onScroll(xoffset, yoffset);
-	});
-#else
-	emscripten_set_resize_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, this, false, browserResizeCallback);
+	// Clusters of the opaque batches, from the draw arguments culling wrote for them
+	if (draw && mClusterLod && mClusterLod->batchCount() > 0) {
+		ComputePassTimestampWrites clusterTimestampWrites;
+		mClusterLod->encode(compute(), mGpuProfiler->computePass("Cluster LOD", clusterTimestampWrites));
+	}
 
-	emscripten_set_mousemove_callback("#canvas", this, true, mouseMoveCallback);
+	if (depthPrePass) {
+		FrameGraph::PassHandle pass = graph.addPass("Depth pre-pass", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			// Same depth attachment as the main pass, without color
+			RenderPassDepthStencilAttachment depthStencilAttachment = depthAttachment(graph.view(frame.depth), LoadOp::Clear, mDepthConvention.farDepth());
+			RenderPassDescriptor depthPassDesc{};
+			depthPassDesc.colorAttachmentCount = 0;
+			depthPassDesc.colorAttachments = nullptr;
+			depthPassDesc.depthStencilAttachment = &depthStencilAttachment;
+			RenderPassTimestampWrites depthPassTimestampWrites;
+			depthPassDesc.timestampWrites = mGpuProfiler->renderPass("Depth pre-pass", depthPassTimestampWrites);
+			GpuHandle<RenderPassEncoder> depthPass = encoder.beginRenderPass(depthPassDesc);
+			uint32_t statisticsQuery = mPipelineStatistics->allocate("Depth pre-pass");
+			mPipelineStatistics->begin(depthPass, statisticsQuery);
+			frame.restrictToWindow(depthPass);
+			if (frame.terrain) mTerrain->drawDepth(depthPass);
+			if (mDrawConstants->pushConstants() || multiDraw()) {
+				RenderStateCache<RenderPassEncoder> state(depthPass);
+				drawOpaqueBatches(state, DrawPass::DepthPrePass);
+			}
+			else {
+				const std::vector<RenderBundle>& renderBundles = getRenderBundles(DrawPass::DepthPrePass);
+				depthPass->executeBundles(renderBundles.size(), renderBundles.data());
+			}
+			countDrawCalls(DrawPass::DepthPrePass);
+			mPipelineStatistics->end(depthPass, statisticsQuery);
+			depthPass->end();
+		});
+		graph.write(pass, frame.depth);
+	}
 
-	emscripten_set_mousedown_callback("#canvas", this, true, mouseDownCallback);
+	// Particles are simulated and sorted for the main pass, which draws them by the arguments
+	// written there
+	if (frame.particles) {
+		ComputePassTimestampWrites particleTimestampWrites;
+		mParticles->simulate(compute(), mGpuProfiler->computePass("Particles", particleTimestampWrites));
+	}
 
-	emscripten_set_mouseup_callback("#canvas", this, true, mouseUpCallback);
+	// Points are rasterized into buffers of their own, resolved by the main pass
+	if (frame.pointCloud) {
+		ComputePassTimestampWrites pointCloudTimestampWrites;
+		mPointCloud->rasterize(compute(), mGpuProfiler->computePass("Point cloud", pointCloudTimestampWrites));
+	}
 
-	emscripten_set_wheel_callback("#canvas", this, true, wheelCallback);
+	// The opaque instances only write the G-buffer, lit per pixel by a compute pass
+	if (frame.deferred) {
+		FrameGraph::PassHandle pass = graph.addPass("G-buffer", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			std::array<RenderPassColorAttachment, 3> colorAttachments{};
+			std::array<FrameGraph::TextureHandle, 3> targets = { frame.gbufferNormals, frame.gbufferAlbedo, frame.objectIds };
+			for (size_t i = 0; i < colorAttachments.size(); ++i) {
+				RenderPassColorAttachment& attachment = colorAttachments[i];
+				attachment.view = i < 2 || mObjectPicker ? graph.view(targets[i]) : nullptr;
+				attachment.resolveTarget = nullptr;
+				attachment.loadOp = LoadOp::Clear;
+				attachment.storeOp = StoreOp::Store;
+				attachment.clearValue = Color{ 0.0, 0.0, 0.0, 0.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+				attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+			}
+			RenderPassDepthStencilAttachment depthStencilAttachment = depthAttachment(
+				graph.view(frame.depth),
+				frame.depthPrePass ? LoadOp::Load : LoadOp::Clear,
+				mDepthConvention.farDepth()
+			);
+
+			RenderPassDescriptor renderPassDesc{};
+			renderPassDesc.colorAttachmentCount = mObjectPicker ? 3 : 2;
+			renderPassDesc.colorAttachments = colorAttachments.data();
+			renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+			RenderPassTimestampWrites gbufferTimestampWrites;
+			renderPassDesc.timestampWrites = mGpuProfiler->renderPass("G-buffer", gbufferTimestampWrites);
+			GpuHandle<RenderPassEncoder> renderPass = encoder.beginRenderPass(renderPassDesc);
+			uint32_t statisticsQuery = mPipelineStatistics->allocate("G-buffer");
+			mPipelineStatistics->begin(renderPass, statisticsQuery);
+			frame.restrictToWindow(renderPass);
+			DrawPass drawPass = frame.depthPrePass ? DrawPass::AfterDepthPrePass : DrawPass::Main;
+			if (mDrawConstants->pushConstants() || multiDraw()) {
+				RenderStateCache<RenderPassEncoder> state(renderPass);
+				drawOpaqueBatches(state, drawPass);
+			}
+			else {
+				const std::vector<RenderBundle>& renderBundles = getRenderBundles(drawPass);
+				renderPass->executeBundles(renderBundles.size(), renderBundles.data());
+			}
+			countDrawCalls(drawPass);
+			mPipelineStatistics->end(renderPass, statisticsQuery);
+			renderPass->end();
+		});
+		if (depthPrePass) graph.read(pass, frame.depth);
+		graph.write(pass, frame.depth);
+		graph.write(pass, frame.gbufferNormals);
+		graph.write(pass, frame.gbufferAlbedo);
+		if (mObjectPicker) graph.write(pass, frame.objectIds);
+
+		// Also where no surface is, to the background the main pass clears to otherwise
+		mDeferredShading->update(
+			mQueue, mViewUniforms.projectionMatrix, mViewUniforms.viewMatrix, frame.sceneSize, glm::vec4(0.30f, 0.30f, 0.30f, 1.0f)
+		);
+		pass = graph.addPass("Deferred lighting", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			uint32_t frameOffset = mUniformRing->offset((uint32_t)BindGroupSlot::Frame);
+			uint32_t viewOffset = mUniformRing->offset((uint32_t)BindGroupSlot::View);
+			ComputePassTimestampWrites lightingTimestampWrites;
+			mDeferredShading->encode(
+				encoder,
+				graph.view(frame.gbufferNormals), graph.view(frame.gbufferAlbedo), graph.view(frame.depth), graph.view(frame.scene),
+				mFrameBindGroup->bindGroup, frameOffset, mViewBindGroup->bindGroup, viewOffset,
+				mGpuProfiler->computePass("Deferred lighting", lightingTimestampWrites)
+			);
+		}, true);
+		graph.read(pass, frame.gbufferNormals);
+		graph.read(pass, frame.gbufferAlbedo);
+		graph.read(pass, frame.depth);
+		graph.write(pass, frame.scene);
+	}
 
-	//emscripten_set_keydown_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, this, true, keyDownCallback);
+	// With deferred shading, what is not in the G-buffer is drawn forward over the lit scene
+	bool forwardDraws = frame.terrain || frame.imposters || frame.pointCloud || frame.sortedTransparency || frame.particles;
+	if (!frame.deferred || forwardDraws) {
+		FrameGraph::PassHandle mainPass = graph.addPass("Main pass", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			TextureView sceneView = graph.view(frame.shadingRate ? frame.sparseScene : frame.scene);
+			TextureView multisampledView = mSampleCount > 1 ? graph.view(frame.multisampledColor) : nullptr;
+			std::array<RenderPassColorAttachment, 2> colorAttachments{};
+			RenderPassColorAttachment& renderPassColorAttachment = colorAttachments[0];
+			renderPassColorAttachment.view = multisampledView ? multisampledView : sceneView;
+			renderPassColorAttachment.resolveTarget = multisampledView ? sceneView : nullptr;
+			renderPassColorAttachment.loadOp = frame.deferred ? LoadOp::Load : LoadOp::Clear;
+			renderPassColorAttachment.storeOp = multisampledView ? StoreOp::Discard : StoreOp::Store;
+			renderPassColorAttachment.clearValue = Color{ 0.30, 0.30, 0.30, 1.0 };
+			// 0 where no instance is drawn
+			RenderPassColorAttachment& idAttachment = colorAttachments[1];
+			idAttachment.view = mObjectPicker ? graph.view(frame.objectIds) : nullptr;
+			idAttachment.resolveTarget = nullptr;
+			idAttachment.loadOp = frame.deferred ? LoadOp::Load : LoadOp::Clear;
+			idAttachment.storeOp = frame.picking ? StoreOp::Store : StoreOp::Discard;
+			idAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 0.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+			renderPassColorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+			idAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+			// Fragments are tested against the depths of the pre-pass or the G-buffer if there is one
+			RenderPassDepthStencilAttachment depthStencilAttachment = depthAttachment(
+				graph.view(frame.depth),
+				frame.depthPrePass || frame.deferred ? LoadOp::Load : LoadOp::Clear,
+				mDepthConvention.farDepth()
+			);
+
+			RenderPassDescriptor renderPassDesc{};
+			renderPassDesc.colorAttachmentCount = mObjectPicker ? 2 : 1;
+			renderPassDesc.colorAttachments = colorAttachments.data();
+			renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+			RenderPassTimestampWrites renderPassTimestampWrites;
+			renderPassDesc.timestampWrites = mGpuProfiler->renderPass("Main pass", renderPassTimestampWrites);
+			GpuHandle<RenderPassEncoder> renderPass = encoder.beginRenderPass(renderPassDesc);
+			uint32_t statisticsQuery = mPipelineStatistics->allocate("Main pass");
+			mPipelineStatistics->begin(renderPass, statisticsQuery);
+			frame.restrictToWindow(renderPass);
+
+			// Shared by the opaque and transparent batches, and forgotten whenever other draws
+			// or the bundles set state of their own
+			RenderStateCache<RenderPassEncoder> state(renderPass);
+			if (frame.terrain) mTerrain->draw(renderPass);
+			if (frame.draw && !frame.deferred) {
+				DrawPass drawPass = frame.depthPrePass ? DrawPass::AfterDepthPrePass : DrawPass::Main;
+				if (mDrawConstants->pushConstants() || multiDraw()) {
+					drawOpaqueBatches(state, drawPass);
+				}
+				else {
+					const std::vector<RenderBundle>& renderBundles = getRenderBundles(drawPass);
+					renderPass->executeBundles(renderBundles.size(), renderBundles.data());
+					state.invalidate();
+				}
+				countDrawCalls(drawPass);
+			}
+			if (frame.imposters) {
+				mImposters->draw(renderPass);
+				state.invalidate();
+			}
+			if (frame.pointCloud) {
+				mPointCloud->draw(renderPass);
+				state.invalidate();
+			}
+			// After the opaque instances, blending over them
+			if (frame.sortedTransparency) drawTransparentBatches(state, DrawPass::Transparent);
+			if (frame.particles) mParticles->draw(renderPass);
+
+			mPipelineStatistics->end(renderPass, statisticsQuery);
+			renderPass->end();
+		});
+		if (depthPrePass || frame.deferred) graph.read(mainPass, frame.depth);
+		graph.write(mainPass, frame.depth);
+		if (mSampleCount > 1) graph.write(mainPass, frame.multisampledColor);
+		if (mObjectPicker) {
+			if (frame.deferred) graph.read(mainPass, frame.objectIds);
+			graph.write(mainPass, frame.objectIds);
+		}
+		if (frame.deferred) graph.read(mainPass, frame.scene);
+		graph.write(mainPass, frame.shadingRate ? frame.sparseScene : frame.scene);
+	}
 
-	//emscripten_set_keyup_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, this, true, keyUpCallback);
-#endif
+	// Pixels the main pass skipped, from the shaded ones around them
+	if (frame.shadingRate) {
+		FrameGraph::PassHandle pass = graph.addPass("Shading rate upsample", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			RenderPassTimestampWrites upsampleTimestampWrites;
+			mShadingRate->upsample(
+				encoder, graph.view(frame.sparseScene), graph.view(frame.depth), graph.view(frame.scene),
+				mGpuProfiler->renderPass("Shading rate upsample", upsampleTimestampWrites)
+			);
+		});
+		graph.read(pass, frame.sparseScene);
+		graph.read(pass, frame.depth);
+		graph.write(pass, frame.scene);
+	}
 
-	adapter.release();
-	return mDevice != nullptr;
-}
+	// The pyramid of the opaque depths, which the occlusion samples and the next culling pass
+	// then tests against
+	bool depthPyramidBuilt = false;
+	if (frame.ambientOcclusionEstimated) {
+		FrameGraph::PassHandle pass = graph.addPass("Depth pyramid", [this](CommandEncoder encoder, const FrameGraph&) {
+			ComputePassTimestampWrites depthPyramidTimestampWrites;
+			mDepthPyramid->build(encoder, mGpuProfiler->computePass("Depth pyramid", depthPyramidTimestampWrites));
+		}, true);
+		graph.read(pass, frame.depth);
+		depthPyramidBuilt = true;
+
+		pass = graph.addPass("Ambient occlusion", [this](CommandEncoder encoder, const FrameGraph&) {
+			ComputePassTimestampWrites occlusionTimestampWrites;
+			mAmbientOcclusion->encode(encoder, mDepthPyramid->view(), mGpuProfiler->computePass("Ambient occlusion", occlusionTimestampWrites));
+		}, true);
+		graph.read(pass, frame.depth);
+	}
+	if (frame.ambientOcclusion) {
+		// Before the transparent surfaces, which nothing occludes
+		FrameGraph::PassHandle pass = graph.addPass("Ambient occlusion upsample", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			RenderPassTimestampWrites upsampleTimestampWrites;
+			mAmbientOcclusion->apply(
+				encoder, graph.view(frame.depth), graph.view(frame.scene),
+				mGpuProfiler->renderPass("Ambient occlusion upsample", upsampleTimestampWrites)
+			);
+		});
+		graph.read(pass, frame.depth);
+		graph.read(pass, frame.scene);
+		graph.write(pass, frame.scene);
+	}
+
+	// Transparent fragments against the depths of the main pass, then composited over its color
+	if (frame.weightedTransparency) {
+		FrameGraph::PassHandle pass = graph.addPass("Transparency", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			// The accumulation starts at 0 and the revealage at 1, fully revealing the scene
+			std::array<RenderPassColorAttachment, 2> colorAttachments{};
+			std::array<FrameGraph::TextureHandle, 2> targets = { frame.accumulation, frame.revealage };
+			std::array<FrameGraph::TextureHandle, 2> multisampledTargets = { frame.multisampledAccumulation, frame.multisampledRevealage };
+			for (size_t i = 0; i < colorAttachments.size(); ++i) {
+				RenderPassColorAttachment& attachment = colorAttachments[i];
+				attachment.view = mSampleCount > 1 ? graph.view(multisampledTargets[i]) : graph.view(targets[i]);
+				attachment.resolveTarget = mSampleCount > 1 ? graph.view(targets[i]) : nullptr;
+				attachment.loadOp = LoadOp::Clear;
+				attachment.storeOp = mSampleCount > 1 ? StoreOp::Discard : StoreOp::Store;
+				attachment.clearValue = i == 0 ? Color{ 0.0, 0.0, 0.0, 0.0 } : Color{ 1.0, 1.0, 1.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+				attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+			}
+			RenderPassDepthStencilAttachment depthStencilAttachment = depthAttachment(graph.view(frame.depth), LoadOp::Load, mDepthConvention.farDepth());
+
+			RenderPassDescriptor renderPassDesc{};
+			renderPassDesc.colorAttachmentCount = (uint32_t)colorAttachments.size();
+			renderPassDesc.colorAttachments = colorAttachments.data();
+			renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+			RenderPassTimestampWrites transparencyTimestampWrites;
+			renderPassDesc.timestampWrites = mGpuProfiler->renderPass("Transparency", transparencyTimestampWrites);
+			GpuHandle<RenderPassEncoder> renderPass = encoder.beginRenderPass(renderPassDesc);
+			uint32_t statisticsQuery = mPipelineStatistics->allocate("Transparency");
+			mPipelineStatistics->begin(renderPass, statisticsQuery);
+			frame.restrictToWindow(renderPass);
+			RenderStateCache<RenderPassEncoder> state(renderPass);
+			drawTransparentBatches(state, DrawPass::WeightedTransparent);
+			mPipelineStatistics->end(renderPass, statisticsQuery);
+			renderPass->end();
+		});
+		graph.read(pass, frame.depth);
+		graph.write(pass, frame.accumulation);
+		graph.write(pass, frame.revealage);
+		if (mSampleCount > 1) {
+			graph.write(pass, frame.multisampledAccumulation);
+			graph.write(pass, frame.multisampledRevealage);
+		}
+
+		pass = graph.addPass("Transparency composite", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			RenderPassTimestampWrites compositeTimestampWrites;
+			mWeightedBlendedOit->composite(
+				encoder,
+				graph.view(frame.accumulation), graph.view(frame.revealage),
+				graph.view(frame.scene), frame.sceneSize.x, frame.sceneSize.y,
+				mGpuProfiler->renderPass("Transparency composite", compositeTimestampWrites)
+			);
+		});
+		graph.read(pass, frame.accumulation);
+		graph.read(pass, frame.revealage);
+		graph.read(pass, frame.scene);
+		graph.write(pass, frame.scene);
+	}
+
+	if (frame.picking) {
+		FrameGraph::PassHandle pass = graph.addPass("Picking", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			ComputePassTimestampWrites pickingTimestampWrites;
+			mObjectPicker->encode(encoder, graph.view(frame.objectIds), mGpuProfiler->computePass("Picking", pickingTimestampWrites));
+		}, true);
+		graph.read(pass, frame.objectIds);
+	}
+
+	// Into a target of its own, every few frames
+	if (mTextureFeedback && ++mTextureFeedbackFrames >= (mVirtualTextures ? virtualTextureFeedbackInterval : textureFeedbackInterval) && draw
+		&& mTextureFeedback->encodeNeeded() && mPipelines[(size_t)DrawPass::TextureFeedback] && mPipelines[(size_t)DrawPass::TextureFeedback]->ready()) {
+		mTextureFeedbackFrames = 0;
+		graph.addPass("Texture feedback", [this, &frame](CommandEncoder encoder, const FrameGraph&) {
+			RenderPassTimestampWrites feedbackTimestampWrites;
+			RenderPassEncoder renderPass = mTextureFeedback->begin(
+				encoder, frame.sceneSize, mGpuProfiler->renderPass("Texture feedback", feedbackTimestampWrites)
+			);
+			drawTextureFeedback(renderPass);
+			mTextureFeedback->end(encoder, renderPass);
+		}, true);
+	}
+
+	// Blended with the history, which takes the result for the next frame
+	if (frame.temporal) {
+		FrameGraph::PassHandle pass = graph.addPass("Temporal resolve", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			RenderPassTimestampWrites resolveTimestampWrites;
+			mTemporalAA->resolve(
+				encoder, graph.view(frame.scene), graph.view(frame.depth), graph.view(frame.resolvedScene),
+				mGpuProfiler->renderPass("Temporal resolve", resolveTimestampWrites)
+			);
+		});
+		graph.read(pass, frame.scene);
+		graph.read(pass, frame.depth);
+		graph.write(pass, frame.resolvedScene);
+	}
+
+	// Rates of the next frame, from what this one looks like once complete
+	if (frame.shadingRate) {
+		FrameGraph::PassHandle pass = graph.addPass("Shading rate", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			ComputePassTimestampWrites classifyTimestampWrites;
+			mShadingRate->classify(encoder, graph.view(frame.scene), graph.view(frame.depth), mGpuProfiler->computePass("Shading rate", classifyTimestampWrites));
+		}, true);
+		graph.read(pass, frame.scene);
+		graph.read(pass, frame.depth);
+	}
+
+	if (mPostProcess && mPostProcess->ready()) {
+		frame.bloom = passDue(mBudgetedWork.bloom);
+		FrameGraph::PassHandle pass = graph.addPass("Post-processing", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			mPostProcess->draw(
+				encoder,
+				graph.view(frame.resolvedScene), frame.sceneTextureSize, frame.sceneSize.x, frame.sceneSize.y,
+				graph.view(frame.surface), mWindowWidth, mWindowHeight,
+				*mGpuProfiler, frame.bloom
+			);
+		});
+		graph.read(pass, frame.resolvedScene);
+		graph.write(pass, frame.surface);
+	}
+	else if (frame.sceneTarget) {
+		// Also while the post-processing pipelines are being built
+		FrameGraph::PassHandle pass = graph.addPass("Blit to surface", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			RenderPassTimestampWrites blitTimestampWrites;
+			mBlit->draw(
+				encoder,
+				graph.view(frame.resolvedScene), frame.sceneSize.x, frame.sceneSize.y,
+				graph.view(frame.surface), mWindowWidth, mWindowHeight,
+				mGpuProfiler->renderPass("Blit to surface", blitTimestampWrites)
+			);
+		});
+		graph.read(pass, frame.resolvedScene);
+		graph.write(pass, frame.surface);
+	}
+
+	// The post-processed frame, before the HUD draws over it
+	if (mFrameCapture && mSurfaceTexture && mFrameCapture->streaming()) {
+		FrameGraph::PassHandle pass = graph.addPass("Frame stream", [this](CommandEncoder encoder, const FrameGraph&) {
+			mFrameCapture->stream(encoder, mSurfaceTexture, mSurfaceTexture.getWidth(), mSurfaceTexture.getHeight());
+		}, true);
+		graph.read(pass, frame.surface);
+	}
+
+	if (mShowHud && mHud->ready()) {
+		FrameGraph::PassHandle pass = graph.addPass("HUD", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			RenderPassTimestampWrites hudTimestampWrites;
+			mHud->draw(encoder, graph.view(frame.surface), mWindowWidth, mWindowHeight, mGpuProfiler->renderPass("HUD", hudTimestampWrites));
+		});
+		graph.read(pass, frame.surface);
+		graph.write(pass, frame.surface);
+	}
+
+	// What is presented, HUD included
+	if (mFrameCapture && mSurfaceTexture && (mScreenshotRequested || !mRecordingDirectory.empty())) {
+		FrameGraph::PassHandle pass = graph.addPass("Frame capture", [this](CommandEncoder encoder, const FrameGraph&) {
+			encodeFrameCapture(encoder);
+		}, true);
+		graph.read(pass, frame.surface);
+	}
+
+	// Secondary views, from the same resources and in the same command buffer. The pipelines
+	// draw to the scene format, blitted to the surface unless it is that format already.
+	// Post-processing, transparency and the other passes of the main window are left out.
+	struct ViewFrame {
+		uint32_t index = 0;
+		glm::uvec2 size = { 0, 0 };
+		FrameGraph::TextureHandle surface = 0;
+		FrameGraph::TextureHandle depth = 0;
+		FrameGraph::TextureHandle scene = 0;
+		FrameGraph::TextureHandle multisampledColor = 0;
+		FrameGraph::TextureHandle objectIds = 0;
+	};
+	FrameVector<ViewFrame> viewFrames{ FrameAllocator<ViewFrame>(mFrameArena) };
+	viewFrames.reserve(mViews.size());
+	for (uint32_t i = 0; i < mViews.size(); ++i) {
+		View& view = *mViews[i];
+		if (!view.targetView()) continue;
+		ViewFrame& viewFrame = viewFrames.emplace_back();
+		viewFrame.index = i;
+		viewFrame.size = view.size();
+		viewFrame.surface = graph.importTexture("View surface texture", view.targetView());
+		viewFrame.depth = graph.importTexture("View depth buffer", view.depthView());
+		viewFrame.scene = viewFrame.surface;
+		colorTargetDesc.size = { viewFrame.size.x, viewFrame.size.y, 1 };
+		colorTargetDesc.format = mSceneFormat;
+		if (mSceneFormat != mSurfaceFormat) {
+			colorTargetDesc.label = "View scene target";
+			colorTargetDesc.sampleCount = 1;
+			colorTargetDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+			viewFrame.scene = graph.createTexture("View scene color", colorTargetDesc);
+		}
+		if (mSampleCount > 1) {
+			colorTargetDesc.label = "View multisampled color target";
+			colorTargetDesc.sampleCount = mSampleCount;
+			colorTargetDesc.usage = TextureUsage::RenderAttachment;
+			viewFrame.multisampledColor = graph.createTexture("View multisampled color", colorTargetDesc);
+		}
+		// Never picked from, only there for the attachments to match the pipeline
+		if (mObjectPicker) {
+			colorTargetDesc.label = "View object ID target";
+			colorTargetDesc.format = ObjectPicker::IdFormat;
+			colorTargetDesc.sampleCount = mSampleCount;
+			colorTargetDesc.usage = TextureUsage::RenderAttachment;
+			viewFrame.objectIds = graph.createTexture("View object IDs", colorTargetDesc);
+		}
+
+		FrameGraph::PassHandle pass = graph.addPass("Secondary view", [this, &viewFrame](CommandEncoder encoder, const FrameGraph& graph) {
+			TextureView sceneView = graph.view(viewFrame.scene);
+			TextureView multisampledView = mSampleCount > 1 ? graph.view(viewFrame.multisampledColor) : nullptr;
+			std::array<RenderPassColorAttachment, 2> colorAttachments{};
+			RenderPassColorAttachment& colorAttachment = colorAttachments[0];
+			colorAttachment.view = multisampledView ? multisampledView : sceneView;
+			colorAttachment.resolveTarget = multisampledView ? sceneView : nullptr;
+			colorAttachment.loadOp = LoadOp::Clear;
+			colorAttachment.storeOp = multisampledView ? StoreOp::Discard : StoreOp::Store;
+			colorAttachment.clearValue = Color{ 0.30, 0.30, 0.30, 1.0 };
+			RenderPassColorAttachment& idAttachment = colorAttachments[1];
+			idAttachment.view = mObjectPicker ? graph.view(viewFrame.objectIds) : nullptr;
+			idAttachment.resolveTarget = nullptr;
+			idAttachment.loadOp = LoadOp::Clear;
+			idAttachment.storeOp = StoreOp::Discard;
+			idAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 0.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+			colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+			idAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+			RenderPassDepthStencilAttachment depthStencilAttachment = depthAttachment(graph.view(viewFrame.depth), LoadOp::Clear, mDepthConvention.farDepth());
+
+			RenderPassDescriptor renderPassDesc{};
+			renderPassDesc.colorAttachmentCount = mObjectPicker ? 2 : 1;
+			renderPassDesc.colorAttachments = colorAttachments.data();
+			renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+			// The views of a frame add up to a single entry of the timings
+			RenderPassTimestampWrites viewTimestampWrites;
+			renderPassDesc.timestampWrites = mGpuProfiler->renderPass("Secondary views", viewTimestampWrites);
+			GpuHandle<RenderPassEncoder> renderPass = encoder.beginRenderPass(renderPassDesc);
+			uint32_t statisticsQuery = mPipelineStatistics->allocate("Secondary views");
+			mPipelineStatistics->begin(renderPass, statisticsQuery);
+			if (mScene.opaqueBatchCount() > 0 && mPipelines[(size_t)DrawPass::Main]->ready()) drawView(renderPass, viewFrame.index);
+			mPipelineStatistics->end(renderPass, statisticsQuery);
+			renderPass->end();
+		});
+		graph.write(pass, viewFrame.depth);
+		if (mSampleCount > 1) graph.write(pass, viewFrame.multisampledColor);
+		if (mObjectPicker) graph.write(pass, viewFrame.objectIds);
+		graph.write(pass, viewFrame.scene);
+
+		if (viewFrame.scene != viewFrame.surface) {
+			pass = graph.addPass("Secondary view blit", [this, &viewFrame](CommandEncoder encoder, const FrameGraph& graph) {
+				mViews[viewFrame.index]->blit().draw(
+					encoder,
+					graph.view(viewFrame.scene), viewFrame.size.x, viewFrame.size.y,
+					graph.view(viewFrame.surface), viewFrame.size.x, viewFrame.size.y
+				);
+			});
+			graph.read(pass, viewFrame.scene);
+			graph.write(pass, viewFrame.surface);
+		}
+	}
+
+	// Once the depths of the frame are final, only while resources stream as that is all the
+	// results are used for
+	if (draw && !mLiveResize && !mStereo && mOcclusionQueries->encodeNeeded() && mOcclusionQueries->ready()
+		&& mResourceCache->streamingCount() > 0 && prepareOcclusionQueries()) {
+		FrameGraph::PassHandle pass = graph.addPass("Occlusion queries", [this, &frame](CommandEncoder encoder, const FrameGraph& graph) {
+			RenderPassTimestampWrites occlusionTimestampWrites;
+			mOcclusionQueries->encode(
+				encoder, graph.view(frame.depth), frame.sceneSize.x, frame.sceneSize.y,
+				mViewUniforms.projectionMatrix * mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix,
+				mOcclusionQueryRanges,
+				mGpuProfiler->renderPass("Occlusion queries", occlusionTimestampWrites)
+			);
+		}, true);
+		graph.read(pass, frame.depth);
+		graph.write(pass, frame.depth);
+	}
+
+	// The next culling pass tests instances against what this frame drew, and may reveal
+	// instances this one missed
+	if (culled) mFrameDirty = true;
+	// Deferred by the pass budget, it tests against the last pyramid built, with its matrix
+	if (culled && mOcclusionCulling && !mLiveResize && mDepthPyramid->ready() && (depthPyramidBuilt || passDue(mBudgetedWork.depthPyramid))) {
+		if (!depthPyramidBuilt) {
+			FrameGraph::PassHandle pass = graph.addPass("Depth pyramid", [this](CommandEncoder encoder, const FrameGraph&) {
+				ComputePassTimestampWrites depthPyramidTimestampWrites;
+				mDepthPyramid->build(encoder, mGpuProfiler->computePass("Depth pyramid", depthPyramidTimestampWrites));
+			}, true);
+			graph.read(pass, frame.depth);
+		}
+		mDepthPyramidValid = true;
+		mDepthPyramidMatrix = mViewUniforms.projectionMatrix * mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix;
+	}
+
+	// Passes are recorded in the order they were added, the profiler's queries with them
+	graph.execute(encoder);
+	// After the last pass of the frame, read back some frames later
+	mGpuProfiler->resolve(encoder);
+	mWorkgroupTuner->resolve(encoder);
+	mPipelineStatistics->resolve(encoder);
+
+	CommandBufferDescriptor cmdBufferDescriptor{};
+	cmdBufferDescriptor.label = "Command buffer";
+	CommandBuffer command = encoder->finish(cmdBufferDescriptor);
+	encoder.reset();
+
+	// In dependency order: the culling and compute command buffers are read by the render one,
+	// which also resolves the timestamps of all three. Uploads precede them all, submitted by
+	// the UploadManager and the uniform ring as they are made.
+	FrameVector<CommandBuffer> commands{ FrameAllocator<CommandBuffer>(mFrameArena) };
+	commands.reserve(3);
+	JobSystem::instance().wait(cullingEncoding);
+	if (culling.command) commands.push_back(culling.command);
+	if (computeEncoder) {
+		CommandBufferDescriptor computeCommandDesc{};
+		computeCommandDesc.label = "Compute command buffer";
+		commands.push_back(computeEncoder->finish(computeCommandDesc));
+		computeEncoder.reset();
+	}
+	commands.push_back(command);
+	return commands;
+}
+
+void Application::countDrawCalls(DrawPass drawPass)
+{
+	FrameCounters::add(mRenderBundleCounts[(size_t)drawPass]);
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	FrameCounts counts;
+	counts[FrameCounter::DrawCalls] = batches.size();
+	for (size_t i = 0; i < batches.size(); ++i) {
+		uint64_t triangleCount = mBatchData[i].indexCount / 3;
+		// Each instance once per eye in stereo
+		uint64_t instanceCount = uint64_t(batches[i].instanceCount) * eyeCount();
+		if (mGpuCulling) {
+			counts[FrameCounter::Instances] += instanceCount;
+			counts[FrameCounter::TrianglesSubmitted] += triangleCount * instanceCount;
+			mFrameStats.allInstancesCounted = true;
+		}
+		else {
+			counts[FrameCounter::Instances] += mDrawArgs[i].instanceCount;
+			counts[FrameCounter::TrianglesSubmitted] += uint64_t(mDrawArgs[i].indexCount / 3) * mDrawArgs[i].instanceCount;
+			counts[FrameCounter::TrianglesCulled] += triangleCount * (instanceCount - mDrawArgs[i].instanceCount);
+		}
+	}
+	FrameCounters::add(counts);
+}
+
+void Application::drawShadowCasters(RenderPassEncoder pass, uint32_t cascade, bool staticCasters)
+{
+	RenderStateCache<RenderPassEncoder> state(pass);
+	state.setPipeline(mPipelines[(size_t)DrawPass::Shadow]->pipeline);
+	uint32_t frameOffset = mUniformRing->offset((uint32_t)BindGroupSlot::Frame);
+	uint32_t viewOffset = cascade * mShadowMaps->casterViewStride();
+	state.setBindGroup((uint32_t)BindGroupSlot::Frame, mFrameBindGroup->bindGroup, 1, &frameOffset);
+	state.setBindGroup((uint32_t)BindGroupSlot::View, mShadowCasterViewBindGroup->bindGroup, 1, &viewOffset);
+
+	// Like the depth pre-pass, without culling: the full level of detail of every instance,
+	// as far as uploaded, those out of the cascade being clipped. The material is never read.
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	bool materialBound = false;
+	FrameCounts counts;
+	for (size_t b = 0; b < batches.size(); ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		if (batch.dynamic == staticCasters) continue;
+		const Scene::Mesh& mesh = mScene.meshes()[batch.mesh];
+		const ResourceCache::Geometry& geometry = *mesh.geometry;
+		if (!materialBound) {
+			state.setBindGroup((uint32_t)BindGroupSlot::Material, mMaterialBindGroups[batch.texture]->bindGroup, 0, nullptr);
+			materialBound = true;
+		}
+		state.setVertexBuffer(0, geometry.vertexBuffer(0));
+		state.setIndexBuffer(geometry.indexBuffer(), geometry.indexFormat);
+
+		mDrawConstants->bind(state, (uint32_t)BindGroupSlot::Draw, drawBindGroup(mAllInstanceDrawBindGroups, geometry), static_cast<uint32_t>(b));
+		const ResourceManager::GeometryLod& lod = geometry.lod(0, mesh.submesh);
+		uint32_t indexCount = geometry.residentIndexCountOf(lod);
+		pass.drawIndexed(indexCount, batch.instanceCount, geometry.firstIndex() + lod.indexOffset, geometry.baseVertex(), multiDraw() ? batch.firstInstance : 0);
+		++counts[FrameCounter::DrawCalls];
+		counts[FrameCounter::Instances] += batch.instanceCount;
+		counts[FrameCounter::TrianglesSubmitted] += uint64_t(indexCount / 3) * batch.instanceCount;
+	}
+	state.addCounts(counts);
+	FrameCounters::add(counts);
+}
+
+void Application::drawView(RenderPassEncoder pass, uint32_t view)
+{
+	RenderStateCache<RenderPassEncoder> state(pass);
+	state.setPipeline(mPipelines[(size_t)DrawPass::Main]->pipeline);
+	uint32_t frameOffset = mUniformRing->offset((uint32_t)BindGroupSlot::Frame);
+	uint32_t viewOffset = view * mViewUniformStride;
+	state.setBindGroup((uint32_t)BindGroupSlot::Frame, mFrameBindGroup->bindGroup, 1, &frameOffset);
+	state.setBindGroup((uint32_t)BindGroupSlot::View, mSecondaryViewBindGroup->bindGroup, 1, &viewOffset);
+
+	// Like the batches of the render bundles, at the levels of detail selected for the main
+	// camera, but without culling: those out of view are clipped
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	FrameCounts counts;
+	for (size_t b = 0; b < mScene.opaqueBatchCount(); ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		const ResourceCache::Geometry& geometry = *mScene.meshes()[batch.mesh].geometry;
+		// Pages shared by meshes, bound whole, which the cache only sets again for another page
+		for (uint32_t slot = 0; slot < fetchedVertexBufferCount(geometry, false); ++slot) {
+			state.setVertexBuffer(slot, geometry.vertexBuffer(slot));
+		}
+		state.setIndexBuffer(geometry.indexBuffer(), geometry.indexFormat);
+		state.setBindGroup((uint32_t)BindGroupSlot::Material, mMaterialBindGroups[batch.texture]->bindGroup, 0, nullptr);
+
+		mDrawConstants->bind(state, (uint32_t)BindGroupSlot::Draw, drawBindGroup(mAllInstanceDrawBindGroups, geometry), static_cast<uint32_t>(b));
+		const BatchData& batchData = mBatchData[b];
+		pass.drawIndexed(batchData.indexCount, batch.instanceCount, batchData.firstIndex, batchData.baseVertex, multiDraw() ? batch.firstInstance * eyeCount() : 0);
+		++counts[FrameCounter::DrawCalls];
+		counts[FrameCounter::Instances] += batch.instanceCount;
+		counts[FrameCounter::TrianglesSubmitted] += uint64_t(batchData.indexCount / 3) * batch.instanceCount;
+	}
+	state.addCounts(counts);
+	FrameCounters::add(counts);
+}
+
+void Application::sortTransparentBatches()
+{
+	TRACE_SCOPE("sortTransparentBatches");
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	uint32_t opaqueBatchCount = mScene.opaqueBatchCount();
+	mTransparentKeys.clear();
+	mTransparentKeys.reserve(batches.size() - opaqueBatchCount);
+
+	// Each transparent batch draws a single instance, from the center of its bounding sphere.
+	// The camera looks down -z, so the farthest has the lowest view z and comes first.
+	glm::mat4 viewModel = mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix;
+	glm::vec4 depthRow = glm::row(viewModel, 2);
+	for (uint32_t b = opaqueBatchCount; b < batches.size(); ++b) {
+		uint32_t i = batches[b].firstInstance;
+		float viewZ = glm::dot(depthRow, glm::vec4(mInstanceBounds.x[i], mInstanceBounds.y[i], mInstanceBounds.z[i], 1.0f));
+		mTransparentKeys.push_back(uint64_t(orderedFloatBits(viewZ)) << 32 | b);
+	}
+	radixSortHigh32(mTransparentKeys, mTransparentSortScratch);
+
+	mTransparentOrder.resize(mTransparentKeys.size());
+	for (size_t i = 0; i < mTransparentKeys.size(); ++i) {
+		mTransparentOrder[i] = static_cast<uint32_t>(mTransparentKeys[i]);
+	}
+}
+
+void Application::drawTransparentBatches(RenderStateCache<RenderPassEncoder>& state, DrawPass drawPass)
+{
+	RenderPassEncoder pass = state.encoder();
+	state.setPipeline(mPipelines[(size_t)drawPass]->pipeline);
+	uint32_t frameOffset = mUniformRing->offset((uint32_t)BindGroupSlot::Frame);
+	uint32_t viewOffset = mUniformRing->offset((uint32_t)BindGroupSlot::View);
+	state.setBindGroup((uint32_t)BindGroupSlot::Frame, mFrameBindGroup->bindGroup, 1, &frameOffset);
+	state.setBindGroup((uint32_t)BindGroupSlot::View, mViewBindGroup->bindGroup, 1, &viewOffset);
+
+	// As in render bundles, with the culled draw arguments of each batch, but in the order of
+	// the sort, which the bindings follow
+	// Their draws are counted with the opaque ones by countDrawCalls()
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	FrameCounts counts;
+	for (uint32_t b : mTransparentOrder) {
+		const Scene::DrawBatch& batch = batches[b];
+		const ResourceCache::Geometry& geometry = *mScene.meshes()[batch.mesh].geometry;
+		// Pages shared by meshes, bound whole, which the cache only sets again for another page
+		for (uint32_t slot = 0; slot < fetchedVertexBufferCount(geometry, false); ++slot) {
+			state.setVertexBuffer(slot, geometry.vertexBuffer(slot));
+		}
+		state.setIndexBuffer(geometry.indexBuffer(), geometry.indexFormat);
+
+		state.setBindGroup((uint32_t)BindGroupSlot::Material, mMaterialBindGroups[batch.texture]->bindGroup, 0, nullptr);
+		mDrawConstants->bind(state, (uint32_t)BindGroupSlot::Draw, drawBindGroup(mDrawBindGroups, geometry), b);
+		pass.drawIndexedIndirect(mDrawArgsBuffer, b * sizeof(DrawIndexedIndirectArgs));
+	}
+	state.addCounts(counts);
+	FrameCounters::add(counts);
+}
+
+void Application::drawTextureFeedback(RenderPassEncoder pass)
+{
+	RenderStateCache<RenderPassEncoder> state(pass);
+	state.setPipeline(mPipelines[(size_t)DrawPass::TextureFeedback]->pipeline);
+	uint32_t frameOffset = mUniformRing->offset((uint32_t)BindGroupSlot::Frame);
+	uint32_t viewOffset = mUniformRing->offset((uint32_t)BindGroupSlot::View);
+	state.setBindGroup((uint32_t)BindGroupSlot::Frame, mFrameBindGroup->bindGroup, 1, &frameOffset);
+	state.setBindGroup((uint32_t)BindGroupSlot::View, mViewBindGroup->bindGroup, 1, &viewOffset);
+	state.setBindGroup(TextureFeedback::BindGroupIndex, mTextureFeedback->bindGroup(), 0, nullptr);
+
+	// With the culled draw arguments, transparent batches measuring what they cover in front of
+	// the opaque ones, as they are sampled there too
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	FrameCounts counts;
+	counts[FrameCounter::DrawCalls] = batches.size();
+	for (size_t b = 0; b < batches.size(); ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		const ResourceCache::Geometry& geometry = *mScene.meshes()[batch.mesh].geometry;
+		// Pages shared by meshes, bound whole, which the cache only sets again for another page
+		for (uint32_t slot = 0; slot < fetchedVertexBufferCount(geometry, false); ++slot) {
+			state.setVertexBuffer(slot, geometry.vertexBuffer(slot));
+		}
+		state.setIndexBuffer(geometry.indexBuffer(), geometry.indexFormat);
+
+		state.setBindGroup((uint32_t)BindGroupSlot::Material, mMaterialBindGroups[batch.texture]->bindGroup, 0, nullptr);
+		mDrawConstants->bind(state, (uint32_t)BindGroupSlot::Draw, drawBindGroup(mDrawBindGroups, geometry), b);
+		pass.drawIndexedIndirect(mDrawArgsBuffer, b * sizeof(DrawIndexedIndirectArgs));
+	}
+	state.addCounts(counts);
+	FrameCounters::add(counts);
+}
+
+bool Application::sceneSettled() const
+{
+	return readyToDraw() && mAssetLoader->pendingCount() == 0 && mResourceCache->streamingCount() == 0;
+}
+
+bool Application::readyToDraw() const
+{
+	// Only clear the frame while the geometry is loading or the pipelines are being built
+	bool cullingReady = !mGpuCulling || mCullingKernel->pipeline()->ready();
+	bool clusterLodReady = !mClusterLod || mClusterLod->batchCount() == 0 || mClusterLod->ready();
+	bool pipelinesReady = mDepthPrePass
+		? mPipelines[(size_t)DrawPass::DepthPrePass]->ready() && mPipelines[(size_t)DrawPass::AfterDepthPrePass]->ready()
+		: mPipelines[(size_t)DrawPass::Main]->ready();
+	bool lightingReady = !mDeferredShading || mDeferredShading->ready();
+	return !mScene.batches().empty() && pipelinesReady && lightingReady && cullingReady && clusterLodReady;
+}
+
+void Application::setBenchmark(const BenchmarkOptions& options)
+{
+	mPowerPreference = options.powerPreference;
+	mBenchmark = options.enabled() ? std::make_unique<Benchmark>(options) : nullptr;
+	if (!options.recordPath.empty()) mInputRecorder = std::make_unique<InputRecorder>(options.recordPath);
+	if (!options.replayPath.empty()) {
+		mInputReplay = InputReplay::open(options.replayPath);
+		if (mInputReplay) std::cout << "Replaying " << mInputReplay->frameCount() << " frames of input from " << options.replayPath << std::endl;
+	}
+	if (options.stressScene.enabled()) {
+		mSceneGenerator = std::make_unique<SceneGenerator>(options.stressScene);
+		const StressSceneOptions& scene = mSceneGenerator->options();
+		std::cout << "Synthetic scene: " << scene.objectCount << " objects of " << scene.meshCount << " meshes of " << scene.trianglesPerMesh
+			<< " triangles, " << scene.materialCount << " materials, " << scene.textureCount << " textures, " << scene.lightCount
+			<< " lights, " << scene.dynamicFraction * 100.0f << "% dynamic" << std::endl;
+	}
+	if (mBenchmark) {
+		mWindowWidth = options.width;
+		mWindowHeight = options.height;
+		// Frames must do the same work from one run to the next
+		mDynamicResolution = false;
+	}
+}
+
+void Application::updateStartupReport()
+{
+	// Browsers present once the frame callback returns
+	StartupProfiler::mark("First present");
+	if (!readyToDraw() || mAssetLoader->pendingCount() > 0 || mPipelineCache->pendingCount() > 0 || mResourceCache->streamingCount() > 0) return;
+
+	StartupProfiler::mark("First complete frame");
+	// Written as JSON when LEARNWEBGPU_STARTUP_REPORT names the file, printed in any case
+	const char* reportPath = std::getenv("LEARNWEBGPU_STARTUP_REPORT");
+	if (StartupProfiler::finish(reportPath ? reportPath : "") && reportPath) {
+		std::cout << "Wrote startup report to " << reportPath << std::endl;
+	}
+	// What the decoders of the loads took from the system at most, and how often their buffers
+	// were reused rather than allocated
+	DecodeHeap::Statistics decodeHeap = DecodeHeap::statistics();
+	if (decodeHeap.allocationCount > 0) {
+		std::cout << "Decode heap: " << formatWithPrefix(static_cast<double>(decodeHeap.peakReservedBytes), "B", 1024.0) << " at peak, "
+			<< formatWithPrefix(static_cast<double>(decodeHeap.reservedBytes), "B", 1024.0) << " kept, "
+			<< 100 * decodeHeap.reuseCount / decodeHeap.allocationCount << "% of " << decodeHeap.allocationCount << " buffers reused" << std::endl;
+	}
+}
+
+void Application::updateRecoveryReport()
+{
+	// Same criterion as the startup report
+	if (!readyToDraw() || mAssetLoader->pendingCount() > 0 || mPipelineCache->pendingCount() > 0 || mResourceCache->streamingCount() > 0) return;
+	std::cerr << "Recovered from the device loss in " << (Trace::now() - mRecoveryStart) / 1000000 << " ms" << std::endl;
+	mRecoveryStart = -1;
+}
+
+bool Application::needsRedraw() const
+{
+	// Frames that change by themselves, clear ones while loading included
+	bool capturing = !mRecordingDirectory.empty() || (mFrameCapture && mFrameCapture->streaming());
+	bool animated = mAnimate || mDragState.coasting() || mShowHud || mBenchmark || capturing;
+	bool loading = !readyToDraw() || mAssetLoader->pendingCount() > 0 || mPipelineCache->pendingCount() > 0 || mResourceCache->streamingCount() > 0;
+	bool resizing = mResizePending || mLiveResize;
+	bool settling = (mTemporalAA && !mTemporalAA->settled())
+		|| (mAmbientOcclusion && mAmbientOcclusionEnabled && !mAmbientOcclusion->settled());
+	return mFrameDirty || animated || loading || resizing || settling;
+}
+
+double Application::currentTime() const
+{
+	if (mInputReplay && mInputReplay->started()) return mInputReplay->time();
+	if (mBenchmark) return mBenchmark->time();
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	// GLFW is not initialized in the worker
+	return emscripten_get_now() / 1000.0;
+#else
+	return glfwGetTime();
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
+}
+
+bool Application::initHud()
+{
+	TRACE_SCOPE("initHud");
+	mHud = std::make_unique<Hud>(mDevice, *mPipelineCache, mSurfaceFormat);
+	return true;
+}
+
+void Application::terminateHud()
+{
+	mHud.reset();
+}
+
+bool Application::initFrameCapture()
+{
+	TRACE_SCOPE("initFrameCapture");
+	bool enabled = false;
+	if (const char* capture = std::getenv("LEARNWEBGPU_CAPTURE")) {
+		uint32_t value = 0;
+		auto result = std::from_chars(capture, capture + std::strlen(capture), value);
+		if (result.ec == std::errc() && *result.ptr == '\0' && value <= 1) {
+			enabled = value == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_CAPTURE '" << capture << "', expected 0 or 1" << std::endl;
+		}
+	}
+	const char* streamPath = std::getenv("LEARNWEBGPU_STREAM");
+#ifdef __EMSCRIPTEN__
+	// Frames would pile up in the in-memory file system
+	if (streamPath) {
+		std::cerr << "Ignoring LEARNWEBGPU_STREAM, frame streams need a native file system" << std::endl;
+		streamPath = nullptr;
+	}
+#endif // __EMSCRIPTEN__
+	if (!enabled && !streamPath) return true;
+	if (!FrameCapture::supports(mSurfaceFormat)) {
+		std::cerr << "Cannot capture frames of surface format " << static_cast<int>(WGPUTextureFormat(mSurfaceFormat)) << ", captures disabled" << std::endl;
+		return true;
+	}
+	mFrameCapture = std::make_unique<FrameCapture>(mDevice);
+	if (streamPath) mFrameCapture->openStream(streamPath);
+	return true;
+}
+
+void Application::terminateFrameCapture()
+{
+	mFrameCapture.reset();
+	mScreenshotRequested = false;
+}
+
+void Application::encodeFrameCapture(CommandEncoder encoder)
+{
+	uint32_t width = mSurfaceTexture.getWidth();
+	uint32_t height = mSurfaceTexture.getHeight();
+	if (mScreenshotRequested) {
+		mScreenshotRequested = false;
+		std::string path = "screenshot-" + std::to_string(++mScreenshotCount) + ".png";
+		if (mFrameCapture->capture(encoder, mSurfaceTexture, width, height, path)) {
+			std::cout << "Saving screenshot to " << path << std::endl;
+		}
+		else {
+			std::cerr << "Could not capture a screenshot, every readback buffer being in use" << std::endl;
+		}
+	}
+	// Numbered without gaps, which video encoders expect of image sequences, dropped frames
+	// being reported when the recording stops
+	if (!mRecordingDirectory.empty()) {
+		char name[32];
+		std::snprintf(name, sizeof(name), "frame-%06u.png", mRecordedFrameCount);
+		if (mFrameCapture->capture(encoder, mSurfaceTexture, width, height, mRecordingDirectory + "/" + name)) ++mRecordedFrameCount;
+	}
+}
+
+void Application::updateHud()
+{
+	using Clock = std::chrono::steady_clock;
+	using Milliseconds = std::chrono::duration<double, std::milli>;
+	// Often enough to follow trends, rarely enough to be read
+	constexpr Clock::duration updateInterval = std::chrono::milliseconds(250);
+
+	Clock::time_point now = Clock::now();
+	FrameStats frame = mFrameStats;
+	mFrameStats = FrameStats{};
+	mFrameStats.start = now;
+
+	if (!mShowHud || frame.start == Clock::time_point{}) {
+		// Start over when shown, with text from the first frame on
+		mHudUpdateStart = now - updateInterval;
+		mHudFrameCount = 0;
+		mHudFrameMs = 0.0;
+		mHudCpuMs = 0.0;
+		mHudAllocationCount = 0;
+		mHudUploadedBytes = uploadedBytes();
+		return;
+	}
+
+	++mHudFrameCount;
+	mHudFrameMs += Milliseconds(now - frame.start).count();
+	mHudCpuMs += Milliseconds(frame.cpuDuration).count();
+	mHudAllocationCount += StartupProfiler::now().allocationCount - frame.allocationCountStart;
+	if (now - mHudUpdateStart < updateInterval) return;
+
+	TRACE_SCOPE("updateHud");
+	double frameMs = mHudFrameMs / mHudFrameCount;
+	double cpuMs = mHudCpuMs / mHudFrameCount;
+	uint64_t totalUploadedBytes = uploadedBytes();
+	double uploadedBytesPerFrame = double(totalUploadedBytes - mHudUploadedBytes) / mHudFrameCount;
+	double allocationsPerFrame = double(mHudAllocationCount) / mHudFrameCount;
+
+	std::vector<std::string> lines;
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(2);
+	auto endLine = [&]() {
+		lines.push_back(line.str());
+		line.str("");
+	};
+
+	line << "Frame " << std::setw(6) << frameMs << " ms  " << std::setprecision(0) << 1000.0 / frameMs << " FPS" << std::setprecision(2);
+	endLine();
+	line << "CPU   " << std::setw(6) << cpuMs << " ms";
+	endLine();
+	if (mGpuProfiler->enabled()) {
+		for (const GpuProfiler::PassTiming& timing : mGpuProfiler->timings()) {
+			line << "GPU " << std::left << std::setw(15) << timing.name << std::right << std::setw(6) << timing.averageMs << " ms";
+			endLine();
+		}
+		// Passes overlapping across command buffers take less time from end to end than in total
+		line << "GPU passes " << std::setw(6) << mGpuProfiler->lastFrameMs() << " ms  span " << mGpuProfiler->lastSpanMs() << " ms";
+		endLine();
+	}
+	else {
+		line << "GPU   no timestamp queries";
+		endLine();
+	}
+	// Averages, what passes spare the GPU showing as fewer invocations
+	for (const PipelineStatistics::PassStatistics& pass : mPipelineStatistics->statistics()) {
+		using Statistic = PipelineStatistics::Statistic;
+		line << "    " << std::left << std::setw(15) << pass.name << std::right;
+		if (pass.averageOf(Statistic::ComputeInvocations) > 0.0) {
+			line << " cs " << formatWithPrefix(pass.averageOf(Statistic::ComputeInvocations), "", 1000.0);
+		}
+		else {
+			line << " vs " << formatWithPrefix(pass.averageOf(Statistic::VertexInvocations), "", 1000.0)
+				<< " prims " << formatWithPrefix(pass.averageOf(Statistic::ClipperPrimitivesOut), "", 1000.0)
+				<< " fs " << formatWithPrefix(pass.averageOf(Statistic::FragmentInvocations), "", 1000.0);
+		}
+		endLine();
+	}
+	// Of the last frame only, the others since the last update being alike
+	FrameCounts counts = FrameCounters::lastFrame();
+	line << "Draws " << counts[FrameCounter::DrawCalls] << "  instances " << counts[FrameCounter::Instances]
+		<< "  triangles " << (frame.allInstancesCounted ? "<= " : "") << formatWithPrefix(double(counts[FrameCounter::TrianglesSubmitted]), "", 1000.0);
+	if (!mGpuCulling) line << " (" << formatWithPrefix(double(counts[FrameCounter::TrianglesCulled]), "", 1000.0) << " culled)";
+	endLine();
+	line << "Pipelines " << counts[FrameCounter::PipelineSwitches] << "  bind groups " << counts[FrameCounter::BindGroupSwitches]
+		<< "  redundant " << counts[FrameCounter::StateChangesFiltered]
+		<< "  buffers and textures +" << counts[FrameCounter::ObjectsCreated] << " -" << counts[FrameCounter::ObjectsDestroyed];
+	endLine();
+	line << "Uploads " << formatWithPrefix(uploadedBytesPerFrame, "B", 1024.0) << "/frame";
+	if (mResourceCache->streamingCount() > 0) line << " (streaming " << formatWithPrefix(double(mUploadBudget->bytes()), "B", 1024.0) << "/frame)";
+	if (uint64_t entered = mPrefetchHitCount + mPrefetchMissCount; entered > 0) {
+		line << "  prefetch hits " << std::setprecision(0) << 100.0 * double(mPrefetchHitCount) / double(entered) << "% of " << entered << std::setprecision(2);
+	}
+	endLine();
+	line << "Heap allocs " << std::setprecision(1) << allocationsPerFrame << "/frame (main thread)" << std::setprecision(2);
+	endLine();
+	// Of all threads, the subsystems holding or allocating nothing being left out
+	if (MemoryProfiler::enabled()) {
+		MemoryProfiler::Usage memory = MemoryProfiler::total();
+		line << "CPU memory " << formatWithPrefix(double(memory.liveBytes), "B", 1024.0) << "  peak " << formatWithPrefix(double(memory.peakBytes), "B", 1024.0)
+			<< "  " << memory.lastFrameAllocationCount << " allocs " << formatWithPrefix(double(memory.lastFrameAllocatedBytes), "B", 1024.0) << "/frame";
+		endLine();
+		for (size_t s = 0; s < static_cast<size_t>(MemorySubsystem::Count); ++s) {
+			MemorySubsystem subsystem = static_cast<MemorySubsystem>(s);
+			MemoryProfiler::Usage usage = MemoryProfiler::usage(subsystem);
+			if (usage.liveBytes <= 0 && usage.lastFrameAllocationCount == 0) continue;
+			line << "    " << std::left << std::setw(17) << memorySubsystemName(subsystem) << std::right
+				<< std::setw(9) << formatWithPrefix(double(std::max<int64_t>(usage.liveBytes, 0)), "B", 1024.0)
+				<< "  peak " << std::setw(9) << formatWithPrefix(double(usage.peakBytes), "B", 1024.0)
+				<< "  " << usage.lastFrameAllocationCount << "/frame";
+			endLine();
+		}
+	}
+	line << "GPU memory " << formatWithPrefix(double(gpuMemorySize()), "B", 1024.0) << "  peak " << formatWithPrefix(double(GpuMemoryTracker::highWaterMark()), "B", 1024.0);
+	if (GpuMemoryTracker::budget() > 0) line << " / " << formatWithPrefix(double(GpuMemoryTracker::budget()), "B", 1024.0);
+	endLine();
+	glm::uvec2 sceneSize = renderSize();
+	line << "Render " << sceneSize.x << "x" << sceneSize.y << std::setprecision(0) << " (" << 100.0 * sceneSize.x / mWindowWidth << "%)  "
+		<< sceneFormatName(mSceneFormat);
+	if (mShadingRate && mAdaptiveShading) line << "  adaptive shading";
+	if (mTemporalAA) line << (mTemporalAA->mode() == TemporalAA::Mode::Reuse ? "  temporal reuse" : "  TAA");
+	if (mAmbientOcclusion && mAmbientOcclusionEnabled) line << "  AO 1/" << mAmbientOcclusion->downscale();
+	// What the G-buffer costs in bandwidth, to weigh against the time of the lighting pass
+	if (mDeferredShading) {
+		double gbufferBytes = double(DeferredShading::gbufferBytes(sceneSize));
+		line << "  deferred G-buffer " << formatWithPrefix(gbufferBytes, "B", 1024.0) << "/frame "
+			<< formatWithPrefix(gbufferBytes * 1000.0 / frameMs, "B", 1024.0) << "/s";
+	}
+	if (!mRecordingDirectory.empty()) line << "  recording";
+	if (mFrameCapture && mFrameCapture->streaming()) line << "  streaming " << mFrameCapture->streamedCount() << " frames";
+	endLine();
+	if (mFrameGovernor) {
+		const PowerState& power = mFrameGovernor->powerState();
+		line << "Governor " << FrameGovernor::presetName(mFrameGovernor->preset()) << std::setprecision(0) << " " << mFrameGovernor->targets().frameRate
+			<< " Hz  " << powerSourceName(power.source) << " power";
+		if (power.batteryLevel >= 0.0f) line << " " << 100.0f * power.batteryLevel << "%";
+		line << "  thermal " << thermalStateName(power.thermal) << std::setprecision(2);
+		endLine();
+	}
+	// Only the optional passes doing less than they could
+	if (mPassBudget) {
+		bool degraded = false;
+		for (PassBudget::WorkId work = 0; work < mPassBudget->workCount(); ++work) {
+			if (mPassBudget->level(work) == PassBudget::Level::Full) continue;
+			line << (degraded ? "  " : "Pass budget  ") << mPassBudget->name(work) << " " << PassBudget::levelName(mPassBudget->level(work));
+			degraded = true;
+		}
+		if (degraded) endLine();
+	}
+	if (mAssetSync) {
+		AssetSync::Statistics sync = mAssetSync->statistics();
+		line << "Asset sync " << sync.updatedFileCount << " files  " << formatWithPrefix(double(sync.downloadedBytes), "B", 1024.0)
+			<< " downloaded  " << formatWithPrefix(double(sync.reusedBytes), "B", 1024.0) << " reused";
+		if (sync.failedFileCount > 0) line << "  " << sync.failedFileCount << " failed";
+		endLine();
+	}
+	mHud->setText(lines);
+
+	mHudUpdateStart = now;
+	mHudFrameCount = 0;
+	mHudFrameMs = 0.0;
+	mHudCpuMs = 0.0;
+	mHudAllocationCount = 0;
+	mHudUploadedBytes = totalUploadedBytes;
+}
+
+void Application::updateFrameCounters()
+{
+	FrameCounters::endFrame();
+	MemoryProfiler::endFrame();
+	// Before updateHud() starts the next frame
+	if (mHitchDetector && mFrameStats.start != std::chrono::steady_clock::time_point{}) {
+		using Nanoseconds = std::chrono::nanoseconds;
+		HitchDetector::Frame& frame = mHitchDetector->next();
+		frame.start = std::chrono::duration_cast<Nanoseconds>(mFrameStats.start.time_since_epoch()).count();
+		frame.duration = std::chrono::duration_cast<Nanoseconds>(std::chrono::steady_clock::now() - mFrameStats.start).count();
+		frame.cpuDuration = std::chrono::duration_cast<Nanoseconds>(mFrameStats.cpuDuration).count();
+		frame.idle = mFrameStats.idle;
+		frame.counts = FrameCounters::lastFrame();
+		mHitchDetector->commit(mGpuProfiler->timings());
+	}
+	if (mMetricsPath.empty()) return;
+	auto now = std::chrono::steady_clock::now();
+	if (now - mMetricsWriteTime < std::chrono::seconds(1)) return;
+	mMetricsWriteTime = now;
+
+	// Renamed once complete, so that a scraper never reads a partial file
+	TRACE_SCOPE("Write metrics");
+	bool written = writeFileAtomically(mMetricsPath, [](std::ostream& file) {
+		FrameCounters::writePrometheus(file);
+		return true;
+	});
+	if (!written) {
+		std::cerr << "Giving up writing metrics" << std::endl;
+		mMetricsPath.clear();
+	}
+}
+
+uint64_t Application::uploadedBytes() const
+{
+	uint64_t tileBytes = mVirtualTextures ? mVirtualTextures->uploadedBytes() : 0;
+	return mUploadedBytes + mUniformRing->uploadedBytes() + mDrawConstants->uploadedBytes() + mResourceCache->uploadedBytes() + tileBytes;
+}
+
+uint64_t Application::gpuMemorySize() const
+{
+	uint64_t size = GpuMemoryTracker::total();
+	if (!mOffscreenTexture) {
+		// Surface textures are not exposed, assume a swap chain of 3 with 4 bytes per texel
+		size += 3ull * mWindowWidth * mWindowHeight * 4;
+	}
+	return size;
+}
+
+void Application::writeBuffer(Buffer buffer, uint64_t offset, const void* data, size_t size)
+{
+	mUploadedBytes += size;
+	FrameCounters::add(FrameCounter::BytesWritten, size);
+	mQueue.writeBuffer(buffer, offset, data, size);
+}
+
+void Application::onFinish()
+{
+	if (mInitState != InitState::Ready) {
+		// Only parts of the application exist, which all tolerate being terminated
+		mScene.clear();
+		terminateAssetLoading();
+		terminateWindowAndDevice();
+		return;
+	}
+
+	if (mBenchmark) {
+		mBenchmark->writeReport(mGpuProfiler->timings(), mPipelineStatistics->statistics());
+	}
+	if (mScenarioBenchmark) {
+		const std::string& path = mBenchmark->options().gpuProfilePath;
+		if (mScenarioBenchmark->writeProfile(path, mGpuProfiler->timings(), mAdapterDescription)) {
+			std::cout << "Wrote GPU profile to " << path << std::endl;
+		}
+	}
+	// With the peaks of the whole run, before the scene is released
+	if (MemoryProfiler::enabled()) {
+		MemoryProfiler::printReport(std::cout);
+	}
+
+  // Each part of the renderer takes care of cleaning up after itself, call in reverse order
+  terminateHud();
+  terminateAssetLoading();
+  terminateDeviceResources();
+  terminateWindowAndDevice();
+
+	if (mInputRecorder && mInputRecorder->started()) {
+		std::cout << "Recorded " << mInputRecorder->frameCount() << " frames of input" << std::endl;
+		mInputRecorder.reset();
+	}
+	Log::flush();
+	if (!mTracePath.empty()) {
+		Trace::stop();
+		if (Trace::writeChromeTrace(mTracePath)) {
+			std::cout << "Wrote CPU trace to " << mTracePath << std::endl;
+		}
+	}
+}
+
+void Application::terminateDeviceResources()
+{
+  terminateBindGroup();
+  terminateCulling();
+  terminateInstances();
+  terminateUniforms();
+  terminateGeometry();
+  terminateTexture();
+  terminateRenderPipeline();
+  terminateViews();
+  terminateAmbientOcclusion();
+  terminateTemporalAA();
+  terminateShadingRate();
+  terminateTextureFeedback();
+  terminateVirtualTextures();
+  terminateImposters();
+  terminatePointCloud();
+  terminateTerrain();
+  terminateParticles();
+  terminateOcclusionQueries();
+  terminatePicking();
+  terminateDeferredShading();
+  terminateLightBaker();
+  terminateEnvironmentLighting();
+  terminatePointLights();
+  terminateShadowMaps();
+  terminateDepthPyramid();
+  terminateDepthBuffer();
+  terminateSurfaceConfig();
+  terminateFrameCapture();
+}
+
+void Application::recoverFromDeviceLoss()
+{
+	TRACE_SCOPE("recoverFromDeviceLoss");
+	mRecoveryStart = Trace::now();
+	// Only parts of the application may exist, which all tolerate being terminated
+	terminateHud();
+	terminateAssetLoading();
+	terminateDeviceResources();
+	terminateDevice();
+	// Once released, which may call the lost callback again
+	mDeviceLost = false;
+	mScene.clear();
+	mAcquireFailureCount = 0;
+	mAcquireRetryTime = {};
+	mSurfaceReconfigurePending = false;
+
+#ifdef __EMSCRIPTEN__
+	// The canvas context would need to be configured again for a new device
+	std::cerr << "Cannot recover from the loss of the device in the browser" << std::endl;
+	mInitState = InitState::Failed;
+#else
+	std::cerr << "Recreating the device" << std::endl;
+	// The instance was released with the adapter, and the surface belongs to it
+	if (!initInstance()) {
+		mInitState = InitState::Failed;
+		return;
+	}
+	// Surfaces are created on the main thread, which alone may attach layers to windows (e.g. Metal
+	// layers on macOS); in the render thread mode this waits for it
+	runOnMainThread([this]() {
+		if (mWindow) {
+			mSurface.release();
+			mSurface = glfwGetWGPUSurface(mInstance, mWindow);
+		}
+		for (std::unique_ptr<View>& view : mViews) {
+			view->recreateSurface(mInstance);
+		}
+	}, true);
+	// Assets load again meanwhile, as on startup, but from the retained data if any rather than
+	// from the files
+	if (mRetainedAssets) {
+		std::cerr << "Uploading " << formatWithPrefix(double(mRetainedAssets->byteSize()), "B", 1024.0) << " of retained assets again" << std::endl;
+	}
+	if (!initAssetLoading()) {
+		mInitState = InitState::Failed;
+		return;
+	}
+	mInitState = InitState::RequestingDevice;
+	requestDevice();
+#endif // __EMSCRIPTEN__
+}
+
+bool Application::isRunning()
+{
+	if (mInitState == InitState::Failed) return false;
+	if (mInputReplay && mInputReplay->finished()) return false;
+	if (mBenchmark) return mBenchmark->running();
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	// The canvas belongs to the page, which never closes it
+	return true;
+#else
+  return !glfwWindowShouldClose(mWindow);
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
+}
+
+// When resizing, we need to re-create the swap chain and depth buffer with the new size.
+void Application::onResize()
+{
+	// Add a ward
+	if (mWindowWidth <= 0 || mWindowHeight <= 0) return;
+
+	terminateSurfaceConfig();
+	configSurface();
+	updateRenderTargets();
+
+  updateProjectionMatrix();
+}
+
+void Application::updateRenderTargets()
+{
+	if (mWindowWidth <= 0 || mWindowHeight <= 0) return;
+
+	// Terminate in reverse order. The depth pyramid of the previous size is kept, unused,
+	// while the size keeps changing.
+	terminateCullingBindGroup();
+	if (!mLiveResize) terminateDepthPyramid();
+	terminateDepthBuffer();
+
+	// Re-init, the transient color targets following the size of the depth buffer
+	mSceneTarget = sceneTargetNeeded();
+	initDepthBuffer();
+	if (!mDepthPyramid) initDepthPyramid();
+	mDepthPyramidValid = false;
+	initCullingBindGroup();
+}
+
+void Application::onMouseMove(double xpos, double ypos)
+{
+	if (!acceptInput({ InputEvent::Type::MouseMove, 0, 0, xpos, ypos })) return;
+	mCursorPosition = { xpos, ypos };
+	// Events of the window may come while the device is still being requested
+	if (mInitState != InitState::Ready) return;
+	if (mDragState.active) {
+		glm::vec2 currentMouse = glm::vec2(-(float)xpos, (float)ypos);
+		glm::vec2 delta = (currentMouse - mDragState.startMouse) * mDragState.sensitivity;
+		mCameraState.angles = mDragState.startCameraState.angles + delta;
+		// Clamp to avoid going too far when orbiting up/down
+		mCameraState.angles.y = glm::clamp(mCameraState.angles.y, -glm::pi<float>() / 2 + 1e-5f, glm::pi<float>() / 2 - 1e-5f);
+		mViewDirty = true;
+	}
+}
+
+void Application::onMouseButton(int button, int action, int /*mods*/)
+{
+	double xpos = mCursorPosition.x, ypos = mCursorPosition.y;
+	// GLFW only answers on the main thread, which forwards the position with the event, as
+	// do replays
+	if (mWindow && !mRenderThread && !mReplayingInput) glfwGetCursorPos(mWindow, &xpos, &ypos);
+	if (!acceptInput({ InputEvent::Type::MouseButton, button, action, xpos, ypos })) return;
+	if (mInitState != InitState::Ready) return;
+	if (button == GLFW_MOUSE_BUTTON_LEFT) {
+		switch (action) {
+		case GLFW_PRESS:
+			mDragState.active = true;
+			mDragState.startMouse = glm::vec2(-(float)xpos, (float)ypos);
+			mDragState.startCameraState = mCameraState;
+			mDragState.previousAngles = mCameraState.angles;
+			mDragState.velocity = { 0.0f, 0.0f };
+			mClickPosition = { xpos, ypos };
+			break;
+		case GLFW_RELEASE:
+			mDragState.active = false;
+			mDragState.stepAngles = mCameraState.angles;
+			mDragState.previousStepAngles = mCameraState.angles;
+			// A click rather than a drag picks the instance under the cursor, on the CPU until
+			// the picking pipeline is built
+			if (glm::length(glm::vec2(mCursorPosition - mClickPosition)) >= 4.0f) break;
+			if (mObjectPicker && mObjectPicker->ready()) {
+				glm::vec2 texel = glm::vec2(mClickPosition) * glm::vec2(renderSize()) / glm::vec2(mWindowWidth, mWindowHeight);
+				mObjectPicker->request(glm::uvec2(glm::max(texel, glm::vec2(0.0f))));
+				mFrameDirty = true;
+			}
+			else {
+				pickWithRay(mClickPosition);
+			}
+			break;
+		}
+	}
+}
+
+void Application::onScroll(double xoffset, double yoffset)
+{
+	if (!acceptInput({ InputEvent::Type::Scroll, 0, 0, xoffset, yoffset })) return;
+	if (mInitState != InitState::Ready) return;
+	mCameraState.zoom += mDragState.scrollSensitivity * static_cast<float>(yoffset);
+	mCameraState.zoom = glm::clamp(mCameraState.zoom, -2.0f, 2.0f);
+	mViewDirty = true;
+}
+
+void Application::onKey(int key, int /*scancode*/, int action, int /*mods*/)
+{
+	if (!acceptInput({ InputEvent::Type::Key, key, action, 0.0, 0.0 })) return;
+	if (mInitState != InitState::Ready) return;
+	// Whatever the key changes, the next frame shows it
+	if (action == GLFW_PRESS) mFrameDirty = true;
+	// Space pauses and resumes the animation
+	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
+		mAnimate = !mAnimate;
+	}
+	// P switches the depth pre-pass on and off, which does not draw the eyes of stereo
+	if (key == GLFW_KEY_P && action == GLFW_PRESS && !mStereo) {
+		mDepthPrePass = !mDepthPrePass;
+		std::cout << "Depth pre-pass " << (mDepthPrePass ? "on" : "off") << std::endl;
+	}
+	// D switches rendering on demand on and off
+	if (key == GLFW_KEY_D && action == GLFW_PRESS) {
+		mRenderOnDemand = !mRenderOnDemand;
+		std::cout << "Render on demand " << (mRenderOnDemand ? "on" : "off") << std::endl;
+	}
+	// R switches dynamic resolution on and off
+	if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+		mDynamicResolution = !mDynamicResolution;
+		mResolutionController->reset();
+		mDepthPyramidValid = false;
+		std::cout << "Dynamic resolution " << (mDynamicResolution ? "on" : "off") << std::endl;
+	}
+	// H shows and hides the performance overlay
+	if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+		mShowHud = !mShowHud;
+	}
+	// T prints the GPU time of each pass
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		if (mGpuProfiler->enabled()) {
+			mGpuProfiler->printTimings(std::cout);
+		}
+		else {
+			std::cout << "GPU timings are not available, the device does not support timestamp queries" << std::endl;
+		}
+		if (mPipelineStatistics->enabled()) {
+			mPipelineStatistics->printStatistics(std::cout);
+		}
+	}
+	// M prints what the GPU memory is taken by, and the CPU memory with LEARNWEBGPU_MEMORY_PROFILE=1
+	if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+		GpuMemoryTracker::printReport(std::cout);
+		if (MemoryProfiler::enabled()) MemoryProfiler::printReport(std::cout);
+	}
+	// B sorts particles back to front and alpha blends them, rather than adding them up
+	if (key == GLFW_KEY_B && action == GLFW_PRESS && mParticles) {
+		mParticles->setSorted(!mParticles->sorted());
+		std::cout << "Sorted particles " << (mParticles->sorted() ? "on" : "off") << std::endl;
+	}
+	// O makes the model half transparent, and opaque again
+	if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+		bool transparent = !mScene.materials()[mModelMaterial].transparent();
+		mScene.setMaterialOpacity(mModelMaterial, transparent ? 0.5f : 1.0f);
+		std::cout << "Transparent model " << (transparent ? "on" : "off") << std::endl;
+	}
+	// I switches transparent draws between sorting and weighted blended order-independent transparency
+	if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+		mWeightedTransparency = !mWeightedTransparency;
+		std::cout << "Weighted blended transparency " << (mWeightedTransparency ? "on" : "off") << std::endl;
+	}
+	// A switches ambient occlusion on and off
+	if (key == GLFW_KEY_A && action == GLFW_PRESS && mAmbientOcclusion) {
+		mAmbientOcclusionEnabled = !mAmbientOcclusionEnabled;
+		mAmbientOcclusion->restartSettling();
+		std::cout << "Ambient occlusion " << (mAmbientOcclusionEnabled ? "on" : "off") << std::endl;
+	}
+	// V switches adaptive shading rates on and off, printing the GPU time the scene took until then
+	if (key == GLFW_KEY_V && action == GLFW_PRESS && mShadingRate) {
+		if (mGpuProfiler->enabled()) {
+			double sceneMs = 0.0;
+			for (const GpuProfiler::PassTiming& timing : mGpuProfiler->timings()) {
+				// Those of the shading rate passes are left over from when they last ran
+				bool shadingRatePass = timing.name.starts_with("Shading rate");
+				if (timing.name == "Main pass" || (shadingRatePass && mAdaptiveShading)) sceneMs += timing.averageMs;
+			}
+			std::cout << "Main pass with adaptive shading " << (mAdaptiveShading ? "on" : "off") << ": " << sceneMs << " ms" << std::endl;
+		}
+		mAdaptiveShading = !mAdaptiveShading;
+		mShadingRateResetNeeded = !mAdaptiveShading;
+		std::cout << "Adaptive shading " << (mAdaptiveShading ? "on" : "off") << std::endl;
+	}
+	// F12 saves a screenshot of the next frame, with LEARNWEBGPU_CAPTURE=1
+	if (key == GLFW_KEY_F12 && action == GLFW_PRESS && mFrameCapture) {
+		mScreenshotRequested = true;
+	}
+	// F11 starts and stops saving every frame to a new directory, with LEARNWEBGPU_CAPTURE=1
+	if (key == GLFW_KEY_F11 && action == GLFW_PRESS && mFrameCapture) {
+		if (mRecordingDirectory.empty()) {
+			std::string directory = "capture-" + std::to_string(++mRecordingCount);
+			std::error_code error;
+			std::filesystem::create_directories(directory, error);
+			if (error) {
+				std::cerr << "Could not create " << directory << ": " << error.message() << std::endl;
+			}
+			else {
+				mRecordingDirectory = directory;
+				mRecordedFrameCount = 0;
+				mRecordingDroppedStart = mFrameCapture->droppedCount();
+				std::cout << "Recording frames to " << directory << std::endl;
+			}
+		}
+		else {
+			std::cout << "Recorded " << mRecordedFrameCount << " frames to " << mRecordingDirectory
+				<< ", " << mFrameCapture->droppedCount() - mRecordingDroppedStart << " dropped" << std::endl;
+			mRecordingDirectory.clear();
+		}
+	}
+}
+
+bool Application::initInstanceAndWindow()
+{
+	TRACE_SCOPE("initInstanceAndWindow");
+	if (!initInstance()) return false;
+
+	// Benchmarks render to an offscreen texture, without window nor surface
+	return mBenchmark || initWindow(mInstance);
+}
+
+bool Application::initInstance()
+{
+	{
+		STARTUP_STAGE("Instance");
+#ifdef __EMSCRIPTEN__
+		mInstance = createInstance();
+#else
+		InstanceDescriptor instanceDesc{};
+		mInstance = createInstance(instanceDesc);
+#endif // ! __EMSCRIPTEN__
+	}
+
+	// Check if the instance was created successfully
+	if (!mInstance) {
+		std::cerr << "Failed to create WebGPU instance. Could not initialize WebGPU" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void Application::requestDevice()
+{
+	TRACE_SCOPE("requestDevice");
+	std::cout << "Requesting adapter..." << std::endl;
+	RequestAdapterOptions adapterOpts{};
+	adapterOpts.compatibleSurface = mSurface;
+	adapterOpts.powerPreference = mPowerPreference;
+	if (const char* powerPreference = std::getenv("LEARNWEBGPU_POWER_PREFERENCE"); powerPreference && mPowerPreference == PowerPreference::Undefined) {
+		if (!parsePowerPreference(powerPreference, adapterOpts.powerPreference)) {
+			std::cerr << "Ignoring unknown LEARNWEBGPU_POWER_PREFERENCE '" << powerPreference << "'" << std::endl;
+		}
+	}
+
+	// Score all the adapters rather than taking the first one, which on machines with
+	// several GPUs is often the integrated one
+	mRequestStart = Trace::now();
+	selectAdapterAsync(mInstance, &adapterOpts, [this](WGPUAdapter adapter) {
+		onAdapterSelected(adapter);
+	});
+}
+
+void Application::onAdapterSelected(Adapter adapter)
+{
+	StartupProfiler::recordSpan("Adapter", mRequestStart, Trace::now());
+	if (!adapter) {
+		std::cerr << "Could not find a suitable WebGPU adapter" << std::endl;
+		mInitState = InitState::Failed;
+		return;
+	}
+	std::cout << "Got adapter: " << adapter << std::endl;
+	mAdapter = adapter;
+
+	if (mBenchmark) {
+		mSurfaceFormat = TextureFormat::RGBA8Unorm;
+	}
+	else {
+		mSurfaceFormats = SurfaceFormat::select(mSurface, adapter);
+		mSurfaceFormat = mSurfaceFormats.viewFormat;
+		std::cout << "Surface format: " << mSurfaceFormats.describe() << std::endl;
+
+		// Used by configSurface, once checked against what the surface supports
+		mPresentMode = FramePacer::selectPresentMode(mSurface, adapter, mPresentMode);
+	}
+
+	std::cout << "Requesting device..." << std::endl;
+	DeviceDescriptor deviceDesc{};
+
+	// Enable the texture compression formats that the adapter supports, for KTX2 textures,
+	// timestamp queries for the GPU profiler, and rendering to the packed float format that
+	// halves the bandwidth of the HDR scene
+	std::vector<WGPUFeatureName> requiredFeatures;
+	for (FeatureName feature : {
+		FeatureName::TextureCompressionBC, FeatureName::TextureCompressionETC2, FeatureName::TextureCompressionASTC,
+		FeatureName::TimestampQuery, FeatureName::RG11B10UfloatRenderable
+	}) {
+		if (adapter.hasFeature(feature)) requiredFeatures.push_back(feature);
+	}
+	// And the pipeline statistics queries of wgpu-native, counting shader invocations per pass
+	if (PipelineStatistics::supported(adapter)) {
+		PipelineStatistics::require(requiredFeatures);
+	}
+
+	// The uniforms of each batch are push constants where wgpu-native has them, unless
+	// LEARNWEBGPU_PUSH_CONSTANTS=0 keeps them in a uniform buffer
+	if (const char* pushConstants = std::getenv("LEARNWEBGPU_PUSH_CONSTANTS")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(pushConstants, pushConstants + std::strlen(pushConstants), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mPushConstants = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_PUSH_CONSTANTS '" << pushConstants << "', expected 0 or 1" << std::endl;
+		}
+	}
+	bool pushConstants = mPushConstants && DrawConstants::supported(adapter, sizeof(DrawUniforms));
+
+	// Runs of opaque batches are drawn by single multi-draw calls where wgpu-native has them,
+	// unless LEARNWEBGPU_MULTI_DRAW=0 keeps one indirect draw per batch
+	if (const char* multiDraw = std::getenv("LEARNWEBGPU_MULTI_DRAW")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(multiDraw, multiDraw + std::strlen(multiDraw), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mMultiDraw = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_MULTI_DRAW '" << multiDraw << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (mMultiDraw && MultiDraw::supported(adapter)) {
+		MultiDraw::require(requiredFeatures);
+		if (MultiDraw::countSupported(adapter)) MultiDraw::requireCount(requiredFeatures);
+	}
+	// The opaque scene is shaded as it is drawn, unless LEARNWEBGPU_SHADING=deferred writes it
+	// to a G-buffer lit by a compute pass, whose bind group comes after those of the draws
+	if (const char* shading = std::getenv("LEARNWEBGPU_SHADING")) {
+		if (std::strcmp(shading, "forward") == 0 || std::strcmp(shading, "deferred") == 0) {
+			mDeferredShadingRequested = std::strcmp(shading, "deferred") == 0;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_SHADING '" << shading << "', expected forward or deferred" << std::endl;
+		}
+	}
+	deviceDesc.requiredFeatureCount = requiredFeatures.size();
+	deviceDesc.requiredFeatures = requiredFeatures.data();
+	deviceDesc.defaultQueue.nextInChain = nullptr;
+	
+	// A function that is invoked whenever the device stops being available. Unless destroyed
+	// on purpose, a new one is requested by the next frame, e.g. after a driver reset.
+	deviceDesc.deviceLostCallback = [](WGPUDeviceLostReason reason, char const* message, void* pUserData) {
+		// Called from within the driver, which must not wait on the console
+		LOG_ERROR("Device lost: reason " << reason << (message ? " (" : "") << (message ? message : "") << (message ? ")" : ""));
+		if (reason != WGPUDeviceLostReason_Destroyed) {
+			reinterpret_cast<Application*>(pUserData)->mDeviceLost = true;
+		}
+		};
+	deviceDesc.deviceLostUserdata = this;
+
+#ifdef __EMSCRIPTEN__
+	deviceDesc.requiredLimits = nullptr;
+#else
+	RequiredLimits requiredLimits = getRequiredLimits(adapter);
+	deviceDesc.requiredLimits = &requiredLimits;
+#ifdef WEBGPU_BACKEND_WGPU
+	WGPURequiredLimitsExtras requiredLimitsExtras{};
+	if (pushConstants) {
+		DrawConstants::require(requiredFeatures, requiredLimits, requiredLimitsExtras, sizeof(DrawUniforms));
+		deviceDesc.requiredFeatureCount = requiredFeatures.size();
+		deviceDesc.requiredFeatures = requiredFeatures.data();
+	}
+#endif // WEBGPU_BACKEND_WGPU
+#endif
+
+	// The descriptor is read right away, the callback may come much later
+	mRequestStart = Trace::now();
+	mRequestDeviceCallback = adapter.requestDevice(deviceDesc, [this](RequestDeviceStatus status, Device device, char const* message) {
+		StartupProfiler::recordSpan("Device", mRequestStart, Trace::now());
+		if (status != RequestDeviceStatus::Success) {
+			std::cerr << "Could not get WebGPU device: " << (message ? message : "unknown error") << std::endl;
+			mInitState = InitState::Failed;
+			return;
+		}
+		std::cout << "Got device: " << device << std::endl;
+		mDevice = device;
+		mInitState = InitState::DeviceReady;
+	});
+}
+
+bool Application::initDevice()
+{
+	TRACE_SCOPE("initDevice");
+	mRequestDeviceCallback.reset();
+	// The machine profile and the workgroup sizes describe the adapter, which is not kept
+	mAdapterDescription = AdapterDescription::of(mAdapter);
+	bool gpuProfile = mBenchmark && !mBenchmark->options().gpuProfilePath.empty();
+#ifndef __EMSCRIPTEN__
+	// Requested while the instance and the adapter are still there
+	if (const char* workerDevice = std::getenv("LEARNWEBGPU_WORKER_DEVICE")) {
+		WorkerDevice::Placement placement = WorkerDevice::Placement::SameAdapter;
+		if (!WorkerDevice::parsePlacement(workerDevice, placement)) {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_WORKER_DEVICE '" << workerDevice << "', expected same, low-power or high-performance" << std::endl;
+		}
+		else {
+			mWorkerDevice = WorkerDevice::create(mInstance, mAdapter, placement);
+			if (!mWorkerDevice) std::cerr << "Running background GPU jobs on the interactive device" << std::endl;
+		}
+	}
+#endif // __EMSCRIPTEN__
+	mAdapter.release();
+	mAdapter = nullptr;
+	// It is good practice to release the instance as soon as we have what we need from it.
+	mInstance.release();
+	mInstance = nullptr;
+
+	// A function that is invoked whenever there is an error in the use of the device
+	mUncapturedErrorCallbackHandle = mDevice.setUncapturedErrorCallback([](ErrorType type, char const* message) {
+		LOG_ERROR("Uncaptured device error: type " << WGPUErrorType(type) << (message ? " (" : "") << (message ? message : "") << (message ? ")" : ""));
+		});
+
+	mQueue = mDevice.getQueue();
+
+	// WebGPU does not tell how much memory the device has, e.g. set 1500 on a 2 GB integrated GPU
+	if (const char* budget = std::getenv("LEARNWEBGPU_GPU_MEMORY_BUDGET")) {
+		uint64_t megabytes = 0;
+		auto result = std::from_chars(budget, budget + std::strlen(budget), megabytes);
+		if (result.ec == std::errc() && *result.ptr == '\0') {
+			GpuMemoryTracker::setBudget(megabytes << 20);
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_GPU_MEMORY_BUDGET '" << budget << "', expected a size in MiB" << std::endl;
+		}
+	}
+
+	// WebGPU only guarantees 1 and 4 samples, and webgpu.h cannot query more, so other
+	// counts are not offered
+	mSampleCount = 4;
+	if (const char* msaa = std::getenv("LEARNWEBGPU_MSAA")) {
+		uint32_t sampleCount = 0;
+		auto result = std::from_chars(msaa, msaa + std::strlen(msaa), sampleCount);
+		if (result.ec == std::errc() && *result.ptr == '\0' && (sampleCount == 1 || sampleCount == 4)) {
+			mSampleCount = sampleCount;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_MSAA '" << msaa << "', expected 1 or 4" << std::endl;
+		}
+	}
+	// The scene is drawn in HDR and post-processed into the surface texture, unless
+	// LEARNWEBGPU_POSTPROCESS=0 draws it to the surface format directly
+	if (const char* postProcess = std::getenv("LEARNWEBGPU_POSTPROCESS")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(postProcess, postProcess + std::strlen(postProcess), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mPostProcessing = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_POSTPROCESS '" << postProcess << "', expected 0 or 1" << std::endl;
+		}
+	}
+	// The HDR scene is drawn in the packed float format where the device renders to it, unless
+	// LEARNWEBGPU_HDR_FORMAT=rgba16float keeps the precision of half floats
+	bool preferHdrPrecision = false;
+	if (const char* hdrFormat = std::getenv("LEARNWEBGPU_HDR_FORMAT")) {
+		if (std::strcmp(hdrFormat, "auto") == 0 || std::strcmp(hdrFormat, "rgba16float") == 0) {
+			preferHdrPrecision = std::strcmp(hdrFormat, "rgba16float") == 0;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_HDR_FORMAT '" << hdrFormat << "', expected auto or rgba16float" << std::endl;
+		}
+	}
+	// The lighting pass writes the HDR scene as storage, one sample per pixel, which the surface
+	// texture cannot be written as
+	if (mDeferredShadingRequested && !mPostProcessing) {
+		std::cerr << "Deferred shading needs post-processing, shading forward" << std::endl;
+		mDeferredShadingRequested = false;
+	}
+	if (mDeferredShadingRequested) preferHdrPrecision = true;
+	mSceneFormat = mPostProcessing ? PostProcessing::selectSceneFormat(mDevice, preferHdrPrecision) : mSurfaceFormat;
+	std::cout << "Scene format: " << sceneFormatName(mSceneFormat) << std::endl;
+	if (mSampleCount > 1 && !supportsMultisampleResolve(mSceneFormat)) {
+		std::cerr << "Scene format " << mSceneFormat << " cannot be multisampled, disabling MSAA" << std::endl;
+		mSampleCount = 1;
+	}
+	if (mDeferredShadingRequested && mSampleCount > 1) {
+		std::cout << "Deferred shading: one sample per pixel, disabling MSAA" << std::endl;
+		mSampleCount = 1;
+	}
+	// Depths go from 0 near to 1 far in a Depth24Plus buffer, unless LEARNWEBGPU_REVERSED_Z=1
+	// reverses them into a Depth32Float one (see DepthConvention.h)
+	if (const char* reversedZ = std::getenv("LEARNWEBGPU_REVERSED_Z")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(reversedZ, reversedZ + std::strlen(reversedZ), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mDepthConvention.reversed = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_REVERSED_Z '" << reversedZ << "', expected 0 or 1" << std::endl;
+		}
+	}
+	mDepthTextureFormat = mDepthConvention.format();
+	if (mDepthConvention.reversed) mShaderDefines.insert("REVERSED_Z");
+	// Both eyes side by side in the same passes with LEARNWEBGPU_STEREO=1, without the features
+	// drawing or reading the frame from the single camera of the view uniforms
+	if (const char* stereo = std::getenv("LEARNWEBGPU_STEREO")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(stereo, stereo + std::strlen(stereo), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mStereo = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_STEREO '" << stereo << "', expected 0 or 1" << std::endl;
+		}
+	}
+	// vs_main reading the vertex pages as storage buffers with LEARNWEBGPU_VERTEX_PULLING=1
+	if (const char* pulling = std::getenv("LEARNWEBGPU_VERTEX_PULLING")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(pulling, pulling + std::strlen(pulling), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mVertexPulling = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_VERTEX_PULLING '" << pulling << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (mVertexPulling) mShaderDefines.insert("VERTEX_PULLING");
+	if (mStereo) {
+		std::cout << "Stereo: particles, terrain, point clouds, imposters, point lights, adaptive shading, temporal anti-aliasing, occlusion culling and the depth pre-pass are disabled" << std::endl;
+		mShaderDefines.insert("STEREO");
+		mParticleCapacity = 0;
+		mPointCloudPath.clear();
+		mClusteredLighting = false;
+		mOcclusionCulling = false;
+		mDepthPrePass = false;
+	}
+	// Transparent batches are sorted unless LEARNWEBGPU_TRANSPARENCY=weighted
+	if (const char* transparency = std::getenv("LEARNWEBGPU_TRANSPARENCY")) {
+		if (std::strcmp(transparency, "sorted") == 0 || std::strcmp(transparency, "weighted") == 0) {
+			mWeightedTransparency = std::strcmp(transparency, "weighted") == 0;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_TRANSPARENCY '" << transparency << "', expected sorted or weighted" << std::endl;
+		}
+	}
+
+	mPipelineCache = std::make_unique<PipelineCache>(mDevice);
+	// The pipelines earlier sessions requested start building now rather than when first drawn,
+	// and with LEARNWEBGPU_RECORD_PIPELINES=1 those of this session are added to them on exit
+	if (const char* recordPipelines = std::getenv("LEARNWEBGPU_RECORD_PIPELINES")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(recordPipelines, recordPipelines + std::strlen(recordPipelines), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mRecordPipelines = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_RECORD_PIPELINES '" << recordPipelines << "', expected 0 or 1" << std::endl;
+		}
+	}
+	mPipelineCache->setRecording(mRecordPipelines);
+	if (size_t precached = mPipelineCache->precache(pipelineManifestPath)) {
+		std::cout << "Precaching " << precached << " pipelines of " << pipelineManifestPath << std::endl;
+	}
+	mWorkgroupTuner = std::make_unique<WorkgroupTuner>(mDevice, *mPipelineCache, mAdapterDescription, workgroupSizesPath);
+	// Shaders declare the uniforms of batches as an array for multi-draws, or as push constants,
+	// if the device has them
+	DrawConstants::Binding drawBinding = mPushConstants ? DrawConstants::Binding::PushConstants : DrawConstants::Binding::DynamicOffset;
+	if (mMultiDraw && MultiDraw::enabled(mDevice)) {
+		drawBinding = DrawConstants::Binding::StorageArray;
+	}
+	mMultiDrawCount = mMultiDraw && MultiDraw::countEnabled(mDevice);
+	mDrawConstants = std::make_unique<DrawConstants>(mDevice, static_cast<uint32_t>(sizeof(DrawUniforms)), drawBinding);
+	mShaderDefines.erase("PUSH_CONSTANTS");
+	mShaderDefines.erase("MULTI_DRAW");
+	if (mDrawConstants->pushConstants()) {
+		std::cout << "Draw uniforms: push constants, opaque batches being drawn without render bundles" << std::endl;
+		mShaderDefines.insert("PUSH_CONSTANTS");
+	}
+	else if (multiDraw()) {
+		std::cout << "Draw uniforms: storage array, opaque batches being drawn by multi-draws without render bundles" << std::endl;
+		mShaderDefines.insert("MULTI_DRAW");
+	}
+	mFramePacer = std::make_unique<FramePacer>(mDevice, mQueue, mMaxFramesInFlight);
+	DeviceEvents::start(mDevice);
+	// Room for the passes of the shadow cascades, on top of those of every frame, and for those
+	// of the primitives and scenarios benchmarked
+	uint32_t primitiveCount = mBenchmark ? mBenchmark->options().primitiveCount : 0;
+	uint32_t benchmarkPassCount = (primitiveCount > 0 ? PrimitivesBenchmark::PassCount : 0) + (gpuProfile ? GpuScenarioBenchmark::PassCount : 0);
+	mGpuProfiler = std::make_unique<GpuProfiler>(mDevice, 25 + benchmarkPassCount);
+	// Culling, the depth pre-pass, the main and transparency passes, and the secondary views
+	mPipelineStatistics = std::make_unique<PipelineStatistics>(mDevice, 16);
+	mTexturePool = std::make_unique<TexturePool>(mDevice);
+	mFrameGraph = std::make_unique<FrameGraph>(*mTexturePool);
+	mBlit = std::make_unique<Blit>(mDevice, *mPipelineCache, mSurfaceFormat);
+	if (mPostProcessing) mPostProcess = std::make_unique<PostProcessing>(mDevice, *mPipelineCache, mSurfaceFormat);
+	mWeightedBlendedOit = std::make_unique<WeightedBlendedOit>(mDevice, *mPipelineCache, mSceneFormat);
+	// The textures it compresses are read back, then uploaded to the interactive device, which
+	// must sample the formats
+	if (mTextureCompression && TextureCompressor::supported(mDevice)) {
+		mTextureCompressor = std::make_unique<TextureCompressor>(backgroundDevice(), backgroundPipelineCache());
+	}
+	if (primitiveCount > 0) {
+		mPrimitivesBenchmark = std::make_unique<PrimitivesBenchmark>(mDevice, *mPipelineCache, primitiveCount);
+		if (!mPrimitivesBenchmark->valid()) mPrimitivesBenchmark.reset();
+	}
+	if (gpuProfile) {
+		mScenarioBenchmark = std::make_unique<GpuScenarioBenchmark>(mDevice, *mPipelineCache, mWindowWidth, mWindowHeight);
+		if (!mScenarioBenchmark->valid()) mScenarioBenchmark.reset();
+	}
+	// Used by the completions of the asset jobs, which only run from now on
+	mResourceCache = std::make_unique<ResourceCache>(mDevice, mVertexPulling);
+
+	// Budget of a refresh period of the display, with some headroom for the compositor
+	DynamicResolution::Settings resolutionSettings;
+	resolutionSettings.targetFrameMs = 0.9 * 1000.0 / mRefreshRate;
+	mResolutionController = std::make_unique<DynamicResolution>(resolutionSettings);
+	if (const char* governor = std::getenv("LEARNWEBGPU_GOVERNOR")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(governor, governor + std::strlen(governor), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mGovernFrames = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_GOVERNOR '" << governor << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (mGovernFrames && !mBenchmark && !mInputReplay) {
+		FrameGovernor::Settings governorSettings;
+		governorSettings.refreshRate = mRefreshRate;
+		mFrameGovernor = std::make_unique<FrameGovernor>(governorSettings);
+	}
+	// Streaming starts at a few staging buffers worth per frame
+	UploadBudget::Settings uploadSettings;
+	uploadSettings.targetFrameMs = resolutionSettings.targetFrameMs;
+	mUploadBudget = std::make_unique<UploadBudget>(uploadSettings);
+
+	if (const char* passBudget = std::getenv("LEARNWEBGPU_PASS_BUDGET")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(passBudget, passBudget + std::strlen(passBudget), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mPassBudgeting = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_PASS_BUDGET '" << passBudget << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (mPassBudgeting && !mBenchmark && !mInputReplay) {
+		PassBudget::Settings passSettings;
+		passSettings.targetFrameMs = resolutionSettings.targetFrameMs;
+		mPassBudget = std::make_unique<PassBudget>(passSettings);
+		// Stepped down in this order: the occlusion applies its last estimate again, the bloom
+		// composites its last chain, culling tests against an older depth pyramid, and the shadows
+		// render one cascade per frame, then keep their last cascades
+		mBudgetedWork.ambientOcclusion = mPassBudget->addWork("AO", { "Ambient occlusion" }, 0, true);
+		mBudgetedWork.bloom = mPassBudget->addWork("bloom", { "Bloom" }, 1, true);
+		mBudgetedWork.depthPyramid = mPassBudget->addWork("Hi-Z", { "Depth pyramid" }, 2, true);
+		mBudgetedWork.shadows = mPassBudget->addWork("shadows", { "Shadow static casters", "Shadow dynamic casters" }, 3, false);
+	}
+	return true;
+}
+
+void Application::updateInit()
+{
+	TRACE_SCOPE("Wait for device");
+	if (mWindow && !mRenderThread) glfwPollEvents();
+	processInputEvents();
+#ifndef __EMSCRIPTEN__
+	if (mInstance) mInstance.processEvents();
+#endif // ! __EMSCRIPTEN__
+	mAssetLoader->processJobs();
+
+	if (mInitState == InitState::DeviceReady && !initDeviceResources()) {
+		std::cerr << "Failed to initialize the application" << std::endl;
+	}
+}
+
+bool Application::initWindow(Instance instance)
+{
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	// Running in a worker, which has neither a DOM nor GLFW: the page transferred the
+	// canvas to it as an OffscreenCanvas (see CMakeLists.txt), from which the surface is
+	// created directly, and mWindow stays null.
+	{
+		STARTUP_STAGE("Window");
+		int width, height;
+		if (emscripten_get_canvas_element_size("#canvas", &width, &height) == EMSCRIPTEN_RESULT_SUCCESS && width > 0 && height > 0) {
+			mWindowWidth = static_cast<uint32_t>(width);
+			mWindowHeight = static_cast<uint32_t>(height);
+		}
+		else {
+			emscripten_set_canvas_element_size("#canvas", mWindowWidth, mWindowHeight);
+		}
+
+		SurfaceDescriptorFromCanvasHTMLSelector canvasDesc;
+		canvasDesc.chain.next = nullptr;
+		canvasDesc.chain.sType = SType::SurfaceDescriptorFromCanvasHTMLSelector;
+		canvasDesc.selector = "#canvas";
+		SurfaceDescriptor surfaceDesc;
+		surfaceDesc.nextInChain = &canvasDesc.chain;
+		surfaceDesc.label = nullptr;
+		mSurface = instance.createSurface(surfaceDesc);
+	}
+	if (!mSurface) {
+		std::cerr << "Could not create a surface for the OffscreenCanvas!" << std::endl;
+		return false;
+	}
+
+	// Events of the canvas only exist on the browser thread. The callbacks run there,
+	// even while this worker renders, and only queue the events for processInputEvents().
+	const pthread_t browserThread = EM_CALLBACK_THREAD_CONTEXT_MAIN_RUNTIME_THREAD;
+	emscripten_set_resize_callback_on_thread(EMSCRIPTEN_EVENT_TARGET_WINDOW, this, false, browserResizeCallback, browserThread);
+	emscripten_set_mousemove_callback_on_thread("#canvas", this, true, mouseMoveCallback, browserThread);
+	emscripten_set_mousedown_callback_on_thread("#canvas", this, true, mouseDownCallback, browserThread);
+	emscripten_set_mouseup_callback_on_thread("#canvas", this, true, mouseUpCallback, browserThread);
+	emscripten_set_wheel_callback_on_thread("#canvas", this, true, wheelCallback, browserThread);
+	return true;
+#else
+	bool initialized;
+	{
+		STARTUP_STAGE("GLFW init");
+		initialized = glfwInit();
+	}
+	if (!initialized) {
+		std::cerr << "Could not initialize GLFW!" << std::endl;
+		return false;
+	}
+
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // NO_API bc We don't want OpenGL in the back, we'll use WebGPU instead.
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE); 
+
+	{
+		STARTUP_STAGE("Window");
+		mWindow = glfwCreateWindow(mWindowWidth, mWindowHeight, "[WebGPU] 3D Playground", NULL, NULL);
+		// Capture surface here so we can use in the main loop
+		if (mWindow) mSurface = glfwGetWGPUSurface(instance, mWindow);
+	}
+	if (!mWindow) {
+		std::cerr << "Could not open window!" << std::endl;
+		return false;
+	}
+
+  // Store a pointer to the application in the GLFW window, so we can access it in callbacks if needed
+  glfwSetWindowUserPointer(mWindow, this);
+	
+
+	mMainThreadId = std::this_thread::get_id();
+#ifndef __EMSCRIPTEN__
+	// Budget of the frames of dynamic resolution, from the main thread, which alone may ask
+	if (const GLFWvidmode* videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor()); videoMode && videoMode->refreshRate > 0) {
+		mRefreshRate = videoMode->refreshRate;
+	}
+	if (const char* renderThread = std::getenv("LEARNWEBGPU_RENDER_THREAD")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(renderThread, renderThread + std::strlen(renderThread), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mRenderThread = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_RENDER_THREAD '" << renderThread << "', expected 0 or 1" << std::endl;
+		}
+	}
+	// Secondary views of the same scene, their cameras spread evenly around it from the main one
+	if (const char* views = std::getenv("LEARNWEBGPU_VIEWS")) {
+		constexpr uint32_t maxViewCount = 8;
+		uint32_t viewCount = 0;
+		auto result = std::from_chars(views, views + std::strlen(views), viewCount);
+		if (result.ec == std::errc() && *result.ptr == '\0' && viewCount <= maxViewCount) {
+			STARTUP_STAGE("View windows");
+			for (uint32_t i = 0; i < viewCount; ++i) {
+				std::string title = "[WebGPU] 3D Playground (view " + std::to_string(i + 1) + ")";
+				float yawOffset = 2.0f * glm::pi<float>() * (i + 1) / (viewCount + 1);
+				std::unique_ptr<View> view = View::create(instance, title.c_str(), mWindowWidth / 2, mWindowHeight / 2, yawOffset);
+				if (!view) break;
+				mViews.push_back(std::move(view));
+			}
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_VIEWS '" << views << "', expected a view count up to " << maxViewCount << std::endl;
+		}
+	}
+
+	// In render thread mode, the callbacks run on the main thread and forward the events to it
+	glfwSetFramebufferSizeCallback(mWindow, [](GLFWwindow* window, int width, int height) {
+		//std::cout << "[GLFW] framebuffer resize: " << width << " x " << height << std::endl;
+		Application* that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+		if (that == nullptr) return;
+		if (that->mRenderThread) that->forwardInputEvent({ InputEvent::Type::Resize, 0, 0, double(width), double(height) });
+		else that->handleResize(width, height);
+	});
+
+	glfwSetCursorPosCallback(mWindow, [](GLFWwindow* window, double xpos, double ypos) {
+		auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+		if (that == nullptr) return;
+		if (that->mRenderThread) that->forwardInputEvent({ InputEvent::Type::MouseMove, 0, 0, xpos, ypos });
+		else that->queueMouseMove(xpos, ypos);
+	});
+
+	glfwSetMouseButtonCallback(mWindow, [](GLFWwindow* window, int button, int action, int mods) {
+		auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+		if (that == nullptr) return;
+		if (that->mRenderThread) {
+			double xpos, ypos;
+			glfwGetCursorPos(window, &xpos, &ypos);
+			that->forwardInputEvent({ InputEvent::Type::MouseButton, button, action, xpos, ypos });
+			return;
+		}
+		that->flushMouseMove();
+		that->onMouseButton(button, action, mods);
+	});
+
+	glfwSetScrollCallback(mWindow, [](GLFWwindow* window, double xoffset, double yoffset) {
+		auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+		if (that == nullptr) return;
+		if (that->mRenderThread) {
+			that->forwardInputEvent({ InputEvent::Type::Scroll, 0, 0, xoffset, yoffset });
+			return;
+		}
+		that->flushMouseMove();
+		that->onScroll(xoffset, yoffset);
+	});
+
+	glfwSetKeyCallback(mWindow, [](GLFWwindow* window, int key, int scancode, int action, int mods) {
+		auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+		if (that == nullptr) return;
+		if (that->mRenderThread) that->forwardInputEvent({ InputEvent::Type::Key, key, action, 0.0, 0.0 });
+		else that->onKey(key, scancode, action, mods);
+	});
+#else
+	emscripten_set_resize_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, this, false, browserResizeCallback);
+
+	emscripten_set_mousemove_callback("#canvas", this, true, mouseMoveCallback);
+
+	emscripten_set_mousedown_callback("#canvas", this, true, mouseDownCallback);
+
+	emscripten_set_mouseup_callback("#canvas", this, true, mouseUpCallback);
+
+	emscripten_set_wheel_callback("#canvas", this, true, wheelCallback);
+
+	//emscripten_set_keydown_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, this, true, keyDownCallback);
+
+	//emscripten_set_keyup_callback(EMSCRIPTEN_EVENT_TARGET_WINDOW, this, true, keyUpCallback);
+#endif
+
+	return true;
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
+}
+
+void Application::terminateWindowAndDevice()
+{
+	terminateDevice();
+	if (mInstance) mInstance.release();
+
+	if (mWindow) {
+		mViews.clear();
+		mSurface.release();
+		glfwDestroyWindow(mWindow);
+		glfwTerminate();
+	}
+}
+
+void Application::terminateDevice()
+{
+	// Its thread polls the device until then
+	DeviceEvents::stop();
+	mFrameGovernor.reset();
+	mResolutionController.reset();
+	mUploadBudget.reset();
+	mPassBudget.reset();
+	mScenarioBenchmark.reset();
+	mPrimitivesBenchmark.reset();
+	mTextureCompressor.reset();
+	mWorkerDevice.reset();
+	mWeightedBlendedOit.reset();
+	mPostProcess.reset();
+	mBlit.reset();
+	mFrameGraph.reset();
+	mTexturePool.reset();
+	mPipelineStatistics.reset();
+	mGpuProfiler.reset();
+	mWorkgroupTuner.reset();
+	mFramePacer.reset();
+	mDrawConstants.reset();
+	if (mRecordPipelines && mPipelineCache && mPipelineCache->saveManifest(pipelineManifestPath)) {
+		std::cout << "Recorded the pipelines of this session in " << pipelineManifestPath << std::endl;
+	}
+	mPipelineCache.reset();
+	mRequestDeviceCallback.reset();
+	if (mDevice) {
+		mQueue.release();
+		mDevice.release();
+		mQueue = nullptr;
+		mDevice = nullptr;
+	}
+	mUncapturedErrorCallbackHandle.reset();
+	if (mAdapter) mAdapter.release();
+	mAdapter = nullptr;
+}
+
+RequiredLimits Application::getRequiredLimits(Adapter adapter)
+{
+	SupportedLimits supportedLimits;
+	adapter.getLimits(&supportedLimits);
+	LimitsNegotiator negotiator(supportedLimits.limits);
+	const Limits& supported = negotiator.supported();
+	uint32_t instanceCount = mSceneGenerator ? mSceneGenerator->options().objectCount : mInstanceGridSize * mInstanceGridSize;
+
+	// Main pipelines: vertex buffers of the layout, frame and view uniforms at dynamic offsets
+	// of the uniform ring and draw uniforms at those of the batches, materials in a texture
+	// array, and instances read from storage buffers, in one bind group per BindGroupSlot
+	Limits renderMinimum;
+	renderMinimum.maxBindGroups = BindGroupSlotCount;
+	renderMinimum.maxVertexBuffers = mVertexLayout.bufferCount();
+	renderMinimum.maxVertexAttributes = 4;
+	renderMinimum.maxVertexBufferArrayStride = static_cast<uint32_t>(mVertexLayout.vertexSize());
+	renderMinimum.maxUniformBuffersPerShaderStage = 3;
+	renderMinimum.maxDynamicUniformBuffersPerPipelineLayout = 3;
+	renderMinimum.maxUniformBufferBindingSize = std::max({ sizeof(FrameUniforms), sizeof(ViewUniforms), sizeof(DrawUniforms), sizeof(CullingUniforms) });
+	renderMinimum.maxSampledTexturesPerShaderStage = 1;
+	renderMinimum.maxSamplersPerShaderStage = 1;
+	renderMinimum.maxStorageBuffersPerShaderStage = 2;
+	renderMinimum.maxStorageBufferBindingSize = uint64_t(instanceCount) * sizeof(InstanceData);
+	renderMinimum.maxTextureArrayLayers = 1;
+	// The surface, or the offscreen target of benchmarks, and its depth buffer
+	renderMinimum.maxTextureDimension2D = std::max(mWindowWidth, mWindowHeight);
+	Limits renderPreferred = renderMinimum;
+	// Textures as large as the adapter supports, larger images losing their largest
+	// mip levels (see TextureLoadOptions::maxSize), and meshes as large as buffers go
+	renderPreferred.maxTextureDimension1D = supported.maxTextureDimension1D;
+	renderPreferred.maxTextureDimension2D = supported.maxTextureDimension2D;
+	renderPreferred.maxBufferSize = supported.maxBufferSize;
+	renderPreferred.maxStorageBufferBindingSize = supported.maxStorageBufferBindingSize;
+	// Materials are packed in a texture array
+	renderPreferred.maxTextureArrayLayers = 256;
+	if (!negotiator.request("rendering", renderMinimum, renderPreferred)) {
+		std::cerr << "Rendering will likely fail on this adapter" << std::endl;
+	}
+
+	// GPU culling, falling back to culling on the CPU
+	Limits cullingMinimum;
+	cullingMinimum.maxBindGroups = 1;
+	cullingMinimum.maxUniformBuffersPerShaderStage = 1;
+	cullingMinimum.maxStorageBuffersPerShaderStage = 4;
+	cullingMinimum.maxSampledTexturesPerShaderStage = 1;
+	cullingMinimum.maxComputeInvocationsPerWorkgroup = 64;
+	cullingMinimum.maxComputeWorkgroupSizeX = 64;
+	// Workgroups of the smallest size the WorkgroupTuner tries, the largest being preferred
+	cullingMinimum.maxComputeWorkgroupsPerDimension = (instanceCount + 31) / 32;
+	Limits cullingPreferred = cullingMinimum;
+	cullingPreferred.maxComputeInvocationsPerWorkgroup = 256;
+	cullingPreferred.maxComputeWorkgroupSizeX = 256;
+	if (mGpuCulling && !negotiator.request("GPU culling", cullingMinimum, cullingPreferred)) {
+		std::cerr << "Culling instances on the CPU instead" << std::endl;
+		mGpuCulling = false;
+	}
+
+	// Occlusion culling, building the depth pyramid with 8x8 workgroups that write a
+	// storage texture, falling back to frustum culling only
+	Limits occlusionMinimum;
+	occlusionMinimum.maxBindGroups = 1;
+	occlusionMinimum.maxSampledTexturesPerShaderStage = 2;
+	occlusionMinimum.maxStorageTexturesPerShaderStage = 1;
+	occlusionMinimum.maxComputeInvocationsPerWorkgroup = 64;
+	occlusionMinimum.maxComputeWorkgroupSizeX = 8;
+	occlusionMinimum.maxComputeWorkgroupSizeY = 8;
+	occlusionMinimum.maxComputeWorkgroupsPerDimension = (std::max(mWindowWidth, mWindowHeight) + 7) / 8;
+	if (mOcclusionCulling && (!mGpuCulling || !negotiator.request("occlusion culling", occlusionMinimum))) {
+		std::cerr << "Occlusion culling disabled" << std::endl;
+		mOcclusionCulling = false;
+	}
+
+	// Shadow maps, a layer per cascade sampled next to the material texture with a comparison
+	// sampler, falling back to unshadowed lighting
+	Limits shadowMinimum;
+	shadowMinimum.maxTextureArrayLayers = ShadowMaps::CascadeCount;
+	shadowMinimum.maxTextureDimension2D = 2048;
+	shadowMinimum.maxSampledTexturesPerShaderStage = 2;
+	shadowMinimum.maxSamplersPerShaderStage = 2;
+	shadowMinimum.maxUniformBuffersPerShaderStage = 3;
+	shadowMinimum.maxUniformBufferBindingSize = sizeof(ShadowMaps::Uniforms);
+	if (mShadows && !negotiator.request("shadows", shadowMinimum)) {
+		std::cerr << "Shadows disabled" << std::endl;
+		mShadows = false;
+	}
+
+	// Clustered lighting, a compute pass writing the light lists of the clusters and fragments
+	// reading them from storage buffers next to the uniforms of the view, falling back to the
+	// directional lights alone
+	Limits clusteredLightingMinimum;
+	clusteredLightingMinimum.maxStorageBuffersPerShaderStage = 2;
+	clusteredLightingMinimum.maxUniformBuffersPerShaderStage = 4;
+	clusteredLightingMinimum.maxUniformBufferBindingSize = sizeof(ClusteredLights::Uniforms);
+	clusteredLightingMinimum.maxStorageBufferBindingSize = uint64_t(ClusteredLights::ClusterCount) * (ClusteredLights::MaxLightsPerCluster + 1) * sizeof(uint32_t);
+	clusteredLightingMinimum.maxComputeWorkgroupStorageSize = 64 * sizeof(glm::vec4);
+	clusteredLightingMinimum.maxComputeInvocationsPerWorkgroup = 64;
+	clusteredLightingMinimum.maxComputeWorkgroupSizeX = 64;
+	clusteredLightingMinimum.maxComputeWorkgroupsPerDimension = (ClusteredLights::ClusterCount + 31) / 32;
+	// Room for the largest workgroups the WorkgroupTuner tries, each one loading a light per invocation
+	Limits clusteredLightingPreferred = clusteredLightingMinimum;
+	clusteredLightingPreferred.maxComputeWorkgroupStorageSize = 256 * sizeof(glm::vec4);
+	clusteredLightingPreferred.maxComputeInvocationsPerWorkgroup = 256;
+	clusteredLightingPreferred.maxComputeWorkgroupSizeX = 256;
+	if (mClusteredLighting && !negotiator.request("clustered lighting", clusteredLightingMinimum, clusteredLightingPreferred)) {
+		std::cerr << "Point lights disabled" << std::endl;
+		mClusteredLighting = false;
+	}
+
+	// Particles, LEARNWEBGPU_PARTICLES of them at most (0 to disable them), their state and
+	// lists in storage buffers that kernels over all of them or over their sort index
+	if (const char* particles = std::getenv("LEARNWEBGPU_PARTICLES")) {
+		uint32_t capacity = 0;
+		auto result = std::from_chars(particles, particles + std::strlen(particles), capacity);
+		if (result.ec == std::errc() && *result.ptr == '\0' && capacity <= ParticleSystem::MaxCapacity) {
+			mParticleCapacity = capacity;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_PARTICLES '" << particles << "', expected at most " << ParticleSystem::MaxCapacity << " particles" << std::endl;
+		}
+	}
+	Limits particleMinimum;
+	particleMinimum.maxBindGroups = 2;
+	particleMinimum.maxDynamicUniformBuffersPerPipelineLayout = 1;
+	particleMinimum.maxStorageBuffersPerShaderStage = 6;
+	particleMinimum.maxStorageBufferBindingSize = uint64_t(mParticleCapacity) * 32;
+	particleMinimum.maxBufferSize = uint64_t(mParticleCapacity) * 32;
+	particleMinimum.maxComputeWorkgroupStorageSize = 512 * 2 * sizeof(uint32_t);
+	particleMinimum.maxComputeInvocationsPerWorkgroup = 256;
+	particleMinimum.maxComputeWorkgroupSizeX = 256;
+	particleMinimum.maxComputeWorkgroupsPerDimension = std::max(std::bit_ceil(mParticleCapacity), 512u) / 256;
+	if (mParticleCapacity > 0 && !negotiator.request("particles", particleMinimum)) {
+		std::cerr << "Particles disabled" << std::endl;
+		mParticleCapacity = 0;
+	}
+
+	// Compute primitives of the benchmark, up to 256 invocations sharing 8 words each while ranking
+	// digits, over buffers of all elements
+	uint32_t primitiveCount = mBenchmark ? mBenchmark->options().primitiveCount : 0;
+	Limits primitivesMinimum;
+	primitivesMinimum.maxBindGroups = 2;
+	primitivesMinimum.maxDynamicUniformBuffersPerPipelineLayout = 1;
+	primitivesMinimum.maxStorageBuffersPerShaderStage = 5;
+	primitivesMinimum.maxStorageBufferBindingSize = uint64_t(primitiveCount) * sizeof(uint32_t);
+	primitivesMinimum.maxBufferSize = uint64_t(primitiveCount) * sizeof(uint32_t);
+	primitivesMinimum.maxComputeWorkgroupStorageSize = 256 * 8 * sizeof(uint32_t);
+	primitivesMinimum.maxComputeInvocationsPerWorkgroup = 256;
+	primitivesMinimum.maxComputeWorkgroupSizeX = 256;
+	if (primitiveCount > 0 && !negotiator.request("primitives benchmark", primitivesMinimum)) {
+		std::cerr << "The primitives benchmark will likely fail on this adapter" << std::endl;
+	}
+
+	// Deferred lighting: the groups of the draws, then the G-buffer's, falling back to forward
+	// shading when the adapter has no room for it
+	Limits deferredMinimum;
+	deferredMinimum.maxBindGroups = DeferredShading::BindGroupIndex + 1;
+	deferredMinimum.maxStorageTexturesPerShaderStage = 1;
+	deferredMinimum.maxComputeInvocationsPerWorkgroup = DeferredShading::TileSize * DeferredShading::TileSize;
+	deferredMinimum.maxComputeWorkgroupSizeX = DeferredShading::TileSize;
+	deferredMinimum.maxComputeWorkgroupSizeY = DeferredShading::TileSize;
+	if (mDeferredShadingRequested && !negotiator.request("deferred shading", deferredMinimum)) {
+		std::cerr << "Deferred shading will likely fail on this adapter" << std::endl;
+	}
+
+	// Staging buffers of the upload manager
+	Limits uploadMinimum;
+	uploadMinimum.maxBufferSize = 4 << 20;
+	negotiator.request("uploads", uploadMinimum);
+
+	// NOTE: is "Default" just an alias for a default initializer {} ? It crashes if I don't copy the limits manually.
+	RequiredLimits requiredLimits = Default;
+	requiredLimits.limits = negotiator.required();
+	return requiredLimits;
+}
+
+void Application::configSurface()
+{
+	TRACE_SCOPE("configSurface");
+	StartupStage startupStage("Surface config");
+	if (mBenchmark) {
+		initOffscreenTarget();
+		return;
+	}
+
+	SurfaceConfiguration config{};
+	config.width = static_cast<uint32_t>(mWindowWidth);
+	config.height = static_cast<uint32_t>(mWindowHeight);
+	// Captures copy from the surface texture, which some platforms then keep off their fastest
+	// presentation path
+	config.usage = TextureUsage::RenderAttachment;
+	if (mFrameCapture) config.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+	mSurfaceFormats.configure(config);
+	config.device = mDevice;
+	config.presentMode = mPresentMode;
+
+	mSurface.configure(config);
+}
+
+void Application::terminateSurfaceConfig()
+{
+	if (mBenchmark) {
+		terminateOffscreenTarget();
+		return;
+	}
+  mSurface.unconfigure();
+}
+
+void Application::initOffscreenTarget()
+{
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Offscreen render target";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = mSurfaceFormat;
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { mWindowWidth, mWindowHeight, 1 };
+	textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mOffscreenTexture = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::RenderTargets, "Application");
+}
+
+void Application::terminateOffscreenTarget()
+{
+	retireTracked(mOffscreenTexture);
+	mOffscreenTexture = nullptr;
+}
+
+bool Application::initDepthBuffer()
+{
+	TRACE_SCOPE("initDepthBuffer");
+	// Create the depth texture
+	TextureDescriptor depthTextureDesc{};
+	depthTextureDesc.dimension = TextureDimension::_2D;
+	depthTextureDesc.format = mDepthTextureFormat;
+	depthTextureDesc.mipLevelCount = 1;
+	depthTextureDesc.sampleCount = mSampleCount;
+	depthTextureDesc.size = { static_cast<uint32_t>(mWindowWidth),static_cast<uint32_t>(mWindowHeight), 1 };
+	// Also read to build the depth pyramid
+	depthTextureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+	depthTextureDesc.viewFormatCount = 1;
+	depthTextureDesc.viewFormats = (WGPUTextureFormat*)&mDepthTextureFormat;
+	// Rounded up when the scene is not drawn to the surface texture, see mLiveResize
+	mDepthTexture = mTexturePool->acquire(depthTextureDesc, mSceneTarget);
+
+	// Create the view of the depth texture manipulated by the rasterizer
+	TextureViewDescriptor depthTextureViewDesc{};
+	depthTextureViewDesc.aspect = TextureAspect::DepthOnly;
+	depthTextureViewDesc.baseArrayLayer = 0;
+	depthTextureViewDesc.arrayLayerCount = 1;
+	depthTextureViewDesc.baseMipLevel = 0;
+	depthTextureViewDesc.mipLevelCount = 1;
+	depthTextureViewDesc.dimension = TextureViewDimension::_2D;
+	depthTextureViewDesc.format = mDepthTextureFormat;
+	mDepthTextureView = mDepthTexture.createView(depthTextureViewDesc);
+	if (!mDepthTextureView) return false;
+
+	return true;
+}
+
+void Application::terminateDepthBuffer()
+{
+	mDepthTextureView.release();
+	mTexturePool->release(mDepthTexture);
+	mDepthTexture = nullptr;
+}
+
+bool Application::initDepthPyramid()
+{
+	TRACE_SCOPE("initDepthPyramid");
+	// Empty until the next frame that runs the culling pass. Covers the whole depth buffer,
+	// the culling pass only reading the part of it that the scene covers.
+	mDepthPyramid = std::make_unique<DepthPyramid>(mDevice, *mPipelineCache, mDepthTextureView, mDepthTexture.getWidth(), mDepthTexture.getHeight(), mSampleCount, mDepthConvention);
+	mDepthPyramidValid = false;
+	return true;
+}
+
+void Application::terminateDepthPyramid()
+{
+	mDepthPyramid.reset();
+}
+
+bool Application::initShadowMaps()
+{
+	TRACE_SCOPE("initShadowMaps");
+	if (!mShadows) return true;
+	mShadowMaps = std::make_unique<ShadowMaps>(mDevice);
+	if (!mShadowMaps->valid()) {
+		std::cerr << "Could not create shadow maps, shadows disabled" << std::endl;
+		mShadowMaps.reset();
+		mShadows = false;
+		return true;
+	}
+	// lightDirection1 of shader.wgsl
+	mShadowMaps->setLightDirection(glm::vec3(0.5f, -0.9f, 0.1f));
+
+	// Hardware filtering of the comparisons of 2x2 texels, under the 3x3 taps of the shader
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::ClampToEdge;
+	samplerDesc.addressModeV = AddressMode::ClampToEdge;
+	samplerDesc.addressModeW = AddressMode::ClampToEdge;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 1.0f;
+	samplerDesc.compare = CompareFunction::Less;
+	samplerDesc.maxAnisotropy = 1;
+	mShadowSampler = mPipelineCache->sampler(samplerDesc);
+
+	// Shadows only darken the diffuse lighting
+	mShaderDefines.insert("LIGHTING");
+	mShaderDefines.insert("SHADOWS");
+	return true;
+}
+
+void Application::terminateShadowMaps()
+{
+	// The sampler is owned by the pipeline cache
+	mShadowSampler = nullptr;
+	mShadowMaps.reset();
+}
+
+bool Application::initPointLights()
+{
+	TRACE_SCOPE("initPointLights");
+	uint32_t lightCount = 128;
+	if (mSceneGenerator) {
+		// One of the axes of the synthetic scene
+		lightCount = mSceneGenerator->options().lightCount;
+		if (lightCount > ClusteredLights::MaxLights) {
+			std::cerr << "The synthetic scene asks for " << lightCount << " lights, drawing " << ClusteredLights::MaxLights << std::endl;
+			lightCount = ClusteredLights::MaxLights;
+		}
+	}
+	else if (const char* lights = std::getenv("LEARNWEBGPU_LIGHTS")) {
+		uint32_t count = 0;
+		auto result = std::from_chars(lights, lights + std::strlen(lights), count);
+		if (result.ec == std::errc() && *result.ptr == '\0' && count <= ClusteredLights::MaxLights) {
+			lightCount = count;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_LIGHTS '" << lights << "', expected at most " << ClusteredLights::MaxLights << " lights" << std::endl;
+		}
+	}
+	if (!mClusteredLighting || lightCount == 0) {
+		mClusteredLighting = false;
+		return true;
+	}
+	mClusteredLights = std::make_unique<ClusteredLights>(mDevice, *mPipelineCache, *mWorkgroupTuner);
+	if (!mClusteredLights->valid()) {
+		std::cerr << "Could not create the light clusters, point lights disabled" << std::endl;
+		mClusteredLights.reset();
+		mClusteredLighting = false;
+		return true;
+	}
+
+	// The same lights from one run to the next, just above the grid of instances, sized for
+	// each point of it to be reached by a few of them
+	std::minstd_rand random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	float radius = std::sqrt(4.0f * 16.0f / (glm::pi<float>() * static_cast<float>(lightCount)));
+	mPointLights.resize(lightCount);
+	for (ClusteredLights::PointLight& light : mPointLights) {
+		light.position = { 4.0f * unit(random) - 2.0f, 4.0f * unit(random) - 2.0f, 0.05f + 0.25f * unit(random) };
+		light.radius = radius * (0.75f + 0.5f * unit(random));
+		// Saturated colors around the hue circle
+		float hue = 6.0f * unit(random);
+		glm::vec3 color = glm::clamp(glm::abs(glm::mod(hue + glm::vec3(0.0f, 4.0f, 2.0f), 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+		light.color = color;
+		light.intensity = 0.5f;
+	}
+	mPointLightsDirty = true;
+
+	mShaderDefines.insert("LIGHTING");
+	mShaderDefines.insert("CLUSTERED_LIGHTS");
+	return true;
+}
+
+void Application::terminatePointLights()
+{
+	mPointLights.clear();
+	mClusteredLights.reset();
+}
+
+bool Application::initEnvironmentLighting()
+{
+	TRACE_SCOPE("initEnvironmentLighting");
+	const char* environmentPath = std::getenv("LEARNWEBGPU_ENVIRONMENT");
+	if (!environmentPath || *environmentPath == '\0') return true;
+	mEnvironmentLighting = std::make_unique<EnvironmentLighting>(mDevice, *mPipelineCache);
+	if (!mEnvironmentLighting->valid()) {
+		std::cerr << "Could not create the environment lighting textures, image-based lighting disabled" << std::endl;
+		mEnvironmentLighting.reset();
+		return true;
+	}
+	if (mWorkerDevice) {
+		mEnvironmentPrefilter = std::make_unique<EnvironmentLighting>(mWorkerDevice->device(), mWorkerDevice->pipelineCache());
+		if (!mEnvironmentPrefilter->valid()) mEnvironmentPrefilter.reset();
+	}
+	loadEnvironment(environmentPath).detach();
+
+	mShaderDefines.insert("LIGHTING");
+	mShaderDefines.insert("IMAGE_BASED_LIGHTING");
+	return true;
+}
+
+void Application::terminateEnvironmentLighting()
+{
+	mEnvironmentPrefilter.reset();
+	mEnvironmentLighting.reset();
+}
+
+bool Application::initLightBaker()
+{
+	const char* bakedLighting = std::getenv("LEARNWEBGPU_BAKED_LIGHTING");
+	if (!bakedLighting) return true;
+	uint32_t enabled = 0;
+	auto result = std::from_chars(bakedLighting, bakedLighting + std::strlen(bakedLighting), enabled);
+	if (result.ec != std::errc() || *result.ptr != '\0' || enabled > 1) {
+		std::cerr << "Ignoring invalid LEARNWEBGPU_BAKED_LIGHTING '" << bakedLighting << "', expected 0 or 1" << std::endl;
+		return true;
+	}
+	if (enabled == 0) return true;
+	TRACE_SCOPE("initLightBaker");
+	mLightBaker = std::make_unique<LightBaker>(backgroundDevice(), backgroundPipelineCache());
+	mShaderDefines.insert("LIGHTING");
+	mShaderDefines.insert("BAKED_LIGHTING");
+	return true;
+}
+
+void Application::terminateLightBaker()
+{
+	mLightBaker.reset();
+}
+
+bool Application::initDeferredShading()
+{
+	if (!mDeferredShadingRequested) return true;
+	TRACE_SCOPE("initDeferredShading");
+	// The G-buffer holds no vertex colors, which baked lighting comes from, nor a second eye
+	if (mLightBaker || mStereo) {
+		std::cerr << "Deferred shading does not combine with baked lighting nor stereo, shading forward" << std::endl;
+		return true;
+	}
+	SupportedLimits supportedLimits;
+	mDevice.getLimits(&supportedLimits);
+	if (supportedLimits.limits.maxBindGroups < DeferredShading::BindGroupIndex + 1 || mSceneFormat != DeferredShading::SceneFormat) {
+		std::cerr << "The device has no room for deferred shading, shading forward" << std::endl;
+		return true;
+	}
+
+	mDeferredShading = std::make_unique<DeferredShading>(mDevice, *mPipelineCache);
+	if (!mDeferredShading->valid()) {
+		std::cerr << "Could not create the deferred shading uniforms, shading forward" << std::endl;
+		mDeferredShading.reset();
+		return true;
+	}
+	mShaderDefines.insert("DEFERRED");
+	// To weigh against the bandwidth of the GPU, the passes telling their time in the profiler
+	glm::uvec2 size(mWindowWidth, mWindowHeight);
+	std::cout << "Deferred shading: G-buffer of " << DeferredShading::BytesPerPixel << " bytes per pixel, "
+		<< formatWithPrefix(double(DeferredShading::gbufferBytes(size)), "B", 1024.0) << " written and read per frame at "
+		<< size.x << "x" << size.y << std::endl;
+	return true;
+}
+
+void Application::terminateDeferredShading()
+{
+	mDeferredShading.reset();
+}
+
+Task<> Application::loadEnvironment(std::filesystem::path path)
+{
+	co_await mAssetLoader->resumeOnWorker();
+	auto environment = std::make_shared<EnvironmentLighting::Environment>();
+	if (!EnvironmentLighting::load(path, *environment)) co_return;
+	bool cached = !environment->radiance.empty();
+
+	co_await mAssetLoader->resumeOnDeviceThread();
+	// The device may have been lost and recreated meanwhile, its lighting loading the environment again
+	if (!mEnvironmentLighting) co_return;
+	std::vector<uint16_t> radiance;
+	// Prefiltered on the worker device if there is one, then uploaded as if from the cache
+	if (!cached && mEnvironmentPrefilter && !mWorkerDevice->lost()) {
+		radiance = co_await mEnvironmentPrefilter->upload(std::shared_ptr<const EnvironmentLighting::Environment>(environment));
+		if (!mEnvironmentLighting) co_return;
+	}
+	if (!radiance.empty()) {
+		auto prefiltered = std::make_shared<EnvironmentLighting::Environment>();
+		prefiltered->hash = environment->hash;
+		prefiltered->uniforms = environment->uniforms;
+		prefiltered->radiance = radiance;
+		co_await mEnvironmentLighting->upload(std::move(prefiltered));
+	}
+	else {
+		radiance = co_await mEnvironmentLighting->upload(std::shared_ptr<const EnvironmentLighting::Environment>(environment));
+	}
+	if (cached || radiance.empty()) co_return;
+
+	co_await mAssetLoader->resumeOnWorker();
+	if (EnvironmentLighting::writeCache(path, *environment, radiance)) {
+		std::cout << "Prefiltered environment " << path.filename() << " on the GPU" << std::endl;
+	}
+}
+
+bool Application::initPicking()
+{
+	// The ID target adds 4 bytes per sample to the main pass, within the 32 all devices allow
+	mObjectPicker = std::make_unique<ObjectPicker>(mDevice, *mPipelineCache, mSampleCount);
+	mShaderDefines.insert("OBJECT_IDS");
+	return true;
+}
+
+void Application::terminatePicking()
+{
+	mObjectPicker.reset();
+	mSelectedInstance = ObjectPicker::NoInstance;
+}
+
+bool Application::initOcclusionQueries()
+{
+	mOcclusionQueries = std::make_unique<OcclusionQueries>(mDevice, *mPipelineCache, mDepthConvention, mSampleCount);
+	return true;
+}
+
+void Application::terminateOcclusionQueries()
+{
+	mOcclusionQueries.reset();
+	mOcclusionQueryBatches.clear();
+	mHiddenQueryCounts.clear();
+}
+
+bool Application::initParticles()
+{
+	TRACE_SCOPE("initParticles");
+	if (mParticleCapacity == 0) return true;
+	TextureFormat idFormat = TextureFormat::Undefined;
+	if (mObjectPicker) idFormat = ObjectPicker::IdFormat;
+	mParticles = std::make_unique<ParticleSystem>(mDevice, *mPipelineCache, mParticleCapacity, mSceneFormat, idFormat, mDepthConvention, mSampleCount);
+	if (!mParticles->valid()) {
+		std::cerr << "Particles disabled" << std::endl;
+		mParticles.reset();
+		return true;
+	}
+
+	// A fountain at the center of the grid, emitting about as many particles as live at once
+	// to keep most of the capacity in use
+	ParticleSystem::Emitter emitter;
+	emitter.position = { 0.0f, 0.0f, 0.1f };
+	emitter.rate = 0.9f * static_cast<float>(mParticles->capacity()) / emitter.maxLifetime;
+	mParticles->setEmitter(emitter);
+	return true;
+}
+
+void Application::terminateParticles()
+{
+	mParticles.reset();
+}
+
+bool Application::initTerrain()
+{
+	TRACE_SCOPE("initTerrain");
+	if (mStereo) return true;
+	bool enabled = false;
+	if (const char* terrain = std::getenv("LEARNWEBGPU_TERRAIN")) {
+		uint32_t value = 0;
+		auto result = std::from_chars(terrain, terrain + std::strlen(terrain), value);
+		if (result.ec == std::errc() && *result.ptr == '\0' && value <= 1) {
+			enabled = value == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_TERRAIN '" << terrain << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (!enabled) return true;
+
+	// Rolling hills below the grid of instances, the scene being about a unit across
+	Terrain::Settings settings;
+	settings.minHeight = -1.6f;
+	settings.maxHeight = -0.4f;
+	TextureFormat idFormat = TextureFormat::Undefined;
+	if (mObjectPicker) idFormat = ObjectPicker::IdFormat;
+	mTerrain = std::make_unique<Terrain>(
+		mDevice, *mPipelineCache, Terrain::fractalHeights(-1.0f, 0.6f, 4.0f), settings,
+		mSceneFormat, idFormat, mDepthConvention, mSampleCount
+	);
+	if (!mTerrain->valid()) {
+		std::cerr << "Terrain disabled" << std::endl;
+		mTerrain.reset();
+	}
+	return true;
+}
+
+void Application::terminateTerrain()
+{
+	mTerrain.reset();
+}
+
+bool Application::initPointCloud()
+{
+	TRACE_SCOPE("initPointCloud");
+	if (mPointCloudPath.empty()) return true;
+	TextureFormat idFormat = TextureFormat::Undefined;
+	if (mObjectPicker) idFormat = ObjectPicker::IdFormat;
+	mPointCloud = std::make_unique<PointCloud>(mDevice, *mPipelineCache, PointCloud::Settings{}, mSceneFormat, idFormat, mDepthConvention, mSampleCount);
+	if (!mPointCloud->valid()) {
+		std::cerr << "Point cloud disabled" << std::endl;
+		mPointCloud.reset();
+		return true;
+	}
+	// Until loaded, by the completion of its job otherwise
+	if (mPointCloudOctree) mPointCloud->setOctree(mPointCloudOctree);
+	return true;
+}
+
+void Application::terminatePointCloud()
+{
+	mPointCloud.reset();
+}
+
+bool Application::initImposters()
+{
+	TRACE_SCOPE("initImposters");
+	if (mStereo) return true;
+	if (const char* imposters = std::getenv("LEARNWEBGPU_IMPOSTERS")) {
+		uint32_t value = 0;
+		auto result = std::from_chars(imposters, imposters + std::strlen(imposters), value);
+		if (result.ec == std::errc() && *result.ptr == '\0' && value <= 1) {
+			mImpostersEnabled = value == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_IMPOSTERS '" << imposters << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (!mImpostersEnabled) return true;
+
+	TextureFormat idFormat = TextureFormat::Undefined;
+	if (mObjectPicker) idFormat = ObjectPicker::IdFormat;
+	mImposters = std::make_unique<Imposters>(mDevice, *mPipelineCache, mSceneFormat, idFormat, mDepthConvention, mSampleCount);
+	if (!mImposters->valid()) {
+		std::cerr << "Imposters disabled" << std::endl;
+		mImposters.reset();
+		return true;
+	}
+	// From what is already loaded, by the completions of the loading jobs otherwise
+	mImposterBakeNeeded = true;
+	return true;
+}
+
+void Application::terminateImposters()
+{
+	mImposters.reset();
+	mImposterInstances.clear();
+}
+
+bool Application::initTextureFeedback()
+{
+	TRACE_SCOPE("initTextureFeedback");
+	bool enabled = false;
+	if (const char* feedback = std::getenv("LEARNWEBGPU_TEXTURE_FEEDBACK")) {
+		uint32_t value = 0;
+		auto result = std::from_chars(feedback, feedback + std::strlen(feedback), value);
+		if (result.ec == std::errc() && *result.ptr == '\0' && value <= 1) {
+			enabled = value == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_TEXTURE_FEEDBACK '" << feedback << "', expected 0 or 1" << std::endl;
+		}
+	}
+	// Which virtual textures need to know the pages to load
+	if (!enabled && !mVirtualTextures) return true;
+
+	// Before the render pipelines, which include its pass when it exists
+	mTextureFeedback = std::make_unique<TextureFeedback>(mDevice, *mPipelineCache, mDepthConvention);
+	if (!mTextureFeedback->valid()) {
+		std::cerr << "Texture feedback disabled" << std::endl;
+		mTextureFeedback.reset();
+		if (mVirtualTextures) std::cerr << "Virtual textures only show their coarsest level" << std::endl;
+	}
+	mTextureFeedbackFrames = 0;
+	return true;
+}
+
+void Application::terminateTextureFeedback()
+{
+	mTextureFeedback.reset();
+	mTextureResolutions.clear();
+	mPageRequests.clear();
+}
+
+bool Application::initVirtualTextures()
+{
+	TRACE_SCOPE("initVirtualTextures");
+	bool enabled = false;
+	if (const char* virtualTextures = std::getenv("LEARNWEBGPU_VIRTUAL_TEXTURES")) {
+		uint32_t value = 0;
+		auto result = std::from_chars(virtualTextures, virtualTextures + std::strlen(virtualTextures), value);
+		if (result.ec == std::errc() && *result.ptr == '\0' && value <= 1) {
+			enabled = value == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_VIRTUAL_TEXTURES '" << virtualTextures << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (!enabled) return true;
+
+	// Before the render pipelines, whose materials bind the page table
+	mVirtualTextures = std::make_unique<VirtualTextures>(mDevice, mTextureLoadOptions.srgb);
+	if (!mVirtualTextures->valid()) {
+		std::cerr << "Could not create the virtual texture cache, loading textures whole" << std::endl;
+		mVirtualTextures.reset();
+		return true;
+	}
+	mShaderDefines.insert("VIRTUAL_TEXTURES");
+	constexpr uint32_t slotSize = VirtualTextures::SlotSize;
+	std::cout << "Virtual textures: cache of " << VirtualTextures::SlotsPerSide * VirtualTextures::SlotsPerSide << " tiles, "
+		<< formatWithPrefix(double(4 * slotSize * slotSize * VirtualTextures::SlotsPerSide * VirtualTextures::SlotsPerSide), "B", 1024.0) << std::endl;
+	return true;
+}
+
+void Application::terminateVirtualTextures()
+{
+	// After the textures, whose views are those of its cache
+	mVirtualTextures.reset();
+}
+
+bool Application::initShadingRate()
+{
+	TRACE_SCOPE("initShadingRate");
+	if (mStereo) return true;
+	// The lighting pass shades every pixel of the G-buffer, which costs little to draw in full
+	if (mDeferredShading) {
+		if (std::getenv("LEARNWEBGPU_SHADING_RATE")) std::cerr << "Adaptive shading does not combine with deferred shading" << std::endl;
+		return true;
+	}
+	bool enabled = false;
+	if (const char* shadingRate = std::getenv("LEARNWEBGPU_SHADING_RATE")) {
+		uint32_t value = 0;
+		auto result = std::from_chars(shadingRate, shadingRate + std::strlen(shadingRate), value);
+		if (result.ec == std::errc() && *result.ptr == '\0' && value <= 1) {
+			enabled = value == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_SHADING_RATE '" << shadingRate << "', expected 0 or 1" << std::endl;
+		}
+	}
+	if (!enabled) return true;
+
+	// Before the render pipelines, whose view then binds the rates
+	mShadingRate = std::make_unique<ShadingRate>(mDevice, *mPipelineCache, mSceneFormat, mSampleCount);
+	if (!mShadingRate->valid()) {
+		std::cerr << "Could not create the shading rate buffers, adaptive shading disabled" << std::endl;
+		mShadingRate.reset();
+		return true;
+	}
+	mShaderDefines.insert("SHADING_RATE");
+	mShadingRateResetNeeded = false;
+	return true;
+}
+
+void Application::terminateShadingRate()
+{
+	mShadingRate.reset();
+}
+
+bool Application::initTemporalAA()
+{
+	TRACE_SCOPE("initTemporalAA");
+	const char* temporal = std::getenv("LEARNWEBGPU_TEMPORAL");
+	if (!temporal || mStereo) return true;
+	TemporalAA::Mode mode = TemporalAA::Mode::AntiAliasing;
+	if (std::strcmp(temporal, "reuse") == 0) {
+		mode = TemporalAA::Mode::Reuse;
+	}
+	else if (std::strcmp(temporal, "aa") != 0) {
+		std::cerr << "Ignoring invalid LEARNWEBGPU_TEMPORAL '" << temporal << "', expected aa or reuse" << std::endl;
+		return true;
+	}
+	// Both would skip pixels, and upsampled ones are no history to reuse
+	if (mode == TemporalAA::Mode::Reuse && mShadingRate) {
+		std::cerr << "Temporal reuse does not combine with adaptive shading, using temporal anti-aliasing" << std::endl;
+		mode = TemporalAA::Mode::AntiAliasing;
+	}
+	// Nor does the lighting pass skip any
+	if (mode == TemporalAA::Mode::Reuse && mDeferredShading) {
+		std::cerr << "Temporal reuse does not combine with deferred shading, using temporal anti-aliasing" << std::endl;
+		mode = TemporalAA::Mode::AntiAliasing;
+	}
+
+	// Before the render pipelines, whose view then binds the pattern in Reuse mode
+	mTemporalAA = std::make_unique<TemporalAA>(mDevice, *mPipelineCache, mSceneFormat, mSampleCount, mode);
+	if (!mTemporalAA->valid()) {
+		std::cerr << "Could not create the temporal uniforms, temporal accumulation disabled" << std::endl;
+		mTemporalAA.reset();
+		return true;
+	}
+	if (mode == TemporalAA::Mode::Reuse) mShaderDefines.insert("TEMPORAL_REUSE");
+	return true;
+}
+
+void Application::terminateTemporalAA()
+{
+	mTemporalAA.reset();
+	mViewUniforms.jitter = glm::vec2(0.0f);
+}
+
+bool Application::initAmbientOcclusion()
+{
+	TRACE_SCOPE("initAmbientOcclusion");
+	if (mStereo) return true;
+	uint32_t downscale = 2;
+	if (const char* value = std::getenv("LEARNWEBGPU_AO")) {
+		auto result = std::from_chars(value, value + std::strlen(value), downscale);
+		if (result.ec != std::errc() || *result.ptr != '\0' || (downscale != 0 && downscale != 2 && downscale != 4)) {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_AO '" << value << "', expected 0, 2 or 4" << std::endl;
+			downscale = 2;
+		}
+	}
+	if (downscale == 0) return true;
+
+	mAmbientOcclusion = std::make_unique<AmbientOcclusion>(mDevice, *mPipelineCache, mSceneFormat, mSampleCount, downscale);
+	if (!mAmbientOcclusion->valid()) {
+		std::cerr << "Could not create the ambient occlusion uniforms, ambient occlusion disabled" << std::endl;
+		mAmbientOcclusion.reset();
+	}
+	return true;
+}
+
+void Application::terminateAmbientOcclusion()
+{
+	mAmbientOcclusion.reset();
+}
+
+bool Application::initViews()
+{
+	if (mViews.empty() || mBenchmark) return true;
+	TRACE_SCOPE("initViews");
+	// These variants leave pixels to passes of the main window, by its own tiles and pattern, and
+	// the pipelines of deferred shading draw into its G-buffer
+	if (mStereo || mShadingRate || (mTemporalAA && mTemporalAA->mode() == TemporalAA::Mode::Reuse) || mDeferredShading) {
+		std::cerr << "Secondary views are not drawn in stereo, with adaptive shading, with temporal reuse nor with deferred shading" << std::endl;
+		return true;
+	}
+	for (std::unique_ptr<View>& view : mViews) {
+		if (!view->configure(mDevice, *mPipelineCache, mSurfaceFormats, mPresentMode, mDepthTextureFormat, mSampleCount)) return false;
+	}
+
+	SupportedLimits supportedLimits;
+	mDevice.getLimits(&supportedLimits);
+	uint32_t alignment = std::max<uint32_t>(supportedLimits.limits.minUniformBufferOffsetAlignment, 16);
+	mViewUniformStride = (sizeof(ViewUniforms) + alignment - 1) / alignment * alignment;
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Secondary view uniforms";
+	bufferDesc.size = uint64_t(mViews.size()) * mViewUniformStride;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mViewUniformBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Uniforms, "Application");
+	// Zero matrices, never those of a camera, so that each view is uploaded on its first frame
+	mSecondaryViewUniforms.assign(mViews.size(), ViewUniforms{});
+	return mViewUniformBuffer != nullptr;
+}
+
+void Application::terminateViews()
+{
+	for (std::unique_ptr<View>& view : mViews) {
+		view->unconfigure();
+	}
+	if (mViewUniformBuffer) {
+		destroyTracked(mViewUniformBuffer);
+		mViewUniformBuffer.release();
+	}
+	mViewUniformBuffer = nullptr;
+	mSecondaryViewUniforms.clear();
+}
+
+void Application::updateViews()
+{
+	TRACE_SCOPE("Update views");
+	if (!mViewUniformBuffer) return;
+	for (size_t i = 0; i < mViews.size(); ++i) {
+		View& view = *mViews[i];
+		if (!view.acquire()) continue;
+
+		// Same lens as the main camera, for the aspect ratio of the view's window
+		CameraState camera = mCameraState;
+		camera.angles.x += view.yawOffset();
+		ViewUniforms uniforms{};
+		uniforms.projectionMatrix = mDepthConvention.perspective(45 * glm::pi<float>() / 180.0f, view.size().x / (float)view.size().y, 0.01f, 100.0f);
+		uniforms.viewMatrix = cameraViewMatrix(camera);
+		if (std::memcmp(&uniforms, &mSecondaryViewUniforms[i], sizeof(ViewUniforms)) != 0) {
+			mSecondaryViewUniforms[i] = uniforms;
+			writeBuffer(mViewUniformBuffer, i * mViewUniformStride, &uniforms, sizeof(ViewUniforms));
+		}
+	}
+}
+
+void Application::updateTextureFeedback()
+{
+	if (!mTextureFeedback || !mTextureFeedback->poll(mTextureResolutions, mPageRequests)) return;
+	// Textures of the scene are indexed like the slots, as DrawUniforms::textureId is
+	const std::vector<ResourceCache::TextureHandle>& textures = mScene.textures();
+	for (size_t i = 0; i < textures.size() && i < mTextureResolutions.size(); ++i) {
+		if (textures[i]) mResourceCache->setRequestedResolution(textures[i], mTextureResolutions[i]);
+	}
+	if (mVirtualTextures) mVirtualTextures->request(mPageRequests);
+}
+
+void Application::updatePicking()
+{
+	uint32_t picked;
+	if (!mObjectPicker || !mObjectPicker->poll(picked)) return;
+	// IDs are positions in the draw order, which may have changed since the click
+	const std::vector<uint32_t>& drawOrder = mScene.drawOrder();
+	selectInstance(picked < drawOrder.size() ? drawOrder[picked] : ObjectPicker::NoInstance);
+}
+
+void Application::pickWithRay(glm::dvec2 cursor)
+{
+	// From the near plane to the far one through the cursor, in the space of the instances
+	glm::mat4 inverseMatrix = glm::inverse(mViewUniforms.projectionMatrix * mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix);
+	glm::vec2 ndc(2.0f * static_cast<float>(cursor.x) / mWindowWidth - 1.0f, 1.0f - 2.0f * static_cast<float>(cursor.y) / mWindowHeight);
+	glm::vec4 nearPoint = inverseMatrix * glm::vec4(ndc, mDepthConvention.nearDepth(), 1.0f);
+	// Reversed depths only reach 0 at infinity, so the ray stops short of it
+	float farDepth = mDepthConvention.reversed ? 1e-6f : mDepthConvention.farDepth();
+	glm::vec4 farPoint = inverseMatrix * glm::vec4(ndc, farDepth, 1.0f);
+	Ray ray;
+	ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+	ray.direction = glm::vec3(farPoint) / farPoint.w - ray.origin;
+	ray.tMax = 1.0f;
+
+	// Instances whose box the ray reaches, nearest first, are tested against their mesh's triangles
+	const std::vector<uint32_t>& drawOrder = mScene.drawOrder();
+	uint32_t picked = ObjectPicker::NoInstance;
+	auto testInstance = [&](uint32_t instanceIndex, Ray& sceneRay) {
+		const Scene::Instance& instance = mScene.instances()[instanceIndex];
+		const MeshBvh* meshBvh = mScene.meshes()[instance.mesh].bvh.get();
+		if (!meshBvh) return false;
+		// Distances along the ray are the same in model space, the transform being affine
+		glm::mat4 toModel = glm::inverse(instance.modelMatrix);
+		Ray modelRay;
+		modelRay.origin = glm::vec3(toModel * glm::vec4(sceneRay.origin, 1.0f));
+		modelRay.direction = glm::vec3(toModel * glm::vec4(sceneRay.direction, 0.0f));
+		modelRay.tMax = sceneRay.tMax;
+		MeshBvh::Hit hit;
+		if (!meshBvh->intersect(modelRay, hit)) return false;
+		sceneRay.tMax = modelRay.tMax;
+		picked = instanceIndex;
+		return true;
+	};
+	// Dynamic instances first, their hits shortening the ray through the BVH
+	mDynamicInstances.intersect(ray, [&](uint32_t object, Ray& sceneRay) {
+		return testInstance(drawOrder[object], sceneRay);
+	});
+	mInstanceBvh.intersect(ray, [&](uint32_t entry, Ray& sceneRay) {
+		return testInstance(drawOrder[mBvhInstances[mInstanceBvh.primitives()[entry]]], sceneRay);
+	});
+	selectInstance(picked);
+}
+
+void Application::selectInstance(uint32_t instance)
+{
+	mSelectedInstance = instance;
+	if (mSelectedInstance == ObjectPicker::NoInstance) {
+		std::cout << "Picked nothing" << std::endl;
+	}
+	else {
+		std::cout << "Picked instance " << mSelectedInstance << " (mesh " << mScene.instances()[mSelectedInstance].mesh << ")" << std::endl;
+	}
+}
+
+void Application::updatePointLights()
+{
+	if (!mClusteredLights || (!mPointLightsDirty && !mAnimate)) return;
+	// Uploaded in world space, each light bobbing at its own phase
+	const glm::mat4& M = mFrameUniforms.modelMatrix;
+	float scale = glm::length(glm::vec3(M[0]));
+	std::vector<ClusteredLights::PointLight> lights(mPointLights);
+	for (size_t i = 0; i < lights.size(); ++i) {
+		glm::vec3 position = lights[i].position;
+		position.z += 0.05f * std::sin(2.0f * mFrameUniforms.time + static_cast<float>(i));
+		lights[i].position = glm::vec3(M * glm::vec4(position, 1.0f));
+		lights[i].radius *= scale;
+	}
+	mClusteredLights->setLights(mQueue, lights);
+	mPointLightsDirty = false;
+}
+
+void Application::updateResize()
+{
+	using Clock = std::chrono::steady_clock;
+	// Time without any resize after which the size is considered settled
+	constexpr Clock::duration settleDelay = std::chrono::milliseconds(200);
+
+	Clock::time_point now = Clock::now();
+	if (mResizePending) {
+		TRACE_SCOPE("Resize");
+		mResizePending = false;
+		mLastResizeTime = now;
+		// Pooled targets larger than the surface texture reach it through the blit
+		mLiveResize = mBlit->ready();
+		onResize();
+	}
+	else if (mLiveResize && now - mLastResizeTime >= settleDelay) {
+		TRACE_SCOPE("Resize");
+		mLiveResize = false;
+		onResize();
+	}
+	mTexturePool->collect();
+}
+
+void Application::updateRenderScale()
+{
+	uint64_t measuredFrameCount = mGpuProfiler->measuredFrameCount();
+	if (mDynamicResolution && measuredFrameCount != mResolutionMeasuredFrameCount) {
+		mResolutionMeasuredFrameCount = measuredFrameCount;
+		// Frames over budget degrade the optional passes first, see updatePassBudget()
+		double gpuFrameMs = mGpuProfiler->lastFrameMs();
+		bool passesDegradable = mPassBudget && !mPassBudget->exhausted() && gpuFrameMs > mResolutionController->settings().targetFrameMs;
+		// Lower scales reach the surface texture through the blit
+		if (!passesDegradable && mBlit->ready() && mResolutionController->update(gpuFrameMs)) {
+			// The depth pyramid covers the part of the depth buffer of the previous scale
+			mDepthPyramidValid = false;
+			mFrameDirty = true;
+		}
+	}
+
+	// Targets change when the scene starts or stops being drawn at the size of the window
+	if (sceneTargetNeeded() != mSceneTarget) {
+		TRACE_SCOPE("Update render targets");
+		updateRenderTargets();
+	}
+}
+
+void Application::updatePassBudget()
+{
+	if (!mPassBudget) return;
+	uint64_t measuredFrameCount = mGpuProfiler->measuredFrameCount();
+	if (measuredFrameCount != mPassBudgetMeasuredFrameCount) {
+		mPassBudgetMeasuredFrameCount = measuredFrameCount;
+		mPassBudget->update(mGpuProfiler->lastFrameMs(), mGpuProfiler->timings());
+	}
+	mPassBudget->beginFrame();
+	if (mShadowMaps) mShadowMaps->setReducedUpdates(mPassBudget->level(mBudgetedWork.shadows) != PassBudget::Level::Full);
+}
+
+bool Application::renderingOnDemand() const
+{
+	return mRenderOnDemand || (mFrameGovernor && mFrameGovernor->targets().renderOnDemand);
+}
+
+bool Application::paceFrame()
+{
+	if (!mFrameGovernor) return true;
+	if (mFrameGovernor->update(currentTime())) applyFramePreset();
+	double interval = mFrameGovernor->frameInterval();
+	if (interval <= 0.0) return true;
+
+	using Clock = std::chrono::steady_clock;
+	Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval));
+	Clock::time_point now = Clock::now();
+#ifdef __EMSCRIPTEN__
+	// Animation frames may come up to half a refresh period early, and still be on time
+	Clock::duration jitter = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(0.5 / mRefreshRate));
+	if (now + jitter < mNextFrameTime) return false;
+#else
+	if (now < mNextFrameTime) {
+		TRACE_SCOPE("Wait for governor");
+		std::this_thread::sleep_until(mNextFrameTime);
+		now = Clock::now();
+	}
+#endif
+	// A frame later than a period starts the schedule over, rather than the next ones catching up
+	mNextFrameTime = now - mNextFrameTime < period ? mNextFrameTime + period : now + period;
+	return true;
+}
+
+void Application::applyFramePreset()
+{
+	FrameGovernor::Targets targets = mFrameGovernor->targets();
+	DynamicResolution::Settings settings = mResolutionController->settings();
+	settings.targetFrameMs = targets.gpuBudget * 1000.0 / targets.frameRate;
+	settings.maxScale = std::max(targets.maxRenderScale, settings.minScale);
+	mResolutionController->setSettings(settings);
+	if (mPassBudget) {
+		PassBudget::Settings passSettings = mPassBudget->settings();
+		passSettings.targetFrameMs = settings.targetFrameMs;
+		mPassBudget->setSettings(passSettings);
+	}
+	// The scale may have changed, see updateRenderScale()
+	mDepthPyramidValid = false;
+	mFrameDirty = true;
+
+	const PowerState& power = mFrameGovernor->powerState();
+	std::cout << "Frame governor: " << FrameGovernor::presetName(mFrameGovernor->preset()) << " at " << targets.frameRate << " Hz ("
+		<< powerSourceName(power.source) << " power, " << thermalStateName(power.thermal) << " thermal state)" << std::endl;
+}
+
+glm::uvec2 Application::renderSize() const
+{
+	float scale = mDynamicResolution ? mResolutionController->scale() : mFrameGovernor ? mFrameGovernor->targets().maxRenderScale : 1.0f;
+	glm::uvec2 size = glm::round(glm::vec2(mWindowWidth, mWindowHeight) * scale);
+	return glm::max(size, glm::uvec2(1));
+}
+
+bool Application::sceneTargetNeeded() const
+{
+	return mLiveResize || renderSize() != glm::uvec2(mWindowWidth, mWindowHeight);
+}
+
+bool Application::initRenderPipeline()
+{
+	TRACE_SCOPE("initRenderPipeline");
+	std::cout << "Creating shader module..." << std::endl;
+	mShaderReflection.clear();
+	mShaderModule = createShaderModule();
+
+	// Check for errors
+	if (mShaderModule == nullptr) {
+		std::cerr << "Could not load shader!" << std::endl;
+		exit(1);
+	}
+	else {
+		std::cout << "Shader module: " << mShaderModule << std::endl;
+	}
+
+	mDepthShaderModule = createDepthShaderModule();
+	if (mDepthShaderModule == nullptr) {
+		std::cerr << "Could not load depth pre-pass shader!" << std::endl;
+		exit(1);
+	}
+	// Reflected before the bind group layouts are derived, its fragments reading the draw
+	// uniforms too, the module being reused from the cache by createRenderPipelines()
+	if (mTextureFeedback) createShaderModule("TEXTURE_FEEDBACK");
+	// And the kernel lighting the G-buffer, for the view group to be visible to compute
+	ShaderModule lightingShaderModule = mDeferredShading ? createShaderModule("DEFERRED_LIGHTING") : nullptr;
+	if (mDeferredShading && !lightingShaderModule) {
+		std::cerr << "Could not load deferred lighting shader!" << std::endl;
+		exit(1);
+	}
+	mShaderReflection.checkVertexBuffers("vs_main", mVertexPulling ? std::span<const VertexBufferLayout>() : mVertexLayout.bufferLayouts());
+	mShaderReflection.checkVertexBuffers("vs_depth", { &mVertexLayout.positionBufferLayout(), 1 });
+
+	mPipelines = createRenderPipelines(mShaderModule, mDepthShaderModule);
+	if (mDeferredShading) {
+		mDeferredShading->setPipeline(createDeferredLightingPipeline(lightingShaderModule));
+	}
+
+#ifdef SHADER_HOT_RELOAD
+	mResourceWatcher = std::make_unique<FileWatcher>(RESOURCE_DIR);
+#endif // SHADER_HOT_RELOAD
+
+	return std::none_of(mPipelines.begin(), mPipelines.end(), [](const PipelineCache::AsyncRenderPipeline& pipeline) {
+		return pipeline && pipeline->status == PipelineCache::AsyncPipeline<RenderPipeline>::Status::Failed;
+	});
+}
+
+ShaderModule Application::createShaderModule(const char* variant)
+{
+	// The shader's VertexInput and decodeVertex() are generated to match the vertex layout
+	std::string shaderSource = shaderPrelude();
+	if (!ResourceManager::loadShaderSource(RESOURCE_DIR "/shader.wgsl", shaderSource)) {
+		return nullptr;
+	}
+	ShaderPreprocessor::Defines defines = mShaderDefines;
+	if (variant) defines.insert(variant);
+	std::string variantSource;
+	if (!ShaderPreprocessor::process(shaderSource, defines, variantSource)) {
+		return nullptr;
+	}
+	// The bind group layouts are derived from it
+	if (!mShaderReflection.add(variantSource)) {
+		return nullptr;
+	}
+	// Compiled once per variant, a pipeline rebuilt with the same source and defines reuses it
+	return mPipelineCache->shaderModule(variantSource);
+}
+
+std::string Application::shaderPrelude() const
+{
+	std::string prelude = mVertexLayout.wgslDeclarations();
+	// The streams of the vertex page follow the bindings of the draw group
+	if (mVertexPulling) prelude += mVertexLayout.wgslPullDeclarations((uint32_t)BindGroupSlot::Draw, PulledVertexBinding);
+	return prelude;
+}
+
+ShaderModule Application::createDepthShaderModule()
+{
+	// The shader's PositionInput and decodePosition() read positions alone
+	std::string shaderSource = mVertexLayout.wgslPositionDeclarations();
+	if (!ResourceManager::loadShaderSource(RESOURCE_DIR "/depth_prepass.wgsl", shaderSource)) {
+		return nullptr;
+	}
+	// For the declarations of the groups it shares with shader.wgsl
+	std::string variantSource;
+	if (!ShaderPreprocessor::process(shaderSource, mShaderDefines, variantSource)) {
+		return nullptr;
+	}
+	if (!mShaderReflection.add(variantSource)) {
+		return nullptr;
+	}
+	return mPipelineCache->shaderModule(variantSource);
+}
+
+Application::RenderPipelines Application::createRenderPipelines(ShaderModule shaderModule, ShaderModule depthShaderModule)
+{
+	RenderPipelines pipelines;
+	pipelines[(size_t)DrawPass::Main] = createRenderPipeline(shaderModule, DrawPass::Main);
+	pipelines[(size_t)DrawPass::DepthPrePass] = createRenderPipeline(depthShaderModule, DrawPass::DepthPrePass);
+	pipelines[(size_t)DrawPass::AfterDepthPrePass] = createRenderPipeline(shaderModule, DrawPass::AfterDepthPrePass);
+	pipelines[(size_t)DrawPass::Shadow] = createRenderPipeline(depthShaderModule, DrawPass::Shadow);
+	pipelines[(size_t)DrawPass::Transparent] = createRenderPipeline(shaderModule, DrawPass::Transparent);
+	pipelines[(size_t)DrawPass::WeightedTransparent] = createRenderPipeline(shaderModule, DrawPass::WeightedTransparent);
+	// From a variant of the same source, left null when disabled
+	if (mTextureFeedback) {
+		ShaderModule feedbackShaderModule = createShaderModule("TEXTURE_FEEDBACK");
+		if (feedbackShaderModule) {
+			pipelines[(size_t)DrawPass::TextureFeedback] = createRenderPipeline(feedbackShaderModule, DrawPass::TextureFeedback);
+		}
+		else {
+			std::cerr << "Could not load texture feedback shader!" << std::endl;
+		}
+	}
+	return pipelines;
+}
+
+PipelineCache::AsyncComputePipeline Application::createDeferredLightingPipeline(ShaderModule shaderModule)
+{
+	if (!mBindGroupLayouts[0]) initBindGroupLayouts();
+	return mDeferredShading->createPipeline(
+		shaderModule, mBindGroupLayouts[(size_t)BindGroupSlot::Frame], mBindGroupLayouts[(size_t)BindGroupSlot::View]
+	);
+}
+
+PipelineCache::AsyncRenderPipeline Application::createRenderPipeline(ShaderModule shaderModule, DrawPass drawPass)
+{
+	RenderPipelineDescriptor pipelineDesc{};
+
+	// Attribute formats and offsets, and how they are spread across buffers, depend on the vertex layout.
+	// Depth-only passes only fetch positions.
+	bool depthOnly = drawPass == DrawPass::DepthPrePass || drawPass == DrawPass::Shadow;
+	std::span<const VertexBufferLayout> vertexBufferLayouts = mVertexLayout.bufferLayouts();
+	if (depthOnly) {
+		vertexBufferLayouts = { &mVertexLayout.positionBufferLayout(), 1 };
+	}
+	// Pulled by vs_main from the storage buffers of the draw group instead
+	else if (mVertexPulling) {
+		vertexBufferLayouts = {};
+	}
+
+	pipelineDesc.vertex.bufferCount = vertexBufferLayouts.size();
+	pipelineDesc.vertex.buffers = vertexBufferLayouts.data();
+	pipelineDesc.vertex.module = shaderModule;
+	pipelineDesc.vertex.entryPoint = depthOnly ? "vs_depth" : "vs_main";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+
+	// Each sequence of 3 vertices is considered as a triangle
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	// When not specified, vertices are considered sequentially.
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::None;
+
+	// We tell that the programmable fragment shader stage is described
+	// by the function called 'fs_main' in the shader module.
+	bool weighted = drawPass == DrawPass::WeightedTransparent;
+	bool feedback = drawPass == DrawPass::TextureFeedback;
+	// With deferred shading, opaque draws write the G-buffer rather than the scene
+	bool gbuffer = mDeferredShading && (drawPass == DrawPass::Main || drawPass == DrawPass::AfterDepthPrePass);
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = weighted ? "fs_weighted" : feedback ? "fs_feedback" : gbuffer ? "fs_gbuffer" : "fs_main";
+	// Values of the shader's override declarations, fixed when the pipeline is built
+	ConstantEntry srgbTextureConstant{};
+	srgbTextureConstant.key = "srgbTexture";
+	srgbTextureConstant.value = mTextureLoadOptions.srgb ? 1.0 : 0.0;
+	fragmentState.constantCount = 1;
+	fragmentState.constants = &srgbTextureConstant;
+
+	// Opaque draws replace what they cover, blending being left to transparent ones, which
+	// keep the alpha of the target
+	BlendState blendState{};
+	blendState.color.srcFactor = BlendFactor::SrcAlpha;
+	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+	blendState.color.operation = BlendOperation::Add;
+	blendState.alpha.srcFactor = BlendFactor::Zero;
+	blendState.alpha.dstFactor = BlendFactor::One;
+	blendState.alpha.operation = BlendOperation::Add;
+
+	std::array<ColorTargetState, 3> colorTargets{};
+	colorTargets[0].format = mSceneFormat;
+	colorTargets[0].blend = drawPass == DrawPass::Transparent ? &blendState : nullptr;
+	colorTargets[0].writeMask = ColorWriteMask::All; // We could write to only some of the color channels.
+	// Instance IDs for picking, which integer formats cannot blend
+	colorTargets[1].format = ObjectPicker::IdFormat;
+	colorTargets[1].blend = nullptr;
+	colorTargets[1].writeMask = ColorWriteMask::All;
+
+	// Weighted fragments add up in the accumulation and scale down the revealage by 1 - alpha
+	BlendState accumulationBlend{};
+	accumulationBlend.color.srcFactor = BlendFactor::One;
+	accumulationBlend.color.dstFactor = BlendFactor::One;
+	accumulationBlend.color.operation = BlendOperation::Add;
+	accumulationBlend.alpha = accumulationBlend.color;
+	BlendState revealageBlend{};
+	revealageBlend.color.srcFactor = BlendFactor::Zero;
+	revealageBlend.color.dstFactor = BlendFactor::OneMinusSrc;
+	revealageBlend.color.operation = BlendOperation::Add;
+	revealageBlend.alpha = revealageBlend.color;
+	if (weighted) {
+		colorTargets[0].format = WeightedBlendedOit::AccumulationFormat;
+		colorTargets[0].blend = &accumulationBlend;
+		colorTargets[1].format = WeightedBlendedOit::RevealageFormat;
+		colorTargets[1].blend = &revealageBlend;
+	}
+	// Normals, albedo, then the IDs after them
+	if (gbuffer) {
+		colorTargets[2] = colorTargets[1];
+		colorTargets[0].format = DeferredShading::NormalFormat;
+		colorTargets[1].format = DeferredShading::AlbedoFormat;
+	}
+
+	// One target per color attachment of the main pass, of the G-buffer pass or of the weighted
+	// transparency pass, the texture feedback pass having none
+	fragmentState.targetCount = weighted || mObjectPicker ? 2 : 1;
+	if (gbuffer) fragmentState.targetCount = mObjectPicker ? 3 : 2;
+	if (feedback) fragmentState.targetCount = 0;
+	fragmentState.targets = colorTargets.data();
+	// Rasterization only writes depth in depth-only passes
+	pipelineDesc.fragment = depthOnly ? nullptr : &fragmentState;
+
+	// Setup depth state, fragments after the depth pre-pass being shaded only when they are
+	// the ones it kept, and transparent ones being tested against opaque depths only
+	bool transparent = drawPass == DrawPass::Transparent || weighted;
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.depthCompare = drawPass == DrawPass::AfterDepthPrePass ? CompareFunction(CompareFunction::Equal) : mDepthConvention.nearer();
+	depthStencilState.depthWriteEnabled = drawPass != DrawPass::AfterDepthPrePass && !transparent;
+	depthStencilState.format = mDepthTextureFormat;
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+	if (drawPass == DrawPass::Shadow) {
+		// Pushed away from the light along the slope of the triangles, against shadow acne
+		// where the texels of the map are larger than the surface they cover
+		depthStencilState.format = ShadowMaps::DepthFormat;
+		depthStencilState.depthCompare = CompareFunction::Less;
+		depthStencilState.depthBias = 1;
+		depthStencilState.depthBiasSlopeScale = 2.0f;
+		depthStencilState.depthBiasClamp = 0.0f;
+	}
+	if (feedback) depthStencilState.format = TextureFeedback::DepthFormat;
+
+	pipelineDesc.depthStencil = &depthStencilState;
+	// Samples per pixel, those of the color and depth attachments
+	pipelineDesc.multisample.count = drawPass == DrawPass::Shadow || feedback ? 1 : mSampleCount;
+	// Default value for the mask, meaning "all bits on"
+	pipelineDesc.multisample.mask = ~0u;
+	// Default value as well, transparent draws blending instead
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	// Bind group layouts are shared by the pipelines of all the passes, the depth pre-pass
+	// reading neither the frame's color nor the material, and shadow passes having a view of
+	// their own
+	if (!mBindGroupLayouts[0]) initBindGroupLayouts();
+	// The slots of the texture feedback after them
+	std::array<BindGroupLayout, BindGroupSlotCount + 1> layouts = {};
+	std::copy(mBindGroupLayouts.begin(), mBindGroupLayouts.end(), layouts.begin());
+	if (drawPass == DrawPass::Shadow) {
+		layouts[(size_t)BindGroupSlot::View] = mShadowCasterViewLayout;
+	}
+	static_assert(TextureFeedback::BindGroupIndex == BindGroupSlotCount);
+	if (feedback) layouts[BindGroupSlotCount] = mTextureFeedback->bindGroupLayout();
+
+	// Create the pipeline layout
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = (uint32_t)(feedback ? BindGroupSlotCount + 1 : BindGroupSlotCount);
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)layouts.data();
+	layoutDesc.nextInChain = mDrawConstants->pipelineLayoutChain();
+	PipelineLayout layout = mPipelineCache->pipelineLayout(layoutDesc);
+
+	pipelineDesc.layout = layout;
+
+	// Compiling shaders may take a while, which must not block frames
+	return mPipelineCache->renderPipelineAsync(pipelineDesc);
+}
+
+void Application::initBindGroupLayouts()
+{
+	// The structures replicated in C++ must have the layout of those of the shaders, which the
+	// sizes of the bindings come from
+	mShaderReflection.checkStruct("FrameUniforms", sizeof(FrameUniforms), { { "time", offsetof(FrameUniforms, time) } });
+	mShaderReflection.checkStruct("ViewUniforms", sizeof(ViewUniforms), { { "viewMatrix", offsetof(ViewUniforms, viewMatrix) }, { "jitter", offsetof(ViewUniforms, jitter) } });
+	mShaderReflection.checkStruct("DrawUniforms", sizeof(DrawUniforms), { { "firstVisibleInstance", offsetof(DrawUniforms, firstVisibleInstance) }, { "textureId", offsetof(DrawUniforms, textureId) } });
+	mShaderReflection.checkStruct("Instance", sizeof(InstanceData), { { "material", offsetof(InstanceData, material) }, { "batch", offsetof(InstanceData, batch) } });
+	mShaderReflection.checkStruct("Material", sizeof(MaterialData), { { "textureLayer", offsetof(MaterialData, textureLayer) }, { "virtualTexture", offsetof(MaterialData, virtualTexture) } });
+	if (mVirtualTextures) {
+		mShaderReflection.checkStruct("VirtualTexture", sizeof(VirtualTextures::Descriptor), { { "levelCount", offsetof(VirtualTextures::Descriptor, levelCount) }, { "levelOffsets", offsetof(VirtualTextures::Descriptor, levelOffsets) } });
+	}
+	if (mShadows) {
+		mShaderReflection.checkStruct("ShadowUniforms", sizeof(ShadowMaps::Uniforms), { { "cascadeEnds", offsetof(ShadowMaps::Uniforms, cascadeEnds) }, { "lightDirection", offsetof(ShadowMaps::Uniforms, lightDirection) } });
+	}
+	if (mClusteredLighting) {
+		mShaderReflection.checkStruct("ClusterUniforms", sizeof(ClusteredLights::Uniforms), { { "gridSize", offsetof(ClusteredLights::Uniforms, gridSize) }, { "sliceBias", offsetof(ClusteredLights::Uniforms, sliceBias) } });
+		mShaderReflection.checkStruct("PointLight", sizeof(ClusteredLights::PointLight), { { "color", offsetof(ClusteredLights::PointLight, color) }, { "intensity", offsetof(ClusteredLights::PointLight, intensity) } });
+	}
+	if (mShadingRate) {
+		mShaderReflection.checkStruct("ShadingRateUniforms", sizeof(ShadingRate::Uniforms), { { "tileStride", offsetof(ShadingRate::Uniforms, tileStride) }, { "motionScale", offsetof(ShadingRate::Uniforms, motionScale) } });
+	}
+	if (mEnvironmentLighting) {
+		mShaderReflection.checkStruct("EnvironmentUniforms", sizeof(EnvironmentLighting::Uniforms), { { "irradiance", offsetof(EnvironmentLighting::Uniforms, irradiance) }, { "levelCount", offsetof(EnvironmentLighting::Uniforms, levelCount) } });
+	}
+	if (mTemporalAA && mTemporalAA->mode() == TemporalAA::Mode::Reuse) {
+		mShaderReflection.checkStruct("TemporalUniforms", sizeof(TemporalAA::Uniforms), { { "pattern", offsetof(TemporalAA::Uniforms, pattern) }, { "phase", offsetof(TemporalAA::Uniforms, phase) } });
+	}
+	if (mDeferredShading) {
+		mShaderReflection.checkStruct("DeferredUniforms", sizeof(DeferredShading::Uniforms), { { "background", offsetof(DeferredShading::Uniforms, background) }, { "sceneSize", offsetof(DeferredShading::Uniforms, sceneSize) } });
+	}
+
+	// Entries of the variables the shaders declare in each group, with the stages reaching them,
+	// the uniforms of the frame, the view and the draw being bound at the slice of the uniform
+	// ring of the current frame, or at the offset of the batch
+	auto createLayout = [this](const BindGroupLayoutEntry* entries, size_t entryCount) {
+		BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+		bindGroupLayoutDesc.entryCount = (uint32_t)entryCount;
+		bindGroupLayoutDesc.entries = entries;
+		return mPipelineCache->bindGroupLayout(bindGroupLayoutDesc);
+	};
+	for (size_t slot = 0; slot < BindGroupSlotCount; ++slot) {
+		std::vector<BindGroupLayoutEntry> entries = mShaderReflection.bindGroupLayoutEntries((uint32_t)slot);
+		for (BindGroupLayoutEntry& entry : entries) {
+			bool uniformRing = (slot == (size_t)BindGroupSlot::Frame || slot == (size_t)BindGroupSlot::View) && entry.binding == 0;
+			bool drawUniforms = slot == (size_t)BindGroupSlot::Draw && entry.binding == 2 && !mDrawConstants->storageArray();
+			entry.buffer.hasDynamicOffset = uniformRing || drawUniforms;
+		}
+		mBindGroupLayouts[slot] = createLayout(entries.data(), entries.size());
+
+		// Shadow casters only see the view uniforms, which the depth shader reads
+		if (slot == (size_t)BindGroupSlot::View) {
+			if (entries.empty() || entries.front().binding != 0) {
+				std::cerr << "The shaders declare no view uniforms at binding 0 of the view group" << std::endl;
+			}
+			mShadowCasterViewLayout = createLayout(entries.data(), std::min<size_t>(entries.size(), 1));
+		}
+	}
+}
+
+void Application::terminateRenderPipeline()
+{
+#ifdef SHADER_HOT_RELOAD
+	mResourceWatcher.reset();
+#endif // SHADER_HOT_RELOAD
+	// Callbacks of a reload still running write to it, so it must outlive them
+	if (mShaderReload && !mShaderReload->done()) mShaderReload.release();
+	mShaderReload.reset();
+
+	// Owned by the pipeline cache, released with the device
+	for (PipelineCache::AsyncRenderPipeline& pipeline : mPipelines) {
+		pipeline.reset();
+	}
+	mShaderModule = nullptr;
+	mDepthShaderModule = nullptr;
+	mBindGroupLayouts = {};
+	mShadowCasterViewLayout = nullptr;
+}
+
+void Application::updateShaderReload()
+{
+#ifdef SHADER_HOT_RELOAD
+	for (const std::filesystem::path& path : mResourceWatcher->poll()) {
+		if (path.extension() == ".wgsl") mShaderReloadRequested = true;
+	}
+#endif // SHADER_HOT_RELOAD
+
+	// Swap pipelines between frames, once the new one is built
+	if (mShaderReload && mShaderReload->done()) {
+		if (mShaderReload->failed()) {
+			std::cerr << "Could not reload shader, keeping the previous one" << std::endl;
+		}
+		else {
+			std::cout << "Reloaded shader" << std::endl;
+			mShaderModule = mShaderReload->shaderModule;
+			mDepthShaderModule = mShaderReload->depthShaderModule;
+			mPipelines = mShaderReload->pipelines;
+			if (mDeferredShading) mDeferredShading->setPipeline(mShaderReload->deferredLighting);
+			invalidateRenderBundles();
+			mFrameDirty = true;
+		}
+		mShaderReload.reset();
+	}
+
+	// Edits made during a reload are picked up by the next one
+	if (mShaderReloadRequested && !mShaderReload) {
+		mShaderReloadRequested = false;
+		startShaderReload();
+	}
+}
+
+void Application::startShaderReload()
+{
+	mShaderReload = std::make_unique<ShaderReload>();
+	ShaderReload* reload = mShaderReload.get();
+	reload->shaderModule = createShaderModule();
+	reload->depthShaderModule = createDepthShaderModule();
+	if (!reload->shaderModule || !reload->depthShaderModule) return;
+
+#ifdef WEBGPU_BACKEND_WGPU
+	// wgpu-native does not implement getCompilationInfo, and reports errors when creating the module
+	reload->compilationInfoDone = true;
+#else
+	// Lines of the prelude are not part of the file. Those of its includes are, from the first
+	// #include on, where lines are those of the composed source.
+	std::string prelude = shaderPrelude();
+	uint64_t preludeLineCount = std::count(prelude.begin(), prelude.end(), '\n');
+	reload->compilationInfoCallback = reload->shaderModule.getCompilationInfo([reload, preludeLineCount](CompilationInfoRequestStatus status, const CompilationInfo& compilationInfo) {
+		if (status == CompilationInfoRequestStatus::Success) {
+			for (size_t i = 0; i < compilationInfo.messageCount; ++i) {
+				const WGPUCompilationMessage& message = compilationInfo.messages[i];
+				if (message.lineNum > preludeLineCount) {
+					std::cerr << "shader.wgsl:" << message.lineNum - preludeLineCount << ":" << message.linePos << ": ";
+				}
+				else {
+					std::cerr << "shader prelude:" << message.lineNum << ":" << message.linePos << ": ";
+				}
+				std::cerr << (message.type == CompilationMessageType::Error ? "error: " : "warning: ")
+					<< (message.message ? message.message : "") << std::endl;
+			}
+		}
+		reload->compilationInfoDone = true;
+	});
+#endif // WEBGPU_BACKEND_WGPU
+
+	reload->pipelines = createRenderPipelines(reload->shaderModule, reload->depthShaderModule);
+	if (mDeferredShading) {
+		ShaderModule lightingShaderModule = createShaderModule("DEFERRED_LIGHTING");
+		if (!lightingShaderModule) {
+			reload->shaderModule = nullptr;
+			return;
+		}
+		reload->deferredLighting = createDeferredLightingPipeline(lightingShaderModule);
+	}
+}
+
+bool Application::initTexture()
+{
+	TRACE_SCOPE("initTexture");
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::Repeat;
+	samplerDesc.addressModeV = AddressMode::Repeat;
+	samplerDesc.addressModeW = AddressMode::Repeat;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Linear;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 8.0f;
+	samplerDesc.compare = CompareFunction::Undefined;
+	samplerDesc.maxAnisotropy = 1;
+	mSampler = mPipelineCache->sampler(samplerDesc);
+
+	// Single grey texel shown until the actual texture is loaded
+	static unsigned char placeholderPixel[4] = { 128, 128, 128, 255 };
+	ResourceManager::Image placeholder;
+	placeholder.width = 1;
+	placeholder.height = 1;
+	placeholder.pixels = { placeholderPixel, [](void*) {} };
+	TextureView placeholderView = nullptr;
+	Texture placeholderTexture = ResourceManager::createTexture(placeholder, mDevice, mTextureLoadOptions, &placeholderView);
+	if (!placeholderTexture) {
+		std::cerr << "Could not create placeholder texture!" << std::endl;
+		return false;
+	}
+	mScene.setMaterialTexture(mModelMaterial, ResourceCache::makeTexture(placeholderTexture, placeholderView));
+  return placeholderView != nullptr;
+}
+
+bool Application::onTextureLoaded(ResourceCache::TextureHandle texture)
+{
+	if (!texture || !texture->view) {
+		std::cerr << "Could not create texture!" << std::endl;
+		return false;
+	}
+
+	// The previous texture is released with its last handle, and its bind group with the
+	// next draw list
+	mScene.setMaterialTexture(mModelMaterial, texture);
+	for (size_t s = 0; s < mSubmeshMaterials.size(); ++s) {
+		if (!mSubmeshOwnTextures[s]) mScene.setMaterialTexture(mSubmeshMaterials[s], texture);
+	}
+	// Imposters are baked from regular textures only, keeping their previous bake otherwise
+	if (texture->virtualTexture == UINT32_MAX) {
+		mImposterTexture = texture;
+		mImposterBakeNeeded = true;
+	}
+	return true;
+}
+
+void Application::terminateTexture()
+{
+	mScene.setMaterialTexture(mModelMaterial, nullptr);
+	for (size_t s = 0; s < mSubmeshMaterials.size(); ++s) {
+		if (!mSubmeshOwnTextures[s]) mScene.setMaterialTexture(mSubmeshMaterials[s], nullptr);
+	}
+	mImposterTexture = nullptr;
+	// Owned by the pipeline cache
+	mSampler = nullptr;
+}
+
+TextureView Application::getNextSurfaceTextureView()
+{
+	if (mBenchmark) {
+		mSurfaceTexture = mOffscreenTexture;
+		return mOffscreenTexture.createView();
+	}
+
+	// The texture of the previous frame was suboptimal, e.g. after a change of display,
+	// and presented anyway
+	if (mSurfaceReconfigurePending) {
+		mSurfaceReconfigurePending = false;
+		reconfigureSurface();
+	}
+
+	// Get the surface Texture
+	SurfaceTexture surfaceTexture{};
+	mSurface.getCurrentTexture(&surfaceTexture);
+	// The surface no longer matches the window: configured again and acquired once more,
+	// rather than dropping the frame
+	if (surfaceTexture.status == SurfaceGetCurrentTextureStatus::Outdated || surfaceTexture.status == SurfaceGetCurrentTextureStatus::Lost) {
+		reconfigureSurface();
+		mSurface.getCurrentTexture(&surfaceTexture);
+	}
+	if (surfaceTexture.status == SurfaceGetCurrentTextureStatus::DeviceLost) {
+		mDeviceLost = true;
+		return nullptr;
+	}
+	if (surfaceTexture.status != SurfaceGetCurrentTextureStatus::Success) {
+		// Timeouts, out of memory, or a surface still outdated, e.g. of a minimized window:
+		// retried after 16 ms, then twice as long after each failure, up to half a second
+		++mAcquireFailureCount;
+		auto delay = std::chrono::milliseconds(std::min(16u << std::min(mAcquireFailureCount - 1, 5u), 500u));
+		mAcquireRetryTime = std::chrono::steady_clock::now() + delay;
+		if (std::has_single_bit(mAcquireFailureCount)) {
+			LOG_WARNING("Cannot acquire the surface texture (status " << WGPUSurfaceGetCurrentTextureStatus(surfaceTexture.status)
+				<< ", " << mAcquireFailureCount << " failures in a row), retrying in " << delay.count() << " ms");
+		}
+		return nullptr;
+	}
+	mAcquireFailureCount = 0;
+	mAcquireRetryTime = {};
+	if (surfaceTexture.suboptimal) mSurfaceReconfigurePending = true;
+	Texture texture = surfaceTexture.texture;
+
+	// Create a view for this surface texture
+	TextureView targetView = mSurfaceFormats.createView(texture, "Surface Texture View");
+	// Released once the frame is encoded
+	mSurfaceTexture = texture;
+	return targetView;
+}
+
+void Application::reconfigureSurface()
+{
+	// Of the size of the window, which cannot be configured while minimized
+	if (mWindowWidth <= 0 || mWindowHeight <= 0) return;
+	terminateSurfaceConfig();
+	configSurface();
+}
+
+bool Application::initGeometry(ResourceCache::GeometryHandle geometry)
+{
+	TRACE_SCOPE("initGeometry");
+	if (!geometry) return false;
+	// Its bounds and dequantization parameters are uploaded with the next draw list
+	mScene.setMeshGeometry(mModelMesh, geometry);
+	mFrameDirty = true;
+	return true;
+}
+
+void Application::terminateGeometry()
+{
+	invalidateRenderBundles();
+	mScene.setMeshGeometry(mModelMesh, nullptr);
+	mScene.setMeshBvh(mModelMesh, nullptr);
+	for (uint32_t mesh : mStaticChunkMeshes) {
+		mScene.setMeshGeometry(mesh, nullptr);
+		mScene.setMeshBvh(mesh, nullptr);
+	}
+	for (uint32_t mesh : mSubmeshMeshes) {
+		mScene.setMeshGeometry(mesh, nullptr);
+		mScene.setMeshBvh(mesh, nullptr);
+	}
+	for (uint32_t mesh : mStressMeshes) {
+		mScene.setMeshGeometry(mesh, nullptr);
+		mScene.setMeshBvh(mesh, nullptr);
+	}
+	// The textures of the .mtl files are loaded again with the geometry
+	for (size_t s = 0; s < mSubmeshMaterials.size(); ++s) {
+		if (mSubmeshOwnTextures[s]) mScene.setMaterialTexture(mSubmeshMaterials[s], nullptr);
+		mSubmeshOwnTextures[s] = false;
+	}
+}
+
+void Application::initSubmeshes(const ResourceManager::Geometry& geometry, ResourceCache::GeometryHandle handle, std::shared_ptr<const MeshBvh> bvh)
+{
+	TRACE_SCOPE("initSubmeshes");
+	uint32_t submeshCount = static_cast<uint32_t>(geometry.materials.size());
+	if (submeshCount < 2) return;
+
+	// Meshes and materials of a previous device are reused, the model's mesh drawing the first
+	// submesh, and the materials taking the model's texture unless their own is loaded
+	if (mSubmeshMeshes.empty()) mSubmeshMeshes.push_back(mModelMesh);
+	while (mSubmeshMeshes.size() < submeshCount) mSubmeshMeshes.push_back(mScene.addMesh());
+	while (mSubmeshMaterials.size() < submeshCount) mSubmeshMaterials.push_back(mScene.addMaterial({}));
+	mSubmeshOwnTextures.resize(mSubmeshMaterials.size(), false);
+	const ResourceCache::TextureHandle& modelTexture = mScene.materials()[mModelMaterial].texture;
+	std::vector<std::filesystem::path> texturePaths;
+	std::vector<uint32_t> texturedSubmeshes;
+	for (uint32_t s = 0; s < submeshCount; ++s) {
+		const ResourceManager::SourceMaterial& source = geometry.materials[s];
+		mScene.setMeshGeometry(mSubmeshMeshes[s], handle, s);
+		mScene.setMeshBvh(mSubmeshMeshes[s], bvh);
+		mScene.setMaterialOpacity(mSubmeshMaterials[s], source.opacity);
+		if (!mSubmeshOwnTextures[s]) mScene.setMaterialTexture(mSubmeshMaterials[s], modelTexture);
+		if (!source.baseColorTexture.empty()) {
+			texturePaths.push_back(mModelPath.parent_path() / source.baseColorTexture);
+			texturedSubmeshes.push_back(s);
+		}
+	}
+	for (size_t s = submeshCount; s < mSubmeshMeshes.size(); ++s) {
+		mScene.setMeshGeometry(mSubmeshMeshes[s], nullptr);
+		mScene.setMeshBvh(mSubmeshMeshes[s], nullptr);
+	}
+
+	// Each instance of the model is one instance of each submesh, with its material
+	std::vector<Scene::Instance> instances = mScene.instances();
+	mScene.clearInstances();
+	for (const Scene::Instance& instance : instances) {
+		if (instance.mesh != mModelMesh) {
+			mScene.addInstance(instance);
+			continue;
+		}
+		for (uint32_t s = 0; s < submeshCount; ++s) {
+			Scene::Instance submeshInstance = instance;
+			submeshInstance.mesh = mSubmeshMeshes[s];
+			submeshInstance.material = mSubmeshMaterials[s];
+			mScene.addInstance(submeshInstance);
+		}
+	}
+	mFrameDirty = true;
+
+	if (texturePaths.empty()) return;
+	mResourceCache->loadTextures(*mAssetLoader, texturePaths, mTextureLoadOptions, [this, texturedSubmeshes](std::vector<ResourceCache::TextureHandle> textures) {
+		for (size_t t = 0; t < textures.size(); ++t) {
+			// Those that fail to load keep the model's texture
+			if (!textures[t] || !textures[t]->view) {
+				std::cerr << "Could not load the texture of a material of the model!" << std::endl;
+				continue;
+			}
+			uint32_t s = texturedSubmeshes[t];
+			mSubmeshOwnTextures[s] = true;
+			mScene.setMaterialTexture(mSubmeshMaterials[s], textures[t]);
+		}
+		mFrameDirty = true;
+	});
+}
+
+void Application::batchStaticInstances(const ResourceManager::Geometry& geometry)
+{
+	TRACE_SCOPE("batchStaticInstances");
+	if (geometry.vertices.size() > mStaticBatchVertexLimit) return;
+	// Chunks are of a single material
+	if (geometry.materials.size() > 1) return;
+
+	// Opaque static instances of the model are merged, the others being kept as they are
+	std::vector<StaticBatcher::Placement> placements;
+	std::vector<Scene::Instance> keptInstances;
+	for (const Scene::Instance& instance : mScene.instances()) {
+		const Scene::Material& material = mScene.materials()[instance.material];
+		if (instance.mesh == mModelMesh && !instance.dynamic && !material.transparent()) {
+			placements.push_back({ &geometry, instance.modelMatrix, instance.material });
+		}
+		else {
+			keptInstances.push_back(instance);
+		}
+	}
+	if (placements.size() < 2) return;
+	std::vector<StaticBatcher::Chunk> chunks = StaticBatcher::build(placements);
+
+	mScene.clearInstances();
+	for (const Scene::Instance& instance : keptInstances) {
+		mScene.addInstance(instance);
+	}
+	// Meshes of the chunks of a previous device are reused
+	size_t chunkCount = 0;
+	for (const StaticBatcher::Chunk& chunk : chunks) {
+		ResourceCache::GeometryHandle handle = mResourceCache->addGeometry(mVertexLayout, *chunk.geometry);
+		if (!handle) {
+			// Its instances are then drawn one by one
+			std::cerr << "Could not upload static batch!" << std::endl;
+			for (uint32_t p : chunk.placements) {
+				Scene::Instance instance;
+				instance.modelMatrix = placements[p].modelMatrix;
+				instance.mesh = mModelMesh;
+				instance.material = chunk.material;
+				mScene.addInstance(instance);
+			}
+			continue;
+		}
+		auto bvh = std::make_shared<MeshBvh>();
+		bvh->build(*chunk.geometry);
+		if (chunkCount == mStaticChunkMeshes.size()) mStaticChunkMeshes.push_back(mScene.addMesh());
+		uint32_t mesh = mStaticChunkMeshes[chunkCount++];
+		mScene.setMeshGeometry(mesh, handle);
+		mScene.setMeshBvh(mesh, bvh);
+
+		// Its vertices being in the space of the model matrices of its instances
+		Scene::Instance instance;
+		instance.mesh = mesh;
+		instance.material = chunk.material;
+		mScene.addInstance(instance);
+	}
+	for (size_t i = chunkCount; i < mStaticChunkMeshes.size(); ++i) {
+		mScene.setMeshGeometry(mStaticChunkMeshes[i], nullptr);
+		mScene.setMeshBvh(mStaticChunkMeshes[i], nullptr);
+	}
+	std::cout << "Static batching: " << placements.size() << " instances merged into " << chunkCount << " chunks" << std::endl;
+	mFrameDirty = true;
+}
+
+bool Application::initUniforms()
+{
+	TRACE_SCOPE("initUniforms");
+	// One slice of frame uniforms and one of view uniforms in each frame in flight, those of
+	// each batch being in the draw uniform buffer, and one more frame for the CPU to write
+	// while the others are in flight
+	mUniformRing = std::make_unique<UniformRing>(mDevice, std::max(sizeof(FrameUniforms), sizeof(ViewUniforms)), 2, mMaxFramesInFlight + 1);
+
+	// The model spins around the vertical axis, see updateUniforms
+	mTransforms.clear();
+	mModelTransform = mTransforms.add();
+	mTransforms.setScale(mModelTransform, glm::vec3(0.3f));
+
+	// Upload the initial value of the uniforms
+	mFrameUniforms.modelMatrix = glm::mat4(1.0f);
+	//mViewUniforms.viewMatrix = glm::lookAt(glm::vec3(-2.0f, -3.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+  updateViewMatrix();
+	//mViewUniforms.projectionMatrix = glm::perspective(45 * glm::pi<float>() / 180.0f, 640.0f / 480.0f, 0.01f, 100.0f);
+  updateProjectionMatrix();
+	mFrameUniforms.time = 0.0f;
+	mFrameClock.reset(currentTime());
+	markUniformDirty(mFrameUniforms);
+	markUniformDirty(mViewUniforms);
+
+	// Written by updateUniforms when the camera moves, after the other uniforms of the view
+	if (mStereo) {
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = "Stereo uniforms";
+		bufferDesc.size = sizeof(StereoUniforms);
+		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+		bufferDesc.mappedAtCreation = false;
+		mStereoUniformBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Uniforms, "Application");
+		if (!mStereoUniformBuffer) return false;
+		mStereoUniforms = StereoUniforms{};
+	}
+
+	return mUniformRing->buffer() != nullptr;
+}
+
+void Application::terminateUniforms()
+{
+	if (mStereoUniformBuffer) {
+		destroyTracked(mStereoUniformBuffer);
+		mStereoUniformBuffer.release();
+	}
+	mStereoUniformBuffer = nullptr;
+	mUniformRing.reset();
+}
+
+bool Application::initInstances()
+{
+	TRACE_SCOPE("initInstances");
+	mScene.clearInstances();
+	mStressDynamicInstances.clear();
+	if (mSceneGenerator) {
+		// The objects of the synthetic scene in place of the model
+		const std::vector<SceneGenerator::Object>& objects = mSceneGenerator->objects();
+		for (uint32_t o = 0; o < objects.size(); ++o) {
+			const SceneGenerator::Object& object = objects[o];
+			Scene::Instance instance;
+			instance.modelMatrix = mSceneGenerator->modelMatrix(object, mFrameUniforms.time);
+			instance.mesh = mStressMeshes[object.mesh];
+			instance.material = mStressMaterials[object.material];
+			instance.dynamic = object.dynamic;
+			uint32_t index = mScene.addInstance(instance);
+			if (object.dynamic) mStressDynamicInstances.emplace_back(index, o);
+		}
+	}
+	else {
+		// A grid of copies of the model centered on the origin, each one scaled down to
+		// its cell, with the model's material
+		TransformStore grid;
+		float spacing = 1.0f / static_cast<float>(mInstanceGridSize);
+		for (uint32_t y = 0; y < mInstanceGridSize; ++y) {
+			for (uint32_t x = 0; x < mInstanceGridSize; ++x) {
+				glm::vec2 cell = (glm::vec2(x, y) + 0.5f) * spacing - 0.5f;
+				uint32_t node = grid.add();
+				grid.setPosition(node, 4.0f * glm::vec3(cell, 0.0f));
+				grid.setScale(node, glm::vec3(spacing));
+			}
+		}
+		grid.update();
+		for (const glm::mat4& modelMatrix : grid.worldMatrices()) {
+			Scene::Instance instance;
+			instance.modelMatrix = modelMatrix;
+			instance.mesh = mModelMesh;
+			instance.material = mModelMaterial;
+			mScene.addInstance(instance);
+		}
+	}
+
+	// At most one batch per mesh and texture, the draw list growing them otherwise, and one per
+	// transparent instance
+	uint32_t instanceCount = static_cast<uint32_t>(mScene.instances().size());
+	uint32_t batchCount = static_cast<uint32_t>(mScene.meshes().size() * mScene.materials().size());
+	batchCount += static_cast<uint32_t>(std::count_if(mScene.instances().begin(), mScene.instances().end(), [this](const Scene::Instance& instance) {
+		return mScene.materials()[instance.material].transparent();
+	}));
+	return initDrawBuffers(instanceCount, std::min(batchCount, instanceCount), static_cast<uint32_t>(mScene.materials().size()));
+}
+
+void Application::terminateInstances()
+{
+	terminateDrawBuffers();
+	mScene.clearInstances();
+}
 
-void Application::terminateWindowAndDevice()
+bool Application::initDrawBuffers(uint32_t instanceCapacity, uint32_t batchCapacity, uint32_t materialCapacity)
 {
-	mQueue.release();
-	mDevice.release();
-	mSurface.release();
+	// Bindings may not be empty
+	mInstanceCapacity = std::max(instanceCapacity, 1u);
+	mBatchCapacity = std::max(batchCapacity, 1u);
+	mMaterialCapacity = std::max(materialCapacity, 1u);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.size = mInstanceCapacity * sizeof(InstanceData);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+	bufferDesc.mappedAtCreation = false;
+	mInstanceBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Application");
+	bufferDesc.size = mMaterialCapacity * sizeof(MaterialData);
+	mMaterialBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Application");
+
+	// Filled by cullInstances or the culling pass, until then the zero initialized arguments draw nothing
+	bufferDesc.size = mInstanceCapacity * sizeof(uint32_t);
+	mVisibleInstanceBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Application");
+	bufferDesc.size = mBatchCapacity * sizeof(BatchData);
+	mBatchBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Application");
+	bufferDesc.size = mBatchCapacity * sizeof(DrawIndexedIndirectArgs);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Indirect | BufferUsage::Storage;
+	mDrawArgsBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Application");
+
+	// The uniforms of each batch, pushed with its draw, at its offset of a uniform buffer or in
+	// the storage array of multi-draws
+	if (!mDrawConstants->resize(mBatchCapacity)) return false;
+
+	// Shadow casters and secondary views draw all the instances of their batch, whichever the
+	// main camera sees
+	if (mShadows || !mViews.empty()) {
+		bufferDesc.size = mInstanceCapacity * sizeof(uint32_t);
+		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+		mAllInstanceBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Application");
+		if (!mAllInstanceBuffer) return false;
+		std::vector<uint32_t> allInstances(mInstanceCapacity);
+		std::iota(allInstances.begin(), allInstances.end(), 0u);
+		writeBuffer(mAllInstanceBuffer, 0, allInstances.data(), allInstances.size() * sizeof(uint32_t));
+	}
 
-	glfwDestroyWindow(mWindow);
-	glfwTerminate();
+	return mInstanceBuffer != nullptr && mMaterialBuffer != nullptr && mVisibleInstanceBuffer != nullptr && mBatchBuffer != nullptr
+		&& mDrawArgsBuffer != nullptr;
 }
 
-RequiredLimits Application::getRequiredLimits(Adapter adapter)
+void Application::terminateDrawBuffers()
 {
-	// Get adapter supported limits, in case we need them
-	SupportedLimits supportedLimits;
-	adapter.getLimits(&supportedLimits);
+	invalidateRenderBundles();
+	if (mDrawConstants) mDrawConstants->clear();
+	if (mClusterLod) mClusterLod->clear();
+	for (Buffer* buffer : { &mAllInstanceBuffer, &mDrawArgsBuffer, &mBatchBuffer, &mVisibleInstanceBuffer, &mMaterialBuffer, &mInstanceBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+		*buffer = nullptr;
+	}
+	mInstanceCapacity = 0;
+	mBatchCapacity = 0;
+	mMaterialCapacity = 0;
+	mInstanceBounds.clear();
+	mInstanceBoxes.clear();
+	mInstanceBvh.clear();
+	mInstanceBvhOrder.clear();
+	mBvhInstances.clear();
+	mBvhBoxes.clear();
+	mDynamicInstances.clear();
+	mInstanceData.clear();
+	mBatchData.clear();
+	mVisibleInstances.clear();
+	mCulledInstances.clear();
+	mDrawArgs.clear();
+}
 
-	// NOTE: is "Default" just an alias for a default initializer {} ? It crashes if I don't copy the supported limits manually.
-	RequiredLimits requiredLimits = Default;
-	requiredLimits.limits = supportedLimits.limits; // Start with the supported limits as a base, then override the ones we want to require
-
-	requiredLimits.limits.maxVertexAttributes = 4;
-	requiredLimits.limits.maxVertexBuffers = 1;
-	requiredLimits.limits.maxBufferSize = 1500000 * sizeof(ResourceManager::VertexAttributes);
-	requiredLimits.limits.maxVertexBufferArrayStride = sizeof(ResourceManager::VertexAttributes);
-	requiredLimits.limits.maxInterStageShaderComponents = 8;
-	requiredLimits.limits.maxBindGroups = 1;
-	requiredLimits.limits.maxUniformBuffersPerShaderStage = 1;
-	requiredLimits.limits.maxUniformBufferBindingSize = 16 * 4 * sizeof(float);
-	// For now allow textures up to 2k
-	requiredLimits.limits.maxTextureDimension1D = 2048;
-	requiredLimits.limits.maxTextureDimension2D = 2048;
-	requiredLimits.limits.maxTextureArrayLayers = 1;
-	requiredLimits.limits.maxSampledTexturesPerShaderStage = 1;
-	requiredLimits.limits.maxSamplersPerShaderStage = 1;
+bool Application::updateDrawList()
+{
+	TRACE_SCOPE("updateDrawList");
+	invalidateRenderBundles();
+	mScene.buildDrawList();
+	const std::vector<uint32_t>& drawOrder = mScene.drawOrder();
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+
+	// Buffers only grow, the bind groups referencing them being created again
+	const std::vector<Scene::Material>& materials = mScene.materials();
+	if (drawOrder.size() > mInstanceCapacity || batches.size() > mBatchCapacity || materials.size() > mMaterialCapacity) {
+		terminateCullingBindGroup();
+		terminateDrawBuffers();
+		if (!initDrawBuffers(static_cast<uint32_t>(drawOrder.size()), static_cast<uint32_t>(batches.size()), static_cast<uint32_t>(materials.size()))) return false;
+		if (!initCullingBindGroup()) return false;
+	}
 
-	return requiredLimits;
+	// Materials in the order of the scene, which instances refer to them by
+	std::vector<MaterialData> materialData(materials.size());
+	for (size_t m = 0; m < materials.size(); ++m) {
+		materialData[m].color = materials[m].color;
+		materialData[m].textureLayer = materials[m].textureLayer;
+		materialData[m].opacity = materials[m].opacity;
+		materialData[m].virtualTexture = materials[m].texture ? materials[m].texture->virtualTexture : UINT32_MAX;
+	}
+	if (!materialData.empty()) {
+		writeBuffer(mMaterialBuffer, 0, materialData.data(), materialData.size() * sizeof(MaterialData));
+	}
+
+	// Instances in draw order, with the bounds of their mesh
+	std::vector<InstanceData> instances;
+	instances.reserve(drawOrder.size());
+	mInstanceBounds.clear();
+	mInstanceBounds.reserve(drawOrder.size());
+	std::vector<Aabb> boxes;
+	boxes.reserve(drawOrder.size());
+	for (uint32_t b = 0; b < batches.size(); ++b) {
+		const ResourceCache::Geometry& geometry = *mScene.meshes()[batches[b].mesh].geometry;
+		for (uint32_t i = batches[b].firstInstance; i < batches[b].firstInstance + batches[b].instanceCount; ++i) {
+			const Scene::Instance& instance = mScene.instances()[drawOrder[i]];
+			InstanceData data{};
+			data.modelMatrix = instance.modelMatrix;
+			data.material = instance.material;
+			data.batch = b;
+			data.animationOffset = instance.animationOffset;
+			instances.push_back(data);
+
+			const glm::mat4& M = instance.modelMatrix;
+			float scale = std::max({ glm::length(glm::vec3(M[0])), glm::length(glm::vec3(M[1])), glm::length(glm::vec3(M[2])) });
+			mInstanceBounds.push_back(glm::vec3(M * glm::vec4(geometry.boundingSphereCenter, 1.0f)), geometry.boundingSphereRadius * scale);
+			boxes.push_back(Aabb{ geometry.boundsMin, geometry.boundsMax }.transformed(M));
+		}
+	}
+	updateInstanceBvh(std::move(boxes));
+	if (mOcclusionQueries) mOcclusionQueries->setBoxes(mInstanceBoxes);
+	if (!instances.empty()) {
+		writeBuffer(mInstanceBuffer, 0, instances.data(), instances.size() * sizeof(InstanceData));
+	}
+	mInstanceData = std::move(instances);
+
+	// Shadow maps cover the spheres of all the instances, cast by what the draw list holds now
+	mSceneBounds = glm::vec4(0.0f);
+	if (mInstanceBounds.size() > 0) {
+		glm::vec3 boundsMin(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+		for (size_t i = 0; i < mInstanceBounds.size(); ++i) {
+			glm::vec3 center(mInstanceBounds.x[i], mInstanceBounds.y[i], mInstanceBounds.z[i]);
+			boundsMin = glm::min(boundsMin, center - mInstanceBounds.radius[i]);
+			boundsMax = glm::max(boundsMax, center + mInstanceBounds.radius[i]);
+		}
+		glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+		float radius = 0.0f;
+		for (size_t i = 0; i < mInstanceBounds.size(); ++i) {
+			glm::vec3 instanceCenter(mInstanceBounds.x[i], mInstanceBounds.y[i], mInstanceBounds.z[i]);
+			radius = std::max(radius, glm::length(instanceCenter - center) + mInstanceBounds.radius[i]);
+		}
+		mSceneBounds = glm::vec4(center, radius);
+	}
+	if (mShadowMaps) {
+		mShadowMaps->invalidateStaticCasters();
+		mShadowMaps->setDynamicCasters(std::any_of(batches.begin(), batches.end(), [](const Scene::DrawBatch& batch) { return batch.dynamic; }));
+	}
+
+	// Each batch owns the range of visible instances starting at its first instance, which
+	// its draw reads from its uniforms. Index ranges are set by cullInstances.
+	mBatchData.assign(batches.size(), BatchData{});
+	for (uint32_t b = 0; b < batches.size(); ++b) {
+		const ResourceCache::Geometry& geometry = *mScene.meshes()[batches[b].mesh].geometry;
+		mBatchData[b].boundingSphere = glm::vec4(geometry.boundingSphereCenter, geometry.boundingSphereRadius);
+		mBatchData[b].firstVisibleInstance = batches[b].firstInstance;
+		mBatchData[b].baseVertex = geometry.baseVertex();
+
+		DrawUniforms uniforms{};
+		uniforms.quantization = geometry.quantization;
+		uniforms.firstVisibleInstance = batches[b].firstInstance;
+		uniforms.textureId = batches[b].texture;
+		uniforms.baseVertex = geometry.baseVertex();
+		uniforms.vertexAnimation = mScene.meshes()[batches[b].mesh].vertexAnimation ? 1 : 0;
+		mDrawConstants->write(b, &uniforms);
+	}
+	mDrawConstants->flush(mQueue);
+
+	// Opaque batches of geometry with a cluster hierarchy draw the clusters selected for them
+	if (mClusterLod) {
+		std::vector<ClusterLod::Batch> clusterBatches;
+		for (uint32_t b = 0; b < mScene.opaqueBatchCount(); ++b) {
+			const ResourceCache::Geometry* geometry = mScene.meshes()[batches[b].mesh].geometry.get();
+			if (!geometry->clusterNodes.empty()) clusterBatches.push_back({ b, geometry });
+		}
+		if (!mClusterLod->setBatches(mDrawArgsBuffer, clusterBatches)) return false;
+	}
+
+	// Culling starts over, uploading everything with its first results
+	mVisibleInstances.assign(drawOrder.size(), 0);
+	mCulledInstances.resize(drawOrder.size());
+	mDrawArgs.assign(batches.size(), DrawIndexedIndirectArgs{});
+	if (!batches.empty()) {
+		writeBuffer(mDrawArgsBuffer, 0, mDrawArgs.data(), mDrawArgs.size() * sizeof(DrawIndexedIndirectArgs));
+	}
+	mCullingUniforms = {};
+	mFrameDirty = true;
+
+	// Bundles were invalidated above, and bind groups of unchanged textures are reused
+	return initBindGroup();
 }
 
-void Application::configSurface()
+void Application::updateInstanceBvh(std::vector<Aabb>&& boxes)
 {
-	SurfaceConfiguration config{};
-	config.width = static_cast<uint32_t>(mWindowWidth);
-	config.height = static_cast<uint32_t>(mWindowHeight);
-	config.usage = TextureUsage::RenderAttachment;
-	config.format = mSurfaceFormat;
-	config.viewFormatCount = 0;
-	config.viewFormats = nullptr;
-	config.device = mDevice;
-	config.presentMode = PresentMode::Fifo;
-	config.alphaMode = CompositeAlphaMode::Auto;
+	TRACE_SCOPE("updateInstanceBvh");
+	const std::vector<uint32_t>& drawOrder = mScene.drawOrder();
+	if (instanceTreesEmpty() || drawOrder != mInstanceBvhOrder || boxes.size() != mInstanceBoxes.size()) {
+		// Batches are all static or all dynamic
+		Aabb bounds;
+		for (const Aabb& box : boxes) bounds.grow(box);
+		mDynamicInstances.reset(bounds);
+		mBvhInstances.clear();
+		std::vector<Aabb> staticBoxes;
+		for (const Scene::DrawBatch& batch : mScene.batches()) {
+			for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i) {
+				if (batch.dynamic) {
+					mDynamicInstances.insert(i, boxes[i]);
+				}
+				else {
+					mBvhInstances.push_back(i);
+					staticBoxes.push_back(boxes[i]);
+				}
+			}
+		}
+		if (staticBoxes.empty()) mInstanceBvh.clear();
+		else mInstanceBvh.build(staticBoxes);
+		mBvhBoxes = std::move(staticBoxes);
+		mInstanceBvhOrder = drawOrder;
+		mInstanceBoxes = std::move(boxes);
+		return;
+	}
 
-	mSurface.configure(config);
+	// The same instances, whose moves the trees absorb without being built again
+	std::vector<uint32_t> moved;
+	for (uint32_t k = 0; k < mBvhInstances.size(); ++k) {
+		uint32_t i = mBvhInstances[k];
+		if (boxes[i].min != mBvhBoxes[k].min || boxes[i].max != mBvhBoxes[k].max) moved.push_back(k);
+		mBvhBoxes[k] = boxes[i];
+	}
+	for (uint32_t i = 0; i < boxes.size(); ++i) {
+		if (!mDynamicInstances.contains(i)) continue;
+		if (boxes[i].min != mInstanceBoxes[i].min || boxes[i].max != mInstanceBoxes[i].max) mDynamicInstances.update(i, boxes[i]);
+	}
+	mInstanceBoxes = std::move(boxes);
+	if (!moved.empty()) mInstanceBvh.refit(mBvhBoxes, moved);
 }
 
-void Application::terminateSurfaceConfig()
+void Application::uploadMovedInstances()
 {
-  mSurface.unconfigure();
+	TRACE_SCOPE("uploadMovedInstances");
+	// Positions in draw order, sorted for neighbors to share an upload
+	std::vector<uint32_t> positions;
+	positions.reserve(mScene.movedInstances().size());
+	for (uint32_t instance : mScene.movedInstances()) {
+		uint32_t position = mScene.drawPosition(instance);
+		if (position != Scene::NotDrawn && position < mInstanceData.size()) positions.push_back(position);
+	}
+	mScene.clearMovedInstances();
+	if (positions.empty()) return;
+	std::sort(positions.begin(), positions.end());
+
+	const std::vector<uint32_t>& drawOrder = mScene.drawOrder();
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	std::vector<uint32_t> refitted;
+	bool staticMoved = false;
+	for (uint32_t position : positions) {
+		const Scene::Instance& instance = mScene.instances()[drawOrder[position]];
+		InstanceData& data = mInstanceData[position];
+		data.modelMatrix = instance.modelMatrix;
+
+		// Bounds as updateDrawList computes them
+		const ResourceCache::Geometry& geometry = *mScene.meshes()[batches[data.batch].mesh].geometry;
+		const glm::mat4& M = instance.modelMatrix;
+		float scale = std::max({ glm::length(glm::vec3(M[0])), glm::length(glm::vec3(M[1])), glm::length(glm::vec3(M[2])) });
+		glm::vec3 center = glm::vec3(M * glm::vec4(geometry.boundingSphereCenter, 1.0f));
+		mInstanceBounds.x[position] = center.x;
+		mInstanceBounds.y[position] = center.y;
+		mInstanceBounds.z[position] = center.z;
+		mInstanceBounds.radius[position] = geometry.boundingSphereRadius * scale;
+		Aabb box = Aabb{ geometry.boundsMin, geometry.boundsMax }.transformed(M);
+		mInstanceBoxes[position] = box;
+		// Shadows keep covering the scene, grown around what leaves it
+		float reach = glm::length(center - glm::vec3(mSceneBounds)) + mInstanceBounds.radius[position];
+		mSceneBounds.w = std::max(mSceneBounds.w, reach);
+
+		if (mDynamicInstances.contains(position)) {
+			mDynamicInstances.update(position, box);
+			continue;
+		}
+		staticMoved = true;
+		auto entry = std::lower_bound(mBvhInstances.begin(), mBvhInstances.end(), position);
+		if (entry != mBvhInstances.end() && *entry == position) {
+			uint32_t k = static_cast<uint32_t>(entry - mBvhInstances.begin());
+			mBvhBoxes[k] = box;
+			refitted.push_back(k);
+		}
+	}
+	if (!refitted.empty()) mInstanceBvh.refit(mBvhBoxes, refitted);
+	if (mOcclusionQueries) mOcclusionQueries->setBoxes(mInstanceBoxes);
+	if (mShadowMaps && staticMoved) mShadowMaps->invalidateStaticCasters();
+
+	// Runs of moved instances, joined over gaps of fewer than MaxInstanceUploadGap unmoved ones
+	// which cost less to upload again than a write of their own
+	constexpr uint32_t MaxInstanceUploadGap = 4;
+	for (size_t p = 0; p < positions.size();) {
+		uint32_t first = positions[p];
+		uint32_t end = first + 1;
+		for (++p; p < positions.size() && positions[p] < end + MaxInstanceUploadGap; ++p) {
+			end = positions[p] + 1;
+		}
+		writeBuffer(mInstanceBuffer, first * sizeof(InstanceData), mInstanceData.data() + first, (end - first) * sizeof(InstanceData));
+	}
+	mCullingDispatchNeeded = true;
+	mFrameDirty = true;
 }
 
-bool Application::initDepthBuffer()
+size_t Application::cullInstanceTrees(const Frustum& frustum, uint32_t* visible) const
 {
-	// Create the depth texture
-	TextureDescriptor depthTextureDesc{};
-	depthTextureDesc.dimension = TextureDimension::_2D;
-	depthTextureDesc.format = mDepthTextureFormat;
-	depthTextureDesc.mipLevelCount = 1;
-	depthTextureDesc.sampleCount = 1;
-	depthTextureDesc.size = { static_cast<uint32_t>(mWindowWidth),static_cast<uint32_t>(mWindowHeight), 1 };
-	depthTextureDesc.usage = TextureUsage::RenderAttachment;
-	depthTextureDesc.viewFormatCount = 1;
-	depthTextureDesc.viewFormats = (WGPUTextureFormat*)&mDepthTextureFormat;
-	mDepthTexture = mDevice.createTexture(depthTextureDesc);
+	size_t visibleCount = mInstanceBvh.empty() ? 0 : mInstanceBvh.cull(frustum, visible);
+	for (size_t v = 0; v < visibleCount; ++v) {
+		visible[v] = mBvhInstances[visible[v]];
+	}
+	return visibleCount + mDynamicInstances.cull(frustum, visible + visibleCount);
+}
 
-	// Create the view of the depth texture manipulated by the rasterizer
-	TextureViewDescriptor depthTextureViewDesc{};
-	depthTextureViewDesc.aspect = TextureAspect::DepthOnly;
-	depthTextureViewDesc.baseArrayLayer = 0;
-	depthTextureViewDesc.arrayLayerCount = 1;
-	depthTextureViewDesc.baseMipLevel = 0;
-	depthTextureViewDesc.mipLevelCount = 1;
-	depthTextureViewDesc.dimension = TextureViewDimension::_2D;
-	depthTextureViewDesc.format = mDepthTextureFormat;
-	mDepthTextureView = mDepthTexture.createView(depthTextureViewDesc);
+bool Application::initCulling()
+{
+	TRACE_SCOPE("initCulling");
+	std::string shaderSource;
+	if (!ResourceManager::loadShaderSource(RESOURCE_DIR "/culling.wgsl", shaderSource)) {
+		return false;
+	}
+	ShaderModule shaderModule = mPipelineCache->shaderModule(shaderSource);
+	if (!shaderModule) return false;
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(6, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(CullingUniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[1].buffer.minBindingSize = sizeof(InstanceData);
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[2].buffer.type = BufferBindingType::Storage;
+	bindingLayoutEntries[2].buffer.minBindingSize = sizeof(uint32_t);
+	bindingLayoutEntries[3].binding = 3;
+	bindingLayoutEntries[3].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[3].buffer.type = BufferBindingType::Storage;
+	bindingLayoutEntries[3].buffer.minBindingSize = sizeof(DrawIndexedIndirectArgs);
+	bindingLayoutEntries[4].binding = 4;
+	bindingLayoutEntries[4].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[4].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[4].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[5].binding = 5;
+	bindingLayoutEntries[5].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[5].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[5].buffer.minBindingSize = sizeof(BatchData);
+
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mCullingBindGroupLayout = mPipelineCache->bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mCullingBindGroupLayout;
+	PipelineLayout layout = mPipelineCache->pipelineLayout(layoutDesc);
+
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = layout;
+	pipelineDesc.compute.module = shaderModule;
+	pipelineDesc.compute.entryPoint = "cullInstances";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mCullingKernel = mWorkgroupTuner->kernel("Culling", pipelineDesc, { 64, 32, 128, 256 });
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Culling uniforms";
+	bufferDesc.size = sizeof(CullingUniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mCullingUniformBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Uniforms, "Application");
+	// Uploaded by the first call to cullInstances
+	mCullingUniforms = {};
+	mCullingDispatchNeeded = false;
 
-	return mDepthTextureView != nullptr;
+	// Given its batches by updateDrawList
+	if (mClusterLodEnabled) mClusterLod = std::make_unique<ClusterLod>(mDevice, *mPipelineCache);
+
+	return initCullingBindGroup()
+		&& mCullingKernel->pipeline()->status != PipelineCache::AsyncPipeline<ComputePipeline>::Status::Failed;
 }
 
-void Application::terminateDepthBuffer()
+void Application::terminateCulling()
 {
-	mDepthTextureView.release();
-	mDepthTexture.destroy();
-	mDepthTexture.release();
+	terminateCullingBindGroup();
+	mClusterLod.reset();
+	destroyTracked(mCullingUniformBuffer);
+	mCullingUniformBuffer.release();
+	// Owned by the pipeline cache, released with the device
+	mCullingKernel.reset();
+	mCullingBindGroupLayout = nullptr;
 }
 
-bool Application::initRenderPipeline()
+bool Application::initCullingBindGroup()
 {
-	std::cout << "Creating shader module..." << std::endl;
-	mShaderModule = ResourceManager::loadShaderModule(RESOURCE_DIR "/shader.wgsl", mDevice);
+	TRACE_SCOPE("initCullingBindGroup");
+	StartupStage startupStage("Bind groups");
+	std::vector<BindGroupEntry> bindings(6);
+	bindings[0].binding = 0;
+	bindings[0].buffer = mCullingUniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(CullingUniforms);
+	bindings[1].binding = 1;
+	bindings[1].buffer = mInstanceBuffer;
+	bindings[1].offset = 0;
+	bindings[1].size = mInstanceBuffer.getSize();
+	bindings[2].binding = 2;
+	bindings[2].buffer = mVisibleInstanceBuffer;
+	bindings[2].offset = 0;
+	bindings[2].size = mVisibleInstanceBuffer.getSize();
+	bindings[3].binding = 3;
+	bindings[3].buffer = mDrawArgsBuffer;
+	bindings[3].offset = 0;
+	bindings[3].size = mDrawArgsBuffer.getSize();
+	bindings[4].binding = 4;
+	bindings[4].textureView = mDepthPyramid->view();
+	bindings[5].binding = 5;
+	bindings[5].buffer = mBatchBuffer;
+	bindings[5].offset = 0;
+	bindings[5].size = mBatchBuffer.getSize();
 
-	// Check for errors
-	if (mShaderModule == nullptr) {
-		std::cerr << "Could not load shader!" << std::endl;
-		exit(1);
-	}
-	else {
-		std::cout << "Shader module: " << mShaderModule << std::endl;
-	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mCullingBindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mCullingBindGroup = mDevice.createBindGroup(bindGroupDesc);
 
-	RenderPipelineDescriptor pipelineDesc{};
+	return mCullingBindGroup != nullptr;
+}
 
-	std::vector<VertexAttribute> vertexAttribs(4);
-
-	// For each attrib, describe its layout, aka how to interpret the data
-	// Position attribute
-	vertexAttribs[0].shaderLocation = 0;
-	vertexAttribs[0].format = VertexFormat::Float32x3;
-	vertexAttribs[0].offset = offsetof(ResourceManager::VertexAttributes, position);
-
-	// Normal attribute
-	vertexAttribs[1].shaderLocation = 1;
-	vertexAttribs[1].format = VertexFormat::Float32x3;
-	vertexAttribs[1].offset = offsetof(ResourceManager::VertexAttributes, normal);
-
-	// Color attribute
-	vertexAttribs[2].shaderLocation = 2;
-	vertexAttribs[2].format = VertexFormat::Float32x3;
-	vertexAttribs[2].offset = offsetof(ResourceManager::VertexAttributes, color);
-
-	// UV attribute
-	vertexAttribs[3].shaderLocation = 3;
-	vertexAttribs[3].format = VertexFormat::Float32x2;
-	vertexAttribs[3].offset = offsetof(ResourceManager::VertexAttributes, uv);
-
-	VertexBufferLayout vertexBufferLayout{};
-	vertexBufferLayout.attributeCount = static_cast<uint32_t>(vertexAttribs.size());
-	vertexBufferLayout.attributes = vertexAttribs.data();
-	vertexBufferLayout.arrayStride = sizeof(ResourceManager::VertexAttributes);
-	vertexBufferLayout.stepMode = VertexStepMode::Vertex; // We move to the next vertex for each vertex shader invocation
-
-	pipelineDesc.vertex.bufferCount = 1;
-	pipelineDesc.vertex.buffers = &vertexBufferLayout;
-	pipelineDesc.vertex.module = mShaderModule;
-	pipelineDesc.vertex.entryPoint = "vs_main";
-	pipelineDesc.vertex.constantCount = 0;
-	pipelineDesc.vertex.constants = nullptr;
+void Application::terminateCullingBindGroup()
+{
+	mCullingBindGroup.release();
+}
 
-	// Each sequence of 3 vertices is considered as a triangle
-	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
-	// When not specified, vertices are considered sequentially.
-	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+bool Application::cullingDispatchNeeded() const
+{
+	// The draw arguments of the last pass stay valid until the parameters change
+	return mCullingDispatchNeeded && mCullingKernel->pipeline()->ready();
+}
 
-	pipelineDesc.primitive.frontFace = FrontFace::CCW;
-	pipelineDesc.primitive.cullMode = CullMode::None;
+void Application::encodeCulling(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites, uint32_t statisticsQuery, ComputePipeline pipeline, uint32_t workgroupSize) const
+{
+	// Visible instances are counted again from zero, the pass writing the other arguments
+	encoder.clearBuffer(mDrawArgsBuffer, 0, mDrawArgs.size() * sizeof(DrawIndexedIndirectArgs));
+
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Culling pass";
+	computePassDesc.timestampWrites = timestampWrites;
+	GpuHandle<ComputePassEncoder> computePass = encoder.beginComputePass(computePassDesc);
+	mPipelineStatistics->begin(computePass, statisticsQuery);
+	computePass->setPipeline(pipeline);
+	computePass->setBindGroup(0, mCullingBindGroup, 0, nullptr);
+	// An invocation per instance, and per batch to write its draw arguments
+	uint32_t invocationCount = std::max(mCullingUniforms.instanceCount, mCullingUniforms.batchCount);
+	computePass->dispatchWorkgroups((invocationCount + workgroupSize - 1) / workgroupSize, 1, 1);
+	mPipelineStatistics->end(computePass, statisticsQuery);
+	computePass->end();
+}
 
-	// We tell that the programmable fragment shader stage is described
-	// by the function called 'fs_main' in the shader module.
-	FragmentState fragmentState{};
-	fragmentState.module = mShaderModule;
-	fragmentState.entryPoint = "fs_main";
-	fragmentState.constantCount = 0;
-	fragmentState.constants = nullptr;
+bool Application::initBindGroup()
+{
+	TRACE_SCOPE("initBindGroup");
+	StartupStage startupStage("Bind groups");
+	auto createBindGroup = [this](BindGroupSlot slot, const std::vector<BindGroupEntry>& bindings) {
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mBindGroupLayouts[(size_t)slot];
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		return mPipelineCache->bindGroup(bindGroupDesc);
+	};
+
+	// Both uniform blocks live in the ring, each at its slice
+	std::vector<BindGroupEntry> uniformBindings(1);
+	uniformBindings[0].binding = 0;
+	uniformBindings[0].buffer = mUniformRing->buffer();
+	uniformBindings[0].offset = 0;
+	uniformBindings[0].size = sizeof(FrameUniforms);
+	PipelineCache::BindGroupHandle frameBindGroup = createBindGroup(BindGroupSlot::Frame, uniformBindings);
+	uniformBindings[0].size = sizeof(ViewUniforms);
+	std::vector<BindGroupEntry> viewBindings = uniformBindings;
+	auto addViewBinding = [&viewBindings](uint32_t binding) -> BindGroupEntry& {
+		BindGroupEntry& entry = viewBindings.emplace_back();
+		entry.binding = binding;
+		return entry;
+	};
+	auto addViewBufferBinding = [&addViewBinding](uint32_t binding, Buffer buffer) {
+		BindGroupEntry& entry = addViewBinding(binding);
+		entry.buffer = buffer;
+		entry.offset = 0;
+		entry.size = buffer.getSize();
+	};
+	if (mShadowMaps) {
+		addViewBinding(1).textureView = mShadowMaps->view();
+		addViewBinding(2).sampler = mShadowSampler;
+		addViewBufferBinding(3, mShadowMaps->uniformBuffer());
+	}
+	if (mClusteredLights) {
+		addViewBufferBinding(4, mClusteredLights->uniformBuffer());
+		addViewBufferBinding(5, mClusteredLights->lightBuffer());
+		addViewBufferBinding(6, mClusteredLights->clusterBuffer());
+	}
+	if (mShadingRate) {
+		addViewBufferBinding(7, mShadingRate->uniformBuffer());
+		addViewBufferBinding(8, mShadingRate->rateBuffer());
+	}
+	if (mTemporalAA && mTemporalAA->mode() == TemporalAA::Mode::Reuse) {
+		addViewBufferBinding(9, mTemporalAA->uniformBuffer());
+	}
+	if (mStereoUniformBuffer) {
+		addViewBufferBinding(10, mStereoUniformBuffer);
+	}
+	if (mEnvironmentLighting) {
+		addViewBinding(11).textureView = mEnvironmentLighting->radianceView();
+		addViewBinding(12).textureView = mEnvironmentLighting->brdfLutView();
+		addViewBinding(13).sampler = mEnvironmentLighting->sampler();
+		addViewBufferBinding(14, mEnvironmentLighting->uniformBuffer());
+	}
+	PipelineCache::BindGroupHandle viewBindGroup = createBindGroup(BindGroupSlot::View, viewBindings);
+
+	std::vector<BindGroupEntry> drawBindings(3);
+	drawBindings[0].binding = 0;
+	drawBindings[0].buffer = mInstanceBuffer;
+	drawBindings[0].offset = 0;
+	drawBindings[0].size = mInstanceBuffer.getSize();
+
+	drawBindings[1].binding = 1;
+	drawBindings[1].buffer = mVisibleInstanceBuffer;
+	drawBindings[1].offset = 0;
+	drawBindings[1].size = mVisibleInstanceBuffer.getSize();
+
+	// Unless they are push constants
+	if (mDrawConstants->pushConstants()) {
+		drawBindings.pop_back();
+	}
+	else {
+		drawBindings[2].binding = 2;
+		drawBindings[2].buffer = mDrawConstants->buffer();
+		drawBindings[2].offset = 0;
+		drawBindings[2].size = mDrawConstants->storageArray() ? mDrawConstants->buffer().getSize() : sizeof(DrawUniforms);
+	}
 
-	BlendState blendState{};
-	blendState.color.srcFactor = BlendFactor::SrcAlpha;
-	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
-	blendState.color.operation = BlendOperation::Add;
-	blendState.alpha.srcFactor = BlendFactor::Zero;
-	blendState.alpha.dstFactor = BlendFactor::One;
-	blendState.alpha.operation = BlendOperation::Add;
+	// One draw group per vertex page when vertices are pulled from its streams, the batches
+	// of a page sharing it, and a single one otherwise
+	std::vector<const ResourceCache::Geometry*> pageGeometries(mVertexPulling ? 0 : 1, nullptr);
+	if (mVertexPulling) {
+		for (const Scene::Mesh& mesh : mScene.meshes()) {
+			if (!mesh.geometry) continue;
+			uint32_t page = mesh.geometry->vertices.page;
+			if (page >= pageGeometries.size()) pageGeometries.resize(page + 1, nullptr);
+			pageGeometries[page] = mesh.geometry.get();
+		}
+	}
+	auto createDrawBindGroups = [&](std::vector<PipelineCache::BindGroupHandle>& bindGroups) {
+		bindGroups.assign(pageGeometries.size(), nullptr);
+		for (size_t page = 0; page < pageGeometries.size(); ++page) {
+			const ResourceCache::Geometry* geometry = pageGeometries[page];
+			if (mVertexPulling && !geometry) continue;
+			drawBindings.resize(3);
+			for (uint32_t slot = 0; mVertexPulling && slot < geometry->vertexBufferCount(); ++slot) {
+				BindGroupEntry& entry = drawBindings.emplace_back();
+				entry.binding = PulledVertexBinding + slot;
+				entry.buffer = geometry->vertexBuffer(slot);
+				entry.offset = 0;
+				entry.size = geometry->vertexBuffer(slot).getSize();
+			}
+			bindGroups[page] = createBindGroup(BindGroupSlot::Draw, drawBindings);
+			if (!bindGroups[page]) return false;
+		}
+		return true;
+	};
+	std::vector<PipelineCache::BindGroupHandle> drawBindGroups;
+	if (!frameBindGroup || !viewBindGroup || !createDrawBindGroups(drawBindGroups)) return false;
+
+	// Shadow passes look from each cascade, at its offset of the caster views, and secondary views
+	// from their own camera with the lights and shadows of the main one, both drawing every
+	// instance of their batches
+	PipelineCache::BindGroupHandle shadowCasterViewBindGroup;
+	PipelineCache::BindGroupHandle secondaryViewBindGroup;
+	std::vector<PipelineCache::BindGroupHandle> allInstanceDrawBindGroups;
+	if (mShadowMaps) {
+		uniformBindings[0].buffer = mShadowMaps->casterViewBuffer();
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mShadowCasterViewLayout;
+		bindGroupDesc.entryCount = (uint32_t)uniformBindings.size();
+		bindGroupDesc.entries = uniformBindings.data();
+		shadowCasterViewBindGroup = mPipelineCache->bindGroup(bindGroupDesc);
+		if (!shadowCasterViewBindGroup) return false;
+	}
+	if (mViewUniformBuffer) {
+		viewBindings[0].buffer = mViewUniformBuffer;
+		secondaryViewBindGroup = createBindGroup(BindGroupSlot::View, viewBindings);
+		if (!secondaryViewBindGroup) return false;
+	}
+	if (mAllInstanceBuffer) {
+		drawBindings[1].buffer = mAllInstanceBuffer;
+		drawBindings[1].size = mAllInstanceBuffer.getSize();
+		if (!createDrawBindGroups(allInstanceDrawBindGroups)) return false;
+	}
 
-	ColorTargetState colorTarget{};
-	colorTarget.format = mSurfaceFormat;
-	colorTarget.blend = &blendState;
-	colorTarget.writeMask = ColorWriteMask::All; // We could write to only some of the color channels.
+	// Material bind groups only differ by their texture, the parameters of every material being
+	// in the one buffer, as are the page table and descriptors of the virtual textures. Those of
+	// textures that did not change are served by the cache, the previous ones being held until
+	// replaced.
+	std::vector<BindGroupEntry> materialBindings(mVirtualTextures ? 5 : 3);
+	materialBindings[0].binding = 0;
+	materialBindings[1].binding = 1;
+	materialBindings[1].sampler = mSampler;
+	materialBindings[2].binding = 2;
+	materialBindings[2].buffer = mMaterialBuffer;
+	materialBindings[2].offset = 0;
+	materialBindings[2].size = mMaterialBuffer.getSize();
+	if (mVirtualTextures) {
+		materialBindings[3].binding = 3;
+		materialBindings[3].buffer = mVirtualTextures->pageTableBuffer();
+		materialBindings[3].offset = 0;
+		materialBindings[3].size = mVirtualTextures->pageTableBuffer().getSize();
+		materialBindings[4].binding = 4;
+		materialBindings[4].buffer = mVirtualTextures->descriptorBuffer();
+		materialBindings[4].offset = 0;
+		materialBindings[4].size = mVirtualTextures->descriptorBuffer().getSize();
+	}
+	std::vector<PipelineCache::BindGroupHandle> materialBindGroups;
+	materialBindGroups.reserve(mScene.textures().size());
+	for (const ResourceCache::TextureHandle& texture : mScene.textures()) {
+		materialBindings[0].textureView = texture->view;
+		PipelineCache::BindGroupHandle bindGroup = createBindGroup(BindGroupSlot::Material, materialBindings);
+		if (!bindGroup) return false;
+		materialBindGroups.push_back(std::move(bindGroup));
+	}
+	mFrameBindGroup = std::move(frameBindGroup);
+	mViewBindGroup = std::move(viewBindGroup);
+	mDrawBindGroups = std::move(drawBindGroups);
+	mShadowCasterViewBindGroup = std::move(shadowCasterViewBindGroup);
+	mSecondaryViewBindGroup = std::move(secondaryViewBindGroup);
+	mAllInstanceDrawBindGroups = std::move(allInstanceDrawBindGroups);
+	mMaterialBindGroups = std::move(materialBindGroups);
+	return true;
+}
 
-	// We have only one target because our render pass has only one output color attachment.
-	fragmentState.targetCount = 1;
-	fragmentState.targets = &colorTarget;
-	pipelineDesc.fragment = &fragmentState;
+void Application::terminateBindGroup()
+{
+  invalidateRenderBundles();
+	mMaterialBindGroups.clear();
+	mAllInstanceDrawBindGroups.clear();
+	mSecondaryViewBindGroup.reset();
+	mShadowCasterViewBindGroup.reset();
+	mDrawBindGroups.clear();
+	mViewBindGroup.reset();
+	mFrameBindGroup.reset();
+}
 
-	// Setup depth state
-	DepthStencilState depthStencilState = Default;
-	depthStencilState.depthCompare = CompareFunction::Less;
-	depthStencilState.depthWriteEnabled = true;
-	depthStencilState.format = mDepthTextureFormat;
-	depthStencilState.stencilReadMask = 0;
-	depthStencilState.stencilWriteMask = 0;
+BindGroup Application::drawBindGroup(const std::vector<PipelineCache::BindGroupHandle>& bindGroups, const ResourceCache::Geometry& geometry) const
+{
+	return bindGroups[mVertexPulling ? geometry.vertices.page : 0]->bindGroup;
+}
 
-	pipelineDesc.depthStencil = &depthStencilState;
-	// Samples per pixel
-	pipelineDesc.multisample.count = 1;
-	// Default value for the mask, meaning "all bits on"
-	pipelineDesc.multisample.mask = ~0u;
-	// Default value as well (irrelevant for count = 1 anyways)
-	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+uint32_t Application::fetchedVertexBufferCount(const ResourceCache::Geometry& geometry, bool depthOnly) const
+{
+	// Positions come first, and alone in depth-only passes, which always fetch them
+	if (depthOnly) return 1;
+	return mVertexPulling ? 0 : geometry.vertexBufferCount();
+}
 
-	// Create a binding group
-	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
-
-	BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
-	bindingLayout.binding = 0;
-	bindingLayout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
-	bindingLayout.buffer.type = BufferBindingType::Uniform;
-	bindingLayout.buffer.minBindingSize = sizeof(BasicShaderUniforms);
-
-	// The texture binding
-	BindGroupLayoutEntry& textureBindingLayout = bindingLayoutEntries[1];
-	textureBindingLayout.binding = 1;
-	textureBindingLayout.visibility = ShaderStage::Fragment;
-	textureBindingLayout.texture.sampleType = TextureSampleType::Float;
-	textureBindingLayout.texture.viewDimension = TextureViewDimension::_2D;
-
-	// The texture sampler binding
-	BindGroupLayoutEntry& samplerBindingLayout = bindingLayoutEntries[2];
-	samplerBindingLayout.binding = 2;
-	samplerBindingLayout.visibility = ShaderStage::Fragment;
-	samplerBindingLayout.sampler.type = SamplerBindingType::Filtering;
-
-	// A bind group contains one or multiple bindings
-	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
-	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
-	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
-	mBindGroupLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
+const std::vector<RenderBundle>& Application::getRenderBundles(DrawPass drawPass)
+{
+	// Bundles bind the uniforms at the slice of a given frame of the ring
+	std::vector<std::vector<RenderBundle>>& frameRenderBundles = mRenderBundles[(size_t)drawPass];
+	frameRenderBundles.resize(mUniformRing->frameCount());
+	std::vector<RenderBundle>& renderBundles = frameRenderBundles[mUniformRing->frameIndex()];
+	if (!renderBundles.empty()) return renderBundles;
+
+	TRACE_SCOPE("Record render bundles");
+	// Transparent batches are sorted again every frame, thus drawn without bundles
+	size_t batchCount = mScene.opaqueBatchCount();
+	size_t bundleCount = std::max<size_t>(1, (batchCount + mBatchesPerBundle - 1) / mBatchesPerBundle);
+	renderBundles.resize(bundleCount, nullptr);
+	std::vector<FrameCounts> bundleCounts(bundleCount);
+	parallelForRanges(bundleCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			size_t firstBatch = i * mBatchesPerBundle;
+			renderBundles[i] = recordRenderBundle(drawPass, firstBatch, std::min(firstBatch + mBatchesPerBundle, batchCount), bundleCounts[i]);
+		}
+	}, 1);
+	// The same for the bundles of every frame of the ring, recorded from the same batches
+	FrameCounts& passCounts = mRenderBundleCounts[(size_t)drawPass];
+	passCounts = FrameCounts{};
+	for (const FrameCounts& counts : bundleCounts) {
+		passCounts += counts;
+	}
+	return renderBundles;
+}
 
-	// Create the pipeline layout
-	PipelineLayoutDescriptor layoutDesc{};
-	layoutDesc.bindGroupLayoutCount = 1;
-	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
-	PipelineLayout layout = mDevice.createPipelineLayout(layoutDesc);
+RenderBundle Application::recordRenderBundle(DrawPass drawPass, size_t firstBatch, size_t endBatch, FrameCounts& counts)
+{
+	// Attachment formats and read-only flags must match those of the render pass,
+	// the depth pre-pass having no color attachment
+	bool depthOnly = drawPass == DrawPass::DepthPrePass;
+	RenderBundleEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "Render bundle encoder";
+	// Those of the G-buffer pass with deferred shading
+	std::array<TextureFormat, 3> colorFormats = { mSceneFormat, ObjectPicker::IdFormat };
+	uint32_t colorFormatCount = mObjectPicker ? 2 : 1;
+	if (mDeferredShading) {
+		colorFormats = { DeferredShading::NormalFormat, DeferredShading::AlbedoFormat, ObjectPicker::IdFormat };
+		colorFormatCount = mObjectPicker ? 3 : 2;
+	}
+	encoderDesc.colorFormatCount = depthOnly ? 0 : colorFormatCount;
+	encoderDesc.colorFormats = depthOnly ? nullptr : (const WGPUTextureFormat*)colorFormats.data();
+	encoderDesc.depthStencilFormat = mDepthTextureFormat;
+	encoderDesc.sampleCount = mSampleCount;
+	encoderDesc.depthReadOnly = false;
+	encoderDesc.stencilReadOnly = true;
+	GpuHandle<RenderBundleEncoder> encoder = mDevice.createRenderBundleEncoder(encoderDesc);
+	RenderStateCache<RenderBundleEncoder> state(encoder);
+	encodeOpaqueBatches(state, drawPass, firstBatch, endBatch, counts);
+
+	RenderBundleDescriptor bundleDesc{};
+	bundleDesc.label = "Render bundle";
+	RenderBundle renderBundle = encoder->finish(bundleDesc);
+	return renderBundle;
+}
 
-	pipelineDesc.layout = layout;
+void Application::drawOpaqueBatches(RenderStateCache<RenderPassEncoder>& state, DrawPass drawPass)
+{
+	FrameCounts counts;
+	encodeOpaqueBatches(state, drawPass, 0, mScene.opaqueBatchCount(), counts);
+	FrameCounters::add(counts);
+}
+
+template <typename Encoder>
+void Application::encodeOpaqueBatches(RenderStateCache<Encoder>& state, DrawPass drawPass, size_t firstBatch, size_t endBatch, FrameCounts& counts)
+{
+	Encoder encoder = state.encoder();
+	bool depthOnly = drawPass == DrawPass::DepthPrePass;
+	state.setPipeline(mPipelines[(size_t)drawPass]->pipeline);
+
+	// Frame and view uniforms are the same for all batches, and for the transparent ones
+	// drawn next in the same pass
+	uint32_t frameOffset = mUniformRing->offset((uint32_t)BindGroupSlot::Frame);
+	uint32_t viewOffset = mUniformRing->offset((uint32_t)BindGroupSlot::View);
+	state.setBindGroup((uint32_t)BindGroupSlot::Frame, mFrameBindGroup->bindGroup, 1, &frameOffset);
+	state.setBindGroup((uint32_t)BindGroupSlot::View, mViewBindGroup->bindGroup, 1, &viewOffset);
+
+	// Meshes share pages of vertex and index buffers, which are bound whole so that they
+	// are only bound again when a batch draws from another page (or index format), meshes
+	// being told apart by the baseVertex and firstIndex of their draws. The material is
+	// bound again when the texture changes (once only in the depth pre-pass, which does not
+	// sample it), and the draw group for every batch, with its constants.
+	//
+	// With multi-draws, the batches between two such changes are drawn by a single call from
+	// their consecutive indirect arguments, the draw group being bound once per run.
+	//
+	// Batches drawn by clusters end the run, their draws being the range of arguments that
+	// ClusterLod wrote for them, as many as it selected where multi-draws take a count.
+	bool multiDrawn = multiDraw();
+	assert(!multiDrawn || (std::is_same_v<Encoder, RenderPassEncoder>));
+	size_t runStart = firstBatch;
+	auto drawRun = [&](size_t runEnd) {
+		if constexpr (std::is_same_v<Encoder, RenderPassEncoder>) {
+			if (runEnd == runStart) return;
+			MultiDraw::drawIndexedIndirect(encoder, mDrawArgsBuffer, runStart * sizeof(DrawIndexedIndirectArgs), static_cast<uint32_t>(runEnd - runStart));
+			runStart = runEnd;
+		}
+	};
+	auto drawClusters = [&](uint32_t slot) {
+		Buffer drawArgsBuffer = mClusterLod->drawArgsBuffer();
+		uint64_t drawArgsOffset = mClusterLod->drawArgsOffset(slot);
+		if constexpr (std::is_same_v<Encoder, RenderPassEncoder>) {
+			if (multiDrawn) {
+				MultiDraw::drawIndexedIndirectCount(encoder, drawArgsBuffer, drawArgsOffset, mClusterLod->countBuffer(), mClusterLod->countOffset(slot), mClusterLod->drawCapacity(slot), mMultiDrawCount);
+				return;
+			}
+		}
+		for (uint32_t draw = 0; draw < mClusterLod->drawCapacity(slot); ++draw) {
+			encoder.drawIndexedIndirect(drawArgsBuffer, drawArgsOffset + draw * sizeof(DrawIndexedIndirectArgs));
+		}
+	};
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	const ResourceCache::Geometry* boundGeometry = nullptr;
+	uint32_t boundTexture = UINT32_MAX;
+	for (size_t b = firstBatch; b < endBatch; ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		const ResourceCache::Geometry& geometry = *mScene.meshes()[batch.mesh].geometry;
+		// The draw group changing with the vertex page only
+		bool vertexPageChanged = !boundGeometry || geometry.vertexHeap != boundGeometry->vertexHeap || geometry.vertices.page != boundGeometry->vertices.page;
+		bool indexPageChanged = !boundGeometry || geometry.indices.page != boundGeometry->indices.page || geometry.indexFormat != boundGeometry->indexFormat;
+		bool textureChanged = boundTexture == UINT32_MAX || (batch.texture != boundTexture && !depthOnly);
+		bool rebound = vertexPageChanged || indexPageChanged || textureChanged;
+		if (multiDrawn && rebound) drawRun(b);
+
+		// Positions come first, and alone in the depth pre-pass
+		uint32_t vertexBufferCount = fetchedVertexBufferCount(geometry, depthOnly);
+		if (vertexPageChanged) {
+			for (uint32_t slot = 0; slot < vertexBufferCount; ++slot) {
+				state.setVertexBuffer(slot, geometry.vertexBuffer(slot));
+			}
+		}
+		if (indexPageChanged) state.setIndexBuffer(geometry.indexBuffer(), geometry.indexFormat);
+		boundGeometry = &geometry;
 
-	mPipeline = mDevice.createRenderPipeline(pipelineDesc);
+		if (textureChanged) {
+			state.setBindGroup((uint32_t)BindGroupSlot::Material, mMaterialBindGroups[batch.texture]->bindGroup, 0, nullptr);
+			boundTexture = batch.texture;
+		}
+		uint32_t clusterSlot = mClusterLod ? mClusterLod->slot(static_cast<uint32_t>(b)) : ClusterLod::NoSlot;
+		if (multiDrawn) {
+			if (rebound) mDrawConstants->bind(state, (uint32_t)BindGroupSlot::Draw, drawBindGroup(mDrawBindGroups, geometry), static_cast<uint32_t>(b));
+			if (clusterSlot != ClusterLod::NoSlot) {
+				drawRun(b);
+				drawClusters(clusterSlot);
+				runStart = b + 1;
+			}
+			continue;
+		}
+		mDrawConstants->bind(state, (uint32_t)BindGroupSlot::Draw, drawBindGroup(mDrawBindGroups, geometry), static_cast<uint32_t>(b));
 
-	return mPipeline != nullptr;
+		if (clusterSlot != ClusterLod::NoSlot) {
+			drawClusters(clusterSlot);
+			continue;
+		}
+		// Index range and instance count are written by cullInstances
+		encoder.drawIndexedIndirect(mDrawArgsBuffer, b * sizeof(DrawIndexedIndirectArgs));
+	}
+	if (multiDrawn) drawRun(endBatch);
+	state.addCounts(counts);
 }
 
-void Application::terminateRenderPipeline()
+void Application::invalidateRenderBundles()
 {
-	mPipeline.release();
-	mShaderModule.release();
-	mBindGroupLayout.release();
+	for (std::vector<std::vector<RenderBundle>>& frameRenderBundles : mRenderBundles) {
+		for (std::vector<RenderBundle>& renderBundles : frameRenderBundles) {
+			for (RenderBundle& renderBundle : renderBundles) {
+				if (renderBundle) renderBundle.release();
+			}
+		}
+		frameRenderBundles.clear();
+	}
 }
 
-bool Application::initTexture()
+bool Application::initAssetLoading()
 {
-	SamplerDescriptor samplerDesc{};
-	samplerDesc.addressModeU = AddressMode::Repeat;
-	samplerDesc.addressModeV = AddressMode::Repeat;
-	samplerDesc.addressModeW = AddressMode::Repeat;
-	samplerDesc.magFilter = FilterMode::Linear;
-	samplerDesc.minFilter = FilterMode::Linear;
-	samplerDesc.mipmapFilter = MipmapFilterMode::Linear;
-	samplerDesc.lodMinClamp = 0.0f;
-	samplerDesc.lodMaxClamp = 8.0f;
-	samplerDesc.compare = CompareFunction::Undefined;
-	samplerDesc.maxAnisotropy = 1;
-	mSampler = mDevice.createSampler(samplerDesc);
+	TRACE_SCOPE("initAssetLoading");
+	// As many workers as cores, so that batches of textures decode in parallel, next to the memory
+	// the main thread uploads them from
+	mAssetLoader = std::make_unique<AssetLoader>(workerThreadCount(), ThreadAffinity::LocalNode);
+#ifndef __EMSCRIPTEN__
+	// Created once, to outlive the devices. Browsers never recover the device, thus nothing to retain.
+	if (!mRetainedAssets) {
+		bool retain = true;
+		if (const char* retainAssets = std::getenv("LEARNWEBGPU_RETAIN_ASSETS")) {
+			uint32_t enabled = 0;
+			auto result = std::from_chars(retainAssets, retainAssets + std::strlen(retainAssets), enabled);
+			if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+				retain = enabled == 1;
+			}
+			else {
+				std::cerr << "Ignoring invalid LEARNWEBGPU_RETAIN_ASSETS '" << retainAssets << "', expected 0 or 1" << std::endl;
+			}
+		}
+		if (retain) mRetainedAssets = std::make_unique<RetainedAssets>();
+	}
+	// Files published on a content server replace those of the resource directory as the
+	// application runs, with LEARNWEBGPU_ASSET_SERVER=<http://host:port/path or directory>
+	if (!mAssetSync) {
+		if (const char* assetServer = std::getenv("LEARNWEBGPU_ASSET_SERVER")) {
+			AssetSync::Settings settings;
+			settings.source = assetServer;
+			settings.root = RESOURCE_DIR;
+			mAssetSync = std::make_unique<AssetSync>(settings);
+		}
+	}
+#endif // ! __EMSCRIPTEN__
+#ifndef __EMSCRIPTEN__
+	// Rendering on demand waits for events, which finished jobs are too
+	if (mWindow) mAssetLoader->setCompletionNotifier([]() { glfwPostEmptyEvent(); });
+#endif // ! __EMSCRIPTEN__
 
-	mTexture = ResourceManager::loadTexture(RESOURCE_DIR "/fourareen2K_albedo.jpg", mDevice, &mTextureView);
-	if (!mTexture) {
-		std::cerr << "Could not load texture!" << std::endl;
-		return false;
+	// Static instances of models of up to that many vertices, e.g. small props, merged into chunks
+	// of combined geometry at load with LEARNWEBGPU_STATIC_BATCHING=<vertices>
+	if (const char* staticBatching = std::getenv("LEARNWEBGPU_STATIC_BATCHING")) {
+		uint32_t vertexLimit = 0;
+		auto result = std::from_chars(staticBatching, staticBatching + std::strlen(staticBatching), vertexLimit);
+		if (result.ec == std::errc() && *result.ptr == '\0') {
+			mStaticBatchVertexLimit = vertexLimit;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_STATIC_BATCHING '" << staticBatching << "', expected a vertex count" << std::endl;
+		}
+	}
+
+	// Models drawn by the clusters of a continuous level of detail hierarchy, built at load, with
+	// LEARNWEBGPU_CLUSTER_LOD=1
+	if (const char* clusterLod = std::getenv("LEARNWEBGPU_CLUSTER_LOD")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(clusterLod, clusterLod + std::strlen(clusterLod), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mClusterLodEnabled = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_CLUSTER_LOD '" << clusterLod << "', expected 0 or 1" << std::endl;
+		}
+	}
+
+	// Largest size of textures, e.g. 512 for low-end devices: JPEG images are then decoded at
+	// a fraction of their size, and the largest levels of others are dropped
+	if (const char* textureSize = std::getenv("LEARNWEBGPU_TEXTURE_SIZE")) {
+		uint32_t maxSize = 0;
+		auto result = std::from_chars(textureSize, textureSize + std::strlen(textureSize), maxSize);
+		if (result.ec == std::errc() && *result.ptr == '\0') {
+			mTextureLoadOptions.maxSize = maxSize;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_TEXTURE_SIZE '" << textureSize << "', expected a size in texels" << std::endl;
+		}
+	}
+
+#ifdef __EMSCRIPTEN__
+	// Resources are fetched, with nowhere to store their compressed versions
+	mTextureCompression = false;
+#else
+	if (const char* textureCompression = std::getenv("LEARNWEBGPU_TEXTURE_COMPRESSION")) {
+		uint32_t enabled = 0;
+		auto result = std::from_chars(textureCompression, textureCompression + std::strlen(textureCompression), enabled);
+		if (result.ec == std::errc() && *result.ptr == '\0' && enabled <= 1) {
+			mTextureCompression = enabled == 1;
+		}
+		else {
+			std::cerr << "Ignoring invalid LEARNWEBGPU_TEXTURE_COMPRESSION '" << textureCompression << "', expected 0 or 1" << std::endl;
+		}
+	}
+#endif // __EMSCRIPTEN__
+
+	// What the scene is made of, filled in by the completions of the jobs
+	mModelMesh = mScene.addMesh();
+	mModelMaterial = mScene.addMaterial({});
+	if (mSceneGenerator) enqueueStressScene();
+
+	// Any .obj, .glb or points/indices .txt file may replace the default model, e.g. one generated by tools
+	mModelPath = RESOURCE_DIR "/fourareen.obj";
+	if (const char* modelPath = std::getenv("LEARNWEBGPU_MODEL")) {
+		mModelPath = modelPath;
 	}
-  return mTextureView != nullptr;
+
+	// Scans too large for triangles, from text files of [points] only
+	if (const char* pointCloudPath = std::getenv("LEARNWEBGPU_POINT_CLOUD")) {
+		mPointCloudPath = pointCloudPath;
+	}
+	if (!mPointCloudPath.empty() && !mPointCloudOctree) {
+		mAssetLoader->enqueue([this, path = mPointCloudPath]() -> AssetLoader::Completion {
+			std::shared_ptr<const PointCloudOctree> octree = PointCloudOctree::load(path);
+			if (!octree) {
+				std::cerr << "Could not load point cloud!" << std::endl;
+				return nullptr;
+			}
+			return [this, octree]() {
+				std::cout << "Point cloud of " << octree->points().size() << " points in " << octree->nodes().size() << " nodes" << std::endl;
+				mPointCloudOctree = octree;
+				if (mPointCloud) mPointCloud->setOctree(octree);
+			};
+		});
+	}
+
+	// Jobs only touch their own data, the device and the cache are used by their completions
+	enqueueTextureLoading(true /* preferCompressed */);
+	enqueueModelLoading();
+
+	return true;
 }
 
-void Application::terminateTexture()
+void Application::enqueueModelLoading()
 {
-	mTextureView.release();
-	mTexture.destroy();
-	mTexture.release();
-	mSampler.release();
+	std::filesystem::path geometryPath = mModelPath;
+	ResourceManager::GeometryLoadOptions geometryOptions;
+	geometryOptions.clusterLod = mClusterLodEnabled;
+	if (geometryPath.extension() == ".glb") {
+		// Exported by the content pipeline ready to draw, thus uploaded straight from the file
+		geometryOptions.optimizeVertexCache = false;
+		geometryOptions.optimizeVertexFetch = false;
+		geometryOptions.lodLevelCount = 1;
+		geometryOptions.buildMeshlets = false;
+		geometryOptions.clusterLod = false;
+	}
+	std::string geometryKey = ResourceCache::geometryKey(geometryPath, geometryOptions, mVertexLayout);
+	mAssetLoader->enqueue([this, geometryPath, geometryOptions, geometryKey]() -> AssetLoader::Completion {
+		RetainedAssets::Mesh mesh = mRetainedAssets ? mRetainedAssets->findMesh(geometryKey) : RetainedAssets::Mesh{};
+		if (!mesh.geometry) {
+			// Load mesh data from the source file, or from its binary cache when up to date
+			auto geometry = std::make_shared<ResourceManager::Geometry>();
+			if (!ResourceManager::loadGeometry(geometryPath, *geometry, geometryOptions)) {
+				std::cerr << "Could not load geometry!" << std::endl;
+				return nullptr;
+			}
+			// Built on this thread too, from the vertices still in CPU memory, unless a snapshot of
+			// the tree was written for them
+			auto bvh = std::make_shared<MeshBvh>();
+			if (!bvh->loadCache(geometryPath, *geometry)) {
+				bvh->build(*geometry);
+				bvh->writeCache(geometryPath, *geometry);
+			}
+			mesh = { geometry, bvh };
+			if (mRetainedAssets) mRetainedAssets->addMesh(geometryKey, mesh);
+		}
+		return [this, geometryPath, geometryOptions, geometryKey, geometry = mesh.geometry, bvh = mesh.bvh]() {
+			if (mLightBaker && !geometry->bakedLighting) {
+				bakeModelLighting(geometryPath, geometryOptions, geometryKey, geometry, bvh).detach();
+				return;
+			}
+			uploadModelGeometry(geometryPath, geometryOptions, geometry, bvh);
+		};
+	});
+}
+
+void Application::uploadModelGeometry(
+	const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options,
+	std::shared_ptr<const ResourceManager::Geometry> geometry, std::shared_ptr<const MeshBvh> bvh
+) {
+	// A model received again (see updateAssetSync) may have other submeshes and batches, which
+	// start over from the grid of instances. The previous geometry is released with them.
+	if (mScene.meshes()[mModelMesh].geometry) {
+		invalidateRenderBundles();
+		terminateInstances();
+		if (!initInstances()) {
+			std::cerr << "Could not place the instances of the model again!" << std::endl;
+			return;
+		}
+	}
+	mScene.setMeshBvh(mModelMesh, bvh);
+	mImposterGeometry = geometry;
+	mImposterBakeNeeded = true;
+	// Large meshes are uploaded over several frames rather than in this one
+	bool stream = geometry->vertices.size_bytes() + geometry->indices.size_bytes() > geometryStreamThreshold;
+	ResourceCache::GeometryHandle handle = stream
+		? mResourceCache->streamGeometry(path, options, mVertexLayout, geometry)
+		: mResourceCache->addGeometry(path, options, mVertexLayout, *geometry);
+	if (!initGeometry(handle)) {
+		std::cerr << "Could not upload geometry!" << std::endl;
+		return;
+	}
+	initSubmeshes(*geometry, handle, bvh);
+	batchStaticInstances(*geometry);
 }
 
-TextureView Application::getNextSurfaceTextureView()
+void Application::enqueueStressScene()
 {
-	// Get the surface Texture
-	SurfaceTexture surfaceTexture{};
-	mSurface.getCurrentTexture(&surfaceTexture);
-	if (surfaceTexture.status != SurfaceGetCurrentTextureStatus::Success) {
-		return nullptr;
+	TRACE_SCOPE("enqueueStressScene");
+	const StressSceneOptions& options = mSceneGenerator->options();
+	mStressMeshes.clear();
+	mStressMaterials.clear();
+	for (uint32_t m = 0; m < options.meshCount; ++m) {
+		mStressMeshes.push_back(mScene.addMesh());
+	}
+	for (uint32_t m = 0; m < options.materialCount; ++m) {
+		Scene::Material material;
+		material.color = mSceneGenerator->materialColor(m);
+		mStressMaterials.push_back(mScene.addMaterial(material));
 	}
-	Texture texture = surfaceTexture.texture;
-
-	// Create a view for this surface texture
-	TextureViewDescriptor viewDescriptor{};
-	viewDescriptor.label = "Surface Texture View";
-	viewDescriptor.format = texture.getFormat();
-	viewDescriptor.dimension = TextureViewDimension::_2D;
-	viewDescriptor.baseMipLevel = 0;
-	viewDescriptor.mipLevelCount = 1;
-	viewDescriptor.baseArrayLayer = 0;
-	viewDescriptor.arrayLayerCount = 1;
-	viewDescriptor.aspect = TextureAspect::All;
-	TextureView targetView = texture.createView(viewDescriptor);
 
-#ifndef WEBGPU_BACKEND_WGPU
-	texture.release();
-#endif // WEBGPU_BACKEND_WGPU
+	// One job per mesh and per texture, generated like others are loaded
+	for (uint32_t m = 0; m < options.meshCount; ++m) {
+		mAssetLoader->enqueue([this, m]() -> AssetLoader::Completion {
+			std::shared_ptr<const ResourceManager::Geometry> geometry = mSceneGenerator->generateMesh(m);
+			auto bvh = std::make_shared<MeshBvh>();
+			bvh->build(*geometry);
+			return [this, m, geometry, bvh = std::shared_ptr<const MeshBvh>(bvh)]() {
+				ResourceCache::GeometryHandle handle = mResourceCache->addGeometry(mVertexLayout, *geometry);
+				if (!handle) {
+					std::cerr << "Could not upload a mesh of the synthetic scene!" << std::endl;
+					return;
+				}
+				mScene.setMeshGeometry(mStressMeshes[m], handle);
+				mScene.setMeshBvh(mStressMeshes[m], bvh);
+				mFrameDirty = true;
+			};
+		});
+	}
+	for (uint32_t t = 0; t < options.textureCount; ++t) {
+		mAssetLoader->enqueue([this, t, textureOptions = mTextureLoadOptions]() -> AssetLoader::Completion {
+			auto image = std::make_shared<ResourceManager::Image>(mSceneGenerator->generateTexture(t));
+			if (!image->pixels) return nullptr;
+			if (textureOptions.mipmapGeneration != ResourceManager::TextureLoadOptions::MipmapGeneration::Gpu) {
+				ResourceManager::buildMipMaps(*image, textureOptions);
+			}
+			return [this, t, textureOptions, image]() {
+				// Named for the cache only, nothing being read from there
+				std::filesystem::path path = "synthetic/texture" + std::to_string(t) + ".png";
+				ResourceCache::TextureHandle texture = mResourceCache->addTexture(path, textureOptions, *image);
+				if (!texture) {
+					std::cerr << "Could not upload a texture of the synthetic scene!" << std::endl;
+					return;
+				}
+				for (uint32_t m = 0; m < mStressMaterials.size(); ++m) {
+					if (mSceneGenerator->materialTexture(m) == t) mScene.setMaterialTexture(mStressMaterials[m], texture);
+				}
+				mFrameDirty = true;
+			};
+		});
+	}
+}
 
-	return targetView;
+Task<> Application::bakeModelLighting(
+	std::filesystem::path path, ResourceManager::GeometryLoadOptions options, std::string key,
+	std::shared_ptr<const ResourceManager::Geometry> geometry, std::shared_ptr<const MeshBvh> bvh
+) {
+	std::vector<glm::vec3> lighting = co_await mLightBaker->bake(geometry, bvh);
+	if (!lighting.empty()) {
+		co_await mAssetLoader->resumeOnWorker();
+		auto baked = std::make_shared<ResourceManager::Geometry>();
+		bool stored = ResourceManager::storeBakedLighting(path, options, *geometry, lighting, *baked);
+		if (stored) {
+			std::cout << "Baked the lighting of " << path.filename() << " on the GPU" << std::endl;
+		}
+		// Same vertices, thus the same tree, whose snapshot now goes with the baked colors
+		geometry = baked;
+		if (stored) bvh->writeCache(path, *geometry);
+		if (mRetainedAssets) mRetainedAssets->addMesh(key, { geometry, bvh });
+		co_await mAssetLoader->resumeOnDeviceThread();
+	}
+	else {
+		std::cerr << "Drawing " << path.filename() << " with its vertex colors as lighting" << std::endl;
+	}
+	// The device may have been lost and recreated meanwhile, loading the model again
+	if (!mLightBaker) co_return;
+	uploadModelGeometry(path, options, geometry, bvh);
 }
 
-bool Application::initGeometry()
+void Application::enqueueTextureLoading(bool preferCompressed)
 {
-	// Load mesh data from OBJ file
-	std::vector<ResourceManager::VertexAttributes> vertexData;
-	bool success = ResourceManager::loadGeometryFromObj(RESOURCE_DIR "/fourareen.obj", vertexData);
-	if (!success) {
-		std::cerr << "Could not load geometry!" << std::endl;
-		return false;
+	// The base color texture embedded in a .glb model, either KTX2 or PNG/JPEG
+	if (preferCompressed && mModelPath.extension() == ".glb") {
+		std::filesystem::path path = mModelPath;
+		ResourceManager::TextureLoadOptions options = mTextureLoadOptions;
+		mAssetLoader->enqueue([this, path, options]() -> AssetLoader::Completion {
+			std::string key = ResourceCache::textureKey(path, options);
+			std::shared_ptr<const ResourceManager::CompressedImage> compressedImage = mRetainedAssets ? mRetainedAssets->findCompressedImage(key) : nullptr;
+			if (!compressedImage) {
+				auto loaded = std::make_shared<ResourceManager::CompressedImage>();
+				if (ResourceManager::loadCompressedImageFromGlb(path, *loaded)) {
+					compressedImage = loaded;
+					if (mRetainedAssets) mRetainedAssets->addCompressedImage(key, compressedImage);
+				}
+			}
+			if (compressedImage) {
+				return [this, path, options, compressedImage]() {
+					ResourceCache::TextureHandle texture = mResourceCache->streamTexture(path, options, compressedImage);
+					if (!texture) {
+						enqueueTextureLoading(false);
+						return;
+					}
+					onTextureLoaded(texture);
+				};
+			}
+			std::shared_ptr<const ResourceManager::Image> image = mRetainedAssets ? mRetainedAssets->findImage(key) : nullptr;
+			if (!image) {
+				auto decoded = std::make_shared<ResourceManager::Image>();
+				if (!ResourceManager::loadImageFromGlb(path, *decoded, options)) {
+					// The default texture then
+					return [this]() { enqueueTextureLoading(false); };
+				}
+				if (options.mipmapGeneration != ResourceManager::TextureLoadOptions::MipmapGeneration::Gpu) {
+					ResourceManager::buildMipMaps(*decoded, options);
+				}
+				image = decoded;
+				if (mRetainedAssets) mRetainedAssets->addImage(key, image);
+			}
+			return [this, path, options, image]() {
+				onTextureLoaded(mResourceCache->streamTexture(path, options, image));
+			};
+		});
+		return;
 	}
 
-	// Create vertex buffer
-	BufferDescriptor bufferDesc{};
-	bufferDesc.size = vertexData.size() * sizeof(ResourceManager::VertexAttributes);
-	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-	bufferDesc.mappedAtCreation = false;
-	mVertexBuffer = mDevice.createBuffer(bufferDesc);
-	mQueue.writeBuffer(mVertexBuffer, 0, vertexData.data(), bufferDesc.size);
-
-	mVertexCount = static_cast<int>(vertexData.size());
+	// A block-compressed version of the texture, if any, is uploaded as is without decoding
+	std::filesystem::path compressedPath = RESOURCE_DIR "/fourareen2K_albedo.ktx2";
+#ifdef __EMSCRIPTEN__
+	// Nothing to check without fetching it, a failed fetch falling back to the regular image
+	bool compressedExists = true;
+#else
+	bool compressedExists = AssetBundle::find(compressedPath) || std::filesystem::exists(compressedPath);
+#endif // __EMSCRIPTEN__
+	// Virtual textures are tiled from the decoded image, whatever its size
+	if (preferCompressed && compressedExists && !mVirtualTextures) {
+		// No cache yet while the device is being requested, thus nothing cached
+		if (ResourceCache::TextureHandle texture = mResourceCache ? mResourceCache->findTexture(compressedPath, mTextureLoadOptions) : nullptr) {
+			onTextureLoaded(texture);
+			return;
+		}
+		// Levels are stored as is, whatever the options
+		std::string key = ResourceCache::textureKey(compressedPath, {});
+		mAssetLoader->enqueue([this, compressedPath, key]() -> AssetLoader::Completion {
+			std::shared_ptr<const ResourceManager::CompressedImage> image = mRetainedAssets ? mRetainedAssets->findCompressedImage(key) : nullptr;
+			if (!image) {
+				auto loaded = std::make_shared<ResourceManager::CompressedImage>();
+				if (!ResourceManager::loadCompressedImage(compressedPath, *loaded)) {
+					return [this]() { enqueueTextureLoading(false); };
+				}
+				image = loaded;
+				if (mRetainedAssets) mRetainedAssets->addCompressedImage(key, image);
+			}
+			return [this, compressedPath, image]() {
+				ResourceCache::TextureHandle texture = mResourceCache->streamTexture(compressedPath, mTextureLoadOptions, image);
+				if (!texture) {
+					// The device does not support this format, fall back to the regular image
+					enqueueTextureLoading(false);
+					return;
+				}
+				onTextureLoaded(texture);
+			};
+		});
+		return;
+	}
 
-	return mVertexBuffer != nullptr;
+	// Mip-maps are filtered on the worker thread as well. Decoded by a job of its own rather
+	// than through ResourceCache::loadTextures, which needs the cache, thus the device.
+	std::filesystem::path path = RESOURCE_DIR "/fourareen2K_albedo.jpg";
+	if (ResourceCache::TextureHandle texture = mResourceCache ? mResourceCache->findTexture(path, mTextureLoadOptions) : nullptr) {
+		onTextureLoaded(texture);
+		return;
+	}
+	loadImageTexture(path, mTextureLoadOptions).detach();
 }
 
-void Application::terminateGeometry()
+Task<> Application::loadImageTexture(std::filesystem::path path, ResourceManager::TextureLoadOptions options)
 {
-	mVertexBuffer.destroy();
-	mVertexBuffer.release();
-	mVertexCount = 0;
-}
+	// Paged in by tiles, unless its tiles could not be stored
+	if (mVirtualTextures) {
+		if (ResourceCache::TextureHandle texture = co_await loadVirtualTexture(path, options)) {
+			onTextureLoaded(texture);
+			co_return;
+		}
+	}
 
-bool Application::initUniforms()
-{
-	// Create uniform buffer
-	BufferDescriptor bufferDesc{};
-	bufferDesc.size = sizeof(BasicShaderUniforms);
-	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-	bufferDesc.mappedAtCreation = false;
-	mUniformBuffer = mDevice.createBuffer(bufferDesc);
+	co_await mAssetLoader->resumeOnWorker();
+	// Compressed by an earlier run, unless the device cannot sample it
+	bool compress = mTextureCompression;
+	if (compress) {
+		auto cached = std::make_shared<ResourceManager::CompressedImage>();
+		if (ResourceManager::loadCompressedTextureCache(path, options, *cached)) {
+			co_await mAssetLoader->resumeOnDeviceThread();
+			if (ResourceCache::TextureHandle texture = mResourceCache->streamTexture(path, options, std::shared_ptr<const ResourceManager::CompressedImage>(cached))) {
+				onTextureLoaded(texture);
+				co_return;
+			}
+			co_await mAssetLoader->resumeOnWorker();
+		}
+	}
 
-	// Upload the initial value of the uniforms
-	mUniforms.modelMatrix = glm::mat4(1.0f);
-	//mUniforms.viewMatrix = glm::lookAt(glm::vec3(-2.0f, -3.0f, 2.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-  updateViewMatrix();
-	//mUniforms.projectionMatrix = glm::perspective(45 * glm::pi<float>() / 180.0f, 640.0f / 480.0f, 0.01f, 100.0f);
-  updateProjectionMatrix();
-	mUniforms.time = 1.0f;
-	mUniforms.color = { 0.0f, 1.0f, 0.4f, 1.0f };
-	mQueue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(BasicShaderUniforms));
+	std::string key = ResourceCache::textureKey(path, options);
+	std::shared_ptr<const ResourceManager::Image> image = mRetainedAssets ? mRetainedAssets->findImage(key) : nullptr;
+	if (!image) {
+		auto decoded = std::make_shared<ResourceManager::Image>();
+		if (!ResourceManager::loadImage(path, *decoded, options)) {
+			std::cerr << "Could not load texture!" << std::endl;
+			co_return;
+		}
+		// Compressed levels are all built ahead
+		if (compress || options.mipmapGeneration != ResourceManager::TextureLoadOptions::MipmapGeneration::Gpu) {
+			ResourceManager::buildMipMaps(*decoded, options);
+		}
+		image = decoded;
+		if (mRetainedAssets) mRetainedAssets->addImage(key, image);
+	}
 
-	return mUniformBuffer != nullptr;
+	co_await mAssetLoader->resumeOnDeviceThread();
+	// Level 0 of compressed textures is a whole number of blocks
+	compress = compress && mTextureCompressor && image->mipLevelCount > 1 && image->width % 4 == 0 && image->height % 4 == 0;
+	if (compress) {
+		TextureCompressor::Result compressed = co_await mTextureCompressor->compress(image, options.srgb);
+		if (!compressed.blocks.empty()) {
+			// Mapped back from the file, as the next runs will
+			co_await mAssetLoader->resumeOnWorker();
+			auto cached = std::make_shared<ResourceManager::CompressedImage>();
+			bool stored = ResourceManager::writeCompressedTextureCache(path, options, compressed.image())
+				&& ResourceManager::loadCompressedTextureCache(path, options, *cached);
+			co_await mAssetLoader->resumeOnDeviceThread();
+			ResourceCache::TextureHandle texture = stored ? mResourceCache->streamTexture(path, options, std::shared_ptr<const ResourceManager::CompressedImage>(cached)) : nullptr;
+			if (texture) {
+				std::cout << "Compressed texture " << path.filename() << " to " << compressed.format << " on the GPU" << std::endl;
+				onTextureLoaded(texture);
+				co_return;
+			}
+		}
+	}
+	onTextureLoaded(mResourceCache->streamTexture(path, options, image));
 }
 
-void Application::terminateUniforms()
+Task<ResourceCache::TextureHandle> Application::loadVirtualTexture(std::filesystem::path path, ResourceManager::TextureLoadOptions options)
 {
-	mUniformBuffer.destroy();
-	mUniformBuffer.release();
+	co_await mAssetLoader->resumeOnWorker();
+	// Tiles of the full image, which the budget of whole textures does not apply to
+	options.maxSize = 0;
+	VirtualTextures::TileFile tiles;
+	if (!VirtualTextures::loadTileFile(path, options, tiles)) {
+		ResourceManager::Image image;
+		if (!ResourceManager::loadImage(path, image, options)
+			|| !VirtualTextures::writeTileFile(path, options, image)
+			|| !VirtualTextures::loadTileFile(path, options, tiles)) {
+			co_await mAssetLoader->resumeOnDeviceThread();
+			co_return nullptr;
+		}
+		std::cout << "Cut texture " << path.filename() << " into tiles" << std::endl;
+	}
+	co_await mAssetLoader->resumeOnDeviceThread();
+	// Gone with the device meanwhile
+	if (!mVirtualTextures) co_return nullptr;
+	co_return mVirtualTextures->add(std::move(tiles));
 }
 
-bool Application::initBindGroup()
+void Application::terminateAssetLoading()
 {
-	// Create a binding
-	std::vector<BindGroupEntry> bindings(3);
-	bindings[0].binding = 0;
-	bindings[0].buffer = mUniformBuffer;
-	bindings[0].offset = 0;
-	bindings[0].size = sizeof(BasicShaderUniforms);
-
-	bindings[1].binding = 1;
-	bindings[1].textureView = mTextureView;
-
-	bindings[2].binding = 2;
-	bindings[2].sampler = mSampler;
-
-	BindGroupDescriptor bindGroupDesc{};
-	bindGroupDesc.layout = mBindGroupLayout;
-	bindGroupDesc.entryCount = (uint32_t)bindings.size();
-	bindGroupDesc.entries = bindings.data();
-	mBindGroup = mDevice.createBindGroup(bindGroupDesc);
-
-  return mBindGroup != nullptr;
+	// Wait for jobs still running, their results are dropped
+	mAssetLoader.reset();
+	// Resources still referenced by the application are released with their handles
+	mResourceCache.reset();
 }
 
-void Application::terminateBindGroup()
+void Application::updateAssetSync()
 {
-  mBindGroup.release();
+	if (!mAssetSync) return;
+	std::vector<std::filesystem::path> paths = mAssetSync->poll();
+	if (paths.empty()) return;
+
+	std::error_code error;
+	std::filesystem::path modelPath = std::filesystem::absolute(mModelPath, error).lexically_normal();
+	bool reloadModel = false;
+	bool reloadTexture = false;
+	for (const std::filesystem::path& path : paths) {
+		// The next loads read the file again, what is drawn staying until replaced
+		mResourceCache->evict(path);
+		if (mRetainedAssets) mRetainedAssets->evict(path);
+		std::filesystem::path extension = path.extension();
+		if (extension == ".wgsl") {
+			mShaderReloadRequested = true;
+		}
+		else if (std::filesystem::absolute(path, error).lexically_normal() == modelPath) {
+			// Along with the texture it may embed
+			reloadModel = true;
+			reloadTexture = reloadTexture || extension == ".glb";
+		}
+		else if (extension == ".mtl") {
+			reloadModel = true;
+		}
+		else if (extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".ktx2") {
+			// The default texture, or that of a submesh, which is loaded with the model
+			reloadTexture = true;
+			reloadModel = reloadModel || !mSubmeshMeshes.empty();
+		}
+	}
+	// Textures that did not change are found in the cache, geometries in the retained assets
+	if (reloadTexture) enqueueTextureLoading(true /* preferCompressed */);
+	if (reloadModel) enqueueModelLoading();
 }
 
 void Application::handleResize(int width, int height)
 {
+	// Applied whether or not a replay plays, the surface having to follow the window
+	if (mInputRecorder) mInputRecorder->record({ InputEvent::Type::Resize, 0, 0, double(width), double(height) });
 	mWindowWidth = width;
 	mWindowHeight = height;
-  onResize();
+	// Applied by the next frame, however many events the window sends until then
+	mResizePending = true;
 }
 
 
@@ -743,10 +6267,14 @@ EM_BOOL Application::browserResizeCallback(int /*eventType*/, const EmscriptenUi
 
 	//std::cout << "[Browser] window resize: " << width << " x " << height << std::endl;
 
-	emscripten_set_canvas_element_size("#canvas", width, height);
-
 	Application* app = reinterpret_cast<Application*>(userData);
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	// The canvas is resized by the worker that owns it
+	app->mInputQueue.push({ InputEvent::Type::Resize, 0, 0, double(width), double(height) });
+#else
+	emscripten_set_canvas_element_size("#canvas", width, height);
   app->handleResize(width, height);
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
 
 	return EM_TRUE;
 }
@@ -757,7 +6285,11 @@ EM_BOOL Application::mouseMoveCallback(int /*eventType*/, const EmscriptenMouseE
 	double x = e->targetX;
 	double y = e->targetY;
 
-	app->onMouseMove(x, y);
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	app->mInputQueue.push({ InputEvent::Type::MouseMove, 0, 0, x, y });
+#else
+	app->queueMouseMove(x, y);
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
 
 	return EM_TRUE;
 }
@@ -767,7 +6299,13 @@ EM_BOOL Application::mouseDownCallback(int /*eventType*/, const EmscriptenMouseE
 
 	int button = e->button;
 
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	// With the position of the press, in case no move was queued before it
+	app->mInputQueue.push({ InputEvent::Type::MouseButton, button, GLFW_PRESS, double(e->targetX), double(e->targetY) });
+#else
+	app->flushMouseMove();
 	app->onMouseButton(button, GLFW_PRESS, 0);
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
 
 	return EM_TRUE;
 }
@@ -777,7 +6315,12 @@ EM_BOOL Application::mouseUpCallback(int /*eventType*/, const EmscriptenMouseEve
 
 	int button = e->button;
 
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	app->mInputQueue.push({ InputEvent::Type::MouseButton, button, GLFW_RELEASE, double(e->targetX), double(e->targetY) });
+#else
+	app->flushMouseMove();
 	app->onMouseButton(button, GLFW_RELEASE, 0);
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
 
 	return EM_TRUE;
 }
@@ -786,54 +6329,674 @@ EM_BOOL Application::wheelCallback(int /*eventType*/ , const EmscriptenWheelEven
 	Application* app = reinterpret_cast<Application*>(userData);
 
 	double normalized = -e->deltaY * 0.01;
+#ifdef LEARNWEBGPU_OFFSCREEN_CANVAS
+	app->mInputQueue.push({ InputEvent::Type::Scroll, 0, 0, 0.0, normalized });
+#else
+	app->flushMouseMove();
 	app->onScroll(0.0, normalized);
+#endif // LEARNWEBGPU_OFFSCREEN_CANVAS
 
 	return EM_TRUE;
 }
 #endif
 
+void Application::processInputEvents()
+{
+	InputEvent event;
+	while (mInputQueue.pop(event)) {
+		if (event.type != InputEvent::Type::MouseMove) flushMouseMove();
+		switch (event.type) {
+		case InputEvent::Type::MouseMove:
+			queueMouseMove(event.x, event.y);
+			break;
+		case InputEvent::Type::MouseButton:
+			mCursorPosition = { event.x, event.y };
+			onMouseButton(event.button, event.action, 0);
+			break;
+		case InputEvent::Type::Scroll:
+			onScroll(event.x, event.y);
+			break;
+		case InputEvent::Type::Key:
+			onKey(event.button, 0, event.action, 0);
+			break;
+		case InputEvent::Type::Resize:
+#ifdef __EMSCRIPTEN__
+			emscripten_set_canvas_element_size("#canvas", static_cast<int>(event.x), static_cast<int>(event.y));
+#endif // __EMSCRIPTEN__
+			handleResize(static_cast<int>(event.x), static_cast<int>(event.y));
+			break;
+		}
+	}
+	flushMouseMove();
+}
+
+void Application::queueMouseMove(double xpos, double ypos)
+{
+	// A drag only depends on where the cursor is relative to where it started, and inertia
+	// on how far the camera went in the frame, which the last position of a run gives
+	mPendingMousePosition = { xpos, ypos };
+	mMouseMovePending = true;
+}
+
+void Application::flushMouseMove()
+{
+	if (!mMouseMovePending) return;
+	mMouseMovePending = false;
+	onMouseMove(mPendingMousePosition.x, mPendingMousePosition.y);
+}
+
+void Application::forwardInputEvent(const InputEvent& event)
+{
+	if (event.type == InputEvent::Type::MouseMove) {
+		mForwardedMove = event;
+		mForwardedMovePending = true;
+		return;
+	}
+	flushForwardedMouseMove();
+	// Dropped when the render thread is stalled for many frames anyway
+	mInputQueue.push(event);
+}
+
+void Application::flushForwardedMouseMove()
+{
+	if (!mForwardedMovePending) return;
+	mForwardedMovePending = false;
+	mInputQueue.push(mForwardedMove);
+}
+
+void Application::runOnMainThread(std::function<void()> task, bool wait)
+{
+	if (!mRenderThread || std::this_thread::get_id() == mMainThreadId) {
+		task();
+		return;
+	}
+#ifdef __EMSCRIPTEN__
+	// There is no render thread in the browser
+	assert(false && "runOnMainThread() in the render thread mode of the browser");
+#else
+	std::promise<void> done;
+	std::future<void> ran = done.get_future();
+	{
+		std::lock_guard<std::mutex> lock(mMainThreadTasksMutex);
+		if (wait) {
+			mMainThreadTasks.push_back([&task, &done]() {
+				task();
+				done.set_value();
+			});
+		}
+		else {
+			mMainThreadTasks.push_back(std::move(task));
+		}
+	}
+	// The main thread may be waiting for events
+	glfwPostEmptyEvent();
+	// It keeps pumping events until the render thread ends, which cannot while waiting here
+	if (wait) ran.wait();
+#endif // __EMSCRIPTEN__
+}
+
+void Application::runMainThreadTasks()
+{
+	std::vector<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(mMainThreadTasksMutex);
+		tasks.swap(mMainThreadTasks);
+	}
+	for (const std::function<void()>& task : tasks) {
+		task();
+	}
+}
+
+void Application::requestWindowSize(int width, int height)
+{
+	if (!mWindow) {
+		handleResize(width, height);
+		return;
+	}
+	// Through the window, whose callback then resizes the surface, from the main thread as GLFW
+	// requires. Not waited for, the resize reaching the render thread as any other.
+	runOnMainThread([this, width, height]() { glfwSetWindowSize(mWindow, width, height); }, false);
+}
+
+bool Application::acceptInput(const InputEvent& event)
+{
+	// The events of the window, until a replay ends
+	if (mInputReplay && !mReplayingInput) return false;
+	if (mInputRecorder) mInputRecorder->record(event);
+	return true;
+}
+
+void Application::replayInputFrame()
+{
+	bool starting = !mInputReplay->started();
+	if (starting) {
+		if (!sceneSettled()) return;
+		const InputRecordingStart& start = mInputReplay->start();
+		mCameraState.angles = start.cameraAngles;
+		mCameraState.zoom = start.cameraZoom;
+		mAnimate = start.animate;
+		mViewDirty = true;
+		if (start.width != mWindowWidth || start.height != mWindowHeight) {
+			requestWindowSize(static_cast<int>(start.width), static_cast<int>(start.height));
+		}
+	}
+
+	std::vector<InputEvent> events;
+	if (!mInputReplay->nextFrame(events)) {
+		std::cout << "Replayed " << mInputReplay->frameCount() << " frames of input" << std::endl;
+		return;
+	}
+	if (starting) mFrameClock.reset(mInputReplay->time());
+
+	mReplayingInput = true;
+	for (const InputEvent& event : events) {
+		switch (event.type) {
+		case InputEvent::Type::MouseMove:
+			onMouseMove(event.x, event.y);
+			break;
+		case InputEvent::Type::MouseButton:
+			mCursorPosition = { event.x, event.y };
+			onMouseButton(event.button, event.action, 0);
+			break;
+		case InputEvent::Type::Scroll:
+			onScroll(event.x, event.y);
+			break;
+		case InputEvent::Type::Key:
+			onKey(event.button, 0, event.action, 0);
+			break;
+		case InputEvent::Type::Resize:
+			requestWindowSize(static_cast<int>(event.x), static_cast<int>(event.y));
+			break;
+		}
+	}
+	mReplayingInput = false;
+}
+
+void Application::recordInputFrame()
+{
+	if (!mInputRecorder->started()) {
+		if (!sceneSettled()) return;
+		InputRecordingStart start;
+		start.width = mWindowWidth;
+		start.height = mWindowHeight;
+		start.cameraAngles = mCameraState.angles;
+		start.cameraZoom = mCameraState.zoom;
+		start.animate = mAnimate;
+		if (!mInputRecorder->start(start, currentTime())) {
+			mInputRecorder.reset();
+			return;
+		}
+		std::cout << "Recording input" << std::endl;
+	}
+	mInputRecorder->endFrame(currentTime());
+}
+
+#ifndef __EMSCRIPTEN__
+void Application::runWithRenderThread()
+{
+	std::atomic<bool> rendering = true;
+	std::thread renderThread([this, &rendering]() {
+		Trace::setThreadName("Render thread");
+		while (isRunning()) {
+			onFrame();
+		}
+		rendering = false;
+		// Which may be waiting for events
+		glfwPostEmptyEvent();
+	});
+
+	while (rendering) {
+		TRACE_SCOPE("Wait for events");
+		glfwWaitEventsTimeout(0.25);
+		runMainThreadTasks();
+		flushForwardedMouseMove();
+		// Even without events, for the render thread to watch shaders and process device
+		// callbacks while idle
+		mInputQueue.wake();
+	}
+	renderThread.join();
+}
+#endif // ! __EMSCRIPTEN__
+
 void Application::updateViewMatrix()
 {
-	float cx = cos(mCameraState.angles.x);
-	float sx = sin(mCameraState.angles.x);
-	float cy = cos(mCameraState.angles.y);
-	float sy = sin(mCameraState.angles.y);
-	glm::vec3 position = glm::vec3(cx * cy, sx * cy, sy) * std::exp(-mCameraState.zoom);
-	mUniforms.viewMatrix = glm::lookAt(position, glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	mQueue.writeBuffer(
-		mUniformBuffer,
-		offsetof(BasicShaderUniforms, viewMatrix),
-		&mUniforms.viewMatrix,
-		sizeof(BasicShaderUniforms::viewMatrix)
-	);
+	mViewUniforms.viewMatrix = cameraViewMatrix(mCameraState);
+	markUniformDirty(mViewUniforms.viewMatrix);
+}
+
+glm::mat4 Application::cameraViewMatrix(const CameraState& camera)
+{
+	float cx = cos(camera.angles.x);
+	float sx = sin(camera.angles.x);
+	float cy = cos(camera.angles.y);
+	float sy = sin(camera.angles.y);
+	glm::vec3 position = glm::vec3(cx * cy, sx * cy, sy) * std::exp(-camera.zoom);
+	return glm::lookAt(position, glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+void Application::updateStereoUniforms()
+{
+	// Parallel eyes either side of the camera of the view uniforms, each with half of the
+	// target. That camera sees wider than them, so culling and levels of detail stay its own.
+	glm::uvec2 size = renderSize();
+	float eyeWidth = 0.5f * size.x;
+	glm::mat4 projection = mDepthConvention.perspective(45 * glm::pi<float>() / 180.0f, eyeWidth / std::max(size.y, 1u), 0.01f, 100.0f);
+	StereoUniforms uniforms{};
+	for (uint32_t eye = 0; eye < 2; ++eye) {
+		// The left eye sees the scene moved right
+		float offset = (eye == 0 ? 0.5f : -0.5f) * stereoEyeSeparation;
+		uniforms.viewProjections[eye] = projection * glm::translate(glm::mat4(1.0f), glm::vec3(offset, 0.0f, 0.0f)) * mViewUniforms.viewMatrix;
+	}
+	uniforms.eyeWidth = eyeWidth;
+	if (uniforms != mStereoUniforms) {
+		mStereoUniforms = uniforms;
+		writeBuffer(mStereoUniformBuffer, 0, &mStereoUniforms, sizeof(StereoUniforms));
+	}
 }
 
 void Application::updateProjectionMatrix()
 {
 	float ratio = mWindowWidth / (float)mWindowHeight;
-	mUniforms.projectionMatrix = glm::perspective(45 * glm::pi<float>() / 180.0f, ratio, 0.01f, 100.0f);
-	mQueue.writeBuffer(
-		mUniformBuffer,
-		offsetof(BasicShaderUniforms, projectionMatrix),
-		&mUniforms.projectionMatrix,
-		sizeof(BasicShaderUniforms::projectionMatrix)
-	);
+	mViewUniforms.projectionMatrix = mDepthConvention.perspective(45 * glm::pi<float>() / 180.0f, ratio, 0.01f, 100.0f);
+	markUniformDirty(mViewUniforms.projectionMatrix);
+}
+
+float Application::screenSize(const ResourceCache::Geometry& geometry) const
+{
+	return screenSize(geometry, mViewUniforms.viewMatrix);
+}
+
+float Application::screenSize(const ResourceCache::Geometry& geometry, const glm::mat4& viewMatrix) const
+{
+	// Distance from the camera to the closest point of the bounding sphere
+	glm::mat4 modelView = viewMatrix * mFrameUniforms.modelMatrix;
+	glm::vec3 center = glm::vec3(modelView * glm::vec4(geometry.boundingSphereCenter, 1.0f));
+	float scale = std::max({
+		glm::length(glm::vec3(mFrameUniforms.modelMatrix[0])),
+		glm::length(glm::vec3(mFrameUniforms.modelMatrix[1])),
+		glm::length(glm::vec3(mFrameUniforms.modelMatrix[2]))
+	});
+	float distance = glm::length(center) - geometry.boundingSphereRadius * scale;
+	if (distance <= 0.0f) return std::numeric_limits<float>::infinity();
+
+	// Size in pixels of one model space unit at that distance
+	glm::vec3 extent = geometry.boundsMax - geometry.boundsMin;
+	float geometryExtent = std::max({ extent.x, extent.y, extent.z });
+	float pixelsPerUnit = 0.5f * renderSize().y * mViewUniforms.projectionMatrix[1][1] * scale / distance;
+	return geometryExtent * pixelsPerUnit;
+}
+
+uint32_t Application::selectLod(const ResourceCache::Geometry& geometry) const
+{
+	// Coarser levels may use vertices that are not uploaded yet
+	if (!geometry.resident()) return 0;
+	float size = screenSize(geometry);
+	if (std::isinf(size)) return 0;
+	for (uint32_t level = static_cast<uint32_t>(geometry.lods.size()) - 1; level > 0; --level) {
+		if (geometry.lods[level].error * size <= mLodPixelError) return level;
+	}
+	return 0;
+}
+
+bool Application::prepareOcclusionQueries()
+{
+	// Boxes are in the space of the model matrix, like the camera once moved there
+	glm::vec3 camera = glm::vec3(glm::inverse(mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	const std::vector<ResourceCache::TextureHandle>& textures = mScene.textures();
+	mOcclusionQueryRanges.clear();
+	mOcclusionQueryBatches.clear();
+	for (size_t b = 0; b < batches.size() && b < OcclusionQueries::MaxQueryCount; ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		bool containsCamera = false;
+		for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount && i < mInstanceBoxes.size(); ++i) {
+			const Aabb& box = mInstanceBoxes[i];
+			if (glm::all(glm::greaterThanEqual(camera, box.min)) && glm::all(glm::lessThanEqual(camera, box.max))) {
+				containsCamera = true;
+				break;
+			}
+		}
+		mOcclusionQueryRanges.push_back({ batch.firstInstance, batch.instanceCount });
+		mOcclusionQueryBatches.push_back({ mScene.meshes()[batch.mesh].geometry.get(), textures[batch.texture].get(), containsCamera });
+	}
+	return !mOcclusionQueryRanges.empty();
+}
+
+void Application::updateOcclusionVisibility()
+{
+	if (!mOcclusionQueries || !mOcclusionQueries->poll(mOcclusionSampleCounts)) return;
+
+	// Resources of batches no longer drawn are forgotten, their next batches starting over
+	std::unordered_map<const void*, bool> visible;
+	for (size_t q = 0; q < mOcclusionSampleCounts.size() && q < mOcclusionQueryBatches.size(); ++q) {
+		const OcclusionQueryBatch& batch = mOcclusionQueryBatches[q];
+		bool batchVisible = batch.containsCamera || mOcclusionSampleCounts[q] > 0;
+		visible[batch.geometry] = visible[batch.geometry] || batchVisible;
+		visible[batch.texture] = visible[batch.texture] || batchVisible;
+	}
+	std::unordered_map<const void*, uint32_t> hiddenCounts;
+	for (const auto& [resource, resourceVisible] : visible) {
+		auto previous = mHiddenQueryCounts.find(resource);
+		uint32_t previousCount = previous != mHiddenQueryCounts.end() ? previous->second : 0;
+		hiddenCounts[resource] = resourceVisible ? 0 : previousCount + 1;
+	}
+	mHiddenQueryCounts = std::move(hiddenCounts);
+}
+
+void Application::updateStreamPriorities()
+{
+	updateOcclusionVisibility();
+	auto hidden = [this](const void* resource) {
+		auto it = mHiddenQueryCounts.find(resource);
+		return it != mHiddenQueryCounts.end() && it->second >= occlusionHiddenResultCount;
+	};
+
+	// Batches in view, and in the view of the camera extrapolated from its drag velocity, or its
+	// inertia once released, and from the trend of the zoom
+	CameraState predictedCamera;
+	bool moving = mDragState.active || mDragState.coasting();
+	glm::vec2 velocity = moving ? mDragState.velocity : glm::vec2(0.0f);
+	predictedCamera.angles = mCameraPredictor.predictAngles(mCameraState.angles, velocity, mDragState.active ? 1.0f : mDragState.inertia);
+	// Within the range of onScroll
+	predictedCamera.zoom = mCameraPredictor.predictZoom(mCameraState.zoom, -2.0f, 2.0f);
+	glm::mat4 predictedViewMatrix = cameraViewMatrix(predictedCamera);
+	cullBatches(Frustum::fromMatrix(mViewUniforms.projectionMatrix * mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix), mBatchesInView);
+	cullBatches(Frustum::fromMatrix(mViewUniforms.projectionMatrix * predictedViewMatrix * mFrameUniforms.modelMatrix), mBatchesPredicted);
+
+	// The largest size on screen of the meshes drawn with each texture, and of each mesh, now or
+	// once the camera gets where it is going, whichever is larger. None for hidden ones and those
+	// out of both frusta, which still stream once the others are done, and the predicted size for
+	// those only predicted to come into view.
+	const std::vector<ResourceCache::TextureHandle>& textures = mScene.textures();
+	const std::vector<Scene::Mesh>& meshes = mScene.meshes();
+	std::vector<float> priorities(textures.size(), 0.0f);
+	std::vector<float> meshPriorities(meshes.size(), 0.0f);
+	std::vector<uint8_t> texturesInView(textures.size(), 0);
+	std::vector<uint8_t> meshesInView(meshes.size(), 0);
+	std::vector<uint8_t> texturesPredicted(textures.size(), 0);
+	std::vector<uint8_t> meshesPredicted(meshes.size(), 0);
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	for (size_t b = 0; b < batches.size(); ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		if (!mBatchesInView[b] && !mBatchesPredicted[b]) continue;
+		const ResourceCache::Geometry& geometry = *meshes[batch.mesh].geometry;
+		float size = std::max(mBatchesInView[b] ? screenSize(geometry) : 0.0f, screenSize(geometry, predictedViewMatrix));
+		if (!hidden(&geometry)) meshPriorities[batch.mesh] = std::max(meshPriorities[batch.mesh], size);
+		if (!hidden(textures[batch.texture].get())) priorities[batch.texture] = std::max(priorities[batch.texture], size);
+		meshesInView[batch.mesh] |= mBatchesInView[b];
+		texturesInView[batch.texture] |= mBatchesInView[b];
+		meshesPredicted[batch.mesh] |= mBatchesPredicted[b];
+		texturesPredicted[batch.texture] |= mBatchesPredicted[b];
+	}
+
+	// Resources come into view resident if they were predicted and streamed in time
+	if (mTexturePrefetchStates.size() != textures.size()) mTexturePrefetchStates.assign(textures.size(), {});
+	if (mMeshPrefetchStates.size() != meshes.size()) mMeshPrefetchStates.assign(meshes.size(), {});
+	auto track = [this](PrefetchState& state, bool inView, bool predicted, bool streaming) {
+		if (inView && !state.inView) {
+			if (streaming) ++mPrefetchMissCount;
+			else if (state.predicted) ++mPrefetchHitCount;
+		}
+		state.inView = inView;
+		state.predicted = !inView && (state.predicted || predicted);
+	};
+
+	for (size_t i = 0; i < textures.size(); ++i) {
+		if (!textures[i]) continue;
+		bool streaming = mResourceCache->streaming(textures[i]);
+		track(mTexturePrefetchStates[i], texturesInView[i], texturesPredicted[i], streaming);
+		if (streaming) mResourceCache->setStreamPriority(textures[i], priorities[i], !texturesInView[i]);
+	}
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		if (!meshes[i].geometry) continue;
+		bool streaming = !meshes[i].geometry->resident();
+		track(mMeshPrefetchStates[i], meshesInView[i], meshesPredicted[i], streaming);
+		if (streaming) mResourceCache->setStreamPriority(meshes[i].geometry, meshPriorities[i], !meshesInView[i]);
+	}
+}
+
+void Application::cullBatches(const Frustum& frustum, std::vector<uint8_t>& inFrustum)
+{
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	inFrustum.assign(batches.size(), 0);
+	mPrefetchCulledInstances.resize(mInstanceBounds.size());
+	size_t visibleCount = 0;
+	if (!instanceTreesEmpty()) {
+		visibleCount = cullInstanceTrees(frustum, mPrefetchCulledInstances.data());
+	}
+	else {
+		visibleCount = cullSpheres(frustum, mInstanceBounds, mPrefetchCulledInstances.data());
+	}
+
+	// Batches are consecutive ranges of the draw order
+	for (size_t v = 0; v < visibleCount; ++v) {
+		uint32_t instance = mPrefetchCulledInstances[v];
+		auto it = std::upper_bound(batches.begin(), batches.end(), instance, [](uint32_t i, const Scene::DrawBatch& batch) {
+			return i < batch.firstInstance;
+		});
+		if (it == batches.begin()) continue;
+		size_t b = std::distance(batches.begin(), it) - 1;
+		if (instance < batches[b].firstInstance + batches[b].instanceCount) inFrustum[b] = 1;
+	}
+}
+
+void Application::cullInstances()
+{
+	Frustum frustum = Frustum::fromMatrix(mViewUniforms.projectionMatrix * mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix);
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+
+	glm::vec3 camera = glm::vec3(glm::inverse(mViewUniforms.viewMatrix * mFrameUniforms.modelMatrix) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	// Level of detail of each batch, that of its mesh
+	bool batchesChanged = updateImposters(frustum, camera);
+	for (size_t b = 0; b < batches.size(); ++b) {
+		const Scene::Mesh& mesh = mScene.meshes()[batches[b].mesh];
+		const ResourceCache::Geometry& geometry = *mesh.geometry;
+		const ResourceManager::GeometryLod& lod = geometry.lod(selectLod(geometry), mesh.submesh);
+		BatchData& batchData = mBatchData[b];
+		uint32_t firstIndex = geometry.firstIndex() + lod.indexOffset;
+		// The full level comes first, so while streaming its resident part is a prefix of it
+		uint32_t indexCount = geometry.residentIndexCountOf(lod);
+		batchesChanged |= batchData.indexCount != indexCount || batchData.firstIndex != firstIndex;
+		batchData.indexCount = indexCount;
+		batchData.firstIndex = firstIndex;
+	}
+	if (mClusterLod) updateClusterLod(camera);
+
+	if (mGpuCulling) {
+		if (batchesChanged) {
+			writeBuffer(mBatchBuffer, 0, mBatchData.data(), mBatchData.size() * sizeof(BatchData));
+			mCullingDispatchNeeded = true;
+		}
+		CullingUniforms cullingUniforms{};
+		cullingUniforms.planes = frustum.planes;
+		cullingUniforms.instanceCount = static_cast<uint32_t>(mScene.drawOrder().size());
+		cullingUniforms.batchCount = static_cast<uint32_t>(batches.size());
+		cullingUniforms.reversedZ = mDepthConvention.reversed ? 1 : 0;
+		cullingUniforms.eyeCount = eyeCount();
+		cullingUniforms.firstInstances = multiDraw() ? 1 : 0;
+		if (mOcclusionCulling && mDepthPyramidValid) {
+			cullingUniforms.occlusionCulling = 1;
+			cullingUniforms.depthPyramidMatrix = mDepthPyramidMatrix;
+			cullingUniforms.depthSize = renderSize();
+		}
+		cullingUniforms.camera = glm::vec4(camera, 1.0f);
+		if (cullingUniforms != mCullingUniforms) {
+			mCullingUniforms = cullingUniforms;
+			writeBuffer(mCullingUniformBuffer, 0, &mCullingUniforms, sizeof(CullingUniforms));
+			mCullingDispatchNeeded = true;
+		}
+		return;
+	}
+
+	// Visible instances come out in draw order, thus batch by batch
+	// Past a few chunks of spheres, rejecting or accepting whole subtrees of the BVH is faster
+	// than testing every sphere, even with sorting the result back into draw order
+	constexpr size_t bvhCullingThreshold = 65536;
+	size_t visibleCount = 0;
+	if (mInstanceBounds.size() >= bvhCullingThreshold && !instanceTreesEmpty()) {
+		visibleCount = cullInstanceTrees(frustum, mCulledInstances.data());
+		std::sort(mCulledInstances.begin(), mCulledInstances.begin() + visibleCount);
+	}
+	else {
+		visibleCount = cullSpheres(frustum, mInstanceBounds, mCulledInstances.data());
+	}
+	const uint32_t* visible = mCulledInstances.data();
+	const uint32_t* visibleEnd = visible + visibleCount;
+
+	for (size_t b = 0; b < batches.size(); ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		const uint32_t* batchEnd = std::lower_bound(visible, visibleEnd, batch.firstInstance + batch.instanceCount);
+		// Without the instances left to imposters, like the culling shader
+		const uint32_t* meshEnd = batchEnd;
+		if (float ratio = mBatchData[b].imposterRatio; ratio > 0.0f) {
+			uint32_t* first = mCulledInstances.data() + (visible - mCulledInstances.data());
+			meshEnd = std::remove_if(first, first + (batchEnd - visible), [&](uint32_t i) {
+				glm::vec3 center(mInstanceBounds.x[i], mInstanceBounds.y[i], mInstanceBounds.z[i]);
+				return mInstanceBounds.radius[i] < ratio * glm::length(center - camera);
+			});
+		}
+		uint32_t batchVisibleCount = static_cast<uint32_t>(meshEnd - visible);
+
+		DrawIndexedIndirectArgs drawArgs;
+		drawArgs.indexCount = mBatchData[b].indexCount;
+		drawArgs.instanceCount = batchVisibleCount * eyeCount();
+		drawArgs.firstIndex = mBatchData[b].firstIndex;
+		drawArgs.baseVertex = mBatchData[b].baseVertex;
+		drawArgs.firstInstance = multiDraw() ? batch.firstInstance * eyeCount() : 0;
+
+		// Into the batch's range of the visible instances
+		uint32_t* uploaded = mVisibleInstances.data() + batch.firstInstance;
+		if (!std::equal(visible, meshEnd, uploaded)) {
+			std::copy(visible, meshEnd, uploaded);
+			writeBuffer(mVisibleInstanceBuffer, batch.firstInstance * sizeof(uint32_t), uploaded, batchVisibleCount * sizeof(uint32_t));
+		}
+		if (drawArgs != mDrawArgs[b]) {
+			mDrawArgs[b] = drawArgs;
+			writeBuffer(mDrawArgsBuffer, b * sizeof(DrawIndexedIndirectArgs), &drawArgs, sizeof(DrawIndexedIndirectArgs));
+		}
+		visible = batchEnd;
+	}
+}
+
+void Application::updateClusterLod(const glm::vec3& camera)
+{
+	// Errors are projected from the instance of each batch nearest to the camera, so that the
+	// clusters selected for it are fine enough for all the others
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	const std::vector<uint32_t>& drawOrder = mScene.drawOrder();
+	for (uint32_t b = 0; b < batches.size(); ++b) {
+		uint32_t slot = mClusterLod->slot(b);
+		const Scene::DrawBatch& batch = batches[b];
+		if (slot == ClusterLod::NoSlot || batch.instanceCount == 0) continue;
+		uint32_t nearest = batch.firstInstance;
+		float nearestDistance = std::numeric_limits<float>::infinity();
+		for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i) {
+			glm::vec3 center(mInstanceBounds.x[i], mInstanceBounds.y[i], mInstanceBounds.z[i]);
+			float distance = glm::length(center - camera) - mInstanceBounds.radius[i];
+			if (distance >= nearestDistance) continue;
+			nearest = i;
+			nearestDistance = distance;
+		}
+		const glm::mat4& modelMatrix = mScene.instances()[drawOrder[nearest]].modelMatrix;
+		glm::vec3 localCamera = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(camera, 1.0f));
+		mClusterLod->setView(slot, localCamera, mScene.meshes()[batch.mesh].geometry->resident());
+	}
+
+	// Errors and distances both being in model space, the scales of the instances and of the
+	// frame cancel out
+	mClusterLod->setErrorScale(0.5f * renderSize().y * mViewUniforms.projectionMatrix[1][1], mLodPixelError);
+	mClusterLod->flush(mQueue);
+}
+
+bool Application::updateImposters(const Frustum& frustum, const glm::vec3& camera)
+{
+	mImposterInstances.clear();
+	if (mImposters && mImposterBakeNeeded && mImposterGeometry && mImposterTexture && mImposters->ready()) {
+		// The texture is the one of the model's material, its layer too
+		uint32_t textureLayer = mScene.materials()[mModelMaterial].textureLayer;
+		if (mImposters->bake(mQueue, *mImposterGeometry, mImposterTexture->view, textureLayer, mTextureLoadOptions.srgb)) {
+			mImposterBakeNeeded = false;
+		}
+	}
+	bool imposters = mImposters && mImposters->baked();
+
+	// Radius over distance of the spheres whose diameter spans mImposterPixelSize, those of the
+	// model fading in from there to where the mesh is left out
+	float pixelsPerRadian = 0.5f * renderSize().y * mViewUniforms.projectionMatrix[1][1];
+	float startRatio = mImposterPixelSize / (2.0f * pixelsPerRadian);
+	float endRatio = 0.75f * startRatio;
+
+	bool changed = false;
+	const std::vector<Scene::DrawBatch>& batches = mScene.batches();
+	const ResourceCache::GeometryHandle& modelGeometry = mScene.meshes()[mModelMesh].geometry;
+	for (size_t b = 0; b < batches.size(); ++b) {
+		const Scene::DrawBatch& batch = batches[b];
+		bool model = mScene.meshes()[batch.mesh].geometry == modelGeometry;
+		float ratio = imposters && model && !batch.transparent ? endRatio : 0.0f;
+		changed |= mBatchData[b].imposterRatio != ratio;
+		mBatchData[b].imposterRatio = ratio;
+		if (ratio == 0.0f) continue;
+		// The other submeshes of the model fade out along with the first, whose instances the
+		// imposters are drawn for
+		if (batch.mesh != mModelMesh) continue;
+
+		for (uint32_t i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; ++i) {
+			glm::vec3 center(mInstanceBounds.x[i], mInstanceBounds.y[i], mInstanceBounds.z[i]);
+			float radius = mInstanceBounds.radius[i];
+			float distance = glm::length(center - camera);
+			if (radius >= startRatio * distance) continue;
+			bool inside = true;
+			for (const glm::vec4& plane : frustum.planes) {
+				inside &= glm::dot(glm::vec3(plane), center) + plane.w >= -radius;
+			}
+			if (!inside) continue;
+
+			Imposters::Instance instance;
+			instance.modelMatrix = mFrameUniforms.modelMatrix * mScene.instances()[mScene.drawOrder()[i]].modelMatrix;
+			instance.fade = glm::clamp((startRatio - radius / distance) / (startRatio - endRatio), 0.0f, 1.0f);
+			// Like the IDs written by shader.wgsl
+			instance.objectId = i + 1;
+			mImposterInstances.push_back(instance);
+		}
+	}
+	if (mImposters) {
+		mImposters->update(mQueue, mViewUniforms.viewMatrix, mViewUniforms.projectionMatrix, mImposterInstances);
+	}
+	return changed;
 }
 
 void Application::updateDragInertia()
 {
-	constexpr float eps = 1e-4f;
-	// Apply inertia only when the user released the click.
-	if (!mDragState.active) {
-		// Avoid updating the matrix when the velocity is no longer noticeable
-		if (std::abs(mDragState.velocity.x) < eps && std::abs(mDragState.velocity.y) < eps) {
-			return;
+	TRACE_SCOPE("updateDragInertia");
+	float frameDelta = static_cast<float>(mFrameClock.frameDelta());
+	if (mDragState.active) {
+		// Smoothed over a few frames, as some frames see no mouse event when they outpace the mouse
+		if (frameDelta > 0.0f) {
+			glm::vec2 velocity = (mCameraState.angles - mDragState.previousAngles) / frameDelta;
+			mDragState.velocity = glm::mix(mDragState.velocity, velocity, 1.0f - std::exp(-frameDelta / 0.03f));
 		}
-		mCameraState.angles += mDragState.velocity;
-		mCameraState.angles.y = glm::clamp(mCameraState.angles.y, -glm::pi<float>() / 2 + 1e-5f, glm::pi<float>() / 2 - 1e-5f);
-		// Dampen the velocity so that it decreases exponentially and stops
-		// after a few frames.
-		mDragState.velocity *= mDragState.inertia;
-		updateViewMatrix();
+		mDragState.previousAngles = mCameraState.angles;
+		return;
+	}
+
+	// Apply inertia only when the user released the click, avoiding to update the matrix
+	// when the velocity is no longer noticeable
+	if (!mDragState.coasting()) {
+		return;
+	}
+	// Dampen the velocity so that it decreases exponentially and stops after a few
+	// steps, as many per second whatever the frame rate
+	const float step = static_cast<float>(mFrameClock.step());
+	const float damping = std::pow(mDragState.inertia, step * 60.0f);
+	for (uint32_t i = 0; i < mFrameClock.stepCount() && mDragState.coasting(); ++i) {
+		mDragState.previousStepAngles = mDragState.stepAngles;
+		mDragState.stepAngles += mDragState.velocity * step;
+		mDragState.stepAngles.y = glm::clamp(mDragState.stepAngles.y, -glm::pi<float>() / 2 + 1e-5f, glm::pi<float>() / 2 - 1e-5f);
+		mDragState.velocity *= damping;
 	}
+	// Ends on the last step rather than between two
+	if (!mDragState.coasting()) mDragState.previousStepAngles = mDragState.stepAngles;
+	mCameraState.angles = glm::mix(mDragState.previousStepAngles, mDragState.stepAngles, mFrameClock.interpolation());
+	mViewDirty = true;
 }
@@ -1,7 +1,88 @@
 #pragma once
 
 #include <webgpu/webgpu.hpp>
-#include <glm/glm.hpp>
+#include "MathConfig.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ResourceManager.h"
+#include "VertexLayout.h"
+#include "AssetLoader.h"
+#include "ResourceCache.h"
+#include "RetainedAssets.h"
+#include "AssetSync.h"
+#include "PipelineCache.h"
+#include "FileWatcher.h"
+#include "ShaderPreprocessor.h"
+#include "ShaderReflection.h"
+#include "UniformRing.h"
+#include "DrawConstants.h"
+#include "MultiDraw.h"
+#include "RenderStateCache.h"
+#include "ClusterLod.h"
+#include "FrustumCulling.h"
+#include "DepthConvention.h"
+#include "Bvh.h"
+#include "LooseOctree.h"
+#include "DepthPyramid.h"
+#include "ShadowMaps.h"
+#include "ClusteredLights.h"
+#include "FramePacer.h"
+#include "FrameGovernor.h"
+#include "SurfaceFormat.h"
+#include "InputRecording.h"
+#include "GpuProfiler.h"
+#include "WorkgroupTuner.h"
+#include "PipelineStatistics.h"
+#include "Trace.h"
+#include "Benchmark.h"
+#include "FrameCounters.h"
+#include "HitchDetector.h"
+#include "FrameClock.h"
+#include "Hud.h"
+#include "FrameCapture.h"
+#include "TexturePool.h"
+#include "FrameGraph.h"
+#include "Blit.h"
+#include "PostProcessing.h"
+#include "ObjectPicker.h"
+#include "OcclusionQueries.h"
+#include "ParticleSystem.h"
+#include "Terrain.h"
+#include "PointCloud.h"
+#include "Imposters.h"
+#include "TextureFeedback.h"
+#include "VirtualTextures.h"
+#include "TextureCompressor.h"
+#include "EnvironmentLighting.h"
+#include "LightBaker.h"
+#include "WorkerDevice.h"
+#include "ShadingRate.h"
+#include "TemporalAA.h"
+#include "AmbientOcclusion.h"
+#include "DeferredShading.h"
+#include "WeightedBlendedOit.h"
+#include "DynamicResolution.h"
+#include "UploadBudget.h"
+#include "PassBudget.h"
+#include "CameraPredictor.h"
+#include "Scene.h"
+#include "SceneGenerator.h"
+#include "TransformStore.h"
+#include "FrameArena.h"
+#include "InputQueue.h"
+#include "View.h"
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -13,9 +94,13 @@ struct GLFWwindow;
 
 class Application {
 public:
-	// Init State or Return with fail message
+	// Init State or Return with fail message. The device may arrive after this returns,
+	// the rest of the initialization then running from the next frames.
 	bool onInit();
 
+	// Whether the initialization failed after onInit() returned
+	bool initFailed() const { return mInitState == InitState::Failed; }
+
 	// Interval updates
 	void onFrame();
 
@@ -25,6 +110,19 @@ public:
 	// keep alive check
 	bool isRunning();
 
+#ifndef __EMSCRIPTEN__
+	// Whether frames are rendered on a thread of their own, see mRenderThread
+	bool rendersOnThread() const { return mRenderThread; }
+
+	// Render frames on a new thread until closed, pumping the window events on the calling
+	// one, which must be the main thread
+	void runWithRenderThread();
+#endif // ! __EMSCRIPTEN__
+
+	// Run the headless benchmark mode rather than opening a window, to call before onInit().
+	// Also takes the adapter options of the command line, in interactive runs too.
+	void setBenchmark(const BenchmarkOptions& options);
+
 	// Window events
 	void onResize();
 
@@ -33,35 +131,380 @@ public:
 	void onMouseButton(int button, int action, int mods);
 	void onScroll(double xoffset, double yoffset);
 
+	// Keyboard events
+	void onKey(int key, int scancode, int action, int mods);
+
 
 private:
-	bool initWindowAndDevice();
+	/**
+	 * Progress of the initialization, which does not block on the adapter and the
+	 * device: asset jobs already load files while they are being requested, and GPU
+	 * objects are created once the device is there.
+	 */
+	enum class InitState {
+		RequestingDevice,
+		DeviceReady,
+		Ready,
+		Failed,
+	};
+
+	// Instance, and the window and surface unless benchmarking
+	bool initInstanceAndWindow();
+	bool initInstance();
+	// Select the adapter and request the device, which completes in the background
+	void requestDevice();
+	void onAdapterSelected(wgpu::Adapter adapter);
+	// Everything that needs the device, once it is there
+	bool initDeviceResources();
+	bool initDevice();
+	// The device and what the parts of the renderer share on it
+	void terminateDevice();
 	void terminateWindowAndDevice();
+	// What onFinish terminates, but the window, asset loading and the device
+	void terminateDeviceResources();
+	// Terminate everything on a lost device, then request a new one, the window staying open
+	void recoverFromDeviceLoss();
+	// Window, surface, and the event callbacks
+	bool initWindow(wgpu::Instance instance);
+	// Let the requests of the adapter and the device, and the asset jobs, progress
+	void updateInit();
 
-  wgpu::RequiredLimits getRequiredLimits(wgpu::Adapter adapter);
+	// Limits that the subsystems need, negotiated with the adapter. Subsystems whose
+	// needs the adapter does not meet are switched to their fallback.
+	wgpu::RequiredLimits getRequiredLimits(wgpu::Adapter adapter);
 
+	// Configure the surface, or the offscreen target in benchmark mode
 	void configSurface();
 	void terminateSurfaceConfig();
+	void initOffscreenTarget();
+	void terminateOffscreenTarget();
 
 	bool initDepthBuffer();
 	void terminateDepthBuffer();
+	bool initDepthPyramid();
+	void terminateDepthPyramid();
+	// Shadow maps of the first light, before the pipelines whose layouts depend on them
+	bool initShadowMaps();
+	void terminateShadowMaps();
+	// Point lights scattered over the grid of instances, LEARNWEBGPU_LIGHTS of them (128 by
+	// default, 0 to disable clustered lighting), before the pipelines too
+	bool initPointLights();
+	void terminatePointLights();
+	// Image-based lighting from the HDR environment at LEARNWEBGPU_ENVIRONMENT, none by default,
+	// before the pipelines as well
+	bool initEnvironmentLighting();
+	void terminateEnvironmentLighting();
+	// Decode or map the environment on a worker thread, then upload it, prefiltered on the GPU
+	// and stored next to it on the first run
+	Task<> loadEnvironment(std::filesystem::path path);
+	// Lighting of the model baked per vertex with LEARNWEBGPU_BAKED_LIGHTING=1, before the
+	// pipelines as well
+	bool initLightBaker();
+	void terminateLightBaker();
+	// G-buffer and lighting pass of the opaque scene with LEARNWEBGPU_SHADING=deferred, after the
+	// lighting it shades with and before the features it rules out
+	bool initDeferredShading();
+	void terminateDeferredShading();
+	// Device and pipelines of the long GPU jobs, those of the worker device if there is one
+	wgpu::Device backgroundDevice() const { return mWorkerDevice ? mWorkerDevice->device() : mDevice; }
+	PipelineCache& backgroundPipelineCache() { return mWorkerDevice ? mWorkerDevice->pipelineCache() : *mPipelineCache; }
+	// Upload the point lights where the animation takes them
+	void updatePointLights();
+	// Instance IDs written by the main pass, read back at the texel clicked, before the pipelines
+	bool initPicking();
+	void terminatePicking();
+	bool initOcclusionQueries();
+	void terminateOcclusionQueries();
+	// Take the result of the last pick once read back
+	void updatePicking();
+	// GPU particles drawn in the main pass, after the picking target they leave untouched
+	bool initParticles();
+	void terminateParticles();
+	// Terrain around the scene, drawn before its instances in the depth pre-pass and main pass
+	bool initTerrain();
+	void terminateTerrain();
+	// Point cloud rasterized before the main pass, which resolves it after the opaque instances
+	bool initPointCloud();
+	void terminatePointCloud();
+	// Imposters of the far instances of the model, drawn in the main pass after the opaque ones
+	bool initImposters();
+	void terminateImposters();
+	// Bake the imposters once the model and its texture are loaded, then select the instances
+	// far enough to fade into them. Returns whether the imposter ratios of the batches changed.
+	bool updateImposters(const Frustum& frustum, const glm::vec3& camera);
+	// Image textures paged in by tiles, before the texture feedback that requests them
+	bool initVirtualTextures();
+	void terminateVirtualTextures();
+	// Resolutions at which the streamed textures are sampled, measured every few frames
+	bool initTextureFeedback();
+	void terminateTextureFeedback();
+	// Pass the resolutions of the last measure to the resource cache, and the pages it requested
+	// to the virtual textures, once they are read back
+	void updateTextureFeedback();
+	// Shading rates by screen tile, classified from the previous frame
+	bool initShadingRate();
+	void terminateShadingRate();
+	bool initTemporalAA();
+	void terminateTemporalAA();
+	bool initAmbientOcclusion();
+	void terminateAmbientOcclusion();
+	// Surfaces, depth buffers and uniforms of the secondary views, whose windows initWindow opens
+	bool initViews();
+	void terminateViews();
+	// Acquire the surface textures of the secondary views and upload their cameras, once the one
+	// of the main window is acquired
+	void updateViews();
+	// Pick the instance under `cursor` right away with a ray cast on the CPU, for when
+	// the ID attachment cannot be read
+	void pickWithRay(glm::dvec2 cursor);
+	// Select an index of mScene.instances(), or ObjectPicker::NoInstance, and report it
+	void selectInstance(uint32_t instance);
+	// Create the targets again, after the window or render size changed
+	void updateRenderTargets();
+	// Apply the resize requested by the window events of the frame, or the final one
+	// once the size settled
+	void updateResize();
+	// Adjust the render scale to the GPU time of the last frame measured
+	void updateRenderScale();
+	// Step the optional passes up or down by the GPU time of the last frame measured, before
+	// the render scale
+	void updatePassBudget();
+	// Whether optional work runs this frame, always without the pass budget
+	bool passDue(PassBudget::WorkId work) { return !mPassBudget || mPassBudget->due(work); }
+	// Size at which the scene is drawn, the window size scaled by dynamic resolution, or by the
+	// preset of the governor without it
+	glm::uvec2 renderSize() const;
+	// Whether the scene is drawn to pooled targets and blitted to the surface rather than drawn to it
+	bool sceneTargetNeeded() const;
+
+	/**
+	 * The ways the geometry is drawn, each one with its own pipeline and render bundles
+	 */
+	enum class DrawPass {
+		// Shading every fragment that passes a Less depth test
+		Main,
+		// Depth only, filling the depth buffer before AfterDepthPrePass
+		DepthPrePass,
+		// Shading only the nearest fragments, with an Equal depth test and no depth writes
+		AfterDepthPrePass,
+		// Depth only, from the light into a cascade of the shadow maps, drawn without bundles
+		Shadow,
+		// Transparent batches back to front after the opaque ones, blended over them with a
+		// Less depth test and no depth writes, drawn without bundles as their order changes
+		Transparent,
+		// Transparent batches in any order into the targets of WeightedBlendedOit, drawn without
+		// bundles either
+		WeightedTransparent,
+		// All the batches into the depth buffer of TextureFeedback, built from the TEXTURE_FEEDBACK
+		// variant of the shader when enabled, drawn without bundles
+		TextureFeedback,
+	};
+	static constexpr size_t DrawPassCount = 7;
+
+	/**
+	 * Bind groups of the draw pipelines by update frequency, each draw binding again only
+	 * those that change from the previous one
+	 */
+	enum class BindGroupSlot : uint32_t {
+		// FrameUniforms, at the slice of the uniform ring of the frame
+		Frame,
+		// ViewUniforms, at the slice of the uniform ring of the frame
+		View,
+		// Texture array and sampler, by texture of the scene
+		Material,
+		// Instances, visible instances and DrawUniforms, at the offset of the batch
+		Draw,
+	};
+	static constexpr size_t BindGroupSlotCount = 4;
+	using RenderPipelines = std::array<PipelineCache::AsyncRenderPipeline, DrawPassCount>;
 
 	bool initRenderPipeline();
 	void terminateRenderPipeline();
+	// Compile resources/shader.wgsl, after the prelude it depends on, with `variant` defined on
+	// top of mShaderDefines, TEXTURE_FEEDBACK for the pipeline of DrawPass::TextureFeedback and
+	// DEFERRED_LIGHTING for the kernel of DeferredShading
+	wgpu::ShaderModule createShaderModule(const char* variant = nullptr);
+	std::string shaderPrelude() const;
+	// Compile resources/depth_prepass.wgsl, after the position prelude it depends on
+	wgpu::ShaderModule createDepthShaderModule();
+	// Pipeline of a draw pass, built from the depth shader module for DrawPass::DepthPrePass
+	// and DrawPass::Shadow
+	PipelineCache::AsyncRenderPipeline createRenderPipeline(wgpu::ShaderModule shaderModule, DrawPass drawPass);
+	// Kernel of DeferredShading, built from the DEFERRED_LIGHTING variant with the layouts of the
+	// frame and view groups
+	PipelineCache::AsyncComputePipeline createDeferredLightingPipeline(wgpu::ShaderModule shaderModule);
+	// Layouts of the bind groups of each BindGroupSlot, from the pipeline cache, with the entries
+	// that the shaders declare
+	void initBindGroupLayouts();
+	RenderPipelines createRenderPipelines(wgpu::ShaderModule shaderModule, wgpu::ShaderModule depthShaderModule);
+	// Rebuild the render pipeline when shaders change on disk (with SHADER_HOT_RELOAD) or are
+	// received from the asset server
+	void updateShaderReload();
+	void startShaderReload();
 
+	// Create the sampler and a placeholder texture, replaced once the real one is loaded
 	bool initTexture();
 	void terminateTexture();
+	// Bind a texture created from what the asset loader loaded instead of the current one
+	bool onTextureLoaded(ResourceCache::TextureHandle texture);
 
+	// The view of the next surface texture, or null to skip the frame: the surface is
+	// configured again when outdated or lost, and acquired again after a delay growing
+	// with the failures in a row otherwise
 	wgpu::TextureView getNextSurfaceTextureView();
+	void reconfigureSurface();
+
+	// Animate, cull and upload the uniforms of the frame
+	void updateUniforms();
+	// Whether the geometry and everything needed to draw it are ready
+	bool readyToDraw() const;
+	// Whether, besides, no asset is left to load or stream in, when benchmarks and input
+	// recordings start
+	bool sceneSettled() const;
+	// Mark the startup milestones reached by the frame just submitted, and print the
+	// startup timeline once the whole scene is shown
+	void updateStartupReport();
+	// Log how long recoverFromDeviceLoss() took, once a complete frame is drawn again
+	void updateRecoveryReport();
+	// In seconds, advancing by a fixed step per frame in benchmark mode, and as recorded
+	// when replaying input
+	double currentTime() const;
+	// Record the passes of the frame, drawing to `targetView`, as command buffers to submit
+	// together in this order, listed in the frame arena
+	FrameVector<wgpu::CommandBuffer> encodeFrame(wgpu::TextureView targetView);
+	// Add the draw calls and triangles of the bundles of a pass to the frame counters, each bundle
+	// holding a draw call per batch, of its visible instances at the selected level of detail,
+	// and the state the bundles of `drawPass` set when recorded
+	void countDrawCalls(DrawPass drawPass);
+	// Draw the static or the dynamic batches into a cascade of the shadow maps
+	void drawShadowCasters(wgpu::RenderPassEncoder pass, uint32_t cascade, bool staticCasters);
+	// Draw every instance of the opaque batches from the camera of mViews[view], with the pipeline
+	// of DrawPass::Main
+	void drawView(wgpu::RenderPassEncoder pass, uint32_t view);
+	// Order the transparent batches back to front from the camera of the frame, into mTransparentOrder
+	void sortTransparentBatches();
+	// Draw the transparent batches in the order of mTransparentOrder, with the pipeline of
+	// DrawPass::Transparent or DrawPass::WeightedTransparent
+	void drawTransparentBatches(RenderStateCache<wgpu::RenderPassEncoder>& state, DrawPass drawPass);
+	// Draw every batch, opaque then transparent, with the pipeline of DrawPass::TextureFeedback
+	void drawTextureFeedback(wgpu::RenderPassEncoder pass);
 
-	bool initGeometry();
+	// Performance overlay, drawn over the main pass when shown
+	bool initHud();
+	void terminateHud();
+	// Refresh the text of the overlay with the statistics of the last frames, a few times per second
+	void updateHud();
+	// End the frame of the FrameCounters, adding it to the history of the hitch detector and
+	// rewriting the metrics file about once a second
+	void updateFrameCounters();
+
+	// Screenshots and image sequences, created before configuring the surface, which then
+	// allows copies
+	bool initFrameCapture();
+	void terminateFrameCapture();
+	// Record the captures the frame asks for, after the passes drawing to the surface texture
+	void encodeFrameCapture(wgpu::CommandEncoder encoder);
+	// Bytes written to GPU resources since the beginning, by any path
+	uint64_t uploadedBytes() const;
+	// Estimated GPU memory of the renderer's resources, see GpuMemory.h
+	uint64_t gpuMemorySize() const;
+	// Same as mQueue.writeBuffer, counted in the upload statistics
+	void writeBuffer(wgpu::Buffer buffer, uint64_t offset, const void* data, size_t size);
+
+	// Give the model's mesh a geometry uploaded by the resource cache, its instances
+	// being left out of the draws until then
+	bool initGeometry(ResourceCache::GeometryHandle geometry);
 	void terminateGeometry();
+	// Replace the static instances of the model by chunks of combined geometry (see
+	// StaticBatcher.h) when `geometry`, its CPU data, is small enough
+	void batchStaticInstances(const ResourceManager::Geometry& geometry);
+	// For a model of several materials, draw each of its submeshes as a mesh of its own, with
+	// the material read from the .mtl file
+	void initSubmeshes(const ResourceManager::Geometry& geometry, ResourceCache::GeometryHandle handle, std::shared_ptr<const MeshBvh> bvh);
+	// Upload the loaded geometry of the model and draw it, from the device thread
+	void uploadModelGeometry(
+		const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options,
+		std::shared_ptr<const ResourceManager::Geometry> geometry, std::shared_ptr<const MeshBvh> bvh
+	);
+	// Bake the lighting of the model into its geometry and mesh cache before uploading it,
+	// retained under `key`
+	Task<> bakeModelLighting(
+		std::filesystem::path path, ResourceManager::GeometryLoadOptions options, std::string key,
+		std::shared_ptr<const ResourceManager::Geometry> geometry, std::shared_ptr<const MeshBvh> bvh
+	);
+	// Add the meshes and materials of the synthetic scene, and generate their geometry and
+	// textures on the workers of the asset loader
+	void enqueueStressScene();
 
 	bool initUniforms();
 	void terminateUniforms();
 
+	// Instances of the scene, and the buffers their draws read
+	bool initInstances();
+	void terminateInstances();
+	// Buffers holding the instances of the draw list, its batches and their draw arguments
+	bool initDrawBuffers(uint32_t instanceCapacity, uint32_t batchCapacity, uint32_t materialCapacity);
+	void terminateDrawBuffers();
+	// Sort the scene into batches again and upload what their draws read, after the
+	// scene changed
+	bool updateDrawList();
+
+	// Compute pipeline culling instances and writing the draw arguments, on the GPU
+	bool initCulling();
+	void terminateCulling();
+	// Created again on resize, as it binds the depth pyramid
+	bool initCullingBindGroup();
+	void terminateCullingBindGroup();
+	// Whether the culling pass must run, when its parameters changed since the last one
+	bool cullingDispatchNeeded() const;
+	// Record the culling pass with a pipeline of the culling kernel, built with `workgroupSize`,
+	// possibly from a worker thread
+	void encodeCulling(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites, uint32_t statisticsQuery, wgpu::ComputePipeline pipeline, uint32_t workgroupSize) const;
+
+	// One bind group per texture of the scene
 	bool initBindGroup();
 	void terminateBindGroup();
+	// Draw group of `bindGroups` for the vertex page of `geometry`
+	wgpu::BindGroup drawBindGroup(const std::vector<PipelineCache::BindGroupHandle>& bindGroups, const ResourceCache::Geometry& geometry) const;
+	// Vertex buffers bound for `geometry` in a pass, none when vs_main pulls them
+	uint32_t fetchedVertexBufferCount(const ResourceCache::Geometry& geometry, bool depthOnly) const;
+
+	// Draw commands of a pass, one indirect draw per batch of the draw list, recorded on
+	// first use and replayed every frame, the level of detail and visible instances
+	// being read from the indirect draw arguments. Batches are split among several
+	// bundles, recorded in parallel.
+	const std::vector<wgpu::RenderBundle>& getRenderBundles(DrawPass drawPass);
+	// Record the draws of batches [firstBatch, endBatch), possibly from a worker thread, adding the
+	// state it sets to `counts`
+	wgpu::RenderBundle recordRenderBundle(DrawPass drawPass, size_t firstBatch, size_t endBatch, FrameCounts& counts);
+	// The same draws for all the opaque batches, straight into the pass of `state`, for push
+	// constants and multi-draws
+	void drawOpaqueBatches(RenderStateCache<wgpu::RenderPassEncoder>& state, DrawPass drawPass);
+	// Into a render bundle or pass encoder, through the state it already has bound
+	template <typename Encoder>
+	void encodeOpaqueBatches(RenderStateCache<Encoder>& state, DrawPass drawPass, size_t firstBatch, size_t endBatch, FrameCounts& counts);
+	// Release recorded draw commands, to call whenever something they use changes
+	void invalidateRenderBundles();
+
+	// Start loading the texture and geometry on worker threads, so that the first
+	// frames are presented without waiting for them. Runs before the device exists,
+	// only the completions of the jobs needing it.
+	bool initAssetLoading();
+	void terminateAssetLoading();
+	// Load the geometry of the model on a worker thread, then upload it, replacing the previous
+	// one if any
+	void enqueueModelLoading();
+	// Load again the files that the asset server replaced, which are drawn once uploaded
+	void updateAssetSync();
+	// Load the texture embedded in a .glb model, otherwise the KTX2 version of the default
+	// texture when there is one, otherwise the JPEG one
+	void enqueueTextureLoading(bool preferCompressed);
+	// Decode the JPEG (or regular image) texture at `path` on a worker thread, then upload it,
+	// block-compressed on the GPU and stored next to it on the first run, mapped on the next ones
+	Task<> loadImageTexture(std::filesystem::path path, ResourceManager::TextureLoadOptions options);
+	// Map the tiles of the image at `path`, cutting them from the decoded image on the first run,
+	// then add it to the virtual textures. Return nullptr if it could not be.
+	Task<ResourceCache::TextureHandle> loadVirtualTexture(std::filesystem::path path, ResourceManager::TextureLoadOptions options);
 	
   void handleResize(int width, int height);
 #ifdef __EMSCRIPTEN__
@@ -75,27 +518,272 @@ private:
 
 	static EM_BOOL wheelCallback(int eventType, const EmscriptenWheelEvent* e, void* userData);
 #endif
+	// Handle the events forwarded by the browser thread since the last call, when it is
+	// not the one rendering, then the cursor move left pending
+	void processInputEvents();
+	// Cursor moves are coalesced into the last one, handled once per frame or before the
+	// next event of another kind, which must see the cursor where it was
+	void queueMouseMove(double xpos, double ypos);
+	void flushMouseMove();
+	// Main thread side of the render thread mode, cursor moves being coalesced until the
+	// end of the events of the window or the next event of another kind
+	void forwardInputEvent(const InputEvent& event);
+	void flushForwardedMouseMove();
+	// Run `task` on the main thread, which alone may call into the window: right away when called
+	// from it or outside of the render thread mode, and otherwise once the main thread is done
+	// waiting for events, the render thread then waiting for it to have run if `wait`
+	void runOnMainThread(std::function<void()> task, bool wait);
+	// Main thread side of runOnMainThread()
+	void runMainThreadTasks();
+	// Resize the window, or the surface where there is none, as the user would
+	void requestWindowSize(int width, int height);
+	// Called by the handlers of the input events with the event they handle, false for them to
+	// drop it: while a replay plays, only its own events are applied. Recorded otherwise.
+	bool acceptInput(const InputEvent& event);
+	// Before the frame clock advances, apply the events of the next frame of the replay, the
+	// first one once the scene is settled
+	void replayInputFrame();
+	// After the frame clock advances, end the frame of the recording
+	void recordInputFrame();
   void updateViewMatrix();
 	void updateProjectionMatrix();
+	// The cameras of both eyes, from the one of the view uniforms
+	void updateStereoUniforms();
+	// Each instance is drawn once per eye, the even instance indices of its draw being for the
+	// left eye and the odd ones for the right eye
+	uint32_t eyeCount() const { return mStereo ? 2 : 1; }
+	// Whether opaque batches are drawn by a multi-draw call per run of those binding the same,
+	// which read their uniforms from the storage array of mDrawConstants. Their draws then start
+	// at the first visible instance of their batch, times eyeCount().
+	bool multiDraw() const { return mDrawConstants && mDrawConstants->storageArray(); }
 
   void updateDragInertia();
 
+	// Upload a field of mFrameUniforms or mViewUniforms (or either of them whole) with the
+	// next flush of the uniform ring, which the next frame shows
+	template <typename T>
+	void markUniformDirty(const T& field) {
+		const std::byte* fieldStart = reinterpret_cast<const std::byte*>(&field);
+		const std::byte* viewStart = reinterpret_cast<const std::byte*>(&mViewUniforms);
+		bool inView = fieldStart >= viewStart && fieldStart < viewStart + sizeof(ViewUniforms);
+		const std::byte* blockStart = inView ? viewStart : reinterpret_cast<const std::byte*>(&mFrameUniforms);
+		uint32_t slice = static_cast<uint32_t>(inView ? BindGroupSlot::View : BindGroupSlot::Frame);
+		mUniformRing->write(slice, fieldStart - blockStart, &field, sizeof(T));
+		mFrameDirty = true;
+	}
+
+	// Whether the next frame may differ from the last one, otherwise rendering on demand skips it
+	bool needsRedraw() const;
+	// Whether frames are only rendered when needsRedraw(), as asked with the D key or by the governor
+	bool renderingOnDemand() const;
+
+	// Update the governor, then return whether the frame should run, which it should once it is
+	// time for it when the governor caps the frame rate: native frames wait until then, while web
+	// frames, called back at the refresh rate, are skipped
+	bool paceFrame();
+	// Give the targets of the preset of the governor to dynamic resolution
+	void applyFramePreset();
+
+	// Size in pixels on screen of the largest side of the bounding box of `geometry`, infinite
+	// when the camera is within its bounding sphere
+	float screenSize(const ResourceCache::Geometry& geometry) const;
+	// Same, seen from a camera of view matrix `viewMatrix`
+	float screenSize(const ResourceCache::Geometry& geometry, const glm::mat4& viewMatrix) const;
+
+	// Index of the coarsest level of detail of `geometry` whose error stays below
+	// mLodPixelError on screen
+	uint32_t selectLod(const ResourceCache::Geometry& geometry) const;
+
+	// Let the visible resources that cover most of the screen get their bandwidth first, after
+	// the latest results of the occlusion queries, then those about to come into view
+	void updateStreamPriorities();
+	// Whether some instance of each batch is in `frustum`, into `inFrustum`
+	void cullBatches(const Frustum& frustum, std::vector<uint8_t>& inFrustum);
+	void updateOcclusionVisibility();
+	// Batches to test and their ranges of the draw order, false if there is nothing to learn
+	bool prepareOcclusionQueries();
+
+	// Test instances against the view frustum, and upload the visible ones and the
+	// draw arguments of the selected levels of detail when they changed. With GPU
+	// culling, only upload the parameters of the culling pass.
+	void cullInstances();
+	// Views of the batches drawn by clusters, from the instance of each nearest to `camera`
+	void updateClusterLod(const glm::vec3& camera);
+	// Build the instance BVH over the static instances of `boxes`, in draw order, and the octree
+	// over the dynamic ones, or only refit the BVH to those that moved and move them in the octree
+	// when the draw order is the one they were built for
+	void updateInstanceBvh(std::vector<Aabb>&& boxes);
+	// Write the positions in draw order of the instances whose box intersects `frustum`, from the
+	// BVH and the octree, to `visible`, in no particular order, and return their count
+	size_t cullInstanceTrees(const Frustum& frustum, uint32_t* visible) const;
+	// Upload the instances that moved since the draw list was built or the last call, in runs of
+	// neighbors in the instance buffer, and move their bounds in the culling structures
+	void uploadMovedInstances();
+	bool instanceTreesEmpty() const { return mInstanceBvh.empty() && mDynamicInstances.empty(); }
+
 private:
 
 	/**
-	 * The same structure as in the shader, replicated in C++
+	 * The FrameUniforms structure of the shaders, replicated in C++: what changes with
+	 * the animation, once per frame
+	 */
+	struct FrameUniforms {
+		// Transform of the whole scene, spinning with the animation
+		glm::mat4 modelMatrix;
+		float time;
+		float _pad[3];
+	};
+	// Have the compiler check byte alignment, and offsets against those of WGSL
+	static_assert(sizeof(FrameUniforms) % 16 == 0);
+	static_assert(offsetof(FrameUniforms, time) == 64);
+
+	/**
+	 * The ViewUniforms structure of the shaders, which only changes with the camera
 	 */
-	struct BasicShaderUniforms {
-		// We add transform matrices
+	struct ViewUniforms {
 		glm::mat4 projectionMatrix;
 		glm::mat4 viewMatrix;
+		// Of the samples within their pixel, in NDC, with temporal anti-aliasing, the matrices
+		// staying unjittered
+		glm::vec2 jitter = glm::vec2(0.0f);
+		float _pad[2];
+	};
+	static_assert(sizeof(ViewUniforms) % 16 == 0 && offsetof(ViewUniforms, viewMatrix) == 64 && offsetof(ViewUniforms, jitter) == 128);
+
+	/**
+	 * The DrawUniforms structure of the shaders, one per batch
+	 */
+	struct DrawUniforms {
+		// Of the vertex buffers of the batch's mesh
+		VertexQuantization quantization;
+		// Start of the batch's range of visible instances
+		uint32_t firstVisibleInstance;
+		// Index of the batch's texture in the scene, for the texture feedback pass
+		uint32_t textureId;
+		// Base vertex of the batch's draws, and whether its mesh has a vertex animation
+		uint32_t baseVertex;
+		uint32_t vertexAnimation;
+	};
+	static_assert(sizeof(DrawUniforms) % 16 == 0);
+
+	/**
+	 * The Instance structure of the shader, replicated in C++
+	 */
+	struct InstanceData {
+		// Applied before the model matrix of the uniforms
 		glm::mat4 modelMatrix;
+		// Index of the material in mMaterialBuffer
+		uint32_t material;
+		// Index of the batch drawing the instance, for the culling pass
+		uint32_t batch;
+		// In seconds, see Scene::Instance::animationOffset
+		float animationOffset;
+		uint32_t _pad;
+	};
+	static_assert(sizeof(InstanceData) % 16 == 0);
+	static_assert(offsetof(InstanceData, material) == 64);
+
+	/**
+	 * The Material structure of the shader, one per material of the scene
+	 */
+	struct MaterialData {
 		glm::vec4 color;
-		float time;
+		// Layer of the material in the texture array
+		uint32_t textureLayer;
+		// Blended by the transparent passes
+		float opacity;
+		// Index in VirtualTextures, UINT32_MAX for a regular texture
+		uint32_t virtualTexture;
+		uint32_t _pad;
+	};
+	static_assert(sizeof(MaterialData) % 16 == 0);
+	static_assert(offsetof(MaterialData, textureLayer) == 16);
+	static_assert(offsetof(MaterialData, virtualTexture) == 24);
+
+	/**
+	 * The Batch structure of the culling shader
+	 */
+	struct BatchData {
+		// Bounding sphere of the mesh, center in xyz and radius in w
+		glm::vec4 boundingSphere;
+		// Index range of the selected level of detail, in the pages shared by all meshes
+		uint32_t indexCount;
+		uint32_t firstIndex;
+		uint32_t firstVisibleInstance;
+		// First vertex of the mesh in its vertex pages
+		int32_t baseVertex;
+		// Instances whose radius over distance to the camera is below this are left to their
+		// imposter, 0 for batches without
+		float imposterRatio;
+		uint32_t _pad[3];
+	};
+	static_assert(sizeof(BatchData) % 16 == 0);
+	static_assert(offsetof(BatchData, indexCount) == 16);
+
+	/**
+	 * A batch tested by the occlusion queries in flight
+	 */
+	struct OcclusionQueryBatch {
+		// Compared by address only, as they may be released before the results arrive
+		const ResourceCache::Geometry* geometry;
+		const ResourceCache::Texture* texture;
+		// Whether the camera was in one of its boxes, whose proxies may then all be clipped
+		bool containsCamera;
+	};
+
+	/**
+	 * The arguments of drawIndexedIndirect, as laid out in the indirect buffer
+	 */
+	struct DrawIndexedIndirectArgs {
+		uint32_t indexCount = 0;
+		uint32_t instanceCount = 0;
+		uint32_t firstIndex = 0;
+		int32_t baseVertex = 0;
+		uint32_t firstInstance = 0;
+
+		bool operator==(const DrawIndexedIndirectArgs&) const = default;
+	};
+
+	/**
+	 * The same structure as in the culling shader
+	 */
+	struct CullingUniforms {
+		std::array<glm::vec4, 6> planes;
+		// Projection * view * model matrix of the frame the depth pyramid was built from
+		glm::mat4 depthPyramidMatrix;
+		uint32_t instanceCount;
+		uint32_t batchCount;
+		// Whether to test instances against the depth pyramid
+		uint32_t occlusionCulling;
+		// Whether the depth buffer is of a reversed DepthConvention
+		uint32_t reversedZ;
+		glm::uvec2 depthSize;
+		// Draws per visible instance, 2 in stereo
+		uint32_t eyeCount;
+		// Whether the draws start at the first visible instance of their batch, see multiDraw()
+		uint32_t firstInstances;
+		// In the space of the model matrix, for the distances of instances to imposter batches
+		glm::vec4 camera;
+
+		bool operator==(const CullingUniforms&) const = default;
+	};
+	static_assert(sizeof(CullingUniforms) % 16 == 0);
+	static_assert(offsetof(CullingUniforms, depthPyramidMatrix) == 96 && offsetof(CullingUniforms, instanceCount) == 160);
+	static_assert(offsetof(CullingUniforms, depthSize) == 176 && offsetof(CullingUniforms, camera) == 192);
+
+	/**
+	 * The StereoUniforms structure of shader.wgsl, bound with the view in stereo
+	 */
+	struct StereoUniforms {
+		// Of the left and right eyes, each drawn to its half of the target
+		std::array<glm::mat4, 2> viewProjections;
+		// In pixels
+		float eyeWidth;
 		float _pad[3];
+
+		bool operator==(const StereoUniforms&) const = default;
 	};
-	// Have the compiler check byte alignment
-	static_assert(sizeof(BasicShaderUniforms) % 16 == 0);
+	static_assert(sizeof(StereoUniforms) % 16 == 0 && offsetof(StereoUniforms, eyeWidth) == 128);
 
 	struct CameraState {
 		// angles.x is the rotation of the camera around the global vertical axis, affected by mouse.x
@@ -117,12 +805,25 @@ private:
 		float sensitivity = 0.01f;
 		float scrollSensitivity = 0.1f;
 
-		// Inertia
+		// Inertia, in radians per second, measured from frame to frame while dragging
 		glm::vec2 velocity = { 0.0f, 0.0f };
-		glm::vec2 previousDelta;
+		glm::vec2 previousAngles;
+		// Fraction of the velocity kept every 1/60 s once released, whatever the frame rate
 		float inertia = 0.9f;
+		// Camera angles of the last two simulation steps once released, rendered in between
+		glm::vec2 stepAngles;
+		glm::vec2 previousStepAngles;
+
+		// Whether the camera still moves after the mouse was released
+		bool coasting() const {
+			constexpr float eps = 6e-3f;
+			return !active && (std::abs(velocity.x) >= eps || std::abs(velocity.y) >= eps);
+		}
 	};
 
+	// Of the orbiting camera in state `camera`
+	static glm::mat4 cameraViewMatrix(const CameraState& camera);
+
 
 	// Window and Device
 	GLFWwindow* mWindow = nullptr;
@@ -130,41 +831,596 @@ private:
   uint32_t mWindowHeight = 1080;
 
 	wgpu::Surface mSurface = nullptr;
+	// Secondary views, in windows of their own (LEARNWEBGPU_VIEWS)
+	std::vector<std::unique_ptr<View>> mViews;
 	wgpu::Device mDevice = nullptr;
 	wgpu::Queue mQueue = nullptr;
+	// Format the passes render to the surface in, the view format of mSurfaceFormats
 	wgpu::TextureFormat mSurfaceFormat = wgpu::TextureFormat::Undefined;
+	SurfaceFormat mSurfaceFormats;
 	// Keep the error callback alive
 	std::unique_ptr<wgpu::ErrorCallback> mUncapturedErrorCallbackHandle;
+	// Set by the device lost callback, handled at the beginning of the next frame
+	std::atomic<bool> mDeviceLost = false;
+	// Surface acquisition, see getNextSurfaceTextureView()
+	uint32_t mAcquireFailureCount = 0;
+	std::chrono::steady_clock::time_point mAcquireRetryTime;
+	bool mSurfaceReconfigurePending = false;
+	// Trace::now() when recoverFromDeviceLoss() started, until a complete frame is drawn again
+	int64_t mRecoveryStart = -1;
+	// Shader modules, layouts and pipelines, shared by the parts of the renderer
+	std::unique_ptr<PipelineCache> mPipelineCache;
+	// Runs the long GPU jobs away from the frames, on the adapter LEARNWEBGPU_WORKER_DEVICE
+	// names (same, low-power or high-performance), none by default
+	std::unique_ptr<WorkerDevice> mWorkerDevice;
+	// Whether the pipelines requested are added to the manifest precached at startup, shipped
+	// with the resources (see PipelineCache::saveManifest)
+	bool mRecordPipelines = false;
+
+	// Frame pacing
+	// Fifo and FifoRelaxed wait for vertical sync, Mailbox and Immediate render uncapped
+	// for benchmarks, the latter possibly tearing. Falls back to a supported mode.
+	wgpu::PresentMode mPresentMode = wgpu::PresentMode::Fifo;
+	// Frames the CPU may submit before the GPU finishes them, 1 for the lowest latency
+	uint32_t mMaxFramesInFlight = 2;
+	// Wait for a frame slot before sampling input, rather than before submitting
+	bool mLowLatency = false;
+	// Only render when something changed, sleeping until the next event otherwise, for
+	// always-on displays showing a still scene. Toggled with the D key.
+	bool mRenderOnDemand = false;
+	// Set by whatever changes what frames show, cleared by each frame rendered
+	bool mFrameDirty = true;
+	std::unique_ptr<FramePacer> mFramePacer;
+	// Frame rate and quality following the power source and the thermal state of the device,
+	// unless LEARNWEBGPU_GOVERNOR=0, and for benchmarks and replays whose frames must not vary
+	bool mGovernFrames = true;
+	std::unique_ptr<FrameGovernor> mFrameGovernor;
+	// Earliest start of the next frame while the governor caps the frame rate
+	std::chrono::steady_clock::time_point mNextFrameTime;
+	// Transient CPU data of the current frame, e.g. its list of command buffers
+	FrameArena mFrameArena;
+	// GPU time of each pass, printed with the T key
+	std::unique_ptr<GpuProfiler> mGpuProfiler;
+	// Workgroup sizes of the culling and light binning kernels, measured on the first runs on an
+	// adapter and saved next to the pipeline manifest
+	std::unique_ptr<WorkgroupTuner> mWorkgroupTuner;
+	// Shader invocations and primitives of the passes drawing the scene, and of culling, printed
+	// with the T key too
+	std::unique_ptr<PipelineStatistics> mPipelineStatistics;
+	// File to write the CPU trace to when the application finishes, empty when not tracing
+	std::string mTracePath;
+	// File that LEARNWEBGPU_METRICS names, the frame counters being written to it in the
+	// Prometheus text format (e.g. for the textfile collector of node_exporter), empty for none
+	std::string mMetricsPath;
+	std::chrono::steady_clock::time_point mMetricsWriteTime;
+	// With LEARNWEBGPU_HITCH_MS=<budget>, frames longer than the budget are dumped with the
+	// frames around them to hitch-<frame>.json
+	std::unique_ptr<HitchDetector> mHitchDetector;
+
+	/**
+	 * What the current frame did, shown by the HUD
+	 */
+	struct FrameStats {
+		std::chrono::steady_clock::time_point start;
+		// Until the commands are recorded, the wait for the surface texture excluded
+		std::chrono::steady_clock::duration cpuDuration{};
+		// With GPU culling, the visible instances are only known to the GPU, so all are counted
+		bool allInstancesCounted = false;
+		// Waited for events, rendering on demand or waiting to acquire the surface again
+		bool idle = false;
+		// Heap allocations of the main thread when the frame started, those of the HUD excluded
+		uint64_t allocationCountStart = 0;
+	};
+	// With LEARNWEBGPU_CAPTURE=1, F12 saves a screenshot and F11 starts and stops saving every
+	// frame to an image sequence in a directory of its own, without stalling either. With
+	// LEARNWEBGPU_STREAM=<path>, every frame is also written there uncompressed, for an encoder
+	// reading it from a named pipe.
+	std::unique_ptr<FrameCapture> mFrameCapture;
+	// Of the frame being encoded, for captures to copy from
+	wgpu::Texture mSurfaceTexture = nullptr;
+	bool mScreenshotRequested = false;
+	uint32_t mScreenshotCount = 0;
+	// Of the image sequence being recorded, empty when not recording
+	std::string mRecordingDirectory;
+	uint32_t mRecordingCount = 0;
+	uint32_t mRecordedFrameCount = 0;
+	uint64_t mRecordingDroppedStart = 0;
+
+	// Performance overlay, toggled with the H key
+	std::unique_ptr<Hud> mHud;
+	bool mShowHud = false;
+	FrameStats mFrameStats;
+	// Statistics accumulated since the text of the HUD was last updated
+	std::chrono::steady_clock::time_point mHudUpdateStart;
+	uint32_t mHudFrameCount = 0;
+	double mHudFrameMs = 0.0;
+	double mHudCpuMs = 0.0;
+	uint64_t mHudAllocationCount = 0;
+	uint64_t mHudUploadedBytes = 0;
+	// Bytes written by writeBuffer()
+	uint64_t mUploadedBytes = 0;
+	// Whether the last frame found the GPU memory over budget (see GpuMemoryTracker)
+	bool mOverGpuMemoryBudget = false;
+
+	InitState mInitState = InitState::RequestingDevice;
+	// Kept until the device arrives, some backends delivering the callbacks of their
+	// requests from Instance::processEvents()
+	wgpu::Instance mInstance = nullptr;
+	wgpu::Adapter mAdapter = nullptr;
+	std::unique_ptr<wgpu::RequestDeviceCallback> mRequestDeviceCallback;
+	// Trace::now() when the pending adapter or device request started
+	int64_t mRequestStart = 0;
+
+	// Adapter requested on the command line, see BenchmarkOptions::powerPreference
+	wgpu::PowerPreference mPowerPreference = wgpu::PowerPreference::Undefined;
+
+	// Benchmark mode, rendering to mOffscreenTexture with a scripted camera, null when interactive
+	std::unique_ptr<Benchmark> mBenchmark;
+	CameraPath mBenchmarkCameraPath = CameraPath::orbit();
+	// Input and frame times written to, and read from, with --record and --replay
+	std::unique_ptr<InputRecorder> mInputRecorder;
+	std::unique_ptr<InputReplay> mInputReplay;
+	// While replayInputFrame() applies the events of the replay
+	bool mReplayingInput = false;
+	// Compute primitives timed in each frame of the benchmark, when --primitives asks for them
+	std::unique_ptr<PrimitivesBenchmark> mPrimitivesBenchmark;
+	// Synthetic GPU scenarios of the benchmark, when --gpu-profile asks for a machine profile
+	std::unique_ptr<GpuScenarioBenchmark> mScenarioBenchmark;
+	// Of the adapter of the device, for the machine profile and the workgroup sizes
+	AdapterDescription mAdapterDescription;
+	wgpu::Texture mOffscreenTexture = nullptr;
 
   // Surface configuration
 	wgpu::SurfaceConfiguration mSurfaceConfig = {};
 
-	// Depth Buffer
+	// Size-dependent targets, recycled across resizes
+	std::unique_ptr<TexturePool> mTexturePool;
+	// Passes of the frame, built again by every encodeFrame(), their transient targets coming
+	// from the texture pool
+	std::unique_ptr<FrameGraph> mFrameGraph;
+	// Window events only request a resize, applied once per frame
+	bool mResizePending = false;
+	// While the window size keeps changing, the scene is drawn to the top left corner of
+	// pooled targets rounded up to buckets, then blitted to the surface, so that most
+	// resizes reuse the targets of the previous frame. Once the size settles (or if the
+	// blit is not ready), targets match the window again.
+	bool mLiveResize = false;
+	std::chrono::steady_clock::time_point mLastResizeTime;
+	// Whether the scene is drawn to a transient color target of the frame graph rather than to
+	// the surface texture, see sceneTargetNeeded(), as of the last updateRenderTargets()
+	bool mSceneTarget = false;
+	std::unique_ptr<Blit> mBlit;
+	// Bloom, tone mapping and FXAA of the HDR scene into the surface texture, unless disabled
+	// by LEARNWEBGPU_POSTPROCESS=0, the scene then being drawn in the surface format
+	bool mPostProcessing = true;
+	wgpu::TextureFormat mSceneFormat = wgpu::TextureFormat::Undefined;
+	std::unique_ptr<PostProcessing> mPostProcess;
+
+	// Picking of instances by clicking them, from the ID attachment of the main pass
+	std::unique_ptr<ObjectPicker> mObjectPicker;
+	// Index in mScene.instances() of the instance picked last, ObjectPicker::NoInstance if none
+	uint32_t mSelectedInstance = ObjectPicker::NoInstance;
+
+	// Visibility of the batches while resources stream, from occlusion queries over the boxes of
+	// their instances. Resources only drawn by batches hidden for a few results in a row are
+	// streamed after all the others.
+	std::unique_ptr<OcclusionQueries> mOcclusionQueries;
+	std::vector<OcclusionQueries::Range> mOcclusionQueryRanges;
+	std::vector<OcclusionQueryBatch> mOcclusionQueryBatches;
+	std::vector<uint64_t> mOcclusionSampleCounts;
+	// Consecutive results in which none of the batches drawing a geometry or texture was visible
+	std::unordered_map<const void*, uint32_t> mHiddenQueryCounts;
+
+	/**
+	 * Whether a texture or mesh of the scene was in view while resources streamed, and was
+	 * since predicted to come into view
+	 */
+	struct PrefetchState {
+		bool inView = false;
+		bool predicted = false;
+	};
+
+	// Resources out of the view frustum stream after the visible ones, but those in the frustum
+	// of the camera as extrapolated by mCameraPredictor before the others. The HUD shows the
+	// fraction of the resources coming into view while streaming that were predicted and already
+	// streamed (hits), rather than still streaming (misses).
+	CameraPredictor mCameraPredictor;
+	std::vector<PrefetchState> mTexturePrefetchStates;
+	std::vector<PrefetchState> mMeshPrefetchStates;
+	std::vector<uint8_t> mBatchesInView;
+	std::vector<uint8_t> mBatchesPredicted;
+	std::vector<uint32_t> mPrefetchCulledInstances;
+	uint64_t mPrefetchHitCount = 0;
+	uint64_t mPrefetchMissCount = 0;
+
+	// Transparent batches are sorted back to front by their view depth every frame and blended
+	// in the main pass, unless LEARNWEBGPU_TRANSPARENCY=weighted (or the I key) draws them in any
+	// order with weighted blended order-independent transparency, in a pass of their own
+	bool mWeightedTransparency = false;
+	std::unique_ptr<WeightedBlendedOit> mWeightedBlendedOit;
+	// Indices of the transparent batches back to front, and the keys sorting them: the view depth
+	// of their instance's bounding sphere mapped to an order preserving u32, above the batch index
+	std::vector<uint32_t> mTransparentOrder;
+	std::vector<uint64_t> mTransparentKeys;
+	std::vector<uint64_t> mTransparentSortScratch;
+
+	// Particles emitted over the scene, up to LEARNWEBGPU_PARTICLES alive (0 if disabled)
+	uint32_t mParticleCapacity = 1 << 20;
+	std::unique_ptr<ParticleSystem> mParticles;
+
+	// Procedural terrain under the scene with LEARNWEBGPU_TERRAIN=1, null otherwise
+	std::unique_ptr<Terrain> mTerrain;
+
+	// Scan loaded from the text file LEARNWEBGPU_POINT_CLOUD, if any, its octree kept across devices
+	std::filesystem::path mPointCloudPath;
+	std::shared_ptr<const PointCloudOctree> mPointCloudOctree;
+	std::unique_ptr<PointCloud> mPointCloud;
+
+	// Imposters of the model unless LEARNWEBGPU_IMPOSTERS=0, baked from the CPU copy of its
+	// geometry and its loaded texture, again whenever either changes
+	bool mImpostersEnabled = true;
+	// Projected diameter in pixels below which instances fade into their imposter, the mesh
+	// being left out at three quarters of it
+	float mImposterPixelSize = 32.0f;
+	std::shared_ptr<const ResourceManager::Geometry> mImposterGeometry;
+	ResourceCache::TextureHandle mImposterTexture;
+	bool mImposterBakeNeeded = false;
+	std::unique_ptr<Imposters> mImposters;
+	std::vector<Imposters::Instance> mImposterInstances;
+
+	// With LEARNWEBGPU_TEXTURE_FEEDBACK=1, streamed textures only keep the levels the scene is
+	// sampled at, from a low resolution pass measuring them every textureFeedbackInterval frames
+	std::unique_ptr<TextureFeedback> mTextureFeedback;
+	uint32_t mTextureFeedbackFrames = 0;
+	std::vector<float> mTextureResolutions;
+	std::vector<uint32_t> mPageRequests;
+
+	// With LEARNWEBGPU_VIRTUAL_TEXTURES=1, image textures are sampled from a cache of the tiles
+	// that the texture feedback, then enabled and measuring more often, finds in view
+	std::unique_ptr<VirtualTextures> mVirtualTextures;
+
+	// With LEARNWEBGPU_SHADING_RATE=1, the main pass shades low detail tiles at half or quarter
+	// rate, the skipped pixels being upsampled. Switched with the V key, the rates of every tile
+	// being reset to full when off.
+	std::unique_ptr<ShadingRate> mShadingRate;
+	bool mAdaptiveShading = true;
+	bool mShadingRateResetNeeded = false;
+
+	// With LEARNWEBGPU_TEMPORAL=aa, samples are jittered from frame to frame and blended into a
+	// reprojected history, and with LEARNWEBGPU_TEMPORAL=reuse the main pass only shades some of
+	// the pixels of each frame, reprojecting the others. Frames keep coming after a change until
+	// the history settles.
+	std::unique_ptr<TemporalAA> mTemporalAA;
+
+	// Ambient occlusion at half resolution, or at quarter resolution with LEARNWEBGPU_AO=4 and
+	// none with LEARNWEBGPU_AO=0, from the depth pyramid built after the main pass. Toggled with
+	// the A key, frames keep coming after a change until its history settles.
+	std::unique_ptr<AmbientOcclusion> mAmbientOcclusion;
+	bool mAmbientOcclusionEnabled = true;
+
+	// With LEARNWEBGPU_SHADING=deferred, the main pass writes the opaque scene to a G-buffer that
+	// a tiled compute pass lights, the rest of the scene being drawn forward after it. Requested
+	// before the device, whose limits and formats it needs, and ruled out by the features it
+	// does not combine with.
+	bool mDeferredShadingRequested = false;
+	std::unique_ptr<DeferredShading> mDeferredShading;
+
+	// Dynamic resolution, drawing the scene at a lower scale when the GPU time of frames
+	// goes over the display's refresh period, then upscaling it to the window. Needs
+	// timestamp queries. Toggled with the R key.
+	bool mDynamicResolution = true;
+	std::unique_ptr<DynamicResolution> mResolutionController;
+	// Frames measured by the GPU profiler the last time the scale was updated
+	uint64_t mResolutionMeasuredFrameCount = 0;
+
+	// Bytes of streamed geometry and texture levels uploaded per frame, lowered while frames
+	// streaming resources go over the same budget as dynamic resolution
+	std::unique_ptr<UploadBudget> mUploadBudget;
+	uint64_t mUploadMeasuredFrameCount = 0;
+
+	// Optional passes run in full, degraded or deferred by the GPU time they take, so that
+	// frames stay within the same budget before the resolution goes down, unless
+	// LEARNWEBGPU_PASS_BUDGET=0 runs them all every frame
+	bool mPassBudgeting = true;
+	std::unique_ptr<PassBudget> mPassBudget;
+	uint64_t mPassBudgetMeasuredFrameCount = 0;
+	struct {
+		PassBudget::WorkId ambientOcclusion = 0;
+		PassBudget::WorkId bloom = 0;
+		PassBudget::WorkId depthPyramid = 0;
+		PassBudget::WorkId shadows = 0;
+	} mBudgetedWork;
+
+	// Depth Buffer, persistent as the depth pyramid and the culling pass bind it. With MSAA,
+	// the color samples are a transient of the frame graph, resolved into the scene target or
+	// the surface texture. 4 samples unless LEARNWEBGPU_MSAA=1 or the surface format cannot be
+	// resolved, pipelines and render bundles being built for that count.
+	uint32_t mSampleCount = 1;
+	// Reversed with LEARNWEBGPU_REVERSED_Z=1, the format following it
+	DepthConvention mDepthConvention;
 	wgpu::TextureFormat mDepthTextureFormat = wgpu::TextureFormat::Depth24Plus;
 	wgpu::Texture mDepthTexture = nullptr;
 	wgpu::TextureView mDepthTextureView = nullptr;
+	// Hi-Z of the depth buffer, built after the frames where the culling pass ran
+	std::unique_ptr<DepthPyramid> mDepthPyramid;
+
+	// Cascaded shadow maps of the first light of shader.wgsl, whose static casters are only
+	// rendered again when they or the cascades change. Disabled when the adapter's limits
+	// fall short, before the pipelines are built.
+	bool mShadows = true;
+	std::unique_ptr<ShadowMaps> mShadowMaps;
+	wgpu::Sampler mShadowSampler = nullptr;
+	// Layout of the View slot of DrawPass::Shadow, which binds the shadow maps as attachment
+	// and thus cannot bind them as texture: camera uniforms alone
+	wgpu::BindGroupLayout mShadowCasterViewLayout = nullptr;
+	PipelineCache::BindGroupHandle mShadowCasterViewBindGroup;
+	// Draw groups reading all the instances of each batch instead of the visible ones alone,
+	// from a buffer of indices 0, 1, 2..., by vertex page like mDrawBindGroups
+	std::vector<PipelineCache::BindGroupHandle> mAllInstanceDrawBindGroups;
+	wgpu::Buffer mAllInstanceBuffer = nullptr;
+	// Bounding sphere of the instances of the draw list, in the space of the model matrix of
+	// the uniforms (center in xyz, radius in w)
+	glm::vec4 mSceneBounds = glm::vec4(0.0f);
+
+	// Point lights shaded through the clusters they touch, bobbing up and down in the space
+	// of the model matrix of the uniforms, where they are stored at rest
+	bool mClusteredLighting = true;
+	std::unique_ptr<ClusteredLights> mClusteredLights;
+	std::vector<ClusteredLights::PointLight> mPointLights;
+	bool mPointLightsDirty = true;
+
+	// Diffuse and specular light of the environment, black until it is loaded
+	std::unique_ptr<EnvironmentLighting> mEnvironmentLighting;
+	// On the worker device, prefiltering the environments that are not cached yet
+	std::unique_ptr<EnvironmentLighting> mEnvironmentPrefilter;
+
+	// Bakes the lights, shadowed, and the occluded sky into the vertex colors of the model the
+	// first time it is loaded, which shading then reads instead of its lights. Lit as placed when
+	// the scene is not turned.
+	std::unique_ptr<LightBaker> mLightBaker;
 
 	// Render Pipeline
-	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	// By BindGroupSlot, shared by the pipelines of all the passes
+	std::array<wgpu::BindGroupLayout, BindGroupSlotCount> mBindGroupLayouts = {};
 	wgpu::ShaderModule mShaderModule = nullptr;
-	wgpu::RenderPipeline mPipeline = nullptr;
+	wgpu::ShaderModule mDepthShaderModule = nullptr;
+	// Features of the shader variant, see resources/shader.wgsl
+	ShaderPreprocessor::Defines mShaderDefines;
+	// Of the sources of the modules created since initRenderPipeline(), which the bind group
+	// layouts are derived from
+	ShaderReflection mShaderReflection;
+	// One per DrawPass, built in the background, frames are only cleared until they are ready
+	RenderPipelines mPipelines;
+	// Fill the depth buffer first, so that only visible fragments are shaded. Toggled
+	// with the P key, to compare both on scenes with more or less overdraw.
+	bool mDepthPrePass = false;
+	/**
+	 * Render pipelines rebuilt after a shader changed, which replace the current
+	 * ones once built, unless compiling one of them failed. Those of disabled passes
+	 * are null.
+	 */
+	struct ShaderReload {
+		wgpu::ShaderModule shaderModule = nullptr;
+		wgpu::ShaderModule depthShaderModule = nullptr;
+		RenderPipelines pipelines;
+		// Of DeferredShading, null in forward mode
+		PipelineCache::AsyncComputePipeline deferredLighting;
+		std::unique_ptr<wgpu::CompilationInfoCallback> compilationInfoCallback;
+		bool compilationInfoDone = false;
 
-	// Texture
+		bool done() const {
+			if (!shaderModule || !depthShaderModule) return true;
+			if (deferredLighting && deferredLighting->status == PipelineCache::AsyncPipeline<wgpu::ComputePipeline>::Status::Pending) return false;
+			return compilationInfoDone && std::none_of(pipelines.begin(), pipelines.end(), [](const PipelineCache::AsyncRenderPipeline& pipeline) {
+				return pipeline && pipeline->status == PipelineCache::AsyncPipeline<wgpu::RenderPipeline>::Status::Pending;
+			});
+		}
+		bool failed() const {
+			if (!shaderModule || !depthShaderModule) return true;
+			if (deferredLighting && !deferredLighting->ready()) return true;
+			return !std::all_of(pipelines.begin(), pipelines.end(), [](const PipelineCache::AsyncRenderPipeline& pipeline) { return !pipeline || pipeline->ready(); });
+		}
+	};
+#ifdef SHADER_HOT_RELOAD
+	std::unique_ptr<FileWatcher> mResourceWatcher;
+#endif // SHADER_HOT_RELOAD
+	std::unique_ptr<ShaderReload> mShaderReload;
+	bool mShaderReloadRequested = false;
+
+	// Scene, whose meshes and materials are filled in as assets load
+	Scene mScene;
+	// The model loaded at startup, and its material, which instances of the grid use
+	std::filesystem::path mModelPath;
+	uint32_t mModelMesh = 0;
+	uint32_t mModelMaterial = 0;
+	// Models of up to that many vertices have their static instances merged, 0 to disable
+	uint32_t mStaticBatchVertexLimit = 0;
+	// Meshes of the merged chunks, those past the current chunks being left empty
+	std::vector<uint32_t> mStaticChunkMeshes;
+	// Meshes and materials of the submeshes of a model of several materials, the first mesh being
+	// the model's, and whether the material's texture is its own rather than the model's
+	std::vector<uint32_t> mSubmeshMeshes;
+	std::vector<uint32_t> mSubmeshMaterials;
+	std::vector<bool> mSubmeshOwnTextures;
+	// Synthetic scene drawn in place of the grid of the model (see BenchmarkOptions::stressScene),
+	// its meshes and materials, and its dynamic objects as pairs of an instance and an object
+	std::unique_ptr<SceneGenerator> mSceneGenerator;
+	std::vector<uint32_t> mStressMeshes;
+	std::vector<uint32_t> mStressMaterials;
+	std::vector<std::pair<uint32_t, uint32_t>> mStressDynamicInstances;
+	// Transform of the model, which the uniforms hold
+	TransformStore mTransforms;
+	uint32_t mModelTransform = 0;
+
+	// Texture, the sampler being owned by the pipeline cache
 	wgpu::Sampler mSampler = nullptr;
-	wgpu::Texture mTexture = nullptr;
-	wgpu::TextureView mTextureView = nullptr;
+	// Switch mipmapGeneration to compare CPU and GPU mip-map generation.
+	// The albedo texture is sRGB, which the sampler decodes for free.
+	// The shader samples a texture array whose layer is given per instance, so that objects
+	// with different materials share a bind group: single textures are 1-layer arrays.
+	ResourceManager::TextureLoadOptions mTextureLoadOptions = { .srgb = true, .viewDimension = wgpu::TextureViewDimension::_2DArray };
+	// Whether images are block-compressed at load where the device samples BC formats, unless
+	// LEARNWEBGPU_TEXTURE_COMPRESSION=0 keeps them RGBA8
+	bool mTextureCompression = true;
+	std::unique_ptr<TextureCompressor> mTextureCompressor;
 
 	// Geometry
-	wgpu::Buffer mVertexBuffer = nullptr;
-	int mVertexCount = 0;
+	// Encoding of the vertex buffers, the compact one takes 20 bytes per vertex instead of 44.
+	// Positions have their own buffer, so that depth-only passes can fetch them alone.
+	VertexLayout mVertexLayout = VertexLayout(VertexLayout::Encoding::Compact, VertexLayout::UvFormat::Float16, true /* splitPositionStream */);
+	// Largest simplification error, in pixels, tolerated on screen
+	float mLodPixelError = 1.0f;
 
 	// Uniforms
-	wgpu::Buffer mUniformBuffer = nullptr;
-	BasicShaderUniforms mUniforms;
+	std::unique_ptr<UniformRing> mUniformRing;
+	// ViewUniforms of the secondary views, one per view at dynamic offsets view * mViewUniformStride,
+	// bound with the rest of the View slot of the main window, and their last uploaded values
+	wgpu::Buffer mViewUniformBuffer = nullptr;
+	uint32_t mViewUniformStride = 0;
+	PipelineCache::BindGroupHandle mSecondaryViewBindGroup;
+	std::vector<ViewUniforms> mSecondaryViewUniforms;
+	// Instanced stereo (LEARNWEBGPU_STEREO), both eyes side by side in the passes of the frame
+	bool mStereo = false;
+	// vs_main reads the vertex streams as storage buffers of the draw group, from binding
+	// PulledVertexBinding on, by vertex index, instead of fetching them from vertex buffers.
+	// Indices are still fetched, so that the post-transform cache keeps working.
+	bool mVertexPulling = false;
+	static constexpr uint32_t PulledVertexBinding = 3;
+	wgpu::Buffer mStereoUniformBuffer = nullptr;
+	StereoUniforms mStereoUniforms = {};
+	// Fields changed are marked dirty, so that frames where nothing changes upload nothing.
+	// Each block has its slice of the ring, the one of its BindGroupSlot.
+	FrameUniforms mFrameUniforms;
+	ViewUniforms mViewUniforms;
+	// Whether the model rotates, toggled with the space key
+	bool mAnimate = true;
+	// Time of the frames, from currentTime(), and fixed steps of the camera inertia
+	FrameClock mFrameClock;
+
+	// Instances of the draw list, in draw order, each one with its own transform and material
+	wgpu::Buffer mInstanceBuffer = nullptr;
+	// Parameters of all the materials of the scene, indexed by the instances, bound with the
+	// texture of every material bind group
+	wgpu::Buffer mMaterialBuffer = nullptr;
+	// Copies of the model along each side of the grid of instances, e.g. 100 for 10k of them
+	uint32_t mInstanceGridSize = 1;
+	// Bounding spheres of the instances of the draw list, in the space of the model matrix
+	// of the uniforms
+	BoundingSpheres mInstanceBounds;
+	// Boxes of the same instances, and a BVH over the static ones for ray queries and for culling
+	// large draw lists, built for the draw order it holds a copy of, with the position in draw
+	// order of each of its primitives. The dynamic ones are in a loose octree instead, which
+	// absorbs their moves where refits would degrade the BVH.
+	std::vector<Aabb> mInstanceBoxes;
+	Bvh mInstanceBvh;
+	std::vector<uint32_t> mInstanceBvhOrder;
+	std::vector<uint32_t> mBvhInstances;
+	std::vector<Aabb> mBvhBoxes;
+	LooseOctree mDynamicInstances;
+	// Copy of the instance buffer, in draw order, for the ranges of moved instances to be
+	// uploaded again from
+	std::vector<InstanceData> mInstanceData;
+	// Per batch draw uniforms, pushed with the draws, bound at a dynamic offset or all at once
+	// for multi-draws, and culling parameters
+	std::unique_ptr<DrawConstants> mDrawConstants;
+	// Whether push constants are used for the draw uniforms where the device has them
+	bool mPushConstants = true;
+	// Whether opaque batches are drawn by multi-draws where the device has them, before push
+	// constants, which cannot change within a multi-draw
+	bool mMultiDraw = true;
+	// Whether multi-draws take their count from a buffer, for the clusters selected per batch
+	bool mMultiDrawCount = false;
+	// Continuous level of detail of the opaque batches whose geometry has a cluster hierarchy,
+	// built at load with LEARNWEBGPU_CLUSTER_LOD=1
+	bool mClusterLodEnabled = false;
+	std::unique_ptr<ClusterLod> mClusterLod;
+	wgpu::Buffer mBatchBuffer = nullptr;
+	std::vector<BatchData> mBatchData;
+	// Instances, batches and materials the buffers have room for
+	uint32_t mInstanceCapacity = 0;
+	uint32_t mBatchCapacity = 0;
+	uint32_t mMaterialCapacity = 0;
+
+	// Frustum culling, whose results are uploaded only when they change
+	// Indices of the visible instances, a range per batch, read by the vertex shader
+	wgpu::Buffer mVisibleInstanceBuffer = nullptr;
+	// Arguments of the draw calls, one per batch, holding the visible instance count and level of detail
+	wgpu::Buffer mDrawArgsBuffer = nullptr;
+	// Last uploaded contents of these buffers, and culling result of the current frame
+	std::vector<uint32_t> mVisibleInstances;
+	std::vector<uint32_t> mCulledInstances;
+	std::vector<DrawIndexedIndirectArgs> mDrawArgs;
+
+	// GPU culling, whose CPU cost does not depend on the number of instances.
+	// Switch mGpuCulling to compare with CPU culling.
+	bool mGpuCulling = true;
+	std::shared_ptr<const WorkgroupTuner::Kernel> mCullingKernel;
+	wgpu::BindGroupLayout mCullingBindGroupLayout = nullptr;
+	wgpu::BindGroup mCullingBindGroup = nullptr;
+	wgpu::Buffer mCullingUniformBuffer = nullptr;
+	// Last uploaded parameters, the pass only running again when they change
+	CullingUniforms mCullingUniforms{};
+	bool mCullingDispatchNeeded = false;
+	// Also skip instances hidden behind what the last culled frame drew. Instances
+	// revealed by a change are drawn one frame late, when the pass runs again with
+	// the depth pyramid of the changed frame.
+	bool mOcclusionCulling = true;
+	bool mDepthPyramidValid = false;
+	glm::mat4 mDepthPyramidMatrix = glm::mat4(1.0f);
+
+	// Bind groups of the Frame, View and Draw slots, shared by all batches
+	PipelineCache::BindGroupHandle mFrameBindGroup;
+	PipelineCache::BindGroupHandle mViewBindGroup;
+	// Bind groups of the Draw slot, one per vertex page when vertices are pulled (see
+	// drawBindGroup()) and a single one otherwise
+	std::vector<PipelineCache::BindGroupHandle> mDrawBindGroups;
+	// Bind groups of the Material slot, by texture of the scene
+	std::vector<PipelineCache::BindGroupHandle> mMaterialBindGroups;
+
+	// Render bundles by DrawPass (but Shadow) and frame of the uniform ring, each one drawing up to
+	// mBatchesPerBundle consecutive batches, empty until recorded
+	std::array<std::vector<std::vector<wgpu::RenderBundle>>, DrawPassCount> mRenderBundles;
+	// Pipelines and bind groups set by all the bundles of a frame, by DrawPass
+	std::array<FrameCounts, DrawPassCount> mRenderBundleCounts;
+	size_t mBatchesPerBundle = 256;
 
-	// Bind Group
-	wgpu::BindGroup mBindGroup = nullptr;
+	// Asset loading, whose completions run at the beginning of onFrame
+	std::unique_ptr<AssetLoader> mAssetLoader;
+	// Textures and geometries shared by everything that loads the same file
+	std::unique_ptr<ResourceCache> mResourceCache;
+	// Decoded assets, which outlive the device so that recoverFromDeviceLoss() uploads them again
+	// without reading the files, null when LEARNWEBGPU_RETAIN_ASSETS=0
+	std::unique_ptr<RetainedAssets> mRetainedAssets;
+	// Models, textures and shaders received from the asset server, null without
+	// LEARNWEBGPU_ASSET_SERVER
+	std::unique_ptr<AssetSync> mAssetSync;
 
   CameraState mCameraState;
   DragState mDragState;
+	// Last position given to onMouseMove, for the button events of windows whose cursor
+	// position cannot be queried
+	glm::dvec2 mCursorPosition = glm::dvec2(0.0);
+	// Where the left button was last pressed, a release close to it being a click
+	glm::dvec2 mClickPosition = glm::dvec2(0.0);
+	// Filled by the html5 callbacks on the browser thread in the OffscreenCanvas build
+	InputQueue mInputQueue;
+	// Last cursor position received and not handled yet, see queueMouseMove
+	bool mMouseMovePending = false;
+	glm::dvec2 mPendingMousePosition = glm::dvec2(0.0);
+	// Whether the camera moved since the view matrix was last computed, once per frame
+	bool mViewDirty = false;
+	// Native windows only: the main thread pumps the window events and forwards them
+	// through mInputQueue to a render thread that encodes and presents the frames, so
+	// that waiting for vertical sync does not hold up input. LEARNWEBGPU_RENDER_THREAD=1.
+	bool mRenderThread = false;
+	// The thread that opened the window and pumps its events
+	std::thread::id mMainThreadId;
+	// Last cursor move received by the main thread and not forwarded yet
+	bool mForwardedMovePending = false;
+	InputEvent mForwardedMove;
+	// Posted by the render thread for the main thread to run, see runOnMainThread()
+	std::mutex mMainThreadTasksMutex;
+	std::vector<std::function<void()>> mMainThreadTasks;
+	// Of the primary monitor, read on the main thread when the window opens
+	double mRefreshRate = 60.0;
 };
\ No newline at end of file
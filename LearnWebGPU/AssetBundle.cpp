@@ -0,0 +1,228 @@
+#include "AssetBundle.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace {
+
+constexpr char bundleMagic[4] = { 'L', 'W', 'G', 'B' };
+constexpr uint32_t bundleVersion = 1;
+
+struct BundleHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+	uint64_t tocOffset;
+	uint64_t namesOffset;
+};
+
+struct TocEntry {
+	uint64_t hash;
+	uint64_t offset;
+	uint64_t size;
+	int64_t writeTime;
+	uint32_t nameOffset;
+	uint32_t nameSize;
+	// Reserved for compressed payloads, only 0 (stored as is) is supported
+	uint32_t compression;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(BundleHeader) == 32 && sizeof(TocEntry) == 48, "The bundle layout must not depend on the compiler");
+
+uint64_t fnv1a(std::string_view text) {
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : text) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/**
+ * The mounted bundle, immutable once mount() returns but for the entries shadowed
+ */
+struct MountedBundle {
+	MappedFile file;
+	// "resources/" for a root of "./resources", the common prefix of the keys
+	std::string rootPrefix;
+	std::vector<uint64_t> hashes;
+	std::vector<std::string_view> names;
+	std::vector<AssetBundle::Entry> entries;
+	// Whether the loose file of each entry is read instead, see shadow()
+	std::unique_ptr<std::atomic<bool>[]> shadowed;
+};
+
+MountedBundle& mountedBundle() {
+	static MountedBundle bundle;
+	return bundle;
+}
+
+std::string normalizedKey(const std::filesystem::path& path) {
+	return path.lexically_normal().generic_string();
+}
+
+} // anonymous namespace
+
+bool AssetBundle::mount(const std::filesystem::path& bundlePath, const std::filesystem::path& root) {
+	MountedBundle& bundle = mountedBundle();
+	MappedFile file;
+	if (!file.open(bundlePath)) return false;
+
+	const std::byte* data = file.data();
+	size_t size = file.size();
+	BundleHeader header;
+	if (size < sizeof(BundleHeader)) {
+		std::cerr << "Invalid asset bundle: " << bundlePath << std::endl;
+		return false;
+	}
+	memcpy(&header, data, sizeof(BundleHeader));
+	bool valid = memcmp(header.magic, bundleMagic, sizeof(bundleMagic)) == 0
+		&& header.version == bundleVersion
+		&& header.tocOffset <= size
+		&& header.entryCount <= (size - header.tocOffset) / sizeof(TocEntry)
+		&& header.namesOffset == header.tocOffset + header.entryCount * sizeof(TocEntry);
+	if (!valid) {
+		std::cerr << "Invalid or outdated asset bundle: " << bundlePath << std::endl;
+		return false;
+	}
+
+	std::vector<uint64_t> hashes(header.entryCount);
+	std::vector<std::string_view> names(header.entryCount);
+	std::vector<Entry> entries(header.entryCount);
+	const char* namesStart = reinterpret_cast<const char*>(data + header.namesOffset);
+	uint64_t namesSize = size - header.namesOffset;
+	for (uint32_t i = 0; i < header.entryCount; ++i) {
+		TocEntry toc;
+		memcpy(&toc, data + header.tocOffset + i * sizeof(TocEntry), sizeof(TocEntry));
+		if (toc.offset > header.tocOffset || toc.size > header.tocOffset - toc.offset
+			|| toc.nameOffset > namesSize || toc.nameSize > namesSize - toc.nameOffset
+			|| (i > 0 && toc.hash < hashes[i - 1])) {
+			std::cerr << "Invalid entry " << i << " in asset bundle " << bundlePath << std::endl;
+			return false;
+		}
+		if (toc.compression != 0) {
+			std::cerr << "Unsupported compression " << toc.compression << " in asset bundle " << bundlePath << std::endl;
+			return false;
+		}
+		hashes[i] = toc.hash;
+		names[i] = { namesStart + toc.nameOffset, toc.nameSize };
+		entries[i] = { data + toc.offset, static_cast<size_t>(toc.size), toc.writeTime };
+	}
+
+	bundle.rootPrefix = normalizedKey(root);
+	if (!bundle.rootPrefix.empty() && bundle.rootPrefix.back() != '/') bundle.rootPrefix += '/';
+	bundle.hashes = std::move(hashes);
+	bundle.names = std::move(names);
+	bundle.entries = std::move(entries);
+	bundle.shadowed = std::make_unique<std::atomic<bool>[]>(header.entryCount);
+	bundle.file = std::move(file);
+	std::cout << "Mounted asset bundle " << bundlePath << " (" << header.entryCount << " files)" << std::endl;
+	return true;
+}
+
+const AssetBundle::Entry* AssetBundle::find(const std::filesystem::path& path) {
+	const MountedBundle& bundle = mountedBundle();
+	if (!bundle.file.isOpen()) return nullptr;
+
+	std::string key = normalizedKey(path);
+	if (key.compare(0, bundle.rootPrefix.size(), bundle.rootPrefix) != 0) return nullptr;
+	std::string_view name = std::string_view(key).substr(bundle.rootPrefix.size());
+
+	uint64_t hash = fnv1a(name);
+	auto it = std::lower_bound(bundle.hashes.begin(), bundle.hashes.end(), hash);
+	for (; it != bundle.hashes.end() && *it == hash; ++it) {
+		size_t i = static_cast<size_t>(it - bundle.hashes.begin());
+		if (bundle.names[i] == name) return bundle.shadowed[i].load(std::memory_order_relaxed) ? nullptr : &bundle.entries[i];
+	}
+	return nullptr;
+}
+
+void AssetBundle::shadow(const std::filesystem::path& path) {
+	MountedBundle& bundle = mountedBundle();
+	if (const Entry* entry = find(path)) {
+		bundle.shadowed[entry - bundle.entries.data()].store(true, std::memory_order_relaxed);
+	}
+}
+
+bool AssetBundle::write(const std::filesystem::path& bundlePath, const std::filesystem::path& root, const std::vector<std::filesystem::path>& relativePaths, const Filter& filter) {
+	struct Source {
+		std::string name;
+		std::filesystem::path relativePath;
+		std::filesystem::path path;
+		TocEntry toc{};
+	};
+	std::vector<Source> sources;
+	sources.reserve(relativePaths.size());
+	for (const std::filesystem::path& relativePath : relativePaths) {
+		Source source;
+		source.name = normalizedKey(relativePath);
+		source.relativePath = relativePath;
+		source.path = root / relativePath;
+		source.toc.hash = fnv1a(source.name);
+		sources.push_back(std::move(source));
+	}
+	std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) {
+		return a.toc.hash != b.toc.hash ? a.toc.hash < b.toc.hash : a.name < b.name;
+	});
+
+	// Written to a temporary file first, so that a build interrupted midway does not
+	// leave a truncated bundle that looks up to date
+	return writeFileAtomically(bundlePath, [&](std::ostream& out) {
+		const char padding[entryAlignment] = {};
+		BundleHeader header{};
+		memcpy(header.magic, bundleMagic, sizeof(bundleMagic));
+		header.version = bundleVersion;
+		header.entryCount = static_cast<uint32_t>(sources.size());
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		uint64_t offset = sizeof(header);
+		uint32_t nameOffset = 0;
+		for (Source& source : sources) {
+			// Empty files cannot be mapped, thus are stored like any other
+			MappedFile file;
+			std::error_code ec;
+			uint64_t size = std::filesystem::file_size(source.path, ec);
+			if (ec || (size > 0 && !file.open(source.path))) {
+				std::cerr << "Could not read " << source.path << std::endl;
+				return false;
+			}
+			std::string_view contents(reinterpret_cast<const char*>(file.data()), file.size());
+			std::string filtered;
+			if (filter && filter(source.relativePath, contents, filtered)) {
+				contents = filtered;
+				size = filtered.size();
+			}
+			uint64_t alignedOffset = (offset + entryAlignment - 1) / entryAlignment * entryAlignment;
+			out.write(padding, static_cast<std::streamsize>(alignedOffset - offset));
+			out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+
+			source.toc.offset = alignedOffset;
+			source.toc.size = size;
+			source.toc.writeTime = std::filesystem::last_write_time(source.path, ec).time_since_epoch().count();
+			source.toc.nameOffset = nameOffset;
+			source.toc.nameSize = static_cast<uint32_t>(source.name.size());
+			offset = alignedOffset + size;
+			nameOffset += source.toc.nameSize;
+		}
+
+		header.tocOffset = offset;
+		header.namesOffset = offset + sources.size() * sizeof(TocEntry);
+		for (const Source& source : sources) {
+			out.write(reinterpret_cast<const char*>(&source.toc), sizeof(TocEntry));
+		}
+		for (const Source& source : sources) {
+			out.write(source.name.data(), static_cast<std::streamsize>(source.name.size()));
+		}
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		return true;
+	});
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A single read-only archive replacing the loose files of the resource directory
+ * in deployed builds, so that starting the application opens one file (or does
+ * one fetch on the web) rather than one per resource.
+ *
+ * The bundle is mapped as a whole through MappedFile and its entries are views of
+ * the mapping: files opened through MappedFile below the root the bundle was
+ * mounted for are served from it, without copying. Payloads are stored as they
+ * are ready to use, e.g. KTX2 textures and binary mesh caches, each aligned to
+ * 64 bytes so that the arrays of a mesh cache can be read in place.
+ *
+ * Layout (little endian):
+ *   - Header
+ *   - payloads, each aligned to `entryAlignment`
+ *   - table of contents, sorted by hash (FNV-1a of the path relative to the root)
+ *   - names of the entries, to tell hash collisions apart
+ *
+ * Each entry records the size and write time of the file it was packed from, for
+ * the validation of the mesh caches that are packed with their source.
+ */
+class AssetBundle {
+public:
+	static constexpr size_t entryAlignment = 64;
+
+	struct Entry {
+		const std::byte* data = nullptr;
+		size_t size = 0;
+		// Write time of the source file, in std::filesystem::file_time_type ticks
+		int64_t writeTime = 0;
+	};
+
+	// Map the bundle at `bundlePath`, whose entries then stand for the files below `root`.
+	// Must be called before anything is loaded. Return false, leaving files to be read
+	// loose, if it is missing or invalid.
+	static bool mount(const std::filesystem::path& bundlePath, const std::filesystem::path& root);
+
+	// The entry of the file at `path`, or null if no bundle is mounted or it does not hold
+	// this file. Safe to call from any thread.
+	static const Entry* find(const std::filesystem::path& path);
+
+	// Read the loose file at `path` rather than its entry from now on, e.g. once AssetSync
+	// replaced it with a newer version. Safe to call from any thread.
+	static void shadow(const std::filesystem::path& path);
+
+	// Given the relative path and contents of a file being packed, write into `output` what to pack
+	// instead and return true, or return false to pack the file as it is
+	using Filter = std::function<bool(const std::filesystem::path& relativePath, std::string_view contents, std::string& output)>;
+
+	// Pack the files at `relativePaths` below `root` into a new bundle at `bundlePath`
+	static bool write(const std::filesystem::path& bundlePath, const std::filesystem::path& root, const std::vector<std::filesystem::path>& relativePaths, const Filter& filter = {});
+};
@@ -0,0 +1,199 @@
+/**
+ * Build step packing the resource directory into an AssetBundle:
+ *   LearnWebGPU-bundle [--compress-meshes] <resource dir> <output bundle> [<output heap manifest>]
+ *
+ * Every regular file is packed, including the binary mesh caches written next to
+ * their source by development runs, so that deployed builds map them instead of
+ * parsing and optimizing the meshes again. Temporary files of interrupted cache
+ * writes are skipped.
+ *
+ * WGSL shaders are packed minified (see ShaderPreprocessor::minify), after checking
+ * that their includes resolve and that their directives are well formed with all of
+ * their defines and with none, so that a broken shader fails the build rather than
+ * the start of the application. Variants are still selected at runtime, the defines
+ * depending on the device and the options, and includes too: the library files of
+ * resources/shaders are packed like the others.
+ *
+ * With --compress-meshes, for builds whose bundle is downloaded, the vertices and
+ * indices of mesh caches are packed encoded by MeshCodec (see MeshCache.h), which
+ * the loader decodes in parallel rather than mapping them in place.
+ *
+ * The heap manifest records the memory each file takes once loaded, for the web
+ * build to size its heap before loading (see HeapManifest).
+ *
+ * The same tool publishes a resource directory for the applications that synchronize
+ * with it (see AssetSync), by writing its AssetManifest into it:
+ *   LearnWebGPU-bundle --asset-manifest <published dir>
+ */
+
+#include "AssetBundle.h"
+#include "AssetManifest.h"
+#include "HeapManifest.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "MeshCodec.h"
+#include "ShaderPreprocessor.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Memory the file `relativePath` of `contents` takes once loaded, besides the file itself
+uint64_t decodedSize(const std::filesystem::path& root, const std::filesystem::path& relativePath, std::span<const std::byte> contents, bool compressMeshes) {
+	std::filesystem::path extension = relativePath.extension();
+	// Decoded to the heap, as large as it is packed from
+	if (extension == ".meshcache" && compressMeshes) return contents.size();
+	// Read in place from the bundle
+	if (extension == ".meshcache" || extension == ".bvhcache" || extension == ".ktx2") return 0;
+
+	if (extension == ".obj" || extension == ".txt" || extension == ".glb") {
+		std::filesystem::path cachePath = root / relativePath;
+		cachePath += ".meshcache";
+		std::error_code ec;
+		uint64_t cacheSize = std::filesystem::file_size(cachePath, ec);
+		if (!ec) return cacheSize;
+		// Vertices of 40 to 60 bytes, from a few tens of bytes of text each
+		return 4 * contents.size();
+	}
+
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	if (stbi_info_from_memory(reinterpret_cast<const stbi_uc*>(contents.data()), static_cast<int>(contents.size()), &width, &height, &channels)) {
+		// RGBA8 pixels, and the mip chain of a third of their size
+		uint64_t pixels = 4 * uint64_t(width) * uint64_t(height);
+		return pixels + pixels / 3;
+	}
+	// Text, e.g. shaders, copied into strings
+	return contents.size();
+}
+
+// Write the compressed variant of the mesh cache `cache` into `output`, or return false if it is
+// not a valid cache or would not get smaller
+bool compressMeshCache(std::string_view cache, std::string& output) {
+	MeshCacheHeader header;
+	if (cache.size() < sizeof(MeshCacheHeader)) return false;
+	std::memcpy(&header, cache.data(), sizeof(MeshCacheHeader));
+	if (std::memcmp(header.magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0 || header.version != meshCacheVersion) return false;
+	uint64_t vertexBytes = header.vertexCount * meshCacheVertexSize;
+	uint64_t indexBytes = header.indexCount * sizeof(uint32_t);
+	if (header.vertexCount > cache.size() || header.indexCount > cache.size() || sizeof(MeshCacheHeader) + vertexBytes + indexBytes > cache.size()) return false;
+	const std::byte* vertices = reinterpret_cast<const std::byte*>(cache.data()) + sizeof(MeshCacheHeader);
+
+	std::vector<std::byte> encodedVertices;
+	std::vector<std::byte> encodedIndices;
+	MeshCodec::encodeVertexBuffer(vertices, header.vertexCount, meshCacheVertexSize, encodedVertices);
+	// Indices are not aligned in the string
+	std::vector<uint32_t> indices(header.indexCount);
+	std::memcpy(indices.data(), vertices + vertexBytes, indexBytes);
+	MeshCodec::encodeIndexBuffer(indices.data(), indices.size(), encodedIndices);
+
+	std::string_view rest = cache.substr(sizeof(MeshCacheHeader) + vertexBytes + indexBytes);
+	CompressedMeshCacheSizes sizes = { encodedVertices.size(), encodedIndices.size() };
+	if (sizeof(MeshCacheHeader) + sizeof(sizes) + sizes.vertexBytes + sizes.indexBytes + rest.size() >= cache.size()) return false;
+	std::memcpy(header.magic, compressedMeshCacheMagic, sizeof(compressedMeshCacheMagic));
+	output.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+	output.append(reinterpret_cast<const char*>(&sizes), sizeof(sizes));
+	output.append(reinterpret_cast<const char*>(encodedVertices.data()), encodedVertices.size());
+	output.append(reinterpret_cast<const char*>(encodedIndices.data()), encodedIndices.size());
+	output.append(rest);
+	return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	const char* program = argv[0];
+	if (argc == 3 && std::strcmp(argv[1], "--asset-manifest") == 0) {
+		std::filesystem::path root = argv[2];
+		std::vector<AssetManifest::Entry> entries;
+		if (!AssetManifest::scan(root, entries) || !AssetManifest::write(root / "assets.manifest", entries)) return 1;
+		std::cout << "Wrote the asset manifest of " << entries.size() << " files in " << root << std::endl;
+		return 0;
+	}
+	bool compressMeshes = argc > 1 && std::strcmp(argv[1], "--compress-meshes") == 0;
+	if (compressMeshes) {
+		--argc;
+		++argv;
+	}
+	if (argc != 3 && argc != 4) {
+		std::cerr << "Usage: " << program << " [--compress-meshes] <resource dir> <output bundle> [<output heap manifest>]" << std::endl;
+		std::cerr << "       " << program << " --asset-manifest <published dir>" << std::endl;
+		return 1;
+	}
+	std::filesystem::path root = argv[1];
+	std::filesystem::path bundlePath = argv[2];
+
+	std::vector<std::filesystem::path> relativePaths;
+	std::error_code ec;
+	for (auto it = std::filesystem::recursive_directory_iterator(root, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+		if (!it->is_regular_file() || it->path().extension() == ".tmp") continue;
+		relativePaths.push_back(std::filesystem::relative(it->path(), root));
+	}
+	if (ec) {
+		std::cerr << "Could not list " << root << " (" << ec.message() << ")" << std::endl;
+		return 1;
+	}
+	std::sort(relativePaths.begin(), relativePaths.end());
+
+	bool shadersValid = true;
+	for (const std::filesystem::path& relativePath : relativePaths) {
+		if (relativePath.extension() != ".wgsl") continue;
+		auto load = [](const std::filesystem::path& path, std::string& source) {
+			MappedFile file;
+			if (!file.open(path)) return false;
+			source.append(reinterpret_cast<const char*>(file.data()), file.size());
+			return true;
+		};
+		std::string source;
+		std::string variant;
+		if (!ShaderPreprocessor::include(root / relativePath, load, source) || !ShaderPreprocessor::process(source, {}, variant) || !ShaderPreprocessor::process(source, ShaderPreprocessor::names(source), variant)) {
+			std::cerr << "Invalid shader " << relativePath << std::endl;
+			shadersValid = false;
+		}
+	}
+	if (!shadersValid) return 1;
+
+	uint64_t meshBytes = 0;
+	uint64_t compressedMeshBytes = 0;
+	auto filter = [&](const std::filesystem::path& relativePath, std::string_view contents, std::string& output) {
+		if (relativePath.extension() == ".wgsl") {
+			ShaderPreprocessor::minify(std::string(contents), output);
+			return true;
+		}
+		if (relativePath.extension() == ".meshcache" && compressMeshes && compressMeshCache(contents, output)) {
+			meshBytes += contents.size();
+			compressedMeshBytes += output.size();
+			return true;
+		}
+		return false;
+	};
+	if (!AssetBundle::write(bundlePath, root, relativePaths, filter)) return 1;
+	std::cout << "Packed " << relativePaths.size() << " files into " << bundlePath << std::endl;
+	if (compressedMeshBytes > 0) {
+		std::cout << "Compressed mesh caches from " << (meshBytes >> 10) << " KiB to " << (compressedMeshBytes >> 10) << " KiB" << std::endl;
+	}
+
+	if (argc == 4) {
+		std::vector<HeapManifest::Entry> entries;
+		for (const std::filesystem::path& relativePath : relativePaths) {
+			MappedFile file;
+			if (!file.open(root / relativePath)) continue;
+			std::span<const std::byte> contents(file.data(), file.size());
+			entries.push_back({ decodedSize(root, relativePath, contents, compressMeshes), file.size(), relativePath });
+		}
+		std::filesystem::path manifestPath = argv[3];
+		if (!HeapManifest::write(manifestPath, entries)) return 1;
+		std::cout << "Wrote heap manifest " << manifestPath << ", " << (HeapManifest::peakSize(entries) >> 20) << " MiB at most" << std::endl;
+	}
+	return 0;
+}
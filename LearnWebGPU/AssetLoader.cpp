@@ -0,0 +1,116 @@
+#include "AssetLoader.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define ASSET_LOADER_NO_THREADS
+#endif
+
+AssetLoader::AssetLoader([[maybe_unused]] unsigned int threadCount, [[maybe_unused]] ThreadAffinity affinity) {
+#ifndef ASSET_LOADER_NO_THREADS
+	threadCount = std::max(1u, threadCount);
+	mThreads.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; ++i) {
+		mThreads.emplace_back([this, affinity]() {
+			setThreadAffinity(affinity);
+			workerLoop();
+		});
+	}
+#endif // ASSET_LOADER_NO_THREADS
+}
+
+AssetLoader::~AssetLoader() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+		mJobs.clear();
+	}
+	mJobAvailable.notify_all();
+	for (std::thread& thread : mThreads) {
+		thread.join();
+	}
+}
+
+void AssetLoader::enqueue(Job job) {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(std::move(job));
+		++mPendingCount;
+	}
+	mJobAvailable.notify_one();
+}
+
+void AssetLoader::post(Completion completion) {
+	++mPendingCount;
+	mCompletions.push(std::move(completion));
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mNotifyCompletion) mNotifyCompletion();
+}
+
+void AssetLoader::processJobs() {
+#ifdef ASSET_LOADER_NO_THREADS
+	runNextJob();
+#endif // ASSET_LOADER_NO_THREADS
+}
+
+size_t AssetLoader::processCompletions() {
+#ifdef ASSET_LOADER_NO_THREADS
+	// Run one job per call, on this thread
+	runNextJob();
+#endif // ASSET_LOADER_NO_THREADS
+
+	// Taken before running them, so that the jobs they enqueue return at the next call
+	std::vector<Completion> completions;
+	mCompletions.drain([&completions](Completion&& completion) { completions.push_back(std::move(completion)); });
+	for (Completion& completion : completions) {
+		if (completion) completion();
+	}
+
+	mPendingCount.fetch_sub(completions.size(), std::memory_order_relaxed);
+	return completions.size();
+}
+
+size_t AssetLoader::pendingCount() const {
+	return mPendingCount.load(std::memory_order_relaxed);
+}
+
+void AssetLoader::setCompletionNotifier(std::function<void()> notify) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mNotifyCompletion = std::move(notify);
+}
+
+void AssetLoader::runNextJob() {
+	Job job;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mJobs.empty()) return;
+		job = std::move(mJobs.front());
+		mJobs.pop_front();
+	}
+	TRACE_SCOPE("Asset job");
+	mCompletions.push(job());
+}
+
+void AssetLoader::workerLoop() {
+	Trace::setThreadName("Asset loader");
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true) {
+		mJobAvailable.wait(lock, [this]() { return mStopping || !mJobs.empty(); });
+		if (mStopping) return;
+
+		Job job = std::move(mJobs.front());
+		mJobs.pop_front();
+
+		lock.unlock();
+		Completion completion;
+		{
+			TRACE_SCOPE("Asset job");
+			completion = job();
+		}
+		mCompletions.push(std::move(completion));
+
+		lock.lock();
+		if (mNotifyCompletion) mNotifyCompletion();
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "LockFree.h"
+#include "ThreadAffinity.h"
+
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Run asset loading jobs (file I/O, decoding, parsing) on worker threads, and
+ * hand their results back to the device thread, which is the only one allowed
+ * to create and upload GPU resources.
+ *
+ * A job returns a completion, that is queued when the job finishes and only
+ * runs when the device thread calls processCompletions(), typically once per
+ * frame. Completions run in the order in which their jobs finished, those of
+ * jobs finishing at once in any order, and are handed over through a lock-free
+ * queue rather than the mutex of the jobs, which the device thread never waits
+ * for while workers pick their next job.
+ *
+ * Coroutines (see Task) switch between both sides by awaiting resumeOnWorker()
+ * and resumeOnDeviceThread(), the part in between running as a job.
+ *
+ * Without thread support (Emscripten built without pthreads), jobs run one at a
+ * time from processCompletions() instead, so that frames keep being presented
+ * in between.
+ */
+class AssetLoader {
+public:
+	// Run on the device thread once the job that returned it finished
+	using Completion = std::function<void()>;
+	// Run on a worker thread
+	using Job = std::function<Completion()>;
+
+	// Start `threadCount` worker threads (at least one when threads are supported), running on the
+	// cores of `affinity`
+	explicit AssetLoader(unsigned int threadCount = 2, ThreadAffinity affinity = ThreadAffinity::Any);
+
+	// Wait for running jobs, dropping those not started yet and all pending completions
+	~AssetLoader();
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	// Queue a job, to be started as soon as a worker thread is available.
+	// A job that returns an empty completion has nothing to hand back.
+	void enqueue(Job job);
+
+	// Run the completions of the jobs that finished since the last call, on the calling
+	// thread. Return the number of completions run.
+	size_t processCompletions();
+
+	// Queue `completion` as if a job returned it, from any thread
+	void post(Completion completion);
+
+	// Awaited by a coroutine to continue as a job, on a worker thread
+	auto resumeOnWorker() {
+		struct Awaiter {
+			AssetLoader& loader;
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> handle) {
+				loader.enqueue([handle]() -> Completion {
+					handle.resume();
+					return nullptr;
+				});
+			}
+			void await_resume() const noexcept {}
+		};
+		return Awaiter{ *this };
+	}
+
+	// Awaited by a coroutine to continue as a completion, on the thread calling processCompletions()
+	auto resumeOnDeviceThread() {
+		struct Awaiter {
+			AssetLoader& loader;
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> handle) {
+				loader.post([handle]() { handle.resume(); });
+			}
+			void await_resume() const noexcept {}
+		};
+		return Awaiter{ *this };
+	}
+
+	// Let jobs progress without running any completion, e.g. while the device they need
+	// does not exist yet. Only does anything without thread support, running one job.
+	void processJobs();
+
+	// Number of jobs enqueued whose completion did not run yet
+	size_t pendingCount() const;
+
+	// Call `notify` on the worker thread each time a job finishes, e.g. to wake up a
+	// device thread waiting for events, which then calls processCompletions()
+	void setCompletionNotifier(std::function<void()> notify);
+
+private:
+	void workerLoop();
+	// Run the next job on the calling thread, if any, and queue its completion
+	void runNextJob();
+
+private:
+	mutable std::mutex mMutex;
+	std::condition_variable mJobAvailable;
+	std::deque<Job> mJobs;
+	// Handed to the device thread without waiting for workers holding the mutex
+	MpscMailbox<Completion, 256> mCompletions;
+	std::atomic<size_t> mPendingCount = 0;
+	bool mStopping = false;
+	std::function<void()> mNotifyCompletion;
+	std::vector<std::thread> mThreads;
+};
@@ -0,0 +1,155 @@
+#include "AssetManifest.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace {
+
+constexpr std::string_view FirstLine = "LearnWebGPU asset manifest 1";
+
+bool endsWith(const std::string& text, std::string_view suffix) {
+	return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool parseHash(std::string_view text, uint64_t& hash) {
+	if (text.size() != 16) return false;
+	auto result = std::from_chars(text.data(), text.data() + text.size(), hash, 16);
+	return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+} // anonymous namespace
+
+uint64_t AssetManifest::hash(std::span<const std::byte> contents) {
+	// Words as in ResourceManager::hashGeometry, the files being hashed on every change
+	constexpr uint64_t prime = 0x100000001b3ull;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t wordCount = contents.size() / sizeof(uint64_t);
+	for (size_t i = 0; i < wordCount; ++i) {
+		uint64_t word;
+		std::memcpy(&word, contents.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+		hash = (hash ^ word) * prime;
+	}
+	for (size_t i = wordCount * sizeof(uint64_t); i < contents.size(); ++i) {
+		hash = (hash ^ static_cast<uint64_t>(contents[i])) * prime;
+	}
+	hash = (hash ^ contents.size()) * prime;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+AssetManifest::Entry AssetManifest::describe(const std::filesystem::path& relativePath, std::span<const std::byte> contents) {
+	Entry entry;
+	entry.relativePath = relativePath;
+	entry.size = contents.size();
+	entry.hash = hash(contents);
+	for (uint64_t offset = 0; offset < contents.size(); offset += chunkSize) {
+		entry.chunkHashes.push_back(hash(contents.subspan(offset, std::min<uint64_t>(chunkSize, contents.size() - offset))));
+	}
+	return entry;
+}
+
+bool AssetManifest::published(const std::filesystem::path& relativePath) {
+	std::string name = relativePath.filename().string();
+	return !endsWith(name, ".tmp") && !endsWith(name, ".meshcache") && !endsWith(name, ".bvhcache")
+		&& !endsWith(name, ".bc.ktx2") && name != "assets.manifest" && name != "workgroups.sizes";
+}
+
+bool AssetManifest::scan(const std::filesystem::path& root, std::vector<Entry>& entries) {
+	std::vector<std::filesystem::path> relativePaths;
+	std::error_code ec;
+	for (auto it = std::filesystem::recursive_directory_iterator(root, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+		if (!it->is_regular_file()) continue;
+		std::filesystem::path relativePath = std::filesystem::relative(it->path(), root);
+		if (published(relativePath)) relativePaths.push_back(relativePath);
+	}
+	if (ec) {
+		std::cerr << "Could not list " << root << " (" << ec.message() << ")" << std::endl;
+		return false;
+	}
+	std::sort(relativePaths.begin(), relativePaths.end());
+
+	for (const std::filesystem::path& relativePath : relativePaths) {
+		MappedFile file;
+		// Empty files cannot be mapped
+		if (!file.open(root / relativePath)) {
+			if (std::filesystem::file_size(root / relativePath, ec) == 0 && !ec) entries.push_back(describe(relativePath, {}));
+			continue;
+		}
+		entries.push_back(describe(relativePath, { file.data(), file.size() }));
+	}
+	return true;
+}
+
+bool AssetManifest::write(const std::filesystem::path& path, const std::vector<Entry>& entries) {
+	return writeFileAtomically(path, [&](std::ostream& file) {
+		file << FirstLine << '\n' << std::hex << std::setfill('0');
+		for (const Entry& entry : entries) {
+			file << std::setw(16) << entry.hash << ' ' << std::dec << entry.size << std::hex << ' ';
+			if (entry.chunkHashes.empty()) file << '-';
+			for (size_t c = 0; c < entry.chunkHashes.size(); ++c) {
+				file << (c > 0 ? "," : "") << std::setw(16) << entry.chunkHashes[c];
+			}
+			file << ' ' << entry.relativePath.generic_string() << '\n';
+		}
+		return true;
+	});
+}
+
+bool AssetManifest::parse(std::string_view text, std::vector<Entry>& entries) {
+	bool first = true;
+	while (!text.empty()) {
+		size_t end = std::min(text.find('\n'), text.size());
+		std::string_view line = text.substr(0, end);
+		text.remove_prefix(std::min(end + 1, text.size()));
+		if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+		if (first) {
+			if (line != FirstLine) return false;
+			first = false;
+			continue;
+		}
+		if (line.empty()) continue;
+
+		// Hash, size and chunk hashes are separated by single spaces, the path taking the rest
+		std::string_view fields[3];
+		for (std::string_view& field : fields) {
+			size_t space = line.find(' ');
+			if (space == std::string_view::npos) return false;
+			field = line.substr(0, space);
+			line.remove_prefix(space + 1);
+		}
+		Entry entry;
+		if (!parseHash(fields[0], entry.hash)) return false;
+		auto size = std::from_chars(fields[1].data(), fields[1].data() + fields[1].size(), entry.size);
+		if (size.ec != std::errc() || size.ptr != fields[1].data() + fields[1].size()) return false;
+		if (fields[2] != "-") {
+			std::string_view chunks = fields[2];
+			while (!chunks.empty()) {
+				size_t comma = std::min(chunks.find(','), chunks.size());
+				uint64_t chunkHash = 0;
+				if (!parseHash(chunks.substr(0, comma), chunkHash)) return false;
+				entry.chunkHashes.push_back(chunkHash);
+				chunks.remove_prefix(std::min(comma + 1, chunks.size()));
+			}
+		}
+		if (entry.chunkHashes.size() != (entry.size + chunkSize - 1) / chunkSize) return false;
+
+		entry.relativePath = std::filesystem::path(line).lexically_normal();
+		bool escapes = entry.relativePath.empty() || entry.relativePath.has_root_name() || entry.relativePath.has_root_directory()
+			|| *entry.relativePath.begin() == "..";
+		if (escapes) {
+			std::cerr << "Ignoring asset manifest entry outside of the resource directory: " << line << std::endl;
+			continue;
+		}
+		entries.push_back(std::move(entry));
+	}
+	return !first;
+}
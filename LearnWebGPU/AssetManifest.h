@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Content hashes of the files of a resource directory, published by a content
+ * server next to the files themselves, for AssetSync to tell which files of a
+ * running application changed and which parts of them it must download.
+ *
+ * Each file is described by the hash of its whole contents and by the hashes of
+ * its consecutive chunks of `chunkSize` bytes: where only some chunks of a file
+ * changed, e.g. the finer levels of a KTX2 texture, which are stored one after
+ * the other, or a few vertices of a mesh, only those chunks are downloaded.
+ *
+ * Each line of the file holds the hash, the size, the chunk hashes (separated by
+ * commas, "-" for an empty file) and the path of a file, relative to the resource
+ * directory, after a first line naming the format. Hashes are 16 hexadecimal
+ * digits. Caches that each device derives from the files it loads (mesh, BVH and
+ * compressed texture caches), the workgroup sizes it measured and temporary files
+ * are left out.
+ */
+class AssetManifest {
+public:
+	static constexpr uint64_t chunkSize = 256 * 1024;
+
+	struct Entry {
+		uint64_t hash = 0;
+		uint64_t size = 0;
+		std::vector<uint64_t> chunkHashes;
+		std::filesystem::path relativePath;
+
+		// Byte range of a chunk
+		uint64_t chunkOffset(size_t chunk) const { return chunk * chunkSize; }
+		uint64_t chunkLength(size_t chunk) const { return std::min(chunkSize, size - chunkOffset(chunk)); }
+	};
+
+	// 64-bit hash of file contents: FNV-1a over 8 byte words, followed by the size and a final mix
+	static uint64_t hash(std::span<const std::byte> contents);
+
+	// Hash the contents of the file at `relativePath`
+	static Entry describe(const std::filesystem::path& relativePath, std::span<const std::byte> contents);
+
+	// Describe the files below `root`, sorted by path, that a manifest lists
+	static bool scan(const std::filesystem::path& root, std::vector<Entry>& entries);
+
+	// Whether a file below the resource directory is published, i.e. is not a derived cache
+	static bool published(const std::filesystem::path& relativePath);
+
+	static bool write(const std::filesystem::path& path, const std::vector<Entry>& entries);
+	// Parse the text of a manifest, e.g. as downloaded, rejecting paths that leave the directory
+	static bool parse(std::string_view text, std::vector<Entry>& entries);
+};
@@ -0,0 +1,493 @@
+#include "AssetSync.h"
+#include "AssetBundle.h"
+#include "MappedFile.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <span>
+#include <string_view>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#if defined(_WIN32)
+using Socket = SOCKET;
+constexpr Socket InvalidSocket = INVALID_SOCKET;
+void closeSocket(Socket socket) { closesocket(socket); }
+#else
+using Socket = int;
+constexpr Socket InvalidSocket = -1;
+void closeSocket(Socket socket) { ::close(socket); }
+#endif
+
+// Of connecting, and of each send and receive, so that a server that went away does not hold
+// the thread, and thus the destructor, for longer
+constexpr int TimeoutSeconds = 10;
+
+/**
+ * What httpGet() received
+ */
+struct HttpResponse {
+	int status = 0;
+	std::string etag;
+	// First byte of a partial response, from its Content-Range
+	uint64_t rangeStart = 0;
+	std::string body;
+};
+
+std::string lowercase(std::string_view text) {
+	std::string result(text);
+	std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return result;
+}
+
+std::string_view trim(std::string_view text) {
+	while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+	while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+	return text;
+}
+
+// Parse "http://host[:port][/path]", IPv6 hosts being in brackets
+bool parseHttpUrl(std::string_view url, std::string& host, std::string& port, std::string& path) {
+	constexpr std::string_view scheme = "http://";
+	if (!url.starts_with(scheme)) return false;
+	url.remove_prefix(scheme.size());
+	size_t slash = std::min(url.find('/'), url.size());
+	std::string_view authority = url.substr(0, slash);
+	path = url.substr(slash);
+	if (path.empty() || path.back() != '/') path += '/';
+
+	size_t colon = authority.rfind(':');
+	if (colon != std::string_view::npos && authority.find(']', colon) == std::string_view::npos) {
+		host = authority.substr(0, colon);
+		port = authority.substr(colon + 1);
+	}
+	else {
+		host = authority;
+		port = "80";
+	}
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+	return !host.empty() && !port.empty();
+}
+
+// Escape what may not appear in the path of a request, keeping the separators
+std::string percentEncode(std::string_view path) {
+	constexpr char digits[] = "0123456789ABCDEF";
+	std::string encoded;
+	for (char c : path) {
+		unsigned char byte = static_cast<unsigned char>(c);
+		if (std::isalnum(byte) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~') {
+			encoded += c;
+		}
+		else {
+			encoded += '%';
+			encoded += digits[byte >> 4];
+			encoded += digits[byte & 15];
+		}
+	}
+	return encoded;
+}
+
+// Decode a body of Transfer-Encoding: chunked
+bool decodeChunked(std::string_view body, std::string& decoded) {
+	decoded.clear();
+	while (true) {
+		size_t lineEnd = body.find("\r\n");
+		if (lineEnd == std::string_view::npos) return false;
+		uint64_t size = 0;
+		auto result = std::from_chars(body.data(), body.data() + lineEnd, size, 16);
+		if (result.ec != std::errc()) return false;
+		body.remove_prefix(lineEnd + 2);
+		if (size == 0) return true;
+		if (body.size() < size + 2) return false;
+		decoded.append(body.substr(0, size));
+		body.remove_prefix(size + 2);
+	}
+}
+
+bool parseHttpResponse(std::string_view raw, HttpResponse& response) {
+	size_t headerEnd = raw.find("\r\n\r\n");
+	if (headerEnd == std::string_view::npos || !raw.starts_with("HTTP/")) return false;
+	std::string_view headers = raw.substr(0, headerEnd + 2);
+	std::string_view body = raw.substr(headerEnd + 4);
+
+	size_t space = headers.find(' ');
+	if (space == std::string_view::npos) return false;
+	auto status = std::from_chars(headers.data() + space + 1, headers.data() + headers.size(), response.status);
+	if (status.ec != std::errc()) return false;
+
+	bool chunked = false;
+	bool hasLength = false;
+	uint64_t contentLength = 0;
+	headers.remove_prefix(headers.find("\r\n") + 2);
+	while (!headers.empty()) {
+		size_t end = headers.find("\r\n");
+		std::string_view line = headers.substr(0, end);
+		headers.remove_prefix(end + 2);
+		size_t colon = line.find(':');
+		if (colon == std::string_view::npos) continue;
+		std::string name = lowercase(trim(line.substr(0, colon)));
+		std::string_view value = trim(line.substr(colon + 1));
+		if (name == "content-length") {
+			hasLength = std::from_chars(value.data(), value.data() + value.size(), contentLength).ec == std::errc();
+		}
+		else if (name == "transfer-encoding") {
+			chunked = lowercase(value).find("chunked") != std::string::npos;
+		}
+		else if (name == "etag") {
+			response.etag = value;
+		}
+		else if (name == "content-range" && value.starts_with("bytes ")) {
+			value.remove_prefix(6);
+			std::from_chars(value.data(), value.data() + value.size(), response.rangeStart);
+		}
+	}
+
+	if (chunked) return decodeChunked(body, response.body);
+	// Without a length, the body ends with the connection
+	if (hasLength) {
+		if (body.size() < contentLength) return false;
+		body = body.substr(0, contentLength);
+	}
+	response.body = body;
+	return true;
+}
+
+// GET `target` from the server, the connection being closed after the response
+bool httpGet(const std::string& host, const std::string& port, const std::string& target, const std::string& extraHeaders, HttpResponse& response) {
+#if defined(_WIN32)
+	static bool started = [] {
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	if (!started) return false;
+#endif
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addresses = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) return false;
+	Socket connection = InvalidSocket;
+	for (addrinfo* address = addresses; address; address = address->ai_next) {
+		connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (connection == InvalidSocket) continue;
+#if defined(_WIN32)
+		DWORD timeout = TimeoutSeconds * 1000;
+#else
+		timeval timeout = { TimeoutSeconds, 0 };
+#endif
+		setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+		// Also that of connecting on Linux
+		setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+		int noSigPipe = 1;
+		setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+		if (connect(connection, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0) break;
+		closeSocket(connection);
+		connection = InvalidSocket;
+	}
+	freeaddrinfo(addresses);
+	if (connection == InvalidSocket) return false;
+
+	std::string request = "GET " + target + " HTTP/1.1\r\n"
+		"Host: " + (host.find(':') != std::string::npos ? "[" + host + "]" : host) + (port != "80" ? ":" + port : "") + "\r\n"
+		"User-Agent: LearnWebGPU\r\n"
+		"Accept-Encoding: identity\r\n"
+		"Connection: close\r\n" + extraHeaders + "\r\n";
+#ifdef MSG_NOSIGNAL
+	int sendFlags = MSG_NOSIGNAL;
+#else
+	int sendFlags = 0;
+#endif
+	for (size_t sent = 0; sent < request.size();) {
+		auto count = send(connection, request.data() + sent, static_cast<int>(request.size() - sent), sendFlags);
+		if (count <= 0) {
+			closeSocket(connection);
+			return false;
+		}
+		sent += static_cast<size_t>(count);
+	}
+
+	std::string raw;
+	char buffer[64 * 1024];
+	while (true) {
+		auto count = recv(connection, buffer, static_cast<int>(sizeof(buffer)), 0);
+		if (count < 0) {
+			closeSocket(connection);
+			return false;
+		}
+		if (count == 0) break;
+		raw.append(buffer, static_cast<size_t>(count));
+	}
+	closeSocket(connection);
+	return parseHttpResponse(raw, response);
+}
+
+} // anonymous namespace
+
+AssetSync::AssetSync(const Settings& settings)
+	: mSettings(settings)
+{
+	if (mSettings.source.starts_with("http://") && !parseHttpUrl(mSettings.source, mHost, mPort, mBasePath)) {
+		std::cerr << "Invalid asset server URL " << mSettings.source << std::endl;
+	}
+	std::cout << "Synchronizing " << mSettings.root.generic_string() << " with " << mSettings.source << std::endl;
+	mThread = std::thread([this]() { run(); });
+}
+
+AssetSync::~AssetSync() {
+	{
+		std::lock_guard lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	mThread.join();
+}
+
+std::vector<std::filesystem::path> AssetSync::poll() {
+	std::lock_guard lock(mMutex);
+	std::vector<std::filesystem::path> replaced;
+	replaced.swap(mReplaced);
+	return replaced;
+}
+
+AssetSync::Statistics AssetSync::statistics() const {
+	std::lock_guard lock(mMutex);
+	return mStatistics;
+}
+
+void AssetSync::run() {
+	Trace::setThreadName("Asset sync");
+	std::unique_lock lock(mMutex);
+	while (!mStopping) {
+		lock.unlock();
+		mRetry = !syncOnce();
+		lock.lock();
+		mWake.wait_for(lock, std::chrono::duration<double>(mSettings.pollInterval), [this]() { return mStopping; });
+	}
+}
+
+bool AssetSync::syncOnce() {
+	bool changed = false;
+	bool fetched = fetchManifest(changed);
+	// Reported when the server goes away and comes back rather than at each poll
+	if (fetched != mReachable) {
+		if (fetched) std::cout << "Asset server " << mSettings.source << " is reachable again" << std::endl;
+		else std::cerr << "Could not get the asset manifest from " << mSettings.source << ", retrying every " << mSettings.pollInterval << " s" << std::endl;
+		mReachable = fetched;
+	}
+	if (!fetched) return false;
+	// Files that failed are tried again with the same manifest
+	if (!changed && !mRetry) return true;
+
+	TRACE_SCOPE("Asset sync");
+	std::vector<AssetManifest::Entry> entries;
+	if (!AssetManifest::parse(mManifest, entries)) {
+		std::cerr << "Invalid asset manifest from " << mSettings.source << std::endl;
+		return false;
+	}
+	bool synced = true;
+	for (const AssetManifest::Entry& entry : entries) {
+		{
+			std::lock_guard lock(mMutex);
+			if (mStopping) return false;
+		}
+		if (!syncFile(entry)) {
+			synced = false;
+			std::lock_guard lock(mMutex);
+			++mStatistics.failedFileCount;
+		}
+	}
+	return synced;
+}
+
+bool AssetSync::syncFile(const AssetManifest::Entry& entry) {
+	std::filesystem::path path = mSettings.root / entry.relativePath;
+	const AssetManifest::Entry* local = describeLocal(entry.relativePath);
+	if (local && local->hash == entry.hash && local->size == entry.size) return true;
+
+	// Chunks of the previous version are reused wherever they moved, e.g. after data inserted
+	// at a chunk boundary, the others being downloaded
+	std::string contents(entry.size, '\0');
+	std::vector<bool> missing(entry.chunkHashes.size(), true);
+	uint64_t reusedBytes = 0;
+	if (local && local->size > 0) {
+		MappedFile file;
+		if (file.open(path)) {
+			std::unordered_map<uint64_t, size_t> localChunks;
+			for (size_t c = 0; c < local->chunkHashes.size(); ++c) {
+				localChunks.emplace(local->chunkHashes[c], c);
+			}
+			for (size_t c = 0; c < entry.chunkHashes.size(); ++c) {
+				auto it = localChunks.find(entry.chunkHashes[c]);
+				if (it == localChunks.end()) continue;
+				uint64_t offset = local->chunkOffset(it->second);
+				uint64_t length = entry.chunkLength(c);
+				if (local->chunkLength(it->second) != length || offset + length > file.size()) continue;
+				std::memcpy(contents.data() + entry.chunkOffset(c), file.data() + offset, length);
+				missing[c] = false;
+				reusedBytes += length;
+			}
+		}
+		// Closed before the file is replaced, which Windows refuses while it is mapped
+	}
+
+	// Runs of missing chunks are requested at once
+	uint64_t downloadedBytes = 0;
+	for (size_t c = 0; c < missing.size();) {
+		if (!missing[c]) {
+			++c;
+			continue;
+		}
+		size_t end = c;
+		while (end < missing.size() && missing[end]) ++end;
+		uint64_t offset = entry.chunkOffset(c);
+		uint64_t length = entry.chunkOffset(end - 1) + entry.chunkLength(end - 1) - offset;
+		std::string data;
+		bool whole = false;
+		if (!fetch(entry.relativePath, offset, length, data, whole)) return false;
+		if (whole) {
+			contents = std::move(data);
+			downloadedBytes = contents.size();
+			reusedBytes = 0;
+			break;
+		}
+		if (data.size() != length) {
+			std::cerr << "Could not fetch " << entry.relativePath.generic_string() << ": " << data.size() << " bytes received of " << length << std::endl;
+			return false;
+		}
+		std::memcpy(contents.data() + offset, data.data(), length);
+		downloadedBytes += length;
+		c = end;
+	}
+
+	// Also catches a file published again while it was being downloaded, which the next
+	// manifest describes
+	if (contents.size() != entry.size || AssetManifest::hash(std::as_bytes(std::span(contents))) != entry.hash) {
+		std::cerr << "Received " << entry.relativePath.generic_string() << " does not match the asset manifest" << std::endl;
+		return false;
+	}
+
+	// Written next to the file, then renamed over it so that loads read either version whole
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+	if (!writeFileAtomically(path, std::as_bytes(std::span(contents)))) return false;
+	AssetBundle::shadow(path);
+	LocalFile& replaced = mLocalFiles[entry.relativePath.generic_string()];
+	replaced.size = entry.size;
+	replaced.writeTime = std::filesystem::last_write_time(path, ec);
+	replaced.entry = entry;
+
+	std::cout << "Received " << entry.relativePath.generic_string() << " from the asset server: "
+		<< downloadedBytes << " bytes downloaded, " << reusedBytes << " reused" << std::endl;
+	std::lock_guard lock(mMutex);
+	mReplaced.push_back(path);
+	++mStatistics.updatedFileCount;
+	mStatistics.downloadedBytes += downloadedBytes;
+	mStatistics.reusedBytes += reusedBytes;
+	return true;
+}
+
+const AssetManifest::Entry* AssetSync::describeLocal(const std::filesystem::path& relativePath) {
+	std::filesystem::path path = mSettings.root / relativePath;
+	// Files of the mounted bundle never change, loose files are hashed again once written to
+	uint64_t size = 0;
+	std::filesystem::file_time_type writeTime;
+	if (const AssetBundle::Entry* bundled = AssetBundle::find(path)) {
+		size = bundled->size;
+	}
+	else {
+		std::error_code ec;
+		size = std::filesystem::file_size(path, ec);
+		if (ec) return nullptr;
+		writeTime = std::filesystem::last_write_time(path, ec);
+		if (ec) return nullptr;
+	}
+
+	std::string key = relativePath.generic_string();
+	auto it = mLocalFiles.find(key);
+	if (it != mLocalFiles.end() && it->second.size == size && it->second.writeTime == writeTime) return &it->second.entry;
+
+	// Empty files cannot be mapped
+	MappedFile file;
+	if (size > 0 && !file.open(path)) return nullptr;
+	LocalFile& local = mLocalFiles[key];
+	local.size = size;
+	local.writeTime = writeTime;
+	local.entry = AssetManifest::describe(relativePath, size > 0 ? std::span<const std::byte>(file.data(), file.size()) : std::span<const std::byte>());
+	return &local.entry;
+}
+
+bool AssetSync::fetchManifest(bool& changed) {
+	changed = false;
+	if (mHost.empty()) {
+		std::ifstream file(std::filesystem::path(mSettings.source) / "assets.manifest", std::ios::binary);
+		if (!file) return false;
+		std::string manifest((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		changed = manifest != mManifest;
+		mManifest = std::move(manifest);
+		return true;
+	}
+
+	std::string headers;
+	if (!mManifestTag.empty()) headers = "If-None-Match: " + mManifestTag + "\r\n";
+	HttpResponse response;
+	if (!httpGet(mHost, mPort, mBasePath + "assets.manifest", headers, response)) return false;
+	if (response.status == 304) return true;
+	if (response.status != 200) return false;
+	changed = response.body != mManifest;
+	mManifest = std::move(response.body);
+	mManifestTag = response.etag;
+	return true;
+}
+
+bool AssetSync::fetch(const std::filesystem::path& relativePath, uint64_t offset, uint64_t length, std::string& data, bool& whole) {
+	whole = false;
+	if (mHost.empty()) {
+		std::ifstream file(std::filesystem::path(mSettings.source) / relativePath, std::ios::binary);
+		data.resize(length);
+		if (!file.seekg(static_cast<std::streamoff>(offset)) || !file.read(data.data(), static_cast<std::streamsize>(length))) {
+			std::cerr << "Could not read " << relativePath.generic_string() << " from " << mSettings.source << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	std::string range = "Range: bytes=" + std::to_string(offset) + "-" + std::to_string(offset + length - 1) + "\r\n";
+	HttpResponse response;
+	if (!httpGet(mHost, mPort, mBasePath + percentEncode(relativePath.generic_string()), range, response)) {
+		std::cerr << "Could not fetch " << relativePath.generic_string() << " from " << mSettings.source << std::endl;
+		return false;
+	}
+	if (response.status == 206 && response.rangeStart == offset) {
+		data = std::move(response.body);
+		return true;
+	}
+	if (response.status == 200) {
+		data = std::move(response.body);
+		whole = true;
+		return true;
+	}
+	std::cerr << "Could not fetch " << relativePath.generic_string() << " from " << mSettings.source << " (HTTP status " << response.status << ")" << std::endl;
+	return false;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "AssetManifest.h"
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Channel through which a running application receives the models, textures and
+ * shaders that operators publish on a content server, to swap them in without
+ * being restarted.
+ *
+ * The server publishes a copy of the resource directory and its AssetManifest,
+ * written by `LearnWebGPU-bundle --asset-manifest`, which any HTTP server can
+ * serve. A thread of the channel subscribes to it by requesting the manifest at
+ * regular intervals, cheaply when it did not change (If-None-Match), and compares
+ * its hashes with those of the local files. Of a file that changed, only the
+ * chunks the local file does not have are downloaded, with range requests, the
+ * others being copied from the local file wherever they moved. The result is
+ * checked against the hash of the manifest, then atomically replaces the local
+ * file, which from then on shadows its entry in a mounted AssetBundle.
+ *
+ * The application gets the paths of the replaced files from poll(), and loads
+ * them again through the resource cache as any other file, on its worker threads,
+ * drawing the previous version until the new one is uploaded.
+ *
+ * The source may also be a local directory, e.g. a share of the server, read the
+ * same way. Only plain HTTP is spoken, for servers on the network of the kiosks
+ * or behind a proxy terminating TLS. Files that the manifest no longer lists are
+ * kept. Not available on the web, whose resources come from a server already.
+ */
+class AssetSync {
+public:
+	struct Settings {
+		// "http://host[:port]/path" of the published directory, or the path of a local directory
+		std::string source;
+		// Resource directory whose files are replaced
+		std::filesystem::path root;
+		// Seconds between two requests of the manifest
+		double pollInterval = 5.0;
+	};
+
+	struct Statistics {
+		uint32_t updatedFileCount = 0;
+		uint32_t failedFileCount = 0;
+		uint64_t downloadedBytes = 0;
+		// Bytes of the updated files copied from their previous version rather than downloaded
+		uint64_t reusedBytes = 0;
+	};
+
+	// Start the thread, which requests the manifest right away
+	explicit AssetSync(const Settings& settings);
+	// Stop the thread, once the request in progress, if any, is answered or times out
+	~AssetSync();
+
+	AssetSync(const AssetSync&) = delete;
+	AssetSync& operator=(const AssetSync&) = delete;
+
+	// Main thread: files of the resource directory replaced since the previous call, as
+	// `root` / relative path
+	std::vector<std::filesystem::path> poll();
+
+	Statistics statistics() const;
+
+private:
+	/**
+	 * Hashes of a local file, valid while its size and write time do not change
+	 */
+	struct LocalFile {
+		uint64_t size = 0;
+		std::filesystem::file_time_type writeTime;
+		AssetManifest::Entry entry;
+	};
+
+	void run();
+	// Request the manifest and bring the files it lists up to date, return false if any failed
+	bool syncOnce();
+	bool syncFile(const AssetManifest::Entry& entry);
+	// Hashes of the local version of a file, loose or in the mounted bundle, null if there is none
+	const AssetManifest::Entry* describeLocal(const std::filesystem::path& relativePath);
+
+	// Read the manifest into mManifest, setting `changed` to whether it differs from the last one
+	bool fetchManifest(bool& changed);
+	// Read `length` bytes from `offset` of a published file into `data`. Servers that do not
+	// support ranges send the whole file, in which case `whole` is set.
+	bool fetch(const std::filesystem::path& relativePath, uint64_t offset, uint64_t length, std::string& data, bool& whole);
+
+private:
+	Settings mSettings;
+	// Empty for a local directory
+	std::string mHost;
+	std::string mPort;
+	// Path of the published directory on the server, ending with a '/'
+	std::string mBasePath;
+
+	// Used by the thread only
+	std::unordered_map<std::string, LocalFile> mLocalFiles;
+	std::string mManifest;
+	std::string mManifestTag;
+	bool mReachable = true;
+	bool mRetry = false;
+
+	mutable std::mutex mMutex;
+	std::condition_variable mWake;
+	bool mStopping = false;
+	std::vector<std::filesystem::path> mReplaced;
+	Statistics mStatistics;
+
+	std::thread mThread;
+};
@@ -0,0 +1,840 @@
+#include "Benchmark.h"
+#include "webgpu-utils.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+#include "ResourceManager.h"
+#include "StaticVertexLayout.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+namespace {
+
+bool parseUint(const char* str, uint32_t& value) {
+	const char* end = str + std::strlen(str);
+	auto result = std::from_chars(str, end, value);
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseSize(const char* str, uint32_t& width, uint32_t& height) {
+	const char* separator = std::strchr(str, 'x');
+	if (!separator) return false;
+	auto result = std::from_chars(str, separator, width);
+	if (result.ec != std::errc() || result.ptr != separator) return false;
+	return parseUint(separator + 1, height) && width > 0 && height > 0;
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double>& sortedValues, double p) {
+	size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sortedValues.size()));
+	return sortedValues[std::clamp<size_t>(rank, 1, sortedValues.size()) - 1];
+}
+
+void writeJsonString(std::ostream& out, const std::string& str) {
+	out << '"';
+	for (char c : str) {
+		if (c == '"' || c == '\\') out << '\\';
+		if (static_cast<unsigned char>(c) >= 0x20) out << c;
+	}
+	out << '"';
+}
+
+double median(std::vector<double> values) {
+	if (values.empty()) return 0.0;
+	std::sort(values.begin(), values.end());
+	return percentile(values, 50.0);
+}
+
+const char* adapterTypeName(WGPUAdapterType type) {
+	switch (type) {
+	case WGPUAdapterType_DiscreteGPU: return "discrete";
+	case WGPUAdapterType_IntegratedGPU: return "integrated";
+	case WGPUAdapterType_CPU: return "cpu";
+	default: return "unknown";
+	}
+}
+
+const char* backendTypeName(WGPUBackendType type) {
+	switch (type) {
+	case WGPUBackendType_Null: return "null";
+	case WGPUBackendType_WebGPU: return "webgpu";
+	case WGPUBackendType_D3D11: return "d3d11";
+	case WGPUBackendType_D3D12: return "d3d12";
+	case WGPUBackendType_Metal: return "metal";
+	case WGPUBackendType_Vulkan: return "vulkan";
+	case WGPUBackendType_OpenGL: return "opengl";
+	case WGPUBackendType_OpenGLES: return "opengles";
+	default: return "undefined";
+	}
+}
+
+const char* scenarioShaderSource = R"(
+struct DrawData {
+	offset: vec2f,
+	scale: f32,
+}
+
+@group(0) @binding(0) var<uniform> drawData: DrawData;
+
+// A small triangle per draw call, where the bound slot puts it
+@vertex
+fn vs_triangle(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f {
+	let corner = vec2f(f32(vertexIndex & 1u), f32(vertexIndex >> 1u));
+	return vec4f(drawData.offset + corner * drawData.scale, 0.0, 1.0);
+}
+
+// A triangle covering the whole target, once per instance
+@vertex
+fn vs_fullscreen(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f {
+	let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+	return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+@vertex
+fn vs_grid(@location(0) position: vec2f) -> @builtin(position) vec4f {
+	return vec4f(position, 0.0, 1.0);
+}
+
+@fragment
+fn fs_main() -> @location(0) vec4f {
+	return vec4f(0.25, 0.5, 0.75, 0.125);
+}
+)";
+
+constexpr wgpu::TextureFormat ScenarioFormat = wgpu::TextureFormat::RGBA8Unorm;
+// Dynamic uniform offsets are aligned to minUniformBufferOffsetAlignment, at most 256
+constexpr uint32_t DrawSlotSize = 256;
+// Written once per chunk size and frame, in chunks
+constexpr uint32_t UploadBufferSize = 8 << 20;
+constexpr uint32_t UploadTextureSize = 1024;
+
+/**
+ * Descriptor of a pipeline of the scenarios, along with the states it points to
+ */
+struct ScenarioPipeline {
+	wgpu::RenderPipelineDescriptor descriptor{};
+	wgpu::FragmentState fragmentState{};
+	wgpu::ColorTargetState colorTarget{};
+	wgpu::BlendState blendState{};
+
+	ScenarioPipeline(
+		wgpu::ShaderModule shaderModule, const char* vertexEntryPoint, wgpu::PipelineLayout layout,
+		const wgpu::VertexBufferLayout* vertexBufferLayout, bool blend
+	) {
+		using namespace wgpu;
+		descriptor.layout = layout;
+		descriptor.vertex.bufferCount = vertexBufferLayout ? 1 : 0;
+		descriptor.vertex.buffers = vertexBufferLayout;
+		descriptor.vertex.module = shaderModule;
+		descriptor.vertex.entryPoint = vertexEntryPoint;
+		descriptor.vertex.constantCount = 0;
+		descriptor.vertex.constants = nullptr;
+		descriptor.primitive.topology = PrimitiveTopology::TriangleList;
+		descriptor.primitive.stripIndexFormat = IndexFormat::Undefined;
+		descriptor.primitive.frontFace = FrontFace::CCW;
+		descriptor.primitive.cullMode = CullMode::None;
+
+		blendState.color.srcFactor = BlendFactor::SrcAlpha;
+		blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+		blendState.color.operation = BlendOperation::Add;
+		blendState.alpha.srcFactor = BlendFactor::Zero;
+		blendState.alpha.dstFactor = BlendFactor::One;
+		blendState.alpha.operation = BlendOperation::Add;
+
+		fragmentState.module = shaderModule;
+		fragmentState.entryPoint = "fs_main";
+		fragmentState.constantCount = 0;
+		fragmentState.constants = nullptr;
+		colorTarget.format = ScenarioFormat;
+		colorTarget.blend = blend ? &blendState : nullptr;
+		colorTarget.writeMask = ColorWriteMask::All;
+		fragmentState.targetCount = 1;
+		fragmentState.targets = &colorTarget;
+		descriptor.fragment = &fragmentState;
+
+		descriptor.depthStencil = nullptr;
+		descriptor.multisample.count = 1;
+		descriptor.multisample.mask = ~0u;
+		descriptor.multisample.alphaToCoverageEnabled = false;
+	}
+
+	// The descriptor points into the object
+	ScenarioPipeline(const ScenarioPipeline&) = delete;
+	ScenarioPipeline& operator=(const ScenarioPipeline&) = delete;
+};
+
+} // anonymous namespace
+
+bool BenchmarkOptions::parse(int argc, char** argv, BenchmarkOptions& options) {
+	bool valid = true;
+	for (int i = 1; i < argc && valid; ++i) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (std::strcmp(arg, "--benchmark") == 0 && value) {
+			valid = parseUint(value, options.frameCount) && options.frameCount > 0;
+		}
+		else if (std::strcmp(arg, "--warmup") == 0 && value) {
+			valid = parseUint(value, options.warmupFrameCount);
+		}
+		else if (std::strcmp(arg, "--size") == 0 && value) {
+			valid = parseSize(value, options.width, options.height);
+		}
+		else if (std::strcmp(arg, "--report") == 0 && value) {
+			options.reportPath = value;
+		}
+		else if (std::strcmp(arg, "--primitives") == 0 && value) {
+			valid = parseUint(value, options.primitiveCount) && options.primitiveCount > 0;
+		}
+		else if (std::strcmp(arg, "--gpu-profile") == 0 && value) {
+			options.gpuProfilePath = value;
+		}
+		else if (std::strcmp(arg, "--record") == 0 && value) {
+			options.recordPath = value;
+		}
+		else if (std::strcmp(arg, "--replay") == 0 && value) {
+			options.replayPath = value;
+		}
+		else if (std::strcmp(arg, "--stress") == 0 && value) {
+			valid = StressSceneOptions::parse(value, options.stressScene) && options.stressScene.enabled();
+		}
+		else if (std::strcmp(arg, "--power-preference") == 0 && value) {
+			WGPUPowerPreference powerPreference = WGPUPowerPreference_Undefined;
+			valid = parsePowerPreference(value, powerPreference);
+			options.powerPreference = powerPreference;
+		}
+		else {
+			valid = false;
+		}
+		++i;
+	}
+
+	if (!valid) {
+		std::cerr << "Usage: " << (argc > 0 ? argv[0] : "LearnWebGPU")
+			<< " [--benchmark <frames> [--warmup <frames>] [--size <width>x<height>] [--report <file.json>]]"
+			<< " [--power-preference <high-performance|low-power|default>] [--primitives <elements>]"
+			<< " [--gpu-profile <file.json>] [--record <file>] [--replay <file>]"
+			<< " [--stress objects=<n>[,meshes=<n>][,triangles=<n>][,materials=<n>][,textures=<n>][,lights=<n>][,dynamic=<0..1>][,seed=<n>]]" << std::endl;
+	}
+	else if (!options.gpuProfilePath.empty() && options.frameCount == 0) {
+		options.frameCount = DefaultProfileFrameCount;
+	}
+	return valid;
+}
+
+CameraPath::CameraPath(std::vector<Keyframe> keyframes)
+	: mKeyframes(std::move(keyframes))
+{}
+
+CameraPath CameraPath::orbit(double duration) {
+	// Starts and ends at the default camera of the application
+	const float turn = 2.0f * glm::pi<float>();
+	return CameraPath({
+		{ 0.00 * duration, { { 0.8f, 0.5f }, -1.2f } },
+		{ 0.25 * duration, { { 0.8f + 0.25f * turn, 0.2f }, -0.6f } },
+		{ 0.50 * duration, { { 0.8f + 0.50f * turn, 0.9f }, -1.2f } },
+		{ 0.75 * duration, { { 0.8f + 0.75f * turn, 0.3f }, -1.8f } },
+		{ 1.00 * duration, { { 0.8f + turn, 0.5f }, -1.2f } },
+	});
+}
+
+CameraPath::Pose CameraPath::poseAt(double time) const {
+	if (mKeyframes.empty()) return { { 0.0f, 0.0f }, 0.0f };
+	double duration = mKeyframes.back().time;
+	if (mKeyframes.size() == 1 || duration <= 0.0) return mKeyframes.front().pose;
+
+	time = std::fmod(std::max(time, 0.0), duration);
+	auto next = std::upper_bound(mKeyframes.begin(), mKeyframes.end(), time, [](double t, const Keyframe& keyframe) {
+		return t < keyframe.time;
+	});
+	if (next == mKeyframes.begin()) return next->pose;
+	if (next == mKeyframes.end()) return mKeyframes.back().pose;
+	auto previous = next - 1;
+	float t = static_cast<float>((time - previous->time) / (next->time - previous->time));
+	return {
+		glm::mix(previous->pose.angles, next->pose.angles, t),
+		glm::mix(previous->pose.zoom, next->pose.zoom, t),
+	};
+}
+
+Benchmark::Benchmark(const BenchmarkOptions& options)
+	: mOptions(options)
+{
+	mFrameTimes.reserve(options.frameCount);
+}
+
+void Benchmark::beginFrame() {
+	auto now = std::chrono::steady_clock::now();
+	// The frame that just ended counts once the warm-up frames are done
+	if (mFrameIndex > mOptions.warmupFrameCount && running()) {
+		mFrameTimes.push_back(std::chrono::duration<double, std::milli>(now - mFrameStart).count());
+		mCounts += FrameCounters::lastFrame();
+	}
+	mFrameStart = now;
+	++mFrameIndex;
+}
+
+bool Benchmark::writeReport(const std::vector<GpuProfiler::PassTiming>& passTimings, const std::vector<PipelineStatistics::PassStatistics>& passStatistics) const {
+	std::vector<double> sorted = mFrameTimes;
+	std::sort(sorted.begin(), sorted.end());
+
+	std::ostringstream report;
+	report << std::fixed << std::setprecision(3);
+	report << "{\n";
+	report << "  \"frames\": " << sorted.size() << ",\n";
+	report << "  \"warmupFrames\": " << mOptions.warmupFrameCount << ",\n";
+	report << "  \"width\": " << mOptions.width << ",\n";
+	report << "  \"height\": " << mOptions.height << ",\n";
+	report << "  \"frameTimeMs\": {";
+	if (!sorted.empty()) {
+		double mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+		report << "\n    \"mean\": " << mean
+			<< ",\n    \"min\": " << sorted.front()
+			<< ",\n    \"p50\": " << percentile(sorted, 50.0)
+			<< ",\n    \"p95\": " << percentile(sorted, 95.0)
+			<< ",\n    \"p99\": " << percentile(sorted, 99.0)
+			<< ",\n    \"max\": " << sorted.back() << "\n  ";
+	}
+	report << "},\n";
+	// Over the last frames only, see GpuProfiler
+	report << "  \"gpuPassMs\": {";
+	const char* separator = "\n    ";
+	for (const GpuProfiler::PassTiming& timing : passTimings) {
+		report << separator;
+		writeJsonString(report, timing.name);
+		report << ": { \"average\": " << timing.averageMs << ", \"max\": " << timing.maxMs << " }";
+		separator = ",\n    ";
+	}
+	report << (passTimings.empty() ? "" : "\n  ") << "}";
+	// Likewise, empty without the feature
+	report << ",\n  \"pipelineStatisticsPerFrame\": {";
+	separator = "\n    ";
+	for (const PipelineStatistics::PassStatistics& pass : passStatistics) {
+		report << separator;
+		writeJsonString(report, pass.name);
+		report << ": {";
+		for (size_t s = 0; s < PipelineStatistics::StatisticCount; ++s) {
+			report << (s == 0 ? " \"" : ", \"") << PipelineStatistics::statisticName(static_cast<PipelineStatistics::Statistic>(s)) << "\": " << pass.average[s];
+		}
+		report << " }";
+		separator = ",\n    ";
+	}
+	report << (passStatistics.empty() ? "" : "\n  ") << "}";
+	report << ",\n  \"countersPerFrame\": {";
+	separator = "\n    ";
+	for (size_t i = 0; i < mCounts.values.size(); ++i) {
+		double perFrame = sorted.empty() ? 0.0 : double(mCounts.values[i]) / sorted.size();
+		report << separator << "\"" << frameCounterName(static_cast<FrameCounter>(i)) << "\": " << perFrame;
+		separator = ",\n    ";
+	}
+	report << "\n  }";
+	// Live at the end of the run, and at most during it
+	report << ",\n  \"gpuMemoryBytes\": { \"total\": " << GpuMemoryTracker::total() << ", \"highWaterMark\": " << GpuMemoryTracker::highWaterMark() << " }";
+	// The axes of a scaling test, for reports to be plotted against them
+	if (mOptions.stressScene.enabled()) {
+		const StressSceneOptions& scene = mOptions.stressScene;
+		report << ",\n  \"stressScene\": {"
+			<< "\n    \"objects\": " << scene.objectCount
+			<< ",\n    \"meshes\": " << scene.meshCount
+			<< ",\n    \"trianglesPerMesh\": " << scene.trianglesPerMesh
+			<< ",\n    \"materials\": " << scene.materialCount
+			<< ",\n    \"textures\": " << scene.textureCount
+			<< ",\n    \"lights\": " << scene.lightCount
+			<< ",\n    \"dynamicFraction\": " << scene.dynamicFraction
+			<< ",\n    \"seed\": " << scene.seed << "\n  }";
+	}
+	// Elements per second of the primitives, from the same timings
+	if (mOptions.primitiveCount > 0) {
+		report << ",\n  \"primitives\": {\n    \"elements\": " << mOptions.primitiveCount;
+		const size_t prefixLength = std::strlen(PrimitivesBenchmark::PassPrefix);
+		for (const GpuProfiler::PassTiming& timing : passTimings) {
+			if (timing.name.compare(0, prefixLength, PrimitivesBenchmark::PassPrefix) != 0) continue;
+			double elementsPerSecond = timing.averageMs > 0.0 ? mOptions.primitiveCount / (timing.averageMs * 1e-3) : 0.0;
+			report << ",\n    ";
+			writeJsonString(report, timing.name.substr(prefixLength));
+			report << ": { \"averageMs\": " << timing.averageMs << ", \"megaElementsPerSecond\": " << elementsPerSecond * 1e-6 << " }";
+		}
+		report << "\n  }";
+	}
+	report << "\n}\n";
+
+	if (mOptions.reportPath.empty()) {
+		std::cout << report.str();
+		return true;
+	}
+	std::ofstream file(mOptions.reportPath);
+	if (!file) {
+		std::cerr << "Could not write benchmark report to " << mOptions.reportPath << std::endl;
+		return false;
+	}
+	file << report.str();
+	return static_cast<bool>(file);
+}
+
+PrimitivesBenchmark::PrimitivesBenchmark(wgpu::Device device, PipelineCache& pipelineCache, uint32_t elementCount)
+	: mElementCount(std::max(elementCount, 1u))
+{
+	using namespace wgpu;
+	BufferDescriptor bufferDesc{};
+	bufferDesc.size = uint64_t(mElementCount) * sizeof(uint32_t);
+	// The scan input also flags the elements the compaction keeps
+	bufferDesc.usage = BufferUsage::CopySrc | BufferUsage::CopyDst | BufferUsage::Storage;
+	bufferDesc.mappedAtCreation = false;
+	for (Buffer* buffer : { &mScanInputBuffer, &mKeyInputBuffer, &mValueInputBuffer }) {
+		bufferDesc.label = "Primitives benchmark input";
+		*buffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "PrimitivesBenchmark");
+	}
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+	for (Buffer* buffer : { &mScanBuffer, &mKeyBuffer, &mValueBuffer, &mCompactedBuffer }) {
+		bufferDesc.label = "Primitives benchmark data";
+		*buffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "PrimitivesBenchmark");
+	}
+	bufferDesc.label = "Primitives benchmark compacted count";
+	bufferDesc.size = 4;
+	bufferDesc.usage = BufferUsage::Storage;
+	mCompactedCountBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "PrimitivesBenchmark");
+	if (!valid()) {
+		std::cerr << "Could not create the buffers of a benchmark of " << mElementCount << " elements" << std::endl;
+		return;
+	}
+
+	// The same data from one run to the next: flags of 0 or 1 to scan, keys over all 32 bits
+	std::minstd_rand random(1);
+	std::vector<uint32_t> data(mElementCount);
+	GpuHandle<Queue> queue = device.getQueue();
+	for (uint32_t& value : data) value = static_cast<uint32_t>(random()) & 1;
+	queue->writeBuffer(mScanInputBuffer, 0, data.data(), data.size() * sizeof(uint32_t));
+	for (uint32_t& value : data) value = static_cast<uint32_t>(random()) ^ (static_cast<uint32_t>(random()) << 16);
+	queue->writeBuffer(mKeyInputBuffer, 0, data.data(), data.size() * sizeof(uint32_t));
+	std::iota(data.begin(), data.end(), 0u);
+	queue->writeBuffer(mValueInputBuffer, 0, data.data(), data.size() * sizeof(uint32_t));
+
+	for (uint32_t workgroupSize : WorkgroupSizes) {
+		Variant variant;
+		variant.scan = std::make_unique<GpuScan>(device, pipelineCache, mElementCount, workgroupSize);
+		variant.compaction = std::make_unique<GpuCompaction>(device, pipelineCache, mElementCount, workgroupSize);
+		variant.sort = std::make_unique<GpuRadixSort>(device, pipelineCache, mElementCount, workgroupSize);
+		variant.scanTarget = variant.scan->addTarget(mScanBuffer);
+		variant.compactionTarget = variant.compaction->addTarget(mValueBuffer, mScanInputBuffer, mCompactedBuffer, mCompactedCountBuffer);
+		variant.sortTarget = variant.sort->addTarget(mKeyBuffer, mValueBuffer);
+		variant.scan->setCount(queue, variant.scanTarget, mElementCount);
+		variant.compaction->setCount(queue, variant.compactionTarget, mElementCount);
+		variant.sort->setCount(queue, variant.sortTarget, mElementCount);
+		std::string suffix = " " + std::to_string(workgroupSize);
+		variant.passNames = {
+			PassPrefix + std::string("scan") + suffix,
+			PassPrefix + std::string("compaction") + suffix,
+			PassPrefix + std::string("radix sort") + suffix,
+		};
+		mVariants.push_back(std::move(variant));
+	}
+}
+
+PrimitivesBenchmark::~PrimitivesBenchmark() {
+	// The primitives first, as their bind groups refer to the buffers
+	mVariants.clear();
+	for (wgpu::Buffer* buffer : { &mCompactedCountBuffer, &mCompactedBuffer, &mValueBuffer, &mKeyBuffer, &mScanBuffer, &mValueInputBuffer, &mKeyInputBuffer, &mScanInputBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+bool PrimitivesBenchmark::valid() const {
+	for (wgpu::Buffer buffer : { mScanInputBuffer, mKeyInputBuffer, mValueInputBuffer, mScanBuffer, mKeyBuffer, mValueBuffer, mCompactedBuffer, mCompactedCountBuffer }) {
+		if (!buffer) return false;
+	}
+	return true;
+}
+
+bool PrimitivesBenchmark::ready() const {
+	if (mVariants.empty()) return false;
+	for (const Variant& variant : mVariants) {
+		if (!variant.scan->ready() || !variant.compaction->ready() || !variant.sort->ready()) return false;
+	}
+	return true;
+}
+
+void PrimitivesBenchmark::encode(wgpu::CommandEncoder encoder, GpuProfiler& profiler) {
+	using namespace wgpu;
+	if (!ready()) return;
+	const uint64_t size = uint64_t(mElementCount) * sizeof(uint32_t);
+	auto timedPass = [&](const std::string& name, auto&& record) {
+		ComputePassTimestampWrites timestampWrites;
+		ComputePassDescriptor computePassDesc{};
+		computePassDesc.label = name.c_str();
+		computePassDesc.timestampWrites = profiler.computePass(name.c_str(), timestampWrites);
+		ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+		record(computePass);
+		computePass.end();
+		computePass.release();
+	};
+	for (const Variant& variant : mVariants) {
+		encoder.copyBufferToBuffer(mScanInputBuffer, 0, mScanBuffer, 0, size);
+		timedPass(variant.passNames[0], [&](ComputePassEncoder pass) { variant.scan->encode(pass, variant.scanTarget); });
+		encoder.copyBufferToBuffer(mKeyInputBuffer, 0, mKeyBuffer, 0, size);
+		encoder.copyBufferToBuffer(mValueInputBuffer, 0, mValueBuffer, 0, size);
+		timedPass(variant.passNames[1], [&](ComputePassEncoder pass) { variant.compaction->encode(pass, variant.compactionTarget); });
+		timedPass(variant.passNames[2], [&](ComputePassEncoder pass) { variant.sort->encode(pass, variant.sortTarget); });
+	}
+}
+
+AdapterDescription AdapterDescription::of(wgpu::Adapter adapter) {
+	WGPUAdapterProperties properties = {};
+	properties.nextInChain = nullptr;
+	wgpuAdapterGetProperties(adapter, &properties);
+	// The strings belong to the adapter
+	auto copy = [](const char* str) { return str ? std::string(str) : std::string(); };
+	AdapterDescription description;
+	description.vendor = copy(properties.vendorName);
+	description.architecture = copy(properties.architecture);
+	description.name = copy(properties.name);
+	description.driver = copy(properties.driverDescription);
+	description.vendorId = properties.vendorID;
+	description.deviceId = properties.deviceID;
+	description.adapterType = properties.adapterType;
+	description.backendType = properties.backendType;
+	return description;
+}
+
+GpuScenarioBenchmark::GpuScenarioBenchmark(wgpu::Device device, PipelineCache& pipelineCache, uint32_t width, uint32_t height)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+	, mWidth(std::max(width, 1u))
+	, mHeight(std::max(height, 1u))
+	, mPassNames({
+		PassPrefix + std::string("draw calls"),
+		PassPrefix + std::string("overdraw"),
+		PassPrefix + std::string("vertices"),
+	})
+{
+	using namespace wgpu;
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Scenario benchmark target";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = ScenarioFormat;
+	textureDesc.size = { mWidth, mHeight, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::RenderAttachment;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mTarget = createTrackedTexture(device, textureDesc, GpuMemoryCategory::RenderTargets, "GpuScenarioBenchmark");
+	textureDesc.label = "Scenario benchmark upload";
+	textureDesc.size = { UploadTextureSize, UploadTextureSize, 1 };
+	textureDesc.usage = TextureUsage::CopyDst;
+	mUploadTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "GpuScenarioBenchmark");
+
+	const uint32_t gridVertexCount = (GridResolution + 1) * (GridResolution + 1);
+	BufferDescriptor bufferDesc{};
+	bufferDesc.mappedAtCreation = false;
+	bufferDesc.label = "Scenario benchmark draws";
+	bufferDesc.size = uint64_t(DrawCount) * DrawSlotSize;
+	bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+	mDrawBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "GpuScenarioBenchmark");
+	bufferDesc.label = "Scenario benchmark grid vertices";
+	bufferDesc.size = uint64_t(gridVertexCount) * sizeof(glm::vec2);
+	bufferDesc.usage = BufferUsage::Vertex | BufferUsage::CopyDst;
+	mGridVertexBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Geometry, "GpuScenarioBenchmark");
+	bufferDesc.label = "Scenario benchmark grid indices";
+	bufferDesc.size = uint64_t(GridResolution) * GridResolution * 6 * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::Index | BufferUsage::CopyDst;
+	mGridIndexBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Geometry, "GpuScenarioBenchmark");
+	bufferDesc.label = "Scenario benchmark upload";
+	bufferDesc.size = UploadBufferSize;
+	bufferDesc.usage = BufferUsage::CopyDst;
+	mUploadBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "GpuScenarioBenchmark");
+	if (!valid()) {
+		std::cerr << "Could not create the resources of the GPU scenario benchmark" << std::endl;
+		return;
+	}
+	mTargetView = mTarget.createView();
+
+	// The draws tile the target on a square grid
+	const uint32_t drawsPerRow = static_cast<uint32_t>(std::ceil(std::sqrt(double(DrawCount))));
+	const float cellSize = 2.0f / drawsPerRow;
+	std::vector<float> drawData(size_t(DrawCount) * DrawSlotSize / sizeof(float), 0.0f);
+	for (uint32_t i = 0; i < DrawCount; ++i) {
+		float* slot = drawData.data() + size_t(i) * DrawSlotSize / sizeof(float);
+		slot[0] = -1.0f + (i % drawsPerRow) * cellSize;
+		slot[1] = -1.0f + (i / drawsPerRow) * cellSize;
+		slot[2] = 0.5f * cellSize;
+	}
+	mQueue.writeBuffer(mDrawBuffer, 0, drawData.data(), drawData.size() * sizeof(float));
+
+	std::vector<glm::vec2> gridVertices;
+	gridVertices.reserve(gridVertexCount);
+	for (uint32_t y = 0; y <= GridResolution; ++y) {
+		for (uint32_t x = 0; x <= GridResolution; ++x) {
+			gridVertices.push_back(glm::vec2(x, y) * (2.0f / GridResolution) - 1.0f);
+		}
+	}
+	mQueue.writeBuffer(mGridVertexBuffer, 0, gridVertices.data(), gridVertices.size() * sizeof(glm::vec2));
+	std::vector<uint32_t> gridIndices;
+	gridIndices.reserve(size_t(GridResolution) * GridResolution * 6);
+	for (uint32_t y = 0; y < GridResolution; ++y) {
+		for (uint32_t x = 0; x < GridResolution; ++x) {
+			uint32_t corner = y * (GridResolution + 1) + x;
+			uint32_t above = corner + GridResolution + 1;
+			for (uint32_t index : { corner, corner + 1, above + 1, corner, above + 1, above }) {
+				gridIndices.push_back(index);
+			}
+		}
+	}
+	mQueue.writeBuffer(mGridIndexBuffer, 0, gridIndices.data(), gridIndices.size() * sizeof(uint32_t));
+
+	// Any data does, as long as it is not all zeros that a driver could special case
+	std::minstd_rand random(1);
+	mUploadData.resize(UploadBufferSize);
+	for (uint8_t& byte : mUploadData) byte = static_cast<uint8_t>(random());
+	for (uint32_t chunkSize : BufferChunkSizes) mBufferUploads.push_back({ chunkSize, {} });
+	for (uint32_t tileSize : TextureTileSizes) mTextureUploads.push_back({ tileSize, {} });
+
+	BindGroupLayoutEntry bindingLayout = Default;
+	bindingLayout.binding = 0;
+	bindingLayout.visibility = ShaderStage::Vertex;
+	bindingLayout.buffer.type = BufferBindingType::Uniform;
+	bindingLayout.buffer.hasDynamicOffset = true;
+	bindingLayout.buffer.minBindingSize = 4 * sizeof(float);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = 1;
+	bindGroupLayoutDesc.entries = &bindingLayout;
+	BindGroupLayout bindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	BindGroupEntry binding{};
+	binding.binding = 0;
+	binding.buffer = mDrawBuffer;
+	binding.offset = 0;
+	binding.size = 4 * sizeof(float);
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = 1;
+	bindGroupDesc.entries = &binding;
+	mDrawBindGroup = device.createBindGroup(bindGroupDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+	PipelineLayout drawLayout = pipelineCache.pipelineLayout(layoutDesc);
+	layoutDesc.bindGroupLayoutCount = 0;
+	layoutDesc.bindGroupLayouts = nullptr;
+	PipelineLayout emptyLayout = pipelineCache.pipelineLayout(layoutDesc);
+
+	using GridVertex = StaticVertexLayout<VertexPosition<f32x2>>;
+	static_assert(GridVertex::stride == sizeof(glm::vec2));
+	VertexBufferLayout gridBufferLayout = GridVertex::bufferLayout();
+
+	ShaderModule shaderModule = pipelineCache.shaderModule(scenarioShaderSource);
+	mDrawPipeline = pipelineCache.renderPipelineAsync(ScenarioPipeline(shaderModule, "vs_triangle", drawLayout, nullptr, false).descriptor);
+	mOverdrawPipeline = pipelineCache.renderPipelineAsync(ScenarioPipeline(shaderModule, "vs_fullscreen", emptyLayout, nullptr, true).descriptor);
+	mGridPipeline = pipelineCache.renderPipelineAsync(ScenarioPipeline(shaderModule, "vs_grid", emptyLayout, &gridBufferLayout, false).descriptor);
+
+	// Shaders the driver never compiled, told apart by a comment, nor the pipeline cache
+	// that would otherwise return the same pipeline
+	for (uint32_t i = 0; i < PipelineSampleCount; ++i) {
+		std::string source = scenarioShaderSource + std::string("// Pipeline creation sample ") + std::to_string(i) + "\n";
+		auto start = std::chrono::steady_clock::now();
+		ShaderModule sampleModule = ResourceManager::createShaderModule(source, device);
+		RenderPipeline pipeline = sampleModule
+			? device.createRenderPipeline(ScenarioPipeline(sampleModule, "vs_fullscreen", emptyLayout, nullptr, true).descriptor)
+			: nullptr;
+		mPipelineSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		if (pipeline) pipeline.release();
+		if (sampleModule) sampleModule.release();
+	}
+}
+
+GpuScenarioBenchmark::~GpuScenarioBenchmark() {
+	if (mDrawBindGroup) mDrawBindGroup.release();
+	if (mTargetView) mTargetView.release();
+	for (wgpu::Buffer* buffer : { &mUploadBuffer, &mGridIndexBuffer, &mGridVertexBuffer, &mDrawBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+	for (wgpu::Texture* texture : { &mUploadTexture, &mTarget }) {
+		if (!*texture) continue;
+		destroyTracked(*texture);
+		texture->release();
+	}
+	mQueue.release();
+}
+
+bool GpuScenarioBenchmark::valid() const {
+	for (wgpu::Buffer buffer : { mDrawBuffer, mGridVertexBuffer, mGridIndexBuffer, mUploadBuffer }) {
+		if (!buffer) return false;
+	}
+	return mTarget && mUploadTexture;
+}
+
+bool GpuScenarioBenchmark::ready() const {
+	return mDrawPipeline && mDrawPipeline->ready()
+		&& mOverdrawPipeline->ready()
+		&& mGridPipeline->ready();
+}
+
+void GpuScenarioBenchmark::upload() {
+	using namespace wgpu;
+	using Clock = std::chrono::steady_clock;
+	for (UploadTiming& timing : mBufferUploads) {
+		auto start = Clock::now();
+		for (uint32_t offset = 0; offset < UploadBufferSize; offset += timing.chunkSize) {
+			mQueue.writeBuffer(mUploadBuffer, offset, mUploadData.data() + offset, timing.chunkSize);
+		}
+		timing.samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+	}
+
+	ImageCopyTexture destination;
+	destination.texture = mUploadTexture;
+	destination.mipLevel = 0;
+	destination.aspect = TextureAspect::All;
+	TextureDataLayout source;
+	source.offset = 0;
+	for (UploadTiming& timing : mTextureUploads) {
+		const uint32_t tileSize = timing.chunkSize;
+		source.bytesPerRow = 4 * tileSize;
+		source.rowsPerImage = tileSize;
+		auto start = Clock::now();
+		for (uint32_t y = 0; y < UploadTextureSize; y += tileSize) {
+			for (uint32_t x = 0; x < UploadTextureSize; x += tileSize) {
+				destination.origin = { x, y, 0 };
+				mQueue.writeTexture(destination, mUploadData.data(), size_t(4) * tileSize * tileSize, source, { tileSize, tileSize, 1 });
+			}
+		}
+		timing.samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+	}
+}
+
+void GpuScenarioBenchmark::encode(wgpu::CommandEncoder encoder, GpuProfiler& profiler) {
+	using namespace wgpu;
+	if (!ready()) return;
+	upload();
+
+	auto timedPass = [&](const std::string& name, auto&& record) {
+		RenderPassColorAttachment colorAttachment{};
+		colorAttachment.view = mTargetView;
+		colorAttachment.resolveTarget = nullptr;
+		colorAttachment.loadOp = LoadOp::Clear;
+		colorAttachment.storeOp = StoreOp::Store;
+		colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+		colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+		RenderPassTimestampWrites timestampWrites;
+		RenderPassDescriptor renderPassDesc{};
+		renderPassDesc.label = name.c_str();
+		renderPassDesc.colorAttachmentCount = 1;
+		renderPassDesc.colorAttachments = &colorAttachment;
+		renderPassDesc.depthStencilAttachment = nullptr;
+		renderPassDesc.timestampWrites = profiler.renderPass(name.c_str(), timestampWrites);
+		RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+		record(renderPass);
+		renderPass.end();
+		renderPass.release();
+	};
+
+	timedPass(mPassNames[0], [&](RenderPassEncoder pass) {
+		auto start = std::chrono::steady_clock::now();
+		pass.setPipeline(mDrawPipeline->pipeline);
+		for (uint32_t i = 0; i < DrawCount; ++i) {
+			uint32_t offset = i * DrawSlotSize;
+			pass.setBindGroup(0, mDrawBindGroup, 1, &offset);
+			pass.draw(3, 1, 0, 0);
+		}
+		mDrawEncodeSamples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	});
+	timedPass(mPassNames[1], [&](RenderPassEncoder pass) {
+		pass.setPipeline(mOverdrawPipeline->pipeline);
+		pass.draw(3, OverdrawLayerCount, 0, 0);
+	});
+	timedPass(mPassNames[2], [&](RenderPassEncoder pass) {
+		pass.setPipeline(mGridPipeline->pipeline);
+		pass.setVertexBuffer(0, mGridVertexBuffer, 0, mGridVertexBuffer.getSize());
+		pass.setIndexBuffer(mGridIndexBuffer, IndexFormat::Uint32, 0, mGridIndexBuffer.getSize());
+		pass.drawIndexed(GridResolution * GridResolution * 6, 1, 0, 0, 0);
+	});
+}
+
+bool GpuScenarioBenchmark::writeProfile(const std::string& path, const std::vector<GpuProfiler::PassTiming>& passTimings, const AdapterDescription& adapter) const {
+	// Average GPU time of a scenario, 0 if the device has no timestamp queries
+	auto gpuMs = [&](const std::string& name) {
+		for (const GpuProfiler::PassTiming& timing : passTimings) {
+			if (timing.name == name) return timing.averageMs;
+		}
+		return 0.0;
+	};
+	auto perSecond = [](double amount, double ms) { return ms > 0.0 ? amount / (ms * 1e-3) : 0.0; };
+
+	std::ostringstream profile;
+	profile << std::fixed << std::setprecision(3);
+	profile << "{\n  \"adapter\": {\n    \"vendor\": ";
+	writeJsonString(profile, adapter.vendor);
+	profile << ",\n    \"architecture\": ";
+	writeJsonString(profile, adapter.architecture);
+	profile << ",\n    \"name\": ";
+	writeJsonString(profile, adapter.name);
+	profile << ",\n    \"driver\": ";
+	writeJsonString(profile, adapter.driver);
+	profile << ",\n    \"vendorId\": " << adapter.vendorId
+		<< ",\n    \"deviceId\": " << adapter.deviceId
+		<< ",\n    \"type\": \"" << adapterTypeName(adapter.adapterType) << "\""
+		<< ",\n    \"backend\": \"" << backendTypeName(adapter.backendType) << "\"\n  },\n";
+	profile << "  \"timestampQueries\": " << (passTimings.empty() ? "false" : "true") << ",\n";
+	profile << "  \"width\": " << mWidth << ",\n";
+	profile << "  \"height\": " << mHeight << ",\n";
+
+	double drawMs = gpuMs(mPassNames[0]);
+	profile << "  \"drawCalls\": { \"draws\": " << DrawCount
+		<< ", \"gpuMs\": " << drawMs
+		<< ", \"gpuMicrosecondsPerDraw\": " << drawMs * 1e3 / DrawCount
+		<< ", \"cpuEncodeMs\": " << median(mDrawEncodeSamples) << " },\n";
+	double overdrawMs = gpuMs(mPassNames[1]);
+	profile << "  \"overdraw\": { \"layers\": " << OverdrawLayerCount
+		<< ", \"gpuMs\": " << overdrawMs
+		<< ", \"gigaPixelsPerSecond\": " << perSecond(double(mWidth) * mHeight * OverdrawLayerCount, overdrawMs) * 1e-9 << " },\n";
+	double gridMs = gpuMs(mPassNames[2]);
+	const double triangleCount = 2.0 * GridResolution * GridResolution;
+	profile << "  \"vertices\": { \"triangles\": " << static_cast<uint64_t>(triangleCount)
+		<< ", \"gpuMs\": " << gridMs
+		<< ", \"megaTrianglesPerSecond\": " << perSecond(triangleCount, gridMs) * 1e-6 << " },\n";
+
+	// Median over the frames, on the CPU
+	auto writeUploads = [&](const char* name, const std::vector<UploadTiming>& timings, double bytes) {
+		profile << "    \"" << name << "\": {";
+		const char* separator = "\n      ";
+		for (const UploadTiming& timing : timings) {
+			double ms = median(timing.samples);
+			profile << separator << "\"" << timing.chunkSize << "\": { \"ms\": " << ms
+				<< ", \"megaBytesPerSecond\": " << perSecond(bytes, ms) * 1e-6 << " }";
+			separator = ",\n      ";
+		}
+		profile << "\n    }";
+	};
+	profile << "  \"uploads\": {\n";
+	writeUploads("writeBufferChunkBytes", mBufferUploads, UploadBufferSize);
+	profile << ",\n";
+	writeUploads("writeTextureTileSize", mTextureUploads, 4.0 * UploadTextureSize * UploadTextureSize);
+	profile << "\n  },\n";
+
+	double pipelineMax = mPipelineSamples.empty() ? 0.0 : *std::max_element(mPipelineSamples.begin(), mPipelineSamples.end());
+	profile << "  \"pipelineCreation\": { \"pipelines\": " << mPipelineSamples.size()
+		<< ", \"medianMs\": " << median(mPipelineSamples)
+		<< ", \"maxMs\": " << pipelineMax << " }\n}\n";
+
+	std::ofstream file(path);
+	if (!file) {
+		std::cerr << "Could not write GPU profile to " << path << std::endl;
+		return false;
+	}
+	file << profile.str();
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+#include "GpuProfiler.h"
+#include "PipelineStatistics.h"
+#include "GpuPrimitives.h"
+#include "FrameCounters.h"
+#include "SceneGenerator.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include "MathConfig.h"
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Settings of the headless benchmark mode, which renders a fixed number of frames
+ * to an offscreen texture, without any window, and reports their frame times.
+ */
+struct BenchmarkOptions {
+	// Frames to measure, 0 to run interactively
+	uint32_t frameCount = 0;
+	// Frames rendered before measuring, for caches and clocks to settle
+	uint32_t warmupFrameCount = 60;
+	// Size of the offscreen render target
+	uint32_t width = 1920;
+	uint32_t height = 1080;
+	// Animation and camera time between two frames, in seconds, whatever the actual frame time
+	double timeStep = 1.0 / 60.0;
+	// JSON file to write the report to, empty to print it
+	std::string reportPath;
+	// Adapter to run on, interactive runs included. Undefined to fall back to the
+	// LEARNWEBGPU_POWER_PREFERENCE environment variable, then to the discrete GPU.
+	wgpu::PowerPreference powerPreference = wgpu::PowerPreference::Undefined;
+	// Elements of the compute primitives timed in each frame (see PrimitivesBenchmark), 0 for none
+	uint32_t primitiveCount = 0;
+	// JSON file to write the machine profile of GpuScenarioBenchmark to, empty not to run it
+	std::string gpuProfilePath;
+	// Input recordings (see InputRecorder) to write, and to replay in place of the input of
+	// the window, or of the camera path of the benchmark, empty for none
+	std::string recordPath;
+	std::string replayPath;
+	// Synthetic scene drawn in place of the model, benchmarked or not, disabled by default
+	StressSceneOptions stressScene;
+
+	static constexpr uint32_t DefaultProfileFrameCount = 240;
+
+	bool enabled() const { return frameCount > 0; }
+
+	// Read the options from the command line:
+	//   [--benchmark <frames> [--warmup <frames>] [--size <width>x<height>] [--report <file.json>]]
+	//   [--power-preference <high-performance|low-power|default>] [--primitives <elements>]
+	//   [--gpu-profile <file.json>] [--record <file>] [--replay <file>] [--stress <key=value,...>]
+	// (see StressSceneOptions::parse for the keys of --stress)
+	// The GPU profile implies a benchmark, of DefaultProfileFrameCount frames unless told otherwise.
+	// Return false and print the usage if an argument is not understood.
+	static bool parse(int argc, char** argv, BenchmarkOptions& options);
+};
+
+/**
+ * A camera path going through keyframes, linearly interpolated and looping, so
+ * that every run of the benchmark sees the same views at the same frames.
+ */
+class CameraPath {
+public:
+	/**
+	 * Orbit camera parameters, same as Application::CameraState
+	 */
+	struct Pose {
+		glm::vec2 angles;
+		float zoom;
+	};
+
+	struct Keyframe {
+		// In seconds from the beginning of the path, increasing from one keyframe to the next
+		double time;
+		Pose pose;
+	};
+
+	explicit CameraPath(std::vector<Keyframe> keyframes);
+
+	// A full turn around the model, closing in and backing out, over `duration` seconds
+	static CameraPath orbit(double duration = 10.0);
+
+	Pose poseAt(double time) const;
+
+private:
+	std::vector<Keyframe> mKeyframes;
+};
+
+/**
+ * Frame time statistics of a benchmark run. Frame times are measured between the
+ * beginning of consecutive frames, which the frames in flight limit to the pace of
+ * the slowest of the CPU and the GPU.
+ */
+class Benchmark {
+public:
+	explicit Benchmark(const BenchmarkOptions& options);
+
+	const BenchmarkOptions& options() const { return mOptions; }
+
+	// Whether frames remain to be measured
+	bool running() const { return mFrameTimes.size() < mOptions.frameCount; }
+
+	// Start a frame, which advances the time and measures the previous frame
+	void beginFrame();
+
+	// Time of the current frame, in seconds, advancing by a fixed step per frame
+	double time() const { return mFrameIndex * mOptions.timeStep; }
+
+	// Write the frame time percentiles, GPU pass timings, pipeline statistics, average frame
+	// counters, GPU memory and the parameters of the synthetic scene, if any, as JSON, returning false if the report file cannot be written
+	bool writeReport(const std::vector<GpuProfiler::PassTiming>& passTimings, const std::vector<PipelineStatistics::PassStatistics>& passStatistics) const;
+
+private:
+	BenchmarkOptions mOptions;
+	// Frames started so far, warm-up included
+	uint32_t mFrameIndex = 0;
+	std::chrono::steady_clock::time_point mFrameStart;
+	// Measured frame times, in milliseconds
+	std::vector<double> mFrameTimes;
+	// Sum of the FrameCounters of the measured frames
+	FrameCounts mCounts;
+};
+
+/**
+ * GPU time of the primitives of GpuPrimitives.h over random data, at several
+ * workgroup sizes, each in a compute pass of its own recorded in every frame of
+ * the benchmark. Passes are named after PassPrefix, the primitive and the workgroup
+ * size, and their throughput is reported along with the frame times. The inputs
+ * are restored before each pass, sorting always starting from the same keys.
+ */
+class PrimitivesBenchmark {
+public:
+	static constexpr std::array<uint32_t, 3> WorkgroupSizes = { 64, 128, 256 };
+	// GpuScan, GpuCompaction and GpuRadixSort at each workgroup size
+	static constexpr uint32_t PassCount = 3 * static_cast<uint32_t>(WorkgroupSizes.size());
+	static constexpr const char* PassPrefix = "Primitive ";
+
+	PrimitivesBenchmark(wgpu::Device device, PipelineCache& pipelineCache, uint32_t elementCount);
+	~PrimitivesBenchmark();
+
+	PrimitivesBenchmark(const PrimitivesBenchmark&) = delete;
+	PrimitivesBenchmark& operator=(const PrimitivesBenchmark&) = delete;
+
+	bool valid() const;
+	bool ready() const;
+	uint32_t elementCount() const { return mElementCount; }
+
+	void encode(wgpu::CommandEncoder encoder, GpuProfiler& profiler);
+
+private:
+	/**
+	 * The primitives at one workgroup size, over the shared buffers
+	 */
+	struct Variant {
+		std::unique_ptr<GpuScan> scan;
+		std::unique_ptr<GpuCompaction> compaction;
+		std::unique_ptr<GpuRadixSort> sort;
+		GpuScan::Target scanTarget = 0;
+		GpuCompaction::Target compactionTarget = 0;
+		GpuRadixSort::Target sortTarget = 0;
+		// Of the passes, in the order above
+		std::array<std::string, 3> passNames;
+	};
+
+private:
+	uint32_t mElementCount;
+	// Inputs as generated, copied to those the primitives work on before each pass
+	wgpu::Buffer mScanInputBuffer = nullptr;
+	wgpu::Buffer mKeyInputBuffer = nullptr;
+	wgpu::Buffer mValueInputBuffer = nullptr;
+	wgpu::Buffer mScanBuffer = nullptr;
+	wgpu::Buffer mKeyBuffer = nullptr;
+	wgpu::Buffer mValueBuffer = nullptr;
+	// Compaction of the values flagged by the scan input, which it leaves as is
+	wgpu::Buffer mCompactedBuffer = nullptr;
+	wgpu::Buffer mCompactedCountBuffer = nullptr;
+	std::vector<Variant> mVariants;
+};
+
+/**
+ * What the machine profile of GpuScenarioBenchmark says of the adapter, copied
+ * from its properties before it is released.
+ */
+struct AdapterDescription {
+	std::string vendor;
+	std::string architecture;
+	std::string name;
+	std::string driver;
+	uint32_t vendorId = 0;
+	uint32_t deviceId = 0;
+	WGPUAdapterType adapterType = WGPUAdapterType_Unknown;
+	WGPUBackendType backendType = WGPUBackendType_Undefined;
+
+	static AdapterDescription of(wgpu::Adapter adapter);
+};
+
+/**
+ * Synthetic scenarios characterizing the GPU rather than the scene, recorded in
+ * every frame of the benchmark and written as a machine profile:
+ *  - many draws of a single triangle, for the cost of a draw call,
+ *  - layers of full-screen triangles blended over each other, for the fill rate,
+ *  - a dense grid of sub-pixel triangles, for the vertex throughput,
+ *  - queue writes to a buffer and a texture in chunks of several sizes, for the
+ *    upload bandwidth,
+ *  - the creation of pipelines from shaders never seen before, for its latency.
+ *
+ * The draws are timed by timestamps around passes of their own, named after
+ * PassPrefix. Queue writes happen outside of any pass, so their timing is that of
+ * the calls on the CPU, which copy the data to staging memory, and pipelines are
+ * timed once at construction, created synchronously.
+ */
+class GpuScenarioBenchmark {
+public:
+	static constexpr const char* PassPrefix = "Scenario ";
+	// Draw calls, overdraw and vertices
+	static constexpr uint32_t PassCount = 3;
+	static constexpr uint32_t DrawCount = 4096;
+	static constexpr uint32_t OverdrawLayerCount = 8;
+	// Quads along each side of the grid of the vertex scenario
+	static constexpr uint32_t GridResolution = 1024;
+	static constexpr std::array<uint32_t, 4> BufferChunkSizes = { 4 << 10, 64 << 10, 1 << 20, 4 << 20 };
+	// Sides of the square regions written to the texture
+	static constexpr std::array<uint32_t, 3> TextureTileSizes = { 64, 256, 1024 };
+	static constexpr uint32_t PipelineSampleCount = 8;
+
+	GpuScenarioBenchmark(wgpu::Device device, PipelineCache& pipelineCache, uint32_t width, uint32_t height);
+	~GpuScenarioBenchmark();
+
+	GpuScenarioBenchmark(const GpuScenarioBenchmark&) = delete;
+	GpuScenarioBenchmark& operator=(const GpuScenarioBenchmark&) = delete;
+
+	bool valid() const;
+	bool ready() const;
+
+	// Record the draw scenarios in passes timed by `profiler`, after timing the uploads
+	void encode(wgpu::CommandEncoder encoder, GpuProfiler& profiler);
+
+	// Write the throughput of each scenario as JSON, returning false if the file cannot be written
+	bool writeProfile(const std::string& path, const std::vector<GpuProfiler::PassTiming>& passTimings, const AdapterDescription& adapter) const;
+
+private:
+	// Time the queue writes of each chunk size
+	void upload();
+
+	/**
+	 * CPU timings of the writes of one chunk size, in milliseconds per frame
+	 */
+	struct UploadTiming {
+		uint32_t chunkSize = 0;
+		std::vector<double> samples;
+	};
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue = nullptr;
+	uint32_t mWidth;
+	uint32_t mHeight;
+	// Of the draw calls, overdraw and vertices passes
+	std::array<std::string, PassCount> mPassNames;
+	wgpu::Texture mTarget = nullptr;
+	wgpu::TextureView mTargetView = nullptr;
+	// A draw position and scale per DrawCount slot of 256 bytes, bound at a dynamic offset
+	wgpu::Buffer mDrawBuffer = nullptr;
+	wgpu::BindGroup mDrawBindGroup = nullptr;
+	wgpu::Buffer mGridVertexBuffer = nullptr;
+	wgpu::Buffer mGridIndexBuffer = nullptr;
+	PipelineCache::AsyncRenderPipeline mDrawPipeline;
+	PipelineCache::AsyncRenderPipeline mOverdrawPipeline;
+	PipelineCache::AsyncRenderPipeline mGridPipeline;
+	// Destinations of the uploads, and the data they write
+	wgpu::Buffer mUploadBuffer = nullptr;
+	wgpu::Texture mUploadTexture = nullptr;
+	std::vector<uint8_t> mUploadData;
+	std::vector<UploadTiming> mBufferUploads;
+	std::vector<UploadTiming> mTextureUploads;
+	// CPU time of encoding the draw call pass, in milliseconds per frame
+	std::vector<double> mDrawEncodeSamples;
+	// Creation of the shader module and pipeline of each sample, in milliseconds
+	std::vector<double> mPipelineSamples;
+};
@@ -0,0 +1,166 @@
+#include "Blit.h"
+#include "FullscreenTriangle.h"
+#include "GpuMemory.h"
+
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+const char* blitShaderSource = R"(
+struct BlitUniforms {
+	// Size of the region of the source to copy, and of the target, in texels
+	sourceSize: vec2f,
+	targetSize: vec2f,
+}
+
+@group(0) @binding(0) var source: texture_2d<f32>;
+@group(0) @binding(1) var sourceSampler: sampler;
+@group(0) @binding(2) var<uniform> uBlit: BlitUniforms;
+
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> @location(0) vec4f {
+	// Texel centers of the target map to those of the source when both have the same size,
+	// and filtering never reaches outside of the region
+	let texel = clamp(position.xy * uBlit.sourceSize / uBlit.targetSize, vec2f(0.5), uBlit.sourceSize - 0.5);
+	return textureSampleLevel(source, sourceSampler, texel / vec2f(textureDimensions(source)), 0.0);
+}
+)";
+
+} // anonymous namespace
+
+Blit::Blit(Device device, PipelineCache& pipelineCache, TextureFormat targetFormat)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+{
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::ClampToEdge;
+	samplerDesc.addressModeV = AddressMode::ClampToEdge;
+	samplerDesc.addressModeW = AddressMode::ClampToEdge;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 1.0f;
+	samplerDesc.compare = CompareFunction::Undefined;
+	samplerDesc.maxAnisotropy = 1;
+	mSampler = pipelineCache.sampler(samplerDesc);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Blit uniforms";
+	bufferDesc.size = sizeof(BlitUniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "Blit");
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[0].texture.sampleType = TextureSampleType::Float;
+	bindingLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[1].sampler.type = SamplerBindingType::Filtering;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[2].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[2].buffer.minBindingSize = sizeof(BlitUniforms);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+
+	ShaderModule shaderModule = pipelineCache.shaderModule(std::string(FullscreenTriangle::VertexShaderSource) + blitShaderSource);
+
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	FullscreenTriangle::setPipelineStates(pipelineDesc, shaderModule);
+
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = "fs_main";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	ColorTargetState colorTarget{};
+	colorTarget.format = targetFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	mPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+Blit::~Blit() {
+	if (mBindGroup) mBindGroup.release();
+	destroyTracked(mUniformBuffer);
+	mUniformBuffer.release();
+	mQueue.release();
+}
+
+bool Blit::draw(
+	CommandEncoder encoder,
+	TextureView sourceView, uint32_t sourceWidth, uint32_t sourceHeight,
+	TextureView targetView, uint32_t targetWidth, uint32_t targetHeight,
+	const RenderPassTimestampWrites* timestampWrites
+) {
+	if (!ready()) return false;
+
+	BlitUniforms uniforms = {
+		{ static_cast<float>(sourceWidth), static_cast<float>(sourceHeight) },
+		{ static_cast<float>(targetWidth), static_cast<float>(targetHeight) },
+	};
+	if (uniforms != mUniforms) {
+		mUniforms = uniforms;
+		mQueue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(BlitUniforms));
+	}
+
+	if (sourceView != mSourceView) {
+		if (mBindGroup) mBindGroup.release();
+		std::vector<BindGroupEntry> bindings(3);
+		bindings[0].binding = 0;
+		bindings[0].textureView = sourceView;
+		bindings[1].binding = 1;
+		bindings[1].sampler = mSampler;
+		bindings[2].binding = 2;
+		bindings[2].buffer = mUniformBuffer;
+		bindings[2].offset = 0;
+		bindings[2].size = sizeof(BlitUniforms);
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mBindGroup = mDevice.createBindGroup(bindGroupDesc);
+		mSourceView = sourceView;
+	}
+
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = targetView;
+	colorAttachment.resolveTarget = nullptr;
+	// Every texel is written
+	colorAttachment.loadOp = LoadOp::Clear;
+	colorAttachment.storeOp = StoreOp::Store;
+	colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Blit";
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &colorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = timestampWrites;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	FullscreenTriangle::draw(renderPass, mPipeline->pipeline, mBindGroup, targetWidth, targetHeight);
+	renderPass.end();
+	renderPass.release();
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+
+/**
+ * Copy the top left corner of a texture to a whole render target, with a draw
+ * rather than copyTextureToTexture, which surface textures do not always support,
+ * and which cannot scale. The source region may be smaller than the target, and is
+ * then upscaled with bilinear filtering. Regions of the same size are copied texel
+ * for texel. Only texels of the region are read, so the source texture may be
+ * larger than it, as pooled textures are.
+ */
+class Blit {
+public:
+	// Blit to color attachments of `targetFormat`
+	Blit(wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureFormat targetFormat);
+	~Blit();
+
+	Blit(const Blit&) = delete;
+	Blit& operator=(const Blit&) = delete;
+
+	// Whether the pipeline is built, before which draw() records nothing
+	bool ready() const { return mPipeline->ready(); }
+
+	// Copy the `sourceWidth` x `sourceHeight` texels in the top left corner of `sourceView` to the
+	// whole of `targetView`, of `targetWidth` x `targetHeight` texels, in a pass of its own, or
+	// return false if not ready
+	bool draw(
+		wgpu::CommandEncoder encoder,
+		wgpu::TextureView sourceView, uint32_t sourceWidth, uint32_t sourceHeight,
+		wgpu::TextureView targetView, uint32_t targetWidth, uint32_t targetHeight,
+		const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr
+	);
+
+private:
+	/**
+	 * Same as BlitUniforms in the shader
+	 */
+	struct BlitUniforms {
+		float sourceSize[2];
+		float targetSize[2];
+
+		bool operator==(const BlitUniforms&) const = default;
+	};
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	wgpu::Sampler mSampler = nullptr;
+	wgpu::Buffer mUniformBuffer = nullptr;
+	// Last uploaded uniforms
+	BlitUniforms mUniforms = {};
+	// Owned by the pipeline cache
+	PipelineCache::AsyncRenderPipeline mPipeline;
+	// Bind group of the last source, which keeps it alive
+	wgpu::TextureView mSourceView = nullptr;
+	wgpu::BindGroup mBindGroup = nullptr;
+};
@@ -0,0 +1,111 @@
+#include "BufferHeap.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+BufferHeap::BufferHeap(Device device, BufferUsage usage, std::vector<uint32_t> strides, uint32_t pageElementCount, const char* label)
+	: mDevice(device)
+	, mUsage(usage)
+	, mStrides(std::move(strides))
+	, mPageElementCount(pageElementCount)
+	, mLabel(label)
+{}
+
+BufferHeap::~BufferHeap() {
+	for (uint32_t page = 0; page < mPages.size(); ++page) {
+		if (mPages[page]) releasePage(page);
+	}
+}
+
+BufferHeap::Slice BufferHeap::allocate(uint32_t count) {
+	if (count == 0) return {};
+
+	// Most recent pages first, older ones being the most likely to be full
+	OffsetAllocator::Allocation allocation;
+	uint32_t page = static_cast<uint32_t>(mPages.size());
+	while (page > 0 && !allocation) {
+		--page;
+		if (mPages[page]) allocation = mPages[page]->allocator.allocate(count);
+	}
+	if (!allocation) {
+		page = createPage(std::max(count, mPageElementCount));
+		if (page == NoPage) return {};
+		allocation = mPages[page]->allocator.allocate(count);
+	}
+	return { page, allocation.offset, allocation.size, allocation.node };
+}
+
+void BufferHeap::free(const Slice& slice) {
+	if (!slice) return;
+	OffsetAllocator& allocator = mPages[slice.page]->allocator;
+	allocator.free({ slice.first, slice.count, slice.node });
+	if (allocator.empty() && slice.page > 0) releasePage(slice.page);
+}
+
+std::byte* BufferHeap::mappedData(const Slice& slice, uint32_t stream) const {
+	const Page& page = *mPages[slice.page];
+	return page.mappedData.empty() ? nullptr : page.mappedData[stream] + offset(slice, stream);
+}
+
+void BufferHeap::unmap() {
+	for (const std::unique_ptr<Page>& page : mPages) {
+		if (!page || page->mappedData.empty()) continue;
+		for (Buffer buffer : page->buffers) {
+			buffer.unmap();
+		}
+		page->mappedData.clear();
+	}
+}
+
+uint64_t BufferHeap::memorySize() const {
+	uint64_t size = 0;
+	for (const std::unique_ptr<Page>& page : mPages) {
+		if (!page) continue;
+		for (Buffer buffer : page->buffers) {
+			size += bufferMemorySize(buffer);
+		}
+	}
+	return size;
+}
+
+uint32_t BufferHeap::createPage(uint32_t elementCount) {
+	auto page = std::make_unique<Page>(elementCount);
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = mLabel;
+	bufferDesc.usage = mUsage;
+	bufferDesc.mappedAtCreation = true;
+	for (uint32_t stride : mStrides) {
+		bufferDesc.size = uint64_t(elementCount) * stride;
+		Buffer buffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Geometry, "BufferHeap");
+		std::byte* data = buffer ? static_cast<std::byte*>(buffer.getMappedRange(0, bufferDesc.size)) : nullptr;
+		if (!data) {
+			std::cerr << "Could not create a page of " << bufferDesc.size << " bytes for " << mLabel << "!" << std::endl;
+			if (buffer) page->buffers.push_back(buffer);
+			for (Buffer created : page->buffers) {
+				created.unmap();
+				destroyTracked(created);
+				created.release();
+			}
+			return NoPage;
+		}
+		page->buffers.push_back(buffer);
+		page->mappedData.push_back(data);
+	}
+
+	// Reuse the slot of a released page, if any
+	auto slot = std::find(mPages.begin(), mPages.end(), nullptr);
+	if (slot == mPages.end()) slot = mPages.insert(slot, nullptr);
+	*slot = std::move(page);
+	return static_cast<uint32_t>(slot - mPages.begin());
+}
+
+void BufferHeap::releasePage(uint32_t page) {
+	for (Buffer buffer : mPages[page]->buffers) {
+		destroyTracked(buffer);
+		buffer.release();
+	}
+	mPages[page].reset();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "OffsetAllocator.h"
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Large GPU buffers ("pages") shared by many small resources, e.g. the vertex
+ * streams of all the meshes of a vertex layout, so that loading thousands of
+ * meshes does not create thousands of buffers, and meshes of a same page are
+ * drawn without binding other buffers in between.
+ *
+ * A heap hands out ranges of elements, managed by an OffsetAllocator per page.
+ * A page is made of one buffer per stream, element i spanning the i-th stride of
+ * each of them, so that for vertex streams a slice gives the same range of
+ * vertices in every stream: its first element is the baseVertex of its draws.
+ *
+ * Pages are created when none has room, an allocation larger than a page getting
+ * one of its own size, and released when they become empty except for the first.
+ * New pages are mapped at creation, so that the slice they were created for can be
+ * written in place through mappedData() rather than through staging buffers, and
+ * remain so until unmap(), which must be called before submitting commands that
+ * use them.
+ */
+class BufferHeap {
+public:
+	static constexpr uint32_t NoPage = 0xFFFFFFFF;
+
+	/**
+	 * Elements [first, first + count) of a page, to give back to free()
+	 */
+	struct Slice {
+		uint32_t page = NoPage;
+		uint32_t first = 0;
+		uint32_t count = 0;
+		uint32_t node = OffsetAllocator::NoSpace;
+
+		explicit operator bool() const { return page != NoPage; }
+	};
+
+	// Pages of `pageElementCount` elements, with one buffer of `usage` for each stride of
+	// `strides` (in bytes, multiples of 4)
+	BufferHeap(wgpu::Device device, wgpu::BufferUsage usage, std::vector<uint32_t> strides, uint32_t pageElementCount, const char* label);
+	~BufferHeap();
+
+	BufferHeap(const BufferHeap&) = delete;
+	BufferHeap& operator=(const BufferHeap&) = delete;
+
+	// Return an invalid slice for 0 elements, or if a new page could not be created
+	Slice allocate(uint32_t count);
+	void free(const Slice& slice);
+
+	uint32_t streamCount() const { return static_cast<uint32_t>(mStrides.size()); }
+	uint32_t stride(uint32_t stream = 0) const { return mStrides[stream]; }
+
+	wgpu::Buffer buffer(uint32_t page, uint32_t stream = 0) const { return mPages[page]->buffers[stream]; }
+	// Byte range of a slice in the buffers of its page
+	uint64_t offset(const Slice& slice, uint32_t stream = 0) const { return uint64_t(slice.first) * mStrides[stream]; }
+	uint64_t size(const Slice& slice, uint32_t stream = 0) const { return uint64_t(slice.count) * mStrides[stream]; }
+
+	// Memory of a slice in a stream of its page if the page is still mapped, null otherwise
+	std::byte* mappedData(const Slice& slice, uint32_t stream = 0) const;
+	// Unmap the pages created since the last call
+	void unmap();
+
+	// Bytes of all the pages, used or not
+	uint64_t memorySize() const;
+
+private:
+	struct Page {
+		std::vector<wgpu::Buffer> buffers;
+		// Mapped range of each buffer, empty once unmapped
+		std::vector<std::byte*> mappedData;
+		OffsetAllocator allocator;
+
+		explicit Page(uint32_t elementCount) : allocator(elementCount) {}
+	};
+
+	// Index of the new page, or NoPage if a buffer could not be created
+	uint32_t createPage(uint32_t elementCount);
+	void releasePage(uint32_t page);
+
+private:
+	wgpu::Device mDevice;
+	wgpu::BufferUsage mUsage;
+	std::vector<uint32_t> mStrides;
+	uint32_t mPageElementCount;
+	const char* mLabel;
+	// Null where pages were released, for the indices of the others to remain
+	std::vector<std::unique_ptr<Page>> mPages;
+};
@@ -0,0 +1,636 @@
+#include "Bvh.h"
+#include "JobSystem.h"
+#include "ParallelFor.h"
+#include "MappedFile.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+namespace {
+
+constexpr uint32_t BinCount = 12;
+// Subtrees of more primitives than this are built by tasks of their own
+constexpr uint32_t ParallelBuildThreshold = 4096;
+constexpr uint32_t NoParent = Bvh::NoParent;
+
+/**
+ * A range of the primitives being sorted into the tree, with its bounds
+ */
+struct Range {
+	uint32_t begin;
+	uint32_t end;
+	Aabb bounds;
+	Aabb centroidBounds;
+
+	uint32_t count() const { return end - begin; }
+};
+
+/**
+ * State shared by the tasks building a tree
+ */
+struct Builder {
+	std::span<const Aabb> bounds;
+	std::vector<glm::vec3> centroids;
+	std::vector<uint32_t>& primitives;
+	std::vector<Bvh::Node>& nodes;
+	std::vector<uint32_t>& parents;
+	std::vector<uint32_t>& primitiveNodes;
+	std::atomic<uint32_t> nodeCount = 1;
+	JobSystem::TaskGroup tasks;
+
+	Builder(std::span<const Aabb> bounds, std::vector<uint32_t>& primitives, std::vector<Bvh::Node>& nodes, std::vector<uint32_t>& parents, std::vector<uint32_t>& primitiveNodes)
+		: bounds(bounds)
+		, centroids(bounds.size())
+		, primitives(primitives)
+		, nodes(nodes)
+		, parents(parents)
+		, primitiveNodes(primitiveNodes)
+	{}
+
+	Range makeRange(uint32_t begin, uint32_t end) const {
+		Range range{ begin, end, {}, {} };
+		for (uint32_t i = begin; i < end; ++i) {
+			range.bounds.grow(bounds[primitives[i]]);
+			range.centroidBounds.grow(centroids[primitives[i]]);
+		}
+		return range;
+	}
+
+	// Split the range at the cheapest of the binned planes, or at the median of its largest
+	// axis without `sah` or when no plane separates its primitives
+	void split(const Range& range, bool sah, Range& left, Range& right) {
+		glm::vec3 extent = range.centroidBounds.max - range.centroidBounds.min;
+		int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+		uint32_t* first = primitives.data() + range.begin;
+		uint32_t* last = primitives.data() + range.end;
+		uint32_t* middle = nullptr;
+
+		if (sah) {
+			float bestCost = std::numeric_limits<float>::max();
+			int bestAxis = -1;
+			uint32_t bestBin = 0;
+			for (int k = 0; k < 3; ++k) {
+				if (extent[k] <= 0.0f) continue;
+				float scale = BinCount / extent[k];
+				uint32_t binCounts[BinCount] = {};
+				Aabb binBounds[BinCount];
+				for (const uint32_t* p = first; p < last; ++p) {
+					uint32_t bin = std::min(BinCount - 1, static_cast<uint32_t>((centroids[*p][k] - range.centroidBounds.min[k]) * scale));
+					++binCounts[bin];
+					binBounds[bin].grow(bounds[*p]);
+				}
+				// Cost of the right side of each plane, then of both sides sweeping from the left
+				float rightCosts[BinCount];
+				Aabb rightBounds;
+				uint32_t rightCount = 0;
+				for (uint32_t b = BinCount - 1; b > 0; --b) {
+					rightBounds.grow(binBounds[b]);
+					rightCount += binCounts[b];
+					rightCosts[b] = rightCount == 0 ? 0.0f : rightCount * rightBounds.halfArea();
+				}
+				Aabb leftBounds;
+				uint32_t leftCount = 0;
+				for (uint32_t b = 0; b + 1 < BinCount; ++b) {
+					leftBounds.grow(binBounds[b]);
+					leftCount += binCounts[b];
+					if (leftCount == 0 || leftCount == range.count()) continue;
+					float cost = leftCount * leftBounds.halfArea() + rightCosts[b + 1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = k;
+						bestBin = b;
+					}
+				}
+			}
+			if (bestAxis >= 0) {
+				float scale = BinCount / extent[bestAxis];
+				float origin = range.centroidBounds.min[bestAxis];
+				middle = std::partition(first, last, [&](uint32_t p) {
+					return std::min(BinCount - 1, static_cast<uint32_t>((centroids[p][bestAxis] - origin) * scale)) <= bestBin;
+				});
+			}
+		}
+		if (middle == nullptr || middle == first || middle == last) {
+			middle = first + range.count() / 2;
+			std::nth_element(first, middle, last, [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+		}
+
+		uint32_t split = static_cast<uint32_t>(middle - primitives.data());
+		left = makeRange(range.begin, split);
+		right = makeRange(split, range.end);
+	}
+
+	// Fill `nodeIndex` with up to 4 children covering `range`, and build those that are nodes
+	void buildNode(uint32_t nodeIndex, const Range& range, uint32_t depth) {
+		// Split the largest child until there are 4, by area with the SAH and by count beyond
+		bool sah = depth < Bvh::MaxSahDepth;
+		Range children[4] = { range };
+		uint32_t childCount = 1;
+		while (childCount < 4) {
+			int largest = -1;
+			float largestSize = -1.0f;
+			for (uint32_t i = 0; i < childCount; ++i) {
+				if (children[i].count() <= Bvh::MaxLeafSize) continue;
+				float size = sah ? children[i].bounds.halfArea() : static_cast<float>(children[i].count());
+				if (size > largestSize) {
+					largest = static_cast<int>(i);
+					largestSize = size;
+				}
+			}
+			if (largest < 0) break;
+			Range left, right;
+			split(children[largest], sah, left, right);
+			children[largest] = left;
+			children[childCount++] = right;
+		}
+		// In primitive order, so that the first child starts the range of the whole node
+		std::sort(children, children + childCount, [](const Range& a, const Range& b) { return a.begin < b.begin; });
+
+		uint32_t innerCount = 0;
+		for (uint32_t i = 0; i < childCount; ++i) {
+			innerCount += children[i].count() > Bvh::MaxLeafSize ? 1 : 0;
+		}
+		uint32_t nextChild = innerCount > 0 ? nodeCount.fetch_add(innerCount, std::memory_order_relaxed) : 0;
+
+		Bvh::Node& node = nodes[nodeIndex];
+		for (uint32_t lane = 0; lane < 4; ++lane) {
+			Aabb box = lane < childCount ? children[lane].bounds : Aabb{};
+			node.minX[lane] = box.min.x;
+			node.minY[lane] = box.min.y;
+			node.minZ[lane] = box.min.z;
+			node.maxX[lane] = box.max.x;
+			node.maxY[lane] = box.max.y;
+			node.maxZ[lane] = box.max.z;
+			node.count[lane] = lane < childCount ? children[lane].count() : 0;
+			node.child[lane] = 0;
+			if (lane >= childCount) continue;
+
+			const Range& child = children[lane];
+			if (child.count() <= Bvh::MaxLeafSize) {
+				node.child[lane] = child.begin;
+				for (uint32_t i = child.begin; i < child.end; ++i) primitiveNodes[primitives[i]] = nodeIndex;
+				continue;
+			}
+			uint32_t childIndex = nextChild++;
+			node.child[lane] = childIndex;
+			parents[childIndex] = nodeIndex;
+			if (child.count() >= ParallelBuildThreshold) {
+				JobSystem::instance().run(tasks, [this, childIndex, child, depth]() { buildNode(childIndex, child, depth + 1); });
+			}
+			else {
+				buildNode(childIndex, child, depth + 1);
+			}
+		}
+	}
+};
+
+/**
+ * Header of the snapshot of a MeshBvh, followed by its arrays at the offsets it records from
+ * the start of the file, each aligned to 64 bytes: nodes, primitives, parents, nodes of the
+ * primitives and vertices
+ */
+struct BvhCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	// Of the geometry the tree was built for
+	uint64_t contentHash;
+	uint64_t nodeCount;
+	uint64_t primitiveCount;
+	uint64_t nodeOffset;
+	uint64_t primitiveOffset;
+	uint64_t parentOffset;
+	uint64_t primitiveNodeOffset;
+	uint64_t vertexOffset;
+	uint64_t size;
+};
+static_assert(sizeof(BvhCacheHeader) == 80);
+
+constexpr uint32_t BvhCacheMagic = 0x5642574C; // "LWBV"
+// Bump whenever Bvh::Node, this header or the build change
+constexpr uint32_t BvhCacheVersion = 1;
+
+std::filesystem::path bvhCachePath(const std::filesystem::path& path) {
+	std::filesystem::path cachePath = path;
+	cachePath += ".bvhcache";
+	return cachePath;
+}
+
+// Offsets of the arrays of a snapshot of `nodeCount` nodes and `primitiveCount` primitives
+BvhCacheHeader bvhCacheLayout(uint64_t nodeCount, uint64_t primitiveCount) {
+	auto align = [](uint64_t offset) { return (offset + 63) & ~uint64_t(63); };
+	BvhCacheHeader header{};
+	header.magic = BvhCacheMagic;
+	header.version = BvhCacheVersion;
+	header.nodeCount = nodeCount;
+	header.primitiveCount = primitiveCount;
+	header.nodeOffset = align(sizeof(BvhCacheHeader));
+	header.primitiveOffset = align(header.nodeOffset + nodeCount * sizeof(Bvh::Node));
+	header.parentOffset = align(header.primitiveOffset + primitiveCount * sizeof(uint32_t));
+	header.primitiveNodeOffset = align(header.parentOffset + nodeCount * sizeof(uint32_t));
+	header.vertexOffset = align(header.primitiveNodeOffset + primitiveCount * sizeof(uint32_t));
+	header.size = header.vertexOffset + 3 * primitiveCount * sizeof(glm::vec3);
+	return header;
+}
+
+template <typename T>
+std::vector<T> readArray(const std::byte* data, uint64_t offset, uint64_t count) {
+	std::vector<T> values(count);
+	std::memcpy(values.data(), data + offset, count * sizeof(T));
+	return values;
+}
+
+} // anonymous namespace
+
+float Aabb::halfArea() const {
+	if (empty()) return 0.0f;
+	glm::vec3 extent = max - min;
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+Aabb Aabb::transformed(const glm::mat4& matrix) const {
+	if (empty()) return *this;
+	// The extent along each axis is the sum of those of the transformed half extents
+	glm::vec3 center = glm::vec3(matrix * glm::vec4(this->center(), 1.0f));
+	glm::vec3 halfExtent = 0.5f * (max - min);
+	glm::vec3 extent =
+		glm::abs(glm::vec3(matrix[0])) * halfExtent.x +
+		glm::abs(glm::vec3(matrix[1])) * halfExtent.y +
+		glm::abs(glm::vec3(matrix[2])) * halfExtent.z;
+	return { center - extent, center + extent };
+}
+
+glm::vec3 Ray::inverseDirection() const {
+	glm::vec3 tiny(1e-30f);
+	return 1.0f / glm::mix(tiny, direction, glm::greaterThan(glm::abs(direction), tiny));
+}
+
+bool intersectSlabs(const Ray& ray, const glm::vec3& inverseDirection, const Aabb& box, float* tNear) {
+	glm::vec3 t0 = (box.min - ray.origin) * inverseDirection;
+	glm::vec3 t1 = (box.max - ray.origin) * inverseDirection;
+	glm::vec3 entries = glm::min(t0, t1);
+	glm::vec3 exits = glm::max(t0, t1);
+	float enter = std::max({ entries.x, entries.y, entries.z, 0.0f });
+	float exit = std::min({ exits.x, exits.y, exits.z, ray.tMax });
+	if (tNear) *tNear = enter;
+	return enter <= exit;
+}
+
+void Bvh::build(std::span<const Aabb> bounds) {
+	clear();
+	if (bounds.empty()) return;
+	uint32_t primitiveCount = static_cast<uint32_t>(bounds.size());
+
+	// Every node but the root has 2 children or more, and every leaf a primitive or more
+	mNodes.resize(primitiveCount);
+	mParents.resize(primitiveCount);
+	mPrimitives.resize(primitiveCount);
+	mPrimitiveNodes.resize(primitiveCount);
+	mParents[0] = NoParent;
+
+	Builder builder(bounds, mPrimitives, mNodes, mParents, mPrimitiveNodes);
+	parallelForRanges(primitiveCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			builder.centroids[i] = bounds[i].center();
+			mPrimitives[i] = static_cast<uint32_t>(i);
+		}
+	});
+	builder.buildNode(0, builder.makeRange(0, primitiveCount), 0);
+	JobSystem::instance().wait(builder.tasks);
+
+	uint32_t nodeCount = builder.nodeCount.load(std::memory_order_relaxed);
+	mNodes.resize(nodeCount);
+	mParents.resize(nodeCount);
+	for (uint32_t lane = 0; lane < 4; ++lane) {
+		if (mNodes[0].count[lane] == 0) continue;
+		mBounds.grow(Aabb{ { mNodes[0].minX[lane], mNodes[0].minY[lane], mNodes[0].minZ[lane] }, { mNodes[0].maxX[lane], mNodes[0].maxY[lane], mNodes[0].maxZ[lane] } });
+	}
+}
+
+bool Bvh::assign(std::vector<Node>&& nodes, std::vector<uint32_t>&& primitives, std::vector<uint32_t>&& parents, std::vector<uint32_t>&& primitiveNodes) {
+	clear();
+	if (nodes.empty() || parents.size() != nodes.size() || primitiveNodes.size() != primitives.size() || parents[0] != NoParent) return false;
+	// Traversals trust the indices not to leave the arrays
+	for (const Node& node : nodes) {
+		for (uint32_t lane = 0; lane < 4; ++lane) {
+			if (node.count[lane] == 0) continue;
+			bool valid = node.count[lane] > MaxLeafSize
+				? node.child[lane] < nodes.size()
+				: uint64_t(node.child[lane]) + node.count[lane] <= primitives.size();
+			if (!valid) return false;
+		}
+	}
+	for (size_t i = 0; i < primitives.size(); ++i) {
+		if (primitives[i] >= primitives.size() || primitiveNodes[i] >= nodes.size()) return false;
+	}
+
+	mNodes = std::move(nodes);
+	mPrimitives = std::move(primitives);
+	mParents = std::move(parents);
+	mPrimitiveNodes = std::move(primitiveNodes);
+	for (uint32_t lane = 0; lane < 4; ++lane) {
+		if (mNodes[0].count[lane] == 0) continue;
+		mBounds.grow(Aabb{ { mNodes[0].minX[lane], mNodes[0].minY[lane], mNodes[0].minZ[lane] }, { mNodes[0].maxX[lane], mNodes[0].maxY[lane], mNodes[0].maxZ[lane] } });
+	}
+	return true;
+}
+
+void Bvh::clear() {
+	mNodes.clear();
+	mPrimitives.clear();
+	mParents.clear();
+	mPrimitiveNodes.clear();
+	mBounds = {};
+}
+
+void Bvh::refitNode(uint32_t nodeIndex, std::span<const Aabb> bounds) {
+	Node& node = mNodes[nodeIndex];
+	for (uint32_t lane = 0; lane < 4; ++lane) {
+		if (node.count[lane] == 0) continue;
+		Aabb box;
+		if (node.count[lane] <= MaxLeafSize) {
+			for (uint32_t e = node.child[lane]; e < node.child[lane] + node.count[lane]; ++e) {
+				box.grow(bounds[mPrimitives[e]]);
+			}
+		}
+		else {
+			const Node& child = mNodes[node.child[lane]];
+			for (uint32_t l = 0; l < 4; ++l) {
+				if (child.count[l] == 0) continue;
+				box.grow(Aabb{ { child.minX[l], child.minY[l], child.minZ[l] }, { child.maxX[l], child.maxY[l], child.maxZ[l] } });
+			}
+		}
+		node.minX[lane] = box.min.x;
+		node.minY[lane] = box.min.y;
+		node.minZ[lane] = box.min.z;
+		node.maxX[lane] = box.max.x;
+		node.maxY[lane] = box.max.y;
+		node.maxZ[lane] = box.max.z;
+	}
+}
+
+void Bvh::refit(std::span<const Aabb> bounds) {
+	// Children come after their parent, so walking backwards refits them first
+	for (size_t i = mNodes.size(); i > 0; --i) {
+		refitNode(static_cast<uint32_t>(i - 1), bounds);
+	}
+	mBounds = {};
+	for (const Aabb& box : bounds) mBounds.grow(box);
+}
+
+void Bvh::refit(std::span<const Aabb> bounds, std::span<const uint32_t> changed) {
+	if (mNodes.empty() || changed.empty()) return;
+
+	// Nodes on the paths from the changed leaves to the root, each one once
+	std::vector<bool> marked(mNodes.size(), false);
+	std::vector<uint32_t> dirty;
+	for (uint32_t primitive : changed) {
+		for (uint32_t node = mPrimitiveNodes[primitive]; node != NoParent && !marked[node]; node = mParents[node]) {
+			marked[node] = true;
+			dirty.push_back(node);
+		}
+	}
+	std::sort(dirty.begin(), dirty.end(), std::greater<uint32_t>());
+	for (uint32_t node : dirty) refitNode(node, bounds);
+
+	mBounds = {};
+	const Node& root = mNodes[0];
+	for (uint32_t lane = 0; lane < 4; ++lane) {
+		if (root.count[lane] == 0) continue;
+		mBounds.grow(Aabb{ { root.minX[lane], root.minY[lane], root.minZ[lane] }, { root.maxX[lane], root.maxY[lane], root.maxZ[lane] } });
+	}
+}
+
+uint32_t Bvh::intersectChildren(const Node& node, const RayData& ray, float tMax, float tNear[4]) {
+	// Slab test: the ray is in a box between the last plane it enters and the first it exits
+	uint32_t nonEmpty = (node.count[0] != 0 ? 1u : 0u) | (node.count[1] != 0 ? 2u : 0u) | (node.count[2] != 0 ? 4u : 0u) | (node.count[3] != 0 ? 8u : 0u);
+#if defined(SIMD_SSE2)
+	__m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+	__m128 ix = _mm_set1_ps(ray.inverseDirection.x), iy = _mm_set1_ps(ray.inverseDirection.y), iz = _mm_set1_ps(ray.inverseDirection.z);
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), ox), ix);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), ox), ix);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), oy), iy);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), oy), iy);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), oz), iz);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), oz), iz);
+	__m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+	_mm_storeu_ps(tNear, enter);
+	return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(enter, exit))) & nonEmpty;
+#elif defined(SIMD_NEON)
+	float32x4_t ox = vdupq_n_f32(ray.origin.x), oy = vdupq_n_f32(ray.origin.y), oz = vdupq_n_f32(ray.origin.z);
+	float32x4_t t0x = vmulq_n_f32(vsubq_f32(vld1q_f32(node.minX), ox), ray.inverseDirection.x);
+	float32x4_t t1x = vmulq_n_f32(vsubq_f32(vld1q_f32(node.maxX), ox), ray.inverseDirection.x);
+	float32x4_t t0y = vmulq_n_f32(vsubq_f32(vld1q_f32(node.minY), oy), ray.inverseDirection.y);
+	float32x4_t t1y = vmulq_n_f32(vsubq_f32(vld1q_f32(node.maxY), oy), ray.inverseDirection.y);
+	float32x4_t t0z = vmulq_n_f32(vsubq_f32(vld1q_f32(node.minZ), oz), ray.inverseDirection.z);
+	float32x4_t t1z = vmulq_n_f32(vsubq_f32(vld1q_f32(node.maxZ), oz), ray.inverseDirection.z);
+	float32x4_t enter = vmaxq_f32(vmaxq_f32(vminq_f32(t0x, t1x), vminq_f32(t0y, t1y)), vmaxq_f32(vminq_f32(t0z, t1z), vdupq_n_f32(0.0f)));
+	float32x4_t exit = vminq_f32(vminq_f32(vmaxq_f32(t0x, t1x), vmaxq_f32(t0y, t1y)), vminq_f32(vmaxq_f32(t0z, t1z), vdupq_n_f32(tMax)));
+	vst1q_f32(tNear, enter);
+	// Lane weights turning a comparison mask into a bit mask
+	const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+	uint32x4_t laneMask = vandq_u32(vcleq_f32(enter, exit), vld1q_u32(laneBits));
+	uint32x2_t pairs = vadd_u32(vget_low_u32(laneMask), vget_high_u32(laneMask));
+	return vget_lane_u32(vpadd_u32(pairs, pairs), 0) & nonEmpty;
+#elif defined(SIMD_WASM)
+	v128_t ox = wasm_f32x4_splat(ray.origin.x), oy = wasm_f32x4_splat(ray.origin.y), oz = wasm_f32x4_splat(ray.origin.z);
+	v128_t ix = wasm_f32x4_splat(ray.inverseDirection.x), iy = wasm_f32x4_splat(ray.inverseDirection.y), iz = wasm_f32x4_splat(ray.inverseDirection.z);
+	v128_t t0x = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(node.minX), ox), ix);
+	v128_t t1x = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(node.maxX), ox), ix);
+	v128_t t0y = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(node.minY), oy), iy);
+	v128_t t1y = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(node.maxY), oy), iy);
+	v128_t t0z = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(node.minZ), oz), iz);
+	v128_t t1z = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(node.maxZ), oz), iz);
+	v128_t enter = wasm_f32x4_max(wasm_f32x4_max(wasm_f32x4_min(t0x, t1x), wasm_f32x4_min(t0y, t1y)), wasm_f32x4_max(wasm_f32x4_min(t0z, t1z), wasm_f32x4_splat(0.0f)));
+	v128_t exit = wasm_f32x4_min(wasm_f32x4_min(wasm_f32x4_max(t0x, t1x), wasm_f32x4_max(t0y, t1y)), wasm_f32x4_min(wasm_f32x4_max(t0z, t1z), wasm_f32x4_splat(tMax)));
+	wasm_v128_store(tNear, enter);
+	return wasm_i32x4_bitmask(wasm_f32x4_le(enter, exit)) & nonEmpty;
+#else
+	Ray clipped;
+	clipped.origin = ray.origin;
+	clipped.tMax = tMax;
+	uint32_t mask = 0;
+	for (uint32_t lane = 0; lane < 4; ++lane) {
+		Aabb box{ { node.minX[lane], node.minY[lane], node.minZ[lane] }, { node.maxX[lane], node.maxY[lane], node.maxZ[lane] } };
+		mask |= intersectSlabs(clipped, ray.inverseDirection, box, &tNear[lane]) ? 1u << lane : 0u;
+	}
+	return mask & nonEmpty;
+#endif
+}
+
+size_t Bvh::cull(const Frustum& frustum, uint32_t* visible) const {
+	if (mNodes.empty()) return 0;
+	size_t visibleCount = 0;
+	uint32_t stack[StackSize];
+	size_t stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const Node& node = mNodes[stack[--stackSize]];
+
+		// Children with their farthest corner along a plane's normal behind it are outside, those
+		// with their nearest corner in front of every plane are fully inside
+		uint32_t intersecting = (node.count[0] != 0 ? 1u : 0u) | (node.count[1] != 0 ? 2u : 0u) | (node.count[2] != 0 ? 4u : 0u) | (node.count[3] != 0 ? 8u : 0u);
+		uint32_t contained = intersecting;
+		for (const glm::vec4& plane : frustum.planes) {
+			const float* farX = plane.x > 0.0f ? node.maxX : node.minX;
+			const float* farY = plane.y > 0.0f ? node.maxY : node.minY;
+			const float* farZ = plane.z > 0.0f ? node.maxZ : node.minZ;
+			const float* nearX = plane.x > 0.0f ? node.minX : node.maxX;
+			const float* nearY = plane.y > 0.0f ? node.minY : node.maxY;
+			const float* nearZ = plane.z > 0.0f ? node.minZ : node.maxZ;
+#if defined(SIMD_SSE2)
+			__m128 px = _mm_set1_ps(plane.x), py = _mm_set1_ps(plane.y), pz = _mm_set1_ps(plane.z), pw = _mm_set1_ps(plane.w);
+			__m128 farDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(farX), px), _mm_mul_ps(_mm_load_ps(farY), py)), _mm_add_ps(_mm_mul_ps(_mm_load_ps(farZ), pz), pw));
+			__m128 nearDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(nearX), px), _mm_mul_ps(_mm_load_ps(nearY), py)), _mm_add_ps(_mm_mul_ps(_mm_load_ps(nearZ), pz), pw));
+			intersecting &= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(farDistance, _mm_setzero_ps())));
+			contained &= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(nearDistance, _mm_setzero_ps())));
+#elif defined(SIMD_NEON)
+			float32x4_t farDistance = vaddq_f32(vaddq_f32(vmulq_n_f32(vld1q_f32(farX), plane.x), vmulq_n_f32(vld1q_f32(farY), plane.y)), vaddq_f32(vmulq_n_f32(vld1q_f32(farZ), plane.z), vdupq_n_f32(plane.w)));
+			float32x4_t nearDistance = vaddq_f32(vaddq_f32(vmulq_n_f32(vld1q_f32(nearX), plane.x), vmulq_n_f32(vld1q_f32(nearY), plane.y)), vaddq_f32(vmulq_n_f32(vld1q_f32(nearZ), plane.z), vdupq_n_f32(plane.w)));
+			const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+			uint32x4_t bits = vld1q_u32(laneBits);
+			uint32x4_t farMask = vandq_u32(vcgeq_f32(farDistance, vdupq_n_f32(0.0f)), bits);
+			uint32x4_t nearMask = vandq_u32(vcgeq_f32(nearDistance, vdupq_n_f32(0.0f)), bits);
+			uint32x2_t farPairs = vadd_u32(vget_low_u32(farMask), vget_high_u32(farMask));
+			uint32x2_t nearPairs = vadd_u32(vget_low_u32(nearMask), vget_high_u32(nearMask));
+			intersecting &= vget_lane_u32(vpadd_u32(farPairs, farPairs), 0);
+			contained &= vget_lane_u32(vpadd_u32(nearPairs, nearPairs), 0);
+#elif defined(SIMD_WASM)
+			v128_t px = wasm_f32x4_splat(plane.x), py = wasm_f32x4_splat(plane.y), pz = wasm_f32x4_splat(plane.z), pw = wasm_f32x4_splat(plane.w);
+			v128_t farDistance = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(farX), px), wasm_f32x4_mul(wasm_v128_load(farY), py)), wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(farZ), pz), pw));
+			v128_t nearDistance = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(nearX), px), wasm_f32x4_mul(wasm_v128_load(nearY), py)), wasm_f32x4_add(wasm_f32x4_mul(wasm_v128_load(nearZ), pz), pw));
+			intersecting &= wasm_i32x4_bitmask(wasm_f32x4_ge(farDistance, wasm_f32x4_splat(0.0f)));
+			contained &= wasm_i32x4_bitmask(wasm_f32x4_ge(nearDistance, wasm_f32x4_splat(0.0f)));
+#else
+			for (uint32_t lane = 0; lane < 4; ++lane) {
+				float farDistance = plane.x * farX[lane] + plane.y * farY[lane] + plane.z * farZ[lane] + plane.w;
+				float nearDistance = plane.x * nearX[lane] + plane.y * nearY[lane] + plane.z * nearZ[lane] + plane.w;
+				intersecting &= farDistance >= 0.0f ? ~0u : ~(1u << lane);
+				contained &= nearDistance >= 0.0f ? ~0u : ~(1u << lane);
+			}
+#endif
+		}
+		contained &= intersecting;
+
+		for (uint32_t lane = 0; lane < 4; ++lane) {
+			if ((intersecting & (1u << lane)) == 0) continue;
+			if (node.count[lane] > MaxLeafSize && (contained & (1u << lane)) == 0) {
+				stack[stackSize++] = node.child[lane];
+				continue;
+			}
+			// A leaf, or a whole subtree: its primitives start where those of its first leaf do
+			uint32_t first = node.child[lane];
+			for (uint32_t count = node.count[lane]; count > MaxLeafSize;) {
+				const Node& child = mNodes[first];
+				first = child.child[0];
+				count = child.count[0];
+			}
+			std::copy(mPrimitives.begin() + first, mPrimitives.begin() + first + node.count[lane], visible + visibleCount);
+			visibleCount += node.count[lane];
+		}
+	}
+	return visibleCount;
+}
+
+void MeshBvh::build(const ResourceManager::Geometry& geometry) {
+	const ResourceManager::GeometryLod& lod = geometry.lods[0];
+	std::span<const uint32_t> indices = geometry.indices.subspan(lod.indexOffset, lod.indexCount);
+	size_t triangleCount = indices.size() / 3;
+
+	std::vector<Aabb> bounds(triangleCount);
+	parallelForRanges(triangleCount, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; ++t) {
+			for (int k = 0; k < 3; ++k) bounds[t].grow(glm::vec3(geometry.vertices[indices[3 * t + k]].position));
+		}
+	});
+	mBvh.build(bounds);
+
+	// Vertices in leaf order, so that the triangles of a leaf are read from consecutive memory
+	const std::vector<uint32_t>& triangles = mBvh.primitives();
+	mVertices.resize(3 * triangles.size());
+	parallelForRanges(triangles.size(), [&](size_t begin, size_t end) {
+		for (size_t e = begin; e < end; ++e) {
+			for (int k = 0; k < 3; ++k) mVertices[3 * e + k] = glm::vec3(geometry.vertices[indices[3 * triangles[e] + k]].position);
+		}
+	});
+}
+
+bool MeshBvh::intersect(Ray& ray, Hit& hit) const {
+	// Möller-Trumbore, both faces of the triangles being hit
+	return mBvh.intersect(ray, [&](uint32_t entry, Ray& r) {
+		const glm::vec3* v = &mVertices[3 * entry];
+		glm::vec3 edge1 = v[1] - v[0];
+		glm::vec3 edge2 = v[2] - v[0];
+		glm::vec3 p = glm::cross(r.direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (std::abs(determinant) < 1e-12f) return false;
+		float inverse = 1.0f / determinant;
+		glm::vec3 s = r.origin - v[0];
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f) return false;
+		glm::vec3 q = glm::cross(s, edge1);
+		float w = glm::dot(r.direction, q) * inverse;
+		if (w < 0.0f || u + w > 1.0f) return false;
+		float t = glm::dot(edge2, q) * inverse;
+		if (t < 0.0f || t > r.tMax) return false;
+		r.tMax = t;
+		hit.distance = t;
+		hit.triangle = mBvh.primitives()[entry];
+		hit.barycentrics = { u, w };
+		return true;
+	});
+}
+
+bool MeshBvh::loadCache(const std::filesystem::path& path, const ResourceManager::Geometry& geometry) {
+	if (geometry.contentHash == 0 || geometry.lods.empty()) return false;
+	MappedFile file;
+	if (!file.open(bvhCachePath(path))) return false;
+	BvhCacheHeader header;
+	if (file.size() < sizeof(BvhCacheHeader)) return false;
+	std::memcpy(&header, file.data(), sizeof(BvhCacheHeader));
+	// The layout is recomputed rather than trusted, which also bounds the counts by the file size
+	uint64_t triangleCount = geometry.lods[0].indexCount / 3;
+	if (header.magic != BvhCacheMagic || header.version != BvhCacheVersion || header.contentHash != geometry.contentHash) return false;
+	if (header.primitiveCount != triangleCount || header.nodeCount > triangleCount + 1) return false;
+	BvhCacheHeader layout = bvhCacheLayout(header.nodeCount, header.primitiveCount);
+	if (std::memcmp(&layout.nodeOffset, &header.nodeOffset, sizeof(BvhCacheHeader) - offsetof(BvhCacheHeader, nodeOffset)) != 0 || file.size() != header.size) return false;
+
+	const std::byte* data = file.data();
+	if (!mBvh.assign(
+		readArray<Bvh::Node>(data, header.nodeOffset, header.nodeCount),
+		readArray<uint32_t>(data, header.primitiveOffset, header.primitiveCount),
+		readArray<uint32_t>(data, header.parentOffset, header.nodeCount),
+		readArray<uint32_t>(data, header.primitiveNodeOffset, header.primitiveCount)
+	)) {
+		return false;
+	}
+	mVertices = readArray<glm::vec3>(data, header.vertexOffset, 3 * header.primitiveCount);
+	return true;
+}
+
+bool MeshBvh::writeCache(const std::filesystem::path& path, const ResourceManager::Geometry& geometry) const {
+	if (geometry.contentHash == 0 || mBvh.empty()) return false;
+	BvhCacheHeader header = bvhCacheLayout(mBvh.nodes().size(), mBvh.primitives().size());
+	header.contentHash = geometry.contentHash;
+
+	// Through a temporary file, so that a concurrent reader never maps a partial cache
+	return writeFileAtomically(bvhCachePath(path), [&](std::ostream& file) {
+		auto writeAt = [&file](uint64_t offset, const void* data, size_t size) {
+			const char padding[64] = {};
+			file.write(padding, offset - static_cast<uint64_t>(file.tellp()));
+			file.write(static_cast<const char*>(data), size);
+		};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(BvhCacheHeader));
+		writeAt(header.nodeOffset, mBvh.nodes().data(), mBvh.nodes().size() * sizeof(Bvh::Node));
+		writeAt(header.primitiveOffset, mBvh.primitives().data(), mBvh.primitives().size() * sizeof(uint32_t));
+		writeAt(header.parentOffset, mBvh.parents().data(), mBvh.parents().size() * sizeof(uint32_t));
+		writeAt(header.primitiveNodeOffset, mBvh.primitiveNodes().data(), mBvh.primitiveNodes().size() * sizeof(uint32_t));
+		writeAt(header.vertexOffset, mVertices.data(), mVertices.size() * sizeof(glm::vec3));
+		return true;
+	});
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "MathConfig.h"
+
+#include "FrustumCulling.h"
+#include "ResourceManager.h"
+
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <span>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * An axis aligned bounding box, empty (min > max) by default.
+ */
+struct Aabb {
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+	void grow(const glm::vec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+	void grow(const Aabb& box) { min = glm::min(min, box.min); max = glm::max(max, box.max); }
+	bool empty() const { return min.x > max.x; }
+	glm::vec3 center() const { return 0.5f * (min + max); }
+	// Half the surface area, which is all the SAH compares
+	float halfArea() const;
+
+	// Bounds of this box once transformed by `matrix`
+	Aabb transformed(const glm::mat4& matrix) const;
+};
+
+/**
+ * A ray from `origin` along `direction`, hitting what lies within [0, tMax]
+ * in units of the direction's length. Queries shorten tMax to the closest hit.
+ */
+struct Ray {
+	glm::vec3 origin = { 0.0f, 0.0f, 0.0f };
+	glm::vec3 direction = { 0.0f, 0.0f, 1.0f };
+	float tMax = std::numeric_limits<float>::infinity();
+
+	// 1 / direction for slab tests, zero components made tiny rather than giving NaN slab
+	// distances for boxes starting at the origin
+	glm::vec3 inverseDirection() const;
+};
+
+// Slab test: whether `ray` crosses `box` within [0, tMax], between the last plane it enters and
+// the first it exits, with `inverseDirection` from the ray. `tNear` gets the distance at which it
+// enters, if any.
+bool intersectSlabs(const Ray& ray, const glm::vec3& inverseDirection, const Aabb& box, float* tNear = nullptr);
+
+/**
+ * A bounding volume hierarchy over boxes of any kind of primitives, for ray
+ * queries and frustum culling on the CPU.
+ *
+ * Nodes have 4 children, whose bounds are stored as a structure of arrays so
+ * that a ray or a frustum plane is tested against all of them at once (SSE2,
+ * NEON or WASM SIMD, as enabled at compile time). A node takes 128 bytes, two
+ * cache lines, and the children of a node are allocated next to each other,
+ * after it. Each child covers a contiguous range of primitives(), so that a
+ * subtree fully inside a frustum is accepted without visiting it.
+ *
+ * It is built top-down with a binned surface area heuristic: each node splits
+ * its primitives in two along the best of 12 planes per axis, then splits the
+ * largest half again, until it has 4 children. Subtrees of many primitives are
+ * built in parallel as JobSystem tasks. When primitives move, refit() updates
+ * the bounds of the nodes above them without changing the tree, which degrades
+ * its quality as they move further from where they were built.
+ */
+class Bvh {
+public:
+	static constexpr uint32_t MaxLeafSize = 4;
+	// Nodes deeper than this are split at the median, halving their primitives, which bounds
+	// the depth and thus the traversal stack for up to 2^32 primitives
+	static constexpr uint32_t MaxSahDepth = 24;
+	static constexpr size_t StackSize = 3 * (MaxSahDepth + 16) + 1;
+
+	struct alignas(64) Node {
+		// Bounds of each child, empty children having min > max
+		float minX[4];
+		float minY[4];
+		float minZ[4];
+		float maxX[4];
+		float maxY[4];
+		float maxZ[4];
+		// Index of the child node, or of the first entry of primitives() for a leaf
+		uint32_t child[4];
+		// Primitives under each child, leaves being the children of at most MaxLeafSize,
+		// 0 for empty children
+		uint32_t count[4];
+	};
+
+	// Build over primitives of `bounds`, replacing the previous tree
+	void build(std::span<const Aabb> bounds);
+	void clear();
+	// Adopt the arrays of a tree that build() made, e.g. read back from a snapshot, returning
+	// false and leaving the tree empty if they do not make one
+	bool assign(std::vector<Node>&& nodes, std::vector<uint32_t>&& primitives, std::vector<uint32_t>&& parents, std::vector<uint32_t>&& primitiveNodes);
+
+	// Update the bounds of every node from `bounds`, in the same order as for build()
+	void refit(std::span<const Aabb> bounds);
+	// Same, only for the nodes above the primitives `changed`
+	void refit(std::span<const Aabb> bounds, std::span<const uint32_t> changed);
+
+	bool empty() const { return mNodes.empty(); }
+	const Aabb& bounds() const { return mBounds; }
+	const std::vector<Node>& nodes() const { return mNodes; }
+	// Primitive indices in leaf order
+	const std::vector<uint32_t>& primitives() const { return mPrimitives; }
+	// Parent of each node, NoParent for the root, and node holding the leaf of each primitive
+	static constexpr uint32_t NoParent = UINT32_MAX;
+	const std::vector<uint32_t>& parents() const { return mParents; }
+	const std::vector<uint32_t>& primitiveNodes() const { return mPrimitiveNodes; }
+
+	// Call `test(entry, ray)` for each entry of primitives() whose leaf the ray reaches, from
+	// the nearest leaf to the farthest, skipping those beyond ray.tMax. `test` returns whether
+	// it hit the primitive, shortening ray.tMax to the hit. Returns whether anything was hit.
+	template <typename Fn>
+	bool intersect(Ray& ray, Fn&& test) const;
+
+	// Write the primitives of the leaves whose box intersects `frustum` to `visible`, which must
+	// have room for all of them, in no particular order, and return their count. Primitives
+	// of a leaf crossing the frustum are all kept, whether their own box is in or not.
+	size_t cull(const Frustum& frustum, uint32_t* visible) const;
+
+private:
+	/**
+	 * A ray prepared for slab tests
+	 */
+	struct RayData {
+		glm::vec3 origin;
+		glm::vec3 inverseDirection;
+	};
+
+	// Mask of the children of `node` that the ray enters before `tMax`, with their entry distances
+	static uint32_t intersectChildren(const Node& node, const RayData& ray, float tMax, float tNear[4]);
+	// Recompute the bounds of the children of `node`, whose child nodes are up to date
+	void refitNode(uint32_t node, std::span<const Aabb> bounds);
+
+private:
+	std::vector<Node> mNodes;
+	std::vector<uint32_t> mPrimitives;
+	// Parent of each node, and node holding the leaf of each primitive, for refits
+	std::vector<uint32_t> mParents;
+	std::vector<uint32_t> mPrimitiveNodes;
+	Aabb mBounds;
+};
+
+/**
+ * A BVH over the triangles of the most detailed level of a mesh, which keeps a
+ * copy of their vertices in leaf order for the ray tests.
+ */
+class MeshBvh {
+public:
+	struct Hit {
+		float distance = std::numeric_limits<float>::infinity();
+		// Index of the triangle within the level, and barycentric coordinates of its 2nd and 3rd vertices
+		uint32_t triangle = 0;
+		glm::vec2 barycentrics = { 0.0f, 0.0f };
+	};
+
+	// Build over the full level of `geometry`, which can be released afterwards
+	void build(const ResourceManager::Geometry& geometry);
+
+	// Read the tree of `geometry`, loaded from `path`, from the snapshot written next to it for
+	// the same content (see ResourceManager::hashGeometry) rather than building it, returning
+	// false if there is none. The snapshot holds the arrays of the tree as they are in memory,
+	// at offsets its header records, so that reading it is a copy of the mapped file.
+	bool loadCache(const std::filesystem::path& path, const ResourceManager::Geometry& geometry);
+	// Write the snapshot loadCache() reads, returning false if it could not be written, which
+	// only costs building the tree again the next time
+	bool writeCache(const std::filesystem::path& path, const ResourceManager::Geometry& geometry) const;
+
+	bool empty() const { return mBvh.empty(); }
+	const Aabb& bounds() const { return mBvh.bounds(); }
+
+	// Closest triangle hit by `ray`, in the space of the mesh, shortening ray.tMax to it
+	bool intersect(Ray& ray, Hit& hit) const;
+
+	// For traversals of the tree elsewhere, e.g. on the GPU: 3 vertices per entry of
+	// bvh().primitives()
+	const Bvh& bvh() const { return mBvh; }
+	std::span<const glm::vec3> vertices() const { return mVertices; }
+
+private:
+	Bvh mBvh;
+	// 3 vertices per entry of the BVH's primitives()
+	std::vector<glm::vec3> mVertices;
+};
+
+template <typename Fn>
+bool Bvh::intersect(Ray& ray, Fn&& test) const {
+	if (mNodes.empty()) return false;
+
+	RayData data;
+	data.origin = ray.origin;
+	data.inverseDirection = ray.inverseDirection();
+
+	// Children still to visit, with the distance at which the ray enters them
+	struct Entry {
+		uint32_t node;
+		float tNear;
+	};
+	Entry stack[StackSize];
+	size_t stackSize = 0;
+	stack[stackSize++] = { 0, 0.0f };
+	bool hit = false;
+	while (stackSize > 0) {
+		Entry entry = stack[--stackSize];
+		if (entry.tNear > ray.tMax) continue;
+		const Node& node = mNodes[entry.node];
+
+		float tNear[4];
+		uint32_t mask = intersectChildren(node, data, ray.tMax, tNear);
+		// Hit children sorted from the nearest to the farthest
+		uint32_t order[4];
+		uint32_t hitCount = 0;
+		for (uint32_t lane = 0; lane < 4; ++lane) {
+			if ((mask & (1u << lane)) == 0) continue;
+			uint32_t i = hitCount++;
+			for (; i > 0 && tNear[order[i - 1]] > tNear[lane]; --i) order[i] = order[i - 1];
+			order[i] = lane;
+		}
+		// Leaves are tested right away and nodes pushed farthest first, to be popped nearest first
+		for (uint32_t i = 0; i < hitCount; ++i) {
+			uint32_t lane = order[i];
+			if (node.count[lane] > MaxLeafSize || tNear[lane] > ray.tMax) continue;
+			for (uint32_t e = node.child[lane]; e < node.child[lane] + node.count[lane]; ++e) {
+				hit |= test(e, ray);
+			}
+		}
+		for (uint32_t i = hitCount; i > 0; --i) {
+			uint32_t lane = order[i - 1];
+			if (node.count[lane] <= MaxLeafSize) continue;
+			stack[stackSize++] = { node.child[lane], tNear[lane] };
+		}
+	}
+	return hit;
+}
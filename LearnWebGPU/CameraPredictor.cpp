@@ -0,0 +1,47 @@
+#include "CameraPredictor.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+CameraPredictor::CameraPredictor()
+	: CameraPredictor(Settings{})
+{}
+
+CameraPredictor::CameraPredictor(const Settings& settings)
+	: mSettings(settings)
+{}
+
+void CameraPredictor::update(float zoom, double frameDelta) {
+	if (!mStarted) {
+		mPreviousZoom = zoom;
+		mStarted = true;
+		return;
+	}
+	if (frameDelta <= 0.0) return;
+	float delta = static_cast<float>(frameDelta);
+	float velocity = (zoom - mPreviousZoom) / delta;
+	mZoomVelocity += (velocity - mZoomVelocity) * (1.0f - std::exp(-delta / mSettings.zoomSmoothing));
+	mPreviousZoom = zoom;
+}
+
+glm::vec2 CameraPredictor::predictAngles(const glm::vec2& angles, const glm::vec2& velocity, float inertia) const {
+	// Integral of the velocity over the horizon, damped by inertia^(60 t)
+	float duration = mSettings.horizon;
+	if (inertia <= 0.0f) {
+		duration = 0.0f;
+	}
+	else if (inertia < 1.0f) {
+		float rate = -60.0f * std::log(inertia);
+		duration = (1.0f - std::exp(-rate * mSettings.horizon)) / rate;
+	}
+	glm::vec2 predicted = angles + velocity * duration;
+	// Same limits as the camera, which never looks straight up or down
+	predicted.y = glm::clamp(predicted.y, -glm::pi<float>() / 2 + 1e-5f, glm::pi<float>() / 2 - 1e-5f);
+	return predicted;
+}
+
+float CameraPredictor::predictZoom(float zoom, float minZoom, float maxZoom) const {
+	return glm::clamp(zoom + mZoomVelocity * mSettings.horizon, minZoom, maxZoom);
+}
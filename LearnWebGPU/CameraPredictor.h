@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+/**
+ * Where the orbiting camera is about to be, extrapolated from its angular
+ * velocity and the trend of its zoom, so that the resources it will show can be
+ * streamed before they come into view rather than pop in once they do.
+ *
+ * Angles follow the velocity measured while dragging, or the damped motion of the
+ * inertia once released, which only covers a bounded arc. The zoom changes by the
+ * discrete steps of the scroll wheel, so its trend is a velocity smoothed over a
+ * few of them.
+ */
+class CameraPredictor {
+public:
+	struct Settings {
+		// How far ahead to predict, in seconds, about the time a texture level takes to stream
+		float horizon = 0.5f;
+		// Time constant of the smoothing of the zoom velocity, in seconds
+		float zoomSmoothing = 0.15f;
+	};
+
+	CameraPredictor();
+	explicit CameraPredictor(const Settings& settings);
+
+	// Account for the zoom of a frame, `frameDelta` seconds after the previous one
+	void update(float zoom, double frameDelta);
+
+	// Angles `horizon` seconds from now moving at `velocity` (in radians per second) whose
+	// fraction `inertia` is kept every 1/60 s, 1 for no damping
+	glm::vec2 predictAngles(const glm::vec2& angles, const glm::vec2& velocity, float inertia) const;
+
+	// Zoom `horizon` seconds from now, within [minZoom, maxZoom]
+	float predictZoom(float zoom, float minZoom, float maxZoom) const;
+
+	const Settings& settings() const { return mSettings; }
+
+private:
+	Settings mSettings;
+	float mPreviousZoom = 0.0f;
+	float mZoomVelocity = 0.0f;
+	bool mStarted = false;
+};
@@ -0,0 +1,252 @@
+#include "ClusterLod.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+using namespace wgpu;
+
+namespace {
+
+const char* clusterLodShaderSource = R"(
+struct ClusterLodNode {
+	bounds: vec4f,
+	parentBounds: vec4f,
+	error: f32,
+	parentError: f32,
+	indexOffset: u32,
+	indexCount: u32,
+};
+
+struct ClusterBatch {
+	// In the model space of the batch, pixels per unit at a distance of 1 over the threshold in w
+	camera: vec4f,
+	firstNode: u32,
+	nodeCount: u32,
+	firstDraw: u32,
+	batch: u32,
+	firstIndex: u32,
+	resident: u32,
+};
+
+struct DrawIndexedIndirectArgs {
+	indexCount: u32,
+	instanceCount: u32,
+	firstIndex: u32,
+	baseVertex: i32,
+	firstInstance: u32,
+};
+
+@group(0) @binding(0) var<storage, read> nodes: array<ClusterLodNode>;
+@group(0) @binding(1) var<storage, read> batches: array<ClusterBatch>;
+// Written by culling, one per batch of the scene
+@group(0) @binding(2) var<storage, read> batchDraws: array<DrawIndexedIndirectArgs>;
+@group(0) @binding(3) var<storage, read_write> clusterDraws: array<DrawIndexedIndirectArgs>;
+@group(0) @binding(4) var<storage, read_write> drawCounts: array<atomic<u32>>;
+
+// Whether `error` spans more than the threshold when seen from the camera at the point of
+// `sphere` nearest to it, anywhere within the sphere exceeding any error
+fn exceeds(batch: ClusterBatch, error: f32, sphere: vec4f) -> bool {
+	let distance = max(length(sphere.xyz - batch.camera.xyz) - sphere.w, 0.0);
+	return error * batch.camera.w > distance;
+}
+
+// One invocation per cluster of a batch, batches along y
+@compute @workgroup_size(64)
+fn selectClusters(@builtin(global_invocation_id) id: vec3u) {
+	let batch = batches[id.y];
+	let batchDraw = batchDraws[batch.batch];
+	if (batch.resident == 0u) {
+		if (id.x == 0u) {
+			clusterDraws[batch.firstDraw] = batchDraw;
+			atomicStore(&drawCounts[id.y], 1u);
+		}
+		return;
+	}
+	if (id.x >= batch.nodeCount || batchDraw.instanceCount == 0u) {
+		return;
+	}
+
+	// Fine enough, and its parent would not be
+	let node = nodes[batch.firstNode + id.x];
+	if (exceeds(batch, node.error, node.bounds)) {
+		return;
+	}
+	if (node.parentError >= 0.0 && !exceeds(batch, node.parentError, node.parentBounds)) {
+		return;
+	}
+	var draw = batchDraw;
+	draw.indexCount = node.indexCount;
+	draw.firstIndex = batch.firstIndex + node.indexOffset;
+	clusterDraws[batch.firstDraw + atomicAdd(&drawCounts[id.y], 1u)] = draw;
+}
+)";
+
+// Of the indexCount, instanceCount, firstIndex, baseVertex and firstInstance of a draw
+constexpr uint64_t DrawIndexedIndirectSize = 5 * sizeof(uint32_t);
+
+} // anonymous namespace
+
+ClusterLod::ClusterLod(Device device, PipelineCache& pipelineCache)
+	: mDevice(device)
+{
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(5, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+		bindingLayoutEntries[binding].buffer.type = binding < 3 ? BufferBindingType::ReadOnlyStorage : BufferBindingType::Storage;
+	}
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(clusterLodShaderSource);
+	pipelineDesc.compute.entryPoint = "selectClusters";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+}
+
+ClusterLod::~ClusterLod() {
+	clear();
+}
+
+bool ClusterLod::setBatches(Buffer batchDrawArgs, std::span<const Batch> batches) {
+	clear();
+	if (batches.empty()) return true;
+
+	// The nodes of each geometry are uploaded once, whichever the number of its batches
+	std::vector<MeshOptimizer::ClusterLodNode> nodes;
+	std::unordered_map<const ResourceCache::Geometry*, uint32_t> firstNodes;
+	uint32_t drawCount = 0;
+	for (const Batch& batch : batches) {
+		const std::vector<MeshOptimizer::ClusterLodNode>& geometryNodes = batch.geometry->clusterNodes;
+		auto [it, inserted] = firstNodes.try_emplace(batch.geometry, static_cast<uint32_t>(nodes.size()));
+		if (inserted) nodes.insert(nodes.end(), geometryNodes.begin(), geometryNodes.end());
+
+		ClusterBatch clusterBatch{};
+		clusterBatch.firstNode = it->second;
+		clusterBatch.nodeCount = static_cast<uint32_t>(geometryNodes.size());
+		clusterBatch.firstDraw = drawCount;
+		clusterBatch.batch = batch.batch;
+		clusterBatch.firstIndex = batch.geometry->firstIndex();
+		if (mSlots.size() <= batch.batch) mSlots.resize(batch.batch + 1, NoSlot);
+		mSlots[batch.batch] = static_cast<uint32_t>(mBatches.size());
+		mBatches.push_back(clusterBatch);
+		mMaxNodeCount = std::max(mMaxNodeCount, clusterBatch.nodeCount);
+		drawCount += clusterBatch.nodeCount;
+	}
+
+	if (!createBuffers(nodes.size(), drawCount)) {
+		std::cerr << "Could not create the buffers of " << nodes.size() << " cluster level of detail nodes" << std::endl;
+		clear();
+		return false;
+	}
+	mDevice.getQueue().writeBuffer(mNodeBuffer, 0, nodes.data(), nodes.size() * sizeof(MeshOptimizer::ClusterLodNode));
+	mDirty = true;
+
+	std::vector<BindGroupEntry> bindings(5);
+	Buffer buffers[] = { mNodeBuffer, mBatchBuffer, batchDrawArgs, mDrawArgsBuffer, mCountBuffer };
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = buffers[binding];
+		bindings[binding].offset = 0;
+		bindings[binding].size = buffers[binding].getSize();
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mBindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mBindGroup = mDevice.createBindGroup(bindGroupDesc);
+	return mBindGroup != nullptr;
+}
+
+void ClusterLod::clear() {
+	if (mBindGroup) mBindGroup.release();
+	mBindGroup = nullptr;
+	releaseBuffers();
+	mBatches.clear();
+	mSlots.clear();
+	mMaxNodeCount = 0;
+	mDirty = false;
+}
+
+bool ClusterLod::createBuffers(uint64_t nodeCount, uint64_t drawCount) {
+	// Never empty, for the bindings to be valid
+	auto create = [this](const char* label, BufferUsage usage, uint64_t size) {
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = label;
+		bufferDesc.usage = usage;
+		bufferDesc.size = (std::max<uint64_t>(size, 16) + 3) & ~uint64_t(3);
+		bufferDesc.mappedAtCreation = false;
+		return createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "ClusterLod");
+	};
+	BufferUsage written = BufferUsage::Storage | BufferUsage::CopyDst;
+	BufferUsage drawn = BufferUsage::Storage | BufferUsage::Indirect | BufferUsage::CopyDst;
+	mNodeBuffer = create("Cluster level of detail nodes", written, nodeCount * sizeof(MeshOptimizer::ClusterLodNode));
+	mBatchBuffer = create("Cluster level of detail batches", written, mBatches.size() * sizeof(ClusterBatch));
+	mDrawArgsBuffer = create("Cluster draw arguments", drawn, drawCount * DrawIndexedIndirectSize);
+	mCountBuffer = create("Cluster draw counts", drawn, mBatches.size() * sizeof(uint32_t));
+	return mNodeBuffer && mBatchBuffer && mDrawArgsBuffer && mCountBuffer;
+}
+
+void ClusterLod::releaseBuffers() {
+	for (Buffer* buffer : { &mCountBuffer, &mDrawArgsBuffer, &mBatchBuffer, &mNodeBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+		*buffer = nullptr;
+	}
+}
+
+void ClusterLod::setView(uint32_t slot, const glm::vec3& camera, bool resident) {
+	ClusterBatch& batch = mBatches[slot];
+	uint32_t residentFlag = resident ? 1 : 0;
+	if (glm::vec3(batch.camera) == camera && batch.resident == residentFlag) return;
+	batch.camera = glm::vec4(camera, batch.camera.w);
+	batch.resident = residentFlag;
+	mDirty = true;
+}
+
+void ClusterLod::setErrorScale(float pixelsPerUnit, float pixelError) {
+	float errorScale = pixelsPerUnit / std::max(pixelError, 1e-3f);
+	for (ClusterBatch& batch : mBatches) {
+		if (batch.camera.w == errorScale) continue;
+		batch.camera.w = errorScale;
+		mDirty = true;
+	}
+}
+
+void ClusterLod::flush(Queue queue) {
+	if (!mDirty) return;
+	mDirty = false;
+	queue.writeBuffer(mBatchBuffer, 0, mBatches.data(), mBatches.size() * sizeof(ClusterBatch));
+}
+
+void ClusterLod::encode(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites) const {
+	if (!ready() || !mBindGroup) return;
+	// Selected again from zero, the arguments past the count drawing nothing
+	encoder.clearBuffer(mDrawArgsBuffer, 0, mDrawArgsBuffer.getSize());
+	encoder.clearBuffer(mCountBuffer, 0, mCountBuffer.getSize());
+
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Cluster level of detail";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mPipeline->pipeline);
+	computePass.setBindGroup(0, mBindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups((std::max(mMaxNodeCount, 1u) + 63) / 64, batchCount(), 1);
+	computePass.end();
+	computePass.release();
+}
+
+uint64_t ClusterLod::drawArgsOffset(uint32_t slot) const {
+	return uint64_t(mBatches[slot].firstDraw) * DrawIndexedIndirectSize;
+}
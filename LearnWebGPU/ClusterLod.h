@@ -0,0 +1,115 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "ResourceCache.h"
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Continuous level of detail of the batches whose geometry has a cluster hierarchy
+ * (see MeshOptimizer::buildClusterLod): a compute pass selects for each batch the
+ * clusters of the coarsest cut of the hierarchy whose error projects to less than a
+ * threshold in pixels, and writes an indirect draw per selected cluster, with the
+ * instances that culling left to the batch.
+ *
+ * Each batch owns a range of drawCapacity() arguments, one per cluster of its
+ * geometry, those past the selected ones drawing nothing, and the number of selected
+ * ones in countBuffer(), for MultiDraw::drawIndexedIndirectCount. Errors are
+ * projected from the camera in the model space of the instance of the batch nearest
+ * to it, which is conservative for the others.
+ *
+ * Until the geometry of a batch is resident, its coarser clusters may index what is
+ * not uploaded yet, so its only draw is the one culling wrote for the batch.
+ */
+class ClusterLod {
+public:
+	static constexpr uint32_t NoSlot = UINT32_MAX;
+
+	// A batch drawn by clusters, with its geometry
+	struct Batch {
+		// Index of the draw arguments of the batch in the buffer given to setBatches()
+		uint32_t batch;
+		const ResourceCache::Geometry* geometry;
+	};
+
+	ClusterLod(wgpu::Device device, PipelineCache& pipelineCache);
+	~ClusterLod();
+
+	ClusterLod(const ClusterLod&) = delete;
+	ClusterLod& operator=(const ClusterLod&) = delete;
+
+	// Whether the pipeline is built, before which encode() records nothing
+	bool ready() const { return mPipeline && mPipeline->ready(); }
+
+	// Draw `batches` by clusters, their culled arguments being read from `batchDrawArgs`, the
+	// DrawIndexedIndirect arguments of all batches, or return false
+	bool setBatches(wgpu::Buffer batchDrawArgs, std::span<const Batch> batches);
+	// Draw no batch by clusters and release the buffers
+	void clear();
+
+	uint32_t batchCount() const { return static_cast<uint32_t>(mBatches.size()); }
+	// Slot of the batch given to setBatches() with index `batch`, NoSlot if it has none
+	uint32_t slot(uint32_t batch) const { return batch < mSlots.size() ? mSlots[batch] : NoSlot; }
+
+	// The camera of a slot, in the model space of the instances of its batch, and whether the
+	// geometry of the batch is resident
+	void setView(uint32_t slot, const glm::vec3& camera, bool resident);
+	// Model space errors are compared to `pixelsPerUnit`, the pixels a unit spans at a distance
+	// of 1, over the threshold in pixels
+	void setErrorScale(float pixelsPerUnit, float pixelError);
+	// Upload the changes of the views
+	void flush(wgpu::Queue queue);
+
+	// Record the selection of the clusters, after the draw arguments of the batches are written
+	void encode(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr) const;
+
+	// The DrawIndexedIndirect arguments of each slot, tightly packed
+	wgpu::Buffer drawArgsBuffer() const { return mDrawArgsBuffer; }
+	uint64_t drawArgsOffset(uint32_t slot) const;
+	uint32_t drawCapacity(uint32_t slot) const { return mBatches[slot].nodeCount; }
+	// The number of arguments selected for each slot, as a uint32_t
+	wgpu::Buffer countBuffer() const { return mCountBuffer; }
+	uint64_t countOffset(uint32_t slot) const { return uint64_t(slot) * sizeof(uint32_t); }
+
+private:
+	/**
+	 * The ClusterBatch structure of the shader
+	 */
+	struct ClusterBatch {
+		// In the model space of the batch, with pixels per unit at a distance of 1 over the
+		// threshold in w
+		glm::vec4 camera;
+		uint32_t firstNode;
+		uint32_t nodeCount;
+		uint32_t firstDraw;
+		uint32_t batch;
+		uint32_t firstIndex;
+		uint32_t resident;
+		uint32_t _pad[2];
+	};
+	static_assert(sizeof(ClusterBatch) == 48);
+
+	bool createBuffers(uint64_t nodeCount, uint64_t drawCount);
+	void releaseBuffers();
+
+	wgpu::Device mDevice;
+	std::vector<ClusterBatch> mBatches;
+	std::vector<uint32_t> mSlots;
+	uint32_t mMaxNodeCount = 0;
+	bool mDirty = false;
+
+	wgpu::Buffer mNodeBuffer = nullptr;
+	wgpu::Buffer mBatchBuffer = nullptr;
+	wgpu::Buffer mDrawArgsBuffer = nullptr;
+	wgpu::Buffer mCountBuffer = nullptr;
+
+	// Owned by the pipeline cache
+	PipelineCache::AsyncComputePipeline mPipeline;
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	wgpu::BindGroup mBindGroup = nullptr;
+};
@@ -0,0 +1,248 @@
+#include "ClusteredLights.h"
+#include "GpuMemory.h"
+#include "DepthConvention.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+const char* lightBinningShaderSource = R"(
+struct PointLight {
+	position: vec3f,
+	radius: f32,
+	color: vec3f,
+	intensity: f32,
+};
+
+struct ClusterUniforms {
+	viewMatrix: mat4x4f,
+	projectionScale: vec2f,
+	tileSize: vec2f,
+	targetSize: vec2f,
+	near: f32,
+	far: f32,
+	gridSize: vec3u,
+	lightCount: u32,
+	sliceScale: f32,
+	sliceBias: f32,
+};
+
+struct Cluster {
+	count: u32,
+	lights: array<u32, 63>,
+};
+
+@group(0) @binding(0) var<uniform> uClusters: ClusterUniforms;
+@group(0) @binding(1) var<storage, read> lights: array<PointLight>;
+@group(0) @binding(2) var<storage, read_write> clusters: array<Cluster>;
+
+// Tuned per adapter by the WorkgroupTuner
+override workgroupSize: u32 = 64;
+
+// View space spheres of a chunk of lights, one loaded by each invocation of the workgroup
+var<workgroup> chunk: array<vec4f, workgroupSize>;
+
+// View space depth of the near side of slice z, slices being spaced exponentially
+fn sliceDepth(z: u32) -> f32 {
+	return uClusters.near * pow(uClusters.far / uClusters.near, f32(z) / f32(uClusters.gridSize.z));
+}
+
+// Normalized device coordinates of a pixel corner of the render target
+fn pixelToNdc(p: vec2f) -> vec2f {
+	return vec2f(p.x / uClusters.targetSize.x * 2.0 - 1.0, 1.0 - p.y / uClusters.targetSize.y * 2.0);
+}
+
+@compute @workgroup_size(workgroupSize)
+fn binLights(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) local: u32) {
+	let grid = uClusters.gridSize;
+	let clusterIndex = id.x;
+	let inGrid = clusterIndex < grid.x * grid.y * grid.z;
+
+	// View space bounding box of the cluster, from the corners of its tile at both depths,
+	// the camera looking towards -z
+	let x = clusterIndex % grid.x;
+	let y = (clusterIndex / grid.x) % grid.y;
+	let z = clusterIndex / (grid.x * grid.y);
+	let tileMin = vec2f(f32(x), f32(y)) * uClusters.tileSize;
+	let ndcA = pixelToNdc(tileMin) / uClusters.projectionScale;
+	let ndcB = pixelToNdc(tileMin + uClusters.tileSize) / uClusters.projectionScale;
+	let ndcMin = min(ndcA, ndcB);
+	let ndcMax = max(ndcA, ndcB);
+	let nearDepth = sliceDepth(z);
+	let farDepth = sliceDepth(z + 1u);
+	let boxMin = vec3f(min(ndcMin * nearDepth, ndcMin * farDepth), -farDepth);
+	let boxMax = vec3f(max(ndcMax * nearDepth, ndcMax * farDepth), -nearDepth);
+
+	var count = 0u;
+	// Every invocation takes part in loading the chunks and in the barriers
+	for (var start = 0u; start < uClusters.lightCount; start += workgroupSize) {
+		if (start + local < uClusters.lightCount) {
+			let light = lights[start + local];
+			let center = (uClusters.viewMatrix * vec4f(light.position, 1.0)).xyz;
+			chunk[local] = vec4f(center, light.radius);
+		}
+		workgroupBarrier();
+
+		let chunkSize = min(workgroupSize, uClusters.lightCount - start);
+		for (var i = 0u; i < chunkSize && inGrid; i++) {
+			let sphere = chunk[i];
+			// Squared distance from the center to the nearest point of the box
+			let offset = sphere.xyz - clamp(sphere.xyz, boxMin, boxMax);
+			if (dot(offset, offset) <= sphere.w * sphere.w && count < 63u) {
+				clusters[clusterIndex].lights[count] = start + i;
+				count++;
+			}
+		}
+		workgroupBarrier();
+	}
+
+	if (inGrid) {
+		clusters[clusterIndex].count = count;
+	}
+}
+)";
+
+} // anonymous namespace
+
+ClusteredLights::ClusteredLights(Device device, PipelineCache& pipelineCache, WorkgroupTuner& workgroupTuner)
+	: mWorkgroupTuner(workgroupTuner)
+{
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Cluster uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ClusteredLights");
+
+	bufferDesc.label = "Point lights";
+	bufferDesc.size = MaxLights * sizeof(PointLight);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+	mLightBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ClusteredLights");
+
+	// Zero-initialized, hence empty lists until the first binning pass
+	bufferDesc.label = "Light clusters";
+	bufferDesc.size = uint64_t(ClusterCount) * (MaxLightsPerCluster + 1) * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::Storage;
+	mClusterBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ClusteredLights");
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[1].buffer.minBindingSize = sizeof(PointLight);
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[2].buffer.type = BufferBindingType::Storage;
+	bindingLayoutEntries[2].buffer.minBindingSize = (MaxLightsPerCluster + 1) * sizeof(uint32_t);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	BindGroupLayout bindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(lightBinningShaderSource);
+	pipelineDesc.compute.entryPoint = "binLights";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mBinning = workgroupTuner.kernel("Light binning", pipelineDesc, { 64, 32, 128, 256 }, sizeof(glm::vec4));
+
+	if (!valid()) return;
+	std::vector<BindGroupEntry> bindings(3);
+	bindings[0].binding = 0;
+	bindings[0].buffer = mUniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(Uniforms);
+	bindings[1].binding = 1;
+	bindings[1].buffer = mLightBuffer;
+	bindings[1].offset = 0;
+	bindings[1].size = mLightBuffer.getSize();
+	bindings[2].binding = 2;
+	bindings[2].buffer = mClusterBuffer;
+	bindings[2].offset = 0;
+	bindings[2].size = mClusterBuffer.getSize();
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mBindGroup = device.createBindGroup(bindGroupDesc);
+}
+
+ClusteredLights::~ClusteredLights() {
+	if (mBindGroup) mBindGroup.release();
+	for (Buffer* buffer : { &mClusterBuffer, &mLightBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+void ClusteredLights::setLights(Queue queue, std::span<const PointLight> lights) {
+	if (!valid()) return;
+	uint32_t lightCount = static_cast<uint32_t>(std::min<size_t>(lights.size(), MaxLights));
+	if (lightCount > 0) {
+		queue.writeBuffer(mLightBuffer, 0, lights.data(), lightCount * sizeof(PointLight));
+	}
+	mUniforms.lightCount = lightCount;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+	mBinningNeeded = true;
+}
+
+void ClusteredLights::update(Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, glm::uvec2 targetSize) {
+	if (!valid()) return;
+	Uniforms uniforms = mUniforms;
+	uniforms.viewMatrix = viewMatrix;
+	uniforms.projectionScale = { projectionMatrix[0][0], projectionMatrix[1][1] };
+	uniforms.targetSize = glm::vec2(glm::max(targetSize, glm::uvec2(1)));
+	// Whole pixels, the last tiles of a row or column reaching beyond the target
+	uniforms.tileSize = glm::ceil(uniforms.targetSize / glm::vec2(GridWidth, GridHeight));
+	// Planes of a perspective projection with depths from 0 to 1, slicing no further than
+	// MaxDepthRatio near planes under an infinite far plane, fragments beyond falling in the
+	// last slice
+	glm::vec2 clipPlanes = DepthConvention::clipPlanes(projectionMatrix);
+	uniforms.near = clipPlanes.x;
+	uniforms.far = std::min(clipPlanes.y, clipPlanes.x * MaxDepthRatio);
+	float logDepthRange = std::log(uniforms.far / uniforms.near);
+	uniforms.sliceScale = static_cast<float>(GridDepth) / logDepthRange;
+	uniforms.sliceBias = -static_cast<float>(GridDepth) * std::log(uniforms.near) / logDepthRange;
+	if (uniforms == mUniforms && !mBinningNeeded) return;
+
+	mUniforms = uniforms;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+	mBinningNeeded = true;
+}
+
+bool ClusteredLights::bin(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites) {
+	if (!ready() || !valid()) return false;
+
+	// While the workgroup size is tuned, the lists are also written with each candidate size
+	for (const WorkgroupTuner::Measurement& measurement : mWorkgroupTuner.measure(*mBinning)) {
+		encodeBinning(encoder, &measurement.timestampWrites, measurement.pipeline, measurement.workgroupSize);
+	}
+	encodeBinning(encoder, timestampWrites, mBinning->pipeline()->pipeline, mBinning->workgroupSize());
+	mBinningNeeded = false;
+	return true;
+}
+
+void ClusteredLights::encodeBinning(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites, ComputePipeline pipeline, uint32_t workgroupSize) const {
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Light binning";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(pipeline);
+	computePass.setBindGroup(0, mBindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups((ClusterCount + workgroupSize - 1) / workgroupSize, 1, 1);
+	computePass.end();
+	computePass.release();
+}
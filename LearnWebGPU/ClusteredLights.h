@@ -0,0 +1,125 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "WorkgroupTuner.h"
+
+#include <array>
+#include <memory>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Clustered forward shading of point lights: the view frustum is split into a
+ * grid of clusters, tiles of the render target by slices of view depth, and a
+ * compute pass lists the lights whose sphere of influence touches each cluster.
+ * Fragments then only loop over the lights of their cluster, whose count depends
+ * on how many lights overlap there rather than on how many the scene has.
+ *
+ * Slices are spaced exponentially between the near and far planes, so that
+ * clusters are about as deep as they are wide. Each workgroup of the binning pass
+ * loads lights by chunks into workgroup memory, transformed to view space once
+ * for all the clusters it tests them against, one per invocation, its size being
+ * tuned for the adapter by the WorkgroupTuner.
+ *
+ * Lists are fixed size, MaxLightsPerCluster lights being kept at most per cluster,
+ * those beyond being dropped. The pass only runs when the camera, the target size
+ * or the lights changed, clusters keeping their lists otherwise.
+ */
+class ClusteredLights {
+public:
+	static constexpr uint32_t GridWidth = 16;
+	static constexpr uint32_t GridHeight = 9;
+	static constexpr uint32_t GridDepth = 24;
+	static constexpr uint32_t ClusterCount = GridWidth * GridHeight * GridDepth;
+	static constexpr uint32_t MaxLights = 1024;
+	// The count and the light indices of a cluster filling 256 bytes
+	static constexpr uint32_t MaxLightsPerCluster = 63;
+	// Far over near distance of the slices at most, for projections of reversed Z
+	static constexpr float MaxDepthRatio = 1e4f;
+
+	/**
+	 * The PointLight structure of the shaders, in world space (after the model matrix of the frame)
+	 */
+	struct PointLight {
+		glm::vec<3, float, glm::packed_highp> position = { 0.0f, 0.0f, 0.0f };
+		// Distance at which the light fades out completely
+		float radius = 1.0f;
+		glm::vec<3, float, glm::packed_highp> color = { 1.0f, 1.0f, 1.0f };
+		float intensity = 1.0f;
+	};
+	static_assert(sizeof(PointLight) == 32);
+
+	/**
+	 * The ClusterUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		glm::mat4 viewMatrix = glm::mat4(1.0f);
+		// Diagonal of the projection matrix, from view space to normalized device coordinates
+		glm::vec2 projectionScale = { 1.0f, 1.0f };
+		// In pixels of the render target
+		glm::vec2 tileSize = { 1.0f, 1.0f };
+		glm::vec2 targetSize = { 1.0f, 1.0f };
+		float near = 0.01f;
+		float far = 100.0f;
+		std::array<uint32_t, 3> gridSize = { GridWidth, GridHeight, GridDepth };
+		uint32_t lightCount = 0;
+		// Slice of a view depth d: log(d) * sliceScale + sliceBias
+		float sliceScale = 0.0f;
+		float sliceBias = 0.0f;
+		float padding[2] = {};
+
+		bool operator==(const Uniforms&) const = default;
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+	static_assert(offsetof(Uniforms, gridSize) == 96 && offsetof(Uniforms, sliceScale) == 112);
+
+	ClusteredLights(wgpu::Device device, PipelineCache& pipelineCache, WorkgroupTuner& workgroupTuner);
+	~ClusteredLights();
+
+	ClusteredLights(const ClusteredLights&) = delete;
+	ClusteredLights& operator=(const ClusteredLights&) = delete;
+
+	// Whether the buffers could be created
+	bool valid() const { return mUniformBuffer != nullptr && mLightBuffer != nullptr && mClusterBuffer != nullptr; }
+	// Whether the pipeline is built, before which bin() records nothing
+	bool ready() const { return mBinning->pipeline()->ready(); }
+
+	// Buffers for the fragment shader to read: uniforms, lights and cluster lists, to bind whole
+	wgpu::Buffer uniformBuffer() const { return mUniformBuffer; }
+	wgpu::Buffer lightBuffer() const { return mLightBuffer; }
+	wgpu::Buffer clusterBuffer() const { return mClusterBuffer; }
+
+	// Upload the lights, the first MaxLights of them only
+	void setLights(wgpu::Queue queue, std::span<const PointLight> lights);
+
+	// Fit the clusters to the camera and a target of `targetSize` pixels, uploading the
+	// uniforms if they changed
+	void update(wgpu::Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, glm::uvec2 targetSize);
+
+	// Whether the lists are out of date, after the lights or the uniforms changed
+	bool binningNeeded() const { return mBinningNeeded; }
+
+	// Record the pass listing the lights of each cluster, before the passes reading them, or
+	// return false if the pipeline is not ready yet
+	bool bin(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr);
+
+private:
+	// Record a binning pass with the given pipeline, built with `workgroupSize`
+	void encodeBinning(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites, wgpu::ComputePipeline pipeline, uint32_t workgroupSize) const;
+
+private:
+	WorkgroupTuner& mWorkgroupTuner;
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::Buffer mLightBuffer = nullptr;
+	wgpu::Buffer mClusterBuffer = nullptr;
+	Uniforms mUniforms;
+	bool mBinningNeeded = true;
+
+	// Its pipelines owned by the pipeline cache
+	std::shared_ptr<const WorkgroupTuner::Kernel> mBinning;
+	wgpu::BindGroup mBindGroup = nullptr;
+};
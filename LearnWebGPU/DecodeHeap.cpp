@@ -0,0 +1,307 @@
+#include "DecodeHeap.h"
+#include "MemoryProfiler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace {
+
+// Slabs small buffers are carved from
+constexpr size_t SlabSize = size_t(4) << 20;
+// 4 classes of 16 bytes up to 64, then 4 per power of two up to maxSmallSize
+constexpr size_t SmallClassCount = 4 + 4 * (std::bit_width(DecodeHeap::maxSmallSize) - 7);
+// Large buffers found in the cache may be that much larger than asked for, in quarters
+constexpr size_t LargeSlackQuarters = 1;
+
+struct Pool;
+
+/**
+ * In front of every buffer
+ */
+struct alignas(DecodeHeap::alignment) Header {
+	// Null for large buffers
+	Pool* owner;
+	// Bytes of the buffer, those of its class for small ones
+	size_t capacity;
+};
+
+/**
+ * A released small buffer, in the free list of its class or of the remote frees of its pool
+ */
+struct FreeBuffer {
+	FreeBuffer* next;
+};
+
+/**
+ * Small buffers of a thread
+ */
+struct Pool {
+	std::array<FreeBuffer*, SmallClassCount> freeLists = {};
+	std::byte* slabCursor = nullptr;
+	std::byte* slabEnd = nullptr;
+	// Released by other threads, pushed without lock and taken all at once, still counted as used
+	// until then
+	std::atomic<FreeBuffer*> remoteFrees = nullptr;
+	// Only written by the thread of the pool, without read-modify-writes, and read by statistics()
+	std::atomic<uint64_t> usedBytes = 0;
+	std::atomic<uint64_t> allocationCount = 0;
+	std::atomic<uint64_t> reuseCount = 0;
+};
+
+/**
+ * All the pools, and those of the threads that exited, to be adopted by new ones
+ */
+struct PoolRegistry {
+	std::mutex mutex;
+	std::vector<Pool*> pools;
+	std::vector<Pool*> orphans;
+};
+
+/**
+ * Released large buffers, by capacity
+ */
+struct LargeCache {
+	std::mutex mutex;
+	std::multimap<size_t, Header*> buffers;
+	size_t cachedBytes = 0;
+};
+
+// Never destroyed, for the pools to outlive the threads exiting after main()
+PoolRegistry& registry() {
+	static PoolRegistry* registry = new PoolRegistry();
+	return *registry;
+}
+
+LargeCache& largeCache() {
+	static LargeCache* cache = new LargeCache();
+	return *cache;
+}
+
+/**
+ * The pool of a thread, given to the registry when it exits
+ */
+struct ThreadPool {
+	Pool* pool = nullptr;
+
+	~ThreadPool() {
+		if (!pool) return;
+		std::lock_guard<std::mutex> lock(registry().mutex);
+		registry().orphans.push_back(pool);
+	}
+};
+
+thread_local ThreadPool tThreadPool;
+
+// Counters of the large buffers, and of the memory of both kinds taken from the system
+std::atomic<uint64_t> gLargeUsedBytes = 0;
+std::atomic<uint64_t> gLargeAllocationCount = 0;
+std::atomic<uint64_t> gLargeReuseCount = 0;
+std::atomic<uint64_t> gReservedBytes = 0;
+std::atomic<uint64_t> gPeakReservedBytes = 0;
+
+Pool& threadPool() {
+	if (!tThreadPool.pool) {
+		std::lock_guard<std::mutex> lock(registry().mutex);
+		if (!registry().orphans.empty()) {
+			tThreadPool.pool = registry().orphans.back();
+			registry().orphans.pop_back();
+		}
+		else {
+			tThreadPool.pool = new Pool();
+			registry().pools.push_back(tThreadPool.pool);
+		}
+	}
+	return *tThreadPool.pool;
+}
+
+void* allocateFromSystem(size_t size) {
+	void* memory = ::operator new(size, std::align_val_t(DecodeHeap::alignment), std::nothrow);
+	if (!memory) return nullptr;
+	uint64_t reserved = gReservedBytes.fetch_add(size, std::memory_order_relaxed) + size;
+	uint64_t peak = gPeakReservedBytes.load(std::memory_order_relaxed);
+	while (reserved > peak && !gPeakReservedBytes.compare_exchange_weak(peak, reserved, std::memory_order_relaxed)) {}
+	MemoryProfiler::addExternal(MemorySubsystem::DecodeHeap, static_cast<int64_t>(size));
+	return memory;
+}
+
+void releaseToSystem(void* memory, size_t size) {
+	::operator delete(memory, std::align_val_t(DecodeHeap::alignment));
+	gReservedBytes.fetch_sub(size, std::memory_order_relaxed);
+	MemoryProfiler::addExternal(MemorySubsystem::DecodeHeap, -static_cast<int64_t>(size));
+}
+
+size_t smallClass(size_t size) {
+	if (size <= 64) return (size + 15) / 16 - 1;
+	// 2^k < size <= 2^(k+1), in 4 steps of 2^(k-2)
+	size_t k = std::bit_width(size - 1) - 1;
+	return 4 + 4 * (k - 6) + (size - (size_t(1) << k) - 1) / (size_t(1) << (k - 2));
+}
+
+size_t smallClassSize(size_t sizeClass) {
+	if (sizeClass < 4) return 16 * (sizeClass + 1);
+	size_t k = 6 + (sizeClass - 4) / 4;
+	return (size_t(1) << k) + ((sizeClass - 4) % 4 + 1) * (size_t(1) << (k - 2));
+}
+
+Header* header(void* buffer) {
+	return reinterpret_cast<Header*>(static_cast<std::byte*>(buffer) - sizeof(Header));
+}
+
+// Add to a counter of the calling thread's pool
+void increase(std::atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void countLargeAllocation(size_t capacity, bool reused) {
+	gLargeUsedBytes.fetch_add(capacity, std::memory_order_relaxed);
+	gLargeAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (reused) gLargeReuseCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Called by the thread of the pool
+void pushFree(Pool& pool, void* buffer) {
+	size_t capacity = header(buffer)->capacity;
+	increase(pool.usedBytes, 0 - uint64_t(capacity));
+	size_t sizeClass = smallClass(capacity);
+	FreeBuffer* freeBuffer = static_cast<FreeBuffer*>(buffer);
+	freeBuffer->next = pool.freeLists[sizeClass];
+	pool.freeLists[sizeClass] = freeBuffer;
+}
+
+void* allocateSmall(size_t size) {
+	Pool& pool = threadPool();
+	if (pool.remoteFrees.load(std::memory_order_relaxed)) {
+		FreeBuffer* remote = pool.remoteFrees.exchange(nullptr, std::memory_order_acquire);
+		while (remote) {
+			FreeBuffer* next = remote->next;
+			pushFree(pool, remote);
+			remote = next;
+		}
+	}
+
+	size_t sizeClass = smallClass(size);
+	size_t capacity = smallClassSize(sizeClass);
+	increase(pool.allocationCount, 1);
+	if (FreeBuffer* freeBuffer = pool.freeLists[sizeClass]) {
+		pool.freeLists[sizeClass] = freeBuffer->next;
+		increase(pool.usedBytes, capacity);
+		increase(pool.reuseCount, 1);
+		return freeBuffer;
+	}
+
+	// The rest of a slab too short for the buffer is lost
+	size_t blockSize = sizeof(Header) + capacity;
+	if (static_cast<size_t>(pool.slabEnd - pool.slabCursor) < blockSize) {
+		auto* slab = static_cast<std::byte*>(allocateFromSystem(SlabSize));
+		if (!slab) return nullptr;
+		pool.slabCursor = slab;
+		pool.slabEnd = slab + SlabSize;
+	}
+	Header* block = reinterpret_cast<Header*>(pool.slabCursor);
+	pool.slabCursor += blockSize;
+	block->owner = &pool;
+	block->capacity = capacity;
+	increase(pool.usedBytes, capacity);
+	return block + 1;
+}
+
+void* allocateLarge(size_t size) {
+	size_t capacity = (size + DecodeHeap::largeGranularity - 1) / DecodeHeap::largeGranularity * DecodeHeap::largeGranularity;
+	LargeCache& cache = largeCache();
+	{
+		std::lock_guard<std::mutex> lock(cache.mutex);
+		auto it = cache.buffers.lower_bound(capacity);
+		if (it != cache.buffers.end() && it->first <= capacity + capacity / 4 * LargeSlackQuarters) {
+			Header* block = it->second;
+			cache.cachedBytes -= it->first;
+			cache.buffers.erase(it);
+			countLargeAllocation(block->capacity, true);
+			return block + 1;
+		}
+	}
+
+	Header* block = static_cast<Header*>(allocateFromSystem(sizeof(Header) + capacity));
+	if (!block) return nullptr;
+	block->owner = nullptr;
+	block->capacity = capacity;
+	countLargeAllocation(capacity, false);
+	return block + 1;
+}
+
+void releaseLarge(Header* block) {
+	gLargeUsedBytes.fetch_sub(block->capacity, std::memory_order_relaxed);
+	LargeCache& cache = largeCache();
+	{
+		std::lock_guard<std::mutex> lock(cache.mutex);
+		if (cache.cachedBytes + block->capacity <= DecodeHeap::largeCacheBytes) {
+			cache.cachedBytes += block->capacity;
+			cache.buffers.emplace(block->capacity, block);
+			return;
+		}
+	}
+	releaseToSystem(block, sizeof(Header) + block->capacity);
+}
+
+} // anonymous namespace
+
+void* DecodeHeap::allocate(size_t size) {
+	if (size == 0 || size > std::numeric_limits<size_t>::max() - sizeof(Header) - largeGranularity) return nullptr;
+	return size <= maxSmallSize ? allocateSmall(size) : allocateLarge(size);
+}
+
+void* DecodeHeap::reallocate(void* buffer, size_t size) {
+	if (!buffer) return allocate(size);
+	if (size == 0) {
+		release(buffer);
+		return nullptr;
+	}
+	size_t capacity = header(buffer)->capacity;
+	if (size <= capacity) return buffer;
+	void* moved = allocate(size);
+	if (!moved) return nullptr;
+	std::memcpy(moved, buffer, capacity);
+	release(buffer);
+	return moved;
+}
+
+void DecodeHeap::release(void* buffer) {
+	if (!buffer) return;
+	Header* block = header(buffer);
+	if (!block->owner) {
+		releaseLarge(block);
+		return;
+	}
+
+	if (block->owner == tThreadPool.pool) {
+		pushFree(*block->owner, buffer);
+		return;
+	}
+	FreeBuffer* freeBuffer = static_cast<FreeBuffer*>(buffer);
+	freeBuffer->next = block->owner->remoteFrees.load(std::memory_order_relaxed);
+	while (!block->owner->remoteFrees.compare_exchange_weak(freeBuffer->next, freeBuffer, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+DecodeHeap::Statistics DecodeHeap::statistics() {
+	Statistics statistics;
+	statistics.usedBytes = gLargeUsedBytes.load(std::memory_order_relaxed);
+	statistics.reservedBytes = gReservedBytes.load(std::memory_order_relaxed);
+	statistics.peakReservedBytes = gPeakReservedBytes.load(std::memory_order_relaxed);
+	statistics.allocationCount = gLargeAllocationCount.load(std::memory_order_relaxed);
+	statistics.reuseCount = gLargeReuseCount.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(registry().mutex);
+	for (const Pool* pool : registry().pools) {
+		statistics.usedBytes += pool->usedBytes.load(std::memory_order_relaxed);
+		statistics.allocationCount += pool->allocationCount.load(std::memory_order_relaxed);
+		statistics.reuseCount += pool->reuseCount.load(std::memory_order_relaxed);
+	}
+	return statistics;
+}
+
+void DecodeHeap::resetPeak() {
+	gPeakReservedBytes.store(gReservedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <limits>
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Allocator of the transient buffers of image and geometry decoding: those of
+ * stb_image (see implementations.cpp) and the other image decoders, and the
+ * scratch arrays of the geometry parsers, so that bulk loads neither go through
+ * malloc for each of them nor fragment the heap the rest of the program uses.
+ *
+ * Each thread allocates from a pool of its own, without locking. Buffers of up to
+ * maxSmallSize bytes come in size classes, 4 per power of two, carved from slabs
+ * and kept in a free list per class once released, for the next decode to reuse.
+ * Larger ones are rounded up to largeGranularity and, once released, kept in a
+ * cache shared by all threads, up to largeCacheBytes, where the next decode of a
+ * similar size finds them with their pages already faulted in.
+ *
+ * Buffers may be released by any thread, e.g. pixels by the thread that uploads
+ * them: those of another thread's pool go back to it through a lock-free list it
+ * drains on its next allocation. Pools outlive their threads, a later thread
+ * adopting them, and slabs are never given back to the system.
+ */
+class DecodeHeap {
+public:
+	static constexpr size_t maxSmallSize = 64 * 1024;
+	static constexpr size_t largeGranularity = 64 * 1024;
+	static constexpr size_t largeCacheBytes = size_t(256) << 20;
+	// Of every buffer
+	static constexpr size_t alignment = 16;
+
+	/**
+	 * Counters of all the threads, each pool's being read without stopping its thread
+	 */
+	struct Statistics {
+		// Bytes of the buffers not released yet, rounded up to their class
+		uint64_t usedBytes = 0;
+		// Bytes taken from the system, in slabs and large buffers, used or cached
+		uint64_t reservedBytes = 0;
+		// Largest reservedBytes since the start or resetPeak(), which is what decoding cost in
+		// memory at most
+		uint64_t peakReservedBytes = 0;
+		uint64_t allocationCount = 0;
+		// Allocations served by a buffer released before
+		uint64_t reuseCount = 0;
+	};
+
+	// Uninitialized memory, or null if `size` is 0 or it could not be allocated
+	static void* allocate(size_t size);
+
+	// Same as realloc(), the buffer staying in place when it has room for `size` bytes
+	static void* reallocate(void* buffer, size_t size);
+
+	// Release a buffer returned by allocate() or reallocate(), from any thread. Null is ignored.
+	static void release(void* buffer);
+
+	static Statistics statistics();
+
+	// Measure the peak from what is reserved now on, e.g. at the start of a bulk load
+	static void resetPeak();
+};
+
+/**
+ * Standard allocator handing out memory of the DecodeHeap, for the scratch
+ * containers of decoders (see DecodeVector)
+ */
+template <typename T>
+class DecodeAllocator {
+public:
+	using value_type = T;
+
+	DecodeAllocator() = default;
+
+	template <typename U>
+	DecodeAllocator(const DecodeAllocator<U>&) {}
+
+	T* allocate(size_t count) {
+		static_assert(alignof(T) <= DecodeHeap::alignment);
+		void* buffer = count <= std::numeric_limits<size_t>::max() / sizeof(T) ? DecodeHeap::allocate(count * sizeof(T)) : nullptr;
+		if (!buffer) throw std::bad_alloc();
+		return static_cast<T*>(buffer);
+	}
+
+	void deallocate(T* buffer, size_t) { DecodeHeap::release(buffer); }
+
+	template <typename U>
+	bool operator==(const DecodeAllocator<U>&) const { return true; }
+};
+
+template <typename T>
+using DecodeVector = std::vector<T, DecodeAllocator<T>>;
@@ -0,0 +1,144 @@
+#include "DeferredShading.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+
+#include <glm/ext.hpp>
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+using namespace wgpu;
+
+DeferredShading::DeferredShading(Device device, PipelineCache& pipelineCache)
+	: mDevice(device)
+	, mPipelineCache(&pipelineCache)
+{
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Deferred shading uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "DeferredShading");
+	if (!mUniformBuffer) return;
+	GpuHandle<Queue>(device.getQueue())->writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+
+	// Uniforms, the normals, the albedo and the depths read, then the scene written, at the
+	// bindings of resources/shader.wgsl
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(5, Default);
+	for (uint32_t i = 0; i < bindingLayoutEntries.size(); ++i) {
+		bindingLayoutEntries[i].binding = 2 + i;
+		bindingLayoutEntries[i].visibility = ShaderStage::Compute;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::Uint;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[2].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[3].texture.sampleType = TextureSampleType::Depth;
+	bindingLayoutEntries[3].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[4].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[4].storageTexture.format = SceneFormat;
+	bindingLayoutEntries[4].storageTexture.viewDimension = TextureViewDimension::_2D;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	bindGroupLayoutDesc.entryCount = 0;
+	bindGroupLayoutDesc.entries = nullptr;
+	mEmptyLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mEmptyLayout;
+	bindGroupDesc.entryCount = 0;
+	bindGroupDesc.entries = nullptr;
+	mEmptyBindGroup = device.createBindGroup(bindGroupDesc);
+}
+
+DeferredShading::~DeferredShading() {
+	if (mBindGroup) mBindGroup.release();
+	if (mEmptyBindGroup) mEmptyBindGroup.release();
+	if (mUniformBuffer) {
+		destroyTracked(mUniformBuffer);
+		mUniformBuffer.release();
+	}
+}
+
+PipelineCache::AsyncComputePipeline DeferredShading::createPipeline(ShaderModule shaderModule, BindGroupLayout frameLayout, BindGroupLayout viewLayout) {
+	// Those of the material and draw groups are not bound, though their slots come first
+	std::array<BindGroupLayout, BindGroupIndex + 1> layouts = { frameLayout, viewLayout, mEmptyLayout, mEmptyLayout, mBindGroupLayout };
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = (uint32_t)layouts.size();
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)layouts.data();
+	ComputePipelineDescriptor computePipelineDesc{};
+	computePipelineDesc.layout = mPipelineCache->pipelineLayout(layoutDesc);
+	computePipelineDesc.compute.module = shaderModule;
+	computePipelineDesc.compute.entryPoint = "cs_lighting";
+	computePipelineDesc.compute.constantCount = 0;
+	computePipelineDesc.compute.constants = nullptr;
+	return mPipelineCache->computePipelineAsync(computePipelineDesc);
+}
+
+void DeferredShading::update(Queue queue, const glm::mat4& projection, const glm::mat4& view, const glm::uvec2& sceneSize, const glm::vec4& background) {
+	Uniforms uniforms{};
+	uniforms.inverseProjection = glm::inverse(projection);
+	uniforms.inverseView = glm::inverse(view);
+	uniforms.background = background;
+	uniforms.sceneSize = glm::max(sceneSize, glm::uvec2(1));
+	if (std::memcmp(&uniforms, &mUniforms, sizeof(Uniforms)) == 0) return;
+	mUniforms = uniforms;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+bool DeferredShading::encode(
+	CommandEncoder encoder,
+	TextureView normalView, TextureView albedoView, TextureView depthView, TextureView sceneView,
+	BindGroup frameBindGroup, uint32_t frameOffset, BindGroup viewBindGroup, uint32_t viewOffset,
+	const ComputePassTimestampWrites* timestampWrites
+) {
+	if (!ready()) return false;
+
+	// Transient targets usually come back from the pool as the same textures
+	if (normalView != mNormalView || albedoView != mAlbedoView || depthView != mDepthView || sceneView != mSceneView) {
+		if (mBindGroup) mBindGroup.release();
+		std::vector<BindGroupEntry> bindings(5);
+		bindings[0].binding = 2;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(Uniforms);
+		bindings[1].binding = 3;
+		bindings[1].textureView = normalView;
+		bindings[2].binding = 4;
+		bindings[2].textureView = albedoView;
+		bindings[3].binding = 5;
+		bindings[3].textureView = depthView;
+		bindings[4].binding = 6;
+		bindings[4].textureView = sceneView;
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mBindGroup = mDevice.createBindGroup(bindGroupDesc);
+		mNormalView = normalView;
+		mAlbedoView = albedoView;
+		mDepthView = depthView;
+		mSceneView = sceneView;
+	}
+
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Deferred lighting";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mPipeline->pipeline);
+	computePass.setBindGroup(0, frameBindGroup, 1, &frameOffset);
+	computePass.setBindGroup(1, viewBindGroup, 1, &viewOffset);
+	computePass.setBindGroup(2, mEmptyBindGroup, 0, nullptr);
+	computePass.setBindGroup(3, mEmptyBindGroup, 0, nullptr);
+	computePass.setBindGroup(BindGroupIndex, mBindGroup, 0, nullptr);
+	const glm::uvec2& size = mUniforms.sceneSize;
+	computePass.dispatchWorkgroups((size.x + TileSize - 1) / TileSize, (size.y + TileSize - 1) / TileSize, 1);
+	computePass.end();
+	computePass.release();
+	return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+
+#include <cstdint>
+
+/**
+ * Deferred shading of the opaque scene, the alternative to shading its fragments
+ * as they are drawn: the main pass only writes a G-buffer, which a compute pass
+ * then lights once per pixel, whatever the overdraw. The G-buffer is kept as small
+ * as it goes, 8 bytes per pixel on top of the depth buffer, from which positions
+ * are reconstructed rather than stored:
+ *  - the world space normal, octahedral encoded on 16 bits per coordinate (NormalFormat)
+ *  - the base color through an sRGB target, with roughness and metalness on 4 bits
+ *    each in its alpha (AlbedoFormat)
+ *
+ * The lighting pass goes by tiles of TileSize x TileSize pixels, each workgroup
+ * bounding the depths of its tile, then listing the point lights reaching the box
+ * around them, which its pixels then loop over, rather than those of the clusters
+ * of ClusteredLights. Its pixels are shaded by the functions of resources/shader.wgsl
+ * that shade fragments in forward mode, with DEFERRED_LIGHTING, and written to the
+ * scene as a storage texture, which must then be of SceneFormat.
+ *
+ * The kernel is the caller's, built from its variant of the source by
+ * createPipeline(), and binds the frame and view groups of the draws, then
+ * bindGroupLayout() as group `BindGroupIndex`. Whether the G-buffer pays off depends
+ * on the overdraw and lights of the scene against the bandwidth of the GPU, which
+ * gbufferBytes() tells for a size, to pick forward or deferred per deployment.
+ */
+class DeferredShading {
+public:
+	static constexpr wgpu::TextureFormat NormalFormat = wgpu::TextureFormat::RG16Uint;
+	static constexpr wgpu::TextureFormat AlbedoFormat = wgpu::TextureFormat::RGBA8UnormSrgb;
+	// The lighting pass writes the scene as storage, which packed floats cannot be
+	static constexpr wgpu::TextureFormat SceneFormat = wgpu::TextureFormat::RGBA16Float;
+	// After the groups of the draws, shared with TextureFeedback in another variant
+	static constexpr uint32_t BindGroupIndex = 4;
+	static constexpr uint32_t TileSize = 16;
+	// Of NormalFormat and AlbedoFormat
+	static constexpr uint32_t BytesPerPixel = 8;
+
+	/**
+	 * The DeferredUniforms structure of the shader
+	 */
+	struct Uniforms {
+		glm::mat4 inverseProjection;
+		glm::mat4 inverseView;
+		glm::vec4 background;
+		glm::uvec2 sceneSize;
+		uint32_t _pad[2];
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	DeferredShading(wgpu::Device device, PipelineCache& pipelineCache);
+	~DeferredShading();
+
+	DeferredShading(const DeferredShading&) = delete;
+	DeferredShading& operator=(const DeferredShading&) = delete;
+
+	bool valid() const { return mUniformBuffer != nullptr; }
+	// Whether the lighting kernel is built, before which encode() records nothing
+	bool ready() const { return mPipeline && mPipeline->ready(); }
+
+	wgpu::BindGroupLayout bindGroupLayout() const { return mBindGroupLayout; }
+
+	// Build the kernel cs_lighting of `shaderModule`, binding the frame and view groups of
+	// the draws at their slots 0 and 1, which does not replace the current one until setPipeline()
+	PipelineCache::AsyncComputePipeline createPipeline(wgpu::ShaderModule shaderModule, wgpu::BindGroupLayout frameLayout, wgpu::BindGroupLayout viewLayout);
+	void setPipeline(PipelineCache::AsyncComputePipeline pipeline) { mPipeline = pipeline; }
+
+	// Bytes the G-buffer passes move per frame at `sceneSize`, written once and read once
+	static uint64_t gbufferBytes(const glm::uvec2& sceneSize) { return uint64_t(sceneSize.x) * sceneSize.y * BytesPerPixel * 2; }
+
+	// Matrices of the frame, unjittered, and region of the scene, with the color of its pixels
+	// that no opaque surface covers
+	void update(wgpu::Queue queue, const glm::mat4& projection, const glm::mat4& view, const glm::uvec2& sceneSize, const glm::vec4& background);
+	// Light the scene region of `sceneView` from the G-buffer and the depths of the frame, or
+	// return false if not ready
+	bool encode(
+		wgpu::CommandEncoder encoder,
+		wgpu::TextureView normalView, wgpu::TextureView albedoView, wgpu::TextureView depthView, wgpu::TextureView sceneView,
+		wgpu::BindGroup frameBindGroup, uint32_t frameOffset, wgpu::BindGroup viewBindGroup, uint32_t viewOffset,
+		const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr
+	);
+
+private:
+	wgpu::Device mDevice;
+	// Owned by the pipeline cache, the empty one standing for the groups of the draws the
+	// kernel does not bind
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	wgpu::BindGroupLayout mEmptyLayout = nullptr;
+	wgpu::BindGroup mEmptyBindGroup = nullptr;
+	PipelineCache* mPipelineCache = nullptr;
+	PipelineCache::AsyncComputePipeline mPipeline;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	Uniforms mUniforms{};
+
+	// Of the last encode(), which keep the bind group valid
+	wgpu::TextureView mNormalView = nullptr;
+	wgpu::TextureView mAlbedoView = nullptr;
+	wgpu::TextureView mDepthView = nullptr;
+	wgpu::TextureView mSceneView = nullptr;
+	wgpu::BindGroup mBindGroup = nullptr;
+};
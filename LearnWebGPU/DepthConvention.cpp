@@ -0,0 +1,36 @@
+#include "DepthConvention.h"
+
+#include <glm/ext.hpp>
+
+#include <cmath>
+#include <limits>
+
+using namespace wgpu;
+
+CompareFunction DepthConvention::nearer(bool orEqual) const {
+	if (reversed) return orEqual ? CompareFunction::GreaterEqual : CompareFunction::Greater;
+	return orEqual ? CompareFunction::LessEqual : CompareFunction::Less;
+}
+
+glm::mat4 DepthConvention::perspective(float fovy, float aspect, float near, float far) const {
+	if (!reversed) return glm::perspective(fovy, aspect, near, far);
+
+	// z / w = near / -zv for a view depth -zv, 1 at the near plane and 0 at infinity
+	float focal = 1.0f / std::tan(0.5f * fovy);
+	glm::mat4 projection(0.0f);
+	projection[0][0] = focal / aspect;
+	projection[1][1] = focal;
+	projection[2][3] = -1.0f;
+	projection[3][2] = near;
+	return projection;
+}
+
+glm::vec2 DepthConvention::clipPlanes(const glm::mat4& projectionMatrix) {
+	// z / w = (a * zv + b) / -zv, b being negative when depths increase with distance and
+	// positive when they decrease
+	float a = projectionMatrix[2][2];
+	float b = projectionMatrix[3][2];
+	if (b < 0.0f) return { b / a, b / (a + 1.0f) };
+	float far = a != 0.0f ? b / a : std::numeric_limits<float>::infinity();
+	return { b / (a + 1.0f), far };
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+/**
+ * How the depth buffer of the scene maps distances to depths, which every pass
+ * testing against it or writing to it must agree on.
+ *
+ * By default depths go from 0 at the near plane to 1 at the far plane, in a
+ * Depth24Plus buffer. With reversed Z they go from 1 at the near plane to 0 at
+ * infinity, in a Depth32Float buffer: floats get denser towards 0 about as fast
+ * as the perspective divide crowds far depths there, so precision stays even
+ * over distance, and there is no far plane to clip the scene.
+ *
+ * Shadow maps and other depth buffers of their own projection are not concerned.
+ */
+struct DepthConvention {
+	bool reversed = false;
+
+	wgpu::TextureFormat format() const { return reversed ? wgpu::TextureFormat::Depth32Float : wgpu::TextureFormat::Depth24Plus; }
+	// Depth of the near plane, and of the far one, which depth buffers are cleared to
+	float nearDepth() const { return reversed ? 1.0f : 0.0f; }
+	float farDepth() const { return reversed ? 0.0f : 1.0f; }
+	// Passing fragments nearer than the depth buffer, and those as near with `orEqual`
+	wgpu::CompareFunction nearer(bool orEqual = false) const;
+
+	// Perspective projection of vertical field of view `fovy` (in radians), whose far plane
+	// is only used without reversed Z
+	glm::mat4 perspective(float fovy, float aspect, float near, float far) const;
+
+	// Distances to the near and far planes of a perspective projection of either convention,
+	// the far one being infinite for an infinite reversed projection
+	static glm::vec2 clipPlanes(const glm::mat4& projectionMatrix);
+};
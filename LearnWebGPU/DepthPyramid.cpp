@@ -0,0 +1,217 @@
+#include "DepthPyramid.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+
+using namespace wgpu;
+
+namespace {
+
+const char* depthPyramidShaderSource = R"(
+@group(0) @binding(0) var depthTexture: texture_depth_2d;
+@group(0) @binding(1) var previousLevel: texture_2d<f32>;
+@group(0) @binding(2) var nextLevel: texture_storage_2d<r32float, write>;
+@group(0) @binding(3) var multisampledDepthTexture: texture_depth_multisampled_2d;
+
+// Whether depths decrease with distance, see DepthConvention.h
+override reversedZ: bool = false;
+
+fn farther(a: f32, b: f32) -> f32 {
+	return select(max(a, b), min(a, b), reversedZ);
+}
+
+// Farthest depth of the 2x2 texels of the previous level below texel id, the last texel of
+// a level with an odd size only covering 1 of them
+@compute @workgroup_size(8, 8)
+fn reduceDepth(@builtin(global_invocation_id) id: vec3u) {
+	let size = textureDimensions(nextLevel);
+	if (id.x >= size.x || id.y >= size.y) {
+		return;
+	}
+	let previousSize = textureDimensions(depthTexture);
+	let p00 = 2u * id.xy;
+	let p11 = min(p00 + 1u, previousSize - 1u);
+	let depth = farther(
+		farther(textureLoad(depthTexture, p00, 0), textureLoad(depthTexture, vec2u(p11.x, p00.y), 0)),
+		farther(textureLoad(depthTexture, vec2u(p00.x, p11.y), 0), textureLoad(depthTexture, p11, 0))
+	);
+	textureStore(nextLevel, id.xy, vec4f(depth, 0.0, 0.0, 1.0));
+}
+
+// Farthest of the samples of a texel, for the test to remain conservative at edges
+fn farthestSample(p: vec2u) -> f32 {
+	var depth = textureLoad(multisampledDepthTexture, p, 0);
+	for (var i = 1u; i < textureNumSamples(multisampledDepthTexture); i++) {
+		depth = farther(depth, textureLoad(multisampledDepthTexture, p, i));
+	}
+	return depth;
+}
+
+// Same as reduceDepth, from all the samples of a multisampled depth texture
+@compute @workgroup_size(8, 8)
+fn reduceMultisampledDepth(@builtin(global_invocation_id) id: vec3u) {
+	let size = textureDimensions(nextLevel);
+	if (id.x >= size.x || id.y >= size.y) {
+		return;
+	}
+	let previousSize = textureDimensions(multisampledDepthTexture);
+	let p00 = 2u * id.xy;
+	let p11 = min(p00 + 1u, previousSize - 1u);
+	let depth = farther(
+		farther(farthestSample(p00), farthestSample(vec2u(p11.x, p00.y))),
+		farther(farthestSample(vec2u(p00.x, p11.y)), farthestSample(p11))
+	);
+	textureStore(nextLevel, id.xy, vec4f(depth, 0.0, 0.0, 1.0));
+}
+
+@compute @workgroup_size(8, 8)
+fn reduceLevel(@builtin(global_invocation_id) id: vec3u) {
+	let size = textureDimensions(nextLevel);
+	if (id.x >= size.x || id.y >= size.y) {
+		return;
+	}
+	let previousSize = textureDimensions(previousLevel);
+	let p00 = 2u * id.xy;
+	let p11 = min(p00 + 1u, previousSize - 1u);
+	let depth = farther(
+		farther(textureLoad(previousLevel, p00, 0).r, textureLoad(previousLevel, vec2u(p11.x, p00.y), 0).r),
+		farther(textureLoad(previousLevel, vec2u(p00.x, p11.y), 0).r, textureLoad(previousLevel, p11, 0).r)
+	);
+	textureStore(nextLevel, id.xy, vec4f(depth, 0.0, 0.0, 1.0));
+}
+)";
+
+// Size of the next level, rounded up so that no texel of the previous one is dropped
+uint32_t nextLevelSize(uint32_t size) {
+	return std::max<uint32_t>((size + 1) / 2, 1);
+}
+
+} // anonymous namespace
+
+DepthPyramid::DepthPyramid(Device device, PipelineCache& pipelineCache, TextureView depthTextureView, uint32_t width, uint32_t height, uint32_t sampleCount, DepthConvention depthConvention) {
+	// Levels down to 1x1
+	Extent3D levelSize = { nextLevelSize(width), nextLevelSize(height), 1 };
+	mLevelSizes.push_back(levelSize);
+	while (levelSize.width > 1 || levelSize.height > 1) {
+		levelSize.width = nextLevelSize(levelSize.width);
+		levelSize.height = nextLevelSize(levelSize.height);
+		mLevelSizes.push_back(levelSize);
+	}
+
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Depth pyramid";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = TextureFormat::R32Float;
+	textureDesc.mipLevelCount = static_cast<uint32_t>(mLevelSizes.size());
+	textureDesc.sampleCount = 1;
+	textureDesc.size = mLevelSizes[0];
+	textureDesc.usage = TextureUsage::StorageBinding | TextureUsage::TextureBinding;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::RenderTargets, "DepthPyramid");
+
+	TextureViewDescriptor viewDesc{};
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = textureDesc.mipLevelCount;
+	viewDesc.dimension = TextureViewDimension::_2D;
+	viewDesc.format = TextureFormat::R32Float;
+	mView = mTexture.createView(viewDesc);
+	viewDesc.mipLevelCount = 1;
+	for (uint32_t level = 0; level < textureDesc.mipLevelCount; ++level) {
+		viewDesc.baseMipLevel = level;
+		mLevelViews.push_back(mTexture.createView(viewDesc));
+	}
+
+	// The first pass reads the depth texture, the next ones the level before theirs
+	ShaderModule shaderModule = pipelineCache.shaderModule(depthPyramidShaderSource);
+
+	bool multisampled = sampleCount > 1;
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(2, Default);
+	bindingLayoutEntries[0].binding = multisampled ? 3 : 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].texture.sampleType = TextureSampleType::Depth;
+	bindingLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[0].texture.multisampled = multisampled;
+	bindingLayoutEntries[1].binding = 2;
+	bindingLayoutEntries[1].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[1].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[1].storageTexture.format = TextureFormat::R32Float;
+	bindingLayoutEntries[1].storageTexture.viewDimension = TextureViewDimension::_2D;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	BindGroupLayout depthBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	bindingLayoutEntries[0] = Default;
+	bindingLayoutEntries[0].binding = 1;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	BindGroupLayout levelBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.compute.module = shaderModule;
+	ConstantEntry reversedZConstant{};
+	reversedZConstant.key = "reversedZ";
+	reversedZConstant.value = depthConvention.reversed ? 1.0 : 0.0;
+	pipelineDesc.compute.constantCount = 1;
+	pipelineDesc.compute.constants = &reversedZConstant;
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&depthBindGroupLayout;
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.entryPoint = multisampled ? "reduceMultisampledDepth" : "reduceDepth";
+	mDepthReductionPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&levelBindGroupLayout;
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.entryPoint = "reduceLevel";
+	mLevelReductionPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+
+	for (uint32_t level = 0; level < mLevelViews.size(); ++level) {
+		std::vector<BindGroupEntry> bindings(2);
+		bindings[0].binding = level > 0 ? 1 : multisampled ? 3 : 0;
+		bindings[0].textureView = level == 0 ? depthTextureView : mLevelViews[level - 1];
+		bindings[1].binding = 2;
+		bindings[1].textureView = mLevelViews[level];
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = level == 0 ? depthBindGroupLayout : levelBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mBindGroups.push_back(device.createBindGroup(bindGroupDesc));
+	}
+}
+
+DepthPyramid::~DepthPyramid() {
+	for (BindGroup& bindGroup : mBindGroups) {
+		bindGroup.release();
+	}
+	for (TextureView& view : mLevelViews) {
+		view.release();
+	}
+	mView.release();
+	// Kept for the frames in flight while the window is resized
+	retireTracked(mTexture);
+}
+
+bool DepthPyramid::build(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites) {
+	if (!ready()) return false;
+
+	// Each dispatch reads what the previous one wrote, which WebGPU synchronizes
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Depth pyramid";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	for (uint32_t level = 0; level < mLevelViews.size(); ++level) {
+		computePass.setPipeline(level == 0 ? mDepthReductionPipeline->pipeline : mLevelReductionPipeline->pipeline);
+		computePass.setBindGroup(0, mBindGroups[level], 0, nullptr);
+		computePass.dispatchWorkgroups((mLevelSizes[level].width + 7) / 8, (mLevelSizes[level].height + 7) / 8, 1);
+	}
+	computePass.end();
+	computePass.release();
+	return true;
+}
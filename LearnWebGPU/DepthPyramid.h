@@ -0,0 +1,61 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+#include "DepthConvention.h"
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * A hierarchical depth buffer (Hi-Z): an R32Float mip chain where each texel
+ * holds the farthest depth of the texels it covers in the level below, level 0
+ * being half the size of the depth buffer. Testing the nearest depth of a
+ * bounding box against the few texels of the level that covers it tells
+ * whether the box is hidden behind what was drawn.
+ *
+ * Levels are ceil(size / 2) of the previous one, so that texel j of level l
+ * covers depth texels [j * 2^(l+1), (j+1) * 2^(l+1)) exactly.
+ *
+ * The depth texture must have the TextureBinding usage. Farthest depths are the
+ * largest ones, or the smallest with reversed Z. A multisampled depth texture is
+ * reduced from all its samples.
+ */
+class DepthPyramid {
+public:
+	// Pyramid of a depth texture of `width` x `height` texels of `sampleCount` samples
+	DepthPyramid(
+		wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureView depthTextureView, uint32_t width, uint32_t height,
+		uint32_t sampleCount = 1, DepthConvention depthConvention = {}
+	);
+	~DepthPyramid();
+
+	DepthPyramid(const DepthPyramid&) = delete;
+	DepthPyramid& operator=(const DepthPyramid&) = delete;
+
+	// All levels, to bind as a texture_2d<f32> with an UnfilterableFloat sample type
+	wgpu::TextureView view() const { return mView; }
+	wgpu::Texture texture() const { return mTexture; }
+	uint32_t mipLevelCount() const { return static_cast<uint32_t>(mLevelViews.size()); }
+
+	// Whether the pipelines are built, before which build() records nothing
+	bool ready() const { return mDepthReductionPipeline->ready() && mLevelReductionPipeline->ready(); }
+
+	// Record the passes reducing the current content of the depth texture into the levels,
+	// or return false if the pipelines are not ready yet
+	bool build(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr);
+
+private:
+	wgpu::Texture mTexture = nullptr;
+	wgpu::TextureView mView = nullptr;
+	// Storage views of each level
+	std::vector<wgpu::TextureView> mLevelViews;
+	std::vector<wgpu::Extent3D> mLevelSizes;
+
+	// Owned by the pipeline cache
+	PipelineCache::AsyncComputePipeline mDepthReductionPipeline;
+	PipelineCache::AsyncComputePipeline mLevelReductionPipeline;
+	// Level 0 reads the depth texture, level l reads level l - 1
+	std::vector<wgpu::BindGroup> mBindGroups;
+};
@@ -0,0 +1,159 @@
+#include "DeviceEvents.h"
+#include "LockFree.h"
+#include "Trace.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif // __EMSCRIPTEN__
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// Only wgpu-native may be polled from another thread than the one using the device
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+#define DEVICE_EVENTS_PUMP
+#endif
+
+// The pump also wakes up that often without being notified, so that a forgotten notify()
+// only delays completions
+constexpr std::chrono::milliseconds IdleTimeout{ 50 };
+
+struct State {
+	// Deferred callbacks waiting for dispatch(), posted by the pump without holding up the
+	// frame thread dispatching them
+	MpscMailbox<std::function<void()>, 256> completions;
+
+	std::mutex mutex;
+	std::condition_variable completed;
+
+	std::thread pump;
+	bool notified = false;
+	bool stopping = false;
+	std::condition_variable wakeUp;
+
+	// Added by addDevice(), only used from the thread calling dispatch()
+	std::vector<Device> otherDevices;
+};
+
+State& state() {
+	static State s;
+	return s;
+}
+
+bool pumping() {
+	State& s = state();
+	std::lock_guard lock(s.mutex);
+	return s.pump.joinable();
+}
+
+[[maybe_unused]] void pump(Device device) {
+	State& s = state();
+	for (;;) {
+		{
+			std::unique_lock lock(s.mutex);
+			s.wakeUp.wait_for(lock, IdleTimeout, [&s] { return s.notified || s.stopping; });
+			if (s.stopping) return;
+			s.notified = false;
+		}
+		// Returns once the work submitted so far is done, its callbacks having run
+		device.poll(true);
+	}
+}
+
+} // anonymous namespace
+
+void DeviceEvents::start([[maybe_unused]] Device device) {
+#ifdef DEVICE_EVENTS_PUMP
+	State& s = state();
+	std::lock_guard lock(s.mutex);
+	if (s.pump.joinable()) return;
+	s.notified = false;
+	s.stopping = false;
+	s.pump = std::thread(pump, device);
+#endif // DEVICE_EVENTS_PUMP
+}
+
+void DeviceEvents::stop() {
+	State& s = state();
+	std::thread pump;
+	{
+		std::lock_guard lock(s.mutex);
+		s.stopping = true;
+		pump = std::move(s.pump);
+	}
+	s.wakeUp.notify_one();
+	if (pump.joinable()) pump.join();
+}
+
+void DeviceEvents::notify() {
+	State& s = state();
+	{
+		std::lock_guard lock(s.mutex);
+		s.notified = true;
+	}
+	s.wakeUp.notify_one();
+}
+
+void DeviceEvents::addDevice(Device device) {
+	state().otherDevices.push_back(device);
+}
+
+void DeviceEvents::removeDevice(Device device) {
+	std::erase_if(state().otherDevices, [device](Device other) { return (WGPUDevice)other == (WGPUDevice)device; });
+}
+
+void DeviceEvents::post(std::function<void()> work) {
+	State& s = state();
+	s.completions.push(std::move(work));
+	// Through the mutex, so that a wait() between testing the completions and sleeping does not
+	// miss the notification
+	{
+		std::lock_guard lock(s.mutex);
+	}
+	s.completed.notify_all();
+}
+
+void DeviceEvents::dispatch([[maybe_unused]] Device device) {
+	TRACE_SCOPE("Dispatch device events");
+	State& s = state();
+#if defined(WEBGPU_BACKEND_DAWN)
+	device.tick();
+	for (Device other : s.otherDevices) other.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+	if (!pumping()) device.poll(false);
+	// The pump only blocks on the main device
+	for (Device other : s.otherDevices) other.poll(false);
+#endif
+
+	// Taken before running them, so that those they post run at the next dispatch
+	std::vector<std::function<void()>> completions;
+	s.completions.drain([&completions](std::function<void()>&& completion) { completions.push_back(std::move(completion)); });
+	for (const std::function<void()>& completion : completions) {
+		completion();
+	}
+}
+
+void DeviceEvents::wait(Device device) {
+#if defined(__EMSCRIPTEN__)
+	// Yield to the browser, which resolves the callbacks (requires ASYNCIFY or JSPI)
+	emscripten_sleep(1);
+#elif defined(WEBGPU_BACKEND_DAWN)
+	device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+	device.poll(true);
+	// The pump may be the one running the callback, which then comes shortly
+	{
+		State& s = state();
+		std::unique_lock lock(s.mutex);
+		s.completed.wait_for(lock, std::chrono::milliseconds(1), [&s] { return !s.completions.empty(); });
+	}
+#endif
+	dispatch(device);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <utility>
+
+/**
+ * Completions of the device (mapAsync, onSubmittedWorkDone) delivered to the
+ * thread driving the frames, rather than to whichever thread happened to poll.
+ *
+ * With wgpu-native, start() launches a thread that blocks in the poll of the
+ * device whenever work was submitted, so that completions are noticed as soon as
+ * the GPU gets there instead of at the next frame, and without the frame thread
+ * spinning on poll(false). Callbacks wrapped with deferred() only queue their
+ * actual work, which dispatch() runs on the frame thread: the state they write
+ * needs no synchronization. Dawn and the browser report completions from their
+ * own event loop, ticked (Dawn) or yielded to (the web) by dispatch() and wait(),
+ * so start() only matters with wgpu-native.
+ *
+ * Coroutines (see Task) await mapAsync() and workDone() instead, resuming on the
+ * thread calling dispatch().
+ *
+ * Shared by the whole application, like the device it pumps. The events of other
+ * devices added with addDevice() are processed by dispatch() without blocking,
+ * their completions thus waiting for the next one.
+ */
+class DeviceEvents {
+public:
+	// Pump the events of `device` from a thread of its own, until stop(), which must be called
+	// before the device is released
+	static void start(wgpu::Device device);
+	static void stop();
+
+	// Wake the pump after submitting work or requesting a map, which it then waits for
+	static void notify();
+
+	// Same callback, running on the thread calling dispatch() instead of the one reporting it
+	template <typename Callback>
+	static auto deferred(Callback callback) {
+		return [callback = std::move(callback)](auto status) {
+			post([callback, status]() { callback(status); });
+		};
+	}
+
+	// Awaited by a coroutine to map a range of `buffer`, resuming with the status of the mapping
+	static auto mapAsync(wgpu::Buffer buffer, wgpu::MapMode mode, size_t offset, size_t size) {
+		struct Awaiter {
+			wgpu::Buffer buffer;
+			wgpu::MapMode mode;
+			size_t offset = 0;
+			size_t size = 0;
+			wgpu::BufferMapAsyncStatus status = wgpu::BufferMapAsyncStatus::Unknown;
+			std::unique_ptr<wgpu::BufferMapCallback> callback = nullptr;
+
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> handle) {
+				callback = buffer.mapAsync(mode, offset, size, deferred([this, handle](wgpu::BufferMapAsyncStatus mapStatus) {
+					status = mapStatus;
+					handle.resume();
+				}));
+				notify();
+			}
+			wgpu::BufferMapAsyncStatus await_resume() const noexcept { return status; }
+		};
+		return Awaiter{ buffer, mode, offset, size };
+	}
+
+	// Awaited by a coroutine to wait for the work submitted to `queue` so far
+	static auto workDone(wgpu::Queue queue) {
+		struct Awaiter {
+			wgpu::Queue queue;
+			wgpu::QueueWorkDoneStatus status = wgpu::QueueWorkDoneStatus::Unknown;
+			std::unique_ptr<wgpu::QueueWorkDoneCallback> callback = nullptr;
+
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> handle) {
+				callback = queue.onSubmittedWorkDone(deferred([this, handle](wgpu::QueueWorkDoneStatus doneStatus) {
+					status = doneStatus;
+					handle.resume();
+				}));
+				notify();
+			}
+			wgpu::QueueWorkDoneStatus await_resume() const noexcept { return status; }
+		};
+		return Awaiter{ queue };
+	}
+
+	// Process the events of another device in dispatch() too, e.g. that of the background jobs
+	// (see WorkerDevice), until removeDevice(). From the thread calling dispatch().
+	static void addDevice(wgpu::Device device);
+	static void removeDevice(wgpu::Device device);
+	// Run `work` on the thread calling dispatch(), from any thread
+	static void post(std::function<void()> work);
+
+	// Run the deferred callbacks reported so far, after processing the events of `device` if
+	// nothing pumps them
+	static void dispatch(wgpu::Device device);
+
+	// Block until `device` reports some progress, then dispatch(), for waiting on a callback
+	static void wait(wgpu::Device device);
+};
@@ -0,0 +1,154 @@
+#include "DrawConstants.h"
+#include "FrameCounters.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace wgpu;
+
+#ifdef WEBGPU_BACKEND_WGPU
+namespace {
+
+const FeatureName PushConstantsFeature = static_cast<WGPUFeatureName>(WGPUNativeFeature_PushConstants);
+// Every stage of the shaders drawing the scene may read them
+const WGPUShaderStageFlags PushConstantStages = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
+
+} // anonymous namespace
+#endif // WEBGPU_BACKEND_WGPU
+
+bool DrawConstants::supported(Adapter adapter, uint32_t size) {
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+	if (!adapter.hasFeature(PushConstantsFeature)) return false;
+	WGPUSupportedLimitsExtras extras{};
+	extras.chain.sType = static_cast<WGPUSType>(WGPUSType_SupportedLimitsExtras);
+	SupportedLimits supportedLimits;
+	supportedLimits.nextInChain = &extras.chain;
+	adapter.getLimits(&supportedLimits);
+	return extras.maxPushConstantSize >= size;
+#else
+	(void)adapter;
+	(void)size;
+	return false;
+#endif
+}
+
+#ifdef WEBGPU_BACKEND_WGPU
+void DrawConstants::require(std::vector<WGPUFeatureName>& features, RequiredLimits& limits, WGPURequiredLimitsExtras& extras, uint32_t size) {
+	features.push_back(PushConstantsFeature);
+	extras = {};
+	extras.chain.sType = static_cast<WGPUSType>(WGPUSType_RequiredLimitsExtras);
+	extras.chain.next = limits.nextInChain;
+	extras.maxPushConstantSize = size;
+	limits.nextInChain = &extras.chain;
+}
+#endif // WEBGPU_BACKEND_WGPU
+
+DrawConstants::DrawConstants(Device device, uint32_t size, Binding binding)
+	: mDevice(device)
+	, mSize(size)
+	, mBinding(binding)
+	, mStride(size)
+{
+	assert(size % 4 == 0);
+#ifdef WEBGPU_BACKEND_WGPU
+	if (binding == Binding::PushConstants && !device.hasFeature(PushConstantsFeature)) {
+		mBinding = Binding::DynamicOffset;
+	}
+	mPushConstantRange.stages = PushConstantStages;
+	mPushConstantRange.start = 0;
+	mPushConstantRange.end = size;
+	mPipelineLayoutExtras.chain.sType = static_cast<WGPUSType>(WGPUSType_PipelineLayoutExtras);
+	mPipelineLayoutExtras.pushConstantRangeCount = 1;
+	mPipelineLayoutExtras.pushConstantRanges = &mPushConstantRange;
+#else
+	if (binding == Binding::PushConstants) mBinding = Binding::DynamicOffset;
+#endif // WEBGPU_BACKEND_WGPU
+	if (mBinding == Binding::DynamicOffset) {
+		SupportedLimits supportedLimits;
+		device.getLimits(&supportedLimits);
+		uint32_t alignment = std::max<uint32_t>(supportedLimits.limits.minUniformBufferOffsetAlignment, 16);
+		mStride = (size + alignment - 1) / alignment * alignment;
+	}
+}
+
+DrawConstants::~DrawConstants() {
+	clear();
+}
+
+bool DrawConstants::resize(uint32_t drawCount) {
+	clear();
+	mDrawCount = drawCount;
+	mValues.assign(uint64_t(drawCount) * mStride, std::byte{ 0 });
+	if (pushConstants()) return true;
+
+	// Binding sizes may not be empty
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Draw constants";
+	bufferDesc.size = std::max<uint64_t>(mValues.size(), mStride);
+	bufferDesc.usage = BufferUsage::CopyDst | (storageArray() ? BufferUsage::Storage : BufferUsage::Uniform);
+	bufferDesc.mappedAtCreation = false;
+	mBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Uniforms, "DrawConstants");
+	return mBuffer != nullptr;
+}
+
+void DrawConstants::clear() {
+	if (mBuffer) {
+		destroyTracked(mBuffer);
+		mBuffer.release();
+	}
+	mBuffer = nullptr;
+	mDrawCount = 0;
+	mValues.clear();
+	mChanged = false;
+}
+
+void DrawConstants::write(uint32_t draw, const void* data) {
+	assert(draw < mDrawCount);
+	std::memcpy(mValues.data() + uint64_t(draw) * mStride, data, mSize);
+	mChanged = true;
+}
+
+void DrawConstants::flush(Queue queue) {
+	if (!mChanged) return;
+	mChanged = false;
+	if (pushConstants() || mValues.empty()) return;
+	queue.writeBuffer(mBuffer, 0, mValues.data(), mValues.size());
+	mUploadedBytes += mValues.size();
+	FrameCounters::add(FrameCounter::BytesWritten, mValues.size());
+}
+
+void DrawConstants::bind(RenderStateCache<RenderPassEncoder>& state, uint32_t groupIndex, BindGroup bindGroup, uint32_t draw) const {
+	assert(draw < mDrawCount);
+#ifdef WEBGPU_BACKEND_WGPU
+	if (pushConstants()) {
+		state.setBindGroup(groupIndex, bindGroup, 0, nullptr);
+		wgpuRenderPassEncoderSetPushConstants(state.encoder(), PushConstantStages, 0, mSize, mValues.data() + uint64_t(draw) * mStride);
+		return;
+	}
+#endif // WEBGPU_BACKEND_WGPU
+	if (storageArray()) {
+		state.setBindGroup(groupIndex, bindGroup, 0, nullptr);
+		return;
+	}
+	uint32_t offset = draw * mStride;
+	state.setBindGroup(groupIndex, bindGroup, 1, &offset);
+}
+
+void DrawConstants::bind(RenderStateCache<RenderBundleEncoder>& state, uint32_t groupIndex, BindGroup bindGroup, uint32_t draw) const {
+	assert(draw < mDrawCount && !pushConstants());
+	if (storageArray()) {
+		state.setBindGroup(groupIndex, bindGroup, 0, nullptr);
+		return;
+	}
+	uint32_t offset = draw * mStride;
+	state.setBindGroup(groupIndex, bindGroup, 1, &offset);
+}
+
+const WGPUChainedStruct* DrawConstants::pipelineLayoutChain() const {
+#ifdef WEBGPU_BACKEND_WGPU
+	if (pushConstants()) return &mPipelineLayoutExtras.chain;
+#endif // WEBGPU_BACKEND_WGPU
+	return nullptr;
+}
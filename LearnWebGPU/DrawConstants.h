@@ -0,0 +1,111 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "RenderStateCache.h"
+
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Values that change with each draw, e.g. the DrawUniforms of each batch, given to
+ * the shaders as push constants when the device has the PushConstants feature of
+ * wgpu-native, and otherwise from a uniform buffer of one slice per draw, bound
+ * with the draw's bind group at the dynamic offset of its slice.
+ *
+ * Values are written to a CPU copy. Push constants are set from it right before
+ * each draw, so that nothing is uploaded when the values of draws change, while
+ * flush() uploads the slices to the uniform buffer in a single writeBuffer.
+ *
+ * Shaders declare the structure as `var<push_constant>` when PUSH_CONSTANTS is
+ * defined, and as a uniform at the binding of the draw group otherwise, which the
+ * bind group layout entry then has with `hasDynamicOffset` set. Pipeline layouts
+ * take the push constant range from pipelineLayoutChain().
+ *
+ * Render bundle encoders cannot set push constants in wgpu-native, so draws have
+ * to be encoded in their pass when pushConstants() is true.
+ *
+ * Draws issued together by a multi-draw call (see MultiDraw.h) cannot change
+ * bindings in between, so the values of all draws are then bound once, as a
+ * storage buffer of tightly packed elements that shaders declare as an array
+ * when MULTI_DRAW is defined, and index with what tells the draws apart.
+ */
+class DrawConstants {
+public:
+	enum class Binding {
+		// A uniform buffer slice per draw, bound at its dynamic offset
+		DynamicOffset,
+		// Push constants where the device has them, and DynamicOffset otherwise
+		PushConstants,
+		// An array of all draws in a storage buffer
+		StorageArray,
+	};
+
+	// Whether `adapter` has push constants of at least `size` bytes, never outside of wgpu-native
+	static bool supported(wgpu::Adapter adapter, uint32_t size);
+#ifdef WEBGPU_BACKEND_WGPU
+	// Add what a device needs for push constants of `size` bytes to the features and limits it
+	// is requested with, `extras` being chained to `limits` and read along with them
+	static void require(std::vector<WGPUFeatureName>& features, wgpu::RequiredLimits& limits, WGPURequiredLimitsExtras& extras, uint32_t size);
+#endif // WEBGPU_BACKEND_WGPU
+
+	// Constants of `size` bytes per draw, bound as `binding` requests, push constants needing
+	// `device` to be created with the feature
+	DrawConstants(wgpu::Device device, uint32_t size, Binding binding = Binding::PushConstants);
+	~DrawConstants();
+
+	DrawConstants(const DrawConstants&) = delete;
+	DrawConstants& operator=(const DrawConstants&) = delete;
+
+	bool pushConstants() const { return mBinding == Binding::PushConstants; }
+	bool storageArray() const { return mBinding == Binding::StorageArray; }
+	uint32_t size() const { return mSize; }
+
+	// Room for `drawCount` draws, the values written so far being lost, or return false
+	bool resize(uint32_t drawCount);
+	// Release the buffer and the values
+	void clear();
+
+	// The buffer the draw groups bind with a binding size of size(), or whole as a storage
+	// array, null with push constants
+	wgpu::Buffer buffer() const { return mBuffer; }
+
+	// Copy the size() bytes of the constants of draw `draw`
+	void write(uint32_t draw, const void* data);
+	// Upload the writes made since the last flush, if they go through the buffer
+	void flush(wgpu::Queue queue);
+	// Bytes uploaded by flush() since creation, for upload statistics
+	uint64_t uploadedBytes() const { return mUploadedBytes; }
+
+	// Bind `bindGroup` at `groupIndex`, with the constants of draw `draw`, which shaders find
+	// themselves in a storage array. The group is then the same for all draws, as it is with
+	// push constants, and set once by the cache.
+	void bind(RenderStateCache<wgpu::RenderPassEncoder>& state, uint32_t groupIndex, wgpu::BindGroup bindGroup, uint32_t draw) const;
+	// Same in a render bundle, which is only possible without push constants
+	void bind(RenderStateCache<wgpu::RenderBundleEncoder>& state, uint32_t groupIndex, wgpu::BindGroup bindGroup, uint32_t draw) const;
+
+	// To chain to the descriptors of the layouts of pipelines reading the constants, null
+	// without push constants. Points into the object, which must outlive the descriptors.
+	const WGPUChainedStruct* pipelineLayoutChain() const;
+
+private:
+	wgpu::Device mDevice;
+	uint32_t mSize;
+	Binding mBinding;
+	// Byte distance between the values of consecutive draws, aligned to the device's
+	// minUniformBufferOffsetAlignment for dynamic offsets
+	uint32_t mStride;
+	uint32_t mDrawCount = 0;
+	std::vector<std::byte> mValues;
+	wgpu::Buffer mBuffer = nullptr;
+	bool mChanged = false;
+	uint64_t mUploadedBytes = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	WGPUPushConstantRange mPushConstantRange = {};
+	WGPUPipelineLayoutExtras mPipelineLayoutExtras = {};
+#endif // WEBGPU_BACKEND_WGPU
+};
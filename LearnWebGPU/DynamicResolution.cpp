@@ -0,0 +1,44 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+DynamicResolution::DynamicResolution(const Settings& settings)
+	: mSettings(settings)
+	, mScale(settings.maxScale)
+{}
+
+bool DynamicResolution::update(double gpuFrameMs) {
+	if (mCooldown > 0) {
+		--mCooldown;
+		return false;
+	}
+	if (gpuFrameMs <= 0.0) return false;
+
+	float scale = mScale;
+	if (gpuFrameMs > mSettings.targetFrameMs) {
+		scale = mScale * static_cast<float>(std::sqrt(mSettings.targetFrameMs / gpuFrameMs));
+	}
+	else if (gpuFrameMs < mSettings.headroom * mSettings.targetFrameMs) {
+		scale = mScale + mSettings.scaleUpStep;
+	}
+	scale = std::clamp(scale, mSettings.minScale, mSettings.maxScale);
+
+	// Ignore changes too small to be worth the frames it takes to see their effect
+	if (std::abs(scale - mScale) < 0.01f && scale != mSettings.minScale && scale != mSettings.maxScale) return false;
+	if (scale == mScale) return false;
+	mScale = scale;
+	mCooldown = mSettings.cooldownFrameCount;
+	return true;
+}
+
+void DynamicResolution::setSettings(const Settings& settings) {
+	mSettings = settings;
+	mScale = std::clamp(mScale, mSettings.minScale, mSettings.maxScale);
+	mCooldown = mSettings.cooldownFrameCount;
+}
+
+void DynamicResolution::reset() {
+	mScale = mSettings.maxScale;
+	mCooldown = 0;
+}
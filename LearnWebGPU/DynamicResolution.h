@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Feedback controller picking the scale at which to render the scene, so that the
+ * GPU time of frames stays within a budget.
+ *
+ * Fragment work being roughly proportional to the number of pixels, the scale is
+ * brought down by the square root of how much a frame goes over budget, and only
+ * raised again by small steps while frames stay well below it, so that it settles
+ * rather than oscillates. GPU timings arrive a few frames after the frames they
+ * measure, so the frames measured right after a change are ignored.
+ */
+class DynamicResolution {
+public:
+	struct Settings {
+		// GPU time budget of a frame
+		double targetFrameMs = 15.0;
+		// Range of the scale, applied to both dimensions
+		float minScale = 0.5f;
+		float maxScale = 1.0f;
+		// Fraction of the budget under which the scale goes up again
+		double headroom = 0.8;
+		// Growth of the scale per measured frame with enough headroom
+		float scaleUpStep = 0.02f;
+		// Measured frames ignored after a change, at least the latency of the timings
+		uint32_t cooldownFrameCount = 6;
+	};
+
+	explicit DynamicResolution(const Settings& settings);
+
+	// Account for the GPU time of a newly measured frame, returning whether the scale changed
+	bool update(double gpuFrameMs);
+
+	// Go back to the largest scale, e.g. when turned off
+	void reset();
+
+	// Change the budget or the range, e.g. for another frame rate, the scale being brought
+	// within the new range and timings measured until then ignored
+	void setSettings(const Settings& settings);
+
+	float scale() const { return mScale; }
+	const Settings& settings() const { return mSettings; }
+
+private:
+	Settings mSettings;
+	float mScale;
+	uint32_t mCooldown = 0;
+};
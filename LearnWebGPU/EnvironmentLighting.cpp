@@ -0,0 +1,722 @@
+#include "EnvironmentLighting.h"
+#include "DeviceEvents.h"
+#include "GpuMemory.h"
+#include "MappedFile.h"
+#include "Mipmaps.h"
+
+#include "stb_image.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+const char* environmentShaderSource = R"(
+struct PrefilterParams {
+	roughness: f32,
+	// Of a texel of the first level of the source
+	sourceTexelSolidAngle: f32,
+	faceSize: u32,
+	sampleCount: u32,
+};
+
+// Equirectangular, +Z up, with its mip levels
+@group(0) @binding(0) var<uniform> params: PrefilterParams;
+@group(0) @binding(1) var source: texture_2d<f32>;
+@group(0) @binding(2) var sourceSampler: sampler;
+// The faces of one level of the cubemap
+@group(0) @binding(3) var target: texture_storage_2d_array<rgba16float, write>;
+// Scale and bias of F0 by N.V along x and roughness along y
+@group(0) @binding(4) var brdfLut: texture_storage_2d<rgba16float, write>;
+
+const PI = 3.14159265359;
+
+// Direction of the texel at `uv` of a face, as cube sampling looks them up
+fn faceDirection(face: u32, uv: vec2f) -> vec3f {
+	let s = uv.x * 2.0 - 1.0;
+	let t = uv.y * 2.0 - 1.0;
+	switch (face) {
+		case 0u: { return vec3f(1.0, -t, -s); }
+		case 1u: { return vec3f(-1.0, -t, s); }
+		case 2u: { return vec3f(s, 1.0, t); }
+		case 3u: { return vec3f(s, -1.0, -t); }
+		case 4u: { return vec3f(s, -t, 1.0); }
+		default: { return vec3f(-s, -t, -1.0); }
+	}
+}
+
+fn sampleSource(direction: vec3f, lod: f32) -> vec3f {
+	let uv = vec2f(atan2(direction.y, direction.x) / (2.0 * PI) + 0.5, acos(clamp(direction.z, -1.0, 1.0)) / PI);
+	return textureSampleLevel(source, sourceSampler, uv, lod).rgb;
+}
+
+fn hammersley(i: u32, count: u32) -> vec2f {
+	return vec2f(f32(i) / f32(count), f32(reverseBits(i)) * 2.3283064365386963e-10);
+}
+
+// Half vector around +Z, distributed as D(h) (n.h) for `alpha`, the square of the roughness
+fn importanceSampleGgx(xi: vec2f, alpha: f32) -> vec3f {
+	let phi = 2.0 * PI * xi.x;
+	let cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+	let sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+	return vec3f(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+fn distributionGgx(nDotH: f32, alpha: f32) -> f32 {
+	let alpha2 = alpha * alpha;
+	let denominator = nDotH * nDotH * (alpha2 - 1.0) + 1.0;
+	return alpha2 / (PI * denominator * denominator);
+}
+
+// One invocation per texel of a level, faces along z. The view direction is taken to be the
+// normal, and each sample reads the source at the level whose texels span its solid angle,
+// which is what makes a few hundred samples enough (Krivanek and Colbert)
+@compute @workgroup_size(8, 8, 1)
+fn prefilter(@builtin(global_invocation_id) id: vec3u) {
+	if (id.x >= params.faceSize || id.y >= params.faceSize) {
+		return;
+	}
+	let n = normalize(faceDirection(id.z, (vec2f(id.xy) + 0.5) / f32(params.faceSize)));
+	if (params.roughness == 0.0) {
+		let texelSolidAngle = 4.0 * PI / (6.0 * f32(params.faceSize * params.faceSize));
+		let lod = max(0.5 * log2(texelSolidAngle / params.sourceTexelSolidAngle), 0.0);
+		textureStore(target, id.xy, id.z, vec4f(sampleSource(n, lod), 1.0));
+		return;
+	}
+
+	let up = select(vec3f(0.0, 0.0, 1.0), vec3f(1.0, 0.0, 0.0), abs(n.z) > 0.999);
+	let tangent = normalize(cross(up, n));
+	let bitangent = cross(n, tangent);
+	let alpha = params.roughness * params.roughness;
+	var color = vec3f(0.0);
+	var weight = 0.0;
+	for (var i = 0u; i < params.sampleCount; i++) {
+		let h = importanceSampleGgx(hammersley(i, params.sampleCount), alpha);
+		let l = 2.0 * h.z * (tangent * h.x + bitangent * h.y + n * h.z) - n;
+		let nDotL = dot(n, l);
+		if (nDotL <= 0.0) {
+			continue;
+		}
+		// The pdf of l is D(h) (n.h) / (4 v.h), with v.h = n.h
+		let pdf = distributionGgx(h.z, alpha) / 4.0;
+		let sampleSolidAngle = 1.0 / (f32(params.sampleCount) * pdf + 1e-4);
+		let lod = max(0.5 * log2(sampleSolidAngle / params.sourceTexelSolidAngle) + 1.0, 0.0);
+		color += sampleSource(l, lod) * nDotL;
+		weight += nDotL;
+	}
+	textureStore(target, id.xy, id.z, vec4f(color / max(weight, 1e-4), 1.0));
+}
+
+// Smith with Schlick's approximation, k being alpha / 2 for image-based lighting
+fn geometrySmith(nDotV: f32, nDotL: f32, alpha: f32) -> f32 {
+	let k = alpha / 2.0;
+	return nDotV / (nDotV * (1.0 - k) + k) * nDotL / (nDotL * (1.0 - k) + k);
+}
+
+const BrdfSampleCount = 256u;
+
+// One invocation per texel of the table
+@compute @workgroup_size(8, 8, 1)
+fn integrateBrdf(@builtin(global_invocation_id) id: vec3u) {
+	let size = textureDimensions(brdfLut);
+	if (id.x >= size.x || id.y >= size.y) {
+		return;
+	}
+	let nDotV = (f32(id.x) + 0.5) / f32(size.x);
+	let roughness = (f32(id.y) + 0.5) / f32(size.y);
+	let alpha = roughness * roughness;
+	let v = vec3f(sqrt(1.0 - nDotV * nDotV), 0.0, nDotV);
+	var scale = 0.0;
+	var bias = 0.0;
+	for (var i = 0u; i < BrdfSampleCount; i++) {
+		let h = importanceSampleGgx(hammersley(i, BrdfSampleCount), alpha);
+		let vDotH = dot(v, h);
+		let l = 2.0 * vDotH * h - v;
+		if (l.z <= 0.0 || vDotH <= 0.0) {
+			continue;
+		}
+		let visibility = geometrySmith(nDotV, l.z, alpha) * vDotH / (h.z * nDotV);
+		let fresnel = pow(1.0 - vDotH, 5.0);
+		scale += (1.0 - fresnel) * visibility;
+		bias += fresnel * visibility;
+	}
+	textureStore(brdfLut, id.xy, vec4f(scale, bias, 0.0, 1.0) / vec4f(f32(BrdfSampleCount), f32(BrdfSampleCount), 1.0, 1.0));
+}
+)";
+
+constexpr uint32_t WorkgroupSize = 8;
+constexpr uint32_t SampleCount = 256;
+// Of the equirectangular image, the larger levels adding nothing to faces of FaceSize
+constexpr uint32_t MaxSourceWidth = 4096;
+// Of the level the irradiance is projected from, which is smooth enough not to need more
+constexpr uint32_t MaxIrradianceWidth = 512;
+// Of the parameters of each level in the uniform buffer, the largest offset alignment
+constexpr uint64_t ParamStride = 256;
+constexpr uint32_t BytesPerTexel = 4 * sizeof(uint16_t);
+constexpr float Pi = 3.14159265358979f;
+
+/**
+ * The PrefilterParams structure of the shader
+ */
+struct PrefilterParams {
+	float roughness;
+	float sourceTexelSolidAngle;
+	uint32_t faceSize;
+	uint32_t sampleCount;
+};
+static_assert(sizeof(PrefilterParams) == 16);
+
+/**
+ * Header of the cache of an environment, followed by the levels of its radiance
+ */
+struct CacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint32_t faceSize;
+	uint32_t levelCount;
+	float irradiance[9][4];
+};
+static_assert(sizeof(CacheHeader) == 168);
+
+constexpr uint32_t CacheMagic = 0x4C424949; // "IIBL"
+constexpr uint32_t CacheVersion = 1;
+
+std::filesystem::path cachePath(const std::filesystem::path& path) {
+	std::filesystem::path cachePath = path;
+	cachePath += ".iblcache";
+	return cachePath;
+}
+
+uint32_t levelSize(uint32_t level) {
+	return std::max(EnvironmentLighting::FaceSize >> level, 1u);
+}
+
+// In texels, of all levels of the cubemap
+size_t radianceTexelCount() {
+	size_t count = 0;
+	for (uint32_t level = 0; level < EnvironmentLighting::LevelCount; ++level) {
+		count += size_t(6) * levelSize(level) * levelSize(level);
+	}
+	return count;
+}
+
+// FNV-1a over 8 byte words, like the content hashes of geometries
+uint64_t hashBytes(std::span<const std::byte> bytes) {
+	constexpr uint64_t prime = 0x100000001b3ull;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t i = 0;
+	for (; i + 8 <= bytes.size(); i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes.data() + i, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < bytes.size(); ++i) {
+		hash = (hash ^ static_cast<uint64_t>(bytes[i])) * prime;
+	}
+	return (hash ^ bytes.size()) * prime;
+}
+
+// A level of the equirectangular image, in linear RGBA
+struct FloatLevel {
+	uint32_t width;
+	uint32_t height;
+	std::vector<glm::vec4> texels;
+};
+
+// The next level of `level` with a 2x2 box filter, an odd last row or column being dropped
+// like in downsampleRgba8()
+FloatLevel downsample(const FloatLevel& level) {
+	FloatLevel next{ nextMipLevelSize(level.width), nextMipLevelSize(level.height), {} };
+	next.texels.resize(size_t(next.width) * next.height);
+	for (uint32_t y = 0; y < next.height; ++y) {
+		uint32_t y0 = std::min(2 * y, level.height - 1);
+		uint32_t y1 = std::min(2 * y + 1, level.height - 1);
+		for (uint32_t x = 0; x < next.width; ++x) {
+			uint32_t x0 = std::min(2 * x, level.width - 1);
+			uint32_t x1 = std::min(2 * x + 1, level.width - 1);
+			next.texels[size_t(y) * next.width + x] = 0.25f * (
+				level.texels[size_t(y0) * level.width + x0] + level.texels[size_t(y0) * level.width + x1] +
+				level.texels[size_t(y1) * level.width + x0] + level.texels[size_t(y1) * level.width + x1]
+			);
+		}
+	}
+	return next;
+}
+
+// Coefficients of the projection of the radiance of `level` on the first 9 real spherical
+// harmonics, convolved with the cosine lobe and divided by pi
+std::array<glm::vec4, 9> projectIrradiance(const FloatLevel& level) {
+	std::array<glm::vec3, 9> coefficients = {};
+	float texelAngle = (2.0f * Pi / level.width) * (Pi / level.height);
+	for (uint32_t y = 0; y < level.height; ++y) {
+		float theta = (y + 0.5f) / level.height * Pi;
+		float sinTheta = std::sin(theta);
+		float weight = texelAngle * sinTheta;
+		for (uint32_t x = 0; x < level.width; ++x) {
+			float phi = ((x + 0.5f) / level.width - 0.5f) * 2.0f * Pi;
+			glm::vec3 d(sinTheta * std::cos(phi), sinTheta * std::sin(phi), std::cos(theta));
+			glm::vec3 radiance = glm::vec3(level.texels[size_t(y) * level.width + x]) * weight;
+			float basis[9] = {
+				0.282095f,
+				0.488603f * d.y, 0.488603f * d.z, 0.488603f * d.x,
+				1.092548f * d.x * d.y, 1.092548f * d.y * d.z, 0.315392f * (3.0f * d.z * d.z - 1.0f),
+				1.092548f * d.x * d.z, 0.546274f * (d.x * d.x - d.y * d.y),
+			};
+			for (int i = 0; i < 9; ++i) coefficients[i] += radiance * basis[i];
+		}
+	}
+	// The convolution scales band l by A_l, of pi, 2 pi / 3 and pi / 4
+	constexpr float bandScales[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+	std::array<glm::vec4, 9> irradiance;
+	for (int i = 0; i < 9; ++i) {
+		float scale = bandScales[i == 0 ? 0 : i < 4 ? 1 : 2];
+		irradiance[i] = glm::vec4(coefficients[i] * scale, 0.0f);
+	}
+	return irradiance;
+}
+
+bool loadCache(const std::filesystem::path& path, uint64_t hash, EnvironmentLighting::Environment& environment) {
+	MappedFile file;
+	if (!file.open(cachePath(path))) return false;
+	CacheHeader header;
+	size_t radianceBytes = radianceTexelCount() * BytesPerTexel;
+	if (file.size() != sizeof(CacheHeader) + radianceBytes) return false;
+	std::memcpy(&header, file.data(), sizeof(CacheHeader));
+	if (header.magic != CacheMagic || header.version != CacheVersion || header.hash != hash) return false;
+	if (header.faceSize != EnvironmentLighting::FaceSize || header.levelCount != EnvironmentLighting::LevelCount) return false;
+
+	for (int i = 0; i < 9; ++i) {
+		environment.uniforms.irradiance[i] = glm::vec4(header.irradiance[i][0], header.irradiance[i][1], header.irradiance[i][2], header.irradiance[i][3]);
+	}
+	environment.radiance.resize(radianceBytes / sizeof(uint16_t));
+	std::memcpy(environment.radiance.data(), file.data() + sizeof(CacheHeader), radianceBytes);
+	return true;
+}
+
+} // anonymous namespace
+
+bool EnvironmentLighting::load(const std::filesystem::path& path, Environment& environment) {
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cerr << "Failed to open environment: " << path << std::endl;
+		return false;
+	}
+	environment = {};
+	environment.hash = hashBytes({ file.data(), file.size() });
+	environment.uniforms.levelCount = static_cast<float>(LevelCount);
+	if (loadCache(path, environment.hash, environment)) return true;
+
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	float* pixels = stbi_loadf_from_memory(reinterpret_cast<const stbi_uc*>(file.data()), static_cast<int>(file.size()), &width, &height, &channels, 4 /* force 4 channels */);
+	if (!pixels) {
+		std::cerr << "Failed to decode environment: " << path << " (" << stbi_failure_reason() << ")" << std::endl;
+		return false;
+	}
+	FloatLevel level{ static_cast<uint32_t>(width), static_cast<uint32_t>(height), {} };
+	level.texels.resize(size_t(width) * height);
+	std::memcpy(level.texels.data(), pixels, level.texels.size() * sizeof(glm::vec4));
+	stbi_image_free(pixels);
+	file.close();
+	while (level.width > MaxSourceWidth) level = downsample(level);
+
+	environment.width = level.width;
+	environment.height = level.height;
+	bool projected = false;
+	while (true) {
+		if (!projected && level.width <= MaxIrradianceWidth) {
+			std::array<glm::vec4, 9> irradiance = projectIrradiance(level);
+			std::copy(irradiance.begin(), irradiance.end(), environment.uniforms.irradiance.begin());
+			projected = true;
+		}
+		for (const glm::vec4& texel : level.texels) {
+			for (int c = 0; c < 4; ++c) environment.texels.push_back(glm::packHalf1x16(texel[c]));
+		}
+		++environment.mipLevelCount;
+		if (level.width == 1 && level.height == 1) break;
+		level = downsample(level);
+	}
+	return true;
+}
+
+bool EnvironmentLighting::writeCache(const std::filesystem::path& path, const Environment& environment, std::span<const uint16_t> radiance) {
+	if (radiance.size() * sizeof(uint16_t) != radianceTexelCount() * BytesPerTexel) return false;
+	CacheHeader header{};
+	header.magic = CacheMagic;
+	header.version = CacheVersion;
+	header.hash = environment.hash;
+	header.faceSize = FaceSize;
+	header.levelCount = LevelCount;
+	for (int i = 0; i < 9; ++i) {
+		for (int c = 0; c < 4; ++c) header.irradiance[i][c] = environment.uniforms.irradiance[i][c];
+	}
+
+	// Through a temporary file, so that a concurrent reader never maps a partial cache
+	return writeFileAtomically(cachePath(path), [&](std::ostream& file) {
+		file.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+		file.write(reinterpret_cast<const char*>(radiance.data()), radiance.size() * sizeof(uint16_t));
+		return true;
+	});
+}
+
+EnvironmentLighting::EnvironmentLighting(Device device, PipelineCache& pipelineCache)
+	: mDevice(device)
+	, mPipelineCache(pipelineCache)
+{
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Environment radiance";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = Format;
+	textureDesc.size = { FaceSize, FaceSize, 6 };
+	textureDesc.mipLevelCount = LevelCount;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::StorageBinding | TextureUsage::CopyDst | TextureUsage::CopySrc;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mRadiance = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "EnvironmentLighting");
+	textureDesc.label = "BRDF integration";
+	textureDesc.size = { BrdfLutSize, BrdfLutSize, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::StorageBinding;
+	mBrdfLut = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "EnvironmentLighting");
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Environment uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "EnvironmentLighting");
+	if (!valid()) return;
+	Uniforms uniforms;
+	device.getQueue().writeBuffer(mUniformBuffer, 0, &uniforms, sizeof(Uniforms));
+
+	TextureViewDescriptor viewDesc{};
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 6;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = LevelCount;
+	viewDesc.dimension = TextureViewDimension::Cube;
+	viewDesc.format = Format;
+	mRadianceView = mRadiance.createView(viewDesc);
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = TextureViewDimension::_2D;
+	mBrdfLutView = mBrdfLut.createView(viewDesc);
+
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::ClampToEdge;
+	samplerDesc.addressModeV = AddressMode::ClampToEdge;
+	samplerDesc.addressModeW = AddressMode::ClampToEdge;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Linear;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = static_cast<float>(LevelCount);
+	samplerDesc.compare = CompareFunction::Undefined;
+	samplerDesc.maxAnisotropy = 1;
+	mSampler = pipelineCache.sampler(samplerDesc);
+	// Longitudes wrap around
+	samplerDesc.addressModeU = AddressMode::Repeat;
+	samplerDesc.lodMaxClamp = 32.0f;
+	mSourceSampler = pipelineCache.sampler(samplerDesc);
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(4, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(PrefilterParams);
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::Float;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].sampler.type = SamplerBindingType::Filtering;
+	bindingLayoutEntries[3].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[3].storageTexture.format = Format;
+	bindingLayoutEntries[3].storageTexture.viewDimension = TextureViewDimension::_2DArray;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mPrefilterLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	bindingLayoutEntries.assign(1, Default);
+	bindingLayoutEntries[0].binding = 4;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[0].storageTexture.format = Format;
+	bindingLayoutEntries[0].storageTexture.viewDimension = TextureViewDimension::_2D;
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBrdfLutLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	ShaderModule shaderModule = pipelineCache.shaderModule(environmentShaderSource);
+	auto createPipeline = [&](BindGroupLayout bindGroupLayout, const char* entryPoint) {
+		PipelineLayoutDescriptor layoutDesc{};
+		layoutDesc.bindGroupLayoutCount = 1;
+		layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+		ComputePipelineDescriptor pipelineDesc{};
+		pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+		pipelineDesc.compute.module = shaderModule;
+		pipelineDesc.compute.entryPoint = entryPoint;
+		pipelineDesc.compute.constantCount = 0;
+		pipelineDesc.compute.constants = nullptr;
+		return pipelineCache.computePipelineAsync(pipelineDesc);
+	};
+	mPrefilterPipeline = createPipeline(mPrefilterLayout, "prefilter");
+	mBrdfLutPipeline = createPipeline(mBrdfLutLayout, "integrateBrdf");
+}
+
+EnvironmentLighting::~EnvironmentLighting() {
+	if (mRadianceView) mRadianceView.release();
+	if (mBrdfLutView) mBrdfLutView.release();
+	for (Texture* texture : { &mRadiance, &mBrdfLut }) {
+		if (!*texture) continue;
+		destroyTracked(*texture);
+		texture->release();
+	}
+	if (mUniformBuffer) {
+		destroyTracked(mUniformBuffer);
+		mUniformBuffer.release();
+	}
+}
+
+Task<std::vector<uint16_t>> EnvironmentLighting::upload(std::shared_ptr<const Environment> environment) {
+	std::vector<uint16_t> radiance;
+	if (!valid()) co_return radiance;
+	PipelineCache::AsyncComputePipeline prefilterPipeline = co_await mPipelineCache.whenBuilt(mPrefilterPipeline);
+	PipelineCache::AsyncComputePipeline brdfLutPipeline = co_await mPipelineCache.whenBuilt(mBrdfLutPipeline);
+	if (!prefilterPipeline->ready() || !brdfLutPipeline->ready()) co_return radiance;
+
+	Queue queue = mDevice.getQueue();
+	Uniforms uniforms = environment->uniforms;
+	uniforms.levelCount = static_cast<float>(LevelCount);
+	TextureViewDescriptor viewDesc{};
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = TextureViewDimension::_2D;
+	viewDesc.format = Format;
+
+	CommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "Environment lighting";
+	CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Environment lighting";
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	std::vector<BindGroup> bindGroups;
+	std::vector<TextureView> views;
+	auto createBindGroup = [&](BindGroupLayout layout, std::vector<BindGroupEntry>& bindings) {
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = layout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		bindGroups.push_back(mDevice.createBindGroup(bindGroupDesc));
+		return bindGroups.back();
+	};
+
+	// The table is the same whichever the environment
+	if (!mBrdfLutBuilt) {
+		views.push_back(mBrdfLut.createView(viewDesc));
+		std::vector<BindGroupEntry> bindings(1);
+		bindings[0].binding = 4;
+		bindings[0].textureView = views.back();
+		computePass.setPipeline(brdfLutPipeline->pipeline);
+		computePass.setBindGroup(0, createBindGroup(mBrdfLutLayout, bindings), 0, nullptr);
+		computePass.dispatchWorkgroups((BrdfLutSize + WorkgroupSize - 1) / WorkgroupSize, (BrdfLutSize + WorkgroupSize - 1) / WorkgroupSize, 1);
+		mBrdfLutBuilt = true;
+	}
+
+	Texture sourceTexture = nullptr;
+	Buffer paramBuffer = nullptr;
+	Buffer readbackBuffer = nullptr;
+	auto release = [&]() {
+		for (BindGroup& bindGroup : bindGroups) bindGroup.release();
+		bindGroups.clear();
+		for (TextureView& view : views) view.release();
+		views.clear();
+		for (Buffer* buffer : { &readbackBuffer, &paramBuffer }) {
+			if (!*buffer) continue;
+			destroyTracked(*buffer);
+			buffer->release();
+			*buffer = nullptr;
+		}
+		if (sourceTexture) {
+			destroyTracked(sourceTexture);
+			sourceTexture.release();
+			sourceTexture = nullptr;
+		}
+	};
+
+	// Rows of the levels read back are aligned as copies require
+	auto paddedBytesPerRow = [](uint32_t size) {
+		return (size * BytesPerTexel + 255) / 256 * 256;
+	};
+	uint64_t readbackBytes = 0;
+	for (uint32_t level = 0; level < LevelCount; ++level) {
+		readbackBytes += uint64_t(paddedBytesPerRow(levelSize(level))) * levelSize(level) * 6;
+	}
+
+	bool prefiltered = environment->radiance.empty();
+	if (prefiltered) {
+		TextureDescriptor textureDesc{};
+		textureDesc.label = "Environment source";
+		textureDesc.dimension = TextureDimension::_2D;
+		textureDesc.format = Format;
+		textureDesc.size = { environment->width, environment->height, 1 };
+		textureDesc.mipLevelCount = environment->mipLevelCount;
+		textureDesc.sampleCount = 1;
+		textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+		textureDesc.viewFormatCount = 0;
+		textureDesc.viewFormats = nullptr;
+		sourceTexture = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::Staging, "EnvironmentLighting");
+
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = "Environment prefilter parameters";
+		bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+		bufferDesc.size = ParamStride * LevelCount;
+		bufferDesc.mappedAtCreation = false;
+		paramBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Uniforms, "EnvironmentLighting");
+		bufferDesc.label = "Environment radiance readback";
+		bufferDesc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+		bufferDesc.size = readbackBytes;
+		readbackBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, "EnvironmentLighting");
+		if (!sourceTexture || !paramBuffer || !readbackBuffer) {
+			std::cerr << "Could not create the resources to prefilter an environment of " << environment->width << "x" << environment->height << " texels" << std::endl;
+			prefiltered = false;
+		}
+	}
+
+	if (prefiltered) {
+		size_t offset = 0;
+		uint32_t width = environment->width;
+		uint32_t height = environment->height;
+		for (uint32_t level = 0; level < environment->mipLevelCount; ++level) {
+			ImageCopyTexture destination;
+			destination.texture = sourceTexture;
+			destination.mipLevel = level;
+			destination.origin = { 0, 0, 0 };
+			destination.aspect = TextureAspect::All;
+			TextureDataLayout source;
+			source.offset = 0;
+			source.bytesPerRow = width * BytesPerTexel;
+			source.rowsPerImage = height;
+			size_t size = size_t(width) * height * BytesPerTexel;
+			queue.writeTexture(destination, environment->texels.data() + offset / sizeof(uint16_t), size, source, { width, height, 1 });
+			offset += size;
+			width = nextMipLevelSize(width);
+			height = nextMipLevelSize(height);
+		}
+
+		viewDesc.mipLevelCount = environment->mipLevelCount;
+		views.push_back(sourceTexture.createView(viewDesc));
+		TextureView sourceView = views.back();
+		float sourceTexelSolidAngle = 4.0f * Pi / (float(environment->width) * environment->height);
+		computePass.setPipeline(prefilterPipeline->pipeline);
+		for (uint32_t level = 0; level < LevelCount; ++level) {
+			PrefilterParams params{ float(level) / (LevelCount - 1), sourceTexelSolidAngle, levelSize(level), SampleCount };
+			queue.writeBuffer(paramBuffer, level * ParamStride, &params, sizeof(PrefilterParams));
+
+			viewDesc.baseMipLevel = level;
+			viewDesc.mipLevelCount = 1;
+			viewDesc.arrayLayerCount = 6;
+			viewDesc.dimension = TextureViewDimension::_2DArray;
+			views.push_back(mRadiance.createView(viewDesc));
+			std::vector<BindGroupEntry> bindings(4);
+			for (uint32_t binding = 0; binding < bindings.size(); ++binding) bindings[binding].binding = binding;
+			bindings[0].buffer = paramBuffer;
+			bindings[0].offset = level * ParamStride;
+			bindings[0].size = sizeof(PrefilterParams);
+			bindings[1].textureView = sourceView;
+			bindings[2].sampler = mSourceSampler;
+			bindings[3].textureView = views.back();
+			computePass.setBindGroup(0, createBindGroup(mPrefilterLayout, bindings), 0, nullptr);
+			uint32_t workgroupCount = (levelSize(level) + WorkgroupSize - 1) / WorkgroupSize;
+			computePass.dispatchWorkgroups(workgroupCount, workgroupCount, 6);
+		}
+	}
+	computePass.end();
+	computePass.release();
+
+	// Copied back for the cache, from which later runs only upload the levels
+	if (prefiltered) {
+		uint64_t offset = 0;
+		for (uint32_t level = 0; level < LevelCount; ++level) {
+			uint32_t size = levelSize(level);
+			ImageCopyTexture source;
+			source.texture = mRadiance;
+			source.mipLevel = level;
+			source.origin = { 0, 0, 0 };
+			source.aspect = TextureAspect::All;
+			ImageCopyBuffer destination;
+			destination.buffer = readbackBuffer;
+			destination.layout.offset = offset;
+			destination.layout.bytesPerRow = paddedBytesPerRow(size);
+			destination.layout.rowsPerImage = size;
+			encoder.copyTextureToBuffer(source, destination, { size, size, 6 });
+			offset += uint64_t(paddedBytesPerRow(size)) * size * 6;
+		}
+	}
+	else if (!environment->radiance.empty()) {
+		size_t offset = 0;
+		for (uint32_t level = 0; level < LevelCount; ++level) {
+			uint32_t size = levelSize(level);
+			ImageCopyTexture destination;
+			destination.texture = mRadiance;
+			destination.mipLevel = level;
+			destination.origin = { 0, 0, 0 };
+			destination.aspect = TextureAspect::All;
+			TextureDataLayout source;
+			source.offset = 0;
+			source.bytesPerRow = size * BytesPerTexel;
+			source.rowsPerImage = size;
+			size_t levelTexelCount = size_t(6) * size * size;
+			queue.writeTexture(destination, environment->radiance.data() + offset, levelTexelCount * BytesPerTexel, source, { size, size, 6 });
+			offset += levelTexelCount * 4;
+		}
+	}
+	else {
+		// Could not be prefiltered, lighting nothing rather than what the texture holds
+		uniforms = {};
+	}
+	queue.writeBuffer(mUniformBuffer, 0, &uniforms, sizeof(Uniforms));
+
+	CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+	encoder.release();
+	queue.submit(commands);
+	commands.release();
+	if (!prefiltered) {
+		release();
+		co_return radiance;
+	}
+
+	BufferMapAsyncStatus status = co_await DeviceEvents::mapAsync(readbackBuffer, MapMode::Read, 0, readbackBytes);
+	if (status == BufferMapAsyncStatus::Success) {
+		const std::byte* texels = static_cast<const std::byte*>(readbackBuffer.getConstMappedRange(0, readbackBytes));
+		radiance.resize(radianceTexelCount() * 4);
+		std::byte* destination = reinterpret_cast<std::byte*>(radiance.data());
+		for (uint32_t level = 0; level < LevelCount; ++level) {
+			uint32_t size = levelSize(level);
+			for (uint32_t row = 0; row < size * 6; ++row) {
+				std::memcpy(destination, texels + size_t(row) * paddedBytesPerRow(size), size * BytesPerTexel);
+				destination += size * BytesPerTexel;
+			}
+			texels += size_t(paddedBytesPerRow(size)) * size * 6;
+		}
+		readbackBuffer.unmap();
+	}
+	else {
+		std::cerr << "Could not read back the prefiltered environment (" << status << ")" << std::endl;
+	}
+	release();
+	co_return radiance;
+}
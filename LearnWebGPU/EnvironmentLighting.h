@@ -0,0 +1,112 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "Task.h"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Image-based lighting from an equirectangular HDR environment (e.g. a .hdr file),
+ * preprocessed once into what shading needs a few fetches of:
+ *  - its radiance prefiltered with the GGX lobe for increasing roughnesses, one per
+ *    level of a cubemap, by a compute pass that importance samples the environment
+ *    at the mip level whose texels cover the solid angle of each sample;
+ *  - its irradiance, as the 9 coefficients of its projection on spherical harmonics
+ *    convolved with the cosine lobe (Ramamoorthi and Hanrahan);
+ *  - the table of the scale and bias of F0 by N.V and roughness, of the split sum
+ *    approximation, which depends on no environment.
+ *
+ * The radiance and irradiance are stored next to the environment (as
+ * `<name>.iblcache`) along with the hash of its content, so that later runs map them
+ * instead of decoding the environment and convolving it again. The table takes a
+ * single small dispatch, so it is built on every run.
+ *
+ * Directions of the environment are those of the scene, +Z being up. Until an
+ * environment is uploaded, everything is black and lights nothing.
+ */
+class EnvironmentLighting {
+public:
+	static constexpr uint32_t FaceSize = 128;
+	// Roughness 0 at the first level to 1 at the last one
+	static constexpr uint32_t LevelCount = 6;
+	static constexpr uint32_t BrdfLutSize = 128;
+	static constexpr wgpu::TextureFormat Format = wgpu::TextureFormat::RGBA16Float;
+
+	/**
+	 * The EnvironmentUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		// RGB coefficients of the irradiance over pi, for shading to multiply by the albedo
+		std::array<glm::vec4, 9> irradiance = {};
+		float levelCount = 0.0f;
+		float _pad[3] = {};
+	};
+	static_assert(sizeof(Uniforms) == 160);
+
+	/**
+	 * An environment as load() finds it, either prefiltered by an earlier run or decoded
+	 */
+	struct Environment {
+		uint64_t hash = 0;
+		Uniforms uniforms;
+		// From the cache, the RGBA16F texels of the levels of the cubemap, faces one after the other
+		std::vector<uint16_t> radiance;
+		// Otherwise, the RGBA16F texels of the equirectangular image and of its mip levels
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t mipLevelCount = 0;
+		std::vector<uint16_t> texels;
+	};
+
+	// Map the cache of the environment at `path` if it holds its current content, or decode it
+	// and project its irradiance. Safe to call from any thread.
+	static bool load(const std::filesystem::path& path, Environment& environment);
+	// Store `radiance`, as upload() read it back, and the irradiance of `environment` in the cache
+	// of the environment at `path`. Safe to call from any thread.
+	static bool writeCache(const std::filesystem::path& path, const Environment& environment, std::span<const uint16_t> radiance);
+
+	EnvironmentLighting(wgpu::Device device, PipelineCache& pipelineCache);
+	~EnvironmentLighting();
+
+	EnvironmentLighting(const EnvironmentLighting&) = delete;
+	EnvironmentLighting& operator=(const EnvironmentLighting&) = delete;
+
+	bool valid() const { return mRadiance && mBrdfLut && mUniformBuffer; }
+
+	// Upload `environment`, prefiltered on the GPU unless it came from the cache, and build the
+	// BRDF table the first time. Awaited on the device thread, where it resumes with the radiance
+	// read back for writeCache(), empty if it came from the cache or could not be read back.
+	Task<std::vector<uint16_t>> upload(std::shared_ptr<const Environment> environment);
+
+	// Bound by the passes shading with the environment
+	wgpu::TextureView radianceView() const { return mRadianceView; }
+	wgpu::TextureView brdfLutView() const { return mBrdfLutView; }
+	wgpu::Sampler sampler() const { return mSampler; }
+	wgpu::Buffer uniformBuffer() const { return mUniformBuffer; }
+
+private:
+	wgpu::Device mDevice;
+	PipelineCache& mPipelineCache;
+	wgpu::Texture mRadiance = nullptr;
+	wgpu::TextureView mRadianceView = nullptr;
+	wgpu::Texture mBrdfLut = nullptr;
+	wgpu::TextureView mBrdfLutView = nullptr;
+	wgpu::Buffer mUniformBuffer = nullptr;
+	bool mBrdfLutBuilt = false;
+
+	// Owned by the pipeline cache
+	wgpu::Sampler mSampler = nullptr;
+	wgpu::Sampler mSourceSampler = nullptr;
+	wgpu::BindGroupLayout mPrefilterLayout = nullptr;
+	wgpu::BindGroupLayout mBrdfLutLayout = nullptr;
+	PipelineCache::AsyncComputePipeline mPrefilterPipeline;
+	PipelineCache::AsyncComputePipeline mBrdfLutPipeline;
+};
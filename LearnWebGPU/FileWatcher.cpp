@@ -0,0 +1,64 @@
+#include "FileWatcher.h"
+
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+FileWatcher::FileWatcher(const fs::path& directory, std::chrono::milliseconds interval)
+	: mDirectory(directory)
+	, mInterval(interval)
+	, mNextPoll(std::chrono::steady_clock::now() + interval)
+{
+	// Files already there are the reference state, not changes
+	std::vector<fs::path> changes;
+	scan(changes);
+}
+
+std::vector<fs::path> FileWatcher::poll() {
+	std::vector<fs::path> changes;
+	auto now = std::chrono::steady_clock::now();
+	if (now < mNextPoll) return changes;
+	mNextPoll = now + mInterval;
+
+	scan(changes);
+	return changes;
+}
+
+void FileWatcher::scan(std::vector<fs::path>& changes) {
+	for (WatchedFile& file : mFiles) {
+		file.found = false;
+	}
+
+	// Errors (e.g., a file removed while iterating) are not fatal, the next scan catches up
+	std::error_code error;
+	for (fs::recursive_directory_iterator it(mDirectory, error), end; !error && it != end; it.increment(error)) {
+		if (!it->is_regular_file(error)) continue;
+		fs::file_time_type lastWriteTime = it->last_write_time(error);
+		if (error) continue;
+
+		auto watched = std::find_if(mFiles.begin(), mFiles.end(), [&](const WatchedFile& file) {
+			return file.path == it->path();
+		});
+		if (watched == mFiles.end()) {
+			mFiles.push_back({ it->path(), lastWriteTime, true });
+			changes.push_back(it->path());
+		}
+		else {
+			if (watched->lastWriteTime != lastWriteTime) changes.push_back(it->path());
+			watched->lastWriteTime = lastWriteTime;
+			watched->found = true;
+		}
+	}
+	if (error) {
+		// Keep the previous state rather than reporting every file as removed
+		for (WatchedFile& file : mFiles) {
+			file.found = true;
+		}
+		return;
+	}
+
+	std::erase_if(mFiles, [&](const WatchedFile& file) {
+		if (!file.found) changes.push_back(file.path);
+		return !file.found;
+	});
+}
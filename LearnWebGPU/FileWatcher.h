@@ -0,0 +1,42 @@
+#pragma once
+
+#include <filesystem>
+#include <chrono>
+#include <vector>
+
+/**
+ * Detect changes to the files of a directory (and its sub-directories) by polling
+ * their modification time, which needs no platform specific notification API and
+ * is cheap enough for a directory of resources to be checked from the frame loop.
+ *
+ * Editors often save files by writing them in several steps, so a file may be
+ * reported while it is still being written and then once more when it is done.
+ */
+class FileWatcher {
+public:
+	// Watch the files present in `directory`, checking them at most every `interval`
+	explicit FileWatcher(const std::filesystem::path& directory, std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+
+	// Files created, modified or removed since the previous call, if the interval elapsed
+	std::vector<std::filesystem::path> poll();
+
+private:
+	/**
+	 * State of a watched file when last checked
+	 */
+	struct WatchedFile {
+		std::filesystem::path path;
+		std::filesystem::file_time_type lastWriteTime;
+		// Still found in the directory by the last scan
+		bool found = true;
+	};
+
+	// Update mFiles from the directory, appending changed paths to `changes`
+	void scan(std::vector<std::filesystem::path>& changes);
+
+private:
+	std::filesystem::path mDirectory;
+	std::chrono::milliseconds mInterval;
+	std::chrono::steady_clock::time_point mNextPoll;
+	std::vector<WatchedFile> mFiles;
+};
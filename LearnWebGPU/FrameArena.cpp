@@ -0,0 +1,44 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <bit>
+
+FrameArena::FrameArena(uint32_t frameCount, size_t initialSize)
+	: mRegions(std::max(1u, frameCount))
+{
+	for (Region& region : mRegions) {
+		region.memory.reset(new std::byte[initialSize]);
+		region.capacity = initialSize;
+	}
+}
+
+void FrameArena::beginFrame() {
+	mFrameIndex = (mFrameIndex + 1) % mRegions.size();
+	Region& region = mRegions[mFrameIndex];
+	if (!region.overflow.empty()) {
+		// Fit the whole of the last frame that used this region
+		region.overflow.clear();
+		region.capacity = std::bit_ceil(region.usedBytes);
+		region.memory.reset(new std::byte[region.capacity]);
+	}
+	region.offset = 0;
+	region.usedBytes = 0;
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment) {
+	Region& region = mRegions[mFrameIndex];
+	uintptr_t base = reinterpret_cast<uintptr_t>(region.memory.get());
+	size_t offset = ((base + region.offset + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+	if (offset + size <= region.capacity) {
+		region.usedBytes += offset + size - region.offset;
+		region.offset = offset + size;
+		return region.memory.get() + offset;
+	}
+
+	// Blocks of new[] are aligned for any fundamental type, only over-aligned types need padding
+	size_t padding = alignment > alignof(std::max_align_t) ? alignment - 1 : 0;
+	region.usedBytes += size + padding;
+	region.overflow.emplace_back(new std::byte[size + padding]);
+	uintptr_t block = reinterpret_cast<uintptr_t>(region.overflow.back().get());
+	return reinterpret_cast<void*>((block + alignment - 1) & ~uintptr_t(alignment - 1));
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Linear allocator for CPU data that only lives for a frame, e.g. the list of
+ * command buffers to submit, so that a frame does not go through malloc.
+ *
+ * Allocations bump an offset in a block reserved up front, and are never freed
+ * one by one: beginFrame() releases them all at once. The arena cycles through
+ * `frameCount` such regions, one per frame, so that what a frame allocated stays
+ * valid during the next `frameCount - 1` frames, e.g. for callbacks of the GPU
+ * about that frame.
+ *
+ * When a frame asks for more than its region holds, the rest goes to blocks of
+ * its own, and the region grows to fit all of it the next time it is reused, so
+ * that after a few frames nothing is allocated any more.
+ *
+ * An arena is used by a single thread.
+ */
+class FrameArena {
+public:
+	// Regions of `initialSize` bytes for `frameCount` frames
+	explicit FrameArena(uint32_t frameCount = 2, size_t initialSize = 64 * 1024);
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// Move on to the region of the next frame, releasing what was allocated in it
+	void beginFrame();
+
+	// Uninitialized memory valid until the current region is reused, `alignment`
+	// being a power of two
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	// Bytes allocated since the last beginFrame()
+	size_t usedBytes() const { return mRegions[mFrameIndex].usedBytes; }
+
+private:
+	struct Region {
+		std::unique_ptr<std::byte[]> memory;
+		size_t capacity = 0;
+		size_t offset = 0;
+		// Including the padding, and what did not fit in `memory`
+		size_t usedBytes = 0;
+		// Allocations that did not fit, freed with the region
+		std::vector<std::unique_ptr<std::byte[]>> overflow;
+	};
+
+	std::vector<Region> mRegions;
+	uint32_t mFrameIndex = 0;
+};
+
+/**
+ * Standard allocator handing out memory of a FrameArena, for containers that
+ * only live for a frame (see FrameVector). Deallocation does nothing.
+ */
+template <typename T>
+class FrameAllocator {
+public:
+	using value_type = T;
+
+	explicit FrameAllocator(FrameArena& arena) : mArena(&arena) {}
+
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>& other) : mArena(other.arena()) {}
+
+	T* allocate(size_t count) {
+		return static_cast<T*>(mArena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	FrameArena* arena() const { return mArena; }
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U>& other) const { return mArena == other.arena(); }
+
+private:
+	FrameArena* mArena;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
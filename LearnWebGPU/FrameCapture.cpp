@@ -0,0 +1,193 @@
+#include "FrameCapture.h"
+#include "Trace.h"
+
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+using namespace wgpu;
+
+namespace {
+
+bool hasJpegExtension(const std::string& path) {
+	std::string extension = path.substr(std::min(path.find_last_of('.'), path.size()));
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return extension == ".jpg" || extension == ".jpeg";
+}
+
+} // anonymous namespace
+
+FrameCapture::FrameCapture(Device device, uint32_t bufferCount, unsigned int encoderThreadCount)
+	// Buffers are created by the first captures, of the size they need
+	: mReadbacks(device, bufferCount, 0, "Frame capture readback buffer", "FrameCapture")
+	, mCaptures(mReadbacks.slotCount())
+	, mEncoder(encoderThreadCount)
+	, mStreamWriter(1)
+{
+}
+
+FrameCapture::~FrameCapture() {
+	// Captures that made it to the CPU are written before quitting
+	mReadbacks.wait();
+	poll();
+	while (mEncoder.pendingCount() > 0 || mStreamWriter.pendingCount() > 0) {
+		mEncoder.processCompletions();
+		mStreamWriter.processCompletions();
+		std::this_thread::yield();
+	}
+	if (mStreamFile) std::fclose(mStreamFile);
+}
+
+bool FrameCapture::supports(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::RGBA8Unorm:
+	case TextureFormat::RGBA8UnormSrgb:
+	case TextureFormat::BGRA8Unorm:
+	case TextureFormat::BGRA8UnormSrgb:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool FrameCapture::capture(CommandEncoder encoder, Texture texture, uint32_t width, uint32_t height, std::string path) {
+	Capture* capture = mEncoder.pendingCount() < MaxPendingEncodes ? copy(encoder, texture, width, height) : nullptr;
+	if (!capture) {
+		++mDroppedCount;
+		return false;
+	}
+	capture->path = std::move(path);
+	return true;
+}
+
+void FrameCapture::openStream(std::string path) {
+	mStreamPath = path;
+	mStreamWidth = 0;
+	mStreamHeight = 0;
+	mStreamWriter.enqueue([this, path]() -> AssetLoader::Completion {
+		mStreamFile = std::fopen(path.c_str(), "wb");
+		if (mStreamFile) return {};
+		return [this, path]() {
+			std::cerr << "Could not open the frame stream '" << path << "'" << std::endl;
+			mStreamPath.clear();
+		};
+	});
+}
+
+bool FrameCapture::stream(CommandEncoder encoder, Texture texture, uint32_t width, uint32_t height) {
+	if (!streaming()) return false;
+	// The reader cannot tell where frames of another size start
+	bool sizeMatches = mStreamWidth == 0 || (width == mStreamWidth && height == mStreamHeight);
+	Capture* capture = sizeMatches && mStreamWriter.pendingCount() < MaxPendingStreamFrames
+		? copy(encoder, texture, width, height) : nullptr;
+	if (!capture) {
+		++mDroppedCount;
+		return false;
+	}
+	if (mStreamWidth == 0) {
+		std::cout << "Streaming " << width << "x" << height << " RGBA frames to " << mStreamPath << std::endl;
+		mStreamWidth = width;
+		mStreamHeight = height;
+	}
+	capture->path.clear();
+	return true;
+}
+
+FrameCapture::Capture* FrameCapture::copy(CommandEncoder encoder, Texture texture, uint32_t width, uint32_t height) {
+	TextureFormat format = texture.getFormat();
+	if (!supports(format) || width == 0 || height == 0) return nullptr;
+	uint32_t bytesPerRow = (4 * width + 255) & ~255u;
+	uint32_t slot = mReadbacks.reserve(uint64_t(bytesPerRow) * height);
+	if (slot == ReadbackPool::NoSlot) return nullptr;
+
+	ImageCopyTexture source{};
+	source.texture = texture;
+	source.mipLevel = 0;
+	source.origin = { 0, 0, 0 };
+	source.aspect = TextureAspect::All;
+	ImageCopyBuffer destination{};
+	destination.buffer = mReadbacks.buffer(slot);
+	destination.layout.offset = 0;
+	destination.layout.bytesPerRow = bytesPerRow;
+	destination.layout.rowsPerImage = height;
+	encoder.copyTextureToBuffer(source, destination, { width, height, 1 });
+
+	Capture& capture = mCaptures[slot];
+	capture.width = width;
+	capture.height = height;
+	capture.bytesPerRow = bytesPerRow;
+	capture.bgra = format == TextureFormat::BGRA8Unorm || format == TextureFormat::BGRA8UnormSrgb;
+	return &capture;
+}
+
+void FrameCapture::readBack() {
+	// Captures that fail to map are dropped
+	for (uint32_t slot = 0; slot < mReadbacks.slotCount(); ++slot) {
+		if (mReadbacks.state(slot) != ReadbackPool::State::Recording) continue;
+		mReadbacks.map(slot, uint64_t(mCaptures[slot].bytesPerRow) * mCaptures[slot].height);
+	}
+}
+
+void FrameCapture::poll() {
+	for (uint32_t slot = 0; slot < mReadbacks.slotCount(); ++slot) {
+		if (mReadbacks.state(slot) != ReadbackPool::State::Mapped) continue;
+		const Capture& readback = mCaptures[slot];
+
+		// Tightly packed, and the buffer free again right away
+		TRACE_SCOPE("Copy frame capture");
+		uint32_t rowSize = 4 * readback.width;
+		std::vector<uint8_t> pixels(size_t(rowSize) * readback.height);
+		const uint8_t* mapped = static_cast<const uint8_t*>(mReadbacks.mappedRange(slot, uint64_t(readback.bytesPerRow) * readback.height));
+		for (uint32_t y = 0; y < readback.height; ++y) {
+			std::memcpy(pixels.data() + size_t(y) * rowSize, mapped + size_t(y) * readback.bytesPerRow, rowSize);
+		}
+		mReadbacks.release(slot);
+
+		if (readback.path.empty()) {
+			mStreamWriter.enqueue([this, pixels = std::move(pixels), bgra = readback.bgra]() mutable -> AssetLoader::Completion {
+				TRACE_SCOPE("Write frame stream");
+				// Dropped, the stream having failed
+				if (!mStreamFile) return {};
+				if (bgra) {
+					for (size_t i = 0; i < pixels.size(); i += 4) std::swap(pixels[i], pixels[i + 2]);
+				}
+				if (std::fwrite(pixels.data(), 1, pixels.size(), mStreamFile) == pixels.size()) {
+					return [this]() { ++mStreamedCount; };
+				}
+				// E.g. the reader of the pipe quit
+				std::fclose(mStreamFile);
+				mStreamFile = nullptr;
+				return [this]() {
+					std::cerr << "Frame stream '" << mStreamPath << "' closed after " << mStreamedCount << " frames" << std::endl;
+					mStreamPath.clear();
+				};
+			});
+			continue;
+		}
+		mEncoder.enqueue([this, pixels = std::move(pixels), width = readback.width, height = readback.height, bgra = readback.bgra, path = readback.path]() mutable -> AssetLoader::Completion {
+			TRACE_SCOPE("Encode frame capture");
+			// Opaque, whatever alpha the surface got
+			for (size_t i = 0; i < pixels.size(); i += 4) {
+				if (bgra) std::swap(pixels[i], pixels[i + 2]);
+				pixels[i + 3] = 255;
+			}
+			int w = static_cast<int>(width);
+			int h = static_cast<int>(height);
+			bool written = hasJpegExtension(path)
+				? stbi_write_jpg(path.c_str(), w, h, 4, pixels.data(), 90) != 0
+				: stbi_write_png(path.c_str(), w, h, 4, pixels.data(), 4 * w) != 0;
+			if (written) return {};
+			return [this, path]() {
+				std::cerr << "Could not write frame capture '" << path << "'" << std::endl;
+				++mFailedCount;
+			};
+		});
+	}
+	mEncoder.processCompletions();
+	mStreamWriter.processCompletions();
+}
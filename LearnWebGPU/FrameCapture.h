@@ -0,0 +1,115 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "AssetLoader.h"
+#include "ReadbackPool.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * Save frames to image files without ever stalling the CPU or the GPU, for
+ * screenshots and for capturing image sequences of whole sessions.
+ *
+ * A capture copies the texture to one of a pool of MapRead staging buffers at the
+ * end of the frame's commands, and the buffer is mapped asynchronously once the
+ * frame is submitted. A few frames later, poll() finds it mapped, copies the rows
+ * out and hands them to worker threads that encode them to PNG, or to JPEG for
+ * paths ending in .jpg or .jpeg, and write the file. A capture is dropped when
+ * every staging buffer is in use or too many frames wait for encoding, which
+ * keeps sequences from slowing the frames down when encoding cannot keep up.
+ *
+ * Frames can also be streamed, uncompressed, to a file or named pipe read by an
+ * external encoder, which can then use the hardware video encoder of the platform
+ * (e.g. ffmpeg with h264_nvenc, h264_vaapi or h264_videotoolbox): the CPU only
+ * copies the rows to the stream, in the order of the frames, from a thread of its
+ * own with a bounded queue, frames being dropped when the reader falls behind.
+ *
+ * Copies need the texture to have the CopySrc usage, and formats of 4 8-bit
+ * channels, whose bytes are written as they are: sRGB formats are saved encoded.
+ * Like the rest of the device, it must only be used from the device thread.
+ */
+class FrameCapture {
+public:
+	// Up to `bufferCount` captures in flight on the GPU, and `encoderThreadCount` threads
+	// encoding them
+	FrameCapture(wgpu::Device device, uint32_t bufferCount = 4, unsigned int encoderThreadCount = 2);
+	// Wait for the readbacks in flight and for the files being encoded
+	~FrameCapture();
+
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+	// Whether `texture` can be captured, given its format
+	static bool supports(wgpu::TextureFormat format);
+
+	// Record the copy of the `width` x `height` top left corner of `texture` to save it to
+	// `path`, after the passes writing it, or return false if the capture is dropped
+	bool capture(wgpu::CommandEncoder encoder, wgpu::Texture texture, uint32_t width, uint32_t height, std::string path);
+
+	// Write the frames of stream() to `path` as raw RGBA, for a reader expecting the size of the
+	// first frame, e.g. `ffmpeg -f rawvideo -pixel_format rgba -video_size 1920x1080
+	// -framerate 60 -i <path> -c:v h264_nvenc ...`. Opened by the writer thread, which waits
+	// there for a named pipe to have a reader.
+	void openStream(std::string path);
+	bool streaming() const { return !mStreamPath.empty(); }
+	// Record the copy of a frame for the stream, or return false if it is dropped, which it
+	// also is when its size is not the one of the first frame
+	bool stream(wgpu::CommandEncoder encoder, wgpu::Texture texture, uint32_t width, uint32_t height);
+
+	// Map the captures recorded since the last call once their frame is submitted
+	void readBack();
+
+	// Hand the mapped captures to the encoder threads, and report the files they wrote
+	void poll();
+
+	// Captures that were dropped, and files that could not be written, since creation
+	uint64_t droppedCount() const { return mDroppedCount; }
+	uint64_t failedCount() const { return mFailedCount; }
+	uint64_t streamedCount() const { return mStreamedCount; }
+
+private:
+	/**
+	 * The pixels of a capture in a slot of the readback pool
+	 */
+	struct Capture {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		// Of the rows in the buffer, rounded up to 256 bytes as copies require
+		uint32_t bytesPerRow = 0;
+		// Whether red and blue are swapped, as in BGRA formats
+		bool bgra = false;
+		// Path of the file to save, empty for frames of the stream
+		std::string path;
+	};
+
+	// Frames waiting for the encoder threads beyond which captures are dropped
+	static constexpr size_t MaxPendingEncodes = 8;
+	// Same for the stream writer, at about 8 MB a frame in 1080p
+	static constexpr size_t MaxPendingStreamFrames = 3;
+
+	// The capture of a free readback slot with the copy of `texture` recorded into it, or null
+	Capture* copy(wgpu::CommandEncoder encoder, wgpu::Texture texture, uint32_t width, uint32_t height);
+
+private:
+	ReadbackPool mReadbacks;
+	// Per readback slot
+	std::vector<Capture> mCaptures;
+	AssetLoader mEncoder;
+	uint64_t mDroppedCount = 0;
+	// Written by the completions of the encoder, on the device thread
+	uint64_t mFailedCount = 0;
+
+	// Writes frames one at a time, in order
+	AssetLoader mStreamWriter;
+	std::string mStreamPath;
+	// Of the first frame of the stream, 0 x 0 before it
+	uint32_t mStreamWidth = 0;
+	uint32_t mStreamHeight = 0;
+	uint64_t mStreamedCount = 0;
+	// Only used by the writer thread
+	std::FILE* mStreamFile = nullptr;
+};
@@ -0,0 +1,33 @@
+#include "FrameClock.h"
+
+#include <algorithm>
+#include <cmath>
+
+FrameClock::FrameClock(double step, uint32_t maxStepCount)
+	: mStep(step > 0.0 ? step : 1.0 / 120.0)
+	, mMaxStepCount(std::max(maxStepCount, 1u))
+{}
+
+void FrameClock::reset(double time) {
+	mStarted = true;
+	mTime = time;
+	mFrameDelta = 0.0;
+	mAccumulator = 0.0;
+	mStepCount = 0;
+}
+
+void FrameClock::advance(double time) {
+	if (!mStarted) {
+		reset(time);
+		return;
+	}
+	// Clocks going backwards, e.g. when a benchmark starts, do not undo steps
+	mFrameDelta = std::max(time - mTime, 0.0);
+	mTime = time;
+	mAccumulator += mFrameDelta;
+	double steps = std::floor(mAccumulator / mStep);
+	mStepCount = static_cast<uint32_t>(std::min(steps, double(mMaxStepCount)));
+	mAccumulator -= mStepCount * mStep;
+	if (mAccumulator >= mStep) mAccumulator = std::fmod(mAccumulator, mStep);
+	mAccumulator = std::max(mAccumulator, 0.0);
+}
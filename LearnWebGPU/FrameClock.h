@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Clock of the frames, which runs the simulation in steps of a fixed duration
+ * whatever the frame rate, and tells how far between two steps a frame lies.
+ *
+ * Each frame accumulates the time elapsed since the previous one and runs as
+ * many steps as fit in it, carrying the remainder over to the next frame. The
+ * state rendered is interpolated between the last two steps by interpolation(),
+ * so that motion stays smooth when frames and steps do not line up. After a
+ * stall, e.g. a frame skipped by render-on-demand, at most maxStepCount steps
+ * run and the rest of the time is dropped, the simulation slowing down rather
+ * than spending the next frames catching up.
+ */
+class FrameClock {
+public:
+	explicit FrameClock(double step = 1.0 / 120.0, uint32_t maxStepCount = 8);
+
+	// Start from `time`, in seconds, with no step pending
+	void reset(double time);
+
+	// Start a frame at `time`, in seconds, the first one resetting the clock
+	void advance(double time);
+
+	// Time of the current frame, and since the previous one
+	double time() const { return mTime; }
+	double frameDelta() const { return mFrameDelta; }
+
+	// Duration of a step, and number of steps the current frame runs
+	double step() const { return mStep; }
+	uint32_t stepCount() const { return mStepCount; }
+
+	// Fraction of a step from the last step run to the current frame, in [0, 1)
+	float interpolation() const { return static_cast<float>(mAccumulator / mStep); }
+
+private:
+	double mStep;
+	uint32_t mMaxStepCount;
+	bool mStarted = false;
+	double mTime = 0.0;
+	double mFrameDelta = 0.0;
+	// Time elapsed and not simulated yet, less than a step
+	double mAccumulator = 0.0;
+	uint32_t mStepCount = 0;
+};
@@ -0,0 +1,110 @@
+#include "FrameCounters.h"
+
+#include <atomic>
+#include <mutex>
+#include <ostream>
+
+namespace {
+
+struct Counters {
+	// Of the current frame, added to from any thread
+	std::array<std::atomic<uint64_t>, static_cast<size_t>(FrameCounter::Count)> current = {};
+	// Read from any thread, written by endFrame()
+	std::mutex mutex;
+	FrameCounts lastFrame;
+	FrameCounts totals;
+	uint64_t frameCount = 0;
+};
+
+Counters& counters() {
+	static Counters counters;
+	return counters;
+}
+
+} // anonymous namespace
+
+const char* frameCounterName(FrameCounter counter) {
+	switch (counter) {
+	case FrameCounter::DrawCalls: return "draw_calls";
+	case FrameCounter::Instances: return "instances";
+	case FrameCounter::TrianglesSubmitted: return "triangles_submitted";
+	case FrameCounter::TrianglesCulled: return "triangles_culled";
+	case FrameCounter::PipelineSwitches: return "pipeline_switches";
+	case FrameCounter::BindGroupSwitches: return "bind_group_switches";
+	case FrameCounter::StateChangesFiltered: return "state_changes_filtered";
+	case FrameCounter::BytesWritten: return "bytes_written";
+	case FrameCounter::ObjectsCreated: return "objects_created";
+	case FrameCounter::ObjectsDestroyed: return "objects_destroyed";
+	default: return "unknown";
+	}
+}
+
+FrameCounts& FrameCounts::operator+=(const FrameCounts& other) {
+	for (size_t i = 0; i < values.size(); ++i) {
+		values[i] += other.values[i];
+	}
+	return *this;
+}
+
+void FrameCounters::add(FrameCounter counter, uint64_t value) {
+	counters().current[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+void FrameCounters::add(const FrameCounts& counts) {
+	Counters& c = counters();
+	for (size_t i = 0; i < counts.values.size(); ++i) {
+		if (counts.values[i] != 0) c.current[i].fetch_add(counts.values[i], std::memory_order_relaxed);
+	}
+}
+
+void FrameCounters::endFrame() {
+	Counters& c = counters();
+	FrameCounts frame;
+	for (size_t i = 0; i < frame.values.size(); ++i) {
+		frame.values[i] = c.current[i].exchange(0, std::memory_order_relaxed);
+	}
+	std::lock_guard<std::mutex> lock(c.mutex);
+	c.lastFrame = frame;
+	c.totals += frame;
+	++c.frameCount;
+}
+
+FrameCounts FrameCounters::lastFrame() {
+	Counters& c = counters();
+	std::lock_guard<std::mutex> lock(c.mutex);
+	return c.lastFrame;
+}
+
+FrameCounts FrameCounters::totals() {
+	Counters& c = counters();
+	std::lock_guard<std::mutex> lock(c.mutex);
+	return c.totals;
+}
+
+uint64_t FrameCounters::frameCount() {
+	Counters& c = counters();
+	std::lock_guard<std::mutex> lock(c.mutex);
+	return c.frameCount;
+}
+
+void FrameCounters::writePrometheus(std::ostream& out, const char* prefix) {
+	FrameCounts frame;
+	FrameCounts totals;
+	uint64_t frameCount = 0;
+	{
+		Counters& c = counters();
+		std::lock_guard<std::mutex> lock(c.mutex);
+		frame = c.lastFrame;
+		totals = c.totals;
+		frameCount = c.frameCount;
+	}
+	out << "# TYPE " << prefix << "frames_total counter\n";
+	out << prefix << "frames_total " << frameCount << "\n";
+	for (size_t i = 0; i < frame.values.size(); ++i) {
+		const char* name = frameCounterName(static_cast<FrameCounter>(i));
+		out << "# TYPE " << prefix << name << " gauge\n";
+		out << prefix << name << " " << frame.values[i] << "\n";
+		out << "# TYPE " << prefix << name << "_total counter\n";
+		out << prefix << name << "_total " << totals.values[i] << "\n";
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+
+/**
+ * What the CPU asked of the GPU in a frame, counted where the commands are recorded
+ * and the data uploaded rather than measured on the GPU
+ */
+enum class FrameCounter {
+	DrawCalls,
+	Instances,
+	// Of the instances drawn, and of those culled on the CPU (the GPU culling its own)
+	TrianglesSubmitted,
+	TrianglesCulled,
+	PipelineSwitches,
+	BindGroupSwitches,
+	// Pipelines, bind groups and buffers already bound, not set again (see RenderStateCache.h)
+	StateChangesFiltered,
+	// Through the upload paths: Application::writeBuffer, UniformRing and UploadManager
+	BytesWritten,
+	// Buffers and textures of createTrackedBuffer/createTrackedTexture and destroyTracked
+	ObjectsCreated,
+	ObjectsDestroyed,
+	Count,
+};
+
+// In snake case, e.g. "draw_calls", as used by the Prometheus metrics and the benchmark report
+const char* frameCounterName(FrameCounter counter);
+
+/**
+ * A value per counter
+ */
+struct FrameCounts {
+	std::array<uint64_t, static_cast<size_t>(FrameCounter::Count)> values{};
+
+	uint64_t& operator[](FrameCounter counter) { return values[static_cast<size_t>(counter)]; }
+	uint64_t operator[](FrameCounter counter) const { return values[static_cast<size_t>(counter)]; }
+	FrameCounts& operator+=(const FrameCounts& other);
+};
+
+/**
+ * Counters of the current frame, which the code recording commands and uploading
+ * data adds to, from any thread (e.g. while recording render bundles in parallel)
+ * at the cost of a relaxed atomic addition. The main thread ends each frame, its
+ * counts then being those that the HUD, the benchmark report and the metrics file
+ * (LEARNWEBGPU_METRICS) pull until the next one ends.
+ *
+ * Commands recorded once and replayed, like render bundles, are counted in a
+ * FrameCounts of their own when recorded, which is added every frame they run.
+ */
+class FrameCounters {
+public:
+	static void add(FrameCounter counter, uint64_t value = 1);
+	static void add(const FrameCounts& counts);
+
+	// Main thread, once per frame: counts added since the previous call become lastFrame()
+	static void endFrame();
+
+	// Counts of the last frame ended, and of all frames ended so far
+	static FrameCounts lastFrame();
+	static FrameCounts totals();
+	static uint64_t frameCount();
+
+	// Write the counters in the Prometheus text format, those of the last frame as gauges
+	// and the totals as counters, each name being prefixed by `prefix`
+	static void writePrometheus(std::ostream& out, const char* prefix = "learnwebgpu_");
+};
@@ -0,0 +1,246 @@
+#include "FrameGovernor.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__EMSCRIPTEN__)
+#include <emscripten/emscripten.h>
+#elif defined(__APPLE__)
+#include <IOKit/ps/IOPowerSources.h>
+#include <notify.h>
+#else
+#include <filesystem>
+#include <fstream>
+#include <string>
+#endif
+
+namespace {
+
+#if defined(__EMSCRIPTEN__)
+// The answers of the browser come asynchronously, and then with each change, the
+// queries reading the last ones
+EM_JS(void, startPowerMonitoring, (), {
+	const power = { charging: -1, level: -1, pressure: 0 };
+	Module.learnWebGpuPower = power;
+	if (typeof navigator !== 'undefined' && navigator.getBattery) {
+		navigator.getBattery().then((battery) => {
+			const update = () => {
+				power.charging = battery.charging ? 1 : 0;
+				power.level = battery.level;
+			};
+			update();
+			battery.addEventListener('chargingchange', update);
+			battery.addEventListener('levelchange', update);
+		}).catch(() => {});
+	}
+	if (typeof PressureObserver !== 'undefined') {
+		const levels = { nominal: 1, fair: 2, serious: 3, critical: 4 };
+		try {
+			new PressureObserver((records) => {
+				power.pressure = levels[records[records.length - 1].state] || 0;
+			}).observe('cpu').catch(() => {});
+		} catch (error) {}
+	}
+});
+
+// -1 while unknown, else whether the battery charges
+EM_JS(int, webBatteryCharging, (), { return Module.learnWebGpuPower.charging; });
+EM_JS(double, webBatteryLevel, (), { return Module.learnWebGpuPower.level; });
+// 0 while unknown, else the level of PowerState::Thermal
+EM_JS(int, webCpuPressure, (), { return Module.learnWebGpuPower.pressure; });
+#elif !defined(_WIN32) && !defined(__APPLE__)
+// First line of a small sysfs file, empty if it cannot be read
+std::string readLine(const std::filesystem::path& path) {
+	std::ifstream file(path);
+	std::string line;
+	std::getline(file, line);
+	return line;
+}
+
+// Millidegrees Celsius, or `fallback` if the file cannot be read
+long readMillidegrees(const std::filesystem::path& path, long fallback) {
+	std::string line = readLine(path);
+	if (line.empty()) return fallback;
+	char* end = nullptr;
+	long value = std::strtol(line.c_str(), &end, 10);
+	return end != line.c_str() ? value : fallback;
+}
+
+// Temperature of a zone against its trip points: fair 10 degrees under the point where it
+// starts throttling passively, serious past it, and critical 5 degrees under the point where
+// the system shuts down. Zones without trip points throttle at 85 degrees.
+PowerState::Thermal zoneThermalState(const std::filesystem::path& zone) {
+	long temperature = readMillidegrees(zone / "temp", 0);
+	if (temperature <= 0) return PowerState::Thermal::Unknown;
+	long passive = 0;
+	long critical = 0;
+	for (int trip = 0;; ++trip) {
+		std::string prefix = "trip_point_" + std::to_string(trip);
+		std::string type = readLine(zone / (prefix + "_type"));
+		if (type.empty()) break;
+		long tripTemperature = readMillidegrees(zone / (prefix + "_temp"), 0);
+		if (tripTemperature <= 0) continue;
+		if (type == "passive" && (passive == 0 || tripTemperature < passive)) passive = tripTemperature;
+		if (type == "critical" && (critical == 0 || tripTemperature < critical)) critical = tripTemperature;
+	}
+	if (passive == 0) passive = critical > 0 ? critical - 15000 : 85000;
+	if (critical == 0) critical = passive + 15000;
+	if (temperature >= critical - 5000) return PowerState::Thermal::Critical;
+	if (temperature >= passive) return PowerState::Thermal::Serious;
+	if (temperature >= passive - 10000) return PowerState::Thermal::Fair;
+	return PowerState::Thermal::Nominal;
+}
+#endif
+
+} // anonymous namespace
+
+const char* powerSourceName(PowerState::Source source) {
+	switch (source) {
+	case PowerState::Source::Mains: return "mains";
+	case PowerState::Source::Battery: return "battery";
+	default: return "unknown";
+	}
+}
+
+const char* thermalStateName(PowerState::Thermal thermal) {
+	switch (thermal) {
+	case PowerState::Thermal::Nominal: return "nominal";
+	case PowerState::Thermal::Fair: return "fair";
+	case PowerState::Thermal::Serious: return "serious";
+	case PowerState::Thermal::Critical: return "critical";
+	default: return "unknown";
+	}
+}
+
+PowerState queryPowerState() {
+	PowerState state;
+#if defined(_WIN32)
+	SYSTEM_POWER_STATUS status;
+	if (GetSystemPowerStatus(&status)) {
+		if (status.ACLineStatus == 1) state.source = PowerState::Source::Mains;
+		else if (status.ACLineStatus == 0) state.source = PowerState::Source::Battery;
+		// 255 when unknown
+		if (status.BatteryLifePercent <= 100) state.batteryLevel = status.BatteryLifePercent / 100.0f;
+		state.powerSaver = status.SystemStatusFlag == 1;
+	}
+#elif defined(__EMSCRIPTEN__)
+	static bool started = false;
+	if (!started) {
+		startPowerMonitoring();
+		started = true;
+	}
+	int charging = webBatteryCharging();
+	// Desktops report a full battery that charges
+	if (charging >= 0) state.source = charging == 1 ? PowerState::Source::Mains : PowerState::Source::Battery;
+	double level = webBatteryLevel();
+	if (level >= 0.0) state.batteryLevel = static_cast<float>(level);
+	state.thermal = static_cast<PowerState::Thermal>(webCpuPressure());
+#elif defined(__APPLE__)
+	CFTimeInterval remaining = IOPSGetTimeRemainingEstimate();
+	state.source = remaining == kIOPSTimeRemainingUnlimited ? PowerState::Source::Mains : PowerState::Source::Battery;
+	// 0 to 4 for nominal, moderate, heavy, trapping and sleeping, see OSThermalNotification.h
+	static int token = 0;
+	static bool registered = notify_register_check("com.apple.system.thermalpressurelevel", &token) == NOTIFY_STATUS_OK;
+	uint64_t pressure = 0;
+	if (registered && notify_get_state(token, &pressure) == NOTIFY_STATUS_OK) {
+		state.thermal = static_cast<PowerState::Thermal>(1 + std::min<uint64_t>(pressure, 3));
+	}
+#else
+	namespace fs = std::filesystem;
+	std::error_code error;
+	bool hasSupply = false;
+	bool discharging = false;
+	for (const fs::directory_entry& supply : fs::directory_iterator("/sys/class/power_supply", error)) {
+		std::string type = readLine(supply.path() / "type");
+		if (type == "Mains" || type == "USB") {
+			hasSupply = true;
+		}
+		else if (type == "Battery" && readLine(supply.path() / "scope") != "Device") {
+			// Not that of a wireless mouse
+			hasSupply = true;
+			discharging = discharging || readLine(supply.path() / "status") == "Discharging";
+			std::string capacity = readLine(supply.path() / "capacity");
+			if (!capacity.empty()) state.batteryLevel = std::clamp(std::atoi(capacity.c_str()) / 100.0f, 0.0f, 1.0f);
+		}
+	}
+	if (hasSupply) state.source = discharging ? PowerState::Source::Battery : PowerState::Source::Mains;
+	state.powerSaver = readLine("/sys/firmware/acpi/platform_profile") == "low-power";
+	for (const fs::directory_entry& zone : fs::directory_iterator("/sys/class/thermal", error)) {
+		if (!zone.path().filename().string().starts_with("thermal_zone")) continue;
+		state.thermal = std::max(state.thermal, zoneThermalState(zone.path()));
+	}
+#endif
+	return state;
+}
+
+FrameGovernor::FrameGovernor(const Settings& settings)
+	: mSettings(settings)
+{}
+
+bool FrameGovernor::update(double time) {
+	if (mLastPollTime >= 0.0 && time - mLastPollTime < mSettings.pollInterval) return false;
+	mLastPollTime = time;
+	return update(time, queryPowerState());
+}
+
+bool FrameGovernor::update(double time, const PowerState& state) {
+	mPowerState = state;
+	Preset preset = presetFor(state);
+	if (preset == mPreset) {
+		mBetterSince = -1.0;
+		return false;
+	}
+	// Presets are ordered from the most to the least power hungry
+	if (preset < mPreset) {
+		if (mBetterSince < 0.0) mBetterSince = time;
+		if (time - mBetterSince < mSettings.recoveryDelay) return false;
+	}
+	mPreset = preset;
+	mBetterSince = -1.0;
+	return true;
+}
+
+FrameGovernor::Targets FrameGovernor::targetsOf(Preset preset) const {
+	Targets targets;
+	switch (preset) {
+	case Preset::Performance:
+		targets = { mSettings.refreshRate, 0.9, 1.0f, false };
+		break;
+	case Preset::Balanced:
+		targets = { 60.0, 0.75, 0.85f, false };
+		break;
+	case Preset::PowerSaving:
+		targets = { 30.0, 0.6, 0.7f, true };
+		break;
+	}
+	targets.frameRate = std::min(targets.frameRate, mSettings.refreshRate);
+	return targets;
+}
+
+double FrameGovernor::frameInterval() const {
+	double frameRate = targets().frameRate;
+	// Vertical sync caps frames at the refresh rate already
+	if (frameRate <= 0.0 || frameRate >= 0.95 * mSettings.refreshRate) return 0.0;
+	return 1.0 / frameRate;
+}
+
+FrameGovernor::Preset FrameGovernor::presetFor(const PowerState& state) const {
+	using Thermal = PowerState::Thermal;
+	bool lowBattery = state.source == PowerState::Source::Battery && state.batteryLevel >= 0.0f && state.batteryLevel < mSettings.lowBattery;
+	if (state.thermal >= Thermal::Serious || state.powerSaver || lowBattery) return Preset::PowerSaving;
+	if (state.thermal == Thermal::Fair || state.source == PowerState::Source::Battery) return Preset::Balanced;
+	return Preset::Performance;
+}
+
+const char* FrameGovernor::presetName(Preset preset) {
+	switch (preset) {
+	case Preset::Performance: return "performance";
+	case Preset::Balanced: return "balanced";
+	case Preset::PowerSaving: return "power saving";
+	default: return "unknown";
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * What the platform tells about the power of the device, each part being unknown
+ * where it does not tell
+ */
+struct PowerState {
+	enum class Source { Unknown, Mains, Battery };
+	// Levels of the thermal pressure of macOS and of the Compute Pressure API of the web
+	enum class Thermal { Unknown, Nominal, Fair, Serious, Critical };
+
+	Source source = Source::Unknown;
+	// Charge of the battery in [0, 1], negative when unknown
+	float batteryLevel = -1.0f;
+	// Whether the user asked the system to save power, e.g. with the battery saver of Windows
+	// or the low-power platform profile of Linux
+	bool powerSaver = false;
+	Thermal thermal = Thermal::Unknown;
+};
+
+const char* powerSourceName(PowerState::Source source);
+const char* thermalStateName(PowerState::Thermal thermal);
+
+// Ask the platform, which may take up to a millisecond: sysfs on Linux, GetSystemPowerStatus
+// on Windows, IOKit and the thermal pressure notifications on macOS, and on the web the Battery
+// Status and Compute Pressure APIs where the browser has them, which answer the next queries
+PowerState queryPowerState();
+
+/**
+ * Frame rate and quality preset of the renderer, picked from the power source
+ * and the thermal state so that laptops keep a steady frame rate rather than
+ * render uncapped until they get hot and throttle.
+ *
+ * On mains and cool, frames run at the refresh rate of the display. On battery,
+ * or once the device warms up, they are capped at 60 Hz and the GPU is given
+ * less of each frame. With a low battery, a power saver or a device that is
+ * hot, frames are capped at 30 Hz, at most at 70% of the resolution, and only
+ * rendered when something changed. The preset is lowered as soon as the state
+ * calls for it, but only raised again once the state stayed better for a while,
+ * so that it does not go back and forth as the device cools down and warms up.
+ *
+ * The application caps frames with frameInterval(), gives targets() to dynamic
+ * resolution as its budget and scale range, and renders on demand when they
+ * say so.
+ */
+class FrameGovernor {
+public:
+	enum class Preset { Performance, Balanced, PowerSaving };
+
+	/**
+	 * What the frames of a preset do
+	 */
+	struct Targets {
+		// At most the refresh rate of the display
+		double frameRate = 60.0;
+		// Fraction of the period of a frame that the GPU may take
+		double gpuBudget = 0.9;
+		float maxRenderScale = 1.0f;
+		bool renderOnDemand = false;
+	};
+
+	struct Settings {
+		double refreshRate = 60.0;
+		// Seconds between two queries of the platform
+		double pollInterval = 2.0;
+		// Seconds that the state must stay better before a higher preset is chosen again
+		double recoveryDelay = 30.0;
+		// Charge under which the battery is saved whatever the thermal state
+		float lowBattery = 0.2f;
+	};
+
+	explicit FrameGovernor(const Settings& settings);
+
+	// Main thread, once per frame starting at `time` seconds: query the platform when due,
+	// and return whether the preset changed
+	bool update(double time);
+	// Same with a known state rather than that of the platform
+	bool update(double time, const PowerState& state);
+
+	Preset preset() const { return mPreset; }
+	const PowerState& powerState() const { return mPowerState; }
+	Targets targets() const { return targetsOf(mPreset); }
+	Targets targetsOf(Preset preset) const;
+
+	// Seconds between the starts of two frames, 0 when they are not capped below the refresh rate
+	double frameInterval() const;
+
+	// Preset that a state calls for, without waiting for it to last
+	Preset presetFor(const PowerState& state) const;
+
+	static const char* presetName(Preset preset);
+
+private:
+	Settings mSettings;
+	Preset mPreset = Preset::Performance;
+	PowerState mPowerState;
+	// Negative until the first query
+	double mLastPollTime = -1.0;
+	// Since when the state calls for a higher preset, negative when it does not
+	double mBetterSince = -1.0;
+};
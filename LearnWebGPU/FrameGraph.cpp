@@ -0,0 +1,119 @@
+#include "FrameGraph.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+FrameGraph::FrameGraph(TexturePool& texturePool)
+	: mTexturePool(texturePool)
+{}
+
+FrameGraph::~FrameGraph() {
+	// Only left when execute() never ran after the last declarations
+	for (Resource& resource : mResources) {
+		if (resource.imported || !resource.texture) continue;
+		mTexturePool.release(resource.texture);
+	}
+}
+
+FrameGraph::TextureHandle FrameGraph::importTexture(const char* name, TextureView view) {
+	Resource resource{ name, Default };
+	resource.imported = true;
+	resource.view = view;
+	mResources.push_back(resource);
+	return static_cast<TextureHandle>(mResources.size() - 1);
+}
+
+FrameGraph::TextureHandle FrameGraph::createTexture(const char* name, const TextureDescriptor& descriptor, bool roundUp) {
+	Resource resource{ name, descriptor };
+	resource.roundUp = roundUp;
+	mResources.push_back(resource);
+	return static_cast<TextureHandle>(mResources.size() - 1);
+}
+
+FrameGraph::PassHandle FrameGraph::addPass(const char* name, Execute execute, bool sideEffects) {
+	mPasses.push_back({ name, std::move(execute), sideEffects });
+	return static_cast<PassHandle>(mPasses.size() - 1);
+}
+
+void FrameGraph::read(PassHandle pass, TextureHandle texture) {
+	mAccesses.push_back({ pass, texture, false });
+}
+
+void FrameGraph::write(PassHandle pass, TextureHandle texture) {
+	mAccesses.push_back({ pass, texture, true });
+}
+
+TextureView FrameGraph::view(TextureHandle texture) const {
+	const Resource& resource = mResources[texture];
+	if (!resource.view) {
+		std::cerr << "Frame graph texture '" << resource.name << "' used outside of the passes declaring it" << std::endl;
+	}
+	return resource.view;
+}
+
+void FrameGraph::execute(CommandEncoder encoder) {
+	// Cull from the last pass back, a pass being kept if something needs what it writes, then
+	// needing what it reads in turn
+	mNeeded.assign(mResources.size(), false);
+	for (size_t i = 0; i < mResources.size(); ++i) {
+		mNeeded[i] = mResources[i].imported;
+	}
+	mCulledPassCount = 0;
+	for (size_t p = mPasses.size(); p-- > 0;) {
+		Pass& pass = mPasses[p];
+		pass.kept = pass.sideEffects;
+		for (const Access& access : mAccesses) {
+			if (access.pass == p && access.write && mNeeded[access.texture]) pass.kept = true;
+		}
+		if (!pass.kept) {
+			++mCulledPassCount;
+			continue;
+		}
+		for (const Access& access : mAccesses) {
+			if (access.pass == p && !access.write) mNeeded[access.texture] = true;
+		}
+	}
+
+	// Lifetimes of the transients over the kept passes
+	for (const Access& access : mAccesses) {
+		if (!mPasses[access.pass].kept) continue;
+		Resource& resource = mResources[access.texture];
+		resource.firstUse = std::min(resource.firstUse, access.pass);
+		resource.lastUse = std::max(resource.lastUse, access.pass);
+	}
+
+	mAcquiredTextures.clear();
+	for (PassHandle p = 0; p < mPasses.size(); ++p) {
+		Pass& pass = mPasses[p];
+		if (!pass.kept) continue;
+
+		for (Resource& resource : mResources) {
+			if (resource.imported || resource.firstUse != p) continue;
+			resource.texture = mTexturePool.acquire(resource.descriptor, resource.roundUp);
+			if (!resource.texture) continue;
+			resource.view = mTexturePool.view(resource.texture);
+			if (std::find(mAcquiredTextures.begin(), mAcquiredTextures.end(), resource.texture) == mAcquiredTextures.end()) {
+				mAcquiredTextures.push_back(resource.texture);
+			}
+		}
+
+		pass.execute(encoder, *this);
+
+		// Given back before the next passes acquire theirs, which may thus get the same texture
+		for (Resource& resource : mResources) {
+			if (resource.imported || resource.lastUse != p || !resource.texture) continue;
+			resource.view = nullptr;
+			mTexturePool.release(resource.texture);
+			resource.texture = nullptr;
+		}
+	}
+	mTransientTextureCount = static_cast<uint32_t>(mAcquiredTextures.size());
+
+	// Captures of the passes go with them
+	mResources.clear();
+	mPasses.clear();
+	mAccesses.clear();
+	mAcquiredTextures.clear();
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "TexturePool.h"
+
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+/**
+ * The passes of a frame, declared with the textures they read and write, then
+ * executed in one go so that their transient textures only exist for as long as
+ * they are used.
+ *
+ * A transient texture is acquired from the texture pool right before the first
+ * kept pass that uses it, and given back right after the last one, so that the
+ * transients of later passes are handed out the same pooled textures whenever
+ * their descriptors match (WebGPU has no memory aliasing across descriptors).
+ * Imported textures, such as the surface texture or persistent targets, are
+ * owned by the caller and their writes are the outputs of the frame.
+ *
+ * Passes run in the order they were added, which must be an order where each
+ * pass comes after those writing what it reads. Those that neither have side
+ * effects (writes to buffers or to resources the graph does not know of) nor
+ * write anything read by a later kept pass or imported are culled and never
+ * execute. Transitions between usages within the command encoder are left to
+ * the WebGPU implementation, which tracks them itself.
+ *
+ * The graph is built again every frame, its containers keeping their capacity
+ * from one frame to the next.
+ */
+class FrameGraph {
+public:
+	using TextureHandle = uint32_t;
+	using PassHandle = uint32_t;
+	// Records the commands of the pass, the views of its textures being available from the graph
+	using Execute = std::function<void(wgpu::CommandEncoder encoder, const FrameGraph& graph)>;
+
+	FrameGraph(TexturePool& texturePool);
+	~FrameGraph();
+
+	FrameGraph(const FrameGraph&) = delete;
+	FrameGraph& operator=(const FrameGraph&) = delete;
+
+	// A texture owned by the caller, which must stay valid until execute() returns
+	TextureHandle importTexture(const char* name, wgpu::TextureView view);
+	// A texture only existing during the passes that use it, of a descriptor whose pointers
+	// (label, view formats) must stay valid until execute() returns
+	TextureHandle createTexture(const char* name, const wgpu::TextureDescriptor& descriptor, bool roundUp = false);
+
+	// A pass, kept even if nothing reads what it writes when `sideEffects`
+	PassHandle addPass(const char* name, Execute execute, bool sideEffects = false);
+	void read(PassHandle pass, TextureHandle texture);
+	void write(PassHandle pass, TextureHandle texture);
+
+	// View of a texture, only valid while a pass declaring it executes
+	wgpu::TextureView view(TextureHandle texture) const;
+
+	// Cull, then execute the passes in order, acquiring and giving back their transient textures,
+	// and clear the graph for the next frame
+	void execute(wgpu::CommandEncoder encoder);
+
+	// Passes that were culled during the last execute(), and distinct pooled textures its
+	// transients were given, fewer than the transients when some shared a texture
+	uint32_t culledPassCount() const { return mCulledPassCount; }
+	uint32_t transientTextureCount() const { return mTransientTextureCount; }
+
+private:
+	struct Resource {
+		const char* name;
+		wgpu::TextureDescriptor descriptor;
+		bool roundUp = false;
+		bool imported = false;
+		wgpu::Texture texture = nullptr;
+		wgpu::TextureView view = nullptr;
+		// Kept passes using it first and last, UINT32_MAX if none
+		PassHandle firstUse = UINT32_MAX;
+		PassHandle lastUse = 0;
+	};
+
+	struct Access {
+		PassHandle pass;
+		TextureHandle texture;
+		bool write;
+	};
+
+	struct Pass {
+		const char* name;
+		Execute execute;
+		bool sideEffects = false;
+		bool kept = false;
+	};
+
+private:
+	TexturePool& mTexturePool;
+	std::vector<Resource> mResources;
+	std::vector<Pass> mPasses;
+	// Declared reads and writes, in order of declaration
+	std::vector<Access> mAccesses;
+	// Pooled textures acquired during execute(), to count them
+	std::vector<wgpu::Texture> mAcquiredTextures;
+	// Whether a texture is read by a kept pass later than the one being culled, or imported
+	std::vector<bool> mNeeded;
+	uint32_t mCulledPassCount = 0;
+	uint32_t mTransientTextureCount = 0;
+};
@@ -0,0 +1,124 @@
+#include "FramePacer.h"
+#include "DeviceEvents.h"
+#include "GpuMemory.h"
+
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+const char* presentModeName(PresentMode presentMode) {
+	switch (presentMode) {
+	case PresentMode::Fifo: return "Fifo";
+	case PresentMode::FifoRelaxed: return "FifoRelaxed";
+	case PresentMode::Immediate: return "Immediate";
+	case PresentMode::Mailbox: return "Mailbox";
+	default: return "Unknown";
+	}
+}
+
+} // anonymous namespace
+
+FramePacer::FramePacer(Device device, Queue queue, uint32_t maxFramesInFlight)
+	: mDevice(device)
+	, mQueue(queue)
+	, mMaxFramesInFlight(std::max(maxFramesInFlight, 1u))
+{
+	GpuRetirement::setFencing(true);
+}
+
+FramePacer::~FramePacer() {
+	waitForFramesInFlight(0);
+	// Resources retired since the last frame, with no frame left to wait for
+	GpuRetirement::setFencing(false);
+	GpuRetirement::flush();
+}
+
+void FramePacer::setMaxFramesInFlight(uint32_t count) {
+	mMaxFramesInFlight = std::max(count, 1u);
+}
+
+uint32_t FramePacer::framesInFlight() {
+	releaseDoneFrames();
+	return static_cast<uint32_t>(mFrames.size());
+}
+
+void FramePacer::waitForFrameSlot() {
+	waitForFramesInFlight(mMaxFramesInFlight - 1);
+}
+
+void FramePacer::submit(std::span<const CommandBuffer> commands) {
+	mFrames.emplace_back();
+	InFlightFrame& frame = mFrames.back();
+	frame.retirementFence = GpuRetirement::fence();
+#ifdef WEBGPU_BACKEND_WGPU
+	frame.submissionIndex = wgpuQueueSubmitForIndex(mQueue, commands.size(), (const WGPUCommandBuffer*)commands.data());
+#else
+	mQueue.submit(commands.size(), commands.data());
+#endif // WEBGPU_BACKEND_WGPU
+	// Whatever the status, the frame no longer holds the GPU
+	frame.callback = mQueue.onSubmittedWorkDone(DeviceEvents::deferred([&frame](QueueWorkDoneStatus) {
+		frame.done = true;
+	}));
+}
+
+void FramePacer::waitForFramesInFlight(uint32_t count) {
+	releaseDoneFrames();
+	while (mFrames.size() > count) {
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+		// Block until the oldest frame is done, rather than all of them, which queues its callback
+		WGPUWrappedSubmissionIndex submissionIndex = { mQueue, mFrames.front().submissionIndex };
+		mDevice.poll(true, &submissionIndex);
+		DeviceEvents::dispatch(mDevice);
+#else
+		DeviceEvents::wait(mDevice);
+#endif
+		releaseDoneFrames();
+	}
+}
+
+void FramePacer::releaseDoneFrames() {
+	// Never called from the callbacks, which must not be destroyed while they run
+	while (!mFrames.empty() && mFrames.front().done) {
+		GpuRetirement::signal(mFrames.front().retirementFence);
+		mFrames.pop_front();
+	}
+}
+
+PresentMode FramePacer::selectPresentMode(Surface surface, Adapter adapter, PresentMode preferred) {
+#ifdef __EMSCRIPTEN__
+	// The browser presents at its own pace
+	(void)surface;
+	(void)adapter;
+	if (preferred != PresentMode::Fifo) {
+		std::cerr << "Present mode " << presentModeName(preferred) << " is not available on the web, using Fifo" << std::endl;
+	}
+	return PresentMode::Fifo;
+#else
+	SurfaceCapabilities capabilities;
+	surface.getCapabilities(adapter, &capabilities);
+	std::vector<PresentMode> supported(capabilities.presentModes, capabilities.presentModes + capabilities.presentModeCount);
+	wgpuSurfaceCapabilitiesFreeMembers(capabilities);
+
+	// Fifo is the only mode every surface supports
+	std::vector<PresentMode> candidates = { preferred };
+	if (preferred == PresentMode::Mailbox) candidates.push_back(PresentMode::Immediate);
+	if (preferred == PresentMode::Immediate) candidates.push_back(PresentMode::Mailbox);
+	candidates.push_back(PresentMode::Fifo);
+	for (PresentMode candidate : candidates) {
+		if (candidate != PresentMode::Fifo && std::find(supported.begin(), supported.end(), candidate) == supported.end()) continue;
+		if (candidate != preferred) {
+			std::cerr << "Present mode " << presentModeName(preferred) << " is not supported, using " << presentModeName(candidate) << std::endl;
+		}
+		return candidate;
+	}
+	return PresentMode::Fifo;
+#endif // __EMSCRIPTEN__
+}
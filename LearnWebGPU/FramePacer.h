@@ -0,0 +1,72 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <deque>
+#include <memory>
+#include <span>
+#include <cstdint>
+
+/**
+ * Limit how many frames the CPU may submit ahead of the GPU. Frames are submitted
+ * through submit(), which tracks their completion with Queue::onSubmittedWorkDone,
+ * and waitForFrameSlot() blocks while maxFramesInFlight of them are not done.
+ *
+ * Fewer frames in flight means less input-to-photon latency, more of them keeps
+ * the GPU busy when frame times vary. Waiting right before sampling input rather
+ * than right before submitting further reduces latency, as the frame is then built
+ * from the latest input instead of queuing behind the frames before it.
+ *
+ * The completion of frames also fences the resources given to retireTracked,
+ * destroyed once the frames that may use them are done (see GpuMemory.h).
+ */
+class FramePacer {
+public:
+	FramePacer(wgpu::Device device, wgpu::Queue queue, uint32_t maxFramesInFlight = 2);
+	// Wait for all frames in flight, whose callbacks refer to this object
+	~FramePacer();
+
+	FramePacer(const FramePacer&) = delete;
+	FramePacer& operator=(const FramePacer&) = delete;
+
+	uint32_t maxFramesInFlight() const { return mMaxFramesInFlight; }
+	void setMaxFramesInFlight(uint32_t count);
+
+	// Number of submitted frames that the GPU has not finished yet
+	uint32_t framesInFlight();
+
+	// Block until fewer than maxFramesInFlight frames are in flight
+	void waitForFrameSlot();
+
+	// Submit the command buffers of a frame at once, in order, and track its completion
+	void submit(std::span<const wgpu::CommandBuffer> commands);
+
+	// The preferred present mode if the surface supports it, otherwise the closest one
+	// that it does: uncapped modes fall back to each other, all eventually to Fifo
+	static wgpu::PresentMode selectPresentMode(wgpu::Surface surface, wgpu::Adapter adapter, wgpu::PresentMode preferred);
+
+private:
+	// Process device events until at most `count` frames are in flight
+	void waitForFramesInFlight(uint32_t count);
+	// Forget frames that are done, which complete in submission order, and destroy the
+	// resources retired before them
+	void releaseDoneFrames();
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	uint32_t mMaxFramesInFlight;
+
+	/**
+	 * A submitted frame, whose address stays the same while it is in the queue
+	 */
+	struct InFlightFrame {
+		std::unique_ptr<wgpu::QueueWorkDoneCallback> callback;
+		bool done = false;
+		// Index of the submission, for wgpu-native to wait for it alone
+		uint64_t submissionIndex = 0;
+		// Of the resources retired before it was submitted (see GpuRetirement)
+		uint64_t retirementFence = 0;
+	};
+	std::deque<InFlightFrame> mFrames;
+};
@@ -0,0 +1,200 @@
+#include "FrustumCulling.h"
+#include "ParallelFor.h"
+#include "Simd.h"
+
+#include <algorithm>
+
+namespace {
+
+// Test spheres [begin, end) one at a time
+size_t cullSpheresScalar(const Frustum& frustum, const BoundingSpheres& spheres, size_t begin, size_t end, uint32_t* visible) {
+	size_t count = 0;
+	for (size_t i = begin; i < end; ++i) {
+		bool inside = true;
+		for (const glm::vec4& plane : frustum.planes) {
+			float distance = plane.x * spheres.x[i] + plane.y * spheres.y[i] + plane.z * spheres.z[i] + plane.w;
+			inside = inside && distance >= -spheres.radius[i];
+		}
+		visible[count] = static_cast<uint32_t>(i);
+		count += inside ? 1 : 0;
+	}
+	return count;
+}
+
+// Append the indices of the lanes set in `mask` among spheres [first, first + lane count)
+inline size_t appendVisible(uint32_t mask, size_t first, uint32_t* visible) {
+	size_t count = 0;
+	for (uint32_t lane = 0; mask != 0; ++lane, mask >>= 1) {
+		visible[count] = static_cast<uint32_t>(first + lane);
+		count += mask & 1;
+	}
+	return count;
+}
+
+// Test as many spheres of [begin, end) as the vector width allows, return the end of the
+// spheres tested (the rest is left to cullSpheresScalar) and add the visible ones to `visibleCount`
+size_t cullSpheresSimd(const Frustum& frustum, const BoundingSpheres& spheres, size_t begin, size_t end, uint32_t* visible, size_t& visibleCount) {
+	size_t i = begin;
+#if defined(SIMD_128)
+	const float* xs = spheres.x.data();
+	const float* ys = spheres.y.data();
+	const float* zs = spheres.z.data();
+	const float* radii = spheres.radius.data();
+#else
+	(void)frustum; (void)spheres; (void)end; (void)visible; (void)visibleCount;
+#endif
+#if defined(SIMD_AVX2)
+	for (; i + 8 <= end; i += 8) {
+		__m256 x = _mm256_loadu_ps(xs + i);
+		__m256 y = _mm256_loadu_ps(ys + i);
+		__m256 z = _mm256_loadu_ps(zs + i);
+		__m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radii + i));
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (const glm::vec4& plane : frustum.planes) {
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane.x)), _mm256_mul_ps(y, _mm256_set1_ps(plane.y))),
+				_mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w))
+			);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+		}
+		visibleCount += appendVisible(static_cast<uint32_t>(_mm256_movemask_ps(inside)), i, visible + visibleCount);
+	}
+#elif defined(SIMD_SSE2)
+	for (; i + 4 <= end; i += 4) {
+		__m128 x = _mm_loadu_ps(xs + i);
+		__m128 y = _mm_loadu_ps(ys + i);
+		__m128 z = _mm_loadu_ps(zs + i);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radii + i));
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (const glm::vec4& plane : frustum.planes) {
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w))
+			);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+		visibleCount += appendVisible(static_cast<uint32_t>(_mm_movemask_ps(inside)), i, visible + visibleCount);
+	}
+#elif defined(SIMD_NEON)
+	// Lane weights turning a comparison mask into a bit mask
+	const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+	uint32x4_t bits = vld1q_u32(laneBits);
+	for (; i + 4 <= end; i += 4) {
+		float32x4_t x = vld1q_f32(xs + i);
+		float32x4_t y = vld1q_f32(ys + i);
+		float32x4_t z = vld1q_f32(zs + i);
+		float32x4_t negativeRadius = vnegq_f32(vld1q_f32(radii + i));
+		uint32x4_t inside = vdupq_n_u32(0xffffffff);
+		for (const glm::vec4& plane : frustum.planes) {
+			float32x4_t distance = vaddq_f32(
+				vaddq_f32(vmulq_n_f32(x, plane.x), vmulq_n_f32(y, plane.y)),
+				vaddq_f32(vmulq_n_f32(z, plane.z), vdupq_n_f32(plane.w))
+			);
+			inside = vandq_u32(inside, vcgeq_f32(distance, negativeRadius));
+		}
+		uint32x4_t laneMask = vandq_u32(inside, bits);
+		uint32x2_t pairs = vadd_u32(vget_low_u32(laneMask), vget_high_u32(laneMask));
+		uint32_t mask = vget_lane_u32(vpadd_u32(pairs, pairs), 0);
+		visibleCount += appendVisible(mask, i, visible + visibleCount);
+	}
+#elif defined(SIMD_WASM)
+	for (; i + 4 <= end; i += 4) {
+		v128_t x = wasm_v128_load(xs + i);
+		v128_t y = wasm_v128_load(ys + i);
+		v128_t z = wasm_v128_load(zs + i);
+		v128_t negativeRadius = wasm_f32x4_neg(wasm_v128_load(radii + i));
+		v128_t inside = wasm_i32x4_splat(-1);
+		for (const glm::vec4& plane : frustum.planes) {
+			v128_t distance = wasm_f32x4_add(
+				wasm_f32x4_add(wasm_f32x4_mul(x, wasm_f32x4_splat(plane.x)), wasm_f32x4_mul(y, wasm_f32x4_splat(plane.y))),
+				wasm_f32x4_add(wasm_f32x4_mul(z, wasm_f32x4_splat(plane.z)), wasm_f32x4_splat(plane.w))
+			);
+			inside = wasm_v128_and(inside, wasm_f32x4_ge(distance, negativeRadius));
+		}
+		visibleCount += appendVisible(wasm_i32x4_bitmask(inside), i, visible + visibleCount);
+	}
+#endif
+	return i;
+}
+
+// Test spheres [begin, end), writing the indices of the visible ones from `visible`
+size_t cullSphereRange(const Frustum& frustum, const BoundingSpheres& spheres, size_t begin, size_t end, uint32_t* visible) {
+	size_t visibleCount = 0;
+	size_t tested = cullSpheresSimd(frustum, spheres, begin, end, visible, visibleCount);
+	return visibleCount + cullSpheresScalar(frustum, spheres, tested, end, visible + visibleCount);
+}
+
+} // anonymous namespace
+
+Frustum Frustum::fromMatrix(const glm::mat4& matrix) {
+	// Rows of the matrix, glm matrices being indexed by column first
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; ++i) {
+		rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+	}
+
+	// Clip volume: -w <= x <= w, -w <= y <= w, 0 <= z <= w
+	Frustum frustum;
+	frustum.planes = {
+		rows[3] + rows[0],
+		rows[3] - rows[0],
+		rows[3] + rows[1],
+		rows[3] - rows[1],
+		rows[2],
+		rows[3] - rows[2],
+	};
+	for (glm::vec4& plane : frustum.planes) {
+		float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f) plane /= length;
+	}
+	return frustum;
+}
+
+void BoundingSpheres::clear() {
+	x.clear();
+	y.clear();
+	z.clear();
+	radius.clear();
+}
+
+void BoundingSpheres::reserve(size_t count) {
+	x.reserve(count);
+	y.reserve(count);
+	z.reserve(count);
+	radius.reserve(count);
+}
+
+void BoundingSpheres::push_back(const glm::vec3& center, float sphereRadius) {
+	x.push_back(center.x);
+	y.push_back(center.y);
+	z.push_back(center.z);
+	radius.push_back(sphereRadius);
+}
+
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible) {
+	// Chunks are tested in parallel, each one writing its visible spheres from where its
+	// own spheres start, which never overwrites those of other chunks, then packed together
+	constexpr size_t chunkSize = 16384;
+	size_t sphereCount = spheres.size();
+	size_t chunkCount = (sphereCount + chunkSize - 1) / chunkSize;
+	if (chunkCount <= 1) return cullSphereRange(frustum, spheres, 0, sphereCount, visible);
+
+	// On the stack up to a million spheres, so that culling every frame does not allocate
+	std::array<size_t, 64> localCounts;
+	std::vector<size_t> heapCounts(chunkCount > localCounts.size() ? chunkCount : 0);
+	size_t* chunkVisibleCounts = heapCounts.empty() ? localCounts.data() : heapCounts.data();
+	parallelForRanges(chunkCount, [&](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; ++chunk) {
+			size_t first = chunk * chunkSize;
+			chunkVisibleCounts[chunk] = cullSphereRange(frustum, spheres, first, std::min(first + chunkSize, sphereCount), visible + first);
+		}
+	}, 1);
+
+	size_t visibleCount = chunkVisibleCounts[0];
+	for (size_t chunk = 1; chunk < chunkCount; ++chunk) {
+		const uint32_t* chunkVisible = visible + chunk * chunkSize;
+		std::copy(chunkVisible, chunkVisible + chunkVisibleCounts[chunk], visible + visibleCount);
+		visibleCount += chunkVisibleCounts[chunk];
+	}
+	return visibleCount;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "MathConfig.h"
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The 6 planes bounding a view frustum, as (normal, distance) such that points p
+ * inside the frustum have dot(normal, p) + distance >= 0 for every plane.
+ */
+struct Frustum {
+	// Left, right, bottom, top, near and far planes
+	std::array<glm::vec4, 6> planes;
+
+	// Frustum of the clip volume of `matrix` (e.g., projection * view * model), in the
+	// space the matrix transforms from, with WebGPU's [0, 1] depth range. Planes are
+	// normalized, so that sphere radii are compared to distances in that space.
+	static Frustum fromMatrix(const glm::mat4& matrix);
+};
+
+/**
+ * Bounding spheres laid out as a structure of arrays, so that tests run on as
+ * many spheres at once as the vector width allows.
+ */
+struct BoundingSpheres {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> radius;
+
+	size_t size() const { return radius.size(); }
+	void clear();
+	void reserve(size_t count);
+	void push_back(const glm::vec3& center, float sphereRadius);
+};
+
+/**
+ * Write the indices of the spheres intersecting `frustum` to `visible`, which must
+ * have room for spheres.size() of them, in increasing order and return their count.
+ * Spheres crossing a plane are considered visible.
+ *
+ * Spheres are tested 4 at a time with SSE2, NEON or WASM SIMD when enabled at
+ * compile time (8 with AVX2), large sets being split in chunks tested in parallel.
+ */
+size_t cullSpheres(const Frustum& frustum, const BoundingSpheres& spheres, uint32_t* visible);
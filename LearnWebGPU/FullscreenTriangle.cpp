@@ -0,0 +1,37 @@
+#include "FullscreenTriangle.h"
+
+using namespace wgpu;
+
+const char* const FullscreenTriangle::VertexShaderSource = R"(
+// A triangle covering the whole target, restricted to the region by the viewport
+@vertex
+fn vs_fullscreen(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f {
+	let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+	return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+void FullscreenTriangle::setPipelineStates(RenderPipelineDescriptor& descriptor, ShaderModule module) {
+	descriptor.vertex.bufferCount = 0;
+	descriptor.vertex.buffers = nullptr;
+	descriptor.vertex.module = module;
+	descriptor.vertex.entryPoint = "vs_fullscreen";
+	descriptor.vertex.constantCount = 0;
+	descriptor.vertex.constants = nullptr;
+	descriptor.primitive.topology = PrimitiveTopology::TriangleList;
+	descriptor.primitive.stripIndexFormat = IndexFormat::Undefined;
+	descriptor.primitive.frontFace = FrontFace::CCW;
+	descriptor.primitive.cullMode = CullMode::None;
+	descriptor.depthStencil = nullptr;
+	descriptor.multisample.count = 1;
+	descriptor.multisample.mask = ~0u;
+	descriptor.multisample.alphaToCoverageEnabled = false;
+}
+
+void FullscreenTriangle::draw(RenderPassEncoder renderPass, RenderPipeline pipeline, BindGroup bindGroup, uint32_t width, uint32_t height) {
+	renderPass.setViewport(0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f);
+	renderPass.setScissorRect(0, 0, width, height);
+	renderPass.setPipeline(pipeline);
+	renderPass.setBindGroup(0, bindGroup, 0, nullptr);
+	renderPass.draw(3, 1, 0, 0);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+
+/**
+ * The single triangle that the passes processing every pixel of a target draw
+ * over it, rather than two triangles sharing a diagonal whose pixels would be
+ * shaded twice. Its vertices come from their index, with no vertex buffer: the
+ * shader of a pass starts with VertexShaderSource, whose vs_fullscreen is the
+ * vertex stage of its pipeline.
+ */
+class FullscreenTriangle {
+public:
+	// WGSL of the vertex stage vs_fullscreen, for the source of a pass to start with
+	static const char* const VertexShaderSource;
+
+	// Set the vertex stage of `descriptor` to vs_fullscreen in `module`, and the primitive and
+	// multisample states to a triangle list of one sample, without depth
+	static void setPipelineStates(wgpu::RenderPipelineDescriptor& descriptor, wgpu::ShaderModule module);
+
+	// Draw the triangle with `pipeline` and its group 0, restricted to the top left `width` x
+	// `height` texels of the targets of `renderPass` by the viewport and scissor rect
+	static void draw(wgpu::RenderPassEncoder renderPass, wgpu::RenderPipeline pipeline, wgpu::BindGroup bindGroup, uint32_t width, uint32_t height);
+};
@@ -0,0 +1,544 @@
+#include "GlbParser.h"
+#include "DecodeHeap.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+constexpr uint32_t glbMagic = 0x46546C67; // "glTF"
+constexpr uint32_t glbVersion = 2;
+constexpr uint32_t jsonChunkType = 0x4E4F534A; // "JSON"
+constexpr uint32_t binChunkType = 0x004E4942; // "BIN\0"
+
+// Component types, as GL enums
+constexpr uint32_t componentByte = 5120;
+constexpr uint32_t componentUnsignedByte = 5121;
+constexpr uint32_t componentShort = 5122;
+constexpr uint32_t componentUnsignedShort = 5123;
+constexpr uint32_t componentUnsignedInt = 5125;
+constexpr uint32_t componentFloat = 5126;
+
+constexpr uint32_t trianglesMode = 4;
+
+/**
+ * A value of the JSON chunk. Objects keep their members in file order, glTF objects
+ * being small enough for linear lookups.
+ */
+struct JsonValue {
+	enum class Type { Null, Bool, Number, String, Array, Object };
+	Type type = Type::Null;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> items;
+	std::vector<std::pair<std::string, JsonValue>> members;
+
+	// Member `key` of an object, null if there is none or this is not an object
+	const JsonValue* find(std::string_view key) const {
+		for (const auto& [name, value] : members) {
+			if (name == key) return &value;
+		}
+		return nullptr;
+	}
+
+	// Value of the numeric member `key`, or `fallback`
+	double numberOr(std::string_view key, double fallback) const {
+		const JsonValue* value = find(key);
+		return value && value->type == Type::Number ? value->number : fallback;
+	}
+
+	// Items of the array member `key`, empty if there is none
+	std::span<const JsonValue> array(std::string_view key) const {
+		const JsonValue* value = find(key);
+		if (!value || value->type != Type::Array) return {};
+		return value->items;
+	}
+};
+
+/**
+ * Recursive descent parser of RFC 8259 JSON. \u escapes are decoded to UTF-8, names
+ * of the glTF schema being ASCII anyway.
+ */
+class JsonReader {
+public:
+	explicit JsonReader(std::string_view text) : mText(text) {}
+
+	bool parse(JsonValue& value) {
+		if (!parseValue(value, 0)) return false;
+		skipWhitespace();
+		return mPos == mText.size();
+	}
+
+private:
+	// Deeper documents are rejected rather than overflowing the stack
+	static constexpr int maxDepth = 64;
+
+	void skipWhitespace() {
+		while (mPos < mText.size() && (mText[mPos] == ' ' || mText[mPos] == '\t' || mText[mPos] == '\n' || mText[mPos] == '\r')) ++mPos;
+	}
+
+	bool consume(char c) {
+		skipWhitespace();
+		if (mPos >= mText.size() || mText[mPos] != c) return false;
+		++mPos;
+		return true;
+	}
+
+	bool consumeLiteral(std::string_view literal) {
+		if (mText.substr(mPos, literal.size()) != literal) return false;
+		mPos += literal.size();
+		return true;
+	}
+
+	bool parseValue(JsonValue& value, int depth) {
+		if (depth > maxDepth) return false;
+		skipWhitespace();
+		if (mPos >= mText.size()) return false;
+		char c = mText[mPos];
+		if (c == '{') {
+			++mPos;
+			value.type = JsonValue::Type::Object;
+			if (consume('}')) return true;
+			do {
+				std::string key;
+				skipWhitespace();
+				if (!parseString(key) || !consume(':')) return false;
+				value.members.emplace_back(std::move(key), JsonValue{});
+				if (!parseValue(value.members.back().second, depth + 1)) return false;
+			} while (consume(','));
+			return consume('}');
+		}
+		if (c == '[') {
+			++mPos;
+			value.type = JsonValue::Type::Array;
+			if (consume(']')) return true;
+			do {
+				value.items.emplace_back();
+				if (!parseValue(value.items.back(), depth + 1)) return false;
+			} while (consume(','));
+			return consume(']');
+		}
+		if (c == '"') {
+			value.type = JsonValue::Type::String;
+			return parseString(value.string);
+		}
+		if (c == 't' || c == 'f') {
+			value.type = JsonValue::Type::Bool;
+			value.boolean = c == 't';
+			return consumeLiteral(value.boolean ? "true" : "false");
+		}
+		if (c == 'n') {
+			return consumeLiteral("null");
+		}
+		value.type = JsonValue::Type::Number;
+		return parseNumber(value.number);
+	}
+
+	bool parseString(std::string& out) {
+		if (mPos >= mText.size() || mText[mPos] != '"') return false;
+		++mPos;
+		while (mPos < mText.size()) {
+			char c = mText[mPos++];
+			if (c == '"') return true;
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (mPos >= mText.size()) return false;
+			char escape = mText[mPos++];
+			switch (escape) {
+			case '"': case '\\': case '/': out += escape; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				if (mPos + 4 > mText.size()) return false;
+				char* end = nullptr;
+				std::string hex(mText.substr(mPos, 4));
+				uint32_t code = static_cast<uint32_t>(strtoul(hex.c_str(), &end, 16));
+				if (end != hex.c_str() + 4) return false;
+				mPos += 4;
+				// Surrogate pairs are not combined, they do not occur in the names we look up
+				if (code < 0x80) {
+					out += static_cast<char>(code);
+				} else if (code < 0x800) {
+					out += static_cast<char>(0xC0 | (code >> 6));
+					out += static_cast<char>(0x80 | (code & 0x3F));
+				} else {
+					out += static_cast<char>(0xE0 | (code >> 12));
+					out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+					out += static_cast<char>(0x80 | (code & 0x3F));
+				}
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		return false;
+	}
+
+	bool parseNumber(double& number) {
+		size_t start = mPos;
+		while (mPos < mText.size() && (std::strchr("+-.eE", mText[mPos]) || (mText[mPos] >= '0' && mText[mPos] <= '9'))) ++mPos;
+		if (mPos == start) return false;
+		// strtod needs a terminated string, numbers are short
+		std::string digits(mText.substr(start, mPos - start));
+		char* end = nullptr;
+		number = strtod(digits.c_str(), &end);
+		return end == digits.c_str() + digits.size();
+	}
+
+	std::string_view mText;
+	size_t mPos = 0;
+};
+
+int32_t indexMember(const JsonValue& object, std::string_view key) {
+	return static_cast<int32_t>(object.numberOr(key, -1.0));
+}
+
+uint32_t componentCountOf(const JsonValue* type) {
+	if (!type || type->type != JsonValue::Type::String) return 0;
+	if (type->string == "SCALAR") return 1;
+	if (type->string == "VEC2") return 2;
+	if (type->string == "VEC3") return 3;
+	if (type->string == "VEC4") return 4;
+	return 0;
+}
+
+uint32_t componentSize(uint32_t componentType) {
+	switch (componentType) {
+	case componentByte: case componentUnsignedByte: return 1;
+	case componentShort: case componentUnsignedShort: return 2;
+	case componentUnsignedInt: case componentFloat: return 4;
+	default: return 0;
+	}
+}
+
+// Range of the elements of an accessor in the binary chunk, or false if it does not fit
+// in its buffer view
+bool accessorRange(const GlbDocument& document, int32_t index, const std::byte*& first, size_t& stride) {
+	if (index < 0 || static_cast<size_t>(index) >= document.accessors.size()) return false;
+	const GlbDocument::Accessor& accessor = document.accessors[index];
+	std::span<const std::byte> view = document.bufferViewData(accessor.bufferView);
+	size_t elementSize = componentSize(accessor.componentType) * accessor.componentCount;
+	if (view.empty() || elementSize == 0) return false;
+	stride = document.bufferViews[accessor.bufferView].byteStride;
+	if (stride == 0) stride = elementSize;
+	if (accessor.count > 0 && (accessor.byteOffset > view.size()
+		|| (accessor.count - 1) * stride + elementSize > view.size() - accessor.byteOffset)) {
+		return false;
+	}
+	first = view.data() + accessor.byteOffset;
+	return true;
+}
+
+float readComponent(const std::byte* p, uint32_t componentType, bool normalized) {
+	switch (componentType) {
+	case componentFloat: { float v; memcpy(&v, p, 4); return v; }
+	case componentUnsignedByte: { uint8_t v; memcpy(&v, p, 1); return normalized ? v / 255.0f : v; }
+	case componentByte: { int8_t v; memcpy(&v, p, 1); return normalized ? std::max(v / 127.0f, -1.0f) : v; }
+	case componentUnsignedShort: { uint16_t v; memcpy(&v, p, 2); return normalized ? v / 65535.0f : v; }
+	case componentShort: { int16_t v; memcpy(&v, p, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+	default: return 0.0f;
+	}
+}
+
+uint32_t readIndex(const std::byte* p, uint32_t componentType) {
+	switch (componentType) {
+	case componentUnsignedByte: { uint8_t v; memcpy(&v, p, 1); return v; }
+	case componentUnsignedShort: { uint16_t v; memcpy(&v, p, 2); return v; }
+	default: { uint32_t v; memcpy(&v, p, 4); return v; }
+	}
+}
+
+// Convert the first `components` components of each element of an accessor into floats,
+// written every `outStride` floats from `out`
+bool readFloats(const GlbDocument& document, int32_t index, uint32_t components, float* out, size_t outStride) {
+	const std::byte* first = nullptr;
+	size_t stride = 0;
+	if (!accessorRange(document, index, first, stride)) return false;
+	const GlbDocument::Accessor& accessor = document.accessors[index];
+	uint32_t size = componentSize(accessor.componentType);
+	uint32_t count = std::min(components, accessor.componentCount);
+	for (uint32_t i = 0; i < accessor.count; ++i) {
+		for (uint32_t c = 0; c < count; ++c) {
+			out[i * outStride + c] = readComponent(first + i * stride + c * size, accessor.componentType, accessor.normalized);
+		}
+	}
+	return true;
+}
+
+// Whether accessor `index` reads `components` floats at byte `offset` of each element of `bufferView`
+bool isFloatAttribute(const GlbDocument& document, int32_t index, int32_t bufferView, size_t offset, uint32_t components) {
+	if (index < 0 || static_cast<size_t>(index) >= document.accessors.size()) return false;
+	const GlbDocument::Accessor& accessor = document.accessors[index];
+	return accessor.bufferView == bufferView && accessor.byteOffset == offset
+		&& accessor.componentType == componentFloat && accessor.componentCount == components;
+}
+
+// Whether a primitive can be viewed in place as VertexAttributes and uint32 indices
+bool isVertexAttributesLayout(const GlbDocument& document, const GlbDocument::Primitive& primitive) {
+	using VertexAttributes = ResourceManager::VertexAttributes;
+	static_assert(sizeof(VertexAttributes) == 44, "The in place layout assumes packed VertexAttributes");
+	if (primitive.position < 0 || primitive.indices < 0) return false;
+	int32_t bufferView = document.accessors[primitive.position].bufferView;
+	if (bufferView < 0 || static_cast<size_t>(bufferView) >= document.bufferViews.size()) return false;
+	if (document.bufferViews[bufferView].byteStride != sizeof(VertexAttributes)) return false;
+	size_t baseOffset = document.accessors[primitive.position].byteOffset;
+	const GlbDocument::Accessor& indices = document.accessors[primitive.indices];
+	return isFloatAttribute(document, primitive.position, bufferView, baseOffset + offsetof(VertexAttributes, position), 3)
+		&& isFloatAttribute(document, primitive.normal, bufferView, baseOffset + offsetof(VertexAttributes, normal), 3)
+		&& isFloatAttribute(document, primitive.color, bufferView, baseOffset + offsetof(VertexAttributes, color), 3)
+		&& isFloatAttribute(document, primitive.texcoord, bufferView, baseOffset + offsetof(VertexAttributes, uv), 2)
+		&& indices.componentType == componentUnsignedInt && indices.componentCount == 1
+		&& indices.bufferView >= 0 && static_cast<size_t>(indices.bufferView) < document.bufferViews.size()
+		&& document.bufferViews[indices.bufferView].byteStride == 0;
+}
+
+} // anonymous namespace
+
+std::span<const std::byte> GlbDocument::bufferViewData(int32_t bufferView) const {
+	if (bufferView < 0 || static_cast<size_t>(bufferView) >= bufferViews.size()) return {};
+	const BufferView& view = bufferViews[bufferView];
+	return binary.subspan(view.byteOffset, view.byteLength);
+}
+
+bool parseGlb(const std::byte* data, size_t size, GlbDocument& document) {
+	document = GlbDocument{};
+	uint32_t header[3];
+	if (size < sizeof(header) + 8) {
+		std::cerr << "Invalid GLB: file too small" << std::endl;
+		return false;
+	}
+	memcpy(header, data, sizeof(header));
+	if (header[0] != glbMagic || header[1] != glbVersion || header[2] > size) {
+		std::cerr << "Invalid GLB: not a glTF 2.0 binary file" << std::endl;
+		return false;
+	}
+	size = header[2];
+
+	// A JSON chunk first, then an optional BIN chunk, both padded to 4 bytes
+	std::string_view jsonText;
+	size_t offset = sizeof(header);
+	while (offset + 8 <= size) {
+		uint32_t chunk[2];
+		memcpy(chunk, data + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+		if (chunk[0] > size - offset) {
+			std::cerr << "Invalid GLB: truncated chunk" << std::endl;
+			return false;
+		}
+		if (chunk[1] == jsonChunkType && jsonText.empty()) {
+			jsonText = { reinterpret_cast<const char*>(data + offset), chunk[0] };
+		} else if (chunk[1] == binChunkType && document.binary.empty()) {
+			document.binary = { data + offset, chunk[0] };
+		}
+		// Unknown chunks are skipped, as the specification requires
+		offset += (chunk[0] + 3) & ~size_t(3);
+	}
+
+	JsonValue root;
+	if (jsonText.empty() || !JsonReader(jsonText).parse(root) || root.type != JsonValue::Type::Object) {
+		std::cerr << "Invalid GLB: malformed JSON chunk" << std::endl;
+		return false;
+	}
+
+	std::span<const JsonValue> buffers = root.array("buffers");
+	for (const JsonValue& buffer : buffers) {
+		if (&buffer != &buffers.front() || buffer.find("uri")) {
+			std::cerr << "Unsupported GLB: only the binary chunk can be referenced, not external buffers" << std::endl;
+			return false;
+		}
+	}
+
+	for (const JsonValue& value : root.array("bufferViews")) {
+		GlbDocument::BufferView view;
+		view.byteOffset = static_cast<size_t>(value.numberOr("byteOffset", 0.0));
+		view.byteLength = static_cast<size_t>(value.numberOr("byteLength", 0.0));
+		view.byteStride = static_cast<uint32_t>(value.numberOr("byteStride", 0.0));
+		if (value.numberOr("buffer", -1.0) != 0.0 || view.byteOffset > document.binary.size() || view.byteLength > document.binary.size() - view.byteOffset) {
+			std::cerr << "Invalid GLB: buffer view out of the binary chunk" << std::endl;
+			return false;
+		}
+		document.bufferViews.push_back(view);
+	}
+
+	for (const JsonValue& value : root.array("accessors")) {
+		GlbDocument::Accessor accessor;
+		accessor.bufferView = indexMember(value, "bufferView");
+		accessor.byteOffset = static_cast<size_t>(value.numberOr("byteOffset", 0.0));
+		accessor.componentType = static_cast<uint32_t>(value.numberOr("componentType", 0.0));
+		const JsonValue* normalized = value.find("normalized");
+		accessor.normalized = normalized && normalized->boolean;
+		accessor.count = static_cast<uint32_t>(value.numberOr("count", 0.0));
+		accessor.componentCount = componentCountOf(value.find("type"));
+		document.accessors.push_back(accessor);
+	}
+
+	int32_t accessorCount = static_cast<int32_t>(document.accessors.size());
+	auto validAccessor = [accessorCount](int32_t index) { return index >= -1 && index < accessorCount; };
+	for (const JsonValue& value : root.array("meshes")) {
+		GlbDocument::Mesh mesh;
+		for (const JsonValue& primitiveValue : value.array("primitives")) {
+			GlbDocument::Primitive primitive;
+			if (const JsonValue* attributes = primitiveValue.find("attributes")) {
+				primitive.position = indexMember(*attributes, "POSITION");
+				primitive.normal = indexMember(*attributes, "NORMAL");
+				primitive.color = indexMember(*attributes, "COLOR_0");
+				primitive.texcoord = indexMember(*attributes, "TEXCOORD_0");
+			}
+			primitive.indices = indexMember(primitiveValue, "indices");
+			primitive.material = indexMember(primitiveValue, "material");
+			primitive.mode = static_cast<uint32_t>(primitiveValue.numberOr("mode", trianglesMode));
+			if (!validAccessor(primitive.position) || !validAccessor(primitive.normal) || !validAccessor(primitive.color)
+				|| !validAccessor(primitive.texcoord) || !validAccessor(primitive.indices)) {
+				std::cerr << "Invalid GLB: primitive accessor out of range" << std::endl;
+				return false;
+			}
+			mesh.primitives.push_back(primitive);
+		}
+		document.meshes.push_back(std::move(mesh));
+	}
+
+	for (const JsonValue& value : root.array("materials")) {
+		GlbDocument::Material material;
+		if (const JsonValue* pbr = value.find("pbrMetallicRoughness")) {
+			if (const JsonValue* texture = pbr->find("baseColorTexture")) {
+				material.baseColorTexture = indexMember(*texture, "index");
+			}
+		}
+		document.materials.push_back(material);
+	}
+
+	for (const JsonValue& value : root.array("textures")) {
+		GlbDocument::Texture texture;
+		texture.source = indexMember(value, "source");
+		const JsonValue* extensions = value.find("extensions");
+		if (const JsonValue* basisu = extensions ? extensions->find("KHR_texture_basisu") : nullptr) {
+			texture.source = indexMember(*basisu, "source");
+		}
+		document.textures.push_back(texture);
+	}
+
+	for (const JsonValue& value : root.array("images")) {
+		GlbDocument::Image image;
+		image.bufferView = indexMember(value, "bufferView");
+		if (const JsonValue* mimeType = value.find("mimeType")) image.mimeType = mimeType->string;
+		document.images.push_back(std::move(image));
+	}
+
+	return true;
+}
+
+bool readGlbGeometry(const GlbDocument& document, uint32_t mesh, ResourceManager::Geometry& geometry) {
+	using VertexAttributes = ResourceManager::VertexAttributes;
+	if (mesh >= document.meshes.size()) {
+		std::cerr << "Invalid GLB: no mesh " << mesh << std::endl;
+		return false;
+	}
+	std::vector<const GlbDocument::Primitive*> primitives;
+	for (const GlbDocument::Primitive& primitive : document.meshes[mesh].primitives) {
+		if (primitive.mode == trianglesMode && primitive.position >= 0) primitives.push_back(&primitive);
+	}
+	if (primitives.empty()) {
+		std::cerr << "Invalid GLB: mesh " << mesh << " has no triangles" << std::endl;
+		return false;
+	}
+
+	// Exported in the layout of the vertex buffers, nothing to convert
+	if (primitives.size() == 1 && isVertexAttributesLayout(document, *primitives.front())) {
+		const GlbDocument::Primitive& primitive = *primitives.front();
+		const std::byte* vertexStart = nullptr;
+		const std::byte* indexStart = nullptr;
+		size_t stride = 0;
+		if (accessorRange(document, primitive.position, vertexStart, stride)
+			&& accessorRange(document, primitive.indices, indexStart, stride)
+			&& reinterpret_cast<uintptr_t>(vertexStart) % alignof(VertexAttributes) == 0
+			&& reinterpret_cast<uintptr_t>(indexStart) % alignof(uint32_t) == 0) {
+			geometry.vertices = { reinterpret_cast<const VertexAttributes*>(vertexStart), document.accessors[primitive.position].count };
+			geometry.indices = { reinterpret_cast<const uint32_t*>(indexStart), document.accessors[primitive.indices].count };
+			for (uint32_t index : geometry.indices) {
+				if (index >= geometry.vertices.size()) {
+					std::cerr << "Invalid GLB: vertex index out of range" << std::endl;
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	std::vector<VertexAttributes>& vertexData = geometry.vertexData;
+	std::vector<uint32_t>& indexData = geometry.indexData;
+	vertexData.clear();
+	indexData.clear();
+	for (const GlbDocument::Primitive* primitive : primitives) {
+		uint32_t baseVertex = static_cast<uint32_t>(vertexData.size());
+		uint32_t vertexCount = document.accessors[primitive->position].count;
+
+		// Read into a float array with the layout of VertexAttributes, whatever the encoding
+		// of the accessors (e.g. quantized by KHR_mesh_quantization)
+		constexpr size_t floatStride = sizeof(VertexAttributes) / sizeof(float);
+		DecodeVector<float> floats(vertexCount * floatStride, 0.0f);
+		for (uint32_t i = 0; i < vertexCount; ++i) {
+			float* vertex = floats.data() + i * floatStride;
+			vertex[offsetof(VertexAttributes, normal) / sizeof(float) + 2] = 1.0f;
+			std::fill_n(vertex + offsetof(VertexAttributes, color) / sizeof(float), 3, 1.0f);
+		}
+		bool valid = readFloats(document, primitive->position, 3, floats.data() + offsetof(VertexAttributes, position) / sizeof(float), floatStride)
+			&& (primitive->normal < 0 || readFloats(document, primitive->normal, 3, floats.data() + offsetof(VertexAttributes, normal) / sizeof(float), floatStride))
+			&& (primitive->color < 0 || readFloats(document, primitive->color, 3, floats.data() + offsetof(VertexAttributes, color) / sizeof(float), floatStride))
+			&& (primitive->texcoord < 0 || readFloats(document, primitive->texcoord, 2, floats.data() + offsetof(VertexAttributes, uv) / sizeof(float), floatStride));
+		bool countsMatch = (primitive->normal < 0 || document.accessors[primitive->normal].count == vertexCount)
+			&& (primitive->color < 0 || document.accessors[primitive->color].count == vertexCount)
+			&& (primitive->texcoord < 0 || document.accessors[primitive->texcoord].count == vertexCount);
+		if (!valid || !countsMatch) {
+			std::cerr << "Invalid GLB: vertex accessors out of range" << std::endl;
+			return false;
+		}
+		vertexData.resize(baseVertex + vertexCount);
+		memcpy(vertexData.data() + baseVertex, floats.data(), floats.size() * sizeof(float));
+
+		if (primitive->indices < 0) {
+			// Non indexed triangles
+			for (uint32_t i = 0; i < vertexCount / 3 * 3; ++i) indexData.push_back(baseVertex + i);
+			continue;
+		}
+		const GlbDocument::Accessor& indices = document.accessors[primitive->indices];
+		const std::byte* first = nullptr;
+		size_t stride = 0;
+		bool indexType = indices.componentType == componentUnsignedByte || indices.componentType == componentUnsignedShort || indices.componentType == componentUnsignedInt;
+		if (indices.componentCount != 1 || !indexType
+			|| !accessorRange(document, primitive->indices, first, stride)) {
+			std::cerr << "Invalid GLB: index accessor out of range" << std::endl;
+			return false;
+		}
+		for (uint32_t i = 0; i < indices.count / 3 * 3; ++i) {
+			uint32_t index = readIndex(first + i * stride, indices.componentType);
+			if (index >= vertexCount) {
+				std::cerr << "Invalid GLB: vertex index out of range" << std::endl;
+				return false;
+			}
+			indexData.push_back(baseVertex + index);
+		}
+	}
+	geometry.vertices = vertexData;
+	geometry.indices = indexData;
+	return true;
+}
+
+int32_t glbBaseColorImage(const GlbDocument& document) {
+	for (const GlbDocument::Material& material : document.materials) {
+		if (material.baseColorTexture < 0 || static_cast<size_t>(material.baseColorTexture) >= document.textures.size()) continue;
+		int32_t source = document.textures[material.baseColorTexture].source;
+		if (source >= 0 && static_cast<size_t>(source) < document.images.size()) return source;
+	}
+	return -1;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "ResourceManager.h"
+
+#include <vector>
+#include <string>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The parts of a binary glTF 2.0 file (https://registry.khronos.org/glTF/specs/2.0/glTF.html#binary-gltf-layout)
+ * that the application draws: the triangle primitives of its meshes, the base color
+ * texture of their materials and the images embedded in the binary chunk.
+ *
+ * Nothing is copied: buffer views are ranges of the binary chunk, which points into
+ * the parsed data. Only the binary chunk can be referenced, external buffers and
+ * images (by uri) are rejected.
+ */
+struct GlbDocument {
+	struct BufferView {
+		// Range of the binary chunk
+		size_t byteOffset = 0;
+		size_t byteLength = 0;
+		// 0 for tightly packed elements
+		uint32_t byteStride = 0;
+	};
+
+	struct Accessor {
+		int32_t bufferView = -1;
+		size_t byteOffset = 0;
+		// GL enum of the components, e.g. 5126 for FLOAT
+		uint32_t componentType = 0;
+		bool normalized = false;
+		uint32_t count = 0;
+		// 1 for SCALAR to 4 for VEC4, matrices are not supported
+		uint32_t componentCount = 0;
+	};
+
+	/**
+	 * Accessors of a primitive, -1 when absent
+	 */
+	struct Primitive {
+		int32_t position = -1;
+		int32_t normal = -1;
+		int32_t color = -1;
+		int32_t texcoord = -1;
+		int32_t indices = -1;
+		int32_t material = -1;
+		// 4 for triangle lists, the only mode drawn
+		uint32_t mode = 4;
+	};
+
+	struct Mesh {
+		std::vector<Primitive> primitives;
+	};
+
+	struct Material {
+		// Index in `textures`, -1 if the material has no base color texture
+		int32_t baseColorTexture = -1;
+	};
+
+	struct Texture {
+		// Index in `images`, that of the KHR_texture_basisu extension if there is one
+		int32_t source = -1;
+	};
+
+	struct Image {
+		int32_t bufferView = -1;
+		// e.g. "image/ktx2", "image/png" or "image/jpeg"
+		std::string mimeType;
+	};
+
+	std::span<const std::byte> binary;
+	std::vector<BufferView> bufferViews;
+	std::vector<Accessor> accessors;
+	std::vector<Mesh> meshes;
+	std::vector<Material> materials;
+	std::vector<Texture> textures;
+	std::vector<Image> images;
+
+	// Content of a buffer view, empty if the index is out of range
+	std::span<const std::byte> bufferViewData(int32_t bufferView) const;
+};
+
+// Parse the GLB file content data[0, size). The document points into `data`, which must
+// thus outlive it. Return false with an error message if the content is not a valid GLB.
+bool parseGlb(const std::byte* data, size_t size, GlbDocument& document);
+
+// Vertices and indices of all the triangle primitives of mesh `mesh`, merged into one
+// indexed geometry. When the mesh is a single primitive whose accessors are already laid
+// out like VertexAttributes (Float32 position, normal, color and uv interleaved at offsets 0,
+// 12, 24 and 36 of the same buffer view, with a stride of 44 bytes) and whose indices are
+// 32-bit, `geometry.vertices` and `geometry.indices` are views of the binary chunk. Otherwise
+// the accessors are converted into `geometry.vertexData` and `geometry.indexData`, a missing
+// color being white and missing uvs 0. Positions are used as is, like those of TXT files,
+// the content pipeline exporting to the Z-up axes of the application.
+bool readGlbGeometry(const GlbDocument& document, uint32_t mesh, ResourceManager::Geometry& geometry);
+
+// Image holding the base color texture of the first material that has one, -1 if there is none
+int32_t glbBaseColorImage(const GlbDocument& document);
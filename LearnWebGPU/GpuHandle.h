@@ -0,0 +1,80 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "GpuMemory.h"
+
+#include <utility>
+
+/**
+ * Default release policy of GpuHandle: drop the reference it owns.
+ */
+struct ReleaseHandle {
+	template <typename Handle>
+	void operator()(Handle& handle) const { handle.release(); }
+};
+
+/**
+ * Release policy of GPU resources created with createTrackedBuffer/createTrackedTexture,
+ * destroyed first so that the memory tracker stops accounting for them. The GPU keeps
+ * them alive until the work already submitted with them is done.
+ */
+struct DestroyTrackedHandle {
+	template <typename Handle>
+	void operator()(Handle& handle) const {
+		destroyTracked(handle);
+		handle.release();
+	}
+};
+
+/**
+ * Owner of a reference to a WebGPU object, released by the `Release` policy once the
+ * owner goes out of scope or is reset, so that objects created for a frame or for a
+ * single submission are not leaked by an early return and need no release list.
+ *
+ * The wrappers of webgpu.hpp copy as plain pointers, without adding references,
+ * hence a GpuHandle can only be moved: a copy would release the object twice. The
+ * owner converts to the wrapper and to the C handle, to be given to the API as is,
+ * and `->` calls the wrapper's methods.
+ */
+template <typename Handle, typename Release = ReleaseHandle>
+class GpuHandle {
+public:
+	GpuHandle() = default;
+	// Adopt the reference returned by a create, begin, finish or get call
+	GpuHandle(Handle handle) : mHandle(handle) {}
+	~GpuHandle() { reset(); }
+
+	GpuHandle(const GpuHandle&) = delete;
+	GpuHandle& operator=(const GpuHandle&) = delete;
+	GpuHandle(GpuHandle&& other) noexcept : mHandle(other.detach()) {}
+	GpuHandle& operator=(GpuHandle&& other) noexcept {
+		if (this != &other) reset(other.detach());
+		return *this;
+	}
+
+	const Handle& get() const { return mHandle; }
+	operator Handle() const { return mHandle; }
+	// For the fields of descriptors
+	operator typename Handle::W() const { return mHandle; }
+	const Handle* operator->() const { return &mHandle; }
+	Handle* operator->() { return &mHandle; }
+	explicit operator bool() const { return mHandle != nullptr; }
+
+	// Release the object owned, if any, to own `handle` instead
+	void reset(Handle handle = nullptr) {
+		if (mHandle) Release{}(mHandle);
+		mHandle = handle;
+	}
+	// Give up the reference without releasing it, to the caller
+	Handle detach() {
+		Handle handle = mHandle;
+		mHandle = nullptr;
+		return handle;
+	}
+
+private:
+	Handle mHandle = nullptr;
+};
+
+using TrackedBufferHandle = GpuHandle<wgpu::Buffer, DestroyTrackedHandle>;
+using TrackedTextureHandle = GpuHandle<wgpu::Texture, DestroyTrackedHandle>;
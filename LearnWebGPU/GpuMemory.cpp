@@ -0,0 +1,367 @@
+#include "GpuMemory.h"
+#include "FrameCounters.h"
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+/**
+ * Footprint of a block of texels (1x1 for uncompressed formats) and its size in bytes
+ */
+struct FormatBlock {
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytes;
+};
+
+FormatBlock formatBlock(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::R8Unorm:
+	case TextureFormat::R8Snorm:
+	case TextureFormat::R8Uint:
+	case TextureFormat::Stencil8:
+		return { 1, 1, 1 };
+	case TextureFormat::R16Uint:
+	case TextureFormat::R16Float:
+	case TextureFormat::RG8Unorm:
+	case TextureFormat::Depth16Unorm:
+		return { 1, 1, 2 };
+	case TextureFormat::RG32Float:
+	case TextureFormat::RG32Uint:
+	case TextureFormat::RGBA16Uint:
+	case TextureFormat::RGBA16Float:
+	case TextureFormat::RGBA16Unorm:
+	case TextureFormat::Depth32FloatStencil8:
+		return { 1, 1, 8 };
+	case TextureFormat::RGBA32Float:
+	case TextureFormat::RGBA32Uint:
+		return { 1, 1, 16 };
+	case TextureFormat::BC1RGBAUnorm:
+	case TextureFormat::BC1RGBAUnormSrgb:
+	case TextureFormat::BC4RUnorm:
+	case TextureFormat::ETC2RGB8Unorm:
+	case TextureFormat::ETC2RGB8UnormSrgb:
+	case TextureFormat::EACR11Unorm:
+		return { 4, 4, 8 };
+	case TextureFormat::BC3RGBAUnorm:
+	case TextureFormat::BC3RGBAUnormSrgb:
+	case TextureFormat::BC5RGUnorm:
+	case TextureFormat::BC7RGBAUnorm:
+	case TextureFormat::BC7RGBAUnormSrgb:
+	case TextureFormat::ETC2RGBA8Unorm:
+	case TextureFormat::ETC2RGBA8UnormSrgb:
+	case TextureFormat::EACRG11Unorm:
+	case TextureFormat::ASTC4x4Unorm:
+	case TextureFormat::ASTC4x4UnormSrgb:
+		return { 4, 4, 16 };
+	default:
+		// Most formats, 8-bit RGBA and 32-bit depths included, take 4 bytes per texel
+		return { 1, 1, 4 };
+	}
+}
+
+/**
+ * A resource accounted by GpuMemoryTracker
+ */
+struct TrackedResource {
+	uint64_t size;
+	GpuMemoryCategory category;
+	uint32_t usage;
+	std::string label;
+	const char* owner;
+};
+
+struct Tracker {
+	std::mutex mutex;
+	std::unordered_map<const void*, TrackedResource> resources;
+	std::array<uint64_t, (size_t)GpuMemoryCategory::Count> totals = {};
+	uint64_t total = 0;
+	uint64_t highWaterMark = 0;
+	uint64_t budget = 0;
+};
+
+Tracker& tracker() {
+	static Tracker tracker;
+	return tracker;
+}
+
+/**
+ * A resource given to retireTracked, one of the two handles being set
+ */
+struct RetiredResource {
+	Buffer buffer = nullptr;
+	Texture texture = nullptr;
+	uint64_t size = 0;
+	// Number of fences taken before it was retired
+	uint64_t fence = 0;
+};
+
+struct Retirement {
+	std::mutex mutex;
+	// In the order they were retired, hence of their fences
+	std::deque<RetiredResource> resources;
+	uint64_t fenceCount = 0;
+	bool fencing = false;
+};
+
+Retirement& retirement() {
+	static Retirement retirement;
+	return retirement;
+}
+
+void destroyRetired(std::vector<RetiredResource>& resources) {
+	for (RetiredResource& resource : resources) {
+		if (resource.buffer) {
+			destroyTracked(resource.buffer);
+			resource.buffer.release();
+		}
+		if (resource.texture) {
+			destroyTracked(resource.texture);
+			resource.texture.release();
+		}
+	}
+}
+
+void retire(RetiredResource resource) {
+	Retirement& r = retirement();
+	{
+		std::lock_guard<std::mutex> lock(r.mutex);
+		if (r.fencing) {
+			resource.fence = r.fenceCount;
+			r.resources.push_back(resource);
+			return;
+		}
+	}
+	std::vector<RetiredResource> resources = { resource };
+	destroyRetired(resources);
+}
+
+} // anonymous namespace
+
+uint64_t textureMemorySize(Texture texture) {
+	if (!texture) return 0;
+	FormatBlock block = formatBlock(texture.getFormat());
+	uint32_t width = texture.getWidth();
+	uint32_t height = texture.getHeight();
+	uint64_t size = 0;
+	for (uint32_t level = 0; level < texture.getMipLevelCount(); ++level) {
+		uint64_t blockCountX = (width + block.width - 1) / block.width;
+		uint64_t blockCountY = (height + block.height - 1) / block.height;
+		size += blockCountX * blockCountY * block.bytes;
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	// Layers of 2D arrays, 3D textures being out of use here
+	return size * texture.getDepthOrArrayLayers() * texture.getSampleCount();
+}
+
+uint64_t bufferMemorySize(Buffer buffer) {
+	return buffer ? buffer.getSize() : 0;
+}
+
+const char* gpuMemoryCategoryName(GpuMemoryCategory category) {
+	switch (category) {
+	case GpuMemoryCategory::Geometry: return "Geometry";
+	case GpuMemoryCategory::Textures: return "Textures";
+	case GpuMemoryCategory::RenderTargets: return "Render targets";
+	case GpuMemoryCategory::Uniforms: return "Uniforms";
+	case GpuMemoryCategory::SceneData: return "Scene data";
+	case GpuMemoryCategory::Staging: return "Staging";
+	default: return "Unknown";
+	}
+}
+
+uint64_t GpuMemoryTracker::total() {
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	return t.total;
+}
+
+uint64_t GpuMemoryTracker::total(GpuMemoryCategory category) {
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	return t.totals[(size_t)category];
+}
+
+uint64_t GpuMemoryTracker::highWaterMark() {
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	return t.highWaterMark;
+}
+
+void GpuMemoryTracker::setBudget(uint64_t bytes) {
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	t.budget = bytes;
+}
+
+uint64_t GpuMemoryTracker::budget() {
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	return t.budget;
+}
+
+bool GpuMemoryTracker::fitsBudget(uint64_t bytes) {
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	return t.budget == 0 || t.total + bytes <= t.budget;
+}
+
+void GpuMemoryTracker::printReport(std::ostream& out, size_t maxResourceCount) {
+	size_t retiredCount = GpuRetirement::pendingCount();
+	uint64_t retiredSize = GpuRetirement::pendingSize();
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	auto megabytes = [](uint64_t bytes) { return double(bytes) / (1 << 20); };
+	out << std::fixed << std::setprecision(1);
+	out << "GPU memory: " << megabytes(t.total) << " MiB in " << t.resources.size() << " resources, peak " << megabytes(t.highWaterMark) << " MiB";
+	if (t.budget > 0) out << ", budget " << megabytes(t.budget) << " MiB";
+	// Included in the total until the frames using them are done
+	if (retiredCount > 0) out << ", " << megabytes(retiredSize) << " MiB in " << retiredCount << " retired";
+	out << std::endl;
+	for (size_t category = 0; category < t.totals.size(); ++category) {
+		out << "  " << std::left << std::setw(16) << gpuMemoryCategoryName((GpuMemoryCategory)category) << std::right
+			<< std::setw(10) << megabytes(t.totals[category]) << " MiB" << std::endl;
+	}
+
+	std::vector<const TrackedResource*> largest;
+	largest.reserve(t.resources.size());
+	for (const auto& [handle, resource] : t.resources) {
+		largest.push_back(&resource);
+	}
+	size_t count = std::min(maxResourceCount, largest.size());
+	std::partial_sort(largest.begin(), largest.begin() + count, largest.end(), [](const TrackedResource* a, const TrackedResource* b) {
+		return a->size > b->size;
+	});
+	out << "Largest resources:" << std::endl;
+	for (size_t i = 0; i < count; ++i) {
+		const TrackedResource& resource = *largest[i];
+		out << "  " << std::setw(10) << megabytes(resource.size) << " MiB  " << resource.owner
+			<< " '" << resource.label << "' (" << gpuMemoryCategoryName(resource.category)
+			<< ", usage 0x" << std::hex << resource.usage << std::dec << ")" << std::endl;
+	}
+}
+
+void GpuMemoryTracker::track(const void* handle, uint64_t size, GpuMemoryCategory category, uint32_t usage, const char* label, const char* owner) {
+	if (!handle) return;
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	auto [it, inserted] = t.resources.try_emplace(handle, TrackedResource{ size, category, usage, label ? label : "", owner });
+	if (!inserted) return;
+	t.totals[(size_t)category] += size;
+	t.total += size;
+	t.highWaterMark = std::max(t.highWaterMark, t.total);
+}
+
+void GpuMemoryTracker::untrack(const void* handle) {
+	Tracker& t = tracker();
+	std::lock_guard<std::mutex> lock(t.mutex);
+	auto it = t.resources.find(handle);
+	if (it == t.resources.end()) return;
+	t.totals[(size_t)it->second.category] -= it->second.size;
+	t.total -= it->second.size;
+	t.resources.erase(it);
+}
+
+Buffer createTrackedBuffer(Device device, const BufferDescriptor& descriptor, GpuMemoryCategory category, const char* owner) {
+	Buffer buffer = device.createBuffer(descriptor);
+	if (buffer) {
+		GpuMemoryTracker::track(buffer, descriptor.size, category, descriptor.usage, descriptor.label, owner);
+		FrameCounters::add(FrameCounter::ObjectsCreated);
+	}
+	return buffer;
+}
+
+Texture createTrackedTexture(Device device, const TextureDescriptor& descriptor, GpuMemoryCategory category, const char* owner) {
+	Texture texture = device.createTexture(descriptor);
+	if (texture) {
+		GpuMemoryTracker::track(texture, textureMemorySize(texture), category, descriptor.usage, descriptor.label, owner);
+		FrameCounters::add(FrameCounter::ObjectsCreated);
+	}
+	return texture;
+}
+
+void destroyTracked(Buffer buffer) {
+	if (!buffer) return;
+	GpuMemoryTracker::untrack(buffer);
+	FrameCounters::add(FrameCounter::ObjectsDestroyed);
+	buffer.destroy();
+}
+
+void destroyTracked(Texture texture) {
+	if (!texture) return;
+	GpuMemoryTracker::untrack(texture);
+	FrameCounters::add(FrameCounter::ObjectsDestroyed);
+	texture.destroy();
+}
+
+void retireTracked(Buffer buffer) {
+	if (!buffer) return;
+	retire({ buffer, nullptr, bufferMemorySize(buffer), 0 });
+}
+
+void retireTracked(Texture texture) {
+	if (!texture) return;
+	retire({ nullptr, texture, textureMemorySize(texture), 0 });
+}
+
+void GpuRetirement::setFencing(bool enabled) {
+	Retirement& r = retirement();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	r.fencing = enabled;
+}
+
+uint64_t GpuRetirement::fence() {
+	Retirement& r = retirement();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	return ++r.fenceCount;
+}
+
+void GpuRetirement::signal(uint64_t fence) {
+	// Destroyed out of the lock, not to hold up the threads retiring resources meanwhile
+	std::vector<RetiredResource> done;
+	{
+		Retirement& r = retirement();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		while (!r.resources.empty() && r.resources.front().fence < fence) {
+			done.push_back(r.resources.front());
+			r.resources.pop_front();
+		}
+	}
+	destroyRetired(done);
+}
+
+void GpuRetirement::flush() {
+	std::vector<RetiredResource> done;
+	{
+		Retirement& r = retirement();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		done.assign(r.resources.begin(), r.resources.end());
+		r.resources.clear();
+	}
+	destroyRetired(done);
+}
+
+size_t GpuRetirement::pendingCount() {
+	Retirement& r = retirement();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	return r.resources.size();
+}
+
+uint64_t GpuRetirement::pendingSize() {
+	Retirement& r = retirement();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	uint64_t size = 0;
+	for (const RetiredResource& resource : r.resources) size += resource.size;
+	return size;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <iosfwd>
+#include <cstdint>
+
+/**
+ * Estimates of the GPU memory taken by resources, from their size and format.
+ * Drivers add alignment, padding and compression metadata on top, so they are
+ * lower bounds meant to follow trends rather than to match the driver's numbers.
+ */
+
+// Bytes of all the mip levels and layers of a texture, multisampled ones counting each sample
+uint64_t textureMemorySize(wgpu::Texture texture);
+
+// Bytes of a buffer, 0 for a null one
+uint64_t bufferMemorySize(wgpu::Buffer buffer);
+
+/**
+ * What the memory of a resource is for, as accounted by GpuMemoryTracker
+ */
+enum class GpuMemoryCategory {
+	// Vertex, index and meshlet pages
+	Geometry,
+	// Textures loaded from files, and the atlas of the HUD
+	Textures,
+	// Attachments and other textures rendered to
+	RenderTargets,
+	Uniforms,
+	// Per instance and per draw buffers, written by the CPU or by the culling pass
+	SceneData,
+	// Copies on their way to or from the GPU
+	Staging,
+	Count,
+};
+
+const char* gpuMemoryCategoryName(GpuMemoryCategory category);
+
+/**
+ * Live GPU memory of the application, made of the resources created with
+ * createTrackedBuffer/createTrackedTexture until destroyed with destroyTracked.
+ * Each one is recorded with its estimated size (see above), usage, label and
+ * owner, and added to the total of its category.
+ *
+ * A budget may be set, that the tracker does not enforce itself: resources that
+ * can do with less memory check overBudget() (or fitsBudget()) before growing,
+ * e.g. textures are loaded at a lower resolution and free pooled textures are
+ * destroyed right away. The high-water mark tells how close a run came to it.
+ *
+ * Shared by the whole application, and safe to use from any thread.
+ */
+class GpuMemoryTracker {
+public:
+	static uint64_t total();
+	static uint64_t total(GpuMemoryCategory category);
+	// Largest total since the start
+	static uint64_t highWaterMark();
+
+	// Bytes that the application should stay under, 0 (the default) for no budget
+	static void setBudget(uint64_t bytes);
+	static uint64_t budget();
+	// Whether `bytes` more would still be within the budget
+	static bool fitsBudget(uint64_t bytes);
+	static bool overBudget() { return !fitsBudget(0); }
+
+	// Print totals per category and the largest resources
+	static void printReport(std::ostream& out, size_t maxResourceCount = 10);
+
+	// Account for a resource created by other means, e.g. by a library
+	static void track(const void* handle, uint64_t size, GpuMemoryCategory category, uint32_t usage, const char* label, const char* owner);
+	// Forget a resource, doing nothing if it was not tracked
+	static void untrack(const void* handle);
+};
+
+// Same as Device::createBuffer/createTexture, the resource being accounted to `category` and
+// `owner` (which must outlive it, typically a string literal) until given to destroyTracked
+wgpu::Buffer createTrackedBuffer(wgpu::Device device, const wgpu::BufferDescriptor& descriptor, GpuMemoryCategory category, const char* owner);
+wgpu::Texture createTrackedTexture(wgpu::Device device, const wgpu::TextureDescriptor& descriptor, GpuMemoryCategory category, const char* owner);
+
+// Same as destroy(), the resource no longer being accounted for. It must still be released.
+void destroyTracked(wgpu::Buffer buffer);
+void destroyTracked(wgpu::Texture texture);
+
+// Same as destroyTracked then release(), once the GPU is done with the frames submitted so far
+// rather than while they may still use the resource (see GpuRetirement), e.g. on resize
+void retireTracked(wgpu::Buffer buffer);
+void retireTracked(wgpu::Texture texture);
+
+/**
+ * Resources given to retireTracked, each waiting for the first frame submitted
+ * after it: once that frame is done, queue order guarantees that every command
+ * that used the resource is too, those of other submissions included.
+ *
+ * Frames are fenced by FramePacer, with onSubmittedWorkDone. Without a pacer,
+ * before the device is ready or after it is gone, resources are destroyed right
+ * away. They stay accounted for by GpuMemoryTracker until they are destroyed.
+ *
+ * Safe to use from any thread. Resources are destroyed from the thread ending
+ * the frames, usually the one submitting them.
+ */
+class GpuRetirement {
+public:
+	// While a pacer fences the frames, from its construction to its destruction
+	static void setFencing(bool enabled);
+	// Fence of a frame about to be submitted
+	static uint64_t fence();
+	// Destroy the resources retired before `fence` was taken, once its frame is done
+	static void signal(uint64_t fence);
+	// Destroy all of them, once the device is idle or lost
+	static void flush();
+
+	// Resources waiting, and their estimated memory
+	static size_t pendingCount();
+	static uint64_t pendingSize();
+};
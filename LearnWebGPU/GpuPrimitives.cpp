@@ -0,0 +1,628 @@
+#include "GpuPrimitives.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// Workgroups per dimension that every device supports
+constexpr uint32_t MaxWorkgroupsPerDimension = 65535;
+// Uniforms of each dispatch, at dynamic offsets aligned as every device requires
+constexpr uint64_t ParamStride = 256;
+
+/**
+ * The Params structure of the shaders
+ */
+struct Params {
+	uint32_t count = 0;
+	uint32_t blockCount = 0;
+	uint32_t shift = 0;
+	uint32_t padding = 0;
+};
+
+const char* paramsSource = R"(
+struct Params {
+	count: u32,
+	blockCount: u32,
+	// Of the digit sorted, for the radix sort
+	shift: u32,
+};
+
+// Index of the block of a workgroup, dispatches being spread over x then y
+fn blockIndex(group: vec3u, groups: vec3u) -> u32 {
+	return group.y * groups.x + group.x;
+}
+)";
+
+const char* scanShaderSource = R"(
+const ItemsPerInvocation = 4u;
+const BlockSize = WorkgroupSize * ItemsPerInvocation;
+
+@group(0) @binding(0) var<storage, read_write> data: array<u32>;
+// One per block of data, exclusive scanned before addSums
+@group(0) @binding(1) var<storage, read_write> sums: array<u32>;
+@group(1) @binding(0) var<uniform> params: Params;
+
+var<workgroup> partialSums: array<u32, WorkgroupSize>;
+
+// Sum of `value` over this invocation and those before it in the workgroup
+fn workgroupInclusiveScan(localIndex: u32, value: u32) -> u32 {
+	var sum = value;
+	partialSums[localIndex] = sum;
+	for (var offset = 1u; offset < WorkgroupSize; offset <<= 1u) {
+		workgroupBarrier();
+		if (localIndex >= offset) {
+			sum += partialSums[localIndex - offset];
+		}
+		workgroupBarrier();
+		partialSums[localIndex] = sum;
+	}
+	return sum;
+}
+
+@compute @workgroup_size(WorkgroupSize)
+fn scanBlocks(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groups: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let block = blockIndex(group, groups);
+	if (block >= (params.count + BlockSize - 1u) / BlockSize) {
+		return;
+	}
+	// Consecutive elements per invocation, scanned serially
+	let first = block * BlockSize + localIndex * ItemsPerInvocation;
+	var items: array<u32, ItemsPerInvocation>;
+	var sum = 0u;
+	for (var i = 0u; i < ItemsPerInvocation; i++) {
+		items[i] = sum;
+		if (first + i < params.count) {
+			sum += data[first + i];
+		}
+	}
+	let inclusive = workgroupInclusiveScan(localIndex, sum);
+	let base = inclusive - sum;
+	for (var i = 0u; i < ItemsPerInvocation; i++) {
+		if (first + i < params.count) {
+			data[first + i] = base + items[i];
+		}
+	}
+	if (localIndex == WorkgroupSize - 1u) {
+		sums[block] = inclusive;
+	}
+}
+
+@compute @workgroup_size(WorkgroupSize)
+fn addSums(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groups: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let block = blockIndex(group, groups);
+	if (block >= (params.count + BlockSize - 1u) / BlockSize) {
+		return;
+	}
+	let offset = sums[block];
+	for (var i = 0u; i < ItemsPerInvocation; i++) {
+		let index = block * BlockSize + i * WorkgroupSize + localIndex;
+		if (index < params.count) {
+			data[index] += offset;
+		}
+	}
+}
+)";
+
+const char* compactionShaderSource = R"(
+@group(0) @binding(0) var<storage, read> elements: array<u32>;
+@group(0) @binding(1) var<storage, read> flags: array<u32>;
+// 0 or 1 per element, then where the elements kept go
+@group(0) @binding(2) var<storage, read_write> offsets: array<u32>;
+@group(0) @binding(3) var<storage, read_write> compacted: array<u32>;
+@group(0) @binding(4) var<storage, read_write> compactedCount: array<u32>;
+@group(1) @binding(0) var<uniform> params: Params;
+
+@compute @workgroup_size(WorkgroupSize)
+fn mark(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groups: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let index = blockIndex(group, groups) * WorkgroupSize + localIndex;
+	if (index < params.count) {
+		offsets[index] = select(0u, 1u, flags[index] != 0u);
+	}
+}
+
+@compute @workgroup_size(WorkgroupSize)
+fn scatter(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groups: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let index = blockIndex(group, groups) * WorkgroupSize + localIndex;
+	if (index >= params.count) {
+		// An empty input still dispatches a workgroup, for the count
+		if (index == 0u) {
+			compactedCount[0] = 0u;
+		}
+		return;
+	}
+	let kept = flags[index] != 0u;
+	if (kept) {
+		compacted[offsets[index]] = elements[index];
+	}
+	if (index == params.count - 1u) {
+		compactedCount[0] = offsets[index] + select(0u, 1u, kept);
+	}
+}
+)";
+
+const char* radixSortShaderSource = R"(
+const DigitCount = 16u;
+
+@group(0) @binding(0) var<storage, read> keysIn: array<u32>;
+@group(0) @binding(1) var<storage, read> valuesIn: array<u32>;
+@group(0) @binding(2) var<storage, read_write> keysOut: array<u32>;
+@group(0) @binding(3) var<storage, read_write> valuesOut: array<u32>;
+// Count of each digit in each block, digit major, then scanned into where they go
+@group(0) @binding(4) var<storage, read_write> blockOffsets: array<u32>;
+@group(1) @binding(0) var<uniform> params: Params;
+
+var<workgroup> digitCounts: array<atomic<u32>, DigitCount>;
+
+@compute @workgroup_size(WorkgroupSize)
+fn countDigits(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groups: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let block = blockIndex(group, groups);
+	if (block >= params.blockCount) {
+		return;
+	}
+	let index = block * WorkgroupSize + localIndex;
+	if (index < params.count) {
+		atomicAdd(&digitCounts[(keysIn[index] >> params.shift) & (DigitCount - 1u)], 1u);
+	}
+	workgroupBarrier();
+	if (localIndex < DigitCount) {
+		blockOffsets[localIndex * params.blockCount + block] = atomicLoad(&digitCounts[localIndex]);
+	}
+}
+
+// Counts of each digit, 16 bits each, over an invocation and those before it in the workgroup
+var<workgroup> digitRanks: array<array<u32, 8>, WorkgroupSize>;
+
+@compute @workgroup_size(WorkgroupSize)
+fn scatter(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groups: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let block = blockIndex(group, groups);
+	if (block >= params.blockCount) {
+		return;
+	}
+	let index = block * WorkgroupSize + localIndex;
+	let inRange = index < params.count;
+	var key = 0u;
+	var digit = 0u;
+	var counts: array<u32, 8>;
+	if (inRange) {
+		key = keysIn[index];
+		digit = (key >> params.shift) & (DigitCount - 1u);
+		counts[digit >> 1u] = 1u << ((digit & 1u) * 16u);
+	}
+
+	// The rank of the element among those of the block with the same digit keeps the sort stable
+	digitRanks[localIndex] = counts;
+	for (var offset = 1u; offset < WorkgroupSize; offset <<= 1u) {
+		workgroupBarrier();
+		if (localIndex >= offset) {
+			let previous = digitRanks[localIndex - offset];
+			for (var w = 0u; w < 8u; w++) {
+				counts[w] += previous[w];
+			}
+		}
+		workgroupBarrier();
+		digitRanks[localIndex] = counts;
+	}
+
+	if (inRange) {
+		let rank = ((counts[digit >> 1u] >> ((digit & 1u) * 16u)) & 0xffffu) - 1u;
+		let destination = blockOffsets[digit * params.blockCount + block] + rank;
+		keysOut[destination] = key;
+		valuesOut[destination] = valuesIn[index];
+	}
+}
+)";
+
+std::string shaderSource(uint32_t workgroupSize, const char* source) {
+	return "const WorkgroupSize = " + std::to_string(workgroupSize) + "u;\n" + paramsSource + source;
+}
+
+uint32_t divideRoundingUp(uint32_t a, uint32_t b) {
+	return a / b + (a % b != 0 ? 1 : 0);
+}
+
+// A power of two the limits of all devices allow, and the digit counts of a block need 16 invocations
+uint32_t validWorkgroupSize(uint32_t workgroupSize) {
+	return std::bit_floor(std::clamp(workgroupSize, 32u, 256u));
+}
+
+Buffer createStorageBuffer(Device device, const char* label, uint64_t size, const char* owner) {
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = label;
+	bufferDesc.size = std::max<uint64_t>(size, 4);
+	bufferDesc.usage = BufferUsage::Storage;
+	bufferDesc.mappedAtCreation = false;
+	return createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, owner);
+}
+
+// Storage buffers of the given types at bindings 0, 1...
+BindGroupLayout storageLayout(PipelineCache& pipelineCache, std::initializer_list<BufferBindingType> types) {
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(types.size(), Default);
+	uint32_t binding = 0;
+	for (BufferBindingType type : types) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+		bindingLayoutEntries[binding].buffer.type = type;
+		bindingLayoutEntries[binding].buffer.minBindingSize = 4;
+		++binding;
+	}
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	return pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+}
+
+// Params of a dispatch, at a dynamic offset
+BindGroupLayout paramLayout(PipelineCache& pipelineCache) {
+	BindGroupLayoutEntry bindingLayout = Default;
+	bindingLayout.binding = 0;
+	bindingLayout.visibility = ShaderStage::Compute;
+	bindingLayout.buffer.type = BufferBindingType::Uniform;
+	bindingLayout.buffer.hasDynamicOffset = true;
+	bindingLayout.buffer.minBindingSize = sizeof(Params);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = 1;
+	bindGroupLayoutDesc.entries = &bindingLayout;
+	return pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+}
+
+PipelineLayout pipelineLayout(PipelineCache& pipelineCache, BindGroupLayout bindGroupLayout, BindGroupLayout paramLayout) {
+	std::array<WGPUBindGroupLayout, 2> layouts = { bindGroupLayout, paramLayout };
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = (uint32_t)layouts.size();
+	layoutDesc.bindGroupLayouts = layouts.data();
+	return pipelineCache.pipelineLayout(layoutDesc);
+}
+
+PipelineCache::AsyncComputePipeline computePipeline(PipelineCache& pipelineCache, PipelineLayout layout, ShaderModule module, const char* entryPoint) {
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = layout;
+	pipelineDesc.compute.module = module;
+	pipelineDesc.compute.entryPoint = entryPoint;
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	return pipelineCache.computePipelineAsync(pipelineDesc);
+}
+
+BindGroup createBindGroup(Device device, BindGroupLayout layout, std::initializer_list<Buffer> buffers) {
+	std::vector<BindGroupEntry> bindings(buffers.size());
+	uint32_t binding = 0;
+	for (Buffer buffer : buffers) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = buffer;
+		bindings[binding].offset = 0;
+		bindings[binding].size = buffer.getSize();
+		++binding;
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = layout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	return device.createBindGroup(bindGroupDesc);
+}
+
+// Room for the params of `dispatchCount` dispatches, and its bind group
+void createParams(Device device, BindGroupLayout layout, uint32_t dispatchCount, const char* owner, Buffer& buffer, BindGroup& bindGroup) {
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Compute primitive params";
+	bufferDesc.size = dispatchCount * ParamStride;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	buffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, owner);
+
+	BindGroupEntry binding{};
+	binding.binding = 0;
+	binding.buffer = buffer;
+	binding.offset = 0;
+	binding.size = sizeof(Params);
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = layout;
+	bindGroupDesc.entryCount = 1;
+	bindGroupDesc.entries = &binding;
+	bindGroup = device.createBindGroup(bindGroupDesc);
+}
+
+void writeParams(Queue queue, Buffer buffer, const std::vector<Params>& params) {
+	std::vector<uint8_t> data(params.size() * ParamStride, 0);
+	for (size_t i = 0; i < params.size(); ++i) {
+		std::memcpy(data.data() + i * ParamStride, &params[i], sizeof(Params));
+	}
+	queue.writeBuffer(buffer, 0, data.data(), data.size());
+}
+
+void releaseParams(Buffer& buffer, BindGroup& bindGroup) {
+	if (bindGroup) bindGroup.release();
+	if (!buffer) return;
+	destroyTracked(buffer);
+	buffer.release();
+}
+
+// `paramIndex` selecting the params of the dispatch in the bind group of the params
+void dispatchBlocks(ComputePassEncoder pass, BindGroup paramBindGroup, uint32_t paramIndex, uint32_t blockCount) {
+	if (blockCount == 0) return;
+	uint32_t offset = static_cast<uint32_t>(paramIndex * ParamStride);
+	pass.setBindGroup(1, paramBindGroup, 1, &offset);
+	uint32_t width = std::min(blockCount, MaxWorkgroupsPerDimension);
+	pass.dispatchWorkgroups(width, divideRoundingUp(blockCount, width), 1);
+}
+
+} // anonymous namespace
+
+// GpuScan
+
+GpuScan::GpuScan(Device device, PipelineCache& pipelineCache, uint32_t maxCount, uint32_t workgroupSize)
+	: mDevice(device)
+	, mMaxCount(std::max(maxCount, 1u))
+	, mWorkgroupSize(validWorkgroupSize(workgroupSize))
+{
+	mBindGroupLayout = storageLayout(pipelineCache, { BufferBindingType::Storage, BufferBindingType::Storage });
+	mParamLayout = paramLayout(pipelineCache);
+	PipelineLayout layout = pipelineLayout(pipelineCache, mBindGroupLayout, mParamLayout);
+	ShaderModule module = pipelineCache.shaderModule(shaderSource(mWorkgroupSize, scanShaderSource).c_str());
+	mScanPipeline = computePipeline(pipelineCache, layout, module, "scanBlocks");
+	mAddPipeline = computePipeline(pipelineCache, layout, module, "addSums");
+
+	// Block sums of each level, down to the single block whose sum is the total
+	std::array<uint32_t, MaxLevels> counts;
+	uint32_t levelCount = levelCounts(mMaxCount, counts);
+	for (uint32_t level = 0; level < levelCount; ++level) {
+		uint32_t blockCount = divideRoundingUp(counts[level], mWorkgroupSize * ItemsPerInvocation);
+		Buffer buffer = createStorageBuffer(device, "Scan block sums", uint64_t(blockCount) * sizeof(uint32_t), "GpuScan");
+		if (!buffer) {
+			std::cerr << "Could not create the block sums of a scan of " << mMaxCount << " elements" << std::endl;
+			break;
+		}
+		mLevelBuffers.push_back(buffer);
+	}
+	if (mLevelBuffers.size() < levelCount) {
+		for (Buffer& buffer : mLevelBuffers) {
+			destroyTracked(buffer);
+			buffer.release();
+		}
+		mLevelBuffers.clear();
+		return;
+	}
+	for (uint32_t level = 1; level < levelCount; ++level) {
+		mLevelBindGroups.push_back(createBindGroup(device, mBindGroupLayout, { mLevelBuffers[level - 1], mLevelBuffers[level] }));
+	}
+}
+
+GpuScan::~GpuScan() {
+	for (TargetData& target : mTargets) {
+		if (target.bindGroup) target.bindGroup.release();
+		releaseParams(target.paramBuffer, target.paramBindGroup);
+	}
+	for (BindGroup& bindGroup : mLevelBindGroups) {
+		bindGroup.release();
+	}
+	for (Buffer& buffer : mLevelBuffers) {
+		destroyTracked(buffer);
+		buffer.release();
+	}
+}
+
+uint32_t GpuScan::levelCounts(uint32_t count, std::array<uint32_t, MaxLevels>& counts) const {
+	const uint32_t blockSize = mWorkgroupSize * ItemsPerInvocation;
+	uint32_t levelCount = 0;
+	counts[levelCount++] = count;
+	while (count > blockSize && levelCount < MaxLevels) {
+		count = divideRoundingUp(count, blockSize);
+		counts[levelCount++] = count;
+	}
+	return levelCount;
+}
+
+GpuScan::Target GpuScan::addTarget(Buffer data) {
+	TargetData target;
+	if (valid()) {
+		target.bindGroup = createBindGroup(mDevice, mBindGroupLayout, { data, mLevelBuffers[0] });
+		createParams(mDevice, mParamLayout, MaxLevels, "GpuScan", target.paramBuffer, target.paramBindGroup);
+	}
+	mTargets.push_back(target);
+	return static_cast<Target>(mTargets.size() - 1);
+}
+
+void GpuScan::setCount(Queue queue, Target target, uint32_t count) {
+	TargetData& data = mTargets[target];
+	data.count = std::min(count, mMaxCount);
+	if (!data.paramBuffer) return;
+	std::array<uint32_t, MaxLevels> counts;
+	uint32_t levelCount = levelCounts(data.count, counts);
+	std::vector<Params> params(levelCount);
+	for (uint32_t level = 0; level < levelCount; ++level) {
+		params[level].count = counts[level];
+	}
+	writeParams(queue, data.paramBuffer, params);
+}
+
+void GpuScan::encode(ComputePassEncoder pass, Target target) const {
+	const TargetData& data = mTargets[target];
+	if (data.count == 0 || !data.bindGroup || !ready()) return;
+
+	// Up the levels scanning blocks, then down adding the scanned sums of the blocks to them
+	std::array<uint32_t, MaxLevels> counts;
+	uint32_t levelCount = levelCounts(data.count, counts);
+	const uint32_t blockSize = mWorkgroupSize * ItemsPerInvocation;
+	pass.setPipeline(mScanPipeline->pipeline);
+	for (uint32_t level = 0; level < levelCount; ++level) {
+		pass.setBindGroup(0, level == 0 ? data.bindGroup : mLevelBindGroups[level - 1], 0, nullptr);
+		dispatchBlocks(pass, data.paramBindGroup, level, divideRoundingUp(counts[level], blockSize));
+	}
+	if (levelCount == 1) return;
+	pass.setPipeline(mAddPipeline->pipeline);
+	for (uint32_t level = levelCount - 1; level-- > 0;) {
+		pass.setBindGroup(0, level == 0 ? data.bindGroup : mLevelBindGroups[level - 1], 0, nullptr);
+		dispatchBlocks(pass, data.paramBindGroup, level, divideRoundingUp(counts[level], blockSize));
+	}
+}
+
+// GpuCompaction
+
+GpuCompaction::GpuCompaction(Device device, PipelineCache& pipelineCache, uint32_t maxCount, uint32_t workgroupSize)
+	: mDevice(device)
+	, mScan(device, pipelineCache, maxCount, workgroupSize)
+{
+	mOffsetBuffer = createStorageBuffer(device, "Compaction offsets", uint64_t(mScan.maxCount()) * sizeof(uint32_t), "GpuCompaction");
+	if (!mOffsetBuffer) {
+		std::cerr << "Could not create the offsets of a compaction of " << mScan.maxCount() << " elements" << std::endl;
+	}
+
+	mBindGroupLayout = storageLayout(pipelineCache, {
+		BufferBindingType::ReadOnlyStorage, BufferBindingType::ReadOnlyStorage,
+		BufferBindingType::Storage, BufferBindingType::Storage, BufferBindingType::Storage
+	});
+	mParamLayout = paramLayout(pipelineCache);
+	PipelineLayout layout = pipelineLayout(pipelineCache, mBindGroupLayout, mParamLayout);
+	ShaderModule module = pipelineCache.shaderModule(shaderSource(mScan.workgroupSize(), compactionShaderSource).c_str());
+	mMarkPipeline = computePipeline(pipelineCache, layout, module, "mark");
+	mScatterPipeline = computePipeline(pipelineCache, layout, module, "scatter");
+}
+
+GpuCompaction::~GpuCompaction() {
+	for (TargetData& target : mTargets) {
+		if (target.bindGroup) target.bindGroup.release();
+		releaseParams(target.paramBuffer, target.paramBindGroup);
+	}
+	if (mOffsetBuffer) {
+		destroyTracked(mOffsetBuffer);
+		mOffsetBuffer.release();
+	}
+}
+
+bool GpuCompaction::ready() const {
+	return mScan.ready() && mMarkPipeline->ready() && mScatterPipeline->ready();
+}
+
+GpuCompaction::Target GpuCompaction::addTarget(Buffer input, Buffer flags, Buffer output, Buffer count) {
+	TargetData target;
+	if (valid()) {
+		target.bindGroup = createBindGroup(mDevice, mBindGroupLayout, { input, flags, mOffsetBuffer, output, count });
+		createParams(mDevice, mParamLayout, 1, "GpuCompaction", target.paramBuffer, target.paramBindGroup);
+		target.scanTarget = mScan.addTarget(mOffsetBuffer);
+	}
+	mTargets.push_back(target);
+	return static_cast<Target>(mTargets.size() - 1);
+}
+
+void GpuCompaction::setCount(Queue queue, Target target, uint32_t count) {
+	TargetData& data = mTargets[target];
+	data.count = std::min(count, maxCount());
+	if (!data.paramBuffer) return;
+	mScan.setCount(queue, data.scanTarget, data.count);
+	std::vector<Params> params(1);
+	params[0].count = data.count;
+	writeParams(queue, data.paramBuffer, params);
+}
+
+void GpuCompaction::encode(ComputePassEncoder pass, Target target) const {
+	const TargetData& data = mTargets[target];
+	if (!data.bindGroup || !ready()) return;
+
+	uint32_t blockCount = divideRoundingUp(data.count, mScan.workgroupSize());
+	if (blockCount > 0) {
+		pass.setPipeline(mMarkPipeline->pipeline);
+		pass.setBindGroup(0, data.bindGroup, 0, nullptr);
+		dispatchBlocks(pass, data.paramBindGroup, 0, blockCount);
+		mScan.encode(pass, data.scanTarget);
+	}
+	// At least one workgroup, which writes the count of an empty input
+	pass.setPipeline(mScatterPipeline->pipeline);
+	pass.setBindGroup(0, data.bindGroup, 0, nullptr);
+	dispatchBlocks(pass, data.paramBindGroup, 0, std::max(blockCount, 1u));
+}
+
+// GpuRadixSort
+
+GpuRadixSort::GpuRadixSort(Device device, PipelineCache& pipelineCache, uint32_t maxCount, uint32_t workgroupSize)
+	: mDevice(device)
+	, mMaxCount(std::max(maxCount, 1u))
+	, mScan(device, pipelineCache, (1u << BitsPerPass) * divideRoundingUp(mMaxCount, validWorkgroupSize(workgroupSize)), workgroupSize)
+{
+	uint64_t size = uint64_t(mMaxCount) * sizeof(uint32_t);
+	mKeyBuffer = createStorageBuffer(device, "Radix sort keys", size, "GpuRadixSort");
+	mValueBuffer = createStorageBuffer(device, "Radix sort values", size, "GpuRadixSort");
+	mBlockOffsetBuffer = createStorageBuffer(device, "Radix sort block offsets", uint64_t(mScan.maxCount()) * sizeof(uint32_t), "GpuRadixSort");
+	if (!mKeyBuffer || !mValueBuffer || !mBlockOffsetBuffer) {
+		std::cerr << "Could not create the buffers of a radix sort of " << mMaxCount << " elements" << std::endl;
+	}
+
+	mBindGroupLayout = storageLayout(pipelineCache, {
+		BufferBindingType::ReadOnlyStorage, BufferBindingType::ReadOnlyStorage,
+		BufferBindingType::Storage, BufferBindingType::Storage, BufferBindingType::Storage
+	});
+	mParamLayout = paramLayout(pipelineCache);
+	PipelineLayout layout = pipelineLayout(pipelineCache, mBindGroupLayout, mParamLayout);
+	ShaderModule module = pipelineCache.shaderModule(shaderSource(mScan.workgroupSize(), radixSortShaderSource).c_str());
+	mCountPipeline = computePipeline(pipelineCache, layout, module, "countDigits");
+	mScatterPipeline = computePipeline(pipelineCache, layout, module, "scatter");
+}
+
+GpuRadixSort::~GpuRadixSort() {
+	for (TargetData& target : mTargets) {
+		for (BindGroup& bindGroup : target.bindGroups) {
+			if (bindGroup) bindGroup.release();
+		}
+		releaseParams(target.paramBuffer, target.paramBindGroup);
+	}
+	for (Buffer* buffer : { &mBlockOffsetBuffer, &mValueBuffer, &mKeyBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+bool GpuRadixSort::ready() const {
+	return mScan.ready() && mCountPipeline->ready() && mScatterPipeline->ready();
+}
+
+GpuRadixSort::Target GpuRadixSort::addTarget(Buffer keys, Buffer values) {
+	TargetData target;
+	if (valid()) {
+		target.bindGroups[0] = createBindGroup(mDevice, mBindGroupLayout, { keys, values, mKeyBuffer, mValueBuffer, mBlockOffsetBuffer });
+		target.bindGroups[1] = createBindGroup(mDevice, mBindGroupLayout, { mKeyBuffer, mValueBuffer, keys, values, mBlockOffsetBuffer });
+		createParams(mDevice, mParamLayout, PassCount, "GpuRadixSort", target.paramBuffer, target.paramBindGroup);
+		target.scanTarget = mScan.addTarget(mBlockOffsetBuffer);
+	}
+	mTargets.push_back(target);
+	return static_cast<Target>(mTargets.size() - 1);
+}
+
+void GpuRadixSort::setCount(Queue queue, Target target, uint32_t count) {
+	TargetData& data = mTargets[target];
+	data.count = std::min(count, mMaxCount);
+	if (!data.paramBuffer) return;
+	uint32_t blockCount = divideRoundingUp(data.count, workgroupSize());
+	mScan.setCount(queue, data.scanTarget, (1u << BitsPerPass) * blockCount);
+	std::vector<Params> params(PassCount);
+	for (uint32_t pass = 0; pass < PassCount; ++pass) {
+		params[pass].count = data.count;
+		params[pass].blockCount = blockCount;
+		params[pass].shift = pass * BitsPerPass;
+	}
+	writeParams(queue, data.paramBuffer, params);
+}
+
+void GpuRadixSort::encode(ComputePassEncoder pass, Target target) const {
+	const TargetData& data = mTargets[target];
+	if (data.count <= 1 || !data.bindGroups[0] || !ready()) return;
+
+	uint32_t blockCount = divideRoundingUp(data.count, workgroupSize());
+	for (uint32_t sortPass = 0; sortPass < PassCount; ++sortPass) {
+		BindGroup bindGroup = data.bindGroups[sortPass % 2];
+		pass.setPipeline(mCountPipeline->pipeline);
+		pass.setBindGroup(0, bindGroup, 0, nullptr);
+		dispatchBlocks(pass, data.paramBindGroup, sortPass, blockCount);
+		// Binds its own groups
+		mScan.encode(pass, data.scanTarget);
+		pass.setPipeline(mScatterPipeline->pipeline);
+		pass.setBindGroup(0, bindGroup, 0, nullptr);
+		dispatchBlocks(pass, data.paramBindGroup, sortPass, blockCount);
+	}
+}
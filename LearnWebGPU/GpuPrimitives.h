@@ -0,0 +1,198 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Compute primitives over arrays of u32 in storage buffers, for the passes that
+ * would otherwise each sort, scan or compact in their own way: exclusive prefix
+ * sum, stream compaction and key/value radix sort.
+ *
+ * Each one is built for a maximum element count and a workgroup size, which
+ * becomes a constant of its shaders, and works on targets: the buffers of the
+ * caller bound once with addTarget(), then given their element count with
+ * setCount() whenever it changes and recorded into a compute pass of the caller
+ * with encode(). Dispatches of any number of workgroups are spread over 2
+ * dimensions, so that counts are only bounded by the size of storage bindings.
+ *
+ * The count of a target is uploaded with the queue, so that a target can only be
+ * encoded with one count per submission. Targets are released with the primitive.
+ * Like the rest of the device, they must only be used from the device thread.
+ */
+
+/**
+ * Exclusive prefix sum of u32 in place, wrapping around on overflow.
+ *
+ * Each workgroup scans a block of ItemsPerInvocation elements per invocation,
+ * then the block sums are scanned the same way, recursively, and added back down
+ * the levels: about 2 reads and 2 writes per element.
+ */
+class GpuScan {
+public:
+	static constexpr uint32_t ItemsPerInvocation = 4;
+	// Levels scanned at most, the elements included: 2^32 elements in blocks of 128 need 5
+	static constexpr uint32_t MaxLevels = 5;
+	using Target = uint32_t;
+
+	// Workgroup sizes are rounded down to a power of two, between 32 and 256
+	GpuScan(wgpu::Device device, PipelineCache& pipelineCache, uint32_t maxCount, uint32_t workgroupSize = 256);
+	~GpuScan();
+
+	GpuScan(const GpuScan&) = delete;
+	GpuScan& operator=(const GpuScan&) = delete;
+
+	// Whether the buffers of the block sums could be created
+	bool valid() const { return !mLevelBuffers.empty(); }
+	bool ready() const { return mScanPipeline->ready() && mAddPipeline->ready(); }
+	uint32_t maxCount() const { return mMaxCount; }
+	uint32_t workgroupSize() const { return mWorkgroupSize; }
+
+	// Scan the u32 of `data`, a Storage buffer, from its beginning
+	Target addTarget(wgpu::Buffer data);
+	// Up to maxCount()
+	void setCount(wgpu::Queue queue, Target target, uint32_t count);
+	void encode(wgpu::ComputePassEncoder pass, Target target) const;
+
+private:
+	struct TargetData {
+		// Level 0 in group 0, the element count of each level in group 1
+		wgpu::BindGroup bindGroup = nullptr;
+		wgpu::Buffer paramBuffer = nullptr;
+		wgpu::BindGroup paramBindGroup = nullptr;
+		uint32_t count = 0;
+	};
+
+	// Elements of each level for `count` elements at level 0, writing the level count
+	uint32_t levelCounts(uint32_t count, std::array<uint32_t, MaxLevels>& counts) const;
+
+private:
+	wgpu::Device mDevice;
+	uint32_t mMaxCount;
+	uint32_t mWorkgroupSize;
+	// Owned by the pipeline cache, like the pipelines
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	wgpu::BindGroupLayout mParamLayout = nullptr;
+	// Block sums of level 0 and above, the last one holding the total
+	std::vector<wgpu::Buffer> mLevelBuffers;
+	// Levels of block sums and the sums of their own blocks, for levels 1 and above
+	std::vector<wgpu::BindGroup> mLevelBindGroups;
+	std::vector<TargetData> mTargets;
+	PipelineCache::AsyncComputePipeline mScanPipeline;
+	PipelineCache::AsyncComputePipeline mAddPipeline;
+};
+
+/**
+ * Stream compaction: the u32 of an input whose flag is not 0 are written to the
+ * beginning of an output, in order, and their count to a buffer, without the CPU
+ * ever knowing it. Flags are turned into 0 or 1, scanned into the destination of
+ * each element kept, which is then scattered there.
+ */
+class GpuCompaction {
+public:
+	using Target = uint32_t;
+
+	GpuCompaction(wgpu::Device device, PipelineCache& pipelineCache, uint32_t maxCount, uint32_t workgroupSize = 256);
+	~GpuCompaction();
+
+	GpuCompaction(const GpuCompaction&) = delete;
+	GpuCompaction& operator=(const GpuCompaction&) = delete;
+
+	bool valid() const { return mOffsetBuffer != nullptr && mScan.valid(); }
+	bool ready() const;
+	uint32_t maxCount() const { return mScan.maxCount(); }
+	uint32_t workgroupSize() const { return mScan.workgroupSize(); }
+
+	// Keep the elements of `input` whose u32 of `flags` is not 0, writing them to `output`
+	// and their count to the first u32 of `count`, all Storage buffers
+	Target addTarget(wgpu::Buffer input, wgpu::Buffer flags, wgpu::Buffer output, wgpu::Buffer count);
+	void setCount(wgpu::Queue queue, Target target, uint32_t count);
+	void encode(wgpu::ComputePassEncoder pass, Target target) const;
+
+private:
+	struct TargetData {
+		wgpu::BindGroup bindGroup = nullptr;
+		wgpu::Buffer paramBuffer = nullptr;
+		wgpu::BindGroup paramBindGroup = nullptr;
+		// Over the offsets, scanned in place
+		GpuScan::Target scanTarget = 0;
+		uint32_t count = 0;
+	};
+
+private:
+	wgpu::Device mDevice;
+	GpuScan mScan;
+	// Destination of each element, shared by the targets
+	wgpu::Buffer mOffsetBuffer = nullptr;
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	wgpu::BindGroupLayout mParamLayout = nullptr;
+	std::vector<TargetData> mTargets;
+	PipelineCache::AsyncComputePipeline mMarkPipeline;
+	PipelineCache::AsyncComputePipeline mScatterPipeline;
+};
+
+/**
+ * Stable least significant digit radix sort of u32 keys along with u32 values,
+ * in increasing order, 4 bits per pass. Each pass counts the digits of the keys
+ * of each block of a workgroup, scans the counts of all blocks digit by digit
+ * with a GpuScan, then moves each element to the offset of its digit in its block
+ * plus its rank among the elements of the block with the same digit. The 8 passes
+ * go back and forth between the buffers of the target and temporary ones, an even
+ * number of times, so that the sorted elements end up in those of the target.
+ *
+ * Keys are floats too once their bits are mapped to an order preserving u32:
+ * flipping the sign bit of positive floats and all bits of negative ones.
+ */
+class GpuRadixSort {
+public:
+	static constexpr uint32_t BitsPerPass = 4;
+	static constexpr uint32_t PassCount = 32 / BitsPerPass;
+	using Target = uint32_t;
+
+	GpuRadixSort(wgpu::Device device, PipelineCache& pipelineCache, uint32_t maxCount, uint32_t workgroupSize = 256);
+	~GpuRadixSort();
+
+	GpuRadixSort(const GpuRadixSort&) = delete;
+	GpuRadixSort& operator=(const GpuRadixSort&) = delete;
+
+	bool valid() const { return mKeyBuffer != nullptr && mValueBuffer != nullptr && mBlockOffsetBuffer != nullptr && mScan.valid(); }
+	bool ready() const;
+	uint32_t maxCount() const { return mMaxCount; }
+	uint32_t workgroupSize() const { return mScan.workgroupSize(); }
+
+	// Sort `keys` and `values` in place, both Storage buffers
+	Target addTarget(wgpu::Buffer keys, wgpu::Buffer values);
+	void setCount(wgpu::Queue queue, Target target, uint32_t count);
+	void encode(wgpu::ComputePassEncoder pass, Target target) const;
+
+private:
+	struct TargetData {
+		// From the buffers of the target to the temporary ones, and back
+		std::array<wgpu::BindGroup, 2> bindGroups = { nullptr, nullptr };
+		// Count, block count and shift of each pass
+		wgpu::Buffer paramBuffer = nullptr;
+		wgpu::BindGroup paramBindGroup = nullptr;
+		// Over the digit counts of the blocks, scanned in place
+		GpuScan::Target scanTarget = 0;
+		uint32_t count = 0;
+	};
+
+private:
+	wgpu::Device mDevice;
+	uint32_t mMaxCount;
+	GpuScan mScan;
+	wgpu::Buffer mKeyBuffer = nullptr;
+	wgpu::Buffer mValueBuffer = nullptr;
+	// Counts of each digit in each block, digit major, then where the digits of each block go
+	wgpu::Buffer mBlockOffsetBuffer = nullptr;
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	wgpu::BindGroupLayout mParamLayout = nullptr;
+	std::vector<TargetData> mTargets;
+	PipelineCache::AsyncComputePipeline mCountPipeline;
+	PipelineCache::AsyncComputePipeline mScatterPipeline;
+};
@@ -0,0 +1,178 @@
+#include "GpuProfiler.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <utility>
+
+using namespace wgpu;
+
+GpuProfiler::GpuProfiler(Device device, uint32_t maxPassCount, uint32_t readbackBufferCount, uint32_t historyLength)
+	: mMaxPassCount(std::max(maxPassCount, 1u))
+	, mHistoryLength(std::max(historyLength, 1u))
+{
+	if (!device.hasFeature(FeatureName::TimestampQuery)) return;
+
+	QuerySetDescriptor querySetDesc{};
+	querySetDesc.label = "GPU profiler timestamps";
+	querySetDesc.type = QueryType::Timestamp;
+	querySetDesc.count = 2 * mMaxPassCount;
+	mQuerySet = device.createQuerySet(querySetDesc);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "GPU profiler resolve buffer";
+	bufferDesc.size = querySetDesc.count * sizeof(uint64_t);
+	bufferDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+	bufferDesc.mappedAtCreation = false;
+	mResolveBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "GpuProfiler");
+
+	mReadbacks = ReadbackPool(device, readbackBufferCount, bufferDesc.size, "GPU profiler readback buffer", "GpuProfiler");
+	mPassNames.resize(mReadbacks.slotCount());
+}
+
+GpuProfiler::~GpuProfiler() {
+	if (!enabled()) return;
+
+	destroyTracked(mResolveBuffer);
+	mResolveBuffer.release();
+	mQuerySet.destroy();
+	mQuerySet.release();
+}
+
+void GpuProfiler::beginFrame() {
+	if (!enabled()) return;
+
+	for (uint32_t slot = 0; slot < mReadbacks.slotCount(); ++slot) {
+		if (mReadbacks.state(slot) == ReadbackPool::State::Mapped) addTimings(slot);
+	}
+
+	// A frame that was not resolved (e.g., it had no surface texture) leaves its buffer to the next one
+	if (mCurrent != ReadbackPool::NoSlot && mReadbacks.state(mCurrent) == ReadbackPool::State::Recording) {
+		mReadbacks.cancel(mCurrent);
+	}
+	mCurrent = mReadbacks.reserve();
+	if (mCurrent != ReadbackPool::NoSlot) mPassNames[mCurrent].clear();
+}
+
+const RenderPassTimestampWrites* GpuProfiler::renderPass(const char* name, RenderPassTimestampWrites& writes) {
+	uint32_t firstQuery;
+	if (!allocateQueries(name, firstQuery)) return nullptr;
+	writes.querySet = mQuerySet;
+	writes.beginningOfPassWriteIndex = firstQuery;
+	writes.endOfPassWriteIndex = firstQuery + 1;
+	return &writes;
+}
+
+const ComputePassTimestampWrites* GpuProfiler::computePass(const char* name, ComputePassTimestampWrites& writes) {
+	uint32_t firstQuery;
+	if (!allocateQueries(name, firstQuery)) return nullptr;
+	writes.querySet = mQuerySet;
+	writes.beginningOfPassWriteIndex = firstQuery;
+	writes.endOfPassWriteIndex = firstQuery + 1;
+	return &writes;
+}
+
+void GpuProfiler::resolve(CommandEncoder encoder) {
+	if (mCurrent == ReadbackPool::NoSlot || mPassNames[mCurrent].empty()) return;
+	uint32_t queryCount = static_cast<uint32_t>(2 * mPassNames[mCurrent].size());
+	encoder.resolveQuerySet(mQuerySet, 0, queryCount, mResolveBuffer, 0);
+	encoder.copyBufferToBuffer(mResolveBuffer, 0, mReadbacks.buffer(mCurrent), 0, queryCount * sizeof(uint64_t));
+}
+
+void GpuProfiler::readBack() {
+	if (mCurrent == ReadbackPool::NoSlot) return;
+	uint32_t slot = std::exchange(mCurrent, ReadbackPool::NoSlot);
+	if (mPassNames[slot].empty()) {
+		mReadbacks.cancel(slot);
+		return;
+	}
+
+	// Timings of a frame that failed to map are dropped
+	mReadbacks.map(slot, 2 * mPassNames[slot].size() * sizeof(uint64_t));
+}
+
+void GpuProfiler::printTimings(std::ostream& out) const {
+	out << "GPU pass timings (ms, last / average / max over " << mHistoryLength << " frames):" << std::endl;
+	std::ios_base::fmtflags flags = out.flags();
+	for (const PassTiming& timing : mTimings) {
+		out << "  " << std::left << std::setw(20) << timing.name << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(9) << timing.lastMs << std::setw(9) << timing.averageMs << std::setw(9) << timing.maxMs << std::endl;
+	}
+	out.flags(flags);
+}
+
+bool GpuProfiler::allocateQueries(const char* name, uint32_t& firstQuery) {
+	if (mCurrent == ReadbackPool::NoSlot || mPassNames[mCurrent].size() >= mMaxPassCount) return false;
+	firstQuery = static_cast<uint32_t>(2 * mPassNames[mCurrent].size());
+	mPassNames[mCurrent].push_back(name);
+	return true;
+}
+
+void GpuProfiler::addTimings(uint32_t slot) {
+	const std::vector<std::string>& passNames = mPassNames[slot];
+	size_t passCount = passNames.size();
+	const uint64_t* timestamps = static_cast<const uint64_t*>(mReadbacks.mappedRange(slot, 2 * passCount * sizeof(uint64_t)));
+
+	// Passes of the same name in a frame add up, e.g. when a pass is split
+	uint64_t firstBegin = std::numeric_limits<uint64_t>::max();
+	uint64_t lastEnd = 0;
+	std::vector<double>& durations = mFrameDurations;
+	std::vector<bool>& measured = mFrameMeasured;
+	durations.assign(mTimings.size(), 0.0);
+	measured.assign(mTimings.size(), false);
+	for (size_t i = 0; i < passCount; ++i) {
+		auto it = std::find_if(mTimings.begin(), mTimings.end(), [&](const PassTiming& timing) {
+			return timing.name == passNames[i];
+		});
+		size_t index = it - mTimings.begin();
+		if (it == mTimings.end()) {
+			PassTiming timing;
+			timing.name = passNames[i];
+			timing.history.reserve(mHistoryLength);
+			mTimings.push_back(std::move(timing));
+			durations.push_back(0.0);
+			measured.push_back(false);
+		}
+		// Timestamps are in nanoseconds, and some implementations do not guarantee that they
+		// increase within a pass
+		uint64_t begin = timestamps[2 * i];
+		uint64_t end = timestamps[2 * i + 1];
+		durations[index] += end > begin ? static_cast<double>(end - begin) * 1e-6 : 0.0;
+		measured[index] = true;
+		if (end > begin) {
+			firstBegin = std::min(firstBegin, begin);
+			lastEnd = std::max(lastEnd, end);
+		}
+	}
+	mReadbacks.release(slot);
+
+	++mMeasuredFrameCount;
+	mLastFrameMs = 0.0;
+	for (double duration : durations) {
+		mLastFrameMs += duration;
+	}
+	mLastSpanMs = lastEnd > firstBegin ? static_cast<double>(lastEnd - firstBegin) * 1e-6 : 0.0;
+
+	for (size_t index = 0; index < mTimings.size(); ++index) {
+		if (!measured[index]) continue;
+		PassTiming& timing = mTimings[index];
+		if (timing.history.size() < mHistoryLength) {
+			timing.history.push_back(durations[index]);
+		}
+		else {
+			timing.history[timing.nextSample] = durations[index];
+		}
+		timing.nextSample = (timing.nextSample + 1) % mHistoryLength;
+
+		timing.lastMs = durations[index];
+		timing.maxMs = 0.0;
+		double sum = 0.0;
+		for (double duration : timing.history) {
+			sum += duration;
+			timing.maxMs = std::max(timing.maxMs, duration);
+		}
+		timing.averageMs = sum / timing.history.size();
+	}
+}
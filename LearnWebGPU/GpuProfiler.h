@@ -0,0 +1,104 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "ReadbackPool.h"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Measure how long the GPU spends in each render and compute pass, from
+ * timestamps written at the beginning and end of the passes.
+ *
+ * The timestamps of a frame are resolved into a buffer at the end of its command
+ * encoding, copied to a readback buffer and mapped asynchronously once submitted,
+ * so that reading them never stalls the CPU: they reach the timing table a few
+ * frames later. A frame is not measured when all readback buffers are still in use.
+ *
+ * Requires the TimestampQuery feature, without which every method does nothing and
+ * passes get no timestamp writes. Like the rest of the device, it must only be used
+ * from the device thread.
+ */
+class GpuProfiler {
+public:
+	/**
+	 * Rolling timing of the passes of a given name
+	 */
+	struct PassTiming {
+		std::string name;
+		// Duration in the last frame measured, in milliseconds
+		double lastMs = 0.0;
+		// Average and maximum durations over the last `historyLength` frames measured
+		double averageMs = 0.0;
+		double maxMs = 0.0;
+		// Durations of the last frames measured, as a ring
+		std::vector<double> history;
+		size_t nextSample = 0;
+	};
+
+	GpuProfiler(wgpu::Device device, uint32_t maxPassCount = 8, uint32_t readbackBufferCount = 4, uint32_t historyLength = 64);
+	~GpuProfiler();
+
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	// Whether the device supports timestamp queries
+	bool enabled() const { return mQuerySet != nullptr; }
+
+	// Add the timings read back since the last frame to the table, and start measuring a new frame
+	void beginFrame();
+
+	// Fill `writes` with the timestamp writes of a pass and return it, to set as the
+	// `timestampWrites` of the pass descriptor, or return nullptr if the frame is not measured.
+	// Only call it for passes that are actually recorded.
+	const wgpu::RenderPassTimestampWrites* renderPass(const char* name, wgpu::RenderPassTimestampWrites& writes);
+	const wgpu::ComputePassTimestampWrites* computePass(const char* name, wgpu::ComputePassTimestampWrites& writes);
+
+	// Record the resolution of the timestamps of the frame, after its last pass
+	void resolve(wgpu::CommandEncoder encoder);
+
+	// Read the timestamps back once the frame is submitted
+	void readBack();
+
+	// Timing of each pass name, in the order they were first measured
+	const std::vector<PassTiming>& timings() const { return mTimings; }
+
+	// Frames measured so far, and GPU time of the last one, summed over its passes
+	uint64_t measuredFrameCount() const { return mMeasuredFrameCount; }
+	double lastFrameMs() const { return mLastFrameMs; }
+	// Time from the beginning of the first pass of the last frame measured to the end of its
+	// last one, shorter than lastFrameMs() when the GPU overlaps passes of its command buffers,
+	// longer when it idles in between
+	double lastSpanMs() const { return mLastSpanMs; }
+
+	// Write the timing table to `out`
+	void printTimings(std::ostream& out) const;
+
+private:
+	// Reserve the 2 queries of a pass, returning the index of the first one or false if there is none
+	bool allocateQueries(const char* name, uint32_t& firstQuery);
+
+	// Add the timestamps of a mapped readback slot to the table
+	void addTimings(uint32_t slot);
+
+private:
+	uint32_t mMaxPassCount;
+	uint32_t mHistoryLength;
+	wgpu::QuerySet mQuerySet = nullptr;
+	// Resolved timestamps, to copy to a readback buffer (queries cannot be resolved to mappable buffers)
+	wgpu::Buffer mResolveBuffer = nullptr;
+	ReadbackPool mReadbacks;
+	// Names of the passes of the timestamps in each readback slot, 2 per pass
+	std::vector<std::vector<std::string>> mPassNames;
+	// Readback slot of the frame being recorded, NoSlot if the frame is not measured
+	uint32_t mCurrent = ReadbackPool::NoSlot;
+	std::vector<PassTiming> mTimings;
+	// Per pass of the frame being read back, kept from one frame to the next not to allocate
+	std::vector<double> mFrameDurations;
+	std::vector<bool> mFrameMeasured;
+	uint64_t mMeasuredFrameCount = 0;
+	double mLastFrameMs = 0.0;
+	double mLastSpanMs = 0.0;
+};
@@ -0,0 +1,410 @@
+#include "GpuVertexConversion.h"
+#include "GpuMemory.h"
+#include "MappedFile.h"
+#include "ObjParser.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <limits>
+#include <string>
+
+using namespace wgpu;
+
+namespace {
+
+const char* conversionShaderSource = R"(
+struct ConversionUniforms {
+	positionOffset: vec4f,
+	inversePositionScale: vec4f,
+	// Offset in xy, inverse scale in zw, for Unorm16 uvs
+	uvOffsetInverseScale: vec4f,
+	cornerCount: u32,
+	// Number of elements of each attribute array, for bound checks
+	positionCount: u32,
+	normalCount: u32,
+	texcoordCount: u32,
+	colorCount: u32,
+};
+
+@group(0) @binding(0) var<uniform> uConversion: ConversionUniforms;
+// The arrays of tinyobj::attrib_t, 3 floats per element (2 for texcoords)
+@group(0) @binding(1) var<storage, read> positions: array<f32>;
+@group(0) @binding(2) var<storage, read> normals: array<f32>;
+@group(0) @binding(3) var<storage, read> texcoords: array<f32>;
+@group(0) @binding(4) var<storage, read> colors: array<f32>;
+// tinyobj::index_t, the vertex, normal and texcoord indices of each corner, -1 if absent
+@group(0) @binding(5) var<storage, read> corners: array<i32>;
+
+struct Corner {
+	position: vec3f,
+	normal: vec3f,
+	color: vec3f,
+	uv: vec2f,
+}
+
+fn readVec3(index: i32, count: u32, attribute: u32) -> vec3f {
+	if (index < 0 || u32(index) >= count) {
+		return select(vec3f(0.0), vec3f(1.0), attribute == 3u);
+	}
+	let i = 3u * u32(index);
+	switch attribute {
+		case 0u: { return vec3f(positions[i], positions[i + 1u], positions[i + 2u]); }
+		case 1u: { return vec3f(normals[i], normals[i + 1u], normals[i + 2u]); }
+		default: { return vec3f(colors[i], colors[i + 1u], colors[i + 2u]); }
+	}
+}
+
+// Same as convertObjVertices: Y-up to Z-up, V flipped, missing normals and uvs are
+// zero and missing colors white
+fn readCorner(corner: u32) -> Corner {
+	let vertexIndex = corners[3u * corner];
+	let normalIndex = corners[3u * corner + 1u];
+	let texcoordIndex = corners[3u * corner + 2u];
+	var out: Corner;
+	let position = readVec3(vertexIndex, uConversion.positionCount, 0u);
+	let normal = readVec3(normalIndex, uConversion.normalCount, 1u);
+	out.position = vec3f(position.x, -position.z, position.y);
+	out.normal = vec3f(normal.x, -normal.z, normal.y);
+	out.color = readVec3(vertexIndex, uConversion.colorCount, 3u);
+	out.uv = vec2f(0.0);
+	if (texcoordIndex >= 0 && u32(texcoordIndex) < uConversion.texcoordCount) {
+		let i = 2u * u32(texcoordIndex);
+		out.uv = vec2f(texcoords[i], 1.0 - texcoords[i + 1u]);
+	}
+	return out;
+}
+
+fn octahedralEncode(n: vec3f) -> vec2f {
+	let norm = abs(n.x) + abs(n.y) + abs(n.z);
+	if (norm == 0.0) {
+		return vec2f(0.0);
+	}
+	let m = n / norm;
+	if (m.z >= 0.0) {
+		return m.xy;
+	}
+	// Fold the lower hemisphere over the diagonals
+	return (1.0 - abs(m.yx)) * select(vec2f(-1.0), vec2f(1.0), m.xy >= vec2f(0.0));
+}
+)";
+
+/**
+ * The ConversionUniforms structure of the shader
+ */
+struct ConversionUniforms {
+	glm::vec4 positionOffset;
+	glm::vec4 inversePositionScale;
+	glm::vec4 uvOffsetInverseScale;
+	uint32_t cornerCount;
+	uint32_t positionCount;
+	uint32_t normalCount;
+	uint32_t texcoordCount;
+	uint32_t colorCount;
+	uint32_t _pad[3];
+};
+static_assert(sizeof(ConversionUniforms) % 16 == 0);
+
+static_assert(sizeof(tinyobj::real_t) == sizeof(float), "The conversion shader reads the attributes of tinyobj as floats");
+static_assert(sizeof(tinyobj::index_t) == 3 * sizeof(int32_t), "The conversion shader reads corners as 3 integers");
+
+// Each invocation writes one vertex, workgroups being laid out along y past the limit on x
+constexpr uint32_t workgroupSize = 64;
+constexpr uint32_t maxWorkgroupsPerDimension = 65535;
+
+// Rest of the shader for `layout`: the encoding of a corner in the words of its vertex, and
+// the entry point writing them to the vertex buffers, the first ones to buffer 0
+std::string conversionShader(const VertexLayout& layout) {
+	uint32_t vertexWords = static_cast<uint32_t>(layout.vertexSize() / 4);
+	uint32_t positionWords = static_cast<uint32_t>(layout.arrayStride(0) / 4);
+	std::string source = conversionShaderSource;
+	source += "\nconst vertexWords = " + std::to_string(vertexWords) + "u;\n";
+	source += "const positionWords = " + std::to_string(positionWords) + "u;\n";
+	source += "@group(0) @binding(6) var<storage, read_write> vertexStream0: array<u32>;\n";
+	if (layout.splitPositionStream()) {
+		source += "@group(0) @binding(7) var<storage, read_write> vertexStream1: array<u32>;\n";
+	}
+
+	source += "\nfn encodeCorner(c: Corner) -> array<u32, vertexWords> {\n";
+	if (layout.encoding() == VertexLayout::Encoding::Float32) {
+		// VertexAttributes as is
+		source += R"(	return array<u32, vertexWords>(
+		bitcast<u32>(c.position.x), bitcast<u32>(c.position.y), bitcast<u32>(c.position.z),
+		bitcast<u32>(c.normal.x), bitcast<u32>(c.normal.y), bitcast<u32>(c.normal.z),
+		bitcast<u32>(c.color.x), bitcast<u32>(c.color.y), bitcast<u32>(c.color.z),
+		bitcast<u32>(c.uv.x), bitcast<u32>(c.uv.y),
+	);
+}
+)";
+	}
+	else {
+		// Packed like CompactVertex, with the same rounding as glm's pack functions
+		source += R"(	let position = (c.position - uConversion.positionOffset.xyz) * uConversion.inversePositionScale.xyz;
+)";
+		if (layout.uvFormat() == VertexLayout::UvFormat::Unorm16) {
+			source += "\tlet uv = pack2x16unorm((c.uv - uConversion.uvOffsetInverseScale.xy) * uConversion.uvOffsetInverseScale.zw);\n";
+		}
+		else {
+			source += "\tlet uv = pack2x16float(c.uv);\n";
+		}
+		source += R"(	return array<u32, vertexWords>(
+		pack2x16unorm(position.xy),
+		pack2x16unorm(vec2f(position.z, 0.0)),
+		pack2x16snorm(octahedralEncode(c.normal)),
+		pack4x8unorm(vec4f(c.color, 1.0)),
+		uv,
+	);
+}
+)";
+	}
+
+	source += R"(
+@compute @workgroup_size(64)
+fn convertCorners(@builtin(global_invocation_id) id: vec3u, @builtin(num_workgroups) workgroups: vec3u) {
+	let corner = id.x + id.y * workgroups.x * 64u;
+	if (corner >= uConversion.cornerCount) {
+		return;
+	}
+	var words = encodeCorner(readCorner(corner));
+	for (var k = 0u; k < positionWords; k++) {
+		vertexStream0[corner * positionWords + k] = words[k];
+	}
+)";
+	if (layout.splitPositionStream()) {
+		source += R"(	for (var k = positionWords; k < vertexWords; k++) {
+		vertexStream1[corner * (vertexWords - positionWords) + k - positionWords] = words[k];
+	}
+)";
+	}
+	source += "}\n";
+	return source;
+}
+
+// Bounds of the positions and uvs of `attrib` once remapped, as VertexLayout::computeQuantization
+// gives them. All vertices count, referenced or not, which only loosens the bounds.
+VertexQuantization computeQuantization(const VertexLayout& layout, const tinyobj::attrib_t& attrib) {
+	VertexQuantization quantization;
+	if (layout.encoding() == VertexLayout::Encoding::Float32) return quantization;
+
+	glm::vec3 positionMin(std::numeric_limits<float>::max());
+	glm::vec3 positionMax(std::numeric_limits<float>::lowest());
+	for (size_t i = 0; i + 2 < attrib.vertices.size(); i += 3) {
+		glm::vec3 position = { attrib.vertices[i], -attrib.vertices[i + 2], attrib.vertices[i + 1] };
+		positionMin = glm::min(positionMin, position);
+		positionMax = glm::max(positionMax, position);
+	}
+	if (positionMin.x <= positionMax.x) {
+		quantization.positionOffset = glm::vec4(positionMin, 0.0f);
+		quantization.positionScale = glm::vec4(positionMax - positionMin, 0.0f);
+	}
+
+	if (layout.uvFormat() == VertexLayout::UvFormat::Unorm16) {
+		// Corners without a texcoord have a uv of 0
+		glm::vec2 uvMin(0.0f);
+		glm::vec2 uvMax(0.0f);
+		for (size_t i = 0; i + 1 < attrib.texcoords.size(); i += 2) {
+			glm::vec2 uv = { attrib.texcoords[i], 1.0f - attrib.texcoords[i + 1] };
+			uvMin = glm::min(uvMin, uv);
+			uvMax = glm::max(uvMax, uv);
+		}
+		quantization.uvOffsetScale = glm::vec4(uvMin, uvMax - uvMin);
+	}
+	return quantization;
+}
+
+// A buffer of `size` bytes, never empty for bindings with nothing to read to still have a valid buffer
+Buffer createBuffer(Device device, const char* label, BufferUsage usage, uint64_t size, GpuMemoryCategory category) {
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = label;
+	bufferDesc.usage = usage;
+	bufferDesc.size = (std::max<uint64_t>(size, 16) + 3) & ~uint64_t(3);
+	bufferDesc.mappedAtCreation = false;
+	return createTrackedBuffer(device, bufferDesc, category, "GpuObjConverter");
+}
+
+} // anonymous namespace
+
+void GpuObjConverter::Mesh::release() {
+	for (Buffer& buffer : vertexBuffers) {
+		if (!buffer) continue;
+		destroyTracked(buffer);
+		buffer.release();
+	}
+	vertexBuffers.clear();
+	vertexCount = 0;
+}
+
+GpuObjConverter::GpuObjConverter(Device device, PipelineCache& pipelineCache, const VertexLayout& layout)
+	: mDevice(device)
+	, mLayout(layout)
+{
+	uint32_t bindingCount = 7 + (layout.splitPositionStream() ? 1 : 0);
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(bindingCount, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+		bindingLayoutEntries[binding].buffer.type = binding >= 6 ? BufferBindingType::Storage : BufferBindingType::ReadOnlyStorage;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(ConversionUniforms);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(conversionShader(layout));
+	pipelineDesc.compute.entryPoint = "convertCorners";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+}
+
+bool GpuObjConverter::loadRaw(const std::filesystem::path& path, RawObj& obj) {
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	if (!parseObjParallel(file.data(), file.size(), obj.attrib, obj.corners)) {
+		std::cerr << "Could not parse " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool GpuObjConverter::convert(UploadManager& uploads, const RawObj& obj, Mesh& mesh) {
+	mesh.release();
+	if (!ready()) return false;
+	const tinyobj::attrib_t& attrib = obj.attrib;
+
+	// Every array is bound whole
+	SupportedLimits supportedLimits;
+	mDevice.getLimits(&supportedLimits);
+	uint64_t maxBytes = std::min(supportedLimits.limits.maxStorageBufferBindingSize, supportedLimits.limits.maxBufferSize);
+	uint64_t cornerCount = obj.corners.size();
+	uint64_t inputBytes = std::max({
+		attrib.vertices.size(), attrib.normals.size(), attrib.texcoords.size(), attrib.colors.size(), 3 * obj.corners.size()
+	}) * sizeof(float);
+	uint64_t outputBytes = cornerCount * std::max(mLayout.arrayStride(0), mLayout.splitPositionStream() ? mLayout.arrayStride(1) : 0);
+	if (std::max(inputBytes, outputBytes) > maxBytes || cornerCount > std::numeric_limits<uint32_t>::max()) {
+		std::cerr << "Could not convert the " << cornerCount << " corners of a mesh on the GPU, it is too large for the storage buffers of the device" << std::endl;
+		return false;
+	}
+	if (cornerCount == 0) return true;
+
+	VertexQuantization quantization = computeQuantization(mLayout, attrib);
+	auto inverse = [](float extent) { return extent > 0.0f ? 1.0f / extent : 0.0f; };
+	ConversionUniforms uniforms = {};
+	uniforms.positionOffset = quantization.positionOffset;
+	uniforms.inversePositionScale = {
+		inverse(quantization.positionScale.x),
+		inverse(quantization.positionScale.y),
+		inverse(quantization.positionScale.z),
+		0.0f
+	};
+	uniforms.uvOffsetInverseScale = {
+		quantization.uvOffsetScale.x,
+		quantization.uvOffsetScale.y,
+		inverse(quantization.uvOffsetScale.z),
+		inverse(quantization.uvOffsetScale.w)
+	};
+	uniforms.cornerCount = static_cast<uint32_t>(cornerCount);
+	uniforms.positionCount = static_cast<uint32_t>(attrib.vertices.size() / 3);
+	uniforms.normalCount = static_cast<uint32_t>(attrib.normals.size() / 3);
+	uniforms.texcoordCount = static_cast<uint32_t>(attrib.texcoords.size() / 2);
+	uniforms.colorCount = static_cast<uint32_t>(attrib.colors.size() / 3);
+
+	// Inputs, in the order of their bindings
+	struct Input {
+		const char* label;
+		const void* data;
+		uint64_t size;
+		GpuMemoryCategory category;
+	};
+	const std::array<Input, 6> inputDescs = { {
+		{ "Conversion uniforms", &uniforms, sizeof(uniforms), GpuMemoryCategory::Uniforms },
+		{ "OBJ positions", attrib.vertices.data(), attrib.vertices.size() * sizeof(float), GpuMemoryCategory::Geometry },
+		{ "OBJ normals", attrib.normals.data(), attrib.normals.size() * sizeof(float), GpuMemoryCategory::Geometry },
+		{ "OBJ texcoords", attrib.texcoords.data(), attrib.texcoords.size() * sizeof(float), GpuMemoryCategory::Geometry },
+		{ "OBJ colors", attrib.colors.data(), attrib.colors.size() * sizeof(float), GpuMemoryCategory::Geometry },
+		{ "OBJ corners", obj.corners.data(), obj.corners.size() * sizeof(tinyobj::index_t), GpuMemoryCategory::Geometry },
+	} };
+	std::vector<Buffer> buffers;
+	bool created = true;
+	for (size_t i = 0; i < inputDescs.size(); ++i) {
+		BufferUsage usage = (i == 0 ? BufferUsage::Uniform : BufferUsage::Storage) | BufferUsage::CopyDst;
+		buffers.push_back(createBuffer(mDevice, inputDescs[i].label, usage, inputDescs[i].size, inputDescs[i].category));
+		created = created && buffers.back();
+	}
+	for (uint32_t buffer = 0; buffer < mLayout.bufferCount(); ++buffer) {
+		Buffer vertexBuffer = createBuffer(mDevice, "Converted vertices", BufferUsage::Vertex | BufferUsage::Storage, cornerCount * mLayout.arrayStride(buffer), GpuMemoryCategory::Geometry);
+		mesh.vertexBuffers.push_back(vertexBuffer);
+		created = created && vertexBuffer;
+	}
+	auto releaseInputs = [&]() {
+		for (Buffer& buffer : buffers) {
+			if (buffer) retireTracked(buffer);
+		}
+	};
+	if (!created) {
+		std::cerr << "Could not create the buffers to convert a mesh of " << cornerCount << " corners" << std::endl;
+		releaseInputs();
+		mesh.release();
+		return false;
+	}
+
+	// The copies are submitted by the flush, before the conversion that reads them
+	for (size_t i = 0; i < inputDescs.size(); ++i) {
+		if (inputDescs[i].size > 0) uploads.writeBuffer(buffers[i], 0, inputDescs[i].data, inputDescs[i].size);
+	}
+	uploads.flush();
+
+	std::vector<BindGroupEntry> bindings(buffers.size() + mesh.vertexBuffers.size());
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+		Buffer buffer = binding < buffers.size() ? buffers[binding] : mesh.vertexBuffers[binding - buffers.size()];
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = buffer;
+		bindings[binding].offset = 0;
+		bindings[binding].size = buffer.getSize();
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mBindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	BindGroup bindGroup = mDevice.createBindGroup(bindGroupDesc);
+
+	uint32_t workgroupCount = static_cast<uint32_t>((cornerCount + workgroupSize - 1) / workgroupSize);
+	uint32_t workgroupCountX = std::min(workgroupCount, maxWorkgroupsPerDimension);
+	uint32_t workgroupCountY = (workgroupCount + workgroupCountX - 1) / workgroupCountX;
+
+	CommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "OBJ conversion";
+	CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "OBJ conversion";
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mPipeline->pipeline);
+	computePass.setBindGroup(0, bindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups(workgroupCountX, workgroupCountY, 1);
+	computePass.end();
+	computePass.release();
+	CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+	encoder.release();
+	Queue queue = mDevice.getQueue();
+	queue.submit(commands);
+	commands.release();
+	queue.release();
+	bindGroup.release();
+
+	// Freed once the conversion is done
+	releaseInputs();
+
+	mesh.vertexCount = static_cast<uint32_t>(cornerCount);
+	mesh.quantization = quantization;
+	return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "VertexLayout.h"
+#include "PipelineCache.h"
+#include "UploadManager.h"
+
+#include "tiny_obj_loader.h"
+
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Conversion of OBJ meshes to vertex buffers on the GPU: the attribute and index
+ * arrays are uploaded as tinyobj parses them, and a compute pass de-indexes,
+ * remaps (Y-up to Z-up, V flipped), quantizes and interleaves them straight into
+ * the vertex buffers of a VertexLayout, in the same encoding as VertexLayout::encode.
+ *
+ * This leaves the CPU with reading and parsing the file, convertObjVertices and
+ * VertexLayout::encode being the GPU's job. Like the vector-only path of
+ * ResourceManager::loadGeometryFromObj, every corner of the mesh makes a vertex
+ * (non-indexed draw) and materials are ignored.
+ */
+class GpuObjConverter {
+public:
+	/**
+	 * Arrays of a parsed OBJ, as given to the GPU
+	 */
+	struct RawObj {
+		tinyobj::attrib_t attrib;
+		// The corners of the triangles, 3 per triangle
+		std::vector<tinyobj::index_t> corners;
+	};
+
+	/**
+	 * Output of convert(), to draw with vertexCount vertices and no index buffer
+	 */
+	struct Mesh {
+		// One per buffer of the layout, with the Vertex and Storage usages
+		std::vector<wgpu::Buffer> vertexBuffers;
+		uint32_t vertexCount = 0;
+		// To give to the shaders for the Compact encoding
+		VertexQuantization quantization;
+
+		void release();
+	};
+
+	// The layout must outlive the converter
+	GpuObjConverter(wgpu::Device device, PipelineCache& pipelineCache, const VertexLayout& layout);
+
+	GpuObjConverter(const GpuObjConverter&) = delete;
+	GpuObjConverter& operator=(const GpuObjConverter&) = delete;
+
+	// Whether the pipeline is built, before which convert() fails
+	bool ready() const { return mPipeline && mPipeline->ready(); }
+
+	// Read and parse the OBJ file at `path`, with no conversion, e.g. on a loader thread
+	static bool loadRaw(const std::filesystem::path& path, RawObj& obj);
+
+	// Upload the arrays of `obj` through `uploads`, which is flushed, then submit the
+	// conversion of its corners into new buffers. Returns false, leaving `mesh` empty,
+	// if the pipeline is not ready or the arrays do not fit in storage buffers.
+	bool convert(UploadManager& uploads, const RawObj& obj, Mesh& mesh);
+
+private:
+	wgpu::Device mDevice;
+	const VertexLayout& mLayout;
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	// Owned by the pipeline cache
+	PipelineCache::AsyncComputePipeline mPipeline;
+};
@@ -0,0 +1,89 @@
+#include "HeapManifest.h"
+#include "MappedFile.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#include <unistd.h>
+#endif // __EMSCRIPTEN__
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <string_view>
+
+namespace {
+
+constexpr std::string_view FirstLine = "LearnWebGPU heap manifest 1";
+
+} // anonymous namespace
+
+bool HeapManifest::write(const std::filesystem::path& path, const std::vector<Entry>& entries) {
+	return writeFileAtomically(path, [&](std::ostream& file) {
+		file << FirstLine << '\n';
+		for (const Entry& entry : entries) {
+			file << entry.decodedSize << ' ' << entry.encodedSize << ' ' << entry.relativePath.generic_string() << '\n';
+		}
+		return true;
+	});
+}
+
+bool HeapManifest::read(const std::filesystem::path& path, std::vector<Entry>& entries) {
+	MappedFile file;
+	if (!file.open(path)) return false;
+	std::string_view text(reinterpret_cast<const char*>(file.data()), file.size());
+
+	bool first = true;
+	while (!text.empty()) {
+		size_t end = std::min(text.find('\n'), text.size());
+		std::string_view line = text.substr(0, end);
+		text.remove_prefix(std::min(end + 1, text.size()));
+		if (first) {
+			if (line != FirstLine) return false;
+			first = false;
+			continue;
+		}
+		if (line.empty()) continue;
+
+		Entry entry;
+		const char* cursor = line.data();
+		const char* lineEnd = line.data() + line.size();
+		auto decoded = std::from_chars(cursor, lineEnd, entry.decodedSize);
+		if (decoded.ec != std::errc() || decoded.ptr == lineEnd || *decoded.ptr != ' ') return false;
+		auto encoded = std::from_chars(decoded.ptr + 1, lineEnd, entry.encodedSize);
+		if (encoded.ec != std::errc() || encoded.ptr == lineEnd || *encoded.ptr != ' ') return false;
+		entry.relativePath = std::string_view(encoded.ptr + 1, lineEnd);
+		entries.push_back(std::move(entry));
+	}
+	return !first;
+}
+
+uint64_t HeapManifest::peakSize(const std::vector<Entry>& entries) {
+	uint64_t size = 0;
+	for (const Entry& entry : entries) {
+		size += entry.decodedSize + entry.encodedSize;
+	}
+	return size;
+}
+
+uint64_t HeapManifest::reserve(const std::filesystem::path& path) {
+#ifdef __EMSCRIPTEN__
+	std::vector<Entry> entries;
+	if (!read(path, entries)) return 0;
+
+	// What is allocated ends at the program break, the heap above it being free
+	uint64_t used = reinterpret_cast<uintptr_t>(sbrk(0));
+	uint64_t heapSize = emscripten_get_heap_size();
+	uint64_t target = std::min<uint64_t>(used + peakSize(entries), emscripten_get_heap_max());
+	if (target <= heapSize) return 0;
+	// Whole pages of WebAssembly memory
+	target = (target + 65535) / 65536 * 65536;
+	if (!emscripten_resize_heap(static_cast<size_t>(target))) {
+		std::cerr << "Could not grow the heap to " << (target >> 20) << " MiB ahead of the loads, growing it as they go" << std::endl;
+		return 0;
+	}
+	return target - heapSize;
+#else
+	(void)path;
+	return 0;
+#endif // __EMSCRIPTEN__
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+/**
+ * The memory the resources take once loaded, recorded at build time next to the
+ * asset bundle, for the web build to grow its heap once, up front, rather than in
+ * steps as large assets load: each step of ALLOW_MEMORY_GROWTH may copy the whole
+ * heap, and detaches the JavaScript views of it in the middle of the loads.
+ *
+ * Each line of the file holds the decoded size, the encoded size and the path of
+ * a resource, relative to the resource directory, after a first line naming the
+ * format. The decoded size of an image is that of its RGBA8 pixels and their mip
+ * chain, that of a mesh the size of its binary mesh cache when packed with it,
+ * and otherwise an estimate. Being plain text, the page may read it as well.
+ */
+class HeapManifest {
+public:
+	struct Entry {
+		uint64_t decodedSize = 0;
+		uint64_t encodedSize = 0;
+		std::filesystem::path relativePath;
+	};
+
+	static bool write(const std::filesystem::path& path, const std::vector<Entry>& entries);
+	static bool read(const std::filesystem::path& path, std::vector<Entry>& entries);
+
+	// Heap the loads of `entries` may peak at, all of them being in memory at once, their
+	// encoded files (e.g. the fetched bundle) and their decoded data
+	static uint64_t peakSize(const std::vector<Entry>& entries);
+
+	// Grow the heap in a single step to hold the loads the manifest at `path` describes on top
+	// of what is allocated so far. Only the web build grows its heap, elsewhere nothing is done.
+	// Returns the bytes the heap grew by.
+	static uint64_t reserve(const std::filesystem::path& path);
+};
@@ -0,0 +1,144 @@
+#include "HitchDetector.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+
+namespace {
+
+// Not to fill the disk with the dumps of a machine too slow for the budget
+constexpr uint32_t MaxDumpCount = 16;
+
+// Chrome trace process of the CPU markers, and of the frame, counter and GPU tracks
+constexpr int CpuProcess = 1;
+constexpr int FrameProcess = 2;
+constexpr int FrameTrack = 1;
+constexpr int GpuTrack = 2;
+
+void writeJsonString(std::ostream& out, const char* str) {
+	out << '"';
+	for (const char* c = str; *c; ++c) {
+		if (*c == '"' || *c == '\\') out << '\\';
+		if (static_cast<unsigned char>(*c) >= 0x20) out << *c;
+	}
+	out << '"';
+}
+
+double milliseconds(int64_t nanoseconds) {
+	return nanoseconds * 1e-6;
+}
+
+} // anonymous namespace
+
+HitchDetector::HitchDetector(uint32_t historyLength, double budgetMs, std::string pathPrefix)
+	: mFrames(std::max(historyLength, 2u))
+	, mBudgetMs(budgetMs)
+	, mPathPrefix(std::move(pathPrefix))
+{}
+
+HitchDetector::Frame& HitchDetector::next() {
+	return mFrames[mFrameCount % mFrames.size()];
+}
+
+void HitchDetector::commit(const std::vector<GpuProfiler::PassTiming>& passTimings) {
+	Frame& committed = next();
+	committed.index = mFrameCount;
+	committed.gpuPassMs.resize(passTimings.size());
+	for (size_t i = 0; i < passTimings.size(); ++i) {
+		committed.gpuPassMs[i] = passTimings[i].lastMs;
+	}
+	while (mPassNames.size() < passTimings.size()) {
+		mPassNames.push_back(passTimings[mPassNames.size()].name);
+	}
+	uint64_t index = mFrameCount++;
+
+	// Half of the history before the hitch, half after
+	uint64_t halfLength = mFrames.size() / 2;
+	bool hitch = !committed.idle && milliseconds(committed.duration) > mBudgetMs;
+	if (hitch && mPendingHitch == UINT64_MAX && index >= mDumpedEnd && mDumpCount < MaxDumpCount) {
+		std::cerr << "Frame " << index << " took " << milliseconds(committed.duration) << " ms, over the budget of " << mBudgetMs << " ms" << std::endl;
+		mPendingHitch = index;
+	}
+	if (mPendingHitch == UINT64_MAX || index < mPendingHitch + halfLength) return;
+
+	uint64_t oldest = mFrameCount > mFrames.size() ? mFrameCount - mFrames.size() : 0;
+	uint64_t first = std::max(mPendingHitch > halfLength ? mPendingHitch - halfLength : 0, oldest);
+	if (dump(mPendingHitch, first, mFrameCount)) ++mDumpCount;
+	// The next dump does not overlap this one
+	mDumpedEnd = mFrameCount + halfLength;
+	mPendingHitch = UINT64_MAX;
+}
+
+bool HitchDetector::dump(uint64_t hitch, uint64_t first, uint64_t end) const {
+	TRACE_SCOPE("Dump hitch");
+	std::string path = mPathPrefix + std::to_string(hitch) + ".json";
+	std::ofstream file(path);
+	if (!file) {
+		std::cerr << "Could not write hitch trace to " << path << std::endl;
+		return false;
+	}
+
+	int64_t origin = frame(first).start;
+	const Frame& last = frame(end - 1);
+	auto timestamp = [origin](int64_t time) { return (time - origin) / 1000.0; };
+
+	// Timestamps and durations are in microseconds
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	file << "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << CpuProcess << ",\"args\":{\"name\":\"CPU\"}}";
+	file << ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << FrameProcess << ",\"args\":{\"name\":\"Frames\"}}";
+	file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << FrameProcess << ",\"tid\":" << FrameTrack << ",\"args\":{\"name\":\"Frames\"}}";
+	file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << FrameProcess << ",\"tid\":" << GpuTrack << ",\"args\":{\"name\":\"GPU passes (as read back)\"}}";
+
+	for (uint64_t i = first; i < end; ++i) {
+		const Frame& f = frame(i);
+		file << ",\n{\"name\":\"Frame " << f.index << (f.index == hitch ? " (hitch)" : "") << "\",\"ph\":\"X\",\"pid\":" << FrameProcess << ",\"tid\":" << FrameTrack
+			<< ",\"ts\":" << timestamp(f.start) << ",\"dur\":" << f.duration / 1000.0
+			<< ",\"args\":{\"cpuMs\":" << milliseconds(f.cpuDuration) << ",\"idle\":" << (f.idle ? "true" : "false") << "}}";
+
+		// Bytes on a chart of their own, their scale dwarfing the other counts
+		file << ",\n{\"name\":\"Counters\",\"ph\":\"C\",\"pid\":" << FrameProcess << ",\"ts\":" << timestamp(f.start) << ",\"args\":{";
+		const char* separator = "";
+		for (size_t c = 0; c < f.counts.values.size(); ++c) {
+			if (static_cast<FrameCounter>(c) == FrameCounter::BytesWritten) continue;
+			file << separator << "\"" << frameCounterName(static_cast<FrameCounter>(c)) << "\":" << f.counts.values[c];
+			separator = ",";
+		}
+		file << "}}";
+		file << ",\n{\"name\":\"Upload bytes\",\"ph\":\"C\",\"pid\":" << FrameProcess << ",\"ts\":" << timestamp(f.start)
+			<< ",\"args\":{\"bytes\":" << f.counts[FrameCounter::BytesWritten] << "}}";
+
+		double gpuStart = timestamp(f.start);
+		for (size_t p = 0; p < f.gpuPassMs.size(); ++p) {
+			if (f.gpuPassMs[p] <= 0.0) continue;
+			file << ",\n{\"name\":";
+			writeJsonString(file, mPassNames[p].c_str());
+			file << ",\"ph\":\"X\",\"pid\":" << FrameProcess << ",\"tid\":" << GpuTrack << ",\"ts\":" << gpuStart << ",\"dur\":" << f.gpuPassMs[p] * 1000.0 << "}";
+			gpuStart += f.gpuPassMs[p] * 1000.0;
+		}
+	}
+
+	// Empty unless Trace is recording
+	std::set<uint32_t> namedThreads;
+	Trace::forEachEvent(origin, last.start + last.duration, [&](uint32_t threadId, const char* threadName, const char* name, int64_t start, int64_t duration) {
+		if (threadName && namedThreads.insert(threadId).second) {
+			file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << CpuProcess << ",\"tid\":" << threadId << ",\"args\":{\"name\":";
+			writeJsonString(file, threadName);
+			file << "}}";
+		}
+		file << ",\n{\"name\":";
+		writeJsonString(file, name);
+		file << ",\"ph\":\"X\",\"pid\":" << CpuProcess << ",\"tid\":" << threadId
+			<< ",\"ts\":" << timestamp(start) << ",\"dur\":" << duration / 1000.0 << "}";
+	});
+	file << "\n]}\n";
+	if (!file) {
+		std::cerr << "Could not write hitch trace to " << path << std::endl;
+		return false;
+	}
+	std::cout << "Wrote the " << end - first << " frames around frame " << hitch << " to " << path << std::endl;
+	return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "FrameCounters.h"
+#include "GpuProfiler.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * History of the last frames, for the occasional long frame that cannot be
+ * reproduced at will: once a frame exceeds the budget, the frames around it are
+ * dumped as a Chrome trace (chrome://tracing, or https://ui.perfetto.dev) when
+ * history holds as many frames after it as before.
+ *
+ * Each frame keeps its duration, the part of it spent recording commands, its
+ * FrameCounters (upload bytes included), and the GPU pass timings known by then, which
+ * GpuProfiler reads back a few frames late. The dump shows frames and counters on
+ * tracks of their own under the CPU trace markers recorded meanwhile (see Trace, to
+ * keep recording its latest chunks for this), GPU passes being laid end to end
+ * from the start of their frame since only their durations are known.
+ *
+ * Records are reused, so that recording a frame does not allocate. Dumps are
+ * written from the main thread, a frame ending up longer for it, at most once
+ * per history length and 16 times per run.
+ */
+class HitchDetector {
+public:
+	/**
+	 * What is kept of a frame
+	 */
+	struct Frame {
+		uint64_t index = 0;
+		// On the clock of Trace::now(), in nanoseconds
+		int64_t start = 0;
+		int64_t duration = 0;
+		// Recording the commands, the wait for the surface texture excluded
+		int64_t cpuDuration = 0;
+		// Frames waiting for events on purpose are never hitches
+		bool idle = false;
+		FrameCounts counts;
+		// Last duration of each pass of GpuProfiler::timings(), in milliseconds
+		std::vector<double> gpuPassMs;
+	};
+
+	// Keep `historyLength` frames, writing the dumps to `<pathPrefix><frame index>.json`
+	HitchDetector(uint32_t historyLength, double budgetMs, std::string pathPrefix);
+
+	// The record of the next frame, to fill before commit()
+	Frame& next();
+	// Add the frame filled in next(), with the GPU timings known so far, dumping the history
+	// when a hitch is surrounded by enough frames
+	void commit(const std::vector<GpuProfiler::PassTiming>& passTimings);
+
+	double budgetMs() const { return mBudgetMs; }
+	uint32_t dumpCount() const { return mDumpCount; }
+
+private:
+	const Frame& frame(uint64_t index) const { return mFrames[index % mFrames.size()]; }
+	// Write frames [first, end) of the history, returning false if the file cannot be written
+	bool dump(uint64_t hitch, uint64_t first, uint64_t end) const;
+
+private:
+	std::vector<Frame> mFrames;
+	// Frames committed so far, the next one going to mFrames[mFrameCount % size]
+	uint64_t mFrameCount = 0;
+	double mBudgetMs;
+	std::string mPathPrefix;
+	// Of the entries of the GPU pass timings, which only grow
+	std::vector<std::string> mPassNames;
+	// History index of the hitch to dump once enough frames followed, UINT64_MAX if none
+	uint64_t mPendingHitch = UINT64_MAX;
+	// Frames up to this one were dumped already
+	uint64_t mDumpedEnd = 0;
+	uint32_t mDumpCount = 0;
+};
@@ -0,0 +1,405 @@
+#include "Hud.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace wgpu;
+
+namespace {
+
+const char* hudShaderSource = R"(
+struct HudUniforms {
+	targetSize: vec2f,
+	// Pixels per texel of the font
+	scale: f32,
+}
+
+struct Glyph {
+	position: vec2f,
+	size: vec2f,
+	cell: u32,
+	color: u32,
+}
+
+@group(0) @binding(0) var<uniform> uHud: HudUniforms;
+@group(0) @binding(1) var<storage, read> glyphs: array<Glyph>;
+@group(0) @binding(2) var fontAtlas: texture_2d<f32>;
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+	// Texel of the glyph's cell
+	@location(0) texel: vec2f,
+	@location(1) @interpolate(flat) cell: u32,
+	@location(2) color: vec4f,
+}
+
+// Two triangles per glyph, the quad of which is read from the glyph buffer
+@vertex
+fn vs_main(@builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) instanceIndex: u32) -> VertexOutput {
+	var corners = array<vec2f, 6>(
+		vec2f(0.0, 0.0), vec2f(1.0, 0.0), vec2f(0.0, 1.0),
+		vec2f(0.0, 1.0), vec2f(1.0, 0.0), vec2f(1.0, 1.0),
+	);
+	let glyph = glyphs[instanceIndex];
+	let corner = corners[vertexIndex];
+	let pixel = glyph.position + corner * glyph.size;
+	var out: VertexOutput;
+	out.position = vec4f(pixel / uHud.targetSize * vec2f(2.0, -2.0) + vec2f(-1.0, 1.0), 0.0, 1.0);
+	out.texel = corner * glyph.size / uHud.scale;
+	out.cell = glyph.cell;
+	out.color = unpack4x8unorm(glyph.color);
+	return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+	let cellOrigin = 8u * vec2u(in.cell % 16u, in.cell / 16u);
+	let texel = cellOrigin + min(vec2u(in.texel), vec2u(7u));
+	if (textureLoad(fontAtlas, texel, 0).r < 0.5) {
+		discard;
+	}
+	return in.color;
+}
+)";
+
+// Rows of the glyphs of ASCII 32 to 95, top to bottom, the highest of the 5 bits being the leftmost column
+constexpr uint8_t font5x7[][7] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+	{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 }, // !
+	{ 0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+	{ 0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a }, // #
+	{ 0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04 }, // $
+	{ 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // %
+	{ 0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d }, // &
+	{ 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+	{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // (
+	{ 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // )
+	{ 0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00 }, // *
+	{ 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 }, // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x04, 0x04, 0x08 }, // ,
+	{ 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 }, // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c }, // .
+	{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // /
+	{ 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e }, // 0
+	{ 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e }, // 1
+	{ 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f }, // 2
+	{ 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e }, // 3
+	{ 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 }, // 4
+	{ 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e }, // 5
+	{ 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e }, // 6
+	{ 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // 7
+	{ 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e }, // 8
+	{ 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c }, // 9
+	{ 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 }, // :
+	{ 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08 }, // ;
+	{ 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 }, // <
+	{ 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 }, // =
+	{ 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 }, // >
+	{ 0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 }, // ?
+	{ 0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e }, // @
+	{ 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // A
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e }, // B
+	{ 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e }, // C
+	{ 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c }, // D
+	{ 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f }, // E
+	{ 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 }, // F
+	{ 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f }, // G
+	{ 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // H
+	{ 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e }, // I
+	{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c }, // J
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
+	{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f }, // L
+	{ 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 }, // M
+	{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // N
+	{ 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // O
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 }, // P
+	{ 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d }, // Q
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 }, // R
+	{ 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e }, // S
+	{ 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // U
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 }, // V
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a }, // W
+	{ 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 }, // X
+	{ 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04 }, // Y
+	{ 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f }, // Z
+	{ 0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e }, // [
+	{ 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 }, // backslash
+	{ 0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e }, // ]
+	{ 0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00 }, // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f }, // _
+};
+
+constexpr uint32_t firstCharacter = 32;
+constexpr uint32_t glyphCount = sizeof(font5x7) / sizeof(font5x7[0]);
+// Cells are 8x8 texels, the glyph in the top left corner, 16 of them per row of the atlas
+constexpr uint32_t cellSize = 8;
+constexpr uint32_t atlasColumnCount = 16;
+// Cell covered with texels, for the panel behind the text
+constexpr uint32_t solidCell = glyphCount;
+constexpr uint32_t atlasWidth = atlasColumnCount * cellSize;
+constexpr uint32_t atlasHeight = (solidCell / atlasColumnCount + 1) * cellSize;
+
+// Texels covered by a character, and from one line to the next, a column and a row of
+// which separate characters
+constexpr float characterWidth = 6.0f;
+constexpr float characterHeight = 8.0f;
+constexpr float lineHeight = 9.0f;
+// Around the text, in texels
+constexpr float panelMargin = 3.0f;
+
+constexpr uint32_t textColor = 0xffffffff;
+constexpr uint32_t panelColor = 0xa0000000;
+
+uint32_t characterCell(char c) {
+	if (c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+	uint32_t code = static_cast<unsigned char>(c);
+	if (code < firstCharacter || code >= firstCharacter + glyphCount) code = '?';
+	return code - firstCharacter;
+}
+
+} // anonymous namespace
+
+Hud::Hud(Device device, PipelineCache& pipelineCache, TextureFormat targetFormat, uint32_t maxGlyphCount)
+	: mQueue(device.getQueue())
+	, mMaxGlyphCount(std::max(maxGlyphCount, 1u))
+{
+	initAtlas(device);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "HUD glyphs";
+	bufferDesc.size = mMaxGlyphCount * sizeof(GlyphInstance);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+	bufferDesc.mappedAtCreation = false;
+	mGlyphBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "Hud");
+
+	bufferDesc.label = "HUD uniforms";
+	bufferDesc.size = sizeof(HudUniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "Hud");
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Vertex;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(HudUniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Vertex;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[1].buffer.minBindingSize = sizeof(GlyphInstance);
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[2].texture.sampleType = TextureSampleType::Float;
+	bindingLayoutEntries[2].texture.viewDimension = TextureViewDimension::_2D;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	BindGroupLayout bindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	std::vector<BindGroupEntry> bindings(3);
+	bindings[0].binding = 0;
+	bindings[0].buffer = mUniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(HudUniforms);
+	bindings[1].binding = 1;
+	bindings[1].buffer = mGlyphBuffer;
+	bindings[1].offset = 0;
+	bindings[1].size = mMaxGlyphCount * sizeof(GlyphInstance);
+	bindings[2].binding = 2;
+	bindings[2].textureView = mAtlasView;
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mBindGroup = device.createBindGroup(bindGroupDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+
+	ShaderModule shaderModule = pipelineCache.shaderModule(hudShaderSource);
+
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	// Quads are generated from the vertex and instance indices
+	pipelineDesc.vertex.bufferCount = 0;
+	pipelineDesc.vertex.buffers = nullptr;
+	pipelineDesc.vertex.module = shaderModule;
+	pipelineDesc.vertex.entryPoint = "vs_main";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::None;
+
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = "fs_main";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+
+	// The panel is translucent, the text over it opaque
+	BlendState blendState{};
+	blendState.color.srcFactor = BlendFactor::SrcAlpha;
+	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+	blendState.color.operation = BlendOperation::Add;
+	blendState.alpha.srcFactor = BlendFactor::Zero;
+	blendState.alpha.dstFactor = BlendFactor::One;
+	blendState.alpha.operation = BlendOperation::Add;
+
+	ColorTargetState colorTarget{};
+	colorTarget.format = targetFormat;
+	colorTarget.blend = &blendState;
+	colorTarget.writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	// Drawn over the frame, whatever its depth
+	pipelineDesc.depthStencil = nullptr;
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	mPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+Hud::~Hud() {
+	mBindGroup.release();
+	destroyTracked(mUniformBuffer);
+	mUniformBuffer.release();
+	destroyTracked(mGlyphBuffer);
+	mGlyphBuffer.release();
+	mAtlasView.release();
+	destroyTracked(mAtlas);
+	mAtlas.release();
+	mQueue.release();
+}
+
+void Hud::initAtlas(Device device) {
+	std::vector<uint8_t> texels(atlasWidth * atlasHeight, 0);
+	for (uint32_t cell = 0; cell < glyphCount; ++cell) {
+		uint32_t x0 = (cell % atlasColumnCount) * cellSize;
+		uint32_t y0 = (cell / atlasColumnCount) * cellSize;
+		for (uint32_t y = 0; y < 7; ++y) {
+			for (uint32_t x = 0; x < 5; ++x) {
+				bool covered = (font5x7[cell][y] >> (4 - x)) & 1;
+				texels[(y0 + y) * atlasWidth + x0 + x] = covered ? 255 : 0;
+			}
+		}
+	}
+	uint32_t x0 = (solidCell % atlasColumnCount) * cellSize;
+	uint32_t y0 = (solidCell / atlasColumnCount) * cellSize;
+	for (uint32_t y = 0; y < cellSize; ++y) {
+		std::fill_n(texels.begin() + (y0 + y) * atlasWidth + x0, cellSize, uint8_t(255));
+	}
+
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "HUD font";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = TextureFormat::R8Unorm;
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { atlasWidth, atlasHeight, 1 };
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mAtlas = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "Hud");
+
+	ImageCopyTexture destination;
+	destination.texture = mAtlas;
+	destination.mipLevel = 0;
+	destination.origin = { 0, 0, 0 };
+	destination.aspect = TextureAspect::All;
+	TextureDataLayout source;
+	source.offset = 0;
+	source.bytesPerRow = atlasWidth;
+	source.rowsPerImage = atlasHeight;
+	mQueue.writeTexture(destination, texels.data(), texels.size(), source, textureDesc.size);
+
+	TextureViewDescriptor viewDesc{};
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = TextureViewDimension::_2D;
+	viewDesc.format = TextureFormat::R8Unorm;
+	mAtlasView = mAtlas.createView(viewDesc);
+}
+
+void Hud::setText(const std::vector<std::string>& lines) {
+	mGlyphs.clear();
+	mGlyphsChanged = true;
+	size_t columnCount = 0;
+	for (const std::string& line : lines) {
+		columnCount = std::max(columnCount, line.size());
+	}
+	if (columnCount == 0) return;
+
+	float scale = static_cast<float>(mScale);
+	float margin = panelMargin * scale;
+	mGlyphs.push_back({
+		{ 0.0f, 0.0f },
+		{ (columnCount * characterWidth - 1.0f) * scale + 2.0f * margin, (lines.size() * lineHeight - 2.0f) * scale + 2.0f * margin },
+		solidCell,
+		panelColor,
+	});
+	for (size_t row = 0; row < lines.size(); ++row) {
+		for (size_t column = 0; column < lines[row].size(); ++column) {
+			char c = lines[row][column];
+			// Glyphs are drawn in a single draw call, so there is nothing to gain from drawing spaces
+			if (c == ' ') continue;
+			if (mGlyphs.size() == mMaxGlyphCount) return;
+			mGlyphs.push_back({
+				{ margin + column * characterWidth * scale, margin + row * lineHeight * scale },
+				{ characterWidth * scale, characterHeight * scale },
+				characterCell(c),
+				textColor,
+			});
+		}
+	}
+}
+
+void Hud::setScale(uint32_t scale) {
+	mScale = std::max(scale, 1u);
+}
+
+void Hud::draw(CommandEncoder encoder, TextureView targetView, uint32_t width, uint32_t height, const RenderPassTimestampWrites* timestampWrites) {
+	if (!ready()) return;
+
+	HudUniforms uniforms = { { static_cast<float>(width), static_cast<float>(height) }, static_cast<float>(mScale), 0.0f };
+	if (memcmp(&uniforms, &mUniforms, sizeof(HudUniforms)) != 0) {
+		mUniforms = uniforms;
+		mQueue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(HudUniforms));
+	}
+	if (mGlyphsChanged) {
+		mQueue.writeBuffer(mGlyphBuffer, 0, mGlyphs.data(), mGlyphs.size() * sizeof(GlyphInstance));
+		mGlyphsChanged = false;
+	}
+
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = targetView;
+	colorAttachment.resolveTarget = nullptr;
+	// Over what the previous passes drew
+	colorAttachment.loadOp = LoadOp::Load;
+	colorAttachment.storeOp = StoreOp::Store;
+#ifndef WEBGPU_BACKEND_WGPU
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "HUD";
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &colorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = timestampWrites;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	renderPass.setPipeline(mPipeline->pipeline);
+	renderPass.setBindGroup(0, mBindGroup, 0, nullptr);
+	renderPass.draw(6, static_cast<uint32_t>(mGlyphs.size()), 0, 0);
+	renderPass.end();
+	renderPass.release();
+}
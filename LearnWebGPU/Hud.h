@@ -0,0 +1,91 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Text overlay drawn over a frame, e.g. to show performance counters without
+ * attaching a profiler.
+ *
+ * Text is drawn with a built-in 5x7 pixel font, whose glyphs are packed in a tiny
+ * R8Unorm atlas, scaled by an integer factor so that it stays sharp. Every glyph,
+ * and the panel behind the text, is an instance of a single draw call that reads
+ * its quad from a storage buffer, so the overlay costs one pass, one draw and a
+ * small upload when the text changes, however long the text is.
+ *
+ * The font covers printable ASCII up to '_', lowercase letters being drawn as
+ * capitals and other characters as '?'.
+ */
+class Hud {
+public:
+	// Overlay drawn to color attachments of `targetFormat`, holding at most `maxGlyphCount` characters
+	Hud(wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureFormat targetFormat, uint32_t maxGlyphCount = 4096);
+	~Hud();
+
+	Hud(const Hud&) = delete;
+	Hud& operator=(const Hud&) = delete;
+
+	// Replace the text shown in the top left corner, one string per line
+	void setText(const std::vector<std::string>& lines);
+
+	// Size in pixels of a texel of the font
+	void setScale(uint32_t scale);
+
+	// Whether draw() draws anything, which it does not while the pipeline is being built
+	bool ready() const { return mPipeline->ready() && !mGlyphs.empty(); }
+
+	// Draw the text over the current content of `targetView` in a pass of its own, or
+	// do nothing if not ready
+	void draw(wgpu::CommandEncoder encoder, wgpu::TextureView targetView, uint32_t width, uint32_t height, const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr);
+
+private:
+	/**
+	 * A quad covering a cell of the atlas, same as Glyph in the shader
+	 */
+	struct GlyphInstance {
+		// Top left corner and size, in pixels
+		float position[2];
+		float size[2];
+		// Cell of the atlas, row by row
+		uint32_t cell;
+		// RGBA8, red in the lowest byte
+		uint32_t color;
+	};
+	static_assert(sizeof(GlyphInstance) == 24);
+
+	/**
+	 * Same as HudUniforms in the shader
+	 */
+	struct HudUniforms {
+		float targetSize[2];
+		float scale;
+		float _pad;
+	};
+	static_assert(sizeof(HudUniforms) % 16 == 0);
+
+	void initAtlas(wgpu::Device device);
+
+private:
+	wgpu::Queue mQueue;
+	uint32_t mMaxGlyphCount;
+	uint32_t mScale = 2;
+
+	wgpu::Texture mAtlas = nullptr;
+	wgpu::TextureView mAtlasView = nullptr;
+	wgpu::Buffer mGlyphBuffer = nullptr;
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::BindGroup mBindGroup = nullptr;
+	// Owned by the pipeline cache
+	PipelineCache::AsyncRenderPipeline mPipeline;
+
+	// Quads of the current text, uploaded by the next draw when they changed
+	std::vector<GlyphInstance> mGlyphs;
+	bool mGlyphsChanged = false;
+	// Last uploaded uniforms
+	HudUniforms mUniforms = {};
+};
@@ -0,0 +1,205 @@
+#include "ImageDecoder.h"
+#include "DecodeHeap.h"
+
+#include "stb_image.h"
+
+#ifdef LEARNWEBGPU_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+#ifdef LEARNWEBGPU_SPNG
+#include <spng.h>
+#endif
+#ifdef LEARNWEBGPU_WEBP
+#include <webp/decode.h>
+#endif
+#ifdef LEARNWEBGPU_AVIF
+#include <avif/avif.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace {
+
+// Largest width and height accepted, beyond any texture size limit
+constexpr uint32_t MaxSize = 1 << 16;
+
+bool startsWith(std::span<const std::byte> data, size_t offset, const char* magic, size_t size) {
+	return data.size() >= offset + size && std::memcmp(data.data() + offset, magic, size) == 0;
+}
+
+// Pixels of the backends other than stb_image, released with DecodeHeap::release like those of
+// stb_image (see implementations.cpp)
+[[maybe_unused]] unsigned char* allocatePixels(uint32_t width, uint32_t height) {
+	if (width == 0 || height == 0 || width > MaxSize || height > MaxSize) return nullptr;
+	return static_cast<unsigned char*>(DecodeHeap::allocate(size_t(width) * height * 4));
+}
+
+unsigned char* decodeStb(std::span<const std::byte> data, uint32_t /* maxSize */, uint32_t& width, uint32_t& height) {
+	if (data.size() > size_t(std::numeric_limits<int>::max())) return nullptr;
+	int w = 0, h = 0, channels = 0;
+	unsigned char* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(data.data()), static_cast<int>(data.size()), &w, &h, &channels, 4 /* force 4 channels */);
+	width = static_cast<uint32_t>(w);
+	height = static_cast<uint32_t>(h);
+	return pixels;
+}
+
+#ifdef LEARNWEBGPU_TURBOJPEG
+unsigned char* decodeTurboJpeg(std::span<const std::byte> data, uint32_t maxSize, uint32_t& width, uint32_t& height) {
+	tjhandle handle = tj3Init(TJINIT_DECOMPRESS);
+	if (!handle) return nullptr;
+	unsigned char* pixels = nullptr;
+	const auto* jpeg = reinterpret_cast<const unsigned char*>(data.data());
+	if (tj3DecompressHeader(handle, jpeg, data.size()) == 0) {
+		int fullWidth = tj3Get(handle, TJPARAM_JPEGWIDTH);
+		int fullHeight = tj3Get(handle, TJPARAM_JPEGHEIGHT);
+		// The smallest of the halving factors whose result is still at least `maxSize`, so that the
+		// mip chain of the texture is filtered from more texels rather than less
+		tjscalingfactor scaling = { 1, 1 };
+		if (maxSize > 0) {
+			for (int denominator = 2; denominator <= 8; denominator *= 2) {
+				tjscalingfactor halved = { 1, denominator };
+				if (static_cast<uint32_t>(TJSCALED(std::max(fullWidth, fullHeight), halved)) < maxSize) break;
+				scaling = halved;
+			}
+		}
+		tj3SetScalingFactor(handle, scaling);
+		width = static_cast<uint32_t>(TJSCALED(fullWidth, scaling));
+		height = static_cast<uint32_t>(TJSCALED(fullHeight, scaling));
+		pixels = allocatePixels(width, height);
+		if (pixels && tj3Decompress8(handle, jpeg, data.size(), pixels, 0, TJPF_RGBA) != 0) {
+			DecodeHeap::release(pixels);
+			pixels = nullptr;
+		}
+	}
+	tj3Destroy(handle);
+	return pixels;
+}
+#endif // LEARNWEBGPU_TURBOJPEG
+
+#ifdef LEARNWEBGPU_SPNG
+unsigned char* decodeSpng(std::span<const std::byte> data, uint32_t /* maxSize */, uint32_t& width, uint32_t& height) {
+	spng_ctx* context = spng_ctx_new(0);
+	if (!context) return nullptr;
+	unsigned char* pixels = nullptr;
+	spng_ihdr header;
+	size_t size = 0;
+	if (spng_set_image_limits(context, MaxSize, MaxSize) == 0
+		&& spng_set_png_buffer(context, data.data(), data.size()) == 0
+		&& spng_get_ihdr(context, &header) == 0
+		&& spng_decoded_image_size(context, SPNG_FMT_RGBA8, &size) == 0) {
+		width = header.width;
+		height = header.height;
+		pixels = allocatePixels(width, height);
+		// Colors keyed as transparent by a tRNS chunk get a null alpha, like stb_image gives them
+		if (pixels && spng_decode_image(context, pixels, size, SPNG_FMT_RGBA8, SPNG_DECODE_TRNS) != 0) {
+			DecodeHeap::release(pixels);
+			pixels = nullptr;
+		}
+	}
+	spng_ctx_free(context);
+	return pixels;
+}
+#endif // LEARNWEBGPU_SPNG
+
+#ifdef LEARNWEBGPU_WEBP
+unsigned char* decodeWebP(std::span<const std::byte> data, uint32_t /* maxSize */, uint32_t& width, uint32_t& height) {
+	const auto* webp = reinterpret_cast<const uint8_t*>(data.data());
+	int w = 0, h = 0;
+	if (!WebPGetInfo(webp, data.size(), &w, &h)) return nullptr;
+	width = static_cast<uint32_t>(w);
+	height = static_cast<uint32_t>(h);
+	unsigned char* pixels = allocatePixels(width, height);
+	if (pixels && !WebPDecodeRGBAInto(webp, data.size(), pixels, size_t(width) * height * 4, static_cast<int>(width * 4))) {
+		DecodeHeap::release(pixels);
+		pixels = nullptr;
+	}
+	return pixels;
+}
+#endif // LEARNWEBGPU_WEBP
+
+#ifdef LEARNWEBGPU_AVIF
+unsigned char* decodeAvif(std::span<const std::byte> data, uint32_t /* maxSize */, uint32_t& width, uint32_t& height) {
+	avifDecoder* decoder = avifDecoderCreate();
+	if (!decoder) return nullptr;
+	unsigned char* pixels = nullptr;
+	if (avifDecoderSetIOMemory(decoder, reinterpret_cast<const uint8_t*>(data.data()), data.size()) == AVIF_RESULT_OK
+		&& avifDecoderParse(decoder) == AVIF_RESULT_OK
+		&& avifDecoderNextImage(decoder) == AVIF_RESULT_OK) {
+		width = decoder->image->width;
+		height = decoder->image->height;
+		pixels = allocatePixels(width, height);
+		avifRGBImage rgb;
+		avifRGBImageSetDefaults(&rgb, decoder->image);
+		rgb.format = AVIF_RGB_FORMAT_RGBA;
+		rgb.depth = 8;
+		rgb.pixels = pixels;
+		rgb.rowBytes = width * 4;
+		if (pixels && avifImageYUVToRGB(decoder->image, &rgb) != AVIF_RESULT_OK) {
+			DecodeHeap::release(pixels);
+			pixels = nullptr;
+		}
+	}
+	avifDecoderDestroy(decoder);
+	return pixels;
+}
+#endif // LEARNWEBGPU_AVIF
+
+const ImageDecoder::Backend Backends[] = {
+#ifdef LEARNWEBGPU_TURBOJPEG
+	{ "libjpeg-turbo", [](ImageDecoder::Format format) { return format == ImageDecoder::Format::Jpeg; }, decodeTurboJpeg, DecodeHeap::release },
+#endif
+#ifdef LEARNWEBGPU_SPNG
+	{ "spng", [](ImageDecoder::Format format) { return format == ImageDecoder::Format::Png; }, decodeSpng, DecodeHeap::release },
+#endif
+#ifdef LEARNWEBGPU_WEBP
+	{ "libwebp", [](ImageDecoder::Format format) { return format == ImageDecoder::Format::WebP; }, decodeWebP, DecodeHeap::release },
+#endif
+#ifdef LEARNWEBGPU_AVIF
+	{ "libavif", [](ImageDecoder::Format format) { return format == ImageDecoder::Format::Avif; }, decodeAvif, DecodeHeap::release },
+#endif
+	{ "stb_image", [](ImageDecoder::Format format) { return format == ImageDecoder::Format::Jpeg || format == ImageDecoder::Format::Png || format == ImageDecoder::Format::Other; }, decodeStb, stbi_image_free },
+};
+
+} // anonymous namespace
+
+ImageDecoder::Format ImageDecoder::detect(std::span<const std::byte> data, const std::filesystem::path& path) {
+	if (startsWith(data, 0, "\xFF\xD8\xFF", 3)) return Format::Jpeg;
+	if (startsWith(data, 0, "\x89PNG\r\n\x1A\n", 8)) return Format::Png;
+	if (startsWith(data, 0, "RIFF", 4) && startsWith(data, 8, "WEBP", 4)) return Format::WebP;
+	// An ISO base media file whose major brand is that of still or animated AVIF
+	if (startsWith(data, 4, "ftyp", 4) && (startsWith(data, 8, "avif", 4) || startsWith(data, 8, "avis", 4))) return Format::Avif;
+	if (data.size() >= 12) return Format::Other;
+
+	std::string extension = path.extension().string();
+	for (char& c : extension) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	if (extension == ".jpg" || extension == ".jpeg") return Format::Jpeg;
+	if (extension == ".png") return Format::Png;
+	if (extension == ".webp") return Format::WebP;
+	if (extension == ".avif") return Format::Avif;
+	return Format::Other;
+}
+
+ImageDecoder::Pixels ImageDecoder::decode(std::span<const std::byte> data, const std::filesystem::path& path, uint32_t& width, uint32_t& height, uint32_t maxSize) {
+	Format format = detect(data, path);
+	for (const Backend& backend : Backends) {
+		if (!backend.supports(format)) continue;
+		if (unsigned char* pixels = backend.decode(data, maxSize, width, height)) return { pixels, backend.release };
+	}
+	return { nullptr, nullptr };
+}
+
+std::span<const ImageDecoder::Backend> ImageDecoder::backends() {
+	return Backends;
+}
+
+const char* ImageDecoder::backendName(Format format) {
+	for (const Backend& backend : Backends) {
+		if (backend.supports(format)) return backend.name;
+	}
+	return "none";
+}
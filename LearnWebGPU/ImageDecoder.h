@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+/**
+ * Decoding of the regular (not block-compressed) image formats to 8-bit RGBA,
+ * through the fastest backend built in for each format: libjpeg-turbo for JPEG
+ * (SIMD Huffman decoding and IDCT), spng for PNG (as fast as the zlib it links,
+ * e.g. zlib-ng), libwebp and libavif, each when found at configure time (see
+ * CMakeLists.txt). stb_image decodes everything else, and the files a backend
+ * rejects, so that images load the same, only faster, with more backends.
+ *
+ * The format is told by the magic bytes of the data, the extension of its path
+ * only deciding for data too short to tell.
+ *
+ * Images larger than the texture they are for may be decoded smaller, halving
+ * their size down to the largest one that fits, which libjpeg-turbo does in the
+ * DCT domain (1/2, 1/4 or 1/8), skipping most of the work. Other backends decode
+ * at full size, and the caller downsizes (see ResourceManager::loadImage).
+ */
+class ImageDecoder {
+public:
+	enum class Format {
+		Jpeg,
+		Png,
+		WebP,
+		Avif,
+		// Whatever stb_image may recognize (BMP, TGA, GIF, PSD...)
+		Other,
+	};
+
+	/**
+	 * A decoder of some formats
+	 */
+	struct Backend {
+		const char* name;
+		bool (*supports)(Format format);
+		// 4 bytes per pixel row by row, null if the data could not be decoded. Images wider or
+		// higher than a non-zero `maxSize` may be decoded at a halved size.
+		unsigned char* (*decode)(std::span<const std::byte> data, uint32_t maxSize, uint32_t& width, uint32_t& height);
+		// Release pixels returned by decode
+		void (*release)(void* pixels);
+	};
+
+	using Pixels = std::unique_ptr<unsigned char, void(*)(void*)>;
+
+	static Format detect(std::span<const std::byte> data, const std::filesystem::path& path = {});
+
+	// Decode `data` to 4 channels, returning null pixels if no backend could. With a non-zero
+	// `maxSize`, the image may come out halved one or more times, never below `maxSize`.
+	static Pixels decode(std::span<const std::byte> data, const std::filesystem::path& path, uint32_t& width, uint32_t& height, uint32_t maxSize = 0);
+
+	// Backends in the order they are tried, stb_image last
+	static std::span<const Backend> backends();
+
+	// Name of the first backend tried for `format`
+	static const char* backendName(Format format);
+};
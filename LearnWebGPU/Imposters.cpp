@@ -0,0 +1,659 @@
+#include "Imposters.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+const char* bakeShaderSource = R"(
+struct BakeUniforms {
+	viewProjection: mat4x4f,
+	right: vec4f,
+	up: vec4f,
+	forward: vec4f,
+	textureLayer: u32,
+	srgbTexture: u32,
+}
+
+@group(0) @binding(0) var<uniform> u: BakeUniforms;
+@group(0) @binding(1) var materialTexture: texture_2d_array<f32>;
+@group(0) @binding(2) var materialSampler: sampler;
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+	@location(0) normal: vec3f,
+	@location(1) uv: vec2f,
+}
+
+@vertex
+fn vs_bake(@location(0) position: vec3f, @location(1) normal: vec3f, @location(2) uv: vec2f) -> VertexOutput {
+	var out: VertexOutput;
+	out.position = u.viewProjection * vec4f(position, 1.0);
+	out.normal = normal;
+	out.uv = uv;
+	return out;
+}
+
+struct BakeOutput {
+	@location(0) albedo: vec4f,
+	@location(1) normalDepth: vec4f,
+}
+
+@fragment
+fn fs_bake(in: VertexOutput) -> BakeOutput {
+	var albedo = textureSample(materialTexture, materialSampler, in.uv, u.textureLayer).rgb;
+	if (u.srgbTexture == 0u) {
+		albedo = pow(albedo, vec3f(2.2));
+	}
+	let normal = normalize(in.normal);
+	var out: BakeOutput;
+	out.albedo = vec4f(albedo, 1.0);
+	out.normalDepth = vec4f(dot(normal, u.right.xyz), dot(normal, u.up.xyz), dot(normal, u.forward.xyz), in.position.z);
+	return out;
+}
+)";
+
+const char* drawShaderSource = R"(
+struct DrawUniforms {
+	viewProjection: mat4x4f,
+}
+
+struct ImposterInstance {
+	// Fade in w
+	center: vec4f,
+	right: vec4f,
+	up: vec4f,
+	forward: vec4f,
+	tile: vec2u,
+	objectId: u32,
+}
+
+const viewCount = 12u;
+
+@group(0) @binding(0) var<uniform> u: DrawUniforms;
+@group(0) @binding(1) var<storage, read> instances: array<ImposterInstance>;
+@group(0) @binding(2) var albedoAtlas: texture_2d<f32>;
+@group(0) @binding(3) var normalDepthAtlas: texture_2d<f32>;
+@group(0) @binding(4) var atlasSampler: sampler;
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+	// In [-1, 1] over the quad
+	@location(0) corner: vec2f,
+	@location(1) @interpolate(flat) instance: u32,
+}
+
+// A quad in front of the bounding sphere, which it covers seen from the camera
+@vertex
+fn vs_main(@builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) instanceIndex: u32) -> VertexOutput {
+	var corners = array<vec2f, 6>(vec2f(-1.0, -1.0), vec2f(1.0, -1.0), vec2f(1.0, 1.0), vec2f(-1.0, -1.0), vec2f(1.0, 1.0), vec2f(-1.0, 1.0));
+	let corner = corners[vertexIndex];
+	let instance = instances[instanceIndex];
+	let position = instance.center.xyz + instance.forward.xyz + corner.x * instance.right.xyz + corner.y * instance.up.xyz;
+	var out: VertexOutput;
+	out.position = u.viewProjection * vec4f(position, 1.0);
+	out.corner = corner;
+	out.instance = instanceIndex;
+	return out;
+}
+
+struct Surface {
+	color: vec4f,
+	depth: f32,
+	objectId: u32,
+}
+
+fn surface(in: VertexOutput) -> Surface {
+	let instance = instances[in.instance];
+	// Rows of the tiles go downwards, like the up axis of the views upwards
+	let tileUv = in.corner * vec2f(0.5, -0.5) + 0.5;
+	let uv = (vec2f(instance.tile) + tileUv) / f32(viewCount);
+	let albedo = textureSampleLevel(albedoAtlas, atlasSampler, uv, 0.0);
+	// Interleaved gradient noise, so that partly faded imposters dissolve evenly
+	let dither = fract(52.9829189 * fract(dot(in.position.xy, vec2f(0.06711056, 0.00583715))));
+	if (albedo.a < 0.5 || dither >= instance.center.w) {
+		discard;
+	}
+
+	// Nearest texel, as depths do not interpolate across the silhouettes
+	let atlasSize = textureDimensions(normalDepthAtlas);
+	let texel = min(vec2u(uv * vec2f(atlasSize)), atlasSize - 1u);
+	let normalDepth = textureLoad(normalDepthAtlas, texel, 0);
+	let normal = normalize(
+		normalDepth.x * normalize(instance.right.xyz) +
+		normalDepth.y * normalize(instance.up.xyz) +
+		normalDepth.z * normalize(instance.forward.xyz)
+	);
+	// Depth goes from the front of the sphere to its back
+	let position = instance.center.xyz + instance.forward.xyz * (1.0 - 2.0 * normalDepth.w)
+		+ in.corner.x * instance.right.xyz + in.corner.y * instance.up.xyz;
+	let clip = u.viewProjection * vec4f(position, 1.0);
+
+	// The two directional lights of shader.wgsl, without shadows
+	let lightColor1 = vec3f(1.0, 0.9, 0.6);
+	let lightColor2 = vec3f(0.6, 0.9, 1.0);
+	let lightDirection1 = vec3f(0.5, -0.9, 0.1);
+	let lightDirection2 = vec3f(0.2, 0.4, 0.3);
+	let shading = max(0.0, dot(lightDirection1, normal)) * lightColor1 + max(0.0, dot(lightDirection2, normal)) * lightColor2;
+
+	var out: Surface;
+	out.color = vec4f(albedo.rgb * shading, 1.0);
+	out.depth = clip.z / clip.w;
+	out.objectId = instance.objectId;
+	return out;
+}
+
+struct FragmentOutput {
+	@location(0) color: vec4f,
+	@builtin(frag_depth) depth: f32,
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> FragmentOutput {
+	let s = surface(in);
+	var out: FragmentOutput;
+	out.color = s.color;
+	out.depth = s.depth;
+	return out;
+}
+
+struct FragmentOutputWithId {
+	@location(0) color: vec4f,
+	@location(1) objectId: u32,
+	@builtin(frag_depth) depth: f32,
+}
+
+@fragment
+fn fs_main_ids(in: VertexOutput) -> FragmentOutputWithId {
+	let s = surface(in);
+	var out: FragmentOutputWithId;
+	out.color = s.color;
+	out.objectId = s.objectId;
+	out.depth = s.depth;
+	return out;
+}
+)";
+
+glm::vec2 encodeOctahedral(glm::vec3 direction) {
+	direction /= std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+	glm::vec2 uv = glm::vec2(direction);
+	if (direction.z < 0.0f) {
+		uv = (1.0f - glm::abs(glm::vec2(uv.y, uv.x))) * glm::vec2(uv.x >= 0.0f ? 1.0f : -1.0f, uv.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return uv;
+}
+
+glm::vec3 decodeOctahedral(const glm::vec2& uv) {
+	glm::vec3 direction(uv, 1.0f - std::abs(uv.x) - std::abs(uv.y));
+	if (direction.z < 0.0f) {
+		glm::vec2 folded = (1.0f - glm::abs(glm::vec2(uv.y, uv.x))) * glm::vec2(uv.x >= 0.0f ? 1.0f : -1.0f, uv.y >= 0.0f ? 1.0f : -1.0f);
+		direction.x = folded.x;
+		direction.y = folded.y;
+	}
+	return glm::normalize(direction);
+}
+
+// Up axis of the view cameras, but for views along it
+glm::vec3 upReference(const glm::vec3& forward) {
+	return std::abs(forward.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+}
+
+} // anonymous namespace
+
+Imposters::ViewFrame Imposters::viewFrame(uint32_t x, uint32_t y) {
+	glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / float(ViewCount) * 2.0f - 1.0f;
+	ViewFrame frame;
+	frame.forward = decodeOctahedral(uv);
+	// As glm::lookAt from the camera towards the center
+	frame.right = glm::normalize(glm::cross(-frame.forward, upReference(frame.forward)));
+	frame.up = glm::cross(frame.right, -frame.forward);
+	return frame;
+}
+
+glm::uvec2 Imposters::nearestView(const glm::vec3& direction) {
+	glm::vec2 uv = encodeOctahedral(direction) * 0.5f + 0.5f;
+	return glm::min(glm::uvec2(glm::max(uv * float(ViewCount), 0.0f)), glm::uvec2(ViewCount - 1));
+}
+
+Imposters::Imposters(
+	Device device, PipelineCache& pipelineCache,
+	TextureFormat colorFormat, TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+)
+	: mDevice(device)
+{
+	SupportedLimits supportedLimits;
+	device.getLimits(&supportedLimits);
+	uint32_t alignment = std::max<uint32_t>(supportedLimits.limits.minUniformBufferOffsetAlignment, 16);
+	mBakeUniformStride = (sizeof(BakeUniforms) + alignment - 1) / alignment * alignment;
+
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Imposter albedo";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = AlbedoFormat;
+	textureDesc.size = { ViewCount * TileSize, ViewCount * TileSize, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::RenderAttachment;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mAlbedoTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "Imposters");
+	textureDesc.label = "Imposter normals and depths";
+	textureDesc.format = NormalDepthFormat;
+	mNormalDepthTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "Imposters");
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Imposter uniforms";
+	bufferDesc.size = sizeof(DrawUniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "Imposters");
+	if (!valid() || !mUniformBuffer) return;
+	mAlbedoView = mAlbedoTexture.createView();
+	mNormalDepthView = mNormalDepthTexture.createView();
+
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::ClampToEdge;
+	samplerDesc.addressModeV = AddressMode::ClampToEdge;
+	samplerDesc.addressModeW = AddressMode::ClampToEdge;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 1.0f;
+	samplerDesc.compare = CompareFunction::Undefined;
+	samplerDesc.maxAnisotropy = 1;
+	mSampler = device.createSampler(samplerDesc);
+
+	// Bake: a view's uniforms at a dynamic offset, then the material
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Vertex | ShaderStage::Fragment;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.hasDynamicOffset = true;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(BakeUniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::Float;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2DArray;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[2].sampler.type = SamplerBindingType::Filtering;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBakeLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	// Draw: uniforms, instances, then the atlas
+	bindingLayoutEntries.assign(5, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Vertex | ShaderStage::Fragment;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(DrawUniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Vertex | ShaderStage::Fragment;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	for (uint32_t i = 2; i < 4; ++i) {
+		bindingLayoutEntries[i].binding = i;
+		bindingLayoutEntries[i].visibility = ShaderStage::Fragment;
+		bindingLayoutEntries[i].texture.sampleType = TextureSampleType::Float;
+		bindingLayoutEntries[i].texture.viewDimension = TextureViewDimension::_2D;
+	}
+	bindingLayoutEntries[4].binding = 4;
+	bindingLayoutEntries[4].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[4].sampler.type = SamplerBindingType::Filtering;
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mDrawLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBakeLayout;
+
+	// Positions, normals and uvs of ResourceManager::VertexAttributes as they are
+	std::array<VertexAttribute, 3> attributes{};
+	attributes[0].shaderLocation = 0;
+	attributes[0].format = VertexFormat::Float32x3;
+	attributes[0].offset = offsetof(ResourceManager::VertexAttributes, position);
+	attributes[1].shaderLocation = 1;
+	attributes[1].format = VertexFormat::Float32x3;
+	attributes[1].offset = offsetof(ResourceManager::VertexAttributes, normal);
+	attributes[2].shaderLocation = 2;
+	attributes[2].format = VertexFormat::Float32x2;
+	attributes[2].offset = offsetof(ResourceManager::VertexAttributes, uv);
+	VertexBufferLayout vertexBufferLayout{};
+	vertexBufferLayout.arrayStride = sizeof(ResourceManager::VertexAttributes);
+	vertexBufferLayout.stepMode = VertexStepMode::Vertex;
+	vertexBufferLayout.attributeCount = (uint32_t)attributes.size();
+	vertexBufferLayout.attributes = attributes.data();
+
+	ShaderModule bakeModule = pipelineCache.shaderModule(bakeShaderSource);
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.label = "Imposter bake";
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.vertex.bufferCount = 1;
+	pipelineDesc.vertex.buffers = &vertexBufferLayout;
+	pipelineDesc.vertex.module = bakeModule;
+	pipelineDesc.vertex.entryPoint = "vs_bake";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	// Meshes with open or inverted faces still cover their silhouette
+	pipelineDesc.primitive.cullMode = CullMode::None;
+
+	FragmentState fragmentState{};
+	fragmentState.module = bakeModule;
+	fragmentState.entryPoint = "fs_bake";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	std::array<ColorTargetState, 2> colorTargets{};
+	colorTargets[0].format = AlbedoFormat;
+	colorTargets[0].blend = nullptr;
+	colorTargets[0].writeMask = ColorWriteMask::All;
+	colorTargets[1].format = NormalDepthFormat;
+	colorTargets[1].blend = nullptr;
+	colorTargets[1].writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = 2;
+	fragmentState.targets = colorTargets.data();
+	pipelineDesc.fragment = &fragmentState;
+
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.depthCompare = CompareFunction::Less;
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.format = TextureFormat::Depth24Plus;
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencilState;
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+	mBakePipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mDrawLayout;
+	ShaderModule drawModule = pipelineCache.shaderModule(drawShaderSource);
+	pipelineDesc.label = "Imposters";
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.vertex.bufferCount = 0;
+	pipelineDesc.vertex.buffers = nullptr;
+	pipelineDesc.vertex.module = drawModule;
+	pipelineDesc.vertex.entryPoint = "vs_main";
+	fragmentState.module = drawModule;
+	fragmentState.entryPoint = idFormat == TextureFormat::Undefined ? "fs_main" : "fs_main_ids";
+	colorTargets[0].format = colorFormat;
+	colorTargets[1].format = idFormat;
+	fragmentState.targetCount = idFormat == TextureFormat::Undefined ? 1 : 2;
+	depthStencilState.depthCompare = depthConvention.nearer(true);
+	depthStencilState.format = depthConvention.format();
+	pipelineDesc.multisample.count = sampleCount;
+	mDrawPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+Imposters::~Imposters() {
+	if (mDrawBindGroup) mDrawBindGroup.release();
+	if (mSampler) mSampler.release();
+	if (mAlbedoView) mAlbedoView.release();
+	if (mNormalDepthView) mNormalDepthView.release();
+	for (Texture* texture : { &mAlbedoTexture, &mNormalDepthTexture }) {
+		if (!*texture) continue;
+		destroyTracked(*texture);
+		texture->release();
+	}
+	for (Buffer* buffer : { &mInstanceBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+bool Imposters::bake(Queue queue, const ResourceManager::Geometry& geometry, TextureView texture, uint32_t textureLayer, bool srgbTexture) {
+	if (!valid() || !ready() || geometry.vertices.empty() || geometry.lods.empty()) return false;
+
+	// Bounding sphere of the bounding box, like ResourceCache::Geometry's
+	glm::vec3 boundsMin = glm::vec3(geometry.vertices[0].position);
+	glm::vec3 boundsMax = boundsMin;
+	for (const ResourceManager::VertexAttributes& vertex : geometry.vertices) {
+		boundsMin = glm::min(boundsMin, glm::vec3(vertex.position));
+		boundsMax = glm::max(boundsMax, glm::vec3(vertex.position));
+	}
+	glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+	float radius = std::max(0.5f * glm::length(boundsMax - boundsMin), 1e-6f);
+	mBoundingSphere = glm::vec4(center, radius);
+
+	// Transient buffers, destroyed once the views are submitted
+	const ResourceManager::GeometryLod& lod = geometry.lods[0];
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Imposter bake vertices";
+	bufferDesc.size = geometry.vertices.size_bytes();
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+	bufferDesc.mappedAtCreation = false;
+	Buffer vertexBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, "Imposters");
+	bufferDesc.label = "Imposter bake indices";
+	bufferDesc.size = uint64_t(lod.indexCount) * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Index;
+	Buffer indexBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, "Imposters");
+	bufferDesc.label = "Imposter bake uniforms";
+	bufferDesc.size = uint64_t(ViewCount) * ViewCount * mBakeUniformStride;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	Buffer uniformBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, "Imposters");
+	TextureDescriptor depthDesc{};
+	depthDesc.label = "Imposter bake depth";
+	depthDesc.dimension = TextureDimension::_2D;
+	depthDesc.format = TextureFormat::Depth24Plus;
+	depthDesc.size = { ViewCount * TileSize, ViewCount * TileSize, 1 };
+	depthDesc.mipLevelCount = 1;
+	depthDesc.sampleCount = 1;
+	depthDesc.usage = TextureUsage::RenderAttachment;
+	depthDesc.viewFormatCount = 0;
+	depthDesc.viewFormats = nullptr;
+	Texture depthTexture = createTrackedTexture(mDevice, depthDesc, GpuMemoryCategory::RenderTargets, "Imposters");
+
+	auto releaseTransients = [&]() {
+		for (Buffer* buffer : { &vertexBuffer, &indexBuffer, &uniformBuffer }) {
+			if (!*buffer) continue;
+			destroyTracked(*buffer);
+			buffer->release();
+		}
+		if (depthTexture) {
+			destroyTracked(depthTexture);
+			depthTexture.release();
+		}
+	};
+	if (!vertexBuffer || !indexBuffer || !uniformBuffer || !depthTexture) {
+		std::cerr << "Could not allocate the imposter bake" << std::endl;
+		releaseTransients();
+		return false;
+	}
+	queue.writeBuffer(vertexBuffer, 0, geometry.vertices.data(), geometry.vertices.size_bytes());
+	queue.writeBuffer(indexBuffer, 0, geometry.indices.data() + lod.indexOffset, uint64_t(lod.indexCount) * sizeof(uint32_t));
+
+	// Orthographic views of the sphere from all directions
+	std::vector<std::byte> uniforms(uniformBuffer.getSize());
+	glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+	for (uint32_t y = 0; y < ViewCount; ++y) {
+		for (uint32_t x = 0; x < ViewCount; ++x) {
+			ViewFrame frame = viewFrame(x, y);
+			BakeUniforms view{};
+			view.viewProjection = projection * glm::lookAt(center + frame.forward * radius, center, upReference(frame.forward));
+			view.right = glm::vec4(frame.right, 0.0f);
+			view.up = glm::vec4(frame.up, 0.0f);
+			view.forward = glm::vec4(frame.forward, 0.0f);
+			view.textureLayer = textureLayer;
+			view.srgbTexture = srgbTexture ? 1 : 0;
+			std::memcpy(uniforms.data() + size_t(y * ViewCount + x) * mBakeUniformStride, &view, sizeof(BakeUniforms));
+		}
+	}
+	queue.writeBuffer(uniformBuffer, 0, uniforms.data(), uniforms.size());
+
+	std::vector<BindGroupEntry> bindings(3);
+	bindings[0].binding = 0;
+	bindings[0].buffer = uniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(BakeUniforms);
+	bindings[1].binding = 1;
+	bindings[1].textureView = texture;
+	bindings[2].binding = 2;
+	bindings[2].sampler = mSampler;
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mBakeLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	BindGroup bindGroup = mDevice.createBindGroup(bindGroupDesc);
+	TextureView depthView = depthTexture.createView();
+
+	// Coverage 0 and the back of the sphere where the mesh is not
+	std::array<RenderPassColorAttachment, 2> colorAttachments{};
+	colorAttachments[0].view = mAlbedoView;
+	colorAttachments[0].clearValue = Color{ 0.0, 0.0, 0.0, 0.0 };
+	colorAttachments[1].view = mNormalDepthView;
+	colorAttachments[1].clearValue = Color{ 0.0, 0.0, 1.0, 1.0 };
+	for (RenderPassColorAttachment& attachment : colorAttachments) {
+		attachment.resolveTarget = nullptr;
+		attachment.loadOp = LoadOp::Clear;
+		attachment.storeOp = StoreOp::Store;
+#ifndef WEBGPU_BACKEND_WGPU
+		attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+	}
+	RenderPassDepthStencilAttachment depthAttachment{};
+	depthAttachment.view = depthView;
+	depthAttachment.depthClearValue = 1.0f;
+	depthAttachment.depthLoadOp = LoadOp::Clear;
+	depthAttachment.depthStoreOp = StoreOp::Discard;
+	depthAttachment.depthReadOnly = false;
+	depthAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	depthAttachment.stencilLoadOp = LoadOp::Clear;
+	depthAttachment.stencilStoreOp = StoreOp::Store;
+#else
+	depthAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif
+	depthAttachment.stencilReadOnly = true;
+
+	CommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "Imposter bake";
+	CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Imposter bake";
+	renderPassDesc.colorAttachmentCount = (uint32_t)colorAttachments.size();
+	renderPassDesc.colorAttachments = colorAttachments.data();
+	renderPassDesc.depthStencilAttachment = &depthAttachment;
+	renderPassDesc.timestampWrites = nullptr;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	renderPass.setPipeline(mBakePipeline->pipeline);
+	renderPass.setVertexBuffer(0, vertexBuffer, 0, vertexBuffer.getSize());
+	renderPass.setIndexBuffer(indexBuffer, IndexFormat::Uint32, 0, indexBuffer.getSize());
+	for (uint32_t y = 0; y < ViewCount; ++y) {
+		for (uint32_t x = 0; x < ViewCount; ++x) {
+			uint32_t offset = (y * ViewCount + x) * mBakeUniformStride;
+			renderPass.setBindGroup(0, bindGroup, 1, &offset);
+			renderPass.setViewport(float(x * TileSize), float(y * TileSize), float(TileSize), float(TileSize), 0.0f, 1.0f);
+			renderPass.drawIndexed(lod.indexCount, 1, 0, 0, 0);
+		}
+	}
+	renderPass.end();
+	renderPass.release();
+	CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+	encoder.release();
+	queue.submit(commands);
+	commands.release();
+
+	bindGroup.release();
+	depthView.release();
+	releaseTransients();
+	mBaked = true;
+	return true;
+}
+
+void Imposters::update(Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, std::span<const Instance> instances) {
+	mInstanceCount = 0;
+	if (!valid() || !mBaked) return;
+	glm::vec3 camera = glm::vec3(glm::inverse(viewMatrix)[3]);
+	glm::vec3 sphereCenter = glm::vec3(mBoundingSphere);
+
+	// Each instance faces the camera of its nearest view, seen in its own model space
+	mInstanceData.clear();
+	for (const Instance& instance : instances) {
+		if (instance.fade <= 0.0f) continue;
+		glm::mat3 linear = glm::mat3(instance.modelMatrix);
+		glm::vec3 center = glm::vec3(instance.modelMatrix * glm::vec4(sphereCenter, 1.0f));
+		float scale = std::max({ glm::length(linear[0]), glm::length(linear[1]), glm::length(linear[2]) });
+		float radius = mBoundingSphere.w * scale;
+		glm::vec3 direction = glm::inverse(linear) * (camera - center);
+		if (glm::dot(direction, direction) <= 0.0f) continue;
+		glm::uvec2 tile = nearestView(glm::normalize(direction));
+		ViewFrame frame = viewFrame(tile.x, tile.y);
+
+		InstanceData data{};
+		data.center = glm::vec4(center, std::min(instance.fade, 1.0f));
+		data.right = glm::vec4(glm::normalize(linear * frame.right) * radius, 0.0f);
+		data.up = glm::vec4(glm::normalize(linear * frame.up) * radius, 0.0f);
+		data.forward = glm::vec4(glm::normalize(linear * frame.forward) * radius, 0.0f);
+		data.tile = tile;
+		data.objectId = instance.objectId;
+		mInstanceData.push_back(data);
+	}
+	mInstanceCount = static_cast<uint32_t>(mInstanceData.size());
+	if (mInstanceCount == 0) return;
+
+	// Grown as needed, the bind group following
+	if (mInstanceCount > mInstanceCapacity) {
+		if (mInstanceBuffer) {
+			destroyTracked(mInstanceBuffer);
+			mInstanceBuffer.release();
+		}
+		if (mDrawBindGroup) mDrawBindGroup.release();
+		mDrawBindGroup = nullptr;
+		mInstanceCapacity = std::max(2 * mInstanceCount, 64u);
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = "Imposter instances";
+		bufferDesc.size = uint64_t(mInstanceCapacity) * sizeof(InstanceData);
+		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+		bufferDesc.mappedAtCreation = false;
+		mInstanceBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Imposters");
+		if (!mInstanceBuffer) {
+			mInstanceCapacity = 0;
+			mInstanceCount = 0;
+			return;
+		}
+
+		std::vector<BindGroupEntry> bindings(5);
+		bindings[0].binding = 0;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(DrawUniforms);
+		bindings[1].binding = 1;
+		bindings[1].buffer = mInstanceBuffer;
+		bindings[1].offset = 0;
+		bindings[1].size = mInstanceBuffer.getSize();
+		bindings[2].binding = 2;
+		bindings[2].textureView = mAlbedoView;
+		bindings[3].binding = 3;
+		bindings[3].textureView = mNormalDepthView;
+		bindings[4].binding = 4;
+		bindings[4].sampler = mSampler;
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mDrawLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mDrawBindGroup = mDevice.createBindGroup(bindGroupDesc);
+	}
+	queue.writeBuffer(mInstanceBuffer, 0, mInstanceData.data(), mInstanceData.size() * sizeof(InstanceData));
+	DrawUniforms uniforms;
+	uniforms.viewProjection = projectionMatrix * viewMatrix;
+	queue.writeBuffer(mUniformBuffer, 0, &uniforms, sizeof(DrawUniforms));
+}
+
+void Imposters::draw(RenderPassEncoder renderPass) {
+	if (!valid() || !ready() || mInstanceCount == 0 || !mDrawBindGroup) return;
+	renderPass.setPipeline(mDrawPipeline->pipeline);
+	renderPass.setBindGroup(0, mDrawBindGroup, 0, nullptr);
+	renderPass.draw(6, mInstanceCount, 0, 0);
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "DepthConvention.h"
+#include "ResourceManager.h"
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Far instances of a mesh drawn as a single quad each, from views of the mesh
+ * baked once it is loaded.
+ *
+ * The mesh is rendered with orthographic cameras looking at its bounding sphere
+ * from ViewCount x ViewCount directions, the centers of the cells of a grid over
+ * the octahedral map of the sphere of directions, each view going to its tile of
+ * the atlas: the albedo of the material with the coverage in alpha, and the
+ * normal in the frame of the view camera with the depth within the sphere.
+ *
+ * Each instance is a quad facing the camera of the view whose direction is the
+ * nearest to that of the actual camera, in the space of the instance. Fragments
+ * out of the mesh are discarded, the others are lit from their baked normal and
+ * write the depth of the baked surface, so that imposters and meshes intersect
+ * like the meshes would. Imposters fade in over a range of distances by screen
+ * door transparency, the mesh being drawn behind them until they are opaque.
+ */
+class Imposters {
+public:
+	static constexpr uint32_t ViewCount = 12;
+	static constexpr uint32_t TileSize = 64;
+	static constexpr wgpu::TextureFormat AlbedoFormat = wgpu::TextureFormat::RGBA8UnormSrgb;
+	static constexpr wgpu::TextureFormat NormalDepthFormat = wgpu::TextureFormat::RGBA16Float;
+
+	/**
+	 * An instance to draw as an imposter
+	 */
+	struct Instance {
+		// Model to world
+		glm::mat4 modelMatrix;
+		// From 0 (invisible) to 1 (opaque)
+		float fade;
+		// Written to the ID attachment, if any
+		uint32_t objectId;
+	};
+
+	// Drawn within render passes of a `colorFormat` attachment, an `idFormat` one (Undefined if
+	// none) and a depth buffer of `depthConvention`, of `sampleCount` samples
+	Imposters(
+		wgpu::Device device, PipelineCache& pipelineCache,
+		wgpu::TextureFormat colorFormat, wgpu::TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+	);
+	~Imposters();
+
+	Imposters(const Imposters&) = delete;
+	Imposters& operator=(const Imposters&) = delete;
+
+	// Whether the atlas could be created
+	bool valid() const { return mAlbedoTexture != nullptr && mNormalDepthTexture != nullptr; }
+	// Whether the pipelines are built, before which bake() and draw() record nothing
+	bool ready() const { return mBakePipeline->ready() && mDrawPipeline->ready(); }
+	bool baked() const { return mBaked; }
+
+	// Render the views of `geometry`, with its full level of detail, sampling layer `textureLayer`
+	// of `texture` (a 2D array view, decoding sRGB if `srgbTexture`), and submit them
+	bool bake(
+		wgpu::Queue queue, const ResourceManager::Geometry& geometry,
+		wgpu::TextureView texture, uint32_t textureLayer, bool srgbTexture
+	);
+
+	// Bounding sphere of the mesh baked, in its model space
+	const glm::vec4& boundingSphere() const { return mBoundingSphere; }
+
+	// Instances drawn by draw(), each one facing the camera of `viewMatrix`
+	void update(wgpu::Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, std::span<const Instance> instances);
+	void draw(wgpu::RenderPassEncoder renderPass);
+
+	uint32_t instanceCount() const { return mInstanceCount; }
+
+private:
+	/**
+	 * The frame of the camera of a view, in the model space of the mesh
+	 */
+	struct ViewFrame {
+		glm::vec3 right;
+		glm::vec3 up;
+		// Towards the camera
+		glm::vec3 forward;
+	};
+
+	/**
+	 * The BakeUniforms structure of the bake shader, one per view at dynamic offsets
+	 */
+	struct BakeUniforms {
+		glm::mat4 viewProjection;
+		glm::vec4 right;
+		glm::vec4 up;
+		glm::vec4 forward;
+		uint32_t textureLayer;
+		uint32_t srgbTexture;
+		uint32_t _pad[2];
+	};
+	static_assert(sizeof(BakeUniforms) == 128);
+
+	/**
+	 * The DrawUniforms structure of the draw shader
+	 */
+	struct DrawUniforms {
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+	};
+
+	/**
+	 * The ImposterInstance structure of the draw shader: axes of the quad in world space, scaled
+	 * by the radius of the sphere, and the tile of the view
+	 */
+	struct InstanceData {
+		// Fade in w
+		glm::vec4 center;
+		glm::vec4 right;
+		glm::vec4 up;
+		glm::vec4 forward;
+		glm::uvec2 tile;
+		uint32_t objectId;
+		uint32_t _pad;
+	};
+	static_assert(sizeof(InstanceData) == 80);
+
+	// Frame of the view of tile (x, y)
+	static ViewFrame viewFrame(uint32_t x, uint32_t y);
+	// Tile of the view nearest to `direction`, in model space
+	static glm::uvec2 nearestView(const glm::vec3& direction);
+
+private:
+	wgpu::Device mDevice;
+	bool mBaked = false;
+	glm::vec4 mBoundingSphere = { 0.0f, 0.0f, 0.0f, 1.0f };
+	uint32_t mBakeUniformStride = 256;
+
+	wgpu::Texture mAlbedoTexture = nullptr;
+	wgpu::TextureView mAlbedoView = nullptr;
+	wgpu::Texture mNormalDepthTexture = nullptr;
+	wgpu::TextureView mNormalDepthView = nullptr;
+	wgpu::Sampler mSampler = nullptr;
+
+	std::vector<InstanceData> mInstanceData;
+	uint32_t mInstanceCount = 0;
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::Buffer mInstanceBuffer = nullptr;
+	uint32_t mInstanceCapacity = 0;
+
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBakeLayout = nullptr;
+	wgpu::BindGroupLayout mDrawLayout = nullptr;
+	PipelineCache::AsyncRenderPipeline mBakePipeline;
+	PipelineCache::AsyncRenderPipeline mDrawPipeline;
+	wgpu::BindGroup mDrawBindGroup = nullptr;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "LockFree.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Events of the window forwarded to the thread that renders when it is not the one
+ * receiving them, i.e. in the OffscreenCanvas build where the application runs
+ * in a Web Worker while the browser keeps calling the html5 callbacks on the main
+ * thread, and in the native render thread mode where the main thread pumps the
+ * GLFW events.
+ */
+struct InputEvent {
+	enum class Type : uint8_t { MouseMove, MouseButton, Scroll, Resize, Key };
+
+	Type type = Type::MouseMove;
+	// MouseButton and Key: the button or key, and GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT
+	int button = 0;
+	int action = 0;
+	// Cursor position, scroll offsets or window size depending on the type
+	double x = 0.0;
+	double y = 0.0;
+};
+
+/**
+ * A bounded ring of events with a single producer and a single consumer, neither of
+ * which ever waits for the other: the browser thread must not block on a worker
+ * busy rendering, and the worker drains the queue once per frame. A consumer with
+ * nothing to do may still sleep until the next event or wake() call.
+ *
+ * When the queue is full, new events are dropped. The capacity holds several frames
+ * of mouse moves, so this only happens if the worker is stalled anyway.
+ */
+class InputQueue {
+public:
+	static constexpr size_t Capacity = 256;
+
+	// Producer side, false if the event was dropped
+	bool push(const InputEvent& event) {
+		if (!mEvents.push(event)) return false;
+		wake();
+		return true;
+	}
+
+	// Producer side, end the wait of the consumer even if there is no event
+	void wake() {
+		mWakeCount.fetch_add(1, std::memory_order_release);
+		mWakeCount.notify_one();
+	}
+
+	// Consumer side, return once there is an event to pop or after a call to wake()
+	void waitForEvents() {
+		// Any push after this load changes the count, so that the wait does not miss it
+		uint32_t wakeCount = mWakeCount.load(std::memory_order_acquire);
+		if (!mEvents.empty()) return;
+		mWakeCount.wait(wakeCount, std::memory_order_acquire);
+	}
+
+	// Consumer side, false if there is no event left
+	bool pop(InputEvent& event) {
+		return mEvents.pop(event);
+	}
+
+private:
+	SpscQueue<InputEvent, Capacity> mEvents;
+	std::atomic<uint32_t> mWakeCount = 0;
+};
@@ -0,0 +1,194 @@
+#include "InputRecording.h"
+#include "MappedFile.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+constexpr uint32_t Magic = 0x5249574c; // "LWIR"
+constexpr uint32_t Version = 1;
+// Record type of the end of a frame, after those of InputEvent::Type
+constexpr uint8_t FrameRecord = 0xff;
+
+struct Header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	float cameraAngles[2];
+	float cameraZoom;
+	uint32_t animate;
+};
+static_assert(sizeof(Header) == 32);
+
+template <typename T>
+void put(std::ofstream& file, T value) {
+	file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/**
+ * Reads of a mapped recording, which fail once past its end
+ */
+class Reader {
+public:
+	Reader(const std::byte* data, size_t size) : mCursor(data), mEnd(data + size) {}
+
+	template <typename T>
+	bool get(T& value) {
+		if (static_cast<size_t>(mEnd - mCursor) < sizeof(T)) return false;
+		std::memcpy(&value, mCursor, sizeof(T));
+		mCursor += sizeof(T);
+		return true;
+	}
+
+	bool atEnd() const { return mCursor == mEnd; }
+
+private:
+	const std::byte* mCursor;
+	const std::byte* mEnd;
+};
+
+} // anonymous namespace
+
+InputRecorder::InputRecorder(std::filesystem::path path)
+	: mPath(std::move(path))
+{}
+
+bool InputRecorder::start(const InputRecordingStart& state, double time) {
+	mFile.open(mPath, std::ios::binary | std::ios::trunc);
+	if (!mFile) {
+		std::cerr << "Could not open input recording " << mPath << std::endl;
+		return false;
+	}
+	Header header{};
+	header.magic = Magic;
+	header.version = Version;
+	header.width = state.width;
+	header.height = state.height;
+	header.cameraAngles[0] = state.cameraAngles.x;
+	header.cameraAngles[1] = state.cameraAngles.y;
+	header.cameraZoom = state.cameraZoom;
+	header.animate = state.animate ? 1 : 0;
+	put(mFile, header);
+	mStarted = true;
+	mStartTime = time;
+	return true;
+}
+
+void InputRecorder::record(const InputEvent& event) {
+	if (!mStarted) return;
+	put(mFile, static_cast<uint8_t>(event.type));
+	switch (event.type) {
+	case InputEvent::Type::MouseButton:
+		put(mFile, static_cast<uint8_t>(event.button));
+		put(mFile, static_cast<uint8_t>(event.action));
+		[[fallthrough]];
+	case InputEvent::Type::MouseMove:
+	case InputEvent::Type::Scroll:
+		put(mFile, static_cast<float>(event.x));
+		put(mFile, static_cast<float>(event.y));
+		break;
+	case InputEvent::Type::Resize:
+		put(mFile, static_cast<uint32_t>(event.x));
+		put(mFile, static_cast<uint32_t>(event.y));
+		break;
+	case InputEvent::Type::Key:
+		put(mFile, static_cast<uint16_t>(event.button));
+		put(mFile, static_cast<uint8_t>(event.action));
+		break;
+	}
+}
+
+void InputRecorder::endFrame(double time) {
+	if (!mStarted) return;
+	put(mFile, FrameRecord);
+	put(mFile, time - mStartTime);
+	++mFrameCount;
+}
+
+std::unique_ptr<InputReplay> InputReplay::open(const std::filesystem::path& path) {
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cerr << "Could not open input recording " << path << std::endl;
+		return nullptr;
+	}
+	Reader reader(file.data(), file.size());
+	Header header;
+	if (!reader.get(header) || header.magic != Magic || header.version != Version) {
+		std::cerr << "Invalid input recording " << path << std::endl;
+		return nullptr;
+	}
+
+	auto replay = std::unique_ptr<InputReplay>(new InputReplay());
+	replay->mStart.width = header.width;
+	replay->mStart.height = header.height;
+	replay->mStart.cameraAngles = { header.cameraAngles[0], header.cameraAngles[1] };
+	replay->mStart.cameraZoom = header.cameraZoom;
+	replay->mStart.animate = header.animate != 0;
+	replay->mFrameEvents.push_back(0);
+
+	// Records after the last frame marker, of a recording cut short, are dropped
+	bool valid = true;
+	while (valid && !reader.atEnd()) {
+		uint8_t type = 0;
+		valid = reader.get(type);
+		if (!valid) break;
+		if (type == FrameRecord) {
+			double time = 0.0;
+			valid = reader.get(time);
+			if (!valid) break;
+			replay->mFrameTimes.push_back(time);
+			replay->mFrameEvents.push_back(static_cast<uint32_t>(replay->mEvents.size()));
+			continue;
+		}
+
+		InputEvent event;
+		event.type = static_cast<InputEvent::Type>(type);
+		float x = 0.0f, y = 0.0f;
+		uint8_t button = 0, action = 0;
+		uint16_t key = 0;
+		uint32_t width = 0, height = 0;
+		switch (event.type) {
+		case InputEvent::Type::MouseButton:
+			valid = reader.get(button) && reader.get(action) && reader.get(x) && reader.get(y);
+			break;
+		case InputEvent::Type::MouseMove:
+		case InputEvent::Type::Scroll:
+			valid = reader.get(x) && reader.get(y);
+			break;
+		case InputEvent::Type::Resize:
+			valid = reader.get(width) && reader.get(height);
+			x = static_cast<float>(width);
+			y = static_cast<float>(height);
+			break;
+		case InputEvent::Type::Key:
+			valid = reader.get(key) && reader.get(action);
+			button = 0;
+			break;
+		default:
+			valid = false;
+			break;
+		}
+		event.button = event.type == InputEvent::Type::Key ? key : button;
+		event.action = action;
+		event.x = x;
+		event.y = y;
+		replay->mEvents.push_back(event);
+	}
+	if (!valid) std::cerr << "Input recording " << path << " is truncated, replaying its first " << replay->mFrameTimes.size() << " frames" << std::endl;
+	replay->mEvents.resize(replay->mFrameEvents.back());
+	return replay;
+}
+
+bool InputReplay::nextFrame(std::vector<InputEvent>& events) {
+	events.clear();
+	if (mNextFrame >= mFrameTimes.size()) {
+		mNextFrame = mFrameTimes.size() + 1;
+		return false;
+	}
+	events.assign(mEvents.begin() + mFrameEvents[mNextFrame], mEvents.begin() + mFrameEvents[mNextFrame + 1]);
+	mTime = mFrameTimes[mNextFrame];
+	++mNextFrame;
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "InputQueue.h"
+#include "MathConfig.h"
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The state a recording starts from, for its replay to start from the same
+ */
+struct InputRecordingStart {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	// Of Application::CameraState
+	glm::vec2 cameraAngles = { 0.0f, 0.0f };
+	float cameraZoom = 0.0f;
+	bool animate = true;
+};
+
+/**
+ * A log of the input events the application handled and of the time of each
+ * frame, written as it goes to a compact binary file, for InputReplay to feed the
+ * same events at the same frames with the same times and repeat a session, e.g.
+ * to profile an interaction reported slow, as a benchmark.
+ *
+ * Events are those the handlers of the application received, after mouse moves
+ * are coalesced, so that the replay needs no window. Each frame ends with a marker
+ * holding its time, relative to the start of the recording, after the events it
+ * handled. Recording starts once the scene is loaded, the state it starts from
+ * (camera, size, animation) being recorded in the header.
+ *
+ * Layout (little endian): a header, then records of a type byte and a payload of
+ * the type: a f64 time for frames, f32 positions or offsets, u32 sizes, and a u8
+ * (u16 for keys) and action byte for buttons and keys.
+ */
+class InputRecorder {
+public:
+	explicit InputRecorder(std::filesystem::path path);
+
+	bool started() const { return mStarted; }
+	// Open the file and write its header, with `time` the origin of the frame times
+	bool start(const InputRecordingStart& state, double time);
+
+	// Once started
+	void record(const InputEvent& event);
+	void endFrame(double time);
+
+	// Frames recorded so far
+	uint32_t frameCount() const { return mFrameCount; }
+
+private:
+	std::filesystem::path mPath;
+	std::ofstream mFile;
+	bool mStarted = false;
+	double mStartTime = 0.0;
+	uint32_t mFrameCount = 0;
+};
+
+/**
+ * A recording of InputRecorder played back frame by frame
+ */
+class InputReplay {
+public:
+	// Read the whole recording, returning null if it is missing or invalid
+	static std::unique_ptr<InputReplay> open(const std::filesystem::path& path);
+
+	const InputRecordingStart& start() const { return mStart; }
+	uint32_t frameCount() const { return static_cast<uint32_t>(mFrameTimes.size()); }
+
+	bool started() const { return mNextFrame > 0; }
+	bool finished() const { return mNextFrame > mFrameTimes.size(); }
+
+	// Move to the next frame, returning its events and false once there are none left
+	bool nextFrame(std::vector<InputEvent>& events);
+	// Of the current frame
+	double time() const { return mTime; }
+
+private:
+	InputRecordingStart mStart;
+	std::vector<InputEvent> mEvents;
+	// Per frame, its time and its first event
+	std::vector<double> mFrameTimes;
+	std::vector<uint32_t> mFrameEvents;
+	size_t mNextFrame = 0;
+	double mTime = 0.0;
+};
@@ -0,0 +1,174 @@
+#include "JobSystem.h"
+#include "ParallelFor.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define JOB_SYSTEM_NO_THREADS
+#endif
+
+namespace {
+
+// Queue of the worker running on this thread, if any
+thread_local const JobSystem* tOwner = nullptr;
+thread_local size_t tQueueIndex = 0;
+
+} // anonymous namespace
+
+JobSystem& JobSystem::instance() {
+	// Created by the main thread, whose node the workers then share. More workers than the
+	// performance cores would only make the frame wait for those sharing a core.
+	static JobSystem jobSystem(std::clamp(CpuTopology::instance().cpuCount(ThreadAffinity::PerformanceCores), 1u, workerThreadCount()) - 1, ThreadAffinity::PerformanceCores);
+	return jobSystem;
+}
+
+JobSystem::JobSystem([[maybe_unused]] unsigned int threadCount, [[maybe_unused]] ThreadAffinity affinity) {
+#ifdef JOB_SYSTEM_NO_THREADS
+	threadCount = 0;
+#endif // JOB_SYSTEM_NO_THREADS
+	mQueues.resize(std::max(1u, threadCount));
+	for (std::unique_ptr<Queue>& queue : mQueues) {
+		queue = std::make_unique<Queue>();
+	}
+	mThreads.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; ++i) {
+		mThreads.emplace_back([this, i, affinity]() {
+			setThreadAffinity(affinity);
+			workerLoop(i);
+		});
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	for (std::thread& thread : mThreads) {
+		thread.join();
+	}
+}
+
+void JobSystem::run(TaskGroup& group, Task task) {
+	group.mPendingCount.fetch_add(1, std::memory_order_relaxed);
+	push({ std::move(task), &group });
+}
+
+void JobSystem::runAfter(TaskGroup& dependency, TaskGroup& group, Task task) {
+	group.mPendingCount.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(dependency.mMutex);
+		if (!dependency.done()) {
+			dependency.mContinuations.emplace_back(std::move(task), &group);
+			return;
+		}
+	}
+	push({ std::move(task), &group });
+}
+
+void JobSystem::wait(TaskGroup& group) {
+	while (!group.done()) {
+		if (runOne()) continue;
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWake.wait(lock, [&]() { return group.done() || mQueuedCount.load() > 0; });
+	}
+	// The task that finished the group may still be releasing it
+	std::lock_guard<std::mutex> lock(group.mMutex);
+}
+
+void JobSystem::push(Entry entry) {
+	size_t index = tOwner == this
+		? tQueueIndex
+		: mNextQueue.fetch_add(1, std::memory_order_relaxed) % mQueues.size();
+	{
+		std::lock_guard<std::mutex> lock(mQueues[index]->mutex);
+		mQueues[index]->pushBack(std::move(entry));
+	}
+	mQueuedCount.fetch_add(1);
+	{
+		// Not to wake up threads between their test of the count and their wait
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWake.notify_one();
+}
+
+bool JobSystem::runOne() {
+	size_t queueCount = mQueues.size();
+	size_t first = tOwner == this ? tQueueIndex : mNextQueue.load(std::memory_order_relaxed) % queueCount;
+	Entry entry;
+	bool found = false;
+	for (size_t i = 0; i < queueCount && !found; ++i) {
+		Queue& queue = *mQueues[(first + i) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.count == 0) continue;
+		// The most recent task of our own queue, whose data is likely still in cache,
+		// and the oldest of the others, likely the largest share of their work
+		bool own = i == 0 && tOwner == this;
+		entry = own ? queue.popBack() : queue.popFront();
+		found = true;
+	}
+	if (!found) return false;
+
+	mQueuedCount.fetch_sub(1);
+	entry.task();
+	entry.task = nullptr;
+	finish(*entry.group);
+	return true;
+}
+
+void JobSystem::finish(TaskGroup& group) {
+	std::vector<std::pair<Task, TaskGroup*>> continuations;
+	{
+		std::lock_guard<std::mutex> lock(group.mMutex);
+		if (group.mPendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+		continuations.swap(group.mContinuations);
+	}
+	// The group may be destroyed from here on
+	for (auto& [task, continuationGroup] : continuations) {
+		push({ std::move(task), continuationGroup });
+	}
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWake.notify_all();
+}
+
+void JobSystem::Queue::pushBack(Entry entry) {
+	if (count == entries.size()) {
+		// Unwrap the entries at the beginning of twice as many
+		std::vector<Entry> grown(std::max<size_t>(2 * entries.size(), 16));
+		for (size_t i = 0; i < count; ++i) {
+			grown[i] = std::move(entries[(first + i) % entries.size()]);
+		}
+		entries.swap(grown);
+		first = 0;
+	}
+	entries[(first + count) % entries.size()] = std::move(entry);
+	++count;
+}
+
+JobSystem::Entry JobSystem::Queue::popBack() {
+	--count;
+	return std::move(entries[(first + count) % entries.size()]);
+}
+
+JobSystem::Entry JobSystem::Queue::popFront() {
+	Entry entry = std::move(entries[first]);
+	first = (first + 1) % entries.size();
+	--count;
+	return entry;
+}
+
+void JobSystem::workerLoop(size_t queueIndex) {
+	Trace::setThreadName("Job worker");
+	tOwner = this;
+	tQueueIndex = queueIndex;
+	while (true) {
+		if (runOne()) continue;
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWake.wait(lock, [this]() { return mStopping || mQueuedCount.load() > 0; });
+		if (mStopping) return;
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ThreadAffinity.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Pool of worker threads running short CPU tasks, e.g. the ranges of a parallelForRanges().
+ *
+ * Each worker has a queue of its own, that tasks it spawns are pushed to and that it
+ * pops from the back, most recent first, while idle workers steal from the front of
+ * the others. Tasks spawned by other threads are spread over the queues in turn.
+ *
+ * Tasks belong to a TaskGroup, which is waited for as a whole. Waiting runs queued
+ * tasks on the waiting thread, so that tasks may wait for tasks of their own without
+ * tying up a worker, and a task may be started once another group is done instead of
+ * blocking on it (see runAfter()).
+ *
+ * Workers may be restricted to some cores (see ThreadAffinity): the shared instance
+ * runs frame work, which the frame waits for, and keeps to the performance cores of
+ * the main thread's node, with a worker for each of them.
+ *
+ * Without thread support (Emscripten built without pthreads) there is no worker, and
+ * tasks run on the thread that waits for them.
+ */
+class JobSystem {
+public:
+	using Task = std::function<void()>;
+
+	/**
+	 * Tasks waited for together. A group must remain alive until waited for.
+	 */
+	class TaskGroup {
+	public:
+		TaskGroup() = default;
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+		// Whether every task run in the group so far finished
+		bool done() const { return mPendingCount.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class JobSystem;
+		std::atomic<size_t> mPendingCount = 0;
+		// Guards the continuations, and the last decrement of the pending count
+		std::mutex mMutex;
+		// Tasks run once the group is done, with the group they belong to
+		std::vector<std::pair<Task, TaskGroup*>> mContinuations;
+	};
+
+	// Shared by the whole application, with a worker per performance core besides the calling thread
+	static JobSystem& instance();
+
+	// Start `threadCount` workers running on the cores of `affinity`, none if threads are not supported
+	explicit JobSystem(unsigned int threadCount, ThreadAffinity affinity = ThreadAffinity::Any);
+
+	// Let workers run the tasks still queued, and stop them
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Threads running tasks, including one waiting for them
+	unsigned int threadCount() const { return static_cast<unsigned int>(mThreads.size()) + 1; }
+
+	// Queue `task` as part of `group`
+	void run(TaskGroup& group, Task task);
+
+	// Queue `task` as part of `group` once `dependency` is done, which also counts tasks
+	// run in `dependency` until then
+	void runAfter(TaskGroup& dependency, TaskGroup& group, Task task);
+
+	// Run queued tasks on the calling thread until every task of `group` finished
+	void wait(TaskGroup& group);
+
+private:
+	struct Entry {
+		Task task;
+		TaskGroup* group = nullptr;
+	};
+
+	/**
+	 * Ring buffer of entries, that only grows, so that queuing tasks stops allocating
+	 * once it held the most tasks queued at once
+	 */
+	struct Queue {
+		std::mutex mutex;
+		std::vector<Entry> entries;
+		size_t first = 0;
+		size_t count = 0;
+
+		void pushBack(Entry entry);
+		Entry popBack();
+		Entry popFront();
+	};
+
+	void push(Entry entry);
+	// Pop or steal a task and run it, return false if all queues were empty
+	bool runOne();
+	void finish(TaskGroup& group);
+	void workerLoop(size_t queueIndex);
+
+private:
+	// One queue per worker, or a single one without workers
+	std::vector<std::unique_ptr<Queue>> mQueues;
+	std::vector<std::thread> mThreads;
+	std::atomic<size_t> mQueuedCount = 0;
+	std::atomic<size_t> mNextQueue = 0;
+
+	// Idle workers and waiting threads sleep until a task is queued or a group is done
+	std::mutex mSleepMutex;
+	std::condition_variable mWake;
+	bool mStopping = false;
+};
@@ -0,0 +1,258 @@
+#include "Ktx2Parser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+constexpr unsigned char ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+/**
+ * Fixed size part of the file, right after the identifier
+ */
+struct Ktx2Header {
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	// Index of the data format descriptor, key/value data and supercompression global data
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	// 64-bit values that are only 4-byte aligned in the file
+	uint32_t sgdByteOffset[2];
+	uint32_t sgdByteLength[2];
+};
+static_assert(sizeof(Ktx2Header) == 68);
+
+struct Ktx2LevelIndex {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+static_assert(sizeof(Ktx2LevelIndex) == 24);
+
+/**
+ * A Vulkan block-compressed format and its WebGPU equivalent
+ */
+struct BlockFormat {
+	uint32_t vkFormat;
+	WGPUTextureFormat format;
+	uint32_t blockWidth;
+	uint32_t blockHeight;
+	uint32_t bytesPerBlock;
+};
+
+// VkFormat values from the Vulkan specification
+constexpr BlockFormat blockFormats[] = {
+	{ 133, TextureFormat::BC1RGBAUnorm, 4, 4, 8 },
+	{ 134, TextureFormat::BC1RGBAUnormSrgb, 4, 4, 8 },
+	{ 137, TextureFormat::BC3RGBAUnorm, 4, 4, 16 },
+	{ 138, TextureFormat::BC3RGBAUnormSrgb, 4, 4, 16 },
+	{ 139, TextureFormat::BC4RUnorm, 4, 4, 8 },
+	{ 141, TextureFormat::BC5RGUnorm, 4, 4, 16 },
+	{ 145, TextureFormat::BC7RGBAUnorm, 4, 4, 16 },
+	{ 146, TextureFormat::BC7RGBAUnormSrgb, 4, 4, 16 },
+	{ 147, TextureFormat::ETC2RGB8Unorm, 4, 4, 8 },
+	{ 148, TextureFormat::ETC2RGB8UnormSrgb, 4, 4, 8 },
+	{ 151, TextureFormat::ETC2RGBA8Unorm, 4, 4, 16 },
+	{ 152, TextureFormat::ETC2RGBA8UnormSrgb, 4, 4, 16 },
+	{ 153, TextureFormat::EACR11Unorm, 4, 4, 8 },
+	{ 155, TextureFormat::EACRG11Unorm, 4, 4, 16 },
+	{ 157, TextureFormat::ASTC4x4Unorm, 4, 4, 16 },
+	{ 158, TextureFormat::ASTC4x4UnormSrgb, 4, 4, 16 },
+};
+
+const BlockFormat* findBlockFormat(uint32_t vkFormat) {
+	for (const BlockFormat& blockFormat : blockFormats) {
+		if (blockFormat.vkFormat == vkFormat) return &blockFormat;
+	}
+	return nullptr;
+}
+
+// Color models and channels of the Khronos Data Format specification
+constexpr uint32_t KHR_DF_MODEL_BC1A = 128;
+constexpr uint32_t KHR_DF_MODEL_BC3 = 130;
+constexpr uint32_t KHR_DF_CHANNEL_BC1A_ALPHAPRESENT = 1;
+constexpr uint32_t KHR_DF_CHANNEL_BC3_COLOR = 0;
+constexpr uint32_t KHR_DF_CHANNEL_BC3_ALPHA = 15;
+
+// Basic data format descriptor of a 4x4 block format, preceded by its total size, as 32-bit words
+std::vector<uint32_t> basicDataFormatDescriptor(uint32_t colorModel, bool srgb, uint32_t bytesPerBlock) {
+	bool alphaPlane = colorModel == KHR_DF_MODEL_BC3;
+	uint32_t sampleCount = alphaPlane ? 2 : 1;
+	uint32_t blockSize = 24 + 16 * sampleCount;
+	std::vector<uint32_t> words = {
+		4 + blockSize,
+		// Khronos vendor, basic descriptor type, version 2
+		0,
+		2 | (blockSize << 16),
+		// BT.709 primaries, sRGB or linear transfer function, straight alpha
+		colorModel | (1u << 8) | ((srgb ? 2u : 1u) << 16),
+		// Block dimensions minus one
+		3 | (3u << 8),
+		bytesPerBlock,
+		0,
+	};
+	auto addSample = [&](uint32_t bitOffset, uint32_t bitLength, uint32_t channel) {
+		words.insert(words.end(), { bitOffset | ((bitLength - 1) << 16) | (channel << 24), 0, 0, UINT32_MAX });
+	};
+	if (alphaPlane) {
+		addSample(0, 64, KHR_DF_CHANNEL_BC3_ALPHA);
+		addSample(64, 64, KHR_DF_CHANNEL_BC3_COLOR);
+	}
+	else {
+		addSample(0, 64, KHR_DF_CHANNEL_BC1A_ALPHAPRESENT);
+	}
+	return words;
+}
+
+} // anonymous namespace
+
+bool parseKtx2(const std::byte* data, size_t size, Ktx2Image& image) {
+	if (size < sizeof(ktx2Identifier) + sizeof(Ktx2Header) || memcmp(data, ktx2Identifier, sizeof(ktx2Identifier)) != 0) {
+		std::cerr << "Not a KTX2 file" << std::endl;
+		return false;
+	}
+
+	Ktx2Header header;
+	memcpy(&header, data + sizeof(ktx2Identifier), sizeof(Ktx2Header));
+
+	if (header.supercompressionScheme != 0) {
+		std::cerr << "Unsupported KTX2 supercompression scheme " << header.supercompressionScheme << " (only uncompressed levels are supported)" << std::endl;
+		return false;
+	}
+	const BlockFormat* blockFormat = findBlockFormat(header.vkFormat);
+	if (blockFormat == nullptr) {
+		std::cerr << "Unsupported KTX2 format " << header.vkFormat << " (only BC, ETC2/EAC and ASTC 4x4 blocks are supported)" << std::endl;
+		return false;
+	}
+	if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1) {
+		std::cerr << "Unsupported KTX2 image, only single 2D images are supported" << std::endl;
+		return false;
+	}
+	if (header.pixelWidth % blockFormat->blockWidth != 0 || header.pixelHeight % blockFormat->blockHeight != 0) {
+		std::cerr << "KTX2 image size " << header.pixelWidth << "x" << header.pixelHeight << " is not a multiple of its block size" << std::endl;
+		return false;
+	}
+
+	// A level count of 0 asks for mip-maps to be generated at load time, which compressed formats do not allow
+	uint32_t levelCount = std::max(header.levelCount, 1u);
+	size_t levelIndexOffset = sizeof(ktx2Identifier) + sizeof(Ktx2Header);
+	if (size < levelIndexOffset + levelCount * sizeof(Ktx2LevelIndex)) {
+		std::cerr << "Truncated KTX2 level index" << std::endl;
+		return false;
+	}
+
+	image.format = blockFormat->format;
+	image.width = header.pixelWidth;
+	image.height = header.pixelHeight;
+	image.blockWidth = blockFormat->blockWidth;
+	image.blockHeight = blockFormat->blockHeight;
+	image.bytesPerBlock = blockFormat->bytesPerBlock;
+	image.levels.clear();
+
+	for (uint32_t level = 0; level < levelCount; ++level) {
+		Ktx2LevelIndex index;
+		memcpy(&index, data + levelIndexOffset + level * sizeof(Ktx2LevelIndex), sizeof(Ktx2LevelIndex));
+
+		uint64_t width = std::max(header.pixelWidth >> level, 1u);
+		uint64_t height = std::max(header.pixelHeight >> level, 1u);
+		uint64_t expectedLength =
+			(width + image.blockWidth - 1) / image.blockWidth *
+			((height + image.blockHeight - 1) / image.blockHeight) *
+			image.bytesPerBlock;
+		if (index.byteLength != expectedLength || index.byteOffset > size || index.byteLength > size - index.byteOffset) {
+			std::cerr << "Invalid KTX2 level " << level << std::endl;
+			return false;
+		}
+		image.levels.emplace_back(data + index.byteOffset, static_cast<size_t>(index.byteLength));
+	}
+	return true;
+}
+
+bool writeKtx2(const Ktx2Image& image, std::vector<std::byte>& data) {
+	uint32_t colorModel = 0;
+	bool srgb = false;
+	switch (image.format) {
+	case TextureFormat::BC1RGBAUnormSrgb: srgb = true; [[fallthrough]];
+	case TextureFormat::BC1RGBAUnorm: colorModel = KHR_DF_MODEL_BC1A; break;
+	case TextureFormat::BC3RGBAUnormSrgb: srgb = true; [[fallthrough]];
+	case TextureFormat::BC3RGBAUnorm: colorModel = KHR_DF_MODEL_BC3; break;
+	default:
+		std::cerr << "Writing KTX2 format " << image.format << " is not supported (only BC1 and BC3 are)" << std::endl;
+		return false;
+	}
+	const BlockFormat* blockFormat = nullptr;
+	for (const BlockFormat& candidate : blockFormats) {
+		if (candidate.format == image.format) blockFormat = &candidate;
+	}
+	std::vector<uint32_t> dfd = basicDataFormatDescriptor(colorModel, srgb, blockFormat->bytesPerBlock);
+
+	uint32_t levelCount = static_cast<uint32_t>(image.levels.size());
+	Ktx2Header header{};
+	header.vkFormat = blockFormat->vkFormat;
+	header.typeSize = 1;
+	header.pixelWidth = image.width;
+	header.pixelHeight = image.height;
+	header.faceCount = 1;
+	header.levelCount = levelCount;
+	header.dfdByteOffset = static_cast<uint32_t>(sizeof(ktx2Identifier) + sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex));
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+	// Levels start at multiples of the block size, which is a multiple of 4
+	std::vector<Ktx2LevelIndex> levelIndex(levelCount);
+	size_t size = header.dfdByteOffset + header.dfdByteLength;
+	for (uint32_t level = levelCount; level-- > 0;) {
+		size = (size + blockFormat->bytesPerBlock - 1) / blockFormat->bytesPerBlock * blockFormat->bytesPerBlock;
+		levelIndex[level].byteOffset = size;
+		levelIndex[level].byteLength = image.levels[level].size();
+		levelIndex[level].uncompressedByteLength = image.levels[level].size();
+		size += image.levels[level].size();
+	}
+
+	data.assign(size, std::byte{ 0 });
+	memcpy(data.data(), ktx2Identifier, sizeof(ktx2Identifier));
+	memcpy(data.data() + sizeof(ktx2Identifier), &header, sizeof(Ktx2Header));
+	memcpy(data.data() + sizeof(ktx2Identifier) + sizeof(Ktx2Header), levelIndex.data(), levelCount * sizeof(Ktx2LevelIndex));
+	memcpy(data.data() + header.dfdByteOffset, dfd.data(), header.dfdByteLength);
+	for (uint32_t level = 0; level < levelCount; ++level) {
+		memcpy(data.data() + levelIndex[level].byteOffset, image.levels[level].data(), image.levels[level].size());
+	}
+	return true;
+}
+
+FeatureName textureFormatFeature(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::BC1RGBAUnorm:
+	case TextureFormat::BC1RGBAUnormSrgb:
+	case TextureFormat::BC3RGBAUnorm:
+	case TextureFormat::BC3RGBAUnormSrgb:
+	case TextureFormat::BC4RUnorm:
+	case TextureFormat::BC5RGUnorm:
+	case TextureFormat::BC7RGBAUnorm:
+	case TextureFormat::BC7RGBAUnormSrgb:
+		return FeatureName::TextureCompressionBC;
+	case TextureFormat::ETC2RGB8Unorm:
+	case TextureFormat::ETC2RGB8UnormSrgb:
+	case TextureFormat::ETC2RGBA8Unorm:
+	case TextureFormat::ETC2RGBA8UnormSrgb:
+	case TextureFormat::EACR11Unorm:
+	case TextureFormat::EACRG11Unorm:
+		return FeatureName::TextureCompressionETC2;
+	case TextureFormat::ASTC4x4Unorm:
+	case TextureFormat::ASTC4x4UnormSrgb:
+		return FeatureName::TextureCompressionASTC;
+	default:
+		return FeatureName::Undefined;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <vector>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Content of a KTX 2.0 container (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html)
+ * holding a single 2D image, its mip levels being stored as is in a block-compressed format
+ * that WebGPU can sample directly: BC1/3/4/5/7, ETC2/EAC or ASTC 4x4.
+ *
+ * Supercompressed files (BasisLZ, Zstandard) and Basis Universal UASTC payloads would need
+ * a transcoder that is not part of this project, so they are rejected.
+ */
+struct Ktx2Image {
+	wgpu::TextureFormat format = wgpu::TextureFormat::Undefined;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	// Footprint of a block in texels and its size in bytes
+	uint32_t blockWidth = 4;
+	uint32_t blockHeight = 4;
+	uint32_t bytesPerBlock = 16;
+	// Compressed data of each mip level from the largest one, pointing into the parsed buffer
+	std::vector<std::span<const std::byte>> levels;
+};
+
+// Parse the KTX2 file content data[0, size). The image levels point into `data`,
+// which must thus outlive them. Return false with an error message if the content
+// is not a supported KTX2 file.
+bool parseKtx2(const std::byte* data, size_t size, Ktx2Image& image);
+
+// Serialize `image`, whose levels may point anywhere, as a KTX2 file that parseKtx2() reads back,
+// levels being stored smallest first after a basic data format descriptor. Only BC1 and BC3
+// images, those written by TextureCompressor, are supported: return false for other formats.
+bool writeKtx2(const Ktx2Image& image, std::vector<std::byte>& data);
+
+// Device feature required to sample a block-compressed format, Undefined if there is none
+wgpu::FeatureName textureFormatFeature(wgpu::TextureFormat format);
@@ -0,0 +1,331 @@
+#include "LightBaker.h"
+#include "DeviceEvents.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace wgpu;
+
+namespace {
+
+const char* bakeShaderSource = R"(
+struct BakeUniforms {
+	firstVertex: u32,
+	vertexCount: u32,
+	rayCount: u32,
+	occlusionRadius: f32,
+	shadowDistance: f32,
+	bias: f32,
+};
+
+// Same as Bvh::Node, children of at most MaxLeafSize primitives being leaves
+struct Node {
+	minX: vec4f,
+	minY: vec4f,
+	minZ: vec4f,
+	maxX: vec4f,
+	maxY: vec4f,
+	maxZ: vec4f,
+	child: vec4u,
+	count: vec4u,
+};
+
+@group(0) @binding(0) var<uniform> uBake: BakeUniforms;
+@group(0) @binding(1) var<storage, read> nodes: array<Node>;
+// 3 vertices per entry of the primitives of the BVH
+@group(0) @binding(2) var<storage, read> triangles: array<vec4f>;
+// Position then normal of each vertex
+@group(0) @binding(3) var<storage, read> vertices: array<vec4f>;
+@group(0) @binding(4) var<storage, read_write> lighting: array<vec4f>;
+
+const PI = 3.14159265359;
+
+// Those of shade() in shader.wgsl, and the sky seen by the unoccluded part of the hemisphere
+const LightColor1 = vec3f(1.0, 0.9, 0.6);
+const LightColor2 = vec3f(0.6, 0.9, 1.0);
+const LightDirection1 = vec3f(0.5, -0.9, 0.1);
+const LightDirection2 = vec3f(0.2, 0.4, 0.3);
+const SkyColor = vec3f(0.15, 0.2, 0.25);
+
+// Möller-Trumbore, both faces of the triangles being hit
+fn hitsTriangle(entry: u32, origin: vec3f, direction: vec3f, tMax: f32) -> bool {
+	let v0 = triangles[3u * entry].xyz;
+	let edge1 = triangles[3u * entry + 1u].xyz - v0;
+	let edge2 = triangles[3u * entry + 2u].xyz - v0;
+	let p = cross(direction, edge2);
+	let determinant = dot(edge1, p);
+	if (abs(determinant) < 1e-12) {
+		return false;
+	}
+	let inverse = 1.0 / determinant;
+	let s = origin - v0;
+	let u = dot(s, p) * inverse;
+	let q = cross(s, edge1);
+	let w = dot(direction, q) * inverse;
+	let t = dot(edge2, q) * inverse;
+	return u >= 0.0 && w >= 0.0 && u + w <= 1.0 && t > 0.0 && t <= tMax;
+}
+
+// Whether anything lies along the ray within `tMax`, in any order
+fn occluded(origin: vec3f, direction: vec3f, tMax: f32) -> bool {
+	let inverseDirection = rayInverseDirection(direction);
+	var stack: array<u32, StackSize>;
+	stack[0] = 0u;
+	var stackSize = 1u;
+	while (stackSize > 0u) {
+		stackSize--;
+		let node = nodes[stack[stackSize]];
+		let x0 = (node.minX - origin.x) * inverseDirection.x;
+		let x1 = (node.maxX - origin.x) * inverseDirection.x;
+		let y0 = (node.minY - origin.y) * inverseDirection.y;
+		let y1 = (node.maxY - origin.y) * inverseDirection.y;
+		let z0 = (node.minZ - origin.z) * inverseDirection.z;
+		let z1 = (node.maxZ - origin.z) * inverseDirection.z;
+		let tNear = max(max(min(x0, x1), min(y0, y1)), max(min(z0, z1), vec4f(0.0)));
+		let tFar = min(min(max(x0, x1), max(y0, y1)), min(max(z0, z1), vec4f(tMax)));
+		for (var lane = 0u; lane < 4u; lane++) {
+			let count = node.count[lane];
+			if (count == 0u || tNear[lane] > tFar[lane]) {
+				continue;
+			}
+			if (count > MaxLeafSize) {
+				if (stackSize < StackSize) {
+					stack[stackSize] = node.child[lane];
+					stackSize++;
+				}
+				continue;
+			}
+			for (var entry = node.child[lane]; entry < node.child[lane] + count; entry++) {
+				if (hitsTriangle(entry, origin, direction, tMax)) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// Of the light of `direction`, scaled as in shade(), where it reaches the vertex
+fn directLight(origin: vec3f, normal: vec3f, direction: vec3f) -> f32 {
+	let shading = max(0.0, dot(direction, normal));
+	if (shading == 0.0 || occluded(origin, normalize(direction), uBake.shadowDistance)) {
+		return 0.0;
+	}
+	return shading;
+}
+
+// One invocation per vertex of the batch
+@compute @workgroup_size(64)
+fn bake(@builtin(global_invocation_id) id: vec3u) {
+	if (id.x >= uBake.vertexCount) {
+		return;
+	}
+	let vertexIndex = uBake.firstVertex + id.x;
+	let position = vertices[2u * vertexIndex].xyz;
+	let rawNormal = vertices[2u * vertexIndex + 1u].xyz;
+	let normal = select(vec3f(0.0, 0.0, 1.0), normalize(rawNormal), dot(rawNormal, rawNormal) > 1e-12);
+	// Off the surface, not to hit the triangles around the vertex
+	let origin = position + normal * uBake.bias;
+
+	// Orthonormal basis around the normal (Duff et al.)
+	let s = select(-1.0, 1.0, normal.z >= 0.0);
+	let a = -1.0 / (s + normal.z);
+	let b = normal.x * normal.y * a;
+	let tangent = vec3f(1.0 + s * normal.x * normal.x * a, s * b, -s * normal.x);
+	let bitangent = vec3f(b, s + normal.y * normal.y * a, -normal.y);
+
+	// Hammersley points on the cosine-weighted hemisphere, rotated differently at each vertex
+	// so that neighbors do not trace the same pattern
+	let rotation = fract(f32(vertexIndex) * 0.618034);
+	var visible = 0u;
+	for (var i = 0u; i < uBake.rayCount; i++) {
+		let u = (f32(i) + 0.5) / f32(uBake.rayCount);
+		let v = f32(reverseBits(i)) * 2.3283064365386963e-10;
+		let r = sqrt(u);
+		let phi = 2.0 * PI * fract(v + rotation);
+		let direction = tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + normal * sqrt(1.0 - u);
+		if (!occluded(origin, direction, uBake.occlusionRadius)) {
+			visible++;
+		}
+	}
+	let occlusion = f32(visible) / f32(max(uBake.rayCount, 1u));
+
+	let light = LightColor1 * directLight(origin, normal, LightDirection1)
+		+ LightColor2 * directLight(origin, normal, LightDirection2)
+		+ SkyColor * occlusion;
+	lighting[vertexIndex] = vec4f(light / LightingScale, occlusion);
+}
+)";
+
+} // anonymous namespace
+
+LightBaker::LightBaker(Device device, PipelineCache& pipelineCache)
+	: mDevice(device)
+	, mPipelineCache(pipelineCache)
+{
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(5, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+		bindingLayoutEntries[binding].buffer.type = BufferBindingType::ReadOnlyStorage;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[4].buffer.type = BufferBindingType::Storage;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	// The traversal follows the limits of the tree as built on the CPU, and its ray helpers come
+	// from the shared library of the shaders. Without them, the pipeline fails and bakes do nothing.
+	std::string source = "const StackSize = " + std::to_string(Bvh::StackSize) + "u;\n"
+		+ "const MaxLeafSize = " + std::to_string(Bvh::MaxLeafSize) + "u;\n"
+		+ "const LightingScale = " + std::to_string(LightingScale) + ";\n";
+	ResourceManager::loadShaderSource(RESOURCE_DIR "/shaders/ray.wgsl", source);
+	source += bakeShaderSource;
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(source);
+	pipelineDesc.compute.entryPoint = "bake";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+}
+
+Task<std::vector<glm::vec3>> LightBaker::bake(std::shared_ptr<const ResourceManager::Geometry> geometry, std::shared_ptr<const MeshBvh> bvh) {
+	std::vector<glm::vec3> result;
+	PipelineCache::AsyncComputePipeline pipeline = co_await mPipelineCache.whenBuilt(mPipeline);
+	const std::vector<Bvh::Node>& nodes = bvh->bvh().nodes();
+	uint32_t vertexCount = static_cast<uint32_t>(geometry->vertices.size());
+	if (!pipeline->ready() || nodes.empty() || vertexCount == 0) co_return result;
+
+	// Vec3 arrays have a stride of 16 bytes in storage buffers
+	std::span<const glm::vec3> bvhVertices = bvh->vertices();
+	std::vector<glm::vec4> triangles(bvhVertices.size());
+	for (size_t i = 0; i < bvhVertices.size(); ++i) triangles[i] = glm::vec4(bvhVertices[i], 1.0f);
+	std::vector<glm::vec4> vertices(2 * size_t(vertexCount));
+	for (uint32_t i = 0; i < vertexCount; ++i) {
+		vertices[2 * i] = glm::vec4(glm::vec3(geometry->vertices[i].position), 1.0f);
+		vertices[2 * i + 1] = glm::vec4(glm::vec3(geometry->vertices[i].normal), 0.0f);
+	}
+	uint64_t nodeBytes = nodes.size() * sizeof(Bvh::Node);
+	uint64_t triangleBytes = triangles.size() * sizeof(glm::vec4);
+	uint64_t vertexBytes = vertices.size() * sizeof(glm::vec4);
+	uint64_t lightingBytes = uint64_t(vertexCount) * sizeof(glm::vec4);
+
+	SupportedLimits supportedLimits;
+	mDevice.getLimits(&supportedLimits);
+	uint64_t maxBytes = std::min(supportedLimits.limits.maxStorageBufferBindingSize, supportedLimits.limits.maxBufferSize);
+	if (std::max({ nodeBytes, triangleBytes, vertexBytes, lightingBytes }) > maxBytes) {
+		std::cerr << "Could not bake the lighting of " << vertexCount << " vertices, the mesh is too large for the storage buffers of the device" << std::endl;
+		co_return result;
+	}
+
+	std::array<Buffer, 6> buffers = {};
+	Buffer& uniformBuffer = buffers[0];
+	Buffer& readbackBuffer = buffers[5];
+	auto release = [&]() {
+		for (Buffer& buffer : buffers) {
+			if (!buffer) continue;
+			destroyTracked(buffer);
+			buffer.release();
+			buffer = nullptr;
+		}
+	};
+	BufferDescriptor bufferDesc{};
+	bufferDesc.mappedAtCreation = false;
+	bufferDesc.label = "Light baking uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+	uniformBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Uniforms, "LightBaker");
+	const char* labels[] = { "Light baking nodes", "Light baking triangles", "Light baking vertices", "Light baking results" };
+	uint64_t sizes[] = { nodeBytes, triangleBytes, vertexBytes, lightingBytes };
+	for (uint32_t i = 0; i < 4; ++i) {
+		bufferDesc.label = labels[i];
+		bufferDesc.size = sizes[i];
+		bufferDesc.usage = BufferUsage::Storage | (i < 3 ? BufferUsage::CopyDst : BufferUsage::CopySrc);
+		buffers[1 + i] = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, "LightBaker");
+	}
+	bufferDesc.label = "Light baking readback";
+	bufferDesc.size = lightingBytes;
+	bufferDesc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+	readbackBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, "LightBaker");
+	if (std::any_of(buffers.begin(), buffers.end(), [](const Buffer& buffer) { return !buffer; })) {
+		std::cerr << "Could not create the buffers to bake the lighting of " << vertexCount << " vertices" << std::endl;
+		release();
+		co_return result;
+	}
+
+	Queue queue = mDevice.getQueue();
+	queue.writeBuffer(buffers[1], 0, nodes.data(), nodeBytes);
+	queue.writeBuffer(buffers[2], 0, triangles.data(), triangleBytes);
+	queue.writeBuffer(buffers[3], 0, vertices.data(), vertexBytes);
+
+	std::vector<BindGroupEntry> bindings(5);
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = buffers[binding];
+		bindings[binding].offset = 0;
+		bindings[binding].size = binding == 0 ? sizeof(Uniforms) : sizes[binding - 1];
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mBindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	BindGroup bindGroup = mDevice.createBindGroup(bindGroupDesc);
+
+	// Distances relative to the extent of the mesh
+	float extent = glm::length(bvh->bounds().max - bvh->bounds().min);
+	Uniforms uniforms{};
+	uniforms.rayCount = RayCount;
+	uniforms.occlusionRadius = OcclusionRadius * extent;
+	uniforms.shadowDistance = 2.0f * extent;
+	uniforms.bias = 1e-4f * extent;
+	for (uint32_t firstVertex = 0; firstVertex < vertexCount; firstVertex += BatchSize) {
+		// Written between the submissions, each batch reads its own
+		uniforms.firstVertex = firstVertex;
+		uniforms.vertexCount = std::min(BatchSize, vertexCount - firstVertex);
+		queue.writeBuffer(uniformBuffer, 0, &uniforms, sizeof(Uniforms));
+
+		CommandEncoderDescriptor encoderDesc{};
+		encoderDesc.label = "Light baking";
+		CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+		ComputePassDescriptor computePassDesc{};
+		computePassDesc.label = "Light baking";
+		ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+		computePass.setPipeline(pipeline->pipeline);
+		computePass.setBindGroup(0, bindGroup, 0, nullptr);
+		computePass.dispatchWorkgroups((uniforms.vertexCount + 63) / 64, 1, 1);
+		computePass.end();
+		computePass.release();
+		if (firstVertex + BatchSize >= vertexCount) {
+			encoder.copyBufferToBuffer(buffers[4], 0, readbackBuffer, 0, lightingBytes);
+		}
+		CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+		encoder.release();
+		queue.submit(commands);
+		commands.release();
+	}
+	bindGroup.release();
+
+	BufferMapAsyncStatus status = co_await DeviceEvents::mapAsync(readbackBuffer, MapMode::Read, 0, lightingBytes);
+	if (status == BufferMapAsyncStatus::Success) {
+		const glm::vec4* texels = static_cast<const glm::vec4*>(readbackBuffer.getConstMappedRange(0, lightingBytes));
+		result.resize(vertexCount);
+		for (uint32_t i = 0; i < vertexCount; ++i) result[i] = glm::vec3(texels[i]);
+		readbackBuffer.unmap();
+	}
+	else {
+		std::cerr << "Could not read back the baked lighting (" << status << ")" << std::endl;
+	}
+	release();
+	co_return result;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "Bvh.h"
+#include "PipelineCache.h"
+#include "ResourceManager.h"
+#include "Task.h"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Lighting of static geometry baked per vertex on the GPU, for shading to read
+ * it back from the vertex colors (see ResourceManager::storeBakedLighting)
+ * rather than evaluating the lights of every fragment of every frame.
+ *
+ * A compute pass traces rays from each vertex through the BVH of the mesh (see
+ * MeshBvh), uploaded as is: RayCount rays over the cosine-weighted hemisphere
+ * of its normal give the fraction of the sky it sees within OcclusionRadius of
+ * the extent of the mesh, and one ray toward each of the two lights of shade()
+ * in shader.wgsl whether they reach it. Each vertex then holds the diffuse light
+ * of both, shadowed, plus that of a sky ambient light, occluded.
+ *
+ * The mesh is lit in its own space, as placed when the scene is not turned, and
+ * only shadows itself. Vertices are traced BatchSize at a time, one submission
+ * each, so that no single one keeps the GPU busy long enough to be reset.
+ */
+class LightBaker {
+public:
+	static constexpr uint32_t RayCount = 64;
+	static constexpr float OcclusionRadius = 0.1f;
+	static constexpr uint32_t BatchSize = 16384;
+	// Baked lighting goes up to this, the vertex colors holding it divided by it so that
+	// normalized 8-bit encodings keep it
+	static constexpr float LightingScale = 2.0f;
+
+	LightBaker(wgpu::Device device, PipelineCache& pipelineCache);
+
+	LightBaker(const LightBaker&) = delete;
+	LightBaker& operator=(const LightBaker&) = delete;
+
+	// Lighting of each vertex of `geometry`, traced through `bvh` built from it, divided by
+	// LightingScale. Awaited on the device thread, where it resumes with it, or with nothing
+	// if the mesh is too large for the storage buffers of the device or could not be read back.
+	Task<std::vector<glm::vec3>> bake(std::shared_ptr<const ResourceManager::Geometry> geometry, std::shared_ptr<const MeshBvh> bvh);
+
+private:
+	/**
+	 * The BakeUniforms structure of the shader
+	 */
+	struct Uniforms {
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		uint32_t rayCount;
+		// In units of the mesh
+		float occlusionRadius;
+		float shadowDistance;
+		float bias;
+		float _pad[2];
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	wgpu::Device mDevice;
+	PipelineCache& mPipelineCache;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	PipelineCache::AsyncComputePipeline mPipeline;
+};
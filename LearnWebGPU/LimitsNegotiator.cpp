@@ -0,0 +1,137 @@
+#include "LimitsNegotiator.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+template <typename T>
+struct LimitField {
+	const char* name;
+	T WGPULimits::* member;
+};
+
+#define LIMIT_FIELD(name) { #name, &WGPULimits::name }
+
+// All limits but alignments, higher values being more permissive
+constexpr LimitField<uint32_t> uint32Limits[] = {
+	LIMIT_FIELD(maxTextureDimension1D),
+	LIMIT_FIELD(maxTextureDimension2D),
+	LIMIT_FIELD(maxTextureDimension3D),
+	LIMIT_FIELD(maxTextureArrayLayers),
+	LIMIT_FIELD(maxBindGroups),
+	LIMIT_FIELD(maxBindGroupsPlusVertexBuffers),
+	LIMIT_FIELD(maxBindingsPerBindGroup),
+	LIMIT_FIELD(maxDynamicUniformBuffersPerPipelineLayout),
+	LIMIT_FIELD(maxDynamicStorageBuffersPerPipelineLayout),
+	LIMIT_FIELD(maxSampledTexturesPerShaderStage),
+	LIMIT_FIELD(maxSamplersPerShaderStage),
+	LIMIT_FIELD(maxStorageBuffersPerShaderStage),
+	LIMIT_FIELD(maxStorageTexturesPerShaderStage),
+	LIMIT_FIELD(maxUniformBuffersPerShaderStage),
+	LIMIT_FIELD(maxVertexBuffers),
+	LIMIT_FIELD(maxVertexAttributes),
+	LIMIT_FIELD(maxVertexBufferArrayStride),
+	LIMIT_FIELD(maxInterStageShaderComponents),
+	LIMIT_FIELD(maxInterStageShaderVariables),
+	LIMIT_FIELD(maxColorAttachments),
+	LIMIT_FIELD(maxColorAttachmentBytesPerSample),
+	LIMIT_FIELD(maxComputeWorkgroupStorageSize),
+	LIMIT_FIELD(maxComputeInvocationsPerWorkgroup),
+	LIMIT_FIELD(maxComputeWorkgroupSizeX),
+	LIMIT_FIELD(maxComputeWorkgroupSizeY),
+	LIMIT_FIELD(maxComputeWorkgroupSizeZ),
+	LIMIT_FIELD(maxComputeWorkgroupsPerDimension),
+};
+
+constexpr LimitField<uint64_t> uint64Limits[] = {
+	LIMIT_FIELD(maxUniformBufferBindingSize),
+	LIMIT_FIELD(maxStorageBufferBindingSize),
+	LIMIT_FIELD(maxBufferSize),
+};
+
+#undef LIMIT_FIELD
+
+template <typename T, size_t N, typename F>
+void forEachLimit(const LimitField<T>(&fields)[N], F f) {
+	for (const LimitField<T>& field : fields) f(field);
+}
+
+// Call f on every negotiated limit, whatever its type
+template <typename F>
+void forEachLimit(F f) {
+	forEachLimit(uint32Limits, f);
+	forEachLimit(uint64Limits, f);
+}
+
+} // anonymous namespace
+
+LimitsNegotiator::LimitsNegotiator(const Limits& supported)
+	: mSupported(supported)
+	, mRequired(defaultLimits())
+{
+	// Some adapters, e.g. the GL fallback of wgpu-native, stay below the defaults
+	forEachLimit([this](const auto& field) {
+		mRequired.*field.member = std::min(mRequired.*field.member, mSupported.*field.member);
+	});
+	mRequired.minUniformBufferOffsetAlignment = mSupported.minUniformBufferOffsetAlignment;
+	mRequired.minStorageBufferOffsetAlignment = mSupported.minStorageBufferOffsetAlignment;
+}
+
+bool LimitsNegotiator::request(const char* subsystem, const Limits& minimum, const Limits& preferred) {
+	bool reachable = true;
+	forEachLimit([&](const auto& field) {
+		if (minimum.*field.member <= mSupported.*field.member) return;
+		if (reachable) {
+			std::cerr << "The adapter does not support the limits that " << subsystem << " needs:" << std::endl;
+		}
+		std::cerr << " - " << field.name << ": " << minimum.*field.member << " needed, " << mSupported.*field.member << " supported" << std::endl;
+		reachable = false;
+	});
+	if (!reachable) return false;
+
+	forEachLimit([&](const auto& field) {
+		auto value = std::max(minimum.*field.member, std::min(preferred.*field.member, mSupported.*field.member));
+		mRequired.*field.member = std::max(mRequired.*field.member, value);
+	});
+	return true;
+}
+
+Limits LimitsNegotiator::defaultLimits() {
+	Limits limits;
+	limits.maxTextureDimension1D = 8192;
+	limits.maxTextureDimension2D = 8192;
+	limits.maxTextureDimension3D = 2048;
+	limits.maxTextureArrayLayers = 256;
+	limits.maxBindGroups = 4;
+	limits.maxBindGroupsPlusVertexBuffers = 24;
+	limits.maxBindingsPerBindGroup = 1000;
+	limits.maxDynamicUniformBuffersPerPipelineLayout = 8;
+	limits.maxDynamicStorageBuffersPerPipelineLayout = 4;
+	limits.maxSampledTexturesPerShaderStage = 16;
+	limits.maxSamplersPerShaderStage = 16;
+	limits.maxStorageBuffersPerShaderStage = 8;
+	limits.maxStorageTexturesPerShaderStage = 4;
+	limits.maxUniformBuffersPerShaderStage = 12;
+	limits.maxUniformBufferBindingSize = 65536;
+	limits.maxStorageBufferBindingSize = 134217728;
+	limits.minUniformBufferOffsetAlignment = 256;
+	limits.minStorageBufferOffsetAlignment = 256;
+	limits.maxVertexBuffers = 8;
+	limits.maxBufferSize = 268435456;
+	limits.maxVertexAttributes = 16;
+	limits.maxVertexBufferArrayStride = 2048;
+	limits.maxInterStageShaderComponents = 60;
+	limits.maxInterStageShaderVariables = 16;
+	limits.maxColorAttachments = 8;
+	limits.maxColorAttachmentBytesPerSample = 32;
+	limits.maxComputeWorkgroupStorageSize = 16384;
+	limits.maxComputeInvocationsPerWorkgroup = 256;
+	limits.maxComputeWorkgroupSizeX = 256;
+	limits.maxComputeWorkgroupSizeY = 256;
+	limits.maxComputeWorkgroupSizeZ = 64;
+	limits.maxComputeWorkgroupsPerDimension = 65535;
+	return limits;
+}
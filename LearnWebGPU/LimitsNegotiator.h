@@ -0,0 +1,40 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+/**
+ * Device limits negotiated between the subsystems that depend on them, rather than
+ * hand-picked in one place.
+ *
+ * Each subsystem states the limits below which it cannot work, and the ones it
+ * would make use of. The device gets the defaults of the WebGPU specification
+ * raised to these requests, everything being clamped to what the adapter supports,
+ * so that it never relies on limits that nobody asked for. A subsystem whose
+ * minimum is out of reach is told so when it makes its request, and picks a
+ * fallback.
+ *
+ * In requests, limits left to 0 are not constrained. Offset alignments are not
+ * negotiated: the device always gets the smallest ones that the adapter supports.
+ */
+class LimitsNegotiator {
+public:
+	explicit LimitsNegotiator(const wgpu::Limits& supported);
+
+	// Ask for at least `minimum`, and for up to `preferred` where the adapter goes that
+	// far. Return false, leaving the required limits untouched, if the adapter does not
+	// reach `minimum`, listing the limits that fall short.
+	bool request(const char* subsystem, const wgpu::Limits& minimum, const wgpu::Limits& preferred);
+	bool request(const char* subsystem, const wgpu::Limits& minimum) { return request(subsystem, minimum, minimum); }
+
+	const wgpu::Limits& supported() const { return mSupported; }
+
+	// Limits to create the device with, given the requests so far
+	const wgpu::Limits& required() const { return mRequired; }
+
+	// Limits that the WebGPU specification guarantees, without asking for more
+	static wgpu::Limits defaultLimits();
+
+private:
+	wgpu::Limits mSupported;
+	wgpu::Limits mRequired;
+};
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * Handoff of values between threads without either side waiting on a lock held
+ * by the other: the frame thread must not stall because a loader or the device
+ * pump was preempted in the middle of a push.
+ *
+ *  - SpscQueue: a bounded ring with one producer and one consumer.
+ *  - MpscQueue: a bounded ring with any number of producers and one consumer.
+ *  - MpscMailbox: an MpscQueue that never refuses a value, keeping those that
+ *    do not fit in a list behind a mutex until the consumer takes them.
+ *  - TripleBuffer: the latest state published by one thread, read by another
+ *    (e.g. the camera or the cursor), skipping intermediate states.
+ *
+ * Capacities are powers of two, and values are default-constructible and movable.
+ * Pushes and pops of the rings only move a value once a slot is reserved, so that
+ * a value that did not fit is left untouched. Indices written by each side are on
+ * separate cache lines.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two");
+
+public:
+	// Producer side, false if the queue is full
+	template <typename U>
+	bool push(U&& value) {
+		size_t tail = mTail.load(std::memory_order_relaxed);
+		if (tail - mCachedHead == Capacity) {
+			mCachedHead = mHead.load(std::memory_order_acquire);
+			if (tail - mCachedHead == Capacity) return false;
+		}
+		mValues[tail & (Capacity - 1)] = std::forward<U>(value);
+		mTail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false if the queue is empty
+	bool pop(T& value) {
+		size_t head = mHead.load(std::memory_order_relaxed);
+		if (head == mCachedTail) {
+			mCachedTail = mTail.load(std::memory_order_acquire);
+			if (head == mCachedTail) return false;
+		}
+		value = std::move(mValues[head & (Capacity - 1)]);
+		mHead.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Either side, exact only when the other side is idle
+	bool empty() const {
+		return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+	}
+
+private:
+	std::array<T, Capacity> mValues;
+	// Indices only grow, wrapping around the ring through the mask. Each side keeps a copy of
+	// the other's index, only reloaded when the ring looks full or empty.
+	alignas(64) std::atomic<size_t> mHead = 0;
+	size_t mCachedTail = 0;
+	alignas(64) std::atomic<size_t> mTail = 0;
+	size_t mCachedHead = 0;
+};
+
+/**
+ * Producers reserve slots by incrementing the tail, and mark them filled with the
+ * sequence number of each slot (Vyukov's bounded queue), so that a producer never
+ * waits for another. The consumer pops the slots in order, thus a producer reserving
+ * a slot and not filling it yet holds back the values pushed after it.
+ */
+template <typename T, size_t Capacity>
+class MpscQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two");
+
+public:
+	MpscQueue() {
+		for (size_t i = 0; i < Capacity; ++i) {
+			mSlots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	// Producer side, from any thread, false if the queue is full
+	template <typename U>
+	bool push(U&& value) {
+		size_t tail = mTail.load(std::memory_order_relaxed);
+		Slot* slot = nullptr;
+		while (true) {
+			slot = &mSlots[tail & (Capacity - 1)];
+			size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			auto difference = static_cast<std::ptrdiff_t>(sequence - tail);
+			if (difference == 0) {
+				if (mTail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) break;
+			}
+			// Still holding the value of the previous round, not popped yet
+			else if (difference < 0) {
+				return false;
+			}
+			else {
+				tail = mTail.load(std::memory_order_relaxed);
+			}
+		}
+		slot->value = std::forward<U>(value);
+		slot->sequence.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, false if the queue is empty or its next slot is not filled yet
+	bool pop(T& value) {
+		size_t head = mHead.load(std::memory_order_relaxed);
+		Slot& slot = mSlots[head & (Capacity - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != head + 1) return false;
+		value = std::move(slot.value);
+		// Free for the producer of the next round
+		slot.sequence.store(head + Capacity, std::memory_order_release);
+		mHead.store(head + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Consumer side, counting the slots reserved but not filled yet as filled
+	bool empty() const {
+		return mHead.load(std::memory_order_relaxed) == mTail.load(std::memory_order_acquire);
+	}
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::array<Slot, Capacity> mSlots;
+	alignas(64) std::atomic<size_t> mHead = 0;
+	alignas(64) std::atomic<size_t> mTail = 0;
+};
+
+/**
+ * For values that must not be dropped, e.g. completions, of which there are seldom
+ * more than the capacity between two drains. Once a value spilled, the following
+ * ones spill too until the consumer took them, so that the values of each producer
+ * keep their order.
+ */
+template <typename T, size_t Capacity>
+class MpscMailbox {
+public:
+	// Producer side, from any thread, only taking a lock when the ring is full
+	template <typename U>
+	void push(U&& value) {
+		if (!mSpilling.load(std::memory_order_acquire) && mQueue.push(std::forward<U>(value))) return;
+		std::lock_guard<std::mutex> lock(mSpillMutex);
+		if (!mSpilling.load(std::memory_order_relaxed) && mQueue.push(std::forward<U>(value))) return;
+		mSpill.push_back(std::forward<U>(value));
+		mSpilling.store(true, std::memory_order_release);
+	}
+
+	// Consumer side, call `consume` on the values pushed so far, returning how many
+	template <typename Consume>
+	size_t drain(Consume&& consume) {
+		size_t count = 0;
+		T value;
+		while (mQueue.pop(value)) {
+			consume(std::move(value));
+			++count;
+		}
+		// The values spilled come after those of slots reserved and not filled yet
+		if (!mSpilling.load(std::memory_order_acquire) || !mQueue.empty()) return count;
+
+		std::deque<T> spill;
+		{
+			std::lock_guard<std::mutex> lock(mSpillMutex);
+			spill.swap(mSpill);
+			mSpilling.store(false, std::memory_order_release);
+		}
+		for (T& spilled : spill) {
+			consume(std::move(spilled));
+		}
+		return count + spill.size();
+	}
+
+	// Consumer side
+	bool empty() const {
+		return mQueue.empty() && !mSpilling.load(std::memory_order_acquire);
+	}
+
+private:
+	MpscQueue<T, Capacity> mQueue;
+	std::atomic<bool> mSpilling = false;
+	std::mutex mSpillMutex;
+	std::deque<T> mSpill;
+};
+
+/**
+ * Three copies of a state: the writer fills the back one, the reader reads the
+ * front one, and publishing or updating swaps either with the middle one through a
+ * single atomic exchange. Neither side ever waits, and the reader always gets the
+ * whole of the latest state published.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+	// Writer side, the state to fill before publish(), holding some older state to overwrite
+	T& write() { return mBuffers[mBack].value; }
+
+	// Writer side, make the state written the latest one
+	void publish() {
+		mBack = mMiddle.exchange(mBack | Fresh, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	// Reader side, switch to the latest state, returning false if none was published since
+	bool update() {
+		if (!(mMiddle.load(std::memory_order_relaxed) & Fresh)) return false;
+		mFront = mMiddle.exchange(mFront, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
+
+	// Reader side, the state as of the last update()
+	const T& read() const { return mBuffers[mFront].value; }
+
+private:
+	static constexpr uint8_t IndexMask = 0x3;
+	// Set in the middle index when it was published and not read yet
+	static constexpr uint8_t Fresh = 0x4;
+
+	struct alignas(64) Buffer {
+		T value;
+	};
+
+	std::array<Buffer, 3> mBuffers;
+	alignas(64) std::atomic<uint8_t> mMiddle = 1;
+	alignas(64) uint8_t mBack = 0;
+	alignas(64) uint8_t mFront = 2;
+};
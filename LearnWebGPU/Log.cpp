@@ -0,0 +1,245 @@
+#include "Log.h"
+
+#include "LockFree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define LOG_WITHOUT_THREADS
+#endif
+
+namespace {
+
+constexpr size_t QueueCapacity = 256;
+// Pause after which the writing thread writes the repeats it folded
+constexpr auto IdleDelay = std::chrono::milliseconds(100);
+
+struct Entry {
+	LogSeverity severity = LogSeverity::Info;
+	uint16_t length = 0;
+	char text[Log::MaxLineLength];
+
+	std::string_view view() const { return { text, length }; }
+};
+
+std::ostream& streamOf(LogSeverity severity) {
+	return severity >= LogSeverity::Warning ? std::cerr : std::cout;
+}
+
+/**
+ * The lines written so far, folding identical consecutive ones, only used by the
+ * thread writing them
+ */
+class Writer {
+public:
+	void write(const Entry& entry) {
+		if (mHasLast && entry.severity == mLast.severity && entry.view() == mLast.view()) {
+			++mRepeats;
+			return;
+		}
+		writeRepeats();
+		streamOf(entry.severity) << entry.view() << '\n';
+		std::copy_n(entry.text, entry.length, mLast.text);
+		mLast.length = entry.length;
+		mLast.severity = entry.severity;
+		mHasLast = true;
+	}
+
+	void writeDropped(uint64_t droppedCount) {
+		if (droppedCount == mReportedDropped) return;
+		writeRepeats();
+		std::cerr << "(" << droppedCount - mReportedDropped << " log lines dropped)\n";
+		mReportedDropped = droppedCount;
+		mHasLast = false;
+	}
+
+	void writeRepeats() {
+		if (mRepeats == 0) return;
+		streamOf(mLast.severity) << "(last message repeated " << mRepeats << " times)\n";
+		mRepeats = 0;
+	}
+
+	void flush() {
+		std::cout.flush();
+		std::cerr.flush();
+	}
+
+	bool repeating() const { return mRepeats > 0; }
+
+private:
+	Entry mLast;
+	bool mHasLast = false;
+	uint32_t mRepeats = 0;
+	uint64_t mReportedDropped = 0;
+};
+
+#ifdef LOG_WITHOUT_THREADS
+
+class Logger {
+public:
+	void write(const Entry& entry) {
+		mWriter.write(entry);
+		mWriter.flush();
+	}
+
+	void flush() {
+		mWriter.writeRepeats();
+		mWriter.flush();
+	}
+
+	uint64_t droppedCount() const { return 0; }
+
+private:
+	Writer mWriter;
+};
+
+#else // LOG_WITHOUT_THREADS
+
+/**
+ * Producers push to the ring and wake the writing thread if it may be waiting, without
+ * taking its mutex: a wakeup lost between its last check and its wait only delays the
+ * line by the idle delay the thread waits for at most.
+ */
+class Logger {
+public:
+	Logger() : mThread([this]() { run(); }) {}
+
+	~Logger() {
+		{
+			std::lock_guard lock(mMutex);
+			mStopping = true;
+		}
+		mWake.notify_one();
+		mThread.join();
+	}
+
+	void write(const Entry& entry) {
+		if (!mQueue.push(entry)) {
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if (!mPending.exchange(true)) mWake.notify_one();
+	}
+
+	void flush() {
+		std::unique_lock lock(mMutex);
+		uint64_t generation = ++mFlushRequest;
+		mWake.notify_one();
+		mFlushed.wait(lock, [&]() { return mFlushDone >= generation || mStopping; });
+	}
+
+	uint64_t droppedCount() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+	void run() {
+		Writer writer;
+		Entry entry;
+		std::unique_lock lock(mMutex);
+		while (true) {
+			// Cleared before draining, so that a line pushed after the drain wakes the thread again
+			mPending.store(false);
+			bool wrote = false;
+			while (mQueue.pop(entry)) {
+				writer.write(entry);
+				wrote = true;
+			}
+			writer.writeDropped(droppedCount());
+
+			bool flushing = mFlushDone < mFlushRequest;
+			if (flushing || mStopping) {
+				// A line pushed before flush() but not filled in yet is still in the ring
+				while (!mQueue.empty()) {
+					if (mQueue.pop(entry)) writer.write(entry);
+					else std::this_thread::yield();
+				}
+				writer.writeRepeats();
+			}
+			if (wrote || flushing || mStopping) writer.flush();
+			if (flushing) {
+				mFlushDone = mFlushRequest;
+				mFlushed.notify_all();
+			}
+			if (mStopping) break;
+
+			bool woken = mWake.wait_for(lock, IdleDelay, [&]() {
+				return mPending.load() || mStopping || mFlushDone < mFlushRequest;
+			});
+			if (!woken && writer.repeating()) {
+				writer.writeRepeats();
+				writer.flush();
+			}
+		}
+	}
+
+private:
+	MpscQueue<Entry, QueueCapacity> mQueue;
+	std::atomic<bool> mPending = false;
+	std::atomic<uint64_t> mDropped = 0;
+
+	// Under the mutex
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mFlushed;
+	bool mStopping = false;
+	uint64_t mFlushRequest = 0;
+	uint64_t mFlushDone = 0;
+
+	std::thread mThread;
+};
+
+#endif // LOG_WITHOUT_THREADS
+
+// Started by the first line, stopped at exit after writing what is left
+Logger& logger() {
+	static Logger instance;
+	return instance;
+}
+
+} // anonymous namespace
+
+void Log::write(LogSeverity severity, std::string_view line) {
+	Entry entry;
+	entry.severity = severity;
+	entry.length = static_cast<uint16_t>(std::min(line.size(), MaxLineLength));
+	std::memcpy(entry.text, line.data(), entry.length);
+	logger().write(entry);
+}
+
+void Log::flush() {
+	logger().flush();
+}
+
+uint64_t Log::droppedCount() {
+	return logger().droppedCount();
+}
+
+LogLine& LogLine::operator<<(std::string_view text) {
+	size_t length = std::min(text.size(), Log::MaxLineLength - mLength);
+	std::memcpy(mText + mLength, text.data(), length);
+	mLength += length;
+	return *this;
+}
+
+bool LogRateLimit::acquire(uint32_t& suppressed) {
+	int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	int64_t windowStart = mWindowStart.load(std::memory_order_relaxed);
+	suppressed = 0;
+	if (now - windowStart >= 1'000'000'000) {
+		// The thread opening the next window takes its first message, and the count of those
+		// suppressed in the previous one
+		if (mWindowStart.compare_exchange_strong(windowStart, now, std::memory_order_relaxed)) {
+			mWindowCount.store(1, std::memory_order_relaxed);
+			suppressed = mSuppressed.exchange(0, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	if (mWindowCount.fetch_add(1, std::memory_order_relaxed) < mBurst) return true;
+	mSuppressed.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <concepts>
+#include <string_view>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Messages of the frame thread and of the driver callbacks, written to the console
+ * by a thread of their own so that neither waits on the terminal: a line costs
+ * formatting into a fixed buffer and a push to a lock-free ring (MpscQueue), which
+ * drops it when full, counting what it dropped.
+ *
+ * The LOG_* macros of a severity below LEARNWEBGPU_LOG_LEVEL (0 debug, 1 info, 2
+ * warning, 3 error, Info by default) expand to nothing. Each call site lets through
+ * a burst of messages per second, then counts those it suppresses until the next
+ * second, reporting their count with its next message. The writing thread folds
+ * identical consecutive lines into a count of repeats, written once another line
+ * comes, once lines stop for a moment, or on flush().
+ *
+ * Builds without threads (the web build without WEB_THREADS) write each line as it
+ * comes. Errors and warnings go to std::cerr, the rest to std::cout.
+ */
+enum class LogSeverity : uint8_t {
+	Debug,
+	Info,
+	Warning,
+	Error,
+};
+
+#ifndef LEARNWEBGPU_LOG_LEVEL
+#define LEARNWEBGPU_LOG_LEVEL 1
+#endif
+
+class Log {
+public:
+	// Longest line, longer messages being cut
+	static constexpr size_t MaxLineLength = 248;
+
+	// Queue a line for the writing thread, started by the first one, from any thread
+	static void write(LogSeverity severity, std::string_view line);
+	// Wait for the lines queued so far to be written, repeats included
+	static void flush();
+	// Lines lost since the start because the ring was full
+	static uint64_t droppedCount();
+};
+
+/**
+ * A line of text formatted in place, which never allocates and cuts what does not fit
+ */
+class LogLine {
+public:
+	LogLine& operator<<(std::string_view text);
+	LogLine& operator<<(const char* text) { return *this << std::string_view(text ? text : "(null)"); }
+	LogLine& operator<<(char c) { return *this << std::string_view(&c, 1); }
+	LogLine& operator<<(bool value) { return *this << (value ? "true" : "false"); }
+	template <typename T>
+		requires (std::integral<T> || std::floating_point<T>)
+	LogLine& operator<<(T value) {
+		auto result = std::to_chars(mText + mLength, mText + Log::MaxLineLength, value);
+		if (result.ec == std::errc()) mLength = static_cast<size_t>(result.ptr - mText);
+		return *this;
+	}
+	// C enumerations of webgpu.h, e.g. WGPUDeviceLostReason, as their value
+	template <typename T>
+		requires std::is_enum_v<T>
+	LogLine& operator<<(T value) { return *this << static_cast<std::underlying_type_t<T>>(value); }
+
+	std::string_view view() const { return { mText, mLength }; }
+
+private:
+	char mText[Log::MaxLineLength];
+	size_t mLength = 0;
+};
+
+/**
+ * The budget of a LOG_* call site: `burst` messages per second of the steady clock
+ */
+class LogRateLimit {
+public:
+	explicit constexpr LogRateLimit(uint32_t burst) : mBurst(burst) {}
+
+	// Whether a message may be written now, setting `suppressed` to the count of those that
+	// were not since the last one that was
+	bool acquire(uint32_t& suppressed);
+
+private:
+	uint32_t mBurst;
+	std::atomic<int64_t> mWindowStart = INT64_MIN;
+	std::atomic<uint32_t> mWindowCount = 0;
+	std::atomic<uint32_t> mSuppressed = 0;
+};
+
+#define LOG_CONCAT_(a, b) a ## b
+#define LOG_CONCAT(a, b) LOG_CONCAT_(a, b)
+
+// Write `message`, a chain of `<<` operands, at `severity`, at most `burst` times per second
+// for this call site
+#define LOG_LIMITED(severity, burst, message) do { \
+		static LogRateLimit LOG_CONCAT(logRateLimit, __LINE__)(burst); \
+		uint32_t logSuppressed = 0; \
+		if (LOG_CONCAT(logRateLimit, __LINE__).acquire(logSuppressed)) { \
+			LogLine logLine; \
+			logLine << message; \
+			if (logSuppressed > 0) logLine << " (" << logSuppressed << " more suppressed)"; \
+			Log::write(severity, logLine.view()); \
+		} \
+	} while (false)
+
+#define LOG_DEFAULT_BURST 10
+
+#if LEARNWEBGPU_LOG_LEVEL <= 0
+#define LOG_DEBUG(message) LOG_LIMITED(LogSeverity::Debug, LOG_DEFAULT_BURST, message)
+#else
+#define LOG_DEBUG(message) do {} while (false)
+#endif
+#if LEARNWEBGPU_LOG_LEVEL <= 1
+#define LOG_INFO(message) LOG_LIMITED(LogSeverity::Info, LOG_DEFAULT_BURST, message)
+#else
+#define LOG_INFO(message) do {} while (false)
+#endif
+#if LEARNWEBGPU_LOG_LEVEL <= 2
+#define LOG_WARNING(message) LOG_LIMITED(LogSeverity::Warning, LOG_DEFAULT_BURST, message)
+#else
+#define LOG_WARNING(message) do {} while (false)
+#endif
+#if LEARNWEBGPU_LOG_LEVEL <= 3
+#define LOG_ERROR(message) LOG_LIMITED(LogSeverity::Error, LOG_DEFAULT_BURST, message)
+#else
+#define LOG_ERROR(message) do {} while (false)
+#endif
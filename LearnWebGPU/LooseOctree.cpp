@@ -0,0 +1,243 @@
+#include "LooseOctree.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Depth of the nodes an object of half extent `extent` goes in, in a root of half size `rootHalfSize`
+uint32_t depthOf(float rootHalfSize, float extent) {
+	if (!(extent > 0.0f)) return LooseOctree::MaxDepth;
+	float levels = std::floor(std::log2(rootHalfSize / extent));
+	return static_cast<uint32_t>(std::clamp(levels, 0.0f, static_cast<float>(LooseOctree::MaxDepth)));
+}
+
+float halfExtentOf(const Aabb& box) {
+	glm::vec3 extent = 0.5f * (box.max - box.min);
+	return std::max({ extent.x, extent.y, extent.z });
+}
+
+bool inCube(const glm::vec3& point, const glm::vec3& center, float halfSize) {
+	glm::vec3 offset = glm::abs(point - center);
+	return offset.x <= halfSize && offset.y <= halfSize && offset.z <= halfSize;
+}
+
+} // anonymous namespace
+
+void LooseOctree::reset(const Aabb& bounds) {
+	clear();
+	Node root;
+	if (!bounds.empty()) {
+		root.center = bounds.center();
+		root.halfSize = std::max(halfExtentOf(bounds), 1e-6f);
+	}
+	else {
+		root.halfSize = 1.0f;
+	}
+	mNodes.push_back(std::move(root));
+}
+
+void LooseOctree::clear() {
+	mNodes.clear();
+	mFreeNodes.clear();
+	mObjectCount = 0;
+	mObjectNodes.clear();
+	mObjectSlots.clear();
+	for (std::vector<float>* bounds : { &mMinX, &mMinY, &mMinZ, &mMaxX, &mMaxY, &mMaxZ }) {
+		bounds->clear();
+	}
+}
+
+void LooseOctree::insert(uint32_t object, const Aabb& box) {
+	if (mNodes.empty()) reset(box);
+	if (object >= mObjectNodes.size()) {
+		mObjectNodes.resize(object + 1, NoNode);
+		mObjectSlots.resize(object + 1, 0);
+		for (std::vector<float>* bounds : { &mMinX, &mMinY, &mMinZ, &mMaxX, &mMaxY, &mMaxZ }) {
+			bounds->resize(object + 1, 0.0f);
+		}
+	}
+	storeBounds(object, box);
+
+	uint32_t node = findNode(box);
+	mObjectNodes[object] = node;
+	mObjectSlots[object] = static_cast<uint32_t>(mNodes[node].objects.size());
+	mNodes[node].objects.push_back(object);
+	for (uint32_t n = node; n != NoNode; n = mNodes[n].parent) {
+		++mNodes[n].subtreeCount;
+	}
+	++mObjectCount;
+}
+
+void LooseOctree::update(uint32_t object, const Aabb& box) {
+	if (!contains(object)) {
+		insert(object, box);
+		return;
+	}
+	if (belongsTo(mObjectNodes[object], box)) {
+		storeBounds(object, box);
+		return;
+	}
+	unlink(object);
+	insert(object, box);
+}
+
+void LooseOctree::remove(uint32_t object) {
+	if (contains(object)) unlink(object);
+}
+
+size_t LooseOctree::cull(const Frustum& frustum, uint32_t* visible) const {
+	if (empty()) return 0;
+	size_t visibleCount = 0;
+
+	// Nodes to visit, with whether they are known to be fully inside the frustum
+	struct Entry {
+		uint32_t node;
+		bool contained;
+	};
+	Entry stack[StackSize];
+	size_t stackSize = 0;
+	stack[stackSize++] = { 0, false };
+	while (stackSize > 0) {
+		Entry entry = stack[--stackSize];
+		const Node& node = mNodes[entry.node];
+		if (node.subtreeCount == 0) continue;
+
+		// Boxes with their farthest corner along a plane's normal behind it are outside, those
+		// with their nearest corner in front of every plane are fully inside. The root holds
+		// the objects that left it, and is never rejected.
+		bool contained = entry.contained;
+		if (!contained && entry.node != 0) {
+			Aabb bounds = looseBounds(node);
+			bool outside = false;
+			contained = true;
+			for (const glm::vec4& plane : frustum.planes) {
+				glm::vec3 normal(plane);
+				glm::vec3 farCorner = glm::mix(bounds.min, bounds.max, glm::vec3(glm::greaterThan(normal, glm::vec3(0.0f))));
+				glm::vec3 nearCorner = glm::mix(bounds.max, bounds.min, glm::vec3(glm::greaterThan(normal, glm::vec3(0.0f))));
+				if (glm::dot(normal, farCorner) + plane.w < 0.0f) {
+					outside = true;
+					break;
+				}
+				contained &= glm::dot(normal, nearCorner) + plane.w >= 0.0f;
+			}
+			if (outside) continue;
+		}
+
+		if (contained) {
+			std::copy(node.objects.begin(), node.objects.end(), visible + visibleCount);
+			visibleCount += node.objects.size();
+		}
+		else {
+			for (uint32_t object : node.objects) {
+				bool objectVisible = true;
+				for (const glm::vec4& plane : frustum.planes) {
+					float farX = plane.x > 0.0f ? mMaxX[object] : mMinX[object];
+					float farY = plane.y > 0.0f ? mMaxY[object] : mMinY[object];
+					float farZ = plane.z > 0.0f ? mMaxZ[object] : mMinZ[object];
+					if (plane.x * farX + plane.y * farY + plane.z * farZ + plane.w < 0.0f) {
+						objectVisible = false;
+						break;
+					}
+				}
+				if (objectVisible) visible[visibleCount++] = object;
+			}
+		}
+		for (uint32_t child : node.children) {
+			if (child != NoNode) stack[stackSize++] = { child, contained };
+		}
+	}
+	return visibleCount;
+}
+
+uint32_t LooseOctree::findNode(const Aabb& box) {
+	glm::vec3 center = box.center();
+	if (!inCube(center, mNodes[0].center, mNodes[0].halfSize)) return 0;
+	uint32_t depth = depthOf(mNodes[0].halfSize, halfExtentOf(box));
+	uint32_t node = 0;
+	while (mNodes[node].depth < depth) {
+		const glm::vec3& nodeCenter = mNodes[node].center;
+		uint32_t octant = (center.x > nodeCenter.x ? 1u : 0u) | (center.y > nodeCenter.y ? 2u : 0u) | (center.z > nodeCenter.z ? 4u : 0u);
+		uint32_t child = mNodes[node].children[octant];
+		if (child == NoNode) child = allocateNode(node, octant);
+		node = child;
+	}
+	return node;
+}
+
+bool LooseOctree::belongsTo(uint32_t node, const Aabb& box) const {
+	const Node& root = mNodes[0];
+	glm::vec3 center = box.center();
+	if (!inCube(center, root.center, root.halfSize)) return node == 0;
+	return mNodes[node].depth == depthOf(root.halfSize, halfExtentOf(box))
+		&& inCube(center, mNodes[node].center, mNodes[node].halfSize);
+}
+
+uint32_t LooseOctree::allocateNode(uint32_t parent, uint32_t octant) {
+	Node node;
+	node.halfSize = 0.5f * mNodes[parent].halfSize;
+	node.center = mNodes[parent].center + node.halfSize * glm::vec3(
+		(octant & 1u) ? 1.0f : -1.0f,
+		(octant & 2u) ? 1.0f : -1.0f,
+		(octant & 4u) ? 1.0f : -1.0f
+	);
+	node.parent = parent;
+	node.depth = mNodes[parent].depth + 1;
+
+	uint32_t index;
+	if (!mFreeNodes.empty()) {
+		index = mFreeNodes.back();
+		mFreeNodes.pop_back();
+		// Keeps the capacity of the objects of the node it was
+		node.objects = std::move(mNodes[index].objects);
+		node.objects.clear();
+		mNodes[index] = std::move(node);
+	}
+	else {
+		index = static_cast<uint32_t>(mNodes.size());
+		mNodes.push_back(std::move(node));
+	}
+	mNodes[parent].children[octant] = index;
+	return index;
+}
+
+void LooseOctree::unlink(uint32_t object) {
+	uint32_t node = mObjectNodes[object];
+	std::vector<uint32_t>& objects = mNodes[node].objects;
+	uint32_t slot = mObjectSlots[object];
+	objects[slot] = objects.back();
+	mObjectSlots[objects[slot]] = slot;
+	objects.pop_back();
+	mObjectNodes[object] = NoNode;
+	--mObjectCount;
+
+	for (uint32_t n = node; n != NoNode; n = mNodes[n].parent) {
+		--mNodes[n].subtreeCount;
+	}
+	// Empty nodes go back to the pool, but for the root
+	while (node != 0 && mNodes[node].subtreeCount == 0) {
+		uint32_t parent = mNodes[node].parent;
+		std::array<uint32_t, 8>& siblings = mNodes[parent].children;
+		*std::find(siblings.begin(), siblings.end(), node) = NoNode;
+		mNodes[node].children.fill(NoNode);
+		mFreeNodes.push_back(node);
+		node = parent;
+	}
+}
+
+void LooseOctree::storeBounds(uint32_t object, const Aabb& box) {
+	mMinX[object] = box.min.x;
+	mMinY[object] = box.min.y;
+	mMinZ[object] = box.min.z;
+	mMaxX[object] = box.max.x;
+	mMaxY[object] = box.max.y;
+	mMaxZ[object] = box.max.z;
+}
+
+Aabb LooseOctree::looseBounds(const Node& node) const {
+	return Aabb{ node.center - 2.0f * node.halfSize, node.center + 2.0f * node.halfSize };
+}
+
+Aabb LooseOctree::objectBounds(uint32_t object) const {
+	return Aabb{ { mMinX[object], mMinY[object], mMinZ[object] }, { mMaxX[object], mMaxY[object], mMaxZ[object] } };
+}
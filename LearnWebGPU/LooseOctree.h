@@ -0,0 +1,126 @@
+#pragma once
+
+#include "MathConfig.h"
+
+#include "Bvh.h"
+#include "FrustumCulling.h"
+
+#include <array>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A loose octree over the boxes of objects that move, are added and removed one
+ * at a time, for frustum culling and ray queries on the CPU: unlike Bvh, which is
+ * built once and only refit, each change costs a walk down the depth of the tree.
+ *
+ * Each node is a cube of the root's subdivision, whose loose bounds extend by half
+ * its size on every side. An object goes in the deepest node at whose size its
+ * largest half extent fits, the one containing its center, so that its box is
+ * within the loose bounds of the node. An object moving within its node only has
+ * its bounds updated, and one leaving it is inserted again from the root.
+ *
+ * Nodes are allocated from a pool, freed as soon as they and their children hold
+ * nothing, and hold the count of objects in their subtree, so that a subtree fully
+ * inside a frustum is accepted without its objects being tested. The bounds of the
+ * objects are stored as a structure of arrays, indexed by object.
+ *
+ * Objects are indices chosen by the caller, which should be dense, and those whose
+ * center is outside the root stay in the root, which queries never reject.
+ */
+class LooseOctree {
+public:
+	static constexpr uint32_t MaxDepth = 10;
+	static constexpr uint32_t NoNode = UINT32_MAX;
+	static constexpr size_t StackSize = 7 * MaxDepth + 1;
+
+	struct Node {
+		glm::vec3 center = glm::vec3(0.0f);
+		// Half the size of the cube, the loose bounds extending twice as far from the center
+		float halfSize = 0.0f;
+		uint32_t parent = NoNode;
+		uint32_t depth = 0;
+		// Octant i has x, y and z above the center for bits 0, 1 and 2 of i
+		std::array<uint32_t, 8> children = { NoNode, NoNode, NoNode, NoNode, NoNode, NoNode, NoNode, NoNode };
+		// Objects in the node itself, and in the whole subtree under it
+		std::vector<uint32_t> objects;
+		uint32_t subtreeCount = 0;
+	};
+
+	// Remove every object and make the root the smallest cube around `bounds`
+	void reset(const Aabb& bounds);
+	void clear();
+
+	bool empty() const { return mObjectCount == 0; }
+	size_t size() const { return mObjectCount; }
+	bool contains(uint32_t object) const { return object < mObjectNodes.size() && mObjectNodes[object] != NoNode; }
+	const std::vector<Node>& nodes() const { return mNodes; }
+
+	// Add `object` of bounds `box`, which must not be in the tree
+	void insert(uint32_t object, const Aabb& box);
+	// Move `object` to `box`, changing its node only when it leaves it
+	void update(uint32_t object, const Aabb& box);
+	void remove(uint32_t object);
+
+	// Write the objects whose box intersects `frustum` to `visible`, which must have room for
+	// size() of them, in no particular order, and return their count. Objects of a node fully
+	// inside the frustum are all kept, whether their own box is in or not.
+	size_t cull(const Frustum& frustum, uint32_t* visible) const;
+
+	// Call `test(object, ray)` for each object whose box the ray reaches within ray.tMax, in no
+	// particular order. `test` returns whether it hit the object, shortening ray.tMax to the hit.
+	// Returns whether anything was hit.
+	template <typename Fn>
+	bool intersect(Ray& ray, Fn&& test) const;
+
+private:
+	// Node of the tree an object of `box` belongs to, allocated along with its parents if needed
+	uint32_t findNode(const Aabb& box);
+	// Whether `box` belongs in `node` rather than one of its children or its parent
+	bool belongsTo(uint32_t node, const Aabb& box) const;
+	uint32_t allocateNode(uint32_t parent, uint32_t octant);
+	// Unlink from the node its object, and free the nodes left empty above it
+	void unlink(uint32_t object);
+	void storeBounds(uint32_t object, const Aabb& box);
+	Aabb looseBounds(const Node& node) const;
+	Aabb objectBounds(uint32_t object) const;
+
+private:
+	std::vector<Node> mNodes;
+	std::vector<uint32_t> mFreeNodes;
+	size_t mObjectCount = 0;
+
+	// Per object, NoNode for those not in the tree
+	std::vector<uint32_t> mObjectNodes;
+	// Index in the objects of its node
+	std::vector<uint32_t> mObjectSlots;
+	std::vector<float> mMinX, mMinY, mMinZ;
+	std::vector<float> mMaxX, mMaxY, mMaxZ;
+};
+
+template <typename Fn>
+bool LooseOctree::intersect(Ray& ray, Fn&& test) const {
+	if (empty()) return false;
+
+	glm::vec3 inverseDirection = ray.inverseDirection();
+
+	uint32_t stack[StackSize];
+	size_t stackSize = 0;
+	stack[stackSize++] = 0;
+	bool hit = false;
+	while (stackSize > 0) {
+		uint32_t index = stack[--stackSize];
+		const Node& node = mNodes[index];
+		// The root holds the objects that left it
+		if (index != 0 && !intersectSlabs(ray, inverseDirection, looseBounds(node))) continue;
+		for (uint32_t object : node.objects) {
+			if (intersectSlabs(ray, inverseDirection, objectBounds(object))) hit |= test(object, ray);
+		}
+		for (uint32_t child : node.children) {
+			if (child != NoNode) stack[stackSize++] = child;
+		}
+	}
+	return hit;
+}
@@ -32,14 +32,39 @@
 
 #include "Application.h"
 
-int main(int, char**) {
+#if defined(__EMSCRIPTEN__) && defined(LEARNWEBGPU_JSPI)
+#include <emscripten/em_js.h>
+
+// Resolved by the browser before it paints the next frame
+EM_ASYNC_JS(void, waitForAnimationFrame, (), {
+  await new Promise(requestAnimationFrame);
+});
+#endif // __EMSCRIPTEN__ && LEARNWEBGPU_JSPI
+
+int main(int argc, char** argv) {
   Application app;
+#ifndef __EMSCRIPTEN__
+  // Headless benchmark mode, e.g. --benchmark 1000 --report report.json
+  BenchmarkOptions benchmarkOptions;
+  if (!BenchmarkOptions::parse(argc, argv, benchmarkOptions)) return 1;
+  app.setBenchmark(benchmarkOptions);
+#else
+  (void)argc;
+  (void)argv;
+#endif // ! __EMSCRIPTEN__
   if (!app.onInit()) {
     std::cerr << "Failed to initialize the application. Program terminated" << std::endl;
     return 1;
   }
 
-#ifdef __EMSCRIPTEN__
+#if defined(__EMSCRIPTEN__) && defined(LEARNWEBGPU_JSPI)
+  // JSPI only suspends the exports it wraps, such as main, and not the callbacks of
+  // emscripten_set_main_loop, so frames run from main, suspended until each animation frame
+  while (app.isRunning()) {
+    app.onFrame();
+    waitForAnimationFrame();
+  }
+#elif defined(__EMSCRIPTEN__)
   // In the Emscripten backend, we use emscripten_set_main_loop to call the main loop function repeatedly until the application is closed.
   auto callback = [](void* arg) {
     Application* pApp = reinterpret_cast<Application*>(arg);
@@ -47,11 +72,17 @@ int main(int, char**) {
     };
   emscripten_set_main_loop_arg(callback, &app, 0, true);
 #else
-  while (app.isRunning()) {
-    app.onFrame();
+  if (app.rendersOnThread()) {
+    // Frames on a thread of their own, this one pumping the window events
+    app.runWithRenderThread();
+  }
+  else {
+    while (app.isRunning()) {
+      app.onFrame();
+    }
   }
 #endif // __EMSCRIPTEN__
 
   app.onFinish();
-  return 0;
+  return app.initFailed() ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "MappedFile.h"
+#include "AssetBundle.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__EMSCRIPTEN__)
+#include "MemoryProfiler.h"
+#include <emscripten/emscripten.h>
+#include <emscripten/fetch.h>
+#include <emscripten/threading.h>
+#include <cstring>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		close();
+		mData = std::exchange(other.mData, nullptr);
+		mSize = std::exchange(other.mSize, 0);
+		mInBundle = std::exchange(other.mInBundle, false);
+#if defined(_WIN32)
+		mFileHandle = std::exchange(other.mFileHandle, nullptr);
+		mMappingHandle = std::exchange(other.mMappingHandle, nullptr);
+#elif defined(__EMSCRIPTEN__)
+		mFetch = std::exchange(other.mFetch, nullptr);
+#endif
+	}
+	return *this;
+}
+
+bool MappedFile::open(const std::filesystem::path& path) {
+	close();
+
+	// A view of the mounted bundle, which stays mapped until the application exits
+	if (const AssetBundle::Entry* entry = AssetBundle::find(path)) {
+		if (entry->size == 0) return false;
+		mData = entry->data;
+		mSize = entry->size;
+		mInBundle = true;
+		return true;
+	}
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	mFileHandle = file;
+	mMappingHandle = mapping;
+	mData = static_cast<const std::byte*>(view);
+	mSize = static_cast<size_t>(fileSize.QuadPart);
+#elif defined(__EMSCRIPTEN__)
+	emscripten_fetch_attr_t attr;
+	emscripten_fetch_attr_init(&attr);
+	strcpy(attr.requestMethod, "GET");
+	attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_PERSIST_FILE;
+	// Set by the callbacks, which the main thread runs from its event loop while sleeping
+	std::atomic<bool> done = false;
+	bool mainThread = emscripten_is_main_runtime_thread();
+	if (mainThread) {
+		attr.userData = &done;
+		attr.onsuccess = [](emscripten_fetch_t* fetch) { static_cast<std::atomic<bool>*>(fetch->userData)->store(true); };
+		attr.onerror = attr.onsuccess;
+	}
+	else {
+		// Synchronous requests cannot read IndexedDB, so workers rely on the HTTP cache
+		attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_SYNCHRONOUS;
+	}
+	emscripten_fetch_t* fetch = emscripten_fetch(&attr, path.generic_string().c_str());
+	if (!fetch) return false;
+	while (mainThread && !done) {
+		emscripten_sleep(1);
+	}
+	if (fetch->status != 200 || fetch->numBytes == 0) {
+		if (fetch->status != 404) std::cerr << "Could not fetch " << fetch->url << " (HTTP status " << fetch->status << ")" << std::endl;
+		emscripten_fetch_close(fetch);
+		return false;
+	}
+
+	mFetch = fetch;
+	mData = reinterpret_cast<const std::byte*>(fetch->data);
+	mSize = static_cast<size_t>(fetch->numBytes);
+	// A copy in the heap, until closed
+	MemoryProfiler::addExternal(MemorySubsystem::Files, static_cast<int64_t>(mSize));
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	::close(fd);
+	if (view == MAP_FAILED) return false;
+
+	mData = static_cast<const std::byte*>(view);
+	mSize = static_cast<size_t>(fileStat.st_size);
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (!mData) return;
+	if (mInBundle) {
+		mData = nullptr;
+		mSize = 0;
+		mInBundle = false;
+		return;
+	}
+
+#if defined(_WIN32)
+	UnmapViewOfFile(mData);
+	CloseHandle(mMappingHandle);
+	CloseHandle(mFileHandle);
+	mFileHandle = nullptr;
+	mMappingHandle = nullptr;
+#elif defined(__EMSCRIPTEN__)
+	emscripten_fetch_close(mFetch);
+	mFetch = nullptr;
+	MemoryProfiler::addExternal(MemorySubsystem::Files, -static_cast<int64_t>(mSize));
+#else
+	munmap(const_cast<std::byte*>(mData), mSize);
+#endif
+
+	mData = nullptr;
+	mSize = 0;
+}
+
+// Next to `path`, with a name that no other write shares, be it from another thread or process,
+// and the .tmp extension that the tools skip
+static std::filesystem::path temporaryPath(const std::filesystem::path& path) {
+	static const uint64_t processTag = (uint64_t(std::random_device{}()) << 32) | std::random_device{}();
+	static std::atomic<uint64_t> writeCount{ 0 };
+	uint64_t threadTag = std::hash<std::thread::id>{}(std::this_thread::get_id());
+	std::ostringstream name;
+	name << '.' << std::hex << (processTag ^ threadTag) << '-' << std::dec << writeCount++ << ".tmp";
+	std::filesystem::path tmpPath = path;
+	tmpPath += name.str();
+	return tmpPath;
+}
+
+bool writeFileAtomically(const std::filesystem::path& path, const std::function<bool(std::ostream&)>& write) {
+	std::filesystem::path tmpPath = temporaryPath(path);
+	std::error_code ec;
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cerr << "Could not write " << path << std::endl;
+			return false;
+		}
+		bool written = write(file);
+		file.close();
+		if (!written || !file) {
+			if (written) std::cerr << "Could not write " << path << std::endl;
+			std::filesystem::remove(tmpPath, ec);
+			return false;
+		}
+	}
+	std::filesystem::rename(tmpPath, path, ec);
+	if (ec) {
+		std::cerr << "Could not write " << path << " (" << ec.message() << ")" << std::endl;
+		std::filesystem::remove(tmpPath, ec);
+		return false;
+	}
+	return true;
+}
+
+bool writeFileAtomically(const std::filesystem::path& path, std::span<const std::byte> data) {
+	return writeFileAtomically(path, [data](std::ostream& file) {
+		file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		return true;
+	});
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <span>
+#include <vector>
+#include <cstddef>
+
+#ifdef __EMSCRIPTEN__
+struct emscripten_fetch_t;
+#endif // __EMSCRIPTEN__
+
+/**
+ * A read-only view of a whole file, memory mapped when the platform allows it.
+ *
+ * On Emscripten, resources are not preloaded into MEMFS: the path is fetched
+ * as a URL relative to the page when the file is opened, and the view is the
+ * memory of the fetch, freed on close. Responses are kept in IndexedDB by the
+ * Fetch API, so that later visits do not download them again (deploying new
+ * resources thus needs new URLs). On the main thread the fetch is waited for
+ * with emscripten_sleep (ASYNCIFY or JSPI), and worker threads use synchronous
+ * fetches.
+ *
+ * Files packed in the mounted AssetBundle, if any, are views of its mapping.
+ */
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	// Map the file at `path`, return false if it could not be opened
+	bool open(const std::filesystem::path& path);
+
+	// Unmap and close the file, invalidating any pointer previously returned by data()
+	void close();
+
+	bool isOpen() const { return mData != nullptr; }
+	const std::byte* data() const { return mData; }
+	size_t size() const { return mSize; }
+
+private:
+	const std::byte* mData = nullptr;
+	size_t mSize = 0;
+	// Whether mData is part of the mapping of the AssetBundle rather than owned
+	bool mInBundle = false;
+
+#if defined(_WIN32)
+	void* mFileHandle = nullptr;
+	void* mMappingHandle = nullptr;
+#elif defined(__EMSCRIPTEN__)
+	emscripten_fetch_t* mFetch = nullptr;
+#endif
+};
+
+// Write the file at `path` through `write`, to a temporary file next to it that is renamed over it
+// once complete, so that a reader never sees, nor maps, a partial file. `write` returns false to
+// give up. Whenever the file is not replaced, the temporary file is removed and the error reported.
+// Safe to call from any thread, each call writing a temporary file of its own: of concurrent
+// writers of the same file, the last one to finish wins.
+bool writeFileAtomically(const std::filesystem::path& path, const std::function<bool(std::ostream&)>& write);
+
+// Same as above, for contents already in memory
+bool writeFileAtomically(const std::filesystem::path& path, std::span<const std::byte> data);
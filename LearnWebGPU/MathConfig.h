@@ -0,0 +1,37 @@
+#pragma once
+
+/**
+ * Configuration of glm, to include instead of <glm/glm.hpp> so that every translation
+ * unit sees the same conventions and data layouts.
+ *
+ * Depth goes from 0 to 1 in clip space, as in WebGPU. Coordinates are right handed,
+ * which the camera and the orientation of loaded models assume. Building with the
+ * GLM_SIMD option defines LEARNWEBGPU_GLM_SIMD, which enables the SSE/NEON code paths
+ * of glm. These only apply to aligned types, so all gentypes become aligned: vec3 then
+ * takes 16 bytes, and structures laid out for the GPU or a file must use packed types
+ * (glm::vec<3, float, glm::packed_highp>) for their vec3 members.
+ */
+
+// Settings of glm are read by its first include, which must be this one
+#ifdef GLM_SETUP_INCLUDED
+#error "glm was included before MathConfig.h, whose settings would be ignored"
+#endif
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#ifdef LEARNWEBGPU_GLM_SIMD
+#define GLM_FORCE_INTRINSICS
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+#endif // LEARNWEBGPU_GLM_SIMD
+
+// Aligned types are unions of anonymous structures, a language extension (warning C4201
+// of MSVC being disabled by the build)
+#if defined(LEARNWEBGPU_GLM_SIMD) && defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#if defined(LEARNWEBGPU_GLM_SIMD) && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
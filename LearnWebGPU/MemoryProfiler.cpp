@@ -0,0 +1,278 @@
+#include "MemoryProfiler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <utility>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#endif
+
+namespace {
+
+constexpr size_t SubsystemCount = static_cast<size_t>(MemorySubsystem::Count);
+// Entry 0 holding the call sites that found no room in the others
+constexpr size_t CallSiteCount = 4096;
+constexpr size_t MaxCallSiteProbes = 64;
+
+/**
+ * In front of every allocation while enabled, its 16 bytes keeping the alignment of malloc()
+ */
+struct AllocationHeader {
+	uint64_t size;
+	uint16_t callSite;
+	MemorySubsystem subsystem;
+};
+static_assert(sizeof(AllocationHeader) == 16);
+
+/**
+ * Counters of a subsystem, only ever added to atomically since any thread may
+ * allocate and release
+ */
+struct SubsystemCounters {
+	std::atomic<int64_t> liveBytes = 0;
+	std::atomic<int64_t> peakBytes = 0;
+	std::atomic<uint64_t> allocatedBytes = 0;
+	std::atomic<uint64_t> allocationCount = 0;
+};
+
+/**
+ * Counters of a call site, the entry being claimed by the first allocation from it
+ */
+struct CallSiteEntry {
+	// 0 while free, else the return address shifted left by 8 bits, user space addresses
+	// leaving them empty, and the subsystem plus 1 in the lowest byte
+	std::atomic<uint64_t> key = 0;
+	std::atomic<int64_t> liveBytes = 0;
+	std::atomic<uint64_t> allocatedBytes = 0;
+	std::atomic<uint64_t> allocationCount = 0;
+};
+
+/**
+ * Totals of all the subsystems at the end of the previous frame, and the allocations of
+ * the last frame, only used by the main thread
+ */
+struct FrameSnapshot {
+	std::array<uint64_t, SubsystemCount + 1> allocatedBytes{};
+	std::array<uint64_t, SubsystemCount + 1> allocationCount{};
+	std::array<uint64_t, SubsystemCount + 1> lastFrameAllocatedBytes{};
+	std::array<uint64_t, SubsystemCount + 1> lastFrameAllocationCount{};
+};
+
+// All of them trivially destructible and constant-initialized, so that operator new may use
+// them whatever the order of initialization and of destruction
+// 0 until read, then 1 when disabled and 2 when enabled
+std::atomic<int> gState = 0;
+// One per subsystem, then the total
+std::array<SubsystemCounters, SubsystemCount + 1> gCounters;
+std::array<CallSiteEntry, CallSiteCount> gCallSites;
+FrameSnapshot gFrames;
+thread_local MemorySubsystem tSubsystem = MemorySubsystem::Other;
+
+void raisePeak(std::atomic<int64_t>& peak, int64_t value) {
+	int64_t current = peak.load(std::memory_order_relaxed);
+	while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+void add(MemorySubsystem subsystem, int64_t bytes) {
+	for (SubsystemCounters* counters : { &gCounters[static_cast<size_t>(subsystem)], &gCounters[SubsystemCount] }) {
+		int64_t live = counters->liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		if (bytes <= 0) continue;
+		raisePeak(counters->peakBytes, live);
+		counters->allocatedBytes.fetch_add(static_cast<uint64_t>(bytes), std::memory_order_relaxed);
+		counters->allocationCount.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+uint16_t callSite(const void* caller, MemorySubsystem subsystem) {
+	uint64_t key = (static_cast<uint64_t>(reinterpret_cast<uintptr_t>(caller)) << 8) | (static_cast<uint64_t>(subsystem) + 1);
+	// Fibonacci hashing, the low bits of return addresses being far from random
+	size_t hash = static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> 40);
+	for (size_t probe = 0; probe < MaxCallSiteProbes; ++probe) {
+		size_t index = 1 + (hash + probe) % (CallSiteCount - 1);
+		uint64_t current = gCallSites[index].key.load(std::memory_order_relaxed);
+		if (current == 0 && gCallSites[index].key.compare_exchange_strong(current, key, std::memory_order_relaxed)) {
+			return static_cast<uint16_t>(index);
+		}
+		// Then claimed, maybe by another thread for the same call site in the meantime
+		if (current == key) return static_cast<uint16_t>(index);
+	}
+	return 0;
+}
+
+MemoryProfiler::Usage usageOf(size_t counter) {
+	const SubsystemCounters& counters = gCounters[counter];
+	MemoryProfiler::Usage usage;
+	usage.liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+	usage.peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+	usage.allocatedBytes = counters.allocatedBytes.load(std::memory_order_relaxed);
+	usage.allocationCount = counters.allocationCount.load(std::memory_order_relaxed);
+	usage.lastFrameAllocatedBytes = gFrames.lastFrameAllocatedBytes[counter];
+	usage.lastFrameAllocationCount = gFrames.lastFrameAllocationCount[counter];
+	return usage;
+}
+
+// Where `address` is, e.g. "LearnWebGPU+0x1a2b3c Application::onFrame()", to be resolved with
+// addr2line when the symbol is not exported
+void printAddress(std::ostream& out, const void* address) {
+	if (!address) {
+		out << "(unknown)";
+		return;
+	}
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+	Dl_info info;
+	if (dladdr(address, &info) && info.dli_fname) {
+		const char* module = std::strrchr(info.dli_fname, '/');
+		out << (module ? module + 1 : info.dli_fname) << "+0x" << std::hex
+			<< reinterpret_cast<uintptr_t>(address) - reinterpret_cast<uintptr_t>(info.dli_fbase) << std::dec;
+		if (info.dli_sname) {
+			int status = 0;
+			char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			out << ' ' << (status == 0 && demangled ? demangled : info.dli_sname);
+			std::free(demangled);
+		}
+		return;
+	}
+#endif
+	out << address;
+}
+
+} // anonymous namespace
+
+const char* memorySubsystemName(MemorySubsystem subsystem) {
+	switch (subsystem) {
+	case MemorySubsystem::Other: return "Other";
+	case MemorySubsystem::ImageDecoding: return "Image decoding";
+	case MemorySubsystem::GeometryParsing: return "Geometry parsing";
+	case MemorySubsystem::MeshData: return "Mesh data";
+	case MemorySubsystem::Mipmaps: return "Mipmaps";
+	case MemorySubsystem::DecodeHeap: return "Decode heap";
+	case MemorySubsystem::Files: return "Files";
+	default: return "Unknown";
+	}
+}
+
+bool MemoryProfiler::enabled() {
+	int state = gState.load(std::memory_order_relaxed);
+	if (state == 0) {
+		// Without allocating, this being called from operator new. Threads racing to read it
+		// read the same value.
+		const char* value = std::getenv("LEARNWEBGPU_MEMORY_PROFILE");
+		state = value && std::strcmp(value, "1") == 0 ? 2 : 1;
+		gState.store(state, std::memory_order_relaxed);
+	}
+	return state == 2;
+}
+
+void* MemoryProfiler::allocate(size_t size, const void* caller) {
+	if (size > SIZE_MAX - sizeof(AllocationHeader)) return nullptr;
+	auto* header = static_cast<AllocationHeader*>(std::malloc(sizeof(AllocationHeader) + size));
+	if (!header) return nullptr;
+	MemorySubsystem subsystem = tSubsystem;
+	header->size = size;
+	header->subsystem = subsystem;
+	header->callSite = callSite(caller, subsystem);
+	add(subsystem, static_cast<int64_t>(size));
+	CallSiteEntry& site = gCallSites[header->callSite];
+	site.liveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+	site.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	site.allocationCount.fetch_add(1, std::memory_order_relaxed);
+	return header + 1;
+}
+
+void MemoryProfiler::release(void* ptr) {
+	if (!ptr) return;
+	AllocationHeader* header = static_cast<AllocationHeader*>(ptr) - 1;
+	add(header->subsystem, -static_cast<int64_t>(header->size));
+	gCallSites[header->callSite].liveBytes.fetch_sub(static_cast<int64_t>(header->size), std::memory_order_relaxed);
+	std::free(header);
+}
+
+void MemoryProfiler::addExternal(MemorySubsystem subsystem, int64_t bytes) {
+	if (!enabled() || bytes == 0) return;
+	add(subsystem, bytes);
+}
+
+MemorySubsystem MemoryProfiler::subsystem() {
+	return tSubsystem;
+}
+
+MemorySubsystem MemoryProfiler::setSubsystem(MemorySubsystem subsystem) {
+	return std::exchange(tSubsystem, subsystem);
+}
+
+void MemoryProfiler::endFrame() {
+	if (!enabled()) return;
+	for (size_t counter = 0; counter <= SubsystemCount; ++counter) {
+		uint64_t allocatedBytes = gCounters[counter].allocatedBytes.load(std::memory_order_relaxed);
+		uint64_t allocationCount = gCounters[counter].allocationCount.load(std::memory_order_relaxed);
+		gFrames.lastFrameAllocatedBytes[counter] = allocatedBytes - gFrames.allocatedBytes[counter];
+		gFrames.lastFrameAllocationCount[counter] = allocationCount - gFrames.allocationCount[counter];
+		gFrames.allocatedBytes[counter] = allocatedBytes;
+		gFrames.allocationCount[counter] = allocationCount;
+	}
+}
+
+MemoryProfiler::Usage MemoryProfiler::usage(MemorySubsystem subsystem) {
+	return usageOf(static_cast<size_t>(subsystem));
+}
+
+MemoryProfiler::Usage MemoryProfiler::total() {
+	return usageOf(SubsystemCount);
+}
+
+std::vector<MemoryProfiler::CallSite> MemoryProfiler::topCallSites(size_t maxCount, bool byAllocatedBytes) {
+	std::vector<CallSite> sites;
+	for (size_t index = 0; index < CallSiteCount; ++index) {
+		const CallSiteEntry& entry = gCallSites[index];
+		CallSite site;
+		uint64_t key = entry.key.load(std::memory_order_relaxed);
+		site.address = reinterpret_cast<const void*>(static_cast<uintptr_t>(key >> 8));
+		site.subsystem = key != 0 ? static_cast<MemorySubsystem>((key & 0xff) - 1) : MemorySubsystem::Other;
+		site.liveBytes = entry.liveBytes.load(std::memory_order_relaxed);
+		site.allocatedBytes = entry.allocatedBytes.load(std::memory_order_relaxed);
+		site.allocationCount = entry.allocationCount.load(std::memory_order_relaxed);
+		if (site.allocationCount > 0) sites.push_back(site);
+	}
+	size_t count = std::min(maxCount, sites.size());
+	std::partial_sort(sites.begin(), sites.begin() + count, sites.end(), [byAllocatedBytes](const CallSite& a, const CallSite& b) {
+		return byAllocatedBytes ? a.allocatedBytes > b.allocatedBytes : a.liveBytes > b.liveBytes;
+	});
+	sites.resize(count);
+	return sites;
+}
+
+void MemoryProfiler::printReport(std::ostream& out, size_t maxCallSiteCount) {
+	if (!enabled()) {
+		out << "CPU memory is not profiled, set LEARNWEBGPU_MEMORY_PROFILE=1 to profile it" << std::endl;
+		return;
+	}
+	auto megabytes = [](int64_t bytes) { return double(bytes) / (1 << 20); };
+	Usage all = total();
+	out << std::fixed << std::setprecision(1);
+	out << "CPU memory: " << megabytes(all.liveBytes) << " MiB, peak " << megabytes(all.peakBytes) << " MiB, "
+		<< all.lastFrameAllocationCount << " allocations of " << megabytes(int64_t(all.lastFrameAllocatedBytes)) << " MiB last frame" << std::endl;
+	for (size_t subsystem = 0; subsystem < SubsystemCount; ++subsystem) {
+		Usage usage = usageOf(subsystem);
+		out << "  " << std::left << std::setw(18) << memorySubsystemName(static_cast<MemorySubsystem>(subsystem)) << std::right
+			<< std::setw(10) << megabytes(usage.liveBytes) << " MiB  peak" << std::setw(10) << megabytes(usage.peakBytes) << " MiB"
+			<< std::setw(10) << usage.lastFrameAllocationCount << " allocations last frame" << std::endl;
+	}
+
+	for (bool byAllocatedBytes : { false, true }) {
+		out << (byAllocatedBytes ? "Call sites allocating the most since the start:" : "Call sites holding the most:") << std::endl;
+		for (const CallSite& site : topCallSites(maxCallSiteCount, byAllocatedBytes)) {
+			out << "  " << std::setw(10) << megabytes(byAllocatedBytes ? int64_t(site.allocatedBytes) : site.liveBytes) << " MiB in "
+				<< std::setw(8) << site.allocationCount << " allocations  (" << memorySubsystemName(site.subsystem) << ") ";
+			printAddress(out, site.address);
+			out << std::endl;
+		}
+	}
+	out << std::defaultfloat;
+}
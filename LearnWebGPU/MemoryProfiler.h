@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Trace.h"
+
+#include <iosfwd>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * What the CPU memory of an allocation is for, as accounted by MemoryProfiler
+ */
+enum class MemorySubsystem : uint8_t {
+	// Allocations outside of any MemoryScope
+	Other,
+	// Scratch memory of texture decoding, the pixels themselves being in the DecodeHeap
+	ImageDecoding,
+	// tinyobj's attribute arrays and the other intermediate arrays of OBJ parsing
+	GeometryParsing,
+	// Vertices and indices of loaded geometry, and what processing them takes
+	MeshData,
+	// Mip chains built on the CPU
+	Mipmaps,
+	// What the DecodeHeap took from the system, for the buffers of stb_image and the other decoders
+	DecodeHeap,
+	// Files fetched into memory on the web, where MappedFile cannot map them
+	Files,
+	Count,
+};
+
+const char* memorySubsystemName(MemorySubsystem subsystem);
+
+/**
+ * Attribution of the CPU memory of the application to its subsystems, for
+ * memory optimization work, enabled by LEARNWEBGPU_MEMORY_PROFILE=1.
+ *
+ * The global operator new (see StartupProfiler.cpp) then puts a small header in
+ * front of each allocation, recording its size, the subsystem of the MemoryScope
+ * that the allocating thread is in, and its call site, i.e. the return address of
+ * operator new. Live bytes and peaks are kept per subsystem and per call site,
+ * what is released being taken from the subsystem it was allocated for whatever
+ * the thread releasing it. Allocators that take memory from the system themselves
+ * (DecodeHeap, fetches) report it with addExternal().
+ *
+ * Whether it is enabled is read once, at the first allocation of the program, and
+ * never changes. Disabled, it costs operator new a relaxed atomic load. Enabled,
+ * every allocation costs a few atomic additions, and an allocation rate per frame
+ * is measured between calls to endFrame(), which the HUD shows next to the live
+ * bytes. Call sites cannot be told apart on the web, all of them being reported
+ * as one per subsystem.
+ */
+class MemoryProfiler {
+public:
+	/**
+	 * Counters of a subsystem, or of all of them
+	 */
+	struct Usage {
+		int64_t liveBytes = 0;
+		// Largest liveBytes since the start
+		int64_t peakBytes = 0;
+		uint64_t allocatedBytes = 0;
+		uint64_t allocationCount = 0;
+		// Between the last two calls to endFrame()
+		uint64_t lastFrameAllocatedBytes = 0;
+		uint64_t lastFrameAllocationCount = 0;
+	};
+
+	/**
+	 * Allocations of a subsystem from a same return address
+	 */
+	struct CallSite {
+		// Null for the call sites that did not fit in the table, and on the web
+		const void* address = nullptr;
+		MemorySubsystem subsystem = MemorySubsystem::Other;
+		int64_t liveBytes = 0;
+		uint64_t allocatedBytes = 0;
+		uint64_t allocationCount = 0;
+	};
+
+	static bool enabled();
+
+	// Used by the global operator new and delete when enabled: `size` bytes accounted to
+	// the subsystem of the calling thread, `caller` being the return address of operator new
+	static void* allocate(size_t size, const void* caller);
+	static void release(void* ptr);
+
+	// Account for `bytes` more (or less, if negative) taken from the system by an allocator
+	// of its own, doing nothing when disabled
+	static void addExternal(MemorySubsystem subsystem, int64_t bytes);
+
+	// Subsystem of the calling thread, see MemoryScope
+	static MemorySubsystem subsystem();
+	// Set it, returning the previous one
+	static MemorySubsystem setSubsystem(MemorySubsystem subsystem);
+
+	// Main thread, once per frame: allocations since the previous call become those of the last frame
+	static void endFrame();
+
+	static Usage usage(MemorySubsystem subsystem);
+	static Usage total();
+
+	// Call sites holding the most live bytes, or that allocated the most since the start
+	static std::vector<CallSite> topCallSites(size_t maxCount, bool byAllocatedBytes = false);
+
+	// Print usage per subsystem and the top call sites, with the module and offset of each
+	// (for addr2line) and its symbol when known
+	static void printReport(std::ostream& out, size_t maxCallSiteCount = 10);
+};
+
+/**
+ * Account the allocations of the calling thread to a subsystem, from its
+ * construction to its destruction, see MEMORY_SCOPE()
+ */
+class MemoryScope {
+public:
+	explicit MemoryScope(MemorySubsystem subsystem)
+		: mPrevious(MemoryProfiler::setSubsystem(subsystem))
+	{}
+	~MemoryScope() {
+		MemoryProfiler::setSubsystem(mPrevious);
+	}
+
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator=(const MemoryScope&) = delete;
+
+private:
+	MemorySubsystem mPrevious;
+};
+
+// Account the allocations of the rest of the enclosing scope to `subsystem`, a MemorySubsystem
+#define MEMORY_SCOPE(subsystem) \
+	MemoryScope TRACE_CONCAT(memoryScope, __LINE__)(MemorySubsystem::subsystem)
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Layout of the binary mesh cache: this header, then `vertexCount` VertexAttributes,
+ * `indexCount` uint32 indices, `lodCount` GeometryLod entries, `submeshCount` times
+ * `lodCount` GeometryLod entries for the submesh ranges, then starting at the next
+ * multiple of 16 bytes, `meshletCount` meshlets, `clusterNodeCount` cluster level of
+ * detail nodes, and finally `materialBytes` bytes of text describing the materials of
+ * the submeshes (see writeMaterials). There is no other padding.
+ *
+ * Bundles for delivery hold the compressed variant instead (see AssetBundleTool.cpp),
+ * which starts with the same header but `compressedMeshCacheMagic`, then:
+ *   - a CompressedMeshCacheSizes
+ *   - the vertices encoded by MeshCodec::encodeVertexBuffer
+ *   - the indices encoded by MeshCodec::encodeIndexBuffer
+ *   - everything that follows the indices in the cache, as is
+ */
+struct MeshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	// Used to detect a stale cache
+	uint64_t sourceSize;
+	int64_t sourceWriteTime;
+	uint64_t vertexCount;
+	uint64_t indexCount;
+	// Load options the data was built with, to detect a cache built with other options
+	uint32_t optimizations; // bit mask of the optimization passes applied, and meshCacheBakedLighting
+	uint32_t lodLevelCount;
+	float lodMaxError;
+	// Number of levels actually built, at most lodLevelCount
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	// 0 when the geometry has no submeshes
+	uint32_t submeshCount;
+	uint32_t materialBytes;
+	uint32_t clusterNodeCount;
+};
+
+struct CompressedMeshCacheSizes {
+	uint64_t vertexBytes;
+	uint64_t indexBytes;
+};
+
+inline constexpr char meshCacheMagic[4] = { 'L', 'W', 'M', 'C' };
+inline constexpr char compressedMeshCacheMagic[4] = { 'L', 'W', 'M', 'Z' };
+// Bump whenever VertexAttributes, this header or the axis conventions of the loader change
+inline constexpr uint32_t meshCacheVersion = 6;
+// Bit of MeshCacheHeader::optimizations set when the colors hold baked lighting, which caches
+// built with the same options are found with or without
+inline constexpr uint32_t meshCacheBakedLighting = 1u << 31;
+// Size of ResourceManager::VertexAttributes, for the tools that do not include it
+inline constexpr size_t meshCacheVertexSize = 11 * sizeof(float);
@@ -0,0 +1,328 @@
+#include "MeshCodec.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+/**
+ * Encoded vertices (and likewise indices):
+ *   - uint32 number of chunks, then the uint32 size in bytes of each of them
+ *   - the chunks, one after the other
+ *
+ * A chunk of vertices is made of blocks of up to blockSize vertices, each of them
+ * holding, for every byte k of a vertex in turn:
+ *   - the 2-bit width code of each group of 16 vertices of the block, 4 per byte
+ *     starting from the low bits (0, 2, 4 or 8 bits per vertex)
+ *   - the bits of each group, values starting from the low bits of their byte
+ * Values are the zigzag encoded (0, -1, 1, -2... as 0, 1, 2, 3...) differences of
+ * byte k with byte k of the previous vertex, 0 for the first vertex of a chunk. The
+ * last group of a block is padded with zeros.
+ *
+ * A chunk of indices is a sequence of LEB128 integers, one per index, holding the
+ * zigzag encoded difference with one of the last two indices (0 at the start of
+ * the chunk) shifted left by 1, the low bit telling which of them.
+ */
+
+namespace {
+
+constexpr size_t blockSize = 256;
+constexpr size_t groupSize = 16;
+
+// Width in bits of each width code
+constexpr uint32_t groupBits[4] = { 0, 2, 4, 8 };
+
+uint8_t zigzag(uint8_t delta) { return static_cast<uint8_t>((delta << 1) ^ (static_cast<int8_t>(delta) >> 7)); }
+uint32_t zigzag(int32_t delta) { return (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31); }
+int32_t unzigzag(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+// Values of the 2 and 4 bit groups of each byte, the first one in the lowest byte
+struct UnpackTables {
+	std::array<uint32_t, 256> twoBits;
+	std::array<uint16_t, 256> fourBits;
+	UnpackTables() {
+		for (uint32_t b = 0; b < 256; ++b) {
+			twoBits[b] = (b & 3) | ((b >> 2) & 3) << 8 | ((b >> 4) & 3) << 16 | ((b >> 6) & 3) << 24;
+			fourBits[b] = static_cast<uint16_t>((b & 15) | (b >> 4) << 8);
+		}
+	}
+};
+const UnpackTables unpackTables;
+
+class Writer {
+public:
+	explicit Writer(std::vector<std::byte>& output) : mOutput(output) {}
+	void byte(uint32_t value) { mOutput.push_back(static_cast<std::byte>(value)); }
+	void uint32(uint32_t value) {
+		for (int i = 0; i < 4; ++i) byte(value >> (8 * i));
+	}
+	void leb128(uint64_t value) {
+		for (; value >= 0x80; value >>= 7) byte(0x80 | (value & 0x7f));
+		byte(static_cast<uint32_t>(value));
+	}
+	size_t size() const { return mOutput.size(); }
+	// Overwrite the uint32 at `offset`, written before as a placeholder
+	void patch(size_t offset, uint32_t value) {
+		for (int i = 0; i < 4; ++i) mOutput[offset + i] = static_cast<std::byte>(value >> (8 * i));
+	}
+
+private:
+	std::vector<std::byte>& mOutput;
+};
+
+uint32_t readUint32(const std::byte* p) {
+	uint32_t value;
+	std::memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/**
+ * The chunks of an encoded buffer, from a given one on
+ */
+class ChunkReader {
+public:
+	// Invalid if `encoded` does not start with the table of `chunkCount` chunks
+	ChunkReader(std::span<const std::byte> encoded, size_t chunkCount, size_t firstChunk)
+		: mEncoded(encoded)
+		, mChunk(firstChunk)
+	{
+		size_t tableSize = 4 + 4 * chunkCount;
+		mValid = encoded.size() >= tableSize && readUint32(encoded.data()) == chunkCount && firstChunk <= chunkCount;
+		mOffset = tableSize;
+		for (size_t i = 0; mValid && i < firstChunk; ++i) mOffset += readUint32(encoded.data() + 4 + 4 * i);
+	}
+
+	// Locate the next chunk, return false if it is out of the data
+	bool next(const uint8_t*& begin, const uint8_t*& end) {
+		if (!mValid) return false;
+		size_t size = readUint32(mEncoded.data() + 4 + 4 * mChunk++);
+		if (mOffset > mEncoded.size() || size > mEncoded.size() - mOffset) return false;
+		begin = reinterpret_cast<const uint8_t*>(mEncoded.data() + mOffset);
+		end = begin + size;
+		mOffset += size;
+		return true;
+	}
+
+private:
+	std::span<const std::byte> mEncoded;
+	size_t mChunk;
+	size_t mOffset = 0;
+	bool mValid = false;
+};
+
+// Write the encoding of vertices [first, first + count) of a chunk, following `last`
+void encodeVertexBlock(const uint8_t* vertices, size_t first, size_t count, size_t vertexSize, uint8_t* last, Writer& writer) {
+	size_t groupCount = (count + groupSize - 1) / groupSize;
+	std::array<uint8_t, blockSize> deltas;
+	for (size_t k = 0; k < vertexSize; ++k) {
+		deltas.fill(0);
+		uint8_t previous = last[k];
+		for (size_t i = 0; i < count; ++i) {
+			uint8_t value = vertices[(first + i) * vertexSize + k];
+			deltas[i] = zigzag(static_cast<uint8_t>(value - previous));
+			previous = value;
+		}
+		last[k] = previous;
+
+		std::array<uint32_t, blockSize / groupSize> codes;
+		for (size_t g = 0; g < groupCount; ++g) {
+			uint8_t largest = *std::max_element(&deltas[g * groupSize], &deltas[g * groupSize] + groupSize);
+			codes[g] = largest == 0 ? 0 : largest < 4 ? 1 : largest < 16 ? 2 : 3;
+		}
+		for (size_t g = 0; g < groupCount; g += 4) {
+			uint32_t header = 0;
+			for (size_t j = 0; j < 4 && g + j < groupCount; ++j) header |= codes[g + j] << (2 * j);
+			writer.byte(header);
+		}
+		for (size_t g = 0; g < groupCount; ++g) {
+			uint32_t bits = groupBits[codes[g]];
+			if (bits == 0) continue;
+			const uint8_t* values = &deltas[g * groupSize];
+			uint32_t perByte = 8 / bits;
+			for (size_t i = 0; i < groupSize; i += perByte) {
+				uint32_t packed = 0;
+				for (uint32_t j = 0; j < perByte; ++j) packed |= uint32_t(values[i + j]) << (j * bits);
+				writer.byte(packed);
+			}
+		}
+	}
+}
+
+// Turn 16 zigzag encoded differences into the values they lead to from `last`, which becomes the
+// last of them
+void decodeDeltas(const uint8_t* deltas, uint8_t& last, uint8_t* values) {
+#if defined(SIMD_SSE2)
+	__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas));
+	__m128i v = _mm_xor_si128(
+		_mm_and_si128(_mm_srli_epi16(d, 1), _mm_set1_epi8(0x7f)),
+		_mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(d, _mm_set1_epi8(1)))
+	);
+	// Prefix sum, in 4 steps of shifts by 1, 2, 4 and 8 bytes
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+	v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+	v = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(last)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(values), v);
+#elif defined(SIMD_NEON)
+	uint8x16_t d = vld1q_u8(deltas);
+	uint8x16_t zero = vdupq_n_u8(0);
+	uint8x16_t v = veorq_u8(vshrq_n_u8(d, 1), vsubq_u8(zero, vandq_u8(d, vdupq_n_u8(1))));
+	// Shifts towards the higher lanes, like _mm_slli_si128
+	v = vaddq_u8(v, vextq_u8(zero, v, 15));
+	v = vaddq_u8(v, vextq_u8(zero, v, 14));
+	v = vaddq_u8(v, vextq_u8(zero, v, 12));
+	v = vaddq_u8(v, vextq_u8(zero, v, 8));
+	v = vaddq_u8(v, vdupq_n_u8(last));
+	vst1q_u8(values, v);
+#elif defined(SIMD_WASM)
+	v128_t d = wasm_v128_load(deltas);
+	v128_t zero = wasm_i8x16_splat(0);
+	v128_t v = wasm_v128_xor(wasm_u8x16_shr(d, 1), wasm_i8x16_sub(zero, wasm_v128_and(d, wasm_i8x16_splat(1))));
+	v = wasm_i8x16_add(v, wasm_i8x16_shuffle(zero, v, 0, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30));
+	v = wasm_i8x16_add(v, wasm_i8x16_shuffle(zero, v, 0, 1, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29));
+	v = wasm_i8x16_add(v, wasm_i8x16_shuffle(zero, v, 0, 1, 2, 3, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27));
+	v = wasm_i8x16_add(v, wasm_i8x16_shuffle(zero, v, 0, 1, 2, 3, 4, 5, 6, 7, 16, 17, 18, 19, 20, 21, 22, 23));
+	v = wasm_i8x16_add(v, wasm_i8x16_splat(static_cast<int8_t>(last)));
+	wasm_v128_store(values, v);
+#else
+	uint8_t value = last;
+	for (size_t i = 0; i < groupSize; ++i) {
+		value = static_cast<uint8_t>(value + ((deltas[i] >> 1) ^ -(deltas[i] & 1)));
+		values[i] = value;
+	}
+#endif
+	last = values[groupSize - 1];
+}
+
+// Decode the block of vertices [first, first + count) of a chunk from `p`, following `last`,
+// and return the end of the block or nullptr if it goes past `end`
+const uint8_t* decodeVertexBlock(const uint8_t* p, const uint8_t* end, size_t first, size_t count, size_t vertexSize, uint8_t* last, uint8_t* destination) {
+	size_t groupCount = (count + groupSize - 1) / groupSize;
+	size_t headerSize = (groupCount + 3) / 4;
+	alignas(16) uint8_t deltas[groupSize];
+	alignas(16) uint8_t values[groupSize];
+	for (size_t k = 0; k < vertexSize; ++k) {
+		if (static_cast<size_t>(end - p) < headerSize) return nullptr;
+		const uint8_t* header = p;
+		p += headerSize;
+		uint8_t* column = destination + first * vertexSize + k;
+		for (size_t g = 0; g < groupCount; ++g) {
+			uint32_t code = (header[g / 4] >> (2 * (g % 4))) & 3;
+			size_t bytes = groupBits[code] * groupSize / 8;
+			if (static_cast<size_t>(end - p) < bytes) return nullptr;
+			switch (code) {
+			case 0:
+				std::memset(deltas, 0, groupSize);
+				break;
+			case 1:
+				for (size_t i = 0; i < 4; ++i) std::memcpy(deltas + 4 * i, &unpackTables.twoBits[p[i]], 4);
+				break;
+			case 2:
+				for (size_t i = 0; i < 8; ++i) std::memcpy(deltas + 2 * i, &unpackTables.fourBits[p[i]], 2);
+				break;
+			default:
+				std::memcpy(deltas, p, groupSize);
+				break;
+			}
+			p += bytes;
+			decodeDeltas(deltas, last[k], values);
+
+			// Scattered to the byte k of each vertex, padding excluded
+			size_t valueCount = std::min(groupSize, count - g * groupSize);
+			uint8_t* out = column + g * groupSize * vertexSize;
+			for (size_t i = 0; i < valueCount; ++i) out[i * vertexSize] = values[i];
+		}
+		// The last vertex is what the next block follows, not the padding
+		if (count % groupSize != 0) last[k] = column[(count - 1) * vertexSize];
+	}
+	return p;
+}
+
+} // anonymous namespace
+
+void MeshCodec::encodeVertexBuffer(const void* vertices, size_t vertexCount, size_t vertexSize, std::vector<std::byte>& output) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(vertices);
+	size_t chunkCount = MeshCodec::chunkCount(vertexCount, vertexChunkSize);
+	Writer writer(output);
+	writer.uint32(static_cast<uint32_t>(chunkCount));
+	size_t table = writer.size();
+	for (size_t chunk = 0; chunk < chunkCount; ++chunk) writer.uint32(0);
+
+	std::array<uint8_t, maxVertexSize> last;
+	for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+		size_t start = writer.size();
+		size_t chunkEnd = std::min(vertexCount, (chunk + 1) * vertexChunkSize);
+		last.fill(0);
+		for (size_t first = chunk * vertexChunkSize; first < chunkEnd; first += blockSize) {
+			encodeVertexBlock(bytes, first, std::min(blockSize, chunkEnd - first), vertexSize, last.data(), writer);
+		}
+		writer.patch(table + 4 * chunk, static_cast<uint32_t>(writer.size() - start));
+	}
+}
+
+bool MeshCodec::decodeVertexBuffer(void* destination, size_t vertexCount, size_t vertexSize, std::span<const std::byte> encoded, size_t firstChunk, size_t lastChunk) {
+	if (vertexSize == 0 || vertexSize > maxVertexSize) return false;
+	size_t chunkCount = MeshCodec::chunkCount(vertexCount, vertexChunkSize);
+	std::array<uint8_t, maxVertexSize> last;
+	ChunkReader reader(encoded, chunkCount, std::min(firstChunk, chunkCount));
+	for (size_t chunk = firstChunk; chunk < std::min(lastChunk, chunkCount); ++chunk) {
+		const uint8_t* p = nullptr;
+		const uint8_t* end = nullptr;
+		if (!reader.next(p, end)) return false;
+		size_t chunkEnd = std::min(vertexCount, (chunk + 1) * vertexChunkSize);
+		last.fill(0);
+		for (size_t first = chunk * vertexChunkSize; first < chunkEnd && p; first += blockSize) {
+			p = decodeVertexBlock(p, end, first, std::min(blockSize, chunkEnd - first), vertexSize, last.data(), static_cast<uint8_t*>(destination));
+		}
+		if (p != end) return false;
+	}
+	return true;
+}
+
+void MeshCodec::encodeIndexBuffer(const uint32_t* indices, size_t indexCount, std::vector<std::byte>& output) {
+	size_t chunkCount = MeshCodec::chunkCount(indexCount, indexChunkSize);
+	Writer writer(output);
+	writer.uint32(static_cast<uint32_t>(chunkCount));
+	size_t table = writer.size();
+	for (size_t chunk = 0; chunk < chunkCount; ++chunk) writer.uint32(0);
+
+	for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+		size_t start = writer.size();
+		uint32_t last[2] = { 0, 0 };
+		for (size_t i = chunk * indexChunkSize; i < std::min(indexCount, (chunk + 1) * indexChunkSize); ++i) {
+			int32_t deltas[2] = { static_cast<int32_t>(indices[i] - last[0]), static_cast<int32_t>(indices[i] - last[1]) };
+			uint32_t which = zigzag(deltas[1]) < zigzag(deltas[0]) ? 1 : 0;
+			writer.leb128((uint64_t(zigzag(deltas[which])) << 1) | which);
+			last[which] = indices[i];
+		}
+		writer.patch(table + 4 * chunk, static_cast<uint32_t>(writer.size() - start));
+	}
+}
+
+bool MeshCodec::decodeIndexBuffer(uint32_t* destination, size_t indexCount, std::span<const std::byte> encoded, size_t firstChunk, size_t lastChunk) {
+	size_t chunkCount = MeshCodec::chunkCount(indexCount, indexChunkSize);
+	ChunkReader reader(encoded, chunkCount, std::min(firstChunk, chunkCount));
+	for (size_t chunk = firstChunk; chunk < std::min(lastChunk, chunkCount); ++chunk) {
+		const uint8_t* p = nullptr;
+		const uint8_t* end = nullptr;
+		if (!reader.next(p, end)) return false;
+		uint32_t last[2] = { 0, 0 };
+		for (size_t i = chunk * indexChunkSize; i < std::min(indexCount, (chunk + 1) * indexChunkSize); ++i) {
+			// Most differences take a single byte
+			uint64_t value = 0;
+			for (uint32_t shift = 0;; shift += 7) {
+				if (p == end || shift > 35) return false;
+				uint8_t byte = *p++;
+				value |= uint64_t(byte & 0x7f) << shift;
+				if (byte < 0x80) break;
+			}
+			uint32_t which = static_cast<uint32_t>(value & 1);
+			uint32_t index = last[which] + static_cast<uint32_t>(unzigzag(static_cast<uint32_t>(value >> 1)));
+			destination[i] = index;
+			last[which] = index;
+		}
+		if (p != end) return false;
+	}
+	return true;
+}
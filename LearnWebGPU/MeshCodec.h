@@ -0,0 +1,51 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Lossless compression of vertex and index buffers for delivery, in the spirit of
+ * meshoptimizer's codecs: the output is a fraction of the size of the buffers and
+ * compresses further with a general purpose compressor (e.g. the gzip or brotli
+ * of the web server), while decoding runs at several GB/s.
+ *
+ *  - Vertices are encoded byte by byte, as the difference of each byte with the
+ *    same byte of the previous vertex. Differences come by groups of 16 vertices
+ *    stored with 0, 2, 4 or 8 bits each, whichever fits the largest of them, so
+ *    that constant bytes (e.g. white colors) cost nothing and slowly varying ones
+ *    (e.g. the high bytes of floats in a mesh ordered for vertex fetch) little.
+ *  - Indices are encoded as the difference with the closer of the last two indices,
+ *    a bit telling which, as variable length integers: a mesh whose triangles are
+ *    ordered for the vertex cache and vertices for fetch takes 1 to 2 bytes each.
+ *
+ * Both are split in chunks of vertexChunkSize vertices and indexChunkSize indices
+ * that are decoded independently, e.g. in parallel with parallelForRanges, straight
+ * into their destination (an array or mapped staging memory).
+ */
+class MeshCodec {
+public:
+	static constexpr size_t vertexChunkSize = 4096;
+	// A multiple of 3, chunks holding whole triangles
+	static constexpr size_t indexChunkSize = 3 * 16384;
+	// Vertices larger than that are not supported
+	static constexpr size_t maxVertexSize = 256;
+
+	// Number of chunks of `count` vertices or indices, `chunkSize` being one of the above
+	static size_t chunkCount(size_t count, size_t chunkSize) { return (count + chunkSize - 1) / chunkSize; }
+
+	// Append the encoding of `vertexCount` vertices of `vertexSize` bytes to `output`
+	static void encodeVertexBuffer(const void* vertices, size_t vertexCount, size_t vertexSize, std::vector<std::byte>& output);
+
+	// Decode the chunks [firstChunk, lastChunk) of the vertices `encoded` by encodeVertexBuffer
+	// to their place in `destination`, which holds all vertexCount vertices. Return false if
+	// `encoded` is not the encoding of such vertices, the chunks being then partially written.
+	static bool decodeVertexBuffer(void* destination, size_t vertexCount, size_t vertexSize, std::span<const std::byte> encoded, size_t firstChunk, size_t lastChunk);
+
+	// Append the encoding of `indexCount` indices to `output`
+	static void encodeIndexBuffer(const uint32_t* indices, size_t indexCount, std::vector<std::byte>& output);
+
+	// Same as decodeVertexBuffer, for indices encoded by encodeIndexBuffer
+	static bool decodeIndexBuffer(uint32_t* destination, size_t indexCount, std::span<const std::byte> encoded, size_t firstChunk, size_t lastChunk);
+};
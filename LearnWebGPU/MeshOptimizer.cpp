@@ -0,0 +1,859 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+
+struct Vec3 {
+	float x, y, z;
+	Vec3 operator+(const Vec3& o) const { return { x + o.x, y + o.y, z + o.z }; }
+	Vec3 operator-(const Vec3& o) const { return { x - o.x, y - o.y, z - o.z }; }
+	Vec3 operator*(float s) const { return { x * s, y * s, z * s }; }
+};
+
+float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+Vec3 cross(const Vec3& a, const Vec3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+Vec3 positionOf(const void* vertices, size_t vertexSize, uint32_t index) {
+	Vec3 p;
+	memcpy(&p, static_cast<const unsigned char*>(vertices) + index * vertexSize, sizeof(Vec3));
+	return p;
+}
+
+/**
+ * Simulation of a FIFO post-transform cache, used to measure and split index sequences.
+ */
+class FifoCache {
+public:
+	FifoCache(size_t vertexCount, uint32_t cacheSize)
+		: mTimestamps(vertexCount, 0)
+		, mCacheSize(cacheSize)
+		, mTime(cacheSize + 1)
+	{}
+
+	// Return true on a cache miss
+	bool access(uint32_t vertex) {
+		if (mTime - mTimestamps[vertex] > mCacheSize) {
+			mTimestamps[vertex] = mTime++;
+			return true;
+		}
+		return false;
+	}
+
+	// Forget everything, as if a new cluster started on a cold cache
+	void flush() { mTime += mCacheSize + 1; }
+
+private:
+	std::vector<uint32_t> mTimestamps;
+	uint32_t mCacheSize;
+	uint32_t mTime;
+};
+
+// Vertex to triangle adjacency, in compressed rows: the triangles using vertex v
+// are adjacency[offsets[v]] to adjacency[offsets[v + 1] - 1]
+void buildTriangleAdjacency(const std::vector<uint32_t>& indices, size_t vertexCount, std::vector<uint32_t>& offsets, std::vector<uint32_t>& adjacency) {
+	std::vector<uint32_t> counts(vertexCount, 0);
+	for (uint32_t v : indices) ++counts[v];
+
+	offsets.assign(vertexCount + 1, 0);
+	std::partial_sum(counts.begin(), counts.end(), offsets.begin() + 1);
+	adjacency.resize(indices.size());
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); ++i) {
+		adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+}
+
+/**
+ * Quadric error of a point, as a symmetric 4x4 matrix accumulated from weighted planes.
+ * Divided by the total weight, it gives the mean squared distance to these planes.
+ */
+struct Quadric {
+	double a2 = 0, b2 = 0, c2 = 0, d2 = 0;
+	double ab = 0, ac = 0, ad = 0, bc = 0, bd = 0, cd = 0;
+	double weight = 0;
+
+	// Add the plane of unit normal `n` going through `p`
+	void addPlane(const Vec3& n, const Vec3& p, double w) {
+		double a = n.x, b = n.y, c = n.z;
+		double d = -(a * p.x + b * p.y + c * p.z);
+		a2 += w * a * a; b2 += w * b * b; c2 += w * c * c; d2 += w * d * d;
+		ab += w * a * b; ac += w * a * c; ad += w * a * d;
+		bc += w * b * c; bd += w * b * d; cd += w * c * d;
+		weight += w;
+	}
+
+	void add(const Quadric& q) {
+		a2 += q.a2; b2 += q.b2; c2 += q.c2; d2 += q.d2;
+		ab += q.ab; ac += q.ac; ad += q.ad;
+		bc += q.bc; bd += q.bd; cd += q.cd;
+		weight += q.weight;
+	}
+
+	double error(const Vec3& p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double e = a2 * x * x + b2 * y * y + c2 * z * z + d2
+			+ 2 * (ab * x * y + ac * x * z + ad * x + bc * y * z + bd * y + cd * z);
+		return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+	}
+};
+
+Vec3 normalize(const Vec3& v) {
+	float length = std::sqrt(dot(v, v));
+	return length > 0.0f ? v * (1.0f / length) : v;
+}
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+	return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+}
+
+// Weld vertices sharing a position into groups, identified by their first vertex: group[v] is
+// the first vertex at the position of v
+void weldPositions(const void* vertices, size_t vertexSize, size_t vertexCount, std::vector<uint32_t>& group) {
+	struct PositionHash {
+		size_t operator()(const Vec3& p) const {
+			// Adding zero turns -0 into +0, which compare equal
+			float values[3] = { p.x + 0.0f, p.y + 0.0f, p.z + 0.0f };
+			uint32_t bits[3];
+			memcpy(bits, values, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+	struct PositionEqual {
+		bool operator()(const Vec3& a, const Vec3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+	};
+	std::unordered_map<Vec3, uint32_t, PositionHash, PositionEqual> firstVertex;
+	firstVertex.reserve(vertexCount);
+	group.resize(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; ++v) {
+		group[v] = firstVertex.try_emplace(positionOf(vertices, vertexSize, v), v).first->second;
+	}
+}
+
+// Smallest sphere enclosing the spheres `a` and `b`, given as center and radius
+glm::vec4 mergeSpheres(const glm::vec4& a, const glm::vec4& b) {
+	Vec3 d = { b.x - a.x, b.y - a.y, b.z - a.z };
+	float distance = std::sqrt(dot(d, d));
+	if (distance + b.w <= a.w) return a;
+	if (distance + a.w <= b.w) return b;
+	float radius = 0.5f * (distance + a.w + b.w);
+	Vec3 center = Vec3{ a.x, a.y, a.z } + d * ((radius - a.w) / distance);
+	return { center.x, center.y, center.z, radius };
+}
+
+} // anonymous namespace
+
+void MeshOptimizer::optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize, std::vector<size_t>* clusters) {
+	size_t triangleCount = indices.size() / 3;
+	if (clusters) clusters->clear();
+	if (triangleCount == 0) return;
+
+	std::vector<uint32_t> adjacencyOffsets;
+	std::vector<uint32_t> adjacency;
+	buildTriangleAdjacency(indices, vertexCount, adjacencyOffsets, adjacency);
+
+	// Number of triangles not emitted yet around each vertex
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	uint32_t timestamp = cacheSize + 1;
+	size_t cursor = 0;
+
+	// Next vertex to fan around when all candidates are exhausted
+	auto skipDeadEnd = [&]() -> int64_t {
+		while (!deadEnd.empty()) {
+			uint32_t d = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[d] > 0) return d;
+		}
+		while (cursor < vertexCount) {
+			if (liveTriangles[cursor] > 0) return static_cast<int64_t>(cursor);
+			++cursor;
+		}
+		return -1;
+	};
+
+	int64_t fanning = skipDeadEnd();
+	if (clusters && fanning >= 0) clusters->push_back(0);
+
+	while (fanning >= 0) {
+		candidates.clear();
+
+		// Emit all remaining triangles around the fanning vertex
+		uint32_t f = static_cast<uint32_t>(fanning);
+		for (uint32_t a = adjacencyOffsets[f]; a < adjacencyOffsets[f + 1]; ++a) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) continue;
+			emitted[t] = 1;
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = indices[3 * t + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				--liveTriangles[v];
+				if (timestamp - cacheTime[v] > cacheSize) {
+					cacheTime[v] = timestamp++;
+				}
+			}
+		}
+
+		// Pick the candidate that will still be in cache once all its triangles are emitted,
+		// preferring the oldest one in the cache
+		int64_t best = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0) continue;
+			int64_t priority = 0;
+			if (timestamp - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+				priority = timestamp - cacheTime[v];
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				best = v;
+			}
+		}
+
+		if (best < 0) {
+			best = skipDeadEnd();
+		}
+
+		// Starting to fan around a vertex that is no longer cached opens a new cluster
+		if (clusters && best >= 0 && timestamp - cacheTime[best] > cacheSize && output.size() < indices.size()) {
+			clusters->push_back(output.size());
+		}
+		fanning = best;
+	}
+
+	indices = std::move(output);
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<size_t>& clusters, const void* vertices, size_t vertexCount, size_t vertexSize, float threshold, uint32_t cacheSize) {
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || clusters.empty()) return;
+
+	float meshAcmr = computeAcmr(indices.data(), indices.size(), vertexCount, cacheSize);
+
+	// Split hard clusters (cache flush points) into soft clusters, cutting as soon as
+	// the cluster alone has an ACMR within the threshold
+	std::vector<size_t> softClusters;
+	FifoCache cache(vertexCount, cacheSize);
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		size_t begin = clusters[c];
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : indices.size();
+		size_t clusterStart = begin;
+		size_t misses = 0;
+		cache.flush();
+		softClusters.push_back(begin);
+		for (size_t i = begin; i < end; i += 3) {
+			for (int k = 0; k < 3; ++k) {
+				misses += cache.access(indices[i + k]);
+			}
+			size_t clusterTriangles = (i + 3 - clusterStart) / 3;
+			if (i + 3 < end && static_cast<float>(misses) / clusterTriangles <= threshold * meshAcmr) {
+				clusterStart = i + 3;
+				misses = 0;
+				cache.flush();
+				softClusters.push_back(clusterStart);
+			}
+		}
+	}
+
+	// Mesh centroid, then for each cluster its area weighted centroid and normal
+	Vec3 meshCentroid = { 0, 0, 0 };
+	for (size_t v = 0; v < vertexCount; ++v) {
+		meshCentroid = meshCentroid + positionOf(vertices, vertexSize, static_cast<uint32_t>(v));
+	}
+	meshCentroid = meshCentroid * (1.0f / std::max<size_t>(vertexCount, 1));
+
+	struct ClusterSortKey {
+		float occlusion;
+		size_t begin;
+		size_t end;
+	};
+	std::vector<ClusterSortKey> keys(softClusters.size());
+	for (size_t c = 0; c < softClusters.size(); ++c) {
+		size_t begin = softClusters[c];
+		size_t end = c + 1 < softClusters.size() ? softClusters[c + 1] : indices.size();
+
+		Vec3 centroid = { 0, 0, 0 };
+		Vec3 normal = { 0, 0, 0 };
+		float area = 0.0f;
+		for (size_t i = begin; i < end; i += 3) {
+			Vec3 a = positionOf(vertices, vertexSize, indices[i + 0]);
+			Vec3 b = positionOf(vertices, vertexSize, indices[i + 1]);
+			Vec3 c2 = positionOf(vertices, vertexSize, indices[i + 2]);
+			Vec3 n = cross(b - a, c2 - a);
+			float triangleArea = std::sqrt(dot(n, n));
+			centroid = centroid + (a + b + c2) * (triangleArea / 3.0f);
+			normal = normal + n;
+			area += triangleArea;
+		}
+		centroid = area > 0.0f ? centroid * (1.0f / area) : positionOf(vertices, vertexSize, indices[begin]);
+		float normalLength = std::sqrt(dot(normal, normal));
+		float occlusion = normalLength > 0.0f ? dot(centroid - meshCentroid, normal) / normalLength : 0.0f;
+		keys[c] = { occlusion, begin, end };
+	}
+
+	// Clusters facing outwards, far from the center, are the most likely occluders
+	std::stable_sort(keys.begin(), keys.end(), [](const ClusterSortKey& a, const ClusterSortKey& b) {
+		return a.occlusion > b.occlusion;
+	});
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (const ClusterSortKey& key : keys) {
+		output.insert(output.end(), indices.begin() + key.begin, indices.begin() + key.end);
+	}
+	indices = std::move(output);
+}
+
+size_t MeshOptimizer::optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize, std::vector<uint32_t>& indices) {
+	constexpr uint32_t unassigned = ~0u;
+	std::vector<uint32_t> remap(vertexCount, unassigned);
+	std::vector<unsigned char> reordered;
+	reordered.reserve(vertexCount * vertexSize);
+
+	const unsigned char* source = static_cast<const unsigned char*>(vertices);
+	uint32_t nextVertex = 0;
+	for (uint32_t& index : indices) {
+		if (remap[index] == unassigned) {
+			remap[index] = nextVertex++;
+			reordered.insert(reordered.end(), source + index * vertexSize, source + (index + 1) * vertexSize);
+		}
+		index = remap[index];
+	}
+
+	memcpy(vertices, reordered.data(), reordered.size());
+	return nextVertex;
+}
+
+float MeshOptimizer::simplify(std::vector<uint32_t>& indices, const void* vertices, size_t vertexCount, size_t vertexSize, size_t targetIndexCount, float targetError, const uint8_t* lockedVertices) {
+	// Open borders are held in place by planes orthogonal to them, weighted this much more than faces
+	constexpr double borderWeight = 10.0;
+
+	if (indices.size() <= targetIndexCount || vertexCount == 0) return 0.0f;
+
+	// Positions normalized by the largest extent, so that errors are relative to it
+	std::vector<Vec3> positions(vertexCount);
+	Vec3 minimum = positionOf(vertices, vertexSize, 0);
+	Vec3 maximum = minimum;
+	for (size_t v = 0; v < vertexCount; ++v) {
+		Vec3 p = positionOf(vertices, vertexSize, static_cast<uint32_t>(v));
+		minimum = { std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z) };
+		maximum = { std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z) };
+		positions[v] = p;
+	}
+	float extent = std::max({ maximum.x - minimum.x, maximum.y - minimum.y, maximum.z - minimum.z });
+	float invExtent = extent > 0.0f ? 1.0f / extent : 0.0f;
+
+	// Weld vertices sharing a position into groups, and link the vertices of each group in a
+	// circular list
+	std::vector<uint32_t> group;
+	weldPositions(vertices, vertexSize, vertexCount, group);
+	std::vector<uint32_t> nextInGroup(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; ++v) {
+		uint32_t g = group[v];
+		nextInGroup[v] = g == v ? v : nextInGroup[g];
+		if (g != v) nextInGroup[g] = v;
+	}
+	for (Vec3& p : positions) {
+		p = (p - minimum) * invExtent;
+	}
+
+	auto isDegenerate = [&](uint32_t a, uint32_t b, uint32_t c) {
+		return group[a] == group[b] || group[b] == group[c] || group[a] == group[c];
+	};
+
+	// Drop triangles that are already degenerate
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+			if (isDegenerate(indices[i], indices[i + 1], indices[i + 2])) continue;
+			for (int k = 0; k < 3; ++k) indices[kept++] = indices[i + k];
+		}
+		indices.resize(kept);
+	}
+
+	// Number of triangles using each edge between groups
+	std::unordered_map<uint64_t, uint32_t> edgeUse;
+	auto countEdges = [&]() {
+		edgeUse.clear();
+		edgeUse.reserve(indices.size());
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; ++k) {
+				++edgeUse[edgeKey(group[indices[i + k]], group[indices[i + (k + 1) % 3]])];
+			}
+		}
+	};
+	countEdges();
+
+	// Face and border quadrics, accumulated per group
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		const Vec3& p0 = positions[indices[i + 0]];
+		const Vec3& p1 = positions[indices[i + 1]];
+		const Vec3& p2 = positions[indices[i + 2]];
+		Vec3 n = cross(p1 - p0, p2 - p0);
+		float doubleArea = std::sqrt(dot(n, n));
+		if (doubleArea == 0.0f) continue;
+		Vec3 unitNormal = n * (1.0f / doubleArea);
+		for (int k = 0; k < 3; ++k) {
+			quadrics[group[indices[i + k]]].addPlane(unitNormal, p0, 0.5 * doubleArea);
+		}
+		for (int k = 0; k < 3; ++k) {
+			uint32_t a = indices[i + k];
+			uint32_t b = indices[i + (k + 1) % 3];
+			if (edgeUse[edgeKey(group[a], group[b])] != 1) continue;
+			Vec3 edge = positions[b] - positions[a];
+			Vec3 borderNormal = normalize(cross(edge, unitNormal));
+			double w = borderWeight * dot(edge, edge);
+			quadrics[group[a]].addPlane(borderNormal, positions[a], w);
+			quadrics[group[b]].addPlane(borderNormal, positions[a], w);
+		}
+	}
+
+	enum VertexKind : uint8_t { Interior, Border, Locked };
+	std::vector<uint8_t> kind(vertexCount);
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> adjacencyOffsets;
+	std::vector<uint32_t> adjacency;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<char> collapseLocked(vertexCount);
+	std::vector<std::pair<uint32_t, uint32_t>> wedges;
+	constexpr uint32_t unassigned = ~0u;
+
+	double errorLimit = static_cast<double>(targetError) * targetError;
+	double maxError = 0.0;
+
+	// Collapse as many edges as possible in each pass, where each group can be involved in only
+	// one collapse so that the adjacency computed at the beginning of the pass stays usable
+	while (indices.size() > targetIndexCount) {
+		// Classify groups from the current edges: borders have edges used by one triangle only,
+		// non manifold groups have edges used by more than two triangles and never move
+		std::fill(kind.begin(), kind.end(), Interior);
+		for (const auto& [key, count] : edgeUse) {
+			uint32_t a = static_cast<uint32_t>(key >> 32);
+			uint32_t b = static_cast<uint32_t>(key);
+			uint8_t edgeKind = count == 1 ? Border : count > 2 ? Locked : Interior;
+			kind[a] = std::max(kind[a], edgeKind);
+			kind[b] = std::max(kind[b], edgeKind);
+		}
+		if (lockedVertices) {
+			for (size_t v = 0; v < vertexCount; ++v) {
+				if (lockedVertices[v]) kind[group[v]] = Locked;
+			}
+		}
+
+		// Candidate half edge collapses, in both directions of each edge
+		collapses.clear();
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; ++k) {
+				uint32_t a = group[indices[i + k]];
+				uint32_t b = group[indices[i + (k + 1) % 3]];
+				bool borderEdge = edgeUse[edgeKey(a, b)] == 1;
+				for (auto [from, to] : { std::pair{ a, b }, std::pair{ b, a } }) {
+					if (kind[from] == Locked) continue;
+					if (kind[from] == Border && !borderEdge) continue;
+					collapses.push_back({ from, to, 0.0 });
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.from != y.from ? x.from < y.from : x.to < y.to;
+		});
+		collapses.erase(std::unique(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.from == y.from && x.to == y.to;
+		}), collapses.end());
+		for (Collapse& collapse : collapses) {
+			collapse.cost = quadrics[collapse.from].error(positions[collapse.to]);
+		}
+		std::stable_sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.cost < y.cost;
+		});
+
+		buildTriangleAdjacency(indices, vertexCount, adjacencyOffsets, adjacency);
+		std::iota(remap.begin(), remap.end(), 0u);
+		std::fill(collapseLocked.begin(), collapseLocked.end(), 0);
+
+		size_t triangleCount = indices.size() / 3;
+		size_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+		size_t removedTriangles = 0;
+		size_t collapseCount = 0;
+
+		for (const Collapse& collapse : collapses) {
+			if (collapse.cost > errorLimit || removedTriangles >= trianglesToRemove) break;
+			if (collapseLocked[collapse.from] || collapseLocked[collapse.to]) continue;
+
+			// Each vertex of the collapsed group must have a wedge to move to in the target group,
+			// found along an edge that disappears, otherwise attribute seams would tear apart.
+			// Triangles that remain must not flip.
+			const Vec3& target = positions[collapse.to];
+			bool valid = true;
+			size_t removedHere = 0;
+			wedges.clear();
+			uint32_t v = collapse.from;
+			do {
+				uint32_t wedge = unassigned;
+				bool used = false;
+				for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1] && valid; ++a) {
+					size_t t = adjacency[a];
+					uint32_t corners[3] = { remap[indices[3 * t + 0]], remap[indices[3 * t + 1]], remap[indices[3 * t + 2]] };
+					if (isDegenerate(corners[0], corners[1], corners[2])) continue;
+					used = true;
+
+					bool removed = false;
+					for (uint32_t c : corners) {
+						if (group[c] == collapse.to) {
+							removed = true;
+							if (wedge == unassigned) wedge = c;
+						}
+					}
+					if (removed) {
+						++removedHere;
+						continue;
+					}
+
+					Vec3 p[3] = { positions[corners[0]], positions[corners[1]], positions[corners[2]] };
+					Vec3 before = cross(p[1] - p[0], p[2] - p[0]);
+					for (int k = 0; k < 3; ++k) {
+						if (group[corners[k]] == collapse.from) p[k] = target;
+					}
+					Vec3 after = cross(p[1] - p[0], p[2] - p[0]);
+					// Reject flips, and normals rotating by more than about 75 degrees
+					valid = dot(before, after) >= 0.25f * std::sqrt(dot(before, before) * dot(after, after));
+				}
+				if (used && wedge == unassigned) valid = false;
+				if (!valid) break;
+				if (used) wedges.push_back({ v, wedge });
+				v = nextInGroup[v];
+			} while (v != collapse.from);
+			if (!valid) continue;
+
+			for (auto [from, to] : wedges) {
+				remap[from] = to;
+			}
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			collapseLocked[collapse.from] = 1;
+			collapseLocked[collapse.to] = 1;
+			removedTriangles += removedHere;
+			maxError = std::max(maxError, collapse.cost);
+			++collapseCount;
+		}
+
+		if (collapseCount == 0) break;
+
+		size_t kept = 0;
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			uint32_t a = remap[indices[i + 0]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+			if (isDegenerate(a, b, c)) continue;
+			indices[kept++] = a;
+			indices[kept++] = b;
+			indices[kept++] = c;
+		}
+		indices.resize(kept);
+		countEdges();
+	}
+
+	return static_cast<float>(std::sqrt(maxError));
+}
+
+// Compute the bounding sphere and normal cone of the triangles indices[begin, end)
+static void computeMeshletBounds(const uint32_t* indices, size_t begin, size_t end, const void* vertices, size_t vertexSize, MeshOptimizer::Meshlet& meshlet) {
+	// Sphere centered on the bounding box
+	Vec3 minimum = positionOf(vertices, vertexSize, indices[begin]);
+	Vec3 maximum = minimum;
+	for (size_t i = begin; i < end; ++i) {
+		Vec3 p = positionOf(vertices, vertexSize, indices[i]);
+		minimum = { std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z) };
+		maximum = { std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z) };
+	}
+	Vec3 center = (minimum + maximum) * 0.5f;
+	float radius = 0.0f;
+	for (size_t i = begin; i < end; ++i) {
+		Vec3 d = positionOf(vertices, vertexSize, indices[i]) - center;
+		radius = std::max(radius, std::sqrt(dot(d, d)));
+	}
+
+	// The cone axis is the average normal, its opening angle is given by the normal that
+	// deviates the most from it
+	Vec3 axis = { 0, 0, 0 };
+	for (size_t i = begin; i < end; i += 3) {
+		Vec3 p0 = positionOf(vertices, vertexSize, indices[i + 0]);
+		Vec3 n = cross(positionOf(vertices, vertexSize, indices[i + 1]) - p0, positionOf(vertices, vertexSize, indices[i + 2]) - p0);
+		axis = axis + normalize(n);
+	}
+	axis = normalize(axis);
+
+	float minDot = 1.0f;
+	for (size_t i = begin; i < end; i += 3) {
+		Vec3 p0 = positionOf(vertices, vertexSize, indices[i + 0]);
+		Vec3 n = cross(positionOf(vertices, vertexSize, indices[i + 1]) - p0, positionOf(vertices, vertexSize, indices[i + 2]) - p0);
+		if (dot(n, n) == 0.0f) continue;
+		minDot = std::min(minDot, dot(axis, normalize(n)));
+	}
+
+	meshlet.boundingSphere = { center.x, center.y, center.z, radius };
+	if (dot(axis, axis) == 0.0f || minDot <= 0.1f) {
+		// Cone too wide to ever cull anything
+		meshlet.coneApex = { center.x, center.y, center.z, 0.0f };
+		meshlet.coneAxisCutoff = { 0.0f, 0.0f, 0.0f, 2.0f };
+		return;
+	}
+
+	// Move the apex back along the axis until it is behind all triangle planes, so that
+	// any view direction within the cone sees only back faces
+	float apexDistance = 0.0f;
+	for (size_t i = begin; i < end; i += 3) {
+		Vec3 p0 = positionOf(vertices, vertexSize, indices[i + 0]);
+		Vec3 n = cross(positionOf(vertices, vertexSize, indices[i + 1]) - p0, positionOf(vertices, vertexSize, indices[i + 2]) - p0);
+		if (dot(n, n) == 0.0f) continue;
+		n = normalize(n);
+		apexDistance = std::max(apexDistance, dot(center - p0, n) / dot(axis, n));
+	}
+	Vec3 apex = center - axis * apexDistance;
+	meshlet.coneApex = { apex.x, apex.y, apex.z, 0.0f };
+	meshlet.coneAxisCutoff = { axis.x, axis.y, axis.z, std::sqrt(1.0f - minDot * minDot) };
+}
+
+void MeshOptimizer::buildMeshlets(const uint32_t* indices, size_t indexCount, uint32_t indexOffset, const void* vertices, size_t vertexCount, size_t vertexSize, std::vector<Meshlet>& meshlets, uint32_t maxVertices, uint32_t maxTriangles) {
+	constexpr uint32_t unassigned = ~0u;
+	// Last meshlet that used each vertex, to count distinct vertices
+	std::vector<uint32_t> lastMeshlet(vertexCount, unassigned);
+
+	size_t begin = 0;
+	uint32_t meshletVertexCount = 0;
+	auto flush = [&](size_t end) {
+		if (end == begin) return;
+		Meshlet meshlet{};
+		meshlet.indexOffset = indexOffset + static_cast<uint32_t>(begin);
+		meshlet.indexCount = static_cast<uint32_t>(end - begin);
+		meshlet.vertexCount = meshletVertexCount;
+		computeMeshletBounds(indices, begin, end, vertices, vertexSize, meshlet);
+		meshlets.push_back(meshlet);
+		begin = end;
+		meshletVertexCount = 0;
+	};
+
+	// Number of vertices of triangle i not in meshlet id yet
+	auto countNewVertices = [&](size_t i, uint32_t id) {
+		uint32_t count = 0;
+		for (int k = 0; k < 3; ++k) {
+			uint32_t v = indices[i + k];
+			bool repeated = (k > 0 && v == indices[i]) || (k > 1 && v == indices[i + 1]);
+			count += lastMeshlet[v] != id && !repeated;
+		}
+		return count;
+	};
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		uint32_t id = static_cast<uint32_t>(meshlets.size());
+		uint32_t newVertices = countNewVertices(i, id);
+		bool full = meshletVertexCount + newVertices > maxVertices || (i - begin) / 3 + 1 > maxTriangles;
+		// A triangle disconnected from a meshlet already well filled most likely starts a
+		// distant patch (e.g., the next overdraw cluster), which would loosen the bounds
+		bool disconnected = newVertices == 3 && meshletVertexCount >= maxVertices / 2;
+		if (full || disconnected) {
+			flush(i);
+			id = static_cast<uint32_t>(meshlets.size());
+			newVertices = countNewVertices(i, id);
+		}
+		for (int k = 0; k < 3; ++k) {
+			lastMeshlet[indices[i + k]] = id;
+		}
+		meshletVertexCount += newVertices;
+	}
+	flush(indexCount - indexCount % 3);
+}
+
+void MeshOptimizer::buildClusterLod(std::vector<uint32_t>& indices, uint32_t indexOffset, size_t indexCount, const void* vertices, size_t vertexCount, size_t vertexSize, std::vector<ClusterLodNode>& nodes, uint32_t maxVertices, uint32_t maxTriangles) {
+	// Clusters merged together per group, chosen among those sharing the most border with them
+	constexpr size_t groupSize = 4;
+	// Groups that keep more of their triangles than this are not worth a coarser version
+	constexpr size_t maxKeptPercent = 85;
+	constexpr uint32_t unassigned = ~0u;
+
+	// Positions, rather than vertices, are what seams share
+	std::vector<uint32_t> position;
+	weldPositions(vertices, vertexSize, vertexCount, position);
+
+	// The finest clusters, with no simplification error
+	std::vector<Meshlet> meshlets;
+	buildMeshlets(indices.data() + indexOffset, indexCount, indexOffset, vertices, vertexCount, vertexSize, meshlets, maxVertices, maxTriangles);
+	std::vector<uint32_t> level;
+	for (const Meshlet& meshlet : meshlets) {
+		level.push_back(static_cast<uint32_t>(nodes.size()));
+		nodes.push_back({ meshlet.boundingSphere, glm::vec4(0.0f), 0.0f, -1.0f, meshlet.indexOffset, meshlet.indexCount });
+	}
+
+	std::vector<uint8_t> locked(vertexCount);
+	std::vector<uint32_t> positionGroup(vertexCount);
+	std::vector<uint32_t> globalToLocal(vertexCount, unassigned);
+	std::vector<uint32_t> localToGlobal;
+	std::vector<uint32_t> localIndices;
+	std::vector<uint32_t> coarseIndices;
+	std::vector<unsigned char> localVertices;
+	std::vector<uint8_t> localLocked;
+	std::vector<Meshlet> coarse;
+
+	while (level.size() > 1) {
+		// Number of positions each cluster of the level shares with each other one
+		std::vector<std::pair<uint32_t, uint32_t>> uses;
+		for (uint32_t c = 0; c < level.size(); ++c) {
+			const ClusterLodNode& node = nodes[level[c]];
+			for (uint32_t i = node.indexOffset; i < node.indexOffset + node.indexCount; ++i) {
+				uses.push_back({ position[indices[i]], c });
+			}
+		}
+		std::sort(uses.begin(), uses.end());
+		uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+		std::vector<std::unordered_map<uint32_t, uint32_t>> shared(level.size());
+		for (size_t begin = 0, end = 0; begin < uses.size(); begin = end) {
+			while (end < uses.size() && uses[end].first == uses[begin].first) ++end;
+			for (size_t a = begin; a < end; ++a) {
+				for (size_t b = a + 1; b < end; ++b) {
+					++shared[uses[a].second][uses[b].second];
+					++shared[uses[b].second][uses[a].second];
+				}
+			}
+		}
+
+		// Groups grown from each cluster left in order, which keeps them compact since
+		// clusters follow the order of the triangles
+		std::vector<uint32_t> groupOf(level.size(), unassigned);
+		std::vector<std::vector<uint32_t>> groups;
+		for (uint32_t seed = 0; seed < level.size(); ++seed) {
+			if (groupOf[seed] != unassigned) continue;
+			uint32_t g = static_cast<uint32_t>(groups.size());
+			groups.push_back({ seed });
+			groupOf[seed] = g;
+			while (groups[g].size() < groupSize) {
+				uint32_t best = unassigned;
+				uint32_t bestShared = 0;
+				for (uint32_t member : groups[g]) {
+					for (auto [neighbour, count] : shared[member]) {
+						if (groupOf[neighbour] != unassigned || count < bestShared || (count == bestShared && neighbour > best)) continue;
+						best = neighbour;
+						bestShared = count;
+					}
+				}
+				if (best == unassigned) break;
+				groups[g].push_back(best);
+				groupOf[best] = g;
+			}
+		}
+
+		// Borders between groups stay in place, so that neighbours simplified or not still match
+		std::fill(locked.begin(), locked.end(), 0);
+		std::fill(positionGroup.begin(), positionGroup.end(), unassigned);
+		for (uint32_t c = 0; c < level.size(); ++c) {
+			const ClusterLodNode& node = nodes[level[c]];
+			for (uint32_t i = node.indexOffset; i < node.indexOffset + node.indexCount; ++i) {
+				uint32_t p = position[indices[i]];
+				if (positionGroup[p] == unassigned) positionGroup[p] = groupOf[c];
+				else if (positionGroup[p] != groupOf[c]) locked[p] = 1;
+			}
+		}
+
+		std::vector<uint32_t> next;
+		bool merged = false;
+		for (const std::vector<uint32_t>& group : groups) {
+			// The triangles of the group on a copy of its vertices only, which simplify()
+			// processes in time proportional to their count
+			glm::vec4 bounds = nodes[level[group[0]]].bounds;
+			float error = 0.0f;
+			localIndices.clear();
+			localToGlobal.clear();
+			for (uint32_t member : group) {
+				const ClusterLodNode& node = nodes[level[member]];
+				bounds = mergeSpheres(bounds, node.bounds);
+				error = std::max(error, node.error);
+				for (uint32_t i = node.indexOffset; i < node.indexOffset + node.indexCount; ++i) {
+					uint32_t v = indices[i];
+					if (globalToLocal[v] == unassigned) {
+						globalToLocal[v] = static_cast<uint32_t>(localToGlobal.size());
+						localToGlobal.push_back(v);
+					}
+					localIndices.push_back(globalToLocal[v]);
+				}
+			}
+			localVertices.resize(localToGlobal.size() * vertexSize);
+			localLocked.resize(localToGlobal.size());
+			Vec3 minimum = positionOf(vertices, vertexSize, localToGlobal[0]);
+			Vec3 maximum = minimum;
+			for (size_t l = 0; l < localToGlobal.size(); ++l) {
+				uint32_t v = localToGlobal[l];
+				memcpy(localVertices.data() + l * vertexSize, static_cast<const unsigned char*>(vertices) + v * vertexSize, vertexSize);
+				localLocked[l] = locked[position[v]];
+				globalToLocal[v] = unassigned;
+				Vec3 p = positionOf(vertices, vertexSize, v);
+				minimum = { std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z) };
+				maximum = { std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z) };
+			}
+			float extent = std::max({ maximum.x - minimum.x, maximum.y - minimum.y, maximum.z - minimum.z });
+
+			size_t triangleCount = localIndices.size() / 3;
+			float relativeError = simplify(localIndices, localVertices.data(), localToGlobal.size(), vertexSize, triangleCount / 2 * 3, 1.0f, localLocked.data());
+			size_t coarseTriangleCount = localIndices.size() / 3;
+			bool reduced = coarseTriangleCount > 0 && coarseTriangleCount * 100 <= triangleCount * maxKeptPercent;
+			coarse.clear();
+			if (reduced) {
+				coarseIndices.resize(localIndices.size());
+				for (size_t i = 0; i < localIndices.size(); ++i) {
+					coarseIndices[i] = localToGlobal[localIndices[i]];
+				}
+				buildMeshlets(coarseIndices.data(), coarseIndices.size(), static_cast<uint32_t>(indices.size()), vertices, vertexCount, vertexSize, coarse, maxVertices, maxTriangles);
+				// Otherwise the next level would not shrink
+				reduced = coarse.size() < group.size();
+			}
+			// Left for the next level, grouped with other neighbours
+			if (!reduced) {
+				for (uint32_t member : group) next.push_back(level[member]);
+				continue;
+			}
+			merged = true;
+
+			// Errors add up from level to level, so that they never decrease towards the roots
+			float groupError = error + relativeError * extent;
+			for (uint32_t member : group) {
+				nodes[level[member]].parentBounds = bounds;
+				nodes[level[member]].parentError = groupError;
+			}
+			indices.insert(indices.end(), coarseIndices.begin(), coarseIndices.end());
+			for (const Meshlet& meshlet : coarse) {
+				next.push_back(static_cast<uint32_t>(nodes.size()));
+				nodes.push_back({ bounds, glm::vec4(0.0f), groupError, -1.0f, meshlet.indexOffset, meshlet.indexCount });
+			}
+		}
+		if (!merged) break;
+		level = std::move(next);
+	}
+}
+
+float MeshOptimizer::computeAcmr(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+	if (indexCount < 3) return 0.0f;
+	FifoCache cache(vertexCount, cacheSize);
+	size_t misses = 0;
+	for (size_t i = 0; i < indexCount; ++i) {
+		misses += cache.access(indices[i]);
+	}
+	return static_cast<float>(misses) / (indexCount / 3);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "MathConfig.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Index and vertex reordering passes applied to loaded meshes before upload.
+ * None of them changes the rendered result, only the order in which the GPU
+ * sees the data: triangles are reordered for post-transform vertex cache
+ * hits, clusters of triangles for less overdraw, and vertices for fetch
+ * locality.
+ *
+ * Vertices are handled as opaque blobs of `vertexSize` bytes, with positions
+ * given as 3 floats at the beginning of each vertex, so that the passes can
+ * be used with any vertex layout.
+ */
+class MeshOptimizer {
+public:
+	// Size of the FIFO post-transform cache assumed by the passes and by computeAcmr
+	static constexpr uint32_t defaultCacheSize = 32;
+
+	/**
+	 * A cluster of consecutive triangles of an index buffer, with what is needed to cull it
+	 * as a whole. Laid out to be uploaded as is into a storage buffer of WGSL structures:
+	 *   struct Meshlet {
+	 *     boundingSphere: vec4f, coneApex: vec4f, coneAxisCutoff: vec4f,
+	 *     indexOffset: u32, indexCount: u32, vertexCount: u32,
+	 *   };
+	 * The meshlet is entirely back facing, hence can be culled, if
+	 *   dot(normalize(coneApex.xyz - cameraPosition), coneAxisCutoff.xyz) >= coneAxisCutoff.w
+	 * A cutoff greater than 1 means that the triangles face too many directions for this test.
+	 */
+	struct Meshlet {
+		// Center and radius
+		glm::vec4 boundingSphere;
+		glm::vec4 coneApex;
+		glm::vec4 coneAxisCutoff;
+		uint32_t indexOffset;
+		uint32_t indexCount;
+		uint32_t vertexCount;
+		uint32_t _pad;
+	};
+	static_assert(sizeof(Meshlet) == 64);
+
+	/**
+	 * A cluster of a continuous level of detail hierarchy (see buildClusterLod), as a WGSL
+	 * structure:
+	 *   struct ClusterLodNode {
+	 *     bounds: vec4f, parentBounds: vec4f,
+	 *     error: f32, parentError: f32, indexOffset: u32, indexCount: u32,
+	 *   };
+	 * Errors are model space distances, and bounds the spheres to project them from. Those of a
+	 * cluster are of the group it was simplified from, shared by its siblings, and those of its
+	 * parent of the group it was merged in to build a coarser one. A cut of the hierarchy without
+	 * holes nor overlaps is drawn by the clusters for which the error of the cluster is below a
+	 * threshold and the one of its parent above, which errors and bounds growing towards the
+	 * roots make consistent. Roots have a negative parentError.
+	 */
+	struct ClusterLodNode {
+		glm::vec4 bounds;
+		glm::vec4 parentBounds;
+		float error;
+		float parentError;
+		uint32_t indexOffset;
+		uint32_t indexCount;
+	};
+	static_assert(sizeof(ClusterLodNode) == 48);
+
+	// Reorder triangles for vertex cache locality, using Tipsify (Sander et al. 2007).
+	// If `clusters` is provided, it receives the index (in `indices`) at which each
+	// cluster of the new order starts, suitable for optimizeOverdraw.
+	static void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = defaultCacheSize, std::vector<size_t>* clusters = nullptr);
+
+	// Sort the clusters produced by optimizeVertexCache so that those most likely to
+	// occlude the others (facing outwards from the mesh center) are drawn first.
+	// Clusters are first split further as long as their ACMR stays within
+	// `threshold` times the one of the whole mesh, which bounds the cache cost.
+	static void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<size_t>& clusters, const void* vertices, size_t vertexCount, size_t vertexSize, float threshold = 1.05f, uint32_t cacheSize = defaultCacheSize);
+
+	// Renumber vertices in order of first use in `indices` and reorder `vertices`
+	// accordingly, dropping unused ones. Return the new vertex count.
+	static size_t optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize, std::vector<uint32_t>& indices);
+
+	// Simplify the mesh by collapsing edges in order of increasing quadric error (Garland and
+	// Heckbert 1997) until `indices` holds at most `targetIndexCount` indices or the next collapse
+	// would exceed `targetError`. Vertices are only moved onto existing ones, so the result uses
+	// the same vertex buffer. Vertices sharing a position (attribute seams) collapse together,
+	// and open borders only collapse along themselves. Errors are distances relative to the
+	// largest extent of the mesh. Vertices flagged in `lockedVertices`, if given, never move, nor
+	// any other at their position. Return the error reached.
+	static float simplify(std::vector<uint32_t>& indices, const void* vertices, size_t vertexCount, size_t vertexSize, size_t targetIndexCount, float targetError = 1.0f, const uint8_t* lockedVertices = nullptr);
+
+	// Split the triangles of indices[0, indexCount) into meshlets of consecutive triangles using at
+	// most `maxVertices` distinct vertices and `maxTriangles` triangles, and append them to `meshlets`.
+	// The order of the triangles is not changed, so it should already have some locality, like
+	// after optimizeVertexCache. Meshlet index offsets are relative to `indices` plus `indexOffset`.
+	static void buildMeshlets(const uint32_t* indices, size_t indexCount, uint32_t indexOffset, const void* vertices, size_t vertexCount, size_t vertexSize, std::vector<Meshlet>& meshlets, uint32_t maxVertices = 64, uint32_t maxTriangles = 124);
+
+	// Build a continuous level of detail hierarchy from the triangles indices[indexOffset,
+	// indexOffset + indexCount) and append its clusters to `nodes`: the triangles are split into
+	// meshlets, then groups of neighbouring meshlets are simplified to half their triangles with
+	// their borders with other groups locked, and split again, level by level until there is
+	// nothing left to merge. The triangles of coarser clusters are appended to `indices`. Clusters
+	// of groups that do not simplify enough are grouped again at the next level, and left as
+	// roots once no group does.
+	static void buildClusterLod(std::vector<uint32_t>& indices, uint32_t indexOffset, size_t indexCount, const void* vertices, size_t vertexCount, size_t vertexSize, std::vector<ClusterLodNode>& nodes, uint32_t maxVertices = 64, uint32_t maxTriangles = 124);
+
+	// Average cache miss ratio: transformed vertices per triangle with a FIFO cache.
+	// 3.0 is the worst case, around 0.5-0.7 is the best that can be reached.
+	static float computeAcmr(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = defaultCacheSize);
+};
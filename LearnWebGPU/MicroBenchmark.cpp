@@ -0,0 +1,742 @@
+/**
+ * Microbenchmarks of the CPU hot paths, timed in isolation from the renderer:
+ *   LearnWebGPU-bench [--repetitions <n>] [--filter <text>] [--max-image <size>]
+ *                     [--report <file.json>] [<file.obj>...]
+ *
+ * Each case runs once to warm caches and the job system up, then <n> times (10 by
+ * default), and reports the median, mean, standard deviation and minimum of its
+ * wall-clock times, with its throughput at the median: MB/s of the data it reads,
+ * and triangles, texels or elements per second.
+ *
+ * Cases cover OBJ parsing of synthetic grids of several sizes and of the files given
+ * (the .obj files of the resource directory by default), CPU mip-map generation of
+ * 512 to <max-image> (8192) square images, decoding of the images of the resource
+ * directory with the backend ImageDecoder picks for each, shader loading and preprocessing, shader
+ * module creation when an adapter is available, transform composition, frustum
+ * culling, float parsing next to std::from_chars, parallel decoding of compressed
+ * vertices and indices (see MeshCodec.h), and the handoff of values between threads through the lock-free queues
+ * and triple buffer, next to the mutex-guarded equivalents they replace, with one
+ * and several producers contending. Only the cases whose name contains the filter run.
+ */
+
+#include "ResourceManager.h"
+#include "ImageDecoder.h"
+#include "ShaderPreprocessor.h"
+#include "VertexLayout.h"
+#include "TransformStore.h"
+#include "FrustumCulling.h"
+#include "TextScanner.h"
+#include "MeshCodec.h"
+#include "ParallelFor.h"
+#include "LockFree.h"
+#include "webgpu-utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+struct Options {
+	uint32_t repetitions = 10;
+	std::string filter;
+	uint32_t maxImageSize = 8192;
+	std::string reportPath;
+	std::vector<std::filesystem::path> objPaths;
+};
+
+/**
+ * What a case processes per run, for its throughput
+ */
+struct Work {
+	uint64_t bytes = 0;
+	uint64_t items = 0;
+	// Unit of the items, e.g. "triangles"
+	const char* unit = "elements";
+};
+
+struct Result {
+	std::string name;
+	Work work;
+	// Milliseconds of each run, sorted
+	std::vector<double> times;
+
+	double median() const { return times[times.size() / 2]; }
+	double mean() const { return std::accumulate(times.begin(), times.end(), 0.0) / times.size(); }
+	double stddev() const {
+		double m = mean();
+		double sum = 0.0;
+		for (double t : times) sum += (t - m) * (t - m);
+		return times.size() > 1 ? std::sqrt(sum / (times.size() - 1)) : 0.0;
+	}
+};
+
+bool parseUint(const char* str, uint32_t& value) {
+	const char* end = str + std::strlen(str);
+	auto result = std::from_chars(str, end, value);
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+	bool valid = true;
+	for (int i = 1; i < argc && valid; ++i) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (std::strcmp(arg, "--repetitions") == 0 && value) {
+			valid = parseUint(value, options.repetitions) && options.repetitions > 0;
+			++i;
+		}
+		else if (std::strcmp(arg, "--filter") == 0 && value) {
+			options.filter = value;
+			++i;
+		}
+		else if (std::strcmp(arg, "--max-image") == 0 && value) {
+			valid = parseUint(value, options.maxImageSize) && options.maxImageSize >= 512;
+			++i;
+		}
+		else if (std::strcmp(arg, "--report") == 0 && value) {
+			options.reportPath = value;
+			++i;
+		}
+		else if (arg[0] != '-') {
+			options.objPaths.push_back(arg);
+		}
+		else {
+			valid = false;
+		}
+	}
+	if (!valid) {
+		std::cerr << "Usage: " << argv[0] << " [--repetitions <n>] [--filter <text>] [--max-image <size>] [--report <file.json>] [<file.obj>...]" << std::endl;
+	}
+	return valid;
+}
+
+/**
+ * Runs the cases and collects their results
+ */
+class Runner {
+public:
+	explicit Runner(const Options& options) : mOptions(options) {}
+
+	bool selected(const std::string& name) const {
+		return mOptions.filter.empty() || name.find(mOptions.filter) != std::string::npos;
+	}
+
+	// Time `run`, which returns false if it failed, after `setup` before every run. The
+	// output of the code measured (e.g. the loaders' log lines) is silenced.
+	void add(const std::string& name, const Work& work, const std::function<bool()>& run, const std::function<void()>& setup = nullptr) {
+		if (!selected(name)) return;
+		Result result;
+		result.name = name;
+		result.work = work;
+		for (uint32_t i = 0; i <= mOptions.repetitions; ++i) {
+			if (setup) setup();
+			std::streambuf* output = std::cout.rdbuf(nullptr);
+			auto start = std::chrono::steady_clock::now();
+			bool succeeded = run();
+			auto end = std::chrono::steady_clock::now();
+			std::cout.rdbuf(output);
+			std::cout.clear();
+			if (!succeeded) {
+				std::cerr << name << " failed" << std::endl;
+				mFailed = true;
+				return;
+			}
+			// The first run warms up
+			if (i > 0) result.times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		std::sort(result.times.begin(), result.times.end());
+		print(result);
+		mResults.push_back(std::move(result));
+	}
+
+	bool failed() const { return mFailed; }
+
+	bool writeReport() const {
+		std::ostringstream report;
+		report << std::fixed << std::setprecision(3);
+		report << "{\n  \"repetitions\": " << mOptions.repetitions << ",\n  \"cases\": {";
+		const char* separator = "\n    ";
+		for (const Result& result : mResults) {
+			double seconds = result.median() * 1e-3;
+			report << separator << '"' << result.name << "\": { \"medianMs\": " << result.median()
+				<< ", \"meanMs\": " << result.mean() << ", \"stddevMs\": " << result.stddev()
+				<< ", \"minMs\": " << result.times.front()
+				<< ", \"megabytesPerSecond\": " << result.work.bytes / seconds * 1e-6
+				<< ", \"" << result.work.unit << "PerSecond\": " << result.work.items / seconds << " }";
+			separator = ",\n    ";
+		}
+		report << (mResults.empty() ? "" : "\n  ") << "}\n}\n";
+
+		std::ofstream file(mOptions.reportPath);
+		file << report.str();
+		if (!file) {
+			std::cerr << "Could not write the report to " << mOptions.reportPath << std::endl;
+			return false;
+		}
+		std::cout << "Wrote the report to " << mOptions.reportPath << std::endl;
+		return true;
+	}
+
+private:
+	static void print(const Result& result) {
+		double seconds = result.median() * 1e-3;
+		std::cout << std::left << std::setw(36) << result.name << std::right << std::fixed
+			<< std::setprecision(3)
+			<< " median " << std::setw(10) << result.median() << " ms"
+			<< "  mean " << std::setw(10) << result.mean() << " ms"
+			<< " +- " << std::setw(8) << result.stddev()
+			<< "  min " << std::setw(10) << result.times.front() << " ms"
+			<< std::setprecision(1)
+			<< "  " << std::setw(9) << result.work.bytes / seconds * 1e-6 << " MB/s"
+			<< "  " << std::setw(9) << result.work.items / seconds * 1e-6 << " M" << result.work.unit << "/s"
+			<< std::endl;
+	}
+
+private:
+	const Options& mOptions;
+	std::vector<Result> mResults;
+	bool mFailed = false;
+};
+
+// An OBJ file of a `size` x `size` grid of quads, each split in 2 triangles, with normals
+// and texture coordinates, returning its triangle count
+uint64_t writeGridObj(const std::filesystem::path& path, uint32_t size) {
+	std::ofstream file(path);
+	file << std::fixed << std::setprecision(6);
+	uint32_t side = size + 1;
+	for (uint32_t y = 0; y < side; ++y) {
+		for (uint32_t x = 0; x < side; ++x) {
+			float u = x / float(size);
+			float v = y / float(size);
+			file << "v " << u << ' ' << v << ' ' << 0.1f * std::sin(8.0f * u) * std::cos(8.0f * v) << '\n';
+			file << "vt " << u << ' ' << v << '\n';
+			file << "vn 0 0 1\n";
+		}
+	}
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			// OBJ indices start at 1
+			uint32_t a = y * side + x + 1;
+			uint32_t b = a + 1;
+			uint32_t c = a + side;
+			uint32_t d = c + 1;
+			file << "f " << a << '/' << a << '/' << a << ' ' << b << '/' << b << '/' << b << ' ' << d << '/' << d << '/' << d << '\n';
+			file << "f " << a << '/' << a << '/' << a << ' ' << d << '/' << d << '/' << d << ' ' << c << '/' << c << '/' << c << '\n';
+		}
+	}
+	file.close();
+	return file ? uint64_t(2) * size * size : 0;
+}
+
+void benchmarkObj(Runner& runner, const std::string& name, const std::filesystem::path& path, uint64_t triangleCount) {
+	std::error_code ec;
+	uint64_t fileSize = std::filesystem::file_size(path, ec);
+	if (ec) {
+		std::cerr << "Could not read the size of " << path << " (" << ec.message() << ")" << std::endl;
+		return;
+	}
+
+	std::vector<ResourceManager::VertexAttributes> vertexData;
+	std::vector<uint32_t> indexData;
+	// Triangles of real files are only known once parsed
+	if (triangleCount == 0 && runner.selected(name)) {
+		std::streambuf* output = std::cout.rdbuf(nullptr);
+		ResourceManager::loadGeometryFromObj(path, vertexData, indexData);
+		std::cout.rdbuf(output);
+		std::cout.clear();
+		triangleCount = indexData.size() / 3;
+	}
+	runner.add(name, { fileSize, triangleCount, "triangles" }, [&]() {
+		return ResourceManager::loadGeometryFromObj(path, vertexData, indexData);
+	}, [&]() {
+		vertexData.clear();
+		indexData.clear();
+	});
+}
+
+// Decoding for textures of at most `maxSize` texels, 0 for the full size
+void benchmarkImageDecode(Runner& runner, const std::filesystem::path& path, uint32_t maxSize) {
+	MappedFile file;
+	if (!file.open(path)) return;
+	std::span<const std::byte> data(file.data(), file.size());
+	std::string name = "image decode " + path.filename().string() + " (" + ImageDecoder::backendName(ImageDecoder::detect(data, path)) + ")";
+	if (maxSize > 0) name += " max " + std::to_string(maxSize);
+	if (!runner.selected(name)) return;
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	if (!ImageDecoder::decode(data, path, width, height, maxSize)) {
+		std::cerr << "Could not decode " << path << std::endl;
+		return;
+	}
+	runner.add(name, { data.size(), uint64_t(width) * height, "texels" }, [&]() {
+		return ImageDecoder::decode(data, path, width, height, maxSize) != nullptr;
+	});
+}
+
+void benchmarkMipMaps(Runner& runner, uint32_t size) {
+	std::string name = "mip-maps " + std::to_string(size) + "x" + std::to_string(size);
+	if (!runner.selected(name)) return;
+
+	// A noisy image, so that filtering cannot take shortcuts
+	ResourceManager::Image image;
+	image.width = size;
+	image.height = size;
+	size_t byteCount = size_t(size) * size * 4;
+	image.pixels = { static_cast<unsigned char*>(std::malloc(byteCount)), std::free };
+	if (!image.pixels) {
+		std::cerr << "Could not allocate a " << size << "x" << size << " image" << std::endl;
+		return;
+	}
+	std::minstd_rand random(size);
+	for (size_t i = 0; i < byteCount; ++i) image.pixels.get()[i] = static_cast<unsigned char>(random());
+
+	ResourceManager::TextureLoadOptions options;
+	options.srgb = true;
+	runner.add(name, { byteCount, uint64_t(size) * size, "texels" }, [&]() {
+		ResourceManager::buildMipMaps(image, options);
+		return image.mipMaps != nullptr;
+	}, [&]() {
+		image.mipMaps.reset();
+		image.mipLevelCount = 1;
+	});
+}
+
+// A device of the default adapter, for the shader module cases, or null if there is none
+Device createHeadlessDevice(Instance instance) {
+	RequestAdapterOptions adapterOptions{};
+	adapterOptions.compatibleSurface = nullptr;
+	adapterOptions.powerPreference = PowerPreference::HighPerformance;
+	Adapter adapter = requestAdapterSync(instance, &adapterOptions);
+	if (!adapter) return nullptr;
+	DeviceDescriptor deviceDesc{};
+	deviceDesc.label = "Benchmark device";
+	Device device = requestDeviceSync(adapter, &deviceDesc);
+	adapter.release();
+	return device;
+}
+
+void benchmarkShaders(Runner& runner, Device device) {
+	VertexLayout vertexLayout;
+	std::filesystem::path shaderPath = RESOURCE_DIR "/shader.wgsl";
+	std::error_code ec;
+	uint64_t shaderSize = std::filesystem::file_size(shaderPath, ec);
+	if (ec) {
+		std::cerr << "Could not read the size of " << shaderPath << " (" << ec.message() << ")" << std::endl;
+		return;
+	}
+
+	// The variant of the application with every feature enabled
+	ShaderPreprocessor::Defines defines = { "LIGHTING", "SHADOWS", "CLUSTERED_LIGHTS", "OBJECT_IDS" };
+	std::string variantSource;
+	runner.add("shader load and preprocess", { shaderSize, 1, "shaders" }, [&]() {
+		std::string source = vertexLayout.wgslDeclarations();
+		return ResourceManager::loadShaderSource(shaderPath, source) && ShaderPreprocessor::process(source, defines, variantSource);
+	});
+	if (!device) {
+		if (runner.selected("shader module")) std::cout << "No adapter, skipping the shader module cases" << std::endl;
+		return;
+	}
+
+	// Modules are released right away, drivers only compiling them along with pipelines
+	runner.add("shader module (depth pre-pass)", { shaderSize, 1, "shaders" }, [&]() {
+		ShaderModule module = ResourceManager::loadShaderModule(RESOURCE_DIR "/depth_prepass.wgsl", device, vertexLayout.wgslPositionDeclarations());
+		if (!module) return false;
+		module.release();
+		return true;
+	});
+	if (variantSource.empty()) return;
+	runner.add("shader module (main variant)", { variantSource.size(), 1, "shaders" }, [&]() {
+		ShaderModule module = ResourceManager::createShaderModule(variantSource, device);
+		if (!module) return false;
+		module.release();
+		return true;
+	});
+}
+
+void benchmarkTransforms(Runner& runner, uint32_t rootCount, uint32_t childCount) {
+	std::string name = "transforms " + std::to_string(rootCount) + "x" + std::to_string(childCount);
+	if (!runner.selected(name)) return;
+
+	// Roots moved every run, their children along with them
+	TransformStore store;
+	std::vector<uint32_t> roots;
+	for (uint32_t r = 0; r < rootCount; ++r) {
+		uint32_t root = store.add();
+		roots.push_back(root);
+		for (uint32_t c = 0; c < childCount; ++c) {
+			uint32_t child = store.add(root);
+			store.setPosition(child, glm::vec3(float(c), 0.0f, 0.0f));
+			store.setScale(child, glm::vec3(0.5f));
+		}
+	}
+	store.update();
+
+	uint64_t nodeCount = store.size();
+	float angle = 0.0f;
+	runner.add(name, { nodeCount * sizeof(glm::mat4), nodeCount, "nodes" }, [&]() {
+		store.update();
+		return true;
+	}, [&]() {
+		angle += 0.01f;
+		glm::quat rotation = glm::angleAxis(angle, glm::vec3(0.0f, 0.0f, 1.0f));
+		for (uint32_t root : roots) store.setRotation(root, rotation);
+	});
+}
+
+void benchmarkCulling(Runner& runner, uint32_t sphereCount) {
+	std::string name = "frustum culling " + std::to_string(sphereCount);
+	if (!runner.selected(name)) return;
+
+	// Spheres filling a cube around a camera looking at its center, about a third of them visible
+	BoundingSpheres spheres;
+	spheres.reserve(sphereCount);
+	std::minstd_rand random(sphereCount);
+	std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> radius(0.1f, 1.0f);
+	for (uint32_t i = 0; i < sphereCount; ++i) {
+		spheres.push_back(glm::vec3(position(random), position(random), position(random)), radius(random));
+	}
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, -60.0f, 0.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 projection = glm::perspectiveZO(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+	Frustum frustum = Frustum::fromMatrix(projection * view);
+	std::vector<uint32_t> visible(sphereCount);
+
+	runner.add(name, { uint64_t(sphereCount) * 4 * sizeof(float), sphereCount, "spheres" }, [&]() {
+		return cullSpheres(frustum, spheres, visible.data()) <= sphereCount;
+	});
+}
+
+// Conversion of the coordinates of a text geometry file, through text::parseFloat and through
+// the std::from_chars it falls back to
+void benchmarkFloatParsing(Runner& runner, uint32_t valueCount) {
+	const std::string suffix = " " + std::to_string(valueCount);
+	if (!runner.selected("float parsing" + suffix) && !runner.selected("float from_chars" + suffix)) return;
+
+	// Written like the exporters do, with 6 decimals
+	std::string source;
+	std::minstd_rand random(valueCount);
+	std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+	char number[32];
+	for (uint32_t i = 0; i < valueCount; ++i) {
+		int length = std::snprintf(number, sizeof(number), "%.6f ", coordinate(random));
+		source.append(number, static_cast<size_t>(length));
+	}
+	const char* begin = source.data();
+	const char* end = begin + source.size();
+	float sum = 0.0f;
+
+	runner.add("float parsing" + suffix, { source.size(), valueCount, "floats" }, [&]() {
+		float value = 0.0f;
+		uint32_t count = 0;
+		for (const char* p = begin; p && p < end; ++count) {
+			p = text::parseFloat(p, end, value);
+			sum += value;
+			if (p) ++p;
+		}
+		return count == valueCount;
+	});
+	runner.add("float from_chars" + suffix, { source.size(), valueCount, "floats" }, [&]() {
+		float value = 0.0f;
+		uint32_t count = 0;
+		for (const char* p = begin; p < end; ++count) {
+			auto [next, ec] = std::from_chars(p, end, value);
+			if (ec != std::errc()) return false;
+			sum += value;
+			p = next + 1;
+		}
+		return count == valueCount;
+	});
+}
+
+// Decoding of the vertices and indices of a sphere of `gridSize` by `gridSize` vertices, in the
+// order a grid is written in, encoded by MeshCodec, with the chunks decoded in parallel
+void benchmarkMeshDecoding(Runner& runner, uint32_t gridSize) {
+	const std::string suffix = " " + std::to_string(gridSize) + "x" + std::to_string(gridSize);
+	if (!runner.selected("vertex decoding" + suffix) && !runner.selected("index decoding" + suffix)) return;
+
+	std::vector<ResourceManager::VertexAttributes> vertices;
+	std::vector<uint32_t> indices;
+	vertices.reserve(size_t(gridSize) * gridSize);
+	for (uint32_t y = 0; y < gridSize; ++y) {
+		for (uint32_t x = 0; x < gridSize; ++x) {
+			glm::vec2 uv = glm::vec2(x, y) / float(gridSize - 1);
+			float theta = 2.0f * glm::pi<float>() * uv.x;
+			float phi = glm::pi<float>() * uv.y;
+			glm::vec3 normal = { std::sin(phi) * std::cos(theta), std::sin(phi) * std::sin(theta), std::cos(phi) };
+			vertices.push_back({ 2.0f * normal, normal, glm::vec3(1.0f), uv });
+		}
+	}
+	for (uint32_t y = 0; y + 1 < gridSize; ++y) {
+		for (uint32_t x = 0; x + 1 < gridSize; ++x) {
+			uint32_t i = y * gridSize + x;
+			indices.insert(indices.end(), { i, i + 1, i + gridSize, i + 1, i + gridSize + 1, i + gridSize });
+		}
+	}
+	std::vector<std::byte> encodedVertices;
+	std::vector<std::byte> encodedIndices;
+	MeshCodec::encodeVertexBuffer(vertices.data(), vertices.size(), sizeof(ResourceManager::VertexAttributes), encodedVertices);
+	MeshCodec::encodeIndexBuffer(indices.data(), indices.size(), encodedIndices);
+	std::vector<ResourceManager::VertexAttributes> decodedVertices(vertices.size());
+	std::vector<uint32_t> decodedIndices(indices.size());
+
+	// Throughput in bytes decoded, the input being a fraction of it
+	uint64_t vertexBytes = vertices.size() * sizeof(ResourceManager::VertexAttributes);
+	runner.add("vertex decoding" + suffix, { vertexBytes, vertices.size(), "vertices" }, [&]() {
+		std::atomic<bool> valid = true;
+		parallelForRanges(MeshCodec::chunkCount(vertices.size(), MeshCodec::vertexChunkSize), [&](size_t begin, size_t end) {
+			if (!MeshCodec::decodeVertexBuffer(decodedVertices.data(), vertices.size(), sizeof(ResourceManager::VertexAttributes), encodedVertices, begin, end)) valid = false;
+		}, 1);
+		return valid.load();
+	});
+	runner.add("index decoding" + suffix, { indices.size() * sizeof(uint32_t), indices.size(), "indices" }, [&]() {
+		std::atomic<bool> valid = true;
+		parallelForRanges(MeshCodec::chunkCount(indices.size(), MeshCodec::indexChunkSize), [&](size_t begin, size_t end) {
+			if (!MeshCodec::decodeIndexBuffer(decodedIndices.data(), indices.size(), encodedIndices, begin, end)) valid = false;
+		}, 1);
+		return valid.load();
+	});
+	// Compared once rather than in the timed runs
+	bool verticesDiffer = runner.selected("vertex decoding" + suffix) && std::memcmp(decodedVertices.data(), vertices.data(), vertexBytes) != 0;
+	bool indicesDiffer = runner.selected("index decoding" + suffix) && decodedIndices != indices;
+	if (verticesDiffer || indicesDiffer) {
+		std::cerr << "Mesh codec" << suffix << ": the decoded mesh differs from the encoded one" << std::endl;
+	}
+	std::cout << "Mesh codec" << suffix << ": vertices " << (vertexBytes >> 10) << " KiB to " << (encodedVertices.size() >> 10)
+		<< " KiB, indices " << ((indices.size() * sizeof(uint32_t)) >> 10) << " KiB to " << (encodedIndices.size() >> 10) << " KiB" << std::endl;
+}
+
+// Values handed over by each run of the handoff cases
+constexpr uint64_t HandoffCount = 1 << 20;
+
+// Push `count` values split among `producerCount` threads through `push`, which returns false
+// when full, while the calling thread pops them with `pop`. Return whether the values of each
+// producer arrived once and in order.
+template <typename Push, typename Pop>
+bool runHandoff(uint32_t producerCount, uint64_t count, const Push& push, const Pop& pop) {
+	const uint64_t perProducer = count / producerCount;
+	std::vector<std::thread> producers;
+	for (uint32_t p = 0; p < producerCount; ++p) {
+		producers.emplace_back([&push, p, perProducer]() {
+			for (uint64_t i = 0; i < perProducer; ++i) {
+				while (!push((uint64_t(p) << 48) | i)) std::this_thread::yield();
+			}
+		});
+	}
+	std::vector<uint64_t> expected(producerCount, 0);
+	bool ordered = true;
+	uint64_t value = 0;
+	for (uint64_t received = 0; received < perProducer * producerCount;) {
+		if (!pop(value)) {
+			std::this_thread::yield();
+			continue;
+		}
+		uint64_t& next = expected[value >> 48];
+		ordered = ordered && (value & ((uint64_t(1) << 48) - 1)) == next;
+		++next;
+		++received;
+	}
+	for (std::thread& producer : producers) producer.join();
+	return ordered;
+}
+
+void benchmarkHandoff(Runner& runner, uint32_t producerCount) {
+	const std::string suffix = " " + std::to_string(producerCount) + (producerCount > 1 ? " producers" : " producer");
+	const Work work = { HandoffCount * sizeof(uint64_t), HandoffCount, "values" };
+
+	if (producerCount == 1) {
+		SpscQueue<uint64_t, 1024> spsc;
+		runner.add("handoff spsc queue" + suffix, work, [&]() {
+			return runHandoff(1, HandoffCount,
+				[&spsc](uint64_t value) { return spsc.push(value); },
+				[&spsc](uint64_t& value) { return spsc.pop(value); });
+		});
+	}
+
+	MpscQueue<uint64_t, 1024> mpsc;
+	runner.add("handoff mpsc queue" + suffix, work, [&]() {
+		return runHandoff(producerCount, HandoffCount,
+			[&mpsc](uint64_t value) { return mpsc.push(value); },
+			[&mpsc](uint64_t& value) { return mpsc.pop(value); });
+	});
+
+	// What the asset loader and device events did before, popping one value per lock like a
+	// frame thread polling would
+	std::mutex mutex;
+	std::deque<uint64_t> deque;
+	runner.add("handoff mutex deque" + suffix, work, [&]() {
+		return runHandoff(producerCount, HandoffCount,
+			[&](uint64_t value) {
+				std::lock_guard<std::mutex> lock(mutex);
+				deque.push_back(value);
+				return true;
+			},
+			[&](uint64_t& value) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (deque.empty()) return false;
+				value = deque.front();
+				deque.pop_front();
+				return true;
+			});
+	});
+}
+
+/**
+ * A camera-sized state, whose fields must be read from the same publication
+ */
+struct Snapshot {
+	glm::mat4 viewMatrix = glm::mat4(1.0f);
+	uint64_t sequence = 0;
+};
+
+// Publish `count` snapshots from another thread while the calling thread keeps reading the
+// latest one through `read`, returning whether every snapshot read was whole and none older
+// than the previous one
+template <typename Write, typename Read>
+bool runSnapshots(uint64_t count, const Write& write, const Read& read) {
+	std::thread writer([&write, count]() {
+		for (uint64_t i = 1; i <= count; ++i) write(i);
+	});
+	bool consistent = true;
+	Snapshot snapshot;
+	for (uint64_t last = 0; last < count;) {
+		read(snapshot);
+		consistent = consistent && snapshot.sequence >= last && snapshot.viewMatrix[3][0] == float(snapshot.sequence);
+		last = snapshot.sequence;
+	}
+	writer.join();
+	return consistent;
+}
+
+void benchmarkSnapshots(Runner& runner) {
+	const uint64_t count = HandoffCount / 4;
+	const Work work = { count * sizeof(Snapshot), count, "snapshots" };
+	auto fill = [](Snapshot& snapshot, uint64_t sequence) {
+		snapshot.viewMatrix[3][0] = float(sequence);
+		snapshot.sequence = sequence;
+	};
+
+	runner.add("handoff triple buffer", work, [&]() {
+		TripleBuffer<Snapshot> buffer;
+		return runSnapshots(count,
+			[&](uint64_t sequence) {
+				fill(buffer.write(), sequence);
+				buffer.publish();
+			},
+			[&](Snapshot& snapshot) {
+				buffer.update();
+				snapshot = buffer.read();
+			});
+	});
+
+	std::mutex mutex;
+	Snapshot shared;
+	runner.add("handoff mutex snapshot", work, [&]() {
+		shared = Snapshot();
+		return runSnapshots(count,
+			[&](uint64_t sequence) {
+				std::lock_guard<std::mutex> lock(mutex);
+				fill(shared, sequence);
+			},
+			[&](Snapshot& snapshot) {
+				std::lock_guard<std::mutex> lock(mutex);
+				snapshot = shared;
+			});
+	});
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) return 1;
+	Runner runner(options);
+
+	// Synthetic grids from 2K to 2M triangles, written to the temporary directory
+	std::error_code ec;
+	std::filesystem::path tempDir = std::filesystem::temp_directory_path(ec);
+	for (uint32_t size : { 32u, 128u, 512u, 1024u }) {
+		std::string name = "obj grid " + std::to_string(uint64_t(2) * size * size) + " triangles";
+		if (!runner.selected(name)) continue;
+		std::filesystem::path path = tempDir / ("learnwebgpu-bench-grid-" + std::to_string(size) + ".obj");
+		if (uint64_t triangleCount = writeGridObj(path, size)) {
+			benchmarkObj(runner, name, path, triangleCount);
+		}
+		else {
+			std::cerr << "Could not write " << path << std::endl;
+		}
+		std::filesystem::remove(path, ec);
+	}
+
+	// Real models, those of the resource directory unless some are given
+	if (options.objPaths.empty()) {
+		for (auto it = std::filesystem::directory_iterator(RESOURCE_DIR, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+			if (it->is_regular_file() && it->path().extension() == ".obj") options.objPaths.push_back(it->path());
+		}
+		std::sort(options.objPaths.begin(), options.objPaths.end());
+	}
+	for (const std::filesystem::path& path : options.objPaths) {
+		benchmarkObj(runner, "obj " + path.filename().string(), path, 0);
+	}
+
+	std::vector<std::filesystem::path> imagePaths;
+	for (auto it = std::filesystem::directory_iterator(RESOURCE_DIR, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+		std::filesystem::path extension = it->path().extension();
+		if (it->is_regular_file() && (extension == ".jpg" || extension == ".png" || extension == ".webp" || extension == ".avif")) imagePaths.push_back(it->path());
+	}
+	std::sort(imagePaths.begin(), imagePaths.end());
+	for (const std::filesystem::path& path : imagePaths) {
+		benchmarkImageDecode(runner, path, 0);
+		benchmarkImageDecode(runner, path, 512);
+	}
+
+	for (uint32_t size = 512; size <= options.maxImageSize; size *= 2) {
+		benchmarkMipMaps(runner, size);
+	}
+
+	Instance instance = nullptr;
+	Device device = nullptr;
+	if (runner.selected("shader module")) {
+		instance = createInstance(InstanceDescriptor{});
+		if (instance) device = createHeadlessDevice(instance);
+	}
+	benchmarkShaders(runner, device);
+	if (device) device.release();
+	if (instance) instance.release();
+
+	benchmarkTransforms(runner, 1000, 100);
+	benchmarkTransforms(runner, 100000, 0);
+	benchmarkCulling(runner, 1 << 16);
+	benchmarkCulling(runner, 1 << 20);
+	benchmarkFloatParsing(runner, 1 << 20);
+	benchmarkMeshDecoding(runner, 1024);
+
+	for (uint32_t producerCount : { 1u, 4u }) {
+		benchmarkHandoff(runner, producerCount);
+	}
+	benchmarkSnapshots(runner);
+
+	if (!options.reportPath.empty() && !runner.writeReport()) return 1;
+	return runner.failed() ? 1 : 0;
+}
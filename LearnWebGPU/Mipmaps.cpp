@@ -0,0 +1,217 @@
+#include "Mipmaps.h"
+#include "ParallelFor.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+// Output pixels that are worth a thread
+static constexpr size_t minPixelsPerThread = 1 << 16;
+
+namespace {
+
+inline unsigned char average(unsigned int a, unsigned int b) {
+	return static_cast<unsigned char>((a + b + 1) >> 1);
+}
+
+// Filter output pixels [begin, end) of a row from the `top` and `bottom` source rows.
+// `rightOffset` is the byte offset of the right pixel of each 2x2 block (0 for 1 pixel wide sources).
+void downsampleRowScalar(const unsigned char* top, const unsigned char* bottom, uint32_t rightOffset, uint32_t begin, uint32_t end, unsigned char* out) {
+	for (uint32_t i = begin; i < end; ++i) {
+		const unsigned char* t = top + 8 * i;
+		const unsigned char* b = bottom + 8 * i;
+		for (int c = 0; c < 4; ++c) {
+			out[4 * i + c] = average(average(t[c], b[c]), average(t[rightOffset + c], b[rightOffset + c]));
+		}
+	}
+}
+
+// Filter as many output pixels of a row as the vector width allows, from a source at least
+// 2 pixels wide. Return the number of pixels written, the rest is left to downsampleRowScalar.
+uint32_t downsampleRowSimd(const unsigned char* top, const unsigned char* bottom, uint32_t count, unsigned char* out) {
+	uint32_t i = 0;
+#if defined(SIMD_AVX2)
+	// 8 output pixels from 2 x 16 source pixels per iteration
+	for (; i + 8 <= count; i += 8) {
+		__m256i v0 = _mm256_avg_epu8(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + 8 * i)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + 8 * i))
+		);
+		__m256i v1 = _mm256_avg_epu8(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + 8 * i + 32)),
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + 8 * i + 32))
+		);
+		// Split even and odd pixels, which shuffle_ps does within each 128-bit lane
+		__m256 f0 = _mm256_castsi256_ps(v0);
+		__m256 f1 = _mm256_castsi256_ps(v1);
+		__m256i even = _mm256_castps_si256(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i odd = _mm256_castps_si256(_mm256_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+		// Then restore the order of the 64-bit halves across lanes
+		__m256i result = _mm256_permute4x64_epi64(_mm256_avg_epu8(even, odd), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * i), result);
+	}
+#elif defined(SIMD_SSE2)
+	// 4 output pixels from 2 x 8 source pixels per iteration
+	for (; i + 4 <= count; i += 4) {
+		__m128i v0 = _mm_avg_epu8(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + 8 * i)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + 8 * i))
+		);
+		__m128i v1 = _mm_avg_epu8(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + 8 * i + 16)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + 8 * i + 16))
+		);
+		__m128 f0 = _mm_castsi128_ps(v0);
+		__m128 f1 = _mm_castsi128_ps(v1);
+		__m128i even = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i odd = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i), _mm_avg_epu8(even, odd));
+	}
+#elif defined(SIMD_NEON)
+	for (; i + 4 <= count; i += 4) {
+		uint8x16_t v0 = vrhaddq_u8(vld1q_u8(top + 8 * i), vld1q_u8(bottom + 8 * i));
+		uint8x16_t v1 = vrhaddq_u8(vld1q_u8(top + 8 * i + 16), vld1q_u8(bottom + 8 * i + 16));
+		uint32x4x2_t pixels = vuzpq_u32(vreinterpretq_u32_u8(v0), vreinterpretq_u32_u8(v1));
+		vst1q_u8(out + 4 * i, vrhaddq_u8(vreinterpretq_u8_u32(pixels.val[0]), vreinterpretq_u8_u32(pixels.val[1])));
+	}
+#elif defined(SIMD_WASM)
+	for (; i + 4 <= count; i += 4) {
+		v128_t v0 = wasm_u8x16_avgr(wasm_v128_load(top + 8 * i), wasm_v128_load(bottom + 8 * i));
+		v128_t v1 = wasm_u8x16_avgr(wasm_v128_load(top + 8 * i + 16), wasm_v128_load(bottom + 8 * i + 16));
+		v128_t even = wasm_i32x4_shuffle(v0, v1, 0, 2, 4, 6);
+		v128_t odd = wasm_i32x4_shuffle(v0, v1, 1, 3, 5, 7);
+		wasm_v128_store(out + 4 * i, wasm_u8x16_avgr(even, odd));
+	}
+#else
+	(void)top;
+	(void)bottom;
+	(void)count;
+	(void)out;
+#endif
+	return i;
+}
+
+/**
+ * Conversions between 8-bit encoded channels and linear floats, through tables
+ * built once since each channel of each texel goes through them.
+ */
+class ChannelTables {
+public:
+	static const ChannelTables& get() {
+		static const ChannelTables tables;
+		return tables;
+	}
+
+	float decode(unsigned char value, bool srgb) const {
+		return srgb ? mSrgbToLinear[value] : value * (1.0f / 255.0f);
+	}
+
+	unsigned char encode(float value, bool srgb) const {
+		value = std::clamp(value, 0.0f, 1.0f);
+		if (srgb) {
+			// The table is fine enough for the steep start of the sRGB curve to round correctly
+			return mLinearToSrgb[static_cast<size_t>(value * (linearToSrgbSize - 1) + 0.5f)];
+		}
+		return static_cast<unsigned char>(value * 255.0f + 0.5f);
+	}
+
+private:
+	static constexpr size_t linearToSrgbSize = 1 << 16;
+
+	ChannelTables() : mLinearToSrgb(linearToSrgbSize) {
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.0f;
+			mSrgbToLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (size_t i = 0; i < linearToSrgbSize; ++i) {
+			float l = static_cast<float>(i) / (linearToSrgbSize - 1);
+			float c = l <= 0.0031308f ? 12.92f * l : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			mLinearToSrgb[i] = static_cast<unsigned char>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+	}
+
+private:
+	std::array<float, 256> mSrgbToLinear;
+	std::vector<unsigned char> mLinearToSrgb;
+};
+
+} // anonymous namespace
+
+void downsampleRgba8(const unsigned char* source, uint32_t width, uint32_t height, unsigned char* destination) {
+	uint32_t mipWidth = nextMipLevelSize(width);
+	uint32_t mipHeight = nextMipLevelSize(height);
+	size_t sourceRowSize = 4 * static_cast<size_t>(width);
+	// 1 pixel wide or high sources filter the same pixel twice
+	uint32_t rightOffset = width > 1 ? 4 : 0;
+	size_t bottomOffset = height > 1 ? sourceRowSize : 0;
+
+	size_t minRows = std::max<size_t>(1, minPixelsPerThread / mipWidth);
+	parallelForRanges(mipHeight, [&](size_t begin, size_t end) {
+		for (size_t j = begin; j < end; ++j) {
+			const unsigned char* top = source + 2 * j * sourceRowSize;
+			const unsigned char* bottom = top + bottomOffset;
+			unsigned char* out = destination + 4 * j * mipWidth;
+			uint32_t done = width > 1 ? downsampleRowSimd(top, bottom, mipWidth, out) : 0;
+			downsampleRowScalar(top, bottom, rightOffset, done, mipWidth, out);
+		}
+	}, minRows);
+}
+
+void downsampleRgba8(const unsigned char* source, uint32_t width, uint32_t height, unsigned char* destination, bool srgb, bool alphaWeighted) {
+	if (!srgb && !alphaWeighted) {
+		downsampleRgba8(source, width, height, destination);
+		return;
+	}
+
+	const ChannelTables& tables = ChannelTables::get();
+	uint32_t mipWidth = nextMipLevelSize(width);
+	uint32_t mipHeight = nextMipLevelSize(height);
+	size_t sourceRowSize = 4 * static_cast<size_t>(width);
+	uint32_t rightOffset = width > 1 ? 4 : 0;
+	size_t bottomOffset = height > 1 ? sourceRowSize : 0;
+
+	size_t minRows = std::max<size_t>(1, minPixelsPerThread / mipWidth);
+	parallelForRanges(mipHeight, [&](size_t begin, size_t end) {
+		for (size_t j = begin; j < end; ++j) {
+			const unsigned char* top = source + 2 * j * sourceRowSize;
+			const unsigned char* bottom = top + bottomOffset;
+			unsigned char* out = destination + 4 * j * mipWidth;
+			for (uint32_t i = 0; i < mipWidth; ++i) {
+				const unsigned char* texels[4] = {
+					top + 8 * i, top + 8 * i + rightOffset,
+					bottom + 8 * i, bottom + 8 * i + rightOffset
+				};
+
+				float color[3] = { 0.0f, 0.0f, 0.0f };
+				float alphaSum = 0.0f;
+				for (const unsigned char* texel : texels) {
+					float alpha = texel[3] * (1.0f / 255.0f);
+					float weight = alphaWeighted ? alpha : 1.0f;
+					for (int c = 0; c < 3; ++c) {
+						color[c] += weight * tables.decode(texel[c], srgb);
+					}
+					alphaSum += alpha;
+				}
+
+				// A fully transparent block has no color to preserve, fall back to a plain average
+				float colorWeight = alphaWeighted ? alphaSum : 4.0f;
+				if (colorWeight == 0.0f) {
+					for (int c = 0; c < 3; ++c) {
+						color[c] = 0.0f;
+						for (const unsigned char* texel : texels) {
+							color[c] += tables.decode(texel[c], srgb);
+						}
+					}
+					colorWeight = 4.0f;
+				}
+
+				for (int c = 0; c < 3; ++c) {
+					out[4 * i + c] = tables.encode(color[c] / colorWeight, srgb);
+				}
+				out[4 * i + 3] = static_cast<unsigned char>(alphaSum * (255.0f / 4.0f) + 0.5f);
+			}
+		}
+	}, minRows);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// Size of a dimension at the next mip level, as defined by WebGPU
+inline uint32_t nextMipLevelSize(uint32_t size) {
+	return size > 1 ? size / 2 : 1;
+}
+
+/**
+ * Build the next mip level of an RGBA8 image with a 2x2 box filter. The
+ * destination is nextMipLevelSize(width) x nextMipLevelSize(height), and an
+ * odd last row or column of the source is dropped.
+ *
+ * Each byte is averaged as avg(avg(top left, bottom left), avg(top right,
+ * bottom right)) with avg(a, b) = (a + b + 1) / 2, which is what the SIMD
+ * rounding average instructions compute (SSE2/AVX2 pavgb, NEON vrhadd, WASM
+ * avgr), so that all implementations give the exact same result. Rows are
+ * split among worker threads for large images.
+ */
+void downsampleRgba8(const unsigned char* source, uint32_t width, uint32_t height, unsigned char* destination);
+
+/**
+ * Same 2x2 box filter, averaging light rather than bytes: when `srgb` is set,
+ * color channels are decoded from sRGB to linear before averaging and encoded
+ * back after (alpha is always linear). When `alphaWeighted` is set, colors are
+ * weighted by their alpha, like averaging premultiplied colors then dividing
+ * back, so that fully transparent texels do not bleed into their neighbors.
+ * With neither flag set, this is downsampleRgba8() above.
+ */
+void downsampleRgba8(const unsigned char* source, uint32_t width, uint32_t height, unsigned char* destination, bool srgb, bool alphaWeighted);
@@ -0,0 +1,98 @@
+#include "MultiDraw.h"
+
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
+using namespace wgpu;
+
+namespace {
+
+// Of the indexCount, instanceCount, firstIndex, baseVertex and firstInstance of a draw
+constexpr uint64_t DrawIndexedIndirectSize = 5 * sizeof(uint32_t);
+
+#ifdef WEBGPU_BACKEND_WGPU
+const FeatureName MultiDrawIndirectFeature = static_cast<WGPUFeatureName>(WGPUNativeFeature_MultiDrawIndirect);
+const FeatureName MultiDrawIndirectCountFeature = static_cast<WGPUFeatureName>(WGPUNativeFeature_MultiDrawIndirectCount);
+#endif // WEBGPU_BACKEND_WGPU
+
+} // anonymous namespace
+
+bool MultiDraw::supported(Adapter adapter) {
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+	return adapter.hasFeature(MultiDrawIndirectFeature) && adapter.hasFeature(FeatureName::IndirectFirstInstance);
+#else
+	(void)adapter;
+	return false;
+#endif
+}
+
+void MultiDraw::require(std::vector<WGPUFeatureName>& features) {
+#ifdef WEBGPU_BACKEND_WGPU
+	features.push_back(MultiDrawIndirectFeature);
+	features.push_back(FeatureName::IndirectFirstInstance);
+#else
+	(void)features;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+bool MultiDraw::enabled(Device device) {
+#ifdef WEBGPU_BACKEND_WGPU
+	return device.hasFeature(MultiDrawIndirectFeature) && device.hasFeature(FeatureName::IndirectFirstInstance);
+#else
+	(void)device;
+	return false;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+bool MultiDraw::countSupported(Adapter adapter) {
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+	return supported(adapter) && adapter.hasFeature(MultiDrawIndirectCountFeature);
+#else
+	(void)adapter;
+	return false;
+#endif
+}
+
+void MultiDraw::requireCount(std::vector<WGPUFeatureName>& features) {
+#ifdef WEBGPU_BACKEND_WGPU
+	features.push_back(MultiDrawIndirectCountFeature);
+#else
+	(void)features;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+bool MultiDraw::countEnabled(Device device) {
+#ifdef WEBGPU_BACKEND_WGPU
+	return enabled(device) && device.hasFeature(MultiDrawIndirectCountFeature);
+#else
+	(void)device;
+	return false;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+void MultiDraw::drawIndexedIndirect(RenderPassEncoder pass, Buffer buffer, uint64_t offset, uint32_t count) {
+#ifdef WEBGPU_BACKEND_WGPU
+	if (count > 1) {
+		wgpuRenderPassEncoderMultiDrawIndexedIndirect(pass, buffer, offset, count);
+		return;
+	}
+#endif // WEBGPU_BACKEND_WGPU
+	for (uint32_t i = 0; i < count; ++i) {
+		pass.drawIndexedIndirect(buffer, offset + i * DrawIndexedIndirectSize);
+	}
+}
+
+void MultiDraw::drawIndexedIndirectCount(RenderPassEncoder pass, Buffer buffer, uint64_t offset, Buffer countBuffer, uint64_t countOffset, uint32_t maxCount, bool countDraws) {
+#ifdef WEBGPU_BACKEND_WGPU
+	if (countDraws) {
+		wgpuRenderPassEncoderMultiDrawIndexedIndirectCount(pass, buffer, offset, countBuffer, countOffset, maxCount);
+		return;
+	}
+#else
+	(void)countBuffer;
+	(void)countOffset;
+	(void)countDraws;
+#endif // WEBGPU_BACKEND_WGPU
+	drawIndexedIndirect(pass, buffer, offset, maxCount);
+}
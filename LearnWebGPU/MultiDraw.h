@@ -0,0 +1,40 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Indirect draws of consecutive arguments issued by a single call where the device
+ * has the MultiDrawIndirect feature of wgpu-native, and by one drawIndexedIndirect
+ * per draw otherwise, e.g. with Dawn or in the browser.
+ *
+ * The draws of a multi-draw share every binding, so shaders tell them apart by their
+ * instance index alone: the arguments of each draw start at its first instance, which
+ * the IndirectFirstInstance feature, required along with it, allows to be non-zero.
+ *
+ * Where the device also has the MultiDrawIndirectCount feature, the number of draws can
+ * be read from a buffer written by the GPU, e.g. by a compute pass selecting them.
+ */
+class MultiDraw {
+public:
+	// Whether `adapter` has the features of multi-draws, never outside of wgpu-native
+	static bool supported(wgpu::Adapter adapter);
+	// Add those features to the ones a device is requested with
+	static void require(std::vector<WGPUFeatureName>& features);
+	// Whether `device` was created with them
+	static bool enabled(wgpu::Device device);
+
+	// Same for the MultiDrawIndirectCount feature
+	static bool countSupported(wgpu::Adapter adapter);
+	static void requireCount(std::vector<WGPUFeatureName>& features);
+	static bool countEnabled(wgpu::Device device);
+
+	// Draw the `count` DrawIndexedIndirect arguments found from `offset` in `buffer`, tightly packed
+	static void drawIndexedIndirect(wgpu::RenderPassEncoder pass, wgpu::Buffer buffer, uint64_t offset, uint32_t count);
+	// Draw as many of the `maxCount` arguments from `offset` in `buffer` as the uint32_t at
+	// `countOffset` in `countBuffer` says, if `countDraws`, which needs the device to have the
+	// feature, and all of them otherwise, those past the count having to draw nothing
+	static void drawIndexedIndirectCount(wgpu::RenderPassEncoder pass, wgpu::Buffer buffer, uint64_t offset, wgpu::Buffer countBuffer, uint64_t countOffset, uint32_t maxCount, bool countDraws);
+};
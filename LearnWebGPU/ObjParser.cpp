@@ -0,0 +1,402 @@
+#include "ObjParser.h"
+#include "DecodeHeap.h"
+#include "ParallelFor.h"
+#include "TextScanner.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+
+// Chunks smaller than this are not worth a thread
+static constexpr size_t minChunkSize = 1 << 20;
+
+namespace {
+
+/**
+ * Number of records found in a chunk during the counting pass, then
+ * turned into the offset of the chunk in the output arrays by a prefix sum.
+ */
+struct ChunkCounts {
+	size_t positions = 0;
+	size_t normals = 0;
+	size_t texcoords = 0;
+	size_t corners = 0; // after triangulation
+};
+
+struct Cursor {
+	const char* p;
+	const char* end;
+
+	bool atLineEnd() const { return p >= end || *p == '\n' || *p == '\r' || *p == '#'; }
+
+	void skipSpaces() {
+		while (p < end && (*p == ' ' || *p == '\t')) ++p;
+	}
+
+	void skipLine() {
+		p = text::findLineEnd(p, end);
+		if (p < end) ++p;
+	}
+
+	bool readFloat(float& value) {
+		skipSpaces();
+		const char* next = text::parseFloat(p, end, value);
+		if (!next) return false;
+		p = next;
+		return true;
+	}
+
+	bool readInt(int& value) {
+		if (p < end && *p == '+') ++p;
+		auto [next, ec] = std::from_chars(p, end, value);
+		if (ec != std::errc()) return false;
+		p = next;
+		return true;
+	}
+};
+
+enum class RecordType { Position, Normal, Texcoord, Face, Other };
+
+// Identify the record at the cursor, which must be at the beginning of a line, and skip its keyword
+RecordType readRecordType(Cursor& c) {
+	c.skipSpaces();
+	if (c.end - c.p < 2) return RecordType::Other;
+	const char* p = c.p;
+	auto isSpace = [](char ch) { return ch == ' ' || ch == '\t'; };
+	if (p[0] == 'v' && isSpace(p[1])) { c.p += 2; return RecordType::Position; }
+	if (p[0] == 'f' && isSpace(p[1])) { c.p += 2; return RecordType::Face; }
+	if (c.end - c.p >= 3 && p[0] == 'v' && isSpace(p[2])) {
+		if (p[1] == 'n') { c.p += 3; return RecordType::Normal; }
+		if (p[1] == 't') { c.p += 3; return RecordType::Texcoord; }
+	}
+	return RecordType::Other;
+}
+
+// Make an OBJ index zero-based, `count` being the number of elements declared so far
+int fixIndex(int idx, size_t count) {
+	if (idx > 0) return idx - 1;
+	if (idx < 0) return static_cast<int>(count) + idx;
+	return -1;
+}
+
+ChunkCounts countChunk(const char* begin, const char* end) {
+	ChunkCounts counts;
+	Cursor c{ begin, end };
+	while (c.p < c.end) {
+		switch (readRecordType(c)) {
+		case RecordType::Position: ++counts.positions; break;
+		case RecordType::Normal: ++counts.normals; break;
+		case RecordType::Texcoord: ++counts.texcoords; break;
+		case RecordType::Face: {
+			const char* lineEnd;
+			size_t cornerCount = text::countFields(c.p, c.end, lineEnd);
+			if (cornerCount >= 3) counts.corners += 3 * (cornerCount - 2);
+			c.p = lineEnd;
+			break;
+		}
+		case RecordType::Other: break;
+		}
+		c.skipLine();
+	}
+	return counts;
+}
+
+// Second pass, writing at the offsets given by `base`. Return false on malformed input.
+// Quads are split along their 0-2 diagonal and the offset of their first corner is
+// recorded in `quads`, for splitTriangulatedQuads to pick the shortest diagonal.
+bool parseChunk(const char* begin, const char* end, const ChunkCounts& base, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& indices, DecodeVector<size_t>& quads) {
+	ChunkCounts cursor = base;
+	Cursor c{ begin, end };
+	bool ok = true;
+	while (c.p < c.end && ok) {
+		switch (readRecordType(c)) {
+		case RecordType::Position: {
+			float* v = &attrib.vertices[3 * cursor.positions];
+			float* col = &attrib.colors[3 * cursor.positions];
+			ok = c.readFloat(v[0]) && c.readFloat(v[1]) && c.readFloat(v[2]);
+			// Optional vertex color (a lone 4th component is a weight, which we ignore)
+			float rgb[3] = { 1.0f, 1.0f, 1.0f };
+			if (ok && c.readFloat(rgb[0]) && c.readFloat(rgb[1]) && c.readFloat(rgb[2])) {
+				col[0] = rgb[0]; col[1] = rgb[1]; col[2] = rgb[2];
+			}
+			else {
+				col[0] = col[1] = col[2] = 1.0f;
+			}
+			++cursor.positions;
+			break;
+		}
+		case RecordType::Normal: {
+			float* n = &attrib.normals[3 * cursor.normals];
+			ok = c.readFloat(n[0]) && c.readFloat(n[1]) && c.readFloat(n[2]);
+			++cursor.normals;
+			break;
+		}
+		case RecordType::Texcoord: {
+			float* t = &attrib.texcoords[2 * cursor.texcoords];
+			ok = c.readFloat(t[0]);
+			if (ok && !c.readFloat(t[1])) t[1] = 0.0f;
+			++cursor.texcoords;
+			break;
+		}
+		case RecordType::Face: {
+			tinyobj::index_t first{}, previous{};
+			size_t firstCorner = cursor.corners;
+			size_t cornerCount = 0;
+			for (c.skipSpaces(); !c.atLineEnd() && ok; c.skipSpaces(), ++cornerCount) {
+				// One of v, v/t, v//n or v/t/n
+				int v = 0, t = 0, n = 0;
+				ok = c.readInt(v);
+				if (ok && c.p < c.end && *c.p == '/') {
+					++c.p;
+					if (c.p < c.end && *c.p != '/') ok = c.readInt(t);
+					if (ok && c.p < c.end && *c.p == '/') {
+						++c.p;
+						ok = c.readInt(n);
+					}
+				}
+				tinyobj::index_t idx;
+				idx.vertex_index = fixIndex(v, cursor.positions);
+				idx.texcoord_index = fixIndex(t, cursor.texcoords);
+				idx.normal_index = fixIndex(n, cursor.normals);
+
+				// Fan triangulation
+				if (cornerCount == 0) {
+					first = idx;
+				}
+				else if (cornerCount >= 2) {
+					indices[cursor.corners++] = first;
+					indices[cursor.corners++] = previous;
+					indices[cursor.corners++] = idx;
+				}
+				previous = idx;
+			}
+			if (cornerCount == 4) quads.push_back(firstCorner);
+			break;
+		}
+		case RecordType::Other: break;
+		}
+		c.skipLine();
+	}
+	return ok;
+}
+
+// Like tinyobj's "simple" triangulation, split quads along their shortest diagonal
+void splitTriangulatedQuads(const DecodeVector<size_t>& quads, const tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& indices) {
+	auto position = [&](const tinyobj::index_t& idx) {
+		const float* v = &attrib.vertices[3 * static_cast<size_t>(idx.vertex_index)];
+		return std::array<float, 3>{ v[0], v[1], v[2] };
+	};
+	auto squaredDistance = [](const std::array<float, 3>& a, const std::array<float, 3>& b) {
+		float dx = b[0] - a[0], dy = b[1] - a[1], dz = b[2] - a[2];
+		return dx * dx + dy * dy + dz * dz;
+	};
+	size_t vertexCount = attrib.vertices.size() / 3;
+
+	for (size_t offset : quads) {
+		// Currently [0, 1, 2], [0, 2, 3]
+		tinyobj::index_t* tri = &indices[offset];
+		tinyobj::index_t i0 = tri[0], i1 = tri[1], i2 = tri[2], i3 = tri[5];
+		bool valid = true;
+		for (const tinyobj::index_t& idx : { i0, i1, i2, i3 }) {
+			valid &= idx.vertex_index >= 0 && static_cast<size_t>(idx.vertex_index) < vertexCount;
+		}
+		if (!valid) continue;
+
+		if (squaredDistance(position(i0), position(i2)) >= squaredDistance(position(i1), position(i3))) {
+			// [0, 1, 3], [1, 2, 3]
+			tri[0] = i0; tri[1] = i1; tri[2] = i3;
+			tri[3] = i1; tri[4] = i2; tri[5] = i3;
+		}
+	}
+}
+
+// Corners converted at once by convertObjVertices, whose attribute pointers are gathered first
+constexpr size_t conversionBlockSize = 64;
+
+/**
+ * Where the attributes of a block of corners are in the arrays of a parsed OBJ
+ */
+struct GatheredCorners {
+	const float* positions[conversionBlockSize];
+	const float* normals[conversionBlockSize];
+	const float* colors[conversionBlockSize];
+	const float* texcoords[conversionBlockSize];
+};
+
+// Element `index` of `values`, made of `size` floats, or `fallback` if out of range
+inline const float* element(const std::vector<tinyobj::real_t>& values, size_t elementCount, int index, size_t size, const float* fallback) {
+	return static_cast<size_t>(index) < elementCount ? &values[size * static_cast<size_t>(index)] : fallback;
+}
+
+// Write the vertex (position, normal, color, uv) of slot `i` of `corners` to `out`, one float at a
+// time, Y-up becoming Z-up and V flipped
+inline void convertCornerScalar(const GatheredCorners& corners, size_t i, float* out) {
+	const float* p = corners.positions[i];
+	const float* n = corners.normals[i];
+	const float* c = corners.colors[i];
+	const float* t = corners.texcoords[i];
+	out[0] = p[0]; out[1] = -p[2]; out[2] = p[1];
+	out[3] = n[0]; out[4] = -n[2]; out[5] = n[1];
+	out[6] = c[0]; out[7] = c[1]; out[8] = c[2];
+	out[9] = t[0]; out[10] = 1 - t[1];
+}
+
+// Same as above, with 12 bytes written past the 44 of the vertex, for the next one to overwrite
+inline void convertCorner(const GatheredCorners& corners, size_t i, float* out) {
+#if defined(SIMD_SSE2)
+	// Exactly the floats of each attribute, as (x, y, z, 0) and (u, v, 0, 0)
+	auto load3 = [](const float* p) { return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p))), _mm_load_ss(p + 2)); };
+	const __m128 flipY = _mm_set_ps(0.0f, 0.0f, -0.0f, 0.0f);
+	// (x, -z, y, 0) of the position and normal, (u, 1 - v, _, _) of the texcoords
+	__m128 position = _mm_xor_ps(_mm_shuffle_ps(load3(corners.positions[i]), load3(corners.positions[i]), _MM_SHUFFLE(3, 1, 2, 0)), flipY);
+	__m128 normal = _mm_xor_ps(_mm_shuffle_ps(load3(corners.normals[i]), load3(corners.normals[i]), _MM_SHUFFLE(3, 1, 2, 0)), flipY);
+	__m128 color = load3(corners.colors[i]);
+	__m128 uv = _mm_add_ps(_mm_set_ps(0.0f, 0.0f, 1.0f, 0.0f), _mm_xor_ps(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(corners.texcoords[i]))), flipY));
+	// (y, y, nx, nx), then (x, -z, y, nx)
+	__m128 yn = _mm_shuffle_ps(position, normal, _MM_SHUFFLE(0, 0, 2, 2));
+	_mm_storeu_ps(out, _mm_shuffle_ps(position, yn, _MM_SHUFFLE(2, 0, 1, 0)));
+	// (-nz, ny, r, g)
+	_mm_storeu_ps(out + 4, _mm_shuffle_ps(normal, color, _MM_SHUFFLE(1, 0, 2, 1)));
+	// (b, b, u, 1 - v), then (b, u, 1 - v, _)
+	__m128 bu = _mm_shuffle_ps(color, uv, _MM_SHUFFLE(1, 0, 2, 2));
+	_mm_storeu_ps(out + 8, _mm_shuffle_ps(bu, bu, _MM_SHUFFLE(3, 3, 2, 0)));
+#elif defined(SIMD_NEON)
+	auto load3 = [](const float* p) { return vcombine_f32(vld1_f32(p), vld1_dup_f32(p + 2)); };
+	float32x4_t position = load3(corners.positions[i]);
+	float32x4_t normal = load3(corners.normals[i]);
+	float32x4_t color = load3(corners.colors[i]);
+	float32x2_t texcoord = vld1_f32(corners.texcoords[i]);
+	// Lane moves rather than shuffles, which NEON only has for fixed patterns
+	float32x4_t v0 = vsetq_lane_f32(-vgetq_lane_f32(position, 2), position, 1);
+	v0 = vsetq_lane_f32(vgetq_lane_f32(position, 1), v0, 2);
+	v0 = vsetq_lane_f32(vgetq_lane_f32(normal, 0), v0, 3);
+	// (ny, nz) reversed and negated where needed into (-nz, ny), then (r, g)
+	float32x2_t zy = vrev64_f32(vget_low_f32(vextq_f32(normal, normal, 1)));
+	zy = vset_lane_f32(-vget_lane_f32(zy, 0), zy, 0);
+	float32x4_t v1 = vcombine_f32(zy, vget_low_f32(color));
+	float32x2_t uv = vset_lane_f32(1.0f - vget_lane_f32(texcoord, 1), texcoord, 1);
+	float32x4_t v2 = vcombine_f32(vset_lane_f32(vgetq_lane_f32(color, 2), uv, 0), uv);
+	v2 = vsetq_lane_f32(vget_lane_f32(uv, 0), v2, 1);
+	v2 = vsetq_lane_f32(vget_lane_f32(uv, 1), v2, 2);
+	vst1q_f32(out, v0);
+	vst1q_f32(out + 4, v1);
+	vst1q_f32(out + 8, v2);
+#elif defined(SIMD_WASM)
+	auto load3 = [](const float* p) { return wasm_v128_load32_lane(p + 2, wasm_v128_load64_zero(p), 2); };
+	const v128_t flipY = wasm_f32x4_make(0.0f, -0.0f, 0.0f, 0.0f);
+	v128_t position = wasm_v128_xor(wasm_i32x4_shuffle(load3(corners.positions[i]), load3(corners.positions[i]), 0, 2, 1, 3), flipY);
+	v128_t normal = wasm_v128_xor(wasm_i32x4_shuffle(load3(corners.normals[i]), load3(corners.normals[i]), 0, 2, 1, 3), flipY);
+	v128_t color = load3(corners.colors[i]);
+	v128_t uv = wasm_f32x4_add(wasm_f32x4_make(0.0f, 1.0f, 0.0f, 0.0f), wasm_v128_xor(wasm_v128_load64_zero(corners.texcoords[i]), flipY));
+	wasm_v128_store(out, wasm_i32x4_shuffle(position, normal, 0, 1, 2, 4));
+	wasm_v128_store(out + 4, wasm_i32x4_shuffle(normal, color, 1, 2, 4, 5));
+	wasm_v128_store(out + 8, wasm_i32x4_shuffle(color, uv, 2, 4, 5, 5));
+#else
+	convertCornerScalar(corners, i, out);
+#endif
+}
+
+} // anonymous namespace
+
+bool parseObjParallel(const std::byte* data, size_t size, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& indices) {
+	const char* text = reinterpret_cast<const char*>(data);
+	const char* textEnd = text + size;
+
+	// Split into line-aligned chunks, one per worker
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(workerThreadCount(), size / minChunkSize));
+	std::vector<const char*> boundaries(chunkCount + 1, textEnd);
+	boundaries[0] = text;
+	for (size_t i = 1; i < chunkCount; ++i) {
+		const char* p = std::max(text + i * (size / chunkCount), boundaries[i - 1]);
+		while (p < textEnd && *p != '\n') ++p;
+		boundaries[i] = p < textEnd ? p + 1 : textEnd;
+	}
+
+	// Counting pass
+	std::vector<ChunkCounts> counts(chunkCount);
+	parallelForRanges(chunkCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			counts[i] = countChunk(boundaries[i], boundaries[i + 1]);
+		}
+	}, 1);
+
+	// Exclusive prefix sum to get each chunk's output offsets
+	ChunkCounts total;
+	for (ChunkCounts& chunk : counts) {
+		ChunkCounts chunkTotal = chunk;
+		chunk = total;
+		total.positions += chunkTotal.positions;
+		total.normals += chunkTotal.normals;
+		total.texcoords += chunkTotal.texcoords;
+		total.corners += chunkTotal.corners;
+	}
+
+	attrib = tinyobj::attrib_t{};
+	attrib.vertices.resize(3 * total.positions);
+	attrib.colors.resize(3 * total.positions);
+	attrib.normals.resize(3 * total.normals);
+	attrib.texcoords.resize(2 * total.texcoords);
+	indices.resize(total.corners);
+
+	// Parsing pass
+	std::vector<char> chunkSuccess(chunkCount, 0);
+	// Grown by the threads parsing, from their DecodeHeap pools
+	std::vector<DecodeVector<size_t>> quads(chunkCount);
+	parallelForRanges(chunkCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			chunkSuccess[i] = parseChunk(boundaries[i], boundaries[i + 1], counts[i], attrib, indices, quads[i]);
+		}
+	}, 1);
+
+	for (size_t i = 0; i < chunkCount; ++i) {
+		if (!chunkSuccess[i]) {
+			std::cerr << "Malformed OBJ record in chunk " << i << " of " << chunkCount << std::endl;
+			return false;
+		}
+	}
+
+	// Quad diagonals depend on positions that may live in any chunk, hence the separate pass
+	parallelForRanges(chunkCount, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			splitTriangulatedQuads(quads[i], attrib, indices);
+		}
+	}, 1);
+	return true;
+}
+
+void convertObjVertices(const tinyobj::attrib_t& attrib, const tinyobj::index_t* corners, size_t count, ResourceManager::VertexAttributes* destination) {
+	static_assert(sizeof(ResourceManager::VertexAttributes) == 11 * sizeof(float));
+	static const float zero[3] = { 0.0f, 0.0f, 0.0f };
+	static const float white[3] = { 1.0f, 1.0f, 1.0f };
+	const size_t positionCount = attrib.vertices.size() / 3;
+	const size_t normalCount = attrib.normals.size() / 3;
+	const size_t colorCount = attrib.colors.size() / 3;
+	const size_t texcoordCount = attrib.texcoords.size() / 2;
+	float* out = reinterpret_cast<float*>(destination);
+
+	GatheredCorners gathered;
+	for (size_t first = 0; first < count; first += conversionBlockSize) {
+		size_t blockSize = std::min(conversionBlockSize, count - first);
+
+		// Gathers first, checked once, so that the loop converting them has no branch
+		for (size_t i = 0; i < blockSize; ++i) {
+			const tinyobj::index_t& corner = corners[first + i];
+			gathered.positions[i] = element(attrib.vertices, positionCount, corner.vertex_index, 3, zero);
+			gathered.normals[i] = element(attrib.normals, normalCount, corner.normal_index, 3, zero);
+			gathered.colors[i] = element(attrib.colors, colorCount, corner.vertex_index, 3, white);
+			gathered.texcoords[i] = element(attrib.texcoords, texcoordCount, corner.texcoord_index, 2, zero);
+		}
+
+		// The very last vertex must not write past the destination
+		size_t vectorCount = first + blockSize == count ? blockSize - 1 : blockSize;
+		for (size_t i = 0; i < vectorCount; ++i) {
+			convertCorner(gathered, i, out + 11 * (first + i));
+		}
+		if (vectorCount < blockSize) {
+			convertCornerScalar(gathered, vectorCount, out + 11 * (first + vectorCount));
+		}
+	}
+}
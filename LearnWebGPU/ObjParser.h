@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ResourceManager.h"
+
+#include "tiny_obj_loader.h"
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * A multi-threaded parser for the geometric subset of the OBJ format
+ * (`v`, `vn`, `vt` and `f` records), meant for very large scans where
+ * tinyobj's single-threaded LoadObj dominates the load time.
+ *
+ * The input is split into line-aligned chunks. A first parallel pass counts
+ * the records of each chunk so that, after a prefix sum, a second parallel
+ * pass can parse every chunk straight into its final slice of the output
+ * arrays, with relative (negative) face indices resolved exactly as tinyobj
+ * would. Faces are fan-triangulated and all shapes are merged into one.
+ * Lines are scanned and numbers converted with TextScanner.h, which also
+ * makes it the faster parser of small files without materials.
+ *
+ * Output uses tinyobj's types so that the rest of the loader is shared.
+ * Missing vertex colors default to white, like tinyobj does.
+ */
+bool parseObjParallel(const std::byte* data, size_t size, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& indices);
+
+/**
+ * Convert the corners `corners[0, count)` of a parsed OBJ to our vertex layout,
+ * Y-up positions and normals becoming Z-up and V flipped, writing every byte of
+ * `destination[0, count)`, which may thus be uninitialized memory such as a
+ * mapped staging buffer (see UploadManager::FillFunction).
+ *
+ * Corners are processed in blocks: the addresses of their attributes in the
+ * scattered arrays of `attrib` are gathered and checked first, then each vertex
+ * is loaded, remapped with SIMD shuffles and stored with three vector writes.
+ * Missing or out of range attributes are zero, white for colors.
+ */
+void convertObjVertices(const tinyobj::attrib_t& attrib, const tinyobj::index_t* corners, size_t count, ResourceManager::VertexAttributes* destination);
@@ -0,0 +1,151 @@
+#include "ObjectPicker.h"
+#include "GpuMemory.h"
+
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// Declarations of the ID attachment, which differ with multisampling
+const char* singleSampledIds = R"(
+@group(0) @binding(0) var objectIds: texture_2d<u32>;
+)";
+const char* multisampledIds = R"(
+@group(0) @binding(0) var objectIds: texture_multisampled_2d<u32>;
+)";
+
+const char* pickShaderSource = R"(
+@group(0) @binding(1) var<uniform> texel: vec2u;
+@group(0) @binding(2) var<storage, read_write> result: array<u32, 4>;
+
+@compute @workgroup_size(1)
+fn pick() {
+	let size = textureDimensions(objectIds);
+	result[0] = textureLoad(objectIds, min(texel, size - 1u), 0).r;
+}
+)";
+
+} // anonymous namespace
+
+ObjectPicker::ObjectPicker(Device device, PipelineCache& pipelineCache, uint32_t sampleCount)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+{
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Picking uniforms";
+	bufferDesc.size = 16;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ObjectPicker");
+
+	bufferDesc.label = "Picking result";
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopySrc;
+	mResultBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "ObjectPicker");
+
+	mReadback = ReadbackPool(device, 1, 16, "Picking readback buffer", "ObjectPicker");
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].texture.sampleType = TextureSampleType::Uint;
+	bindingLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[0].texture.multisampled = sampleCount > 1;
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[1].buffer.minBindingSize = 8;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[2].buffer.type = BufferBindingType::Storage;
+	bindingLayoutEntries[2].buffer.minBindingSize = 16;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+	std::string source = std::string(sampleCount > 1 ? multisampledIds : singleSampledIds) + pickShaderSource;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(source.c_str());
+	pipelineDesc.compute.entryPoint = "pick";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+}
+
+ObjectPicker::~ObjectPicker() {
+	if (mBindGroup) mBindGroup.release();
+	for (Buffer* buffer : { &mResultBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+	mQueue.release();
+}
+
+void ObjectPicker::request(glm::uvec2 texel) {
+	mTexel = texel;
+	mRequested = true;
+}
+
+void ObjectPicker::encode(CommandEncoder encoder, TextureView idView, const ComputePassTimestampWrites* timestampWrites) {
+	if (!encodeNeeded() || !ready()) return;
+	uint32_t slot = mReadback.reserve();
+	if (slot == ReadbackPool::NoSlot) return;
+
+	if (idView != mIdView) {
+		if (mBindGroup) mBindGroup.release();
+		std::vector<BindGroupEntry> bindings(3);
+		bindings[0].binding = 0;
+		bindings[0].textureView = idView;
+		bindings[1].binding = 1;
+		bindings[1].buffer = mUniformBuffer;
+		bindings[1].offset = 0;
+		bindings[1].size = 8;
+		bindings[2].binding = 2;
+		bindings[2].buffer = mResultBuffer;
+		bindings[2].offset = 0;
+		bindings[2].size = 16;
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mBindGroup = mDevice.createBindGroup(bindGroupDesc);
+		mIdView = idView;
+	}
+
+	uint32_t texel[2] = { mTexel.x, mTexel.y };
+	mQueue.writeBuffer(mUniformBuffer, 0, texel, sizeof(texel));
+
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Picking";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mPipeline->pipeline);
+	computePass.setBindGroup(0, mBindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups(1, 1, 1);
+	computePass.end();
+	computePass.release();
+	encoder.copyBufferToBuffer(mResultBuffer, 0, mReadback.buffer(slot), 0, 16);
+
+	mRequested = false;
+}
+
+void ObjectPicker::readBack() {
+	if (mReadback.state(0) != ReadbackPool::State::Recording) return;
+	// A pick that failed to map is dropped
+	mReadback.map(0, 16);
+}
+
+bool ObjectPicker::poll(uint32_t& instance) {
+	if (mReadback.state(0) != ReadbackPool::State::Mapped) return false;
+	uint32_t id = *static_cast<const uint32_t*>(mReadback.mappedRange(0, 16));
+	mReadback.release(0);
+	instance = id == 0 ? NoInstance : id - 1;
+	return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "ReadbackPool.h"
+
+#include <cstdint>
+
+/**
+ * Find the instance drawn at a pixel from an ID attachment of the main pass,
+ * rather than by casting a ray against every triangle on the CPU: the cost of a
+ * pick does not depend on the scene.
+ *
+ * The main pass writes the index of each fragment's instance plus one to an
+ * R32Uint attachment, 0 meaning nothing was drawn. When a pick is requested, a
+ * one invocation compute pass copies the texel under the cursor (its first sample
+ * with MSAA, which copies to buffers do not allow) to a buffer, which is mapped
+ * asynchronously once submitted, so the result arrives a frame or so later
+ * without ever stalling the CPU. One pick is in flight at a time, newer requests
+ * replacing the one waiting to be encoded.
+ */
+class ObjectPicker {
+public:
+	static constexpr wgpu::TextureFormat IdFormat = wgpu::TextureFormat::R32Uint;
+	// Result of a pick where no instance is drawn
+	static constexpr uint32_t NoInstance = UINT32_MAX;
+
+	// Read ID attachments of `sampleCount` samples
+	ObjectPicker(wgpu::Device device, PipelineCache& pipelineCache, uint32_t sampleCount);
+	~ObjectPicker();
+
+	ObjectPicker(const ObjectPicker&) = delete;
+	ObjectPicker& operator=(const ObjectPicker&) = delete;
+
+	// Whether the pipeline is built, before which encode() records nothing
+	bool ready() const { return mPipeline->ready(); }
+
+	// Pick the instance at `texel` of the ID attachment with the next encode()
+	void request(glm::uvec2 texel);
+
+	// Whether a request waits for encode(), the previous pick being read back
+	bool encodeNeeded() const { return mRequested && mReadback.state(0) == ReadbackPool::State::Free; }
+
+	// Record the copy of the requested texel of `idView`, after the pass writing it
+	void encode(wgpu::CommandEncoder encoder, wgpu::TextureView idView, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr);
+
+	// Map the result once the frame of encode() is submitted
+	void readBack();
+
+	// The instance of the last pick read back, or NoInstance, returning true once per pick
+	bool poll(uint32_t& instance);
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	PipelineCache::AsyncComputePipeline mPipeline;
+
+	// Texel to read, and the ID written by the shader, copied to the readback buffer
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::Buffer mResultBuffer = nullptr;
+	// A single slot, one pick being in flight at a time
+	ReadbackPool mReadback;
+
+	glm::uvec2 mTexel = { 0, 0 };
+	bool mRequested = false;
+
+	// Bind group of the last ID view, which keeps it alive
+	wgpu::TextureView mIdView = nullptr;
+	wgpu::BindGroup mBindGroup = nullptr;
+};
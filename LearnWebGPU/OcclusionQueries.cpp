@@ -0,0 +1,227 @@
+#include "OcclusionQueries.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+const char* proxyShaderSource = R"(
+@group(0) @binding(0) var<uniform> matrix: mat4x4f;
+// Minimum then maximum corner of each box
+@group(0) @binding(1) var<storage, read> boxes: array<vec4f>;
+
+// A cube as a strip of 14 vertices, the corner of each one given by a bit of each mask
+@vertex
+fn vs_main(@builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) instanceIndex: u32) -> @builtin(position) vec4f {
+	let bit = 1u << vertexIndex;
+	let corner = vec3<bool>((0x287au & bit) != 0u, (0x02afu & bit) != 0u, (0x31e3u & bit) != 0u);
+	let position = select(boxes[2u * instanceIndex].xyz, boxes[2u * instanceIndex + 1u].xyz, corner);
+	return matrix * vec4f(position, 1.0);
+}
+)";
+
+} // anonymous namespace
+
+OcclusionQueries::OcclusionQueries(Device device, PipelineCache& pipelineCache, DepthConvention depthConvention, uint32_t sampleCount)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+{
+	QuerySetDescriptor querySetDesc{};
+	querySetDesc.label = "Occlusion queries";
+	querySetDesc.type = QueryType::Occlusion;
+	querySetDesc.count = MaxQueryCount;
+	mQuerySet = device.createQuerySet(querySetDesc);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Occlusion query uniforms";
+	bufferDesc.size = sizeof(glm::mat4);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "OcclusionQueries");
+
+	bufferDesc.label = "Occlusion query resolve buffer";
+	bufferDesc.size = MaxQueryCount * sizeof(uint64_t);
+	bufferDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+	mResolveBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "OcclusionQueries");
+
+	mReadback = ReadbackPool(device, 1, bufferDesc.size, "Occlusion query readback buffer", "OcclusionQueries");
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(2, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Vertex;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(glm::mat4);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Vertex;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[1].buffer.minBindingSize = 2 * sizeof(glm::vec4);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.label = "Occlusion proxies";
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.vertex.bufferCount = 0;
+	pipelineDesc.vertex.buffers = nullptr;
+	pipelineDesc.vertex.module = pipelineCache.shaderModule(proxyShaderSource);
+	pipelineDesc.vertex.entryPoint = "vs_main";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	// Both sides, for the faces of the strip to be drawn whatever their winding
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleStrip;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::None;
+
+	// Tested against the depths of the frame without changing them, and no color at all
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.depthCompare = depthConvention.nearer();
+	depthStencilState.depthWriteEnabled = false;
+	depthStencilState.format = depthConvention.format();
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencilState;
+	pipelineDesc.fragment = nullptr;
+
+	pipelineDesc.multisample.count = sampleCount;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	mPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+OcclusionQueries::~OcclusionQueries() {
+	if (mBindGroup) mBindGroup.release();
+	for (Buffer* buffer : { &mResolveBuffer, &mBoxBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+	if (mQuerySet) {
+		mQuerySet.destroy();
+		mQuerySet.release();
+	}
+	mQueue.release();
+}
+
+void OcclusionQueries::setBoxes(std::span<const Aabb> boxes) {
+	mBoxCount = static_cast<uint32_t>(boxes.size());
+	if (boxes.empty()) return;
+
+	uint64_t size = boxes.size() * 2 * sizeof(glm::vec4);
+	if (!mBoxBuffer || mBoxBuffer.getSize() < size) {
+		if (mBindGroup) mBindGroup.release();
+		if (mBoxBuffer) {
+			destroyTracked(mBoxBuffer);
+			mBoxBuffer.release();
+		}
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = "Occlusion proxy boxes";
+		// Room for some more, as the draw list grows while assets load
+		bufferDesc.size = std::max<uint64_t>(size + size / 2, 256);
+		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+		bufferDesc.mappedAtCreation = false;
+		mBoxBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "OcclusionQueries");
+
+		std::vector<BindGroupEntry> bindings(2);
+		bindings[0].binding = 0;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(glm::mat4);
+		bindings[1].binding = 1;
+		bindings[1].buffer = mBoxBuffer;
+		bindings[1].offset = 0;
+		bindings[1].size = bufferDesc.size;
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mBindGroup = mDevice.createBindGroup(bindGroupDesc);
+	}
+
+	std::vector<glm::vec4> corners;
+	corners.reserve(2 * boxes.size());
+	for (const Aabb& box : boxes) {
+		corners.push_back(glm::vec4(box.min, 0.0f));
+		corners.push_back(glm::vec4(box.max, 0.0f));
+	}
+	mQueue.writeBuffer(mBoxBuffer, 0, corners.data(), size);
+}
+
+void OcclusionQueries::encode(
+	CommandEncoder encoder, TextureView depthView, uint32_t width, uint32_t height,
+	const glm::mat4& matrix, std::span<const Range> ranges,
+	const RenderPassTimestampWrites* timestampWrites
+) {
+	if (!encodeNeeded() || !ready() || !mBindGroup || ranges.empty()) return;
+	uint32_t slot = mReadback.reserve();
+	if (slot == ReadbackPool::NoSlot) return;
+
+	mQueue.writeBuffer(mUniformBuffer, 0, &matrix, sizeof(glm::mat4));
+
+	RenderPassDepthStencilAttachment depthStencilAttachment{};
+	depthStencilAttachment.view = depthView;
+	depthStencilAttachment.depthClearValue = 1.0f;
+	depthStencilAttachment.depthLoadOp = LoadOp::Load;
+	depthStencilAttachment.depthStoreOp = StoreOp::Store;
+	depthStencilAttachment.depthReadOnly = false;
+	depthStencilAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Store;
+#else
+	depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif // ! WGPU BACKEND
+	depthStencilAttachment.stencilReadOnly = true;
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Occlusion queries";
+	renderPassDesc.colorAttachmentCount = 0;
+	renderPassDesc.colorAttachments = nullptr;
+	renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+	renderPassDesc.occlusionQuerySet = mQuerySet;
+	renderPassDesc.timestampWrites = timestampWrites;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	renderPass.setViewport(0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f);
+	renderPass.setScissorRect(0, 0, width, height);
+	renderPass.setPipeline(mPipeline->pipeline);
+	renderPass.setBindGroup(0, mBindGroup, 0, nullptr);
+	mQueryCount = static_cast<uint32_t>(std::min<size_t>(ranges.size(), MaxQueryCount));
+	for (uint32_t i = 0; i < mQueryCount; ++i) {
+		// Ranges past the boxes uploaded still get their query, which then counts nothing
+		uint32_t first = std::min(ranges[i].firstBox, mBoxCount);
+		uint32_t count = std::min(ranges[i].boxCount, mBoxCount - first);
+		renderPass.beginOcclusionQuery(i);
+		if (count > 0) renderPass.draw(14, count, 0, first);
+		renderPass.endOcclusionQuery();
+	}
+	renderPass.end();
+	renderPass.release();
+
+	encoder.resolveQuerySet(mQuerySet, 0, mQueryCount, mResolveBuffer, 0);
+	encoder.copyBufferToBuffer(mResolveBuffer, 0, mReadback.buffer(slot), 0, mQueryCount * sizeof(uint64_t));
+}
+
+void OcclusionQueries::readBack() {
+	if (mReadback.state(0) != ReadbackPool::State::Recording) return;
+	// Results that failed to map are dropped
+	mReadback.map(0, mQueryCount * sizeof(uint64_t));
+}
+
+bool OcclusionQueries::poll(std::vector<uint64_t>& sampleCounts) {
+	if (mReadback.state(0) != ReadbackPool::State::Mapped) return false;
+	const uint64_t* results = static_cast<const uint64_t*>(mReadback.mappedRange(0, mQueryCount * sizeof(uint64_t)));
+	sampleCounts.assign(results, results + mQueryCount);
+	mReadback.release(0);
+	return true;
+}
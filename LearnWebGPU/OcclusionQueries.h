@@ -0,0 +1,91 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "ReadbackPool.h"
+#include "DepthConvention.h"
+#include "Bvh.h"
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Whether groups of instances are visible at all, counted by occlusion queries
+ * over proxy draws of their bounding boxes against the depth buffer of a frame.
+ *
+ * Each query draws the boxes of a range of instances without writing depth or
+ * color, so it counts the samples of the boxes in front of what the frame drew,
+ * none meaning the whole range is hidden, behind other geometry or out of the
+ * view. Boxes bound their instances, thus a range reported hidden is hidden
+ * whenever the camera is outside all of its boxes, which the caller checks.
+ *
+ * Results are resolved to a buffer mapped asynchronously, like for picking, and
+ * arrive a frame or so later. One set of queries is in flight at a time.
+ */
+class OcclusionQueries {
+public:
+	// Queries a single encode() records at most, later ranges being left out
+	static constexpr uint32_t MaxQueryCount = 1024;
+
+	/**
+	 * Instances [firstBox, firstBox + boxCount) of the boxes, tested together
+	 */
+	struct Range {
+		uint32_t firstBox;
+		uint32_t boxCount;
+	};
+
+	// Test against depth attachments of `depthConvention` with `sampleCount` samples
+	OcclusionQueries(wgpu::Device device, PipelineCache& pipelineCache, DepthConvention depthConvention, uint32_t sampleCount);
+	~OcclusionQueries();
+
+	OcclusionQueries(const OcclusionQueries&) = delete;
+	OcclusionQueries& operator=(const OcclusionQueries&) = delete;
+
+	// Whether the pipeline is built, before which encode() records nothing
+	bool ready() const { return mPipeline->ready(); }
+
+	// Whether the previous results were read by poll(), so that encode() may record new ones
+	bool encodeNeeded() const { return mReadback.state(0) == ReadbackPool::State::Free; }
+
+	// Upload the bounding boxes drawn by the next encode(), in the space `matrix` of encode()
+	// projects from
+	void setBoxes(std::span<const Aabb> boxes);
+
+	// Record a pass testing each range of the boxes against the `width` x `height` texels in
+	// the top left corner of `depthView`, as seen through `matrix`
+	void encode(
+		wgpu::CommandEncoder encoder, wgpu::TextureView depthView, uint32_t width, uint32_t height,
+		const glm::mat4& matrix, std::span<const Range> ranges,
+		const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr
+	);
+
+	// Map the results once the frame of encode() is submitted
+	void readBack();
+
+	// Samples of each range of the last encode() that passed the depth test, returning true
+	// once per encode()
+	bool poll(std::vector<uint64_t>& sampleCounts);
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	PipelineCache::AsyncRenderPipeline mPipeline;
+
+	wgpu::QuerySet mQuerySet = nullptr;
+	wgpu::Buffer mUniformBuffer = nullptr;
+	// Minimum then maximum corner of each box, grown as needed
+	wgpu::Buffer mBoxBuffer = nullptr;
+	uint32_t mBoxCount = 0;
+	wgpu::BindGroup mBindGroup = nullptr;
+
+	wgpu::Buffer mResolveBuffer = nullptr;
+	// A single slot, the results of one encode() being in flight at a time
+	ReadbackPool mReadback;
+	uint32_t mQueryCount = 0;
+};
@@ -0,0 +1,154 @@
+#include "OffsetAllocator.h"
+
+#include <bit>
+#include <cassert>
+
+OffsetAllocator::OffsetAllocator(uint32_t capacity)
+	: mCapacity(capacity)
+	, mFreeSize(capacity)
+{
+	mBinHeads.fill(NoSpace);
+	if (capacity > 0) insertFree(createNode(0, capacity, NoSpace, NoSpace));
+}
+
+uint32_t OffsetAllocator::binRoundDown(uint32_t size) {
+	// Sizes below 8 have a bin each, the others 8 bins per power of two
+	constexpr uint32_t mantissaCount = 1 << SecondLevelBits;
+	if (size < mantissaCount) return size;
+	uint32_t leadingBit = 31 - std::countl_zero(size);
+	uint32_t shift = leadingBit - SecondLevelBits;
+	uint32_t mantissa = (size >> shift) & (mantissaCount - 1);
+	return ((shift + 1) << SecondLevelBits) | mantissa;
+}
+
+uint32_t OffsetAllocator::binRoundUp(uint32_t size) {
+	uint32_t bin = binRoundDown(size);
+	if (size < (1u << SecondLevelBits)) return bin;
+	uint32_t shift = 31 - std::countl_zero(size) - SecondLevelBits;
+	// Sizes of the next bin follow those of this one, including across powers of two
+	return (size & ((1u << shift) - 1)) != 0 ? bin + 1 : bin;
+}
+
+uint32_t OffsetAllocator::findBin(uint32_t bin) const {
+	if (bin >= BinCount) return NoSpace;
+	uint32_t firstLevel = bin >> SecondLevelBits;
+	uint32_t secondLevel = bin & ((1u << SecondLevelBits) - 1);
+	uint32_t secondLevelMask = mSecondLevelMasks[firstLevel] & (0xFFu << secondLevel);
+	if (secondLevelMask == 0) {
+		// The first non-empty bin of a larger leading bit
+		uint32_t firstLevelMask = firstLevel < 31 ? mFirstLevelMask & (0xFFFFFFFFu << (firstLevel + 1)) : 0;
+		if (firstLevelMask == 0) return NoSpace;
+		firstLevel = std::countr_zero(firstLevelMask);
+		secondLevelMask = mSecondLevelMasks[firstLevel];
+	}
+	return (firstLevel << SecondLevelBits) | std::countr_zero(secondLevelMask);
+}
+
+OffsetAllocator::Allocation OffsetAllocator::allocate(uint32_t size) {
+	if (size == 0 || size > mFreeSize) return {};
+	uint32_t index = NoSpace;
+	uint32_t bin = findBin(binRoundUp(size));
+	if (bin != NoSpace) {
+		index = mBinHeads[bin];
+	}
+	else {
+		// Only the bin of `size` itself may still have a range that fits, e.g. when all is free
+		for (uint32_t node = mBinHeads[binRoundDown(size)]; node != NoSpace && index == NoSpace; node = mNodes[node].binNext) {
+			if (mNodes[node].size >= size) index = node;
+		}
+		if (index == NoSpace) return {};
+	}
+
+	removeFree(index);
+	mNodes[index].used = true;
+	mFreeSize -= size;
+
+	// Give the excess back, as a free range right after the allocation
+	if (mNodes[index].size > size) {
+		Node& node = mNodes[index];
+		uint32_t remainder = createNode(node.offset + size, node.size - size, index, node.next);
+		Node& allocated = mNodes[index];
+		if (allocated.next != NoSpace) mNodes[allocated.next].previous = remainder;
+		allocated.next = remainder;
+		allocated.size = size;
+		insertFree(remainder);
+	}
+	return { mNodes[index].offset, size, index };
+}
+
+void OffsetAllocator::free(const Allocation& allocation) {
+	if (!allocation) return;
+	uint32_t index = allocation.node;
+	assert(mNodes[index].used);
+	mNodes[index].used = false;
+	mFreeSize += mNodes[index].size;
+
+	// Merge with the free neighbors, the node of the lowest offset holding the result
+	uint32_t previous = mNodes[index].previous;
+	if (previous != NoSpace && !mNodes[previous].used) {
+		removeFree(previous);
+		mNodes[previous].size += mNodes[index].size;
+		mNodes[previous].next = mNodes[index].next;
+		if (mNodes[index].next != NoSpace) mNodes[mNodes[index].next].previous = previous;
+		mUnusedNodes.push_back(index);
+		index = previous;
+	}
+	uint32_t next = mNodes[index].next;
+	if (next != NoSpace && !mNodes[next].used) {
+		removeFree(next);
+		mNodes[index].size += mNodes[next].size;
+		mNodes[index].next = mNodes[next].next;
+		if (mNodes[next].next != NoSpace) mNodes[mNodes[next].next].previous = index;
+		mUnusedNodes.push_back(next);
+	}
+	insertFree(index);
+}
+
+uint32_t OffsetAllocator::createNode(uint32_t offset, uint32_t size, uint32_t previous, uint32_t next) {
+	uint32_t index;
+	if (!mUnusedNodes.empty()) {
+		index = mUnusedNodes.back();
+		mUnusedNodes.pop_back();
+	}
+	else {
+		index = static_cast<uint32_t>(mNodes.size());
+		mNodes.emplace_back();
+	}
+	Node& node = mNodes[index];
+	node = Node{};
+	node.offset = offset;
+	node.size = size;
+	node.previous = previous;
+	node.next = next;
+	return index;
+}
+
+void OffsetAllocator::insertFree(uint32_t index) {
+	uint32_t bin = binRoundDown(mNodes[index].size);
+	Node& node = mNodes[index];
+	node.binPrevious = NoSpace;
+	node.binNext = mBinHeads[bin];
+	if (node.binNext != NoSpace) mNodes[node.binNext].binPrevious = index;
+	mBinHeads[bin] = index;
+	mFirstLevelMask |= 1u << (bin >> SecondLevelBits);
+	mSecondLevelMasks[bin >> SecondLevelBits] |= uint8_t(1u << (bin & ((1u << SecondLevelBits) - 1)));
+}
+
+void OffsetAllocator::removeFree(uint32_t index) {
+	Node& node = mNodes[index];
+	if (node.binPrevious != NoSpace) {
+		mNodes[node.binPrevious].binNext = node.binNext;
+	}
+	else {
+		uint32_t bin = binRoundDown(node.size);
+		mBinHeads[bin] = node.binNext;
+		if (node.binNext == NoSpace) {
+			uint32_t firstLevel = bin >> SecondLevelBits;
+			mSecondLevelMasks[firstLevel] &= uint8_t(~(1u << (bin & ((1u << SecondLevelBits) - 1))));
+			if (mSecondLevelMasks[firstLevel] == 0) mFirstLevelMask &= ~(1u << firstLevel);
+		}
+	}
+	if (node.binNext != NoSpace) mNodes[node.binNext].binPrevious = node.binPrevious;
+	node.binPrevious = NoSpace;
+	node.binNext = NoSpace;
+}
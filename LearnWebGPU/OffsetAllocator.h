@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Allocator of ranges of [0, capacity), e.g. of elements of a GPU buffer, that
+ * only does the bookkeeping: the memory itself is elsewhere.
+ *
+ * Free ranges are kept in bins as in a two-level segregated fit allocator (TLSF,
+ * Masmano et al. 2004): the bin of a size is given by its leading bit and the 3
+ * bits after it, and two levels of bitmasks tell which bins have ranges, so that
+ * allocating and freeing take constant time. A range is taken from the first
+ * non-empty bin whose sizes are all large enough, or failing that from the bin of
+ * the size itself, and what it has in excess goes back to the bins. Freed ranges
+ * merge with their free neighbors.
+ */
+class OffsetAllocator {
+public:
+	static constexpr uint32_t NoSpace = 0xFFFFFFFF;
+
+	/**
+	 * An allocated range, to give back to free()
+	 */
+	struct Allocation {
+		uint32_t offset = NoSpace;
+		uint32_t size = 0;
+		uint32_t node = NoSpace;
+
+		explicit operator bool() const { return offset != NoSpace; }
+	};
+
+	explicit OffsetAllocator(uint32_t capacity);
+
+	// A range of `size`, or an invalid allocation if no free range is large enough
+	Allocation allocate(uint32_t size);
+	void free(const Allocation& allocation);
+
+	uint32_t capacity() const { return mCapacity; }
+	// Sum of the free ranges, which may be too fragmented for an allocation of that size
+	uint32_t freeSize() const { return mFreeSize; }
+	bool empty() const { return mFreeSize == mCapacity; }
+
+private:
+	static constexpr uint32_t SecondLevelBits = 3;
+	static constexpr uint32_t BinCount = 32 << SecondLevelBits;
+
+	/**
+	 * A range, free or allocated, linked to the ranges before and after it and, when
+	 * free, to the other ranges of its bin
+	 */
+	struct Node {
+		uint32_t offset = 0;
+		uint32_t size = 0;
+		uint32_t previous = NoSpace;
+		uint32_t next = NoSpace;
+		uint32_t binPrevious = NoSpace;
+		uint32_t binNext = NoSpace;
+		bool used = false;
+	};
+
+	// Bin whose sizes are all at most `size`, where free ranges of `size` are stored
+	static uint32_t binRoundDown(uint32_t size);
+	// Bin whose sizes are all at least `size`, where allocations of `size` are looked for
+	static uint32_t binRoundUp(uint32_t size);
+	// First non-empty bin from `bin` on, or NoSpace
+	uint32_t findBin(uint32_t bin) const;
+
+	uint32_t createNode(uint32_t offset, uint32_t size, uint32_t previous, uint32_t next);
+	void insertFree(uint32_t node);
+	void removeFree(uint32_t node);
+
+private:
+	uint32_t mCapacity;
+	uint32_t mFreeSize;
+	std::vector<Node> mNodes;
+	// Nodes of mNodes that no range uses, to reuse before growing it
+	std::vector<uint32_t> mUnusedNodes;
+	std::array<uint32_t, BinCount> mBinHeads;
+	// Bit i of the first level is set if the bins of leading bit i are not all empty
+	uint32_t mFirstLevelMask = 0;
+	std::array<uint8_t, 32> mSecondLevelMasks = {};
+};
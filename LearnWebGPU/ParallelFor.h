@@ -0,0 +1,47 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "MemoryProfiler.h"
+
+#include <algorithm>
+#include <thread>
+
+// Number of threads worth spawning for data-parallel CPU work
+inline unsigned int workerThreadCount() {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+	return 1;
+#else
+	return std::max(1u, std::thread::hardware_concurrency());
+#endif
+}
+
+/**
+ * Split [0, count) into at most workerThreadCount() contiguous ranges of at
+ * least `minRangeSize` elements and call `fn(begin, end)` for each of them, as
+ * tasks of the shared JobSystem. The calling thread processes the last range
+ * itself, then helps with the others until all are done.
+ */
+template <typename Fn>
+void parallelForRanges(size_t count, Fn&& fn, size_t minRangeSize = 4096) {
+	size_t rangeCount = std::min<size_t>(workerThreadCount(), (count + minRangeSize - 1) / std::max<size_t>(minRangeSize, 1));
+	if (rangeCount <= 1) {
+		if (count > 0) fn(size_t(0), count);
+		return;
+	}
+
+	size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+	JobSystem& jobSystem = JobSystem::instance();
+	// Workers allocating for the subsystem of the calling thread (see MemoryProfiler)
+	MemorySubsystem subsystem = MemoryProfiler::subsystem();
+	auto runRange = [&fn, rangeSize, subsystem](size_t r) {
+		MemoryScope scope(subsystem);
+		fn(r * rangeSize, (r + 1) * rangeSize);
+	};
+	JobSystem::TaskGroup ranges;
+	for (size_t r = 0; r + 1 < rangeCount; ++r) {
+		// Two words of captures, stored in the Task itself rather than on the heap
+		jobSystem.run(ranges, [&runRange, r]() { runRange(r); });
+	}
+	fn((rangeCount - 1) * rangeSize, count);
+	jobSystem.wait(ranges);
+}
@@ -0,0 +1,735 @@
+#include "ParticleSystem.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// Elements of the blocks sorted in workgroup memory, 2 per invocation
+constexpr uint32_t SortBlockSize = 512;
+constexpr uint32_t WorkgroupSize = 256;
+// Words of the indirect buffer before the arguments of the sort steps: the draw, then the
+// dispatches of the simulation, of the sort keys and of the block sort, 4 words each
+constexpr uint32_t SortStepArgsOffset = 16;
+
+const char* uniformsSource = R"(
+struct ParticleUniforms {
+	viewMatrix: mat4x4f,
+	projectionMatrix: mat4x4f,
+	emitterPosition: vec3f,
+	emitterRadius: f32,
+	emitterVelocity: vec3f,
+	spread: f32,
+	gravity: vec3f,
+	drag: f32,
+	startColor: vec4f,
+	endColor: vec4f,
+	deltaTime: f32,
+	minLifetime: f32,
+	maxLifetime: f32,
+	size: f32,
+	emitCount: u32,
+	capacity: u32,
+	sortCapacity: u32,
+	emitList: u32,
+	drawList: u32,
+	seed: u32,
+	sorted: u32,
+};
+
+struct Particle {
+	position: vec3f,
+	age: f32,
+	velocity: vec3f,
+	lifetime: f32,
+};
+)";
+
+const char* computeShaderSource = R"(
+struct Counters {
+	// Signed, as emission takes from it before knowing whether some are left
+	deadCount: atomic<i32>,
+	aliveCounts: array<atomic<u32>, 2>,
+};
+
+struct SortStep {
+	blockSize: u32,
+	stride: u32,
+};
+
+@group(0) @binding(0) var<uniform> u: ParticleUniforms;
+@group(0) @binding(1) var<storage, read_write> particles: array<Particle>;
+// The 2 alive lists, of u.capacity indices each
+@group(0) @binding(2) var<storage, read_write> alive: array<u32>;
+@group(0) @binding(3) var<storage, read_write> dead: array<u32>;
+@group(0) @binding(4) var<storage, read_write> counters: Counters;
+// (depth, particle index) pairs, sorted by decreasing depth
+@group(0) @binding(5) var<storage, read_write> sortEntries: array<vec2u>;
+// Group 1 holds either the parameters of a sort step or, for the kernels writing them alone, the
+// indirect arguments, which a dispatch cannot both read and have bound as writable storage
+@group(1) @binding(0) var<uniform> sortStep: SortStep;
+@group(1) @binding(1) var<storage, read_write> indirect: array<u32>;
+
+// PCG hash, a random u32 per input
+fn hash(seed: u32) -> u32 {
+	let state = seed * 747796405u + 2891336453u;
+	let word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+fn random(state: ptr<function, u32>) -> f32 {
+	*state = hash(*state);
+	return f32(*state >> 8u) / 16777216.0;
+}
+
+fn randomInSphere(state: ptr<function, u32>) -> vec3f {
+	let z = random(state) * 2.0 - 1.0;
+	let angle = random(state) * 6.2831853;
+	let radius = pow(random(state), 1.0 / 3.0);
+	let r = sqrt(max(1.0 - z * z, 0.0));
+	return radius * vec3f(r * cos(angle), r * sin(angle), z);
+}
+
+@compute @workgroup_size(256)
+fn reset(@builtin(global_invocation_id) id: vec3u) {
+	if (id.x < u.capacity) {
+		dead[id.x] = id.x;
+	}
+}
+
+@compute @workgroup_size(256)
+fn emit(@builtin(global_invocation_id) id: vec3u) {
+	if (id.x >= u.emitCount) {
+		return;
+	}
+	// Nothing is emitted once the dead list is empty
+	let previous = atomicSub(&counters.deadCount, 1);
+	if (previous <= 0) {
+		atomicAdd(&counters.deadCount, 1);
+		return;
+	}
+	let index = dead[u32(previous - 1)];
+
+	var state = hash(id.x ^ hash(u.seed));
+	var particle: Particle;
+	particle.position = u.emitterPosition + u.emitterRadius * randomInSphere(&state);
+	particle.age = 0.0;
+	particle.velocity = u.emitterVelocity + length(u.emitterVelocity) * u.spread * randomInSphere(&state);
+	particle.lifetime = mix(u.minLifetime, u.maxLifetime, random(&state));
+	particles[index] = particle;
+
+	let slot = atomicAdd(&counters.aliveCounts[u.emitList], 1u);
+	alive[u.emitList * u.capacity + slot] = index;
+}
+
+@compute @workgroup_size(1)
+fn prepareSimulate() {
+	let count = atomicLoad(&counters.aliveCounts[u.emitList]);
+	indirect[4] = (count + 255u) / 256u;
+	indirect[5] = 1u;
+	indirect[6] = 1u;
+	atomicStore(&counters.aliveCounts[u.drawList], 0u);
+}
+
+// Slots reserved by the invocations of a workgroup, then the first one of the workgroup
+var<workgroup> survivorCount: atomic<u32>;
+var<workgroup> expiredCount: atomic<u32>;
+var<workgroup> survivorBase: u32;
+var<workgroup> expiredBase: u32;
+
+@compute @workgroup_size(256)
+fn simulate(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	// Every invocation reaches the barriers, those past the end doing nothing else
+	let count = atomicLoad(&counters.aliveCounts[u.emitList]);
+	var index = 0u;
+	var survives = false;
+	var slot = 0u;
+	if (id.x < count) {
+		index = alive[u.emitList * u.capacity + id.x];
+		var particle = particles[index];
+		particle.age += u.deltaTime;
+		survives = particle.age < particle.lifetime;
+		if (survives) {
+			particle.velocity = (particle.velocity + u.gravity * u.deltaTime) / (1.0 + u.drag * u.deltaTime);
+			particle.position += particle.velocity * u.deltaTime;
+			particles[index] = particle;
+			slot = atomicAdd(&survivorCount, 1u);
+		}
+		else {
+			slot = atomicAdd(&expiredCount, 1u);
+		}
+	}
+	workgroupBarrier();
+	if (localIndex == 0u) {
+		survivorBase = atomicAdd(&counters.aliveCounts[u.drawList], atomicLoad(&survivorCount));
+		expiredBase = u32(atomicAdd(&counters.deadCount, i32(atomicLoad(&expiredCount))));
+	}
+	workgroupBarrier();
+	if (id.x < count) {
+		if (survives) {
+			alive[u.drawList * u.capacity + survivorBase + slot] = index;
+		}
+		else {
+			dead[expiredBase + slot] = index;
+		}
+	}
+}
+
+fn writeDispatch(offset: u32, workgroups: u32) {
+	indirect[offset] = workgroups;
+	indirect[offset + 1u] = 1u;
+	indirect[offset + 2u] = 1u;
+}
+
+@compute @workgroup_size(1)
+fn prepareDraw() {
+	let count = atomicLoad(&counters.aliveCounts[u.drawList]);
+	indirect[0] = 6u;
+	indirect[1] = count;
+	indirect[2] = 0u;
+	indirect[3] = 0u;
+
+	// Same steps as recorded by the CPU, those for blocks larger than the sort running empty
+	var sortSize = 512u;
+	if (count > 512u) {
+		sortSize = min(1u << (32u - countLeadingZeros(count - 1u)), u.sortCapacity);
+	}
+	writeDispatch(8u, sortSize / 256u);
+	writeDispatch(12u, sortSize / 512u);
+	var offset = 16u;
+	for (var blockSize = 1024u; blockSize <= u.sortCapacity; blockSize <<= 1u) {
+		let workgroups = select(0u, sortSize / 512u, blockSize <= sortSize);
+		for (var stride = blockSize >> 1u; stride >= 512u; stride >>= 1u) {
+			writeDispatch(offset, workgroups);
+			offset += 4u;
+		}
+		writeDispatch(offset, workgroups);
+		offset += 4u;
+	}
+}
+
+@compute @workgroup_size(256)
+fn sortKeys(@builtin(global_invocation_id) id: vec3u) {
+	// Padding sorts last, behind every particle
+	var entry = vec2u(0u, 0u);
+	if (id.x < atomicLoad(&counters.aliveCounts[u.drawList])) {
+		let index = alive[u.drawList * u.capacity + id.x];
+		let depth = -(u.viewMatrix * vec4f(particles[index].position, 1.0)).z;
+		entry = vec2u(bitcast<u32>(max(depth, 0.0)), index);
+	}
+	sortEntries[id.x] = entry;
+}
+
+// Whether the pair at i and j = i + stride is out of order, within a block sorted in decreasing
+// order when i & blockSize is 0 and in increasing order otherwise
+fn outOfOrder(a: vec2u, b: vec2u, i: u32, blockSize: u32) -> bool {
+	let decreasing = (i & blockSize) == 0u;
+	return select(a.x > b.x, a.x < b.x, decreasing);
+}
+
+// First element of the pair compared by invocation t at `stride`
+fn pairStart(t: u32, stride: u32) -> u32 {
+	return 2u * stride * (t / stride) + t % stride;
+}
+
+var<workgroup> localEntries: array<vec2u, 512>;
+
+fn compareLocal(localIndex: u32, base: u32, blockSize: u32, stride: u32) {
+	let i = pairStart(localIndex, stride);
+	let a = localEntries[i];
+	let b = localEntries[i + stride];
+	if (outOfOrder(a, b, base + i, blockSize)) {
+		localEntries[i] = b;
+		localEntries[i + stride] = a;
+	}
+}
+
+@compute @workgroup_size(256)
+fn sortBlocks(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let base = group.x * 512u;
+	localEntries[localIndex] = sortEntries[base + localIndex];
+	localEntries[localIndex + 256u] = sortEntries[base + localIndex + 256u];
+	for (var blockSize = 2u; blockSize <= 512u; blockSize <<= 1u) {
+		for (var stride = blockSize >> 1u; stride > 0u; stride >>= 1u) {
+			workgroupBarrier();
+			compareLocal(localIndex, base, blockSize, stride);
+		}
+	}
+	workgroupBarrier();
+	sortEntries[base + localIndex] = localEntries[localIndex];
+	sortEntries[base + localIndex + 256u] = localEntries[localIndex + 256u];
+}
+
+@compute @workgroup_size(256)
+fn sortStep(@builtin(global_invocation_id) id: vec3u) {
+	let i = pairStart(id.x, sortStep.stride);
+	let j = i + sortStep.stride;
+	let a = sortEntries[i];
+	let b = sortEntries[j];
+	if (outOfOrder(a, b, i, sortStep.blockSize)) {
+		sortEntries[i] = b;
+		sortEntries[j] = a;
+	}
+}
+
+@compute @workgroup_size(256)
+fn sortMerge(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	// The strides below 512 of a block size above it, within workgroup memory
+	let base = group.x * 512u;
+	localEntries[localIndex] = sortEntries[base + localIndex];
+	localEntries[localIndex + 256u] = sortEntries[base + localIndex + 256u];
+	for (var stride = 256u; stride > 0u; stride >>= 1u) {
+		workgroupBarrier();
+		compareLocal(localIndex, base, sortStep.blockSize, stride);
+	}
+	workgroupBarrier();
+	sortEntries[base + localIndex] = localEntries[localIndex];
+	sortEntries[base + localIndex + 256u] = localEntries[localIndex + 256u];
+}
+)";
+
+const char* drawShaderSource = R"(
+@group(0) @binding(0) var<uniform> u: ParticleUniforms;
+@group(0) @binding(1) var<storage, read> particles: array<Particle>;
+@group(0) @binding(2) var<storage, read> alive: array<u32>;
+@group(0) @binding(3) var<storage, read> sortEntries: array<vec2u>;
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+	@location(0) corner: vec2f,
+	@location(1) color: vec4f,
+};
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex: u32, @builtin(instance_index) instance: u32) -> VertexOutput {
+	var index = alive[u.drawList * u.capacity + instance];
+	if (u.sorted != 0u) {
+		index = sortEntries[instance].y;
+	}
+	let particle = particles[index];
+	let t = clamp(particle.age / particle.lifetime, 0.0, 1.0);
+
+	// Two triangles facing the camera, in view space
+	var corners = array<vec2f, 6>(
+		vec2f(-1.0, -1.0), vec2f(1.0, -1.0), vec2f(-1.0, 1.0),
+		vec2f(-1.0, 1.0), vec2f(1.0, -1.0), vec2f(1.0, 1.0),
+	);
+	let corner = corners[vertex];
+	let center = u.viewMatrix * vec4f(particle.position, 1.0);
+	let size = u.size * (1.0 + t);
+
+	var out: VertexOutput;
+	out.position = u.projectionMatrix * vec4f(center.xyz + vec3f(corner * size, 0.0), 1.0);
+	out.corner = corner;
+	out.color = mix(u.startColor, u.endColor, t);
+	return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+	let r2 = dot(in.corner, in.corner);
+	if (r2 > 1.0) {
+		discard;
+	}
+	// Premultiplied, additive particles leaving what is behind them as is
+	let alpha = in.color.a * (1.0 - r2) * (1.0 - r2);
+	return vec4f(in.color.rgb * alpha, select(0.0, alpha, u.sorted != 0u));
+}
+)";
+
+} // anonymous namespace
+
+ParticleSystem::ParticleSystem(
+	Device device, PipelineCache& pipelineCache, uint32_t capacity,
+	TextureFormat colorFormat, TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+)
+	: mDevice(device)
+	, mCapacity(std::clamp(capacity, 1u, MaxCapacity))
+	, mSortCapacity(std::max(std::bit_ceil(mCapacity), SortBlockSize))
+{
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Particle uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ParticleSystem");
+
+	bufferDesc.label = "Particle sort steps";
+	bufferDesc.size = uint64_t(std::max(sortStepCount(), 1u)) * mStepStride;
+	mSortStepBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ParticleSystem");
+
+	// Zero-initialized, thus drawing nothing until the first simulation
+	bufferDesc.usage = BufferUsage::Storage;
+	bufferDesc.label = "Particles";
+	bufferDesc.size = uint64_t(mCapacity) * 32;
+	mParticleBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ParticleSystem");
+	bufferDesc.label = "Alive particles";
+	bufferDesc.size = uint64_t(mCapacity) * 2 * sizeof(uint32_t);
+	mAliveBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ParticleSystem");
+	bufferDesc.label = "Dead particles";
+	bufferDesc.size = uint64_t(mCapacity) * sizeof(uint32_t);
+	mDeadBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ParticleSystem");
+	bufferDesc.label = "Particle sort entries";
+	bufferDesc.size = uint64_t(mSortCapacity) * 2 * sizeof(uint32_t);
+	mSortBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ParticleSystem");
+	bufferDesc.label = "Particle counters";
+	bufferDesc.size = 16;
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+	mCounterBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ParticleSystem");
+	bufferDesc.label = "Particle indirect arguments";
+	bufferDesc.size = uint64_t(SortStepArgsOffset + 4 * sortStepCount()) * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::Indirect;
+	mIndirectBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "ParticleSystem");
+
+	// Compute kernels, sharing one layout
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(6, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	for (uint32_t binding = 1; binding < 6; ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+		bindingLayoutEntries[binding].buffer.type = BufferBindingType::Storage;
+	}
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	BindGroupLayout computeLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	BindGroupLayoutEntry stepLayoutEntry = Default;
+	stepLayoutEntry.binding = 0;
+	stepLayoutEntry.visibility = ShaderStage::Compute;
+	stepLayoutEntry.buffer.type = BufferBindingType::Uniform;
+	stepLayoutEntry.buffer.hasDynamicOffset = true;
+	stepLayoutEntry.buffer.minBindingSize = 2 * sizeof(uint32_t);
+	bindGroupLayoutDesc.entryCount = 1;
+	bindGroupLayoutDesc.entries = &stepLayoutEntry;
+	BindGroupLayout stepLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	BindGroupLayoutEntry indirectLayoutEntry = Default;
+	indirectLayoutEntry.binding = 1;
+	indirectLayoutEntry.visibility = ShaderStage::Compute;
+	indirectLayoutEntry.buffer.type = BufferBindingType::Storage;
+	bindGroupLayoutDesc.entries = &indirectLayoutEntry;
+	BindGroupLayout indirectLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	std::array<WGPUBindGroupLayout, 2> computeLayouts = { computeLayout, stepLayout };
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = (uint32_t)computeLayouts.size();
+	layoutDesc.bindGroupLayouts = computeLayouts.data();
+	PipelineLayout computePipelineLayout = pipelineCache.pipelineLayout(layoutDesc);
+	computeLayouts[1] = indirectLayout;
+	PipelineLayout preparePipelineLayout = pipelineCache.pipelineLayout(layoutDesc);
+	std::string computeSource = std::string(uniformsSource) + computeShaderSource;
+	ShaderModule computeModule = pipelineCache.shaderModule(computeSource.c_str());
+	auto computePipeline = [&](const char* entryPoint, PipelineLayout layout) {
+		ComputePipelineDescriptor pipelineDesc{};
+		pipelineDesc.layout = layout;
+		pipelineDesc.compute.module = computeModule;
+		pipelineDesc.compute.entryPoint = entryPoint;
+		pipelineDesc.compute.constantCount = 0;
+		pipelineDesc.compute.constants = nullptr;
+		return pipelineCache.computePipelineAsync(pipelineDesc);
+	};
+	mResetPipeline = computePipeline("reset", computePipelineLayout);
+	mEmitPipeline = computePipeline("emit", computePipelineLayout);
+	mPrepareSimulatePipeline = computePipeline("prepareSimulate", preparePipelineLayout);
+	mSimulatePipeline = computePipeline("simulate", computePipelineLayout);
+	mPrepareDrawPipeline = computePipeline("prepareDraw", preparePipelineLayout);
+	mSortKeysPipeline = computePipeline("sortKeys", computePipelineLayout);
+	mSortBlocksPipeline = computePipeline("sortBlocks", computePipelineLayout);
+	mSortStepPipeline = computePipeline("sortStep", computePipelineLayout);
+	mSortMergePipeline = computePipeline("sortMerge", computePipelineLayout);
+
+	// The draw, reading the particles from the vertex stage
+	std::vector<BindGroupLayoutEntry> drawLayoutEntries(4, Default);
+	drawLayoutEntries[0].binding = 0;
+	drawLayoutEntries[0].visibility = ShaderStage::Vertex | ShaderStage::Fragment;
+	drawLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	drawLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	for (uint32_t binding = 1; binding < 4; ++binding) {
+		drawLayoutEntries[binding].binding = binding;
+		drawLayoutEntries[binding].visibility = ShaderStage::Vertex;
+		drawLayoutEntries[binding].buffer.type = BufferBindingType::ReadOnlyStorage;
+	}
+	bindGroupLayoutDesc.entryCount = (uint32_t)drawLayoutEntries.size();
+	bindGroupLayoutDesc.entries = drawLayoutEntries.data();
+	BindGroupLayout drawLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&drawLayout;
+	std::string drawSource = std::string(uniformsSource) + drawShaderSource;
+	ShaderModule drawModule = pipelineCache.shaderModule(drawSource.c_str());
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.vertex.bufferCount = 0;
+	pipelineDesc.vertex.buffers = nullptr;
+	pipelineDesc.vertex.module = drawModule;
+	pipelineDesc.vertex.entryPoint = "vs_main";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::None;
+
+	FragmentState fragmentState{};
+	fragmentState.module = drawModule;
+	fragmentState.entryPoint = "fs_main";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	// Premultiplied alpha, the same state blending both ways
+	BlendState blendState{};
+	blendState.color.srcFactor = BlendFactor::One;
+	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+	blendState.color.operation = BlendOperation::Add;
+	blendState.alpha = blendState.color;
+	std::array<ColorTargetState, 2> colorTargets{};
+	colorTargets[0].format = colorFormat;
+	colorTargets[0].blend = &blendState;
+	colorTargets[0].writeMask = ColorWriteMask::All;
+	// Particles are not picked, leaving the IDs of what is behind them
+	colorTargets[1].format = idFormat;
+	colorTargets[1].blend = nullptr;
+	colorTargets[1].writeMask = ColorWriteMask::None;
+	fragmentState.targetCount = idFormat == TextureFormat::Undefined ? 1 : 2;
+	fragmentState.targets = colorTargets.data();
+	pipelineDesc.fragment = &fragmentState;
+
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.depthCompare = depthConvention.nearer();
+	depthStencilState.depthWriteEnabled = false;
+	depthStencilState.format = depthConvention.format();
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencilState;
+	pipelineDesc.multisample.count = sampleCount;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+	mDrawPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+
+	if (!valid() || !mUniformBuffer || !mSortStepBuffer || !mAliveBuffer || !mDeadBuffer || !mCounterBuffer || !mIndirectBuffer) {
+		std::cerr << "Could not create the buffers of " << mCapacity << " particles" << std::endl;
+		for (Buffer* buffer : { &mParticleBuffer, &mSortBuffer }) {
+			if (!*buffer) continue;
+			destroyTracked(*buffer);
+			buffer->release();
+			*buffer = nullptr;
+		}
+		return;
+	}
+
+	// Every particle is dead, the reset kernel listing them on the first simulation
+	GpuHandle<Queue> queue = device.getQueue();
+	int32_t counters[4] = { static_cast<int32_t>(mCapacity), 0, 0, 0 };
+	queue->writeBuffer(mCounterBuffer, 0, counters, sizeof(counters));
+
+	// Block size and stride of each step, in the order of prepareDraw
+	std::vector<uint8_t> steps(mSortStepBuffer.getSize(), 0);
+	uint32_t stepIndex = 0;
+	auto addStep = [&](uint32_t blockSize, uint32_t stride) {
+		uint32_t step[2] = { blockSize, stride };
+		std::memcpy(steps.data() + stepIndex++ * mStepStride, step, sizeof(step));
+	};
+	for (uint32_t blockSize = 2 * SortBlockSize; blockSize <= mSortCapacity; blockSize <<= 1) {
+		for (uint32_t stride = blockSize >> 1; stride >= SortBlockSize; stride >>= 1) addStep(blockSize, stride);
+		addStep(blockSize, 0);
+	}
+	queue->writeBuffer(mSortStepBuffer, 0, steps.data(), steps.size());
+
+	std::vector<BindGroupEntry> bindings(6);
+	Buffer computeBuffers[6] = { mUniformBuffer, mParticleBuffer, mAliveBuffer, mDeadBuffer, mCounterBuffer, mSortBuffer };
+	for (uint32_t binding = 0; binding < 6; ++binding) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = computeBuffers[binding];
+		bindings[binding].offset = 0;
+		bindings[binding].size = computeBuffers[binding].getSize();
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = computeLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mComputeBindGroup = device.createBindGroup(bindGroupDesc);
+
+	BindGroupEntry stepBinding{};
+	stepBinding.binding = 0;
+	stepBinding.buffer = mSortStepBuffer;
+	stepBinding.offset = 0;
+	stepBinding.size = 2 * sizeof(uint32_t);
+	bindGroupDesc.layout = stepLayout;
+	bindGroupDesc.entryCount = 1;
+	bindGroupDesc.entries = &stepBinding;
+	mSortStepBindGroup = device.createBindGroup(bindGroupDesc);
+
+	BindGroupEntry indirectBinding{};
+	indirectBinding.binding = 1;
+	indirectBinding.buffer = mIndirectBuffer;
+	indirectBinding.offset = 0;
+	indirectBinding.size = mIndirectBuffer.getSize();
+	bindGroupDesc.layout = indirectLayout;
+	bindGroupDesc.entries = &indirectBinding;
+	mIndirectBindGroup = device.createBindGroup(bindGroupDesc);
+
+	bindings.resize(4);
+	Buffer drawBuffers[4] = { mUniformBuffer, mParticleBuffer, mAliveBuffer, mSortBuffer };
+	for (uint32_t binding = 0; binding < 4; ++binding) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = drawBuffers[binding];
+		bindings[binding].offset = 0;
+		bindings[binding].size = drawBuffers[binding].getSize();
+	}
+	bindGroupDesc.layout = drawLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mDrawBindGroup = device.createBindGroup(bindGroupDesc);
+}
+
+ParticleSystem::~ParticleSystem() {
+	for (BindGroup* bindGroup : { &mDrawBindGroup, &mIndirectBindGroup, &mSortStepBindGroup, &mComputeBindGroup }) {
+		if (*bindGroup) bindGroup->release();
+	}
+	for (Buffer* buffer : { &mSortBuffer, &mIndirectBuffer, &mCounterBuffer, &mDeadBuffer, &mAliveBuffer, &mParticleBuffer, &mSortStepBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+bool ParticleSystem::ready() const {
+	for (const PipelineCache::AsyncComputePipeline* pipeline : {
+		&mResetPipeline, &mEmitPipeline, &mPrepareSimulatePipeline, &mSimulatePipeline, &mPrepareDrawPipeline,
+		&mSortKeysPipeline, &mSortBlocksPipeline, &mSortStepPipeline, &mSortMergePipeline
+	}) {
+		if (!(*pipeline)->ready()) return false;
+	}
+	return mDrawPipeline->ready();
+}
+
+uint32_t ParticleSystem::sortStepCount() const {
+	uint32_t count = 0;
+	for (uint32_t blockSize = 2 * SortBlockSize; blockSize <= mSortCapacity; blockSize <<= 1) {
+		count += static_cast<uint32_t>(std::countr_zero(blockSize / SortBlockSize)) + 1;
+	}
+	return count;
+}
+
+void ParticleSystem::update(Queue queue, float deltaTime, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) {
+	if (!valid()) return;
+	// A long frame, e.g. after a stall, moves particles by a frame of 100 ms at most
+	deltaTime = std::clamp(deltaTime, 0.0f, 0.1f);
+	mStepping = deltaTime > 0.0f && ready();
+
+	// Emitting in whole particles, the fraction left waiting for the next frame
+	uint32_t emitCount = 0;
+	if (mStepping) {
+		mPendingEmission = std::min(mPendingEmission + mEmitter.rate * deltaTime, static_cast<float>(mCapacity));
+		emitCount = static_cast<uint32_t>(mPendingEmission);
+		mPendingEmission -= static_cast<float>(emitCount);
+	}
+
+	mUniforms.viewMatrix = viewMatrix;
+	mUniforms.projectionMatrix = projectionMatrix;
+	mUniforms.emitterPosition = mEmitter.position;
+	mUniforms.emitterRadius = mEmitter.radius;
+	mUniforms.emitterVelocity = mEmitter.velocity;
+	mUniforms.spread = mEmitter.spread;
+	mUniforms.gravity = mEmitter.gravity;
+	mUniforms.drag = mEmitter.drag;
+	mUniforms.startColor = mEmitter.startColor;
+	mUniforms.endColor = mEmitter.endColor;
+	mUniforms.deltaTime = deltaTime;
+	mUniforms.minLifetime = mEmitter.minLifetime;
+	mUniforms.maxLifetime = std::max(mEmitter.maxLifetime, mEmitter.minLifetime);
+	mUniforms.size = mEmitter.size;
+	mUniforms.emitCount = emitCount;
+	mUniforms.capacity = mCapacity;
+	mUniforms.sortCapacity = mSortCapacity;
+	// Simulation moves the particles from one list to the other
+	mUniforms.emitList = mAliveList;
+	mUniforms.drawList = mStepping ? 1 - mAliveList : mAliveList;
+	mUniforms.seed += 1;
+	mUniforms.sorted = mSorted ? 1 : 0;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+bool ParticleSystem::simulate(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites) {
+	if (!valid() || !ready()) return false;
+
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Particles";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setBindGroup(0, mComputeBindGroup, 0, nullptr);
+	uint32_t stepOffset = 0;
+	auto bindSortStep = [&](uint32_t step) {
+		stepOffset = step * mStepStride;
+		computePass.setBindGroup(1, mSortStepBindGroup, 1, &stepOffset);
+	};
+	// Replacing the indirect arguments bound as storage before they are read
+	auto prepare = [&](const PipelineCache::AsyncComputePipeline& pipeline) {
+		computePass.setPipeline(pipeline->pipeline);
+		computePass.setBindGroup(1, mIndirectBindGroup, 0, nullptr);
+		computePass.dispatchWorkgroups(1, 1, 1);
+		bindSortStep(0);
+	};
+	bindSortStep(0);
+
+	if (mResetNeeded) {
+		computePass.setPipeline(mResetPipeline->pipeline);
+		computePass.dispatchWorkgroups((mCapacity + WorkgroupSize - 1) / WorkgroupSize, 1, 1);
+		mResetNeeded = false;
+	}
+	if (mStepping) {
+		if (mUniforms.emitCount > 0) {
+			computePass.setPipeline(mEmitPipeline->pipeline);
+			computePass.dispatchWorkgroups((mUniforms.emitCount + WorkgroupSize - 1) / WorkgroupSize, 1, 1);
+		}
+		prepare(mPrepareSimulatePipeline);
+		computePass.setPipeline(mSimulatePipeline->pipeline);
+		computePass.dispatchWorkgroupsIndirect(mIndirectBuffer, 4 * sizeof(uint32_t));
+		mAliveList = 1 - mAliveList;
+		mStepping = false;
+	}
+	prepare(mPrepareDrawPipeline);
+
+	if (mSorted) {
+		computePass.setPipeline(mSortKeysPipeline->pipeline);
+		computePass.dispatchWorkgroupsIndirect(mIndirectBuffer, 8 * sizeof(uint32_t));
+		computePass.setPipeline(mSortBlocksPipeline->pipeline);
+		computePass.dispatchWorkgroupsIndirect(mIndirectBuffer, 12 * sizeof(uint32_t));
+		// Steps past the alive count are dispatched with no workgroup
+		uint32_t step = 0;
+		for (uint32_t blockSize = 2 * SortBlockSize; blockSize <= mSortCapacity; blockSize <<= 1) {
+			for (uint32_t stride = blockSize >> 1; stride >= SortBlockSize; stride >>= 1, ++step) {
+				computePass.setPipeline(mSortStepPipeline->pipeline);
+				bindSortStep(step);
+				computePass.dispatchWorkgroupsIndirect(mIndirectBuffer, (SortStepArgsOffset + 4 * step) * sizeof(uint32_t));
+			}
+			computePass.setPipeline(mSortMergePipeline->pipeline);
+			bindSortStep(step);
+			computePass.dispatchWorkgroupsIndirect(mIndirectBuffer, (SortStepArgsOffset + 4 * step) * sizeof(uint32_t));
+			++step;
+		}
+	}
+	computePass.end();
+	computePass.release();
+	return true;
+}
+
+void ParticleSystem::draw(RenderPassEncoder renderPass) {
+	if (!valid() || !mDrawPipeline->ready()) return;
+	renderPass.setPipeline(mDrawPipeline->pipeline);
+	renderPass.setBindGroup(0, mDrawBindGroup, 0, nullptr);
+	renderPass.drawIndirect(mIndirectBuffer, 0);
+}
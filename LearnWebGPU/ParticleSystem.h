@@ -0,0 +1,180 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "DepthConvention.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Particles simulated and drawn entirely on the GPU, the CPU only choosing how
+ * many to emit each frame and never reading how many are alive.
+ *
+ * Particles live in a storage buffer of fixed capacity, the indices of the free
+ * ones in a dead list consumed from its end by an atomic counter. Each frame an
+ * emission kernel takes indices from the dead list, as long as there are some,
+ * and appends the new particles to the alive list. The simulation kernel then
+ * integrates the alive particles and compacts them into the other alive list,
+ * those that expired going back to the dead list, each workgroup reserving the
+ * slots of all its invocations with one global atomic. Single invocation kernels
+ * turn the counters into the arguments of the indirect dispatches and of the
+ * indirect draw that follow, so that no count ever makes a round trip to the CPU.
+ *
+ * Particles are billboards, 6 vertices per instance. They blend in premultiplied
+ * alpha, additive particles writing no alpha. Additive ones are drawn in any order,
+ * while alpha blended ones are first sorted back to front by a bitonic sort of
+ * (depth, index) pairs: blocks of 512 are sorted in workgroup memory, then merged
+ * by global steps until their stride fits a workgroup again. The sort covers the
+ * alive count rounded up to a power of two, the steps beyond it dispatching no
+ * workgroup, its cost thus following the particles alive rather than the capacity.
+ */
+class ParticleSystem {
+public:
+	// Workgroups of the kernels dispatched once per particle go up to 65535
+	static constexpr uint32_t MaxCapacity = 1u << 22;
+
+	/**
+	 * Where and how particles are emitted, then moved. Lifetimes are in seconds.
+	 */
+	struct Emitter {
+		// Particles start within a sphere, and fly in a cone along `velocity`, `spread` being the
+		// ratio of its radius to its height
+		glm::vec3 position = { 0.0f, 0.0f, 0.0f };
+		float radius = 0.02f;
+		glm::vec3 velocity = { 0.0f, 0.0f, 2.0f };
+		float spread = 0.4f;
+		glm::vec3 gravity = { 0.0f, 0.0f, -2.0f };
+		// Fraction of the velocity lost per second
+		float drag = 0.3f;
+		// Premultiplied by alpha when drawn, the color fading from start to end over the lifetime
+		glm::vec4 startColor = { 4.0f, 1.6f, 0.4f, 1.0f };
+		glm::vec4 endColor = { 0.4f, 0.1f, 0.05f, 0.0f };
+		float minLifetime = 1.0f;
+		float maxLifetime = 2.0f;
+		// Half the side of the billboards, in world units
+		float size = 0.01f;
+		// Particles per second
+		float rate = 10000.0f;
+	};
+
+	// Up to `capacity` particles, drawn within render passes of a `colorFormat` attachment, an
+	// `idFormat` one (written nothing, Undefined if none) and a depth buffer of `depthConvention`
+	// tested without writing it, of `sampleCount` samples
+	ParticleSystem(
+		wgpu::Device device, PipelineCache& pipelineCache, uint32_t capacity,
+		wgpu::TextureFormat colorFormat, wgpu::TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+	);
+	~ParticleSystem();
+
+	ParticleSystem(const ParticleSystem&) = delete;
+	ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+	// Whether the buffers could be created
+	bool valid() const { return mParticleBuffer != nullptr && mSortBuffer != nullptr; }
+	// Whether the pipelines are built, before which simulate() and draw() record nothing
+	bool ready() const;
+
+	uint32_t capacity() const { return mCapacity; }
+	void setEmitter(const Emitter& emitter) { mEmitter = emitter; }
+	const Emitter& emitter() const { return mEmitter; }
+
+	// Sort back to front, for alpha blending, rather than blending additively
+	void setSorted(bool sorted) { mSorted = sorted; }
+	bool sorted() const { return mSorted; }
+
+	// Upload the parameters of the next simulate(), which moves particles by `deltaTime` seconds
+	// (0 to only draw them again) and sorts them for the camera
+	void update(wgpu::Queue queue, float deltaTime, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix);
+
+	// Record emission, simulation and sorting in a compute pass of their own, before the
+	// pass drawing the particles, or return false if not ready
+	bool simulate(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr);
+
+	// Draw the particles alive after the last simulate(), with the draw arguments it wrote
+	void draw(wgpu::RenderPassEncoder renderPass);
+
+private:
+	/**
+	 * The ParticleUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		glm::mat4 viewMatrix = glm::mat4(1.0f);
+		glm::mat4 projectionMatrix = glm::mat4(1.0f);
+		glm::vec<3, float, glm::packed_highp> emitterPosition = { 0.0f, 0.0f, 0.0f };
+		float emitterRadius = 0.0f;
+		glm::vec<3, float, glm::packed_highp> emitterVelocity = { 0.0f, 0.0f, 0.0f };
+		float spread = 0.0f;
+		glm::vec<3, float, glm::packed_highp> gravity = { 0.0f, 0.0f, 0.0f };
+		float drag = 0.0f;
+		glm::vec4 startColor = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glm::vec4 endColor = { 1.0f, 1.0f, 1.0f, 0.0f };
+		float deltaTime = 0.0f;
+		float minLifetime = 1.0f;
+		float maxLifetime = 1.0f;
+		float size = 0.01f;
+		uint32_t emitCount = 0;
+		uint32_t capacity = 0;
+		uint32_t sortCapacity = 0;
+		// Alive list emitted into and simulated from, and the one sorted and drawn
+		uint32_t emitList = 0;
+		uint32_t drawList = 0;
+		uint32_t seed = 0;
+		uint32_t sorted = 0;
+		uint32_t padding = 0;
+	};
+	static_assert(sizeof(Uniforms) == 256);
+
+	// The steps of the bitonic sort after the sorting of blocks, for sorts of up to mSortCapacity
+	// elements: for each block size k above 512, the global steps merging at strides down to 512,
+	// then the local one finishing the merge
+	uint32_t sortStepCount() const;
+
+private:
+	wgpu::Device mDevice;
+	uint32_t mCapacity = 0;
+	// The capacity rounded up to a power of two, 512 at least
+	uint32_t mSortCapacity = 0;
+	Emitter mEmitter;
+	bool mSorted = false;
+	Uniforms mUniforms;
+
+	// Particles that rate * time asked for but were not emitted yet, and the alive list holding
+	// the particles, which the simulation swaps
+	float mPendingEmission = 0.0f;
+	uint32_t mAliveList = 0;
+	// Whether the next simulate() moves particles, and whether the dead list still needs filling
+	bool mStepping = false;
+	bool mResetNeeded = true;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	// Block size and stride of each sort step, at a stride of mStepStride
+	wgpu::Buffer mSortStepBuffer = nullptr;
+	uint32_t mStepStride = 256;
+	wgpu::Buffer mParticleBuffer = nullptr;
+	// The 2 alive lists one after the other, the dead list, and their counts
+	wgpu::Buffer mAliveBuffer = nullptr;
+	wgpu::Buffer mDeadBuffer = nullptr;
+	wgpu::Buffer mCounterBuffer = nullptr;
+	// Arguments of the indirect draw and dispatches, written by the kernels
+	wgpu::Buffer mIndirectBuffer = nullptr;
+	wgpu::Buffer mSortBuffer = nullptr;
+
+	// Owned by the pipeline cache
+	PipelineCache::AsyncComputePipeline mResetPipeline;
+	PipelineCache::AsyncComputePipeline mEmitPipeline;
+	PipelineCache::AsyncComputePipeline mPrepareSimulatePipeline;
+	PipelineCache::AsyncComputePipeline mSimulatePipeline;
+	PipelineCache::AsyncComputePipeline mPrepareDrawPipeline;
+	PipelineCache::AsyncComputePipeline mSortKeysPipeline;
+	PipelineCache::AsyncComputePipeline mSortBlocksPipeline;
+	PipelineCache::AsyncComputePipeline mSortStepPipeline;
+	PipelineCache::AsyncComputePipeline mSortMergePipeline;
+	PipelineCache::AsyncRenderPipeline mDrawPipeline;
+	wgpu::BindGroup mComputeBindGroup = nullptr;
+	wgpu::BindGroup mSortStepBindGroup = nullptr;
+	wgpu::BindGroup mIndirectBindGroup = nullptr;
+	wgpu::BindGroup mDrawBindGroup = nullptr;
+};
@@ -0,0 +1,136 @@
+#include "PassBudget.h"
+
+#include <algorithm>
+#include <numeric>
+
+PassBudget::PassBudget(const Settings& settings)
+	: mSettings(settings)
+{}
+
+PassBudget::WorkId PassBudget::addWork(const std::string& name, std::vector<std::string> passNames, int priority, bool halfRate) {
+	Work work;
+	work.name = name;
+	work.passNames = std::move(passNames);
+	work.priority = priority;
+	work.halfRate = halfRate;
+	mWork.push_back(std::move(work));
+	return static_cast<WorkId>(mWork.size() - 1);
+}
+
+double PassBudget::costFraction(Level level) const {
+	switch (level) {
+	case Level::Full: return 1.0;
+	case Level::Reduced: return 0.5;
+	case Level::Deferred: return 1.0 / std::max(mSettings.deferredInterval, 1u);
+	}
+	return 1.0;
+}
+
+bool PassBudget::update(double gpuFrameMs, const std::vector<GpuProfiler::PassTiming>& timings) {
+	// Costs follow the timings even while changes are ignored
+	for (Work& work : mWork) {
+		double costMs = 0.0;
+		bool measured = false;
+		for (const std::string& passName : work.passNames) {
+			auto it = std::find_if(timings.begin(), timings.end(), [&](const GpuProfiler::PassTiming& timing) {
+				return timing.name == passName;
+			});
+			if (it == timings.end()) continue;
+			costMs += it->averageMs;
+			measured = true;
+		}
+		if (measured) work.costMs = costMs;
+	}
+	std::vector<bool> requested(mWork.size());
+	for (size_t i = 0; i < mWork.size(); ++i) {
+		requested[i] = mWork[i].requested;
+		mWork[i].requested = false;
+	}
+	// Work that did not run saves nothing, nor does work not measured yet
+	auto sheddable = [&](size_t i) {
+		return requested[i] && mWork[i].costMs > 0.0 && mWork[i].level != Level::Deferred;
+	};
+
+	mExhausted = true;
+	for (size_t i = 0; i < mWork.size(); ++i) {
+		if (sheddable(i)) mExhausted = false;
+	}
+	if (mCooldown > 0) {
+		--mCooldown;
+		return false;
+	}
+	if (gpuFrameMs <= 0.0) return false;
+
+	// Cost of a frame of the work at Full, those that run every frame at Reduced doing half as much
+	auto fullCostMs = [](const Work& work) {
+		return !work.halfRate && work.level != Level::Full ? 2.0 * work.costMs : work.costMs;
+	};
+	std::vector<size_t> order(mWork.size());
+	std::iota(order.begin(), order.end(), size_t(0));
+	std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return mWork[a].priority < mWork[b].priority; });
+
+	bool changed = false;
+	if (gpuFrameMs > mSettings.targetFrameMs) {
+		double excessMs = gpuFrameMs - mSettings.targetFrameMs;
+		for (size_t i : order) {
+			Work& work = mWork[i];
+			if (!sheddable(i)) continue;
+			// Of the level measured
+			double costMs = fullCostMs(work);
+			while (work.level != Level::Deferred && excessMs > 0.0) {
+				Level lower = static_cast<Level>(static_cast<int>(work.level) + 1);
+				excessMs -= costMs * (costFraction(work.level) - costFraction(lower));
+				work.level = lower;
+				changed = true;
+			}
+			if (excessMs <= 0.0) break;
+		}
+	}
+	else if (gpuFrameMs < mSettings.headroom * mSettings.targetFrameMs) {
+		double roomMs = mSettings.headroom * mSettings.targetFrameMs - gpuFrameMs;
+		for (auto it = order.rbegin(); it != order.rend(); ++it) {
+			Work& work = mWork[*it];
+			if (work.level == Level::Full) continue;
+			Level higher = static_cast<Level>(static_cast<int>(work.level) - 1);
+			// Lower priorities wait for this one to fit
+			if (fullCostMs(work) * (costFraction(higher) - costFraction(work.level)) > roomMs) break;
+			work.level = higher;
+			changed = true;
+			break;
+		}
+	}
+	if (changed) {
+		mCooldown = mSettings.cooldownFrameCount;
+		mExhausted = std::none_of(order.begin(), order.end(), sheddable);
+	}
+	return changed;
+}
+
+bool PassBudget::due(WorkId id) {
+	Work& work = mWork[id];
+	work.requested = true;
+	uint32_t interval = 1;
+	if (work.level == Level::Reduced && work.halfRate) interval = 2;
+	if (work.level == Level::Deferred) interval = std::max(mSettings.deferredInterval, 1u);
+	// Offset by the work, for frames to take turns
+	return (mFrameIndex + id) % interval == 0;
+}
+
+void PassBudget::setSettings(const Settings& settings) {
+	mSettings = settings;
+	mCooldown = mSettings.cooldownFrameCount;
+}
+
+void PassBudget::reset() {
+	for (Work& work : mWork) work.level = Level::Full;
+	mCooldown = mSettings.cooldownFrameCount;
+}
+
+const char* PassBudget::levelName(Level level) {
+	switch (level) {
+	case Level::Full: return "full";
+	case Level::Reduced: return "reduced";
+	case Level::Deferred: return "deferred";
+	}
+	return "unknown";
+}
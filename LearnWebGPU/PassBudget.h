@@ -0,0 +1,104 @@
+#pragma once
+
+#include "GpuProfiler.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Scheduler of the optional work of frames, picking from the GPU time the profiler
+ * measured for its passes which of it runs in full, degraded or deferred, so that
+ * frames stay within a budget without the quality of the whole frame dropping, as
+ * it does with DynamicResolution.
+ *
+ * Work is added with the names of the passes it records, whose average duration
+ * is its cost, and a priority. When a measured frame goes over budget, the work of
+ * lowest priority steps down first, one level at a time, until what the steps are
+ * estimated to save covers the excess. While frames stay well below budget, the
+ * degraded work of highest priority steps back up, one level per change, if what
+ * it costs again fits in the headroom. Like UploadBudget, which governs streaming
+ * against the same budget, the frames measured right after a change are ignored.
+ *
+ * At Reduced, work either runs every other frame or does less every frame, as
+ * decided by the caller from level(), which halves its cost either way; at Deferred
+ * it runs once every `deferredInterval` frames, doing as little as at Reduced.
+ * Work that skips frames takes turns with the other work doing so, rather than all
+ * of it running in the same frame.
+ */
+class PassBudget {
+public:
+	enum class Level {
+		Full,
+		Reduced,
+		Deferred,
+	};
+
+	struct Settings {
+		// GPU time budget of a frame
+		double targetFrameMs = 15.0;
+		// Fraction of the budget under which degraded work steps back up
+		double headroom = 0.8;
+		// Frames between two runs of deferred work
+		uint32_t deferredInterval = 8;
+		// Measured frames ignored after a change, at least the latency of the timings
+		uint32_t cooldownFrameCount = 4;
+	};
+
+	using WorkId = uint32_t;
+
+	explicit PassBudget(const Settings& settings);
+
+	// Add work recording the passes `passNames`, stepped down before work of a higher `priority`.
+	// At Reduced, it runs every other frame if `halfRate`, otherwise every frame and it is up to
+	// the caller to do less.
+	WorkId addWork(const std::string& name, std::vector<std::string> passNames, int priority, bool halfRate);
+
+	// Account for the timings of a newly measured frame, returning whether a level changed
+	bool update(double gpuFrameMs, const std::vector<GpuProfiler::PassTiming>& timings);
+
+	// Start a new frame, in which due() tells what runs
+	void beginFrame() { ++mFrameIndex; }
+
+	// Whether the work runs this frame, to ask every frame it could run, which marks it as
+	// running for update() to step it down
+	bool due(WorkId id);
+	Level level(WorkId id) const { return mWork[id].level; }
+	// Whether all the work that ran and was measured by the last update() is deferred, past which
+	// frames over budget need other measures, e.g. a lower resolution
+	bool exhausted() const { return mExhausted; }
+	const std::string& name(WorkId id) const { return mWork[id].name; }
+	size_t workCount() const { return mWork.size(); }
+
+	// Change the budget, e.g. for another frame rate, timings measured until then being ignored
+	void setSettings(const Settings& settings);
+	// Bring all work back to Full
+	void reset();
+
+	const Settings& settings() const { return mSettings; }
+
+	static const char* levelName(Level level);
+
+private:
+	struct Work {
+		std::string name;
+		std::vector<std::string> passNames;
+		int priority = 0;
+		bool halfRate = false;
+		Level level = Level::Full;
+		// Average GPU time of a run at the current level, in milliseconds, 0 until measured
+		double costMs = 0.0;
+		// Whether due() was asked since the last update()
+		bool requested = false;
+	};
+
+	// Fraction of the cost of work at Full that it costs per frame at `level`
+	double costFraction(Level level) const;
+
+private:
+	Settings mSettings;
+	std::vector<Work> mWork;
+	uint64_t mFrameIndex = 0;
+	uint32_t mCooldown = 0;
+	bool mExhausted = true;
+};
@@ -0,0 +1,994 @@
+#include "PipelineCache.h"
+#include "DeviceEvents.h"
+#include "MappedFile.h"
+#include "ResourceManager.h"
+#include "StartupProfiler.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <deque>
+#include <iostream>
+#include <string_view>
+#include <unordered_set>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif // __EMSCRIPTEN__
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
+using namespace wgpu;
+
+namespace {
+
+constexpr std::string_view ManifestFirstLine = "LearnWebGPU pipeline manifest 1";
+
+/**
+ * 64-bit FNV-1a hash of a sequence of values
+ */
+class Hasher {
+public:
+	explicit Hasher(std::string_view tag) { add(tag); }
+
+	void add(std::string_view bytes) {
+		for (char c : bytes) {
+			mHash = (mHash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+		}
+		// Separate consecutive strings
+		add(uint64_t(bytes.size()));
+	}
+
+	void add(const char* string) { add(std::string_view(string ? string : "")); }
+
+	void add(uint64_t value) {
+		for (int i = 0; i < 8; ++i) {
+			mHash = (mHash ^ ((value >> (8 * i)) & 0xff)) * 0x100000001b3ull;
+		}
+	}
+
+	void add(double value) { add(std::bit_cast<uint64_t>(value)); }
+	void add(float value) { add(uint64_t(std::bit_cast<uint32_t>(value))); }
+
+	// Enums, flags and integers
+	template <typename T>
+	void addValue(T value) { add(static_cast<uint64_t>(value)); }
+
+	// Key of an object the descriptor refers to
+	void addObject(uint64_t key) { add(key); }
+
+	uint64_t value() const { return mHash; }
+
+private:
+	uint64_t mHash = 0xcbf29ce484222325ull;
+};
+
+/**
+ * Same values as Hasher, written as the fields of a manifest record
+ */
+class ManifestWriter {
+public:
+	void add(std::string_view bytes) {
+		mFields += ' ';
+		mFields += std::to_string(bytes.size());
+		mFields += ':';
+		mFields += bytes;
+	}
+
+	void add(const char* string) { add(std::string_view(string ? string : "")); }
+
+	void add(uint64_t value) {
+		mFields += ' ';
+		mFields += std::to_string(value);
+	}
+
+	void add(double value) { add(std::bit_cast<uint64_t>(value)); }
+	void add(float value) { add(uint64_t(std::bit_cast<uint32_t>(value))); }
+
+	template <typename T>
+	void addValue(T value) { add(static_cast<uint64_t>(value)); }
+
+	void addObject(uint64_t key) {
+		add(key);
+		// Automatic layouts are no objects
+		if (key != 0) mDependencies.push_back(key);
+	}
+
+	std::string& fields() { return mFields; }
+	std::vector<uint64_t>& dependencies() { return mDependencies; }
+
+private:
+	std::string mFields;
+	std::vector<uint64_t> mDependencies;
+};
+
+/**
+ * Reads back what a ManifestWriter wrote, in the same order, failing on the first value
+ * that is missing or malformed
+ */
+class ManifestReader {
+public:
+	explicit ManifestReader(std::string_view text) : mText(text) {}
+
+	uint64_t number() {
+		skipSpaces();
+		uint64_t value = 0;
+		auto result = std::from_chars(mText.data(), mText.data() + mText.size(), value);
+		if (result.ec != std::errc()) {
+			mFailed = true;
+			return 0;
+		}
+		mText.remove_prefix(result.ptr - mText.data());
+		return value;
+	}
+
+	std::string_view string() {
+		uint64_t size = number();
+		if (mFailed || mText.empty() || mText[0] != ':' || mText.size() - 1 < size) {
+			mFailed = true;
+			return {};
+		}
+		std::string_view bytes = mText.substr(1, size);
+		mText.remove_prefix(1 + size);
+		return bytes;
+	}
+
+	// Number of items that follow, each taking a character at least
+	size_t count() {
+		uint64_t count = number();
+		if (count > mText.size()) {
+			mFailed = true;
+			return 0;
+		}
+		return static_cast<size_t>(count);
+	}
+
+	// Enums, flags and integers
+	template <typename T>
+	void read(T& value) { value = static_cast<T>(number()); }
+	void read(double& value) { value = std::bit_cast<double>(number()); }
+	void read(float& value) { value = std::bit_cast<float>(static_cast<uint32_t>(number())); }
+
+	// A string given to webgpu.h, kept in `storage`, null when empty
+	const char* cString(std::deque<std::string>& storage) {
+		std::string_view bytes = string();
+		if (bytes.empty()) return nullptr;
+		return storage.emplace_back(bytes).c_str();
+	}
+
+	// The object of the key read, among those created so far, or null
+	void* object(const std::unordered_map<uint64_t, void*>& objects) {
+		uint64_t key = number();
+		if (key == 0) return nullptr;
+		auto it = objects.find(key);
+		if (it == objects.end()) {
+			mFailed = true;
+			return nullptr;
+		}
+		return it->second;
+	}
+
+	std::string_view word() {
+		skipSpaces();
+		size_t end = std::min(mText.find_first_of(" \n"), mText.size());
+		std::string_view word = mText.substr(0, end);
+		mText.remove_prefix(end);
+		if (word.empty()) mFailed = true;
+		return word;
+	}
+
+	bool atEnd() {
+		skipSpaces();
+		return mText.empty();
+	}
+
+	bool failed() const { return mFailed; }
+
+private:
+	void skipSpaces() {
+		while (!mText.empty() && (mText[0] == ' ' || mText[0] == '\n')) mText.remove_prefix(1);
+	}
+
+private:
+	std::string_view mText;
+	bool mFailed = false;
+};
+
+template <typename Sink>
+void addConstants(Sink& sink, size_t constantCount, const WGPUConstantEntry* constants) {
+	sink.addValue(constantCount);
+	for (size_t i = 0; i < constantCount; ++i) {
+		sink.add(constants[i].key);
+		sink.add(constants[i].value);
+	}
+}
+
+template <typename Sink>
+void addStencilFace(Sink& sink, const WGPUStencilFaceState& face) {
+	sink.addValue(face.compare);
+	sink.addValue(face.failOp);
+	sink.addValue(face.depthFailOp);
+	sink.addValue(face.passOp);
+}
+
+template <typename Sink>
+void addBlendComponent(Sink& sink, const WGPUBlendComponent& component) {
+	sink.addValue(component.operation);
+	sink.addValue(component.srcFactor);
+	sink.addValue(component.dstFactor);
+}
+
+void readConstants(ManifestReader& reader, std::vector<WGPUConstantEntry>& constants, std::deque<std::string>& strings) {
+	constants.resize(reader.count());
+	for (WGPUConstantEntry& constant : constants) {
+		constant = {};
+		constant.key = reader.cString(strings);
+		reader.read(constant.value);
+	}
+}
+
+void readStencilFace(ManifestReader& reader, WGPUStencilFaceState& face) {
+	reader.read(face.compare);
+	reader.read(face.failOp);
+	reader.read(face.depthFailOp);
+	reader.read(face.passOp);
+}
+
+void readBlendComponent(ManifestReader& reader, WGPUBlendComponent& component) {
+	reader.read(component.operation);
+	reader.read(component.srcFactor);
+	reader.read(component.dstFactor);
+}
+
+template <typename T>
+std::shared_ptr<PipelineCache::AsyncPipeline<T>> readyPipeline(T pipeline) {
+	auto result = std::make_shared<PipelineCache::AsyncPipeline<T>>();
+	result->pipeline = pipeline;
+	result->status = pipeline ? PipelineCache::AsyncPipeline<T>::Status::Ready : PipelineCache::AsyncPipeline<T>::Status::Failed;
+	return result;
+}
+
+template <typename Pending>
+bool isPending(const Pending& entry) {
+	return entry.second.result->status == std::remove_cvref_t<decltype(*entry.second.result)>::Status::Pending;
+}
+
+} // anonymous namespace
+
+PipelineCache::SharedBindGroup::~SharedBindGroup() {
+	if (bindGroup) bindGroup.release();
+	for (Buffer buffer : buffers) buffer.release();
+	for (TextureView textureView : textureViews) textureView.release();
+}
+
+PipelineCache::PipelineCache(Device device)
+	: mDevice(device)
+{}
+
+PipelineCache::~PipelineCache() {
+	clear();
+}
+
+ShaderModule PipelineCache::shaderModule(const std::string& source) {
+	Hasher hasher("ShaderModule");
+	hasher.add(source);
+	record("shaderModule", hasher.value(), false, [&](ManifestWriter& writer) { writer.add(source); });
+	return findOrCreate(mShaderModules, hasher.value(), [&]() {
+		StartupStage startupStage("Shader compile");
+		return ResourceManager::createShaderModule(source, mDevice);
+	});
+}
+
+BindGroupLayout PipelineCache::bindGroupLayout(const BindGroupLayoutDescriptor& descriptor) {
+	uint64_t key = bindGroupLayoutKey(descriptor);
+	record("bindGroupLayout", key, false, [&](ManifestWriter& writer) { describeBindGroupLayout(descriptor, writer); });
+	return findOrCreate(mBindGroupLayouts, key, [&]() {
+		return mDevice.createBindGroupLayout(descriptor);
+	});
+}
+
+PipelineLayout PipelineCache::pipelineLayout(const PipelineLayoutDescriptor& descriptor) {
+	uint64_t key = pipelineLayoutKey(descriptor);
+	record("pipelineLayout", key, false, [&](ManifestWriter& writer) { describePipelineLayout(descriptor, writer); });
+	return findOrCreate(mPipelineLayouts, key, [&]() {
+		return mDevice.createPipelineLayout(descriptor);
+	});
+}
+
+RenderPipeline PipelineCache::renderPipeline(const RenderPipelineDescriptor& descriptor) {
+	uint64_t key = renderPipelineKey(descriptor);
+	record("renderPipeline", key, true, [&](ManifestWriter& writer) { describeRenderPipeline(descriptor, writer); });
+	return findOrCreate(mRenderPipelines, key, [&]() {
+		StartupStage startupStage("Pipeline creation");
+		return mDevice.createRenderPipeline(descriptor);
+	});
+}
+
+ComputePipeline PipelineCache::computePipeline(const ComputePipelineDescriptor& descriptor) {
+	uint64_t key = computePipelineKey(descriptor);
+	record("computePipeline", key, true, [&](ManifestWriter& writer) { describeComputePipeline(descriptor, writer); });
+	return findOrCreate(mComputePipelines, key, [&]() {
+		StartupStage startupStage("Pipeline creation");
+		return mDevice.createComputePipeline(descriptor);
+	});
+}
+
+Sampler PipelineCache::sampler(const SamplerDescriptor& descriptor) {
+	return findOrCreate(mSamplers, samplerKey(descriptor), [&]() {
+		return mDevice.createSampler(descriptor);
+	});
+}
+
+PipelineCache::BindGroupHandle PipelineCache::bindGroup(const BindGroupDescriptor& descriptor) {
+	uint64_t key = bindGroupKey(descriptor);
+	auto it = mBindGroups.find(key);
+	if (it != mBindGroups.end()) {
+		if (BindGroupHandle cached = it->second.lock()) {
+			++mHitCount;
+			return cached;
+		}
+	}
+
+	++mMissCount;
+	std::erase_if(mBindGroups, [](const auto& entry) { return entry.second.expired(); });
+	BindGroup bindGroup = mDevice.createBindGroup(descriptor);
+	if (!bindGroup) return nullptr;
+	auto handle = std::make_shared<SharedBindGroup>();
+	handle->bindGroup = bindGroup;
+	for (size_t i = 0; i < descriptor.entryCount; ++i) {
+		const WGPUBindGroupEntry& entry = descriptor.entries[i];
+		if (entry.buffer) {
+			handle->buffers.emplace_back(entry.buffer);
+			handle->buffers.back().reference();
+		}
+		if (entry.textureView) {
+			handle->textureViews.emplace_back(entry.textureView);
+			handle->textureViews.back().reference();
+		}
+	}
+	mBindGroups[key] = handle;
+	return handle;
+}
+
+PipelineCache::AsyncRenderPipeline PipelineCache::renderPipelineAsync(const RenderPipelineDescriptor& descriptor) {
+#ifdef WEBGPU_BACKEND_WGPU
+	// wgpu-native does not implement createRenderPipelineAsync yet
+	return readyPipeline(renderPipeline(descriptor));
+#else
+	uint64_t key = renderPipelineKey(descriptor);
+	record("renderPipeline", key, true, [&](ManifestWriter& writer) { describeRenderPipeline(descriptor, writer); });
+	return findOrCreateAsync(mRenderPipelines, mPendingRenderPipelines, key, [&](auto&& callback) {
+		return mDevice.createRenderPipelineAsync(descriptor, std::move(callback));
+	});
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+PipelineCache::AsyncComputePipeline PipelineCache::computePipelineAsync(const ComputePipelineDescriptor& descriptor) {
+#ifdef WEBGPU_BACKEND_WGPU
+	// wgpu-native does not implement createComputePipelineAsync yet
+	return readyPipeline(computePipeline(descriptor));
+#else
+	uint64_t key = computePipelineKey(descriptor);
+	record("computePipeline", key, true, [&](ManifestWriter& writer) { describeComputePipeline(descriptor, writer); });
+	return findOrCreateAsync(mComputePipelines, mPendingComputePipelines, key, [&](auto&& callback) {
+		return mDevice.createComputePipelineAsync(descriptor, std::move(callback));
+	});
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+size_t PipelineCache::pendingCount() const {
+	return std::count_if(mPendingRenderPipelines.begin(), mPendingRenderPipelines.end(), isPending<decltype(mPendingRenderPipelines)::value_type>)
+		+ std::count_if(mPendingComputePipelines.begin(), mPendingComputePipelines.end(), isPending<decltype(mPendingComputePipelines)::value_type>);
+}
+
+void PipelineCache::clear() {
+	// Callbacks of pending requests refer to the cache
+	waitForPendingPipelines();
+	mPendingRenderPipelines.clear();
+	mPendingComputePipelines.clear();
+
+	// Release pipelines before what they were built from
+	for (auto& [key, pipeline] : mRenderPipelines) pipeline.release();
+	for (auto& [key, pipeline] : mComputePipelines) pipeline.release();
+	for (auto& [key, layout] : mPipelineLayouts) layout.release();
+	for (auto& [key, sampler] : mSamplers) sampler.release();
+	for (auto& [key, layout] : mBindGroupLayouts) layout.release();
+	for (auto& [key, shaderModule] : mShaderModules) shaderModule.release();
+	for (auto& [handle, release] : mForeignObjects) release(handle);
+	mRenderPipelines.clear();
+	mComputePipelines.clear();
+	mPipelineLayouts.clear();
+	mSamplers.clear();
+	mBindGroups.clear();
+	mBindGroupLayouts.clear();
+	mShaderModules.clear();
+	mForeignObjects.clear();
+	mObjectKeys.clear();
+}
+
+bool PipelineCache::saveManifest(const std::filesystem::path& path) {
+	// Requests of this session add up with those of earlier ones
+	Manifest manifest;
+	manifest.read(path);
+	for (uint64_t key : mManifest.order) {
+		const ManifestRecord& record = mManifest.records.at(key);
+		auto [it, inserted] = manifest.records.try_emplace(key, record);
+		if (inserted) manifest.order.push_back(key);
+		else it->second.uses += record.uses;
+	}
+	if (!manifest.write(path)) return false;
+	// So that they are not added again by the next save
+	for (auto& [key, record] : mManifest.records) record.uses = 0;
+	return true;
+}
+
+size_t PipelineCache::precache(const std::filesystem::path& path) {
+#ifdef WEBGPU_BACKEND_WGPU
+	// Asynchronous pipelines are built synchronously, which would only move the hitches to
+	// the startup
+	(void)path;
+	return 0;
+#else
+	Manifest manifest;
+	if (!manifest.read(path)) return 0;
+	std::unordered_map<uint64_t, void*> objects;
+	size_t count = 0;
+	mPrecaching = true;
+	for (uint64_t key : manifest.pipelines()) {
+		if (createRecorded(manifest, key, objects)) ++count;
+	}
+	mPrecaching = false;
+	return count;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+template <typename Describe>
+void PipelineCache::record(std::string_view kind, uint64_t key, bool pipeline, Describe&& describe) {
+	if (!mRecording) return;
+	auto [it, inserted] = mManifest.records.try_emplace(key);
+	ManifestRecord& record = it->second;
+	if (inserted) {
+		ManifestWriter writer;
+		describe(writer);
+		record.kind = kind;
+		record.fields = std::move(writer.fields());
+		record.dependencies = std::move(writer.dependencies());
+		mManifest.order.push_back(key);
+	}
+	// Requests of precache() are no uses
+	if (pipeline && !mPrecaching) ++record.uses;
+}
+
+bool PipelineCache::createRecorded(const Manifest& manifest, uint64_t key, std::unordered_map<uint64_t, void*>& objects) {
+	// Objects failing to be created are null
+	auto created = objects.find(key);
+	if (created != objects.end()) return created->second != nullptr;
+	objects[key] = nullptr;
+
+	const ManifestRecord& record = manifest.records.at(key);
+	for (uint64_t dependency : record.dependencies) {
+		if (!createRecorded(manifest, dependency, objects)) return false;
+	}
+
+	// Values are read in the order of the describe functions
+	ManifestReader reader(record.fields);
+	std::deque<std::string> strings;
+	void* object = nullptr;
+	if (record.kind == "shaderModule") {
+		std::string source(reader.string());
+		if (reader.failed() || !reader.atEnd()) return false;
+		object = static_cast<void*>(static_cast<WGPUShaderModule>(shaderModule(source)));
+	}
+	else if (record.kind == "bindGroupLayout") {
+		std::vector<WGPUBindGroupLayoutEntry> entries(reader.count());
+		for (WGPUBindGroupLayoutEntry& entry : entries) {
+			entry = {};
+			reader.read(entry.binding);
+			reader.read(entry.visibility);
+			reader.read(entry.buffer.type);
+			reader.read(entry.buffer.hasDynamicOffset);
+			reader.read(entry.buffer.minBindingSize);
+			reader.read(entry.sampler.type);
+			reader.read(entry.texture.sampleType);
+			reader.read(entry.texture.viewDimension);
+			reader.read(entry.texture.multisampled);
+			reader.read(entry.storageTexture.access);
+			reader.read(entry.storageTexture.format);
+			reader.read(entry.storageTexture.viewDimension);
+		}
+		if (reader.failed() || !reader.atEnd()) return false;
+		BindGroupLayoutDescriptor descriptor{};
+		descriptor.entryCount = entries.size();
+		descriptor.entries = entries.data();
+		object = static_cast<void*>(static_cast<WGPUBindGroupLayout>(bindGroupLayout(descriptor)));
+	}
+	else if (record.kind == "pipelineLayout") {
+		std::vector<WGPUBindGroupLayout> layouts(reader.count());
+		for (WGPUBindGroupLayout& layout : layouts) {
+			layout = static_cast<WGPUBindGroupLayout>(reader.object(objects));
+		}
+		// Push constants, recorded with wgpu-native only, which does not precache
+		if (reader.count() > 0 || reader.failed() || !reader.atEnd()) return false;
+		PipelineLayoutDescriptor descriptor{};
+		descriptor.bindGroupLayoutCount = layouts.size();
+		descriptor.bindGroupLayouts = layouts.data();
+		object = static_cast<void*>(static_cast<WGPUPipelineLayout>(pipelineLayout(descriptor)));
+	}
+	else if (record.kind == "renderPipeline") {
+		RenderPipelineDescriptor descriptor{};
+		descriptor.layout = static_cast<WGPUPipelineLayout>(reader.object(objects));
+
+		WGPUVertexState& vertex = descriptor.vertex;
+		vertex.module = static_cast<WGPUShaderModule>(reader.object(objects));
+		vertex.entryPoint = reader.cString(strings);
+		std::vector<WGPUConstantEntry> vertexConstants;
+		readConstants(reader, vertexConstants, strings);
+		vertex.constantCount = vertexConstants.size();
+		vertex.constants = vertexConstants.data();
+		std::vector<WGPUVertexBufferLayout> buffers(reader.count());
+		std::vector<std::vector<WGPUVertexAttribute>> attributes(buffers.size());
+		for (size_t i = 0; i < buffers.size(); ++i) {
+			WGPUVertexBufferLayout& buffer = buffers[i];
+			buffer = {};
+			reader.read(buffer.arrayStride);
+			reader.read(buffer.stepMode);
+			attributes[i].resize(reader.count());
+			for (WGPUVertexAttribute& attribute : attributes[i]) {
+				attribute = {};
+				reader.read(attribute.format);
+				reader.read(attribute.offset);
+				reader.read(attribute.shaderLocation);
+			}
+			buffer.attributeCount = attributes[i].size();
+			buffer.attributes = attributes[i].data();
+		}
+		vertex.bufferCount = buffers.size();
+		vertex.buffers = buffers.data();
+
+		reader.read(descriptor.primitive.topology);
+		reader.read(descriptor.primitive.stripIndexFormat);
+		reader.read(descriptor.primitive.frontFace);
+		reader.read(descriptor.primitive.cullMode);
+
+		WGPUDepthStencilState depthStencil = {};
+		if (reader.number() != 0) {
+			reader.read(depthStencil.format);
+			reader.read(depthStencil.depthWriteEnabled);
+			reader.read(depthStencil.depthCompare);
+			readStencilFace(reader, depthStencil.stencilFront);
+			readStencilFace(reader, depthStencil.stencilBack);
+			reader.read(depthStencil.stencilReadMask);
+			reader.read(depthStencil.stencilWriteMask);
+			reader.read(depthStencil.depthBias);
+			reader.read(depthStencil.depthBiasSlopeScale);
+			reader.read(depthStencil.depthBiasClamp);
+			descriptor.depthStencil = &depthStencil;
+		}
+
+		reader.read(descriptor.multisample.count);
+		reader.read(descriptor.multisample.mask);
+		reader.read(descriptor.multisample.alphaToCoverageEnabled);
+
+		WGPUFragmentState fragment = {};
+		std::vector<WGPUConstantEntry> fragmentConstants;
+		std::vector<WGPUColorTargetState> targets;
+		std::vector<WGPUBlendState> blends;
+		if (reader.number() != 0) {
+			fragment.module = static_cast<WGPUShaderModule>(reader.object(objects));
+			fragment.entryPoint = reader.cString(strings);
+			readConstants(reader, fragmentConstants, strings);
+			fragment.constantCount = fragmentConstants.size();
+			fragment.constants = fragmentConstants.data();
+			targets.resize(reader.count());
+			blends.resize(targets.size());
+			for (size_t i = 0; i < targets.size(); ++i) {
+				WGPUColorTargetState& target = targets[i];
+				target = {};
+				reader.read(target.format);
+				reader.read(target.writeMask);
+				if (reader.number() != 0) {
+					readBlendComponent(reader, blends[i].color);
+					readBlendComponent(reader, blends[i].alpha);
+					target.blend = &blends[i];
+				}
+			}
+			fragment.targetCount = targets.size();
+			fragment.targets = targets.data();
+			descriptor.fragment = &fragment;
+		}
+		if (reader.failed() || !reader.atEnd()) return false;
+		renderPipelineAsync(descriptor);
+		return true;
+	}
+	else if (record.kind == "computePipeline") {
+		ComputePipelineDescriptor descriptor{};
+		descriptor.layout = static_cast<WGPUPipelineLayout>(reader.object(objects));
+		descriptor.compute.module = static_cast<WGPUShaderModule>(reader.object(objects));
+		descriptor.compute.entryPoint = reader.cString(strings);
+		std::vector<WGPUConstantEntry> constants;
+		readConstants(reader, constants, strings);
+		descriptor.compute.constantCount = constants.size();
+		descriptor.compute.constants = constants.data();
+		if (reader.failed() || !reader.atEnd()) return false;
+		computePipelineAsync(descriptor);
+		return true;
+	}
+	objects[key] = object;
+	return object != nullptr;
+}
+
+bool PipelineCache::Manifest::read(const std::filesystem::path& path) {
+	MappedFile file;
+	if (!file.open(path)) return false;
+	std::string_view text(reinterpret_cast<const char*>(file.data()), file.size());
+	if (!text.starts_with(ManifestFirstLine)) {
+		std::cerr << "Ignoring invalid pipeline manifest " << path << std::endl;
+		return false;
+	}
+
+	ManifestReader reader(text.substr(ManifestFirstLine.size()));
+	while (!reader.atEnd()) {
+		std::string_view kind = reader.word();
+		uint64_t key = reader.number();
+		ManifestRecord record;
+		record.kind = kind;
+		record.uses = reader.number();
+		record.dependencies.resize(reader.count());
+		for (uint64_t& dependency : record.dependencies) dependency = reader.number();
+		record.fields = reader.string();
+		if (reader.failed()) {
+			std::cerr << "Ignoring invalid pipeline manifest " << path << std::endl;
+			records.clear();
+			order.clear();
+			return false;
+		}
+		auto [it, inserted] = records.try_emplace(key);
+		if (inserted) {
+			it->second = std::move(record);
+			order.push_back(key);
+		}
+		else {
+			it->second.uses += record.uses;
+		}
+	}
+	return true;
+}
+
+bool PipelineCache::Manifest::write(const std::filesystem::path& path) const {
+	return writeFileAtomically(path, [&](std::ostream& file) {
+		file << ManifestFirstLine << '\n';
+		// Each object after those it refers to, once
+		std::unordered_set<uint64_t> written;
+		auto writeRecord = [&](auto& self, uint64_t key) -> void {
+			if (!written.insert(key).second) return;
+			const ManifestRecord& record = records.at(key);
+			for (uint64_t dependency : record.dependencies) self(self, dependency);
+			file << record.kind << ' ' << key << ' ' << record.uses << ' ' << record.dependencies.size();
+			for (uint64_t dependency : record.dependencies) file << ' ' << dependency;
+			file << ' ' << record.fields.size() << ':' << record.fields << '\n';
+		};
+		for (uint64_t key : pipelines()) writeRecord(writeRecord, key);
+		return true;
+	});
+}
+
+std::vector<uint64_t> PipelineCache::Manifest::pipelines() const {
+	// Whether the object of a key and those it refers to are all recorded
+	std::unordered_map<uint64_t, bool> complete;
+	auto isComplete = [&](auto& self, uint64_t key) -> bool {
+		auto known = complete.find(key);
+		if (known != complete.end()) return known->second;
+		auto it = records.find(key);
+		bool result = it != records.end() && std::all_of(it->second.dependencies.begin(), it->second.dependencies.end(), [&](uint64_t dependency) {
+			return self(self, dependency);
+		});
+		complete[key] = result;
+		return result;
+	};
+
+	std::vector<uint64_t> keys;
+	for (uint64_t key : order) {
+		if (records.at(key).uses > 0 && isComplete(isComplete, key)) keys.push_back(key);
+	}
+	std::stable_sort(keys.begin(), keys.end(), [&](uint64_t a, uint64_t b) {
+		return records.at(a).uses > records.at(b).uses;
+	});
+	return keys;
+}
+
+template <typename T>
+uint64_t PipelineCache::objectKey(T object) {
+	void* handle = static_cast<void*>(static_cast<typename T::W>(object));
+	if (handle == nullptr) return 0;
+	auto it = mObjectKeys.find(handle);
+	if (it != mObjectKeys.end()) return it->second;
+
+	// Keep foreign objects alive, so that their handle is not reused by another object
+	object.reference();
+	mForeignObjects.emplace_back(handle, [](void* foreignHandle) {
+		T(static_cast<typename T::W>(foreignHandle)).release();
+	});
+	uint64_t key = reinterpret_cast<uintptr_t>(handle);
+	mObjectKeys[handle] = key;
+	return key;
+}
+
+template <typename Sink>
+void PipelineCache::describeBindGroupLayout(const BindGroupLayoutDescriptor& descriptor, Sink& sink) {
+	sink.addValue(descriptor.entryCount);
+	for (size_t i = 0; i < descriptor.entryCount; ++i) {
+		const WGPUBindGroupLayoutEntry& entry = descriptor.entries[i];
+		sink.addValue(entry.binding);
+		sink.addValue(entry.visibility);
+		sink.addValue(entry.buffer.type);
+		sink.addValue(entry.buffer.hasDynamicOffset);
+		sink.addValue(entry.buffer.minBindingSize);
+		sink.addValue(entry.sampler.type);
+		sink.addValue(entry.texture.sampleType);
+		sink.addValue(entry.texture.viewDimension);
+		sink.addValue(entry.texture.multisampled);
+		sink.addValue(entry.storageTexture.access);
+		sink.addValue(entry.storageTexture.format);
+		sink.addValue(entry.storageTexture.viewDimension);
+	}
+}
+
+template <typename Sink>
+void PipelineCache::describePipelineLayout(const PipelineLayoutDescriptor& descriptor, Sink& sink) {
+	sink.addValue(descriptor.bindGroupLayoutCount);
+	for (size_t i = 0; i < descriptor.bindGroupLayoutCount; ++i) {
+		sink.addObject(objectKey(BindGroupLayout(descriptor.bindGroupLayouts[i])));
+	}
+	// Layouts of the same groups differ by their push constants, which only wgpu-native has
+	size_t pushConstantRangeCount = 0;
+	const WGPUPushConstantRange* pushConstantRanges = nullptr;
+#ifdef WEBGPU_BACKEND_WGPU
+	for (const WGPUChainedStruct* chain = descriptor.nextInChain; chain; chain = chain->next) {
+		if (chain->sType != static_cast<WGPUSType>(WGPUSType_PipelineLayoutExtras)) continue;
+		const WGPUPipelineLayoutExtras& extras = *reinterpret_cast<const WGPUPipelineLayoutExtras*>(chain);
+		pushConstantRangeCount = extras.pushConstantRangeCount;
+		pushConstantRanges = extras.pushConstantRanges;
+	}
+#endif // WEBGPU_BACKEND_WGPU
+	sink.addValue(pushConstantRangeCount);
+	for (size_t i = 0; i < pushConstantRangeCount; ++i) {
+		sink.addValue(pushConstantRanges[i].stages);
+		sink.addValue(pushConstantRanges[i].start);
+		sink.addValue(pushConstantRanges[i].end);
+	}
+}
+
+template <typename Sink>
+void PipelineCache::describeRenderPipeline(const RenderPipelineDescriptor& descriptor, Sink& sink) {
+	// A null layout is an automatic layout, which only depends on the shaders
+	sink.addObject(objectKey(PipelineLayout(descriptor.layout)));
+
+	const WGPUVertexState& vertex = descriptor.vertex;
+	sink.addObject(objectKey(ShaderModule(vertex.module)));
+	sink.add(vertex.entryPoint);
+	addConstants(sink, vertex.constantCount, vertex.constants);
+	sink.addValue(vertex.bufferCount);
+	for (size_t i = 0; i < vertex.bufferCount; ++i) {
+		const WGPUVertexBufferLayout& buffer = vertex.buffers[i];
+		sink.addValue(buffer.arrayStride);
+		sink.addValue(buffer.stepMode);
+		sink.addValue(buffer.attributeCount);
+		for (size_t j = 0; j < buffer.attributeCount; ++j) {
+			sink.addValue(buffer.attributes[j].format);
+			sink.addValue(buffer.attributes[j].offset);
+			sink.addValue(buffer.attributes[j].shaderLocation);
+		}
+	}
+
+	sink.addValue(descriptor.primitive.topology);
+	sink.addValue(descriptor.primitive.stripIndexFormat);
+	sink.addValue(descriptor.primitive.frontFace);
+	sink.addValue(descriptor.primitive.cullMode);
+
+	sink.addValue(descriptor.depthStencil != nullptr);
+	if (const WGPUDepthStencilState* depthStencil = descriptor.depthStencil) {
+		sink.addValue(depthStencil->format);
+		sink.addValue(depthStencil->depthWriteEnabled);
+		sink.addValue(depthStencil->depthCompare);
+		addStencilFace(sink, depthStencil->stencilFront);
+		addStencilFace(sink, depthStencil->stencilBack);
+		sink.addValue(depthStencil->stencilReadMask);
+		sink.addValue(depthStencil->stencilWriteMask);
+		sink.addValue(depthStencil->depthBias);
+		sink.add(depthStencil->depthBiasSlopeScale);
+		sink.add(depthStencil->depthBiasClamp);
+	}
+
+	sink.addValue(descriptor.multisample.count);
+	sink.addValue(descriptor.multisample.mask);
+	sink.addValue(descriptor.multisample.alphaToCoverageEnabled);
+
+	sink.addValue(descriptor.fragment != nullptr);
+	if (const WGPUFragmentState* fragment = descriptor.fragment) {
+		sink.addObject(objectKey(ShaderModule(fragment->module)));
+		sink.add(fragment->entryPoint);
+		addConstants(sink, fragment->constantCount, fragment->constants);
+		sink.addValue(fragment->targetCount);
+		for (size_t i = 0; i < fragment->targetCount; ++i) {
+			const WGPUColorTargetState& target = fragment->targets[i];
+			sink.addValue(target.format);
+			sink.addValue(target.writeMask);
+			sink.addValue(target.blend != nullptr);
+			if (target.blend) {
+				addBlendComponent(sink, target.blend->color);
+				addBlendComponent(sink, target.blend->alpha);
+			}
+		}
+	}
+}
+
+template <typename Sink>
+void PipelineCache::describeComputePipeline(const ComputePipelineDescriptor& descriptor, Sink& sink) {
+	sink.addObject(objectKey(PipelineLayout(descriptor.layout)));
+	sink.addObject(objectKey(ShaderModule(descriptor.compute.module)));
+	sink.add(descriptor.compute.entryPoint);
+	addConstants(sink, descriptor.compute.constantCount, descriptor.compute.constants);
+}
+
+uint64_t PipelineCache::bindGroupLayoutKey(const BindGroupLayoutDescriptor& descriptor) {
+	Hasher hasher("BindGroupLayout");
+	describeBindGroupLayout(descriptor, hasher);
+	return hasher.value();
+}
+
+uint64_t PipelineCache::pipelineLayoutKey(const PipelineLayoutDescriptor& descriptor) {
+	Hasher hasher("PipelineLayout");
+	describePipelineLayout(descriptor, hasher);
+	return hasher.value();
+}
+
+uint64_t PipelineCache::renderPipelineKey(const RenderPipelineDescriptor& descriptor) {
+	Hasher hasher("RenderPipeline");
+	describeRenderPipeline(descriptor, hasher);
+	return hasher.value();
+}
+
+uint64_t PipelineCache::computePipelineKey(const ComputePipelineDescriptor& descriptor) {
+	Hasher hasher("ComputePipeline");
+	describeComputePipeline(descriptor, hasher);
+	return hasher.value();
+}
+
+uint64_t PipelineCache::samplerKey(const SamplerDescriptor& descriptor) {
+	Hasher hasher("Sampler");
+	hasher.addValue(descriptor.addressModeU);
+	hasher.addValue(descriptor.addressModeV);
+	hasher.addValue(descriptor.addressModeW);
+	hasher.addValue(descriptor.magFilter);
+	hasher.addValue(descriptor.minFilter);
+	hasher.addValue(descriptor.mipmapFilter);
+	hasher.add(descriptor.lodMinClamp);
+	hasher.add(descriptor.lodMaxClamp);
+	hasher.addValue(descriptor.compare);
+	hasher.addValue(descriptor.maxAnisotropy);
+	return hasher.value();
+}
+
+uint64_t PipelineCache::bindGroupKey(const BindGroupDescriptor& descriptor) {
+	Hasher hasher("BindGroup");
+	hasher.add(objectKey(BindGroupLayout(descriptor.layout)));
+	hasher.addValue(descriptor.entryCount);
+	for (size_t i = 0; i < descriptor.entryCount; ++i) {
+		const WGPUBindGroupEntry& entry = descriptor.entries[i];
+		hasher.addValue(entry.binding);
+		// Buffers and views by handle, referenced by the bind group rather than the cache, so
+		// that they are released with it
+		hasher.addValue(reinterpret_cast<uintptr_t>(entry.buffer));
+		hasher.addValue(entry.offset);
+		hasher.addValue(entry.size);
+		hasher.add(objectKey(Sampler(entry.sampler)));
+		hasher.addValue(reinterpret_cast<uintptr_t>(entry.textureView));
+	}
+	return hasher.value();
+}
+
+template <typename T, typename Create>
+T PipelineCache::findOrCreate(std::unordered_map<uint64_t, T>& objects, uint64_t key, Create&& create) {
+	auto it = objects.find(key);
+	if (it != objects.end()) {
+		++mHitCount;
+		return it->second;
+	}
+
+	++mMissCount;
+#ifdef WEBGPU_BACKEND_WGPU
+	// Invalid objects are not null, errors must be caught to tell them apart
+	mDevice.pushErrorScope(ErrorFilter::Validation);
+#endif // WEBGPU_BACKEND_WGPU
+	T object = create();
+#ifdef WEBGPU_BACKEND_WGPU
+	// wgpu-native calls the callback before popErrorScope returns
+	bool failed = false;
+	mDevice.popErrorScope([&](ErrorType type, char const* message) {
+		if (type == ErrorType::NoError) return;
+		std::cerr << "Validation error: " << (message ? message : "") << std::endl;
+		failed = true;
+	});
+	if (failed && object) {
+		object.release();
+		object = nullptr;
+	}
+#endif // WEBGPU_BACKEND_WGPU
+	// Failures are not cached, so that they are reported again
+	if (!object) return nullptr;
+	objects[key] = object;
+	mObjectKeys[static_cast<void*>(static_cast<typename T::W>(object))] = key;
+	return object;
+}
+
+template <typename T, typename Callback, typename CreateAsync>
+std::shared_ptr<const PipelineCache::AsyncPipeline<T>> PipelineCache::findOrCreateAsync(
+	std::unordered_map<uint64_t, T>& objects,
+	std::unordered_map<uint64_t, PendingPipeline<T, Callback>>& pendingPipelines,
+	uint64_t key,
+	CreateAsync&& createAsync
+) {
+	auto it = objects.find(key);
+	if (it != objects.end()) {
+		++mHitCount;
+		return readyPipeline(it->second);
+	}
+
+	auto pendingIt = pendingPipelines.find(key);
+	if (pendingIt != pendingPipelines.end() && isPending(*pendingIt)) {
+		++mHitCount;
+		return pendingIt->second.result;
+	}
+
+	// Callbacks of finished requests are done running, and may be destroyed
+	std::erase_if(pendingPipelines, [](const auto& entry) { return !isPending(entry); });
+
+	++mMissCount;
+	PendingPipeline<T, Callback>& pending = pendingPipelines[key];
+	pending.result = std::make_shared<AsyncPipeline<T>>();
+	AsyncPipeline<T>* result = pending.result.get();
+	int64_t start = Trace::now();
+	bool quiet = mPrecaching;
+	pending.callback = createAsync([this, &objects, key, result, start, quiet](CreatePipelineAsyncStatus status, T pipeline, char const* message) {
+		StartupProfiler::recordSpan("Pipeline creation", start, Trace::now());
+		if (status == CreatePipelineAsyncStatus::Success && pipeline) {
+			objects[key] = pipeline;
+			mObjectKeys[static_cast<void*>(static_cast<typename T::W>(pipeline))] = key;
+			result->pipeline = pipeline;
+			result->status = AsyncPipeline<T>::Status::Ready;
+		}
+		else {
+			// Failures are not cached, so that they are reported again
+			result->message = message ? message : "";
+			result->status = AsyncPipeline<T>::Status::Failed;
+			if (!quiet) std::cerr << "Could not create pipeline: " << result->message << std::endl;
+		}
+		resumeWaiters(result);
+	});
+	return pending.result;
+}
+
+void PipelineCache::resumeWaiters(const void* result) {
+	auto it = mPipelineWaiters.find(result);
+	if (it == mPipelineWaiters.end()) return;
+	// Posted rather than resumed from the callback, which their requests could destroy
+	for (std::coroutine_handle<> handle : it->second) {
+		DeviceEvents::post([handle]() { handle.resume(); });
+	}
+	mPipelineWaiters.erase(it);
+}
+
+void PipelineCache::waitForPendingPipelines() {
+	while (pendingCount() > 0) {
+#if defined(__EMSCRIPTEN__)
+		// Yield to the browser, which resolves pipeline creation (requires ASYNCIFY or JSPI)
+		emscripten_sleep(1);
+#elif defined(WEBGPU_BACKEND_DAWN)
+		mDevice.tick();
+#else
+		// Asynchronous pipelines are built synchronously
+		break;
+#endif
+	}
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <coroutine>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+/**
+ * Shader modules, layouts and pipelines shared by all the requests made with the
+ * same content, so that each distinct WGSL source is compiled once and each
+ * distinct pipeline is built once for the lifetime of the cache.
+ *
+ * Objects are keyed by a hash of their descriptor, where objects created by the
+ * cache are identified by their own content hash (in particular, shader modules
+ * by the hash of their WGSL source). Other objects referenced by descriptors are
+ * identified by handle, and kept alive by the cache so that handles are not reused.
+ * Chained structs (nextInChain) are not part of keys, except the push constant
+ * ranges of pipeline layouts with wgpu-native.
+ *
+ * Objects returned are owned by the cache, and must not be released by callers.
+ * Bind groups are the exception: as they refer to resources that come and go, they
+ * are shared through handles and released with the last one, like ResourceCache does.
+ *
+ * Pipelines may also be requested asynchronously, in which case the driver compiles
+ * them in the background and they become ready while device events are processed
+ * (e.g., by Device::tick or the browser's event loop), one frame or more later.
+ *
+ * Neither wgpu-native nor Dawn expose their pipeline caches through webgpu.h, so
+ * compiled pipelines do not persist across runs: warm starts rely on the driver's
+ * own shader cache. What persists instead is a manifest of the pipelines sessions
+ * requested, with the shaders and layouts they are built from and how often each
+ * was requested, that later sessions precache() ahead of their first use. Keys
+ * being content hashes, those of the manifest are the keys the requests later get.
+ *
+ * The manifest is text, a record per object, each made of its kind, key, number of
+ * requests (0 but for pipelines), the keys of the objects its descriptor refers to,
+ * which come first in the file, and the values of the descriptor, as one string.
+ * Numbers are decimal, floats by their bits, and strings are prefixed by their
+ * length and a colon.
+ */
+class PipelineCache {
+public:
+	/**
+	 * A pipeline requested asynchronously, which may only be used once ready
+	 */
+	template <typename T>
+	struct AsyncPipeline {
+		enum class Status {
+			Pending,
+			Ready,
+			Failed,
+		};
+		Status status = Status::Pending;
+		// Null until ready, owned by the cache
+		T pipeline = nullptr;
+		// Error reported by the device when creation failed
+		std::string message;
+
+		bool ready() const { return status == Status::Ready; }
+	};
+	using AsyncRenderPipeline = std::shared_ptr<const AsyncPipeline<wgpu::RenderPipeline>>;
+	using AsyncComputePipeline = std::shared_ptr<const AsyncPipeline<wgpu::ComputePipeline>>;
+
+	/**
+	 * A bind group with references to the buffers and views it binds, so that their handles,
+	 * which identify them in keys, are not reused while it is cached
+	 */
+	struct SharedBindGroup {
+		wgpu::BindGroup bindGroup = nullptr;
+		std::vector<wgpu::Buffer> buffers;
+		std::vector<wgpu::TextureView> textureViews;
+
+		SharedBindGroup() = default;
+		~SharedBindGroup();
+		SharedBindGroup(const SharedBindGroup&) = delete;
+		SharedBindGroup& operator=(const SharedBindGroup&) = delete;
+	};
+	using BindGroupHandle = std::shared_ptr<const SharedBindGroup>;
+
+public:
+	explicit PipelineCache(wgpu::Device device);
+	~PipelineCache();
+
+	PipelineCache(const PipelineCache&) = delete;
+	PipelineCache& operator=(const PipelineCache&) = delete;
+
+	// Shader module compiled from a WGSL source, or nullptr if compilation failed. Only
+	// wgpu-native reports failures right away, Dawn returns an invalid module instead,
+	// whose errors are reported by getCompilationInfo and pipelines built from it.
+	wgpu::ShaderModule shaderModule(const std::string& source);
+
+	wgpu::BindGroupLayout bindGroupLayout(const wgpu::BindGroupLayoutDescriptor& descriptor);
+	wgpu::PipelineLayout pipelineLayout(const wgpu::PipelineLayoutDescriptor& descriptor);
+	wgpu::RenderPipeline renderPipeline(const wgpu::RenderPipelineDescriptor& descriptor);
+	wgpu::ComputePipeline computePipeline(const wgpu::ComputePipelineDescriptor& descriptor);
+	wgpu::Sampler sampler(const wgpu::SamplerDescriptor& descriptor);
+
+	// Bind group of the same layout and resources as the descriptor, shared with the other
+	// holders of its handle, or nullptr if it could not be created
+	BindGroupHandle bindGroup(const wgpu::BindGroupDescriptor& descriptor);
+
+	// Request a pipeline without waiting for it to be built. Requests for a pipeline that is
+	// cached or already being built share its handle. Objects the descriptor refers to must
+	// stay alive until the pipeline is ready.
+	AsyncRenderPipeline renderPipelineAsync(const wgpu::RenderPipelineDescriptor& descriptor);
+	AsyncComputePipeline computePipelineAsync(const wgpu::ComputePipelineDescriptor& descriptor);
+
+	// Awaited by a coroutine (see Task) until `pipeline` is ready or failed, resuming on the
+	// thread calling DeviceEvents::dispatch() with the same handle
+	template <typename T>
+	auto whenBuilt(std::shared_ptr<const AsyncPipeline<T>> pipeline) {
+		struct Awaiter {
+			PipelineCache& cache;
+			std::shared_ptr<const AsyncPipeline<T>> pipeline;
+
+			bool await_ready() const noexcept { return pipeline->status != AsyncPipeline<T>::Status::Pending; }
+			void await_suspend(std::coroutine_handle<> handle) { cache.mPipelineWaiters[pipeline.get()].push_back(handle); }
+			std::shared_ptr<const AsyncPipeline<T>> await_resume() { return std::move(pipeline); }
+		};
+		return Awaiter{ *this, std::move(pipeline) };
+	}
+
+	// Number of pipelines requested asynchronously that are not ready yet
+	size_t pendingCount() const;
+
+	// Wait for pending pipelines and release all cached objects
+	void clear();
+
+	// Number of objects built on request, and of requests served from the cache
+	uint64_t missCount() const { return mMissCount; }
+	uint64_t hitCount() const { return mHitCount; }
+
+	// Record the objects requested from now on, and how often each pipeline is, for saveManifest()
+	void setRecording(bool recording) { mRecording = recording; }
+
+	// Add the pipelines requested while recording to the manifest at `path`, which is created
+	// if missing. Pipelines built from objects the cache did not create (e.g. a bind group
+	// layout made by the device) could not be created again, and are left out.
+	bool saveManifest(const std::filesystem::path& path);
+
+	// Request the pipelines of the manifest at `path`, most requested first, without waiting
+	// for them, so that the requests for them find them built or being built. Only pipelines
+	// that fail to build for a request are reported. Returns the number of pipelines requested,
+	// 0 with wgpu-native, which would build them right away.
+	size_t precache(const std::filesystem::path& path);
+
+private:
+	/**
+	 * An object of the manifest, with what it takes to create it again
+	 */
+	struct ManifestRecord {
+		std::string kind;
+		// Values of its descriptor, as written by the describe functions
+		std::string fields;
+		// Keys of the objects the descriptor refers to
+		std::vector<uint64_t> dependencies;
+		// Requests for a pipeline, 0 for other objects
+		uint64_t uses = 0;
+	};
+
+	/**
+	 * Records of a manifest, by key
+	 */
+	struct Manifest {
+		std::unordered_map<uint64_t, ManifestRecord> records;
+		// Keys in the order they were first recorded
+		std::vector<uint64_t> order;
+
+		bool read(const std::filesystem::path& path);
+		bool write(const std::filesystem::path& path) const;
+		// Keys of the pipelines whose dependencies are all recorded, most requested first,
+		// then in the order of their first request
+		std::vector<uint64_t> pipelines() const;
+	};
+
+	// Content hash of an object created by the cache, or its handle for foreign objects
+	template <typename T>
+	uint64_t objectKey(T object);
+
+	// Feed the values of a descriptor to `sink`, a hasher or a manifest writer, objects being
+	// identified by their key
+	template <typename Sink>
+	void describeBindGroupLayout(const wgpu::BindGroupLayoutDescriptor& descriptor, Sink& sink);
+	template <typename Sink>
+	void describePipelineLayout(const wgpu::PipelineLayoutDescriptor& descriptor, Sink& sink);
+	template <typename Sink>
+	void describeRenderPipeline(const wgpu::RenderPipelineDescriptor& descriptor, Sink& sink);
+	template <typename Sink>
+	void describeComputePipeline(const wgpu::ComputePipelineDescriptor& descriptor, Sink& sink);
+
+	uint64_t bindGroupLayoutKey(const wgpu::BindGroupLayoutDescriptor& descriptor);
+	uint64_t pipelineLayoutKey(const wgpu::PipelineLayoutDescriptor& descriptor);
+	uint64_t renderPipelineKey(const wgpu::RenderPipelineDescriptor& descriptor);
+	uint64_t computePipelineKey(const wgpu::ComputePipelineDescriptor& descriptor);
+	uint64_t samplerKey(const wgpu::SamplerDescriptor& descriptor);
+	uint64_t bindGroupKey(const wgpu::BindGroupDescriptor& descriptor);
+
+	// While recording, add the record of the object of `key` if missing, its fields being
+	// written by `describe(writer)`, and count a request for pipelines
+	template <typename Describe>
+	void record(std::string_view kind, uint64_t key, bool pipeline, Describe&& describe);
+
+	// Create the object of the record of `key` in `manifest` after its dependencies, storing
+	// the handles of those that are not pipelines in `objects`. Return false if it could not be.
+	bool createRecorded(const Manifest& manifest, uint64_t key, std::unordered_map<uint64_t, void*>& objects);
+
+	// Return the cached object for `key` if any, otherwise create and cache it
+	template <typename T, typename Create>
+	T findOrCreate(std::unordered_map<uint64_t, T>& objects, uint64_t key, Create&& create);
+
+	/**
+	 * An asynchronous request, with the callback the device calls when it is done
+	 */
+	template <typename T, typename Callback>
+	struct PendingPipeline {
+		std::shared_ptr<AsyncPipeline<T>> result;
+		std::unique_ptr<Callback> callback;
+	};
+
+	// Same as findOrCreate, where `createAsync(callback)` starts building the object
+	template <typename T, typename Callback, typename CreateAsync>
+	std::shared_ptr<const AsyncPipeline<T>> findOrCreateAsync(
+		std::unordered_map<uint64_t, T>& objects,
+		std::unordered_map<uint64_t, PendingPipeline<T, Callback>>& pendingPipelines,
+		uint64_t key,
+		CreateAsync&& createAsync
+	);
+
+	// Process device events until pending pipelines are ready or failed
+	void waitForPendingPipelines();
+
+	// Resume the coroutines waiting for the request `result`, which finished
+	void resumeWaiters(const void* result);
+
+private:
+	wgpu::Device mDevice;
+	std::unordered_map<uint64_t, wgpu::ShaderModule> mShaderModules;
+	std::unordered_map<uint64_t, wgpu::BindGroupLayout> mBindGroupLayouts;
+	std::unordered_map<uint64_t, wgpu::PipelineLayout> mPipelineLayouts;
+	std::unordered_map<uint64_t, wgpu::RenderPipeline> mRenderPipelines;
+	std::unordered_map<uint64_t, wgpu::ComputePipeline> mComputePipelines;
+	std::unordered_map<uint64_t, wgpu::Sampler> mSamplers;
+	// Only weak references, entries of released bind groups being dropped on later misses
+	std::unordered_map<uint64_t, std::weak_ptr<const SharedBindGroup>> mBindGroups;
+	// Asynchronous requests by key, including finished ones until the next request
+	std::unordered_map<uint64_t, PendingPipeline<wgpu::RenderPipeline, wgpu::CreateRenderPipelineAsyncCallback>> mPendingRenderPipelines;
+	std::unordered_map<uint64_t, PendingPipeline<wgpu::ComputePipeline, wgpu::CreateComputePipelineAsyncCallback>> mPendingComputePipelines;
+	// Coroutines suspended in whenBuilt(), by request
+	std::unordered_map<const void*, std::vector<std::coroutine_handle<>>> mPipelineWaiters;
+	// Content hash of each object created by the cache
+	std::unordered_map<void*, uint64_t> mObjectKeys;
+	// Foreign objects referenced by keys, with the function releasing them
+	std::vector<std::pair<void*, void(*)(void*)>> mForeignObjects;
+	uint64_t mMissCount = 0;
+	uint64_t mHitCount = 0;
+	// Objects requested while recording
+	bool mRecording = false;
+	Manifest mManifest;
+	// Set by precache() for its requests, which are not counted and fail quietly
+	bool mPrecaching = false;
+};
@@ -0,0 +1,249 @@
+#include "PipelineStatistics.h"
+#include "GpuMemory.h"
+
+#ifdef WEBGPU_BACKEND_WGPU
+#include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <utility>
+
+using namespace wgpu;
+
+namespace {
+
+#ifdef WEBGPU_BACKEND_WGPU
+const FeatureName PipelineStatisticsFeature = static_cast<WGPUFeatureName>(WGPUNativeFeature_PipelineStatisticsQuery);
+
+// In the order of Statistic, which is also the one the values of a query are resolved in
+const std::array<WGPUPipelineStatisticName, PipelineStatistics::StatisticCount> StatisticNames = {
+	WGPUPipelineStatisticName_VertexShaderInvocations,
+	WGPUPipelineStatisticName_ClipperInvocations,
+	WGPUPipelineStatisticName_ClipperPrimitivesOut,
+	WGPUPipelineStatisticName_FragmentShaderInvocations,
+	WGPUPipelineStatisticName_ComputeShaderInvocations,
+};
+#endif // WEBGPU_BACKEND_WGPU
+
+constexpr uint64_t QuerySize = PipelineStatistics::StatisticCount * sizeof(uint64_t);
+
+} // anonymous namespace
+
+const char* PipelineStatistics::statisticName(Statistic statistic) {
+	switch (statistic) {
+	case Statistic::VertexInvocations: return "vertexInvocations";
+	case Statistic::ClipperInvocations: return "clipperInvocations";
+	case Statistic::ClipperPrimitivesOut: return "clipperPrimitivesOut";
+	case Statistic::FragmentInvocations: return "fragmentInvocations";
+	case Statistic::ComputeInvocations: return "computeInvocations";
+	case Statistic::Count: break;
+	}
+	return "unknown";
+}
+
+bool PipelineStatistics::supported(Adapter adapter) {
+#if defined(WEBGPU_BACKEND_WGPU) && !defined(__EMSCRIPTEN__)
+	return adapter.hasFeature(PipelineStatisticsFeature);
+#else
+	(void)adapter;
+	return false;
+#endif
+}
+
+void PipelineStatistics::require(std::vector<WGPUFeatureName>& features) {
+#ifdef WEBGPU_BACKEND_WGPU
+	features.push_back(PipelineStatisticsFeature);
+#else
+	(void)features;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+PipelineStatistics::PipelineStatistics(Device device, uint32_t maxPassCount, uint32_t readbackBufferCount, uint32_t historyLength)
+	: mMaxPassCount(std::max(maxPassCount, 1u))
+	, mHistoryLength(std::max(historyLength, 1u))
+{
+#ifdef WEBGPU_BACKEND_WGPU
+	if (!device.hasFeature(PipelineStatisticsFeature)) return;
+
+	WGPUQuerySetDescriptorExtras extras{};
+	extras.chain.sType = static_cast<WGPUSType>(WGPUSType_QuerySetDescriptorExtras);
+	extras.pipelineStatistics = StatisticNames.data();
+	extras.pipelineStatisticCount = StatisticNames.size();
+	QuerySetDescriptor querySetDesc{};
+	querySetDesc.nextInChain = &extras.chain;
+	querySetDesc.label = "Pipeline statistics";
+	querySetDesc.type = static_cast<WGPUQueryType>(WGPUNativeQueryType_PipelineStatistics);
+	querySetDesc.count = mMaxPassCount;
+	mQuerySet = device.createQuerySet(querySetDesc);
+	if (!mQuerySet) return;
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Pipeline statistics resolve buffer";
+	bufferDesc.size = mMaxPassCount * QuerySize;
+	bufferDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+	bufferDesc.mappedAtCreation = false;
+	mResolveBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "PipelineStatistics");
+
+	mReadbacks = ReadbackPool(device, readbackBufferCount, bufferDesc.size, "Pipeline statistics readback buffer", "PipelineStatistics");
+	mPassNames.resize(mReadbacks.slotCount());
+#else
+	(void)readbackBufferCount;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+PipelineStatistics::~PipelineStatistics() {
+	if (!enabled()) return;
+
+	destroyTracked(mResolveBuffer);
+	mResolveBuffer.release();
+	mQuerySet.destroy();
+	mQuerySet.release();
+}
+
+void PipelineStatistics::beginFrame() {
+	if (!enabled()) return;
+
+	for (uint32_t slot = 0; slot < mReadbacks.slotCount(); ++slot) {
+		if (mReadbacks.state(slot) == ReadbackPool::State::Mapped) addStatistics(slot);
+	}
+
+	// A frame that was not resolved leaves its buffer to the next one
+	if (mCurrent != ReadbackPool::NoSlot && mReadbacks.state(mCurrent) == ReadbackPool::State::Recording) {
+		mReadbacks.cancel(mCurrent);
+	}
+	mCurrent = mReadbacks.reserve();
+	if (mCurrent != ReadbackPool::NoSlot) mPassNames[mCurrent].clear();
+}
+
+uint32_t PipelineStatistics::allocate(const char* name) {
+	if (mCurrent == ReadbackPool::NoSlot || mPassNames[mCurrent].size() >= mMaxPassCount) return NoQuery;
+	mPassNames[mCurrent].push_back(name);
+	return static_cast<uint32_t>(mPassNames[mCurrent].size() - 1);
+}
+
+void PipelineStatistics::begin(RenderPassEncoder pass, uint32_t query) const {
+	if (query == NoQuery) return;
+#ifdef WEBGPU_BACKEND_WGPU
+	wgpuRenderPassEncoderBeginPipelineStatisticsQuery(pass, mQuerySet, query);
+#else
+	(void)pass;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+void PipelineStatistics::end(RenderPassEncoder pass, uint32_t query) const {
+	if (query == NoQuery) return;
+#ifdef WEBGPU_BACKEND_WGPU
+	wgpuRenderPassEncoderEndPipelineStatisticsQuery(pass);
+#else
+	(void)pass;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+void PipelineStatistics::begin(ComputePassEncoder pass, uint32_t query) const {
+	if (query == NoQuery) return;
+#ifdef WEBGPU_BACKEND_WGPU
+	wgpuComputePassEncoderBeginPipelineStatisticsQuery(pass, mQuerySet, query);
+#else
+	(void)pass;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+void PipelineStatistics::end(ComputePassEncoder pass, uint32_t query) const {
+	if (query == NoQuery) return;
+#ifdef WEBGPU_BACKEND_WGPU
+	wgpuComputePassEncoderEndPipelineStatisticsQuery(pass);
+#else
+	(void)pass;
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+void PipelineStatistics::resolve(CommandEncoder encoder) {
+	if (mCurrent == ReadbackPool::NoSlot || mPassNames[mCurrent].empty()) return;
+	uint32_t queryCount = static_cast<uint32_t>(mPassNames[mCurrent].size());
+	encoder.resolveQuerySet(mQuerySet, 0, queryCount, mResolveBuffer, 0);
+	encoder.copyBufferToBuffer(mResolveBuffer, 0, mReadbacks.buffer(mCurrent), 0, queryCount * QuerySize);
+}
+
+void PipelineStatistics::readBack() {
+	if (mCurrent == ReadbackPool::NoSlot) return;
+	uint32_t slot = std::exchange(mCurrent, ReadbackPool::NoSlot);
+	if (mPassNames[slot].empty()) {
+		mReadbacks.cancel(slot);
+		return;
+	}
+
+	// Counts of a frame that failed to map are dropped
+	mReadbacks.map(slot, mPassNames[slot].size() * QuerySize);
+}
+
+void PipelineStatistics::printStatistics(std::ostream& out) const {
+	out << "Pipeline statistics (average per frame over " << mHistoryLength << " frames):" << std::endl;
+	out << "  " << std::left << std::setw(20) << "pass" << std::right
+		<< std::setw(14) << "vertices" << std::setw(14) << "clipped in" << std::setw(14) << "clipped out"
+		<< std::setw(14) << "fragments" << std::setw(14) << "compute" << std::endl;
+	std::ios_base::fmtflags flags = out.flags();
+	for (const PassStatistics& pass : mStatistics) {
+		out << "  " << std::left << std::setw(20) << pass.name << std::right << std::fixed << std::setprecision(0);
+		for (double average : pass.average) {
+			out << std::setw(14) << average;
+		}
+		out << std::endl;
+	}
+	out.flags(flags);
+}
+
+void PipelineStatistics::addStatistics(uint32_t slot) {
+	const std::vector<std::string>& passNames = mPassNames[slot];
+	size_t passCount = passNames.size();
+	const uint64_t* values = static_cast<const uint64_t*>(mReadbacks.mappedRange(slot, passCount * QuerySize));
+
+	// Passes of the same name in a frame add up
+	std::vector<std::array<uint64_t, StatisticCount>>& counts = mFrameCounts;
+	std::vector<bool>& measured = mFrameMeasured;
+	counts.assign(mStatistics.size(), {});
+	measured.assign(mStatistics.size(), false);
+	for (size_t i = 0; i < passCount; ++i) {
+		auto it = std::find_if(mStatistics.begin(), mStatistics.end(), [&](const PassStatistics& pass) {
+			return pass.name == passNames[i];
+		});
+		size_t index = it - mStatistics.begin();
+		if (it == mStatistics.end()) {
+			PassStatistics pass;
+			pass.name = passNames[i];
+			pass.history.reserve(mHistoryLength);
+			mStatistics.push_back(std::move(pass));
+			counts.push_back({});
+			measured.push_back(false);
+		}
+		for (size_t s = 0; s < StatisticCount; ++s) {
+			counts[index][s] += values[i * StatisticCount + s];
+		}
+		measured[index] = true;
+	}
+	mReadbacks.release(slot);
+
+	for (size_t index = 0; index < mStatistics.size(); ++index) {
+		if (!measured[index]) continue;
+		PassStatistics& pass = mStatistics[index];
+		if (pass.history.size() < mHistoryLength) {
+			pass.history.push_back(counts[index]);
+		}
+		else {
+			pass.history[pass.nextSample] = counts[index];
+		}
+		pass.nextSample = (pass.nextSample + 1) % mHistoryLength;
+
+		pass.last = counts[index];
+		pass.average = {};
+		for (const std::array<uint64_t, StatisticCount>& sample : pass.history) {
+			for (size_t s = 0; s < StatisticCount; ++s) {
+				pass.average[s] += static_cast<double>(sample[s]);
+			}
+		}
+		for (double& average : pass.average) {
+			average /= pass.history.size();
+		}
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "ReadbackPool.h"
+
+#include <array>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Count what the GPU does in each render and compute pass: vertex shader
+ * invocations, primitives reaching and leaving the clipper, fragment and compute
+ * shader invocations, from the pipeline statistics queries of wgpu-native, begun
+ * and ended within the passes. They tell whether culling, levels of detail and the
+ * depth pre-pass spare the GPU work, which their timings alone may hide.
+ *
+ * Like GpuProfiler, the queries of a frame are resolved at the end of its command
+ * encoding and mapped asynchronously once submitted, reaching the table a few
+ * frames later, and a frame is not measured when all readback buffers are in use.
+ *
+ * Requires the PipelineStatisticsQuery feature, never available outside of
+ * wgpu-native, without which every method does nothing. Queries are allocated from
+ * the device thread, while passes may be recorded elsewhere.
+ */
+class PipelineStatistics {
+public:
+	enum class Statistic {
+		VertexInvocations,
+		ClipperInvocations,
+		ClipperPrimitivesOut,
+		FragmentInvocations,
+		ComputeInvocations,
+		Count,
+	};
+	static constexpr size_t StatisticCount = static_cast<size_t>(Statistic::Count);
+	static constexpr uint32_t NoQuery = UINT32_MAX;
+
+	// In camel case, e.g. "vertexInvocations", as in the benchmark report
+	static const char* statisticName(Statistic statistic);
+
+	/**
+	 * Rolling counts of the passes of a given name, per frame
+	 */
+	struct PassStatistics {
+		std::string name;
+		// In the last frame measured
+		std::array<uint64_t, StatisticCount> last{};
+		// Averages over the last `historyLength` frames measured
+		std::array<double, StatisticCount> average{};
+		// Counts of the last frames measured, as a ring
+		std::vector<std::array<uint64_t, StatisticCount>> history;
+		size_t nextSample = 0;
+
+		uint64_t lastOf(Statistic statistic) const { return last[static_cast<size_t>(statistic)]; }
+		double averageOf(Statistic statistic) const { return average[static_cast<size_t>(statistic)]; }
+	};
+
+	// Whether `adapter` has pipeline statistics queries
+	static bool supported(wgpu::Adapter adapter);
+	// Add the feature to those a device is requested with
+	static void require(std::vector<WGPUFeatureName>& features);
+
+	PipelineStatistics(wgpu::Device device, uint32_t maxPassCount = 8, uint32_t readbackBufferCount = 4, uint32_t historyLength = 64);
+	~PipelineStatistics();
+
+	PipelineStatistics(const PipelineStatistics&) = delete;
+	PipelineStatistics& operator=(const PipelineStatistics&) = delete;
+
+	// Whether the device has the feature
+	bool enabled() const { return mQuerySet != nullptr; }
+
+	// Add the counts read back since the last frame to the table, and start measuring a new frame
+	void beginFrame();
+
+	// Reserve the query of a pass named `name`, or return NoQuery if the frame is not measured.
+	// Only call it for passes that are actually recorded, then begin and end the query in them.
+	uint32_t allocate(const char* name);
+	// Count what the commands of `pass` between the two do, nothing for NoQuery
+	void begin(wgpu::RenderPassEncoder pass, uint32_t query) const;
+	void end(wgpu::RenderPassEncoder pass, uint32_t query) const;
+	void begin(wgpu::ComputePassEncoder pass, uint32_t query) const;
+	void end(wgpu::ComputePassEncoder pass, uint32_t query) const;
+
+	// Record the resolution of the queries of the frame, after its last pass
+	void resolve(wgpu::CommandEncoder encoder);
+
+	// Read the counts back once the frame is submitted
+	void readBack();
+
+	// Counts of each pass name, in the order they were first measured
+	const std::vector<PassStatistics>& statistics() const { return mStatistics; }
+
+	// Write the table of the averages to `out`
+	void printStatistics(std::ostream& out) const;
+
+private:
+	// Add the counts of a mapped readback slot to the table
+	void addStatistics(uint32_t slot);
+
+private:
+	uint32_t mMaxPassCount;
+	uint32_t mHistoryLength;
+	wgpu::QuerySet mQuerySet = nullptr;
+	wgpu::Buffer mResolveBuffer = nullptr;
+	ReadbackPool mReadbacks;
+	// Names of the passes the queries in each readback slot belong to, 1 per pass
+	std::vector<std::vector<std::string>> mPassNames;
+	uint32_t mCurrent = ReadbackPool::NoSlot;
+	std::vector<PassStatistics> mStatistics;
+	// Per pass of the frame being read back, kept from one frame to the next not to allocate
+	std::vector<std::array<uint64_t, StatisticCount>> mFrameCounts;
+	std::vector<bool> mFrameMeasured;
+};
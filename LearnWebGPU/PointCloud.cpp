@@ -0,0 +1,571 @@
+#include "PointCloud.h"
+#include "FullscreenTriangle.h"
+#include "ResourceManager.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <string>
+
+using namespace wgpu;
+
+namespace {
+
+const char* pointCloudShaderSource = R"(
+struct PointCloudUniforms {
+	viewProjection: mat4x4f,
+	size: vec2u,
+	depthScale: f32,
+	depthOffset: f32,
+	depthTolerance: f32,
+	splatRadius: i32,
+}
+
+@group(0) @binding(0) var<uniform> u: PointCloudUniforms;
+)";
+
+const char* rasterShaderSource = R"(
+struct Point {
+	position: vec3f,
+	color: u32,
+}
+
+const chunkCapacity = 8192u;
+
+@group(0) @binding(1) var<storage, read> points: array<Point>;
+// Slot and point count of each chunk drawn
+@group(0) @binding(2) var<storage, read> chunks: array<vec2u>;
+@group(0) @binding(3) var<storage, read_write> depths: array<atomic<u32>>;
+@group(0) @binding(4) var<storage, read_write> colors: array<atomic<u32>>;
+
+struct Projected {
+	pixel: u32,
+	depth: f32,
+	color: u32,
+}
+
+// The point of invocation `local` of workgroup `group` on the target, if it is one in view
+fn project(group: vec3u, local: u32, projected: ptr<function, Projected>) -> bool {
+	let chunk = chunks[group.y];
+	let index = group.x * 256u + local;
+	if (index >= chunk.y) {
+		return false;
+	}
+	let point = points[chunk.x * chunkCapacity + index];
+	let clip = u.viewProjection * vec4f(point.position, 1.0);
+	if (clip.w <= 0.0 || any(abs(clip.xy) > vec2f(clip.w)) || clip.z < 0.0 || clip.z > clip.w) {
+		return false;
+	}
+	let uv = clip.xy / clip.w * vec2f(0.5, -0.5) + 0.5;
+	let texel = min(vec2u(uv * vec2f(u.size)), u.size - 1u);
+	(*projected).pixel = texel.y * u.size.x + texel.x;
+	(*projected).depth = clip.w;
+	(*projected).color = point.color;
+	return true;
+}
+
+// Positive floats order like their bits, thus the nearest depth is the largest inverted one
+@compute @workgroup_size(256)
+fn rasterize_depth(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_index) local: u32) {
+	var projected: Projected;
+	if (!project(group, local, &projected)) {
+		return;
+	}
+	atomicMax(&depths[projected.pixel], ~bitcast<u32>(projected.depth));
+}
+
+@compute @workgroup_size(256)
+fn rasterize_color(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_index) local: u32) {
+	var projected: Projected;
+	if (!project(group, local, &projected)) {
+		return;
+	}
+	let nearest = bitcast<f32>(~atomicLoad(&depths[projected.pixel]));
+	if (projected.depth > nearest * (1.0 + u.depthTolerance)) {
+		return;
+	}
+	let color = unpack4x8unorm(projected.color);
+	let first = projected.pixel * 4u;
+	atomicAdd(&colors[first], u32(color.r * 255.0 + 0.5));
+	atomicAdd(&colors[first + 1u], u32(color.g * 255.0 + 0.5));
+	atomicAdd(&colors[first + 2u], u32(color.b * 255.0 + 0.5));
+	atomicAdd(&colors[first + 3u], 1u);
+}
+)";
+
+const char* resolveShaderSource = R"(
+@group(0) @binding(1) var<storage, read> depths: array<u32>;
+@group(0) @binding(2) var<storage, read> colors: array<vec4u>;
+
+const noDepth = 1e30;
+
+fn depthAt(texel: vec2i) -> f32 {
+	if (any(texel < vec2i(0)) || any(texel >= vec2i(u.size))) {
+		return noDepth;
+	}
+	let bits = depths[u32(texel.y) * u.size.x + u32(texel.x)];
+	return select(bitcast<f32>(~bits), noDepth, bits == 0u);
+}
+
+struct Resolved {
+	color: vec4f,
+	depth: f32,
+}
+
+// The nearest surface within the splat radius, its color averaged over the pixels it covers
+fn resolve(position: vec4f) -> Resolved {
+	let texel = vec2i(position.xy);
+	let radius = u.splatRadius;
+	var nearest = noDepth;
+	for (var y = -radius; y <= radius; y++) {
+		for (var x = -radius; x <= radius; x++) {
+			if (x * x + y * y <= radius * radius) {
+				nearest = min(nearest, depthAt(texel + vec2i(x, y)));
+			}
+		}
+	}
+	if (nearest >= noDepth) {
+		discard;
+	}
+	var color = vec3f(0.0);
+	var weight = 0.0;
+	for (var y = -radius; y <= radius; y++) {
+		for (var x = -radius; x <= radius; x++) {
+			let neighbour = texel + vec2i(x, y);
+			if (x * x + y * y > radius * radius || depthAt(neighbour) > nearest * (1.0 + u.depthTolerance)) {
+				continue;
+			}
+			let sums = colors[u32(neighbour.y) * u.size.x + u32(neighbour.x)];
+			if (sums.w == 0u) {
+				continue;
+			}
+			let w = 1.0 / f32(1 + x * x + y * y);
+			color += w * vec3f(sums.rgb) / (255.0 * f32(sums.w));
+			weight += w;
+		}
+	}
+	var out: Resolved;
+	out.color = vec4f(color / max(weight, 1e-6), 1.0);
+	out.depth = clamp(u.depthScale / nearest + u.depthOffset, 0.0, 1.0);
+	return out;
+}
+
+struct FragmentOutput {
+	@location(0) color: vec4f,
+	@builtin(frag_depth) depth: f32,
+}
+
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> FragmentOutput {
+	let resolved = resolve(position);
+	var out: FragmentOutput;
+	out.color = resolved.color;
+	out.depth = resolved.depth;
+	return out;
+}
+
+struct FragmentOutputWithId {
+	@location(0) color: vec4f,
+	@location(1) id: u32,
+	@builtin(frag_depth) depth: f32,
+}
+
+// Along with an ID target, where points hide instances as nothing picked
+@fragment
+fn fs_main_ids(@builtin(position) position: vec4f) -> FragmentOutputWithId {
+	let resolved = resolve(position);
+	var out: FragmentOutputWithId;
+	out.color = resolved.color;
+	out.id = 0u;
+	out.depth = resolved.depth;
+	return out;
+}
+)";
+
+bool sphereInFrustum(const glm::vec3& center, float radius, const Frustum& frustum) {
+	for (const glm::vec4& plane : frustum.planes) {
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) return false;
+	}
+	return true;
+}
+
+uint32_t packColor(const glm::vec3& color) {
+	glm::uvec3 bytes = glm::uvec3(glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f);
+	return bytes.r | (bytes.g << 8) | (bytes.b << 16) | (255u << 24);
+}
+
+} // anonymous namespace
+
+std::shared_ptr<const PointCloudOctree> PointCloudOctree::load(const std::filesystem::path& path) {
+	std::vector<ResourceManager::VertexAttributes> vertices;
+	std::vector<uint32_t> indices;
+	if (!ResourceManager::loadGeometryFromTxt(path, vertices, indices)) return nullptr;
+	if (vertices.empty()) {
+		std::cerr << "No point in " << path.string() << std::endl;
+		return nullptr;
+	}
+	std::vector<Point> points(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		points[i] = { vertices[i].position, packColor(glm::vec3(vertices[i].color)) };
+	}
+	// Freed before the octree doubles the points as its scratch
+	vertices = {};
+	return build(std::move(points));
+}
+
+std::shared_ptr<const PointCloudOctree> PointCloudOctree::build(std::vector<Point> points) {
+	auto octree = std::make_shared<PointCloudOctree>();
+	if (points.empty() || points.size() > UINT32_MAX) return octree;
+
+	// Same shuffle on every run, thus the same nodes
+	std::mt19937 random(1);
+	std::shuffle(points.begin(), points.end(), random);
+
+	glm::vec3 min = glm::vec3(points[0].position);
+	glm::vec3 max = min;
+	for (const Point& point : points) {
+		min = glm::min(min, glm::vec3(point.position));
+		max = glm::max(max, glm::vec3(point.position));
+	}
+	float size = std::max({ max.x - min.x, max.y - min.y, max.z - min.z, 1e-6f });
+
+	octree->mPoints = std::move(points);
+	octree->mNodes.push_back({ min, size, 0, 0 });
+	std::vector<Point> scratch(octree->mPoints.size());
+	octree->buildNode(0, 0, static_cast<uint32_t>(octree->mPoints.size()), 0, scratch);
+	return octree;
+}
+
+void PointCloudOctree::buildNode(uint32_t index, uint32_t begin, uint32_t end, uint32_t depth, std::vector<Point>& scratch) {
+	uint32_t count = std::min(end - begin, ChunkCapacity);
+	mNodes[index].firstPoint = begin;
+	mNodes[index].pointCount = count;
+	begin += count;
+	if (begin == end || depth == MaxDepth) return;
+
+	// Stable counting sort of the remaining points by octant
+	Node node = mNodes[index];
+	float half = 0.5f * node.size;
+	glm::vec3 center = node.min + half;
+	auto octant = [&center](const Point& point) {
+		return (point.position.x >= center.x ? 1u : 0u) | (point.position.y >= center.y ? 2u : 0u) | (point.position.z >= center.z ? 4u : 0u);
+	};
+	std::array<uint32_t, 9> offsets = {};
+	for (uint32_t i = begin; i < end; ++i) ++offsets[octant(mPoints[i]) + 1];
+	for (uint32_t i = 1; i < 9; ++i) offsets[i] += offsets[i - 1];
+	std::array<uint32_t, 8> cursors;
+	std::copy(offsets.begin(), offsets.begin() + 8, cursors.begin());
+	for (uint32_t i = begin; i < end; ++i) scratch[begin + cursors[octant(mPoints[i])]++] = mPoints[i];
+	std::copy(scratch.begin() + begin, scratch.begin() + end, mPoints.begin() + begin);
+
+	// Non empty children side by side, then their subtrees
+	uint32_t firstChild = static_cast<uint32_t>(mNodes.size());
+	std::array<uint32_t, 8> children;
+	for (uint32_t child = 0; child < 8; ++child) {
+		if (offsets[child + 1] == offsets[child]) continue;
+		glm::vec3 offset = glm::vec3(child & 1, (child >> 1) & 1, (child >> 2) & 1) * half;
+		children[mNodes.size() - firstChild] = child;
+		mNodes.push_back({ node.min + offset, half, 0, 0 });
+	}
+	uint32_t childCount = static_cast<uint32_t>(mNodes.size()) - firstChild;
+	mNodes[index].firstChild = firstChild;
+	mNodes[index].childCount = childCount;
+	for (uint32_t i = 0; i < childCount; ++i) {
+		uint32_t child = children[i];
+		buildNode(firstChild + i, begin + offsets[child], begin + offsets[child + 1], depth + 1, scratch);
+	}
+}
+
+PointCloud::PointCloud(
+	Device device, PipelineCache& pipelineCache, const Settings& settings,
+	TextureFormat colorFormat, TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+)
+	: mDevice(device)
+	, mSettings(settings)
+{
+	mSettings.uploadBudget = std::max(mSettings.uploadBudget, PointCloudOctree::ChunkCapacity);
+	mSettings.splatRadius = std::min(mSettings.splatRadius, MaxSplatRadius);
+	mUploader = std::make_unique<UploadManager>(device, 4 << 20, 4);
+	mSlotNodes.assign(SlotCount, -1);
+	mSlotFrames.assign(SlotCount, 0);
+	mUniforms.depthTolerance = mSettings.depthTolerance;
+	mUniforms.splatRadius = static_cast<int32_t>(mSettings.splatRadius);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Point cloud uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "Point cloud");
+	// 128 MiB, the default limit of a storage buffer binding
+	bufferDesc.label = "Point cloud chunks";
+	bufferDesc.size = uint64_t(SlotCount) * PointCloudOctree::ChunkCapacity * sizeof(PointCloudOctree::Point);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+	mPointBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Geometry, "Point cloud");
+	bufferDesc.label = "Point cloud chunk list";
+	bufferDesc.size = SlotCount * sizeof(glm::uvec2);
+	mChunkBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::SceneData, "Point cloud");
+	if (!valid()) return;
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(5, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	for (uint32_t i = 1; i < 5; ++i) {
+		bindingLayoutEntries[i].binding = i;
+		bindingLayoutEntries[i].visibility = ShaderStage::Compute;
+		bindingLayoutEntries[i].buffer.type = i < 3 ? BufferBindingType::ReadOnlyStorage : BufferBindingType::Storage;
+	}
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mRasterLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	// Depths and colors, read only by the resolve
+	bindingLayoutEntries.resize(3);
+	for (BindGroupLayoutEntry& entry : bindingLayoutEntries) entry.visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	mResolveLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mRasterLayout;
+	ComputePipelineDescriptor computePipelineDesc{};
+	computePipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	computePipelineDesc.compute.module = pipelineCache.shaderModule((std::string(pointCloudShaderSource) + rasterShaderSource).c_str());
+	computePipelineDesc.compute.constantCount = 0;
+	computePipelineDesc.compute.constants = nullptr;
+	computePipelineDesc.label = "Point cloud depth";
+	computePipelineDesc.compute.entryPoint = "rasterize_depth";
+	mDepthPipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+	computePipelineDesc.label = "Point cloud color";
+	computePipelineDesc.compute.entryPoint = "rasterize_color";
+	mColorPipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mResolveLayout;
+	ShaderModule shaderModule = pipelineCache.shaderModule(std::string(FullscreenTriangle::VertexShaderSource) + pointCloudShaderSource + resolveShaderSource);
+
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.label = "Point cloud resolve";
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	FullscreenTriangle::setPipelineStates(pipelineDesc, shaderModule);
+
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = idFormat == TextureFormat::Undefined ? "fs_main" : "fs_main_ids";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	std::array<ColorTargetState, 2> colorTargets{};
+	colorTargets[0].format = colorFormat;
+	colorTargets[0].blend = nullptr;
+	colorTargets[0].writeMask = ColorWriteMask::All;
+	colorTargets[1].format = idFormat;
+	colorTargets[1].blend = nullptr;
+	colorTargets[1].writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = idFormat == TextureFormat::Undefined ? 1 : 2;
+	fragmentState.targets = colorTargets.data();
+	pipelineDesc.fragment = &fragmentState;
+
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.depthCompare = depthConvention.nearer();
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.format = depthConvention.format();
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencilState;
+	pipelineDesc.multisample.count = sampleCount;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+	mResolvePipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+PointCloud::~PointCloud() {
+	// Copies still recorded reference the chunks
+	mUploader.reset();
+	if (mRasterBindGroup) mRasterBindGroup.release();
+	if (mResolveBindGroup) mResolveBindGroup.release();
+	for (Buffer* buffer : { &mColorBuffer, &mDepthBuffer, &mChunkBuffer, &mPointBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+void PointCloud::setOctree(std::shared_ptr<const PointCloudOctree> octree) {
+	mOctree = std::move(octree);
+	mNodeSlots.assign(mOctree ? mOctree->nodes().size() : 0, -1);
+	mSlotNodes.assign(SlotCount, -1);
+	mSlotFrames.assign(SlotCount, 0);
+	mChunks.clear();
+	mPointCount = 0;
+}
+
+void PointCloud::update(Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::uvec2& size) {
+	if (!valid()) return;
+	++mFrame;
+	if (size != mSize && size.x > 0 && size.y > 0) {
+		SupportedLimits supportedLimits;
+		mDevice.getLimits(&supportedLimits);
+		for (Buffer* buffer : { &mColorBuffer, &mDepthBuffer }) {
+			if (!*buffer) continue;
+			destroyTracked(*buffer);
+			buffer->release();
+		}
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = "Point cloud depths";
+		bufferDesc.size = uint64_t(size.x) * size.y * sizeof(uint32_t);
+		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+		bufferDesc.mappedAtCreation = false;
+		mDepthBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::RenderTargets, "Point cloud");
+		bufferDesc.label = "Point cloud colors";
+		bufferDesc.size *= 4;
+		if (bufferDesc.size <= supportedLimits.limits.maxStorageBufferBindingSize) {
+			mColorBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::RenderTargets, "Point cloud");
+		}
+		else {
+			std::cerr << "Point cloud not drawn at " << size.x << "x" << size.y << ", beyond the storage binding limit" << std::endl;
+		}
+		mSize = size;
+		updateBindGroups();
+	}
+
+	mChunks.clear();
+	mPointCount = 0;
+	if (mOctree && !mOctree->nodes().empty()) {
+		const std::vector<PointCloudOctree::Node>& nodes = mOctree->nodes();
+		glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+		Frustum frustum = Frustum::fromMatrix(viewProjection);
+		glm::vec3 camera = glm::vec3(glm::inverse(viewMatrix)[3]);
+		// Pixels per world unit at unit distance
+		float projectionScale = 0.5f * static_cast<float>(mSize.y) * projectionMatrix[1][1];
+
+		// Largest point spacings on screen first, so that the budget goes to what shows most
+		using Candidate = std::pair<float, uint32_t>;
+		std::priority_queue<Candidate> candidates;
+		auto pixelSpacing = [&](const PointCloudOctree::Node& node) {
+			glm::vec3 center = node.min + 0.5f * node.size;
+			float radius = 0.866f * node.size;
+			float distance = std::max(glm::length(center - camera) - radius, 1e-3f);
+			return PointCloudOctree::spacing(node) * projectionScale / distance;
+		};
+		candidates.push({ pixelSpacing(nodes[0]), 0 });
+		uint64_t uploaded = 0;
+		while (!candidates.empty()) {
+			auto [spacing, index] = candidates.top();
+			candidates.pop();
+			const PointCloudOctree::Node& node = nodes[index];
+			if (mPointCount + node.pointCount > mSettings.pointBudget) break;
+			if (!sphereInFrustum(node.min + 0.5f * node.size, 0.866f * node.size, frustum)) continue;
+			if (mNodeSlots[index] < 0) {
+				// Left out with its subtree until uploaded, its parent standing for it
+				if (uploaded + node.pointCount > mSettings.uploadBudget || !makeResident(index)) continue;
+				mUploader->writeBuffer(
+					mPointBuffer,
+					uint64_t(mNodeSlots[index]) * PointCloudOctree::ChunkCapacity * sizeof(PointCloudOctree::Point),
+					mOctree->points().data() + node.firstPoint,
+					uint64_t(node.pointCount) * sizeof(PointCloudOctree::Point)
+				);
+				uploaded += node.pointCount;
+				continue;
+			}
+			uint32_t slot = static_cast<uint32_t>(mNodeSlots[index]);
+			mSlotFrames[slot] = mFrame;
+			mChunks.push_back({ slot, node.pointCount });
+			mPointCount += node.pointCount;
+			if (spacing <= mSettings.minPixelSpacing) continue;
+			for (uint32_t child = node.firstChild; child < node.firstChild + node.childCount; ++child) {
+				candidates.push({ pixelSpacing(nodes[child]), child });
+			}
+		}
+		mUploader->flush();
+
+		mUniforms.viewProjection = viewProjection;
+		// Perspective depth, z / w = (P[2][2] * zv + P[3][2]) / -zv for a view depth w = -zv
+		mUniforms.depthScale = projectionMatrix[3][2];
+		mUniforms.depthOffset = -projectionMatrix[2][2];
+	}
+	if (!mChunks.empty()) queue.writeBuffer(mChunkBuffer, 0, mChunks.data(), mChunks.size() * sizeof(glm::uvec2));
+	mUniforms.size = mSize;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+bool PointCloud::makeResident(uint32_t node) {
+	// Free slots have frame 0, thus come first
+	auto oldest = std::min_element(mSlotFrames.begin(), mSlotFrames.end());
+	if (*oldest == mFrame) return false;
+	uint32_t slot = static_cast<uint32_t>(oldest - mSlotFrames.begin());
+	if (mSlotNodes[slot] >= 0) mNodeSlots[mSlotNodes[slot]] = -1;
+	mSlotNodes[slot] = static_cast<int32_t>(node);
+	mNodeSlots[node] = static_cast<int32_t>(slot);
+	// Not evicted by the uploads that follow in this frame
+	mSlotFrames[slot] = mFrame;
+	return true;
+}
+
+void PointCloud::updateBindGroups() {
+	if (mRasterBindGroup) mRasterBindGroup.release();
+	if (mResolveBindGroup) mResolveBindGroup.release();
+	mRasterBindGroup = nullptr;
+	mResolveBindGroup = nullptr;
+	if (!mDepthBuffer || !mColorBuffer) return;
+
+	std::vector<BindGroupEntry> bindings(5);
+	bindings[0].binding = 0;
+	bindings[0].buffer = mUniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(Uniforms);
+	std::array<Buffer, 4> buffers = { mPointBuffer, mChunkBuffer, mDepthBuffer, mColorBuffer };
+	for (uint32_t i = 1; i < 5; ++i) {
+		bindings[i].binding = i;
+		bindings[i].buffer = buffers[i - 1];
+		bindings[i].offset = 0;
+		bindings[i].size = buffers[i - 1].getSize();
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mRasterLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mRasterBindGroup = mDevice.createBindGroup(bindGroupDesc);
+
+	bindings.erase(bindings.begin() + 1, bindings.begin() + 3);
+	bindings[1].binding = 1;
+	bindings[2].binding = 2;
+	bindGroupDesc.layout = mResolveLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mResolveBindGroup = mDevice.createBindGroup(bindGroupDesc);
+}
+
+void PointCloud::rasterize(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites) {
+	if (!valid() || !ready() || !mRasterBindGroup) return;
+	encoder.clearBuffer(mDepthBuffer, 0, mDepthBuffer.getSize());
+	encoder.clearBuffer(mColorBuffer, 0, mColorBuffer.getSize());
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Point cloud";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	if (!mChunks.empty()) {
+		// Each dispatch sees all the writes of the previous one
+		computePass.setBindGroup(0, mRasterBindGroup, 0, nullptr);
+		uint32_t chunkCount = static_cast<uint32_t>(mChunks.size());
+		computePass.setPipeline(mDepthPipeline->pipeline);
+		computePass.dispatchWorkgroups(PointCloudOctree::ChunkCapacity / 256, chunkCount, 1);
+		computePass.setPipeline(mColorPipeline->pipeline);
+		computePass.dispatchWorkgroups(PointCloudOctree::ChunkCapacity / 256, chunkCount, 1);
+	}
+	computePass.end();
+	computePass.release();
+}
+
+void PointCloud::draw(RenderPassEncoder renderPass) {
+	if (!valid() || !ready() || !mResolveBindGroup || mChunks.empty()) return;
+	renderPass.setPipeline(mResolvePipeline->pipeline);
+	renderPass.setBindGroup(0, mResolveBindGroup, 0, nullptr);
+	renderPass.draw(3, 1, 0, 0);
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "DepthConvention.h"
+#include "UploadManager.h"
+#include "FrustumCulling.h"
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Points of a scan organized for level of detail, built on the CPU and never
+ * changed afterwards, thus shared by the renderers of successive devices.
+ *
+ * Each node of the octree holds up to ChunkCapacity points subsampling its cube
+ * uniformly, the points it could not hold going to its children, as in layered
+ * point clouds (Potree). Points are shuffled before the build so that the first
+ * ones falling in a node are a uniform subsample of all of them; partitions being
+ * stable, each node simply keeps the first points reaching it. Drawing a node and
+ * its ancestors thus shows its cube at the density of its level, each level
+ * adding as many points as all those above.
+ */
+class PointCloudOctree {
+public:
+	static constexpr uint32_t ChunkCapacity = 8192;
+	// Deeper nodes would only hold duplicates of the same positions, which are dropped
+	static constexpr uint32_t MaxDepth = 20;
+
+	/**
+	 * A point as stored on the GPU, its color in RGBA8
+	 */
+	struct Point {
+		glm::vec<3, float, glm::packed_highp> position;
+		uint32_t color;
+	};
+	static_assert(sizeof(Point) == 16);
+
+	/**
+	 * A cube and the points of the chunk it holds
+	 */
+	struct Node {
+		glm::vec3 min;
+		float size;
+		uint32_t firstPoint;
+		uint32_t pointCount;
+		// First of the non empty children, which follow each other, and their count
+		uint32_t firstChild = 0;
+		uint32_t childCount = 0;
+	};
+
+	// Load the points of a text file of `[points]` like resources/pyramid.txt, ignoring
+	// its `[indices]` if any, then build the octree. Returns null on failure.
+	static std::shared_ptr<const PointCloudOctree> load(const std::filesystem::path& path);
+	// Build the octree of `points`, which are shuffled and reordered by node
+	static std::shared_ptr<const PointCloudOctree> build(std::vector<Point> points);
+
+	// The root first
+	const std::vector<Node>& nodes() const { return mNodes; }
+	const std::vector<Point>& points() const { return mPoints; }
+
+	// Distance between neighbouring points of a node, seeing the scan as surfaces
+	static float spacing(const Node& node) { return node.size / 90.5f; }
+
+private:
+	// Build node `index` of the points [begin, end), those beyond the first ChunkCapacity ones
+	// being partitioned by octant through `scratch`
+	void buildNode(uint32_t index, uint32_t begin, uint32_t end, uint32_t depth, std::vector<Point>& scratch);
+
+private:
+	std::vector<Node> mNodes;
+	std::vector<Point> mPoints;
+};
+
+/**
+ * A point cloud rasterized by compute kernels rather than drawn as primitives,
+ * which is several times faster for points smaller than a few pixels, those
+ * leaving rasterizers with mostly empty 2x2 quads.
+ *
+ * Each frame the octree is traversed by decreasing projected size, nodes being
+ * refined while their point spacing spans over minPixelSpacing and the points
+ * kept remain within the budget. The chunks of the nodes selected are streamed
+ * into fixed size slots of a storage buffer, the least recently drawn ones being
+ * reused, within an upload budget per frame; nodes not resident yet are left
+ * out with their subtree until they are.
+ *
+ * WGSL has no 64-bit atomics to pack depth and color in a single atomicMin, thus
+ * the rasterization takes two dispatches over the points: the first one keeps the
+ * nearest view depth of each pixel with an atomicMax of its inverted bits, the
+ * second one accumulates the colors of the points within depthTolerance of that
+ * depth, averaging points of the same surface instead of letting the last one win.
+ * A fullscreen draw within the main pass then resolves the pixels, filling holes
+ * with the nearest surface within splatRadius pixels around them, and writes the
+ * depth of the points so that meshes and points hide each other.
+ */
+class PointCloud {
+public:
+	static constexpr uint32_t SlotCount = 1024;
+	static constexpr uint32_t MaxSplatRadius = 3;
+
+	struct Settings {
+		// Points drawn per frame at most
+		uint32_t pointBudget = 4 << 20;
+		// Points uploaded per frame at most, at least a chunk
+		uint32_t uploadBudget = 1 << 20;
+		// Point spacing in pixels beyond which nodes are refined
+		float minPixelSpacing = 1.0f;
+		// Pixels around holes taking the nearest surface, up to MaxSplatRadius
+		uint32_t splatRadius = 1;
+		// Points farther than the nearest one of their pixel by this fraction of its depth are hidden
+		float depthTolerance = 0.01f;
+	};
+
+	// Resolved within render passes of a `colorFormat` attachment, an `idFormat` one (written 0,
+	// as points cannot be picked, Undefined if none) and a depth buffer of `depthConvention`, of
+	// `sampleCount` samples
+	PointCloud(
+		wgpu::Device device, PipelineCache& pipelineCache, const Settings& settings,
+		wgpu::TextureFormat colorFormat, wgpu::TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+	);
+	~PointCloud();
+
+	PointCloud(const PointCloud&) = delete;
+	PointCloud& operator=(const PointCloud&) = delete;
+
+	// Whether the slots could be allocated
+	bool valid() const { return mPointBuffer != nullptr; }
+	// Whether the pipelines are built, before which nothing is recorded
+	bool ready() const { return mDepthPipeline->ready() && mColorPipeline->ready() && mResolvePipeline->ready(); }
+
+	// Points drawn from now on, none if null
+	void setOctree(std::shared_ptr<const PointCloudOctree> octree);
+
+	// Select the nodes seen by the camera, upload the chunks they need within the budget, and
+	// (re)allocate the per pixel buffers for a target of `size`
+	void update(wgpu::Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::uvec2& size);
+
+	// Record the rasterization of the nodes selected, in a compute pass of its own
+	void rasterize(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr);
+	// Resolve the rasterized points over the target, testing and writing depth
+	void draw(wgpu::RenderPassEncoder renderPass);
+
+	// Nodes and points selected by the last update()
+	uint32_t nodeCount() const { return static_cast<uint32_t>(mChunks.size()); }
+	uint64_t pointCount() const { return mPointCount; }
+
+private:
+	/**
+	 * The PointCloudUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+		glm::uvec2 size = { 0, 0 };
+		// Depth of the target for a view depth w being scale / w + offset
+		float depthScale = 0.0f;
+		float depthOffset = 0.0f;
+		float depthTolerance = 0.0f;
+		int32_t splatRadius = 0;
+		uint32_t padding[2] = {};
+	};
+	static_assert(sizeof(Uniforms) == 96);
+
+	// Put node `node` in a slot, evicting the least recently drawn one not used this frame.
+	// Returns false if all slots are used this frame.
+	bool makeResident(uint32_t node);
+	// Point the bind groups at the current buffers
+	void updateBindGroups();
+
+private:
+	wgpu::Device mDevice;
+	Settings mSettings;
+	std::unique_ptr<UploadManager> mUploader;
+	std::shared_ptr<const PointCloudOctree> mOctree;
+	uint64_t mFrame = 0;
+
+	// Slot of each node of the octree, -1 if not resident, node and last frame drawn of each slot
+	std::vector<int32_t> mNodeSlots;
+	std::vector<int32_t> mSlotNodes;
+	std::vector<uint64_t> mSlotFrames;
+
+	// Slot and point count of the nodes selected
+	std::vector<glm::uvec2> mChunks;
+	uint64_t mPointCount = 0;
+	Uniforms mUniforms;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	// SlotCount chunks of ChunkCapacity points
+	wgpu::Buffer mPointBuffer = nullptr;
+	wgpu::Buffer mChunkBuffer = nullptr;
+	// Per pixel: inverted bits of the nearest view depth, 0 where no point is, and sums of the
+	// red, green and blue of the points kept with their count
+	wgpu::Buffer mDepthBuffer = nullptr;
+	wgpu::Buffer mColorBuffer = nullptr;
+	glm::uvec2 mSize = { 0, 0 };
+
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mRasterLayout = nullptr;
+	wgpu::BindGroupLayout mResolveLayout = nullptr;
+	PipelineCache::AsyncComputePipeline mDepthPipeline;
+	PipelineCache::AsyncComputePipeline mColorPipeline;
+	PipelineCache::AsyncRenderPipeline mResolvePipeline;
+	wgpu::BindGroup mRasterBindGroup = nullptr;
+	wgpu::BindGroup mResolveBindGroup = nullptr;
+};
@@ -0,0 +1,589 @@
+#include "PostProcessing.h"
+#include "FullscreenTriangle.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <iostream>
+#include <string>
+
+using namespace wgpu;
+
+namespace {
+
+const char* bloomShaderSource = R"(
+struct BloomUniforms {
+	// Texels of the source holding the image, and of the level written
+	sourceSize: vec2u,
+	targetSize: vec2u,
+	threshold: f32,
+	knee: f32,
+};
+
+@group(0) @binding(0) var source: texture_2d<f32>;
+@group(0) @binding(1) var destination: texture_storage_2d<rgba16float, write>;
+@group(0) @binding(2) var<uniform> uBloom: BloomUniforms;
+// When upsampling, the downsampled level of the same size as the destination
+@group(0) @binding(3) var downsampled: texture_2d<f32>;
+
+// Downsampling: the 2 x 8 texels of the source the workgroup's 8 x 8 outputs cover, with
+// 2 more on each side
+const downTileSize = 20u;
+var<workgroup> downTile: array<vec4f, 400>;
+
+// Upsampling: the texels of the coarser level bilinear taps of the tent filter reach
+const upTileSize = 8u;
+var<workgroup> upTile: array<vec4f, 64>;
+
+fn luminance(color: vec3f) -> f32 {
+	return dot(color, vec3f(0.2126, 0.7152, 0.0722));
+}
+
+// Average of the 2x2 texels of the tile starting at p
+fn block(p: vec2u) -> vec3f {
+	let i = p.y * downTileSize + p.x;
+	return (downTile[i].rgb + downTile[i + 1u].rgb + downTile[i + downTileSize].rgb + downTile[i + downTileSize + 1u].rgb) * 0.25;
+}
+
+// The share of a color above the threshold, fading in over the knee below it
+fn prefilter(color: vec3f) -> vec3f {
+	let brightness = max(color.r, max(color.g, color.b));
+	let soft = clamp(brightness - uBloom.threshold + uBloom.knee, 0.0, 2.0 * uBloom.knee);
+	let contribution = max(soft * soft / (4.0 * uBloom.knee + 1e-5), brightness - uBloom.threshold);
+	return color * (contribution / max(brightness, 1e-5));
+}
+
+fn downsampleLevel(group: vec2u, local: vec2u, localIndex: u32, first: bool) {
+	// Loads are clamped to the image, as a sampler clamping to edges would
+	let origin = vec2i(group * 16u) - 2;
+	let maxTexel = vec2i(uBloom.sourceSize) - 1;
+	for (var i = localIndex; i < downTileSize * downTileSize; i += 64u) {
+		let texel = clamp(origin + vec2i(vec2u(i % downTileSize, i / downTileSize)), vec2i(0), maxTexel);
+		downTile[i] = textureLoad(source, texel, 0);
+	}
+	workgroupBarrier();
+
+	let output = group * 8u + local;
+	if (any(output >= uBloom.targetSize)) {
+		return;
+	}
+
+	// 2x2 averages around the 2x2 texels of the output (e), the 13 taps of the filter
+	let p = local * 2u + 2u;
+	let a = block(p - vec2u(2u, 2u));
+	let b = block(p - vec2u(0u, 2u));
+	let c = block(p + vec2u(2u, 0u) - vec2u(0u, 2u));
+	let d = block(p - vec2u(2u, 0u));
+	let e = block(p);
+	let f = block(p + vec2u(2u, 0u));
+	let g = block(p + vec2u(0u, 2u) - vec2u(2u, 0u));
+	let h = block(p + vec2u(0u, 2u));
+	let i = block(p + vec2u(2u, 2u));
+	let j = block(p - vec2u(1u, 1u));
+	let k = block(p + vec2u(1u, 0u) - vec2u(0u, 1u));
+	let l = block(p + vec2u(0u, 1u) - vec2u(1u, 0u));
+	let m = block(p + vec2u(1u, 1u));
+
+	// Five overlapping 4x4 boxes: the inner one weighs half, the corner ones an eighth each
+	let inner = (j + k + l + m) * 0.25;
+	let topLeft = (a + b + d + e) * 0.25;
+	let topRight = (b + c + e + f) * 0.25;
+	let bottomLeft = (d + e + g + h) * 0.25;
+	let bottomRight = (e + f + h + i) * 0.25;
+	var color: vec3f;
+	if (first) {
+		// Boxes weighed by the inverse of their luminance (Karis average), for single bright
+		// texels not to flicker as they move
+		let wInner = 0.5 / (1.0 + luminance(inner));
+		let wTopLeft = 0.125 / (1.0 + luminance(topLeft));
+		let wTopRight = 0.125 / (1.0 + luminance(topRight));
+		let wBottomLeft = 0.125 / (1.0 + luminance(bottomLeft));
+		let wBottomRight = 0.125 / (1.0 + luminance(bottomRight));
+		color = (inner * wInner + topLeft * wTopLeft + topRight * wTopRight + bottomLeft * wBottomLeft + bottomRight * wBottomRight)
+			/ (wInner + wTopLeft + wTopRight + wBottomLeft + wBottomRight);
+		color = prefilter(color);
+	}
+	else {
+		color = inner * 0.5 + (topLeft + topRight + bottomLeft + bottomRight) * 0.125;
+	}
+	textureStore(destination, output, vec4f(color, 1.0));
+}
+
+@compute @workgroup_size(8, 8)
+fn downsampleFirst(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_id) local: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	downsampleLevel(group.xy, local.xy, localIndex, true);
+}
+
+@compute @workgroup_size(8, 8)
+fn downsample(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_id) local: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	downsampleLevel(group.xy, local.xy, localIndex, false);
+}
+
+// Bilinear tap of the tile at x, in texels of the coarser level
+fn upTap(x: vec2f, origin: vec2i) -> vec3f {
+	let t = x - 0.5 - vec2f(origin);
+	let base = vec2u(floor(t));
+	let f = fract(t);
+	let i = base.y * upTileSize + base.x;
+	let top = mix(upTile[i].rgb, upTile[i + 1u].rgb, f.x);
+	let bottom = mix(upTile[i + upTileSize].rgb, upTile[i + upTileSize + 1u].rgb, f.x);
+	return mix(top, bottom, f.y);
+}
+
+@compute @workgroup_size(8, 8)
+fn upsample(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_id) local: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	// The 8 x 8 outputs reach coarser texels from 2 before to 5 after 4 times the group
+	let origin = vec2i(group.xy * 4u) - 2;
+	let maxTexel = vec2i(uBloom.sourceSize) - 1;
+	let texel = clamp(origin + vec2i(vec2u(localIndex % upTileSize, localIndex / upTileSize)), vec2i(0), maxTexel);
+	upTile[localIndex] = textureLoad(source, texel, 0);
+	workgroupBarrier();
+
+	let output = group.xy * 8u + local.xy;
+	if (any(output >= uBloom.targetSize)) {
+		return;
+	}
+
+	// 3x3 tent at one coarser texel around the center of the output
+	let center = (vec2f(output) + 0.5) * 0.5;
+	var color = upTap(center, origin) * 4.0;
+	color += (upTap(center + vec2f(-1.0, 0.0), origin) + upTap(center + vec2f(1.0, 0.0), origin)
+		+ upTap(center + vec2f(0.0, -1.0), origin) + upTap(center + vec2f(0.0, 1.0), origin)) * 2.0;
+	color += upTap(center + vec2f(-1.0, -1.0), origin) + upTap(center + vec2f(1.0, -1.0), origin)
+		+ upTap(center + vec2f(-1.0, 1.0), origin) + upTap(center + vec2f(1.0, 1.0), origin);
+	color = color / 16.0 + textureLoad(downsampled, output, 0).rgb;
+	textureStore(destination, output, vec4f(color, 1.0));
+}
+)";
+
+const char* finalShaderSource = R"(
+struct PostUniforms {
+	// Region of the scene and of the first bloom level, in texels, and size of the target
+	sceneSize: vec2f,
+	bloomSize: vec2f,
+	targetSize: vec2f,
+	bloomStrength: f32,
+	exposure: f32,
+};
+
+@group(0) @binding(0) var scene: texture_2d<f32>;
+@group(0) @binding(1) var bloom: texture_2d<f32>;
+@group(0) @binding(2) var linearSampler: sampler;
+@group(0) @binding(3) var<uniform> uPost: PostUniforms;
+
+// Fit of the ACES filmic curve by Krzysztof Narkowicz
+fn tonemap(color: vec3f) -> vec3f {
+	return saturate((color * (2.51 * color + 0.03)) / (color * (2.43 * color + 0.59) + 0.14));
+}
+
+// The bloomed and tone mapped scene at position p, in pixels of the target
+fn composite(p: vec2f) -> vec3f {
+	// Filtering never reaches outside of the regions
+	let sceneTexel = clamp(p * uPost.sceneSize / uPost.targetSize, vec2f(0.5), uPost.sceneSize - 0.5);
+	let hdr = textureSampleLevel(scene, linearSampler, sceneTexel / vec2f(textureDimensions(scene)), 0.0).rgb;
+	let bloomTexel = clamp(sceneTexel * 0.5, vec2f(0.5), uPost.bloomSize - 0.5);
+	let glow = textureSampleLevel(bloom, linearSampler, bloomTexel / vec2f(textureDimensions(bloom)), 0.0).rgb;
+	return tonemap((hdr + glow * uPost.bloomStrength) * uPost.exposure);
+}
+
+// Perceived brightness, roughly gamma encoded as FXAA expects
+fn luma(color: vec3f) -> f32 {
+	return sqrt(dot(color, vec3f(0.299, 0.587, 0.114)));
+}
+
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> @location(0) vec4f {
+	let p = position.xy;
+	let rgbM = composite(p);
+	let lumaM = luma(rgbM);
+	let lumaNW = luma(composite(p + vec2f(-1.0, -1.0)));
+	let lumaNE = luma(composite(p + vec2f(1.0, -1.0)));
+	let lumaSW = luma(composite(p + vec2f(-1.0, 1.0)));
+	let lumaSE = luma(composite(p + vec2f(1.0, 1.0)));
+	let lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+	let lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+	// Most pixels are not on an edge
+	if (lumaMax - lumaMin < max(0.0312, lumaMax * 0.125)) {
+		return vec4f(rgbM, 1.0);
+	}
+
+	// Blur along the edge, as far as its contrast allows (FXAA 3.11, console variant)
+	var direction = vec2f(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+	let directionReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25 / 8.0), 1.0 / 128.0);
+	let inverseDirectionMin = 1.0 / (min(abs(direction.x), abs(direction.y)) + directionReduce);
+	direction = clamp(direction * inverseDirectionMin, vec2f(-8.0), vec2f(8.0));
+	let rgbA = 0.5 * (composite(p + direction * (1.0 / 3.0 - 0.5)) + composite(p + direction * (2.0 / 3.0 - 0.5)));
+	let rgbB = rgbA * 0.5 + 0.25 * (composite(p - direction * 0.5) + composite(p + direction * 0.5));
+	let lumaB = luma(rgbB);
+	if (lumaB < lumaMin || lumaB > lumaMax) {
+		return vec4f(rgbA, 1.0);
+	}
+	return vec4f(rgbB, 1.0);
+}
+)";
+
+// Texels of a level of the chain covering a region of `size` texels of the level before
+glm::uvec2 halved(glm::uvec2 size) {
+	return glm::max((size + 1u) / 2u, glm::uvec2(1));
+}
+
+} // anonymous namespace
+
+TextureFormat PostProcessing::selectSceneFormat(Device device, bool preferPrecision) {
+	// Always filterable, renderable, blendable and multisampled with the feature
+	if (!preferPrecision && device.hasFeature(FeatureName::RG11B10UfloatRenderable)) return SceneFormat;
+	return HdrFormat;
+}
+
+PostProcessing::PostProcessing(Device device, PipelineCache& pipelineCache, TextureFormat targetFormat)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+{
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::ClampToEdge;
+	samplerDesc.addressModeV = AddressMode::ClampToEdge;
+	samplerDesc.addressModeW = AddressMode::ClampToEdge;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 1.0f;
+	samplerDesc.compare = CompareFunction::Undefined;
+	samplerDesc.maxAnisotropy = 1;
+	mSampler = pipelineCache.sampler(samplerDesc);
+
+	// Limits guarantee a minUniformBufferOffsetAlignment of 256 at most
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Bloom uniforms";
+	bufferDesc.size = uint64_t(2 * MaxBloomLevels) * mUniformStride;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mBloomUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "PostProcessing");
+
+	bufferDesc.label = "Post-processing uniforms";
+	bufferDesc.size = sizeof(PostUniforms);
+	mPostUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "PostProcessing");
+
+	// Downsampling and upsampling layouts, the latter also reading the downsampled level
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(4, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].texture.sampleType = TextureSampleType::Float;
+	bindingLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[1].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[1].storageTexture.format = HdrFormat;
+	bindingLayoutEntries[1].storageTexture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[2].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[2].buffer.minBindingSize = sizeof(BloomUniforms);
+	bindingLayoutEntries[3] = bindingLayoutEntries[0];
+	bindingLayoutEntries[3].binding = 3;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = 3;
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mDownsampleLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+	bindGroupLayoutDesc.entryCount = 4;
+	mUpsampleLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	ShaderModule bloomModule = pipelineCache.shaderModule(bloomShaderSource);
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	ComputePipelineDescriptor computePipelineDesc{};
+	computePipelineDesc.compute.module = bloomModule;
+	computePipelineDesc.compute.constantCount = 0;
+	computePipelineDesc.compute.constants = nullptr;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mDownsampleLayout;
+	computePipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	computePipelineDesc.compute.entryPoint = "downsampleFirst";
+	mDownsampleFirstPipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+	computePipelineDesc.compute.entryPoint = "downsample";
+	mDownsamplePipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mUpsampleLayout;
+	computePipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	computePipelineDesc.compute.entryPoint = "upsample";
+	mUpsamplePipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+
+	std::vector<BindGroupLayoutEntry> finalLayoutEntries(4, Default);
+	finalLayoutEntries[0].binding = 0;
+	finalLayoutEntries[0].visibility = ShaderStage::Fragment;
+	finalLayoutEntries[0].texture.sampleType = TextureSampleType::Float;
+	finalLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	finalLayoutEntries[1] = finalLayoutEntries[0];
+	finalLayoutEntries[1].binding = 1;
+	finalLayoutEntries[2].binding = 2;
+	finalLayoutEntries[2].visibility = ShaderStage::Fragment;
+	finalLayoutEntries[2].sampler.type = SamplerBindingType::Filtering;
+	finalLayoutEntries[3].binding = 3;
+	finalLayoutEntries[3].visibility = ShaderStage::Fragment;
+	finalLayoutEntries[3].buffer.type = BufferBindingType::Uniform;
+	finalLayoutEntries[3].buffer.minBindingSize = sizeof(PostUniforms);
+	bindGroupLayoutDesc.entryCount = (uint32_t)finalLayoutEntries.size();
+	bindGroupLayoutDesc.entries = finalLayoutEntries.data();
+	mFinalLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mFinalLayout;
+	ShaderModule finalModule = pipelineCache.shaderModule(std::string(FullscreenTriangle::VertexShaderSource) + finalShaderSource);
+
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	FullscreenTriangle::setPipelineStates(pipelineDesc, finalModule);
+
+	FragmentState fragmentState{};
+	fragmentState.module = finalModule;
+	fragmentState.entryPoint = "fs_main";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	ColorTargetState colorTarget{};
+	colorTarget.format = targetFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	mFinalPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+PostProcessing::~PostProcessing() {
+	terminateBloomTextures();
+	for (Buffer* buffer : { &mPostUniformBuffer, &mBloomUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+	mQueue.release();
+}
+
+void PostProcessing::updateBloomTextures(glm::uvec2 sceneTextureSize) {
+	glm::uvec2 size = halved(sceneTextureSize);
+	if (size == mBloomTextureSize && mDownTexture) return;
+	terminateBloomTextures();
+
+	// Down to levels of a few texels, from the smaller side
+	uint32_t fullChain = static_cast<uint32_t>(std::bit_width(std::min(size.x, size.y)));
+	mBloomLevelCount = std::clamp(fullChain, 1u, MaxBloomLevels);
+	mBloomTextureSize = size;
+
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Bloom downsampled levels";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = HdrFormat;
+	textureDesc.mipLevelCount = mBloomLevelCount;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { size.x, size.y, 1 };
+	textureDesc.usage = TextureUsage::StorageBinding | TextureUsage::TextureBinding;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mDownTexture = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::RenderTargets, "PostProcessing");
+	if (mBloomLevelCount > 1) {
+		textureDesc.label = "Bloom upsampled levels";
+		textureDesc.mipLevelCount = mBloomLevelCount - 1;
+		mUpTexture = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::RenderTargets, "PostProcessing");
+	}
+	if (!mDownTexture || (mBloomLevelCount > 1 && !mUpTexture)) {
+		std::cerr << "Could not create the bloom textures" << std::endl;
+		terminateBloomTextures();
+		return;
+	}
+
+	TextureViewDescriptor viewDesc{};
+	viewDesc.format = HdrFormat;
+	viewDesc.dimension = TextureViewDimension::_2D;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.aspect = TextureAspect::All;
+	for (uint32_t level = 0; level < mBloomLevelCount; ++level) {
+		viewDesc.baseMipLevel = level;
+		mDownViews.push_back(mDownTexture.createView(viewDesc));
+		if (level + 1 < mBloomLevelCount) mUpViews.push_back(mUpTexture.createView(viewDesc));
+	}
+}
+
+void PostProcessing::updateBindGroups(TextureView sceneView) {
+	if (sceneView == mSceneView && mFinalBindGroup) return;
+	for (BindGroup& bindGroup : mDownsampleBindGroups) bindGroup.release();
+	for (BindGroup& bindGroup : mUpsampleBindGroups) bindGroup.release();
+	mDownsampleBindGroups.clear();
+	mUpsampleBindGroups.clear();
+	if (mFinalBindGroup) mFinalBindGroup.release();
+
+	std::vector<BindGroupEntry> bindings(4);
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.entries = bindings.data();
+	auto bindLevel = [&](TextureView source, TextureView target, uint32_t dispatch) {
+		bindings[0].binding = 0;
+		bindings[0].textureView = source;
+		bindings[1].binding = 1;
+		bindings[1].textureView = target;
+		bindings[2].binding = 2;
+		bindings[2].buffer = mBloomUniformBuffer;
+		bindings[2].offset = uint64_t(dispatch) * mUniformStride;
+		bindings[2].size = sizeof(BloomUniforms);
+	};
+
+	// Uniforms of the downsampling dispatches come first, then those of the upsampling ones
+	bindGroupDesc.layout = mDownsampleLayout;
+	bindGroupDesc.entryCount = 3;
+	for (uint32_t level = 0; level < mBloomLevelCount; ++level) {
+		bindLevel(level == 0 ? sceneView : mDownViews[level - 1], mDownViews[level], level);
+		mDownsampleBindGroups.push_back(mDevice.createBindGroup(bindGroupDesc));
+	}
+	// Upsampled level i is written from the coarser one, downsampled only for the coarsest
+	bindGroupDesc.layout = mUpsampleLayout;
+	bindGroupDesc.entryCount = 4;
+	for (uint32_t level = 0; level + 1 < mBloomLevelCount; ++level) {
+		bool coarsest = level + 2 == mBloomLevelCount;
+		bindLevel(coarsest ? mDownViews[level + 1] : mUpViews[level + 1], mUpViews[level], mBloomLevelCount + level);
+		bindings[3].binding = 3;
+		bindings[3].textureView = mDownViews[level];
+		mUpsampleBindGroups.push_back(mDevice.createBindGroup(bindGroupDesc));
+	}
+
+	std::vector<BindGroupEntry> finalBindings(4);
+	finalBindings[0].binding = 0;
+	finalBindings[0].textureView = sceneView;
+	finalBindings[1].binding = 1;
+	finalBindings[1].textureView = mBloomLevelCount > 1 ? mUpViews[0] : mDownViews[0];
+	finalBindings[2].binding = 2;
+	finalBindings[2].sampler = mSampler;
+	finalBindings[3].binding = 3;
+	finalBindings[3].buffer = mPostUniformBuffer;
+	finalBindings[3].offset = 0;
+	finalBindings[3].size = sizeof(PostUniforms);
+	bindGroupDesc.layout = mFinalLayout;
+	bindGroupDesc.entryCount = (uint32_t)finalBindings.size();
+	bindGroupDesc.entries = finalBindings.data();
+	mFinalBindGroup = mDevice.createBindGroup(bindGroupDesc);
+	mSceneView = sceneView;
+}
+
+void PostProcessing::terminateBloomTextures() {
+	for (BindGroup& bindGroup : mDownsampleBindGroups) bindGroup.release();
+	for (BindGroup& bindGroup : mUpsampleBindGroups) bindGroup.release();
+	mDownsampleBindGroups.clear();
+	mUpsampleBindGroups.clear();
+	if (mFinalBindGroup) mFinalBindGroup.release();
+	mFinalBindGroup = nullptr;
+	mSceneView = nullptr;
+	for (TextureView& view : mDownViews) view.release();
+	for (TextureView& view : mUpViews) view.release();
+	mDownViews.clear();
+	mUpViews.clear();
+	for (Texture* texture : { &mUpTexture, &mDownTexture }) {
+		if (!*texture) continue;
+		retireTracked(*texture);
+		*texture = nullptr;
+	}
+	mBloomTextureSize = { 0, 0 };
+	mBloomLevelCount = 0;
+	mBloomBuilt = false;
+	// The uniforms of each level depend on the level count
+	mUploadedSceneSize = { 0, 0 };
+}
+
+void PostProcessing::encodeBloom(CommandEncoder encoder, const std::array<glm::uvec2, MaxBloomLevels>& levelSizes, GpuProfiler& profiler) {
+	// Dispatches of a pass see the writes of the ones before
+	ComputePassTimestampWrites bloomTimestampWrites;
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Bloom";
+	computePassDesc.timestampWrites = profiler.computePass("Bloom", bloomTimestampWrites);
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	auto dispatch = [&computePass](glm::uvec2 size) {
+		computePass.dispatchWorkgroups((size.x + 7) / 8, (size.y + 7) / 8, 1);
+	};
+	for (uint32_t level = 0; level < mBloomLevelCount; ++level) {
+		computePass.setPipeline((level == 0 ? mDownsampleFirstPipeline : mDownsamplePipeline)->pipeline);
+		computePass.setBindGroup(0, mDownsampleBindGroups[level], 0, nullptr);
+		dispatch(levelSizes[level]);
+	}
+	if (mBloomLevelCount > 1) computePass.setPipeline(mUpsamplePipeline->pipeline);
+	for (uint32_t level = mBloomLevelCount - 1; level-- > 0;) {
+		computePass.setBindGroup(0, mUpsampleBindGroups[level], 0, nullptr);
+		dispatch(levelSizes[level]);
+	}
+	computePass.end();
+	computePass.release();
+}
+
+bool PostProcessing::draw(
+	CommandEncoder encoder,
+	TextureView sceneView, glm::uvec2 sceneTextureSize, uint32_t sceneWidth, uint32_t sceneHeight,
+	TextureView targetView, uint32_t targetWidth, uint32_t targetHeight,
+	GpuProfiler& profiler, bool updateBloom
+) {
+	if (!ready() || !mBloomUniformBuffer || !mPostUniformBuffer) return false;
+	updateBloomTextures(sceneTextureSize);
+	if (!mDownTexture) return false;
+	updateBindGroups(sceneView);
+
+	// Regions of the levels, halving that of the scene
+	std::array<glm::uvec2, MaxBloomLevels> levelSizes;
+	glm::uvec2 sceneSize(sceneWidth, sceneHeight);
+	for (uint32_t level = 0; level < mBloomLevelCount; ++level) {
+		levelSizes[level] = halved(level == 0 ? sceneSize : levelSizes[level - 1]);
+	}
+
+	if (sceneSize != mUploadedSceneSize || mBloomThreshold != mUploadedThreshold) {
+		mBloomBuilt = false;
+		std::vector<uint8_t> uniformData(size_t(2 * mBloomLevelCount - 1) * mUniformStride, 0);
+		auto setUniforms = [&](uint32_t dispatch, glm::uvec2 source, glm::uvec2 target) {
+			BloomUniforms uniforms = { { source.x, source.y }, { target.x, target.y }, mBloomThreshold, 0.5f * mBloomThreshold, {} };
+			std::copy_n(reinterpret_cast<const uint8_t*>(&uniforms), sizeof(BloomUniforms), uniformData.data() + size_t(dispatch) * mUniformStride);
+		};
+		for (uint32_t level = 0; level < mBloomLevelCount; ++level) {
+			setUniforms(level, level == 0 ? sceneSize : levelSizes[level - 1], levelSizes[level]);
+		}
+		for (uint32_t level = 0; level + 1 < mBloomLevelCount; ++level) {
+			setUniforms(mBloomLevelCount + level, levelSizes[level + 1], levelSizes[level]);
+		}
+		mQueue.writeBuffer(mBloomUniformBuffer, 0, uniformData.data(), uniformData.size());
+		mUploadedSceneSize = sceneSize;
+		mUploadedThreshold = mBloomThreshold;
+	}
+
+	PostUniforms postUniforms = {
+		{ static_cast<float>(sceneWidth), static_cast<float>(sceneHeight) },
+		{ static_cast<float>(levelSizes[0].x), static_cast<float>(levelSizes[0].y) },
+		{ static_cast<float>(targetWidth), static_cast<float>(targetHeight) },
+		mBloomStrength,
+		1.0f,
+	};
+	if (postUniforms != mPostUniforms) {
+		mPostUniforms = postUniforms;
+		mQueue.writeBuffer(mPostUniformBuffer, 0, &mPostUniforms, sizeof(PostUniforms));
+	}
+
+	if (updateBloom || !mBloomBuilt) {
+		encodeBloom(encoder, levelSizes, profiler);
+		mBloomBuilt = true;
+	}
+
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = targetView;
+	colorAttachment.resolveTarget = nullptr;
+	// Every texel is written
+	colorAttachment.loadOp = LoadOp::Clear;
+	colorAttachment.storeOp = StoreOp::Store;
+	colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+
+	RenderPassTimestampWrites finalTimestampWrites;
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Tone mapping and FXAA";
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &colorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = profiler.renderPass("Tone mapping and FXAA", finalTimestampWrites);
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	FullscreenTriangle::draw(renderPass, mFinalPipeline->pipeline, mFinalBindGroup, targetWidth, targetHeight);
+	renderPass.end();
+	renderPass.release();
+	return true;
+}
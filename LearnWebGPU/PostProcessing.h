@@ -0,0 +1,146 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "GpuProfiler.h"
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Post-processing of the HDR scene into the surface texture: bloom, then tone
+ * mapping and FXAA in a single final pass.
+ *
+ * Bloom is a chain of half resolution levels, built by compute kernels within a
+ * single compute pass. Each downsampling kernel loads the texels its workgroup
+ * covers into workgroup memory once, then filters them with the 13 taps of Call
+ * of Duty's downsampling (as 2x2 averages), the first level also weighing them
+ * against fireflies and keeping what is above a soft threshold. Upsampling runs
+ * back up the chain, each level adding a tent filtered copy of the coarser one,
+ * again from a tile of workgroup memory.
+ *
+ * The final pass is a draw rather than a dispatch, as surface textures cannot
+ * be written as storage textures everywhere. It composites the bloom, tone maps
+ * and applies FXAA, tone mapping each of the taps FXAA reads (9 at most) rather
+ * than writing and reading back a tone mapped copy of the scene. The scene region
+ * may be smaller than the target, and is then upscaled, which replaces the blit
+ * of the scene to the surface.
+ */
+class PostProcessing {
+public:
+	// Format of the bloom chain, which kernels write as storage textures, and of the scene
+	// where SceneFormat cannot be rendered to
+	static constexpr wgpu::TextureFormat HdrFormat = wgpu::TextureFormat::RGBA16Float;
+	// Half the bandwidth of HdrFormat, with no alpha, which the scene has no use for
+	static constexpr wgpu::TextureFormat SceneFormat = wgpu::TextureFormat::RG11B10Ufloat;
+	static constexpr uint32_t MaxBloomLevels = 6;
+
+	// Format to draw the scene in for draw() to read, SceneFormat when `device` has the
+	// RG11B10UfloatRenderable feature unless `preferPrecision`, HdrFormat otherwise
+	static wgpu::TextureFormat selectSceneFormat(wgpu::Device device, bool preferPrecision);
+
+	// Draw to color attachments of `targetFormat`
+	PostProcessing(wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureFormat targetFormat);
+	~PostProcessing();
+
+	PostProcessing(const PostProcessing&) = delete;
+	PostProcessing& operator=(const PostProcessing&) = delete;
+
+	// Whether the pipelines are built, before which draw() records nothing
+	bool ready() const { return mDownsampleFirstPipeline->ready() && mDownsamplePipeline->ready() && mUpsamplePipeline->ready() && mFinalPipeline->ready(); }
+
+	// Brightness above which the scene blooms, and how much of the bloom is added to it
+	void setBloom(float threshold, float strength) { mBloomThreshold = threshold; mBloomStrength = strength; }
+
+	// Post-process the `sceneWidth` x `sceneHeight` texels in the top left corner of `sceneView`,
+	// of `sceneTextureSize` texels, into the whole of `targetView`, or return false if not ready.
+	// Records a compute pass and a render pass of their own. Unless `updateBloom`, the bloom of
+	// an earlier frame is composited again without its compute pass, if there is one of the same
+	// region and threshold.
+	bool draw(
+		wgpu::CommandEncoder encoder,
+		wgpu::TextureView sceneView, glm::uvec2 sceneTextureSize, uint32_t sceneWidth, uint32_t sceneHeight,
+		wgpu::TextureView targetView, uint32_t targetWidth, uint32_t targetHeight,
+		GpuProfiler& profiler, bool updateBloom = true
+	);
+
+private:
+	/**
+	 * Same as BloomUniforms in the shader, one per kernel dispatch
+	 */
+	struct BloomUniforms {
+		// Texels of the source holding the image, and of the level written
+		uint32_t sourceSize[2];
+		uint32_t targetSize[2];
+		float threshold;
+		float knee;
+		float padding[2];
+	};
+
+	/**
+	 * Same as PostUniforms in the shader
+	 */
+	struct PostUniforms {
+		// Region of the scene and of the first bloom level, in texels, and size of the target
+		float sceneSize[2];
+		float bloomSize[2];
+		float targetSize[2];
+		float bloomStrength;
+		float exposure;
+
+		bool operator==(const PostUniforms&) const = default;
+	};
+
+	// Create the bloom chain for a scene texture of `sceneTextureSize`, if not done yet
+	void updateBloomTextures(glm::uvec2 sceneTextureSize);
+	// Create the bind groups reading `sceneView` and the bloom chain, if not done yet
+	void updateBindGroups(wgpu::TextureView sceneView);
+	void terminateBloomTextures();
+	// Record the compute pass building the chain from the scene, down then up its levels
+	void encodeBloom(wgpu::CommandEncoder encoder, const std::array<glm::uvec2, MaxBloomLevels>& levelSizes, GpuProfiler& profiler);
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	float mBloomThreshold = 1.0f;
+	float mBloomStrength = 0.05f;
+
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mDownsampleLayout = nullptr;
+	wgpu::BindGroupLayout mUpsampleLayout = nullptr;
+	wgpu::BindGroupLayout mFinalLayout = nullptr;
+	wgpu::Sampler mSampler = nullptr;
+	PipelineCache::AsyncComputePipeline mDownsampleFirstPipeline;
+	PipelineCache::AsyncComputePipeline mDownsamplePipeline;
+	PipelineCache::AsyncComputePipeline mUpsamplePipeline;
+	PipelineCache::AsyncRenderPipeline mFinalPipeline;
+
+	// BloomUniforms of each dispatch at a stride of mUniformStride, downsampling first
+	wgpu::Buffer mBloomUniformBuffer = nullptr;
+	uint32_t mUniformStride = 256;
+	wgpu::Buffer mPostUniformBuffer = nullptr;
+	// Last uploaded, a zero scene width meaning none yet
+	glm::uvec2 mUploadedSceneSize = { 0, 0 };
+	float mUploadedThreshold = 0.0f;
+	PostUniforms mPostUniforms = {};
+
+	// Downsampled levels, and upsampled ones but the coarsest, half the size of the scene
+	// texture for their first level
+	glm::uvec2 mBloomTextureSize = { 0, 0 };
+	uint32_t mBloomLevelCount = 0;
+	// Whether the chain holds the bloom of the uploaded scene size and threshold
+	bool mBloomBuilt = false;
+	wgpu::Texture mDownTexture = nullptr;
+	wgpu::Texture mUpTexture = nullptr;
+	std::vector<wgpu::TextureView> mDownViews;
+	std::vector<wgpu::TextureView> mUpViews;
+
+	// Bind groups of the last scene view, which keep it alive, one per dispatch
+	wgpu::TextureView mSceneView = nullptr;
+	std::vector<wgpu::BindGroup> mDownsampleBindGroups;
+	std::vector<wgpu::BindGroup> mUpsampleBindGroups;
+	wgpu::BindGroup mFinalBindGroup = nullptr;
+};
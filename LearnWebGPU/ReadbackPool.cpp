@@ -0,0 +1,128 @@
+#include "ReadbackPool.h"
+#include "DeviceEvents.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+using namespace wgpu;
+
+ReadbackPool::ReadbackPool(Device device, uint32_t slotCount, uint64_t size, const char* label, const char* owner)
+	: mDevice(device)
+	, mSize(size)
+	, mLabel(label)
+	, mOwner(owner)
+{
+	for (uint32_t i = 0; i < std::max(slotCount, 1u); ++i) {
+		auto slot = std::make_unique<Slot>();
+		if (size > 0) {
+			BufferDescriptor bufferDesc{};
+			bufferDesc.label = label;
+			bufferDesc.size = size;
+			bufferDesc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+			bufferDesc.mappedAtCreation = false;
+			slot->buffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, owner);
+			if (!slot->buffer) mValid = false;
+		}
+		mSlots.push_back(std::move(slot));
+	}
+}
+
+ReadbackPool::~ReadbackPool() {
+	destroy();
+}
+
+ReadbackPool::ReadbackPool(ReadbackPool&& other) noexcept {
+	*this = std::move(other);
+}
+
+ReadbackPool& ReadbackPool::operator=(ReadbackPool&& other) noexcept {
+	if (this != &other) {
+		destroy();
+		mDevice = std::exchange(other.mDevice, nullptr);
+		mSize = std::exchange(other.mSize, 0);
+		mLabel = std::exchange(other.mLabel, nullptr);
+		mOwner = std::exchange(other.mOwner, nullptr);
+		mValid = std::exchange(other.mValid, true);
+		mSlots = std::move(other.mSlots);
+		other.mSlots.clear();
+	}
+	return *this;
+}
+
+uint32_t ReadbackPool::reserve(uint64_t size) {
+	if (size == 0) size = mSize;
+	auto free = std::find_if(mSlots.begin(), mSlots.end(), [](const std::unique_ptr<Slot>& slot) {
+		return slot->state == State::Free;
+	});
+	if (free == mSlots.end() || size == 0) return NoSlot;
+	Slot& slot = **free;
+
+	// Reallocated when too small, e.g. for a capture after the window grew
+	if (slot.buffer && slot.buffer.getSize() < size) {
+		destroyTracked(slot.buffer);
+		slot.buffer.release();
+		slot.buffer = nullptr;
+	}
+	if (!slot.buffer) {
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = mLabel;
+		bufferDesc.size = size;
+		bufferDesc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+		bufferDesc.mappedAtCreation = false;
+		slot.buffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, mOwner);
+		if (!slot.buffer) return NoSlot;
+	}
+
+	slot.state = State::Recording;
+	return static_cast<uint32_t>(free - mSlots.begin());
+}
+
+void ReadbackPool::cancel(uint32_t slot) {
+	assert(mSlots[slot]->state == State::Recording);
+	mSlots[slot]->state = State::Free;
+}
+
+void ReadbackPool::map(uint32_t slot, uint64_t size, std::function<void(bool)> onMapped) {
+	Slot* mapped = mSlots[slot].get();
+	assert(mapped->state == State::Recording);
+	mapped->state = State::InFlight;
+	mapped->mapCallback = mapped->buffer.mapAsync(MapMode::Read, 0, size, DeviceEvents::deferred([mapped, onMapped = std::move(onMapped)](BufferMapAsyncStatus status) {
+		bool success = status == BufferMapAsyncStatus::Success;
+		mapped->state = success ? State::Mapped : State::Free;
+		if (onMapped) onMapped(success);
+	}));
+}
+
+const void* ReadbackPool::mappedRange(uint32_t slot, uint64_t size) const {
+	assert(mSlots[slot]->state == State::Mapped);
+	return mSlots[slot]->buffer.getConstMappedRange(0, size);
+}
+
+void ReadbackPool::release(uint32_t slot) {
+	assert(mSlots[slot]->state == State::Mapped);
+	mSlots[slot]->buffer.unmap();
+	mSlots[slot]->state = State::Free;
+}
+
+void ReadbackPool::wait() {
+	auto inFlight = [](const std::unique_ptr<Slot>& slot) {
+		return slot->state == State::InFlight;
+	};
+	while (std::any_of(mSlots.begin(), mSlots.end(), inFlight)) {
+		DeviceEvents::wait(mDevice);
+	}
+}
+
+void ReadbackPool::destroy() {
+	// Map callbacks point to the slots, which must thus outlive them
+	wait();
+	for (const std::unique_ptr<Slot>& slot : mSlots) {
+		if (!slot->buffer) continue;
+		if (slot->state == State::Mapped) slot->buffer.unmap();
+		destroyTracked(slot->buffer);
+		slot->buffer.release();
+	}
+	mSlots.clear();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Staging buffers through which the GPU hands results back to the CPU without ever
+ * stalling it: a slot is reserved while recording the commands that copy to its
+ * buffer, mapped asynchronously once they are submitted, read when the map completes
+ * a frame or so later, then released for the next readback.
+ *
+ * The map callbacks refer to the slots, hence the pool waits for the maps in flight
+ * before destroying its buffers. Owners whose map completions refer to themselves
+ * call wait() first thing in their destructor. Like the rest of the device, it must
+ * only be used from the device thread.
+ */
+class ReadbackPool {
+public:
+	enum class State {
+		// Available for the next readback
+		Free,
+		// Copied to by the commands being recorded
+		Recording,
+		// Copied to by submitted commands, waiting for mapAsync
+		InFlight,
+		// Mapped, until release()
+		Mapped,
+	};
+
+	static constexpr uint32_t NoSlot = UINT32_MAX;
+
+	ReadbackPool() = default;
+	// `slotCount` buffers of `size` bytes, tracked as the staging memory of `owner`. With a size
+	// of 0, buffers are created by reserve(), and grown by it, to the size it asks for.
+	ReadbackPool(wgpu::Device device, uint32_t slotCount, uint64_t size, const char* label, const char* owner);
+	~ReadbackPool();
+
+	ReadbackPool(const ReadbackPool&) = delete;
+	ReadbackPool& operator=(const ReadbackPool&) = delete;
+	// Slots are allocated one by one, so the maps in flight survive a move
+	ReadbackPool(ReadbackPool&& other) noexcept;
+	ReadbackPool& operator=(ReadbackPool&& other) noexcept;
+
+	// Whether the buffers given a size at creation could all be created
+	bool valid() const { return mValid; }
+
+	uint32_t slotCount() const { return static_cast<uint32_t>(mSlots.size()); }
+	State state(uint32_t slot) const { return mSlots[slot]->state; }
+	wgpu::Buffer buffer(uint32_t slot) const { return mSlots[slot]->buffer; }
+
+	// Reserve a free slot whose buffer holds at least `size` bytes, the size given at creation
+	// when 0, for the commands being recorded to copy to. Return NoSlot if all slots are in
+	// use or the buffer could not be created.
+	uint32_t reserve(uint64_t size = 0);
+
+	// Give a reserved slot back unmapped, e.g. when nothing was copied to it after all
+	void cancel(uint32_t slot);
+
+	// Map the first `size` bytes of a reserved slot, once the commands copying to it are
+	// submitted. `onMapped`, if any, is called on the device thread when the map completes,
+	// with whether it succeeded; a slot that failed to map is free again.
+	void map(uint32_t slot, uint64_t size, std::function<void(bool)> onMapped = nullptr);
+
+	// The first `size` bytes of a mapped slot, valid until it is released
+	const void* mappedRange(uint32_t slot, uint64_t size) const;
+
+	// Unmap a mapped slot, free for the next readback
+	void release(uint32_t slot);
+
+	// Wait for the maps in flight to complete, their callbacks having run
+	void wait();
+
+private:
+	struct Slot {
+		wgpu::Buffer buffer = nullptr;
+		State state = State::Free;
+		std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+	};
+
+	// Wait for the maps in flight, then unmap and destroy the buffers
+	void destroy();
+
+private:
+	wgpu::Device mDevice = nullptr;
+	uint64_t mSize = 0;
+	const char* mLabel = nullptr;
+	const char* mOwner = nullptr;
+	bool mValid = true;
+	std::vector<std::unique_ptr<Slot>> mSlots;
+};
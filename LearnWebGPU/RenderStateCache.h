@@ -0,0 +1,154 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "FrameCounters.h"
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+
+/**
+ * State last set on a render pass or render bundle encoder, through which draws set
+ * their pipeline, bind groups and vertex and index buffers, so that what is already
+ * bound is not set again. The draw functions of a pass share the cache of the pass,
+ * hence e.g. the frame and view groups are bound once for the opaque and transparent
+ * batches alike, rather than at the start of each. Every state change saved is one
+ * the driver no longer validates and tracks.
+ *
+ * Bind groups are compared along with their dynamic offsets, and buffers with their
+ * range, by handle: a group released and another created at the same address would
+ * be mistaken for it, which cannot happen within a pass as the pass references what
+ * it binds. Groups with more than MaxDynamicOffsets offsets are always set.
+ *
+ * The state of the encoder is only known while everything goes through the cache:
+ * invalidate() must be called after handing the encoder to code that sets state of
+ * its own, and after executeBundles(), which resets the state of the pass.
+ *
+ * Only the state changes issued are counted as switches, those filtered being counted
+ * as FrameCounter::StateChangesFiltered, in the counts added to by addCounts().
+ */
+template <typename Encoder>
+class RenderStateCache {
+public:
+	// At least the maxBindGroups and maxVertexBuffers the device is requested with
+	static constexpr uint32_t MaxBindGroups = 8;
+	static constexpr uint32_t MaxVertexBuffers = 8;
+	static constexpr uint32_t MaxDynamicOffsets = 2;
+
+	explicit RenderStateCache(Encoder encoder) : mEncoder(encoder) {}
+
+	RenderStateCache(const RenderStateCache&) = delete;
+	RenderStateCache& operator=(const RenderStateCache&) = delete;
+
+	// For what the cache does not set, e.g. draws and push constants
+	Encoder encoder() const { return mEncoder; }
+
+	void setPipeline(wgpu::RenderPipeline pipeline) {
+		if (mPipeline == pipeline) {
+			++mCounts[FrameCounter::StateChangesFiltered];
+			return;
+		}
+		mEncoder.setPipeline(pipeline);
+		mPipeline = pipeline;
+		++mCounts[FrameCounter::PipelineSwitches];
+	}
+
+	void setBindGroup(uint32_t groupIndex, wgpu::BindGroup bindGroup, uint32_t dynamicOffsetCount, const uint32_t* dynamicOffsets) {
+		assert(groupIndex < MaxBindGroups);
+		BoundGroup& bound = mBindGroups[groupIndex];
+		bool cached = dynamicOffsetCount <= MaxDynamicOffsets;
+		if (cached && bound.bindGroup == bindGroup && bound.dynamicOffsetCount == dynamicOffsetCount) {
+			bool sameOffsets = true;
+			for (uint32_t i = 0; i < dynamicOffsetCount; ++i) {
+				sameOffsets = sameOffsets && bound.dynamicOffsets[i] == dynamicOffsets[i];
+			}
+			if (sameOffsets) {
+				++mCounts[FrameCounter::StateChangesFiltered];
+				return;
+			}
+		}
+		mEncoder.setBindGroup(groupIndex, bindGroup, dynamicOffsetCount, dynamicOffsets);
+		++mCounts[FrameCounter::BindGroupSwitches];
+		bound.bindGroup = cached ? bindGroup : nullptr;
+		bound.dynamicOffsetCount = dynamicOffsetCount;
+		for (uint32_t i = 0; cached && i < dynamicOffsetCount; ++i) {
+			bound.dynamicOffsets[i] = dynamicOffsets[i];
+		}
+	}
+
+	void setVertexBuffer(uint32_t slot, wgpu::Buffer buffer, uint64_t offset, uint64_t size) {
+		assert(slot < MaxVertexBuffers);
+		BoundBuffer& bound = mVertexBuffers[slot];
+		if (bound.buffer == buffer && bound.offset == offset && bound.size == size) {
+			++mCounts[FrameCounter::StateChangesFiltered];
+			return;
+		}
+		mEncoder.setVertexBuffer(slot, buffer, offset, size);
+		bound = { buffer, offset, size };
+	}
+	// The whole of `buffer`, whose size is only asked for when it is bound
+	void setVertexBuffer(uint32_t slot, wgpu::Buffer buffer) {
+		assert(slot < MaxVertexBuffers);
+		if (mVertexBuffers[slot].buffer == buffer && mVertexBuffers[slot].offset == 0 && mVertexBuffers[slot].whole) {
+			++mCounts[FrameCounter::StateChangesFiltered];
+			return;
+		}
+		setVertexBuffer(slot, buffer, 0, buffer.getSize());
+		mVertexBuffers[slot].whole = true;
+	}
+
+	void setIndexBuffer(wgpu::Buffer buffer, wgpu::IndexFormat format, uint64_t offset, uint64_t size) {
+		if (mIndexBuffer.buffer == buffer && mIndexFormat == format && mIndexBuffer.offset == offset && mIndexBuffer.size == size) {
+			++mCounts[FrameCounter::StateChangesFiltered];
+			return;
+		}
+		mEncoder.setIndexBuffer(buffer, format, offset, size);
+		mIndexBuffer = { buffer, offset, size };
+		mIndexFormat = format;
+	}
+	void setIndexBuffer(wgpu::Buffer buffer, wgpu::IndexFormat format) {
+		if (mIndexBuffer.buffer == buffer && mIndexFormat == format && mIndexBuffer.offset == 0 && mIndexBuffer.whole) {
+			++mCounts[FrameCounter::StateChangesFiltered];
+			return;
+		}
+		setIndexBuffer(buffer, format, 0, buffer.getSize());
+		mIndexBuffer.whole = true;
+	}
+
+	// Forget what is bound, for everything to be set again
+	void invalidate() {
+		mPipeline = nullptr;
+		mBindGroups = {};
+		mVertexBuffers = {};
+		mIndexBuffer = {};
+		mIndexFormat = wgpu::IndexFormat::Undefined;
+	}
+
+	// Add the state changes issued and filtered since the last call to `counts`
+	void addCounts(FrameCounts& counts) {
+		counts += mCounts;
+		mCounts = FrameCounts{};
+	}
+
+private:
+	struct BoundGroup {
+		wgpu::BindGroup bindGroup = nullptr;
+		uint32_t dynamicOffsetCount = 0;
+		std::array<uint32_t, MaxDynamicOffsets> dynamicOffsets{};
+	};
+	struct BoundBuffer {
+		wgpu::Buffer buffer = nullptr;
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		// Bound by size, rather than the size given
+		bool whole = false;
+	};
+
+	Encoder mEncoder;
+	wgpu::RenderPipeline mPipeline = nullptr;
+	std::array<BoundGroup, MaxBindGroups> mBindGroups{};
+	std::array<BoundBuffer, MaxVertexBuffers> mVertexBuffers{};
+	BoundBuffer mIndexBuffer;
+	wgpu::IndexFormat mIndexFormat = wgpu::IndexFormat::Undefined;
+	FrameCounts mCounts;
+};
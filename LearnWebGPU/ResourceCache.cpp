@@ -0,0 +1,805 @@
+#include "ResourceCache.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+#include "StartupProfiler.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+using namespace wgpu;
+
+namespace {
+
+// Options that drop the largest mip levels of a texture of `width` x `height` texels taking
+// `size` bytes with all its levels, until it fits in the GPU memory budget (down to 64x64)
+ResourceManager::TextureLoadOptions fitToBudget(const ResourceManager::TextureLoadOptions& options, const std::filesystem::path& path, uint32_t width, uint32_t height, uint64_t size) {
+	uint32_t maxSize = std::max(width, height);
+	if (options.maxSize > 0) {
+		for (; maxSize > options.maxSize; maxSize /= 2) size /= 4;
+	}
+	if (GpuMemoryTracker::fitsBudget(size)) return options;
+
+	// Each level dropped halves the size, and divides the memory by 4
+	while (maxSize > 64 && !GpuMemoryTracker::fitsBudget(size)) {
+		maxSize /= 2;
+		size /= 4;
+	}
+	std::cerr << "Over the GPU memory budget, loading " << path.filename().string() << " at most " << maxSize << " texels wide" << std::endl;
+	ResourceManager::TextureLoadOptions fitted = options;
+	fitted.maxSize = maxSize;
+	return fitted;
+}
+
+// 4 bytes per texel, a third more for the mip-maps
+uint64_t imageMemorySize(const ResourceManager::Image& image) {
+	return uint64_t(image.width) * image.height * 4 * 4 / 3;
+}
+
+uint64_t compressedImageSize(const ResourceManager::CompressedImage& image) {
+	uint64_t size = 0;
+	for (std::span<const std::byte> level : image.image.levels) {
+		size += level.size();
+	}
+	return size;
+}
+
+// Largest levels of a streamed texture uploaded when it is added, a few KiB of them at most
+constexpr uint32_t textureStreamResidentSize = 128;
+
+// Requested resolutions in a row below the uploaded one before finer levels are dropped, so
+// that a texture seen for a moment from afar, or from behind an object moving by, keeps them
+constexpr uint32_t textureEvictionRounds = 8;
+
+} // anonymous namespace
+
+ResourceCache::Texture::~Texture() {
+	if (view != nullptr) view.release();
+	// Possibly still drawn by the frames in flight
+	if (texture != nullptr) retireTracked(texture);
+}
+
+ResourceCache::Geometry::~Geometry() {
+	if (vertexHeap) vertexHeap->free(vertices);
+	if (indexHeap) indexHeap->free(indices);
+	if (meshletHeap) meshletHeap->free(meshlets);
+}
+
+ResourceCache::ResourceCache(Device device, bool storageVertices)
+	: mDevice(device)
+	, mStorageVertices(storageVertices)
+	, mUploader(device)
+	// 16 MiB of indices and 1 MiB of meshlets per page
+	, mIndexHeap(std::make_shared<BufferHeap>(device, BufferUsage::CopyDst | BufferUsage::Index, std::vector<uint32_t>{ 4 }, 1 << 22, "Index pages"))
+	, mMeshletHeap(std::make_shared<BufferHeap>(device, BufferUsage::CopyDst | BufferUsage::Storage, std::vector<uint32_t>{ sizeof(MeshOptimizer::Meshlet) }, 1 << 14, "Meshlet pages"))
+{}
+
+uint64_t ResourceCache::gpuMemorySize() const {
+	uint64_t size = mUploader.stagingMemorySize();
+	for (const auto& [key, entry] : mTextures) {
+		if (TextureHandle texture = entry.lock()) size += textureMemorySize(texture->texture);
+	}
+	// Pages count whole, their free ranges included
+	for (const auto& [strides, heap] : mVertexHeaps) {
+		size += heap->memorySize();
+	}
+	return size + mIndexHeap->memorySize() + mMeshletHeap->memorySize();
+}
+
+ResourceCache::TextureHandle ResourceCache::loadTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options) {
+	if (TextureHandle texture = findTexture(path, options)) return texture;
+
+	if (path.extension() == ".ktx2") {
+		ResourceManager::CompressedImage image;
+		if (!ResourceManager::loadCompressedImage(path, image)) return nullptr;
+		return addTexture(path, options, image);
+	}
+	ResourceManager::Image image;
+	if (!ResourceManager::loadImage(path, image, options)) return nullptr;
+	return addTexture(path, options, image);
+}
+
+ResourceCache::GeometryHandle ResourceCache::loadGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout) {
+	if (GeometryHandle geometry = findGeometry(path, options, layout)) return geometry;
+
+	ResourceManager::Geometry geometry;
+	if (!ResourceManager::loadGeometry(path, geometry, options)) return nullptr;
+	return addGeometry(path, options, layout, geometry);
+}
+
+ResourceCache::TextureHandle ResourceCache::findTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options) const {
+	return find(mTextures, textureKey(path, options));
+}
+
+ResourceCache::TextureHandle ResourceCache::addTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, const ResourceManager::Image& image) {
+	std::string key = textureKey(path, options);
+	if (TextureHandle texture = find(mTextures, key)) return texture;
+	STARTUP_STAGE("Upload");
+
+	TextureView view = nullptr;
+	ResourceManager::TextureLoadOptions fittedOptions = fitToBudget(options, path, image.width, image.height, imageMemorySize(image));
+	wgpu::Texture texture = ResourceManager::createTexture(image, mUploader, fittedOptions, &view);
+	if (!texture) return nullptr;
+	mUploader.flush();
+	TextureHandle handle = makeTexture(texture, view);
+	mTextures[key] = handle;
+	return handle;
+}
+
+ResourceCache::TextureHandle ResourceCache::addTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, const ResourceManager::CompressedImage& image) {
+	std::string key = textureKey(path, options);
+	if (TextureHandle texture = find(mTextures, key)) return texture;
+	STARTUP_STAGE("Upload");
+
+	TextureView view = nullptr;
+	ResourceManager::TextureLoadOptions fittedOptions = fitToBudget(options, path, image.image.width, image.image.height, compressedImageSize(image));
+	wgpu::Texture texture = ResourceManager::createTexture(image, mUploader, fittedOptions, &view);
+	if (!texture) return nullptr;
+	mUploader.flush();
+	TextureHandle handle = makeTexture(texture, view);
+	mTextures[key] = handle;
+	return handle;
+}
+
+ResourceCache::TextureHandle ResourceCache::streamTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, std::shared_ptr<const ResourceManager::Image> image) {
+	std::string key = textureKey(path, options);
+	if (TextureHandle texture = find(mTextures, key)) return texture;
+	STARTUP_STAGE("Upload");
+
+	TextureStream stream;
+	stream.options = fitToBudget(options, path, image->width, image->height, imageMemorySize(*image));
+	uint32_t residentLevel = 0;
+	wgpu::Texture texture = ResourceManager::createStreamedTexture(*image, mUploader, stream.options, textureStreamResidentSize, residentLevel);
+	if (!texture) return nullptr;
+	stream.width = image->width;
+	stream.height = image->height;
+	stream.imageLevelCount = std::bit_width(std::max(image->width, image->height));
+	stream.image = std::move(image);
+	return addTextureStream(key, texture, residentLevel, std::move(stream));
+}
+
+ResourceCache::TextureHandle ResourceCache::streamTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, std::shared_ptr<const ResourceManager::CompressedImage> image) {
+	std::string key = textureKey(path, options);
+	if (TextureHandle texture = find(mTextures, key)) return texture;
+	STARTUP_STAGE("Upload");
+
+	TextureStream stream;
+	stream.options = fitToBudget(options, path, image->image.width, image->image.height, compressedImageSize(*image));
+	uint32_t residentLevel = 0;
+	wgpu::Texture texture = ResourceManager::createStreamedTexture(*image, mUploader, stream.options, textureStreamResidentSize, residentLevel);
+	if (!texture) return nullptr;
+	stream.width = image->image.width;
+	stream.height = image->image.height;
+	stream.imageLevelCount = static_cast<uint32_t>(image->image.levels.size());
+	stream.blockWidth = image->image.blockWidth;
+	stream.blockHeight = image->image.blockHeight;
+	stream.compressedImage = std::move(image);
+	return addTextureStream(key, texture, residentLevel, std::move(stream));
+}
+
+ResourceCache::TextureHandle ResourceCache::addTextureStream(const std::string& key, wgpu::Texture texture, uint32_t residentLevel, TextureStream stream) {
+	mUploader.flush();
+	auto handle = std::make_shared<Texture>();
+	handle->texture = texture;
+	handle->view = ResourceManager::createTextureView(texture, stream.options, residentLevel);
+	handle->residentMipLevel = residentLevel;
+	mTextures[key] = handle;
+	if (residentLevel > 0) {
+		stream.target = handle;
+		stream.firstLevel = stream.imageLevelCount - texture.getMipLevelCount();
+		stream.finestLevel = stream.firstLevel;
+		stream.coarsestLevel = stream.firstLevel + residentLevel;
+		stream.requestedLevel = stream.finestLevel;
+		mTextureStreams.push_back(std::move(stream));
+	}
+	return handle;
+}
+
+bool ResourceCache::TextureStream::pending(const Texture& target) const {
+	return residentLevel(target) > requestedLevel || requestedLevel < firstLevel
+		|| (evictionRounds >= textureEvictionRounds && requestedLevel > residentLevel(target));
+}
+
+void ResourceCache::evict(const std::filesystem::path& path) {
+	// Entries of the file start with its key prefix, and those of texture arrays hold it after a separator
+	std::error_code error;
+	std::string prefix = std::filesystem::absolute(path, error).lexically_normal().generic_string() + "|";
+	auto holdsFile = [&](const auto& entry) {
+		return entry.first.starts_with(prefix) || entry.first.find("|" + prefix) != std::string::npos;
+	};
+	std::erase_if(mTextures, holdsFile);
+	std::erase_if(mGeometries, holdsFile);
+}
+
+size_t ResourceCache::streamingCount() const {
+	size_t count = mGeometryStreams.size();
+	for (const TextureStream& stream : mTextureStreams) {
+		std::shared_ptr<Texture> target = stream.target.lock();
+		if (target && stream.pending(*target)) ++count;
+	}
+	return count;
+}
+
+void ResourceCache::setRequestedResolution(const TextureHandle& texture, float resolution) {
+	for (TextureStream& stream : mTextureStreams) {
+		std::shared_ptr<Texture> target = stream.target.lock();
+		if (!target || target != texture) continue;
+
+		// The level of at least `resolution` texels per unit, between the finest the texture may
+		// have and the coarsest ones it always keeps
+		uint32_t level = stream.coarsestLevel;
+		if (resolution > 0.0f) {
+			float texelRatio = static_cast<float>(std::max(stream.width, stream.height)) / resolution;
+			level = texelRatio > 1.0f ? static_cast<uint32_t>(std::floor(std::log2(texelRatio))) : 0;
+		}
+		level = std::clamp(level, stream.finestLevel, stream.coarsestLevel);
+		while (level > stream.finestLevel
+			&& (std::max(stream.width >> level, 1u) % stream.blockWidth != 0 || std::max(stream.height >> level, 1u) % stream.blockHeight != 0)) {
+			--level;
+		}
+
+		stream.feedback = true;
+		stream.requestedLevel = level;
+		stream.evictionRounds = level > stream.residentLevel(*target) ? stream.evictionRounds + 1 : 0;
+	}
+}
+
+Texture ResourceCache::resizeStreamedTexture(TextureStream& stream, Texture& target, uint32_t firstLevel, CommandEncoder encoder) {
+	wgpu::Texture resized = ResourceManager::resizeStreamedTexture(
+		mDevice, target.texture,
+		std::max(stream.width >> firstLevel, 1u), std::max(stream.height >> firstLevel, 1u), stream.imageLevelCount - firstLevel,
+		target.residentMipLevel, stream.blockWidth, stream.blockHeight, stream.options, encoder
+	);
+	if (!resized) return nullptr;
+
+	// Levels dropped from the top leave the texture resident, those added are to be streamed
+	uint32_t residentLevel = stream.residentLevel(target);
+	wgpu::Texture previous = target.texture;
+	target.texture = resized;
+	target.residentMipLevel = residentLevel > firstLevel ? residentLevel - firstLevel : 0;
+	stream.firstLevel = firstLevel;
+	// Rows of a level being uploaded are not copied
+	stream.residentRowCount = 0;
+	return previous;
+}
+
+void ResourceCache::setStreamPriority(const TextureHandle& texture, float priority, bool prefetch) {
+	for (TextureStream& stream : mTextureStreams) {
+		if (stream.target.lock() != texture) continue;
+		stream.priority = priority;
+		stream.prefetch = prefetch;
+	}
+}
+
+void ResourceCache::setStreamPriority(const GeometryHandle& geometry, float priority, bool prefetch) {
+	for (GeometryStream& stream : mGeometryStreams) {
+		if (stream.target.lock() != geometry) continue;
+		stream.priority = priority;
+		stream.prefetch = prefetch;
+	}
+}
+
+bool ResourceCache::streaming(const TextureHandle& texture) const {
+	for (const TextureStream& stream : mTextureStreams) {
+		std::shared_ptr<Texture> target = stream.target.lock();
+		if (target && target == texture) return stream.pending(*target);
+	}
+	return false;
+}
+
+void ResourceCache::loadTextures(AssetLoader& loader, std::vector<std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options, std::function<void(std::vector<TextureHandle>)> onLoaded) {
+	/**
+	 * Decoded images waiting for their turn to be uploaded, only touched by the
+	 * worker that decodes them until they are marked ready on the device thread
+	 */
+	struct Entry {
+		ResourceManager::Image image;
+		ResourceManager::CompressedImage compressedImage;
+		bool compressed = false;
+		bool decoded = false;
+		bool ready = false;
+	};
+	struct Batch {
+		std::vector<std::filesystem::path> paths;
+		ResourceManager::TextureLoadOptions options;
+		std::function<void(std::vector<TextureHandle>)> onLoaded;
+		std::vector<Entry> entries;
+		std::vector<TextureHandle> textures;
+		// Index of the next texture to upload
+		size_t next = 0;
+	};
+	auto batch = std::make_shared<Batch>();
+	batch->paths = std::move(paths);
+	batch->options = options;
+	batch->onLoaded = std::move(onLoaded);
+	batch->entries.resize(batch->paths.size());
+	batch->textures.resize(batch->paths.size());
+
+	// Upload, in order, all the textures whose predecessors are uploaded
+	auto uploadReady = [this, batch]() {
+		for (; batch->next < batch->entries.size() && batch->entries[batch->next].ready; ++batch->next) {
+			size_t i = batch->next;
+			Entry& entry = batch->entries[i];
+			if (!batch->textures[i] && entry.decoded) {
+				batch->textures[i] = entry.compressed
+					? addTexture(batch->paths[i], batch->options, entry.compressedImage)
+					: addTexture(batch->paths[i], batch->options, entry.image);
+			}
+			entry = Entry{};
+		}
+		if (batch->next == batch->entries.size() && batch->onLoaded) {
+			batch->onLoaded(std::move(batch->textures));
+			batch->onLoaded = nullptr;
+		}
+	};
+
+	for (size_t i = 0; i < batch->paths.size(); ++i) {
+		// Textures already loaded need no decoding
+		if ((batch->textures[i] = findTexture(batch->paths[i], options))) {
+			batch->entries[i].ready = true;
+			continue;
+		}
+		loader.enqueue([batch, i, uploadReady]() -> AssetLoader::Completion {
+			Entry& entry = batch->entries[i];
+			const std::filesystem::path& path = batch->paths[i];
+			entry.compressed = path.extension() == ".ktx2";
+			if (entry.compressed) {
+				entry.decoded = ResourceManager::loadCompressedImage(path, entry.compressedImage);
+			}
+			else {
+				entry.decoded = ResourceManager::loadImage(path, entry.image, batch->options);
+				bool gpuMipMaps = batch->options.mipmapGeneration == ResourceManager::TextureLoadOptions::MipmapGeneration::Gpu;
+				if (entry.decoded && !gpuMipMaps) {
+					ResourceManager::buildMipMaps(entry.image, batch->options);
+				}
+			}
+			return [batch, i, uploadReady]() {
+				batch->entries[i].ready = true;
+				uploadReady();
+			};
+		});
+	}
+
+	// Everything may already be cached
+	uploadReady();
+}
+
+Task<ResourceCache::TextureHandle> ResourceCache::loadTextureAsync(AssetLoader& loader, std::filesystem::path path, ResourceManager::TextureLoadOptions options) {
+	if (TextureHandle texture = findTexture(path, options)) co_return texture;
+
+	co_await loader.resumeOnWorker();
+	bool compressed = path.extension() == ".ktx2";
+	ResourceManager::CompressedImage compressedImage;
+	ResourceManager::Image image;
+	bool decoded = compressed ? ResourceManager::loadCompressedImage(path, compressedImage) : ResourceManager::loadImage(path, image, options);
+	if (decoded && !compressed && options.mipmapGeneration != ResourceManager::TextureLoadOptions::MipmapGeneration::Gpu) {
+		ResourceManager::buildMipMaps(image, options);
+	}
+
+	co_await loader.resumeOnDeviceThread();
+	if (!decoded) co_return nullptr;
+	co_return compressed ? addTexture(path, options, compressedImage) : addTexture(path, options, image);
+}
+
+Task<ResourceCache::GeometryHandle> ResourceCache::loadGeometryAsync(AssetLoader& loader, std::filesystem::path path, ResourceManager::GeometryLoadOptions options, const VertexLayout& layout) {
+	if (GeometryHandle geometry = findGeometry(path, options, layout)) co_return geometry;
+
+	co_await loader.resumeOnWorker();
+	ResourceManager::Geometry geometry;
+	bool loaded = ResourceManager::loadGeometry(path, geometry, options);
+
+	co_await loader.resumeOnDeviceThread();
+	if (!loaded) co_return nullptr;
+	co_return addGeometry(path, options, layout, geometry);
+}
+
+ResourceCache::TextureHandle ResourceCache::findTextureArray(std::span<const std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options) const {
+	return find(mTextures, textureArrayKey(paths, options));
+}
+
+ResourceCache::TextureHandle ResourceCache::addTextureArray(std::span<const std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options, std::span<const ResourceManager::Image* const> images) {
+	std::string key = textureArrayKey(paths, options);
+	if (TextureHandle texture = find(mTextures, key)) return texture;
+	STARTUP_STAGE("Upload");
+
+	TextureView view = nullptr;
+	uint64_t size = 0;
+	for (const ResourceManager::Image* image : images) {
+		size += imageMemorySize(*image);
+	}
+	ResourceManager::TextureLoadOptions fittedOptions = images.empty() ? options : fitToBudget(options, paths.empty() ? std::filesystem::path() : paths[0], images[0]->width, images[0]->height, size);
+	wgpu::Texture texture = ResourceManager::createTextureArray(images, mUploader, fittedOptions, &view);
+	if (!texture) return nullptr;
+	mUploader.flush();
+	TextureHandle handle = makeTexture(texture, view);
+	mTextures[key] = handle;
+	return handle;
+}
+
+ResourceCache::GeometryHandle ResourceCache::findGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout) const {
+	return find(mGeometries, geometryKey(path, options, layout));
+}
+
+ResourceCache::GeometryHandle ResourceCache::addGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout, const ResourceManager::Geometry& geometry) {
+	std::string key = geometryKey(path, options, layout);
+	if (GeometryHandle cached = find(mGeometries, key)) return cached;
+	std::string contentKey = geometryContentKey(geometry, layout);
+	if (GeometryHandle cached = find(mGeometryContents, contentKey)) {
+		std::cout << "Geometry of " << path.filename().string() << " is identical to one already uploaded" << std::endl;
+		mGeometries[key] = cached;
+		return cached;
+	}
+	STARTUP_STAGE("Upload");
+
+	GeometryHandle handle = uploadGeometry(geometry, layout);
+	mUploader.flush();
+	if (handle) {
+		mGeometries[key] = handle;
+		mGeometryContents[contentKey] = handle;
+	}
+	return handle;
+}
+
+ResourceCache::GeometryHandle ResourceCache::addGeometry(const VertexLayout& layout, const ResourceManager::Geometry& geometry) {
+	std::string contentKey = geometryContentKey(geometry, layout);
+	if (GeometryHandle cached = find(mGeometryContents, contentKey)) return cached;
+	GeometryHandle handle = uploadGeometry(geometry, layout);
+	mUploader.flush();
+	if (handle) mGeometryContents[contentKey] = handle;
+	return handle;
+}
+
+ResourceCache::TextureHandle ResourceCache::makeTexture(wgpu::Texture texture, TextureView view) {
+	auto handle = std::make_shared<Texture>();
+	handle->texture = texture;
+	handle->view = view;
+	return handle;
+}
+
+std::string ResourceCache::textureKey(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options) {
+	std::error_code error;
+	std::ostringstream key;
+	key << std::filesystem::absolute(path, error).lexically_normal().generic_string()
+		<< "|mips=" << static_cast<int>(options.mipmapGeneration)
+		<< "|srgb=" << options.srgb
+		<< "|alpha=" << options.alphaWeightedMipMaps
+		<< "|view=" << static_cast<int>(options.viewDimension)
+		<< "|max=" << options.maxSize;
+	return key.str();
+}
+
+std::string ResourceCache::textureArrayKey(std::span<const std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options) {
+	// The view dimension of arrays is always _2DArray
+	ResourceManager::TextureLoadOptions arrayOptions = options;
+	arrayOptions.viewDimension = TextureViewDimension::_2DArray;
+	std::string key = "array";
+	for (const std::filesystem::path& path : paths) {
+		key += "|" + textureKey(path, arrayOptions);
+	}
+	return key;
+}
+
+std::string ResourceCache::geometryKey(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout) {
+	std::error_code error;
+	std::ostringstream key;
+	key << std::filesystem::absolute(path, error).lexically_normal().generic_string()
+		<< "|opt=" << options.optimizeVertexCache << options.optimizeOverdraw << options.optimizeVertexFetch
+		<< "|lod=" << options.lodLevelCount << "," << options.lodMaxError
+		<< "|meshlets=" << options.buildMeshlets << "|clusterLod=" << options.clusterLod
+		<< "|layout=" << static_cast<int>(layout.encoding()) << static_cast<int>(layout.uvFormat()) << layout.splitPositionStream();
+	return key.str();
+}
+
+std::string ResourceCache::geometryContentKey(const ResourceManager::Geometry& geometry, const VertexLayout& layout) {
+	// Hashed here for geometries built at runtime, the loaders computing it otherwise
+	uint64_t hash = geometry.contentHash != 0 ? geometry.contentHash : ResourceManager::hashGeometry(geometry);
+	std::ostringstream key;
+	key << std::hex << hash << std::dec
+		<< "|vertices=" << geometry.vertices.size() << "|indices=" << geometry.indices.size()
+		<< "|layout=" << static_cast<int>(layout.encoding()) << static_cast<int>(layout.uvFormat()) << layout.splitPositionStream();
+	return key.str();
+}
+
+template <typename T>
+std::shared_ptr<const T> ResourceCache::find(std::unordered_map<std::string, std::weak_ptr<const T>>& entries, const std::string& key) {
+	auto it = entries.find(key);
+	if (it == entries.end()) return nullptr;
+	std::shared_ptr<const T> resource = it->second.lock();
+	if (!resource) entries.erase(it);
+	return resource;
+}
+
+std::shared_ptr<ResourceCache::Geometry> ResourceCache::allocateGeometry(const ResourceManager::Geometry& geometry, const VertexLayout& layout) {
+	auto handle = std::make_shared<Geometry>();
+	Geometry& gpuGeometry = *handle;
+	gpuGeometry.lods.assign(geometry.lods.begin(), geometry.lods.end());
+	gpuGeometry.submeshLods.assign(geometry.submeshLods.begin(), geometry.submeshLods.end());
+	gpuGeometry.clusterNodes.assign(geometry.clusterNodes.begin(), geometry.clusterNodes.end());
+	gpuGeometry.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	gpuGeometry.boundsMax = glm::vec3(std::numeric_limits<float>::lowest());
+	for (const ResourceManager::VertexAttributes& vertex : geometry.vertices) {
+		glm::vec3 position = vertex.position;
+		gpuGeometry.boundsMin = glm::min(gpuGeometry.boundsMin, position);
+		gpuGeometry.boundsMax = glm::max(gpuGeometry.boundsMax, position);
+	}
+	// Tighter than half the diagonal of the box for all but box shaped meshes
+	gpuGeometry.boundingSphereCenter = 0.5f * (gpuGeometry.boundsMin + gpuGeometry.boundsMax);
+	for (const ResourceManager::VertexAttributes& vertex : geometry.vertices) {
+		gpuGeometry.boundingSphereRadius = std::max(gpuGeometry.boundingSphereRadius, glm::length(glm::vec3(vertex.position) - gpuGeometry.boundingSphereCenter));
+	}
+	gpuGeometry.quantization = layout.computeQuantization(geometry.vertices);
+
+	// Allocate the vertices in the pages of the strides of the layout, 256Ki vertices each
+	std::vector<uint32_t> strides;
+	for (uint32_t buffer = 0; buffer < layout.bufferCount(); ++buffer) {
+		strides.push_back(static_cast<uint32_t>(layout.arrayStride(buffer)));
+	}
+	std::shared_ptr<BufferHeap>& vertexHeap = mVertexHeaps[strides];
+	if (!vertexHeap) {
+		BufferUsage usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+		if (mStorageVertices) usage = usage | BufferUsage::Storage;
+		vertexHeap = std::make_shared<BufferHeap>(mDevice, usage, strides, 1 << 18, "Vertex pages");
+	}
+	gpuGeometry.vertexHeap = vertexHeap;
+	gpuGeometry.vertexCount = static_cast<uint32_t>(geometry.vertices.size());
+	gpuGeometry.vertices = vertexHeap->allocate(gpuGeometry.vertexCount);
+
+	// Narrowed to 16-bit indices when they all fit, two per element of the index pages
+	gpuGeometry.indexHeap = mIndexHeap;
+	gpuGeometry.indexCount = static_cast<uint32_t>(geometry.indices.size());
+	gpuGeometry.indexFormat = geometry.vertices.size() <= 0xFFFF ? IndexFormat::Uint16 : IndexFormat::Uint32;
+	bool shortIndices = gpuGeometry.indexFormat == IndexFormat::Uint16;
+	gpuGeometry.indices = mIndexHeap->allocate(shortIndices ? (gpuGeometry.indexCount + 1) / 2 : gpuGeometry.indexCount);
+
+	gpuGeometry.meshletHeap = mMeshletHeap;
+	gpuGeometry.meshletCount = static_cast<uint32_t>(geometry.meshlets.size());
+	gpuGeometry.meshlets = mMeshletHeap->allocate(gpuGeometry.meshletCount);
+
+	if (!gpuGeometry.vertices || !gpuGeometry.indices || (gpuGeometry.meshletCount > 0 && !gpuGeometry.meshlets)) {
+		std::cerr << "Could not allocate geometry buffers!" << std::endl;
+		vertexHeap->unmap();
+		mIndexHeap->unmap();
+		mMeshletHeap->unmap();
+		return nullptr;
+	}
+	return handle;
+}
+
+ResourceCache::GeometryHandle ResourceCache::uploadGeometry(const ResourceManager::Geometry& geometry, const VertexLayout& layout) {
+	std::shared_ptr<Geometry> handle = allocateGeometry(geometry, layout);
+	if (!handle) return nullptr;
+
+	// Vertices are encoded, and indices narrowed, straight from the mapped cache into GPU visible
+	// memory: the page itself when it was just created, otherwise staging buffers
+	writeVertices(*handle, geometry, layout, 0, handle->vertexCount);
+	writeIndices(*handle, geometry, 0, handle->indexCount);
+	writeMeshlets(*handle, geometry);
+	handle->residentIndexCount = handle->indexCount;
+
+	// Pages created for this geometry must be unmapped before anything that draws it is submitted
+	handle->vertexHeap->unmap();
+	mIndexHeap->unmap();
+	mMeshletHeap->unmap();
+	return handle;
+}
+
+void ResourceCache::writeSlice(BufferHeap& heap, const BufferHeap::Slice& slice, uint32_t stream, uint32_t first, uint32_t count, const UploadManager::FillFunction& fill) {
+	if (count == 0) return;
+	uint64_t stride = heap.stride(stream);
+	if (std::byte* data = heap.mappedData(slice, stream)) {
+		fill(data + first * stride, first, count);
+		return;
+	}
+	mUploader.writeBuffer(heap.buffer(slice.page, stream), heap.offset(slice, stream) + first * stride, count, stride, [&](std::byte* destination, uint64_t chunkFirst, uint64_t chunkCount) {
+		fill(destination, first + chunkFirst, chunkCount);
+	});
+}
+
+void ResourceCache::writeVertices(const Geometry& target, const ResourceManager::Geometry& source, const VertexLayout& layout, uint32_t first, uint32_t count) {
+	BufferHeap& heap = *target.vertexHeap;
+	for (uint32_t stream = 0; stream < heap.streamCount(); ++stream) {
+		writeSlice(heap, target.vertices, stream, first, count, [&](std::byte* destination, uint64_t chunkFirst, uint64_t chunkCount) {
+			layout.encode(source.vertices.subspan(chunkFirst, chunkCount), target.quantization, stream, destination);
+		});
+	}
+}
+
+void ResourceCache::writeIndices(const Geometry& target, const ResourceManager::Geometry& source, uint32_t first, uint32_t count) {
+	if (target.indexFormat == IndexFormat::Uint32) {
+		writeSlice(*mIndexHeap, target.indices, 0, first, count, [&](std::byte* destination, uint64_t chunkFirst, uint64_t chunkCount) {
+			memcpy(destination, source.indices.data() + chunkFirst, chunkCount * sizeof(uint32_t));
+		});
+		return;
+	}
+
+	// Two indices per element, the last one padded with 0 for odd counts
+	writeSlice(*mIndexHeap, target.indices, 0, first / 2, (count + 1) / 2, [&](std::byte* destination, uint64_t chunkFirst, uint64_t chunkCount) {
+		uint16_t* narrowed = reinterpret_cast<uint16_t*>(destination);
+		for (uint64_t i = 2 * chunkFirst; i < 2 * (chunkFirst + chunkCount); ++i) {
+			*narrowed++ = i < source.indices.size() ? static_cast<uint16_t>(source.indices[i]) : 0;
+		}
+	});
+}
+
+void ResourceCache::writeMeshlets(const Geometry& target, const ResourceManager::Geometry& source) {
+	// Each Meshlet is laid out as its WGSL counterpart
+	writeSlice(*mMeshletHeap, target.meshlets, 0, 0, target.meshletCount, [&](std::byte* destination, uint64_t first, uint64_t count) {
+		memcpy(destination, source.meshlets.data() + first, count * sizeof(MeshOptimizer::Meshlet));
+	});
+}
+
+ResourceCache::GeometryHandle ResourceCache::streamGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout, std::shared_ptr<const ResourceManager::Geometry> geometry) {
+	std::string key = geometryKey(path, options, layout);
+	if (GeometryHandle cached = find(mGeometries, key)) return cached;
+	// Possibly still streaming, its copy being drawn as far as it is
+	std::string contentKey = geometryContentKey(*geometry, layout);
+	if (GeometryHandle cached = find(mGeometryContents, contentKey)) {
+		std::cout << "Geometry of " << path.filename().string() << " is identical to one already uploaded" << std::endl;
+		mGeometries[key] = cached;
+		return cached;
+	}
+
+	std::shared_ptr<Geometry> handle = allocateGeometry(*geometry, layout);
+	if (!handle) return nullptr;
+	// Pages stay live across the frames of the upload, so nothing is written in place
+	handle->vertexHeap->unmap();
+	mIndexHeap->unmap();
+	mMeshletHeap->unmap();
+
+	mGeometryStreams.push_back({ handle, std::move(geometry), &layout });
+	mGeometries[key] = handle;
+	mGeometryContents[contentKey] = handle;
+	return handle;
+}
+
+ResourceCache::StreamProgress ResourceCache::updateStreams(uint64_t byteBudget) {
+	StreamProgress progress;
+	if (mGeometryStreams.empty() && mTextureStreams.empty()) return progress;
+	TRACE_SCOPE("Stream resources");
+
+	std::stable_sort(mGeometryStreams.begin(), mGeometryStreams.end(), [](const GeometryStream& a, const GeometryStream& b) {
+		return a.priority > b.priority;
+	});
+	std::erase_if(mTextureStreams, [](const TextureStream& stream) {
+		std::shared_ptr<Texture> target = stream.target.lock();
+		return !target || (target->resident() && !stream.feedback);
+	});
+	std::stable_sort(mTextureStreams.begin(), mTextureStreams.end(), [](const TextureStream& a, const TextureStream& b) {
+		return a.priority > b.priority;
+	});
+
+	// Textures holding finer levels than requested for long enough move to a texture without
+	// them, and those requesting levels they lack to one with them
+	GpuHandle<CommandEncoder> encoder;
+	std::vector<bool> texturesChanged(mTextureStreams.size(), false);
+	for (size_t i = 0; i < mTextureStreams.size(); ++i) {
+		TextureStream& stream = mTextureStreams[i];
+		std::shared_ptr<Texture> target = stream.target.lock();
+		if (!stream.pending(*target)) continue;
+		if (stream.requestedLevel < stream.firstLevel || stream.requestedLevel > stream.residentLevel(*target)) {
+			if (!encoder) {
+				CommandEncoderDescriptor encoderDesc{};
+				encoderDesc.label = "Texture resize";
+				encoder.reset(mDevice.createCommandEncoder(encoderDesc));
+			}
+			// Previous textures are destroyed once the frames drawing them and their copies are done
+			if (wgpu::Texture previous = resizeStreamedTexture(stream, *target, stream.requestedLevel, encoder)) {
+				retireTracked(previous);
+				texturesChanged[i] = true;
+			}
+			stream.evictionRounds = 0;
+		}
+	}
+
+	// Geometry of the visible resources first, as nothing is drawn where it is missing, by
+	// decreasing priority
+	auto streamGeometries = [&](bool visible) {
+		for (auto it = mGeometryStreams.begin(); it != mGeometryStreams.end() && byteBudget > 0;) {
+			std::shared_ptr<Geometry> target = it->target.lock();
+			if (!target || target->resident()) {
+				it = mGeometryStreams.erase(it);
+				continue;
+			}
+			if ((it->priority > 0.0f && !it->prefetch) != visible) {
+				++it;
+				continue;
+			}
+			streamChunk(*it, *target, byteBudget);
+			progress.geometry = true;
+		}
+	};
+	// Then at most `maxLevelCount` finer levels of each texture, those that cover most of the
+	// screen first, down to their requested level, large levels taking several frames
+	auto streamTextures = [&](bool visible, uint32_t maxLevelCount) {
+		for (size_t i = 0; i < mTextureStreams.size() && byteBudget > 0; ++i) {
+			TextureStream& stream = mTextureStreams[i];
+			if ((stream.priority > 0.0f && !stream.prefetch) != visible) continue;
+			std::shared_ptr<Texture> target = stream.target.lock();
+			for (uint32_t levelCount = 0; levelCount < maxLevelCount && byteBudget > 0 && target->residentMipLevel > 0 && stream.residentLevel(*target) > stream.requestedLevel;) {
+				if (streamRows(stream, *target, byteBudget)) {
+					++levelCount;
+					texturesChanged[i] = true;
+				}
+			}
+		}
+	};
+	// What is visible now, then the next level of its textures before their finer ones, and
+	// last, prefetching, the resources of priority 0, e.g. hidden for now, or to prefetch
+	for (bool visible : { true, false }) {
+		streamGeometries(visible);
+		streamTextures(visible, 1);
+		streamTextures(visible, UINT32_MAX);
+	}
+
+	// Sampling is limited to uploaded levels by the view rather than by the sampler, which all
+	// textures share
+	for (size_t i = 0; i < mTextureStreams.size(); ++i) {
+		if (!texturesChanged[i]) continue;
+		TextureStream& stream = mTextureStreams[i];
+		std::shared_ptr<Texture> target = stream.target.lock();
+		target->view.release();
+		target->view = ResourceManager::createTextureView(target->texture, stream.options, target->residentMipLevel);
+		progress.textures = true;
+	}
+
+	if (encoder) {
+		GpuHandle<CommandBuffer> commands = encoder->finish(CommandBufferDescriptor{});
+		encoder.reset();
+		GpuHandle<Queue>(mDevice.getQueue())->submit(commands.get());
+	}
+
+	// Chunks and levels must be submitted for their resident part to be drawn
+	mUploader.flush();
+	return progress;
+}
+
+bool ResourceCache::streamRows(TextureStream& stream, Texture& target, uint64_t& byteBudget) {
+	uint32_t level = target.residentMipLevel - 1;
+	uint64_t bytesPerRow = 0;
+	uint32_t rowCount = stream.image
+		? ResourceManager::textureLevelRowCount(*stream.image, target.texture, level, bytesPerRow)
+		: ResourceManager::textureLevelRowCount(*stream.compressedImage, target.texture, level, bytesPerRow);
+	// At least a row, so that a level larger than the budget still progresses
+	uint32_t count = static_cast<uint32_t>(std::clamp<uint64_t>(byteBudget / bytesPerRow, 1, rowCount - stream.residentRowCount));
+	uint64_t size = stream.image
+		? ResourceManager::writeTextureLevel(*stream.image, target.texture, mUploader, level, stream.residentRowCount, count)
+		: ResourceManager::writeTextureLevel(*stream.compressedImage, target.texture, mUploader, level, stream.residentRowCount, count);
+	byteBudget -= std::min(byteBudget, size);
+	stream.residentRowCount += count;
+	if (stream.residentRowCount < rowCount) return false;
+	stream.residentRowCount = 0;
+	target.residentMipLevel = level;
+	return true;
+}
+
+void ResourceCache::streamChunk(GeometryStream& stream, Geometry& target, uint64_t& byteBudget) {
+	// Whole triangles, and an even count for pairs of 16-bit indices
+	constexpr uint32_t chunkIndexCount = 6 << 14;
+	const ResourceManager::Geometry& source = *stream.source;
+	uint32_t first = target.residentIndexCount;
+	uint32_t count = std::min(chunkIndexCount, target.indexCount - first);
+	std::span<const uint32_t> indices = source.indices.subspan(first, count);
+	bool last = first + count == target.indexCount;
+
+	// Vertices are mostly ordered by first use, so a chunk usually only needs a few new ones,
+	// and all are needed by the end, including those only coarser levels use
+	uint32_t vertexCount = last ? target.vertexCount : *std::max_element(indices.begin(), indices.end()) + 1;
+	if (vertexCount > stream.residentVertexCount) {
+		uint32_t newVertexCount = vertexCount - stream.residentVertexCount;
+		writeVertices(target, source, *stream.layout, stream.residentVertexCount, newVertexCount);
+		byteBudget -= std::min(byteBudget, newVertexCount * stream.layout->vertexSize());
+		stream.residentVertexCount = vertexCount;
+	}
+
+	writeIndices(target, source, first, count);
+	byteBudget -= std::min(byteBudget, uint64_t(count) * sizeof(uint32_t));
+	if (last) {
+		writeMeshlets(target, source);
+	}
+	target.residentIndexCount = first + count;
+}
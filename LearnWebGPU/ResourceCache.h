@@ -0,0 +1,355 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "ResourceManager.h"
+#include "VertexLayout.h"
+#include "UploadManager.h"
+#include "AssetLoader.h"
+#include "BufferHeap.h"
+#include "Task.h"
+
+/**
+ * GPU resources loaded from files, shared by all the users of a same file loaded
+ * with the same options, so that it is decoded and uploaded only once.
+ *
+ * The cache only keeps weak references: users hold ref-counted handles, and a
+ * resource is released as soon as its last handle is. Entries are keyed by the
+ * normalized file path and everything that changes the uploaded data (load
+ * options, vertex layout).
+ *
+ * It is meant to be used from the device thread only. Loading can go through
+ * loadTexture/loadGeometry, which decode on a miss, or be split for asynchronous
+ * loading: find*() on the device thread, decoding on a worker thread with
+ * ResourceManager, then add*() back on the device thread to upload.
+ *
+ * Uploads go through the staging buffer ring of an UploadManager, and each add*()
+ * submits its copies before returning, so that the resource can be used right away.
+ * Geometry that gets a new page of its BufferHeap is written into it directly, as
+ * the page is still mapped from its creation.
+ */
+class ResourceCache {
+public:
+	/**
+	 * A texture with a view of all its uploaded mip levels, released with the last handle
+	 */
+	struct Texture {
+		wgpu::Texture texture = nullptr;
+		wgpu::TextureView view = nullptr;
+		// First level of `view`, more than 0 while streamTexture() is still uploading the finer
+		// levels, each step of which replaces `view`
+		uint32_t residentMipLevel = 0;
+		// Index of the texture in VirtualTextures when its texels are paged in by tiles, `view`
+		// then being that of the tile cache, and `texture` null. UINT32_MAX for the others.
+		uint32_t virtualTexture = UINT32_MAX;
+
+		bool resident() const { return residentMipLevel == 0; }
+
+		Texture() = default;
+		~Texture();
+		Texture(const Texture&) = delete;
+		Texture& operator=(const Texture&) = delete;
+	};
+
+	/**
+	 * Geometry uploaded through a given VertexLayout to pages of GPU buffers shared with
+	 * other geometries (see BufferHeap), released with the last handle
+	 */
+	struct Geometry {
+		// Vertex range in pages of one buffer per buffer layout of the vertex layout
+		std::shared_ptr<BufferHeap> vertexHeap;
+		BufferHeap::Slice vertices;
+		uint32_t vertexCount = 0;
+		// Indices relative to the first vertex, in 4 byte elements of pages of all geometries
+		std::shared_ptr<BufferHeap> indexHeap;
+		BufferHeap::Slice indices;
+		uint32_t indexCount = 0;
+		// Leading indices whose data and vertices are uploaded, less than indexCount while
+		// streamGeometry() is still uploading the geometry
+		uint32_t residentIndexCount = 0;
+		// Uint16 whenever the mesh has less than 65536 unique vertices, to halve index fetch bandwidth
+		wgpu::IndexFormat indexFormat = wgpu::IndexFormat::Uint32;
+		// Ranges of the indices, from the full mesh to the coarsest level, relative to firstIndex()
+		std::vector<ResourceManager::GeometryLod> lods;
+		// Ranges of the submeshes in each level, level by level, empty for a single submesh (see
+		// ResourceManager::Geometry::submeshLods)
+		std::vector<ResourceManager::GeometryLod> submeshLods;
+		// Meshlets of all levels (MeshOptimizer::Meshlet), in pages of storage buffers for GPU
+		// culling, an invalid slice when the geometry has none
+		std::shared_ptr<BufferHeap> meshletHeap;
+		BufferHeap::Slice meshlets;
+		uint32_t meshletCount = 0;
+		// Cluster level of detail hierarchy (see ResourceManager::Geometry::clusterNodes), with
+		// index offsets relative to firstIndex(), kept in CPU memory for the batches drawing with it
+		std::vector<MeshOptimizer::ClusterLodNode> clusterNodes;
+		// Dequantization parameters of the vertex buffers, for the vertex shader
+		VertexQuantization quantization;
+		// Model space bounding box
+		glm::vec3 boundsMin = { 0.0f, 0.0f, 0.0f };
+		glm::vec3 boundsMax = { 0.0f, 0.0f, 0.0f };
+		// Model space bounding sphere, centered on the bounding box, for culling
+		glm::vec3 boundingSphereCenter = { 0.0f, 0.0f, 0.0f };
+		float boundingSphereRadius = 0.0f;
+
+		// Buffers to draw from, whole pages that other geometries may share, and the
+		// baseVertex and firstIndex of the geometry in them
+		uint32_t vertexBufferCount() const { return vertexHeap->streamCount(); }
+		wgpu::Buffer vertexBuffer(uint32_t slot) const { return vertexHeap->buffer(vertices.page, slot); }
+		wgpu::Buffer indexBuffer() const { return indexHeap->buffer(indices.page); }
+		int32_t baseVertex() const { return static_cast<int32_t>(vertices.first); }
+		uint32_t firstIndex() const { return indexFormat == wgpu::IndexFormat::Uint16 ? 2 * indices.first : indices.first; }
+
+		uint32_t submeshCount() const { return submeshLods.empty() ? 1 : static_cast<uint32_t>(submeshLods.size() / lods.size()); }
+		// Range of a submesh at a level of detail, the whole level for a single submesh
+		const ResourceManager::GeometryLod& lod(uint32_t level, uint32_t submesh) const {
+			return submeshLods.empty() ? lods[level] : submeshLods[level * submeshCount() + submesh];
+		}
+		// Leading indices of a range that are uploaded
+		uint32_t residentIndexCountOf(const ResourceManager::GeometryLod& lod) const {
+			return residentIndexCount > lod.indexOffset ? std::min(lod.indexCount, residentIndexCount - lod.indexOffset) : 0;
+		}
+
+		// Whether everything is uploaded. Until then only the uploaded part of the full
+		// level of detail, which comes first, may be drawn.
+		bool resident() const { return residentIndexCount == indexCount; }
+
+		Geometry() = default;
+		~Geometry();
+		Geometry(const Geometry&) = delete;
+		Geometry& operator=(const Geometry&) = delete;
+	};
+
+	using TextureHandle = std::shared_ptr<const Texture>;
+	using GeometryHandle = std::shared_ptr<const Geometry>;
+
+	// With `storageVertices`, vertex pages can also be bound as storage buffers, for shaders to
+	// pull vertices from
+	explicit ResourceCache(wgpu::Device device, bool storageVertices = false);
+
+	ResourceCache(const ResourceCache&) = delete;
+	ResourceCache& operator=(const ResourceCache&) = delete;
+
+	// Return the cached texture, or decode and upload it. Return nullptr if loading failed.
+	TextureHandle loadTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options);
+
+	// Return the cached geometry, or load and upload it. Return nullptr if loading failed.
+	GeometryHandle loadGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout);
+
+	// Return the texture cached for this path and options, or nullptr
+	TextureHandle findTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options) const;
+
+	// Upload a texture decoded from `path` and cache it. If another load of the same texture
+	// completed in the meantime, return the cached one instead.
+	TextureHandle addTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, const ResourceManager::Image& image);
+	TextureHandle addTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, const ResourceManager::CompressedImage& image);
+
+	// Return the texture array cached for these layer paths and options, or nullptr
+	TextureHandle findTextureArray(std::span<const std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options) const;
+
+	// Upload a texture array with one layer per image (see ResourceManager::createTextureArray),
+	// decoded from `paths`, and cache it like addTexture
+	TextureHandle addTextureArray(std::span<const std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options, std::span<const ResourceManager::Image* const> images);
+
+	// Load a batch of textures (.ktx2 files or regular images), decoding them and filtering their
+	// mip-maps concurrently on the worker threads of `loader`. Textures are uploaded on the device
+	// thread in the order of `paths`, each one as soon as it and those before are decoded, then
+	// `onLoaded` receives their handles in that order, null for those that failed to load.
+	// The cache must outlive the completions of `loader`.
+	void loadTextures(AssetLoader& loader, std::vector<std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options, std::function<void(std::vector<TextureHandle>)> onLoaded);
+
+	// Same as loadTexture, decoding on a worker thread of `loader` and resuming on the device
+	// thread, where the task must be started. The cache must outlive the task.
+	Task<TextureHandle> loadTextureAsync(AssetLoader& loader, std::filesystem::path path, ResourceManager::TextureLoadOptions options);
+
+	// Same as loadGeometry, parsing on a worker thread of `loader` like loadTextureAsync decodes.
+	// The layout, which cannot be copied, must outlive the task too.
+	Task<GeometryHandle> loadGeometryAsync(AssetLoader& loader, std::filesystem::path path, ResourceManager::GeometryLoadOptions options, const VertexLayout& layout);
+
+	// Return the geometry cached for this path, options and layout, or nullptr. Geometries of
+	// different paths whose data is identical, as told by their content hash, are uploaded once
+	// and share the same handle, whichever add*() call they go through.
+	GeometryHandle findGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout) const;
+
+	// Upload a geometry loaded from `path` and cache it, like addTexture
+	GeometryHandle addGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout, const ResourceManager::Geometry& geometry);
+	// Upload a geometry built at runtime rather than loaded from a file, e.g. by StaticBatcher,
+	// which is not cached
+	GeometryHandle addGeometry(const VertexLayout& layout, const ResourceManager::Geometry& geometry);
+
+	// Same as addGeometry, but only allocate the geometry and leave its upload to the next
+	// calls to updateStreams(), so that large meshes appear progressively instead of blocking
+	// a frame. `geometry` is kept, and `layout` must remain valid, until the upload is done.
+	GeometryHandle streamGeometry(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout, std::shared_ptr<const ResourceManager::Geometry> geometry);
+
+	// Same as addTexture, but only upload the coarsest mip levels and leave the finer ones to
+	// updateStreams(), so that a texture shows up blurry right away rather than after its whole
+	// upload. `image` is kept until the upload is done.
+	TextureHandle streamTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, std::shared_ptr<const ResourceManager::Image> image);
+	TextureHandle streamTexture(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, std::shared_ptr<const ResourceManager::CompressedImage> image);
+
+	// Textures of higher priority get their finer levels first, e.g. with their size on screen,
+	// and geometries of higher priority their next chunks. Those of priority 0, and those to
+	// `prefetch`, e.g. predicted to come into view, only get what is left of the budget once
+	// the others are done, still by decreasing priority.
+	void setStreamPriority(const TextureHandle& texture, float priority, bool prefetch = false);
+	void setStreamPriority(const GeometryHandle& geometry, float priority, bool prefetch = false);
+
+	// Whether a texture still has levels to stream down to its requested resolution
+	bool streaming(const TextureHandle& texture) const;
+
+	// Texels per unit of texture coordinates a streamed texture is sampled at, at most, as
+	// measured by TextureFeedback, 0 if it is not sampled at all. Streaming then stops at the
+	// level of that resolution, and finer levels requested by none of textureEvictionRounds
+	// calls in a row are dropped by moving the others to a smaller texture, to be streamed
+	// again once requested. Textures never given a resolution keep all their levels.
+	void setRequestedResolution(const TextureHandle& texture, float resolution);
+
+	/**
+	 * What updateStreams() uploaded. Bind groups of textures that progressed must be created
+	 * again, as their view changed.
+	 */
+	struct StreamProgress {
+		bool geometry = false;
+		bool textures = false;
+	};
+
+	// Forget the resources loaded from the file at `path`, e.g. once it changed, so that the
+	// next loads read it again. Handles already given out stay valid until released.
+	void evict(const std::filesystem::path& path);
+
+	// Upload about `byteBudget` bytes of the resources being streamed, by decreasing priority:
+	// the geometry of visible resources (of priority above 0) in chunks of whole triangles of
+	// the full level of detail preceded by the vertices they use, then the next finer mip level
+	// of each of their textures, then their other levels, and last the same for the resources
+	// of priority 0 or to prefetch. Levels are uploaded by slices of rows, a large one taking
+	// several calls, and only sampled once complete.
+	StreamProgress updateStreams(uint64_t byteBudget);
+
+	// Number of geometries and textures not fully uploaded yet, textures down to their requested
+	// resolution only, or with levels to drop
+	size_t streamingCount() const;
+
+	// Bytes uploaded since creation, for upload statistics
+	uint64_t uploadedBytes() const { return mUploader.uploadedBytes(); }
+
+	// Estimated GPU memory of the resources still alive and of the staging buffers (see GpuMemory.h)
+	uint64_t gpuMemorySize() const;
+
+	// Wrap textures that do not come from a file in a handle, which takes ownership of them
+	static TextureHandle makeTexture(wgpu::Texture texture, wgpu::TextureView view);
+
+	// Keys of the entries, which also tell decoded data apart in RetainedAssets
+	static std::string textureKey(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options);
+	static std::string geometryKey(const std::filesystem::path& path, const ResourceManager::GeometryLoadOptions& options, const VertexLayout& layout);
+
+private:
+	static std::string textureArrayKey(std::span<const std::filesystem::path> paths, const ResourceManager::TextureLoadOptions& options);
+	// Key of the data of a geometry uploaded through `layout`, whatever it was loaded from
+	static std::string geometryContentKey(const ResourceManager::Geometry& geometry, const VertexLayout& layout);
+
+	// Look up a key, dropping its entry if the resource has been released
+	template <typename T>
+	static std::shared_ptr<const T> find(std::unordered_map<std::string, std::weak_ptr<const T>>& entries, const std::string& key);
+
+	/**
+	 * A geometry being uploaded by updateStreams()
+	 */
+	struct GeometryStream {
+		// The upload stops, and the source is released, if the geometry is released first
+		std::weak_ptr<Geometry> target;
+		std::shared_ptr<const ResourceManager::Geometry> source;
+		const VertexLayout* layout;
+		uint32_t residentVertexCount = 0;
+		float priority = 0.0f;
+		bool prefetch = false;
+	};
+
+	/**
+	 * A texture whose finer levels are being uploaded by updateStreams(), from one of the two
+	 * images
+	 */
+	struct TextureStream {
+		std::weak_ptr<Texture> target;
+		std::shared_ptr<const ResourceManager::Image> image;
+		std::shared_ptr<const ResourceManager::CompressedImage> compressedImage;
+		// Those the texture was created with, for its views
+		ResourceManager::TextureLoadOptions options;
+		float priority = 0.0f;
+		bool prefetch = false;
+
+		// Levels of the image, the first of them in the texture, the finest it may have, and the
+		// coarsest level uploaded at creation, which it always keeps
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t imageLevelCount = 0;
+		uint32_t firstLevel = 0;
+		uint32_t finestLevel = 0;
+		uint32_t coarsestLevel = 0;
+		// Compressed textures only start at levels of whole blocks
+		uint32_t blockWidth = 1;
+		uint32_t blockHeight = 1;
+		// Finest image level to upload, and results of setRequestedResolution() in a row below
+		// the finest uploaded one. Streams given a resolution are kept once resident.
+		uint32_t requestedLevel = 0;
+		uint32_t evictionRounds = 0;
+		bool feedback = false;
+		// Rows uploaded of the level after the finest uploaded one, which takes several calls
+		// to updateStreams() when it is larger than their budget
+		uint32_t residentRowCount = 0;
+
+		// Image level of the finest level uploaded
+		uint32_t residentLevel(const Texture& target) const { return firstLevel + target.residentMipLevel; }
+		bool pending(const Texture& target) const;
+	};
+
+	// Cache a texture created by createStreamedTexture() and stream the rest of its levels
+	TextureHandle addTextureStream(const std::string& key, wgpu::Texture texture, uint32_t residentLevel, TextureStream stream);
+	// Move a streamed texture to one starting at image level `firstLevel`, copying its uploaded
+	// levels with `encoder`. Return the previous texture, to give to retireTracked.
+	wgpu::Texture resizeStreamedTexture(TextureStream& stream, Texture& target, uint32_t firstLevel, wgpu::CommandEncoder encoder);
+
+	// Compute the bounds and allocate the buffer slices of a geometry, without uploading it
+	std::shared_ptr<Geometry> allocateGeometry(const ResourceManager::Geometry& geometry, const VertexLayout& layout);
+	GeometryHandle uploadGeometry(const ResourceManager::Geometry& geometry, const VertexLayout& layout);
+
+	// Write elements [first, first + count) of a slice in a stream of its heap, produced by `fill`
+	// in place if its page is still mapped from its creation, otherwise through staging buffers
+	void writeSlice(BufferHeap& heap, const BufferHeap::Slice& slice, uint32_t stream, uint32_t first, uint32_t count, const UploadManager::FillFunction& fill);
+	void writeVertices(const Geometry& target, const ResourceManager::Geometry& source, const VertexLayout& layout, uint32_t first, uint32_t count);
+	// `first` must be even, as 16-bit indices are written by pairs
+	void writeIndices(const Geometry& target, const ResourceManager::Geometry& source, uint32_t first, uint32_t count);
+	void writeMeshlets(const Geometry& target, const ResourceManager::Geometry& source);
+	// Upload the next chunk of a stream, which must not be done yet
+	void streamChunk(GeometryStream& stream, Geometry& target, uint64_t& byteBudget);
+	// Upload the next rows of the level after the finest uploaded one, as many as the budget
+	// allows, returning whether that level is then uploaded
+	bool streamRows(TextureStream& stream, Texture& target, uint64_t& byteBudget);
+
+private:
+	wgpu::Device mDevice;
+	bool mStorageVertices;
+	UploadManager mUploader;
+	mutable std::unordered_map<std::string, std::weak_ptr<const Texture>> mTextures;
+	mutable std::unordered_map<std::string, std::weak_ptr<const Geometry>> mGeometries;
+	// The same geometries by geometryContentKey()
+	mutable std::unordered_map<std::string, std::weak_ptr<const Geometry>> mGeometryContents;
+	// Pages of geometry data, those of vertices by strides of their vertex layout, shared
+	// with the geometries that allocated from them in case these outlive the cache
+	std::map<std::vector<uint32_t>, std::shared_ptr<BufferHeap>> mVertexHeaps;
+	std::shared_ptr<BufferHeap> mIndexHeap;
+	std::shared_ptr<BufferHeap> mMeshletHeap;
+	std::vector<GeometryStream> mGeometryStreams;
+	std::vector<TextureStream> mTextureStreams;
+};
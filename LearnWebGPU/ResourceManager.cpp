@@ -1,32 +1,66 @@
 #include "ResourceManager.h"
 
-#include <fstream>
+#include <istream>
+#include <streambuf>
 #include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <unordered_map>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <atomic>
+
+#include "ParallelFor.h"
+#include "DecodeHeap.h"
+#include "MemoryProfiler.h"
+#include "ObjParser.h"
+#include "TxtGeometryParser.h"
+#include "GlbParser.h"
+#include "ImageDecoder.h"
+#include "MeshOptimizer.h"
+#include "Mipmaps.h"
+#include "StartupProfiler.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+#include "AssetBundle.h"
+#include "MeshCache.h"
+#include "MeshCodec.h"
+#include "ShaderPreprocessor.h"
 
 #include "tiny_obj_loader.h"
-#include "stb_image.h"
 
 using namespace wgpu;
 
-ShaderModule ResourceManager::loadShaderModule(const std::filesystem::path& path, Device device) {
-    // Open the file in binary mode to preserve line endings exactly
-    std::ifstream file(path, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Could not load shader: " << path << std::endl;
-        return nullptr;
-    }
+bool ResourceManager::loadShaderSource(const std::filesystem::path& path, std::string& source) {
+    // Through MappedFile, which fetches it on the web, taking line endings as they are
+    auto load = [](const std::filesystem::path& path, std::string& source) {
+        MappedFile file;
+        if (!file.open(path)) {
+            std::cerr << "Could not load shader: " << path << std::endl;
+            return false;
+        }
+        source.append(reinterpret_cast<const char*>(file.data()), file.size());
+        return true;
+    };
+    return ShaderPreprocessor::include(path, load, source);
+}
 
-    // Read the entire file into a string without modifying line endings
-    std::string shaderSource((std::istreambuf_iterator<char>(file)),
-                              std::istreambuf_iterator<char>());
+ShaderModule ResourceManager::loadShaderModule(const std::filesystem::path& path, Device device, const std::string& prelude) {
+    std::string shaderSource = prelude;
+    if (!loadShaderSource(path, shaderSource)) return nullptr;
 
-    // Guarantee null-termination for WGSL descriptor
-    shaderSource.push_back('\0');
+    return createShaderModule(shaderSource, device);
+}
 
+ShaderModule ResourceManager::createShaderModule(const std::string& source, Device device) {
+    // c_str() is null-terminated as required by the WGSL descriptor
     ShaderModuleWGSLDescriptor shaderCodeDesc{};
     shaderCodeDesc.chain.next = nullptr;
     shaderCodeDesc.chain.sType = SType::ShaderModuleWGSLDescriptor;
-    shaderCodeDesc.code = shaderSource.c_str();
+    shaderCodeDesc.code = source.c_str();
 
     ShaderModuleDescriptor shaderDesc{};
 #ifdef WEBGPU_BACKEND_WGPU
@@ -38,15 +72,71 @@ ShaderModule ResourceManager::loadShaderModule(const std::filesystem::path& path
     return device.createShaderModule(shaderDesc);
 }
 
-bool ResourceManager::loadGeometryFromObj(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData) {
-	tinyobj::attrib_t attrib;
+// Files larger than this go through the multi-threaded parser rather than tinyobj, whatever
+// their materials
+static constexpr uintmax_t parallelObjThreshold = 16 << 20;
+
+// A stream reading straight from memory, for tinyobj to parse a mapped file rather than open it
+// through stdio, which has nothing to read on the web
+class MemoryStreamBuffer : public std::streambuf {
+public:
+	MemoryStreamBuffer(const std::byte* data, size_t size) {
+		char* begin = const_cast<char*>(reinterpret_cast<const char*>(data));
+		setg(begin, begin, begin + size);
+	}
+};
+
+// The .mtl files an OBJ refers to, read from its directory and mapped like the OBJ itself
+class MappedMaterialReader : public tinyobj::MaterialReader {
+public:
+	explicit MappedMaterialReader(std::filesystem::path directory) : mDirectory(std::move(directory)) {}
+
+	bool operator()(const std::string& matId, std::vector<tinyobj::material_t>* materials, std::map<std::string, int>* matMap, std::string* warn, std::string* err) override {
+		MappedFile file;
+		if (!file.open(mDirectory / matId)) {
+			if (warn) *warn += "Material file " + matId + " not found\n";
+			return false;
+		}
+		MemoryStreamBuffer buffer(file.data(), file.size());
+		std::istream stream(&buffer);
+		tinyobj::LoadMtl(matMap, materials, &stream, warn, err);
+		return true;
+	}
+
+private:
+	std::filesystem::path mDirectory;
+};
+
+// Auxiliary function for loadGeometryFromObj, parse the file into attributes
+// and one flat list of triangle corners covering all shapes, and if requested the
+// materials and the material of each triangle (-1 for none). Files large enough for
+// the parallel parser have no materials. Those that assign none, or whose materials are not
+// requested, go through it too, on a single chunk when small, its scanning and number
+// parsing (see TextScanner.h) being much faster than those of tinyobj.
+static bool parseObj(const std::filesystem::path& path, tinyobj::attrib_t& attrib, std::vector<tinyobj::index_t>& corners, std::vector<tinyobj::material_t>* materials = nullptr, std::vector<int>* triangleMaterials = nullptr) {
+	MEMORY_SCOPE(GeometryParsing);
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	std::string_view source(reinterpret_cast<const char*>(file.data()), file.size());
+	bool large = file.size() >= parallelObjThreshold && workerThreadCount() > 1;
+	if (large || !materials || source.find("usemtl") == std::string_view::npos) {
+		return parseObjParallel(file.data(), file.size(), attrib, corners);
+	}
+
 	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
+	std::vector<tinyobj::material_t> parsedMaterials;
 
 	std::string warn;
 	std::string err;
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.string().c_str());
+	// Materials are only read from the files they are in when used
+	MemoryStreamBuffer buffer(file.data(), file.size());
+	std::istream stream(&buffer);
+	MappedMaterialReader materialReader(path.parent_path());
+	bool ret = tinyobj::LoadObj(&attrib, &shapes, &parsedMaterials, &warn, &err, &stream, materials ? &materialReader : nullptr);
 
 	if (!warn.empty()) {
 		std::cout << warn << std::endl;
@@ -60,144 +150,1393 @@ bool ResourceManager::loadGeometryFromObj(const std::filesystem::path& path, std
 		return false;
 	}
 
-	// Filling in vertexData:
-	vertexData.clear();
+	size_t totalIndexCount = 0;
+	for (const auto& shape : shapes) {
+		totalIndexCount += shape.mesh.indices.size();
+	}
+	corners.clear();
+	corners.reserve(totalIndexCount);
 	for (const auto& shape : shapes) {
-		size_t offset = vertexData.size();
-		vertexData.resize(offset + shape.mesh.indices.size());
+		corners.insert(corners.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+	}
+	// Faces are triangulated, thus one material per triangle
+	if (triangleMaterials) {
+		triangleMaterials->clear();
+		triangleMaterials->reserve(totalIndexCount / 3);
+		for (const auto& shape : shapes) {
+			triangleMaterials->insert(triangleMaterials->end(), shape.mesh.material_ids.begin(), shape.mesh.material_ids.end());
+		}
+	}
+	if (materials) *materials = std::move(parsedMaterials);
+	return true;
+}
+
+// Auxiliary function for loadGeometryFromObj: sort the triangles of `indexData` by material,
+// in the order of `parsedMaterials` then those of none, into the submeshes of the materials used
+static void sortObjSubmeshes(const std::vector<tinyobj::material_t>& parsedMaterials, const std::vector<int>& triangleMaterials, std::vector<uint32_t>& indexData, std::vector<ResourceManager::GeometryLod>& submeshes, std::vector<ResourceManager::SourceMaterial>& materials) {
+	submeshes.clear();
+	materials.clear();
+	size_t triangleCount = indexData.size() / 3;
+	if (triangleMaterials.size() != triangleCount) return;
+
+	// Those of no material, or of an unknown one, after all the others
+	auto materialSlot = [&](int material) {
+		return material >= 0 && material < static_cast<int>(parsedMaterials.size()) ? static_cast<size_t>(material) : parsedMaterials.size();
+	};
+	std::vector<uint32_t> counts(parsedMaterials.size() + 1, 0);
+	for (int material : triangleMaterials) {
+		++counts[materialSlot(material)];
+	}
+	if (std::count_if(counts.begin(), counts.end(), [](uint32_t count) { return count > 0; }) <= 1) return;
+
+	// A counting sort, which keeps the order of the triangles within each material
+	std::vector<uint32_t> firstTriangle(counts.size(), 0);
+	uint32_t triangle = 0;
+	for (size_t slot = 0; slot < counts.size(); ++slot) {
+		firstTriangle[slot] = triangle;
+		triangle += counts[slot];
+		if (counts[slot] == 0) continue;
+		submeshes.push_back({ 3 * firstTriangle[slot], 3 * counts[slot], 0.0f, 0, 0 });
+		ResourceManager::SourceMaterial material;
+		if (slot < parsedMaterials.size()) {
+			material.name = parsedMaterials[slot].name;
+			material.baseColorTexture = parsedMaterials[slot].diffuse_texname;
+			material.opacity = static_cast<float>(parsedMaterials[slot].dissolve);
+		}
+		materials.push_back(std::move(material));
+	}
+	std::vector<uint32_t> sorted(indexData.size());
+	for (size_t t = 0; t < triangleCount; ++t) {
+		uint32_t target = firstTriangle[materialSlot(triangleMaterials[t])]++;
+		std::copy_n(indexData.begin() + 3 * t, 3, sorted.begin() + 3 * size_t(target));
+	}
+	indexData = std::move(sorted);
+}
+
+bool ResourceManager::loadGeometryFromObj(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData) {
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::index_t> corners;
+	if (!parseObj(path, attrib, corners)) {
+		return false;
+	}
+
+	// Filling in vertexData:
+	vertexData.resize(corners.size());
+	parallelForRanges(corners.size(), [&](size_t begin, size_t end) {
+		convertObjVertices(attrib, corners.data() + begin, end - begin, vertexData.data() + begin);
+	});
+
+	return true;
+}
+
+bool ResourceManager::loadGeometryFromObj(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData) {
+	std::vector<GeometryLod> submeshes;
+	std::vector<SourceMaterial> materials;
+	return loadGeometryFromObj(path, vertexData, indexData, submeshes, materials);
+}
+
+bool ResourceManager::loadGeometryFromObj(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData, std::vector<GeometryLod>& submeshes, std::vector<SourceMaterial>& materials) {
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::index_t> corners;
+	std::vector<tinyobj::material_t> parsedMaterials;
+	std::vector<int> triangleMaterials;
+	if (!parseObj(path, attrib, corners, &parsedMaterials, &triangleMaterials)) {
+		return false;
+	}
+
+	// A corner is uniquely identified by its (position, normal, texcoord) triple
+	struct CornerHash {
+		size_t operator()(const tinyobj::index_t& idx) const {
+			size_t h = std::hash<int>()(idx.vertex_index);
+			h ^= std::hash<int>()(idx.normal_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<int>()(idx.texcoord_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+	struct CornerEqual {
+		bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const {
+			return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+		}
+	};
+
+	// A node per unique corner, from the DecodeHeap pool of the loading thread
+	std::unordered_map<tinyobj::index_t, uint32_t, CornerHash, CornerEqual, DecodeAllocator<std::pair<const tinyobj::index_t, uint32_t>>> uniqueVertices;
+	uniqueVertices.reserve(corners.size() / 4);
+
+	// Deduplication is sequential, the attribute conversion of unique corners is not
+	DecodeVector<tinyobj::index_t> uniqueCorners;
+	indexData.resize(corners.size());
+	for (size_t i = 0; i < corners.size(); ++i) {
+		auto [it, inserted] = uniqueVertices.try_emplace(corners[i], static_cast<uint32_t>(uniqueCorners.size()));
+		if (inserted) {
+			uniqueCorners.push_back(corners[i]);
+		}
+		indexData[i] = it->second;
+	}
+
+	vertexData.resize(uniqueCorners.size());
+	parallelForRanges(uniqueCorners.size(), [&](size_t begin, size_t end) {
+		convertObjVertices(attrib, uniqueCorners.data() + begin, end - begin, vertexData.data() + begin);
+	});
+
+	sortObjSubmeshes(parsedMaterials, triangleMaterials, indexData, submeshes, materials);
+
+	std::cout << "Loaded " << path.filename() << ": " << vertexData.size() << " unique vertices for "
+		<< indexData.size() << " indices";
+	if (!materials.empty()) std::cout << " in " << materials.size() << " materials";
+	std::cout << std::endl;
+
+	return true;
+}
+
+static_assert(sizeof(MeshCacheHeader) % alignof(ResourceManager::VertexAttributes) == 0);
+static_assert(sizeof(ResourceManager::VertexAttributes) == meshCacheVertexSize);
+
+// Header of the cache matching the given load options, without source stamp nor counts
+static MeshCacheHeader meshCacheHeader(const ResourceManager::GeometryLoadOptions& options) {
+	MeshCacheHeader header{};
+	memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+	header.version = meshCacheVersion;
+	header.optimizations = (options.optimizeVertexCache ? 1u : 0u)
+		| (options.optimizeVertexCache && options.optimizeOverdraw ? 2u : 0u)
+		| (options.optimizeVertexFetch ? 4u : 0u)
+		| (options.buildMeshlets ? 8u : 0u)
+		| (options.clusterLod ? 16u : 0u);
+	header.lodLevelCount = std::max(options.lodLevelCount, 1u);
+	header.lodMaxError = header.lodLevelCount > 1 ? options.lodMaxError : 0.0f;
+	return header;
+}
+
+// Offset of the meshlets in the cache, aligned for their vec4 members
+static size_t meshCacheMeshletOffset(const MeshCacheHeader& header) {
+	size_t end = sizeof(MeshCacheHeader)
+		+ header.vertexCount * sizeof(ResourceManager::VertexAttributes)
+		+ header.indexCount * sizeof(uint32_t)
+		+ header.lodCount * sizeof(ResourceManager::GeometryLod)
+		+ size_t(header.submeshCount) * header.lodCount * sizeof(ResourceManager::GeometryLod);
+	return (end + 15) & ~size_t(15);
+}
+
+// Materials of the submeshes in the mesh cache, as three lines each: name, base color texture
+// and opacity
+static std::string writeMaterials(const std::vector<ResourceManager::SourceMaterial>& materials) {
+	std::ostringstream text;
+	for (const ResourceManager::SourceMaterial& material : materials) {
+		text << material.name << '\n' << material.baseColorTexture.generic_string() << '\n' << material.opacity << '\n';
+	}
+	return text.str();
+}
+
+static bool readMaterials(std::string_view text, std::vector<ResourceManager::SourceMaterial>& materials) {
+	materials.clear();
+	std::istringstream lines{ std::string(text) };
+	ResourceManager::SourceMaterial material;
+	std::string texture;
+	std::string opacity;
+	while (std::getline(lines, material.name) && std::getline(lines, texture) && std::getline(lines, opacity)) {
+		material.baseColorTexture = texture;
+		material.opacity = std::strtof(opacity.c_str(), nullptr);
+		materials.push_back(material);
+	}
+	return lines.eof();
+}
+
+static std::filesystem::path meshCachePath(const std::filesystem::path& path) {
+	std::filesystem::path cachePath = path;
+	cachePath += ".meshcache";
+	return cachePath;
+}
+
+// Fill the source metadata part of a cache header, return false if the source is not readable
+static bool sourceStamp(const std::filesystem::path& path, MeshCacheHeader& header) {
+	// As recorded when packing, the bundle being packed from the files of the caches
+	if (const AssetBundle::Entry* entry = AssetBundle::find(path)) {
+		header.sourceSize = entry->size;
+		header.sourceWriteTime = entry->writeTime;
+		return true;
+	}
+	std::error_code ec;
+	header.sourceSize = std::filesystem::file_size(path, ec);
+	if (ec) return false;
+	header.sourceWriteTime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	return !ec;
+}
+
+// Decode the compressed cache `compressed` of header `header` (see MeshCache.h) to `decoded`, of
+// `decodedSize` bytes, the uncompressed cache it was made from. The chunks of the vertices and
+// indices are decoded in parallel.
+static bool decompressMeshCache(const MeshCacheHeader& header, std::span<const std::byte> compressed, std::unique_ptr<std::byte[]>& decoded, size_t& decodedSize) {
+	CompressedMeshCacheSizes sizes;
+	size_t offset = sizeof(MeshCacheHeader) + sizeof(CompressedMeshCacheSizes);
+	if (compressed.size() < offset) return false;
+	memcpy(&sizes, compressed.data() + sizeof(MeshCacheHeader), sizeof(CompressedMeshCacheSizes));
+	if (sizes.vertexBytes > compressed.size() - offset || sizes.indexBytes > compressed.size() - offset - sizes.vertexBytes) return false;
+	std::span<const std::byte> encodedVertices = compressed.subspan(offset, sizes.vertexBytes);
+	std::span<const std::byte> encodedIndices = compressed.subspan(offset + sizes.vertexBytes, sizes.indexBytes);
+	std::span<const std::byte> rest = compressed.subspan(offset + sizes.vertexBytes + sizes.indexBytes);
+	// Every chunk takes at least 4 bytes of its table, which bounds the counts before allocating
+	if (header.vertexCount > sizes.vertexBytes * MeshCodec::vertexChunkSize || header.indexCount > sizes.indexBytes * MeshCodec::indexChunkSize) return false;
+
+	size_t vertexBytes = header.vertexCount * sizeof(ResourceManager::VertexAttributes);
+	size_t indexBytes = header.indexCount * sizeof(uint32_t);
+	decodedSize = sizeof(MeshCacheHeader) + vertexBytes + indexBytes + rest.size();
+	decoded = std::make_unique_for_overwrite<std::byte[]>(decodedSize);
+	MeshCacheHeader decodedHeader = header;
+	memcpy(decodedHeader.magic, meshCacheMagic, sizeof(meshCacheMagic));
+	memcpy(decoded.get(), &decodedHeader, sizeof(MeshCacheHeader));
+	std::byte* vertexStart = decoded.get() + sizeof(MeshCacheHeader);
+	uint32_t* indexStart = reinterpret_cast<uint32_t*>(vertexStart + vertexBytes);
+	memcpy(vertexStart + vertexBytes + indexBytes, rest.data(), rest.size());
+
+	// Vertex chunks first, then index chunks
+	size_t vertexChunkCount = MeshCodec::chunkCount(header.vertexCount, MeshCodec::vertexChunkSize);
+	size_t indexChunkCount = MeshCodec::chunkCount(header.indexCount, MeshCodec::indexChunkSize);
+	std::atomic<bool> valid = true;
+	parallelForRanges(vertexChunkCount + indexChunkCount, [&](size_t begin, size_t end) {
+		bool rangeValid = true;
+		if (begin < vertexChunkCount) {
+			rangeValid = MeshCodec::decodeVertexBuffer(vertexStart, header.vertexCount, sizeof(ResourceManager::VertexAttributes), encodedVertices, begin, std::min(end, vertexChunkCount));
+		}
+		if (end > vertexChunkCount) {
+			rangeValid = rangeValid && MeshCodec::decodeIndexBuffer(indexStart, header.indexCount, encodedIndices, std::max(begin, vertexChunkCount) - vertexChunkCount, end - vertexChunkCount);
+		}
+		if (!rangeValid) valid = false;
+	}, 1);
+	return valid;
+}
+
+static bool mapMeshCache(const std::filesystem::path& path, MeshCacheHeader expected, ResourceManager::Geometry& geometry) {
+	if (!sourceStamp(path, expected)) return false;
+
+	if (!geometry.mapping.open(meshCachePath(path))) return false;
 
-		for (size_t i = 0; i < shape.mesh.indices.size(); ++i) {
-			const tinyobj::index_t& idx = shape.mesh.indices[i];
+	const std::byte* data = geometry.mapping.data();
+	size_t size = geometry.mapping.size();
+	MeshCacheHeader header;
+	if (size < sizeof(MeshCacheHeader)) {
+		geometry.mapping.close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(MeshCacheHeader));
+
+	size_t vertexBytes = header.vertexCount * sizeof(ResourceManager::VertexAttributes);
+	size_t indexBytes = header.indexCount * sizeof(uint32_t);
+	size_t meshletBytes = header.meshletCount * sizeof(MeshOptimizer::Meshlet);
+	size_t clusterNodeBytes = header.clusterNodeCount * sizeof(MeshOptimizer::ClusterLodNode);
+	size_t submeshLodBytes = size_t(header.submeshCount) * header.lodCount * sizeof(ResourceManager::GeometryLod);
+	bool compressed = memcmp(header.magic, compressedMeshCacheMagic, sizeof(compressedMeshCacheMagic)) == 0;
+	bool valid = (compressed || memcmp(header.magic, expected.magic, sizeof(meshCacheMagic)) == 0)
+		&& header.version == expected.version
+		&& header.sourceSize == expected.sourceSize
+		&& header.sourceWriteTime == expected.sourceWriteTime
+		&& (header.optimizations & ~meshCacheBakedLighting) == expected.optimizations
+		&& header.lodLevelCount == expected.lodLevelCount
+		&& header.lodMaxError == expected.lodMaxError
+		&& header.lodCount >= 1 && header.lodCount <= header.lodLevelCount
+		&& header.submeshCount != 1;
+	// Compressed caches, found in delivery bundles, are decoded to the heap and then read like
+	// the mapped ones
+	if (valid && compressed) {
+		valid = decompressMeshCache(header, { data, size }, geometry.decodedCache, size);
+		data = geometry.decodedCache.get();
+		geometry.mapping.close();
+	}
+	valid = valid && size == meshCacheMeshletOffset(header) + meshletBytes + clusterNodeBytes + header.materialBytes;
+	const char* materialStart = valid ? reinterpret_cast<const char*>(data) + meshCacheMeshletOffset(header) + meshletBytes + clusterNodeBytes : nullptr;
+	if (!valid || !readMaterials({ materialStart, header.materialBytes }, geometry.materials) || geometry.materials.size() != header.submeshCount) {
+		geometry.mapping.close();
+		geometry.decodedCache.reset();
+		geometry.materials.clear();
+		return false;
+	}
+
+	// The mapping is page aligned, the decoded cache aligned like any heap block (16 bytes), and
+	// the header size keeps the arrays aligned
+	const std::byte* vertexStart = data + sizeof(MeshCacheHeader);
+	const std::byte* indexStart = vertexStart + vertexBytes;
+	const std::byte* lodStart = indexStart + indexBytes;
+	const std::byte* submeshLodStart = lodStart + header.lodCount * sizeof(ResourceManager::GeometryLod);
+	geometry.vertices = { reinterpret_cast<const ResourceManager::VertexAttributes*>(vertexStart), header.vertexCount };
+	geometry.indices = { reinterpret_cast<const uint32_t*>(indexStart), header.indexCount };
+	geometry.lods = { reinterpret_cast<const ResourceManager::GeometryLod*>(lodStart), header.lodCount };
+	geometry.submeshLods = { reinterpret_cast<const ResourceManager::GeometryLod*>(submeshLodStart), submeshLodBytes / sizeof(ResourceManager::GeometryLod) };
+	const std::byte* meshletStart = data + meshCacheMeshletOffset(header);
+	geometry.meshlets = { reinterpret_cast<const MeshOptimizer::Meshlet*>(meshletStart), header.meshletCount };
+	// Meshlets keep the alignment of their vec4 members for the nodes
+	geometry.clusterNodes = { reinterpret_cast<const MeshOptimizer::ClusterLodNode*>(meshletStart + meshletBytes), header.clusterNodeCount };
+	geometry.fromCache = true;
+	geometry.bakedLighting = (header.optimizations & meshCacheBakedLighting) != 0;
+	return true;
+}
+
+// Return false if the cache could not be written, which only costs parsing the source again
+static bool writeMeshCache(const std::filesystem::path& path, MeshCacheHeader header, const ResourceManager::Geometry& geometry) {
+	if (!sourceStamp(path, header)) return false;
+	header.vertexCount = geometry.vertices.size();
+	header.indexCount = geometry.indices.size();
+	header.lodCount = static_cast<uint32_t>(geometry.lods.size());
+	header.meshletCount = static_cast<uint32_t>(geometry.meshlets.size());
+	header.clusterNodeCount = static_cast<uint32_t>(geometry.clusterNodes.size());
+	header.submeshCount = static_cast<uint32_t>(geometry.materials.size());
+	std::string materials = writeMaterials(geometry.materials);
+	header.materialBytes = static_cast<uint32_t>(materials.size());
+	if (geometry.bakedLighting) header.optimizations |= meshCacheBakedLighting;
+
+	// Through a temporary file, so that a concurrent reader never maps a partial cache
+	return writeFileAtomically(meshCachePath(path), [&](std::ostream& file) {
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(geometry.vertices.data()), geometry.vertices.size_bytes());
+		file.write(reinterpret_cast<const char*>(geometry.indices.data()), geometry.indices.size_bytes());
+		file.write(reinterpret_cast<const char*>(geometry.lods.data()), geometry.lods.size_bytes());
+		file.write(reinterpret_cast<const char*>(geometry.submeshLods.data()), geometry.submeshLods.size_bytes());
+		const char padding[16] = {};
+		file.write(padding, meshCacheMeshletOffset(header) - static_cast<size_t>(file.tellp()));
+		file.write(reinterpret_cast<const char*>(geometry.meshlets.data()), geometry.meshlets.size_bytes());
+		file.write(reinterpret_cast<const char*>(geometry.clusterNodes.data()), geometry.clusterNodes.size_bytes());
+		file.write(materials.data(), materials.size());
+		return true;
+	});
+}
+
+// Append coarser levels of detail to the index data of freshly parsed geometry, each one
+// simplified from the previous one down to half of its triangles. The submeshes of the full
+// level in `submeshLodData`, if any, are simplified one by one, and their ranges in each level
+// appended to it.
+static void buildLodChain(const ResourceManager::GeometryLoadOptions& options, ResourceManager::Geometry& geometry) {
+	using VertexAttributes = ResourceManager::VertexAttributes;
+	static_assert(offsetof(VertexAttributes, position) == 0, "MeshOptimizer expects positions first");
+	std::vector<VertexAttributes>& vertexData = geometry.vertexData;
+	std::vector<uint32_t>& indexData = geometry.indexData;
+
+	geometry.lodData = { { 0, static_cast<uint32_t>(indexData.size()), 0.0f, 0, 0 } };
 
-			vertexData[offset + i].position = {
-				attrib.vertices[3 * idx.vertex_index + 0],
-				-attrib.vertices[3 * idx.vertex_index + 2],
-				attrib.vertices[3 * idx.vertex_index + 1]
-			};
+	// The whole level as a single submesh otherwise
+	std::vector<ResourceManager::GeometryLod> fullSubmeshes = geometry.submeshLodData;
+	if (fullSubmeshes.empty()) fullSubmeshes = geometry.lodData;
+	std::vector<std::vector<uint32_t>> lodIndices;
+	for (const ResourceManager::GeometryLod& submesh : fullSubmeshes) {
+		lodIndices.emplace_back(indexData.begin() + submesh.indexOffset, indexData.begin() + submesh.indexOffset + submesh.indexCount);
+	}
+	std::vector<float> errors(fullSubmeshes.size(), 0.0f);
+	while (geometry.lodData.size() < options.lodLevelCount) {
+		size_t previousIndexCount = 0;
+		size_t indexCount = 0;
+		for (size_t s = 0; s < lodIndices.size(); ++s) {
+			previousIndexCount += lodIndices[s].size();
+			size_t targetIndexCount = lodIndices[s].size() / 6 * 3;
+			float lodError = MeshOptimizer::simplify(lodIndices[s], vertexData.data(), vertexData.size(), sizeof(VertexAttributes), targetIndexCount, options.lodMaxError);
+			// Errors are measured against the previous level, so they add up
+			errors[s] += lodError;
+			indexCount += lodIndices[s].size();
+		}
 
-			vertexData[offset + i].normal = {
-				attrib.normals[3 * idx.normal_index + 0],
-				-attrib.normals[3 * idx.normal_index + 2],
-				attrib.normals[3 * idx.normal_index + 1]
-			};
+		// Not worth a level if the error bound prevents reducing much further
+		if (indexCount == 0 || indexCount > previousIndexCount * 9 / 10) break;
 
-			vertexData[offset + i].color = {
-				attrib.colors[3 * idx.vertex_index + 0],
-				attrib.colors[3 * idx.vertex_index + 1],
-				attrib.colors[3 * idx.vertex_index + 2]
-			}; 
-			
-			vertexData[offset + i].uv = {
-				attrib.texcoords[2 * idx.texcoord_index + 0],
-				1 - attrib.texcoords[2 * idx.texcoord_index + 1]
-			};
+		// That of the submesh simplified the most
+		float error = *std::max_element(errors.begin(), errors.end());
+		geometry.lodData.push_back({ static_cast<uint32_t>(indexData.size()), static_cast<uint32_t>(indexCount), error, 0, 0 });
+		for (size_t s = 0; s < lodIndices.size(); ++s) {
+			if (!geometry.submeshLodData.empty()) {
+				geometry.submeshLodData.push_back({ static_cast<uint32_t>(indexData.size()), static_cast<uint32_t>(lodIndices[s].size()), errors[s], 0, 0 });
+			}
+			indexData.insert(indexData.end(), lodIndices[s].begin(), lodIndices[s].end());
 		}
 	}
 
+	std::cout << "Built " << geometry.lodData.size() << " levels of detail:";
+	for (const ResourceManager::GeometryLod& lod : geometry.lodData) {
+		std::cout << " " << lod.indexCount / 3;
+	}
+	std::cout << " triangles" << std::endl;
+}
+
+// Apply the reordering passes selected in `options` to freshly parsed geometry, to each level of detail
+static void optimizeGeometry(const ResourceManager::GeometryLoadOptions& options, ResourceManager::Geometry& geometry) {
+	using VertexAttributes = ResourceManager::VertexAttributes;
+	std::vector<VertexAttributes>& vertexData = geometry.vertexData;
+	std::vector<uint32_t>& indexData = geometry.indexData;
+	const ResourceManager::GeometryLod& fullLod = geometry.lodData.front();
+
+	float acmrBefore = MeshOptimizer::computeAcmr(indexData.data() + fullLod.indexOffset, fullLod.indexCount, vertexData.size());
+
+	// Triangles are only reordered within their submesh, if any
+	if (options.optimizeVertexCache) {
+		std::vector<uint32_t> lodIndices;
+		std::vector<size_t> clusters;
+		for (const ResourceManager::GeometryLod& lod : geometry.submeshLodData.empty() ? geometry.lodData : geometry.submeshLodData) {
+			auto lodBegin = indexData.begin() + lod.indexOffset;
+			lodIndices.assign(lodBegin, lodBegin + lod.indexCount);
+			MeshOptimizer::optimizeVertexCache(lodIndices, vertexData.size(), MeshOptimizer::defaultCacheSize, &clusters);
+			if (options.optimizeOverdraw) {
+				MeshOptimizer::optimizeOverdraw(lodIndices, clusters, vertexData.data(), vertexData.size(), sizeof(VertexAttributes));
+			}
+			std::copy(lodIndices.begin(), lodIndices.end(), lodBegin);
+		}
+	}
+
+	// The full level comes first, so vertices end up in the order it uses them
+	if (options.optimizeVertexFetch) {
+		size_t vertexCount = MeshOptimizer::optimizeVertexFetch(vertexData.data(), vertexData.size(), sizeof(VertexAttributes), indexData);
+		vertexData.resize(vertexCount);
+	}
+
+	float acmrAfter = MeshOptimizer::computeAcmr(indexData.data() + fullLod.indexOffset, fullLod.indexCount, vertexData.size());
+	std::cout << "Vertex cache ACMR: " << acmrBefore << " -> " << acmrAfter << std::endl;
+}
+
+// Split each level of detail of the final geometry into meshlets
+static void buildMeshlets(ResourceManager::Geometry& geometry) {
+	using VertexAttributes = ResourceManager::VertexAttributes;
+	for (ResourceManager::GeometryLod& lod : geometry.lodData) {
+		lod.meshletOffset = static_cast<uint32_t>(geometry.meshletData.size());
+		MeshOptimizer::buildMeshlets(
+			geometry.indexData.data() + lod.indexOffset, lod.indexCount, lod.indexOffset,
+			geometry.vertexData.data(), geometry.vertexData.size(), sizeof(VertexAttributes),
+			geometry.meshletData
+		);
+		lod.meshletCount = static_cast<uint32_t>(geometry.meshletData.size()) - lod.meshletOffset;
+	}
+	std::cout << "Built " << geometry.meshletData.size() << " meshlets, "
+		<< geometry.lodData.front().meshletCount << " for the full level of detail" << std::endl;
+}
+
+// Append the cluster level of detail hierarchy of the full level of the final geometry, the
+// clusters of the full level reading its reordered triangles
+static void buildClusterLod(ResourceManager::Geometry& geometry) {
+	using VertexAttributes = ResourceManager::VertexAttributes;
+	const ResourceManager::GeometryLod& fullLod = geometry.lodData.front();
+	MeshOptimizer::buildClusterLod(
+		geometry.indexData, fullLod.indexOffset, fullLod.indexCount,
+		geometry.vertexData.data(), geometry.vertexData.size(), sizeof(VertexAttributes),
+		geometry.clusterNodeData
+	);
+	size_t rootCount = std::count_if(geometry.clusterNodeData.begin(), geometry.clusterNodeData.end(), [](const MeshOptimizer::ClusterLodNode& node) {
+		return node.parentError < 0.0f;
+	});
+	std::cout << "Built a cluster level of detail hierarchy of " << geometry.clusterNodeData.size() << " clusters, "
+		<< rootCount << " of them roots" << std::endl;
+}
+
+// Auxiliary function for the Geometry overloads of loadGeometryFromObj/Txt: map the mesh
+// cache of `path` if it is up to date, otherwise parse the source by calling `parse(path,
+// geometry)`, which fills in the vertex and index data and, if any, the full level of the
+// submeshes and their materials, process it and write the cache
+template <typename Parse>
+static bool loadCachedGeometry(const std::filesystem::path& path, ResourceManager::Geometry& geometry, const ResourceManager::GeometryLoadOptions& options, Parse&& parse) {
+	geometry = ResourceManager::Geometry{};
+	MeshCacheHeader cacheHeader = meshCacheHeader(options);
+
+	if (mapMeshCache(path, cacheHeader, geometry)) {
+		std::cout << "Loaded " << path.filename() << " from mesh cache: " << geometry.vertices.size() << " vertices, "
+			<< geometry.indices.size() << " indices, " << geometry.lods.size() << " levels of detail, "
+			<< geometry.meshlets.size() << " meshlets" << std::endl;
+		return true;
+	}
+
+	if (!parse(path, geometry)) {
+		return false;
+	}
+	buildLodChain(options, geometry);
+	if (options.optimizeVertexCache || options.optimizeVertexFetch) {
+		optimizeGeometry(options, geometry);
+	}
+	if (options.buildMeshlets) {
+		buildMeshlets(geometry);
+	}
+	if (options.clusterLod && geometry.submeshLodData.empty()) {
+		buildClusterLod(geometry);
+	}
+	geometry.vertices = geometry.vertexData;
+	geometry.indices = geometry.indexData;
+	geometry.lods = geometry.lodData;
+	geometry.meshlets = geometry.meshletData;
+	geometry.submeshLods = geometry.submeshLodData;
+	geometry.clusterNodes = geometry.clusterNodeData;
+
+	// Then backed by the cache rather than by the heap, like the next time it is loaded, so that
+	// geometry kept after its upload (see RetainedAssets) lives in pages the system can drop and
+	// read again from the file, instead of a copy that would only ever be swapped out
+	if (writeMeshCache(path, cacheHeader, geometry)) {
+		ResourceManager::Geometry mapped;
+		if (mapMeshCache(path, cacheHeader, mapped)) geometry = std::move(mapped);
+	}
+	return true;
+}
+
+bool ResourceManager::loadGeometryFromObj(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options) {
+	STARTUP_STAGE("OBJ parse");
+	MEMORY_SCOPE(MeshData);
+	return loadCachedGeometry(path, geometry, options, [](const std::filesystem::path& source, Geometry& parsed) {
+		return loadGeometryFromObj(source, parsed.vertexData, parsed.indexData, parsed.submeshLodData, parsed.materials);
+	});
+}
+
+bool ResourceManager::loadGeometryFromObj(const std::filesystem::path& path, Geometry& geometry) {
+	return loadGeometryFromObj(path, geometry, GeometryLoadOptions{});
+}
+
+bool ResourceManager::loadGeometryFromTxt(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData) {
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	if (!parseTxtGeometry(file.data(), file.size(), vertexData, indexData)) {
+		std::cerr << "Could not parse " << path << std::endl;
+		return false;
+	}
+
+	std::cout << "Loaded " << path.filename() << ": " << vertexData.size() << " vertices for "
+		<< indexData.size() << " indices" << std::endl;
 	return true;
 }
 
+bool ResourceManager::loadGeometryFromTxt(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options) {
+	STARTUP_STAGE("TXT parse");
+	MEMORY_SCOPE(MeshData);
+	return loadCachedGeometry(path, geometry, options, [](const std::filesystem::path& source, Geometry& parsed) {
+		return loadGeometryFromTxt(source, parsed.vertexData, parsed.indexData);
+	});
+}
+
+// Auxiliary function for loadGeometryFromGlb, read the first mesh of the mapped file `file`
+static bool parseGlbGeometry(const std::filesystem::path& path, const MappedFile& file, ResourceManager::Geometry& geometry) {
+	GlbDocument document;
+	if (!parseGlb(file.data(), file.size(), document) || !readGlbGeometry(document, 0, geometry)) {
+		std::cerr << "Could not parse " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool ResourceManager::loadGeometryFromGlb(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options) {
+	STARTUP_STAGE("GLB parse");
+	MEMORY_SCOPE(MeshData);
+	bool processed = options.lodLevelCount > 1 || options.optimizeVertexCache || options.optimizeVertexFetch || options.buildMeshlets || options.clusterLod;
+	if (processed) {
+		return loadCachedGeometry(path, geometry, options, [](const std::filesystem::path& source, Geometry& geometry) {
+			MappedFile file;
+			Geometry parsed;
+			if (!file.open(source)) {
+				std::cerr << "Could not open " << source << std::endl;
+				return false;
+			}
+			if (!parseGlbGeometry(source, file, parsed)) return false;
+			// Processing reorders them, so views of the file are copied
+			geometry.vertexData.assign(parsed.vertices.begin(), parsed.vertices.end());
+			geometry.indexData.assign(parsed.indices.begin(), parsed.indices.end());
+			return true;
+		});
+	}
+
+	// Drawn as exported: a single level and no meshlets, nor any cache
+	geometry = Geometry{};
+	if (!geometry.mapping.open(path)) {
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	if (!parseGlbGeometry(path, geometry.mapping, geometry)) {
+		geometry.mapping.close();
+		return false;
+	}
+	bool inPlace = geometry.vertexData.empty();
+	if (!inPlace) geometry.mapping.close();
+	geometry.lodData = { { 0, static_cast<uint32_t>(geometry.indices.size()), 0.0f, 0, 0 } };
+	geometry.lods = geometry.lodData;
+
+	std::cout << "Loaded " << path.filename() << (inPlace ? " in place: " : ": ") << geometry.vertices.size() << " vertices for "
+		<< geometry.indices.size() << " indices" << std::endl;
+	return true;
+}
+
+bool ResourceManager::storeBakedLighting(
+	const std::filesystem::path& path, const GeometryLoadOptions& options, const Geometry& geometry,
+	std::span<const glm::vec3> lighting, Geometry& baked
+) {
+	baked = Geometry{};
+	if (lighting.size() != geometry.vertices.size()) return false;
+	baked.vertexData.assign(geometry.vertices.begin(), geometry.vertices.end());
+	for (size_t i = 0; i < lighting.size(); ++i) baked.vertexData[i].color = glm::vec<3, float, glm::packed_highp>(lighting[i]);
+	baked.indexData.assign(geometry.indices.begin(), geometry.indices.end());
+	baked.lodData.assign(geometry.lods.begin(), geometry.lods.end());
+	baked.meshletData.assign(geometry.meshlets.begin(), geometry.meshlets.end());
+	baked.submeshLodData.assign(geometry.submeshLods.begin(), geometry.submeshLods.end());
+	baked.clusterNodeData.assign(geometry.clusterNodes.begin(), geometry.clusterNodes.end());
+	baked.materials = geometry.materials;
+	baked.vertices = baked.vertexData;
+	baked.indices = baked.indexData;
+	baked.lods = baked.lodData;
+	baked.meshlets = baked.meshletData;
+	baked.submeshLods = baked.submeshLodData;
+	baked.clusterNodes = baked.clusterNodeData;
+	baked.bakedLighting = true;
+	baked.contentHash = hashGeometry(baked);
+
+	// Geometry drawn as exported from a .glb file has no cache to store it in
+	if (!geometry.fromCache) return false;
+	MeshCacheHeader cacheHeader = meshCacheHeader(options);
+	if (!writeMeshCache(path, cacheHeader, baked)) return false;
+	// Then backed by the cache, like freshly parsed geometry
+	Geometry mapped;
+	if (mapMeshCache(path, cacheHeader, mapped)) {
+		mapped.contentHash = baked.contentHash;
+		baked = std::move(mapped);
+	}
+	return true;
+}
+
+bool ResourceManager::loadGeometry(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options) {
+	bool loaded = false;
+	if (path.extension() == ".txt") {
+		loaded = loadGeometryFromTxt(path, geometry, options);
+	}
+	else if (path.extension() == ".glb") {
+		loaded = loadGeometryFromGlb(path, geometry, options);
+	}
+	else {
+		loaded = loadGeometryFromObj(path, geometry, options);
+	}
+	// On the loading thread, rather than when the geometry is added to the cache
+	if (loaded) geometry.contentHash = hashGeometry(geometry);
+	return loaded;
+}
+
+// Auxiliary function for hashGeometry: FNV-1a over 8 byte words rather than bytes, the data
+// being hashed on every load, followed by its size to tell consecutive arrays apart
+static uint64_t hashBytes(uint64_t hash, std::span<const std::byte> bytes) {
+	constexpr uint64_t prime = 0x100000001b3ull;
+	size_t wordCount = bytes.size() / 8;
+	for (size_t i = 0; i < wordCount; ++i) {
+		uint64_t word;
+		memcpy(&word, bytes.data() + 8 * i, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for (size_t i = 8 * wordCount; i < bytes.size(); ++i) {
+		hash = (hash ^ static_cast<uint64_t>(bytes[i])) * prime;
+	}
+	return (hash ^ bytes.size()) * prime;
+}
+
+uint64_t ResourceManager::hashGeometry(const Geometry& geometry) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	hash = hashBytes(hash, std::as_bytes(geometry.vertices));
+	hash = hashBytes(hash, std::as_bytes(geometry.indices));
+	hash = hashBytes(hash, std::as_bytes(geometry.lods));
+	hash = hashBytes(hash, std::as_bytes(geometry.meshlets));
+	hash = hashBytes(hash, std::as_bytes(geometry.submeshLods));
+	hash = hashBytes(hash, std::as_bytes(geometry.clusterNodes));
+	// Mixed so that all the bits depend on the last words too (finalizer of MurmurHash3)
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+	// 0 meaning not computed
+	return hash != 0 ? hash : 1;
+}
+
 // Auxiliary function for loadTexture
-static void writeMipMaps(Device device, Texture m_texture, Extent3D textureSize, uint32_t mipLevelCount, const unsigned char* pixelData) {
-	Queue queue = device.getQueue();
+// Offset of each mip level after the first one in a single arena holding them all, which
+// is about a third of the size of level 0. Return the size of the arena.
+static size_t mipChainLayout(Extent3D textureSize, uint32_t mipLevelCount, std::vector<size_t>& levelOffsets) {
+	levelOffsets.assign(mipLevelCount, 0);
+	size_t arenaSize = 0;
+	Extent3D mipLevelSize = textureSize;
+	for (uint32_t level = 1; level < mipLevelCount; ++level) {
+		mipLevelSize.width = nextMipLevelSize(mipLevelSize.width);
+		mipLevelSize.height = nextMipLevelSize(mipLevelSize.height);
+		levelOffsets[level] = arenaSize;
+		arenaSize += size_t(4) * mipLevelSize.width * mipLevelSize.height;
+	}
+	return arenaSize;
+}
+
+// Downsample each level from the previous one, in place in the arena
+static void buildMipChain(const unsigned char* pixelData, Extent3D textureSize, const std::vector<size_t>& levelOffsets, unsigned char* arena, const ResourceManager::TextureLoadOptions& options) {
+	const unsigned char* previousLevelPixels = pixelData;
+	Extent3D previousMipLevelSize = textureSize;
+	for (uint32_t level = 1; level < levelOffsets.size(); ++level) {
+		unsigned char* pixels = arena + levelOffsets[level];
+		downsampleRgba8(previousLevelPixels, previousMipLevelSize.width, previousMipLevelSize.height, pixels, options.srgb, options.alphaWeightedMipMaps);
+		previousLevelPixels = pixels;
+		previousMipLevelSize.width = nextMipLevelSize(previousMipLevelSize.width);
+		previousMipLevelSize.height = nextMipLevelSize(previousMipLevelSize.height);
+	}
+}
 
+// Upload levels [firstLevel, mipLevelCount) of an array layer, level 0 from the source pixels as is,
+// without copying it, and the other levels from `mipMaps` (laid out by mipChainLayout), or built
+// on the fly when it is null
+static void writeMipMaps(UploadManager& uploader, Texture m_texture, Extent3D textureSize, uint32_t layer, uint32_t firstLevel, uint32_t mipLevelCount, const unsigned char* pixelData, const unsigned char* mipMaps, const ResourceManager::TextureLoadOptions& options) {
+	MEMORY_SCOPE(Mipmaps);
 	// Arguments telling which part of the texture we upload to
 	ImageCopyTexture destination{};
 	destination.texture = m_texture;
-	destination.origin = { 0, 0, 0 };
+	destination.origin = { 0, 0, layer };
 	destination.aspect = TextureAspect::All;
 
-	// Arguments telling how the C++ side pixel memory is laid out
-	TextureDataLayout source{};
-	source.offset = 0;
+	std::vector<size_t> levelOffsets;
+	size_t arenaSize = mipChainLayout(textureSize, mipLevelCount, levelOffsets);
+	std::unique_ptr<unsigned char[]> arena;
+	if (!mipMaps) {
+		arena.reset(new unsigned char[arenaSize]);
+		buildMipChain(pixelData, textureSize, levelOffsets, arena.get(), options);
+		mipMaps = arena.get();
+	}
 
-	// Create image data
-	Extent3D mipLevelSize = textureSize;
-	std::vector<unsigned char> previousLevelPixels;
-	Extent3D previousMipLevelSize{};
+	Extent3D mipLevelSize = { textureSize.width, textureSize.height, 1 };
 	for (uint32_t level = 0; level < mipLevelCount; ++level) {
-		// Pixel data for the current level
-		std::vector<unsigned char> pixels(4 * mipLevelSize.width * mipLevelSize.height);
-		if (level == 0) {
-			// We cannot really avoid this copy since we need this
-			// in previousLevelPixels at the next iteration
-			memcpy(pixels.data(), pixelData, pixels.size());
-		}
-		else {
-			// Create mip level data
-			for (uint32_t i = 0; i < mipLevelSize.width; ++i) {
-				for (uint32_t j = 0; j < mipLevelSize.height; ++j) {
-					unsigned char* p = &pixels[4 * (j * mipLevelSize.width + i)];
-					// Get the corresponding 4 pixels from the previous level
-					unsigned char* p00 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 0))];
-					unsigned char* p01 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 1))];
-					unsigned char* p10 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 0))];
-					unsigned char* p11 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 1))];
-					// Average
-					p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
-					p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
-					p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
-					p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
-				}
-			}
-		}
-
 		// Upload data to the GPU texture
+		const unsigned char* pixels = level == 0 ? pixelData : mipMaps + levelOffsets[level];
 		destination.mipLevel = level;
-		source.bytesPerRow = 4 * mipLevelSize.width;
-		source.rowsPerImage = mipLevelSize.height;
-		queue.writeTexture(destination, pixels.data(), pixels.size(), source, mipLevelSize);
+		if (level >= firstLevel) {
+			uploader.writeTexture(destination, pixels, 4 * mipLevelSize.width, mipLevelSize.height, mipLevelSize);
+		}
 
-		previousLevelPixels = std::move(pixels);
-		previousMipLevelSize = mipLevelSize;
-		mipLevelSize.width /= 2;
-		mipLevelSize.height /= 2;
+		mipLevelSize.width = nextMipLevelSize(mipLevelSize.width);
+		mipLevelSize.height = nextMipLevelSize(mipLevelSize.height);
 	}
+}
+
+// Expects the `srgb` and `alphaWeighted` boolean constants to be prepended
+static const char* mipMapShaderSource = R"(
+@group(0) @binding(0) var previousMipLevel: texture_2d<f32>;
+@group(0) @binding(1) var nextMipLevel: texture_storage_2d<rgba8unorm, write>;
+
+fn srgbToLinear(c: vec3f) -> vec3f {
+	return select(pow((c + 0.055) / 1.055, vec3f(2.4)), c / 12.92, c <= vec3f(0.04045));
+}
 
-	queue.release();
+fn linearToSrgb(c: vec3f) -> vec3f {
+	return select(1.055 * pow(c, vec3f(1.0 / 2.4)) - 0.055, 12.92 * c, c <= vec3f(0.0031308));
 }
 
+// Texel with its color in linear space and weighted, alpha being the weight
+fn loadWeighted(p: vec2u) -> vec4f {
+	let texel = textureLoad(previousMipLevel, p, 0);
+	var color = texel.rgb;
+	if (srgb) {
+		color = srgbToLinear(color);
+	}
+	if (alphaWeighted) {
+		color *= texel.a;
+	}
+	return vec4f(color, texel.a);
+}
+
+// Same 2x2 box filter as the CPU path, 1 texel wide or high levels filtering the same texel twice
+@compute @workgroup_size(8, 8)
+fn computeMipMap(@builtin(global_invocation_id) id: vec3u) {
+	let size = textureDimensions(nextMipLevel);
+	if (id.x >= size.x || id.y >= size.y) {
+		return;
+	}
+	let previousSize = textureDimensions(previousMipLevel);
+	let p00 = 2u * id.xy;
+	let p11 = min(p00 + 1u, previousSize - 1u);
+	let sum = loadWeighted(p00) + loadWeighted(vec2u(p11.x, p00.y)) + loadWeighted(vec2u(p00.x, p11.y)) + loadWeighted(p11);
+
+	var color = sum.rgb * 0.25;
+	if (alphaWeighted && sum.a > 0.0) {
+		color = sum.rgb / sum.a;
+	}
+	if (srgb) {
+		color = linearToSrgb(clamp(color, vec3f(0.0), vec3f(1.0)));
+	}
+	textureStore(nextMipLevel, id.xy, vec4f(color, sum.a * 0.25));
+}
+)";
+
+// Fill levels 1 to mipLevelCount - 1 of an RGBA8Unorm texture from its level 0, on the GPU
+static void generateMipMaps(Device device, Texture texture, Extent3D textureSize, uint32_t mipLevelCount, const ResourceManager::TextureLoadOptions& options) {
+	STARTUP_STAGE("Mip generation");
+	if (mipLevelCount <= 1) return;
+
+	// Storage textures cannot be sRGB, so the shader encodes and decodes itself
+	std::string shaderSource;
+	shaderSource += options.srgb ? "const srgb = true;\n" : "const srgb = false;\n";
+	shaderSource += options.alphaWeightedMipMaps ? "const alphaWeighted = true;\n" : "const alphaWeighted = false;\n";
+	shaderSource += mipMapShaderSource;
+	GpuHandle<ShaderModule> shaderModule = ResourceManager::createShaderModule(shaderSource, device);
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(2, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[0].texture.sampleType = TextureSampleType::Float;
+	bindingLayoutEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[1].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[1].storageTexture.format = TextureFormat::RGBA8Unorm;
+	bindingLayoutEntries[1].storageTexture.viewDimension = TextureViewDimension::_2D;
+
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	GpuHandle<BindGroupLayout> bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout.get();
+	GpuHandle<PipelineLayout> layout = device.createPipelineLayout(layoutDesc);
+
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = layout;
+	pipelineDesc.compute.module = shaderModule;
+	pipelineDesc.compute.entryPoint = "computeMipMap";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	GpuHandle<ComputePipeline> pipeline = device.createComputePipeline(pipelineDesc);
+
+	// One view per level, each one being written by a dispatch then read by the next one
+	std::vector<GpuHandle<TextureView>> levelViews(mipLevelCount);
+	TextureViewDescriptor viewDesc{};
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = TextureViewDimension::_2D;
+	viewDesc.format = TextureFormat::RGBA8Unorm;
+	for (uint32_t level = 0; level < mipLevelCount; ++level) {
+		viewDesc.baseMipLevel = level;
+		levelViews[level].reset(texture.createView(viewDesc));
+	}
+
+	CommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "Mip-map generation";
+	GpuHandle<CommandEncoder> encoder = device.createCommandEncoder(encoderDesc);
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.timestampWrites = nullptr;
+	GpuHandle<ComputePassEncoder> computePass = encoder->beginComputePass(computePassDesc);
+	computePass->setPipeline(pipeline);
+
+	std::vector<GpuHandle<BindGroup>> bindGroups;
+	Extent3D mipLevelSize = textureSize;
+	for (uint32_t level = 1; level < mipLevelCount; ++level) {
+		mipLevelSize.width = nextMipLevelSize(mipLevelSize.width);
+		mipLevelSize.height = nextMipLevelSize(mipLevelSize.height);
+
+		std::vector<BindGroupEntry> bindings(2);
+		bindings[0].binding = 0;
+		bindings[0].textureView = levelViews[level - 1];
+		bindings[1].binding = 1;
+		bindings[1].textureView = levelViews[level];
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = bindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		bindGroups.emplace_back(device.createBindGroup(bindGroupDesc));
+
+		computePass->setBindGroup(0, bindGroups.back(), 0, nullptr);
+		computePass->dispatchWorkgroups((mipLevelSize.width + 7) / 8, (mipLevelSize.height + 7) / 8, 1);
+	}
+
+	computePass->end();
+	CommandBufferDescriptor cmdBufferDesc{};
+	cmdBufferDesc.label = "Mip-map generation";
+	GpuHandle<CommandBuffer> command = encoder->finish(cmdBufferDesc);
+	GpuHandle<Queue> queue = device.getQueue();
+	// Objects are released on return, as soon as the work is submitted
+	queue->submit(command.get());
+}
 
 Texture ResourceManager::loadTexture(const std::filesystem::path& path, Device device, TextureView* pTextureView) {
-	int width, height, channels;
-	unsigned char* pixelData = stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */);
+	Image image;
+	if (!loadImage(path, image)) return nullptr;
+	return createTexture(image, device, pTextureView);
+}
+
+bool ResourceManager::loadImage(const std::filesystem::path& path, Image& image) {
+	return loadImage(path, image, TextureLoadOptions{});
+}
+
+// Halve a decoded image until it fits in `options.maxSize`, filtering it like its mip-maps
+static void fitImageToMaxSize(ResourceManager::Image& image, const ResourceManager::TextureLoadOptions& options) {
+	if (options.maxSize == 0) return;
+	while (std::max(image.width, image.height) > options.maxSize) {
+		uint32_t width = nextMipLevelSize(image.width);
+		uint32_t height = nextMipLevelSize(image.height);
+		auto* pixels = static_cast<unsigned char*>(DecodeHeap::allocate(4 * static_cast<size_t>(width) * height));
+		downsampleRgba8(image.pixels.get(), image.width, image.height, pixels, options.srgb, options.alphaWeightedMipMaps);
+		image.pixels = { pixels, DecodeHeap::release };
+		image.width = width;
+		image.height = height;
+	}
+}
+
+bool ResourceManager::loadImage(const std::filesystem::path& path, Image& image, const TextureLoadOptions& options) {
+	STARTUP_STAGE("Texture decode");
+	MEMORY_SCOPE(ImageDecoding);
+	// Decoded from memory rather than from the path, so that it is fetched on the web, the
+	// encoded file being released as soon as it is decoded
+	MappedFile file;
+	ImageDecoder::Pixels pixels = file.open(path)
+		? ImageDecoder::decode({ file.data(), file.size() }, path, image.width, image.height, options.maxSize)
+		: ImageDecoder::Pixels{ nullptr, nullptr };
 	
 	// If data is null, loading failed.
-	if (!pixelData) {
+	if (!pixels) {
 		std::cerr << "Failed to load texture: " << path << std::endl;
-		return nullptr;
+		return false;
+	}
+	image.pixels = std::move(pixels);
+	fitImageToMaxSize(image, options);
+	return true;
+}
+
+void ResourceManager::buildMipMaps(Image& image, const TextureLoadOptions& options) {
+	STARTUP_STAGE("Mip generation");
+	MEMORY_SCOPE(Mipmaps);
+	Extent3D size = { image.width, image.height, 1 };
+	uint32_t mipLevelCount = std::bit_width(std::max(image.width, image.height));
+	std::vector<size_t> levelOffsets;
+	size_t arenaSize = mipChainLayout(size, mipLevelCount, levelOffsets);
+	image.mipMaps.reset(new unsigned char[arenaSize]);
+	buildMipChain(image.pixels.get(), size, levelOffsets, image.mipMaps.get(), options);
+	image.mipLevelCount = mipLevelCount;
+}
+
+const unsigned char* ResourceManager::mipLevelPixels(const Image& image, uint32_t level) {
+	if (level == 0) return image.pixels.get();
+	std::vector<size_t> levelOffsets;
+	mipChainLayout({ image.width, image.height, 1 }, image.mipLevelCount, levelOffsets);
+	return image.mipMaps.get() + levelOffsets[level];
+}
+
+Texture ResourceManager::createTexture(const Image& image, Device device, TextureView* pTextureView) {
+	return createTexture(image, device, TextureLoadOptions{}, pTextureView);
+}
+
+Texture ResourceManager::createTexture(const Image& image, Device device, const TextureLoadOptions& options, TextureView* pTextureView) {
+	UploadManager uploader(device);
+	return createTexture(image, uploader, options, pTextureView);
+}
+
+Texture ResourceManager::createTexture(const Image& image, UploadManager& uploader, const TextureLoadOptions& options, TextureView* pTextureView) {
+	const Image* layers[] = { &image };
+	uint32_t residentLevel;
+	return createTexture(layers, uploader, options, options.viewDimension, pTextureView, std::numeric_limits<uint32_t>::max(), residentLevel);
+}
+
+Texture ResourceManager::createStreamedTexture(const Image& image, UploadManager& uploader, const TextureLoadOptions& options, uint32_t residentSize, uint32_t& residentLevel) {
+	const Image* layers[] = { &image };
+	return createTexture(layers, uploader, options, options.viewDimension, nullptr, residentSize, residentLevel);
+}
+
+// Level of `image` that is level `level` of `texture`, levels of the image that exceeded the size
+// limit not being in the texture
+static uint32_t imageLevel(const ResourceManager::Image& image, Texture texture, uint32_t level) {
+	uint32_t fullMipLevelCount = std::bit_width(std::max(image.width, image.height));
+	return fullMipLevelCount - texture.getMipLevelCount() + level;
+}
+
+uint64_t ResourceManager::writeTextureLevel(const Image& image, Texture texture, UploadManager& uploader, uint32_t level, uint32_t firstRow, uint32_t rowCount) {
+	uint32_t fullMipLevelCount = std::bit_width(std::max(image.width, image.height));
+	uint32_t sourceLevel = imageLevel(image, texture, level);
+	std::vector<size_t> levelOffsets;
+	mipChainLayout({ image.width, image.height, 1 }, fullMipLevelCount, levelOffsets);
+	const unsigned char* pixels = sourceLevel == 0 ? image.pixels.get() : image.mipMaps.get() + levelOffsets[sourceLevel];
+
+	Extent3D levelSize = { std::max(image.width >> sourceLevel, 1u), std::max(image.height >> sourceLevel, 1u), 1 };
+	uint32_t bytesPerRow = 4 * levelSize.width;
+	if (firstRow >= levelSize.height) return 0;
+	rowCount = std::min(rowCount, levelSize.height - firstRow);
+
+	ImageCopyTexture destination{};
+	destination.texture = texture;
+	destination.mipLevel = level;
+	destination.origin = { 0, firstRow, 0 };
+	destination.aspect = TextureAspect::All;
+	uploader.writeTexture(destination, pixels + size_t(firstRow) * bytesPerRow, bytesPerRow, rowCount, { levelSize.width, rowCount, 1 });
+	return uint64_t(bytesPerRow) * rowCount;
+}
+
+uint32_t ResourceManager::textureLevelRowCount(const Image& image, Texture texture, uint32_t level, uint64_t& bytesPerRow) {
+	uint32_t sourceLevel = imageLevel(image, texture, level);
+	bytesPerRow = uint64_t(4) * std::max(image.width >> sourceLevel, 1u);
+	return std::max(image.height >> sourceLevel, 1u);
+}
+
+Texture ResourceManager::createTextureArray(std::span<const Image* const> images, UploadManager& uploader, const TextureLoadOptions& options, TextureView* pTextureView) {
+	if (images.empty()) return nullptr;
+	for (const Image* image : images) {
+		if (image->width != images[0]->width || image->height != images[0]->height) {
+			std::cerr << "Texture array layers must all have the same size, got " << image->width << "x" << image->height
+				<< " instead of " << images[0]->width << "x" << images[0]->height << std::endl;
+			return nullptr;
+		}
+	}
+	uint32_t residentLevel;
+	return createTexture(images, uploader, options, TextureViewDimension::_2DArray, pTextureView, std::numeric_limits<uint32_t>::max(), residentLevel);
+}
+
+Texture ResourceManager::createTexture(std::span<const Image* const> layers, UploadManager& uploader, const TextureLoadOptions& options, TextureViewDimension viewDimension, TextureView* pTextureView, uint32_t residentSize, uint32_t& residentLevel) {
+	Device device = uploader.device();
+	uint32_t width = layers[0]->width;
+	uint32_t height = layers[0]->height;
+	uint32_t layerCount = static_cast<uint32_t>(layers.size());
+	uint32_t fullMipLevelCount = std::bit_width(std::max(width, height));
+
+	// Skip the largest levels of images that exceed the size limit
+	SupportedLimits deviceLimits{};
+	device.getLimits(&deviceLimits);
+	uint32_t maxSize = deviceLimits.limits.maxTextureDimension2D;
+	if (options.maxSize > 0) maxSize = std::min(maxSize, options.maxSize);
+	uint32_t skippedLevelCount = 0;
+	while (skippedLevelCount + 1 < fullMipLevelCount && std::max(width, height) > maxSize) {
+		width = nextMipLevelSize(width);
+		height = nextMipLevelSize(height);
+		++skippedLevelCount;
 	}
 
-	// Use the width, height, channels and data variables here
+	// The mip-map compute shader only handles 2D textures from their full size level,
+	// arrays and downsized textures are filtered on the CPU
+	bool gpuMipMaps = options.mipmapGeneration == TextureLoadOptions::MipmapGeneration::Gpu && layerCount == 1 && skippedLevelCount == 0;
+
+	// Format in which the texture is sampled
+	TextureFormat viewFormat = options.srgb ? TextureFormat::RGBA8UnormSrgb : TextureFormat::RGBA8Unorm;
+
 	TextureDescriptor textureDesc{};
 	textureDesc.dimension = TextureDimension::_2D;
-	textureDesc.format = TextureFormat::RGBA8Unorm; // by convention for bmp, png and jpg file. Be careful with other formats.
-	textureDesc.size = { (unsigned int)width, (unsigned int)height, 1 };
-	textureDesc.mipLevelCount = std::bit_width(std::max(textureDesc.size.width, textureDesc.size.height));
+	textureDesc.format = viewFormat; // by convention for bmp, png and jpg file. Be careful with other formats.
+	textureDesc.size = { width, height, layerCount };
+	textureDesc.mipLevelCount = fullMipLevelCount - skippedLevelCount;
 	textureDesc.sampleCount = 1;
 	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	// Streamed textures are copied to textures of more or fewer levels by resizeStreamedTexture()
+	if (residentSize != std::numeric_limits<uint32_t>::max()) textureDesc.usage |= TextureUsage::CopySrc;
 	textureDesc.viewFormatCount = 0;
 	textureDesc.viewFormats = nullptr;
-	Texture m_texture = device.createTexture(textureDesc);
+	if (gpuMipMaps) {
+		// Storage textures cannot be sRGB, so the texture is created linear and only viewed as sRGB
+		textureDesc.usage |= TextureUsage::StorageBinding;
+		textureDesc.format = TextureFormat::RGBA8Unorm;
+		if (options.srgb) {
+			textureDesc.viewFormatCount = 1;
+			textureDesc.viewFormats = (WGPUTextureFormat*)&viewFormat;
+		}
+	}
+	Texture m_texture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "ResourceManager");
 
-	// Upload data to the GPU texture
-	writeMipMaps(device, m_texture, textureDesc.size, textureDesc.mipLevelCount, pixelData);
+	// Levels larger than residentSize are left for writeTextureLevel, which needs the whole mip
+	// chain of a single image to be built ahead
+	residentLevel = 0;
+	if (!gpuMipMaps && layerCount == 1 && layers[0]->mipLevelCount == fullMipLevelCount) {
+		while (residentLevel + 1 < textureDesc.mipLevelCount && std::max(width >> residentLevel, height >> residentLevel) > residentSize) {
+			++residentLevel;
+		}
+	}
 
-	stbi_image_free(pixelData);
-	// (Do not use data after this)
+	// Upload data to the GPU texture
+	if (gpuMipMaps) {
+		// The compute passes read level 0, so it must be submitted first
+		writeMipMaps(uploader, m_texture, textureDesc.size, 0, 0, 1, layers[0]->pixels.get(), nullptr, options);
+		uploader.flush();
+		generateMipMaps(device, m_texture, textureDesc.size, textureDesc.mipLevelCount, options);
+	}
+	else {
+		MEMORY_SCOPE(Mipmaps);
+		std::vector<size_t> levelOffsets;
+		size_t arenaSize = mipChainLayout({ layers[0]->width, layers[0]->height, 1 }, fullMipLevelCount, levelOffsets);
+		std::unique_ptr<unsigned char[]> arena;
+		for (uint32_t layer = 0; layer < layerCount; ++layer) {
+			// Use the mip-maps built ahead by buildMipMaps, if any
+			const Image& image = *layers[layer];
+			const unsigned char* pixels = image.pixels.get();
+			const unsigned char* mipMaps = image.mipLevelCount == fullMipLevelCount ? image.mipMaps.get() : nullptr;
+			if (skippedLevelCount > 0) {
+				// The full chain is needed to get to the first uploaded level
+				if (!mipMaps) {
+					if (!arena) arena.reset(new unsigned char[arenaSize]);
+					buildMipChain(pixels, { image.width, image.height, 1 }, levelOffsets, arena.get(), options);
+					mipMaps = arena.get();
+				}
+				// Levels are contiguous, so the levels after the first uploaded one follow the same layout
+				pixels = mipMaps + levelOffsets[skippedLevelCount];
+				mipMaps = skippedLevelCount + 1 < fullMipLevelCount ? mipMaps + levelOffsets[skippedLevelCount + 1] : nullptr;
+			}
+			writeMipMaps(uploader, m_texture, textureDesc.size, layer, residentLevel, textureDesc.mipLevelCount, pixels, mipMaps, options);
+		}
+	}
 
 	if (pTextureView) {
 		TextureViewDescriptor textureViewDesc{};
 		textureViewDesc.aspect = TextureAspect::All;
 		textureViewDesc.baseArrayLayer = 0;
-		textureViewDesc.arrayLayerCount = 1;
+		textureViewDesc.arrayLayerCount = layerCount;
 		textureViewDesc.baseMipLevel = 0;
 		textureViewDesc.mipLevelCount = textureDesc.mipLevelCount;
-		textureViewDesc.dimension = TextureViewDimension::_2D;
-		textureViewDesc.format = textureDesc.format;
+		textureViewDesc.dimension = viewDimension;
+		textureViewDesc.format = viewFormat;
 		*pTextureView = m_texture.createView(textureViewDesc);
 	}
 
 	return m_texture;
 }
 
+bool ResourceManager::loadCompressedImage(const std::filesystem::path& path, CompressedImage& image) {
+	STARTUP_STAGE("Texture decode");
+	MEMORY_SCOPE(ImageDecoding);
+	if (!image.file.open(path)) {
+		std::cerr << "Failed to open compressed texture: " << path << std::endl;
+		return false;
+	}
+	if (!parseKtx2(image.file.data(), image.file.size(), image.image)) {
+		std::cerr << "Failed to load compressed texture: " << path << std::endl;
+		image.file.close();
+		return false;
+	}
+	return true;
+}
+
+static std::filesystem::path compressedTextureCachePath(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options) {
+	std::filesystem::path cachePath = path;
+	cachePath += ".bc";
+	if (options.srgb) cachePath += "-srgb";
+	if (options.alphaWeightedMipMaps) cachePath += "-alpha";
+	if (options.maxSize > 0) cachePath += "-" + std::to_string(options.maxSize);
+	cachePath += ".ktx2";
+	return cachePath;
+}
+
+bool ResourceManager::loadCompressedTextureCache(const std::filesystem::path& path, const TextureLoadOptions& options, CompressedImage& image) {
+	// Older than the image, which was edited since it was compressed
+	std::filesystem::path cachePath = compressedTextureCachePath(path, options);
+	std::error_code ec;
+	std::filesystem::file_time_type cacheTime = std::filesystem::last_write_time(cachePath, ec);
+	if (ec) return false;
+	std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(path, ec);
+	if (ec || cacheTime < sourceTime) return false;
+	return loadCompressedImage(cachePath, image);
+}
+
+bool ResourceManager::writeCompressedTextureCache(const std::filesystem::path& path, const TextureLoadOptions& options, const Ktx2Image& image) {
+	std::vector<std::byte> data;
+	if (!writeKtx2(image, data)) return false;
+
+	// Through a temporary file, so that a concurrent reader never maps a partial cache
+	return writeFileAtomically(compressedTextureCachePath(path, options), data);
+}
+
+// Auxiliary function for loadCompressedImageFromGlb and loadImageFromGlb, the embedded base
+// color image of the mapped file `file` with its MIME type
+static std::span<const std::byte> glbBaseColorImageData(const std::filesystem::path& path, const MappedFile& file, std::string& mimeType) {
+	GlbDocument document;
+	if (!parseGlb(file.data(), file.size(), document)) return {};
+	int32_t image = glbBaseColorImage(document);
+	std::span<const std::byte> data = image >= 0 ? document.bufferViewData(document.images[image].bufferView) : std::span<const std::byte>{};
+	if (data.empty()) {
+		std::cerr << "No embedded base color texture in " << path << std::endl;
+		return {};
+	}
+	mimeType = document.images[image].mimeType;
+	return data;
+}
+
+bool ResourceManager::loadCompressedImageFromGlb(const std::filesystem::path& path, CompressedImage& image) {
+	STARTUP_STAGE("Texture decode");
+	MEMORY_SCOPE(ImageDecoding);
+	if (!image.file.open(path)) {
+		std::cerr << "Failed to open compressed texture: " << path << std::endl;
+		return false;
+	}
+	std::string mimeType;
+	std::span<const std::byte> data = glbBaseColorImageData(path, image.file, mimeType);
+	if (data.empty() || mimeType != "image/ktx2" || !parseKtx2(data.data(), data.size(), image.image)) {
+		image.file.close();
+		return false;
+	}
+	return true;
+}
+
+bool ResourceManager::loadImageFromGlb(const std::filesystem::path& path, Image& image) {
+	return loadImageFromGlb(path, image, TextureLoadOptions{});
+}
+
+bool ResourceManager::loadImageFromGlb(const std::filesystem::path& path, Image& image, const TextureLoadOptions& options) {
+	STARTUP_STAGE("Texture decode");
+	MEMORY_SCOPE(ImageDecoding);
+	MappedFile file;
+	std::string mimeType;
+	std::span<const std::byte> data = file.open(path) ? glbBaseColorImageData(path, file, mimeType) : std::span<const std::byte>{};
+	ImageDecoder::Pixels pixels = !data.empty() && mimeType != "image/ktx2"
+		? ImageDecoder::decode(data, {}, image.width, image.height, options.maxSize)
+		: ImageDecoder::Pixels{ nullptr, nullptr };
+	if (!pixels) {
+		std::cerr << "Failed to load texture: " << path << std::endl;
+		return false;
+	}
+	image.pixels = std::move(pixels);
+	fitImageToMaxSize(image, options);
+	return true;
+}
+
+// sRGB view format of a block-compressed format, or the format itself if it has none
+static TextureFormat srgbViewFormat(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::RGBA8Unorm: return TextureFormat::RGBA8UnormSrgb;
+	case TextureFormat::BC1RGBAUnorm: return TextureFormat::BC1RGBAUnormSrgb;
+	case TextureFormat::BC3RGBAUnorm: return TextureFormat::BC3RGBAUnormSrgb;
+	case TextureFormat::BC7RGBAUnorm: return TextureFormat::BC7RGBAUnormSrgb;
+	case TextureFormat::ETC2RGB8Unorm: return TextureFormat::ETC2RGB8UnormSrgb;
+	case TextureFormat::ETC2RGBA8Unorm: return TextureFormat::ETC2RGBA8UnormSrgb;
+	case TextureFormat::ASTC4x4Unorm: return TextureFormat::ASTC4x4UnormSrgb;
+	default: return format;
+	}
+}
+
+Texture ResourceManager::createTexture(const CompressedImage& compressedImage, Device device, const TextureLoadOptions& options, TextureView* pTextureView) {
+	UploadManager uploader(device);
+	return createTexture(compressedImage, uploader, options, pTextureView);
+}
+
+Texture ResourceManager::createTexture(const CompressedImage& compressedImage, UploadManager& uploader, const TextureLoadOptions& options, TextureView* pTextureView) {
+	uint32_t residentLevel;
+	Texture texture = createStreamedTexture(compressedImage, uploader, options, std::numeric_limits<uint32_t>::max(), residentLevel);
+	if (texture && pTextureView) *pTextureView = createTextureView(texture, options, 0);
+	return texture;
+}
+
+// Upload rows [firstRow, firstRow + rowCount) of blocks of level `level` of a compressed texture whose
+// level 0 is level `firstLevel` of the image, copies being made of whole blocks. Return the number
+// of bytes uploaded.
+static uint64_t writeCompressedLevel(UploadManager& uploader, Texture texture, const Ktx2Image& image, uint32_t firstLevel, uint32_t level, uint32_t firstRow = 0, uint32_t rowCount = UINT32_MAX) {
+	uint32_t blockCountX = (std::max(image.width >> (firstLevel + level), 1u) + image.blockWidth - 1) / image.blockWidth;
+	uint32_t blockCountY = (std::max(image.height >> (firstLevel + level), 1u) + image.blockHeight - 1) / image.blockHeight;
+	if (firstRow >= blockCountY) return 0;
+	rowCount = std::min(rowCount, blockCountY - firstRow);
+	uint32_t bytesPerRow = blockCountX * image.bytesPerBlock;
+
+	ImageCopyTexture destination{};
+	destination.texture = texture;
+	destination.mipLevel = level;
+	destination.origin = { 0, firstRow * image.blockHeight, 0 };
+	destination.aspect = TextureAspect::All;
+	Extent3D writeSize = { blockCountX * image.blockWidth, rowCount * image.blockHeight, 1 };
+	const std::span<const std::byte>& data = image.levels[firstLevel + level];
+	uploader.writeTexture(destination, data.data() + size_t(firstRow) * bytesPerRow, bytesPerRow, rowCount, writeSize);
+	return uint64_t(bytesPerRow) * rowCount;
+}
+
+uint64_t ResourceManager::writeTextureLevel(const CompressedImage& compressedImage, Texture texture, UploadManager& uploader, uint32_t level, uint32_t firstRow, uint32_t rowCount) {
+	const Ktx2Image& image = compressedImage.image;
+	uint32_t firstLevel = static_cast<uint32_t>(image.levels.size()) - texture.getMipLevelCount();
+	return writeCompressedLevel(uploader, texture, image, firstLevel, level, firstRow, rowCount);
+}
+
+uint32_t ResourceManager::textureLevelRowCount(const CompressedImage& compressedImage, Texture texture, uint32_t level, uint64_t& bytesPerRow) {
+	const Ktx2Image& image = compressedImage.image;
+	uint32_t imageLevel = static_cast<uint32_t>(image.levels.size()) - texture.getMipLevelCount() + level;
+	bytesPerRow = uint64_t((std::max(image.width >> imageLevel, 1u) + image.blockWidth - 1) / image.blockWidth) * image.bytesPerBlock;
+	return (std::max(image.height >> imageLevel, 1u) + image.blockHeight - 1) / image.blockHeight;
+}
+
+Texture ResourceManager::createStreamedTexture(const CompressedImage& compressedImage, UploadManager& uploader, const TextureLoadOptions& options, uint32_t residentSize, uint32_t& residentLevel) {
+	Device device = uploader.device();
+	const Ktx2Image& image = compressedImage.image;
+	FeatureName feature = textureFormatFeature(image.format);
+	if (feature != FeatureName::Undefined && !device.hasFeature(feature)) {
+		std::cerr << "Compressed texture format " << image.format << " is not supported by the device" << std::endl;
+		return nullptr;
+	}
+
+	TextureFormat viewFormat = options.srgb ? srgbViewFormat(image.format) : image.format;
+
+	// Skip the largest levels of images that exceed the size limit, as long as the remaining
+	// ones keep a size that is a multiple of the block size, as compressed textures require
+	SupportedLimits deviceLimits{};
+	device.getLimits(&deviceLimits);
+	uint32_t maxSize = deviceLimits.limits.maxTextureDimension2D;
+	if (options.maxSize > 0) maxSize = std::min(maxSize, options.maxSize);
+	uint32_t firstLevel = 0;
+	auto levelWidth = [&](uint32_t level) { return std::max(image.width >> level, 1u); };
+	auto levelHeight = [&](uint32_t level) { return std::max(image.height >> level, 1u); };
+	while (firstLevel + 1 < image.levels.size()
+		&& std::max(levelWidth(firstLevel), levelHeight(firstLevel)) > maxSize
+		&& levelWidth(firstLevel + 1) % image.blockWidth == 0
+		&& levelHeight(firstLevel + 1) % image.blockHeight == 0
+	) {
+		++firstLevel;
+	}
+
+	TextureDescriptor textureDesc{};
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = image.format;
+	textureDesc.size = { levelWidth(firstLevel), levelHeight(firstLevel), 1 };
+	textureDesc.mipLevelCount = static_cast<uint32_t>(image.levels.size()) - firstLevel;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	if (residentSize != std::numeric_limits<uint32_t>::max()) textureDesc.usage |= TextureUsage::CopySrc;
+	textureDesc.viewFormatCount = viewFormat != image.format ? 1 : 0;
+	textureDesc.viewFormats = (WGPUTextureFormat*)&viewFormat;
+	Texture texture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "ResourceManager");
+
+	// Upload each level as is, those larger than residentSize being left for writeTextureLevel
+	residentLevel = 0;
+	while (residentLevel + 1 < textureDesc.mipLevelCount && std::max(levelWidth(firstLevel + residentLevel), levelHeight(firstLevel + residentLevel)) > residentSize) {
+		++residentLevel;
+	}
+	for (uint32_t level = residentLevel; level < textureDesc.mipLevelCount; ++level) {
+		writeCompressedLevel(uploader, texture, image, firstLevel, level);
+	}
+	return texture;
+}
+
+Texture ResourceManager::resizeStreamedTexture(
+	Device device, Texture texture, uint32_t width, uint32_t height, uint32_t mipLevelCount,
+	uint32_t firstCopiedLevel, uint32_t blockWidth, uint32_t blockHeight,
+	const TextureLoadOptions& options, CommandEncoder encoder
+) {
+	TextureFormat format = texture.getFormat();
+	TextureFormat viewFormat = options.srgb ? srgbViewFormat(format) : format;
+	TextureDescriptor textureDesc{};
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = format;
+	textureDesc.size = { width, height, texture.getDepthOrArrayLayers() };
+	textureDesc.mipLevelCount = mipLevelCount;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst | TextureUsage::CopySrc;
+	textureDesc.viewFormatCount = viewFormat != format ? 1 : 0;
+	textureDesc.viewFormats = (WGPUTextureFormat*)&viewFormat;
+	Texture resized = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "ResourceManager");
+	if (!resized) return nullptr;
+
+	// Both chains end with the same levels, level i of the old one being this far in the new one
+	uint32_t oldLevelCount = texture.getMipLevelCount();
+	int32_t levelShift = static_cast<int32_t>(mipLevelCount) - static_cast<int32_t>(oldLevelCount);
+	uint32_t oldWidth = texture.getWidth();
+	uint32_t oldHeight = texture.getHeight();
+	for (uint32_t level = std::max<uint32_t>(firstCopiedLevel, std::max(-levelShift, 0)); level < oldLevelCount; ++level) {
+		ImageCopyTexture source{};
+		source.texture = texture;
+		source.mipLevel = level;
+		source.origin = { 0, 0, 0 };
+		source.aspect = TextureAspect::All;
+		ImageCopyTexture destination = source;
+		destination.texture = resized;
+		destination.mipLevel = static_cast<uint32_t>(static_cast<int32_t>(level) + levelShift);
+		// Whole blocks, which compressed levels smaller than a block still take
+		uint32_t levelWidth = std::max(oldWidth >> level, 1u);
+		uint32_t levelHeight = std::max(oldHeight >> level, 1u);
+		Extent3D copySize = {
+			(levelWidth + blockWidth - 1) / blockWidth * blockWidth,
+			(levelHeight + blockHeight - 1) / blockHeight * blockHeight,
+			textureDesc.size.depthOrArrayLayers
+		};
+		encoder.copyTextureToTexture(source, destination, copySize);
+	}
+	return resized;
+}
+
+TextureView ResourceManager::createTextureView(Texture texture, const TextureLoadOptions& options, uint32_t baseMipLevel) {
+	TextureViewDescriptor textureViewDesc{};
+	textureViewDesc.aspect = TextureAspect::All;
+	textureViewDesc.baseArrayLayer = 0;
+	textureViewDesc.arrayLayerCount = texture.getDepthOrArrayLayers();
+	textureViewDesc.baseMipLevel = baseMipLevel;
+	textureViewDesc.mipLevelCount = texture.getMipLevelCount() - baseMipLevel;
+	textureViewDesc.dimension = options.viewDimension;
+	textureViewDesc.format = options.srgb ? srgbViewFormat(texture.getFormat()) : texture.getFormat();
+	return texture.createView(textureViewDesc);
+}
@@ -1,31 +1,356 @@
 #pragma once
 
 #include <webgpu/webgpu.hpp>
-#include <glm/glm.hpp>
+#include "MathConfig.h"
 
 #include <vector>
 #include <filesystem>
+#include <span>
+#include <string>
+#include <memory>
+
+#include "MappedFile.h"
+#include "MeshOptimizer.h"
+#include "Ktx2Parser.h"
+#include "UploadManager.h"
 
 class ResourceManager {
 public:
 
 	/**
-	* A structure that describes the data layout in the vertex buffer
+	* A structure that describes the data layout in the vertex buffer, packed
+	* whatever the configuration of glm (see MathConfig.h)
 	*/
 	struct VertexAttributes {
-		glm::vec3 position;
-		glm::vec3 normal;
-		glm::vec3 color;
-    glm::vec2 uv;
+		glm::vec<3, float, glm::packed_highp> position;
+		glm::vec<3, float, glm::packed_highp> normal;
+		glm::vec<3, float, glm::packed_highp> color;
+		glm::vec<2, float, glm::packed_highp> uv;
+	};
+
+	/**
+	 * A level of detail of an indexed geometry, as a range of its index array.
+	 * All levels share the same vertices.
+	 */
+	struct GeometryLod {
+		uint32_t indexOffset;
+		uint32_t indexCount;
+		// Simplification error, as a distance relative to the largest extent of the mesh
+		float error;
+		// Range of Geometry::meshlets covering this level, empty if meshlets were not built
+		uint32_t meshletOffset;
+		uint32_t meshletCount;
+	};
+
+	/**
+	 * A material of the file a geometry is loaded from, e.g. a `newmtl` of the .mtl files
+	 * of an OBJ, drawn with the triangles of a submesh
+	 */
+	struct SourceMaterial {
+		std::string name;
+		// Relative to the directory of the source file, empty if the material has none
+		std::filesystem::path baseColorTexture;
+		// Blended over what is behind when below 1
+		float opacity = 1.0f;
+	};
+
+	/**
+	 * Indexed geometry, either backed by a memory mapped binary cache file or
+	 * by owned arrays when it was parsed from the source file and the cache could
+	 * not be written (e.g. on the web). Freshly parsed geometry is mapped from the
+	 * cache just written, so that keeping it costs pages the system can reclaim.
+	 * Compressed caches, those of delivery bundles, are decoded to the heap.
+	 * In all cases `vertices` and `indices` are the views to upload from.
+	 */
+	struct Geometry {
+		std::span<const VertexAttributes> vertices;
+		std::span<const uint32_t> indices;
+		// Levels of detail from the full mesh to the coarsest one, at least one
+		std::span<const GeometryLod> lods;
+		// Clusters of consecutive triangles of each level, with their culling data
+		std::span<const MeshOptimizer::Meshlet> meshlets;
+		// Continuous level of detail hierarchy of the full level, whose coarser clusters index
+		// past the discrete levels, empty unless built (see GeometryLoadOptions::clusterLod)
+		std::span<const MeshOptimizer::ClusterLodNode> clusterNodes;
+		// Ranges of the triangles of each material in each level, level by level and in the order
+		// of `materials`, those of a level covering it in order. Empty when the source uses at most
+		// one material, the whole levels being drawn with it.
+		std::span<const GeometryLod> submeshLods;
+		// One per submesh, owned whatever backs the arrays
+		std::vector<SourceMaterial> materials;
+
+		// Storage, only one of the three is in use
+		MappedFile mapping;
+		// A compressed cache once decoded, laid out like a mapped one
+		std::unique_ptr<std::byte[]> decodedCache;
+		std::vector<VertexAttributes> vertexData;
+		std::vector<uint32_t> indexData;
+		std::vector<GeometryLod> lodData;
+		std::vector<MeshOptimizer::Meshlet> meshletData;
+		std::vector<GeometryLod> submeshLodData;
+		std::vector<MeshOptimizer::ClusterLodNode> clusterNodeData;
+
+		// Whether the data comes from the binary cache, mapped or decoded, rather than from the source
+		bool fromCache = false;
+		// Whether the colors of `vertices` hold lighting baked by LightBaker rather than those of
+		// the source (see storeBakedLighting)
+		bool bakedLighting = false;
+		// Hash of the data (see hashGeometry), set by loadGeometry, 0 when not computed
+		uint64_t contentHash = 0;
+	};
+
+	/**
+	 * Processing applied to an indexed mesh after it is parsed and before it is cached:
+	 * generation of simplified levels of detail, then reordering passes that do not
+	 * change the rendered result, only how fast it renders.
+	 */
+	struct GeometryLoadOptions {
+		// Reorder triangles for post-transform vertex cache hits
+		bool optimizeVertexCache = true;
+		// Then reorder clusters of triangles to reduce overdraw (requires optimizeVertexCache)
+		bool optimizeOverdraw = true;
+		// Then renumber vertices in order of first use, for vertex fetch locality
+		bool optimizeVertexFetch = true;
+
+		// Number of levels of detail, including the full mesh, each one having about half
+		// the triangles of the previous one
+		uint32_t lodLevelCount = 4;
+		// Simplification error, relative to the mesh extent, above which no coarser level is built
+		float lodMaxError = 0.05f;
+
+		// Split each level into meshlets of up to 64 vertices and 124 triangles, for cluster culling
+		bool buildMeshlets = true;
+
+		// Also build a hierarchy of clusters simplified group by group (see
+		// MeshOptimizer::buildClusterLod), for a level of detail chosen per cluster on the GPU.
+		// Not built for geometry made of several submeshes.
+		bool clusterLod = false;
+	};
+
+	/**
+	 * An RGBA8 image decoded in CPU memory, not yet uploaded to a texture.
+	 * Decoding does not involve the device, so it can run on any thread.
+	 */
+	struct Image {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		// 4 bytes per pixel, row by row
+		std::unique_ptr<unsigned char, void(*)(void*)> pixels = { nullptr, nullptr };
+		// Levels 1 and up, smallest last, when built ahead of the upload by buildMipMaps()
+		std::unique_ptr<unsigned char[]> mipMaps;
+		// Number of levels held, including `pixels`
+		uint32_t mipLevelCount = 1;
+	};
+
+	/**
+	 * A block-compressed image with all its mip levels, as stored in a KTX2 file.
+	 * Levels are uploaded as is, straight from the mapped file.
+	 */
+	struct CompressedImage {
+		// Levels point into `file`
+		Ktx2Image image;
+		MappedFile file;
+	};
+
+	/**
+	 * How textures are created from decoded images
+	 */
+	struct TextureLoadOptions {
+		enum class MipmapGeneration {
+			// Box filter on the CPU (see downsampleRgba8), every level uploaded with writeTexture
+			Cpu,
+			// Upload level 0 only and fill the other levels with a compute shader,
+			// which requires the texture to have the StorageBinding usage
+			Gpu,
+		};
+		MipmapGeneration mipmapGeneration = MipmapGeneration::Cpu;
+
+		// Whether the image holds sRGB encoded colors, like most 8-bit photos and paintings.
+		// Mip-maps are then filtered in linear space, and the texture is sampled through an
+		// RGBA8UnormSrgb view so that shaders read linear colors without decoding them.
+		bool srgb = false;
+
+		// Weight colors by their alpha when filtering mip-maps (i.e., average premultiplied
+		// colors), so that transparent texels do not bleed their color into their neighbors
+		bool alphaWeightedMipMaps = false;
+
+		// Dimension of the view of single textures, _2DArray giving a single layer array
+		// that can be bound where texture arrays (see createTextureArray) are expected
+		wgpu::TextureViewDimension viewDimension = wgpu::TextureViewDimension::_2D;
+
+		// Largest width and height of the texture, in texels, 0 meaning the device limit.
+		// The largest mip levels of bigger images are dropped until they fit, which bounds
+		// the memory textures take whatever the size of the files they come from.
+		uint32_t maxSize = 0;
 	};
 
 	
-	// Create a shader module for a given WebGPU `device` from a WGSL shader source loaded from a path
-	static wgpu::ShaderModule loadShaderModule(const std::filesystem::path& path, wgpu::Device device);
+	// Append the WGSL shader source loaded from a path to `source`, with the files of the
+	// shared library it #includes (see ShaderPreprocessor)
+	static bool loadShaderSource(const std::filesystem::path& path, std::string& source);
+
+	// Create a shader module for a given WebGPU `device` from a WGSL shader source loaded from a path.
+	// The optional `prelude` is prepended to the source, e.g. for generated declarations.
+	static wgpu::ShaderModule loadShaderModule(const std::filesystem::path& path, wgpu::Device device, const std::string& prelude = "");
+
+	// Create a shader module from WGSL source code
+	static wgpu::ShaderModule createShaderModule(const std::string& source, wgpu::Device device);
 	
 	// Load an 3D mesh from a standard .obj file into a vertex data buffer
 	static bool loadGeometryFromObj(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData);
 
+	// Load an 3D mesh from a standard .obj file into a deduplicated vertex buffer and an index buffer.
+	// Corners sharing the same (position, normal, texcoord) triple are merged into a single vertex.
+	static bool loadGeometryFromObj(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData);
+
+	// Same as above, also reading the .mtl files that the OBJ refers to, from its directory. When
+	// more than one material is used, triangles are sorted by material, `submeshes` receives the
+	// range of each one and `materials` the materials, in the same order, both being left empty
+	// otherwise. Triangles of no material come last, with a default material.
+	static bool loadGeometryFromObj(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData, std::vector<GeometryLod>& submeshes, std::vector<SourceMaterial>& materials);
+
+	// Load an indexed 3D mesh through a binary cache stored next to the .obj file (as `<name>.obj.meshcache`).
+	// The cache is (re)written whenever it is missing or older than the source, otherwise it is memory mapped.
+	// Levels of detail are built and the optimization passes selected in `options` are applied before writing the cache,
+	// to each submesh of a multi-material OBJ on its own so that their ranges stay apart.
+	static bool loadGeometryFromObj(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options);
+
+	// Same as above, with all optimization passes enabled
+	static bool loadGeometryFromObj(const std::filesystem::path& path, Geometry& geometry);
+
+	// Load an indexed 3D mesh from a text file of `[points]` and `[indices]` sections like
+	// resources/pyramid.txt (see TxtGeometryParser.h for the supported point layouts)
+	static bool loadGeometryFromTxt(const std::filesystem::path& path, std::vector<VertexAttributes>& vertexData, std::vector<uint32_t>& indexData);
+
+	// Same as above through a binary cache stored next to the file (as `<name>.txt.meshcache`),
+	// exactly like the Geometry overload of loadGeometryFromObj
+	static bool loadGeometryFromTxt(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options);
+
+	// Load the first mesh of a binary glTF file (see GlbParser.h). The file is memory mapped and, when
+	// `options` do not process the geometry and its accessors are laid out like VertexAttributes, the
+	// vertices and indices are views of its buffer views, uploaded as is. Otherwise it is converted
+	// and processed through a binary cache, exactly like the Geometry overload of loadGeometryFromObj.
+	static bool loadGeometryFromGlb(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options);
+
+	// Call loadGeometryFromTxt for .txt files, loadGeometryFromGlb for .glb files and loadGeometryFromObj
+	// for any other extension
+	static bool loadGeometry(const std::filesystem::path& path, Geometry& geometry, const GeometryLoadOptions& options);
+
+	// Copy `geometry`, loaded from `path` with `options`, to `baked` with the colors of its
+	// vertices replaced by `lighting`, one per vertex, and store it in the mesh cache of `path`
+	// when it was loaded through one, so that later loads map it baked. Return whether it was
+	// stored. Safe to call from any thread.
+	static bool storeBakedLighting(
+		const std::filesystem::path& path, const GeometryLoadOptions& options, const Geometry& geometry,
+		std::span<const glm::vec3> lighting, Geometry& baked
+	);
+
+	// 64-bit hash of the vertices, indices, levels and meshlets of `geometry`, the same for copies
+	// of a mesh exported to different files, for them to be uploaded once and drawn instanced
+	static uint64_t hashGeometry(const Geometry& geometry);
+
 	// Load an image from a standard image file into a new texture object
 	static wgpu::Texture loadTexture(const std::filesystem::path& path, wgpu::Device m_device, wgpu::TextureView* pTextureView = nullptr);
+
+	// Decode an image from a standard image file, forcing 4 channels. Safe to call from any thread.
+	static bool loadImage(const std::filesystem::path& path, Image& image);
+
+	// Same as above, for a texture created with `options`: images larger than its maxSize are
+	// decoded at a reduced size when the format allows it (JPEG), then halved until they fit,
+	// rather than decoded whole for createTexture() to drop their largest levels.
+	static bool loadImage(const std::filesystem::path& path, Image& image, const TextureLoadOptions& options);
+
+	// Filter the mip-maps of a decoded image on the CPU, so that createTexture() only uploads
+	// them. `options` must be those passed to createTexture(). Safe to call from any thread.
+	static void buildMipMaps(Image& image, const TextureLoadOptions& options);
+
+	// Pixels of level `level` of an image whose mip-maps were built by buildMipMaps(), each level
+	// being nextMipLevelSize() of the previous one on each side
+	static const unsigned char* mipLevelPixels(const Image& image, uint32_t level);
+
+	// Create a texture object with its mip-maps from a decoded image
+	static wgpu::Texture createTexture(const Image& image, wgpu::Device device, const TextureLoadOptions& options, wgpu::TextureView* pTextureView = nullptr);
+
+	// Same as above, uploading through the staging buffers of `uploader`. The texture
+	// content is only there for commands submitted after the next uploader.flush().
+	static wgpu::Texture createTexture(const Image& image, UploadManager& uploader, const TextureLoadOptions& options, wgpu::TextureView* pTextureView = nullptr);
+
+	// Same as above, with default options
+	static wgpu::Texture createTexture(const Image& image, wgpu::Device device, wgpu::TextureView* pTextureView = nullptr);
+
+	// Create a texture array with one layer per image, which must all have the same size, and
+	// a _2DArray view of all layers. Mip-maps are always filtered on the CPU. Return nullptr if
+	// sizes do not match.
+	static wgpu::Texture createTextureArray(std::span<const Image* const> images, UploadManager& uploader, const TextureLoadOptions& options, wgpu::TextureView* pTextureView = nullptr);
+
+	// Map a KTX2 file holding a block-compressed image (see Ktx2Image). Safe to call from any thread.
+	static bool loadCompressedImage(const std::filesystem::path& path, CompressedImage& image);
+
+	// Map the block-compressed version of the image at `path` that writeCompressedTextureCache()
+	// stored next to it for `options`, unless the image changed since. Safe to call from any thread.
+	static bool loadCompressedTextureCache(const std::filesystem::path& path, const TextureLoadOptions& options, CompressedImage& image);
+
+	// Store `image`, compressed from the image at `path` loaded with `options` (e.g. by
+	// TextureCompressor), as a KTX2 file next to it (as `<name>.bc[-srgb][-alpha][-<maxSize>].ktx2`,
+	// the options changing the levels). Safe to call from any thread.
+	static bool writeCompressedTextureCache(const std::filesystem::path& path, const TextureLoadOptions& options, const Ktx2Image& image);
+
+	// Map a binary glTF file whose first base color texture is an embedded KTX2 image, as the
+	// KHR_texture_basisu extension references them. The levels point into the mapped file.
+	// Safe to call from any thread.
+	static bool loadCompressedImageFromGlb(const std::filesystem::path& path, CompressedImage& image);
+
+	// Decode the first base color texture of a binary glTF file, an embedded PNG or JPEG image.
+	// Safe to call from any thread.
+	static bool loadImageFromGlb(const std::filesystem::path& path, Image& image);
+
+	// Same as above, reducing the image to the maxSize of `options` like loadImage() does
+	static bool loadImageFromGlb(const std::filesystem::path& path, Image& image, const TextureLoadOptions& options);
+
+	// Create a texture object from a block-compressed image, or return nullptr if the device
+	// lacks the feature needed to sample its format. Mip-maps are those of the image, so only
+	// `options.srgb` applies: it selects the sRGB view of formats that have one.
+	static wgpu::Texture createTexture(const CompressedImage& image, wgpu::Device device, const TextureLoadOptions& options, wgpu::TextureView* pTextureView = nullptr);
+
+	// Same as above, uploading through the staging buffers of `uploader`
+	static wgpu::Texture createTexture(const CompressedImage& image, UploadManager& uploader, const TextureLoadOptions& options, wgpu::TextureView* pTextureView = nullptr);
+
+	// Create a texture with its whole mip chain but only upload the levels no larger than
+	// `residentSize`, the smallest one at least. `residentLevel` is set to the first uploaded
+	// level, the others to be uploaded one at a time with writeTextureLevel() and sampled only
+	// through views that start at an uploaded level (see createTextureView). An image is only
+	// streamed so if its mip-maps were built ahead by buildMipMaps(), otherwise all levels are
+	// uploaded and `residentLevel` is 0.
+	static wgpu::Texture createStreamedTexture(const Image& image, UploadManager& uploader, const TextureLoadOptions& options, uint32_t residentSize, uint32_t& residentLevel);
+	static wgpu::Texture createStreamedTexture(const CompressedImage& image, UploadManager& uploader, const TextureLoadOptions& options, uint32_t residentSize, uint32_t& residentLevel);
+
+	// Upload level `level` of a texture created from `image` by createStreamedTexture(), or the
+	// rows [firstRow, firstRow + rowCount) of it, rows of texels or of blocks for compressed
+	// images, so that a large level may be written over several frames. Return the number of
+	// bytes uploaded.
+	static uint64_t writeTextureLevel(const Image& image, wgpu::Texture texture, UploadManager& uploader, uint32_t level, uint32_t firstRow = 0, uint32_t rowCount = UINT32_MAX);
+	static uint64_t writeTextureLevel(const CompressedImage& image, wgpu::Texture texture, UploadManager& uploader, uint32_t level, uint32_t firstRow = 0, uint32_t rowCount = UINT32_MAX);
+
+	// Number of rows of level `level`, in the sense of writeTextureLevel(), and their size in bytes
+	static uint32_t textureLevelRowCount(const Image& image, wgpu::Texture texture, uint32_t level, uint64_t& bytesPerRow);
+	static uint32_t textureLevelRowCount(const CompressedImage& image, wgpu::Texture texture, uint32_t level, uint64_t& bytesPerRow);
+
+	// Create a texture like `texture`, created by createStreamedTexture(), of `width` x `height`
+	// texels and `mipLevelCount` levels whose chain ends like that of `texture`, so that levels
+	// are dropped from or added to its top. Levels of `texture` from `firstCopiedLevel` on that
+	// both have are copied with `encoder`, in blocks of `blockWidth` x `blockHeight` texels (1 x 1
+	// unless compressed), the others being left to writeTextureLevel().
+	static wgpu::Texture resizeStreamedTexture(
+		wgpu::Device device, wgpu::Texture texture, uint32_t width, uint32_t height, uint32_t mipLevelCount,
+		uint32_t firstCopiedLevel, uint32_t blockWidth, uint32_t blockHeight,
+		const TextureLoadOptions& options, wgpu::CommandEncoder encoder
+	);
+
+	// View of all array layers and of levels from `baseMipLevel` on, in the format `options` select
+	static wgpu::TextureView createTextureView(wgpu::Texture texture, const TextureLoadOptions& options, uint32_t baseMipLevel);
+
+private:
+	// Texture with one layer per image, all of the same size, of which only levels no larger
+	// than `residentSize` are uploaded (see createStreamedTexture)
+	static wgpu::Texture createTexture(std::span<const Image* const> layers, UploadManager& uploader, const TextureLoadOptions& options, wgpu::TextureViewDimension viewDimension, wgpu::TextureView* pTextureView, uint32_t residentSize, uint32_t& residentLevel);
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "RetainedAssets.h"
+
+namespace {
+
+template <typename T>
+T findEntry(const std::unordered_map<std::string, T>& entries, const std::string& key)
+{
+	auto it = entries.find(key);
+	return it != entries.end() ? it->second : T{};
+}
+
+uint64_t imageByteSize(const ResourceManager::Image& image)
+{
+	// Mip-maps add up to a third of the base level
+	uint64_t baseSize = uint64_t(image.width) * image.height * 4;
+	return image.mipLevelCount > 1 ? baseSize + baseSize / 3 : baseSize;
+}
+
+uint64_t compressedImageByteSize(const ResourceManager::CompressedImage& image)
+{
+	uint64_t size = 0;
+	for (const auto& level : image.image.levels) {
+		size += level.size_bytes();
+	}
+	return size;
+}
+
+} // anonymous namespace
+
+RetainedAssets::Mesh RetainedAssets::findMesh(const std::string& key) const
+{
+	std::lock_guard lock(mMutex);
+	return findEntry(mMeshes, key);
+}
+
+std::shared_ptr<const ResourceManager::Image> RetainedAssets::findImage(const std::string& key) const
+{
+	std::lock_guard lock(mMutex);
+	return findEntry(mImages, key);
+}
+
+std::shared_ptr<const ResourceManager::CompressedImage> RetainedAssets::findCompressedImage(const std::string& key) const
+{
+	std::lock_guard lock(mMutex);
+	return findEntry(mCompressedImages, key);
+}
+
+void RetainedAssets::addMesh(const std::string& key, Mesh mesh)
+{
+	std::lock_guard lock(mMutex);
+	mMeshes[key] = std::move(mesh);
+}
+
+void RetainedAssets::addImage(const std::string& key, std::shared_ptr<const ResourceManager::Image> image)
+{
+	std::lock_guard lock(mMutex);
+	mImages[key] = std::move(image);
+}
+
+void RetainedAssets::addCompressedImage(const std::string& key, std::shared_ptr<const ResourceManager::CompressedImage> image)
+{
+	std::lock_guard lock(mMutex);
+	mCompressedImages[key] = std::move(image);
+}
+
+void RetainedAssets::evict(const std::filesystem::path& path)
+{
+	// Keys start with the normalized absolute path of the file, see ResourceCache::textureKey
+	std::error_code error;
+	std::string prefix = std::filesystem::absolute(path, error).lexically_normal().generic_string() + "|";
+	std::lock_guard lock(mMutex);
+	std::erase_if(mMeshes, [&](const auto& entry) { return entry.first.starts_with(prefix); });
+	std::erase_if(mImages, [&](const auto& entry) { return entry.first.starts_with(prefix); });
+	std::erase_if(mCompressedImages, [&](const auto& entry) { return entry.first.starts_with(prefix); });
+}
+
+void RetainedAssets::clear()
+{
+	std::lock_guard lock(mMutex);
+	mMeshes.clear();
+	mImages.clear();
+	mCompressedImages.clear();
+}
+
+uint64_t RetainedAssets::byteSize() const
+{
+	std::lock_guard lock(mMutex);
+	uint64_t size = 0;
+	for (const auto& [key, mesh] : mMeshes) {
+		// Mapped from the binary cache otherwise, which the system may page out, unless the cache
+		// was compressed and decoded to the heap
+		if (!mesh.geometry->fromCache || mesh.geometry->decodedCache) {
+			size += mesh.geometry->vertices.size_bytes() + mesh.geometry->indices.size_bytes();
+		}
+	}
+	for (const auto& [key, image] : mImages) {
+		size += imageByteSize(*image);
+	}
+	for (const auto& [key, image] : mCompressedImages) {
+		size += compressedImageByteSize(*image);
+	}
+	return size;
+}
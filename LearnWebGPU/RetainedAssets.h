@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ResourceManager.h"
+#include "Bvh.h"
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+/**
+ * Decoded CPU-side data of the assets the GPU resources were created from,
+ * kept after their upload so that the resources can be created again without
+ * reading and parsing the files again, e.g. once a lost device is replaced.
+ *
+ * Entries are keyed like those of the ResourceCache (see ResourceCache::textureKey
+ * and ResourceCache::geometryKey), and are shared read-only with the uploads.
+ * Unlike the cache, which only references resources while they are in use, it
+ * owns its entries until cleared. Loading jobs use it from worker threads.
+ */
+class RetainedAssets {
+public:
+	/**
+	 * A geometry and the bounding volume hierarchy built from its vertices
+	 */
+	struct Mesh {
+		std::shared_ptr<const ResourceManager::Geometry> geometry;
+		std::shared_ptr<const MeshBvh> bvh;
+	};
+
+	// Null members when nothing is retained under the key
+	Mesh findMesh(const std::string& key) const;
+	std::shared_ptr<const ResourceManager::Image> findImage(const std::string& key) const;
+	std::shared_ptr<const ResourceManager::CompressedImage> findCompressedImage(const std::string& key) const;
+
+	// Replace any entry of the same key
+	void addMesh(const std::string& key, Mesh mesh);
+	void addImage(const std::string& key, std::shared_ptr<const ResourceManager::Image> image);
+	void addCompressedImage(const std::string& key, std::shared_ptr<const ResourceManager::CompressedImage> image);
+
+	// Drop the entries of the file at `path`, e.g. once it changed, so that it is read again
+	void evict(const std::filesystem::path& path);
+
+	void clear();
+
+	// CPU memory held by the entries, without the part of it other owners may share
+	uint64_t byteSize() const;
+
+private:
+	mutable std::mutex mMutex;
+	std::unordered_map<std::string, Mesh> mMeshes;
+	std::unordered_map<std::string, std::shared_ptr<const ResourceManager::Image>> mImages;
+	std::unordered_map<std::string, std::shared_ptr<const ResourceManager::CompressedImage>> mCompressedImages;
+};
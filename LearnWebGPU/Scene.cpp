@@ -0,0 +1,148 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+uint32_t Scene::addMesh(ResourceCache::GeometryHandle geometry) {
+	mMeshes.push_back({ std::move(geometry), 0, nullptr });
+	mDrawListDirty = true;
+	return static_cast<uint32_t>(mMeshes.size() - 1);
+}
+
+uint32_t Scene::addMaterial(const Material& material) {
+	mMaterials.push_back(material);
+	mDrawListDirty = true;
+	return static_cast<uint32_t>(mMaterials.size() - 1);
+}
+
+uint32_t Scene::addInstance(const Instance& instance) {
+	mInstances.push_back(instance);
+	mDrawListDirty = true;
+	return static_cast<uint32_t>(mInstances.size() - 1);
+}
+
+void Scene::setMeshGeometry(uint32_t mesh, ResourceCache::GeometryHandle geometry, uint32_t submesh) {
+	mMeshes[mesh].geometry = std::move(geometry);
+	mMeshes[mesh].submesh = submesh;
+	mDrawListDirty = true;
+}
+
+void Scene::setMeshBvh(uint32_t mesh, std::shared_ptr<const MeshBvh> bvh) {
+	// Not drawn, thus leaving the draw list as is
+	mMeshes[mesh].bvh = std::move(bvh);
+}
+
+void Scene::setMaterialTexture(uint32_t material, ResourceCache::TextureHandle texture) {
+	mMaterials[material].texture = std::move(texture);
+	mDrawListDirty = true;
+}
+
+void Scene::setMaterialOpacity(uint32_t material, float opacity) {
+	mMaterials[material].opacity = opacity;
+	mDrawListDirty = true;
+}
+
+void Scene::setMaterialColor(uint32_t material, const glm::vec4& color) {
+	mMaterials[material].color = color;
+	mDrawListDirty = true;
+}
+
+void Scene::setInstanceTransform(uint32_t instance, const glm::mat4& modelMatrix) {
+	mInstances[instance].modelMatrix = modelMatrix;
+	if (mInstanceMoved.size() < mInstances.size()) mInstanceMoved.resize(mInstances.size(), 0);
+	if (mInstanceMoved[instance]) return;
+	mInstanceMoved[instance] = 1;
+	mMovedInstances.push_back(instance);
+}
+
+void Scene::clearMovedInstances() {
+	for (uint32_t instance : mMovedInstances) {
+		mInstanceMoved[instance] = 0;
+	}
+	mMovedInstances.clear();
+}
+
+void Scene::clearInstances() {
+	mInstances.clear();
+	clearMovedInstances();
+	mInstanceMoved.clear();
+	// Not to keep textures alive through the last draw list
+	mDrawOrder.clear();
+	mDrawPositions.clear();
+	mBatches.clear();
+	mOpaqueBatchCount = 0;
+	mTextures.clear();
+	mDrawListDirty = true;
+}
+
+void Scene::clear() {
+	mMeshes.clear();
+	mMaterials.clear();
+	clearInstances();
+}
+
+void Scene::buildDrawList() {
+	mDrawListDirty = false;
+	// Drawn where they are now
+	clearMovedInstances();
+	mDrawOrder.clear();
+	mBatches.clear();
+	mOpaqueBatchCount = 0;
+	mTextures.clear();
+
+	// Textures are numbered in the order materials use them, which the sort follows
+	std::unordered_map<const ResourceCache::Texture*, uint32_t> textureIndices;
+	std::vector<uint32_t> materialTextures(mMaterials.size());
+	for (size_t i = 0; i < mMaterials.size(); ++i) {
+		const ResourceCache::TextureHandle& texture = mMaterials[i].texture;
+		if (!texture) continue;
+		auto [it, inserted] = textureIndices.try_emplace(texture.get(), static_cast<uint32_t>(mTextures.size()));
+		if (inserted) mTextures.push_back(texture);
+		materialTextures[i] = it->second;
+	}
+
+	// Meshes sharing a submesh of a geometry, copies of a mesh that the resource cache uploaded
+	// once, have their instances drawn by the batches of the first of them
+	std::map<std::pair<const ResourceCache::Geometry*, uint32_t>, uint32_t> geometryMeshes;
+	std::vector<uint32_t> batchMeshes(mMeshes.size());
+	for (uint32_t i = 0; i < mMeshes.size(); ++i) {
+		const Mesh& mesh = mMeshes[i];
+		batchMeshes[i] = mesh.geometry ? geometryMeshes.try_emplace({ mesh.geometry.get(), mesh.submesh }, i).first->second : i;
+	}
+
+	// 64-bit keys, transparency first, then texture and whether the instance is dynamic, ties
+	// keeping the order of the instances
+	std::vector<std::pair<uint64_t, uint32_t>> keys;
+	keys.reserve(mInstances.size());
+	for (uint32_t i = 0; i < mInstances.size(); ++i) {
+		const Instance& instance = mInstances[i];
+		const Material& material = mMaterials[instance.material];
+		if (!mMeshes[instance.mesh].geometry || !material.texture) continue;
+		keys.emplace_back(uint64_t(material.transparent()) << 63 | uint64_t(materialTextures[instance.material]) << 32 | uint64_t(instance.dynamic) << 31 | batchMeshes[instance.mesh], i);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	mDrawOrder.reserve(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i) {
+		bool transparent = (keys[i].first >> 63) != 0;
+		if (i == 0 || keys[i].first != keys[i - 1].first || transparent) {
+			DrawBatch batch;
+			batch.mesh = static_cast<uint32_t>(keys[i].first) & 0x7fffffff;
+			batch.texture = static_cast<uint32_t>(keys[i].first >> 32) & 0x7fffffff;
+			batch.firstInstance = static_cast<uint32_t>(i);
+			batch.instanceCount = 0;
+			batch.dynamic = (keys[i].first >> 31 & 1) != 0;
+			batch.transparent = transparent;
+			if (!transparent) mOpaqueBatchCount = static_cast<uint32_t>(mBatches.size() + 1);
+			mBatches.push_back(batch);
+		}
+		++mBatches.back().instanceCount;
+		mDrawOrder.push_back(keys[i].second);
+	}
+
+	mDrawPositions.assign(mInstances.size(), NotDrawn);
+	for (uint32_t i = 0; i < mDrawOrder.size(); ++i) {
+		mDrawPositions[mDrawOrder[i]] = i;
+	}
+}
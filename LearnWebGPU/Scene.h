@@ -0,0 +1,149 @@
+#pragma once
+
+#include "MathConfig.h"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "ResourceCache.h"
+#include "Bvh.h"
+
+/**
+ * What the renderer draws: meshes, materials, and instances of a mesh with a
+ * material, stored as flat arrays and referenced by index.
+ *
+ * The draw list orders instances by the state their draws need, so that they are
+ * encoded with as few state changes as possible: first by bind group, which only
+ * depends on the texture array of the material (its layer is per instance), then
+ * by mesh, whose vertex and index buffers are bound for each run of its instances.
+ * Meshes of a same submesh of a geometry, which the resource cache shares between
+ * identical meshes loaded from different files, are one mesh for batching.
+ * Every draw of a pass uses the same pipeline, all meshes sharing one vertex
+ * layout, so the pipeline is set once per pass. Each run of instances sharing a
+ * texture and a mesh is a batch, drawn by a single indirect instanced draw.
+ * Static and dynamic instances are kept in separate batches, for shadow casters
+ * to be drawn either alone.
+ *
+ * The parameters of materials are uploaded by the renderer into one buffer, which
+ * instances index with their material, so that only the texture array tells the
+ * bind groups of materials apart.
+ *
+ * Transparent materials, of an opacity below 1, are drawn after all opaque ones
+ * and blended over them, which needs their draws to be ordered back to front by
+ * the renderer every frame. Their instances are thus sorted after the opaque ones,
+ * each in a batch of its own.
+ *
+ * Instances of meshes still loading are left out of the draw list, which is built
+ * again after any change.
+ */
+class Scene {
+public:
+	struct Mesh {
+		// Null while loading
+		ResourceCache::GeometryHandle geometry;
+		// Triangles of the geometry drawn, each submesh of a geometry of several materials
+		// being a mesh of its own, with instances of its own material
+		uint32_t submesh = 0;
+		// Triangles of its full level for ray queries on the CPU, null while loading
+		std::shared_ptr<const MeshBvh> bvh;
+		// Whether its vertices are animated by the textures of a VertexAnimationTexture bound
+		// with the view, rather than drawn as the geometry has them
+		bool vertexAnimation = false;
+	};
+
+	struct Material {
+		// A texture array, null while loading
+		ResourceCache::TextureHandle texture;
+		uint32_t textureLayer = 0;
+		// Multiplies the color of the texture
+		glm::vec4 color = glm::vec4(1.0f);
+		// Blended over what is behind when below 1
+		float opacity = 1.0f;
+
+		bool transparent() const { return opacity < 1.0f; }
+	};
+
+	struct Instance {
+		glm::mat4 modelMatrix = glm::mat4(1.0f);
+		uint32_t mesh = 0;
+		uint32_t material = 0;
+		// Whether the instance moves by itself, which shadows are cached without
+		bool dynamic = false;
+		// Time the instance plays the vertex animation of its mesh ahead of the frame, in seconds,
+		// for the instances of a crowd not to move in step
+		float animationOffset = 0.0f;
+	};
+
+	/**
+	 * Instances drawn together, a range of the draw order
+	 */
+	struct DrawBatch {
+		uint32_t mesh;
+		// Index in textures()
+		uint32_t texture;
+		uint32_t firstInstance;
+		uint32_t instanceCount;
+		// Instances of a batch are all static or all dynamic
+		bool dynamic;
+		// A single instance of a transparent material
+		bool transparent;
+	};
+
+	// Indices of the new elements
+	uint32_t addMesh(ResourceCache::GeometryHandle geometry = nullptr);
+	uint32_t addMaterial(const Material& material);
+	uint32_t addInstance(const Instance& instance);
+
+	void setMeshGeometry(uint32_t mesh, ResourceCache::GeometryHandle geometry, uint32_t submesh = 0);
+	void setMeshBvh(uint32_t mesh, std::shared_ptr<const MeshBvh> bvh);
+	void setMaterialTexture(uint32_t material, ResourceCache::TextureHandle texture);
+	void setMaterialOpacity(uint32_t material, float opacity);
+	void setMaterialColor(uint32_t material, const glm::vec4& color);
+	// Move an instance without the draw list being built again, only recording it as moved
+	void setInstanceTransform(uint32_t instance, const glm::mat4& modelMatrix);
+	// Remove the instances, and the draw list
+	void clearInstances();
+	// Release everything, meshes and materials included
+	void clear();
+
+	const std::vector<Mesh>& meshes() const { return mMeshes; }
+	const std::vector<Material>& materials() const { return mMaterials; }
+	const std::vector<Instance>& instances() const { return mInstances; }
+
+	// Whether something changed since the draw list was built
+	bool drawListDirty() const { return mDrawListDirty; }
+	// Sort the instances that can be drawn into batches
+	void buildDrawList();
+
+	// Instance drawn at each position of the draw order, batch by batch
+	const std::vector<uint32_t>& drawOrder() const { return mDrawOrder; }
+	// Position in the draw order of `instance`, NotDrawn for those the draw list leaves out
+	static constexpr uint32_t NotDrawn = UINT32_MAX;
+	uint32_t drawPosition(uint32_t instance) const { return instance < mDrawPositions.size() ? mDrawPositions[instance] : NotDrawn; }
+	const std::vector<DrawBatch>& batches() const { return mBatches; }
+	// Batches before the transparent ones, which follow up to the end of batches()
+	uint32_t opaqueBatchCount() const { return mOpaqueBatchCount; }
+	// Distinct textures of the drawn materials, one bind group each
+	const std::vector<ResourceCache::TextureHandle>& textures() const { return mTextures; }
+
+	// Instances moved by setInstanceTransform() since the draw list was built or the moves were
+	// last cleared, each once, in the order they first moved
+	const std::vector<uint32_t>& movedInstances() const { return mMovedInstances; }
+	void clearMovedInstances();
+
+private:
+	std::vector<Mesh> mMeshes;
+	std::vector<Material> mMaterials;
+	std::vector<Instance> mInstances;
+
+	bool mDrawListDirty = true;
+	std::vector<uint32_t> mDrawOrder;
+	std::vector<uint32_t> mDrawPositions;
+	std::vector<uint32_t> mMovedInstances;
+	// Per instance, whether it is in mMovedInstances
+	std::vector<uint8_t> mInstanceMoved;
+	std::vector<DrawBatch> mBatches;
+	uint32_t mOpaqueBatchCount = 0;
+	std::vector<ResourceCache::TextureHandle> mTextures;
+};
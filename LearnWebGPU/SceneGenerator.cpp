@@ -0,0 +1,208 @@
+#include "SceneGenerator.h"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string_view>
+
+namespace {
+
+// Side of the square the grid of the model covers, centered on the origin
+constexpr float SceneExtent = 4.0f;
+
+bool parseValue(std::string_view text, uint32_t& value) {
+	auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+	return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+bool parseValue(std::string_view text, float& value) {
+	auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+	return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+// Saturated color of `hue`, from 0 to 1 around the hue circle
+glm::vec3 hueColor(float hue) {
+	float h = 6.0f * (hue - std::floor(hue));
+	return glm::clamp(glm::abs(glm::mod(h + glm::vec3(0.0f, 4.0f, 2.0f), 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+}
+
+// Hues of consecutive indices far apart
+float indexHue(uint32_t index) {
+	return 0.618034f * static_cast<float>(index);
+}
+
+} // anonymous namespace
+
+bool StressSceneOptions::parse(const char* spec, StressSceneOptions& options) {
+	std::string_view text = spec;
+	while (!text.empty()) {
+		size_t end = std::min(text.find(','), text.size());
+		std::string_view pair = text.substr(0, end);
+		text.remove_prefix(std::min(end + 1, text.size()));
+
+		size_t separator = pair.find('=');
+		if (separator == std::string_view::npos) return false;
+		std::string_view key = pair.substr(0, separator);
+		std::string_view value = pair.substr(separator + 1);
+		bool valid = false;
+		if (key == "objects") valid = parseValue(value, options.objectCount);
+		else if (key == "meshes") valid = parseValue(value, options.meshCount) && options.meshCount > 0;
+		else if (key == "triangles") valid = parseValue(value, options.trianglesPerMesh) && options.trianglesPerMesh > 0;
+		else if (key == "materials") valid = parseValue(value, options.materialCount) && options.materialCount > 0;
+		else if (key == "textures") valid = parseValue(value, options.textureCount) && options.textureCount > 0;
+		else if (key == "lights") valid = parseValue(value, options.lightCount);
+		else if (key == "dynamic") valid = parseValue(value, options.dynamicFraction) && options.dynamicFraction >= 0.0f && options.dynamicFraction <= 1.0f;
+		else if (key == "seed") valid = parseValue(value, options.seed);
+		if (!valid) return false;
+	}
+	return true;
+}
+
+SceneGenerator::SceneGenerator(const StressSceneOptions& options)
+	: mOptions(options)
+{
+	mOptions.meshCount = std::max(mOptions.meshCount, 1u);
+	mOptions.materialCount = std::max(mOptions.materialCount, 1u);
+	mOptions.textureCount = std::clamp(mOptions.textureCount, 1u, mOptions.materialCount);
+	mOptions.trianglesPerMesh = std::max(mOptions.trianglesPerMesh, 8u);
+
+	// A jittered grid, each object in a cell of its own
+	uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(mOptions.objectCount))));
+	mSpacing = SceneExtent / static_cast<float>(std::max(side, 1u));
+	std::minstd_rand random(mOptions.seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	mObjects.resize(mOptions.objectCount);
+	for (uint32_t i = 0; i < mOptions.objectCount; ++i) {
+		Object& object = mObjects[i];
+		glm::vec2 cell = glm::vec2(i % side, i / side) + 0.25f + 0.5f * glm::vec2(unit(random), unit(random));
+		float scale = 0.4f * mSpacing * (0.75f + 0.5f * unit(random));
+		object.position = glm::vec3(cell * mSpacing - 0.5f * SceneExtent, scale);
+		object.shape = glm::rotate(glm::mat4(1.0f), glm::two_pi<float>() * unit(random), glm::vec3(0.0f, 0.0f, 1.0f));
+		object.shape = glm::scale(object.shape, glm::vec3(scale));
+		object.mesh = std::min(static_cast<uint32_t>(unit(random) * mOptions.meshCount), mOptions.meshCount - 1);
+		object.material = std::min(static_cast<uint32_t>(unit(random) * mOptions.materialCount), mOptions.materialCount - 1);
+		// Evenly spread, exactly the fraction asked for being dynamic
+		double fraction = mOptions.dynamicFraction;
+		object.dynamic = std::floor((i + 1) * fraction) > std::floor(i * fraction);
+		object.phase = 10.0f * unit(random);
+	}
+}
+
+std::shared_ptr<ResourceManager::Geometry> SceneGenerator::generateMesh(uint32_t index) const {
+	// A sphere of rings from pole to pole, of twice as many segments, 4 rings² triangles
+	uint32_t rings = std::max(2u, static_cast<uint32_t>(std::lround(std::sqrt(mOptions.trianglesPerMesh / 4.0))));
+	uint32_t segments = 2 * rings;
+
+	// Waves of its own on its radius, for meshes not to look alike
+	std::minstd_rand random(mOptions.seed * 7919u + index + 1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	float ringWaves = std::floor(1.0f + 4.0f * unit(random));
+	float segmentWaves = std::floor(1.0f + 6.0f * unit(random));
+	float ringPhase = glm::two_pi<float>() * unit(random);
+	float segmentPhase = glm::two_pi<float>() * unit(random);
+	float amplitude = 0.05f + 0.15f * unit(random);
+
+	auto geometry = std::make_shared<ResourceManager::Geometry>();
+	std::vector<ResourceManager::VertexAttributes>& vertices = geometry->vertexData;
+	vertices.resize(size_t(rings + 1) * (segments + 1));
+	for (uint32_t r = 0; r <= rings; ++r) {
+		float theta = glm::pi<float>() * static_cast<float>(r) / static_cast<float>(rings);
+		for (uint32_t s = 0; s <= segments; ++s) {
+			float phi = glm::two_pi<float>() * static_cast<float>(s) / static_cast<float>(segments);
+			glm::vec3 direction = { std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta) };
+			float radius = 1.0f - amplitude + amplitude * std::sin(ringWaves * theta + ringPhase) * std::sin(segmentWaves * phi + segmentPhase);
+			ResourceManager::VertexAttributes& vertex = vertices[size_t(r) * (segments + 1) + s];
+			vertex.position = radius * direction;
+			vertex.normal = glm::vec3(0.0f);
+			vertex.color = glm::vec3(1.0f);
+			vertex.uv = { static_cast<float>(s) / static_cast<float>(segments), static_cast<float>(r) / static_cast<float>(rings) };
+		}
+	}
+
+	// Counter-clockwise seen from outside, those at the poles being degenerate
+	std::vector<uint32_t>& indices = geometry->indexData;
+	indices.reserve(size_t(6) * rings * segments);
+	for (uint32_t r = 0; r < rings; ++r) {
+		for (uint32_t s = 0; s < segments; ++s) {
+			uint32_t a = r * (segments + 1) + s;
+			uint32_t b = a + segments + 1;
+			indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+		}
+	}
+
+	// Smooth normals, weighted by the area of the triangles around each vertex
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		glm::vec3 p0 = vertices[indices[i]].position;
+		glm::vec3 p1 = vertices[indices[i + 1]].position;
+		glm::vec3 p2 = vertices[indices[i + 2]].position;
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		for (size_t k = 0; k < 3; ++k) {
+			vertices[indices[i + k]].normal = glm::vec3(vertices[indices[i + k]].normal) + normal;
+		}
+	}
+	for (ResourceManager::VertexAttributes& vertex : vertices) {
+		glm::vec3 normal = vertex.normal;
+		float length = glm::length(normal);
+		vertex.normal = length > 0.0f ? normal / length : glm::normalize(glm::vec3(vertex.position));
+	}
+
+	ResourceManager::GeometryLod lod{};
+	lod.indexOffset = 0;
+	lod.indexCount = static_cast<uint32_t>(indices.size());
+	lod.error = 0.0f;
+	geometry->lodData.push_back(lod);
+
+	geometry->vertices = geometry->vertexData;
+	geometry->indices = geometry->indexData;
+	geometry->lods = geometry->lodData;
+	return geometry;
+}
+
+ResourceManager::Image SceneGenerator::generateTexture(uint32_t index) const {
+	ResourceManager::Image image;
+	image.width = TextureSize;
+	image.height = TextureSize;
+	size_t byteCount = size_t(TextureSize) * TextureSize * 4;
+	image.pixels = { static_cast<unsigned char*>(std::malloc(byteCount)), std::free };
+	if (!image.pixels) return image;
+
+	// Checkers of a hue of its own, of a tile size of its own
+	glm::vec3 light = 255.0f * glm::mix(glm::vec3(1.0f), hueColor(indexHue(index)), 0.6f);
+	glm::vec3 dark = 0.35f * light;
+	uint32_t tileShift = 3 + index % 3;
+	unsigned char* pixel = image.pixels.get();
+	for (uint32_t y = 0; y < TextureSize; ++y) {
+		for (uint32_t x = 0; x < TextureSize; ++x) {
+			glm::vec3 color = ((x >> tileShift) + (y >> tileShift)) % 2 == 0 ? light : dark;
+			pixel[0] = static_cast<unsigned char>(color.r);
+			pixel[1] = static_cast<unsigned char>(color.g);
+			pixel[2] = static_cast<unsigned char>(color.b);
+			pixel[3] = 255;
+			pixel += 4;
+		}
+	}
+	return image;
+}
+
+glm::vec4 SceneGenerator::materialColor(uint32_t material) const {
+	// Materials of a same texture told apart by their tint, offset from the hues of the textures
+	return glm::vec4(glm::mix(glm::vec3(1.0f), hueColor(indexHue(material) + 0.5f), 0.4f), 1.0f);
+}
+
+glm::mat4 SceneGenerator::modelMatrix(const Object& object, float time) const {
+	glm::vec3 position = object.position;
+	if (object.dynamic) {
+		// Around a circle within its cell, bobbing up and down
+		float angle = time + object.phase;
+		position += 0.25f * mSpacing * glm::vec3(std::cos(angle), std::sin(angle), 0.5f + 0.5f * std::sin(2.0f * angle));
+	}
+	glm::mat4 matrix = object.shape;
+	matrix[3] = glm::vec4(position, 1.0f);
+	return matrix;
+}
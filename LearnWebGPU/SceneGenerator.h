@@ -0,0 +1,89 @@
+#pragma once
+
+#include "ResourceManager.h"
+
+#include "MathConfig.h"
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Parameters of a synthetic scene, each one an axis along which to measure how
+ * the renderer scales, e.g. frame time and memory in benchmark reports.
+ */
+struct StressSceneOptions {
+	// Instances, 0 for the grid of the model instead of a generated scene
+	uint32_t objectCount = 0;
+	// Distinct meshes, and triangles of each one
+	uint32_t meshCount = 16;
+	uint32_t trianglesPerMesh = 1024;
+	// Distinct materials, spread over distinct textures, one bind group each
+	uint32_t materialCount = 16;
+	uint32_t textureCount = 4;
+	// Point lights, at most ClusteredLights::MaxLights
+	uint32_t lightCount = 128;
+	// Instances moving by themselves, from 0 to 1
+	float dynamicFraction = 0.0f;
+	// Of the random placement, the same scene being generated from the same seed
+	uint32_t seed = 1;
+
+	bool enabled() const { return objectCount > 0; }
+
+	// Read comma-separated key=value pairs, e.g. "objects=10000,meshes=64,dynamic=0.1", of keys
+	// objects, meshes, triangles, materials, textures, lights, dynamic and seed, the others
+	// keeping their value. Return false if a pair is not understood.
+	static bool parse(const char* spec, StressSceneOptions& options);
+};
+
+/**
+ * Builds the scene of StressSceneOptions: procedural meshes (spheres deformed by
+ * waves of their own), procedural textures (checkers of their own hue), and
+ * objects scattered over the area of the grid of the model, sized for them to
+ * cover it rather than to overlap. Everything is generated from the seed alone,
+ * for every run, and every axis of a sweep, to draw the same things.
+ *
+ * Meshes and images are generated on the CPU, from any thread, and uploaded like
+ * loaded ones; objects are plain data for the application to turn into instances.
+ */
+class SceneGenerator {
+public:
+	/**
+	 * An instance to create, with the motion of dynamic ones
+	 */
+	struct Object {
+		// Scale and orientation, about the origin
+		glm::mat4 shape = glm::mat4(1.0f);
+		glm::vec3 position = glm::vec3(0.0f);
+		uint32_t mesh = 0;
+		uint32_t material = 0;
+		bool dynamic = false;
+		// Of the circle dynamic objects move on, in seconds
+		float phase = 0.0f;
+	};
+
+	static constexpr uint32_t TextureSize = 256;
+
+	explicit SceneGenerator(const StressSceneOptions& options);
+
+	const StressSceneOptions& options() const { return mOptions; }
+
+	// Mesh `index`, of about options().trianglesPerMesh triangles in the [-1, 1] cube, with one
+	// level of detail and no meshlets
+	std::shared_ptr<ResourceManager::Geometry> generateMesh(uint32_t index) const;
+	// RGBA8 image of texture `index`, without mip-maps
+	ResourceManager::Image generateTexture(uint32_t index) const;
+	// Color the texture of `material` is multiplied by, and which of the textures it uses
+	glm::vec4 materialColor(uint32_t material) const;
+	uint32_t materialTexture(uint32_t material) const { return material % mOptions.textureCount; }
+
+	const std::vector<Object>& objects() const { return mObjects; }
+	// Model matrix of `object` at `time`, dynamic objects circling around their position
+	glm::mat4 modelMatrix(const Object& object, float time) const;
+
+private:
+	StressSceneOptions mOptions;
+	std::vector<Object> mObjects;
+	// Side of the cell of each object
+	float mSpacing = 1.0f;
+};
@@ -0,0 +1,222 @@
+#include "ShaderPreprocessor.h"
+
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr std::string_view whitespace = " \t\r";
+
+std::string_view trim(std::string_view text) {
+	size_t begin = text.find_first_not_of(whitespace);
+	if (begin == std::string_view::npos) return {};
+	size_t end = text.find_last_not_of(whitespace);
+	return text.substr(begin, end + 1 - begin);
+}
+
+/**
+ * An #ifdef block being processed
+ */
+struct Branch {
+	// Lines of the block are kept in the output
+	bool enabled;
+	// The enclosing block is enabled
+	bool parentEnabled;
+	// #else was met
+	bool inElse = false;
+};
+
+// Punctuation that never forms a token with a neighbour, so that spaces around it can go
+bool isSeparator(char c) {
+	return c != '\0' && std::strchr(",;:(){}[]", c) != nullptr;
+}
+
+// `source` with comments replaced by a space, block comments nesting as in WGSL, and line breaks
+// kept
+std::string stripComments(const std::string& source) {
+	std::string code;
+	code.reserve(source.size());
+	size_t i = 0;
+	while (i < source.size()) {
+		if (source.compare(i, 2, "//") == 0) {
+			i = std::min(source.find('\n', i), source.size());
+			code.push_back(' ');
+		}
+		else if (source.compare(i, 2, "/*") == 0) {
+			int depth = 0;
+			do {
+				if (source.compare(i, 2, "/*") == 0) { ++depth; i += 2; }
+				else if (source.compare(i, 2, "*/") == 0) { --depth; i += 2; }
+				else {
+					if (source[i] == '\n') code.push_back('\n');
+					++i;
+				}
+			} while (depth > 0 && i < source.size());
+			code.push_back(' ');
+		}
+		else {
+			code.push_back(source[i++]);
+		}
+	}
+	return code;
+}
+
+bool includeOnce(const std::filesystem::path& path, const ShaderPreprocessor::Loader& load, std::set<std::filesystem::path>& included, std::string& output) {
+	std::filesystem::path normalized = path.lexically_normal();
+	if (!included.insert(normalized).second) return true;
+	std::string source;
+	if (!load(normalized, source)) return false;
+
+	size_t lineNumber = 0;
+	size_t lineBegin = 0;
+	while (lineBegin < source.size()) {
+		size_t lineEnd = std::min(source.find('\n', lineBegin), source.size());
+		std::string_view line(source.data() + lineBegin, lineEnd - lineBegin);
+		bool hasNewline = lineEnd < source.size();
+		lineBegin = lineEnd + 1;
+		++lineNumber;
+
+		std::string_view directive = trim(line);
+		if (!directive.starts_with("#include")) {
+			output.append(line);
+			if (hasNewline) output.push_back('\n');
+			continue;
+		}
+		std::string_view name = trim(directive.substr(std::strlen("#include")));
+		if (name.size() < 2 || name.front() != '"' || name.back() != '"') {
+			std::cerr << normalized.string() << ":" << lineNumber << ": expected #include \"path\"" << std::endl;
+			return false;
+		}
+		name = name.substr(1, name.size() - 2);
+		if (!includeOnce(normalized.parent_path() / name, load, included, output)) {
+			std::cerr << normalized.string() << ":" << lineNumber << ": could not include \"" << name << "\"" << std::endl;
+			return false;
+		}
+		if (!output.empty() && output.back() != '\n') output.push_back('\n');
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+bool ShaderPreprocessor::process(const std::string& source, const Defines& defines, std::string& output) {
+	output.clear();
+	output.reserve(source.size());
+
+	std::vector<Branch> branches;
+	auto enabled = [&]() { return branches.empty() || branches.back().enabled; };
+
+	size_t lineNumber = 0;
+	size_t lineBegin = 0;
+	while (lineBegin < source.size()) {
+		size_t lineEnd = source.find('\n', lineBegin);
+		if (lineEnd == std::string::npos) lineEnd = source.size();
+		std::string_view line(source.data() + lineBegin, lineEnd - lineBegin);
+		bool hasNewline = lineEnd < source.size();
+		lineBegin = lineEnd + 1;
+		++lineNumber;
+
+		std::string_view directive = trim(line);
+		if (directive.empty() || directive[0] != '#') {
+			if (enabled()) output.append(line);
+			if (hasNewline) output.push_back('\n');
+			continue;
+		}
+
+		size_t nameBegin = directive.find_first_of(whitespace);
+		std::string_view keyword = directive.substr(0, nameBegin);
+		std::string_view name = nameBegin == std::string_view::npos ? std::string_view() : trim(directive.substr(nameBegin));
+
+		if (keyword == "#ifdef" || keyword == "#ifndef") {
+			if (name.empty()) {
+				std::cerr << "Shader line " << lineNumber << ": " << keyword << " without a name" << std::endl;
+				return false;
+			}
+			bool defined = defines.count(std::string(name)) > 0;
+			bool parentEnabled = enabled();
+			branches.push_back({ parentEnabled && defined == (keyword == "#ifdef"), parentEnabled });
+		}
+		else if (keyword == "#else") {
+			if (branches.empty() || branches.back().inElse) {
+				std::cerr << "Shader line " << lineNumber << ": unexpected #else" << std::endl;
+				return false;
+			}
+			Branch& branch = branches.back();
+			branch.enabled = branch.parentEnabled && !branch.enabled;
+			branch.inElse = true;
+		}
+		else if (keyword == "#endif") {
+			if (branches.empty()) {
+				std::cerr << "Shader line " << lineNumber << ": unexpected #endif" << std::endl;
+				return false;
+			}
+			branches.pop_back();
+		}
+		else {
+			std::cerr << "Shader line " << lineNumber << ": unknown directive " << keyword << std::endl;
+			return false;
+		}
+
+		// Directives are blanked out rather than removed to keep line numbers
+		if (hasNewline) output.push_back('\n');
+	}
+
+	if (!branches.empty()) {
+		std::cerr << "Shader: missing #endif" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool ShaderPreprocessor::include(const std::filesystem::path& path, const Loader& load, std::string& output) {
+	std::set<std::filesystem::path> included;
+	return includeOnce(path, load, included, output);
+}
+
+ShaderPreprocessor::Defines ShaderPreprocessor::names(const std::string& source) {
+	Defines result;
+	size_t lineBegin = 0;
+	while (lineBegin < source.size()) {
+		size_t lineEnd = std::min(source.find('\n', lineBegin), source.size());
+		std::string_view directive = trim(std::string_view(source.data() + lineBegin, lineEnd - lineBegin));
+		lineBegin = lineEnd + 1;
+		if (!directive.starts_with("#ifdef") && !directive.starts_with("#ifndef")) continue;
+		size_t nameBegin = directive.find_first_of(whitespace);
+		if (nameBegin != std::string_view::npos) result.insert(std::string(trim(directive.substr(nameBegin))));
+	}
+	return result;
+}
+
+void ShaderPreprocessor::minify(const std::string& source, std::string& output) {
+	output.clear();
+	std::string code = stripComments(source);
+	size_t lineBegin = 0;
+	while (lineBegin < code.size()) {
+		size_t lineEnd = std::min(code.find('\n', lineBegin), code.size());
+		std::string_view line = trim(std::string_view(code.data() + lineBegin, lineEnd - lineBegin));
+		lineBegin = lineEnd + 1;
+		if (line.empty()) continue;
+		if (line[0] == '#') {
+			output.append(line);
+			output.push_back('\n');
+			continue;
+		}
+
+		// Runs of spaces become one, which goes altogether next to a separator
+		bool pendingSpace = false;
+		for (char c : line) {
+			if (c == ' ' || c == '\t' || c == '\r') {
+				pendingSpace = true;
+				continue;
+			}
+			if (pendingSpace && !output.empty() && !isSeparator(output.back()) && output.back() != '\n' && !isSeparator(c)) {
+				output.push_back(' ');
+			}
+			pendingSpace = false;
+			output.push_back(c);
+		}
+		output.push_back('\n');
+	}
+}
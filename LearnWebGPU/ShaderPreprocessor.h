@@ -0,0 +1,56 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <set>
+
+/**
+ * Select the variant of a WGSL source to compile with a small subset of the C
+ * preprocessor, since WGSL has none:
+ *
+ *   #ifdef NAME / #ifndef NAME
+ *   ...
+ *   #else
+ *   ...
+ *   #endif
+ *
+ * Directives may be nested and indented. Lines of disabled branches and directives
+ * are replaced by empty lines, so that compilation messages keep the line numbers
+ * of the original source.
+ *
+ * Before that, include() composes a source out of the shared library of
+ * resources/shaders, replacing lines `#include "path"` by the file they name,
+ * relative to the including one. Each file is included once per source, like a
+ * header with `#pragma once`, whether its #include lines are in enabled branches
+ * or not, and the lines after an #include are shifted by the lines it adds.
+ *
+ * Each set of defines gives a different source, hence a different shader module
+ * once compiled through the PipelineCache. Features that only change values rather
+ * than code are better expressed as pipeline-overridable constants (`override`),
+ * which share a single module.
+ */
+class ShaderPreprocessor {
+public:
+	// Names tested by #ifdef and #ifndef
+	using Defines = std::set<std::string>;
+
+	// Write to `output` the lines of `source` enabled by `defines`.
+	// Return false if directives are malformed or unbalanced.
+	static bool process(const std::string& source, const Defines& defines, std::string& output);
+
+	// Append the file at `path` to `source`, or return false if it cannot be read
+	using Loader = std::function<bool(const std::filesystem::path& path, std::string& source)>;
+
+	// Append to `output` the file at `path` read with `load`, with the files it includes.
+	// Return false if one cannot be read, or an #include is malformed.
+	static bool include(const std::filesystem::path& path, const Loader& load, std::string& output);
+
+	// Names that the directives of `source` test
+	static Defines names(const std::string& source);
+
+	// Write to `output` the code of `source` without its comments, indentation, blank lines and
+	// spaces around punctuation, for the driver to parse less. Directives stay on lines of their
+	// own, but line numbers change: meant for packed shaders, not the ones being edited.
+	static void minify(const std::string& source, std::string& output);
+};
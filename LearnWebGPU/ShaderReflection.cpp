@@ -0,0 +1,669 @@
+#include "ShaderReflection.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <iostream>
+#include <set>
+
+using namespace wgpu;
+
+namespace {
+
+bool isIdentifierStart(char c) {
+	return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool isIdentifierChar(char c) {
+	return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Identifiers, numbers (suffixes included) and single punctuation characters, but for "->".
+// Comments, block ones nesting as in WGSL, are dropped.
+bool tokenize(std::string_view source, std::vector<std::string>& tokens) {
+	size_t i = 0;
+	while (i < source.size()) {
+		char c = source[i];
+		if (std::isspace(static_cast<unsigned char>(c))) {
+			++i;
+		}
+		else if (source.compare(i, 2, "//") == 0) {
+			i = source.find('\n', i);
+			if (i == std::string_view::npos) i = source.size();
+		}
+		else if (source.compare(i, 2, "/*") == 0) {
+			int depth = 0;
+			do {
+				if (source.compare(i, 2, "/*") == 0) { ++depth; i += 2; }
+				else if (source.compare(i, 2, "*/") == 0) { --depth; i += 2; }
+				else ++i;
+			} while (depth > 0 && i < source.size());
+			if (depth > 0) return false;
+		}
+		else if (isIdentifierStart(c) || std::isdigit(static_cast<unsigned char>(c))) {
+			size_t end = i + 1;
+			while (end < source.size() && (isIdentifierChar(source[end]) || (source[end] == '.' && std::isdigit(static_cast<unsigned char>(c))))) ++end;
+			tokens.emplace_back(source.substr(i, end - i));
+			i = end;
+		}
+		else if (source.compare(i, 2, "->") == 0) {
+			tokens.emplace_back("->");
+			i += 2;
+		}
+		else {
+			tokens.emplace_back(1, c);
+			++i;
+		}
+	}
+	return true;
+}
+
+// An integer literal, with or without its u or i suffix
+bool parseInteger(std::string_view text, uint32_t& value) {
+	if (!text.empty() && (text.back() == 'u' || text.back() == 'i')) text.remove_suffix(1);
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return error == std::errc() && end == text.data() + text.size();
+}
+
+uint32_t roundUp(uint32_t alignment, uint32_t size) {
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * The outer name and the parameters of a type as written by Parser::type(), e.g.
+ * "array" and { "vec4<f32>", "4" } for "array<vec4<f32>,4>"
+ */
+struct TypeName {
+	std::string_view name;
+	std::vector<std::string_view> parameters;
+};
+
+TypeName splitType(std::string_view type) {
+	TypeName result;
+	size_t open = type.find('<');
+	result.name = type.substr(0, open);
+	if (open == std::string_view::npos || type.back() != '>') return result;
+	int depth = 0;
+	size_t begin = open + 1;
+	for (size_t i = begin; i < type.size() - 1; ++i) {
+		if (type[i] == '<') ++depth;
+		else if (type[i] == '>') --depth;
+		else if (type[i] == ',' && depth == 0) {
+			result.parameters.push_back(type.substr(begin, i - begin));
+			begin = i + 1;
+		}
+	}
+	result.parameters.push_back(type.substr(begin, type.size() - 1 - begin));
+	return result;
+}
+
+// The predeclared aliases, e.g. vec3f for vec3<f32> and mat4x4f for mat4x4<f32>
+std::string expandShorthand(std::string_view name) {
+	auto scalar = [](char suffix) -> std::string_view {
+		switch (suffix) {
+		case 'f': return "f32";
+		case 'h': return "f16";
+		case 'i': return "i32";
+		case 'u': return "u32";
+		default: return {};
+		}
+	};
+	bool isVector = name.size() == 5 && name.substr(0, 3) == "vec" && name[3] >= '2' && name[3] <= '4';
+	bool isMatrix = name.size() == 7 && name.substr(0, 3) == "mat" && name[4] == 'x' && (name[6] == 'f' || name[6] == 'h');
+	if ((isVector || isMatrix) && !scalar(name.back()).empty()) {
+		return std::string(name.substr(0, name.size() - 1)) + "<" + std::string(scalar(name.back())) + ">";
+	}
+	return std::string(name);
+}
+
+/**
+ * Walks through the tokens of a source
+ */
+class Parser {
+public:
+	explicit Parser(std::vector<std::string> tokens) : mTokens(std::move(tokens)) {}
+
+	bool done() const { return mIndex >= mTokens.size(); }
+	const std::string& peek() const { static const std::string end; return done() ? end : mTokens[mIndex]; }
+	std::string next() { return done() ? std::string() : mTokens[mIndex++]; }
+	bool accept(std::string_view token) {
+		if (peek() != token) return false;
+		++mIndex;
+		return true;
+	}
+	bool expect(std::string_view token) {
+		if (accept(token)) return true;
+		std::cerr << "Shader reflection: expected '" << token << "' instead of '" << peek() << "'" << std::endl;
+		return false;
+	}
+
+	// Attributes before a declaration, by name, with their first argument ("" for none)
+	std::map<std::string, std::string> attributes() {
+		std::map<std::string, std::string> result;
+		while (accept("@")) {
+			std::string name = next();
+			std::string argument;
+			if (accept("(")) {
+				argument = peek();
+				skipUntilClosing("(", ")");
+			}
+			result[name] = argument;
+		}
+		return result;
+	}
+
+	// A type with its template parameters, written without spaces
+	std::string type() {
+		std::string result = next();
+		if (!accept("<")) return result;
+		result += "<";
+		for (bool first = true; !done() && !accept(">"); first = false) {
+			if (!first && !expect(",")) return {};
+			result += (first ? "" : ",") + type();
+		}
+		return result + ">";
+	}
+
+	// After an opening token, up to its closing one, reporting the identifiers in between
+	void skipUntilClosing(std::string_view open, std::string_view close, std::vector<std::string>* identifiers = nullptr) {
+		int depth = 1;
+		while (!done() && depth > 0) {
+			const std::string& token = mTokens[mIndex++];
+			if (token == open) ++depth;
+			else if (token == close) --depth;
+			else if (identifiers && isIdentifierStart(token[0])) identifiers->push_back(token);
+		}
+	}
+
+	void skipUntil(std::string_view token) {
+		while (!done() && next() != token) {}
+	}
+
+private:
+	std::vector<std::string> mTokens;
+	size_t mIndex = 0;
+};
+
+bool textureViewDimension(std::string_view dimension, TextureViewDimension& viewDimension) {
+	if (dimension == "1d") viewDimension = TextureViewDimension::_1D;
+	else if (dimension == "2d") viewDimension = TextureViewDimension::_2D;
+	else if (dimension == "2d_array") viewDimension = TextureViewDimension::_2DArray;
+	else if (dimension == "3d") viewDimension = TextureViewDimension::_3D;
+	else if (dimension == "cube") viewDimension = TextureViewDimension::Cube;
+	else if (dimension == "cube_array") viewDimension = TextureViewDimension::CubeArray;
+	else return false;
+	return true;
+}
+
+bool storageTextureFormat(std::string_view format, TextureFormat& textureFormat) {
+	static const std::map<std::string_view, WGPUTextureFormat> formats = {
+		{ "rgba8unorm", WGPUTextureFormat_RGBA8Unorm },
+		{ "rgba8snorm", WGPUTextureFormat_RGBA8Snorm },
+		{ "rgba8uint", WGPUTextureFormat_RGBA8Uint },
+		{ "bgra8unorm", WGPUTextureFormat_BGRA8Unorm },
+		{ "rgba16uint", WGPUTextureFormat_RGBA16Uint },
+		{ "rgba16float", WGPUTextureFormat_RGBA16Float },
+		{ "r32uint", WGPUTextureFormat_R32Uint },
+		{ "r32sint", WGPUTextureFormat_R32Sint },
+		{ "r32float", WGPUTextureFormat_R32Float },
+		{ "rg32uint", WGPUTextureFormat_RG32Uint },
+		{ "rg32float", WGPUTextureFormat_RG32Float },
+		{ "rgba32uint", WGPUTextureFormat_RGBA32Uint },
+		{ "rgba32float", WGPUTextureFormat_RGBA32Float },
+	};
+	auto it = formats.find(format);
+	if (it == formats.end()) return false;
+	textureFormat = it->second;
+	return true;
+}
+
+// 'f' for floats, 'i' for signed and 'u' for unsigned integers, of a vertex format or input type
+char scalarKind(VertexFormat format) {
+	switch (format) {
+	case VertexFormat::Uint8x2: case VertexFormat::Uint8x4:
+	case VertexFormat::Uint16x2: case VertexFormat::Uint16x4:
+	case VertexFormat::Uint32: case VertexFormat::Uint32x2: case VertexFormat::Uint32x3: case VertexFormat::Uint32x4:
+		return 'u';
+	case VertexFormat::Sint8x2: case VertexFormat::Sint8x4:
+	case VertexFormat::Sint16x2: case VertexFormat::Sint16x4:
+	case VertexFormat::Sint32: case VertexFormat::Sint32x2: case VertexFormat::Sint32x3: case VertexFormat::Sint32x4:
+		return 'i';
+	default:
+		return 'f';
+	}
+}
+
+char scalarKind(std::string_view type) {
+	std::string expanded = expandShorthand(type);
+	TypeName name = splitType(expanded);
+	std::string_view scalar = name.parameters.empty() ? name.name : name.parameters.front();
+	if (scalar == "i32") return 'i';
+	if (scalar == "u32") return 'u';
+	return 'f';
+}
+
+} // anonymous namespace
+
+bool ShaderReflection::add(std::string_view source) {
+	std::vector<std::string> tokens;
+	if (!tokenize(source, tokens)) {
+		std::cerr << "Shader reflection: unterminated comment" << std::endl;
+		return false;
+	}
+	Parser parser(std::move(tokens));
+
+	/**
+	 * A resource variable as declared
+	 */
+	struct Variable {
+		uint32_t group = 0;
+		uint32_t binding = 0;
+		std::string name;
+		std::string addressSpace;
+		std::string access;
+		std::string type;
+	};
+	std::vector<Variable> variables;
+	std::map<std::string, Function, std::less<>> functions;
+
+	while (!parser.done()) {
+		std::map<std::string, std::string> attributes = parser.attributes();
+		std::string keyword = parser.next();
+		if (keyword == "struct") {
+			std::string name = parser.next();
+			if (!parser.expect("{")) return false;
+			std::vector<Declaration> members;
+			while (!parser.done() && !parser.accept("}")) {
+				std::map<std::string, std::string> memberAttributes = parser.attributes();
+				Declaration& member = members.emplace_back();
+				member.name = parser.next();
+				if (!parser.expect(":")) return false;
+				member.type = parser.type();
+				uint32_t value = 0;
+				if (memberAttributes.contains("location") && parseInteger(memberAttributes["location"], value)) member.location = static_cast<int32_t>(value);
+				if (memberAttributes.contains("align")) parseInteger(memberAttributes["align"], member.align);
+				if (memberAttributes.contains("size")) parseInteger(memberAttributes["size"], member.size);
+				if (!parser.accept(",") && parser.peek() != "}") {
+					std::cerr << "Shader reflection: expected ',' after member '" << member.name << "' of '" << name << "'" << std::endl;
+					return false;
+				}
+			}
+			parser.accept(";");
+			// Shaders often only declare the members they use of a structure of another one
+			auto existing = mStructDeclarations.find(name);
+			if (existing == mStructDeclarations.end()) {
+				mStructDeclarations[name] = std::move(members);
+			}
+			else if (!isPrefix(members, existing->second) && !isPrefix(existing->second, members)) {
+				std::cerr << "Shader reflection: structure '" << name << "' differs between shaders" << std::endl;
+			}
+			else if (members.size() > existing->second.size()) {
+				existing->second = std::move(members);
+			}
+		}
+		else if (keyword == "var") {
+			Variable variable;
+			if (parser.accept("<")) {
+				variable.addressSpace = parser.next();
+				if (parser.accept(",")) variable.access = parser.next();
+				if (!parser.expect(">")) return false;
+			}
+			variable.name = parser.next();
+			if (!parser.expect(":")) return false;
+			variable.type = parser.type();
+			parser.skipUntil(";");
+			if (attributes.contains("group") && attributes.contains("binding")) {
+				if (!parseInteger(attributes["group"], variable.group) || !parseInteger(attributes["binding"], variable.binding)) {
+					std::cerr << "Shader reflection: the group and binding of '" << variable.name << "' must be literals" << std::endl;
+					return false;
+				}
+				variables.push_back(std::move(variable));
+			}
+		}
+		else if (keyword == "fn") {
+			std::string name = parser.next();
+			Function& function = functions[name];
+			if (attributes.contains("vertex")) function.stage = ShaderStage::Vertex;
+			if (attributes.contains("fragment")) function.stage = ShaderStage::Fragment;
+			if (attributes.contains("compute")) function.stage = ShaderStage::Compute;
+			if (!parser.expect("(")) return false;
+			while (!parser.done() && !parser.accept(")")) {
+				std::map<std::string, std::string> parameterAttributes = parser.attributes();
+				Declaration& parameter = function.parameters.emplace_back();
+				parameter.name = parser.next();
+				if (!parser.expect(":")) return false;
+				parameter.type = parser.type();
+				uint32_t location = 0;
+				if (parameterAttributes.contains("location") && parseInteger(parameterAttributes["location"], location)) parameter.location = static_cast<int32_t>(location);
+				parser.accept(",");
+			}
+			if (parser.accept("->")) {
+				parser.attributes();
+				parser.type();
+			}
+			if (!parser.expect("{")) return false;
+			parser.skipUntilClosing("{", "}", &function.references);
+			if (function.stage != ShaderStage::None) mEntryPoints[name] = function.parameters;
+		}
+		else if (keyword == "alias") {
+			std::string name = parser.next();
+			if (!parser.expect("=")) return false;
+			mAliases[name] = parser.type();
+			parser.accept(";");
+		}
+		else if (keyword == "const" || keyword == "override") {
+			// Integer constants may size arrays
+			std::string name = parser.next();
+			if (parser.accept(":")) parser.type();
+			if (parser.accept("=")) {
+				std::string value = parser.next();
+				uint32_t integer = 0;
+				if (parser.peek() == ";" && parseInteger(value, integer)) mConstants[name] = integer;
+			}
+			parser.skipUntil(";");
+		}
+		else if (keyword == "enable" || keyword == "requires" || keyword == "diagnostic" || keyword == "const_assert") {
+			parser.skipUntil(";");
+		}
+		else if (keyword != ";") {
+			std::cerr << "Shader reflection: unexpected '" << keyword << "' at global scope" << std::endl;
+			return false;
+		}
+	}
+
+	// Again for all, structures being able to refer to those of this source
+	mStructs.clear();
+	for (const auto& [name, members] : mStructDeclarations) {
+		if (!mStructs.contains(name)) layoutStruct(name, 0);
+	}
+
+	bool success = true;
+	for (const Variable& variable : variables) {
+		BindGroupLayoutEntry entry = Default;
+		entry.binding = variable.binding;
+		entry.visibility = visibility(functions, variable.name);
+		if (!bindingEntry(variable.addressSpace, variable.access, variable.type, entry)) {
+			std::cerr << "Shader reflection: no binding layout for '" << variable.name << "' of type " << variable.type << std::endl;
+			success = false;
+			continue;
+		}
+
+		// Merged with the same binding in other sources
+		auto [it, inserted] = mBindings.try_emplace({ variable.group, variable.binding }, Binding{ variable.name, variable.type, entry });
+		if (inserted) continue;
+		Binding& binding = it->second;
+		if (binding.type != variable.type) {
+			std::cerr << "Shader reflection: group " << variable.group << " binding " << variable.binding << " is a " << variable.type << " in a shader and a " << binding.type << " in another" << std::endl;
+		}
+		binding.entry.visibility |= entry.visibility;
+		binding.entry.buffer.minBindingSize = std::max(binding.entry.buffer.minBindingSize, entry.buffer.minBindingSize);
+	}
+	return success;
+}
+
+bool ShaderReflection::isPrefix(const std::vector<Declaration>& members, const std::vector<Declaration>& of) {
+	if (members.size() > of.size()) return false;
+	return std::equal(members.begin(), members.end(), of.begin(), [](const Declaration& a, const Declaration& b) {
+		return a.name == b.name && a.type == b.type && a.align == b.align && a.size == b.size;
+	});
+}
+
+void ShaderReflection::clear() {
+	mStructDeclarations.clear();
+	mStructs.clear();
+	mAliases.clear();
+	mConstants.clear();
+	mBindings.clear();
+	mEntryPoints.clear();
+}
+
+const ShaderReflection::Struct* ShaderReflection::findStruct(std::string_view name) const {
+	auto it = mStructs.find(name);
+	return it != mStructs.end() ? &it->second : nullptr;
+}
+
+std::vector<BindGroupLayoutEntry> ShaderReflection::bindGroupLayoutEntries(uint32_t group) const {
+	std::vector<BindGroupLayoutEntry> entries;
+	for (auto it = mBindings.lower_bound({ group, 0 }); it != mBindings.end() && it->first.first == group; ++it) {
+		entries.push_back(it->second.entry);
+	}
+	return entries;
+}
+
+std::vector<ShaderReflection::VertexInput> ShaderReflection::vertexInputs(std::string_view entryPoint) const {
+	std::vector<VertexInput> inputs;
+	auto entry = mEntryPoints.find(entryPoint);
+	if (entry == mEntryPoints.end()) return inputs;
+	for (const Declaration& parameter : entry->second) {
+		if (parameter.location >= 0) {
+			inputs.push_back({ static_cast<uint32_t>(parameter.location), parameter.name, parameter.type });
+			continue;
+		}
+		auto members = mStructDeclarations.find(parameter.type);
+		if (members == mStructDeclarations.end()) continue;
+		for (const Declaration& member : members->second) {
+			if (member.location >= 0) inputs.push_back({ static_cast<uint32_t>(member.location), member.name, member.type });
+		}
+	}
+	std::sort(inputs.begin(), inputs.end(), [](const VertexInput& a, const VertexInput& b) { return a.location < b.location; });
+	return inputs;
+}
+
+bool ShaderReflection::checkStruct(std::string_view name, size_t size, std::initializer_list<std::pair<std::string_view, size_t>> offsets) const {
+	const Struct* wgslStruct = findStruct(name);
+	if (!wgslStruct) {
+		std::cerr << "Shader reflection: no structure '" << name << "' in the shaders" << std::endl;
+		return false;
+	}
+	bool matches = true;
+	if (size < wgslStruct->size) {
+		std::cerr << "Shader reflection: structure '" << name << "' is " << wgslStruct->size << " bytes in WGSL but " << size << " in C++" << std::endl;
+		matches = false;
+	}
+	for (const auto& [memberName, offset] : offsets) {
+		auto member = std::find_if(wgslStruct->members.begin(), wgslStruct->members.end(), [&](const Member& m) { return m.name == memberName; });
+		if (member == wgslStruct->members.end()) {
+			std::cerr << "Shader reflection: structure '" << name << "' has no member '" << memberName << "' in WGSL" << std::endl;
+			matches = false;
+		}
+		else if (member->offset != offset) {
+			std::cerr << "Shader reflection: member '" << memberName << "' of '" << name << "' is at offset " << member->offset << " in WGSL but " << offset << " in C++" << std::endl;
+			matches = false;
+		}
+	}
+	return matches;
+}
+
+bool ShaderReflection::checkVertexBuffers(std::string_view entryPoint, std::span<const VertexBufferLayout> buffers) const {
+	bool matches = true;
+	for (const VertexInput& input : vertexInputs(entryPoint)) {
+		const WGPUVertexAttribute* attribute = nullptr;
+		for (const VertexBufferLayout& buffer : buffers) {
+			for (size_t i = 0; i < buffer.attributeCount; ++i) {
+				if (buffer.attributes[i].shaderLocation == input.location) attribute = &buffer.attributes[i];
+			}
+		}
+		if (!attribute) {
+			std::cerr << "Shader reflection: no vertex attribute for input '" << input.name << "' of " << entryPoint << " at location " << input.location << std::endl;
+			matches = false;
+		}
+		else if (scalarKind(VertexFormat(attribute->format)) != scalarKind(input.type)) {
+			std::cerr << "Shader reflection: the vertex attribute at location " << input.location << " cannot be read as the " << input.type << " of " << entryPoint << std::endl;
+			matches = false;
+		}
+	}
+	return matches;
+}
+
+bool ShaderReflection::layout(std::string_view type, uint32_t& size, uint32_t& alignment, int depth) {
+	// Against aliases and structures referring to themselves
+	if (depth > 32) return false;
+	std::string expanded = expandShorthand(type);
+	TypeName name = splitType(expanded);
+
+	if (auto alias = mAliases.find(name.name); alias != mAliases.end()) {
+		return layout(alias->second, size, alignment, depth + 1);
+	}
+	if (name.name == "f32" || name.name == "i32" || name.name == "u32") {
+		size = alignment = 4;
+		return true;
+	}
+	if (name.name == "f16") {
+		size = alignment = 2;
+		return true;
+	}
+	if (name.name == "atomic" && name.parameters.size() == 1) {
+		return layout(name.parameters[0], size, alignment, depth + 1);
+	}
+	if (name.name.size() == 4 && name.name.substr(0, 3) == "vec" && name.parameters.size() == 1) {
+		uint32_t count = name.name[3] - '0';
+		uint32_t scalarSize = 0;
+		if (count < 2 || count > 4 || !layout(name.parameters[0], scalarSize, alignment, depth + 1)) return false;
+		size = count * scalarSize;
+		alignment = (count == 3 ? 4 : count) * scalarSize;
+		return true;
+	}
+	if (name.name.size() == 6 && name.name.substr(0, 3) == "mat" && name.name[4] == 'x' && name.parameters.size() == 1) {
+		// Columns are vectors of as many rows
+		uint32_t columns = name.name[3] - '0';
+		uint32_t rows = name.name[5] - '0';
+		uint32_t scalarSize = 0;
+		if (columns < 2 || columns > 4 || rows < 2 || rows > 4 || !layout(name.parameters[0], scalarSize, alignment, depth + 1)) return false;
+		alignment = (rows == 3 ? 4 : rows) * scalarSize;
+		size = columns * roundUp(alignment, rows * scalarSize);
+		return true;
+	}
+	if (name.name == "array" && (name.parameters.size() == 1 || name.parameters.size() == 2)) {
+		uint32_t elementSize = 0;
+		if (!layout(name.parameters[0], elementSize, alignment, depth + 1)) return false;
+		uint32_t stride = roundUp(alignment, elementSize);
+		// Runtime-sized arrays need room for one element
+		uint32_t count = 1;
+		if (name.parameters.size() == 2 && !parseInteger(name.parameters[1], count)) {
+			auto constant = mConstants.find(name.parameters[1]);
+			if (constant == mConstants.end()) return false;
+			count = constant->second;
+		}
+		size = count * stride;
+		return true;
+	}
+	if (name.parameters.empty() && mStructDeclarations.contains(name.name)) {
+		std::string structName(name.name);
+		if (!mStructs.contains(structName) && !layoutStruct(structName, depth + 1)) return false;
+		size = mStructs[structName].size;
+		alignment = mStructs[structName].alignment;
+		return true;
+	}
+	// Booleans, textures, samplers and pointers have no host-shareable layout
+	return false;
+}
+
+bool ShaderReflection::layoutStruct(const std::string& name, int depth) {
+	auto declaration = mStructDeclarations.find(name);
+	if (declaration == mStructDeclarations.end()) return false;
+	Struct result;
+	result.alignment = 1;
+	uint32_t end = 0;
+	for (const Declaration& member : declaration->second) {
+		uint32_t size = 0;
+		uint32_t alignment = 0;
+		if (!layout(member.type, size, alignment, depth + 1)) return false;
+		if (member.align) alignment = member.align;
+		if (member.size) size = member.size;
+		uint32_t offset = roundUp(alignment, end);
+		result.members.push_back({ member.name, member.type, offset, size });
+		end = offset + size;
+		result.alignment = std::max(result.alignment, alignment);
+	}
+	result.size = roundUp(result.alignment, end);
+	mStructs[name] = std::move(result);
+	return true;
+}
+
+WGPUShaderStageFlags ShaderReflection::visibility(const std::map<std::string, Function, std::less<>>& functions, const std::string& name) {
+	WGPUShaderStageFlags stages = ShaderStage::None;
+	for (const auto& [entryPointName, entryPoint] : functions) {
+		if (entryPoint.stage == ShaderStage::None) continue;
+		// Functions reached from the entry point, through the calls in their bodies
+		std::set<std::string_view> reached = { entryPointName };
+		std::vector<const Function*> pending = { &entryPoint };
+		bool uses = false;
+		while (!pending.empty() && !uses) {
+			const Function* function = pending.back();
+			pending.pop_back();
+			for (const std::string& reference : function->references) {
+				if (reference == name) uses = true;
+				auto callee = functions.find(reference);
+				if (callee != functions.end() && reached.insert(callee->first).second) pending.push_back(&callee->second);
+			}
+		}
+		if (uses) stages |= entryPoint.stage;
+	}
+	return stages;
+}
+
+bool ShaderReflection::bindingEntry(const std::string& addressSpace, const std::string& access, const std::string& type, BindGroupLayoutEntry& entry) {
+	uint32_t size = 0;
+	uint32_t alignment = 0;
+	if (addressSpace == "uniform" || addressSpace == "storage") {
+		if (!layout(type, size, alignment)) return false;
+		entry.buffer.type = addressSpace == "uniform" ? BufferBindingType::Uniform
+			: access == "read_write" ? BufferBindingType::Storage : BufferBindingType::ReadOnlyStorage;
+		entry.buffer.minBindingSize = size;
+		return true;
+	}
+	if (!addressSpace.empty()) return false;
+
+	TypeName name = splitType(type);
+	if (name.name == "sampler") {
+		entry.sampler.type = SamplerBindingType::Filtering;
+		return true;
+	}
+	if (name.name == "sampler_comparison") {
+		entry.sampler.type = SamplerBindingType::Comparison;
+		return true;
+	}
+	constexpr std::string_view storagePrefix = "texture_storage_";
+	if (name.name.starts_with(storagePrefix)) {
+		StorageTextureAccess storageAccess = StorageTextureAccess::WriteOnly;
+		if (name.parameters.size() == 2 && name.parameters[1] == "read") storageAccess = StorageTextureAccess::ReadOnly;
+		else if (name.parameters.size() == 2 && name.parameters[1] == "read_write") storageAccess = StorageTextureAccess::ReadWrite;
+		else if (name.parameters.size() != 2 || name.parameters[1] != "write") return false;
+		TextureFormat format = TextureFormat::Undefined;
+		TextureViewDimension viewDimension = TextureViewDimension::Undefined;
+		if (!storageTextureFormat(name.parameters[0], format) || !textureViewDimension(name.name.substr(storagePrefix.size()), viewDimension)) return false;
+		entry.storageTexture.access = storageAccess;
+		entry.storageTexture.format = format;
+		entry.storageTexture.viewDimension = viewDimension;
+		return true;
+	}
+
+	constexpr std::string_view depthPrefix = "texture_depth_";
+	constexpr std::string_view texturePrefix = "texture_";
+	std::string_view dimension;
+	TextureSampleType sampleType = TextureSampleType::Float;
+	if (name.name.starts_with(depthPrefix)) {
+		dimension = name.name.substr(depthPrefix.size());
+		sampleType = TextureSampleType::Depth;
+	}
+	else if (name.name.starts_with(texturePrefix) && name.parameters.size() == 1) {
+		dimension = name.name.substr(texturePrefix.size());
+		if (name.parameters[0] == "i32") sampleType = TextureSampleType::Sint;
+		else if (name.parameters[0] == "u32") sampleType = TextureSampleType::Uint;
+		else if (name.parameters[0] != "f32") return false;
+	}
+	else {
+		return false;
+	}
+	// Multisampled float textures cannot be filtered
+	if (dimension == "multisampled_2d") {
+		entry.texture.multisampled = true;
+		dimension = "2d";
+		if (sampleType == TextureSampleType::Float) sampleType = TextureSampleType::UnfilterableFloat;
+	}
+	TextureViewDimension viewDimension = TextureViewDimension::Undefined;
+	if (!textureViewDimension(dimension, viewDimension)) return false;
+	entry.texture.sampleType = sampleType;
+	entry.texture.viewDimension = viewDimension;
+	return true;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * What the pipelines need to know about the resources of WGSL shaders, read from
+ * their (preprocessed) source rather than replicated by hand next to each one:
+ * the bind group layout entries of the bound variables, with the stages whose
+ * entry points reach them, the tight minBindingSize of buffers, and the layout of
+ * structures in the host-shareable address spaces.
+ *
+ * Only declarations are parsed, bodies being scanned for the names they refer to,
+ * which is enough for the shaders of this project but no substitute for a WGSL
+ * front end: a source that does not parse is reported, not diagnosed.
+ *
+ * Several sources may be added, e.g. all the shaders sharing a set of layouts, whose
+ * bindings then merge, each getting the stages of every entry point using it.
+ * Uniform structures are still written in C++ too (see Application.h), which
+ * checkStruct() compares against the shader's layout.
+ */
+class ShaderReflection {
+public:
+	/**
+	 * A member of a structure, with its offset and size following the WGSL
+	 * alignment rules (vec3 aligned like vec4, arrays and structures rounded up to
+	 * their alignment, and so on)
+	 */
+	struct Member {
+		std::string name;
+		std::string type;
+		uint32_t offset = 0;
+		uint32_t size = 0;
+	};
+
+	struct Struct {
+		std::vector<Member> members;
+		uint32_t size = 0;
+		uint32_t alignment = 0;
+	};
+
+	/**
+	 * An input of a vertex entry point, at a shader location
+	 */
+	struct VertexInput {
+		uint32_t location = 0;
+		std::string name;
+		std::string type;
+	};
+
+	// Add the declarations of `source`, or return false if they could not be parsed
+	bool add(std::string_view source);
+	void clear();
+
+	// Null for structures that were not declared, or that have no host-shareable layout
+	const Struct* findStruct(std::string_view name) const;
+
+	// Entries of the variables of `group`, ordered by binding. Nothing in WGSL tells buffers
+	// bound at dynamic offsets, which are left to the caller, nor filtering samplers from
+	// non-filtering ones, samplers being assumed to filter and float textures to be filterable.
+	std::vector<wgpu::BindGroupLayoutEntry> bindGroupLayoutEntries(uint32_t group) const;
+
+	// Inputs of the vertex entry point `entryPoint`, from its parameters and their structures
+	std::vector<VertexInput> vertexInputs(std::string_view entryPoint) const;
+
+	// Whether a structure of `size` bytes with members at `offsets` can hold the WGSL
+	// structure `name` of the same layout, printing the differences otherwise
+	bool checkStruct(std::string_view name, size_t size, std::initializer_list<std::pair<std::string_view, size_t>> offsets = {}) const;
+
+	// Whether `buffers` provide every input of `entryPoint`, with formats of the same kind of
+	// scalars (float, signed or unsigned), printing those missing otherwise
+	bool checkVertexBuffers(std::string_view entryPoint, std::span<const wgpu::VertexBufferLayout> buffers) const;
+
+private:
+	/**
+	 * A member or parameter as declared, with the attributes that matter here
+	 */
+	struct Declaration {
+		std::string name;
+		std::string type;
+		// Of @location, -1 without one
+		int32_t location = -1;
+		// Of @align and @size, 0 without them
+		uint32_t align = 0;
+		uint32_t size = 0;
+	};
+
+	/**
+	 * A resource variable, at a group and binding
+	 */
+	struct Binding {
+		std::string name;
+		std::string type;
+		wgpu::BindGroupLayoutEntry entry;
+	};
+
+	/**
+	 * A function, and the names its body refers to
+	 */
+	struct Function {
+		std::vector<Declaration> parameters;
+		std::vector<std::string> references;
+		// Vertex, Fragment or Compute for entry points, None for others
+		WGPUShaderStageFlags stage = wgpu::ShaderStage::None;
+	};
+
+	// Size and alignment of `type`, the size of a runtime-sized array being that of one element
+	bool layout(std::string_view type, uint32_t& size, uint32_t& alignment, int depth = 0);
+	bool layoutStruct(const std::string& name, int depth);
+	// Whether `members` are the first ones of `of`
+	static bool isPrefix(const std::vector<Declaration>& members, const std::vector<Declaration>& of);
+	// Stages of the entry points among `functions` whose calls reach the variable `name`
+	static WGPUShaderStageFlags visibility(const std::map<std::string, Function, std::less<>>& functions, const std::string& name);
+	// Type and size of the binding of a variable, or false if it has none
+	bool bindingEntry(const std::string& addressSpace, const std::string& access, const std::string& type, wgpu::BindGroupLayoutEntry& entry);
+
+private:
+	std::map<std::string, std::vector<Declaration>, std::less<>> mStructDeclarations;
+	// Those of the declarations that have a host-shareable layout
+	std::map<std::string, Struct, std::less<>> mStructs;
+	std::map<std::string, std::string, std::less<>> mAliases;
+	std::map<std::string, uint32_t, std::less<>> mConstants;
+	std::map<std::pair<uint32_t, uint32_t>, Binding> mBindings;
+	// Parameters of the entry points, functions being only kept while their source is added
+	std::map<std::string, std::vector<Declaration>, std::less<>> mEntryPoints;
+};
@@ -0,0 +1,389 @@
+#include "ShadingRate.h"
+#include "FullscreenTriangle.h"
+#include "GpuMemory.h"
+
+#include <glm/ext.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// Sample 0 of multisampled depths, which is enough to tell edges apart
+const char* depthLoadSource = R"(
+@group(0) @binding(2) var depthTexture: texture_depth_2d;
+
+fn loadDepth(pixel: vec2u) -> f32 {
+	return textureLoad(depthTexture, pixel, 0);
+}
+)";
+
+const char* multisampledDepthLoadSource = R"(
+@group(0) @binding(2) var depthTexture: texture_depth_multisampled_2d;
+
+fn loadDepth(pixel: vec2u) -> f32 {
+	return textureLoad(depthTexture, pixel, 0);
+}
+)";
+
+const char* shadingRateShaderSource = R"(
+/**
+ * Same as ShadingRate::Uniforms
+ */
+struct ShadingRateUniforms {
+	reprojection: mat4x4f,
+	sceneSize: vec2u,
+	tileStride: u32,
+	threshold: f32,
+	motionScale: f32,
+};
+
+const TileSize = 16u;
+const FullRate = 0u;
+const HalfRate = 1u;
+const QuarterRate = 2u;
+
+@group(0) @binding(0) var<uniform> uShadingRate: ShadingRateUniforms;
+@group(0) @binding(1) var scene: texture_2d<f32>;
+
+fn rateAt(pixel: vec2u) -> u32 {
+	let tile = pixel / TileSize;
+	return shadingRates[tile.y * uShadingRate.tileStride + tile.x];
+}
+
+// Same as skippedByShadingRate in shader.wgsl
+fn skipped(pixel: vec2u) -> bool {
+	let rate = rateAt(pixel);
+	if (rate == HalfRate) {
+		return ((pixel.x + pixel.y) & 1u) != 0u;
+	}
+	if (rate == QuarterRate) {
+		return ((pixel.x | pixel.y) & 1u) != 0u;
+	}
+	return false;
+}
+
+fn luminance(pixel: vec2u) -> f32 {
+	let color = textureLoad(scene, min(pixel, uShadingRate.sceneSize - 1u), 0).rgb;
+	return dot(color, vec3f(0.2126, 0.7152, 0.0722));
+}
+)";
+
+const char* classifyShaderSource = R"(
+@group(0) @binding(3) var<storage, read_write> shadingRates: array<u32>;
+
+// Squared luminance differences, luminance and motion of each pixel of the tile, summed up
+var<workgroup> sums: array<vec3f, 256>;
+
+// A workgroup per tile
+@compute @workgroup_size(16, 16)
+fn classify(
+	@builtin(global_invocation_id) id: vec3u,
+	@builtin(workgroup_id) tile: vec3u,
+	@builtin(local_invocation_index) index: u32
+) {
+	let size = uShadingRate.sceneSize;
+	var pixelSums = vec3f(0.0);
+	if (all(id.xy < size)) {
+		let center = luminance(id.xy);
+		let dx = luminance(id.xy + vec2u(1u, 0u)) - center;
+		let dy = luminance(id.xy + vec2u(0u, 1u)) - center;
+
+		// Where the surface was in the previous frame, from its depth
+		let uv = (vec2f(id.xy) + 0.5) / vec2f(size);
+		let ndc = vec4f(2.0 * uv.x - 1.0, 1.0 - 2.0 * uv.y, loadDepth(id.xy), 1.0);
+		let previous = uShadingRate.reprojection * ndc;
+		var motion = 0.0;
+		if (previous.w > 0.0) {
+			let previousUv = vec2f(0.5, -0.5) * previous.xy / previous.w + 0.5;
+			motion = length((previousUv - uv) * vec2f(size));
+		}
+		pixelSums = vec3f(dx * dx + dy * dy, center, motion);
+	}
+	sums[index] = pixelSums;
+	workgroupBarrier();
+	for (var stride = 128u; stride > 0u; stride >>= 1u) {
+		if (index < stride) {
+			sums[index] += sums[index + stride];
+		}
+		workgroupBarrier();
+	}
+
+	if (index == 0u) {
+		let corner = tile.xy * TileSize;
+		let extent = min(size - corner, vec2u(TileSize));
+		let means = sums[0] / f32(extent.x * extent.y);
+		// Quarter rate interpolates over 2 pixels, where the checkerboard of half rate
+		// interpolates over 1, with about half the error
+		let error = sqrt(means.x);
+		let threshold = uShadingRate.threshold * (means.y + 0.05) * (1.0 + means.z / uShadingRate.motionScale);
+		var rate = FullRate;
+		if (error < threshold) {
+			rate = QuarterRate;
+		}
+		else if (error < 2.0 * threshold) {
+			rate = HalfRate;
+		}
+		shadingRates[tile.y * uShadingRate.tileStride + tile.x] = rate;
+	}
+}
+)";
+
+const char* upsampleShaderSource = R"(
+@group(0) @binding(3) var<storage, read> shadingRates: array<u32>;
+
+// Skipped pixels blend the shaded ones around them, bilinearly over the quads of quarter rate
+// and from the 4 direct neighbours of the checkerboard of half rate. Neighbours across a depth
+// discontinuity barely count, so that surfaces do not bleed into each other.
+@fragment
+fn fs_upsample(@builtin(position) position: vec4f) -> @location(0) vec4f {
+	let pixel = vec2u(position.xy);
+	if (!skipped(pixel)) {
+		return textureLoad(scene, pixel, 0);
+	}
+
+	let size = vec2i(uShadingRate.sceneSize);
+	let centerDepth = loadDepth(pixel);
+	// Repeated where the pixel is aligned with the quad on one axis, which weighs them bilinearly
+	var neighbours: array<vec2i, 4>;
+	if (rateAt(pixel) == HalfRate) {
+		let p = vec2i(pixel);
+		neighbours = array<vec2i, 4>(p - vec2i(1, 0), p + vec2i(1, 0), p - vec2i(0, 1), p + vec2i(0, 1));
+	}
+	else {
+		let base = vec2i(pixel & vec2u(~1u));
+		let odd = vec2i(pixel & vec2u(1u));
+		neighbours = array<vec2i, 4>(base, base + vec2i(2 * odd.x, 0), base + vec2i(0, 2 * odd.y), base + 2 * odd);
+	}
+
+	var color = vec4f(0.0);
+	var totalWeight = 0.0;
+	for (var i = 0u; i < 4u; i++) {
+		let neighbour = vec2u(clamp(neighbours[i], vec2i(0), size - 1));
+		if (skipped(neighbour)) {
+			continue;
+		}
+		let weight = 1.0 / (1e-4 + abs(loadDepth(neighbour) - centerDepth));
+		color += weight * textureLoad(scene, neighbour, 0);
+		totalWeight += weight;
+	}
+	if (totalWeight == 0.0) {
+		return textureLoad(scene, pixel, 0);
+	}
+	return color / totalWeight;
+}
+)";
+
+} // anonymous namespace
+
+ShadingRate::ShadingRate(Device device, PipelineCache& pipelineCache, TextureFormat sceneFormat, uint32_t sampleCount)
+	: mDevice(device)
+{
+	SupportedLimits supportedLimits;
+	device.getLimits(&supportedLimits);
+	uint32_t maxSize = supportedLimits.limits.maxTextureDimension2D;
+	mUniforms.tileStride = (maxSize + TileSize - 1) / TileSize;
+	mUniforms.threshold = 0.04f;
+	mUniforms.motionScale = 4.0f;
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Shading rate uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ShadingRate");
+
+	// Zero, full rate, until classified
+	bufferDesc.label = "Shading rates";
+	bufferDesc.size = uint64_t(mUniforms.tileStride) * mUniforms.tileStride * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+	mRateBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::RenderTargets, "ShadingRate");
+	if (!mUniformBuffer || !mRateBuffer) return;
+
+	// The classification reads the complete scene and writes the rates, the upsampling reads
+	// the sparse one and the rates
+	bool multisampled = sampleCount > 1;
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(4, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].texture.sampleType = TextureSampleType::Depth;
+	bindingLayoutEntries[2].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].texture.multisampled = multisampled;
+	bindingLayoutEntries[3].binding = 3;
+	bindingLayoutEntries[3].buffer.type = BufferBindingType::Storage;
+	bindingLayoutEntries[3].buffer.minBindingSize = sizeof(uint32_t);
+	for (BindGroupLayoutEntry& entry : bindingLayoutEntries) entry.visibility = ShaderStage::Compute;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mClassifyBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	for (BindGroupLayoutEntry& entry : bindingLayoutEntries) entry.visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[3].buffer.type = BufferBindingType::ReadOnlyStorage;
+	mUpsampleBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	std::string depthSource = multisampled ? multisampledDepthLoadSource : depthLoadSource;
+	std::string commonSource = depthSource + shadingRateShaderSource;
+	ShaderModule classifyModule = pipelineCache.shaderModule(commonSource + classifyShaderSource);
+	ShaderModule upsampleModule = pipelineCache.shaderModule(FullscreenTriangle::VertexShaderSource + commonSource + upsampleShaderSource);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mClassifyBindGroupLayout;
+	ComputePipelineDescriptor computePipelineDesc{};
+	computePipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	computePipelineDesc.compute.module = classifyModule;
+	computePipelineDesc.compute.entryPoint = "classify";
+	computePipelineDesc.compute.constantCount = 0;
+	computePipelineDesc.compute.constants = nullptr;
+	mClassifyPipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mUpsampleBindGroupLayout;
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	FullscreenTriangle::setPipelineStates(pipelineDesc, upsampleModule);
+
+	FragmentState fragmentState{};
+	fragmentState.module = upsampleModule;
+	fragmentState.entryPoint = "fs_upsample";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	ColorTargetState colorTarget{};
+	colorTarget.format = sceneFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+	mUpsamplePipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+ShadingRate::~ShadingRate() {
+	if (mClassifyBindGroup) mClassifyBindGroup.release();
+	if (mUpsampleBindGroup) mUpsampleBindGroup.release();
+	for (Buffer* buffer : { &mRateBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+void ShadingRate::update(Queue queue, const glm::mat4& viewProjection, const glm::uvec2& sceneSize) {
+	// No motion in the first frame
+	if (mFirstUpdate) mPreviousViewProjection = viewProjection;
+	mFirstUpdate = false;
+	Uniforms uniforms = mUniforms;
+	uniforms.reprojection = mPreviousViewProjection * glm::inverse(viewProjection);
+	uniforms.sceneSize = glm::max(sceneSize, glm::uvec2(1));
+	mPreviousViewProjection = viewProjection;
+	if (std::memcmp(&uniforms, &mUniforms, sizeof(Uniforms)) == 0) return;
+	mUniforms = uniforms;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+bool ShadingRate::upsample(
+	CommandEncoder encoder, TextureView sparseSceneView, TextureView depthView, TextureView targetView,
+	const RenderPassTimestampWrites* timestampWrites
+) {
+	if (!ready()) return false;
+
+	if (sparseSceneView != mUpsampleSceneView || depthView != mUpsampleDepthView) {
+		if (mUpsampleBindGroup) mUpsampleBindGroup.release();
+		std::vector<BindGroupEntry> bindings(4);
+		bindings[0].binding = 0;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(Uniforms);
+		bindings[1].binding = 1;
+		bindings[1].textureView = sparseSceneView;
+		bindings[2].binding = 2;
+		bindings[2].textureView = depthView;
+		bindings[3].binding = 3;
+		bindings[3].buffer = mRateBuffer;
+		bindings[3].offset = 0;
+		bindings[3].size = mRateBuffer.getSize();
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mUpsampleBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mUpsampleBindGroup = mDevice.createBindGroup(bindGroupDesc);
+		mUpsampleSceneView = sparseSceneView;
+		mUpsampleDepthView = depthView;
+	}
+
+	// Every pixel of the region is written, shaded ones as they are
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = targetView;
+	colorAttachment.resolveTarget = nullptr;
+	colorAttachment.loadOp = LoadOp::Clear;
+	colorAttachment.storeOp = StoreOp::Store;
+	colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Shading rate upsample";
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &colorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = timestampWrites;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	const glm::uvec2& size = mUniforms.sceneSize;
+	FullscreenTriangle::draw(renderPass, mUpsamplePipeline->pipeline, mUpsampleBindGroup, size.x, size.y);
+	renderPass.end();
+	renderPass.release();
+	return true;
+}
+
+bool ShadingRate::classify(CommandEncoder encoder, TextureView sceneView, TextureView depthView, const ComputePassTimestampWrites* timestampWrites) {
+	if (!ready()) return false;
+
+	if (sceneView != mClassifySceneView || depthView != mClassifyDepthView) {
+		if (mClassifyBindGroup) mClassifyBindGroup.release();
+		std::vector<BindGroupEntry> bindings(4);
+		bindings[0].binding = 0;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(Uniforms);
+		bindings[1].binding = 1;
+		bindings[1].textureView = sceneView;
+		bindings[2].binding = 2;
+		bindings[2].textureView = depthView;
+		bindings[3].binding = 3;
+		bindings[3].buffer = mRateBuffer;
+		bindings[3].offset = 0;
+		bindings[3].size = mRateBuffer.getSize();
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mClassifyBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mClassifyBindGroup = mDevice.createBindGroup(bindGroupDesc);
+		mClassifySceneView = sceneView;
+		mClassifyDepthView = depthView;
+	}
+
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Shading rate classification";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mClassifyPipeline->pipeline);
+	computePass.setBindGroup(0, mClassifyBindGroup, 0, nullptr);
+	const glm::uvec2& size = mUniforms.sceneSize;
+	computePass.dispatchWorkgroups((size.x + TileSize - 1) / TileSize, (size.y + TileSize - 1) / TileSize, 1);
+	computePass.end();
+	computePass.release();
+	return true;
+}
+
+void ShadingRate::reset(CommandEncoder encoder) {
+	encoder.clearBuffer(mRateBuffer, 0, mRateBuffer.getSize());
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+
+#include <cstdint>
+
+/**
+ * Variable rate shading, emulated as WebGPU has none: each TileSize x TileSize
+ * tile of the scene is shaded at full, half or quarter rate, the rates of a frame
+ * being classified from the previous one.
+ *
+ * After the scene is drawn, a compute pass estimates for each tile how much
+ * shading fewer pixels would lose, from the luminance differences between its
+ * neighbouring pixels relative to its brightness, and how far it moved on screen
+ * since the frame before, reprojecting its depths: moving tiles tolerate a coarser
+ * rate. The rates land in rateBuffer(), one u32 per tile at a row stride of
+ * tileStride(), which the next frame's draws read (see SHADING_RATE in
+ * resources/shader.wgsl).
+ *
+ * Fragments of tiles at a reduced rate only run the shading of every other pixel
+ * in a checkerboard for half rate, and of one pixel in each 2x2 quad for quarter
+ * rate, the others writing their depth and no color. upsample() then fills the
+ * skipped pixels from their shaded neighbours, weighed by depth similarity so
+ * that colors do not bleed across edges.
+ */
+class ShadingRate {
+public:
+	static constexpr uint32_t TileSize = 16;
+	// Values of rateBuffer()
+	static constexpr uint32_t FullRate = 0;
+	static constexpr uint32_t HalfRate = 1;
+	static constexpr uint32_t QuarterRate = 2;
+
+	/**
+	 * The ShadingRateUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		// From the clip space of the frame to the one of the frame before
+		glm::mat4 reprojection;
+		glm::uvec2 sceneSize;
+		uint32_t tileStride;
+		// Root mean square of the luminance differences between neighbouring pixels, relative to
+		// the luminance of the tile, below which a still tile is shaded at quarter rate, and at
+		// half rate up to twice as much
+		float threshold;
+		// Pixels per frame of motion that double the threshold
+		float motionScale;
+		uint32_t _pad[3];
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	// For a scene of `sceneFormat` drawn with a depth buffer of `sampleCount` samples, the tiles
+	// covering up to the largest texture the device allows so that resizes keep the buffers
+	ShadingRate(wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureFormat sceneFormat, uint32_t sampleCount);
+	~ShadingRate();
+
+	ShadingRate(const ShadingRate&) = delete;
+	ShadingRate& operator=(const ShadingRate&) = delete;
+
+	bool valid() const { return mRateBuffer != nullptr; }
+	// Whether the pipelines are built, before which classify() and upsample() record nothing
+	bool ready() const { return mClassifyPipeline->ready() && mUpsamplePipeline->ready(); }
+
+	// Bound with the view of the draws, as read-only storage for the rates
+	wgpu::Buffer uniformBuffer() const { return mUniformBuffer; }
+	wgpu::Buffer rateBuffer() const { return mRateBuffer; }
+	uint32_t tileStride() const { return mUniforms.tileStride; }
+
+	// Projection * view * model matrix and region of the scene drawn this frame, before the
+	// passes using them, reprojecting into those of the previous call
+	void update(wgpu::Queue queue, const glm::mat4& viewProjection, const glm::uvec2& sceneSize);
+
+	// Fill the skipped pixels of the scene drawn into `sparseSceneView` along with `depthView`,
+	// writing every pixel of the scene region to `targetView`, or return false if not ready
+	bool upsample(
+		wgpu::CommandEncoder encoder, wgpu::TextureView sparseSceneView, wgpu::TextureView depthView, wgpu::TextureView targetView,
+		const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr
+	);
+	// Classify the tiles of the complete scene in `sceneView` and `depthView` for the next frame,
+	// or return false if not ready
+	bool classify(
+		wgpu::CommandEncoder encoder, wgpu::TextureView sceneView, wgpu::TextureView depthView,
+		const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr
+	);
+	// Shade every tile at full rate until the next classify()
+	void reset(wgpu::CommandEncoder encoder);
+
+private:
+	wgpu::Device mDevice;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mClassifyBindGroupLayout = nullptr;
+	wgpu::BindGroupLayout mUpsampleBindGroupLayout = nullptr;
+	PipelineCache::AsyncComputePipeline mClassifyPipeline;
+	PipelineCache::AsyncRenderPipeline mUpsamplePipeline;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::Buffer mRateBuffer = nullptr;
+	Uniforms mUniforms{};
+	// Of the last update(), identity until the first one
+	glm::mat4 mPreviousViewProjection = glm::mat4(1.0f);
+	bool mFirstUpdate = true;
+
+	// Bind groups of the last views, which keep them alive
+	wgpu::TextureView mClassifySceneView = nullptr;
+	wgpu::TextureView mClassifyDepthView = nullptr;
+	wgpu::BindGroup mClassifyBindGroup = nullptr;
+	wgpu::TextureView mUpsampleSceneView = nullptr;
+	wgpu::TextureView mUpsampleDepthView = nullptr;
+	wgpu::BindGroup mUpsampleBindGroup = nullptr;
+};
@@ -0,0 +1,306 @@
+#include "ShadowMaps.h"
+#include "GpuMemory.h"
+#include "DepthConvention.h"
+
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace wgpu;
+
+namespace {
+
+// Weight of the logarithmic distribution of cascade ends, against the uniform one
+constexpr float splitLambda = 0.7f;
+// Half width of a cascade relative to the radius of its slice, leaving room for snapping
+constexpr float cascadeMargin = 1.25f;
+// Grid cells per cascade width, a whole number of texels for any power of 2 resolution
+constexpr float snapCellCount = 8.0f;
+
+// Smallest power of sqrt(2) that is at least x, for sizes to only change in steps
+float quantizeUp(float x) {
+	return std::exp2(std::ceil(2.0f * std::log2(x)) * 0.5f);
+}
+
+Texture createDepthArray(Device device, uint32_t resolution, WGPUTextureUsageFlags usage, const char* label) {
+	TextureDescriptor textureDesc{};
+	textureDesc.label = label;
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = ShadowMaps::DepthFormat;
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.size = { resolution, resolution, ShadowMaps::CascadeCount };
+	textureDesc.usage = usage;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	return createTrackedTexture(device, textureDesc, GpuMemoryCategory::RenderTargets, "ShadowMaps");
+}
+
+TextureView createLayerView(Texture texture, uint32_t baseLayer, uint32_t layerCount, TextureViewDimension dimension) {
+	TextureViewDescriptor viewDesc{};
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.baseArrayLayer = baseLayer;
+	viewDesc.arrayLayerCount = layerCount;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = dimension;
+	viewDesc.format = ShadowMaps::DepthFormat;
+	return texture.createView(viewDesc);
+}
+
+} // anonymous namespace
+
+ShadowMaps::ShadowMaps(Device device, uint32_t resolution)
+	: mDevice(device)
+	, mResolution(resolution)
+{
+	mTexture = createDepthArray(device, resolution, TextureUsage::RenderAttachment | TextureUsage::TextureBinding | TextureUsage::CopyDst, "Shadow maps");
+	if (!mTexture) return;
+	mView = createLayerView(mTexture, 0, CascadeCount, TextureViewDimension::_2DArray);
+	for (uint32_t cascade = 0; cascade < CascadeCount; ++cascade) {
+		mLayerViews[cascade] = createLayerView(mTexture, cascade, 1, TextureViewDimension::_2D);
+	}
+
+	// Never written before the first update() but zero-initialized, with cascade ends of 0
+	// that leave everything lit
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Shadow uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ShadowMaps");
+
+	// 256 is the largest minUniformBufferOffsetAlignment allowed
+	bufferDesc.label = "Shadow caster views";
+	bufferDesc.size = CascadeCount * mCasterViewStride;
+	mCasterViewBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ShadowMaps");
+}
+
+ShadowMaps::~ShadowMaps() {
+	for (Buffer* buffer : { &mCasterViewBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+	for (std::array<TextureView, CascadeCount>* views : { &mLayerViews, &mStaticLayerViews }) {
+		for (TextureView& view : *views) {
+			if (view) view.release();
+		}
+	}
+	if (mView) mView.release();
+	for (Texture* texture : { &mTexture, &mStaticTexture }) {
+		if (!*texture) continue;
+		destroyTracked(*texture);
+		texture->release();
+	}
+}
+
+void ShadowMaps::setLightDirection(const glm::vec3& direction) {
+	mLightDirection = glm::normalize(direction);
+	mUniforms.lightDirection = glm::vec4(mLightDirection, 0.0f);
+}
+
+void ShadowMaps::setDynamicCasters(bool dynamicCasters) {
+	// Layers hold the last dynamic casters drawn, over which static ones are rendered again
+	if (mDynamicCasters && !dynamicCasters) ++mStaticVersion;
+	mDynamicCasters = dynamicCasters;
+	// Only allocated once there are dynamic casters to draw over it
+	if (mDynamicCasters && !mStaticTexture) {
+		mStaticTexture = createDepthArray(mDevice, mResolution, TextureUsage::RenderAttachment | TextureUsage::CopySrc, "Shadow maps static casters");
+		if (!mStaticTexture) {
+			mDynamicCasters = false;
+			return;
+		}
+		for (uint32_t cascade = 0; cascade < CascadeCount; ++cascade) {
+			mStaticLayerViews[cascade] = createLayerView(mStaticTexture, cascade, 1, TextureViewDimension::_2D);
+		}
+	}
+}
+
+ShadowMaps::Cascade ShadowMaps::fitCascade(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float near, float far, const glm::vec4& sceneSphere) const {
+	// Bounding sphere of the slice of the frustum, on its axis: the nearest to center c of
+	// the corners at distances n and f, which are at t * n and t * f off the axis, are
+	// equally far from c for c = (n + f) / 2 * (1 + t^2), or at f when that is beyond it
+	float tanX = 1.0f / projectionMatrix[0][0];
+	float tanY = 1.0f / projectionMatrix[1][1];
+	float t2 = tanX * tanX + tanY * tanY;
+	float centerDistance = 0.5f * (near + far) * (1.0f + t2);
+	float radius = 0.0f;
+	if (centerDistance >= far) {
+		centerDistance = far;
+		radius = far * std::sqrt(t2);
+	}
+	else {
+		radius = std::sqrt((far - centerDistance) * (far - centerDistance) + far * far * t2);
+	}
+
+	glm::mat4 cameraMatrix = glm::inverse(viewMatrix);
+	glm::vec3 forward = -glm::normalize(glm::vec3(cameraMatrix[2]));
+	glm::vec3 center = glm::vec3(cameraMatrix[3]) + centerDistance * forward;
+
+	// Looking from the light, any up vector not along it
+	glm::vec3 up = std::abs(mLightDirection.z) < 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), -mLightDirection, up);
+
+	float halfSize = cascadeMargin * quantizeUp(radius);
+	float cellSize = 2.0f * halfSize / snapCellCount;
+	glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+	lightCenter.x = std::floor(lightCenter.x / cellSize + 0.5f) * cellSize;
+	lightCenter.y = std::floor(lightCenter.y / cellSize + 0.5f) * cellSize;
+
+	// Depths span the whole scene, for casters out of the slice to occlude it too
+	float sceneDepth = glm::vec3(lightRotation * glm::vec4(glm::vec3(sceneSphere), 1.0f)).z;
+	float sceneRadius = std::max(sceneSphere.w, 1e-6f);
+
+	Cascade cascade;
+	cascade.view.viewMatrix = glm::translate(glm::mat4(1.0f), -glm::vec3(lightCenter.x, lightCenter.y, sceneDepth + sceneRadius)) * lightRotation;
+	cascade.view.projectionMatrix = glm::ortho(-halfSize, halfSize, -halfSize, halfSize, 0.0f, 2.0f * sceneRadius);
+	cascade.end = far;
+	cascade.texelSize = 2.0f * halfSize / static_cast<float>(mResolution);
+	return cascade;
+}
+
+void ShadowMaps::update(Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::vec4& sceneSphere) {
+	mUpdateMask = 0;
+	mStaticUpdateMask = 0;
+	if (!valid() || sceneSphere.w <= 0.0f) return;
+
+	// Planes of a perspective projection with depths from 0 to 1, the far one being infinite
+	// with reversed Z
+	glm::vec2 clipPlanes = DepthConvention::clipPlanes(projectionMatrix);
+	float near = clipPlanes.x;
+	float far = clipPlanes.y;
+
+	// Shadows stop where the scene does, the distance changing in steps for cascades to
+	// stay the same while the camera moves a bit
+	glm::vec3 cameraPosition = glm::vec3(glm::inverse(viewMatrix)[3]);
+	float sceneEnd = glm::length(glm::vec3(sceneSphere) - cameraPosition) + sceneSphere.w;
+	float distance = std::min(far, quantizeUp(std::max(sceneEnd, 2.0f * near)));
+
+	std::array<Cascade, CascadeCount> fitted;
+	float sliceNear = near;
+	for (uint32_t i = 0; i < CascadeCount; ++i) {
+		float k = static_cast<float>(i + 1) / static_cast<float>(CascadeCount);
+		float logarithmic = near * std::pow(distance / near, k);
+		float uniform = near + (distance - near) * k;
+		float sliceFar = splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+		fitted[i] = fitCascade(viewMatrix, projectionMatrix, sliceNear, sliceFar, sceneSphere);
+		sliceNear = sliceFar;
+	}
+
+	auto staticDirty = [&](uint32_t i) {
+		const Cascade& cascade = mCascades[i];
+		bool moved = fitted[i].view.viewMatrix != cascade.view.viewMatrix || fitted[i].view.projectionMatrix != cascade.view.projectionMatrix;
+		return !cascade.rendered || moved || cascade.staticVersion != mStaticVersion || (mDynamicCasters && !cascade.cached);
+	};
+	auto needsUpdate = [&](uint32_t i) {
+		return staticDirty(i) || mDynamicCasters || fitted[i].end != mCascades[i].end;
+	};
+
+	// The first cascade whenever it needs it, then at most one of the farther ones, in turns,
+	// those never rendered being taken first
+	std::array<bool, CascadeCount> updated = {};
+	if (mReducedUpdates) {
+		// Or one of all of them, the first one included
+		for (uint32_t k = 0; k < CascadeCount; ++k) {
+			uint32_t i = (mNextReducedCascade + k) % CascadeCount;
+			if (!needsUpdate(i)) continue;
+			updated[i] = true;
+			mNextReducedCascade = (i + 1) % CascadeCount;
+			break;
+		}
+	}
+	else {
+		updated[0] = needsUpdate(0);
+		bool staggeredUpdated = false;
+		for (uint32_t i = 1; i < CascadeCount; ++i) {
+			if (!mCascades[i].rendered) {
+				updated[i] = true;
+				staggeredUpdated = true;
+			}
+		}
+		for (uint32_t k = 0; k < CascadeCount - 1 && !staggeredUpdated; ++k) {
+			uint32_t i = 1 + (mNextStaggeredCascade - 1 + k) % (CascadeCount - 1);
+			if (!needsUpdate(i)) continue;
+			updated[i] = true;
+			staggeredUpdated = true;
+			mNextStaggeredCascade = 1 + i % (CascadeCount - 1);
+		}
+	}
+
+	for (uint32_t i = 0; i < CascadeCount; ++i) {
+		if (!updated[i]) continue;
+		bool staticCasters = staticDirty(i);
+		fitted[i].rendered = true;
+		fitted[i].staticVersion = mStaticVersion;
+		fitted[i].cached = mDynamicCasters && (staticCasters || mCascades[i].cached);
+		mCascades[i] = fitted[i];
+
+		mUpdateMask |= 1u << i;
+		if (staticCasters) mStaticUpdateMask |= 1u << i;
+		mUniforms.lightMatrices[i] = fitted[i].view.projectionMatrix * fitted[i].view.viewMatrix;
+		mUniforms.cascadeEnds[i] = fitted[i].end;
+		mUniforms.texelSizes[i] = fitted[i].texelSize;
+		queue.writeBuffer(mCasterViewBuffer, i * mCasterViewStride, &fitted[i].view, sizeof(CasterView));
+	}
+	if (mUpdateMask != 0) {
+		mUniforms.lightDirection = glm::vec4(mLightDirection, 0.0f);
+		queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+	}
+}
+
+void ShadowMaps::encode(CommandEncoder encoder, const DrawCasters& drawCasters, GpuProfiler& profiler) {
+	auto renderCasters = [&](TextureView target, uint32_t cascade, bool staticCasters) {
+		RenderPassDepthStencilAttachment depthAttachment{};
+		depthAttachment.view = target;
+		depthAttachment.depthClearValue = 1.0f;
+		depthAttachment.depthLoadOp = staticCasters ? LoadOp::Clear : LoadOp::Load;
+		depthAttachment.depthStoreOp = StoreOp::Store;
+		depthAttachment.depthReadOnly = false;
+		depthAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+		depthAttachment.stencilLoadOp = LoadOp::Clear;
+		depthAttachment.stencilStoreOp = StoreOp::Store;
+#else
+		depthAttachment.stencilLoadOp = LoadOp::Undefined;
+		depthAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif // ! WGPU BACKEND
+		depthAttachment.stencilReadOnly = true;
+
+		RenderPassDescriptor passDesc{};
+		passDesc.label = staticCasters ? "Shadow static casters" : "Shadow dynamic casters";
+		passDesc.colorAttachmentCount = 0;
+		passDesc.colorAttachments = nullptr;
+		passDesc.depthStencilAttachment = &depthAttachment;
+		RenderPassTimestampWrites timestampWrites;
+		passDesc.timestampWrites = profiler.renderPass(passDesc.label, timestampWrites);
+		RenderPassEncoder pass = encoder.beginRenderPass(passDesc);
+		drawCasters(pass, cascade, staticCasters);
+		pass.end();
+		pass.release();
+	};
+
+	for (uint32_t cascade = 0; cascade < CascadeCount; ++cascade) {
+		if ((mUpdateMask & (1u << cascade)) == 0) continue;
+		bool staticCasters = (mStaticUpdateMask & (1u << cascade)) != 0;
+		if (!mDynamicCasters) {
+			// Nothing to draw over them, static casters go straight to the sampled layer
+			if (staticCasters) renderCasters(mLayerViews[cascade], cascade, true);
+			continue;
+		}
+
+		if (staticCasters) renderCasters(mStaticLayerViews[cascade], cascade, true);
+		ImageCopyTexture source = Default;
+		source.texture = mStaticTexture;
+		source.mipLevel = 0;
+		source.origin = { 0, 0, cascade };
+		source.aspect = TextureAspect::All;
+		ImageCopyTexture destination = source;
+		destination.texture = mTexture;
+		encoder.copyTextureToTexture(source, destination, { mResolution, mResolution, 1 });
+		renderCasters(mLayerViews[cascade], cascade, false);
+	}
+	mUpdateMask = 0;
+	mStaticUpdateMask = 0;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "GpuProfiler.h"
+
+#include <array>
+#include <functional>
+#include <cstdint>
+
+/**
+ * Cascaded shadow maps of a directional light, whose shadow casters are rendered
+ * again only when what they show changed.
+ *
+ * Each cascade is a layer of a depth texture array, covering a slice of the view
+ * frustum. Cascades are sized by the slice they cover, quantized so that zooming
+ * does not resize them at every step, and their center is snapped to a grid of
+ * an eighth of their width, with a margin, so that they stay in place while the
+ * camera moves within a cell. Static casters are rendered into a cached layer
+ * whenever their cascade moves, the light turns or static casters change (see
+ * invalidateStaticCasters). The layer that is sampled is a copy of the cached one
+ * with the dynamic casters drawn over it, made again every frame there are any.
+ *
+ * Cascade 0 is updated every frame it needs it, the farther ones take turns, one
+ * per frame, their matrices being those they were last rendered with until then.
+ * With reduced updates, cascade 0 takes turns with them too.
+ *
+ * Casters are drawn by the application, with the projection and view matrices of
+ * casterViewBuffer() at the offset of the cascade, into a Depth32Float attachment
+ * without color. Depths go from 0 (nearest to the light) to 1 with a Less compare.
+ */
+class ShadowMaps {
+public:
+	static constexpr uint32_t CascadeCount = 3;
+	static constexpr wgpu::TextureFormat DepthFormat = wgpu::TextureFormat::Depth32Float;
+
+	/**
+	 * The ShadowUniforms structure of shader.wgsl, replicated in C++
+	 */
+	struct Uniforms {
+		// From the space of the scene (after the model matrix of the frame) to the clip space
+		// of each cascade, as it was last rendered
+		std::array<glm::mat4, CascadeCount> lightMatrices;
+		// View space distance up to which each cascade is used
+		glm::vec4 cascadeEnds;
+		// Size of a texel of each cascade in scene space, to offset positions along their normal
+		glm::vec4 texelSizes;
+		// Towards the light, normalized
+		glm::vec4 lightDirection;
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	/**
+	 * Matrices of a cascade, laid out like the ViewUniforms of the shaders
+	 */
+	struct CasterView {
+		glm::mat4 projectionMatrix;
+		glm::mat4 viewMatrix;
+		// Casters are never jittered
+		glm::vec2 jitter = glm::vec2(0.0f);
+		float _pad[2] = {};
+	};
+
+	// Casters of `cascade` drawn into `pass`, the static ones or the dynamic ones
+	using DrawCasters = std::function<void(wgpu::RenderPassEncoder pass, uint32_t cascade, bool staticCasters)>;
+
+	// Cascades of `resolution` x `resolution` texels
+	ShadowMaps(wgpu::Device device, uint32_t resolution = 2048);
+	~ShadowMaps();
+
+	ShadowMaps(const ShadowMaps&) = delete;
+	ShadowMaps& operator=(const ShadowMaps&) = delete;
+
+	// Whether the textures and buffers could be created
+	bool valid() const { return mTexture != nullptr && mUniformBuffer != nullptr; }
+
+	// All cascades, to bind as a texture_depth_2d_array
+	wgpu::TextureView view() const { return mView; }
+	// Uniforms, to bind whole
+	wgpu::Buffer uniformBuffer() const { return mUniformBuffer; }
+	// One CasterView per cascade, to bind at dynamic offsets cascade * casterViewStride()
+	wgpu::Buffer casterViewBuffer() const { return mCasterViewBuffer; }
+	uint32_t casterViewStride() const { return mCasterViewStride; }
+
+	// Direction towards the light, in the space of the scene
+	void setLightDirection(const glm::vec3& direction);
+	// To call whenever static casters moved, appeared or disappeared since the last frame
+	void invalidateStaticCasters() { ++mStaticVersion; }
+	// Whether there are dynamic casters to draw every frame, over a cache of the static ones
+	void setDynamicCasters(bool dynamicCasters);
+	// Whether at most one cascade is rendered per frame, the first one included, to spend less
+	// GPU time on shadows
+	void setReducedUpdates(bool reducedUpdates) { mReducedUpdates = reducedUpdates; }
+
+	// Fit the cascades to the camera and pick those to render this frame, uploading their
+	// matrices. `sceneSphere` bounds all casters (center in xyz, radius in w). Each call
+	// must be followed by encode() in the same frame.
+	void update(wgpu::Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::vec4& sceneSphere);
+
+	// Whether update() picked cascades to render
+	bool encodeNeeded() const { return mUpdateMask != 0; }
+
+	// Record the passes rendering the cascades picked by update(), before the passes sampling them
+	void encode(wgpu::CommandEncoder encoder, const DrawCasters& drawCasters, GpuProfiler& profiler);
+
+private:
+	/**
+	 * A cascade as fitted to the camera, or as last rendered
+	 */
+	struct Cascade {
+		CasterView view;
+		float end = 0.0f;
+		float texelSize = 0.0f;
+		// mStaticVersion of the static casters last rendered
+		uint64_t staticVersion = 0;
+		bool rendered = false;
+		// Whether the static layer holds them, the sampled one having them alone otherwise
+		bool cached = false;
+	};
+
+	// Matrices of the cascade covering view distances [near, far]
+	Cascade fitCascade(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float near, float far, const glm::vec4& sceneSphere) const;
+
+private:
+	wgpu::Device mDevice;
+	uint32_t mResolution;
+	// The layers sampled, and while there are dynamic casters a cache of the static ones, copied
+	// under them
+	wgpu::Texture mStaticTexture = nullptr;
+	wgpu::Texture mTexture = nullptr;
+	wgpu::TextureView mView = nullptr;
+	std::array<wgpu::TextureView, CascadeCount> mStaticLayerViews = {};
+	std::array<wgpu::TextureView, CascadeCount> mLayerViews = {};
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::Buffer mCasterViewBuffer = nullptr;
+	uint32_t mCasterViewStride = 256;
+
+	glm::vec3 mLightDirection = glm::vec3(0.0f, 0.0f, 1.0f);
+	uint64_t mStaticVersion = 1;
+	bool mDynamicCasters = false;
+
+	// As last rendered, which the uniforms hold
+	std::array<Cascade, CascadeCount> mCascades;
+	Uniforms mUniforms{};
+	// Cascades to render in the next encode(), and whether their static casters are too
+	uint32_t mUpdateMask = 0;
+	uint32_t mStaticUpdateMask = 0;
+	// Farther cascade whose turn it is
+	uint32_t mNextStaggeredCascade = 1;
+	bool mReducedUpdates = false;
+	// Cascade whose turn it is with reduced updates
+	uint32_t mNextReducedCascade = 0;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+/**
+ * Instruction sets of the SIMD kernels, to include instead of the intrinsics headers so
+ * that every kernel agrees on which ones a build uses.
+ *
+ * The widest instruction set enabled at compile time is used, there is no runtime
+ * dispatch. Exactly one of SIMD_SSE2, SIMD_NEON and SIMD_WASM is defined when 128 bit
+ * vectors are available, along with SIMD_128. SIMD_AVX2 is defined on top of SIMD_SSE2
+ * when AVX2 is enabled, for the kernels that have a wider path to test it first, the
+ * others keeping to SSE2.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#else
+#include <emmintrin.h>
+#endif // __AVX2__
+#define SIMD_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define SIMD_WASM
+#endif
+
+#if defined(SIMD_SSE2) || defined(SIMD_NEON) || defined(SIMD_WASM)
+#define SIMD_128
+#endif
@@ -0,0 +1,285 @@
+#include "Skinning.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+const char* skinningShaderSource = R"(
+struct SkinningUniforms {
+	vertexCount: u32,
+	jointCount: u32,
+	morphTargetCount: u32,
+};
+
+struct MorphDelta {
+	position: vec4f,
+	normal: vec4f,
+};
+
+// VertexAttributes are 11 packed floats (position, normal, color, uv), which WGSL
+// structures cannot match because of the alignment of vec3f
+const vertexStride = 11u;
+
+@group(0) @binding(0) var<uniform> uSkinning: SkinningUniforms;
+@group(0) @binding(1) var<storage, read> restVertices: array<f32>;
+// Joint indices and Unorm8 weights of each vertex
+@group(0) @binding(2) var<storage, read> skin: array<vec2u>;
+@group(0) @binding(3) var<storage, read> morphDeltas: array<MorphDelta>;
+// jointCount matrices per instance
+@group(0) @binding(4) var<storage, read> jointMatrices: array<mat4x4f>;
+// morphTargetCount weights per instance
+@group(0) @binding(5) var<storage, read> morphWeights: array<f32>;
+@group(0) @binding(6) var<storage, read_write> skinnedVertices: array<f32>;
+
+// One invocation per vertex of an instance, instances along y
+@compute @workgroup_size(64)
+fn skinVertices(@builtin(global_invocation_id) id: vec3u) {
+	let vertex = id.x;
+	let instance = id.y;
+	if (vertex >= uSkinning.vertexCount) {
+		return;
+	}
+	let src = vertex * vertexStride;
+	var position = vec3f(restVertices[src], restVertices[src + 1u], restVertices[src + 2u]);
+	var normal = vec3f(restVertices[src + 3u], restVertices[src + 4u], restVertices[src + 5u]);
+
+	// Morph targets apply to the rest pose, before skinning
+	for (var morphTarget = 0u; morphTarget < uSkinning.morphTargetCount; morphTarget++) {
+		let weight = morphWeights[instance * uSkinning.morphTargetCount + morphTarget];
+		if (weight != 0.0) {
+			let delta = morphDeltas[morphTarget * uSkinning.vertexCount + vertex];
+			position += weight * delta.position.xyz;
+			normal += weight * delta.normal.xyz;
+		}
+	}
+
+	let influences = skin[vertex];
+	var weights = unpack4x8unorm(influences.y);
+	weights /= max(dot(weights, vec4f(1.0)), 1e-6);
+	var skinMatrix = mat4x4f();
+	for (var i = 0u; i < 4u; i++) {
+		let joint = (influences.x >> (8u * i)) & 0xFFu;
+		skinMatrix += jointMatrices[instance * uSkinning.jointCount + joint] * weights[i];
+	}
+	position = (skinMatrix * vec4f(position, 1.0)).xyz;
+	normal = normalize((skinMatrix * vec4f(normal, 0.0)).xyz);
+
+	let dst = (instance * uSkinning.vertexCount + vertex) * vertexStride;
+	skinnedVertices[dst] = position.x;
+	skinnedVertices[dst + 1u] = position.y;
+	skinnedVertices[dst + 2u] = position.z;
+	skinnedVertices[dst + 3u] = normal.x;
+	skinnedVertices[dst + 4u] = normal.y;
+	skinnedVertices[dst + 5u] = normal.z;
+	// Color and uv are not animated
+	for (var i = 6u; i < vertexStride; i++) {
+		skinnedVertices[dst + i] = restVertices[src + i];
+	}
+}
+)";
+
+/**
+ * The SkinningUniforms structure of the shader
+ */
+struct SkinningUniforms {
+	uint32_t vertexCount;
+	uint32_t jointCount;
+	uint32_t morphTargetCount;
+	uint32_t _pad;
+};
+
+static_assert(sizeof(ResourceManager::VertexAttributes) == 11 * sizeof(float), "The skinning shader reads vertices as 11 floats");
+
+// A storage buffer holding `data`, or `size` bytes left to be written when it is null.
+// Never empty, for bindings with nothing to read to still have a valid buffer.
+Buffer createStorageBuffer(Device device, const char* label, BufferUsage usage, const void* data, uint64_t size, GpuMemoryCategory category) {
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = label;
+	bufferDesc.usage = usage;
+	bufferDesc.size = (std::max<uint64_t>(size, 16) + 3) & ~uint64_t(3);
+	bufferDesc.mappedAtCreation = data != nullptr;
+	Buffer buffer = createTrackedBuffer(device, bufferDesc, category, "GpuSkinning");
+	if (buffer && data) {
+		std::memcpy(buffer.getMappedRange(0, bufferDesc.size), data, size);
+		buffer.unmap();
+	}
+	return buffer;
+}
+
+} // anonymous namespace
+
+Skeleton::Pose Skeleton::restPose() const {
+	Pose pose;
+	pose.translations.reserve(joints.size());
+	pose.rotations.reserve(joints.size());
+	pose.scales.reserve(joints.size());
+	for (const Joint& joint : joints) {
+		pose.translations.push_back(joint.translation);
+		pose.rotations.push_back(joint.rotation);
+		pose.scales.push_back(joint.scale);
+	}
+	return pose;
+}
+
+void Skeleton::computeJointMatrices(const Pose& pose, glm::mat4* matrices) const {
+	// World transforms first, parents being before their children
+	for (size_t i = 0; i < joints.size(); ++i) {
+		glm::mat4 local = glm::translate(glm::mat4(1.0f), pose.translations[i])
+			* glm::mat4_cast(pose.rotations[i])
+			* glm::scale(glm::mat4(1.0f), pose.scales[i]);
+		int32_t parent = joints[i].parent;
+		matrices[i] = parent >= 0 ? matrices[parent] * local : local;
+	}
+	for (size_t i = 0; i < joints.size(); ++i) {
+		matrices[i] = matrices[i] * joints[i].inverseBindMatrix;
+	}
+}
+
+void AnimationClip::sample(float time, Skeleton::Pose& pose) const {
+	if (duration > 0.0f) time = std::fmod(time, duration);
+	if (time < 0.0f) time += duration;
+
+	for (const Channel& channel : channels) {
+		if (channel.times.empty() || channel.joint >= pose.rotations.size()) continue;
+		// Keyframes k and k + 1 around `time`, clamped to the first and last ones
+		auto next = std::upper_bound(channel.times.begin(), channel.times.end(), time);
+		size_t k1 = std::min(static_cast<size_t>(next - channel.times.begin()), channel.times.size() - 1);
+		size_t k0 = next == channel.times.begin() ? 0 : std::min(k1, static_cast<size_t>(next - channel.times.begin()) - 1);
+		float span = channel.times[k1] - channel.times[k0];
+		float t = span > 0.0f ? glm::clamp((time - channel.times[k0]) / span, 0.0f, 1.0f) : 0.0f;
+		const glm::vec4& a = channel.values[k0];
+		const glm::vec4& b = channel.values[k1];
+
+		switch (channel.path) {
+		case Path::Translation:
+			pose.translations[channel.joint] = glm::mix(glm::vec3(a), glm::vec3(b), t);
+			break;
+		case Path::Rotation:
+			pose.rotations[channel.joint] = glm::slerp(glm::quat(a.w, a.x, a.y, a.z), glm::quat(b.w, b.x, b.y, b.z), t);
+			break;
+		case Path::Scale:
+			pose.scales[channel.joint] = glm::mix(glm::vec3(a), glm::vec3(b), t);
+			break;
+		}
+	}
+}
+
+GpuSkinning::GpuSkinning(
+	Device device,
+	PipelineCache& pipelineCache,
+	std::span<const ResourceManager::VertexAttributes> vertices,
+	std::span<const SkinVertex> skin,
+	uint32_t jointCount,
+	std::span<const MorphDelta> morphDeltas,
+	uint32_t morphTargetCount,
+	uint32_t instanceCapacity
+)
+	: mVertexCount(static_cast<uint32_t>(vertices.size()))
+	, mJointCount(jointCount)
+	, mMorphTargetCount(morphTargetCount)
+	, mInstanceCapacity(instanceCapacity)
+{
+	if (skin.size() != vertices.size() || morphDeltas.size() != size_t(morphTargetCount) * vertices.size() || jointCount > 256) {
+		std::cerr << "Invalid skin: " << skin.size() << " influences and " << morphDeltas.size() << " morph deltas for "
+			<< vertices.size() << " vertices and " << jointCount << " joints" << std::endl;
+		return;
+	}
+
+	SkinningUniforms uniforms = { mVertexCount, mJointCount, mMorphTargetCount, 0 };
+	BufferUsage storage = BufferUsage::Storage;
+	BufferUsage uploaded = BufferUsage::Storage | BufferUsage::CopyDst;
+	mUniformBuffer = createStorageBuffer(device, "Skinning uniforms", BufferUsage::Uniform, &uniforms, sizeof(uniforms), GpuMemoryCategory::Uniforms);
+	mRestVertexBuffer = createStorageBuffer(device, "Rest vertices", storage, vertices.data(), vertices.size_bytes(), GpuMemoryCategory::Geometry);
+	mSkinBuffer = createStorageBuffer(device, "Skin", storage, skin.data(), skin.size_bytes(), GpuMemoryCategory::Geometry);
+	mMorphDeltaBuffer = createStorageBuffer(device, "Morph deltas", storage, morphDeltas.empty() ? nullptr : morphDeltas.data(), morphDeltas.size_bytes(), GpuMemoryCategory::Geometry);
+	mJointMatrixBuffer = createStorageBuffer(device, "Joint matrices", uploaded, nullptr, uint64_t(instanceCapacity) * jointCount * sizeof(glm::mat4), GpuMemoryCategory::SceneData);
+	mMorphWeightBuffer = createStorageBuffer(device, "Morph weights", uploaded, nullptr, uint64_t(instanceCapacity) * morphTargetCount * sizeof(float), GpuMemoryCategory::SceneData);
+	Buffer skinnedVertexBuffer = createStorageBuffer(device, "Skinned vertices", BufferUsage::Storage | BufferUsage::Vertex, nullptr, uint64_t(instanceCapacity) * vertices.size_bytes(), GpuMemoryCategory::Geometry);
+	if (!mUniformBuffer || !mRestVertexBuffer || !mSkinBuffer || !mMorphDeltaBuffer || !mJointMatrixBuffer || !mMorphWeightBuffer || !skinnedVertexBuffer) {
+		std::cerr << "Could not create the buffers of a skin of " << vertices.size() << " vertices" << std::endl;
+		if (skinnedVertexBuffer) {
+			destroyTracked(skinnedVertexBuffer);
+			skinnedVertexBuffer.release();
+		}
+		return;
+	}
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(7, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+		bindingLayoutEntries[binding].buffer.type = BufferBindingType::ReadOnlyStorage;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(SkinningUniforms);
+	bindingLayoutEntries[6].buffer.type = BufferBindingType::Storage;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	BindGroupLayout bindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(skinningShaderSource);
+	pipelineDesc.compute.entryPoint = "skinVertices";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+
+	std::vector<BindGroupEntry> bindings(7);
+	Buffer buffers[] = { mUniformBuffer, mRestVertexBuffer, mSkinBuffer, mMorphDeltaBuffer, mJointMatrixBuffer, mMorphWeightBuffer, skinnedVertexBuffer };
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = buffers[binding];
+		bindings[binding].offset = 0;
+		bindings[binding].size = buffers[binding].getSize();
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mBindGroup = device.createBindGroup(bindGroupDesc);
+
+	mSkinnedVertexBuffer = skinnedVertexBuffer;
+}
+
+GpuSkinning::~GpuSkinning() {
+	if (mBindGroup) mBindGroup.release();
+	for (Buffer* buffer : { &mSkinnedVertexBuffer, &mUniformBuffer, &mMorphWeightBuffer, &mJointMatrixBuffer, &mMorphDeltaBuffer, &mSkinBuffer, &mRestVertexBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+void GpuSkinning::setJointMatrices(Queue queue, uint32_t instance, const glm::mat4* matrices) {
+	if (!valid() || instance >= mInstanceCapacity || mJointCount == 0) return;
+	uint64_t size = uint64_t(mJointCount) * sizeof(glm::mat4);
+	queue.writeBuffer(mJointMatrixBuffer, instance * size, matrices, size);
+}
+
+void GpuSkinning::setMorphWeights(Queue queue, uint32_t instance, const float* weights) {
+	if (!valid() || instance >= mInstanceCapacity || mMorphTargetCount == 0) return;
+	uint64_t size = uint64_t(mMorphTargetCount) * sizeof(float);
+	// writeBuffer needs multiples of 4 bytes, which floats are
+	queue.writeBuffer(mMorphWeightBuffer, instance * size, weights, size);
+}
+
+bool GpuSkinning::skin(ComputePassEncoder computePass, uint32_t instanceCount) {
+	if (!valid() || !ready()) return false;
+	instanceCount = std::min(instanceCount, mInstanceCapacity);
+	if (instanceCount == 0 || mVertexCount == 0) return true;
+	computePass.setPipeline(mPipeline->pipeline);
+	computePass.setBindGroup(0, mBindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups((mVertexCount + 63) / 64, instanceCount, 1);
+	return true;
+}
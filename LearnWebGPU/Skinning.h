@@ -0,0 +1,153 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "ResourceManager.h"
+#include "PipelineCache.h"
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Joints of a skin, in the form glTF gives them: a hierarchy of joints whose
+ * parents come before their children, each with the local transform of its rest
+ * pose and the inverse of its bind matrix.
+ */
+struct Skeleton {
+	struct Joint {
+		// Index of the parent joint, -1 for roots
+		int32_t parent = -1;
+		glm::vec3 translation = glm::vec3(0.0f);
+		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		glm::vec3 scale = glm::vec3(1.0f);
+		glm::mat4 inverseBindMatrix = glm::mat4(1.0f);
+	};
+	std::vector<Joint> joints;
+
+	/**
+	 * Local transform of each joint, starting from the rest pose
+	 */
+	struct Pose {
+		std::vector<glm::vec3> translations;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+	};
+	Pose restPose() const;
+
+	// Skinning matrices of `pose`, the world transform of each joint times its inverse bind
+	// matrix, written to `jointCount()` matrices at `matrices`
+	void computeJointMatrices(const Pose& pose, glm::mat4* matrices) const;
+
+	uint32_t jointCount() const { return static_cast<uint32_t>(joints.size()); }
+};
+
+/**
+ * Keyframes of the joints of a skeleton, as the channels of a glTF animation with
+ * linear interpolation (spherical for rotations)
+ */
+struct AnimationClip {
+	enum class Path { Translation, Rotation, Scale };
+
+	struct Channel {
+		uint32_t joint = 0;
+		Path path = Path::Translation;
+		// Increasing times, in seconds, and the value at each of them (xyz, or a quaternion
+		// as xyzw for rotations)
+		std::vector<float> times;
+		std::vector<glm::vec4> values;
+	};
+	std::vector<Channel> channels;
+	float duration = 0.0f;
+
+	// Overwrite the animated transforms of `pose` with their value at `time`, looped over
+	// the duration of the clip
+	void sample(float time, Skeleton::Pose& pose) const;
+};
+
+/**
+ * Skinning and morph targets of a mesh on the GPU: a compute pass transforms the
+ * rest pose vertices of every animated instance once per frame into a vertex
+ * buffer, then read like a static mesh by all the passes that draw it (depth
+ * pre-pass, shadows, main pass) rather than each of them skinning again.
+ *
+ * The skinned buffer is in the unsplit Float32 VertexLayout (VertexAttributes as
+ * is), with the vertices of instance i starting at baseVertex(i). Joint matrices
+ * and morph weights are uploaded per instance before skin() is recorded.
+ */
+class GpuSkinning {
+public:
+	/**
+	 * Influences of up to 4 joints on a vertex, as glTF JOINTS_0 and WEIGHTS_0 with
+	 * 8-bit components. Weights need not add up to exactly 1.
+	 */
+	struct SkinVertex {
+		// 4 joint indices of 8 bits, the first one in the lowest byte
+		uint32_t joints = 0;
+		// 4 Unorm8 weights, in the order of the joints
+		uint32_t weights = 0;
+	};
+
+	/**
+	 * Offset of a vertex in a morph target, added in proportion to the weight of the target
+	 */
+	struct MorphDelta {
+		glm::vec4 position = glm::vec4(0.0f);
+		glm::vec4 normal = glm::vec4(0.0f);
+	};
+
+	// Skin of `vertices` for up to `instanceCapacity` instances. `morphDeltas` holds the
+	// `morphTargetCount` targets one after the other, vertices.size() deltas each.
+	GpuSkinning(
+		wgpu::Device device,
+		PipelineCache& pipelineCache,
+		std::span<const ResourceManager::VertexAttributes> vertices,
+		std::span<const SkinVertex> skin,
+		uint32_t jointCount,
+		std::span<const MorphDelta> morphDeltas,
+		uint32_t morphTargetCount,
+		uint32_t instanceCapacity
+	);
+	~GpuSkinning();
+
+	GpuSkinning(const GpuSkinning&) = delete;
+	GpuSkinning& operator=(const GpuSkinning&) = delete;
+
+	// Whether the buffers could be created
+	bool valid() const { return mSkinnedVertexBuffer != nullptr; }
+	// Whether the pipeline is built, before which skin() records nothing
+	bool ready() const { return mPipeline && mPipeline->ready(); }
+
+	// Output of skin(), with the Vertex and Storage usages
+	wgpu::Buffer skinnedVertexBuffer() const { return mSkinnedVertexBuffer; }
+	uint32_t vertexCount() const { return mVertexCount; }
+	uint32_t baseVertex(uint32_t instance) const { return instance * mVertexCount; }
+
+	// Upload the jointCount skinning matrices of `instance`, see Skeleton::computeJointMatrices
+	void setJointMatrices(wgpu::Queue queue, uint32_t instance, const glm::mat4* matrices);
+	// Upload the morphTargetCount weights of `instance`
+	void setMorphWeights(wgpu::Queue queue, uint32_t instance, const float* weights);
+
+	// Record the skinning of the first `instanceCount` instances in a compute pass, to
+	// submit before the passes that draw them, or return false if the pipeline is not ready
+	bool skin(wgpu::ComputePassEncoder computePass, uint32_t instanceCount);
+
+private:
+	uint32_t mVertexCount;
+	uint32_t mJointCount;
+	uint32_t mMorphTargetCount;
+	uint32_t mInstanceCapacity;
+
+	wgpu::Buffer mRestVertexBuffer = nullptr;
+	wgpu::Buffer mSkinBuffer = nullptr;
+	wgpu::Buffer mMorphDeltaBuffer = nullptr;
+	wgpu::Buffer mJointMatrixBuffer = nullptr;
+	wgpu::Buffer mMorphWeightBuffer = nullptr;
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::Buffer mSkinnedVertexBuffer = nullptr;
+
+	// Owned by the pipeline cache
+	PipelineCache::AsyncComputePipeline mPipeline;
+	wgpu::BindGroup mBindGroup = nullptr;
+};
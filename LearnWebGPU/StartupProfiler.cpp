@@ -0,0 +1,218 @@
+#include "StartupProfiler.h"
+#include "MemoryProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+/**
+ * A stage of the timeline, or a milestone when it has no duration
+ */
+struct Record {
+	const char* name;
+	// Nanoseconds since start()
+	int64_t start;
+	int64_t end;
+	// Unknown for spans and milestones
+	bool hasAllocatedBytes;
+	uint64_t allocatedBytes;
+	bool milestone;
+	bool mainThread;
+};
+
+struct Timeline {
+	std::mutex mutex;
+	int64_t origin = 0;
+	std::thread::id mainThread;
+	std::vector<Record> records;
+};
+
+std::atomic<bool> gRecording = false;
+// Allocations of the thread since it started, kept trivial so that operator new
+// may use it whatever the order of initialization
+thread_local uint64_t tAllocatedBytes = 0;
+thread_local uint64_t tAllocationCount = 0;
+
+Timeline& timeline() {
+	static Timeline timeline;
+	return timeline;
+}
+
+void writeJsonString(std::ostream& out, const char* str) {
+	out << '"';
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') out << '\\';
+		if (static_cast<unsigned char>(*str) >= 0x20) out << *str;
+	}
+	out << '"';
+}
+
+void* allocate(std::size_t size, const void* caller) {
+	void* ptr = MemoryProfiler::enabled() ? MemoryProfiler::allocate(size, caller) : std::malloc(size > 0 ? size : 1);
+	if (!ptr) throw std::bad_alloc();
+	tAllocatedBytes += size;
+	++tAllocationCount;
+	return ptr;
+}
+
+void release(void* ptr) {
+	if (MemoryProfiler::enabled()) MemoryProfiler::release(ptr);
+	else std::free(ptr);
+}
+
+} // anonymous namespace
+
+// Return address of operator new, the call site of MemoryProfiler. The web only has
+// it with -sUSE_OFFSET_CONVERTER, which the profiler does without.
+#if defined(__EMSCRIPTEN__)
+#define CALLER_ADDRESS() nullptr
+#elif defined(_MSC_VER)
+#define CALLER_ADDRESS() _ReturnAddress()
+#else
+#define CALLER_ADDRESS() __builtin_return_address(0)
+#endif
+
+// Count what each thread allocates, see StartupProfiler, and attribute it to subsystems
+// with LEARNWEBGPU_MEMORY_PROFILE=1 (see MemoryProfiler). Aligned variants are left to
+// the standard library, which pairs them with its own deletes.
+void* operator new(std::size_t size) { return allocate(size, CALLER_ADDRESS()); }
+void* operator new[](std::size_t size) { return allocate(size, CALLER_ADDRESS()); }
+void operator delete(void* ptr) noexcept { release(ptr); }
+void operator delete[](void* ptr) noexcept { release(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { release(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { release(ptr); }
+
+void StartupProfiler::start() {
+	Timeline& tl = timeline();
+	std::lock_guard<std::mutex> lock(tl.mutex);
+	tl.origin = Trace::now();
+	tl.mainThread = std::this_thread::get_id();
+	tl.records.clear();
+	tl.records.reserve(256);
+	gRecording.store(true, std::memory_order_relaxed);
+}
+
+bool StartupProfiler::recording() {
+	return gRecording.load(std::memory_order_relaxed);
+}
+
+StartupProfiler::Timestamp StartupProfiler::now() {
+	return { Trace::now(), tAllocatedBytes, tAllocationCount };
+}
+
+void StartupProfiler::record(const char* stage, const Timestamp& start) {
+	Timestamp end = now();
+	if (!recording()) return;
+	Timeline& tl = timeline();
+	std::lock_guard<std::mutex> lock(tl.mutex);
+	tl.records.push_back({
+		stage,
+		start.time - tl.origin,
+		end.time - tl.origin,
+		true,
+		end.allocatedBytes - start.allocatedBytes,
+		false,
+		std::this_thread::get_id() == tl.mainThread,
+	});
+}
+
+void StartupProfiler::recordSpan(const char* stage, int64_t start, int64_t end) {
+	if (!recording()) return;
+	Timeline& tl = timeline();
+	std::lock_guard<std::mutex> lock(tl.mutex);
+	tl.records.push_back({ stage, start - tl.origin, end - tl.origin, false, 0, false, std::this_thread::get_id() == tl.mainThread });
+}
+
+void StartupProfiler::mark(const char* milestone) {
+	int64_t time = Trace::now();
+	if (!recording()) return;
+	Timeline& tl = timeline();
+	std::lock_guard<std::mutex> lock(tl.mutex);
+	for (const Record& record : tl.records) {
+		if (record.milestone && std::strcmp(record.name, milestone) == 0) return;
+	}
+	tl.records.push_back({ milestone, time - tl.origin, time - tl.origin, false, 0, true, true });
+}
+
+bool StartupProfiler::finish(const std::string& jsonPath) {
+	if (!gRecording.exchange(false, std::memory_order_relaxed)) return true;
+	Timeline& tl = timeline();
+	std::vector<Record> records;
+	{
+		std::lock_guard<std::mutex> lock(tl.mutex);
+		records = std::move(tl.records);
+		tl.records.clear();
+	}
+	std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+		return a.start < b.start;
+	});
+
+	constexpr double nsPerMs = 1e6;
+	std::cout << "Startup timeline:" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+	for (const Record& record : records) {
+		std::cout << "  " << std::setw(9) << record.start / nsPerMs << " ms  ";
+		if (record.milestone) {
+			std::cout << "-- " << record.name << std::endl;
+			continue;
+		}
+		std::cout << std::left << std::setw(20) << record.name << std::right
+			<< std::setw(9) << (record.end - record.start) / nsPerMs << " ms";
+		if (record.hasAllocatedBytes) {
+			std::cout << std::setw(10) << record.allocatedBytes / 1024 << " KiB";
+		}
+		if (!record.mainThread) std::cout << "  (worker)";
+		std::cout << std::endl;
+	}
+	std::cout << std::defaultfloat;
+
+	if (jsonPath.empty()) return true;
+
+	std::ostringstream json;
+	json << std::fixed << std::setprecision(3);
+	json << "{\n  \"stages\": [";
+	const char* separator = "\n    ";
+	for (const Record& record : records) {
+		if (record.milestone) continue;
+		json << separator << "{ \"name\": ";
+		writeJsonString(json, record.name);
+		json << ", \"startMs\": " << record.start / nsPerMs
+			<< ", \"durationMs\": " << (record.end - record.start) / nsPerMs;
+		if (record.hasAllocatedBytes) json << ", \"allocatedBytes\": " << record.allocatedBytes;
+		json << ", \"thread\": \"" << (record.mainThread ? "main" : "worker") << "\" }";
+		separator = ",\n    ";
+	}
+	json << "\n  ],\n  \"milestonesMs\": {";
+	separator = "\n    ";
+	for (const Record& record : records) {
+		if (!record.milestone) continue;
+		json << separator;
+		writeJsonString(json, record.name);
+		json << ": " << record.start / nsPerMs;
+		separator = ",\n    ";
+	}
+	json << "\n  }\n}\n";
+
+	std::ofstream file(jsonPath);
+	if (!file) {
+		std::cerr << "Could not write startup report to " << jsonPath << std::endl;
+		return false;
+	}
+	file << json.str();
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Trace.h"
+
+#include <string>
+#include <cstdint>
+
+/**
+ * Timeline of the startup, from onInit() to the first frame that shows the whole
+ * scene, to track time-to-first-frame from one release to the next.
+ *
+ * Stages record their wall time and the bytes that their thread allocated with
+ * operator new while they ran, which the profiler counts per thread by replacing
+ * the global operator new (a thread-local addition per allocation). Stages that
+ * span callbacks, e.g. requests to the device, only record their wall time.
+ *
+ * Recording stops at finish(), after which stages cost a relaxed atomic load, so
+ * that code shared with later frames (uploads, pipeline creation) may be marked.
+ */
+class StartupProfiler {
+public:
+	/**
+	 * Start of a stage, see record()
+	 */
+	struct Timestamp {
+		int64_t time = 0;
+		// Bytes allocated by the calling thread so far, and in how many allocations
+		uint64_t allocatedBytes = 0;
+		uint64_t allocationCount = 0;
+	};
+
+	// Start recording, the origin of the timeline being now
+	static void start();
+	static bool recording();
+
+	// Also valid when not recording, e.g. to count the allocations of a frame
+	static Timestamp now();
+
+	// Record a stage that ran on the calling thread from `start` to now, `stage` having
+	// to outlive the profiler (typically a string literal)
+	static void record(const char* stage, const Timestamp& start);
+
+	// Record a stage whose allocations are unknown, e.g. that completes in a callback.
+	// Times are those of Trace::now().
+	static void recordSpan(const char* stage, int64_t start, int64_t end);
+
+	// Mark the time of a milestone, e.g. "First present", only the first time it is reached
+	static void mark(const char* milestone);
+
+	// Stop recording, print the timeline, and write it as JSON to `jsonPath` unless
+	// empty. Return false if the file cannot be written.
+	static bool finish(const std::string& jsonPath);
+};
+
+/**
+ * Record a stage from its construction to its destruction, see STARTUP_STAGE()
+ */
+class StartupStage {
+public:
+	explicit StartupStage(const char* stage)
+		: mStage(stage)
+		, mRecording(StartupProfiler::recording())
+	{
+		if (mRecording) mStart = StartupProfiler::now();
+	}
+	~StartupStage() {
+		if (mRecording) StartupProfiler::record(mStage, mStart);
+	}
+
+	StartupStage(const StartupStage&) = delete;
+	StartupStage& operator=(const StartupStage&) = delete;
+
+private:
+	const char* mStage;
+	bool mRecording;
+	StartupProfiler::Timestamp mStart;
+};
+
+// Time the rest of the enclosing scope as a startup stage, and as a trace marker,
+// `name` being a string literal
+#define STARTUP_STAGE(name) \
+	TRACE_SCOPE(name); \
+	StartupStage TRACE_CONCAT(startupStage, __LINE__)(name)
@@ -0,0 +1,86 @@
+#include "StaticBatcher.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+std::vector<StaticBatcher::Chunk> StaticBatcher::build(std::span<const Placement> placements, uint32_t maxVertices) {
+	std::map<uint32_t, std::vector<uint32_t>> materialPlacements;
+	for (uint32_t i = 0; i < placements.size(); ++i) {
+		materialPlacements[placements[i].material].push_back(i);
+	}
+	std::vector<Chunk> chunks;
+	for (auto& [material, order] : materialPlacements) {
+		split(placements, order, maxVertices, chunks);
+	}
+	return chunks;
+}
+
+void StaticBatcher::split(std::span<const Placement> placements, std::span<uint32_t> order, uint32_t maxVertices, std::vector<Chunk>& chunks) {
+	uint64_t vertexCount = 0;
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+	for (uint32_t i : order) {
+		vertexCount += placements[i].geometry->vertices.size();
+		glm::vec3 position = glm::vec3(placements[i].modelMatrix[3]);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+	if (vertexCount <= maxVertices || order.size() == 1) {
+		chunks.push_back(merge(placements, order));
+		return;
+	}
+
+	// Halves of the instances on either side of the median along the largest extent
+	glm::vec3 extent = boundsMax - boundsMin;
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+	size_t middle = order.size() / 2;
+	std::nth_element(order.begin(), order.begin() + middle, order.end(), [&](uint32_t a, uint32_t b) {
+		return placements[a].modelMatrix[3][axis] < placements[b].modelMatrix[3][axis];
+	});
+	split(placements, order.first(middle), maxVertices, chunks);
+	split(placements, order.subspan(middle), maxVertices, chunks);
+}
+
+StaticBatcher::Chunk StaticBatcher::merge(std::span<const Placement> placements, std::span<const uint32_t> order) {
+	Chunk chunk;
+	chunk.geometry = std::make_shared<ResourceManager::Geometry>();
+	chunk.material = placements[order.front()].material;
+	chunk.placements.assign(order.begin(), order.end());
+	ResourceManager::Geometry& geometry = *chunk.geometry;
+
+	for (uint32_t i : order) {
+		const Placement& placement = placements[i];
+		const ResourceManager::Geometry& source = *placement.geometry;
+		const glm::mat4& M = placement.modelMatrix;
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(M)));
+
+		uint32_t baseVertex = static_cast<uint32_t>(geometry.vertexData.size());
+		for (const ResourceManager::VertexAttributes& vertex : source.vertices) {
+			ResourceManager::VertexAttributes transformed = vertex;
+			transformed.position = glm::vec3(M * glm::vec4(glm::vec3(vertex.position), 1.0f));
+			glm::vec3 normal = normalMatrix * glm::vec3(vertex.normal);
+			float length = glm::length(normal);
+			transformed.normal = length > 0.0f ? normal / length : normal;
+			geometry.vertexData.push_back(transformed);
+		}
+		// The full level alone, which comes first
+		const ResourceManager::GeometryLod& lod = source.lods[0];
+		for (uint32_t index : source.indices.subspan(lod.indexOffset, lod.indexCount)) {
+			geometry.indexData.push_back(baseVertex + index);
+		}
+	}
+
+	ResourceManager::GeometryLod lod{};
+	lod.indexOffset = 0;
+	lod.indexCount = static_cast<uint32_t>(geometry.indexData.size());
+	lod.error = 0.0f;
+	lod.meshletOffset = 0;
+	lod.meshletCount = 0;
+	geometry.lodData.push_back(lod);
+
+	geometry.vertices = geometry.vertexData;
+	geometry.indices = geometry.indexData;
+	geometry.lods = geometry.lodData;
+	return chunk;
+}
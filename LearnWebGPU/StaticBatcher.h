@@ -0,0 +1,54 @@
+#pragma once
+
+#include "MathConfig.h"
+#include "ResourceManager.h"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+/**
+ * Static batching: static instances of small meshes sharing a material are
+ * transformed on the CPU and concatenated into combined geometries, each drawn
+ * as a single instance, so that hundreds of props cost a handful of draws.
+ *
+ * Instances are merged by spatial chunks rather than all at once, the chunks
+ * being split at the median of their instance positions along their largest
+ * extent until their vertices fit 16-bit indices. Each chunk thus stays compact
+ * enough for culling to reject it as a whole, at the cost of drawing all of its
+ * instances whenever part of it is visible.
+ *
+ * Combined geometries only have the full level of detail of their instances,
+ * and no meshlets, their instances being too small for either to pay off.
+ */
+class StaticBatcher {
+public:
+	/**
+	 * An instance to merge, of a geometry still in CPU memory
+	 */
+	struct Placement {
+		const ResourceManager::Geometry* geometry;
+		glm::mat4 modelMatrix;
+		uint32_t material;
+	};
+
+	/**
+	 * Combined geometry of instances of a same material, in the space their model
+	 * matrices transform to
+	 */
+	struct Chunk {
+		std::shared_ptr<ResourceManager::Geometry> geometry;
+		uint32_t material;
+		// Indices of the placements merged
+		std::vector<uint32_t> placements;
+	};
+
+	// Merge placements of a same material into chunks of at most `maxVertices` vertices. A
+	// placement whose geometry alone has more is left in a chunk of its own.
+	static std::vector<Chunk> build(std::span<const Placement> placements, uint32_t maxVertices = 0xFFFF);
+
+private:
+	static void split(std::span<const Placement> placements, std::span<uint32_t> order, uint32_t maxVertices, std::vector<Chunk>& chunks);
+	static Chunk merge(std::span<const Placement> placements, std::span<const uint32_t> order);
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Formats of vertex attributes, each with its size in the vertex buffer and the
+ * WGSL type that the vertex shader reads it as.
+ */
+struct f32 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32; static constexpr uint32_t size = 4; static constexpr std::string_view wgslType = "f32"; };
+struct f32x2 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32x2; static constexpr uint32_t size = 8; static constexpr std::string_view wgslType = "vec2f"; };
+struct f32x3 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32x3; static constexpr uint32_t size = 12; static constexpr std::string_view wgslType = "vec3f"; };
+struct f32x4 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float32x4; static constexpr uint32_t size = 16; static constexpr std::string_view wgslType = "vec4f"; };
+struct f16x2 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float16x2; static constexpr uint32_t size = 4; static constexpr std::string_view wgslType = "vec2f"; };
+struct f16x4 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Float16x4; static constexpr uint32_t size = 8; static constexpr std::string_view wgslType = "vec4f"; };
+struct unorm8x4 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Unorm8x4; static constexpr uint32_t size = 4; static constexpr std::string_view wgslType = "vec4f"; };
+struct snorm8x4 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Snorm8x4; static constexpr uint32_t size = 4; static constexpr std::string_view wgslType = "vec4f"; };
+struct unorm16x2 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Unorm16x2; static constexpr uint32_t size = 4; static constexpr std::string_view wgslType = "vec2f"; };
+struct unorm16x4 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Unorm16x4; static constexpr uint32_t size = 8; static constexpr std::string_view wgslType = "vec4f"; };
+struct snorm16x2 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Snorm16x2; static constexpr uint32_t size = 4; static constexpr std::string_view wgslType = "vec2f"; };
+struct snorm16x4 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Snorm16x4; static constexpr uint32_t size = 8; static constexpr std::string_view wgslType = "vec4f"; };
+struct u32 { static constexpr WGPUVertexFormat format = WGPUVertexFormat_Uint32; static constexpr uint32_t size = 4; static constexpr std::string_view wgslType = "u32"; };
+
+/**
+ * Attributes of a vertex, named as the fields of the WGSL input structure
+ */
+template <typename Format> struct VertexPosition { using Type = Format; static constexpr std::string_view name = "position"; };
+template <typename Format> struct VertexNormal { using Type = Format; static constexpr std::string_view name = "normal"; };
+template <typename Format> struct VertexColor { using Type = Format; static constexpr std::string_view name = "color"; };
+template <typename Format> struct VertexUv { using Type = Format; static constexpr std::string_view name = "uv"; };
+
+/**
+ * Name of a WGSL structure, given as a template argument
+ */
+template <size_t N>
+struct WgslName {
+	char chars[N] = {};
+	constexpr WgslName(const char (&name)[N]) {
+		for (size_t i = 0; i < N; ++i) chars[i] = name[i];
+	}
+	constexpr std::string_view view() const { return { chars, N - 1 }; }
+};
+
+// Attributes at shader locations 0 to N - 1, in order and tightly packed
+template <typename... Attributes>
+constexpr std::array<WGPUVertexAttribute, sizeof...(Attributes)> makeVertexAttributes() {
+	std::array<WGPUVertexAttribute, sizeof...(Attributes)> attributes{};
+	uint64_t offset = 0;
+	uint32_t location = 0;
+	auto add = [&](WGPUVertexFormat format, uint32_t size) {
+		attributes[location].format = format;
+		attributes[location].offset = offset;
+		attributes[location].shaderLocation = location;
+		offset += size;
+		++location;
+	};
+	(add(Attributes::Type::format, Attributes::Type::size), ...);
+	return attributes;
+}
+
+// Write the WGSL structure reading the attributes to `out`, if not null, and return its length
+template <typename... Attributes>
+constexpr size_t writeWgslVertexStruct(std::string_view name, char* out) {
+	size_t length = 0;
+	auto put = [&](std::string_view text) {
+		for (char c : text) {
+			if (out) out[length] = c;
+			++length;
+		}
+	};
+	auto putDigit = [&](uint32_t digit) {
+		if (out) out[length] = static_cast<char>('0' + digit);
+		++length;
+	};
+	put("struct ");
+	put(name);
+	put(" {\n");
+	uint32_t location = 0;
+	auto putAttribute = [&](std::string_view attributeName, std::string_view type) {
+		put("\t@location(");
+		if (location >= 10) putDigit(location / 10);
+		putDigit(location % 10);
+		put(") ");
+		put(attributeName);
+		put(": ");
+		put(type);
+		put(",\n");
+		++location;
+	};
+	(putAttribute(Attributes::name, Attributes::Type::wgslType), ...);
+	put("};\n");
+	return length;
+}
+
+template <WgslName Name, typename... Attributes>
+constexpr auto makeWgslVertexStruct() {
+	std::array<char, writeWgslVertexStruct<Attributes...>(Name.view(), nullptr)> text{};
+	writeWgslVertexStruct<Attributes...>(Name.view(), text.data());
+	return text;
+}
+
+/**
+ * Vertex buffer layout of a single buffer of interleaved attributes, given with
+ * their formats, e.g. StaticVertexLayout<VertexPosition<f32x3>, VertexUv<f16x2>>,
+ * along with the matching WGSL input structure, all built at compile time so
+ * that the layout, the stride and the shader cannot disagree.
+ *
+ * Attributes are read at shader locations 0 to N - 1, in the order given, and
+ * are tightly packed, every vertex format being a multiple of 4 bytes. The C++
+ * structure that the vertices are encoded from is checked against offset() with
+ * static_assert where it is defined.
+ */
+template <typename... Attributes>
+class StaticVertexLayout {
+public:
+	static constexpr size_t attributeCount = sizeof...(Attributes);
+	static constexpr std::array<WGPUVertexAttribute, attributeCount> attributes = makeVertexAttributes<Attributes...>();
+	static constexpr uint64_t stride = (uint64_t(0) + ... + Attributes::Type::size);
+
+	static constexpr uint64_t offset(uint32_t location) { return attributes[location].offset; }
+
+	// WGSL source declaring a structure `Name` with one field per attribute, e.g. `VertexInput`
+	template <WgslName Name>
+	static constexpr auto wgslStructText = makeWgslVertexStruct<Name, Attributes...>();
+	template <WgslName Name>
+	static constexpr std::string_view wgslStruct = { wgslStructText<Name>.data(), wgslStructText<Name>.size() };
+
+	// Its attributes being static, the layout can be copied freely
+	static wgpu::VertexBufferLayout bufferLayout(wgpu::VertexStepMode stepMode = wgpu::VertexStepMode::Vertex) {
+		wgpu::VertexBufferLayout layout;
+		layout.arrayStride = stride;
+		layout.stepMode = stepMode;
+		layout.attributeCount = attributeCount;
+		layout.attributes = attributes.data();
+		return layout;
+	}
+};
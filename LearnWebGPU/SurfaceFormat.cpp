@@ -0,0 +1,121 @@
+#include "SurfaceFormat.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// The formats the passes writing to the surface are written for, and their sRGB variant
+TextureFormat srgbVariant(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::BGRA8Unorm:
+	case TextureFormat::BGRA8UnormSrgb:
+		return TextureFormat::BGRA8UnormSrgb;
+	case TextureFormat::RGBA8Unorm:
+	case TextureFormat::RGBA8UnormSrgb:
+		return TextureFormat::RGBA8UnormSrgb;
+	default:
+		return TextureFormat::Undefined;
+	}
+}
+
+const char* formatName(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::BGRA8Unorm: return "BGRA8Unorm";
+	case TextureFormat::BGRA8UnormSrgb: return "BGRA8UnormSrgb";
+	case TextureFormat::RGBA8Unorm: return "RGBA8Unorm";
+	case TextureFormat::RGBA8UnormSrgb: return "RGBA8UnormSrgb";
+	case TextureFormat::RGBA16Float: return "RGBA16Float";
+	case TextureFormat::RGB10A2Unorm: return "RGB10A2Unorm";
+	default: return "other format";
+	}
+}
+
+const char* alphaModeName(CompositeAlphaMode alphaMode) {
+	switch (alphaMode) {
+	case CompositeAlphaMode::Auto: return "auto";
+	case CompositeAlphaMode::Opaque: return "opaque";
+	case CompositeAlphaMode::Premultiplied: return "premultiplied";
+	case CompositeAlphaMode::Unpremultiplied: return "unpremultiplied";
+	case CompositeAlphaMode::Inherit: return "inherit";
+	default: return "unknown";
+	}
+}
+
+} // anonymous namespace
+
+SurfaceFormat SurfaceFormat::select(Surface surface, Adapter adapter) {
+	std::vector<TextureFormat> formats;
+	std::vector<CompositeAlphaMode> alphaModes;
+#ifdef __EMSCRIPTEN__
+	// The canvas takes the format of navigator.gpu.getPreferredCanvasFormat() as is, and
+	// any alpha mode
+	formats.push_back(surface.getPreferredFormat(adapter));
+	alphaModes.push_back(CompositeAlphaMode::Opaque);
+#else
+	SurfaceCapabilities capabilities;
+	surface.getCapabilities(adapter, &capabilities);
+	formats.assign(capabilities.formats, capabilities.formats + capabilities.formatCount);
+	alphaModes.assign(capabilities.alphaModes, capabilities.alphaModes + capabilities.alphaModeCount);
+	wgpuSurfaceCapabilitiesFreeMembers(capabilities);
+#endif // __EMSCRIPTEN__
+
+	SurfaceFormat result;
+	auto usable = std::find_if(formats.begin(), formats.end(), [](TextureFormat format) {
+		return srgbVariant(format) != TextureFormat::Undefined;
+	});
+	if (usable != formats.end()) {
+		result.format = *usable;
+		result.preferred = usable == formats.begin();
+	}
+	else {
+		// Every surface is meant to take one of them, this one being the most common
+		std::cerr << "The surface lists no 8-bit format, trying BGRA8Unorm" << std::endl;
+		result.format = TextureFormat::BGRA8Unorm;
+	}
+	result.viewFormat = srgbVariant(result.format);
+
+	// Auto leaves the choice to the platform, which may pick one that blends the window
+	if (std::find(alphaModes.begin(), alphaModes.end(), CompositeAlphaMode::Opaque) != alphaModes.end()) {
+		result.alphaMode = CompositeAlphaMode::Opaque;
+	}
+	return result;
+}
+
+void SurfaceFormat::configure(SurfaceConfiguration& config) const {
+	config.format = format;
+	if (viewFormat != format) {
+		config.viewFormatCount = 1;
+		config.viewFormats = (const WGPUTextureFormat*)&viewFormat;
+	}
+	else {
+		config.viewFormatCount = 0;
+		config.viewFormats = nullptr;
+	}
+	config.alphaMode = alphaMode;
+}
+
+TextureView SurfaceFormat::createView(Texture texture, const char* label) const {
+	TextureViewDescriptor viewDescriptor{};
+	viewDescriptor.label = label;
+	viewDescriptor.format = viewFormat;
+	viewDescriptor.dimension = TextureViewDimension::_2D;
+	viewDescriptor.baseMipLevel = 0;
+	viewDescriptor.mipLevelCount = 1;
+	viewDescriptor.baseArrayLayer = 0;
+	viewDescriptor.arrayLayerCount = 1;
+	viewDescriptor.aspect = TextureAspect::All;
+	return texture.createView(viewDescriptor);
+}
+
+std::string SurfaceFormat::describe() const {
+	std::ostringstream out;
+	out << formatName(format);
+	if (viewFormat != format) out << " as " << formatName(viewFormat);
+	out << ", " << alphaModeName(alphaMode) << ", " << (preferred ? "preferred" : "not the preferred format, converted by the compositor");
+	return out.str();
+}
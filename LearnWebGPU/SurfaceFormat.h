@@ -0,0 +1,39 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <string>
+
+/**
+ * The format and alpha mode a surface is configured with, chosen from its
+ * capabilities so that the compositor takes the presented textures as they are
+ * rather than converting them each frame: the format it prefers, the first the
+ * surface lists (navigator.gpu.getPreferredCanvasFormat() on the web), and an
+ * opaque alpha mode, which spares blending the window with what is behind it.
+ *
+ * The renderer writes sRGB encoded colors through the hardware, thus renders to
+ * views of the sRGB variant of the format, listed as a view format of the surface
+ * when the format itself is not sRGB, as on the web. Preferred formats the passes
+ * are not written for (e.g. RGBA16Float or RGB10A2Unorm) are skipped for the first
+ * 8-bit one the surface lists, which is then reported as a conversion.
+ */
+struct SurfaceFormat {
+	// Of the surface textures
+	wgpu::TextureFormat format = wgpu::TextureFormat::Undefined;
+	// Of the views the passes render to, `format` or its sRGB variant
+	wgpu::TextureFormat viewFormat = wgpu::TextureFormat::Undefined;
+	wgpu::CompositeAlphaMode alphaMode = wgpu::CompositeAlphaMode::Auto;
+	// Whether `format` is the one the surface prefers
+	bool preferred = false;
+
+	// The configuration of `surface` on `adapter`
+	static SurfaceFormat select(wgpu::Surface surface, wgpu::Adapter adapter);
+
+	// Set the format, view formats and alpha mode of `config`, which then points to this
+	void configure(wgpu::SurfaceConfiguration& config) const;
+	// View of a texture of the surface, as the passes render to
+	wgpu::TextureView createView(wgpu::Texture texture, const char* label) const;
+
+	// E.g. "BGRA8Unorm as BGRA8UnormSrgb, opaque, preferred"
+	std::string describe() const;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/**
+ * A coroutine returning a T, for loading code that hops between threads and waits
+ * for the device without blocking any of them nor nesting callbacks:
+ *
+ *   Task<ResourceCache::TextureHandle> load(AssetLoader& loader, ...) {
+ *       co_await loader.resumeOnWorker();
+ *       // decode...
+ *       co_await loader.resumeOnDeviceThread();
+ *       co_return cache.addTexture(...);
+ *   }
+ *
+ * Tasks are lazy: they start when awaited, and resume their awaiter when they
+ * return, on whichever thread they finished. A task nobody awaits is started with
+ * detach(), which lets it run to the end and free itself. Awaitables are provided
+ * by what tasks wait for: AssetLoader (switching threads), DeviceEvents (buffer
+ * mapping, submitted work) and PipelineCache (asynchronous pipelines).
+ *
+ * Parameters are copied into the coroutine frame, thus are better taken by value:
+ * references must outlive the task. A task still suspended when what it waits for
+ * is destroyed (e.g. the loader, dropping its queued jobs) is abandoned, never
+ * resuming nor freeing its frame.
+ */
+template <typename T = void>
+class Task;
+
+// Resumes the awaiter of a task that returned, or frees a detached one
+template <typename Promise>
+struct TaskFinalAwaiter {
+	bool await_ready() noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+		Promise& promise = handle.promise();
+		if (promise.continuation) return promise.continuation;
+		if (promise.detached) handle.destroy();
+		return std::noop_coroutine();
+	}
+	void await_resume() noexcept {}
+};
+
+// What the promises of all tasks share
+struct TaskPromiseBase {
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	// Exceptions are not used by this project
+	void unhandled_exception() noexcept { std::terminate(); }
+
+	// Resumed once the task returns
+	std::coroutine_handle<> continuation;
+	bool detached = false;
+};
+
+template <typename T>
+class Task {
+public:
+	struct promise_type : TaskPromiseBase {
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		TaskFinalAwaiter<promise_type> final_suspend() noexcept { return {}; }
+		template <typename U>
+		void return_value(U&& value) { result.emplace(std::forward<U>(value)); }
+
+		std::optional<T> result;
+	};
+
+	Task(Task&& other) noexcept : mHandle(std::exchange(other.mHandle, nullptr)) {}
+	Task& operator=(Task&& other) noexcept {
+		if (this != &other) {
+			if (mHandle) mHandle.destroy();
+			mHandle = std::exchange(other.mHandle, nullptr);
+		}
+		return *this;
+	}
+	~Task() {
+		if (mHandle) mHandle.destroy();
+	}
+
+	// Start the task without awaiting it, its result being dropped
+	void detach() && {
+		std::coroutine_handle<promise_type> handle = std::exchange(mHandle, nullptr);
+		handle.promise().detached = true;
+		handle.resume();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+		mHandle.promise().continuation = awaiter;
+		return mHandle;
+	}
+	T await_resume() { return std::move(*mHandle.promise().result); }
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : mHandle(handle) {}
+
+	std::coroutine_handle<promise_type> mHandle;
+};
+
+template <>
+class Task<void> {
+public:
+	struct promise_type : TaskPromiseBase {
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		TaskFinalAwaiter<promise_type> final_suspend() noexcept { return {}; }
+		void return_void() {}
+	};
+
+	Task(Task&& other) noexcept : mHandle(std::exchange(other.mHandle, nullptr)) {}
+	Task& operator=(Task&& other) noexcept {
+		if (this != &other) {
+			if (mHandle) mHandle.destroy();
+			mHandle = std::exchange(other.mHandle, nullptr);
+		}
+		return *this;
+	}
+	~Task() {
+		if (mHandle) mHandle.destroy();
+	}
+
+	// Start the task without awaiting it
+	void detach() && {
+		std::coroutine_handle<promise_type> handle = std::exchange(mHandle, nullptr);
+		handle.promise().detached = true;
+		handle.resume();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+		mHandle.promise().continuation = awaiter;
+		return mHandle;
+	}
+	void await_resume() {}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : mHandle(handle) {}
+
+	std::coroutine_handle<promise_type> mHandle;
+};
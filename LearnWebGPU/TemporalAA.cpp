@@ -0,0 +1,425 @@
+#include "TemporalAA.h"
+#include "FullscreenTriangle.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+
+#include <glm/ext.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// Sample 0 of multisampled depths, the scene being resolved from the others already
+const char* depthLoadSource = R"(
+@group(0) @binding(2) var depthTexture: texture_depth_2d;
+
+fn loadDepth(pixel: vec2u) -> f32 {
+	return textureLoad(depthTexture, pixel, 0);
+}
+)";
+
+const char* multisampledDepthLoadSource = R"(
+@group(0) @binding(2) var depthTexture: texture_depth_multisampled_2d;
+
+fn loadDepth(pixel: vec2u) -> f32 {
+	return textureLoad(depthTexture, pixel, 0);
+}
+)";
+
+const char* resolveShaderSource = R"(
+/**
+ * Same as TemporalAA::Uniforms
+ */
+struct TemporalUniforms {
+	reprojection: mat4x4f,
+	jitter: vec2f,
+	depthParameters: vec2f,
+	sceneSize: vec2u,
+	historySize: vec2u,
+	mode: u32,
+	pattern: u32,
+	phase: u32,
+	blend: f32,
+};
+
+const AntiAliasing = 0u;
+const Checkerboard = 1u;
+const Quad = 2u;
+
+@group(0) @binding(0) var<uniform> uTemporal: TemporalUniforms;
+@group(0) @binding(1) var scene: texture_2d<f32>;
+@group(0) @binding(3) var historyColor: texture_2d<f32>;
+@group(0) @binding(4) var historyDistance: texture_2d<f32>;
+@group(0) @binding(5) var historySampler: sampler;
+
+struct ResolveOutput {
+	@location(0) color: vec4f,
+	@location(1) history: vec4f,
+	@location(2) distance: f32,
+};
+
+// Same as skippedByTemporalReuse in shader.wgsl
+fn skipped(pixel: vec2u) -> bool {
+	if (uTemporal.pattern == Checkerboard) {
+		return ((pixel.x + pixel.y + uTemporal.phase) & 1u) != 0u;
+	}
+	if (uTemporal.pattern == Quad) {
+		return (pixel.x & 1u) + 2u * (pixel.y & 1u) != uTemporal.phase;
+	}
+	return false;
+}
+
+// Bounded, as the far plane of reversed depths is at infinity
+fn viewDistance(depth: f32) -> f32 {
+	let a = uTemporal.depthParameters.x;
+	let b = uTemporal.depthParameters.y;
+	return min(b / max(depth + a, 1e-20), 1e20);
+}
+
+@fragment
+fn fs_resolve(@builtin(position) position: vec4f) -> ResolveOutput {
+	let pixel = vec2u(position.xy);
+	let size = vec2i(uTemporal.sceneSize);
+	let depth = loadDepth(pixel);
+
+	// Colors of the shaded pixels of the 3x3 around, which the history is clamped to, and their
+	// average weighed by depth similarity for skipped pixels without history
+	var boxMin = vec3f(1e30);
+	var boxMax = vec3f(-1e30);
+	var filled = vec4f(0.0);
+	var filledWeight = 0.0;
+	for (var y = -1; y <= 1; y++) {
+		for (var x = -1; x <= 1; x++) {
+			let neighbour = vec2u(clamp(vec2i(pixel) + vec2i(x, y), vec2i(0), size - 1));
+			if (skipped(neighbour)) {
+				continue;
+			}
+			let color = textureLoad(scene, neighbour, 0);
+			boxMin = min(boxMin, color.rgb);
+			boxMax = max(boxMax, color.rgb);
+			let weight = 1.0 / (1e-4 + abs(loadDepth(neighbour) - depth));
+			filled += weight * color;
+			filledWeight += weight;
+		}
+	}
+
+	// Where the surface seen at the unjittered center of the pixel was in the previous frame
+	let uv = (vec2f(pixel) + 0.5) / vec2f(size);
+	let ndc = vec2f(2.0 * uv.x - 1.0, 1.0 - 2.0 * uv.y) - uTemporal.jitter;
+	let previous = uTemporal.reprojection * vec4f(ndc, depth, 1.0);
+	let previousUv = vec2f(0.5, -0.5) * previous.xy / previous.w + 0.5;
+	var valid = all(uTemporal.historySize > vec2u(0u)) && previous.w > 0.0
+		&& all(previousUv >= vec2f(0.0)) && all(previousUv <= vec2f(1.0));
+	var history = vec4f(0.0);
+	if (valid) {
+		let historyPixel = previousUv * vec2f(uTemporal.historySize);
+		history = textureSampleLevel(historyColor, historySampler, historyPixel / vec2f(textureDimensions(historyColor)), 0.0);
+		// The history holds another surface where this one was hidden
+		let historyPixelIndex = min(vec2u(historyPixel), uTemporal.historySize - 1u);
+		let previousDistance = textureLoad(historyDistance, historyPixelIndex, 0).r;
+		valid = abs(previousDistance - previous.w) <= 0.02 * max(previousDistance, previous.w);
+	}
+
+	var color = textureLoad(scene, pixel, 0);
+	if (!skipped(pixel)) {
+		if (valid && uTemporal.mode == AntiAliasing) {
+			color = vec4f(mix(clamp(history.rgb, boxMin, boxMax), color.rgb, uTemporal.blend), color.a);
+		}
+	}
+	else if (!valid) {
+		color = filled / filledWeight;
+	}
+	else if (uTemporal.pattern == Checkerboard) {
+		// Half of the pixels are shaded while the camera moves, around which what the history
+		// missed shows the least
+		color = vec4f(clamp(history.rgb, boxMin, boxMax), history.a);
+	}
+	else {
+		// The camera stands still, each pixel being shaded again every 4 frames
+		color = history;
+	}
+
+	var out: ResolveOutput;
+	out.color = color;
+	out.history = color;
+	out.distance = viewDistance(depth);
+	return out;
+}
+)";
+
+// Radical inverse of `index` in `base`
+float halton(uint32_t index, uint32_t base) {
+	float fraction = 1.0f;
+	float result = 0.0f;
+	while (index > 0) {
+		fraction /= static_cast<float>(base);
+		result += fraction * static_cast<float>(index % base);
+		index /= base;
+	}
+	return result;
+}
+
+} // anonymous namespace
+
+TemporalAA::TemporalAA(Device device, PipelineCache& pipelineCache, TextureFormat sceneFormat, uint32_t sampleCount, Mode mode)
+	: mDevice(device)
+{
+	mUniforms.mode = mode;
+	mUniforms.pattern = Pattern::All;
+	mUniforms.blend = 0.1f;
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Temporal uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "TemporalAA");
+	if (!mUniformBuffer) return;
+	GpuHandle<Queue>(device.getQueue())->writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+
+	// The history is read between pixels when the view moves
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::ClampToEdge;
+	samplerDesc.addressModeV = AddressMode::ClampToEdge;
+	samplerDesc.addressModeW = AddressMode::ClampToEdge;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Nearest;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 1.0f;
+	samplerDesc.compare = CompareFunction::Undefined;
+	samplerDesc.maxAnisotropy = 1;
+	mSampler = pipelineCache.sampler(samplerDesc);
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(6, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].texture.sampleType = TextureSampleType::Depth;
+	bindingLayoutEntries[2].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[2].texture.multisampled = sampleCount > 1;
+	bindingLayoutEntries[3].binding = 3;
+	bindingLayoutEntries[3].texture.sampleType = TextureSampleType::Float;
+	bindingLayoutEntries[3].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[4].binding = 4;
+	bindingLayoutEntries[4].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[4].texture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[5].binding = 5;
+	bindingLayoutEntries[5].sampler.type = SamplerBindingType::Filtering;
+	for (BindGroupLayoutEntry& entry : bindingLayoutEntries) entry.visibility = ShaderStage::Fragment;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	std::string depthSource = sampleCount > 1 ? multisampledDepthLoadSource : depthLoadSource;
+	ShaderModule shaderModule = pipelineCache.shaderModule(FullscreenTriangle::VertexShaderSource + depthSource + resolveShaderSource);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	FullscreenTriangle::setPipelineStates(pipelineDesc, shaderModule);
+
+	// The resolved scene, then the next history
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = "fs_resolve";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	std::vector<ColorTargetState> colorTargets(3);
+	colorTargets[0].format = sceneFormat;
+	colorTargets[1].format = HistoryFormat;
+	colorTargets[2].format = DistanceFormat;
+	for (ColorTargetState& colorTarget : colorTargets) {
+		colorTarget.blend = nullptr;
+		colorTarget.writeMask = ColorWriteMask::All;
+	}
+	fragmentState.targetCount = (uint32_t)colorTargets.size();
+	fragmentState.targets = colorTargets.data();
+	pipelineDesc.fragment = &fragmentState;
+	mPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+TemporalAA::~TemporalAA() {
+	terminateHistory();
+	if (mUniformBuffer) {
+		destroyTracked(mUniformBuffer);
+		mUniformBuffer.release();
+	}
+}
+
+void TemporalAA::createHistory(const glm::uvec2& size) {
+	TextureDescriptor textureDesc{};
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.size = { size.x, size.y, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::TextureBinding;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	for (uint32_t i = 0; i < 2; ++i) {
+		textureDesc.label = "Temporal history";
+		textureDesc.format = HistoryFormat;
+		mHistoryTextures[i] = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::RenderTargets, "TemporalAA");
+		mHistoryViews[i] = mHistoryTextures[i].createView();
+		textureDesc.label = "Temporal history distances";
+		textureDesc.format = DistanceFormat;
+		mDistanceTextures[i] = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::RenderTargets, "TemporalAA");
+		mDistanceViews[i] = mDistanceTextures[i].createView();
+	}
+	mHistoryTextureSize = size;
+}
+
+void TemporalAA::terminateHistory() {
+	for (uint32_t i = 0; i < 2; ++i) {
+		if (mBindGroups[i]) mBindGroups[i].release();
+		mBindGroups[i] = nullptr;
+		for (TextureView* view : { &mHistoryViews[i], &mDistanceViews[i] }) {
+			if (*view) view->release();
+			*view = nullptr;
+		}
+		for (Texture* texture : { &mHistoryTextures[i], &mDistanceTextures[i] }) {
+			if (!*texture) continue;
+			retireTracked(*texture);
+			*texture = nullptr;
+		}
+	}
+	mSceneView = nullptr;
+	mDepthView = nullptr;
+	mHistoryTextureSize = { 0, 0 };
+}
+
+bool TemporalAA::settled() const {
+	// Until each pixel of the quads was shaded once, and until what history is left of the
+	// change weighs about 3% with the default blend
+	uint32_t settleFrameCount = mUniforms.mode == Mode::Reuse ? 4 : 32;
+	return mSettlingFrames >= settleFrameCount;
+}
+
+glm::vec2 TemporalAA::nextJitter(const glm::uvec2& sceneSize) {
+	if (mUniforms.mode != Mode::AntiAliasing) return glm::vec2(0.0f);
+	// Halton (2, 3), skipping its first sample at 0
+	uint32_t index = mFrameIndex % JitterSampleCount + 1;
+	glm::vec2 offset = glm::vec2(halton(index, 2), halton(index, 3)) - 0.5f;
+	mUniforms.jitter = 2.0f * offset / glm::vec2(glm::max(sceneSize, glm::uvec2(1)));
+	return mUniforms.jitter;
+}
+
+void TemporalAA::update(
+	Queue queue, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+	const glm::uvec2& sceneSize, const glm::uvec2& sceneTextureSize
+) {
+	// The history does not survive resizes
+	if (sceneTextureSize != mHistoryTextureSize) {
+		terminateHistory();
+		createHistory(sceneTextureSize);
+		mHistoryWritten = false;
+	}
+
+	glm::mat4 viewProjection = projection * view * model;
+	glm::mat4 camera = projection * view;
+	bool hasHistory = mHistoryWritten && ready();
+	bool cameraMoved = camera != mPreviousCamera;
+
+	Uniforms uniforms = mUniforms;
+	uniforms.reprojection = mPreviousViewProjection * glm::inverse(viewProjection);
+	uniforms.depthParameters = { projection[2][2], projection[3][2] };
+	uniforms.sceneSize = glm::max(sceneSize, glm::uvec2(1));
+	uniforms.historySize = hasHistory ? mPreviousSceneSize : glm::uvec2(0);
+	uniforms.pattern = Pattern::All;
+	uniforms.phase = 0;
+	if (uniforms.mode == Mode::Reuse && hasHistory) {
+		uniforms.pattern = cameraMoved ? Pattern::Checkerboard : Pattern::Quad;
+		uniforms.phase = mFrameIndex % (cameraMoved ? 2 : 4);
+	}
+	mPreviousViewProjection = viewProjection;
+	mPreviousCamera = camera;
+	mPreviousSceneSize = uniforms.sceneSize;
+	mHistoryWritten = false;
+	++mFrameIndex;
+
+	if (std::memcmp(&uniforms, &mUniforms, sizeof(Uniforms)) == 0) return;
+	mUniforms = uniforms;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+bool TemporalAA::resolve(
+	CommandEncoder encoder, TextureView sceneView, TextureView depthView, TextureView targetView,
+	const RenderPassTimestampWrites* timestampWrites
+) {
+	if (!ready() || !mHistoryViews[0]) return false;
+
+	if (sceneView != mSceneView || depthView != mDepthView) {
+		for (BindGroup& bindGroup : mBindGroups) {
+			if (bindGroup) bindGroup.release();
+			bindGroup = nullptr;
+		}
+		mSceneView = sceneView;
+		mDepthView = depthView;
+	}
+	BindGroup& bindGroup = mBindGroups[mHistoryIndex];
+	if (!bindGroup) {
+		std::vector<BindGroupEntry> bindings(6);
+		bindings[0].binding = 0;
+		bindings[0].buffer = mUniformBuffer;
+		bindings[0].offset = 0;
+		bindings[0].size = sizeof(Uniforms);
+		bindings[1].binding = 1;
+		bindings[1].textureView = sceneView;
+		bindings[2].binding = 2;
+		bindings[2].textureView = depthView;
+		bindings[3].binding = 3;
+		bindings[3].textureView = mHistoryViews[mHistoryIndex];
+		bindings[4].binding = 4;
+		bindings[4].textureView = mDistanceViews[mHistoryIndex];
+		bindings[5].binding = 5;
+		bindings[5].sampler = mSampler;
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		bindGroup = mDevice.createBindGroup(bindGroupDesc);
+	}
+
+	uint32_t next = 1 - mHistoryIndex;
+	std::vector<RenderPassColorAttachment> colorAttachments(3);
+	colorAttachments[0].view = targetView;
+	colorAttachments[1].view = mHistoryViews[next];
+	colorAttachments[2].view = mDistanceViews[next];
+	for (RenderPassColorAttachment& colorAttachment : colorAttachments) {
+		colorAttachment.resolveTarget = nullptr;
+		colorAttachment.loadOp = LoadOp::Clear;
+		colorAttachment.storeOp = StoreOp::Store;
+		colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+		colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+	}
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Temporal resolve";
+	renderPassDesc.colorAttachmentCount = (uint32_t)colorAttachments.size();
+	renderPassDesc.colorAttachments = colorAttachments.data();
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = timestampWrites;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	const glm::uvec2& size = mUniforms.sceneSize;
+	FullscreenTriangle::draw(renderPass, mPipeline->pipeline, bindGroup, size.x, size.y);
+	renderPass.end();
+	renderPass.release();
+
+	mHistoryIndex = next;
+	mHistoryWritten = true;
+	++mSettlingFrames;
+	return true;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Temporal accumulation of the scene into a history, reprojected from one frame
+ * to the next by motion vectors computed from the depth buffer and the current
+ * and previous projection * view * model matrices. The history also keeps the
+ * view distance of each pixel, and is rejected where the surface reprojected to
+ * it is not at the distance it held, as when it was disoccluded.
+ *
+ * Two modes:
+ *  - AntiAliasing: samples are jittered within their pixel from frame to frame
+ *    (see nextJitter()), and each pixel of the frame is blended into its history
+ *    clamped to the colors around it, which averages the jittered samples where
+ *    the view is still and keeps moving edges from ghosting.
+ *  - Reuse: the main pass only shades a subset of the pixels, the others taking
+ *    their reprojected history (see TEMPORAL_REUSE in resources/shader.wgsl).
+ *    A checkerboard alternating from frame to frame is shaded while the camera
+ *    moves, the history of the other half being clamped to its shaded neighbours.
+ *    One pixel of each 2x2 quad is shaded while it stands still, each one being
+ *    shaded again every 4 frames. Pixels whose history is rejected are filled from
+ *    their shaded neighbours. Samples are not jittered.
+ *
+ * Every pixel is shaded in frames without a valid history, e.g. the first one or
+ * the first one after a resize.
+ */
+class TemporalAA {
+public:
+	static constexpr wgpu::TextureFormat HistoryFormat = wgpu::TextureFormat::RGBA16Float;
+	static constexpr wgpu::TextureFormat DistanceFormat = wgpu::TextureFormat::R32Float;
+	// Of the Halton sequence that jitters the samples
+	static constexpr uint32_t JitterSampleCount = 8;
+
+	enum class Mode : uint32_t {
+		AntiAliasing,
+		Reuse,
+	};
+
+	// Pixels shaded by the main pass in Reuse mode
+	enum class Pattern : uint32_t {
+		All,
+		// One in two, (x + y + phase) being even
+		Checkerboard,
+		// One in each 2x2 quad, the one at (x & 1) + 2 * (y & 1) == phase
+		Quad,
+	};
+
+	/**
+	 * The TemporalUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		// From the unjittered clip space of the frame to the one of the previous frame
+		glm::mat4 reprojection;
+		// Offset of the samples of the frame, in NDC
+		glm::vec2 jitter;
+		// A view distance is b / (depth + a) for (a, b) of the projection matrix, in both depth
+		// conventions
+		glm::vec2 depthParameters;
+		glm::uvec2 sceneSize;
+		// Region of the history holding the previous frame, 0 x 0 when there is none
+		glm::uvec2 historySize;
+		Mode mode;
+		Pattern pattern;
+		uint32_t phase;
+		// Weight of the frame against its history, in AntiAliasing mode
+		float blend;
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	// Resolve a scene of `sceneFormat` drawn with a depth buffer of `sampleCount` samples, into
+	// targets of `sceneFormat`
+	TemporalAA(wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureFormat sceneFormat, uint32_t sampleCount, Mode mode);
+	~TemporalAA();
+
+	TemporalAA(const TemporalAA&) = delete;
+	TemporalAA& operator=(const TemporalAA&) = delete;
+
+	bool valid() const { return mUniformBuffer != nullptr && mSampler != nullptr; }
+	// Whether the pipeline is built, before which resolve() records nothing
+	bool ready() const { return mPipeline->ready(); }
+	Mode mode() const { return mUniforms.mode; }
+
+	// Whether the history caught up with what the frames show since the last restartSettling(),
+	// before which the frames should keep coming even when nothing changes
+	bool settled() const;
+	void restartSettling() { mSettlingFrames = 0; }
+
+	// Bound with the view of the draws in Reuse mode, for the main pass to tell the pixels it shades
+	wgpu::Buffer uniformBuffer() const { return mUniformBuffer; }
+
+	// Offset to add to the NDC of the samples of the next frame, of a scene of `sceneSize` pixels,
+	// 0 in Reuse mode
+	glm::vec2 nextJitter(const glm::uvec2& sceneSize);
+	// Unjittered matrices and region of the scene drawn this frame in a texture of
+	// `sceneTextureSize`, before its passes, reprojecting into those of the previous call.
+	// Selects the pixels the main pass shades.
+	void update(
+		wgpu::Queue queue, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model,
+		const glm::uvec2& sceneSize, const glm::uvec2& sceneTextureSize
+	);
+	// Blend the scene drawn into `sceneView` along with `depthView` with the history into the
+	// scene region of `targetView` and the next history, or return false if not ready
+	bool resolve(
+		wgpu::CommandEncoder encoder, wgpu::TextureView sceneView, wgpu::TextureView depthView, wgpu::TextureView targetView,
+		const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr
+	);
+
+private:
+	void createHistory(const glm::uvec2& size);
+	void terminateHistory();
+
+private:
+	wgpu::Device mDevice;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	PipelineCache::AsyncRenderPipeline mPipeline;
+	wgpu::Sampler mSampler = nullptr;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	Uniforms mUniforms{};
+	uint32_t mFrameIndex = 0;
+	uint32_t mSettlingFrames = 0;
+	// Of the last update()
+	glm::mat4 mPreviousViewProjection = glm::mat4(1.0f);
+	glm::mat4 mPreviousCamera = glm::mat4(1.0f);
+	glm::uvec2 mPreviousSceneSize = { 0, 0 };
+	// Whether the last frame was resolved into the history at mHistoryIndex
+	bool mHistoryWritten = false;
+
+	// Read from mHistoryIndex and written to the other one, swapped by each resolve()
+	glm::uvec2 mHistoryTextureSize = { 0, 0 };
+	std::array<wgpu::Texture, 2> mHistoryTextures = {};
+	std::array<wgpu::TextureView, 2> mHistoryViews = {};
+	std::array<wgpu::Texture, 2> mDistanceTextures = {};
+	std::array<wgpu::TextureView, 2> mDistanceViews = {};
+	uint32_t mHistoryIndex = 0;
+
+	// Bind groups reading each history, of the last scene and depth views, which keep them alive
+	wgpu::TextureView mSceneView = nullptr;
+	wgpu::TextureView mDepthView = nullptr;
+	std::array<wgpu::BindGroup, 2> mBindGroups = {};
+};
@@ -0,0 +1,607 @@
+#include "Terrain.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+const char* terrainShaderSource = R"(
+struct TerrainUniforms {
+	viewProjection: mat4x4f,
+	camera: vec3f,
+	spacing: f32,
+	lightDirection: vec3f,
+	clipmapSize: u32,
+	levels: array<vec4f, 12>,
+}
+
+@group(0) @binding(0) var<uniform> u: TerrainUniforms;
+@group(0) @binding(1) var heights: texture_2d_array<f32>;
+)";
+
+const char* drawShaderSource = R"(
+@group(0) @binding(2) var normals: texture_2d_array<f32>;
+
+struct VertexOutput {
+	@builtin(position) @invariant position: vec4f,
+	@location(0) world: vec3f,
+	@location(1) normal: vec3f,
+}
+
+// Texel of a global sample, wrapping around the layer
+fn texelOf(sample: vec2i) -> vec2i {
+	return sample & vec2i(i32(u.clipmapSize) - 1);
+}
+
+@vertex
+fn vs_main(@location(0) grid: vec2f, @location(1) origin: vec2i, @location(2) level: u32) -> VertexOutput {
+	let spacing = u.spacing * f32(1u << level);
+	let range = u.levels[level];
+	// Odd vertices slide onto their even neighbours over the outer part of the range
+	let distance = length((vec2f(origin) + grid) * spacing - u.camera.xy);
+	let morph = clamp((distance - range.x) / (range.y - range.x), 0.0, 1.0);
+	let sample = vec2f(origin) + grid - fract(grid * 0.5) * 2.0 * morph;
+
+	// Between the two vertices while sliding, exactly on texels otherwise
+	let base = vec2i(floor(sample));
+	let t = sample - floor(sample);
+	var height = 0.0;
+	var normal = vec3f(0.0);
+	for (var i = 0; i < 4; i++) {
+		let offset = vec2i(i & 1, i >> 1);
+		let weight = mix(1.0 - t.x, t.x, f32(offset.x)) * mix(1.0 - t.y, t.y, f32(offset.y));
+		let texel = texelOf(base + offset);
+		height += weight * textureLoad(heights, texel, level, 0).r;
+		normal += weight * textureLoad(normals, texel, level, 0).xyz;
+	}
+
+	var out: VertexOutput;
+	out.world = vec3f(sample * spacing, height);
+	out.position = u.viewProjection * vec4f(out.world, 1.0);
+	out.normal = normal;
+	return out;
+}
+
+fn shade(in: VertexOutput) -> vec4f {
+	let normal = normalize(in.normal);
+	// Rock on slopes, grass elsewhere
+	let grass = vec3f(0.22, 0.36, 0.12);
+	let rock = vec3f(0.42, 0.38, 0.34);
+	let albedo = mix(rock, grass, smoothstep(0.7, 0.9, normal.z));
+	let diffuse = max(dot(normal, normalize(u.lightDirection)), 0.0);
+	return vec4f(albedo * (0.25 + 0.75 * diffuse), 1.0);
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+	return shade(in);
+}
+
+struct FragmentOutput {
+	@location(0) color: vec4f,
+	@location(1) id: u32,
+}
+
+// Along with an ID target, where the terrain hides instances as nothing picked
+@fragment
+fn fs_main_ids(in: VertexOutput) -> FragmentOutput {
+	var out: FragmentOutput;
+	out.color = shade(in);
+	out.id = 0u;
+	return out;
+}
+)";
+
+const char* normalShaderSource = R"(
+@group(0) @binding(2) var normals: texture_storage_2d_array<rgba16float, write>;
+
+@compute @workgroup_size(8, 8)
+fn derive_normals(@builtin(global_invocation_id) id: vec3u) {
+	let mask = vec2i(i32(u.clipmapSize) - 1);
+	let texel = vec2i(id.xy);
+	let level = id.z;
+	let left = textureLoad(heights, (texel - vec2i(1, 0)) & mask, level, 0).r;
+	let right = textureLoad(heights, (texel + vec2i(1, 0)) & mask, level, 0).r;
+	let down = textureLoad(heights, (texel - vec2i(0, 1)) & mask, level, 0).r;
+	let up = textureLoad(heights, (texel + vec2i(0, 1)) & mask, level, 0).r;
+	let spacing = u.spacing * f32(1u << level);
+	let normal = normalize(vec3f(left - right, down - up, 2.0 * spacing));
+	textureStore(normals, texel, level, vec4f(normal, 0.0));
+}
+)";
+
+uint32_t hash(int64_t x, int64_t y, uint32_t seed) {
+	uint32_t h = static_cast<uint32_t>(x) * 0x8da6b343u ^ static_cast<uint32_t>(y) * 0xd8163841u ^ seed * 0xcb1ab31fu;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	h *= 0x297a2d39u;
+	h ^= h >> 15;
+	return h;
+}
+
+// In [-1, 1], smoothly interpolated between random values at integer coordinates
+float valueNoise(double x, double y, uint32_t seed) {
+	double fx = std::floor(x);
+	double fy = std::floor(y);
+	int64_t ix = static_cast<int64_t>(fx);
+	int64_t iy = static_cast<int64_t>(fy);
+	auto value = [seed](int64_t x, int64_t y) {
+		return static_cast<float>(hash(x, y, seed)) * (2.0f / 4294967295.0f) - 1.0f;
+	};
+	float tx = static_cast<float>(x - fx);
+	float ty = static_cast<float>(y - fy);
+	tx = tx * tx * (3.0f - 2.0f * tx);
+	ty = ty * ty * (3.0f - 2.0f * ty);
+	float bottom = value(ix, iy) + (value(ix + 1, iy) - value(ix, iy)) * tx;
+	float top = value(ix, iy + 1) + (value(ix + 1, iy + 1) - value(ix, iy + 1)) * tx;
+	return bottom + (top - bottom) * ty;
+}
+
+bool boxInFrustum(const glm::vec3& min, const glm::vec3& max, const Frustum& frustum) {
+	for (const glm::vec4& plane : frustum.planes) {
+		// The corner furthest along the normal
+		glm::vec3 corner = glm::mix(min, max, glm::vec3(glm::greaterThanEqual(glm::vec3(plane), glm::vec3(0.0f))));
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) return false;
+	}
+	return true;
+}
+
+bool boxInCircle(const glm::vec2& min, const glm::vec2& max, const glm::vec2& center, float radius) {
+	glm::vec2 closest = glm::clamp(center, min, max);
+	glm::vec2 offset = closest - center;
+	return glm::dot(offset, offset) <= radius * radius;
+}
+
+int64_t floorDiv(int64_t value, int64_t divisor) {
+	int64_t quotient = value / divisor;
+	return quotient * divisor > value ? quotient - 1 : quotient;
+}
+
+} // anonymous namespace
+
+Terrain::HeightSource Terrain::fractalHeights(float baseHeight, float amplitude, float featureSize, uint32_t seed) {
+	return [=](int64_t x, int64_t y, uint32_t width, uint32_t height, double spacing, float* heights) {
+		constexpr uint32_t octaveCount = 10;
+		for (uint32_t j = 0; j < height; ++j) {
+			for (uint32_t i = 0; i < width; ++i) {
+				// Same positions at every level, spacings being powers of two of each other
+				double px = double(x + i) * spacing / featureSize;
+				double py = double(y + j) * spacing / featureSize;
+				float sum = 0.0f;
+				float octaveAmplitude = 0.5f;
+				for (uint32_t octave = 0; octave < octaveCount; ++octave) {
+					sum += octaveAmplitude * valueNoise(px, py, seed + octave);
+					px *= 2.0;
+					py *= 2.0;
+					octaveAmplitude *= 0.5f;
+				}
+				heights[j * width + i] = baseHeight + amplitude * sum;
+			}
+		}
+	};
+}
+
+Terrain::Terrain(
+	Device device, PipelineCache& pipelineCache, HeightSource source, const Settings& settings,
+	TextureFormat colorFormat, TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+)
+	: mDevice(device)
+	, mSource(std::move(source))
+	, mSettings(settings)
+{
+	mSettings.levelCount = std::clamp(mSettings.levelCount, 1u, MaxLevelCount);
+	mSettings.sampleBudget = std::max(mSettings.sampleBudget, ClipmapSize * ClipmapSize);
+	mLayers.resize(mSettings.levelCount);
+	mFinestLevel = mSettings.levelCount;
+	// Column strips are padded to rows of 256 bytes in staging memory
+	mUploader = std::make_unique<UploadManager>(device, 1 << 20, 4);
+
+	mUniforms.spacing = mSettings.spacing;
+	for (uint32_t level = 0; level < mSettings.levelCount; ++level) {
+		float range = mSettings.rangeFactor * static_cast<float>(nodeSize(level));
+		mUniforms.levels[level] = glm::vec4((1.0f - mSettings.morphRatio) * range, range, 0.0f, 0.0f);
+	}
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Terrain uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "Terrain");
+
+	// The grid, with the triangles of each quadrant together
+	std::vector<glm::vec2> gridVertices;
+	gridVertices.reserve((GridSize + 1) * (GridSize + 1));
+	for (uint32_t y = 0; y <= GridSize; ++y) {
+		for (uint32_t x = 0; x <= GridSize; ++x) {
+			gridVertices.push_back(glm::vec2(x, y));
+		}
+	}
+	std::vector<uint16_t> gridIndices;
+	constexpr uint32_t half = GridSize / 2;
+	for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+		uint32_t x0 = (quadrant & 1) * half;
+		uint32_t y0 = (quadrant >> 1) * half;
+		for (uint32_t y = y0; y < y0 + half; ++y) {
+			for (uint32_t x = x0; x < x0 + half; ++x) {
+				uint16_t corner = static_cast<uint16_t>(y * (GridSize + 1) + x);
+				uint16_t above = static_cast<uint16_t>(corner + GridSize + 1);
+				gridIndices.insert(gridIndices.end(), { corner, static_cast<uint16_t>(corner + 1), static_cast<uint16_t>(above + 1) });
+				gridIndices.insert(gridIndices.end(), { corner, static_cast<uint16_t>(above + 1), above });
+			}
+		}
+	}
+	mQuadrantIndexCount = static_cast<uint32_t>(gridIndices.size() / 4);
+
+	bufferDesc.label = "Terrain grid vertices";
+	bufferDesc.size = gridVertices.size() * sizeof(glm::vec2);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+	mGridVertexBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Geometry, "Terrain");
+	bufferDesc.label = "Terrain grid indices";
+	bufferDesc.size = gridIndices.size() * sizeof(uint16_t);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Index;
+	mGridIndexBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Geometry, "Terrain");
+	mUploader->writeBuffer(mGridVertexBuffer, 0, gridVertices.data(), gridVertices.size() * sizeof(glm::vec2));
+	mUploader->writeBuffer(mGridIndexBuffer, 0, gridIndices.data(), gridIndices.size() * sizeof(uint16_t));
+	mUploader->flush();
+
+	// The clipmap, a layer per level
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Terrain heights";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = HeightFormat;
+	textureDesc.size = { ClipmapSize, ClipmapSize, mSettings.levelCount };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mHeightTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "Terrain");
+	textureDesc.label = "Terrain normals";
+	textureDesc.format = NormalFormat;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::StorageBinding;
+	mNormalTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "Terrain");
+	if (!valid()) return;
+
+	TextureViewDescriptor viewDesc{};
+	viewDesc.dimension = TextureViewDimension::_2DArray;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = mSettings.levelCount;
+	viewDesc.aspect = TextureAspect::All;
+	viewDesc.format = HeightFormat;
+	mHeightView = mHeightTexture.createView(viewDesc);
+	viewDesc.format = NormalFormat;
+	mNormalView = mNormalTexture.createView(viewDesc);
+
+	// Uniforms and heights, then normals read by the draws or written by the compute pass
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Vertex | ShaderStage::Fragment | ShaderStage::Compute;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Vertex | ShaderStage::Compute;
+	bindingLayoutEntries[1].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[1].texture.viewDimension = TextureViewDimension::_2DArray;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Vertex;
+	bindingLayoutEntries[2].texture.sampleType = TextureSampleType::UnfilterableFloat;
+	bindingLayoutEntries[2].texture.viewDimension = TextureViewDimension::_2DArray;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mDrawLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	bindingLayoutEntries[2] = Default;
+	bindingLayoutEntries[2].binding = 2;
+	bindingLayoutEntries[2].visibility = ShaderStage::Compute;
+	bindingLayoutEntries[2].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[2].storageTexture.format = NormalFormat;
+	bindingLayoutEntries[2].storageTexture.viewDimension = TextureViewDimension::_2DArray;
+	mNormalLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	std::vector<BindGroupEntry> bindings(3);
+	bindings[0].binding = 0;
+	bindings[0].buffer = mUniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(Uniforms);
+	bindings[1].binding = 1;
+	bindings[1].textureView = mHeightView;
+	bindings[2].binding = 2;
+	bindings[2].textureView = mNormalView;
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mDrawLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mDrawBindGroup = device.createBindGroup(bindGroupDesc);
+	bindGroupDesc.layout = mNormalLayout;
+	mNormalBindGroup = device.createBindGroup(bindGroupDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mNormalLayout;
+	ComputePipelineDescriptor computePipelineDesc{};
+	computePipelineDesc.label = "Terrain normals";
+	computePipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	computePipelineDesc.compute.module = pipelineCache.shaderModule((std::string(terrainShaderSource) + normalShaderSource).c_str());
+	computePipelineDesc.compute.entryPoint = "derive_normals";
+	computePipelineDesc.compute.constantCount = 0;
+	computePipelineDesc.compute.constants = nullptr;
+	mNormalPipeline = pipelineCache.computePipelineAsync(computePipelineDesc);
+
+	// The grid, then the node of each instance
+	std::array<VertexAttribute, 3> attributes{};
+	attributes[0].shaderLocation = 0;
+	attributes[0].format = VertexFormat::Float32x2;
+	attributes[0].offset = 0;
+	attributes[1].shaderLocation = 1;
+	attributes[1].format = VertexFormat::Sint32x2;
+	attributes[1].offset = offsetof(Node, origin);
+	attributes[2].shaderLocation = 2;
+	attributes[2].format = VertexFormat::Uint32;
+	attributes[2].offset = offsetof(Node, level);
+	std::array<VertexBufferLayout, 2> vertexBufferLayouts{};
+	vertexBufferLayouts[0].arrayStride = sizeof(glm::vec2);
+	vertexBufferLayouts[0].stepMode = VertexStepMode::Vertex;
+	vertexBufferLayouts[0].attributeCount = 1;
+	vertexBufferLayouts[0].attributes = &attributes[0];
+	vertexBufferLayouts[1].arrayStride = sizeof(Node);
+	vertexBufferLayouts[1].stepMode = VertexStepMode::Instance;
+	vertexBufferLayouts[1].attributeCount = 2;
+	vertexBufferLayouts[1].attributes = &attributes[1];
+
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mDrawLayout;
+	ShaderModule shaderModule = pipelineCache.shaderModule((std::string(terrainShaderSource) + drawShaderSource).c_str());
+
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.label = "Terrain";
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.vertex.bufferCount = (uint32_t)vertexBufferLayouts.size();
+	pipelineDesc.vertex.buffers = vertexBufferLayouts.data();
+	pipelineDesc.vertex.module = shaderModule;
+	pipelineDesc.vertex.entryPoint = "vs_main";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	pipelineDesc.primitive.cullMode = CullMode::Back;
+
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = idFormat == TextureFormat::Undefined ? "fs_main" : "fs_main_ids";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	std::array<ColorTargetState, 2> colorTargets{};
+	colorTargets[0].format = colorFormat;
+	colorTargets[0].blend = nullptr;
+	colorTargets[0].writeMask = ColorWriteMask::All;
+	colorTargets[1].format = idFormat;
+	colorTargets[1].blend = nullptr;
+	colorTargets[1].writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = idFormat == TextureFormat::Undefined ? 1 : 2;
+	fragmentState.targets = colorTargets.data();
+	pipelineDesc.fragment = &fragmentState;
+
+	// Equal depths pass as well, for the draw after the depth only one
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.depthCompare = depthConvention.nearer(true);
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.format = depthConvention.format();
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencilState;
+	pipelineDesc.multisample.count = sampleCount;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+	mDrawPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+
+	pipelineDesc.label = "Terrain depth";
+	pipelineDesc.fragment = nullptr;
+	depthStencilState.depthCompare = depthConvention.nearer();
+	mDepthPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+Terrain::~Terrain() {
+	// Copies still recorded reference the textures
+	mUploader.reset();
+	if (mDrawBindGroup) mDrawBindGroup.release();
+	if (mNormalBindGroup) mNormalBindGroup.release();
+	if (mHeightView) mHeightView.release();
+	if (mNormalView) mNormalView.release();
+	for (Texture* texture : { &mHeightTexture, &mNormalTexture }) {
+		if (!*texture) continue;
+		destroyTracked(*texture);
+		texture->release();
+	}
+	for (Buffer* buffer : { &mNodeBuffer, &mGridIndexBuffer, &mGridVertexBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+}
+
+void Terrain::update(Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::vec3& lightDirection) {
+	if (!valid()) return;
+	glm::vec3 camera = glm::vec3(glm::inverse(viewMatrix)[3]);
+	updateLayers(glm::dvec2(camera));
+
+	// Nodes of the coarsest level within its range, subdivided down to the finest level up to date
+	for (std::vector<Node>& nodes : mQuadrantNodes) nodes.clear();
+	glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+	Frustum frustum = Frustum::fromMatrix(viewProjection);
+	if (mFinestLevel < mSettings.levelCount) {
+		uint32_t top = mSettings.levelCount - 1;
+		double size = nodeSize(top);
+		double range = mUniforms.levels[top].y;
+		int64_t x0 = static_cast<int64_t>(std::floor((camera.x - range) / size));
+		int64_t x1 = static_cast<int64_t>(std::floor((camera.x + range) / size));
+		int64_t y0 = static_cast<int64_t>(std::floor((camera.y - range) / size));
+		int64_t y1 = static_cast<int64_t>(std::floor((camera.y + range) / size));
+		for (int64_t y = y0; y <= y1; ++y) {
+			for (int64_t x = x0; x <= x1; ++x) {
+				selectNode(x, y, top, glm::vec2(camera), frustum);
+			}
+		}
+	}
+
+	mNodeData.clear();
+	for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+		mQuadrantFirstNode[quadrant] = static_cast<uint32_t>(mNodeData.size());
+		mNodeData.insert(mNodeData.end(), mQuadrantNodes[quadrant].begin(), mQuadrantNodes[quadrant].end());
+	}
+	mNodeCount = static_cast<uint32_t>(mNodeData.size());
+	if (mNodeCount > mNodeCapacity) {
+		if (mNodeBuffer) {
+			destroyTracked(mNodeBuffer);
+			mNodeBuffer.release();
+		}
+		mNodeCapacity = std::max(2 * mNodeCount, 256u);
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = "Terrain nodes";
+		bufferDesc.size = mNodeCapacity * sizeof(Node);
+		bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+		bufferDesc.mappedAtCreation = false;
+		mNodeBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::SceneData, "Terrain");
+	}
+	if (mNodeCount > 0) queue.writeBuffer(mNodeBuffer, 0, mNodeData.data(), mNodeData.size() * sizeof(Node));
+
+	mUniforms.viewProjection = viewProjection;
+	mUniforms.camera = camera;
+	mUniforms.lightDirection = lightDirection;
+	queue.writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+void Terrain::updateLayers(const glm::dvec2& camera) {
+	int64_t budget = mSettings.sampleBudget;
+	uint32_t finestLevel = mSettings.levelCount;
+	constexpr int64_t size = ClipmapSize;
+	for (uint32_t level = mSettings.levelCount; level-- > 0;) {
+		// Centered on the camera, to the texel
+		double spacing = double(mSettings.spacing) * double(1u << level);
+		glm::i64vec2 origin = glm::i64vec2(glm::floor(camera / spacing)) - size / 2;
+		Layer& layer = mLayers[level];
+		glm::i64vec2 delta = origin - layer.origin;
+		bool refill = !layer.filled || std::abs(delta.x) >= size || std::abs(delta.y) >= size;
+		int64_t cost = refill ? size * size : std::abs(delta.x) * size + std::abs(delta.y) * (size - std::abs(delta.x));
+		if (cost > budget) break;
+		budget -= cost;
+		finestLevel = level;
+		if (cost == 0) continue;
+
+		if (refill) {
+			uploadRegion(level, origin.x, origin.y, ClipmapSize, ClipmapSize);
+		}
+		else {
+			// Columns entering the layer, over all its new rows, then rows entering it over the
+			// columns it kept
+			uint32_t columnCount = static_cast<uint32_t>(std::abs(delta.x));
+			uint32_t rowCount = static_cast<uint32_t>(std::abs(delta.y));
+			int64_t columnStart = delta.x > 0 ? layer.origin.x + size : origin.x;
+			int64_t keptColumnStart = delta.x > 0 ? origin.x : origin.x + columnCount;
+			int64_t rowStart = delta.y > 0 ? layer.origin.y + size : origin.y;
+			uploadRegion(level, columnStart, origin.y, columnCount, ClipmapSize);
+			uploadRegion(level, keptColumnStart, rowStart, ClipmapSize - columnCount, rowCount);
+		}
+		layer.origin = origin;
+		layer.filled = true;
+		mNormalsDirty = true;
+	}
+	mFinestLevel = finestLevel;
+	mUploader->flush();
+}
+
+void Terrain::uploadRegion(uint32_t level, int64_t x, int64_t y, uint32_t width, uint32_t height) {
+	if (width == 0 || height == 0) return;
+	double spacing = double(mSettings.spacing) * double(1u << level);
+	constexpr int64_t size = ClipmapSize;
+	for (uint32_t row = 0; row < height;) {
+		uint32_t texelY = static_cast<uint32_t>(y + row - floorDiv(y + row, size) * size);
+		uint32_t pieceHeight = std::min(height - row, ClipmapSize - texelY);
+		for (uint32_t column = 0; column < width;) {
+			uint32_t texelX = static_cast<uint32_t>(x + column - floorDiv(x + column, size) * size);
+			uint32_t pieceWidth = std::min(width - column, ClipmapSize - texelX);
+			mSamples.resize(size_t(pieceWidth) * pieceHeight);
+			mSource(x + column, y + row, pieceWidth, pieceHeight, spacing, mSamples.data());
+
+			ImageCopyTexture destination{};
+			destination.texture = mHeightTexture;
+			destination.mipLevel = 0;
+			destination.origin = { texelX, texelY, level };
+			destination.aspect = TextureAspect::All;
+			mUploader->writeTexture(destination, mSamples.data(), pieceWidth * sizeof(float), pieceHeight, { pieceWidth, pieceHeight, 1 });
+			column += pieceWidth;
+		}
+		row += pieceHeight;
+	}
+}
+
+bool Terrain::selectNode(int64_t x, int64_t y, uint32_t level, const glm::vec2& camera, const Frustum& frustum) {
+	float size = static_cast<float>(nodeSize(level));
+	glm::vec2 min = glm::vec2(glm::dvec2(x, y) * nodeSize(level));
+	glm::vec2 max = min + size;
+	if (!boxInCircle(min, max, camera, mUniforms.levels[level].y)) return false;
+	// Out of view, thus neither drawn nor subdivided, but covered
+	if (!boxInFrustum(glm::vec3(min, mSettings.minHeight), glm::vec3(max, mSettings.maxHeight), frustum)) return true;
+
+	uint32_t quadrants = 0b1111;
+	if (level > mFinestLevel && boxInCircle(min, max, camera, mUniforms.levels[level - 1].y)) {
+		for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+			if (selectNode(2 * x + (quadrant & 1), 2 * y + (quadrant >> 1), level - 1, camera, frustum)) {
+				quadrants &= ~(1u << quadrant);
+			}
+		}
+	}
+	Node node{ glm::ivec2(glm::i64vec2(x, y) * int64_t(GridSize)), level };
+	for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+		if (quadrants & (1u << quadrant)) mQuadrantNodes[quadrant].push_back(node);
+	}
+	return true;
+}
+
+void Terrain::encodeNormals(CommandEncoder encoder, const ComputePassTimestampWrites* timestampWrites) {
+	if (!valid() || !ready()) return;
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Terrain normals";
+	computePassDesc.timestampWrites = timestampWrites;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mNormalPipeline->pipeline);
+	computePass.setBindGroup(0, mNormalBindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups(ClipmapSize / 8, ClipmapSize / 8, mSettings.levelCount);
+	computePass.end();
+	computePass.release();
+	mNormalsDirty = false;
+}
+
+void Terrain::draw(RenderPassEncoder renderPass) {
+	if (!valid() || !ready() || mNodeCount == 0) return;
+	renderPass.setPipeline(mDrawPipeline->pipeline);
+	renderPass.setBindGroup(0, mDrawBindGroup, 0, nullptr);
+	renderPass.setVertexBuffer(0, mGridVertexBuffer, 0, mGridVertexBuffer.getSize());
+	renderPass.setVertexBuffer(1, mNodeBuffer, 0, mNodeBuffer.getSize());
+	renderPass.setIndexBuffer(mGridIndexBuffer, IndexFormat::Uint16, 0, mGridIndexBuffer.getSize());
+	for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+		uint32_t count = static_cast<uint32_t>(mQuadrantNodes[quadrant].size());
+		if (count > 0) renderPass.drawIndexed(mQuadrantIndexCount, count, quadrant * mQuadrantIndexCount, 0, mQuadrantFirstNode[quadrant]);
+	}
+}
+
+void Terrain::drawDepth(RenderPassEncoder renderPass) {
+	if (!valid() || !ready() || mNodeCount == 0) return;
+	renderPass.setPipeline(mDepthPipeline->pipeline);
+	renderPass.setBindGroup(0, mDrawBindGroup, 0, nullptr);
+	renderPass.setVertexBuffer(0, mGridVertexBuffer, 0, mGridVertexBuffer.getSize());
+	renderPass.setVertexBuffer(1, mNodeBuffer, 0, mNodeBuffer.getSize());
+	renderPass.setIndexBuffer(mGridIndexBuffer, IndexFormat::Uint16, 0, mGridIndexBuffer.getSize());
+	for (uint32_t quadrant = 0; quadrant < 4; ++quadrant) {
+		uint32_t count = static_cast<uint32_t>(mQuadrantNodes[quadrant].size());
+		if (count > 0) renderPass.drawIndexed(mQuadrantIndexCount, count, quadrant * mQuadrantIndexCount, 0, mQuadrantFirstNode[quadrant]);
+	}
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "DepthConvention.h"
+#include "UploadManager.h"
+#include "FrustumCulling.h"
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Terrain of any extent, drawn from heights produced on demand, whose memory
+ * follows the view distance rather than the size of the terrain: continuous
+ * distance-dependent level of detail (CDLOD, Strugar 2009) over a clipmap of
+ * the heights.
+ *
+ * A single grid mesh of GridSize x GridSize quads is drawn for every node of an
+ * implicit quadtree selected around the camera each frame. Nodes of level l are
+ * 2^l times the size of those of level 0, and are used up to a range 2^l times
+ * that of level 0, beyond which the level above takes over. Over the outer part
+ * of each range, the odd vertices of the grid slide onto their even neighbours,
+ * so that at the range the grid matches that of the level above and neighbouring
+ * nodes of different levels meet without cracks. Nodes partly covered by finer
+ * nodes draw the remaining quadrants of the grid alone, each quadrant being a
+ * range of the index buffer drawn for all the nodes needing it at once.
+ *
+ * The vertex shader displaces the grid by heights read from the clipmap: a layer
+ * of ClipmapSize x ClipmapSize texels per level around the camera, one texel per
+ * vertex of that level. Layers are addressed toroidally, by the global index of a
+ * texel modulo the layer size, so that as the camera moves only the rows and
+ * columns entering a layer are produced by the height source and uploaded, through
+ * the staging ring of an UploadManager. A compute pass then derives the normals of
+ * the layers from their heights. Layers are updated from the coarsest one within a
+ * budget of samples per frame, finer levels than the last one up to date being left
+ * out of the selection until they are, coarser nodes covering their area.
+ *
+ * Heights are in world units along z, the ground plane being xy.
+ */
+class Terrain {
+public:
+	// Quads along a side of the grid mesh, and texels along a side of a layer, which must hold
+	// the vertices of the nodes of its level within its range (see Settings::rangeFactor)
+	static constexpr uint32_t GridSize = 32;
+	static constexpr uint32_t ClipmapSize = 256;
+	static constexpr uint32_t MaxLevelCount = 12;
+	static constexpr wgpu::TextureFormat HeightFormat = wgpu::TextureFormat::R32Float;
+	static constexpr wgpu::TextureFormat NormalFormat = wgpu::TextureFormat::RGBA16Float;
+
+	// Fill `heights`, row by row, with the `width` x `height` samples of the region starting at
+	// sample (x, y) of a grid of `spacing` world units, i.e. at world positions (x + i, y + j) *
+	// spacing. It must return the same height for the same position whatever the spacing, for
+	// the levels to match.
+	using HeightSource = std::function<void(int64_t x, int64_t y, uint32_t width, uint32_t height, double spacing, float* heights)>;
+
+	struct Settings {
+		// Levels of detail, the view distance doubling with each one
+		uint32_t levelCount = 8;
+		// Distance between the vertices of level 0, in world units
+		float spacing = 1.0f / 64.0f;
+		// Range of each level in sizes of its nodes, at most (ClipmapSize / 2 - 1) / GridSize - 1 for
+		// the nodes to fit in their layer, and the outer part of the range over which vertices
+		// slide, at most 1 - (rangeFactor + sqrt(2)) / (2 * rangeFactor) for the vertices of a
+		// level to stay still where they meet finer nodes
+		float rangeFactor = 2.5f;
+		float morphRatio = 0.2f;
+		// Bounds of the heights, for culling the nodes
+		float minHeight = -1.0f;
+		float maxHeight = 1.0f;
+		// Height samples produced and uploaded per frame at most, at least a layer
+		uint32_t sampleBudget = 2 * ClipmapSize * ClipmapSize;
+	};
+
+	// Several octaves of value noise, of `amplitude` around `baseHeight` with features as large as
+	// `featureSize` world units down to about a thousandth of that
+	static HeightSource fractalHeights(float baseHeight, float amplitude, float featureSize, uint32_t seed = 1);
+
+	// Drawn within render passes of a `colorFormat` attachment, an `idFormat` one (written 0, as
+	// the terrain cannot be picked, Undefined if none) and a depth buffer of `depthConvention`, of
+	// `sampleCount` samples
+	Terrain(
+		wgpu::Device device, PipelineCache& pipelineCache, HeightSource source, const Settings& settings,
+		wgpu::TextureFormat colorFormat, wgpu::TextureFormat idFormat, DepthConvention depthConvention, uint32_t sampleCount
+	);
+	~Terrain();
+
+	Terrain(const Terrain&) = delete;
+	Terrain& operator=(const Terrain&) = delete;
+
+	// Whether the clipmap could be created
+	bool valid() const { return mHeightTexture != nullptr && mNormalTexture != nullptr; }
+	// Whether the pipelines are built, before which nothing is recorded
+	bool ready() const { return mDrawPipeline->ready() && mDepthPipeline->ready() && mNormalPipeline->ready(); }
+
+	// Select the nodes seen by the camera, upload the layer texels they need, and the uniforms.
+	// `lightDirection` points towards the light.
+	void update(wgpu::Queue queue, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::vec3& lightDirection);
+
+	// Whether update() changed heights, whose normals must be derived again by encodeNormals()
+	// before the next draw
+	bool normalsDirty() const { return mNormalsDirty; }
+	// Record the derivation of the normals of all layers in a compute pass of its own
+	void encodeNormals(wgpu::CommandEncoder encoder, const wgpu::ComputePassTimestampWrites* timestampWrites = nullptr);
+
+	// Draw the nodes selected by the last update(), writing depth. The depth only version is for
+	// depth pre-passes, after which draw() passes the depth test where the pre-pass drew.
+	void draw(wgpu::RenderPassEncoder renderPass);
+	void drawDepth(wgpu::RenderPassEncoder renderPass);
+
+	// Nodes selected by the last update(), and the finest level drawn
+	uint32_t nodeCount() const { return mNodeCount; }
+	uint32_t finestLevel() const { return mFinestLevel; }
+
+private:
+	/**
+	 * The TerrainUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+		glm::vec<3, float, glm::packed_highp> camera = { 0.0f, 0.0f, 0.0f };
+		float spacing = 0.0f;
+		glm::vec<3, float, glm::packed_highp> lightDirection = { 0.0f, 0.0f, 1.0f };
+		uint32_t clipmapSize = ClipmapSize;
+		// Distances at which vertices of each level start and finish sliding, in xy
+		std::array<glm::vec4, MaxLevelCount> levels = {};
+	};
+	static_assert(sizeof(Uniforms) == 96 + 16 * MaxLevelCount);
+
+	/**
+	 * A node drawn, the instance attributes of the grid mesh
+	 */
+	struct Node {
+		// First vertex of the node, in samples of its level
+		glm::ivec2 origin;
+		uint32_t level;
+		uint32_t padding = 0;
+	};
+
+	/**
+	 * Region of the samples of a level held by its layer, [origin, origin + ClipmapSize) along
+	 * both axes
+	 */
+	struct Layer {
+		glm::i64vec2 origin = { 0, 0 };
+		bool filled = false;
+	};
+
+	// Move the layers towards the camera within the sample budget, from the coarsest one
+	void updateLayers(const glm::dvec2& camera);
+	// Produce and upload samples [x, x + width) x [y, y + height) of `level`, split where the
+	// layer wraps around
+	void uploadRegion(uint32_t level, int64_t x, int64_t y, uint32_t width, uint32_t height);
+
+	// Select node (x, y) of `level`, in sizes of its nodes, or the parts of it its children do
+	// not cover. Returns false if the node is out of the range of its level, its parent then
+	// covering its area itself.
+	bool selectNode(int64_t x, int64_t y, uint32_t level, const glm::vec2& camera, const Frustum& frustum);
+
+	double nodeSize(uint32_t level) const { return double(mSettings.spacing) * GridSize * double(1u << level); }
+
+private:
+	wgpu::Device mDevice;
+	HeightSource mSource;
+	Settings mSettings;
+	std::unique_ptr<UploadManager> mUploader;
+
+	std::vector<Layer> mLayers;
+	// Levels from this one up are up to date, finer ones are not selected
+	uint32_t mFinestLevel = 0;
+	bool mNormalsDirty = false;
+	std::vector<float> mSamples;
+
+	// Selected nodes by quadrant of the grid they draw, uploaded one list after the other
+	std::array<std::vector<Node>, 4> mQuadrantNodes;
+	std::vector<Node> mNodeData;
+	std::array<uint32_t, 4> mQuadrantFirstNode = {};
+	uint32_t mNodeCount = 0;
+	Uniforms mUniforms;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	// Vertices of the grid, in quads from its corner, and triangles of each quadrant after the other
+	wgpu::Buffer mGridVertexBuffer = nullptr;
+	wgpu::Buffer mGridIndexBuffer = nullptr;
+	uint32_t mQuadrantIndexCount = 0;
+	wgpu::Buffer mNodeBuffer = nullptr;
+	uint32_t mNodeCapacity = 0;
+
+	wgpu::Texture mHeightTexture = nullptr;
+	wgpu::TextureView mHeightView = nullptr;
+	wgpu::Texture mNormalTexture = nullptr;
+	wgpu::TextureView mNormalView = nullptr;
+
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mDrawLayout = nullptr;
+	wgpu::BindGroupLayout mNormalLayout = nullptr;
+	PipelineCache::AsyncRenderPipeline mDrawPipeline;
+	PipelineCache::AsyncRenderPipeline mDepthPipeline;
+	PipelineCache::AsyncComputePipeline mNormalPipeline;
+	wgpu::BindGroup mDrawBindGroup = nullptr;
+	wgpu::BindGroup mNormalBindGroup = nullptr;
+};
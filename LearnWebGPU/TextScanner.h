@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Simd.h"
+
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Scanning and number conversion shared by the text geometry parsers (see
+ * ObjParser.h and TxtGeometryParser.h), whose counting pass only looks for the
+ * ends of lines and the number of fields on them, and whose parsing pass is
+ * mostly float conversion.
+ *
+ *  - findLineEnd and countFields look at 16 bytes at a time, comparing them
+ *    against the separators at once and working on the resulting bit masks.
+ *  - parseFloat converts the short decimals that geometry files are made of
+ *    (at most 15 significant digits and a small exponent) with a single double
+ *    multiplication or division, which is correctly rounded, and leaves the
+ *    others to std::from_chars (Eisel-Lemire in the standard libraries we build
+ *    with).
+ *
+ * Header only, the parsers calling these once per field.
+ */
+namespace text {
+
+#if defined(SIMD_128)
+
+/**
+ * Masks of the bytes of a 16 byte block equal to some characters, bit i for byte i
+ */
+struct Block {
+#if defined(SIMD_SSE2)
+	__m128i bytes;
+	explicit Block(const char* p) : bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+	uint32_t equal(char c) const { return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)))); }
+#elif defined(SIMD_NEON)
+	uint8x16_t bytes;
+	explicit Block(const char* p) : bytes(vld1q_u8(reinterpret_cast<const uint8_t*>(p))) {}
+	uint32_t equal(char c) const {
+		// Weight each lane by its bit, then add the 8 lanes of each half
+		static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+		uint8x16_t bits = vandq_u8(vceqq_u8(bytes, vdupq_n_u8(static_cast<uint8_t>(c))), vld1q_u8(weights));
+		uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+		sum = vpadd_u8(sum, sum);
+		sum = vpadd_u8(sum, sum);
+		return vget_lane_u8(sum, 0) | (uint32_t(vget_lane_u8(sum, 1)) << 8);
+	}
+#elif defined(SIMD_WASM)
+	v128_t bytes;
+	explicit Block(const char* p) : bytes(wasm_v128_load(p)) {}
+	uint32_t equal(char c) const { return wasm_i8x16_bitmask(wasm_i8x16_eq(bytes, wasm_i8x16_splat(c))); }
+#endif
+};
+#endif
+
+// The '\n' ending the line that `p` is on, or `end`
+inline const char* findLineEnd(const char* p, const char* end) {
+#if defined(SIMD_128)
+	for (; end - p >= 16; p += 16) {
+		if (uint32_t newlines = Block(p).equal('\n')) return p + std::countr_zero(newlines);
+	}
+#endif
+	while (p < end && *p != '\n') ++p;
+	return p;
+}
+
+// Number of fields separated by spaces or tabs from `p` to the end of its line or to a '#' or
+// '\r', whichever comes first. The end of the line is written to `lineEnd`.
+inline uint32_t countFields(const char* p, const char* end, const char*& lineEnd) {
+	uint32_t count = 0;
+	// Whether the byte before the current one belongs to a field
+	bool inField = false;
+#if defined(SIMD_128)
+	for (; end - p >= 16; p += 16) {
+		Block block(p);
+		uint32_t stops = block.equal('\n') | block.equal('\r') | block.equal('#');
+		uint32_t fields = ~(block.equal(' ') | block.equal('\t')) & 0xffff;
+		if (stops) fields &= (1u << std::countr_zero(stops)) - 1;
+		// A field starts where a byte of a field follows a separator
+		uint32_t starts = fields & ~((fields << 1) | (inField ? 1u : 0u));
+		count += static_cast<uint32_t>(std::popcount(starts));
+		if (stops) {
+			p += std::countr_zero(stops);
+			lineEnd = *p == '\n' ? p : findLineEnd(p, end);
+			return count;
+		}
+		inField = (fields >> 15) != 0;
+	}
+#endif
+	for (; p < end && *p != '\n' && *p != '\r' && *p != '#'; ++p) {
+		bool field = *p != ' ' && *p != '\t';
+		count += field && !inField ? 1 : 0;
+		inField = field;
+	}
+	lineEnd = findLineEnd(p, end);
+	return count;
+}
+
+// Convert the decimal at `p`, with an optional sign and exponent, return the end of the number
+// or nullptr if there is none. Unlike std::from_chars, accept an explicit '+' sign.
+inline const char* parseFloat(const char* p, const char* end, float& value) {
+	if (p < end && *p == '+') ++p;
+	const char* start = p;
+	bool negative = p < end && *p == '-';
+	if (negative) ++p;
+
+	// Digits of the mantissa, then the power of ten it is scaled by
+	uint64_t mantissa = 0;
+	const char* digits = p;
+	for (; p < end && static_cast<unsigned char>(*p - '0') < 10; ++p) {
+		mantissa = 10 * mantissa + static_cast<uint64_t>(*p - '0');
+	}
+	ptrdiff_t digitCount = p - digits;
+	int exponent = 0;
+	if (p < end && *p == '.') {
+		const char* fraction = ++p;
+		for (; p < end && static_cast<unsigned char>(*p - '0') < 10; ++p) {
+			mantissa = 10 * mantissa + static_cast<uint64_t>(*p - '0');
+		}
+		exponent = -static_cast<int>(p - fraction);
+		digitCount += p - fraction;
+	}
+	bool hasDigits = digitCount > 0;
+	if (hasDigits && p < end && (*p == 'e' || *p == 'E')) {
+		// An exponent without digits is not part of the number
+		const char* q = p + 1;
+		bool negativeExponent = q < end && *q == '-';
+		if (q < end && (*q == '-' || *q == '+')) ++q;
+		int explicitExponent = 0;
+		const char* exponentDigits = q;
+		for (; q < end && static_cast<unsigned char>(*q - '0') < 10 && explicitExponent < 10000; ++q) {
+			explicitExponent = 10 * explicitExponent + (*q - '0');
+		}
+		if (q > exponentDigits) {
+			exponent += negativeExponent ? -explicitExponent : explicitExponent;
+			p = q;
+		}
+	}
+
+	// A mantissa and a power of ten that are both exact doubles make their product or quotient
+	// the correctly rounded double (Clinger's fast path). Rounding that double to a float then
+	// gives the correctly rounded float, unless it lies exactly halfway between two floats.
+	constexpr double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	// Up to 19 digits, leading zeros included, cannot overflow the mantissa
+	if (hasDigits && digitCount <= 19 && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+		double result = static_cast<double>(mantissa);
+		result = exponent < 0 ? result / powersOfTen[-exponent] : result * powersOfTen[exponent];
+		// The 29 bits of the double that a float drops
+		if ((std::bit_cast<uint64_t>(result) & 0x1fffffff) != 0x10000000) {
+			value = static_cast<float>(negative ? -result : result);
+			return p;
+		}
+	}
+
+	// Long mantissas, large exponents, halfway cases, infinities and NaNs
+	auto [next, ec] = std::from_chars(start, end, value);
+	return ec == std::errc() ? next : nullptr;
+}
+
+} // namespace text
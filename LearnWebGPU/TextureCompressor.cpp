@@ -0,0 +1,424 @@
+#include "TextureCompressor.h"
+#include "DeviceEvents.h"
+#include "GpuMemory.h"
+#include "Mipmaps.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+const char* compressionShaderSource = R"(
+struct Params {
+	levelCount: u32,
+	blockCount: u32,
+	// Whether blocks are BC3, with an alpha part before the color part, rather than BC1
+	alpha: u32,
+	_pad: u32,
+};
+
+struct Level {
+	width: u32,
+	height: u32,
+	// In texels from the start of the pixels, and in blocks from the start of the blocks
+	pixelOffset: u32,
+	firstBlock: u32,
+	blocksPerRow: u32,
+	_pad0: u32,
+	_pad1: u32,
+	_pad2: u32,
+};
+
+@group(0) @binding(0) var<uniform> params: Params;
+@group(0) @binding(1) var<storage, read> levels: array<Level>;
+// RGBA8 texels of all levels, one after the other
+@group(0) @binding(2) var<storage, read> pixels: array<u32>;
+@group(0) @binding(3) var<storage, read_write> blocks: array<u32>;
+
+fn quantize565(color: vec3f) -> u32 {
+	let c = vec3u(round(clamp(color, vec3f(0.0), vec3f(255.0)) * vec3f(31.0, 63.0, 31.0) / 255.0));
+	return (c.r << 11u) | (c.g << 5u) | c.b;
+}
+
+// As decoders expand it, replicating the high bits
+fn expand565(packed: u32) -> vec3f {
+	let r = (packed >> 11u) & 31u;
+	let g = (packed >> 5u) & 63u;
+	let b = packed & 31u;
+	return vec3f(f32((r << 3u) | (r >> 2u)), f32((g << 2u) | (g >> 4u)), f32((b << 3u) | (b >> 2u)));
+}
+
+// The 2 words of a BC1 block, in the 4 color mode
+fn encodeColor(texels: ptr<function, array<vec4f, 16>>) -> vec2u {
+	var mean = vec3f(0.0);
+	var low = vec3f(255.0);
+	var high = vec3f(0.0);
+	for (var i = 0u; i < 16u; i++) {
+		let color = (*texels)[i].rgb;
+		mean += color;
+		low = min(low, color);
+		high = max(high, color);
+	}
+	mean /= 16.0;
+
+	// Principal axis of the colors, by power iterations on their covariance from the diagonal of
+	// their bounding box
+	var xx = 0.0; var xy = 0.0; var xz = 0.0; var yy = 0.0; var yz = 0.0; var zz = 0.0;
+	for (var i = 0u; i < 16u; i++) {
+		let d = (*texels)[i].rgb - mean;
+		xx += d.x * d.x; xy += d.x * d.y; xz += d.x * d.z;
+		yy += d.y * d.y; yz += d.y * d.z; zz += d.z * d.z;
+	}
+	var axis = high - low;
+	for (var iteration = 0; iteration < 4; iteration++) {
+		axis = vec3f(
+			xx * axis.x + xy * axis.y + xz * axis.z,
+			xy * axis.x + yy * axis.y + yz * axis.z,
+			xz * axis.x + yz * axis.y + zz * axis.z
+		);
+		let scale = max(max(abs(axis.x), abs(axis.y)), abs(axis.z));
+		if (scale > 0.0) {
+			axis /= scale;
+		}
+	}
+	if (dot(axis, axis) > 0.0) {
+		axis = normalize(axis);
+		var minT = 1e9;
+		var maxT = -1e9;
+		for (var i = 0u; i < 16u; i++) {
+			let t = dot((*texels)[i].rgb - mean, axis);
+			minT = min(minT, t);
+			maxT = max(maxT, t);
+		}
+		low = mean + axis * minT;
+		high = mean + axis * maxT;
+	}
+	else {
+		low = mean;
+		high = mean;
+	}
+	// The extremes are rarely the best endpoints, texels being spread in between
+	let inset = (high - low) / 16.0;
+	high -= inset;
+	low += inset;
+
+	var color0 = quantize565(high);
+	var color1 = quantize565(low);
+	if (color0 < color1) {
+		let swapped = color0;
+		color0 = color1;
+		color1 = swapped;
+	}
+	if (color0 == color1) {
+		return vec2u(color0 | (color1 << 16u), 0u);
+	}
+	let p0 = expand565(color0);
+	let p1 = expand565(color1);
+	var palette = array<vec3f, 4>(p0, p1, (2.0 * p0 + p1) / 3.0, (p0 + 2.0 * p1) / 3.0);
+	var indices = 0u;
+	for (var i = 0u; i < 16u; i++) {
+		var best = 0u;
+		var bestDistance = 1e9;
+		for (var k = 0u; k < 4u; k++) {
+			let d = (*texels)[i].rgb - palette[k];
+			let distance = dot(d, d);
+			if (distance < bestDistance) {
+				best = k;
+				bestDistance = distance;
+			}
+		}
+		indices |= best << (2u * i);
+	}
+	return vec2u(color0 | (color1 << 16u), indices);
+}
+
+// The 2 words of the alpha part of a BC3 block, in the 8 value mode
+fn encodeAlpha(texels: ptr<function, array<vec4f, 16>>) -> vec2u {
+	var low = 255.0;
+	var high = 0.0;
+	for (var i = 0u; i < 16u; i++) {
+		low = min(low, (*texels)[i].a);
+		high = max(high, (*texels)[i].a);
+	}
+	let alpha0 = u32(round(high));
+	let alpha1 = u32(round(low));
+	if (alpha0 == alpha1) {
+		return vec2u(alpha0 | (alpha1 << 8u), 0u);
+	}
+
+	// 48 bits of 3-bit indices, code 0 being alpha0, 1 alpha1 and 2 to 7 the values in between
+	// from alpha0 to alpha1
+	var lowBits = 0u;
+	var highBits = 0u;
+	for (var i = 0u; i < 16u; i++) {
+		let t = (f32(alpha0) - (*texels)[i].a) / f32(alpha0 - alpha1) * 7.0;
+		let step = u32(clamp(round(t), 0.0, 7.0));
+		let index = select(select(step + 1u, 1u, step == 7u), 0u, step == 0u);
+		let bit = 3u * i;
+		if (bit < 30u) {
+			lowBits |= index << bit;
+		}
+		else if (bit >= 32u) {
+			highBits |= index << (bit - 32u);
+		}
+		else {
+			lowBits |= index << bit;
+			highBits |= index >> (32u - bit);
+		}
+	}
+	return vec2u(alpha0 | (alpha1 << 8u) | (lowBits << 16u), (lowBits >> 16u) | (highBits << 16u));
+}
+
+// One invocation per block of all levels, workgroups spread over 2 dimensions
+@compute @workgroup_size(64)
+fn compressBlocks(@builtin(workgroup_id) group: vec3u, @builtin(num_workgroups) groups: vec3u, @builtin(local_invocation_index) localIndex: u32) {
+	let block = (group.x + group.y * groups.x) * 64u + localIndex;
+	if (block >= params.blockCount) {
+		return;
+	}
+	var levelIndex = 0u;
+	for (var l = 1u; l < params.levelCount; l++) {
+		if (levels[l].firstBlock <= block) {
+			levelIndex = l;
+		}
+	}
+	let level = levels[levelIndex];
+	let levelBlock = block - level.firstBlock;
+	let origin = vec2u(levelBlock % level.blocksPerRow, levelBlock / level.blocksPerRow) * 4u;
+
+	// Levels smaller than a block repeat their last row and column
+	var texels: array<vec4f, 16>;
+	for (var i = 0u; i < 16u; i++) {
+		let x = min(origin.x + (i & 3u), level.width - 1u);
+		let y = min(origin.y + (i >> 2u), level.height - 1u);
+		texels[i] = unpack4x8unorm(pixels[level.pixelOffset + y * level.width + x]) * 255.0;
+	}
+
+	let color = encodeColor(&texels);
+	if (params.alpha == 0u) {
+		blocks[2u * block] = color.x;
+		blocks[2u * block + 1u] = color.y;
+		return;
+	}
+	let alpha = encodeAlpha(&texels);
+	blocks[4u * block] = alpha.x;
+	blocks[4u * block + 1u] = alpha.y;
+	blocks[4u * block + 2u] = color.x;
+	blocks[4u * block + 3u] = color.y;
+}
+)";
+
+constexpr uint32_t WorkgroupSize = 64;
+constexpr uint32_t MaxWorkgroupsPerDimension = 65535;
+
+/**
+ * The Params structure of the shader
+ */
+struct Params {
+	uint32_t levelCount;
+	uint32_t blockCount;
+	uint32_t alpha;
+	uint32_t _pad;
+};
+static_assert(sizeof(Params) == 16);
+
+/**
+ * The Level structure of the shader
+ */
+struct Level {
+	uint32_t width;
+	uint32_t height;
+	uint32_t pixelOffset;
+	uint32_t firstBlock;
+	uint32_t blocksPerRow;
+	uint32_t _pad[3];
+};
+static_assert(sizeof(Level) == 32);
+
+uint32_t blockCount(uint32_t size) {
+	return (size + 3) / 4;
+}
+
+} // anonymous namespace
+
+bool TextureCompressor::supported(Device device) {
+	return device.hasFeature(FeatureName::TextureCompressionBC);
+}
+
+TextureCompressor::TextureCompressor(Device device, PipelineCache& pipelineCache)
+	: mDevice(device)
+	, mPipelineCache(pipelineCache)
+{
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(4, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Params);
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[3].buffer.type = BufferBindingType::Storage;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(compressionShaderSource);
+	pipelineDesc.compute.entryPoint = "compressBlocks";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+}
+
+Ktx2Image TextureCompressor::Result::image() const {
+	Ktx2Image image;
+	image.format = format;
+	image.width = width;
+	image.height = height;
+	image.bytesPerBlock = format == TextureFormat::BC1RGBAUnorm || format == TextureFormat::BC1RGBAUnormSrgb ? 8 : 16;
+	size_t offset = 0;
+	uint32_t levelWidth = width;
+	uint32_t levelHeight = height;
+	for (uint32_t level = 0; level < mipLevelCount; ++level) {
+		size_t size = size_t(blockCount(levelWidth)) * blockCount(levelHeight) * image.bytesPerBlock;
+		image.levels.emplace_back(blocks.data() + offset, size);
+		offset += size;
+		levelWidth = nextMipLevelSize(levelWidth);
+		levelHeight = nextMipLevelSize(levelHeight);
+	}
+	return image;
+}
+
+Task<TextureCompressor::Result> TextureCompressor::compress(std::shared_ptr<const ResourceManager::Image> image, bool srgb) {
+	Result result;
+	PipelineCache::AsyncComputePipeline pipeline = co_await mPipelineCache.whenBuilt(mPipeline);
+	if (!pipeline->ready()) co_return result;
+
+	// The alpha of lower levels only averages that of the first one
+	size_t texelCount = size_t(image->width) * image->height;
+	const uint32_t* texels = reinterpret_cast<const uint32_t*>(image->pixels.get());
+	bool opaque = std::all_of(texels, texels + texelCount, [](uint32_t texel) { return (texel >> 24) == 0xFF; });
+	result.format = opaque
+		? (srgb ? TextureFormat::BC1RGBAUnormSrgb : TextureFormat::BC1RGBAUnorm)
+		: (srgb ? TextureFormat::BC3RGBAUnormSrgb : TextureFormat::BC3RGBAUnorm);
+	result.width = image->width;
+	result.height = image->height;
+	result.mipLevelCount = image->mipLevelCount;
+	uint32_t bytesPerBlock = opaque ? 8 : 16;
+
+	std::vector<Level> levels(image->mipLevelCount);
+	uint32_t pixelCount = 0;
+	uint32_t totalBlockCount = 0;
+	uint32_t width = image->width;
+	uint32_t height = image->height;
+	for (Level& level : levels) {
+		level = {};
+		level.width = width;
+		level.height = height;
+		level.pixelOffset = pixelCount;
+		level.firstBlock = totalBlockCount;
+		level.blocksPerRow = blockCount(width);
+		pixelCount += width * height;
+		totalBlockCount += blockCount(width) * blockCount(height);
+		width = nextMipLevelSize(width);
+		height = nextMipLevelSize(height);
+	}
+	uint64_t pixelBytes = uint64_t(pixelCount) * 4;
+	uint64_t blockBytes = uint64_t(totalBlockCount) * bytesPerBlock;
+	SupportedLimits supportedLimits;
+	mDevice.getLimits(&supportedLimits);
+	if (std::max(pixelBytes, blockBytes) > supportedLimits.limits.maxStorageBufferBindingSize) {
+		std::cerr << "Image of " << image->width << "x" << image->height << " texels is too large to be compressed on the GPU" << std::endl;
+		co_return result;
+	}
+
+	auto create = [this](const char* label, BufferUsage usage, uint64_t size, GpuMemoryCategory category) {
+		BufferDescriptor bufferDesc{};
+		bufferDesc.label = label;
+		bufferDesc.usage = usage;
+		bufferDesc.size = size;
+		bufferDesc.mappedAtCreation = false;
+		return createTrackedBuffer(mDevice, bufferDesc, category, "TextureCompressor");
+	};
+	Buffer paramBuffer = create("Texture compression parameters", BufferUsage::Uniform | BufferUsage::CopyDst, sizeof(Params), GpuMemoryCategory::Uniforms);
+	Buffer levelBuffer = create("Texture compression levels", BufferUsage::Storage | BufferUsage::CopyDst, levels.size() * sizeof(Level), GpuMemoryCategory::Staging);
+	Buffer pixelBuffer = create("Texture compression pixels", BufferUsage::Storage | BufferUsage::CopyDst, pixelBytes, GpuMemoryCategory::Staging);
+	Buffer blockBuffer = create("Texture compression blocks", BufferUsage::Storage | BufferUsage::CopySrc, blockBytes, GpuMemoryCategory::Staging);
+	Buffer readbackBuffer = create("Texture compression readback", BufferUsage::MapRead | BufferUsage::CopyDst, blockBytes, GpuMemoryCategory::Staging);
+	auto release = [&]() {
+		for (Buffer* buffer : { &readbackBuffer, &blockBuffer, &pixelBuffer, &levelBuffer, &paramBuffer }) {
+			if (!*buffer) continue;
+			destroyTracked(*buffer);
+			buffer->release();
+			*buffer = nullptr;
+		}
+	};
+	if (!paramBuffer || !levelBuffer || !pixelBuffer || !blockBuffer || !readbackBuffer) {
+		release();
+		co_return result;
+	}
+
+	Queue queue = mDevice.getQueue();
+	Params params{ static_cast<uint32_t>(levels.size()), totalBlockCount, opaque ? 0u : 1u, 0 };
+	queue.writeBuffer(paramBuffer, 0, &params, sizeof(Params));
+	queue.writeBuffer(levelBuffer, 0, levels.data(), levels.size() * sizeof(Level));
+	queue.writeBuffer(pixelBuffer, 0, image->pixels.get(), texelCount * 4);
+	if (image->mipLevelCount > 1) {
+		queue.writeBuffer(pixelBuffer, texelCount * 4, image->mipMaps.get(), pixelBytes - texelCount * 4);
+	}
+
+	std::vector<BindGroupEntry> bindings(4);
+	Buffer buffers[] = { paramBuffer, levelBuffer, pixelBuffer, blockBuffer };
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = buffers[binding];
+		bindings[binding].offset = 0;
+		bindings[binding].size = buffers[binding].getSize();
+	}
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mBindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	BindGroup bindGroup = mDevice.createBindGroup(bindGroupDesc);
+
+	CommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "Texture compression";
+	CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Texture compression";
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(pipeline->pipeline);
+	computePass.setBindGroup(0, bindGroup, 0, nullptr);
+	uint32_t workgroupCount = (totalBlockCount + WorkgroupSize - 1) / WorkgroupSize;
+	uint32_t workgroupsX = std::min(workgroupCount, MaxWorkgroupsPerDimension);
+	computePass.dispatchWorkgroups(workgroupsX, (workgroupCount + workgroupsX - 1) / workgroupsX, 1);
+	computePass.end();
+	computePass.release();
+	encoder.copyBufferToBuffer(blockBuffer, 0, readbackBuffer, 0, blockBytes);
+	CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+	encoder.release();
+	queue.submit(commands);
+	commands.release();
+	bindGroup.release();
+
+	BufferMapAsyncStatus status = co_await DeviceEvents::mapAsync(readbackBuffer, MapMode::Read, 0, blockBytes);
+	if (status == BufferMapAsyncStatus::Success) {
+		const std::byte* blocks = static_cast<const std::byte*>(readbackBuffer.getConstMappedRange(0, blockBytes));
+		result.blocks.assign(blocks, blocks + blockBytes);
+		readbackBuffer.unmap();
+	}
+	else {
+		std::cerr << "Could not read back the compressed texture (" << status << ")" << std::endl;
+	}
+	release();
+	co_return result;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+#include "ResourceManager.h"
+#include "Ktx2Parser.h"
+#include "Task.h"
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Block compression of decoded images on the GPU, for the textures whose source is
+ * a JPEG or PNG image rather than KTX2, so that they take the memory and sampling
+ * bandwidth of compressed textures without an offline step. The result is meant to
+ * be stored next to the source (see ResourceManager::writeCompressedTextureCache),
+ * for later runs to map it instead of decoding the image again.
+ *
+ * Opaque images are encoded as BC1 and the others as BC3, of which BC1 is the color
+ * part, by a compute pass running an invocation per 4x4 block of every mip level:
+ * endpoints are the extremes of the colors along their principal axis, inset by a
+ * sixteenth of their range, and each texel takes the nearest of the 4 colors (and
+ * of the 8 alphas) they give. This is the quality of real-time encoders, below that
+ * of offline BC7 encoders, which the content pipeline should still be preferred for.
+ *
+ * Like the rest of the device, it must only be used from the device thread.
+ */
+class TextureCompressor {
+public:
+	// Whether `device` can sample what compress() writes, which needs the TextureCompressionBC feature
+	static bool supported(wgpu::Device device);
+
+	TextureCompressor(wgpu::Device device, PipelineCache& pipelineCache);
+
+	TextureCompressor(const TextureCompressor&) = delete;
+	TextureCompressor& operator=(const TextureCompressor&) = delete;
+
+	/**
+	 * Levels of an image encoded by compress()
+	 */
+	struct Result {
+		wgpu::TextureFormat format = wgpu::TextureFormat::Undefined;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t mipLevelCount = 0;
+		// Levels one after the other from the largest, empty if the image was not compressed
+		std::vector<std::byte> blocks;
+
+		// The levels as a KTX2 image, pointing into `blocks`
+		Ktx2Image image() const;
+	};
+
+	// Encode all levels of `image`, whose mip-maps must be built and whose size must be a multiple
+	// of 4, in the sRGB variant of the format if `srgb` is set. Awaited on the device thread, where
+	// it resumes once the blocks are read back, with no blocks if the image does not fit in the
+	// storage bindings of the device or could not be read back.
+	Task<Result> compress(std::shared_ptr<const ResourceManager::Image> image, bool srgb);
+
+private:
+	wgpu::Device mDevice;
+	PipelineCache& mPipelineCache;
+	// Owned by the pipeline cache
+	PipelineCache::AsyncComputePipeline mPipeline;
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+};
@@ -0,0 +1,153 @@
+#include "TextureFeedback.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <bit>
+#include <vector>
+
+using namespace wgpu;
+
+TextureFeedback::TextureFeedback(Device device, PipelineCache& pipelineCache, DepthConvention depthConvention)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+	, mDepthConvention(depthConvention)
+{
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Texture feedback uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "TextureFeedback");
+
+	bufferDesc.label = "Texture feedback slots";
+	bufferDesc.size = SlotCount * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::Storage | BufferUsage::CopySrc | BufferUsage::CopyDst;
+	mSlotBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "TextureFeedback");
+
+	mReadback = ReadbackPool(device, 1, bufferDesc.size, "Texture feedback readback buffer", "TextureFeedback");
+	if (!mUniformBuffer || !mSlotBuffer || !mReadback.valid()) return;
+
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(2, Default);
+	bindingLayoutEntries[0].binding = 0;
+	bindingLayoutEntries[0].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].binding = 1;
+	bindingLayoutEntries[1].visibility = ShaderStage::Fragment;
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::Storage;
+	bindingLayoutEntries[1].buffer.minBindingSize = SlotCount * sizeof(uint32_t);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	std::vector<BindGroupEntry> bindings(2);
+	bindings[0].binding = 0;
+	bindings[0].buffer = mUniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(Uniforms);
+	bindings[1].binding = 1;
+	bindings[1].buffer = mSlotBuffer;
+	bindings[1].offset = 0;
+	bindings[1].size = mSlotBuffer.getSize();
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mBindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	mBindGroup = device.createBindGroup(bindGroupDesc);
+
+	// The same for every pass
+	Uniforms uniforms{};
+	uniforms.resolutionScale = static_cast<float>(Downscale);
+	mQueue.writeBuffer(mUniformBuffer, 0, &uniforms, sizeof(Uniforms));
+}
+
+TextureFeedback::~TextureFeedback() {
+	if (mBindGroup) mBindGroup.release();
+	if (mDepthView) mDepthView.release();
+	if (mDepthTexture) {
+		destroyTracked(mDepthTexture);
+		mDepthTexture.release();
+	}
+	for (Buffer* buffer : { &mSlotBuffer, &mUniformBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+	mQueue.release();
+}
+
+RenderPassEncoder TextureFeedback::begin(CommandEncoder encoder, const glm::uvec2& sceneSize, const RenderPassTimestampWrites* timestampWrites) {
+	// Reallocated when the scene is resized
+	glm::uvec2 size = glm::max((sceneSize + Downscale - 1u) / Downscale, glm::uvec2(1));
+	if (size != mDepthSize) {
+		if (mDepthView) mDepthView.release();
+		if (mDepthTexture) {
+			destroyTracked(mDepthTexture);
+			mDepthTexture.release();
+		}
+		TextureDescriptor depthDesc{};
+		depthDesc.label = "Texture feedback depth";
+		depthDesc.dimension = TextureDimension::_2D;
+		depthDesc.format = DepthFormat;
+		depthDesc.size = { size.x, size.y, 1 };
+		depthDesc.mipLevelCount = 1;
+		depthDesc.sampleCount = 1;
+		depthDesc.usage = TextureUsage::RenderAttachment;
+		depthDesc.viewFormatCount = 0;
+		depthDesc.viewFormats = nullptr;
+		mDepthTexture = createTrackedTexture(mDevice, depthDesc, GpuMemoryCategory::RenderTargets, "TextureFeedback");
+		mDepthView = mDepthTexture.createView();
+		mDepthSize = size;
+	}
+
+	encoder.clearBuffer(mSlotBuffer, 0, mSlotBuffer.getSize());
+
+	RenderPassDepthStencilAttachment depthAttachment{};
+	depthAttachment.view = mDepthView;
+	depthAttachment.depthClearValue = mDepthConvention.farDepth();
+	depthAttachment.depthLoadOp = LoadOp::Clear;
+	depthAttachment.depthStoreOp = StoreOp::Discard;
+	depthAttachment.depthReadOnly = false;
+	depthAttachment.stencilClearValue = 0;
+#ifdef WEBGPU_BACKEND_WGPU
+	depthAttachment.stencilLoadOp = LoadOp::Clear;
+	depthAttachment.stencilStoreOp = StoreOp::Store;
+#else
+	depthAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthAttachment.stencilStoreOp = StoreOp::Undefined;
+#endif // ! WGPU BACKEND
+	depthAttachment.stencilReadOnly = true;
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Texture feedback";
+	renderPassDesc.colorAttachmentCount = 0;
+	renderPassDesc.colorAttachments = nullptr;
+	renderPassDesc.depthStencilAttachment = &depthAttachment;
+	renderPassDesc.timestampWrites = timestampWrites;
+	return encoder.beginRenderPass(renderPassDesc);
+}
+
+void TextureFeedback::end(CommandEncoder encoder, RenderPassEncoder renderPass) {
+	renderPass.end();
+	renderPass.release();
+	uint32_t slot = mReadback.reserve();
+	if (slot == ReadbackPool::NoSlot) return;
+	encoder.copyBufferToBuffer(mSlotBuffer, 0, mReadback.buffer(slot), 0, mSlotBuffer.getSize());
+}
+
+void TextureFeedback::readBack() {
+	if (mReadback.state(0) != ReadbackPool::State::Recording) return;
+	// Results that failed to map are dropped
+	mReadback.map(0, mSlotBuffer.getSize());
+}
+
+bool TextureFeedback::poll(std::vector<float>& resolutions, std::vector<uint32_t>& pageRequests) {
+	if (mReadback.state(0) != ReadbackPool::State::Mapped) return false;
+	const uint32_t* slots = static_cast<const uint32_t*>(mReadback.mappedRange(0, mSlotBuffer.getSize()));
+	resolutions.resize(MaxTextureCount);
+	std::transform(slots, slots + MaxTextureCount, resolutions.begin(), [](uint32_t bits) { return std::bit_cast<float>(bits); });
+	pageRequests.assign(slots + MaxTextureCount, slots + SlotCount);
+	mReadback.release(0);
+	return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "ReadbackPool.h"
+#include "DepthConvention.h"
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * Which resolution of each texture of the scene is actually sampled on screen,
+ * for the resource cache to stream the levels that are seen and drop the others.
+ *
+ * A pass draws the opaque scene at 1/Downscale of its resolution into a depth
+ * buffer of its own, its fragments writing no color: each one measures the
+ * footprint of its pixel in texture coordinates from their derivatives, scaled
+ * back to the full resolution, and keeps the texel density it asks for in the
+ * slot of its texture with an atomicMax, only the nearest surface of each pixel
+ * being counted. The slots are copied to a buffer mapped asynchronously, like
+ * for picking, so that results arrive a frame or so later. One pass is in
+ * flight at a time.
+ *
+ * The slots are followed by one bit per page of the VirtualTextures, set for the
+ * pages that fragments sample at the level their footprint asks for.
+ *
+ * The draws are the caller's, with its own pipeline: its fragment shader binds
+ * bindGroupLayout() as group `BindGroupIndex`, of FeedbackUniforms and the slots
+ * (see TEXTURE_FEEDBACK in resources/shader.wgsl).
+ */
+class TextureFeedback {
+public:
+	static constexpr uint32_t Downscale = 8;
+	// Textures of higher indices are not measured
+	static constexpr uint32_t MaxTextureCount = 4096;
+	// Pages of higher indices are not requested
+	static constexpr uint32_t MaxPageCount = 65536;
+	static constexpr uint32_t BindGroupIndex = 4;
+	static constexpr wgpu::TextureFormat DepthFormat = wgpu::TextureFormat::Depth24Plus;
+
+	// Drawn with depths of `depthConvention`, in a buffer of DepthFormat regardless
+	TextureFeedback(wgpu::Device device, PipelineCache& pipelineCache, DepthConvention depthConvention);
+	~TextureFeedback();
+
+	TextureFeedback(const TextureFeedback&) = delete;
+	TextureFeedback& operator=(const TextureFeedback&) = delete;
+
+	bool valid() const { return mBindGroup != nullptr; }
+	// Whether the previous results were read by poll(), so that begin() may record new ones
+	bool encodeNeeded() const { return mReadback.state(0) == ReadbackPool::State::Free; }
+
+	wgpu::BindGroupLayout bindGroupLayout() const { return mBindGroupLayout; }
+	wgpu::BindGroup bindGroup() const { return mBindGroup; }
+
+	// Clear the slots and begin the pass over a scene of `sceneSize` pixels, in which the caller
+	// draws with bindGroup() bound, then ends it with end()
+	wgpu::RenderPassEncoder begin(wgpu::CommandEncoder encoder, const glm::uvec2& sceneSize, const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr);
+	void end(wgpu::CommandEncoder encoder, wgpu::RenderPassEncoder renderPass);
+
+	// Map the results once the frame of end() is submitted
+	void readBack();
+
+	// Texels per unit of texture coordinates requested for each texture of the last pass, 0 for
+	// those not seen, and the bits of the pages requested, returning true once per pass
+	bool poll(std::vector<float>& resolutions, std::vector<uint32_t>& pageRequests);
+
+private:
+	/**
+	 * The FeedbackUniforms structure of the shader
+	 */
+	struct Uniforms {
+		// Full resolution pixels per pixel of the pass
+		float resolutionScale;
+		uint32_t _pad[3];
+	};
+	static_assert(sizeof(Uniforms) == 16);
+
+	static constexpr uint32_t SlotCount = MaxTextureCount + MaxPageCount / 32;
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	DepthConvention mDepthConvention;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+
+	wgpu::Buffer mUniformBuffer = nullptr;
+	// Bits of the densities, positive floats ordering like their bits, then of the pages
+	wgpu::Buffer mSlotBuffer = nullptr;
+	// A single slot, the results of one pass being in flight at a time
+	ReadbackPool mReadback;
+	wgpu::BindGroup mBindGroup = nullptr;
+
+	wgpu::Texture mDepthTexture = nullptr;
+	wgpu::TextureView mDepthView = nullptr;
+	glm::uvec2 mDepthSize = { 0, 0 };
+};
@@ -0,0 +1,108 @@
+#include "TexturePool.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+TexturePool::TexturePool(Device device, uint32_t bucketSize, uint32_t maxIdleFrameCount)
+	: mDevice(device)
+	, mBucketSize(std::max(bucketSize, 1u))
+	, mMaxIdleFrameCount(maxIdleFrameCount)
+{}
+
+TexturePool::~TexturePool() {
+	for (Entry& entry : mEntries) {
+		if (entry.view) entry.view.release();
+		destroyTracked(entry.texture);
+		entry.texture.release();
+	}
+}
+
+Texture TexturePool::acquire(const TextureDescriptor& descriptor, bool roundUp) {
+	Key key{
+		descriptor.dimension,
+		descriptor.format,
+		descriptor.usage,
+		roundUp ? bucketed(descriptor.size.width) : descriptor.size.width,
+		roundUp ? bucketed(descriptor.size.height) : descriptor.size.height,
+		descriptor.size.depthOrArrayLayers,
+		descriptor.mipLevelCount,
+		descriptor.sampleCount,
+		std::vector<TextureFormat>(descriptor.viewFormats, descriptor.viewFormats + descriptor.viewFormatCount),
+	};
+
+	auto it = std::find_if(mEntries.begin(), mEntries.end(), [&key](const Entry& entry) {
+		return !entry.used && entry.key == key;
+	});
+	if (it != mEntries.end()) {
+		it->used = true;
+		it->idleFrameCount = 0;
+		return it->texture;
+	}
+
+	TextureDescriptor textureDesc = descriptor;
+	textureDesc.size.width = key.width;
+	textureDesc.size.height = key.height;
+	Texture texture = createTrackedTexture(mDevice, textureDesc, GpuMemoryCategory::RenderTargets, "TexturePool");
+	if (!texture) {
+		std::cerr << "Could not create pooled texture " << key.width << "x" << key.height << std::endl;
+		return nullptr;
+	}
+	mEntries.push_back({ std::move(key), texture, nullptr, true, 0 });
+	return texture;
+}
+
+void TexturePool::release(Texture texture) {
+	if (!texture) return;
+	auto it = std::find_if(mEntries.begin(), mEntries.end(), [texture](const Entry& entry) {
+		return entry.texture == texture;
+	});
+	if (it == mEntries.end()) {
+		std::cerr << "Texture released to a pool it does not come from" << std::endl;
+		return;
+	}
+	it->used = false;
+	it->idleFrameCount = 0;
+}
+
+TextureView TexturePool::view(Texture texture) {
+	auto it = std::find_if(mEntries.begin(), mEntries.end(), [texture](const Entry& entry) {
+		return entry.texture == texture;
+	});
+	if (it == mEntries.end()) {
+		std::cerr << "View of a texture that does not come from the pool" << std::endl;
+		return nullptr;
+	}
+	if (!it->view) it->view = texture.createView();
+	return it->view;
+}
+
+void TexturePool::collect() {
+	// Free textures are only kept for reuse as long as the GPU memory budget allows it
+	bool overBudget = GpuMemoryTracker::overBudget();
+	for (Entry& entry : mEntries) {
+		if (entry.used) continue;
+		if (++entry.idleFrameCount <= mMaxIdleFrameCount && !overBudget) continue;
+		if (entry.view) entry.view.release();
+		// Possibly still in use by the last frames to have it
+		retireTracked(entry.texture);
+		entry.texture = nullptr;
+	}
+	mEntries.erase(std::remove_if(mEntries.begin(), mEntries.end(), [](const Entry& entry) {
+		return !entry.texture;
+	}), mEntries.end());
+}
+
+uint64_t TexturePool::memorySize() const {
+	uint64_t size = 0;
+	for (const Entry& entry : mEntries) {
+		size += textureMemorySize(entry.texture);
+	}
+	return size;
+}
+
+uint32_t TexturePool::bucketed(uint32_t size) const {
+	return std::max((size + mBucketSize - 1) / mBucketSize, 1u) * mBucketSize;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * Transient textures, such as render targets whose size follows the window,
+ * recycled rather than destroyed so that resizing does not allocate again and again.
+ *
+ * Textures requested with rounding up are allocated with a width and height
+ * rounded up to a multiple of the bucket size, and a free texture of the same
+ * bucket, format and usage is handed out again for any size within it. Callers
+ * then only render to the requested part of it, restricting the viewport and
+ * scissor rectangle of their passes (and of all their attachments, which must
+ * share the same size in WebGPU).
+ *
+ * Textures given back to the pool may be handed out again right away, commands
+ * already submitted being ordered before the ones of the next user by the queue.
+ * Free textures that are not reused for a while are retired by collect(), and
+ * right away while over the GPU memory budget (see GpuMemoryTracker), to be
+ * destroyed once the frames in flight are done with them (see retireTracked).
+ */
+class TexturePool {
+public:
+	TexturePool(wgpu::Device device, uint32_t bucketSize = 256, uint32_t maxIdleFrameCount = 60);
+	~TexturePool();
+
+	TexturePool(const TexturePool&) = delete;
+	TexturePool& operator=(const TexturePool&) = delete;
+
+	// A texture matching `descriptor`, or at least as large within its bucket if `roundUp`,
+	// which remains owned by the pool and must be given back with release()
+	wgpu::Texture acquire(const wgpu::TextureDescriptor& descriptor, bool roundUp = false);
+
+	// Give back a texture returned by acquire()
+	void release(wgpu::Texture texture);
+
+	// Default view of a texture returned by acquire(), created once per pooled texture, so that
+	// bind groups of a texture handed out again can be kept
+	wgpu::TextureView view(wgpu::Texture texture);
+
+	// Destroy the textures that stayed free for the last `maxIdleFrameCount` calls, to call once per frame
+	void collect();
+
+	// Estimated GPU memory of the textures of the pool, free ones included (see GpuMemory.h)
+	uint64_t memorySize() const;
+
+	// Size rounded up to the bucket size
+	uint32_t bucketed(uint32_t size) const;
+
+private:
+	/**
+	 * The properties of a texture that a request must match
+	 */
+	struct Key {
+		wgpu::TextureDimension dimension;
+		wgpu::TextureFormat format;
+		WGPUTextureUsageFlags usage;
+		uint32_t width;
+		uint32_t height;
+		uint32_t depthOrArrayLayers;
+		uint32_t mipLevelCount;
+		uint32_t sampleCount;
+		std::vector<wgpu::TextureFormat> viewFormats;
+
+		bool operator==(const Key&) const = default;
+	};
+
+	struct Entry {
+		Key key;
+		wgpu::Texture texture = nullptr;
+		wgpu::TextureView view = nullptr;
+		bool used = false;
+		// Calls to collect() since the texture was given back
+		uint32_t idleFrameCount = 0;
+	};
+
+private:
+	wgpu::Device mDevice;
+	uint32_t mBucketSize;
+	uint32_t mMaxIdleFrameCount;
+	std::vector<Entry> mEntries;
+};
@@ -0,0 +1,245 @@
+#include "ThreadAffinity.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__EMSCRIPTEN__)
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/qos.h>
+#include <sys/sysctl.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <filesystem>
+#include <fstream>
+#endif
+
+namespace {
+
+// LEARNWEBGPU_THREAD_AFFINITY=0 leaves every thread to the OS scheduler
+bool affinityEnabled() {
+	static const bool enabled = []() {
+		const char* value = std::getenv("LEARNWEBGPU_THREAD_AFFINITY");
+		if (value == nullptr || std::strcmp(value, "1") == 0) return true;
+		if (std::strcmp(value, "0") == 0) return false;
+		std::cerr << "Ignoring invalid LEARNWEBGPU_THREAD_AFFINITY=" << value << " (expected 0 or 1)" << std::endl;
+		return true;
+	}();
+	return enabled;
+}
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && !defined(__APPLE__)
+
+std::string readLine(const std::filesystem::path& path) {
+	std::ifstream file(path);
+	std::string line;
+	std::getline(file, line);
+	return line;
+}
+
+// CPU numbers of a sysfs list such as "0-3,8,10-11", empty if malformed
+std::vector<uint32_t> parseCpuList(const std::string& list) {
+	std::vector<uint32_t> cpus;
+	size_t begin = 0;
+	while (begin < list.size()) {
+		size_t end = list.find(',', begin);
+		if (end == std::string::npos) end = list.size();
+		const std::string range = list.substr(begin, end - begin);
+		char* rest = nullptr;
+		const unsigned long first = std::strtoul(range.c_str(), &rest, 10);
+		unsigned long last = first;
+		if (*rest == '-') last = std::strtoul(rest + 1, &rest, 10);
+		if (rest == range.c_str() || *rest != '\0' || last < first) return {};
+		for (unsigned long cpu = first; cpu <= last; ++cpu) {
+			cpus.push_back(static_cast<uint32_t>(cpu));
+		}
+		begin = end + 1;
+	}
+	return cpus;
+}
+
+#endif
+
+} // anonymous namespace
+
+const CpuTopology& CpuTopology::instance() {
+	static const CpuTopology topology;
+	return topology;
+}
+
+#if defined(_WIN32)
+
+CpuTopology::CpuTopology() {
+	ULONG length = 0;
+	GetSystemCpuSetInformation(nullptr, 0, &length, GetCurrentProcess(), 0);
+	std::vector<std::byte> buffer(length);
+	if (length == 0 || !GetSystemCpuSetInformation(reinterpret_cast<PSYSTEM_CPU_SET_INFORMATION>(buffer.data()), length, &length, GetCurrentProcess(), 0)) {
+		std::cerr << "Could not read the CPU sets of the system" << std::endl;
+		return;
+	}
+	// The higher the efficiency class, the faster the core (and the more power it draws)
+	std::vector<BYTE> efficiencyClasses;
+	for (ULONG offset = 0; offset < length;) {
+		const auto* info = reinterpret_cast<const SYSTEM_CPU_SET_INFORMATION*>(buffer.data() + offset);
+		if (info->Type == CpuSetInformation) {
+			mCpus.push_back({ info->CpuSet.Id, info->CpuSet.NumaNodeIndex, true });
+			efficiencyClasses.push_back(info->CpuSet.EfficiencyClass);
+		}
+		offset += info->Size;
+	}
+	const BYTE fastest = efficiencyClasses.empty() ? 0 : *std::max_element(efficiencyClasses.begin(), efficiencyClasses.end());
+	for (size_t i = 0; i < mCpus.size(); ++i) {
+		mCpus[i].performance = efficiencyClasses[i] == fastest;
+	}
+
+	PROCESSOR_NUMBER processor;
+	GetCurrentProcessorNumberEx(&processor);
+	USHORT node = 0;
+	if (GetNumaProcessorNodeEx(&processor, &node)) mLocalNode = node;
+
+	std::set<uint32_t> nodes;
+	for (const Cpu& cpu : mCpus) nodes.insert(cpu.node);
+	mNodeCount = std::max<uint32_t>(1, static_cast<uint32_t>(nodes.size()));
+}
+
+#elif defined(__EMSCRIPTEN__)
+
+// Web workers run wherever the browser puts them
+CpuTopology::CpuTopology() {
+	const uint32_t count = std::thread::hardware_concurrency();
+	for (uint32_t id = 0; id < count; ++id) {
+		mCpus.push_back({ id, 0, true });
+	}
+}
+
+#elif defined(__APPLE__)
+
+CpuTopology::CpuTopology() {
+	// Performance level 0 is the fastest one, whose cores come first here
+	auto sysctlValue = [](const char* name, int fallback) {
+		int value = 0;
+		size_t size = sizeof(value);
+		return sysctlbyname(name, &value, &size, nullptr, 0) == 0 ? value : fallback;
+	};
+	const int count = sysctlValue("hw.logicalcpu", static_cast<int>(std::thread::hardware_concurrency()));
+	const int performanceCount = sysctlValue("hw.nperflevels", 1) > 1 ? sysctlValue("hw.perflevel0.logicalcpu", count) : count;
+	for (int id = 0; id < count; ++id) {
+		mCpus.push_back({ static_cast<uint32_t>(id), 0, id < performanceCount });
+	}
+}
+
+#else
+
+CpuTopology::CpuTopology() {
+	const std::filesystem::path cpuRoot = "/sys/devices/system/cpu";
+	std::vector<uint32_t> online = parseCpuList(readLine(cpuRoot / "online"));
+	if (online.empty()) {
+		for (uint32_t id = 0; id < std::thread::hardware_concurrency(); ++id) online.push_back(id);
+	}
+	for (uint32_t id : online) {
+		mCpus.push_back({ id, 0, true });
+	}
+
+	// Intel hybrid CPUs expose their performance cores as a PMU device of their own, while ARM
+	// big.LITTLE ones give each core a capacity relative to the fastest one
+	const std::vector<uint32_t> coreCpus = parseCpuList(readLine("/sys/devices/cpu_core/cpus"));
+	if (!coreCpus.empty() && !readLine("/sys/devices/cpu_atom/cpus").empty()) {
+		for (Cpu& cpu : mCpus) {
+			cpu.performance = std::find(coreCpus.begin(), coreCpus.end(), cpu.id) != coreCpus.end();
+		}
+	}
+	else {
+		std::vector<unsigned long> capacities;
+		for (const Cpu& cpu : mCpus) {
+			const std::string capacity = readLine(cpuRoot / ("cpu" + std::to_string(cpu.id)) / "cpu_capacity");
+			capacities.push_back(capacity.empty() ? 0 : std::strtoul(capacity.c_str(), nullptr, 10));
+		}
+		const unsigned long fastest = capacities.empty() ? 0 : *std::max_element(capacities.begin(), capacities.end());
+		for (size_t i = 0; i < mCpus.size(); ++i) {
+			mCpus[i].performance = fastest == 0 || capacities[i] * 10 >= fastest * 8;
+		}
+	}
+
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+		const std::string name = entry.path().filename().string();
+		if (name.rfind("node", 0) != 0 || name.size() == 4 || name.find_first_not_of("0123456789", 4) != std::string::npos) continue;
+		const uint32_t node = static_cast<uint32_t>(std::stoul(name.substr(4)));
+		mNodeCount = std::max(mNodeCount, node + 1);
+		for (uint32_t id : parseCpuList(readLine(entry.path() / "cpulist"))) {
+			for (Cpu& cpu : mCpus) {
+				if (cpu.id == id) cpu.node = node;
+			}
+		}
+	}
+
+	const int current = sched_getcpu();
+	for (const Cpu& cpu : mCpus) {
+		if (current >= 0 && cpu.id == static_cast<uint32_t>(current)) mLocalNode = cpu.node;
+	}
+}
+
+#endif
+
+bool CpuTopology::hybrid() const {
+	return std::any_of(mCpus.begin(), mCpus.end(), [](const Cpu& cpu) { return !cpu.performance; });
+}
+
+std::vector<uint32_t> CpuTopology::select(ThreadAffinity affinity) const {
+	if (affinity == ThreadAffinity::Any || !affinityEnabled()) return {};
+	const bool performanceOnly = affinity == ThreadAffinity::PerformanceCores && hybrid();
+	const bool localOnly = mNodeCount > 1;
+	if (!performanceOnly && !localOnly) return {};
+
+	std::vector<uint32_t> ids;
+	for (const Cpu& cpu : mCpus) {
+		if (performanceOnly && !cpu.performance) continue;
+		if (localOnly && cpu.node != mLocalNode) continue;
+		ids.push_back(cpu.id);
+	}
+	// Rather unrestricted than stuck on nothing, e.g. if the main thread ran on an efficiency
+	// core of a node without performance ones
+	if (ids.empty() && performanceOnly && localOnly) return select(ThreadAffinity::LocalNode);
+	return ids;
+}
+
+uint32_t CpuTopology::cpuCount(ThreadAffinity affinity) const {
+	const std::vector<uint32_t> ids = select(affinity);
+	return static_cast<uint32_t>(ids.empty() ? mCpus.size() : ids.size());
+}
+
+bool setThreadAffinity(ThreadAffinity affinity) {
+	const CpuTopology& topology = CpuTopology::instance();
+#if defined(__APPLE__)
+	// Threads cannot be pinned, but their class of service decides which cores they get
+	if (affinity == ThreadAffinity::Any || !affinityEnabled() || !topology.hybrid()) return false;
+	const qos_class_t qos = affinity == ThreadAffinity::PerformanceCores ? QOS_CLASS_USER_INTERACTIVE : QOS_CLASS_USER_INITIATED;
+	return pthread_set_qos_class_self_np(qos, 0) == 0;
+#else
+	const std::vector<uint32_t> ids = topology.select(affinity);
+	if (ids.empty()) return false;
+#if defined(_WIN32)
+	std::vector<ULONG> cpuSets(ids.begin(), ids.end());
+	return SetThreadSelectedCpuSets(GetCurrentThread(), cpuSets.data(), static_cast<ULONG>(cpuSets.size())) != 0;
+#elif defined(__EMSCRIPTEN__)
+	return false;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (uint32_t id : ids) {
+		if (id < CPU_SETSIZE) CPU_SET(id, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+#endif
+}
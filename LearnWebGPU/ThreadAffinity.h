@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Where the threads of a kind of work may run, on machines whose cores are not all
+ * alike: hybrid CPUs mixing performance and efficiency cores, and multi-socket ones
+ * whose memory is local to some of the cores (NUMA nodes).
+ */
+enum class ThreadAffinity {
+	// Wherever the OS schedules it, e.g. background file loading
+	Any,
+	// The performance cores of the node of the main thread, for work that frames wait for
+	PerformanceCores,
+	// Any core of the node of the main thread, for memory-heavy work whose results it reads,
+	// e.g. decoding assets
+	LocalNode,
+};
+
+/**
+ * Logical CPUs of the machine as reported by the OS, detected once: from sysfs on
+ * Linux (cpu_core/cpu_atom devices of Intel hybrid CPUs, or the relative capacity
+ * of ARM cores), from the CPU sets on Windows, and from the performance levels on
+ * macOS, which only takes hints (quality of service classes) rather than affinities.
+ *
+ * The node of the thread first asking is the local one, which is where the main
+ * thread runs as long as it asks first, e.g. by creating the JobSystem.
+ */
+class CpuTopology {
+public:
+	/**
+	 * A logical CPU
+	 */
+	struct Cpu {
+		// CPU number on Linux, CPU set ID on Windows
+		uint32_t id = 0;
+		uint32_t node = 0;
+		bool performance = true;
+	};
+
+	static const CpuTopology& instance();
+
+	const std::vector<Cpu>& cpus() const { return mCpus; }
+	uint32_t nodeCount() const { return mNodeCount; }
+	uint32_t localNode() const { return mLocalNode; }
+	// Whether some cores are efficiency cores
+	bool hybrid() const;
+
+	// Number of logical CPUs that threads of `affinity` run on, 0 if unknown
+	uint32_t cpuCount(ThreadAffinity affinity) const;
+
+	// IDs of the CPUs of `affinity`, empty if it restricts nothing here
+	std::vector<uint32_t> select(ThreadAffinity affinity) const;
+
+private:
+	CpuTopology();
+
+private:
+	std::vector<Cpu> mCpus;
+	uint32_t mNodeCount = 1;
+	uint32_t mLocalNode = 0;
+};
+
+// Restrict the calling thread to the CPUs of `affinity`, returning whether it was restricted.
+// Nothing is restricted where all cores are alike, nor with LEARNWEBGPU_THREAD_AFFINITY=0.
+bool setThreadAffinity(ThreadAffinity affinity);
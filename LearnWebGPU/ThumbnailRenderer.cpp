@@ -0,0 +1,548 @@
+#include "ThumbnailRenderer.h"
+#include "StaticVertexLayout.h"
+#include "DeviceEvents.h"
+#include "GpuMemory.h"
+#include "Trace.h"
+
+#include "stb_image_write.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <span>
+#include <thread>
+#include <utility>
+
+using namespace wgpu;
+
+namespace {
+
+using ThumbnailVertex = StaticVertexLayout<VertexPosition<f32x3>, VertexNormal<f32x3>, VertexColor<f32x3>, VertexUv<f32x2>>;
+static_assert(ThumbnailVertex::stride == sizeof(ResourceManager::VertexAttributes));
+static_assert(ThumbnailVertex::offset(3) == offsetof(ResourceManager::VertexAttributes, uv));
+
+constexpr TextureFormat AtlasFormat = TextureFormat::RGBA8UnormSrgb;
+constexpr TextureFormat DepthFormat = TextureFormat::Depth24Plus;
+// Dynamic uniform offsets are aligned to minUniformBufferOffsetAlignment, at most 256
+constexpr uint32_t UniformSlotSize = 256;
+// Vertical field of view of the camera of every thumbnail
+constexpr float FieldOfView = glm::radians(30.0f);
+
+const char* thumbnailShaderSource = R"(
+struct Uniforms {
+	viewProjection: mat4x4f,
+}
+
+@group(0) @binding(0) var<uniform> uniforms: Uniforms;
+@group(1) @binding(0) var baseColorTexture: texture_2d<f32>;
+@group(1) @binding(1) var baseColorSampler: sampler;
+
+struct VertexOutput {
+	@builtin(position) position: vec4f,
+	@location(0) normal: vec3f,
+	@location(1) color: vec3f,
+	@location(2) uv: vec2f,
+}
+
+@vertex
+fn vs_main(in: VertexInput) -> VertexOutput {
+	var out: VertexOutput;
+	out.position = uniforms.viewProjection * vec4f(in.position, 1.0);
+	out.normal = in.normal;
+	out.color = in.color;
+	out.uv = in.uv;
+	return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f {
+	// A key light from above and in front, and a dim fill from behind, Z being up
+	let n = normalize(in.normal);
+	let key = max(dot(n, normalize(vec3f(0.5, -0.9, 0.8))), 0.0);
+	let fill = max(dot(n, normalize(vec3f(-0.6, 0.7, 0.2))), 0.0);
+	let baseColor = textureSample(baseColorTexture, baseColorSampler, in.uv).rgb * in.color;
+	return vec4f(baseColor * (0.25 + 0.8 * key + 0.2 * fill), 1.0);
+}
+)";
+
+} // anonymous namespace
+
+ThumbnailRenderer::ThumbnailRenderer(Device device, uint32_t tileSize, uint32_t tilesPerSide, uint32_t batchCount, unsigned int encoderThreadCount)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+	, mTileSize(std::max(tileSize, 1u))
+	, mTilesPerSide(std::max(tilesPerSide, 1u))
+	, mEncoder(encoderThreadCount)
+{
+	uint32_t atlasSize = mTileSize * mTilesPerSide;
+	mBytesPerRow = (4 * atlasSize + 255) & ~255u;
+
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Thumbnail atlas";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = AtlasFormat;
+	textureDesc.size = { atlasSize, atlasSize, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mAtlas = createTrackedTexture(device, textureDesc, GpuMemoryCategory::RenderTargets, "ThumbnailRenderer");
+	textureDesc.label = "Thumbnail atlas depth";
+	textureDesc.format = DepthFormat;
+	textureDesc.usage = TextureUsage::RenderAttachment;
+	mDepth = createTrackedTexture(device, textureDesc, GpuMemoryCategory::RenderTargets, "ThumbnailRenderer");
+	textureDesc.label = "Thumbnail white texture";
+	textureDesc.format = TextureFormat::RGBA8Unorm;
+	textureDesc.size = { 1, 1, 1 };
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	mWhiteTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "ThumbnailRenderer");
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Thumbnail uniforms";
+	bufferDesc.size = uint64_t(tileCount()) * UniformSlotSize;
+	bufferDesc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "ThumbnailRenderer");
+	if (!mAtlas || !mDepth || !mWhiteTexture || !mUniformBuffer) {
+		std::cerr << "Could not create the resources of the thumbnail renderer" << std::endl;
+		return;
+	}
+	mAtlasView = mAtlas.createView();
+	mDepthView = mDepth.createView();
+	mWhiteView = mWhiteTexture.createView();
+
+	ImageCopyTexture destination{};
+	destination.texture = mWhiteTexture;
+	destination.mipLevel = 0;
+	destination.origin = { 0, 0, 0 };
+	destination.aspect = TextureAspect::All;
+	TextureDataLayout layout{};
+	layout.offset = 0;
+	layout.bytesPerRow = 4;
+	layout.rowsPerImage = 1;
+	const uint8_t white[4] = { 255, 255, 255, 255 };
+	mQueue.writeTexture(destination, white, sizeof(white), layout, { 1, 1, 1 });
+
+	SamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = AddressMode::Repeat;
+	samplerDesc.addressModeV = AddressMode::Repeat;
+	samplerDesc.addressModeW = AddressMode::Repeat;
+	samplerDesc.magFilter = FilterMode::Linear;
+	samplerDesc.minFilter = FilterMode::Linear;
+	samplerDesc.mipmapFilter = MipmapFilterMode::Linear;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 32.0f;
+	samplerDesc.compare = CompareFunction::Undefined;
+	samplerDesc.maxAnisotropy = 1;
+	mSampler = mDevice.createSampler(samplerDesc);
+
+	for (uint32_t i = 0; i < std::max(batchCount, 1u); ++i) {
+		mBatches.push_back(std::make_unique<Batch>());
+	}
+	// Buffers are created by the first batches drawn
+	mReadbacks = ReadbackPool(device, std::max(batchCount, 1u), 0, "Thumbnail readback", "ThumbnailRenderer");
+	if (!initPipeline()) {
+		std::cerr << "Could not create the pipeline of the thumbnail renderer" << std::endl;
+	}
+}
+
+ThumbnailRenderer::~ThumbnailRenderer() {
+	// Map completions point to the batches
+	mReadbacks.wait();
+
+	// Thumbnails that made it to the CPU are written before quitting
+	poll();
+	while (mEncoder.pendingCount() > 0) {
+		mEncoder.processCompletions();
+		std::this_thread::yield();
+	}
+
+	for (const std::unique_ptr<Batch>& batch : mBatches) {
+		releaseTiles(*batch);
+	}
+	if (mPipeline) mPipeline.release();
+	if (mPipelineLayout) mPipelineLayout.release();
+	if (mUniformBindGroup) mUniformBindGroup.release();
+	if (mUniformLayout) mUniformLayout.release();
+	if (mTextureLayout) mTextureLayout.release();
+	if (mSampler) mSampler.release();
+	for (TextureView* view : { &mAtlasView, &mDepthView, &mWhiteView }) {
+		if (*view) view->release();
+	}
+	for (Texture* texture : { &mAtlas, &mDepth, &mWhiteTexture }) {
+		if (!*texture) continue;
+		destroyTracked(*texture);
+		texture->release();
+	}
+	if (mUniformBuffer) {
+		destroyTracked(mUniformBuffer);
+		mUniformBuffer.release();
+	}
+	if (mQueue) mQueue.release();
+}
+
+bool ThumbnailRenderer::initPipeline() {
+	if (!mUniformBuffer || !mSampler) return false;
+
+	BindGroupLayoutEntry uniformEntry = Default;
+	uniformEntry.binding = 0;
+	uniformEntry.visibility = ShaderStage::Vertex;
+	uniformEntry.buffer.type = BufferBindingType::Uniform;
+	uniformEntry.buffer.hasDynamicOffset = true;
+	uniformEntry.buffer.minBindingSize = sizeof(glm::mat4);
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = 1;
+	bindGroupLayoutDesc.entries = &uniformEntry;
+	mUniformLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
+
+	std::array<BindGroupLayoutEntry, 2> textureEntries = { Default, Default };
+	textureEntries[0].binding = 0;
+	textureEntries[0].visibility = ShaderStage::Fragment;
+	textureEntries[0].texture.sampleType = TextureSampleType::Float;
+	textureEntries[0].texture.viewDimension = TextureViewDimension::_2D;
+	textureEntries[1].binding = 1;
+	textureEntries[1].visibility = ShaderStage::Fragment;
+	textureEntries[1].sampler.type = SamplerBindingType::Filtering;
+	bindGroupLayoutDesc.entryCount = static_cast<uint32_t>(textureEntries.size());
+	bindGroupLayoutDesc.entries = textureEntries.data();
+	mTextureLayout = mDevice.createBindGroupLayout(bindGroupLayoutDesc);
+
+	BindGroupEntry uniformBinding{};
+	uniformBinding.binding = 0;
+	uniformBinding.buffer = mUniformBuffer;
+	uniformBinding.offset = 0;
+	uniformBinding.size = sizeof(glm::mat4);
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mUniformLayout;
+	bindGroupDesc.entryCount = 1;
+	bindGroupDesc.entries = &uniformBinding;
+	mUniformBindGroup = mDevice.createBindGroup(bindGroupDesc);
+
+	std::array<WGPUBindGroupLayout, 2> layouts = { mUniformLayout, mTextureLayout };
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = static_cast<uint32_t>(layouts.size());
+	layoutDesc.bindGroupLayouts = layouts.data();
+	mPipelineLayout = mDevice.createPipelineLayout(layoutDesc);
+
+	std::string source(ThumbnailVertex::wgslStruct<"VertexInput">);
+	source += thumbnailShaderSource;
+	ShaderModule shaderModule = ResourceManager::createShaderModule(source, mDevice);
+	if (!shaderModule) return false;
+
+	VertexBufferLayout vertexBufferLayout = ThumbnailVertex::bufferLayout();
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.label = "Thumbnails";
+	pipelineDesc.layout = mPipelineLayout;
+	pipelineDesc.vertex.module = shaderModule;
+	pipelineDesc.vertex.entryPoint = "vs_main";
+	pipelineDesc.vertex.constantCount = 0;
+	pipelineDesc.vertex.constants = nullptr;
+	pipelineDesc.vertex.bufferCount = 1;
+	pipelineDesc.vertex.buffers = &vertexBufferLayout;
+	pipelineDesc.primitive.topology = PrimitiveTopology::TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = IndexFormat::Undefined;
+	pipelineDesc.primitive.frontFace = FrontFace::CCW;
+	// Meshes of a library are not all closed, nor all wound the same way
+	pipelineDesc.primitive.cullMode = CullMode::None;
+
+	ColorTargetState colorTarget{};
+	colorTarget.format = AtlasFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = ColorWriteMask::All;
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = "fs_main";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	DepthStencilState depthStencilState = Default;
+	depthStencilState.format = DepthFormat;
+	depthStencilState.depthWriteEnabled = true;
+	depthStencilState.depthCompare = CompareFunction::Less;
+	depthStencilState.stencilReadMask = 0;
+	depthStencilState.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencilState;
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	mPipeline = mDevice.createRenderPipeline(pipelineDesc);
+	shaderModule.release();
+	return mPipeline != nullptr;
+}
+
+glm::vec4 ThumbnailRenderer::boundingSphere(const ResourceManager::Geometry& geometry) {
+	if (geometry.lods.empty()) return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	const ResourceManager::GeometryLod& lod = geometry.lods[0];
+	std::span<const uint32_t> indices = geometry.indices.subspan(lod.indexOffset, lod.indexCount);
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+	for (uint32_t index : indices) {
+		glm::vec3 position = geometry.vertices[index].position;
+		min = glm::min(min, position);
+		max = glm::max(max, position);
+	}
+	if (indices.empty()) return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	glm::vec3 center = 0.5f * (min + max);
+	float radius = 0.0f;
+	for (uint32_t index : indices) {
+		radius = std::max(radius, glm::distance(center, glm::vec3(geometry.vertices[index].position)));
+	}
+	return glm::vec4(center, std::max(radius, 1e-6f));
+}
+
+ThumbnailRenderer::Batch* ThumbnailRenderer::fillingBatch() {
+	return const_cast<Batch*>(std::as_const(*this).fillingBatch());
+}
+
+const ThumbnailRenderer::Batch* ThumbnailRenderer::fillingBatch() const {
+	const Batch* free = nullptr;
+	for (const std::unique_ptr<Batch>& batch : mBatches) {
+		if (batch->state == Batch::State::Filling) return batch.get();
+		if (batch->state == Batch::State::Free && !free) free = batch.get();
+	}
+	return free;
+}
+
+bool ThumbnailRenderer::canAdd() const {
+	return valid() && fillingBatch() != nullptr && mEncoder.pendingCount() < maxPendingEncodes();
+}
+
+bool ThumbnailRenderer::add(Asset asset) {
+	TRACE_SCOPE("Add thumbnail");
+	if (!canAdd() || !asset.geometry || asset.geometry->lods.empty()) return false;
+	Batch& batch = *fillingBatch();
+	const ResourceManager::Geometry& geometry = *asset.geometry;
+	const ResourceManager::GeometryLod& lod = geometry.lods[0];
+
+	Tile tile;
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Thumbnail vertices";
+	bufferDesc.size = (geometry.vertices.size_bytes() + 3) & ~uint64_t(3);
+	bufferDesc.usage = BufferUsage::Vertex | BufferUsage::CopyDst;
+	bufferDesc.mappedAtCreation = false;
+	tile.vertexBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Geometry, "ThumbnailRenderer");
+	bufferDesc.label = "Thumbnail indices";
+	bufferDesc.size = uint64_t(lod.indexCount) * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::Index | BufferUsage::CopyDst;
+	tile.indexBuffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Geometry, "ThumbnailRenderer");
+	if (!tile.vertexBuffer || !tile.indexBuffer || lod.indexCount == 0) {
+		std::cerr << "Could not upload the mesh of thumbnail '" << asset.outputPath << "'" << std::endl;
+		Batch discarded;
+		discarded.tiles.push_back(std::move(tile));
+		releaseTiles(discarded);
+		return false;
+	}
+	mQueue.writeBuffer(tile.vertexBuffer, 0, geometry.vertices.data(), geometry.vertices.size_bytes());
+	mQueue.writeBuffer(tile.indexBuffer, 0, geometry.indices.data() + lod.indexOffset, uint64_t(lod.indexCount) * sizeof(uint32_t));
+	tile.indexCount = lod.indexCount;
+
+	TextureView view = nullptr;
+	if (asset.image && asset.image->pixels) {
+		ResourceManager::TextureLoadOptions options;
+		options.srgb = true;
+		tile.texture = ResourceManager::createTexture(*asset.image, mDevice, options, &view);
+	}
+	BindGroupEntry bindings[2] = {};
+	bindings[0].binding = 0;
+	bindings[0].textureView = view ? view : mWhiteView;
+	bindings[1].binding = 1;
+	bindings[1].sampler = mSampler;
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mTextureLayout;
+	bindGroupDesc.entryCount = 2;
+	bindGroupDesc.entries = (WGPUBindGroupEntry*)bindings;
+	tile.bindGroup = mDevice.createBindGroup(bindGroupDesc);
+	if (view) view.release();
+
+	// From the front, a little to the side and above, the whole bounding sphere in view
+	glm::vec3 center = glm::vec3(asset.boundingSphere);
+	float radius = asset.boundingSphere.w;
+	float distance = radius / std::sin(0.5f * FieldOfView);
+	glm::vec3 direction = glm::normalize(glm::vec3(0.6f, -1.0f, 0.6f));
+	glm::mat4 view3D = glm::lookAt(center + distance * direction, center, glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 projection = glm::perspective(FieldOfView, 1.0f, 0.5f * (distance - radius), distance + radius);
+	tile.viewProjection = projection * view3D;
+	tile.outputPath = std::move(asset.outputPath);
+
+	batch.state = Batch::State::Filling;
+	batch.tiles.push_back(std::move(tile));
+	if (batch.tiles.size() == tileCount()) draw(batch);
+	return true;
+}
+
+void ThumbnailRenderer::flush() {
+	for (const std::unique_ptr<Batch>& batch : mBatches) {
+		if (batch->state == Batch::State::Filling) draw(*batch);
+	}
+}
+
+void ThumbnailRenderer::draw(Batch& batch) {
+	TRACE_SCOPE("Draw thumbnails");
+	uint32_t atlasSize = mTileSize * mTilesPerSide;
+	// There are as many slots as batches, so one is free unless its buffer cannot be created
+	batch.readback = mReadbacks.reserve(uint64_t(mBytesPerRow) * atlasSize);
+	if (batch.readback == ReadbackPool::NoSlot) {
+		std::cerr << "Could not create a readback buffer of the thumbnails" << std::endl;
+		mFailedCount += batch.tiles.size();
+		releaseTiles(batch);
+		batch.state = Batch::State::Free;
+		return;
+	}
+
+	// Uniforms of the previous batches were read by the passes submitted before this write
+	std::vector<uint8_t> uniforms(size_t(batch.tiles.size()) * UniformSlotSize);
+	for (size_t t = 0; t < batch.tiles.size(); ++t) {
+		std::memcpy(uniforms.data() + t * UniformSlotSize, &batch.tiles[t].viewProjection, sizeof(glm::mat4));
+	}
+	mQueue.writeBuffer(mUniformBuffer, 0, uniforms.data(), uniforms.size());
+
+	CommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "Thumbnails";
+	CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = mAtlasView;
+	colorAttachment.resolveTarget = nullptr;
+	colorAttachment.loadOp = LoadOp::Clear;
+	colorAttachment.storeOp = StoreOp::Store;
+	// Transparent where no mesh covers the tile
+	colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 0.0 };
+	RenderPassDepthStencilAttachment depthAttachment{};
+	depthAttachment.view = mDepthView;
+	depthAttachment.depthClearValue = 1.0f;
+	depthAttachment.depthLoadOp = LoadOp::Clear;
+	depthAttachment.depthStoreOp = StoreOp::Discard;
+	depthAttachment.depthReadOnly = false;
+	depthAttachment.stencilLoadOp = LoadOp::Undefined;
+	depthAttachment.stencilStoreOp = StoreOp::Undefined;
+	depthAttachment.stencilReadOnly = true;
+	RenderPassDescriptor passDesc{};
+	passDesc.colorAttachmentCount = 1;
+	passDesc.colorAttachments = &colorAttachment;
+	passDesc.depthStencilAttachment = &depthAttachment;
+	passDesc.timestampWrites = nullptr;
+	RenderPassEncoder pass = encoder.beginRenderPass(passDesc);
+	pass.setPipeline(mPipeline);
+	for (uint32_t t = 0; t < batch.tiles.size(); ++t) {
+		const Tile& tile = batch.tiles[t];
+		float x = static_cast<float>((t % mTilesPerSide) * mTileSize);
+		float y = static_cast<float>((t / mTilesPerSide) * mTileSize);
+		float size = static_cast<float>(mTileSize);
+		pass.setViewport(x, y, size, size, 0.0f, 1.0f);
+		pass.setScissorRect((t % mTilesPerSide) * mTileSize, (t / mTilesPerSide) * mTileSize, mTileSize, mTileSize);
+		uint32_t offset = t * UniformSlotSize;
+		pass.setBindGroup(0, mUniformBindGroup, 1, &offset);
+		pass.setBindGroup(1, tile.bindGroup, 0, nullptr);
+		pass.setVertexBuffer(0, tile.vertexBuffer, 0, tile.vertexBuffer.getSize());
+		pass.setIndexBuffer(tile.indexBuffer, IndexFormat::Uint32, 0, tile.indexBuffer.getSize());
+		pass.drawIndexed(tile.indexCount, 1, 0, 0, 0);
+	}
+	pass.end();
+	pass.release();
+
+	// Whole rows of tiles, those past the last tile being left out
+	uint32_t rowCount = static_cast<uint32_t>((batch.tiles.size() + mTilesPerSide - 1) / mTilesPerSide);
+	ImageCopyTexture source{};
+	source.texture = mAtlas;
+	source.mipLevel = 0;
+	source.origin = { 0, 0, 0 };
+	source.aspect = TextureAspect::All;
+	ImageCopyBuffer destination{};
+	destination.buffer = mReadbacks.buffer(batch.readback);
+	destination.layout.offset = 0;
+	destination.layout.bytesPerRow = mBytesPerRow;
+	destination.layout.rowsPerImage = atlasSize;
+	encoder.copyTextureToBuffer(source, destination, { atlasSize, rowCount * mTileSize, 1 });
+
+	CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+	encoder.release();
+	mQueue.submit(commands);
+	commands.release();
+
+	batch.state = Batch::State::InFlight;
+	mPendingTiles += batch.tiles.size();
+	Batch* mapped = &batch;
+	uint64_t size = uint64_t(mBytesPerRow) * rowCount * mTileSize;
+	mReadbacks.map(batch.readback, size, [this, mapped](bool success) {
+		if (success) {
+			mapped->state = Batch::State::Mapped;
+			return;
+		}
+		// Thumbnails that failed to map are dropped
+		std::cerr << "Could not read back " << mapped->tiles.size() << " thumbnails" << std::endl;
+		mFailedCount += mapped->tiles.size();
+		mPendingTiles -= mapped->tiles.size();
+		releaseTiles(*mapped);
+		mapped->state = Batch::State::Free;
+	});
+	DeviceEvents::notify();
+}
+
+void ThumbnailRenderer::releaseTiles(Batch& batch) {
+	for (Tile& tile : batch.tiles) {
+		for (Buffer* buffer : { &tile.vertexBuffer, &tile.indexBuffer }) {
+			if (!*buffer) continue;
+			destroyTracked(*buffer);
+			buffer->release();
+		}
+		if (tile.texture) {
+			destroyTracked(tile.texture);
+			tile.texture.release();
+		}
+		if (tile.bindGroup) tile.bindGroup.release();
+	}
+	batch.tiles.clear();
+}
+
+void ThumbnailRenderer::poll() {
+	for (const std::unique_ptr<Batch>& entry : mBatches) {
+		Batch& batch = *entry;
+		if (batch.state != Batch::State::Mapped) continue;
+
+		// Rows of whole tiles, shared by the encodes of the tiles, and the buffer free again right away
+		TRACE_SCOPE("Copy thumbnails");
+		uint32_t rowCount = static_cast<uint32_t>((batch.tiles.size() + mTilesPerSide - 1) / mTilesPerSide);
+		size_t size = size_t(mBytesPerRow) * rowCount * mTileSize;
+		auto pixels = std::make_shared<std::vector<uint8_t>>(size);
+		std::memcpy(pixels->data(), mReadbacks.mappedRange(batch.readback, size), size);
+		mReadbacks.release(batch.readback);
+
+		for (uint32_t t = 0; t < batch.tiles.size(); ++t) {
+			size_t offset = size_t(t / mTilesPerSide) * mTileSize * mBytesPerRow + size_t(t % mTilesPerSide) * mTileSize * 4;
+			mEncoder.enqueue([this, pixels, offset, path = std::move(batch.tiles[t].outputPath)]() -> AssetLoader::Completion {
+				TRACE_SCOPE("Encode thumbnail");
+				std::error_code ec;
+				std::filesystem::path directory = std::filesystem::path(path).parent_path();
+				if (!directory.empty()) std::filesystem::create_directories(directory, ec);
+				int size = static_cast<int>(mTileSize);
+				// The stride of the atlas rows crops the tile out of them
+				bool written = stbi_write_png(path.c_str(), size, size, 4, pixels->data() + offset, static_cast<int>(mBytesPerRow)) != 0;
+				if (written) return [this]() { ++mWrittenCount; --mPendingTiles; };
+				return [this, path]() {
+					std::cerr << "Could not write thumbnail '" << path << "'" << std::endl;
+					++mFailedCount;
+					--mPendingTiles;
+				};
+			});
+		}
+		releaseTiles(batch);
+		batch.state = Batch::State::Free;
+	}
+	mEncoder.processCompletions();
+}
+
+size_t ThumbnailRenderer::pendingCount() const {
+	const Batch* batch = fillingBatch();
+	size_t filling = batch && batch->state == Batch::State::Filling ? batch->tiles.size() : 0;
+	return filling + mPendingTiles;
+}
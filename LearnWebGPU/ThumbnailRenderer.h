@@ -0,0 +1,157 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "AssetLoader.h"
+#include "ResourceManager.h"
+#include "ReadbackPool.h"
+
+#include "MathConfig.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Renders preview images of many meshes with one device and one pipeline, for
+ * the thumbnails of an asset library to be made at a rate of assets per second
+ * rather than of application launches.
+ *
+ * Assets are drawn into the tiles of an atlas, each one framed by a camera of its
+ * own from the same angle, so that a single render pass draws as many thumbnails
+ * as the atlas has tiles. The atlas is then copied to one of a few MapRead buffers
+ * and mapped asynchronously, while the next batch is drawn into the same atlas,
+ * the queue ordering the copy before it. Once mapped, the pixels are copied out
+ * and split into one PNG per tile by worker threads, so that the device thread
+ * only uploads and records. Meshes and textures of a batch are released once its
+ * readback is mapped, their draws being done by then.
+ *
+ * Assets are decoded in CPU memory by the caller, e.g. on the workers of an
+ * AssetLoader, and drawn with their base color texture, lit from above, over a
+ * transparent background. Like the rest of the device, it must only be used from
+ * the device thread.
+ */
+class ThumbnailRenderer {
+public:
+	/**
+	 * A mesh to draw, with its texture, and where to save its thumbnail
+	 */
+	struct Asset {
+		std::shared_ptr<const ResourceManager::Geometry> geometry;
+		// Null for the mesh to be drawn with its vertex colors alone
+		std::shared_ptr<const ResourceManager::Image> image;
+		// Center and radius the camera frames, see boundingSphere()
+		glm::vec4 boundingSphere = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		std::string outputPath;
+	};
+
+	// Thumbnails of `tileSize` pixels, `tilesPerSide` x `tilesPerSide` per render pass, up to
+	// `batchCount` passes being read back at once and `encoderThreadCount` threads encoding them
+	ThumbnailRenderer(wgpu::Device device, uint32_t tileSize = 256, uint32_t tilesPerSide = 8, uint32_t batchCount = 3, unsigned int encoderThreadCount = 2);
+	// Wait for the readbacks in flight, and for the files being encoded
+	~ThumbnailRenderer();
+
+	ThumbnailRenderer(const ThumbnailRenderer&) = delete;
+	ThumbnailRenderer& operator=(const ThumbnailRenderer&) = delete;
+
+	bool valid() const { return mPipeline != nullptr; }
+	uint32_t tileCount() const { return mTilesPerSide * mTilesPerSide; }
+
+	// Sphere around the vertices of the full level of `geometry`, from the center of its bounding
+	// box. Safe to call from any thread, e.g. when the asset is loaded.
+	static glm::vec4 boundingSphere(const ResourceManager::Geometry& geometry);
+
+	// Whether add() can take an asset now, rather than once a readback or encodes finish
+	bool canAdd() const;
+	// Upload `asset` and give it the next tile, drawing the batch once it is full. Return false if
+	// its upload fails or it cannot be taken now.
+	bool add(Asset asset);
+	// Draw the batch being filled, even if some of its tiles are left empty
+	void flush();
+
+	// Hand the mapped batches to the encoder threads, and count the files they wrote
+	void poll();
+
+	// Assets added whose thumbnail is not written yet
+	size_t pendingCount() const;
+	uint64_t writtenCount() const { return mWrittenCount; }
+	uint64_t failedCount() const { return mFailedCount; }
+
+private:
+	/**
+	 * An asset uploaded for the draw of its tile
+	 */
+	struct Tile {
+		wgpu::Buffer vertexBuffer = nullptr;
+		wgpu::Buffer indexBuffer = nullptr;
+		uint32_t indexCount = 0;
+		wgpu::Texture texture = nullptr;
+		wgpu::BindGroup bindGroup = nullptr;
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+		std::string outputPath;
+	};
+
+	/**
+	 * The tiles of a render pass and the buffer its atlas is read back to
+	 */
+	struct Batch {
+		enum class State {
+			// Available for the next tiles
+			Free,
+			// Taking tiles, drawn once full or flushed
+			Filling,
+			// Drawn and copied, waiting for mapAsync
+			InFlight,
+			// Mapped, to be handed to the encoder threads by the next poll()
+			Mapped,
+		};
+		State state = State::Free;
+		// Slot of the readback pool the atlas is copied to, once drawn
+		uint32_t readback = ReadbackPool::NoSlot;
+		std::vector<Tile> tiles;
+	};
+
+	// Encodes waiting for the threads beyond which no asset is taken
+	size_t maxPendingEncodes() const { return 2 * tileCount(); }
+
+	bool initPipeline();
+	// The batch being filled, or a free one starting to, or null
+	Batch* fillingBatch();
+	const Batch* fillingBatch() const;
+	// Record the draws of `batch` and the copy of the atlas, submit them and map the copy
+	void draw(Batch& batch);
+	static void releaseTiles(Batch& batch);
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue = nullptr;
+	uint32_t mTileSize;
+	uint32_t mTilesPerSide;
+	// Of the atlas rows in readback buffers, a multiple of 256 bytes as copies require
+	uint32_t mBytesPerRow = 0;
+	wgpu::Texture mAtlas = nullptr;
+	wgpu::TextureView mAtlasView = nullptr;
+	wgpu::Texture mDepth = nullptr;
+	wgpu::TextureView mDepthView = nullptr;
+	// A view-projection matrix per tile, in slots bound at dynamic offsets
+	wgpu::Buffer mUniformBuffer = nullptr;
+	wgpu::BindGroupLayout mUniformLayout = nullptr;
+	wgpu::BindGroup mUniformBindGroup = nullptr;
+	wgpu::BindGroupLayout mTextureLayout = nullptr;
+	wgpu::PipelineLayout mPipelineLayout = nullptr;
+	wgpu::RenderPipeline mPipeline = nullptr;
+	wgpu::Sampler mSampler = nullptr;
+	// Bound for assets without a texture
+	wgpu::Texture mWhiteTexture = nullptr;
+	wgpu::TextureView mWhiteView = nullptr;
+
+	std::vector<std::unique_ptr<Batch>> mBatches;
+	ReadbackPool mReadbacks;
+	AssetLoader mEncoder;
+	// Tiles drawn and being read back or encoded
+	size_t mPendingTiles = 0;
+	// Written by the completions of the encoder, on the device thread
+	uint64_t mWrittenCount = 0;
+	uint64_t mFailedCount = 0;
+};
@@ -0,0 +1,248 @@
+/**
+ * Batch renderer of the thumbnails of an asset library:
+ *   LearnWebGPU-thumbnails [--output <directory>] [--size <pixels>] [--tiles <per side>]
+ *                          [--threads <n>] <list.txt | file.obj>...
+ *
+ * Each line of a list names a mesh (.obj, .glb or .txt) and, optionally, its texture,
+ * relative to the directory of the list, as in "chairs/chair01.obj chairs/chair01.png".
+ * Meshes without a texture get the base color texture of their first material, if
+ * any. The thumbnail of each mesh is written to <directory> (thumbnails by default)
+ * at the path of the mesh relative to its list, with a .png extension.
+ *
+ * Meshes and textures load on the workers of an AssetLoader, a few batches ahead of
+ * the renderer, and are drawn by a single ThumbnailRenderer on one device, whose
+ * readbacks and encodes overlap the next batches. Prints the throughput, in assets
+ * per second, once every thumbnail is written.
+ */
+
+#include "ThumbnailRenderer.h"
+#include "AssetLoader.h"
+#include "DeviceEvents.h"
+#include "ResourceManager.h"
+#include "webgpu-utils.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+struct Options {
+	std::filesystem::path outputDirectory = "thumbnails";
+	uint32_t tileSize = 256;
+	uint32_t tilesPerSide = 8;
+	unsigned int threadCount = std::max(2u, std::thread::hardware_concurrency());
+	std::vector<std::filesystem::path> inputs;
+};
+
+/**
+ * A mesh to make the thumbnail of
+ */
+struct Entry {
+	std::filesystem::path meshPath;
+	// Empty for that of the first material of the mesh, if any
+	std::filesystem::path texturePath;
+	std::filesystem::path outputPath;
+};
+
+bool parseUint(const char* str, uint32_t& value) {
+	const char* end = str + std::strlen(str);
+	auto result = std::from_chars(str, end, value);
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+	bool valid = true;
+	for (int i = 1; i < argc && valid; ++i) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (std::strcmp(arg, "--output") == 0 && value) {
+			options.outputDirectory = value;
+			++i;
+		}
+		else if (std::strcmp(arg, "--size") == 0 && value) {
+			valid = parseUint(value, options.tileSize) && options.tileSize >= 16 && options.tileSize <= 1024;
+			++i;
+		}
+		else if (std::strcmp(arg, "--tiles") == 0 && value) {
+			valid = parseUint(value, options.tilesPerSide) && options.tilesPerSide > 0;
+			++i;
+		}
+		else if (std::strcmp(arg, "--threads") == 0 && value) {
+			uint32_t threadCount = 0;
+			valid = parseUint(value, threadCount) && threadCount > 0;
+			options.threadCount = threadCount;
+			++i;
+		}
+		else if (arg[0] != '-') {
+			options.inputs.push_back(arg);
+		}
+		else {
+			valid = false;
+		}
+	}
+	if (!valid || options.inputs.empty()) {
+		std::cerr << "Usage: " << argv[0] << " [--output <directory>] [--size <pixels>] [--tiles <per side>] [--threads <n>] <list.txt | file.obj>..." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// The entries of the lists and meshes given, in order
+bool readEntries(const Options& options, std::vector<Entry>& entries) {
+	for (const std::filesystem::path& input : options.inputs) {
+		if (input.extension() != ".txt") {
+			Entry entry;
+			entry.meshPath = input;
+			entry.outputPath = options.outputDirectory / input.filename().replace_extension(".png");
+			entries.push_back(std::move(entry));
+			continue;
+		}
+		std::ifstream list(input);
+		if (!list) {
+			std::cerr << "Could not open the list " << input << std::endl;
+			return false;
+		}
+		std::filesystem::path directory = input.parent_path();
+		std::string line;
+		while (std::getline(list, line)) {
+			std::istringstream fields(line);
+			std::string mesh, texture;
+			if (!(fields >> mesh) || mesh[0] == '#') continue;
+			fields >> texture;
+			Entry entry;
+			entry.meshPath = directory / mesh;
+			if (!texture.empty()) entry.texturePath = directory / texture;
+			entry.outputPath = options.outputDirectory / std::filesystem::path(mesh).replace_extension(".png");
+			entries.push_back(std::move(entry));
+		}
+	}
+	return true;
+}
+
+Device createHeadlessDevice(Instance instance) {
+	RequestAdapterOptions adapterOptions{};
+	adapterOptions.compatibleSurface = nullptr;
+	adapterOptions.powerPreference = PowerPreference::HighPerformance;
+	Adapter adapter = requestAdapterSync(instance, &adapterOptions);
+	if (!adapter) return nullptr;
+	DeviceDescriptor deviceDesc{};
+	deviceDesc.label = "Thumbnail device";
+	Device device = requestDeviceSync(adapter, &deviceDesc);
+	adapter.release();
+	return device;
+}
+
+// Render the thumbnails of `entries`, returning whether every one of them was written
+bool renderThumbnails(Device device, const Options& options, const std::vector<Entry>& entries) {
+	uint64_t loadFailures = 0;
+	ThumbnailRenderer renderer(device, options.tileSize, options.tilesPerSide);
+	if (!renderer.valid()) return false;
+	AssetLoader loader(options.threadCount);
+
+	// Only what is needed to draw, from the mesh cache when up to date, and textures no
+	// larger than a few times the tile
+	ResourceManager::GeometryLoadOptions geometryOptions;
+	geometryOptions.lodLevelCount = 1;
+	geometryOptions.buildMeshlets = false;
+	ResourceManager::TextureLoadOptions textureOptions;
+	textureOptions.srgb = true;
+	textureOptions.maxSize = 2 * options.tileSize;
+
+	// Loads run up to two batches ahead of the renderer, bounding the memory they take
+	const size_t maxLoads = 2 * size_t(renderer.tileCount());
+	std::deque<ThumbnailRenderer::Asset> loaded;
+	size_t next = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (next < entries.size() || loader.pendingCount() > 0 || !loaded.empty() || renderer.pendingCount() > 0) {
+		while (next < entries.size() && loader.pendingCount() + loaded.size() < maxLoads) {
+			const Entry& entry = entries[next++];
+			loader.enqueue([&, entry]() -> AssetLoader::Completion {
+				auto geometry = std::make_shared<ResourceManager::Geometry>();
+				if (!ResourceManager::loadGeometry(entry.meshPath, *geometry, geometryOptions)) {
+					return [&, entry]() {
+						std::cerr << "Could not load " << entry.meshPath << std::endl;
+						++loadFailures;
+					};
+				}
+				std::filesystem::path texturePath = entry.texturePath;
+				if (texturePath.empty() && !geometry->materials.empty() && !geometry->materials[0].baseColorTexture.empty()) {
+					texturePath = entry.meshPath.parent_path() / geometry->materials[0].baseColorTexture;
+				}
+				std::shared_ptr<ResourceManager::Image> image;
+				if (!texturePath.empty()) {
+					image = std::make_shared<ResourceManager::Image>();
+					if (ResourceManager::loadImage(texturePath, *image, textureOptions)) {
+						ResourceManager::buildMipMaps(*image, textureOptions);
+					}
+					else {
+						// Drawn with its vertex colors
+						image.reset();
+					}
+				}
+				ThumbnailRenderer::Asset asset;
+				asset.boundingSphere = ThumbnailRenderer::boundingSphere(*geometry);
+				asset.geometry = geometry;
+				asset.image = image;
+				asset.outputPath = entry.outputPath.string();
+				return [&, asset = std::move(asset)]() mutable { loaded.push_back(std::move(asset)); };
+			});
+		}
+		loader.processCompletions();
+
+		while (!loaded.empty() && renderer.canAdd()) {
+			if (!renderer.add(std::move(loaded.front()))) ++loadFailures;
+			loaded.pop_front();
+		}
+		// The last batch is drawn however full it gets
+		if (next == entries.size() && loader.pendingCount() == 0 && loaded.empty()) renderer.flush();
+		renderer.poll();
+
+		DeviceEvents::dispatch(device);
+		std::this_thread::yield();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint64_t written = renderer.writtenCount();
+	std::cout << "Wrote " << written << " thumbnails to " << options.outputDirectory << " in " << std::fixed << std::setprecision(2) << seconds
+		<< " s, " << std::setprecision(1) << (seconds > 0.0 ? written / seconds : 0.0) << " assets/s";
+	uint64_t failed = renderer.failedCount() + loadFailures;
+	if (failed > 0) std::cout << ", " << failed << " failed";
+	std::cout << std::endl;
+	return failed == 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) return 1;
+	std::vector<Entry> entries;
+	if (!readEntries(options, entries)) return 1;
+
+	Instance instance = createInstance(InstanceDescriptor{});
+	Device device = instance ? createHeadlessDevice(instance) : nullptr;
+	if (!device) {
+		std::cerr << "Could not create a device" << std::endl;
+		if (instance) instance.release();
+		return 1;
+	}
+
+	bool written = renderThumbnails(device, options, entries);
+
+	device.release();
+	instance.release();
+	return written ? 0 : 1;
+}
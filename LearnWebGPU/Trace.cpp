@@ -0,0 +1,222 @@
+#include "Trace.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+/**
+ * A complete event ("ph": "X" in the trace format)
+ */
+struct Event {
+	const char* name;
+	int64_t start;
+	int64_t duration;
+};
+
+/**
+ * Events are never moved once written, so that they can be read while the
+ * thread appends to its buffer
+ */
+struct Chunk {
+	static constexpr uint32_t capacity = 4096;
+	std::array<Event, capacity> events;
+	// Events written, published after each of them is complete
+	std::atomic<uint32_t> count = 0;
+	std::atomic<Chunk*> next = nullptr;
+};
+
+/**
+ * Events of a thread, only ever written by that thread
+ */
+struct ThreadBuffer {
+	uint32_t threadId = 0;
+	std::atomic<const char*> name = nullptr;
+	Chunk* head = nullptr;
+	// Only accessed by the thread
+	Chunk* tail = nullptr;
+
+	// Chunks from head to tail, only counted when they are limited
+	uint32_t chunkCount = 1;
+
+	ThreadBuffer() : head(new Chunk), tail(head) {}
+	~ThreadBuffer() {
+		for (Chunk* chunk = head; chunk;) {
+			Chunk* next = chunk->next.load(std::memory_order_relaxed);
+			delete chunk;
+			chunk = next;
+		}
+	}
+};
+
+struct Registry {
+	// Only locked when a thread records its first event and when exporting
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+std::atomic<bool> gRecording = false;
+std::atomic<uint32_t> gChunkLimit = 0;
+thread_local ThreadBuffer* tBuffer = nullptr;
+
+Registry& registry() {
+	static Registry registry;
+	return registry;
+}
+
+ThreadBuffer& threadBuffer() {
+	if (!tBuffer) {
+		Registry& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+		tBuffer = reg.buffers.back().get();
+		tBuffer->threadId = static_cast<uint32_t>(reg.buffers.size());
+	}
+	return *tBuffer;
+}
+
+void writeJsonString(std::ostream& out, const char* str) {
+	out << '"';
+	for (const char* c = str; *c; ++c) {
+		if (*c == '"' || *c == '\\') out << '\\';
+		if (static_cast<unsigned char>(*c) >= 0x20) out << *c;
+	}
+	out << '"';
+}
+
+} // anonymous namespace
+
+void Trace::start() {
+	gRecording.store(true, std::memory_order_relaxed);
+}
+
+void Trace::stop() {
+	gRecording.store(false, std::memory_order_relaxed);
+}
+
+bool Trace::recording() {
+	return gRecording.load(std::memory_order_relaxed);
+}
+
+void Trace::setChunkLimit(uint32_t chunkCount) {
+	gChunkLimit.store(chunkCount, std::memory_order_relaxed);
+}
+
+void Trace::setThreadName(const char* name) {
+	threadBuffer().name.store(name, std::memory_order_release);
+#ifdef TRACY_ENABLE
+	tracy::SetThreadName(name);
+#endif // TRACY_ENABLE
+}
+
+void Trace::record(const char* name, int64_t start, int64_t duration) {
+	ThreadBuffer& buffer = threadBuffer();
+	Chunk* chunk = buffer.tail;
+	uint32_t count = chunk->count.load(std::memory_order_relaxed);
+	if (count == Chunk::capacity) {
+		uint32_t limit = gChunkLimit.load(std::memory_order_relaxed);
+		Chunk* next = nullptr;
+		if (limit > 1 && buffer.chunkCount >= limit) {
+			// Readers walk the chunks under the lock, which the thread otherwise never takes, and
+			// only once every few thousand events here
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			next = buffer.head;
+			buffer.head = next->next.load(std::memory_order_relaxed);
+			next->count.store(0, std::memory_order_relaxed);
+			next->next.store(nullptr, std::memory_order_relaxed);
+			chunk->next.store(next, std::memory_order_release);
+		}
+		else {
+			next = new Chunk;
+			chunk->next.store(next, std::memory_order_release);
+			++buffer.chunkCount;
+		}
+		buffer.tail = chunk = next;
+		count = 0;
+	}
+	chunk->events[count] = { name, start, duration };
+	chunk->count.store(count + 1, std::memory_order_release);
+}
+
+int64_t Trace::now() {
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool Trace::writeChromeTrace(const std::string& path) {
+	std::ofstream file(path);
+	if (!file) {
+		std::cerr << "Could not write trace to " << path << std::endl;
+		return false;
+	}
+
+	Registry& reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+
+	// Events published so far, the threads possibly writing more meanwhile
+	struct ThreadEvents {
+		const ThreadBuffer* buffer;
+		std::vector<Event> events;
+	};
+	std::vector<ThreadEvents> threads;
+	int64_t origin = std::numeric_limits<int64_t>::max();
+	for (const std::unique_ptr<ThreadBuffer>& buffer : reg.buffers) {
+		ThreadEvents thread{ buffer.get(), {} };
+		for (const Chunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+			uint32_t count = chunk->count.load(std::memory_order_acquire);
+			thread.events.insert(thread.events.end(), chunk->events.begin(), chunk->events.begin() + count);
+		}
+		for (const Event& event : thread.events) {
+			origin = std::min(origin, event.start);
+		}
+		threads.push_back(std::move(thread));
+	}
+
+	// Timestamps and durations are in microseconds
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	const char* separator = "\n";
+	for (const ThreadEvents& thread : threads) {
+		if (const char* name = thread.buffer->name.load(std::memory_order_acquire)) {
+			file << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.buffer->threadId << ",\"args\":{\"name\":";
+			writeJsonString(file, name);
+			file << "}}";
+			separator = ",\n";
+		}
+		for (const Event& event : thread.events) {
+			file << separator << "{\"name\":";
+			writeJsonString(file, event.name);
+			file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.buffer->threadId
+				<< ",\"ts\":" << (event.start - origin) / 1000.0
+				<< ",\"dur\":" << event.duration / 1000.0 << "}";
+			separator = ",\n";
+		}
+	}
+	file << "\n]}\n";
+	return static_cast<bool>(file);
+}
+
+void Trace::forEachEvent(int64_t from, int64_t to, const Visitor& visit) {
+	Registry& reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	for (const std::unique_ptr<ThreadBuffer>& buffer : reg.buffers) {
+		const char* threadName = buffer->name.load(std::memory_order_acquire);
+		for (const Chunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+			uint32_t count = chunk->count.load(std::memory_order_acquire);
+			for (uint32_t i = 0; i < count; ++i) {
+				const Event& event = chunk->events[i];
+				if (event.start < to && event.start + event.duration > from) {
+					visit(buffer->threadId, threadName, event.name, event.start, event.duration);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <cstdint>
+
+/**
+ * Scoped CPU timing markers, exported as a Chrome trace (chrome://tracing, or
+ * https://ui.perfetto.dev) to see where startup and frame time goes.
+ *
+ * Each thread records into a buffer of its own, a list of fixed-size chunks that
+ * it appends to without locking, the count of events of a chunk being published
+ * atomically so that writeChromeTrace() may read them from another thread while
+ * recording goes on. Buffers only grow while recording, unless limited to their
+ * latest chunks for recording all along (see setChunkLimit()), and live until the
+ * end of the program. A marker costs a relaxed atomic load when recording is stopped.
+ *
+ * When built with Tracy (TRACY_ENABLE defined, with Tracy's include directory),
+ * TRACE_SCOPE() opens Tracy zones instead, and Trace only records thread names.
+ */
+class Trace {
+public:
+	// Start and stop recording
+	static void start();
+	static void stop();
+	static bool recording();
+
+	// Keep at most `chunkCount` chunks of 4096 events per thread, reusing the oldest one once
+	// they are full, 0 (the default) to keep every event
+	static void setChunkLimit(uint32_t chunkCount);
+
+	// Name the calling thread in the trace
+	static void setThreadName(const char* name);
+
+	// Write the events recorded so far as Chrome trace_event JSON, returning false
+	// if the file cannot be written
+	static bool writeChromeTrace(const std::string& path);
+
+	// Call `visit` on the events recorded so far that overlap [from, to), thread by thread,
+	// with the index (from 1) and name (null if unnamed) of their thread. Events must not be
+	// recorded from `visit`, which runs under the lock that limited buffers take.
+	using Visitor = std::function<void(uint32_t threadId, const char* threadName, const char* name, int64_t start, int64_t duration)>;
+	static void forEachEvent(int64_t from, int64_t to, const Visitor& visit);
+
+	// Record a complete event of the calling thread, `name` having to outlive the trace
+	// (typically a string literal). Times are in nanoseconds since an arbitrary origin.
+	static void record(const char* name, int64_t start, int64_t duration);
+
+	// Current time of the trace clock, in nanoseconds
+	static int64_t now();
+};
+
+/**
+ * Record the time from its construction to its destruction, see TRACE_SCOPE()
+ */
+class TraceScope {
+public:
+	explicit TraceScope(const char* name)
+		: mName(name)
+		, mStart(Trace::recording() ? Trace::now() : -1)
+	{}
+	~TraceScope() {
+		if (mStart >= 0) Trace::record(mName, mStart, Trace::now() - mStart);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* mName;
+	int64_t mStart;
+};
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef TRACY_ENABLE
+#include <tracy/Tracy.hpp>
+// Time the rest of the enclosing scope, `name` being a string literal
+#define TRACE_SCOPE(name) ZoneScopedN(name)
+#else
+// Time the rest of the enclosing scope, `name` being a string literal
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#endif // TRACY_ENABLE
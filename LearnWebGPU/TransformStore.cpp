@@ -0,0 +1,214 @@
+#include "TransformStore.h"
+#include "ParallelFor.h"
+#include "Simd.h"
+
+#include <algorithm>
+
+namespace {
+
+#if defined(SIMD_SSE2)
+using float4 = __m128;
+inline float4 load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, float4 v) { _mm_storeu_ps(p, v); }
+inline float4 splat(float value) { return _mm_set1_ps(value); }
+inline float4 add4(float4 a, float4 b) { return _mm_add_ps(a, b); }
+inline float4 sub4(float4 a, float4 b) { return _mm_sub_ps(a, b); }
+inline float4 mul4(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+inline void transpose(float4& r0, float4& r1, float4& r2, float4& r3) { _MM_TRANSPOSE4_PS(r0, r1, r2, r3); }
+#elif defined(SIMD_NEON)
+using float4 = float32x4_t;
+inline float4 load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, float4 v) { vst1q_f32(p, v); }
+inline float4 splat(float value) { return vdupq_n_f32(value); }
+inline float4 add4(float4 a, float4 b) { return vaddq_f32(a, b); }
+inline float4 sub4(float4 a, float4 b) { return vsubq_f32(a, b); }
+inline float4 mul4(float4 a, float4 b) { return vmulq_f32(a, b); }
+inline void transpose(float4& r0, float4& r1, float4& r2, float4& r3) {
+	float32x4x2_t t01 = vtrnq_f32(r0, r1);
+	float32x4x2_t t23 = vtrnq_f32(r2, r3);
+	r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+	r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+	r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+	r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+#elif defined(SIMD_WASM)
+using float4 = v128_t;
+inline float4 load(const float* p) { return wasm_v128_load(p); }
+inline void store(float* p, float4 v) { wasm_v128_store(p, v); }
+inline float4 splat(float value) { return wasm_f32x4_splat(value); }
+inline float4 add4(float4 a, float4 b) { return wasm_f32x4_add(a, b); }
+inline float4 sub4(float4 a, float4 b) { return wasm_f32x4_sub(a, b); }
+inline float4 mul4(float4 a, float4 b) { return wasm_f32x4_mul(a, b); }
+inline void transpose(float4& r0, float4& r1, float4& r2, float4& r3) {
+	float4 t0 = wasm_i32x4_shuffle(r0, r1, 0, 4, 1, 5);
+	float4 t1 = wasm_i32x4_shuffle(r2, r3, 0, 4, 1, 5);
+	float4 t2 = wasm_i32x4_shuffle(r0, r1, 2, 6, 3, 7);
+	float4 t3 = wasm_i32x4_shuffle(r2, r3, 2, 6, 3, 7);
+	r0 = wasm_i32x4_shuffle(t0, t1, 0, 1, 4, 5);
+	r1 = wasm_i32x4_shuffle(t0, t1, 2, 3, 6, 7);
+	r2 = wasm_i32x4_shuffle(t2, t3, 0, 1, 4, 5);
+	r3 = wasm_i32x4_shuffle(t2, t3, 2, 3, 6, 7);
+}
+#endif
+
+#ifdef SIMD_128
+// Store column `column` of 4 consecutive matrices, given as its rows across the lanes
+inline void storeColumns(glm::mat4* matrices, int column, float4 x, float4 y, float4 z, float4 w) {
+	transpose(x, y, z, w);
+	store(&matrices[0][column][0], x);
+	store(&matrices[1][column][0], y);
+	store(&matrices[2][column][0], z);
+	store(&matrices[3][column][0], w);
+}
+
+// parent * local, one column at a time
+inline void multiply(const glm::mat4& parent, const glm::mat4& local, glm::mat4& result) {
+	float4 p0 = load(&parent[0][0]);
+	float4 p1 = load(&parent[1][0]);
+	float4 p2 = load(&parent[2][0]);
+	float4 p3 = load(&parent[3][0]);
+	for (int column = 0; column < 4; ++column) {
+		const glm::vec4& l = local[column];
+		float4 r = add4(
+			add4(mul4(p0, splat(l.x)), mul4(p1, splat(l.y))),
+			add4(mul4(p2, splat(l.z)), mul4(p3, splat(l.w)))
+		);
+		store(&result[column][0], r);
+	}
+}
+#else
+inline void multiply(const glm::mat4& parent, const glm::mat4& local, glm::mat4& result) {
+	result = parent * local;
+}
+#endif // SIMD_128
+
+} // anonymous namespace
+
+uint32_t TransformStore::add(uint32_t parent) {
+	uint32_t node = static_cast<uint32_t>(size());
+	mPositionX.push_back(0.0f);
+	mPositionY.push_back(0.0f);
+	mPositionZ.push_back(0.0f);
+	mRotationX.push_back(0.0f);
+	mRotationY.push_back(0.0f);
+	mRotationZ.push_back(0.0f);
+	mRotationW.push_back(1.0f);
+	mScaleX.push_back(1.0f);
+	mScaleY.push_back(1.0f);
+	mScaleZ.push_back(1.0f);
+	mParents.push_back(parent < node ? parent : NoParent);
+	mLocalDirty.push_back(1);
+	mWorldDirty.push_back(1);
+	mLocal.emplace_back(1.0f);
+	mWorld.emplace_back(1.0f);
+	mFirstDirty = std::min<size_t>(mFirstDirty, node);
+	return node;
+}
+
+void TransformStore::clear() {
+	for (std::vector<float>* values : { &mPositionX, &mPositionY, &mPositionZ, &mRotationX, &mRotationY, &mRotationZ, &mRotationW, &mScaleX, &mScaleY, &mScaleZ }) {
+		values->clear();
+	}
+	mParents.clear();
+	mLocalDirty.clear();
+	mWorldDirty.clear();
+	mLocal.clear();
+	mWorld.clear();
+	mFirstDirty = 0;
+}
+
+void TransformStore::setPosition(uint32_t node, const glm::vec3& position) {
+	mPositionX[node] = position.x;
+	mPositionY[node] = position.y;
+	mPositionZ[node] = position.z;
+	markDirty(node);
+}
+
+void TransformStore::setRotation(uint32_t node, const glm::quat& rotation) {
+	mRotationX[node] = rotation.x;
+	mRotationY[node] = rotation.y;
+	mRotationZ[node] = rotation.z;
+	mRotationW[node] = rotation.w;
+	markDirty(node);
+}
+
+void TransformStore::setScale(uint32_t node, const glm::vec3& scale) {
+	mScaleX[node] = scale.x;
+	mScaleY[node] = scale.y;
+	mScaleZ[node] = scale.z;
+	markDirty(node);
+}
+
+void TransformStore::markDirty(uint32_t node) {
+	mLocalDirty[node] = 1;
+	mFirstDirty = std::min<size_t>(mFirstDirty, node);
+}
+
+void TransformStore::composeLocal(size_t begin, size_t end) {
+	// Groups of 4 nodes in which any is dirty are composed, clean ones being composed
+	// again to the same values
+	size_t i = begin;
+#ifdef SIMD_128
+	float4 one = splat(1.0f);
+	float4 two = splat(2.0f);
+	float4 zero = splat(0.0f);
+	for (; i + 4 <= end; i += 4) {
+		if (!(mLocalDirty[i] | mLocalDirty[i + 1] | mLocalDirty[i + 2] | mLocalDirty[i + 3])) continue;
+		float4 x = load(&mRotationX[i]);
+		float4 y = load(&mRotationY[i]);
+		float4 z = load(&mRotationZ[i]);
+		float4 w = load(&mRotationW[i]);
+		float4 x2 = mul4(x, two), y2 = mul4(y, two), z2 = mul4(z, two);
+		float4 xx = mul4(x, x2), yy = mul4(y, y2), zz = mul4(z, z2);
+		float4 xy = mul4(x, y2), xz = mul4(x, z2), yz = mul4(y, z2);
+		float4 wx = mul4(w, x2), wy = mul4(w, y2), wz = mul4(w, z2);
+		float4 sx = load(&mScaleX[i]);
+		float4 sy = load(&mScaleY[i]);
+		float4 sz = load(&mScaleZ[i]);
+
+		glm::mat4* local = &mLocal[i];
+		storeColumns(local, 0, mul4(sub4(one, add4(yy, zz)), sx), mul4(add4(xy, wz), sx), mul4(sub4(xz, wy), sx), zero);
+		storeColumns(local, 1, mul4(sub4(xy, wz), sy), mul4(sub4(one, add4(xx, zz)), sy), mul4(add4(yz, wx), sy), zero);
+		storeColumns(local, 2, mul4(add4(xz, wy), sz), mul4(sub4(yz, wx), sz), mul4(sub4(one, add4(xx, yy)), sz), zero);
+		storeColumns(local, 3, load(&mPositionX[i]), load(&mPositionY[i]), load(&mPositionZ[i]), one);
+	}
+#endif // SIMD_128
+	for (; i < end; ++i) {
+		if (!mLocalDirty[i]) continue;
+		glm::quat rotation(mRotationW[i], mRotationX[i], mRotationY[i], mRotationZ[i]);
+		glm::mat4 local = glm::mat4_cast(rotation);
+		local[0] *= mScaleX[i];
+		local[1] *= mScaleY[i];
+		local[2] *= mScaleZ[i];
+		local[3] = glm::vec4(mPositionX[i], mPositionY[i], mPositionZ[i], 1.0f);
+		mLocal[i] = local;
+	}
+}
+
+void TransformStore::update() {
+	size_t nodeCount = size();
+	if (mFirstDirty >= nodeCount) return;
+
+	// Local matrices are independent from one another, and composed in parallel
+	parallelForRanges(nodeCount - mFirstDirty, [this](size_t begin, size_t end) {
+		composeLocal(mFirstDirty + begin, mFirstDirty + end);
+	}, 4096);
+
+	// World matrices, parents being done before their children
+	for (size_t i = mFirstDirty; i < nodeCount; ++i) {
+		uint32_t parent = mParents[i];
+		bool dirty = mLocalDirty[i] || mWorldDirty[i] || (parent != NoParent && mWorldDirty[parent]);
+		mWorldDirty[i] = dirty;
+		if (!dirty) continue;
+		if (parent == NoParent) {
+			mWorld[i] = mLocal[i];
+		}
+		else {
+			multiply(mWorld[parent], mLocal[i], mWorld[i]);
+		}
+	}
+
+	std::fill(mLocalDirty.begin() + mFirstDirty, mLocalDirty.end(), 0);
+	std::fill(mWorldDirty.begin() + mFirstDirty, mWorldDirty.end(), 0);
+	mFirstDirty = nodeCount;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "MathConfig.h"
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Hierarchy of transforms, each one a translation, rotation and scale relative to
+ * its parent, stored as a structure of arrays so that local matrices are composed
+ * as many at once as the vector width allows.
+ *
+ * Parents are always added before their children, so that a single pass in index
+ * order propagates world matrices down the hierarchy. Setters mark their node
+ * dirty, and update() only composes dirty nodes and recomputes the world matrices
+ * of dirty nodes and their descendants, clean subtrees costing a flag test per node.
+ * The pass starts at the first dirty node, nodes before it being unaffected.
+ *
+ * Kernels use SSE2, NEON or WASM SIMD when enabled at compile time, 4 nodes at a time,
+ * local matrices of large hierarchies being composed in parallel.
+ */
+class TransformStore {
+public:
+	static constexpr uint32_t NoParent = UINT32_MAX;
+
+	// Add an identity transform, child of `parent` which must already exist, and return its index
+	uint32_t add(uint32_t parent = NoParent);
+	void clear();
+	size_t size() const { return mParents.size(); }
+
+	void setPosition(uint32_t node, const glm::vec3& position);
+	void setRotation(uint32_t node, const glm::quat& rotation);
+	void setScale(uint32_t node, const glm::vec3& scale);
+
+	// Whether world matrices are out of date
+	bool dirty() const { return mFirstDirty < size(); }
+
+	// Compose the local matrices of the nodes changed since the last update, and propagate
+	// them down the hierarchy
+	void update();
+
+	// As of the last update
+	const glm::mat4& world(uint32_t node) const { return mWorld[node]; }
+	const std::vector<glm::mat4>& worldMatrices() const { return mWorld; }
+
+private:
+	void markDirty(uint32_t node);
+	// Local matrices T * R * S of the dirty nodes among [begin, end)
+	void composeLocal(size_t begin, size_t end);
+
+private:
+	std::vector<float> mPositionX, mPositionY, mPositionZ;
+	// Unit quaternions
+	std::vector<float> mRotationX, mRotationY, mRotationZ, mRotationW;
+	std::vector<float> mScaleX, mScaleY, mScaleZ;
+	std::vector<uint32_t> mParents;
+
+	// Local changes since the last update, and nodes whose world matrix changes with them
+	std::vector<uint8_t> mLocalDirty;
+	std::vector<uint8_t> mWorldDirty;
+	size_t mFirstDirty = 0;
+
+	std::vector<glm::mat4> mLocal;
+	std::vector<glm::mat4> mWorld;
+};
@@ -0,0 +1,260 @@
+#include "TxtGeometryParser.h"
+#include "ParallelFor.h"
+#include "TextScanner.h"
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+
+// Chunks smaller than this are not worth a thread
+static constexpr size_t minChunkSize = 1 << 20;
+
+namespace {
+
+enum class Section { None, Points, Indices };
+
+/**
+ * A line-aligned range of the text, within a single section. The counting pass
+ * fills `rowCount`, then a prefix sum gives the first row of the chunk in the
+ * output array of its section.
+ */
+struct Chunk {
+	const char* begin;
+	const char* end;
+	Section section;
+	size_t rowCount = 0;
+	size_t firstRow = 0;
+};
+
+/**
+ * Where the columns of a point go, for each supported column count
+ */
+struct PointLayout {
+	uint32_t columnCount;
+	uint32_t positionCount; // 2 or 3
+	int normal; // first column, or -1 for +Z
+	int color;
+	int uv; // first column, or -1 for (0, 0)
+};
+
+constexpr std::array<PointLayout, 4> pointLayouts = { {
+	{ 5, 2, -1, 2, -1 },
+	{ 6, 3, -1, 3, -1 },
+	{ 9, 3, 3, 6, -1 },
+	{ 11, 3, 3, 6, 9 },
+} };
+
+struct Cursor {
+	const char* p;
+	const char* end;
+
+	bool atLineEnd() const { return p >= end || *p == '\n' || *p == '\r' || *p == '#'; }
+
+	void skipSpaces() {
+		while (p < end && (*p == ' ' || *p == '\t')) ++p;
+	}
+
+	void skipLine() {
+		p = text::findLineEnd(p, end);
+		if (p < end) ++p;
+	}
+
+	// Skip blank and comment lines, return false at the end of the range
+	bool nextRow() {
+		for (;;) {
+			skipSpaces();
+			if (!atLineEnd()) return true;
+			if (p >= end) return false;
+			skipLine();
+		}
+	}
+
+	// Whether only spaces and a comment remain on the line
+	bool rowEnds() {
+		skipSpaces();
+		return atLineEnd();
+	}
+
+	bool readFloat(float& value) {
+		skipSpaces();
+		const char* next = text::parseFloat(p, end, value);
+		if (!next) return false;
+		p = next;
+		return true;
+	}
+
+	bool readIndex(uint32_t& value) {
+		skipSpaces();
+		auto [next, ec] = std::from_chars(p, end, value);
+		if (ec != std::errc()) return false;
+		p = next;
+		return true;
+	}
+};
+
+// Name of the section whose header is the line starting at `line`, if it is one
+bool readSectionHeader(const char* line, const char* end, Section& section) {
+	Cursor c{ line, end };
+	c.skipSpaces();
+	if (c.p >= end || *c.p != '[') return false;
+	const char* nameBegin = ++c.p;
+	while (c.p < end && *c.p != ']' && *c.p != '\n') ++c.p;
+	if (c.p >= end || *c.p != ']') return false;
+	std::string_view name(nameBegin, static_cast<size_t>(c.p - nameBegin));
+	if (name == "points") section = Section::Points;
+	else if (name == "indices") section = Section::Indices;
+	else {
+		std::cerr << "Unknown section [" << name << "] in geometry file" << std::endl;
+		section = Section::None;
+	}
+	return true;
+}
+
+// Cut [begin, end) into line-aligned chunks of about `chunkSize` bytes
+void splitSection(const char* begin, const char* end, Section section, size_t chunkSize, std::vector<Chunk>& chunks) {
+	while (begin < end) {
+		const char* p = end - begin > static_cast<ptrdiff_t>(chunkSize) ? begin + chunkSize : end;
+		Cursor c{ p, end };
+		if (p < end && p[-1] != '\n') c.skipLine();
+		chunks.push_back({ begin, c.p, section });
+		begin = c.p;
+	}
+}
+
+size_t countRows(const Chunk& chunk) {
+	size_t rowCount = 0;
+	for (Cursor c{ chunk.begin, chunk.end }; c.nextRow(); c.skipLine()) {
+		++rowCount;
+	}
+	return rowCount;
+}
+
+uint32_t countColumns(const char* row, const char* end) {
+	const char* lineEnd;
+	return text::countFields(row, end, lineEnd);
+}
+
+bool parsePoints(const Chunk& chunk, const PointLayout& layout, ResourceManager::VertexAttributes* vertices) {
+	std::array<float, 11> v;
+	ResourceManager::VertexAttributes* vertex = vertices + chunk.firstRow;
+	for (Cursor c{ chunk.begin, chunk.end }; c.nextRow(); c.skipLine(), ++vertex) {
+		for (uint32_t i = 0; i < layout.columnCount; ++i) {
+			if (!c.readFloat(v[i])) return false;
+		}
+		if (!c.rowEnds()) return false;
+
+		vertex->position = { v[0], v[1], layout.positionCount == 3 ? v[2] : 0.0f };
+		vertex->normal = layout.normal >= 0 ? glm::vec3(v[layout.normal], v[layout.normal + 1], v[layout.normal + 2]) : glm::vec3(0.0f, 0.0f, 1.0f);
+		vertex->color = { v[layout.color], v[layout.color + 1], v[layout.color + 2] };
+		vertex->uv = layout.uv >= 0 ? glm::vec2(v[layout.uv], v[layout.uv + 1]) : glm::vec2(0.0f);
+	}
+	return true;
+}
+
+bool parseIndices(const Chunk& chunk, size_t vertexCount, uint32_t* indices) {
+	uint32_t* triangle = indices + 3 * chunk.firstRow;
+	for (Cursor c{ chunk.begin, chunk.end }; c.nextRow(); c.skipLine(), triangle += 3) {
+		if (!c.readIndex(triangle[0]) || !c.readIndex(triangle[1]) || !c.readIndex(triangle[2]) || !c.rowEnds()) return false;
+		if (triangle[0] >= vertexCount || triangle[1] >= vertexCount || triangle[2] >= vertexCount) return false;
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+bool parseTxtGeometry(const std::byte* data, size_t size, std::vector<ResourceManager::VertexAttributes>& vertices, std::vector<uint32_t>& indices) {
+	const char* text = reinterpret_cast<const char*>(data);
+	const char* textEnd = text + size;
+
+	// Section headers are the only lines starting with '[', so look for those, then cut
+	// each section into chunks so that a chunk never spans two of them
+	size_t chunkSize = std::max(minChunkSize, size / workerThreadCount() + 1);
+	std::vector<Chunk> chunks;
+	Section section = Section::None;
+	const char* sectionBegin = text;
+	for (const char* p = text; p < textEnd;) {
+		const void* bracket = memchr(p, '[', static_cast<size_t>(textEnd - p));
+		if (!bracket) break;
+		const char* line = static_cast<const char*>(bracket);
+		while (line > text && (line[-1] == ' ' || line[-1] == '\t')) --line;
+		p = static_cast<const char*>(bracket) + 1;
+		if (line > text && line[-1] != '\n') continue;
+
+		Section nextSection;
+		if (!readSectionHeader(line, textEnd, nextSection)) continue;
+		splitSection(sectionBegin, line, section, chunkSize, chunks);
+		Cursor c{ line, textEnd };
+		c.skipLine();
+		section = nextSection;
+		sectionBegin = p = c.p;
+	}
+	splitSection(sectionBegin, textEnd, section, chunkSize, chunks);
+
+	// Counting pass
+	parallelForRanges(chunks.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			chunks[i].rowCount = countRows(chunks[i]);
+		}
+	}, 1);
+
+	// Exclusive prefix sum of each section, and the column count from the first point
+	size_t pointCount = 0;
+	size_t triangleCount = 0;
+	const PointLayout* layout = nullptr;
+	for (Chunk& chunk : chunks) {
+		if (chunk.rowCount == 0) continue;
+		switch (chunk.section) {
+		case Section::None:
+			std::cerr << "Geometry data outside of a [points] or [indices] section" << std::endl;
+			return false;
+		case Section::Points:
+			if (!layout) {
+				Cursor c{ chunk.begin, chunk.end };
+				c.nextRow();
+				uint32_t columnCount = countColumns(c.p, chunk.end);
+				for (const PointLayout& candidate : pointLayouts) {
+					if (candidate.columnCount == columnCount) layout = &candidate;
+				}
+				if (!layout) {
+					std::cerr << "Unsupported number of columns for points: " << columnCount << std::endl;
+					return false;
+				}
+			}
+			chunk.firstRow = pointCount;
+			pointCount += chunk.rowCount;
+			break;
+		case Section::Indices:
+			chunk.firstRow = triangleCount;
+			triangleCount += chunk.rowCount;
+			break;
+		}
+	}
+	if (pointCount > UINT32_MAX || triangleCount == 0) {
+		std::cerr << "Geometry file has " << pointCount << " points and " << triangleCount << " triangles" << std::endl;
+		return false;
+	}
+
+	vertices.resize(pointCount);
+	indices.resize(3 * triangleCount);
+
+	// Parsing pass
+	std::vector<char> chunkSuccess(chunks.size(), 0);
+	parallelForRanges(chunks.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const Chunk& chunk = chunks[i];
+			if (chunk.rowCount == 0) chunkSuccess[i] = true;
+			else if (chunk.section == Section::Points) chunkSuccess[i] = parsePoints(chunk, *layout, vertices.data());
+			else chunkSuccess[i] = parseIndices(chunk, pointCount, indices.data());
+		}
+	}, 1);
+
+	for (size_t i = 0; i < chunks.size(); ++i) {
+		if (!chunkSuccess[i]) {
+			std::cerr << "Malformed or out of range row in chunk " << i << " of " << chunks.size() << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
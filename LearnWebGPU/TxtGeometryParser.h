@@ -0,0 +1,27 @@
+#pragma once
+
+#include "ResourceManager.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A multi-threaded parser for the simple text geometry format of pyramid.txt:
+ * a `[points]` section with one vertex per line, then an `[indices]` section
+ * with one triangle (three zero-based indices) per line. Anything after a `#`
+ * is a comment and blank lines are ignored.
+ *
+ * The layout of a point is given by its number of columns, which must be the
+ * same for all of them:
+ *   5: x y r g b
+ *   6: x y z r g b
+ *   9: x y z nx ny nz r g b
+ *  11: x y z nx ny nz r g b u v
+ * Missing coordinates are 0 and missing normals are +Z. Unlike OBJ, positions
+ * are used as is, the demo files being already Z-up.
+ *
+ * Like parseObjParallel, the text is split into line-aligned chunks that are
+ * counted then parsed in parallel straight into the output arrays.
+ */
+bool parseTxtGeometry(const std::byte* data, size_t size, std::vector<ResourceManager::VertexAttributes>& vertices, std::vector<uint32_t>& indices);
@@ -0,0 +1,83 @@
+#include "UniformRing.h"
+#include "FrameCounters.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace wgpu;
+
+UniformRing::UniformRing(Device device, uint64_t sliceSize, uint32_t slicesPerFrame, uint32_t frameCount)
+	: mSliceSize(sliceSize)
+	, mSlicesPerFrame(std::max(slicesPerFrame, 1u))
+	, mFrameCount(std::max(frameCount, 1u))
+{
+	SupportedLimits supportedLimits;
+	device.getLimits(&supportedLimits);
+	uint64_t alignment = std::max<uint64_t>(supportedLimits.limits.minUniformBufferOffsetAlignment, 4);
+	mSliceStride = (sliceSize + alignment - 1) / alignment * alignment;
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Uniform ring";
+	bufferDesc.size = mSliceStride * mSlicesPerFrame * mFrameCount;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "UniformRing");
+
+	// No region has been written yet
+	mSliceData.resize(mSliceStride * mSlicesPerFrame);
+	mDirtyRanges.assign(mFrameCount, { 0, mSliceData.size() });
+	// The first flush moves on to the first region
+	mFrameIndex = mFrameCount - 1;
+}
+
+UniformRing::~UniformRing() {
+	if (mBuffer) {
+		destroyTracked(mBuffer);
+		mBuffer.release();
+	}
+}
+
+void UniformRing::write(uint32_t slice, uint64_t offset, const void* data, size_t size) {
+	assert(slice < mSlicesPerFrame && offset + size <= mSliceSize);
+	if (size == 0) return;
+	uint64_t begin = slice * mSliceStride + offset;
+	memcpy(mSliceData.data() + begin, data, size);
+
+	// Adjacent and overlapping ranges merge, so do distant ones: uploading the clean
+	// bytes in between costs less than another writeBuffer
+	for (DirtyRange& range : mDirtyRanges) {
+		if (range.begin >= range.end) {
+			range = { begin, begin + size };
+		}
+		else {
+			range.begin = std::min(range.begin, begin);
+			range.end = std::max(range.end, begin + size);
+		}
+	}
+	mChanged = true;
+}
+
+uint32_t UniformRing::offset(uint32_t slice) const {
+	return static_cast<uint32_t>((uint64_t(mFrameIndex) * mSlicesPerFrame + slice) * mSliceStride);
+}
+
+void UniformRing::flush(Queue queue) {
+	// The current region is up to date, and may keep being read
+	if (!mChanged) return;
+	mChanged = false;
+
+	// The GPU may still read the regions of previous frames, but not that one
+	mFrameIndex = (mFrameIndex + 1) % mFrameCount;
+	DirtyRange& range = mDirtyRanges[mFrameIndex];
+	if (range.begin >= range.end) return;
+
+	// writeBuffer requires offsets and sizes that are multiples of 4
+	uint64_t begin = range.begin / 4 * 4;
+	uint64_t end = std::min<uint64_t>((range.end + 3) / 4 * 4, mSliceData.size());
+	queue.writeBuffer(mBuffer, offset(0) + begin, mSliceData.data() + begin, end - begin);
+	mUploadedBytes += end - begin;
+	FrameCounters::add(FrameCounter::BytesWritten, end - begin);
+	range = {};
+}
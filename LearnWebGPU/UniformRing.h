@@ -0,0 +1,75 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A uniform buffer split in one region per frame in flight, each region holding
+ * one slice per object drawn in the frame. Slices are bound with a dynamic offset,
+ * so that a single bind group serves all objects and frames, and the slices a
+ * frame writes never are those the GPU may still be reading for previous frames.
+ *
+ * Writes go to a CPU copy of the slices, and only the byte ranges they touch are
+ * uploaded. flush() moves on to the next region when something changed, and
+ * uploads to it what changed since that region was last written, merged in a
+ * single writeBuffer. When nothing changed, the GPU keeps reading the current
+ * region and nothing is uploaded.
+ *
+ * The bind group layout entry must have `hasDynamicOffset` set and a binding size
+ * of `sliceSize`, rather than the whole buffer.
+ */
+class UniformRing {
+public:
+	// Room for `slicesPerFrame` slices of `sliceSize` bytes in each of `frameCount` frames
+	UniformRing(wgpu::Device device, uint64_t sliceSize, uint32_t slicesPerFrame, uint32_t frameCount = 3);
+	~UniformRing();
+
+	UniformRing(const UniformRing&) = delete;
+	UniformRing& operator=(const UniformRing&) = delete;
+
+	wgpu::Buffer buffer() const { return mBuffer; }
+	uint64_t sliceSize() const { return mSliceSize; }
+	uint32_t frameCount() const { return mFrameCount; }
+
+	// Region read by commands encoded after the last flush, in [0, frameCount)
+	uint32_t frameIndex() const { return mFrameIndex; }
+
+	// Copy `size` bytes at byte `offset` of slice `slice`, uploaded by the next flush
+	void write(uint32_t slice, uint64_t offset, const void* data, size_t size);
+
+	// Dynamic offset of slice `slice` in the current region
+	uint32_t offset(uint32_t slice) const;
+
+	// Upload the writes made since the last call to the next region and make it current,
+	// or do nothing if there was none
+	void flush(wgpu::Queue queue);
+
+	// Bytes uploaded by flush() since creation, for upload statistics
+	uint64_t uploadedBytes() const { return mUploadedBytes; }
+
+private:
+	wgpu::Buffer mBuffer = nullptr;
+	uint64_t mSliceSize;
+	// Slice size rounded up to the device's minUniformBufferOffsetAlignment
+	uint64_t mSliceStride;
+	uint32_t mSlicesPerFrame;
+	uint32_t mFrameCount;
+	uint32_t mFrameIndex = 0;
+	// Latest contents of the slices, which every region eventually receives
+	std::vector<std::byte> mSliceData;
+	uint64_t mUploadedBytes = 0;
+
+	/**
+	 * Bytes of mSliceData a region is missing, empty when begin >= end
+	 */
+	struct DirtyRange {
+		uint64_t begin = 0;
+		uint64_t end = 0;
+	};
+	std::vector<DirtyRange> mDirtyRanges;
+	// Whether writes were made since the last flush
+	bool mChanged = true;
+};
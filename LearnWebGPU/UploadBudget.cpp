@@ -0,0 +1,27 @@
+#include "UploadBudget.h"
+
+#include <algorithm>
+
+UploadBudget::UploadBudget(const Settings& settings)
+	: mSettings(settings)
+	, mBytes(std::clamp(settings.initialBytes, settings.minBytes, settings.maxBytes))
+{}
+
+void UploadBudget::update(double gpuFrameMs) {
+	if (mCooldown > 0) {
+		--mCooldown;
+		return;
+	}
+	if (gpuFrameMs <= 0.0) return;
+
+	if (gpuFrameMs > mSettings.targetFrameMs) {
+		// More than proportionally, the rest of the frame taking its share of the time too
+		double ratio = mSettings.targetFrameMs / gpuFrameMs;
+		mBytes = static_cast<uint64_t>(static_cast<double>(mBytes) * ratio * ratio);
+		mCooldown = mSettings.cooldownFrameCount;
+	}
+	else if (gpuFrameMs < mSettings.headroom * mSettings.targetFrameMs) {
+		mBytes += mSettings.growthStep;
+	}
+	mBytes = std::clamp(mBytes, mSettings.minBytes, mSettings.maxBytes);
+}
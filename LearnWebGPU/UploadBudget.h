@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Feedback controller picking how many bytes of streamed resources to upload per
+ * frame, so that streaming does not push the GPU time of frames over a budget.
+ *
+ * Uploads are copies competing with the frame's passes for the GPU, and staging
+ * writes taking CPU time from it, so the budget is cut in proportion to how much a
+ * frame goes over budget, and only grows again by steps while frames stay well
+ * below it. Like DynamicResolution, which reacts to the same timings, the frames
+ * measured right after a change are ignored, the timings arriving late.
+ */
+class UploadBudget {
+public:
+	struct Settings {
+		// GPU time budget of a frame
+		double targetFrameMs = 15.0;
+		// Range of the bytes uploaded per frame, the minimum keeping streams progressing
+		uint64_t minBytes = 1 << 20;
+		uint64_t maxBytes = 64 << 20;
+		// Initial bytes per frame, before any timing
+		uint64_t initialBytes = 16 << 20;
+		// Fraction of the budget under which uploads grow again
+		double headroom = 0.8;
+		// Growth per measured frame with enough headroom
+		uint64_t growthStep = 2 << 20;
+		// Measured frames ignored after a cut, at least the latency of the timings
+		uint32_t cooldownFrameCount = 4;
+	};
+
+	explicit UploadBudget(const Settings& settings);
+
+	// Account for the GPU time of a newly measured frame during which resources were streamed
+	void update(double gpuFrameMs);
+
+	uint64_t bytes() const { return mBytes; }
+	const Settings& settings() const { return mSettings; }
+
+private:
+	Settings mSettings;
+	uint64_t mBytes;
+	uint32_t mCooldown = 0;
+};
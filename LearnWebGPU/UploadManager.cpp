@@ -0,0 +1,227 @@
+#include "UploadManager.h"
+#include "DeviceEvents.h"
+#include "FrameCounters.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+// Alignment required by copyBufferToTexture for bytesPerRow
+constexpr uint64_t textureRowAlignment = 256;
+// Alignment required by copyBufferToBuffer for offsets and sizes
+constexpr uint64_t bufferCopyAlignment = 4;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+} // anonymous namespace
+
+UploadManager::UploadManager(Device device, uint64_t stagingBufferSize, uint32_t maxStagingBufferCount)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+	, mStagingBufferSize(alignUp(std::max(stagingBufferSize, textureRowAlignment), textureRowAlignment))
+	, mMaxStagingBufferCount(std::max(maxStagingBufferCount, 1u))
+{}
+
+UploadManager::~UploadManager() {
+	flush();
+
+	// Map callbacks point to the staging buffers, which must thus outlive them
+	auto inFlight = [](const std::unique_ptr<StagingBuffer>& staging) {
+		return staging->state == StagingBuffer::State::InFlight;
+	};
+	while (std::any_of(mStagingBuffers.begin(), mStagingBuffers.end(), inFlight)) {
+		waitForStagingBuffer();
+	}
+
+	for (const std::unique_ptr<StagingBuffer>& staging : mStagingBuffers) {
+		if (staging->state == StagingBuffer::State::Mapped) staging->buffer.unmap();
+		destroyTracked(staging->buffer);
+		staging->buffer.release();
+	}
+	mQueue.release();
+}
+
+void UploadManager::writeBuffer(Buffer buffer, uint64_t offset, const void* data, uint64_t size) {
+	mUploadedBytes += size;
+	FrameCounters::add(FrameCounter::BytesWritten, size);
+	const std::byte* source = static_cast<const std::byte*>(data);
+	while (size > 0) {
+		uint64_t chunkSize = std::min(size, mStagingBufferSize);
+		Region region = allocate(chunkSize, bufferCopyAlignment);
+		memcpy(region.data, source, chunkSize);
+		encoder().copyBufferToBuffer(region.buffer, region.offset, buffer, offset, chunkSize);
+
+		source += chunkSize;
+		offset += chunkSize;
+		size -= chunkSize;
+	}
+}
+
+void UploadManager::writeBuffer(Buffer buffer, uint64_t offset, uint64_t elementCount, uint64_t elementSize, const FillFunction& fill) {
+	mUploadedBytes += elementCount * elementSize;
+	FrameCounters::add(FrameCounter::BytesWritten, elementCount * elementSize);
+	uint64_t maxChunkCount = std::max<uint64_t>(mStagingBufferSize / elementSize, 1);
+	for (uint64_t first = 0; first < elementCount;) {
+		uint64_t chunkCount = std::min(elementCount - first, maxChunkCount);
+		uint64_t chunkSize = chunkCount * elementSize;
+		Region region = allocate(chunkSize, bufferCopyAlignment);
+		fill(region.data, first, chunkCount);
+		encoder().copyBufferToBuffer(region.buffer, region.offset, buffer, offset, chunkSize);
+
+		first += chunkCount;
+		offset += chunkSize;
+	}
+}
+
+void UploadManager::writeTexture(const ImageCopyTexture& destination, const void* data, uint32_t bytesPerRow, uint32_t rowCount, const Extent3D& writeSize) {
+	if (rowCount == 0) return;
+	mUploadedBytes += uint64_t(bytesPerRow) * rowCount;
+	FrameCounters::add(FrameCounter::BytesWritten, uint64_t(bytesPerRow) * rowCount);
+
+	// Staging rows are padded to the alignment copies require
+	uint64_t stagingBytesPerRow = alignUp(bytesPerRow, textureRowAlignment);
+	if (stagingBytesPerRow > mStagingBufferSize) {
+		// A single row does not fit, which only happens with tiny staging buffers
+		TextureDataLayout source{};
+		source.offset = 0;
+		source.bytesPerRow = bytesPerRow;
+		source.rowsPerImage = rowCount;
+		flush();
+		mQueue.writeTexture(destination, data, uint64_t(bytesPerRow) * rowCount, source, writeSize);
+		return;
+	}
+
+	// Texel height of a row, which is the block height of compressed formats
+	uint32_t rowHeight = writeSize.height / rowCount;
+	uint32_t maxRowsPerCopy = static_cast<uint32_t>(mStagingBufferSize / stagingBytesPerRow);
+
+	const std::byte* source = static_cast<const std::byte*>(data);
+	for (uint32_t row = 0; row < rowCount;) {
+		uint32_t copyRowCount = std::min(rowCount - row, maxRowsPerCopy);
+		Region region = allocate(stagingBytesPerRow * copyRowCount, textureRowAlignment);
+		if (stagingBytesPerRow == bytesPerRow) {
+			memcpy(region.data, source, uint64_t(bytesPerRow) * copyRowCount);
+		}
+		else {
+			for (uint32_t i = 0; i < copyRowCount; ++i) {
+				memcpy(region.data + i * stagingBytesPerRow, source + uint64_t(i) * bytesPerRow, bytesPerRow);
+			}
+		}
+
+		ImageCopyBuffer copySource{};
+		copySource.buffer = region.buffer;
+		copySource.layout.offset = region.offset;
+		copySource.layout.bytesPerRow = static_cast<uint32_t>(stagingBytesPerRow);
+		copySource.layout.rowsPerImage = copyRowCount;
+		ImageCopyTexture copyDestination = destination;
+		copyDestination.origin.y += row * rowHeight;
+		Extent3D copySize = { writeSize.width, copyRowCount * rowHeight, 1 };
+		encoder().copyBufferToTexture(copySource, copyDestination, copySize);
+
+		source += uint64_t(bytesPerRow) * copyRowCount;
+		row += copyRowCount;
+	}
+}
+
+void UploadManager::flush() {
+	if (!mEncoder) return;
+
+	// Copies read staging buffers, which must not be mapped anymore when they are submitted
+	for (StagingBuffer* staging : mWritten) {
+		staging->buffer.unmap();
+		staging->state = StagingBuffer::State::InFlight;
+	}
+
+	CommandBufferDescriptor cmdBufferDescriptor{};
+	cmdBufferDescriptor.label = "Uploads";
+	CommandBuffer command = mEncoder.finish(cmdBufferDescriptor);
+	mEncoder.release();
+	mEncoder = nullptr;
+	mQueue.submit(command);
+	command.release();
+
+	// Written staging buffers become available again once the GPU is done copying from them
+	for (StagingBuffer* staging : mWritten) {
+		staging->cursor = 0;
+		staging->mapCallback = staging->buffer.mapAsync(MapMode::Write, 0, mStagingBufferSize, DeviceEvents::deferred([staging](BufferMapAsyncStatus status) {
+			staging->state = status == BufferMapAsyncStatus::Success ? StagingBuffer::State::Mapped : StagingBuffer::State::Lost;
+		}));
+	}
+	mWritten.clear();
+	DeviceEvents::notify();
+	mCurrent = nullptr;
+}
+
+UploadManager::Region UploadManager::allocate(uint64_t size, uint64_t alignment) {
+	StagingBuffer* staging = acquire(size, alignment);
+	if (std::find(mWritten.begin(), mWritten.end(), staging) == mWritten.end()) {
+		mWritten.push_back(staging);
+	}
+	mCurrent = staging;
+
+	Region region;
+	region.buffer = staging->buffer;
+	region.offset = alignUp(staging->cursor, alignment);
+	region.data = static_cast<std::byte*>(staging->buffer.getMappedRange(0, mStagingBufferSize)) + region.offset;
+	staging->cursor = region.offset + size;
+	return region;
+}
+
+UploadManager::StagingBuffer* UploadManager::acquire(uint64_t size, uint64_t alignment) {
+	auto fits = [&](const StagingBuffer* staging) {
+		return staging->state == StagingBuffer::State::Mapped && alignUp(staging->cursor, alignment) + size <= mStagingBufferSize;
+	};
+	if (mCurrent && fits(mCurrent)) return mCurrent;
+
+	for (;;) {
+		// Drop staging buffers that cannot be mapped anymore
+		std::erase_if(mStagingBuffers, [](const std::unique_ptr<StagingBuffer>& staging) {
+			if (staging->state != StagingBuffer::State::Lost) return false;
+			destroyTracked(staging->buffer);
+			staging->buffer.release();
+			return true;
+		});
+
+		// Reuse a staging buffer that is mapped and not written by pending copies,
+		// the one being written being full
+		for (const std::unique_ptr<StagingBuffer>& staging : mStagingBuffers) {
+			if (staging->state == StagingBuffer::State::Mapped && staging->cursor == 0) return staging.get();
+		}
+
+		if (mStagingBuffers.size() < mMaxStagingBufferCount) {
+			BufferDescriptor bufferDesc{};
+			bufferDesc.label = "Staging buffer";
+			bufferDesc.size = mStagingBufferSize;
+			bufferDesc.usage = BufferUsage::MapWrite | BufferUsage::CopySrc;
+			bufferDesc.mappedAtCreation = true;
+			auto staging = std::make_unique<StagingBuffer>();
+			staging->buffer = createTrackedBuffer(mDevice, bufferDesc, GpuMemoryCategory::Staging, "UploadManager");
+			mStagingBuffers.push_back(std::move(staging));
+			return mStagingBuffers.back().get();
+		}
+
+		// All staging buffers are used: submit those written so far and wait for one
+		flush();
+		waitForStagingBuffer();
+	}
+}
+
+void UploadManager::waitForStagingBuffer() {
+	DeviceEvents::wait(mDevice);
+}
+
+CommandEncoder UploadManager::encoder() {
+	if (!mEncoder) {
+		CommandEncoderDescriptor encoderDesc{};
+		encoderDesc.label = "Upload command encoder";
+		mEncoder = mDevice.createCommandEncoder(encoderDesc);
+	}
+	return mEncoder;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Upload data to buffers and textures through a ring of staging buffers that are
+ * reused from one upload to the next, instead of handing every write to the queue
+ * (which copies it to a staging area of its own, allocated per write).
+ *
+ * Writes are copied to a mapped (MapWrite | CopySrc) staging buffer and recorded
+ * as copyBufferToBuffer/copyBufferToTexture commands, which flush() submits in a
+ * single command buffer. Staging buffers are then mapped again asynchronously and
+ * reused once the GPU is done with them. At most `maxStagingBufferCount` of them
+ * exist, so a large load that outpaces the GPU waits for one to be available
+ * rather than growing memory: large writes are split in as many copies as needed.
+ *
+ * Like the rest of the device, it must only be used from the device thread.
+ * Writes are only visible to commands submitted after the next flush().
+ */
+class UploadManager {
+public:
+	explicit UploadManager(wgpu::Device device, uint64_t stagingBufferSize = 4 << 20, uint32_t maxStagingBufferCount = 8);
+
+	// Flush pending writes and wait for staging buffers still in use before releasing them
+	~UploadManager();
+
+	UploadManager(const UploadManager&) = delete;
+	UploadManager& operator=(const UploadManager&) = delete;
+
+	wgpu::Device device() const { return mDevice; }
+
+	// Copy `size` bytes to `buffer` at `offset`. Both must be multiples of 4 bytes,
+	// like for Queue::writeBuffer, and the buffer must have the CopyDst usage.
+	void writeBuffer(wgpu::Buffer buffer, uint64_t offset, const void* data, uint64_t size);
+
+	// Called with consecutive ranges [first, first + count) of the elements to write,
+	// to produce them straight into `destination`
+	using FillFunction = std::function<void(std::byte* destination, uint64_t first, uint64_t count)>;
+
+	// Same as above, with the data of `elementCount` elements of `elementSize` bytes (a multiple
+	// of 4) produced by `fill` directly in staging memory rather than copied from an array, e.g.
+	// to encode vertices without an intermediate copy of the whole mesh
+	void writeBuffer(wgpu::Buffer buffer, uint64_t offset, uint64_t elementCount, uint64_t elementSize, const FillFunction& fill);
+
+	// Copy `rowCount` rows of `bytesPerRow` bytes each (rows of texels, or of blocks for
+	// compressed formats) to the region of `destination` of size `writeSize`
+	void writeTexture(const wgpu::ImageCopyTexture& destination, const void* data, uint32_t bytesPerRow, uint32_t rowCount, const wgpu::Extent3D& writeSize);
+
+	// Submit the copies recorded since the last flush
+	void flush();
+
+	// Bytes written since creation, for upload statistics
+	uint64_t uploadedBytes() const { return mUploadedBytes; }
+	// Bytes of the staging buffers currently allocated
+	uint64_t stagingMemorySize() const { return mStagingBuffers.size() * mStagingBufferSize; }
+
+private:
+	/**
+	 * A staging buffer, mapped when it is not in use by submitted copies
+	 */
+	struct StagingBuffer {
+		enum class State {
+			// Mapped, and may be written from `cursor` on
+			Mapped,
+			// Unmapped for submitted copies, waiting for mapAsync
+			InFlight,
+			// Mapping failed (e.g., the device was lost), to be released
+			Lost,
+		};
+		wgpu::Buffer buffer = nullptr;
+		State state = State::Mapped;
+		uint64_t cursor = 0;
+		std::unique_ptr<wgpu::BufferMapCallback> mapCallback;
+	};
+
+	/**
+	 * Mapped memory in a staging buffer, to copy data to
+	 */
+	struct Region {
+		wgpu::Buffer buffer;
+		uint64_t offset;
+		std::byte* data;
+	};
+
+	// Reserve `size` bytes (at most mStagingBufferSize) aligned on `alignment`,
+	// flushing and waiting for a staging buffer if needed
+	Region allocate(uint64_t size, uint64_t alignment);
+
+	// Return a mapped staging buffer with at least `size` bytes free after aligning its cursor
+	StagingBuffer* acquire(uint64_t size, uint64_t alignment);
+
+	// Process device events until a staging buffer in flight is mapped again
+	void waitForStagingBuffer();
+
+	wgpu::CommandEncoder encoder();
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	uint64_t mStagingBufferSize;
+	uint32_t mMaxStagingBufferCount;
+	std::vector<std::unique_ptr<StagingBuffer>> mStagingBuffers;
+	// Staging buffer being written, null when it must be picked again
+	StagingBuffer* mCurrent = nullptr;
+	// Staging buffers written since the last flush, to unmap before submitting
+	std::vector<StagingBuffer*> mWritten;
+	// Commands recorded since the last flush, null if there is none
+	wgpu::CommandEncoder mEncoder = nullptr;
+	uint64_t mUploadedBytes = 0;
+};
@@ -0,0 +1,248 @@
+#include "VertexAnimation.h"
+#include "GpuMemory.h"
+#include "GpuHandle.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+const char* packShaderSource = R"(
+struct VertexAnimationUniforms {
+	frameCount: u32,
+	frameRate: f32,
+	width: u32,
+	rowsPerFrame: u32,
+};
+
+// The skinned VertexAttributes of GpuSkinning, 11 packed floats
+const vertexStride = 11u;
+
+@group(0) @binding(0) var<uniform> uVertexAnimation: VertexAnimationUniforms;
+@group(0) @binding(1) var<storage, read> skinnedVertices: array<f32>;
+@group(0) @binding(2) var positions: texture_storage_2d<rgba32float, write>;
+@group(0) @binding(3) var normals: texture_storage_2d<rgba16float, write>;
+
+// One invocation per vertex of a frame, frames along y
+@compute @workgroup_size(64)
+fn pack(@builtin(global_invocation_id) id: vec3u) {
+	let vertexCount = arrayLength(&skinnedVertices) / (vertexStride * uVertexAnimation.frameCount);
+	let vertexIndex = id.x;
+	let frame = id.y;
+	if (vertexIndex >= vertexCount || frame >= uVertexAnimation.frameCount) {
+		return;
+	}
+	let src = (frame * vertexCount + vertexIndex) * vertexStride;
+	let position = vec3f(skinnedVertices[src], skinnedVertices[src + 1u], skinnedVertices[src + 2u]);
+	let normal = vec3f(skinnedVertices[src + 3u], skinnedVertices[src + 4u], skinnedVertices[src + 5u]);
+	let texel = vec2u(
+		vertexIndex % uVertexAnimation.width,
+		frame * uVertexAnimation.rowsPerFrame + vertexIndex / uVertexAnimation.width
+	);
+	textureStore(positions, texel, vec4f(position, 1.0));
+	textureStore(normals, texel, vec4f(normal, 0.0));
+}
+)";
+
+} // anonymous namespace
+
+VertexAnimationTexture::VertexAnimationTexture(
+	Device device,
+	PipelineCache& pipelineCache,
+	std::span<const ResourceManager::VertexAttributes> vertices,
+	std::span<const GpuSkinning::SkinVertex> skin,
+	const Skeleton& skeleton,
+	const AnimationClip& clip,
+	std::span<const GpuSkinning::MorphDelta> morphDeltas,
+	uint32_t morphTargetCount,
+	std::span<const float> morphWeights,
+	uint32_t frameCount,
+	float frameRate
+)
+	: mDevice(device)
+	, mVertexCount(static_cast<uint32_t>(vertices.size()))
+{
+	if (mVertexCount == 0 || frameCount == 0 || !(frameRate > 0.0f) || skeleton.jointCount() == 0
+		|| (!morphWeights.empty() && morphWeights.size() != size_t(frameCount) * morphTargetCount)) {
+		std::cerr << "Invalid vertex animation: " << frameCount << " frames at " << frameRate << " per second of "
+			<< vertices.size() << " vertices, " << skeleton.jointCount() << " joints and " << morphWeights.size()
+			<< " morph weights" << std::endl;
+		return;
+	}
+
+	// Frames of the whole mesh, skinned all at once, then one row of texels per MaxWidth vertices
+	SupportedLimits supportedLimits;
+	device.getLimits(&supportedLimits);
+	uint64_t maxBytes = std::min(supportedLimits.limits.maxStorageBufferBindingSize, supportedLimits.limits.maxBufferSize);
+	uint32_t width = std::min(mVertexCount, MaxWidth);
+	uint32_t rowsPerFrame = (mVertexCount + width - 1) / width;
+	if (uint64_t(frameCount) * vertices.size_bytes() > maxBytes
+		|| uint64_t(frameCount) * rowsPerFrame > supportedLimits.limits.maxTextureDimension2D) {
+		std::cerr << "Could not bake " << frameCount << " frames of " << mVertexCount
+			<< " vertices, the animation is too large for the buffers and textures of the device" << std::endl;
+		return;
+	}
+	mUniforms = { frameCount, frameRate, width, rowsPerFrame };
+
+	mSkinning = std::make_unique<GpuSkinning>(device, pipelineCache, vertices, skin, skeleton.jointCount(), morphDeltas, morphTargetCount, frameCount);
+	if (!mSkinning->valid()) {
+		mSkinning.reset();
+		return;
+	}
+
+	// Pose of each frame, sampled in the same looping time the vertex shader reads it in
+	mJointMatrices.resize(size_t(frameCount) * skeleton.jointCount());
+	Skeleton::Pose pose = skeleton.restPose();
+	for (uint32_t frame = 0; frame < frameCount; ++frame) {
+		clip.sample(frame / frameRate, pose);
+		skeleton.computeJointMatrices(pose, mJointMatrices.data() + size_t(frame) * skeleton.jointCount());
+	}
+	if (morphTargetCount > 0) {
+		mMorphWeights.assign(morphWeights.begin(), morphWeights.end());
+		mMorphWeights.resize(size_t(frameCount) * morphTargetCount, 0.0f);
+	}
+
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Vertex animation positions";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = PositionFormat;
+	textureDesc.size = { width, frameCount * rowsPerFrame, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::StorageBinding | TextureUsage::TextureBinding;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mPositionTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Geometry, "VertexAnimationTexture");
+	textureDesc.label = "Vertex animation normals";
+	textureDesc.format = NormalFormat;
+	mNormalTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Geometry, "VertexAnimationTexture");
+	if (!mPositionTexture || !mNormalTexture) {
+		std::cerr << "Could not create the vertex animation textures of " << frameCount << " frames" << std::endl;
+		mSkinning.reset();
+		return;
+	}
+	mPositionView = mPositionTexture.createView();
+	mNormalView = mNormalTexture.createView();
+
+	// Pack: uniforms, the skinned frames, then the positions and normals written
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(4, Default);
+	for (uint32_t binding = 0; binding < bindingLayoutEntries.size(); ++binding) {
+		bindingLayoutEntries[binding].binding = binding;
+		bindingLayoutEntries[binding].visibility = ShaderStage::Compute;
+	}
+	bindingLayoutEntries[0].buffer.type = BufferBindingType::Uniform;
+	bindingLayoutEntries[0].buffer.minBindingSize = sizeof(Uniforms);
+	bindingLayoutEntries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	bindingLayoutEntries[2].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[2].storageTexture.format = PositionFormat;
+	bindingLayoutEntries[2].storageTexture.viewDimension = TextureViewDimension::_2D;
+	bindingLayoutEntries[3].storageTexture.access = StorageTextureAccess::WriteOnly;
+	bindingLayoutEntries[3].storageTexture.format = NormalFormat;
+	bindingLayoutEntries[3].storageTexture.viewDimension = TextureViewDimension::_2D;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mPackLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mPackLayout;
+	ComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	pipelineDesc.compute.module = pipelineCache.shaderModule(packShaderSource);
+	pipelineDesc.compute.entryPoint = "pack";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	mPackPipeline = pipelineCache.computePipelineAsync(pipelineDesc);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Vertex animation uniforms";
+	bufferDesc.size = sizeof(Uniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	mUniformBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Uniforms, "VertexAnimationTexture");
+	if (!mUniformBuffer) {
+		mSkinning.reset();
+		return;
+	}
+	GpuHandle<Queue>(device.getQueue())->writeBuffer(mUniformBuffer, 0, &mUniforms, sizeof(Uniforms));
+}
+
+VertexAnimationTexture::~VertexAnimationTexture() {
+	mSkinning.reset();
+	for (TextureView* view : { &mPositionView, &mNormalView }) {
+		if (*view) view->release();
+	}
+	for (Texture* texture : { &mPositionTexture, &mNormalTexture }) {
+		if (*texture) retireTracked(*texture);
+	}
+	if (mUniformBuffer) {
+		destroyTracked(mUniformBuffer);
+		mUniformBuffer.release();
+	}
+}
+
+bool VertexAnimationTexture::bake(Queue queue) {
+	if (mBaked) return true;
+	if (!valid() || !mSkinning || !mSkinning->ready() || !mPackPipeline->ready()) return false;
+
+	uint32_t frameCount = mUniforms.frameCount;
+	size_t jointCount = mJointMatrices.size() / frameCount;
+	size_t morphTargetCount = mMorphWeights.size() / frameCount;
+	for (uint32_t frame = 0; frame < frameCount; ++frame) {
+		mSkinning->setJointMatrices(queue, frame, mJointMatrices.data() + frame * jointCount);
+		if (morphTargetCount > 0) mSkinning->setMorphWeights(queue, frame, mMorphWeights.data() + frame * morphTargetCount);
+	}
+
+	Buffer skinnedVertices = mSkinning->skinnedVertexBuffer();
+	std::vector<BindGroupEntry> bindings(4);
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+		bindings[binding].binding = binding;
+	}
+	bindings[0].buffer = mUniformBuffer;
+	bindings[0].offset = 0;
+	bindings[0].size = sizeof(Uniforms);
+	// The skinned buffer rounds up its size, which the shader would read as vertices
+	bindings[1].buffer = skinnedVertices;
+	bindings[1].offset = 0;
+	bindings[1].size = uint64_t(frameCount) * mVertexCount * sizeof(ResourceManager::VertexAttributes);
+	bindings[2].textureView = mPositionView;
+	bindings[3].textureView = mNormalView;
+	BindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = mPackLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	BindGroup bindGroup = mDevice.createBindGroup(bindGroupDesc);
+
+	CommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = "Vertex animation baking";
+	CommandEncoder encoder = mDevice.createCommandEncoder(encoderDesc);
+	ComputePassDescriptor computePassDesc{};
+	computePassDesc.label = "Vertex animation baking";
+	// Skinning and packing in passes of their own, for the frames to be written before they are read
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	mSkinning->skin(computePass, frameCount);
+	computePass.end();
+	computePass.release();
+	computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setPipeline(mPackPipeline->pipeline);
+	computePass.setBindGroup(0, bindGroup, 0, nullptr);
+	computePass.dispatchWorkgroups((mVertexCount + 63) / 64, frameCount, 1);
+	computePass.end();
+	computePass.release();
+	CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+	encoder.release();
+	queue.submit(commands);
+	commands.release();
+	bindGroup.release();
+
+	// Buffers destroyed once submitted are only freed after the work reading them
+	mSkinning.reset();
+	mJointMatrices = {};
+	mMorphWeights = {};
+	mBaked = true;
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "PipelineCache.h"
+#include "ResourceManager.h"
+#include "Skinning.h"
+
+#include <memory>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+/**
+ * A skeletal or morph animation baked into vertex animation textures: the position
+ * and the normal of every vertex at every frame, for instances of a mesh to be
+ * animated by their vertex shader with two texture loads per vertex (see
+ * resources/shaders/vertex_animation.wgsl) rather than skinned each frame. A crowd
+ * then costs a static instanced draw, each instance playing the clip at its own
+ * time through Scene::Instance::animationOffset.
+ *
+ * Frames are skinned once on the GPU by GpuSkinning, frame i as its instance i,
+ * then packed into the textures: vertex v of frame f is the texel
+ * (v % width, f * rowsPerFrame + v / width), so that meshes of more vertices than a
+ * texture is wide still fit. Morph animations without joints are baked with a
+ * single joint of identity matrices, all vertices weighing 1 on it.
+ */
+class VertexAnimationTexture {
+public:
+	static constexpr wgpu::TextureFormat PositionFormat = wgpu::TextureFormat::RGBA32Float;
+	static constexpr wgpu::TextureFormat NormalFormat = wgpu::TextureFormat::RGBA16Float;
+	static constexpr uint32_t MaxWidth = 2048;
+
+	/**
+	 * The VertexAnimationUniforms structure of the shaders
+	 */
+	struct Uniforms {
+		uint32_t frameCount;
+		// Frames per second of animation time
+		float frameRate;
+		uint32_t width;
+		uint32_t rowsPerFrame;
+	};
+	static_assert(sizeof(Uniforms) % 16 == 0);
+
+	// Animation of `vertices`, skinned by `skin` to the joints of `skeleton`, sampled `frameCount`
+	// times at `frameRate` from the start of `clip`, which loops. `morphWeights` holds the
+	// `morphTargetCount` weights of each frame, frame after frame, or nothing for weights of 0.
+	VertexAnimationTexture(
+		wgpu::Device device,
+		PipelineCache& pipelineCache,
+		std::span<const ResourceManager::VertexAttributes> vertices,
+		std::span<const GpuSkinning::SkinVertex> skin,
+		const Skeleton& skeleton,
+		const AnimationClip& clip,
+		std::span<const GpuSkinning::MorphDelta> morphDeltas,
+		uint32_t morphTargetCount,
+		std::span<const float> morphWeights,
+		uint32_t frameCount,
+		float frameRate
+	);
+	~VertexAnimationTexture();
+
+	VertexAnimationTexture(const VertexAnimationTexture&) = delete;
+	VertexAnimationTexture& operator=(const VertexAnimationTexture&) = delete;
+
+	bool valid() const { return mUniformBuffer != nullptr; }
+	// Whether bake() submitted the frames, before which the textures hold nothing
+	bool baked() const { return mBaked; }
+
+	// Skin the frames and pack them into the textures in a submission of their own, once the
+	// pipelines are built, returning whether the textures are baked
+	bool bake(wgpu::Queue queue);
+
+	// Bound by the passes drawing the animated mesh
+	wgpu::TextureView positionView() const { return mPositionView; }
+	wgpu::TextureView normalView() const { return mNormalView; }
+	wgpu::Buffer uniformBuffer() const { return mUniformBuffer; }
+	const Uniforms& uniforms() const { return mUniforms; }
+
+private:
+	wgpu::Device mDevice;
+	uint32_t mVertexCount = 0;
+	Uniforms mUniforms{};
+	bool mBaked = false;
+
+	wgpu::Texture mPositionTexture = nullptr;
+	wgpu::TextureView mPositionView = nullptr;
+	wgpu::Texture mNormalTexture = nullptr;
+	wgpu::TextureView mNormalView = nullptr;
+	wgpu::Buffer mUniformBuffer = nullptr;
+
+	// Until baked, the frames as instances of the skin, and their matrices and weights to upload
+	std::unique_ptr<GpuSkinning> mSkinning;
+	std::vector<glm::mat4> mJointMatrices;
+	std::vector<float> mMorphWeights;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mPackLayout = nullptr;
+	PipelineCache::AsyncComputePipeline mPackPipeline;
+};
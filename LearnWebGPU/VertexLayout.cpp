@@ -0,0 +1,306 @@
+#include "VertexLayout.h"
+#include "ParallelFor.h"
+#include "StaticVertexLayout.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace wgpu;
+using VertexAttributes = ResourceManager::VertexAttributes;
+
+namespace {
+
+/**
+ * Memory layout of a vertex in the Compact encoding, each word packed with glm's
+ * pack* functions which store the first component in the lowest bits.
+ */
+struct CompactVertex {
+	uint32_t positionXY; // Unorm16x4 position, w unused
+	uint32_t positionZW;
+	uint32_t normal;     // Snorm16x2, octahedral encoding
+	uint32_t color;      // Unorm8x4, alpha unused
+	uint32_t uv;         // Float16x2 or Unorm16x2
+};
+static_assert(sizeof(CompactVertex) == 20);
+
+// Layouts of the two encodings, the Compact one with either of its uv formats
+using Float32Vertex = StaticVertexLayout<VertexPosition<f32x3>, VertexNormal<f32x3>, VertexColor<f32x3>, VertexUv<f32x2>>;
+using CompactVertexFloat16Uv = StaticVertexLayout<VertexPosition<unorm16x4>, VertexNormal<snorm16x2>, VertexColor<unorm8x4>, VertexUv<f16x2>>;
+using CompactVertexUnorm16Uv = StaticVertexLayout<VertexPosition<unorm16x4>, VertexNormal<snorm16x2>, VertexColor<unorm8x4>, VertexUv<unorm16x2>>;
+using Float32Position = StaticVertexLayout<VertexPosition<f32x3>>;
+using CompactPosition = StaticVertexLayout<VertexPosition<unorm16x4>>;
+
+// The Float32 encoding uploads VertexAttributes as they are
+static_assert(Float32Vertex::stride == sizeof(VertexAttributes));
+static_assert(Float32Vertex::offset(0) == offsetof(VertexAttributes, position) && Float32Vertex::offset(1) == offsetof(VertexAttributes, normal));
+static_assert(Float32Vertex::offset(2) == offsetof(VertexAttributes, color) && Float32Vertex::offset(3) == offsetof(VertexAttributes, uv));
+static_assert(CompactVertexFloat16Uv::stride == sizeof(CompactVertex) && CompactVertexUnorm16Uv::stride == sizeof(CompactVertex));
+static_assert(CompactVertexFloat16Uv::offset(0) == offsetof(CompactVertex, positionXY) && CompactVertexFloat16Uv::offset(1) == offsetof(CompactVertex, normal));
+static_assert(CompactVertexFloat16Uv::offset(2) == offsetof(CompactVertex, color) && CompactVertexFloat16Uv::offset(3) == offsetof(CompactVertex, uv));
+
+// Map a unit vector to the [-1, 1]² square by projecting it onto an octahedron
+glm::vec2 octahedralEncode(glm::vec3 n) {
+	float norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (norm == 0.0f) return { 0.0f, 0.0f };
+	n /= norm;
+	glm::vec2 e = { n.x, n.y };
+	if (n.z < 0.0f) {
+		// Fold the lower hemisphere over the diagonals
+		e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+} // anonymous namespace
+
+VertexLayout::VertexLayout(Encoding encoding, UvFormat uvFormat, bool splitPositionStream)
+	: mEncoding(encoding)
+	, mUvFormat(uvFormat)
+{
+	// Attributes in the order of their interleaved layout, the position coming first
+	std::span<const WGPUVertexAttribute> layoutAttributes;
+	uint64_t stride = 0;
+	if (mEncoding == Encoding::Float32) {
+		layoutAttributes = Float32Vertex::attributes;
+		stride = Float32Vertex::stride;
+	}
+	else if (mUvFormat == UvFormat::Float16) {
+		layoutAttributes = CompactVertexFloat16Uv::attributes;
+		stride = CompactVertexFloat16Uv::stride;
+	}
+	else {
+		layoutAttributes = CompactVertexUnorm16Uv::attributes;
+		stride = CompactVertexUnorm16Uv::stride;
+	}
+	std::vector<VertexAttribute> attributes(layoutAttributes.begin(), layoutAttributes.end());
+
+	if (splitPositionStream) {
+		// Attributes after the position simply move to the second buffer
+		uint64_t positionSize = attributes[1].offset;
+		mAttributes.push_back({ attributes[0] });
+		mAttributes.push_back({ attributes.begin() + 1, attributes.end() });
+		for (VertexAttribute& attribute : mAttributes[1]) {
+			attribute.offset -= positionSize;
+		}
+		mBufferLayouts.resize(2);
+		mBufferLayouts[0].arrayStride = positionSize;
+		mBufferLayouts[1].arrayStride = stride - positionSize;
+	}
+	else {
+		mAttributes.push_back(std::move(attributes));
+		mBufferLayouts.resize(1);
+		mBufferLayouts[0].arrayStride = stride;
+	}
+
+	for (size_t i = 0; i < mBufferLayouts.size(); ++i) {
+		mBufferLayouts[i].attributeCount = mAttributes[i].size();
+		mBufferLayouts[i].attributes = mAttributes[i].data();
+		mBufferLayouts[i].stepMode = VertexStepMode::Vertex;
+	}
+
+	// Position is the first attribute of buffer 0 in both cases
+	mPositionBufferLayout = mBufferLayouts[0];
+	mPositionBufferLayout.attributeCount = 1;
+}
+
+uint64_t VertexLayout::vertexSize() const {
+	uint64_t size = 0;
+	for (const VertexBufferLayout& layout : mBufferLayouts) {
+		size += layout.arrayStride;
+	}
+	return size;
+}
+
+static const char* wgslQuantizationDeclaration = R"(
+struct VertexQuantization {
+	positionOffset: vec4f,
+	positionScale: vec4f,
+	uvOffsetScale: vec4f,
+};
+)";
+
+std::string VertexLayout::wgslDeclarations() const {
+	std::string source = wgslQuantizationDeclaration;
+	source += R"(
+struct DecodedVertex {
+	position: vec3f,
+	normal: vec3f,
+	color: vec3f,
+	uv: vec2f,
+};
+)";
+
+	if (mEncoding == Encoding::Float32) {
+		source += "\n";
+		source += Float32Vertex::wgslStruct<"VertexInput">;
+		source += R"(
+fn decodeVertex(in: VertexInput, q: VertexQuantization) -> DecodedVertex {
+	return DecodedVertex(in.position, in.normal, in.color, in.uv);
+}
+)";
+		return source;
+	}
+
+	// Both uv formats are read as vec2f
+	source += "\n";
+	source += CompactVertexFloat16Uv::wgslStruct<"VertexInput">;
+	source += R"(
+fn octahedralDecode(e: vec2f) -> vec3f {
+	var n = vec3f(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+	let t = max(-n.z, 0.0);
+	n.x += select(t, -t, n.x >= 0.0);
+	n.y += select(t, -t, n.y >= 0.0);
+	return normalize(n);
+}
+
+fn decodeVertex(in: VertexInput, q: VertexQuantization) -> DecodedVertex {
+	var out: DecodedVertex;
+	out.position = q.positionOffset.xyz + q.positionScale.xyz * in.position.xyz;
+	out.normal = octahedralDecode(in.normal);
+	out.color = in.color.rgb;
+)";
+	if (mUvFormat == UvFormat::Unorm16) {
+		source += "\tout.uv = q.uvOffsetScale.xy + q.uvOffsetScale.zw * in.uv;\n";
+	}
+	else {
+		source += "\tout.uv = in.uv;\n";
+	}
+	source += "\treturn out;\n}\n";
+	return source;
+}
+
+// WGSL expression reading an attribute of `format` from the words of a vertex, from `word` on
+static std::string wgslPullExpression(VertexFormat format, const std::string& stream, const std::string& word) {
+	auto at = [&](uint32_t i) { return stream + "[" + word + " + " + std::to_string(i) + "u]"; };
+	switch (format) {
+	case VertexFormat::Float32x2: return "vec2f(bitcast<f32>(" + at(0) + "), bitcast<f32>(" + at(1) + "))";
+	case VertexFormat::Float32x3: return "vec3f(bitcast<f32>(" + at(0) + "), bitcast<f32>(" + at(1) + "), bitcast<f32>(" + at(2) + "))";
+	case VertexFormat::Unorm16x4: return "vec4f(unpack2x16unorm(" + at(0) + "), unpack2x16unorm(" + at(1) + "))";
+	case VertexFormat::Unorm16x2: return "unpack2x16unorm(" + at(0) + ")";
+	case VertexFormat::Snorm16x2: return "unpack2x16snorm(" + at(0) + ")";
+	case VertexFormat::Float16x2: return "unpack2x16float(" + at(0) + ")";
+	case VertexFormat::Unorm8x4: return "unpack4x8unorm(" + at(0) + ")";
+	default: return "";
+	}
+}
+
+std::string VertexLayout::wgslPullDeclarations(uint32_t group, uint32_t firstBinding) const {
+	static const char* fieldNames[] = { "position", "normal", "color", "uv" };
+	std::string source = "\n";
+	for (uint32_t buffer = 0; buffer < bufferCount(); ++buffer) {
+		source += "@group(" + std::to_string(group) + ") @binding(" + std::to_string(firstBinding + buffer) + ") var<storage, read> vertexStream" + std::to_string(buffer) + ": array<u32>;\n";
+	}
+
+	// The VertexInput that the buffer layouts would fetch, rebuilt from 32-bit words, which all
+	// attributes are made of
+	source += "\nfn pullVertex(vertexIndex: u32, q: VertexQuantization) -> DecodedVertex {\n\tvar in: VertexInput;\n";
+	for (uint32_t buffer = 0; buffer < bufferCount(); ++buffer) {
+		std::string stream = "vertexStream" + std::to_string(buffer);
+		std::string word = "vertexIndex * " + std::to_string(arrayStride(buffer) / 4) + "u";
+		for (const VertexAttribute& attribute : mAttributes[buffer]) {
+			std::string first = "(" + word + " + " + std::to_string(attribute.offset / 4) + "u)";
+			source += "\tin." + std::string(fieldNames[attribute.shaderLocation]) + " = " + wgslPullExpression(attribute.format, stream, first) + ";\n";
+		}
+	}
+	source += "\treturn decodeVertex(in, q);\n}\n";
+	return source;
+}
+
+std::string VertexLayout::wgslPositionDeclarations() const {
+	std::string source = wgslQuantizationDeclaration;
+	source += "\n";
+	if (mEncoding == Encoding::Float32) {
+		source += Float32Position::wgslStruct<"PositionInput">;
+		source += R"(
+fn decodePosition(in: PositionInput, q: VertexQuantization) -> vec3f {
+	return in.position;
+}
+)";
+	}
+	else {
+		source += CompactPosition::wgslStruct<"PositionInput">;
+		source += R"(
+fn decodePosition(in: PositionInput, q: VertexQuantization) -> vec3f {
+	return q.positionOffset.xyz + q.positionScale.xyz * in.position.xyz;
+}
+)";
+	}
+	return source;
+}
+
+VertexQuantization VertexLayout::computeQuantization(std::span<const VertexAttributes> vertices) const {
+	VertexQuantization quantization;
+	if (mEncoding == Encoding::Float32 || vertices.empty()) return quantization;
+
+	glm::vec3 positionMin(std::numeric_limits<float>::max());
+	glm::vec3 positionMax(std::numeric_limits<float>::lowest());
+	glm::vec2 uvMin(std::numeric_limits<float>::max());
+	glm::vec2 uvMax(std::numeric_limits<float>::lowest());
+	for (const VertexAttributes& vertex : vertices) {
+		glm::vec3 position = vertex.position;
+		glm::vec2 uv = vertex.uv;
+		positionMin = glm::min(positionMin, position);
+		positionMax = glm::max(positionMax, position);
+		uvMin = glm::min(uvMin, uv);
+		uvMax = glm::max(uvMax, uv);
+	}
+
+	quantization.positionOffset = glm::vec4(positionMin, 0.0f);
+	quantization.positionScale = glm::vec4(positionMax - positionMin, 0.0f);
+	if (mUvFormat == UvFormat::Unorm16) {
+		quantization.uvOffsetScale = glm::vec4(uvMin, uvMax - uvMin);
+	}
+	return quantization;
+}
+
+void VertexLayout::encode(std::span<const VertexAttributes> vertices, const VertexQuantization& quantization, uint32_t buffer, std::byte* destination) const {
+	uint64_t stride = arrayStride(buffer);
+	if (mEncoding == Encoding::Float32 && !splitPositionStream()) {
+		memcpy(destination, vertices.data(), vertices.size_bytes());
+		return;
+	}
+
+	// Bytes of each interleaved vertex that go to this buffer, the position being the first ones
+	uint64_t vertexOffset = buffer == 0 ? 0 : arrayStride(0);
+	if (mEncoding == Encoding::Float32) {
+		parallelForRanges(vertices.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				memcpy(destination + i * stride, reinterpret_cast<const std::byte*>(&vertices[i]) + vertexOffset, stride);
+			}
+		});
+		return;
+	}
+
+	// Degenerate extents (e.g., a flat mesh) encode to 0
+	auto inverse = [](float extent) { return extent > 0.0f ? 1.0f / extent : 0.0f; };
+	glm::vec3 positionOffset = glm::vec3(quantization.positionOffset);
+	glm::vec3 invPositionScale = {
+		inverse(quantization.positionScale.x),
+		inverse(quantization.positionScale.y),
+		inverse(quantization.positionScale.z)
+	};
+	glm::vec2 uvOffset = { quantization.uvOffsetScale.x, quantization.uvOffsetScale.y };
+	glm::vec2 invUvScale = { inverse(quantization.uvOffsetScale.z), inverse(quantization.uvOffsetScale.w) };
+
+	parallelForRanges(vertices.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const VertexAttributes& vertex = vertices[i];
+			CompactVertex compact;
+
+			glm::vec3 position = (glm::vec3(vertex.position) - positionOffset) * invPositionScale;
+			compact.positionXY = glm::packUnorm2x16({ position.x, position.y });
+			compact.positionZW = glm::packUnorm2x16({ position.z, 0.0f });
+			compact.normal = glm::packSnorm2x16(octahedralEncode(vertex.normal));
+			compact.color = glm::packUnorm4x8(glm::vec4(vertex.color, 1.0f));
+			if (mUvFormat == UvFormat::Float16) {
+				compact.uv = glm::packHalf2x16(vertex.uv);
+			}
+			else {
+				compact.uv = glm::packUnorm2x16((glm::vec2(vertex.uv) - uvOffset) * invUvScale);
+			}
+			memcpy(destination + i * stride, reinterpret_cast<const std::byte*>(&compact) + vertexOffset, stride);
+		}
+	});
+}
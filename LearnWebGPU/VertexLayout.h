@@ -0,0 +1,112 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include <vector>
+#include <string>
+#include <span>
+#include <cstddef>
+
+#include "ResourceManager.h"
+
+/**
+ * Parameters needed by the vertex shader to dequantize compact vertices,
+ * stored in the uniform buffer (hence the vec4 padding).
+ * Replicated in WGSL by VertexLayout::wgslDeclarations().
+ */
+struct VertexQuantization {
+	// position = positionOffset + positionScale * encodedPosition, with encodedPosition in [0, 1]
+	glm::vec4 positionOffset = { 0.0f, 0.0f, 0.0f, 0.0f };
+	glm::vec4 positionScale = { 1.0f, 1.0f, 1.0f, 0.0f };
+	// uv = uvOffsetScale.xy + uvOffsetScale.zw * encodedUv (only for Unorm16 uvs)
+	glm::vec4 uvOffsetScale = { 0.0f, 0.0f, 1.0f, 1.0f };
+};
+static_assert(sizeof(VertexQuantization) % 16 == 0);
+
+/**
+ * Describe how ResourceManager::VertexAttributes are encoded in vertex buffers,
+ * and generate everything that must agree on it: the pipeline's vertex buffer
+ * layouts, the WGSL `VertexInput` structure with its `decodeVertex` function,
+ * and the CPU side encoding of the vertex data.
+ *
+ * Attributes are either interleaved in a single buffer, or split in two streams:
+ * positions alone in buffer 0 and all other attributes in buffer 1, so that
+ * depth-only passes fetch positions only (see positionBufferLayout()).
+ */
+class VertexLayout {
+public:
+	enum class Encoding {
+		// VertexAttributes as is, 44 bytes per vertex
+		Float32,
+		// Unorm16x4 position within the mesh bounds, octahedral Snorm16x2 normal,
+		// Unorm8x4 color and 16-bit uv, 20 bytes per vertex
+		Compact,
+	};
+
+	// How uvs are stored by the Compact encoding
+	enum class UvFormat {
+		// Half floats, best for uvs that wrap around the texture many times
+		Float16,
+		// Normalized within the uv bounds of the mesh, uniform precision
+		Unorm16,
+	};
+
+	VertexLayout(Encoding encoding = Encoding::Float32, UvFormat uvFormat = UvFormat::Float16, bool splitPositionStream = false);
+
+	// Non copyable because buffer layouts point to the attributes
+	VertexLayout(const VertexLayout&) = delete;
+	VertexLayout& operator=(const VertexLayout&) = delete;
+
+	Encoding encoding() const { return mEncoding; }
+	UvFormat uvFormat() const { return mUvFormat; }
+	bool splitPositionStream() const { return mBufferLayouts.size() > 1; }
+
+	// Number of vertex buffers to bind, at slots 0 to bufferCount() - 1
+	uint32_t bufferCount() const { return static_cast<uint32_t>(mBufferLayouts.size()); }
+
+	// Layouts of all vertex buffers, with attributes at shader locations 0 (position) to 3 (uv).
+	// They remain valid as long as this object.
+	const std::vector<wgpu::VertexBufferLayout>& bufferLayouts() const { return mBufferLayouts; }
+
+	// Layout of buffer 0 restricted to the position attribute, for depth-only pipelines
+	// whose vertex shader uses wgslPositionDeclarations().
+	const wgpu::VertexBufferLayout& positionBufferLayout() const { return mPositionBufferLayout; }
+
+	// Size in bytes of one encoded vertex in a given buffer
+	uint64_t arrayStride(uint32_t buffer) const { return mBufferLayouts[buffer].arrayStride; }
+
+	// Size in bytes of one encoded vertex, all buffers included
+	uint64_t vertexSize() const;
+
+	// WGSL source declaring `VertexInput`, `VertexQuantization`, `DecodedVertex` and
+	// `fn decodeVertex(in: VertexInput, q: VertexQuantization) -> DecodedVertex`,
+	// to be prepended to shaders that read vertices through this layout.
+	std::string wgslDeclarations() const;
+
+	// WGSL source reading the vertex buffers as storage buffers instead, for vertex shaders that
+	// are given no vertex buffer layout: declares buffer i as `vertexStream<i>: array<u32>` at
+	// binding `firstBinding + i` of group `group`, and `fn pullVertex(vertexIndex: u32,
+	// q: VertexQuantization) -> DecodedVertex`. To append to wgslDeclarations().
+	std::string wgslPullDeclarations(uint32_t group, uint32_t firstBinding) const;
+
+	// WGSL source declaring `PositionInput`, `VertexQuantization` and
+	// `fn decodePosition(in: PositionInput, q: VertexQuantization) -> vec3f`,
+	// for shaders that read positions through positionBufferLayout().
+	std::string wgslPositionDeclarations() const;
+
+	// Compute the dequantization parameters that best fit the given vertices
+	VertexQuantization computeQuantization(std::span<const ResourceManager::VertexAttributes> vertices) const;
+
+	// Encode the part of vertices that goes to `buffer`, writing vertices.size() * arrayStride(buffer)
+	// bytes to `destination`, e.g. straight into mapped memory
+	void encode(std::span<const ResourceManager::VertexAttributes> vertices, const VertexQuantization& quantization, uint32_t buffer, std::byte* destination) const;
+
+private:
+	Encoding mEncoding;
+	UvFormat mUvFormat;
+	// Per buffer attributes, pointed to by the buffer layouts
+	std::vector<std::vector<wgpu::VertexAttribute>> mAttributes;
+	std::vector<wgpu::VertexBufferLayout> mBufferLayouts;
+	wgpu::VertexBufferLayout mPositionBufferLayout;
+};
@@ -0,0 +1,196 @@
+#include "View.h"
+#include "Blit.h"
+#include "GpuMemory.h"
+
+#include <glfw3webgpu.h>
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <iostream>
+
+using namespace wgpu;
+
+namespace {
+
+uint64_t packSize(int width, int height) {
+	return (uint64_t(std::max(height, 0)) << 32) | uint32_t(std::max(width, 0));
+}
+
+} // anonymous namespace
+
+std::unique_ptr<View> View::create(Instance instance, const char* title, uint32_t width, uint32_t height, float yawOffset) {
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+	GLFWwindow* window = glfwCreateWindow(width, height, title, nullptr, nullptr);
+	if (!window) {
+		std::cerr << "Could not open the window of view '" << title << "'!" << std::endl;
+		return nullptr;
+	}
+	std::unique_ptr<View> view(new View(window, width, height, yawOffset));
+	if (!view->recreateSurface(instance)) return nullptr;
+	return view;
+}
+
+View::View(GLFWwindow* window, uint32_t width, uint32_t height, float yawOffset)
+	: mWindow(window)
+	, mFramebufferSize(packSize(width, height))
+	, mYawOffset(yawOffset)
+{
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(mWindow, &framebufferWidth, &framebufferHeight);
+	mFramebufferSize = packSize(framebufferWidth, framebufferHeight);
+
+	glfwSetWindowUserPointer(mWindow, this);
+	glfwSetFramebufferSizeCallback(mWindow, [](GLFWwindow* window, int width, int height) {
+		View* that = reinterpret_cast<View*>(glfwGetWindowUserPointer(window));
+		if (that) that->mFramebufferSize = packSize(width, height);
+	});
+	// The main window alone ends the application
+	glfwSetWindowCloseCallback(mWindow, [](GLFWwindow* window) {
+		View* that = reinterpret_cast<View*>(glfwGetWindowUserPointer(window));
+		if (that) that->mClosed = true;
+		glfwSetWindowShouldClose(window, GLFW_FALSE);
+		glfwHideWindow(window);
+	});
+}
+
+View::~View() {
+	unconfigure();
+	if (mSurface) mSurface.release();
+	glfwDestroyWindow(mWindow);
+}
+
+bool View::recreateSurface(Instance instance) {
+	if (mSurface) mSurface.release();
+	mSurface = glfwGetWGPUSurface(instance, mWindow);
+	if (!mSurface) {
+		std::cerr << "Could not create the surface of a view!" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool View::configure(Device device, PipelineCache& pipelineCache, const SurfaceFormat& surfaceFormat, PresentMode presentMode, TextureFormat depthFormat, uint32_t sampleCount) {
+	unconfigure();
+	mDevice = device;
+	mSurfaceFormat = surfaceFormat;
+	mPresentMode = presentMode;
+	mDepthFormat = depthFormat;
+	mSampleCount = sampleCount;
+	// Its uniforms are those of the view's own scene size
+	mBlit = std::make_unique<Blit>(device, pipelineCache, surfaceFormat.viewFormat);
+	uint64_t size = mFramebufferSize;
+	mSize = { uint32_t(size), uint32_t(size >> 32) };
+	// Minimized windows are configured once restored
+	if (mSize.x == 0 || mSize.y == 0) {
+		mSize = { 0, 0 };
+		return true;
+	}
+	configureSurface();
+	return initDepthBuffer();
+}
+
+void View::unconfigure() {
+	if (mTargetView) mTargetView.release();
+	mTargetView = nullptr;
+	mTargetTexture = nullptr;
+	if (mSize.x > 0) {
+		terminateDepthBuffer();
+		mSurface.unconfigure();
+	}
+	mSize = { 0, 0 };
+	mBlit.reset();
+	mDevice = nullptr;
+}
+
+void View::configureSurface() {
+	SurfaceConfiguration config{};
+	config.width = mSize.x;
+	config.height = mSize.y;
+	config.usage = TextureUsage::RenderAttachment;
+	mSurfaceFormat.configure(config);
+	config.device = mDevice;
+	config.presentMode = mPresentMode;
+	mSurface.configure(config);
+}
+
+bool View::initDepthBuffer() {
+	TextureDescriptor depthTextureDesc{};
+	depthTextureDesc.label = "View depth buffer";
+	depthTextureDesc.dimension = TextureDimension::_2D;
+	depthTextureDesc.format = mDepthFormat;
+	depthTextureDesc.mipLevelCount = 1;
+	depthTextureDesc.sampleCount = mSampleCount;
+	depthTextureDesc.size = { mSize.x, mSize.y, 1 };
+	depthTextureDesc.usage = TextureUsage::RenderAttachment;
+	depthTextureDesc.viewFormatCount = 0;
+	depthTextureDesc.viewFormats = nullptr;
+	mDepthTexture = createTrackedTexture(mDevice, depthTextureDesc, GpuMemoryCategory::RenderTargets, "View");
+	if (!mDepthTexture) return false;
+
+	TextureViewDescriptor depthTextureViewDesc{};
+	depthTextureViewDesc.aspect = TextureAspect::DepthOnly;
+	depthTextureViewDesc.baseArrayLayer = 0;
+	depthTextureViewDesc.arrayLayerCount = 1;
+	depthTextureViewDesc.baseMipLevel = 0;
+	depthTextureViewDesc.mipLevelCount = 1;
+	depthTextureViewDesc.dimension = TextureViewDimension::_2D;
+	depthTextureViewDesc.format = mDepthFormat;
+	mDepthView = mDepthTexture.createView(depthTextureViewDesc);
+	return mDepthView != nullptr;
+}
+
+void View::terminateDepthBuffer() {
+	if (mDepthView) mDepthView.release();
+	mDepthView = nullptr;
+	// Still used by the frames in flight when the window is resized
+	if (mDepthTexture) retireTracked(mDepthTexture);
+	mDepthTexture = nullptr;
+}
+
+bool View::acquire() {
+	if (!mDevice || mClosed) return false;
+
+	// Resized since the last frame, or restored after being minimized
+	uint64_t size = mFramebufferSize;
+	glm::uvec2 framebufferSize = { uint32_t(size), uint32_t(size >> 32) };
+	if (framebufferSize != mSize) {
+		if (mSize.x > 0) {
+			terminateDepthBuffer();
+			mSurface.unconfigure();
+		}
+		mSize = { 0, 0 };
+		if (framebufferSize.x == 0 || framebufferSize.y == 0) return false;
+		mSize = framebufferSize;
+		configureSurface();
+		if (!initDepthBuffer()) return false;
+	}
+	if (mSize.x == 0) return false;
+
+	SurfaceTexture surfaceTexture{};
+	mSurface.getCurrentTexture(&surfaceTexture);
+	if (surfaceTexture.status == SurfaceGetCurrentTextureStatus::Outdated || surfaceTexture.status == SurfaceGetCurrentTextureStatus::Lost) {
+		mSurface.unconfigure();
+		configureSurface();
+		mSurface.getCurrentTexture(&surfaceTexture);
+	}
+	// Skipped until it succeeds, the main window reporting the loss of the device
+	if (surfaceTexture.status != SurfaceGetCurrentTextureStatus::Success) return false;
+	mTargetTexture = surfaceTexture.texture;
+
+	mTargetView = mSurfaceFormat.createView(mTargetTexture, "View surface texture view");
+	return mTargetView != nullptr;
+}
+
+void View::present() {
+	if (!mTargetView) return;
+	mTargetView.release();
+	mTargetView = nullptr;
+#ifndef __EMSCRIPTEN__
+	mSurface.present();
+#endif // ! __EMSCRIPTEN__
+#ifndef WEBGPU_BACKEND_WGPU
+	mTargetTexture.release();
+#endif // WEBGPU_BACKEND_WGPU
+	mTargetTexture = nullptr;
+}
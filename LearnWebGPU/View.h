@@ -0,0 +1,90 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "SurfaceFormat.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+class Blit;
+class PipelineCache;
+struct GLFWwindow;
+
+/**
+ * A secondary view of the scene, in a window of its own: its surface, its camera,
+ * and the depth buffer it is drawn with. Views share the device, the resource
+ * caches, the pipelines and the bind groups of the main window, and are drawn in
+ * the command buffer of the frame, presented after it (see Application::encodeFrame).
+ *
+ * The camera orbits with the main one, turned around the vertical axis by a fixed
+ * angle. The surface follows the size of the window, as read from its framebuffer
+ * size callback, which may run on another thread than the view is drawn from.
+ * Closing the window hides it, after which the view is no longer drawn.
+ */
+class View {
+public:
+	// Open a window of `width` x `height` pixels with a surface of `instance`, which must be
+	// done from the thread processing GLFW events, or return nullptr
+	static std::unique_ptr<View> create(wgpu::Instance instance, const char* title, uint32_t width, uint32_t height, float yawOffset);
+	~View();
+
+	View(const View&) = delete;
+	View& operator=(const View&) = delete;
+
+	// For the instance of a recreated device, the surface belonging to the previous one. From the
+	// main thread, as create().
+	bool recreateSurface(wgpu::Instance instance);
+
+	// Configure the surface, and create the depth buffer and the blit to the surface with the
+	// formats and sample count of the main window's passes, or return false
+	bool configure(wgpu::Device device, PipelineCache& pipelineCache, const SurfaceFormat& surfaceFormat, wgpu::PresentMode presentMode, wgpu::TextureFormat depthFormat, uint32_t sampleCount);
+	void unconfigure();
+
+	// Acquire the surface texture of the frame, configured again first if the window was
+	// resized, or return false if the window is hidden, minimized, or the texture could not
+	// be acquired, the view then being skipped for the frame
+	bool acquire();
+	// Once the frame is submitted, if acquired
+	void present();
+
+	// Between acquire() and present()
+	wgpu::TextureView targetView() const { return mTargetView; }
+	wgpu::TextureView depthView() const { return mDepthView; }
+	Blit& blit() { return *mBlit; }
+
+	glm::uvec2 size() const { return mSize; }
+	float yawOffset() const { return mYawOffset; }
+
+private:
+	View(GLFWwindow* window, uint32_t width, uint32_t height, float yawOffset);
+	void configureSurface();
+	bool initDepthBuffer();
+	void terminateDepthBuffer();
+
+private:
+	GLFWwindow* mWindow = nullptr;
+	wgpu::Surface mSurface = nullptr;
+	// Framebuffer size, width in the low bits, written by the GLFW callbacks
+	std::atomic<uint64_t> mFramebufferSize;
+	std::atomic<bool> mClosed = false;
+	float mYawOffset;
+
+	// Of the last configuration
+	wgpu::Device mDevice = nullptr;
+	SurfaceFormat mSurfaceFormat;
+	wgpu::PresentMode mPresentMode = wgpu::PresentMode::Fifo;
+	wgpu::TextureFormat mDepthFormat = wgpu::TextureFormat::Undefined;
+	uint32_t mSampleCount = 1;
+	// Size of the surface and of the depth buffer, 0 while not configured
+	glm::uvec2 mSize = { 0, 0 };
+
+	wgpu::Texture mDepthTexture = nullptr;
+	wgpu::TextureView mDepthView = nullptr;
+	std::unique_ptr<Blit> mBlit;
+	// Of the frame being drawn
+	wgpu::Texture mTargetTexture = nullptr;
+	wgpu::TextureView mTargetView = nullptr;
+};
@@ -0,0 +1,392 @@
+#include "VirtualTextures.h"
+#include "GpuMemory.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+using namespace wgpu;
+
+namespace {
+
+constexpr char TileFileMagic[8] = { 'L', 'W', 'G', 'P', 'U', 'V', 'T', '1' };
+constexpr size_t TileBytes = size_t(4) * VirtualTextures::SlotSize * VirtualTextures::SlotSize;
+
+glm::uvec2 levelSize(glm::uvec2 size, uint32_t level) {
+	return glm::max(size >> level, glm::uvec2(1));
+}
+
+glm::uvec2 levelPageCount(glm::uvec2 size, uint32_t level) {
+	return (levelSize(size, level) + VirtualTextures::TileSize - 1u) / VirtualTextures::TileSize;
+}
+
+// Levels down to the first one that fits in a single tile, and the number of tiles they make
+uint32_t tileLevelCount(glm::uvec2 size, uint32_t& tileCount) {
+	uint32_t levelCount = 0;
+	tileCount = 0;
+	glm::uvec2 pageCount;
+	do {
+		pageCount = levelPageCount(size, levelCount++);
+		tileCount += pageCount.x * pageCount.y;
+	} while (pageCount.x > 1 || pageCount.y > 1);
+	return levelCount;
+}
+
+int32_t wrap(int32_t coordinate, uint32_t size) {
+	int32_t wrapped = coordinate % static_cast<int32_t>(size);
+	return wrapped < 0 ? wrapped + static_cast<int32_t>(size) : wrapped;
+}
+
+uint32_t packPageEntry(uint32_t slot, uint32_t level) {
+	return (slot % VirtualTextures::SlotsPerSide) | (slot / VirtualTextures::SlotsPerSide) << 8 | level << 16;
+}
+
+} // anonymous namespace
+
+const std::byte* VirtualTextures::TileFile::tile(uint32_t index) const {
+	return file.data() + sizeof(TileFileHeader) + size_t(index) * TileBytes;
+}
+
+std::filesystem::path VirtualTextures::tileFilePath(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options) {
+	std::filesystem::path tilePath = path;
+	tilePath += ".vt";
+	if (options.srgb) tilePath += "-srgb";
+	if (options.alphaWeightedMipMaps) tilePath += "-alpha";
+	tilePath += ".tiles";
+	return tilePath;
+}
+
+bool VirtualTextures::loadTileFile(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, TileFile& tiles) {
+	// Older than the image, which was edited since it was tiled
+	tiles.path = tileFilePath(path, options);
+	std::error_code ec;
+	std::filesystem::file_time_type tileTime = std::filesystem::last_write_time(tiles.path, ec);
+	if (ec) return false;
+	std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(path, ec);
+	if (ec || tileTime < sourceTime) return false;
+	if (!tiles.file.open(tiles.path) || tiles.file.size() < sizeof(TileFileHeader)) return false;
+
+	std::memcpy(&tiles.header, tiles.file.data(), sizeof(TileFileHeader));
+	const TileFileHeader& header = tiles.header;
+	uint32_t tileCount = 0;
+	bool valid = std::memcmp(header.magic, TileFileMagic, sizeof(TileFileMagic)) == 0
+		&& header.tileSize == TileSize && header.border == Border
+		&& header.width > 0 && header.height > 0
+		&& header.levelCount == tileLevelCount({ header.width, header.height }, tileCount)
+		&& header.levelCount <= MaxLevelCount && header.tileCount == tileCount
+		&& tiles.file.size() == sizeof(TileFileHeader) + tileCount * TileBytes;
+	if (!valid) {
+		std::cerr << "Ignoring invalid virtual texture tiles " << tiles.path << std::endl;
+		tiles.file.close();
+		return false;
+	}
+	return true;
+}
+
+bool VirtualTextures::writeTileFile(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, ResourceManager::Image& image) {
+	TileFileHeader header{};
+	std::memcpy(header.magic, TileFileMagic, sizeof(TileFileMagic));
+	header.width = image.width;
+	header.height = image.height;
+	header.tileSize = TileSize;
+	header.border = Border;
+	glm::uvec2 size(image.width, image.height);
+	header.levelCount = tileLevelCount(size, header.tileCount);
+	if (header.levelCount > MaxLevelCount) {
+		std::cerr << "Image too large for a virtual texture: " << path << std::endl;
+		return false;
+	}
+	if (image.mipLevelCount < header.levelCount) ResourceManager::buildMipMaps(image, options);
+
+	// Through a temporary file, so that a concurrent reader never maps partial tiles
+	return writeFileAtomically(tileFilePath(path, options), [&](std::ostream& file) {
+		file.write(reinterpret_cast<const char*>(&header), sizeof(TileFileHeader));
+		std::vector<uint32_t> tile(SlotSize * SlotSize);
+		for (uint32_t level = 0; level < header.levelCount; ++level) {
+			const unsigned char* pixels = ResourceManager::mipLevelPixels(image, level);
+			glm::uvec2 texels = levelSize(size, level);
+			glm::uvec2 pageCount = levelPageCount(size, level);
+			for (uint32_t pageY = 0; pageY < pageCount.y; ++pageY) {
+				for (uint32_t pageX = 0; pageX < pageCount.x; ++pageX) {
+					// The border wraps around the level, as does the sampler
+					for (uint32_t y = 0; y < SlotSize; ++y) {
+						int32_t sourceY = wrap(static_cast<int32_t>(pageY * TileSize + y) - static_cast<int32_t>(Border), texels.y);
+						const unsigned char* row = pixels + size_t(4) * texels.x * sourceY;
+						for (uint32_t x = 0; x < SlotSize; ++x) {
+							int32_t sourceX = wrap(static_cast<int32_t>(pageX * TileSize + x) - static_cast<int32_t>(Border), texels.x);
+							std::memcpy(&tile[y * SlotSize + x], row + 4 * sourceX, 4);
+						}
+					}
+					file.write(reinterpret_cast<const char*>(tile.data()), TileBytes);
+				}
+			}
+		}
+		return true;
+	});
+}
+
+VirtualTextures::VirtualTextures(Device device, bool srgb)
+	: mDevice(device)
+	, mQueue(device.getQueue())
+	, mSrgb(srgb)
+{
+	TextureDescriptor textureDesc{};
+	textureDesc.label = "Virtual texture tiles";
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.format = srgb ? TextureFormat::RGBA8UnormSrgb : TextureFormat::RGBA8Unorm;
+	textureDesc.size = { SlotsPerSide * SlotSize, SlotsPerSide * SlotSize, 1 };
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	mCacheTexture = createTrackedTexture(device, textureDesc, GpuMemoryCategory::Textures, "VirtualTextures");
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Virtual texture page table";
+	bufferDesc.size = MaxPageCount * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+	bufferDesc.mappedAtCreation = false;
+	mPageTableBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Textures, "VirtualTextures");
+
+	bufferDesc.label = "Virtual texture descriptors";
+	bufferDesc.size = MaxTextureCount * sizeof(Descriptor);
+	if (mCacheTexture && mPageTableBuffer) {
+		mDescriptorBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Textures, "VirtualTextures");
+	}
+}
+
+VirtualTextures::~VirtualTextures() {
+	for (Buffer* buffer : { &mDescriptorBuffer, &mPageTableBuffer }) {
+		if (!*buffer) continue;
+		destroyTracked(*buffer);
+		buffer->release();
+	}
+	if (mCacheTexture) {
+		destroyTracked(mCacheTexture);
+		mCacheTexture.release();
+	}
+	mQueue.release();
+}
+
+ResourceCache::TextureHandle VirtualTextures::add(TileFile tiles) {
+	auto free = std::find_if(mTextures.begin(), mTextures.end(), [](const Texture& texture) { return !texture.used; });
+	uint32_t pageOffset = static_cast<uint32_t>(mPageSlots.size());
+	if (free == mTextures.end() || pageOffset + tiles.header.tileCount > MaxPageCount) {
+		std::cerr << "No room left for virtual texture " << tiles.path << std::endl;
+		return nullptr;
+	}
+	uint32_t index = static_cast<uint32_t>(free - mTextures.begin());
+	Texture& texture = *free;
+	texture.used = true;
+	texture.pageCount = tiles.header.tileCount;
+	Descriptor& descriptor = texture.descriptor;
+	descriptor = {};
+	descriptor.size = { tiles.header.width, tiles.header.height };
+	descriptor.pageCount = levelPageCount(descriptor.size, 0);
+	descriptor.levelCount = tiles.header.levelCount;
+	uint32_t offset = pageOffset;
+	for (uint32_t level = 0; level < descriptor.levelCount; ++level) {
+		descriptor.levelOffsets[level] = offset;
+		glm::uvec2 pageCount = levelPageCount(descriptor.size, level);
+		offset += pageCount.x * pageCount.y;
+	}
+	texture.tiles = std::move(tiles);
+	mPageSlots.resize(offset, NoSlot);
+
+	// Its coarsest level, which pages fall back to until theirs are uploaded
+	uint32_t root = offset - 1;
+	uint32_t slot = allocateSlot(true);
+	if (slot == NoSlot) {
+		std::cerr << "No room left for virtual texture " << texture.tiles.path << std::endl;
+		remove(index);
+		return nullptr;
+	}
+	upload(root, slot);
+	mSlots[slot].pinned = true;
+	mDescriptorsDirty = true;
+	writePageTable();
+
+	TextureViewDescriptor viewDesc{};
+	viewDesc.format = mSrgb ? TextureFormat::RGBA8UnormSrgb : TextureFormat::RGBA8Unorm;
+	viewDesc.dimension = TextureViewDimension::_2DArray;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.aspect = TextureAspect::All;
+	ResourceCache::TextureHandle handle = ResourceCache::makeTexture(nullptr, mCacheTexture.createView(viewDesc));
+	handle->virtualTexture = index;
+	texture.handle = handle;
+	std::cout << "Virtual texture " << texture.tiles.path.filename() << ": " << descriptor.size.x << "x" << descriptor.size.y
+		<< ", " << descriptor.levelCount << " levels of " << texture.pageCount << " tiles in all" << std::endl;
+	return handle;
+}
+
+bool VirtualTextures::locate(uint32_t page, uint32_t& texture, uint32_t& level, glm::uvec2& position) const {
+	for (texture = 0; texture < MaxTextureCount; ++texture) {
+		const Texture& candidate = mTextures[texture];
+		const Descriptor& descriptor = candidate.descriptor;
+		if (!candidate.used || page < descriptor.levelOffsets[0] || page >= descriptor.levelOffsets[0] + candidate.pageCount) continue;
+		for (level = descriptor.levelCount - 1; page < descriptor.levelOffsets[level]; --level) {}
+		uint32_t pageCountX = levelPageCount(descriptor.size, level).x;
+		uint32_t index = page - descriptor.levelOffsets[level];
+		position = { index % pageCountX, index / pageCountX };
+		return true;
+	}
+	return false;
+}
+
+void VirtualTextures::request(std::span<const uint32_t> pageRequests) {
+	++mRound;
+	// With their ancestors, finer levels first so that requests reach the root of each texture
+	std::vector<bool> requested(mPageSlots.size(), false);
+	for (uint32_t page = 0; page < requested.size() && page / 32 < pageRequests.size(); ++page) {
+		requested[page] = (pageRequests[page / 32] >> (page % 32) & 1) != 0;
+	}
+	std::vector<std::pair<uint32_t, uint32_t>> missing;
+	for (const Texture& texture : mTextures) {
+		if (!texture.used) continue;
+		const Descriptor& descriptor = texture.descriptor;
+		for (uint32_t level = 0; level < descriptor.levelCount; ++level) {
+			glm::uvec2 pageCount = levelPageCount(descriptor.size, level);
+			glm::uvec2 parentPageCount = levelPageCount(descriptor.size, level + 1);
+			for (uint32_t y = 0; y < pageCount.y; ++y) {
+				for (uint32_t x = 0; x < pageCount.x; ++x) {
+					uint32_t page = descriptor.levelOffsets[level] + y * pageCount.x + x;
+					if (!requested[page]) continue;
+					if (level + 1 < descriptor.levelCount) {
+						requested[descriptor.levelOffsets[level + 1] + (y / 2) * parentPageCount.x + x / 2] = true;
+					}
+					if (mPageSlots[page] != NoSlot) mSlots[mPageSlots[page]].lastUsed = mRound;
+					else missing.emplace_back(level, page);
+				}
+			}
+		}
+	}
+	std::stable_sort(missing.begin(), missing.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+	mPendingPages.clear();
+	for (const auto& [level, page] : missing) mPendingPages.push_back(page);
+}
+
+uint32_t VirtualTextures::allocateSlot(bool evictUsed) {
+	uint32_t oldest = NoSlot;
+	for (uint32_t slot = 0; slot < SlotCount; ++slot) {
+		if (mSlots[slot].page == NoPage) return slot;
+		if (!mSlots[slot].pinned && (oldest == NoSlot || mSlots[slot].lastUsed < mSlots[oldest].lastUsed)) oldest = slot;
+	}
+	if (oldest == NoSlot || (!evictUsed && mSlots[oldest].lastUsed >= mRound)) return NoSlot;
+	mPageSlots[mSlots[oldest].page] = NoSlot;
+	mSlots[oldest].page = NoPage;
+	return oldest;
+}
+
+void VirtualTextures::upload(uint32_t page, uint32_t slot) {
+	uint32_t texture, level;
+	glm::uvec2 position;
+	if (!locate(page, texture, level, position)) return;
+	const Texture& owner = mTextures[texture];
+	ImageCopyTexture destination{};
+	destination.texture = mCacheTexture;
+	destination.mipLevel = 0;
+	destination.origin = { (slot % SlotsPerSide) * SlotSize, (slot / SlotsPerSide) * SlotSize, 0 };
+	destination.aspect = TextureAspect::All;
+	TextureDataLayout source{};
+	source.offset = 0;
+	source.bytesPerRow = 4 * SlotSize;
+	source.rowsPerImage = SlotSize;
+	mQueue.writeTexture(destination, owner.tiles.tile(page - owner.descriptor.levelOffsets[0]), TileBytes, source, { SlotSize, SlotSize, 1 });
+	mUploadedBytes += TileBytes;
+
+	mSlots[slot].page = page;
+	mSlots[slot].lastUsed = mRound;
+	mSlots[slot].pinned = false;
+	mPageSlots[page] = slot;
+	mPageTableDirty = true;
+}
+
+void VirtualTextures::remove(uint32_t index) {
+	Texture& texture = mTextures[index];
+	uint32_t first = texture.descriptor.levelOffsets[0];
+	uint32_t count = texture.pageCount;
+	// Later textures move down the page table, with their tiles
+	for (Slot& slot : mSlots) {
+		if (slot.page == NoPage || slot.page < first) continue;
+		if (slot.page < first + count) slot = Slot{};
+		else slot.page -= count;
+	}
+	mPageSlots.erase(mPageSlots.begin() + first, mPageSlots.begin() + first + count);
+	for (Texture& other : mTextures) {
+		if (!other.used || other.descriptor.levelOffsets[0] < first + count) continue;
+		for (uint32_t level = 0; level < other.descriptor.levelCount; ++level) other.descriptor.levelOffsets[level] -= count;
+	}
+	texture = Texture{};
+	mPendingPages.clear();
+	mPageTableDirty = true;
+	mDescriptorsDirty = true;
+}
+
+bool VirtualTextures::update() {
+	for (uint32_t index = 0; index < MaxTextureCount; ++index) {
+		if (mTextures[index].used && mTextures[index].handle.expired()) remove(index);
+	}
+
+	uint32_t uploadCount = 0;
+	size_t next = 0;
+	for (; next < mPendingPages.size() && uploadCount < MaxTileUploadsPerFrame; ++next) {
+		uint32_t page = mPendingPages[next];
+		if (page >= mPageSlots.size() || mPageSlots[page] != NoSlot) continue;
+		uint32_t slot = allocateSlot(false);
+		// The tiles in view fill the cache
+		if (slot == NoSlot) {
+			next = mPendingPages.size();
+			break;
+		}
+		upload(page, slot);
+		++uploadCount;
+	}
+	mPendingPages.erase(mPendingPages.begin(), mPendingPages.begin() + next);
+
+	bool changed = mPageTableDirty;
+	writePageTable();
+	return changed;
+}
+
+void VirtualTextures::writePageTable() {
+	if (mDescriptorsDirty) {
+		std::vector<Descriptor> descriptors(MaxTextureCount);
+		for (uint32_t index = 0; index < MaxTextureCount; ++index) descriptors[index] = mTextures[index].descriptor;
+		mQueue.writeBuffer(mDescriptorBuffer, 0, descriptors.data(), descriptors.size() * sizeof(Descriptor));
+		mDescriptorsDirty = false;
+	}
+	if (!mPageTableDirty || mPageSlots.empty()) return;
+
+	// Coarsest levels first, each page that is not resident taking the entry of its parent
+	std::vector<uint32_t> entries(mPageSlots.size());
+	for (const Texture& texture : mTextures) {
+		if (!texture.used) continue;
+		const Descriptor& descriptor = texture.descriptor;
+		for (uint32_t level = descriptor.levelCount; level-- > 0;) {
+			glm::uvec2 pageCount = levelPageCount(descriptor.size, level);
+			glm::uvec2 parentPageCount = levelPageCount(descriptor.size, level + 1);
+			for (uint32_t y = 0; y < pageCount.y; ++y) {
+				for (uint32_t x = 0; x < pageCount.x; ++x) {
+					uint32_t page = descriptor.levelOffsets[level] + y * pageCount.x + x;
+					if (mPageSlots[page] != NoSlot) {
+						entries[page] = packPageEntry(mPageSlots[page], level);
+					}
+					else if (level + 1 < descriptor.levelCount) {
+						entries[page] = entries[descriptor.levelOffsets[level + 1] + (y / 2) * parentPageCount.x + x / 2];
+					}
+				}
+			}
+		}
+	}
+	mQueue.writeBuffer(mPageTableBuffer, 0, entries.data(), entries.size() * sizeof(uint32_t));
+	mPageTableDirty = false;
+}
+
+uint32_t VirtualTextures::residentTileCount() const {
+	return static_cast<uint32_t>(std::count_if(mSlots.begin(), mSlots.end(), [](const Slot& slot) { return slot.page != NoPage; }));
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include "MathConfig.h"
+
+#include "MappedFile.h"
+#include "ResourceCache.h"
+#include "ResourceManager.h"
+#include "TextureFeedback.h"
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Textures of any size, sampled through a cache of tiles of fixed size in which only
+ * the tiles that TextureFeedback sees are resident.
+ *
+ * Each texture is read from a pre-tiled file next to its image (see writeTileFile),
+ * holding every level as square tiles of TileSize texels, and a border of Border
+ * texels on each side. The border wraps around the edges of the level like the
+ * Repeat sampler of the materials does, so that bilinear filtering never reads
+ * outside of a tile. Levels stop at the first one that fits in a single tile. The
+ * file is mapped, and tiles are copied from it into the slots of one texture of
+ * SlotsPerSide x SlotsPerSide tiles, which is the view of every virtual texture.
+ *
+ * A page table of one entry per tile of each level of each texture tells the slot
+ * and level of the tile to sample for the page: its own tile when it is resident,
+ * otherwise that of its nearest resident ancestor, the single tile of the coarsest
+ * level of each texture never being evicted. It is rebuilt on the CPU when tiles
+ * come and go, and bound with the descriptors of the textures to every material
+ * (see VIRTUAL_TEXTURES in resources/shader.wgsl).
+ *
+ * The feedback pass sets one bit per page sampled, at the level the footprint of
+ * the fragment asks for, which request() takes with the ancestors of each page.
+ * Missing pages are then uploaded coarsest first, MaxTileUploadsPerFrame per frame,
+ * into free slots or those of the tiles that were seen the longest ago. Tiles seen
+ * by the last feedback are never evicted: when the cache is too small for what is
+ * on screen, coarser levels are sampled instead.
+ *
+ * To be used from the device thread, except for the static functions.
+ */
+class VirtualTextures {
+public:
+	static constexpr uint32_t TileSize = 128;
+	static constexpr uint32_t Border = 4;
+	// Tiles with their border, as stored and in the cache
+	static constexpr uint32_t SlotSize = TileSize + 2 * Border;
+	static constexpr uint32_t SlotsPerSide = 16;
+	static constexpr uint32_t MaxLevelCount = 16;
+	static constexpr uint32_t MaxTextureCount = 64;
+	// Pages of all the textures together, as many as the feedback has bits for
+	static constexpr uint32_t MaxPageCount = TextureFeedback::MaxPageCount;
+	static constexpr uint32_t MaxTileUploadsPerFrame = 16;
+
+	/**
+	 * The VirtualTexture structure of the shader
+	 */
+	struct Descriptor {
+		// Texels of level 0
+		glm::uvec2 size;
+		// Pages of level 0 on each side
+		glm::uvec2 pageCount;
+		uint32_t levelCount;
+		// First entry of each level in the page table, finest first
+		uint32_t levelOffsets[MaxLevelCount];
+		uint32_t _pad;
+	};
+	static_assert(sizeof(Descriptor) % 8 == 0);
+
+	/**
+	 * Header of a pre-tiled file, followed by the tiles of level 0 row by row, then those of
+	 * level 1, etc. as SlotSize x SlotSize RGBA8 texels each
+	 */
+	struct TileFileHeader {
+		char magic[8];
+		uint32_t width;
+		uint32_t height;
+		uint32_t tileSize;
+		uint32_t border;
+		uint32_t levelCount;
+		uint32_t tileCount;
+	};
+	static_assert(sizeof(TileFileHeader) == 32);
+
+	/**
+	 * A mapped pre-tiled file
+	 */
+	struct TileFile {
+		MappedFile file;
+		TileFileHeader header{};
+		std::filesystem::path path;
+
+		const std::byte* tile(uint32_t index) const;
+	};
+
+	// Where the tiles of the image at `path` loaded with `options` are stored, as
+	// `<name>.vt[-srgb][-alpha].tiles`, the options changing the filtered levels
+	static std::filesystem::path tileFilePath(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options);
+
+	// Map the tiles that writeTileFile() stored for the image at `path`, unless the image
+	// changed since. Safe to call from any thread.
+	static bool loadTileFile(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, TileFile& tiles);
+
+	// Cut `image`, loaded from `path` with `options`, into the tiles of each of its levels and
+	// store them next to it, building its mip-maps if needed. Safe to call from any thread.
+	static bool writeTileFile(const std::filesystem::path& path, const ResourceManager::TextureLoadOptions& options, ResourceManager::Image& image);
+
+	// With a cache whose view decodes sRGB colors if `srgb`, as the texture load options say
+	VirtualTextures(wgpu::Device device, bool srgb);
+	~VirtualTextures();
+
+	VirtualTextures(const VirtualTextures&) = delete;
+	VirtualTextures& operator=(const VirtualTextures&) = delete;
+
+	bool valid() const { return mDescriptorBuffer != nullptr; }
+
+	// Bound with the materials
+	wgpu::Buffer pageTableBuffer() const { return mPageTableBuffer; }
+	wgpu::Buffer descriptorBuffer() const { return mDescriptorBuffer; }
+
+	// Add the texture of `tiles`, the tile of its coarsest level being uploaded right away.
+	// Return a handle with the view of the cache and the index of the texture, which is
+	// removed once the last copy of the handle is released, or nullptr if there is no room.
+	ResourceCache::TextureHandle add(TileFile tiles);
+
+	// Take the bits of the pages that the last feedback pass requested, in the order of the
+	// page table, which may have changed since for a texture removed meanwhile
+	void request(std::span<const uint32_t> pageRequests);
+
+	// Remove the textures that were released, upload some of the missing tiles and write the
+	// page table if it changed. Return whether any tile did.
+	bool update();
+
+	uint64_t uploadedBytes() const { return mUploadedBytes; }
+	uint32_t residentTileCount() const;
+
+private:
+	static constexpr uint32_t NoSlot = UINT32_MAX;
+	static constexpr uint32_t NoPage = UINT32_MAX;
+	static constexpr uint32_t SlotCount = SlotsPerSide * SlotsPerSide;
+
+	struct Texture {
+		std::weak_ptr<ResourceCache::Texture> handle;
+		TileFile tiles;
+		Descriptor descriptor{};
+		// Entries of the page table, from descriptor.levelOffsets[0]
+		uint32_t pageCount = 0;
+		bool used = false;
+	};
+
+	struct Slot {
+		// Index in the page table of the tile held, if any
+		uint32_t page = NoPage;
+		// Feedback round in which the tile was last requested
+		uint64_t lastUsed = 0;
+		// The tile of the coarsest level, always resident
+		bool pinned = false;
+	};
+
+	// Texture and level of the page table entry `page`, and its position in the level
+	bool locate(uint32_t page, uint32_t& texture, uint32_t& level, glm::uvec2& position) const;
+	// Slot that a new tile goes to, free or evicted, or NoSlot if all hold tiles in use
+	uint32_t allocateSlot(bool evictUsed);
+	void upload(uint32_t page, uint32_t slot);
+	void remove(uint32_t texture);
+	void writePageTable();
+
+private:
+	wgpu::Device mDevice;
+	wgpu::Queue mQueue;
+	bool mSrgb = false;
+
+	wgpu::Texture mCacheTexture = nullptr;
+	wgpu::Buffer mPageTableBuffer = nullptr;
+	wgpu::Buffer mDescriptorBuffer = nullptr;
+
+	std::array<Texture, MaxTextureCount> mTextures;
+	std::array<Slot, SlotCount> mSlots;
+	// Slot of each page of the page table, or NoSlot
+	std::vector<uint32_t> mPageSlots;
+	// Requested pages that are not resident, coarsest first
+	std::vector<uint32_t> mPendingPages;
+	uint64_t mRound = 1;
+	bool mPageTableDirty = false;
+	bool mDescriptorsDirty = false;
+	uint64_t mUploadedBytes = 0;
+};
@@ -0,0 +1,131 @@
+#include "WeightedBlendedOit.h"
+#include "FullscreenTriangle.h"
+
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+const char* compositeShaderSource = R"(
+@group(0) @binding(0) var accumulation: texture_2d<f32>;
+@group(0) @binding(1) var revealage: texture_2d<f32>;
+
+@fragment
+fn fs_main(@builtin(position) position: vec4f) -> @location(0) vec4f {
+	let texel = vec2i(position.xy);
+	let reveal = textureLoad(revealage, texel, 0).r;
+	// Texels no transparent fragment covers are left as they are
+	if (reveal >= 1.0) {
+		discard;
+	}
+	let accumulated = textureLoad(accumulation, texel, 0);
+	// Weights may sum up beyond what half floats hold
+	let average = accumulated.rgb / clamp(accumulated.a, 1e-4, 5e4);
+	return vec4f(average, 1.0 - reveal);
+}
+)";
+
+} // anonymous namespace
+
+WeightedBlendedOit::WeightedBlendedOit(Device device, PipelineCache& pipelineCache, TextureFormat targetFormat)
+	: mDevice(device)
+{
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(2, Default);
+	for (uint32_t i = 0; i < 2; ++i) {
+		bindingLayoutEntries[i].binding = i;
+		bindingLayoutEntries[i].visibility = ShaderStage::Fragment;
+		bindingLayoutEntries[i].texture.sampleType = TextureSampleType::Float;
+		bindingLayoutEntries[i].texture.viewDimension = TextureViewDimension::_2D;
+	}
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	mBindGroupLayout = pipelineCache.bindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&mBindGroupLayout;
+
+	ShaderModule shaderModule = pipelineCache.shaderModule(std::string(FullscreenTriangle::VertexShaderSource) + compositeShaderSource);
+
+	RenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = pipelineCache.pipelineLayout(layoutDesc);
+	FullscreenTriangle::setPipelineStates(pipelineDesc, shaderModule);
+
+	// Over the scene by the coverage of the transparent fragments, its alpha left as is
+	BlendState blendState{};
+	blendState.color.srcFactor = BlendFactor::SrcAlpha;
+	blendState.color.dstFactor = BlendFactor::OneMinusSrcAlpha;
+	blendState.color.operation = BlendOperation::Add;
+	blendState.alpha.srcFactor = BlendFactor::Zero;
+	blendState.alpha.dstFactor = BlendFactor::One;
+	blendState.alpha.operation = BlendOperation::Add;
+
+	FragmentState fragmentState{};
+	fragmentState.module = shaderModule;
+	fragmentState.entryPoint = "fs_main";
+	fragmentState.constantCount = 0;
+	fragmentState.constants = nullptr;
+	ColorTargetState colorTarget{};
+	colorTarget.format = targetFormat;
+	colorTarget.blend = &blendState;
+	colorTarget.writeMask = ColorWriteMask::All;
+	fragmentState.targetCount = 1;
+	fragmentState.targets = &colorTarget;
+	pipelineDesc.fragment = &fragmentState;
+
+	mPipeline = pipelineCache.renderPipelineAsync(pipelineDesc);
+}
+
+WeightedBlendedOit::~WeightedBlendedOit() {
+	if (mBindGroup) mBindGroup.release();
+}
+
+bool WeightedBlendedOit::composite(
+	CommandEncoder encoder,
+	TextureView accumulationView, TextureView revealageView,
+	TextureView targetView, uint32_t width, uint32_t height,
+	const RenderPassTimestampWrites* timestampWrites
+) {
+	if (!ready()) return false;
+
+	if (accumulationView != mAccumulationView || revealageView != mRevealageView) {
+		if (mBindGroup) mBindGroup.release();
+		std::vector<BindGroupEntry> bindings(2);
+		bindings[0].binding = 0;
+		bindings[0].textureView = accumulationView;
+		bindings[1].binding = 1;
+		bindings[1].textureView = revealageView;
+		BindGroupDescriptor bindGroupDesc{};
+		bindGroupDesc.layout = mBindGroupLayout;
+		bindGroupDesc.entryCount = (uint32_t)bindings.size();
+		bindGroupDesc.entries = bindings.data();
+		mBindGroup = mDevice.createBindGroup(bindGroupDesc);
+		mAccumulationView = accumulationView;
+		mRevealageView = revealageView;
+	}
+
+	RenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = targetView;
+	colorAttachment.resolveTarget = nullptr;
+	colorAttachment.loadOp = LoadOp::Load;
+	colorAttachment.storeOp = StoreOp::Store;
+	colorAttachment.clearValue = Color{ 0.0, 0.0, 0.0, 1.0 };
+#ifndef WEBGPU_BACKEND_WGPU
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif // ! WGPU BACKEND
+
+	RenderPassDescriptor renderPassDesc{};
+	renderPassDesc.label = "Transparency composite";
+	renderPassDesc.colorAttachmentCount = 1;
+	renderPassDesc.colorAttachments = &colorAttachment;
+	renderPassDesc.depthStencilAttachment = nullptr;
+	renderPassDesc.timestampWrites = timestampWrites;
+	RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+	FullscreenTriangle::draw(renderPass, mPipeline->pipeline, mBindGroup, width, height);
+	renderPass.end();
+	renderPass.release();
+	return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+
+#include <cstdint>
+
+/**
+ * Composite of weighted blended order-independent transparency (McGuire and
+ * Bavoil, 2013), for transparent draws that are not sorted.
+ *
+ * Transparent fragments are drawn in any order into two targets cleared by the
+ * caller: the accumulation, to which each one adds its premultiplied color and
+ * its alpha scaled by a weight falling off with depth, and the revealage, which
+ * each one multiplies by 1 - alpha. The composite then blends the average color
+ * of the accumulation over the scene, by the coverage 1 - revealage. Nearer and
+ * more opaque fragments weigh more, which approximates their order without
+ * sorting them, and is exact when all of them have the same color.
+ */
+class WeightedBlendedOit {
+public:
+	// Formats of the targets the transparent draws write, both of which blend and resolve
+	static constexpr wgpu::TextureFormat AccumulationFormat = wgpu::TextureFormat::RGBA16Float;
+	static constexpr wgpu::TextureFormat RevealageFormat = wgpu::TextureFormat::R8Unorm;
+
+	// Composite over color attachments of `targetFormat`
+	WeightedBlendedOit(wgpu::Device device, PipelineCache& pipelineCache, wgpu::TextureFormat targetFormat);
+	~WeightedBlendedOit();
+
+	WeightedBlendedOit(const WeightedBlendedOit&) = delete;
+	WeightedBlendedOit& operator=(const WeightedBlendedOit&) = delete;
+
+	// Whether the pipeline is built, before which composite() records nothing
+	bool ready() const { return mPipeline->ready(); }
+
+	// Blend the transparent fragments accumulated into the `width` x `height` texels in the top left
+	// corner of `accumulationView` and `revealageView` over the same texels of `targetView`, in a
+	// pass of its own, or return false if not ready
+	bool composite(
+		wgpu::CommandEncoder encoder,
+		wgpu::TextureView accumulationView, wgpu::TextureView revealageView,
+		wgpu::TextureView targetView, uint32_t width, uint32_t height,
+		const wgpu::RenderPassTimestampWrites* timestampWrites = nullptr
+	);
+
+private:
+	wgpu::Device mDevice;
+	// Owned by the pipeline cache
+	wgpu::BindGroupLayout mBindGroupLayout = nullptr;
+	PipelineCache::AsyncRenderPipeline mPipeline;
+	// Bind group of the last targets, which keeps them alive
+	wgpu::TextureView mAccumulationView = nullptr;
+	wgpu::TextureView mRevealageView = nullptr;
+	wgpu::BindGroup mBindGroup = nullptr;
+};
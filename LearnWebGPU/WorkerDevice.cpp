@@ -0,0 +1,86 @@
+#include "WorkerDevice.h"
+#include "Benchmark.h"
+#include "DeviceEvents.h"
+#include "LimitsNegotiator.h"
+#include "Log.h"
+#include "webgpu-utils.h"
+
+#include <cstring>
+#include <iostream>
+
+using namespace wgpu;
+
+bool WorkerDevice::parsePlacement(const char* str, Placement& placement) {
+	if (std::strcmp(str, "same") == 0) placement = Placement::SameAdapter;
+	else if (std::strcmp(str, "low-power") == 0) placement = Placement::LowPower;
+	else if (std::strcmp(str, "high-performance") == 0) placement = Placement::HighPerformance;
+	else return false;
+	return true;
+}
+
+std::unique_ptr<WorkerDevice> WorkerDevice::create(Instance instance, Adapter interactiveAdapter, Placement placement) {
+	Adapter adapter = interactiveAdapter;
+	if (placement != Placement::SameAdapter) {
+		RequestAdapterOptions adapterOpts{};
+		adapterOpts.compatibleSurface = nullptr;
+		adapterOpts.powerPreference = placement == Placement::LowPower ? PowerPreference::LowPower : PowerPreference::HighPerformance;
+		adapter = requestAdapterSync(instance, &adapterOpts);
+		if (!adapter) {
+			std::cerr << "Could not get an adapter for the worker device" << std::endl;
+			return nullptr;
+		}
+	}
+	AdapterDescription description = AdapterDescription::of(adapter);
+
+	// Jobs take meshes and images as large as the adapter goes, and nothing else beyond the defaults
+	SupportedLimits supportedLimits;
+	adapter.getLimits(&supportedLimits);
+	LimitsNegotiator negotiator(supportedLimits.limits);
+	Limits preferred;
+	preferred.maxBufferSize = negotiator.supported().maxBufferSize;
+	preferred.maxStorageBufferBindingSize = negotiator.supported().maxStorageBufferBindingSize;
+	preferred.maxTextureDimension2D = negotiator.supported().maxTextureDimension2D;
+	negotiator.request("background jobs", Limits{}, preferred);
+	RequiredLimits requiredLimits = Default;
+	requiredLimits.limits = negotiator.required();
+
+	std::unique_ptr<WorkerDevice> workerDevice(new WorkerDevice());
+	DeviceDescriptor deviceDesc{};
+	deviceDesc.label = "Worker device";
+	deviceDesc.requiredFeatureCount = 0;
+	deviceDesc.requiredFeatures = nullptr;
+	deviceDesc.requiredLimits = &requiredLimits;
+	deviceDesc.defaultQueue.nextInChain = nullptr;
+	deviceDesc.defaultQueue.label = "Worker queue";
+	deviceDesc.deviceLostCallback = [](WGPUDeviceLostReason reason, char const* message, void* pUserData) {
+		// Called from within the driver, which must not wait on the console
+		if (reason == WGPUDeviceLostReason_Destroyed) return;
+		LOG_ERROR("Worker device lost: reason " << reason << (message ? " (" : "") << (message ? message : "") << (message ? ")" : ""));
+		reinterpret_cast<WorkerDevice*>(pUserData)->mLost = true;
+	};
+	deviceDesc.deviceLostUserdata = workerDevice.get();
+	Device device = requestDeviceSync(adapter, &deviceDesc);
+	if (placement != Placement::SameAdapter) adapter.release();
+	if (!device) {
+		std::cerr << "Could not get the worker device" << std::endl;
+		return nullptr;
+	}
+
+	workerDevice->mDevice = device;
+	workerDevice->mErrorCallback = device.setUncapturedErrorCallback([](ErrorType type, char const* message) {
+		LOG_ERROR("Uncaptured worker device error: type " << WGPUErrorType(type) << (message ? " (" : "") << (message ? message : "") << (message ? ")" : ""));
+	});
+	workerDevice->mPipelineCache = std::make_unique<PipelineCache>(device);
+	DeviceEvents::addDevice(device);
+	std::cout << "Background GPU jobs run on a worker device of " << description.name
+		<< (placement == Placement::SameAdapter ? ", the interactive adapter" : "") << std::endl;
+	return workerDevice;
+}
+
+WorkerDevice::~WorkerDevice() {
+	if (!mDevice) return;
+	mPipelineCache.reset();
+	DeviceEvents::removeDevice(mDevice);
+	mErrorCallback.reset();
+	mDevice.release();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+
+#include <atomic>
+#include <memory>
+
+/**
+ * A second device for the long GPU jobs of the background: baking the lighting of
+ * meshes (LightBaker), compressing textures (TextureCompressor) and prefiltering
+ * environments (EnvironmentLighting). On the device drawing the frames, their
+ * submissions queue up with those of the frames, which then miss their budget
+ * for as long as a job runs.
+ *
+ * The device is either a second one of the adapter of the interactive device,
+ * whose queue the driver schedules alongside the other, or one of another adapter,
+ * e.g. the integrated GPU of a machine drawing with the discrete one. Jobs never
+ * share GPU objects with the interactive device: they read their results back to
+ * the CPU, from which the interactive device uploads them, usually through the
+ * on-disk caches of baked lighting, compressed textures and environments, as it
+ * would on later runs.
+ *
+ * Its events are processed by DeviceEvents::dispatch(), its jobs thus resuming on
+ * the device thread like the others. When it is lost, its jobs fail and fall back
+ * as they do on failed readbacks. Not available on the web, whose pages get one
+ * adapter.
+ */
+class WorkerDevice {
+public:
+	/**
+	 * Adapter the device is requested from
+	 */
+	enum class Placement {
+		// The adapter of the interactive device
+		SameAdapter,
+		// The adapter the system prefers for low power, e.g. the integrated GPU
+		LowPower,
+		HighPerformance,
+	};
+
+	// Parse "same", "low-power" or "high-performance"
+	static bool parsePlacement(const char* str, Placement& placement);
+
+	// Request the device, synchronously, or return null if the adapter or the device cannot be
+	// had. `interactiveAdapter` is the adapter of the interactive device.
+	static std::unique_ptr<WorkerDevice> create(wgpu::Instance instance, wgpu::Adapter interactiveAdapter, Placement placement);
+
+	// Wait for the pipelines being built, then release the device
+	~WorkerDevice();
+
+	WorkerDevice(const WorkerDevice&) = delete;
+	WorkerDevice& operator=(const WorkerDevice&) = delete;
+
+	wgpu::Device device() const { return mDevice; }
+	// Of the objects of this device, distinct from those of the interactive device
+	PipelineCache& pipelineCache() { return *mPipelineCache; }
+
+	// Whether the device was lost, e.g. after a reset of its GPU
+	bool lost() const { return mLost; }
+
+private:
+	WorkerDevice() = default;
+
+private:
+	wgpu::Device mDevice = nullptr;
+	std::unique_ptr<PipelineCache> mPipelineCache;
+	std::unique_ptr<wgpu::ErrorCallback> mErrorCallback;
+	// Set from the thread of the driver
+	std::atomic<bool> mLost = false;
+};
@@ -0,0 +1,303 @@
+#include "WorkgroupTuner.h"
+#include "Benchmark.h"
+#include "GpuMemory.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <utility>
+
+using namespace wgpu;
+
+namespace {
+
+constexpr std::string_view FirstLine = "LearnWebGPU workgroup sizes 1";
+
+uint64_t hashString(std::string_view text, uint64_t hash = 0xcbf29ce484222325ull) {
+	for (char c : text) {
+		hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// Everything that may change the fastest sizes: the GPU, its driver and the backend
+uint64_t adapterKey(const AdapterDescription& adapter) {
+	std::ostringstream description;
+	description << adapter.vendor << '\n' << adapter.architecture << '\n' << adapter.name << '\n' << adapter.driver << '\n'
+		<< adapter.vendorId << ' ' << adapter.deviceId << ' ' << static_cast<int>(adapter.adapterType) << ' ' << static_cast<int>(adapter.backendType);
+	return hashString(description.str());
+}
+
+bool parseSizes(std::string_view text, std::vector<uint32_t>& sizes) {
+	while (!text.empty()) {
+		size_t comma = std::min(text.find(','), text.size());
+		uint32_t size = 0;
+		auto result = std::from_chars(text.data(), text.data() + comma, size);
+		if (result.ec != std::errc() || result.ptr != text.data() + comma || size == 0) return false;
+		sizes.push_back(size);
+		text.remove_prefix(std::min(comma + 1, text.size()));
+	}
+	return !sizes.empty();
+}
+
+double median(std::vector<double> durations) {
+	std::nth_element(durations.begin(), durations.begin() + durations.size() / 2, durations.end());
+	return durations[durations.size() / 2];
+}
+
+} // anonymous namespace
+
+WorkgroupTuner::WorkgroupTuner(Device device, PipelineCache& pipelineCache, const AdapterDescription& adapter, std::filesystem::path path, uint32_t maxPassCount)
+	: mPipelineCache(pipelineCache)
+	, mPath(std::move(path))
+	, mMaxPassCount(std::max(maxPassCount, 1u))
+	, mAdapterKey(adapterKey(adapter))
+{
+	SupportedLimits supportedLimits;
+	device.getLimits(&supportedLimits);
+	mLimits = supportedLimits.limits;
+	load();
+
+	if (!device.hasFeature(FeatureName::TimestampQuery)) return;
+
+	QuerySetDescriptor querySetDesc{};
+	querySetDesc.label = "Workgroup tuner timestamps";
+	querySetDesc.type = QueryType::Timestamp;
+	querySetDesc.count = 2 * mMaxPassCount;
+	mQuerySet = device.createQuerySet(querySetDesc);
+
+	BufferDescriptor bufferDesc{};
+	bufferDesc.label = "Workgroup tuner resolve buffer";
+	bufferDesc.size = querySetDesc.count * sizeof(uint64_t);
+	bufferDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+	bufferDesc.mappedAtCreation = false;
+	mResolveBuffer = createTrackedBuffer(device, bufferDesc, GpuMemoryCategory::Staging, "WorkgroupTuner");
+
+	mReadbacks = ReadbackPool(device, 2, bufferDesc.size, "Workgroup tuner readback buffer", "WorkgroupTuner");
+	mPasses.resize(mReadbacks.slotCount());
+}
+
+WorkgroupTuner::~WorkgroupTuner() {
+	if (!enabled()) return;
+
+	destroyTracked(mResolveBuffer);
+	mResolveBuffer.release();
+	mQuerySet.destroy();
+	mQuerySet.release();
+}
+
+std::shared_ptr<const WorkgroupTuner::Kernel> WorkgroupTuner::kernel(const std::string& name, const ComputePipelineDescriptor& descriptor, const std::vector<uint32_t>& workgroupSizes, uint32_t workgroupStoragePerInvocation) {
+	std::shared_ptr<Kernel>& entry = mKernels[name];
+	if (!entry) {
+		entry = std::make_shared<Kernel>();
+		entry->mName = name;
+	}
+	Kernel& kernel = *entry;
+
+	// The default is kept whatever the limits, the device being created with those it needs
+	std::vector<uint32_t> sizes;
+	for (uint32_t size : workgroupSizes) {
+		bool fits = size <= mLimits.maxComputeWorkgroupSizeX && size <= mLimits.maxComputeInvocationsPerWorkgroup
+			&& uint64_t(size) * workgroupStoragePerInvocation <= mLimits.maxComputeWorkgroupStorageSize;
+		if (sizes.empty() || (fits && std::find(sizes.begin(), sizes.end(), size) == sizes.end())) sizes.push_back(size);
+	}
+
+	// Constants of the descriptor, with the workgroup size added
+	std::vector<WGPUConstantEntry> constants(descriptor.compute.constants, descriptor.compute.constants + descriptor.compute.constantCount);
+	constants.push_back({});
+	auto build = [&](uint32_t workgroupSize) {
+		constants.back().nextInChain = nullptr;
+		constants.back().key = "workgroupSize";
+		constants.back().value = static_cast<double>(workgroupSize);
+		ComputePipelineDescriptor pipelineDesc = descriptor;
+		pipelineDesc.compute.constantCount = constants.size();
+		pipelineDesc.compute.constants = constants.data();
+		return mPipelineCache.computePipelineAsync(pipelineDesc);
+	};
+
+	kernel.mWorkgroupSizes = sizes;
+	kernel.mCandidates.clear();
+	auto saved = mSavedSizes.find({ mAdapterKey, name });
+	if (saved != mSavedSizes.end() && saved->second.workgroupSizes == sizes) {
+		kernel.mWorkgroupSize = saved->second.workgroupSize;
+	}
+	else {
+		kernel.mWorkgroupSize = sizes[0];
+		if (enabled() && sizes.size() > 1) {
+			for (uint32_t size : sizes) {
+				kernel.mCandidates.push_back({ size, build(size), {} });
+			}
+		}
+	}
+	kernel.mPipeline = build(kernel.mWorkgroupSize);
+	return entry;
+}
+
+void WorkgroupTuner::beginFrame() {
+	if (!enabled()) return;
+
+	for (uint32_t slot = 0; slot < mReadbacks.slotCount(); ++slot) {
+		if (mReadbacks.state(slot) == ReadbackPool::State::Mapped) addDurations(slot);
+	}
+
+	bool tuning = false;
+	for (auto& [name, kernel] : mKernels) {
+		bool measured = std::all_of(kernel->mCandidates.begin(), kernel->mCandidates.end(), [](const Kernel::Candidate& candidate) {
+			return candidate.durations.size() >= SampleCount || candidate.failed();
+		});
+		if (kernel->tuning() && measured) pick(*kernel);
+		tuning = tuning || kernel->tuning();
+	}
+
+	// A frame that was not resolved (e.g., it had no surface texture) leaves its buffer to the next one
+	if (mCurrent != ReadbackPool::NoSlot && mReadbacks.state(mCurrent) == ReadbackPool::State::Recording) {
+		mReadbacks.cancel(mCurrent);
+	}
+	mCurrent = ReadbackPool::NoSlot;
+	if (!tuning) return;
+	mCurrent = mReadbacks.reserve();
+	if (mCurrent != ReadbackPool::NoSlot) mPasses[mCurrent].clear();
+}
+
+std::vector<WorkgroupTuner::Measurement> WorkgroupTuner::measure(const Kernel& kernel) {
+	std::vector<Measurement> measurements;
+	if (mCurrent == ReadbackPool::NoSlot || !kernel.tuning()) return measurements;
+	auto it = mKernels.find(kernel.mName);
+	if (it == mKernels.end() || it->second.get() != &kernel) return measurements;
+
+	std::vector<Kernel::Candidate>& candidates = it->second->mCandidates;
+	std::vector<std::pair<Kernel*, size_t>>& passes = mPasses[mCurrent];
+	for (size_t c = 0; c < candidates.size() && passes.size() < mMaxPassCount; ++c) {
+		if (candidates[c].durations.size() >= SampleCount || !candidates[c].pipeline->ready()) continue;
+		uint32_t firstQuery = static_cast<uint32_t>(2 * passes.size());
+		Measurement& measurement = measurements.emplace_back();
+		measurement.pipeline = candidates[c].pipeline->pipeline;
+		measurement.workgroupSize = candidates[c].workgroupSize;
+		measurement.timestampWrites.querySet = mQuerySet;
+		measurement.timestampWrites.beginningOfPassWriteIndex = firstQuery;
+		measurement.timestampWrites.endOfPassWriteIndex = firstQuery + 1;
+		passes.emplace_back(it->second.get(), c);
+	}
+	return measurements;
+}
+
+void WorkgroupTuner::resolve(CommandEncoder encoder) {
+	if (mCurrent == ReadbackPool::NoSlot || mPasses[mCurrent].empty()) return;
+	uint32_t queryCount = static_cast<uint32_t>(2 * mPasses[mCurrent].size());
+	encoder.resolveQuerySet(mQuerySet, 0, queryCount, mResolveBuffer, 0);
+	encoder.copyBufferToBuffer(mResolveBuffer, 0, mReadbacks.buffer(mCurrent), 0, queryCount * sizeof(uint64_t));
+}
+
+void WorkgroupTuner::readBack() {
+	if (mCurrent == ReadbackPool::NoSlot) return;
+	uint32_t slot = std::exchange(mCurrent, ReadbackPool::NoSlot);
+	if (mPasses[slot].empty()) {
+		mReadbacks.cancel(slot);
+		return;
+	}
+	mReadbacks.map(slot, 2 * mPasses[slot].size() * sizeof(uint64_t));
+}
+
+void WorkgroupTuner::addDurations(uint32_t slot) {
+	const std::vector<std::pair<Kernel*, size_t>>& passes = mPasses[slot];
+	size_t passCount = passes.size();
+	const uint64_t* timestamps = static_cast<const uint64_t*>(mReadbacks.mappedRange(slot, 2 * passCount * sizeof(uint64_t)));
+	for (size_t i = 0; i < passCount; ++i) {
+		auto [kernel, c] = passes[i];
+		// Candidates changed if the kernel was registered again, or picked meanwhile
+		if (c >= kernel->mCandidates.size()) continue;
+		// Timestamps are in nanoseconds, and may not increase within a pass on some implementations
+		uint64_t begin = timestamps[2 * i];
+		uint64_t end = timestamps[2 * i + 1];
+		if (end > begin) kernel->mCandidates[c].durations.push_back(static_cast<double>(end - begin) * 1e-6);
+	}
+	mReadbacks.release(slot);
+}
+
+void WorkgroupTuner::pick(Kernel& kernel) {
+	// Medians, for the frames where something else slowed the GPU down not to count
+	const Kernel::Candidate* best = nullptr;
+	double bestMs = 0.0;
+	std::ostringstream timings;
+	timings << std::fixed << std::setprecision(3);
+	for (const Kernel::Candidate& candidate : kernel.mCandidates) {
+		if (candidate.failed() || candidate.durations.empty()) continue;
+		double ms = median(candidate.durations);
+		timings << (best ? ", " : "") << candidate.workgroupSize << ": " << ms << " ms";
+		if (!best || ms < bestMs) {
+			best = &candidate;
+			bestMs = ms;
+		}
+	}
+	if (!best) {
+		kernel.mCandidates.clear();
+		return;
+	}
+	std::cout << "Workgroup size of " << kernel.mName << " tuned to " << best->workgroupSize << " (" << timings.str() << ")" << std::endl;
+
+	kernel.mWorkgroupSize = best->workgroupSize;
+	kernel.mPipeline = best->pipeline;
+	kernel.mCandidates.clear();
+	mSavedSizes[{ mAdapterKey, kernel.mName }] = { kernel.mWorkgroupSize, kernel.mWorkgroupSizes };
+	save();
+}
+
+bool WorkgroupTuner::load() {
+	std::ifstream file(mPath);
+	if (!file) return false;
+	std::string line;
+	if (!std::getline(file, line) || line != FirstLine) {
+		std::cerr << "Ignoring invalid workgroup sizes " << mPath << std::endl;
+		return false;
+	}
+
+	// Adapter key, workgroup size and candidates are separated by single spaces, the kernel
+	// name taking the rest
+	while (std::getline(file, line)) {
+		if (line.empty()) continue;
+		std::string_view rest = line;
+		std::string_view fields[3];
+		bool valid = true;
+		for (std::string_view& field : fields) {
+			size_t space = rest.find(' ');
+			if (space == std::string_view::npos) {
+				valid = false;
+				break;
+			}
+			field = rest.substr(0, space);
+			rest.remove_prefix(space + 1);
+		}
+		uint64_t adapter = 0;
+		SavedSize saved;
+		valid = valid && fields[0].size() == 16
+			&& std::from_chars(fields[0].data(), fields[0].data() + 16, adapter, 16).ptr == fields[0].data() + 16
+			&& std::from_chars(fields[1].data(), fields[1].data() + fields[1].size(), saved.workgroupSize).ptr == fields[1].data() + fields[1].size()
+			&& parseSizes(fields[2], saved.workgroupSizes)
+			&& std::find(saved.workgroupSizes.begin(), saved.workgroupSizes.end(), saved.workgroupSize) != saved.workgroupSizes.end()
+			&& !rest.empty();
+		if (!valid) {
+			std::cerr << "Ignoring invalid line of " << mPath << ": " << line << std::endl;
+			continue;
+		}
+		mSavedSizes[{ adapter, std::string(rest) }] = std::move(saved);
+	}
+	return true;
+}
+
+bool WorkgroupTuner::save() const {
+	return writeFileAtomically(mPath, [&](std::ostream& file) {
+		file << FirstLine << '\n';
+		for (const auto& [key, saved] : mSavedSizes) {
+			file << std::hex << std::setfill('0') << std::setw(16) << key.first << std::dec << ' ' << saved.workgroupSize << ' ';
+			for (size_t i = 0; i < saved.workgroupSizes.size(); ++i) {
+				file << (i > 0 ? "," : "") << saved.workgroupSizes[i];
+			}
+			file << ' ' << key.second << '\n';
+		}
+		return true;
+	});
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include "PipelineCache.h"
+#include "ReadbackPool.h"
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct AdapterDescription;
+
+/**
+ * Workgroup sizes of compute kernels chosen for the adapter actually present, by
+ * measuring them: the fastest size of a kernel changes from one GPU to the next
+ * with the width of its SIMD units, its occupancy and its caches.
+ *
+ * A kernel declares its workgroup size as the override constant `workgroupSize`
+ * and is registered with kernel(), along with the sizes it supports, the first
+ * one being its default. It then always dispatches with the pipeline and the size
+ * of its Kernel, those of the default until the size is tuned.
+ *
+ * A kernel this adapter never measured is built with each candidate size, and the
+ * frames that record it also record, before its own pass, one pass per candidate
+ * got from measure(), with timestamps around it. These passes process the data of
+ * the frame, which the pass of the kernel then writes again, so kernels must give
+ * the same result when recorded twice. Once each candidate has SampleCount
+ * durations, the one of lowest median wins: the Kernel switches to it, and it is
+ * saved with the adapter next to the pipeline manifest, for later sessions on the
+ * same adapter to start with it. Sizes are measured again when the candidates of a
+ * kernel change, or on another adapter or driver.
+ *
+ * Without the TimestampQuery feature, kernels keep the sizes saved earlier, if any,
+ * or their default. Like the rest of the device, it must only be used from the
+ * device thread, except for recording the measurements it returns.
+ */
+class WorkgroupTuner {
+public:
+	// Durations measured per candidate size
+	static constexpr uint32_t SampleCount = 15;
+
+	/**
+	 * A compute kernel, to dispatch with pipeline() in workgroups of workgroupSize()
+	 */
+	class Kernel {
+	public:
+		const std::string& name() const { return mName; }
+		const PipelineCache::AsyncComputePipeline& pipeline() const { return mPipeline; }
+		uint32_t workgroupSize() const { return mWorkgroupSize; }
+		// Workgroups of a dispatch of one invocation per item
+		uint32_t workgroupCount(uint32_t itemCount) const { return (itemCount + mWorkgroupSize - 1) / mWorkgroupSize; }
+		// Whether candidate sizes are still being measured
+		bool tuning() const { return !mCandidates.empty(); }
+
+	private:
+		friend class WorkgroupTuner;
+
+		struct Candidate {
+			uint32_t workgroupSize = 0;
+			PipelineCache::AsyncComputePipeline pipeline;
+			// In milliseconds
+			std::vector<double> durations;
+
+			// Sizes whose pipeline could not be built, e.g. beyond what the shader allows, are left out
+			bool failed() const { return pipeline->status == PipelineCache::AsyncPipeline<wgpu::ComputePipeline>::Status::Failed; }
+		};
+
+		std::string mName;
+		PipelineCache::AsyncComputePipeline mPipeline;
+		uint32_t mWorkgroupSize = 0;
+		// Sizes supported by the kernel, as registered
+		std::vector<uint32_t> mWorkgroupSizes;
+		std::vector<Candidate> mCandidates;
+	};
+
+	/**
+	 * A pass measuring a kernel with one of its candidate sizes, to record with its pipeline,
+	 * its workgroup size and its timestamp writes
+	 */
+	struct Measurement {
+		wgpu::ComputePipeline pipeline = nullptr;
+		uint32_t workgroupSize = 0;
+		wgpu::ComputePassTimestampWrites timestampWrites;
+	};
+
+	// Read the sizes saved at `path` for `adapter`
+	WorkgroupTuner(wgpu::Device device, PipelineCache& pipelineCache, const AdapterDescription& adapter, std::filesystem::path path, uint32_t maxPassCount = 16);
+	~WorkgroupTuner();
+
+	WorkgroupTuner(const WorkgroupTuner&) = delete;
+	WorkgroupTuner& operator=(const WorkgroupTuner&) = delete;
+
+	// Whether the device supports timestamp queries, without which sizes are not measured
+	bool enabled() const { return mQuerySet != nullptr; }
+
+	// Build the kernel `name` from `descriptor`, whose constants get `workgroupSize` added, with
+	// the size saved for the adapter or, if there is none, `workgroupSizes[0]` while they are all
+	// measured. Sizes beyond the limits of the device are left out. Registering a kernel again,
+	// e.g. when its shader is reloaded, returns the same Kernel, rebuilt.
+	std::shared_ptr<const Kernel> kernel(const std::string& name, const wgpu::ComputePipelineDescriptor& descriptor, const std::vector<uint32_t>& workgroupSizes, uint32_t workgroupStoragePerInvocation = 0);
+
+	// Pick the kernels whose candidates are all measured, then start measuring a new frame
+	void beginFrame();
+
+	// Passes to record before the pass of `kernel` in this frame, one per candidate size whose
+	// pipeline is built, none once it is tuned or when the frame is not measured. Only call it
+	// for kernels that are actually recorded.
+	std::vector<Measurement> measure(const Kernel& kernel);
+
+	// Record the resolution of the timestamps of the frame, after its last pass
+	void resolve(wgpu::CommandEncoder encoder);
+
+	// Read the timestamps back once the frame is submitted
+	void readBack();
+
+private:
+	/**
+	 * Workgroup size of a kernel on an adapter, as saved, with the candidates it was picked from
+	 */
+	struct SavedSize {
+		uint32_t workgroupSize = 0;
+		std::vector<uint32_t> workgroupSizes;
+	};
+
+	// Add the durations of a mapped readback slot to the candidates
+	void addDurations(uint32_t slot);
+
+	// Switch `kernel` to its candidate of lowest median duration
+	void pick(Kernel& kernel);
+
+	bool load();
+	bool save() const;
+
+private:
+	PipelineCache& mPipelineCache;
+	std::filesystem::path mPath;
+	uint32_t mMaxPassCount;
+	wgpu::Limits mLimits;
+	// Hash of the description of the adapter, its driver included
+	uint64_t mAdapterKey = 0;
+
+	std::map<std::string, std::shared_ptr<Kernel>> mKernels;
+	// By adapter key then kernel name, those of other adapters being saved again untouched
+	std::map<std::pair<uint64_t, std::string>, SavedSize> mSavedSizes;
+
+	wgpu::QuerySet mQuerySet = nullptr;
+	wgpu::Buffer mResolveBuffer = nullptr;
+	ReadbackPool mReadbacks;
+	// Kernel and candidate measured by each pair of timestamps, per readback slot
+	std::vector<std::vector<std::pair<Kernel*, size_t>>> mPasses;
+	// Readback slot of the frame being recorded, NoSlot if the frame is not measured
+	uint32_t mCurrent = ReadbackPool::NoSlot;
+};
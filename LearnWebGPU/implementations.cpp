@@ -4,5 +4,13 @@
 #define WEBGPU_CPP_IMPLEMENTATION
 #include <webgpu/webgpu.hpp>
 
+// Decoded pixels and the buffers of decoding come from the pools of the loader threads
+#include "DecodeHeap.h"
+#define STBI_MALLOC(size) DecodeHeap::allocate(size)
+#define STBI_REALLOC(buffer, size) DecodeHeap::reallocate(buffer, size)
+#define STBI_FREE(buffer) DecodeHeap::release(buffer)
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
\ No newline at end of file
+#include "stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
@@ -0,0 +1,155 @@
+/**
+ * Parameters of the culling pass, updated whenever the view or model changes
+ */
+struct CullingUniforms {
+	// Frustum planes in the space of the model matrix of the uniforms, pointing inwards
+	planes: array<vec4f, 6>,
+	// Projection * view * model matrix of the frame the depth pyramid was built from
+	depthPyramidMatrix: mat4x4f,
+	instanceCount: u32,
+	batchCount: u32,
+	// Whether to test instances against the depth pyramid, 0 until it is first built
+	occlusionCulling: u32,
+	// Whether depths decrease with distance, the pyramid then holding the smallest ones
+	reversedZ: u32,
+	// Size of the depth buffer the pyramid was built from
+	depthSize: vec2u,
+	// Draws per visible instance, one per eye in stereo
+	eyeCount: u32,
+	// Whether the draws start at the first visible instance of their batch, for multi-draws
+	firstInstances: u32,
+	// Position of the camera in the space of the model matrix
+	camera: vec4f,
+};
+
+#include "shaders/instance.wgsl"
+
+/**
+ * Instances sharing a mesh, drawn by a draw call of their own, updated whenever the
+ * level of detail changes
+ */
+struct Batch {
+	// Bounding sphere of the mesh, center in xyz and radius in w
+	boundingSphere: vec4f,
+	// Index range of the selected level of detail
+	indexCount: u32,
+	firstIndex: u32,
+	// Start of the batch's range of visible instances
+	firstVisibleInstance: u32,
+	// First vertex of the mesh in the vertex buffers it shares with others
+	baseVertex: i32,
+	// Instances whose radius over distance is below this are drawn as imposters, 0 if none
+	imposterRatio: f32,
+};
+
+/**
+ * Arguments of drawIndexedIndirect, cleared before the pass
+ */
+struct DrawIndexedIndirectArgs {
+	indexCount: u32,
+	instanceCount: atomic<u32>,
+	firstIndex: u32,
+	baseVertex: i32,
+	firstInstance: u32,
+};
+
+@group(0) @binding(0) var<uniform> uCulling: CullingUniforms;
+@group(0) @binding(1) var<storage, read> instances: array<Instance>;
+@group(0) @binding(2) var<storage, read_write> visibleInstances: array<u32>;
+// One per batch
+@group(0) @binding(3) var<storage, read_write> drawArgs: array<DrawIndexedIndirectArgs>;
+// Farthest depth of each 2^(level+1) texels wide square of the depth buffer (see DepthPyramid.h)
+@group(0) @binding(4) var depthPyramid: texture_2d<f32>;
+@group(0) @binding(5) var<storage, read> batches: array<Batch>;
+
+// Whether the bounding box of a sphere lies behind what the depth pyramid was built from
+fn isOccluded(center: vec3f, radius: f32) -> bool {
+	// Screen space bounds of the 8 corners of the box, and its nearest depth
+	var minUv = vec2f(1.0);
+	var maxUv = vec2f(0.0);
+	var minDepth = 1.0;
+	for (var i = 0u; i < 8u; i++) {
+		let corner = center + radius * vec3f(
+			select(-1.0, 1.0, (i & 1u) != 0u),
+			select(-1.0, 1.0, (i & 2u) != 0u),
+			select(-1.0, 1.0, (i & 4u) != 0u)
+		);
+		let clip = uCulling.depthPyramidMatrix * vec4f(corner, 1.0);
+		// Boxes crossing the near plane cover too much of the screen to be worth testing
+		let nearPlaneCrossed = select(clip.z < 0.0, clip.z > clip.w, uCulling.reversedZ != 0u);
+		if (clip.w <= 0.0 || nearPlaneCrossed) {
+			return false;
+		}
+		let ndc = clip.xyz / clip.w;
+		// Texture rows go downwards, when NDC y goes upwards
+		let uv = vec2f(0.5, -0.5) * ndc.xy + 0.5;
+		minUv = min(minUv, uv);
+		maxUv = max(maxUv, uv);
+		// Distance ordered, 0 at the near plane either way
+		minDepth = min(minDepth, select(ndc.z, 1.0 - ndc.z, uCulling.reversedZ != 0u));
+	}
+	minUv = clamp(minUv, vec2f(0.0), vec2f(1.0));
+	maxUv = clamp(maxUv, vec2f(0.0), vec2f(1.0));
+
+	// Level whose texels are at least as large as the box, so that it overlaps 2x2 of them at most
+	let depthSize = vec2f(uCulling.depthSize);
+	let extent = (maxUv - minUv) * depthSize;
+	let largestExtent = max(max(extent.x, extent.y), 1.0);
+	let level = min(u32(max(ceil(log2(largestExtent)) - 1.0, 0.0)), textureNumLevels(depthPyramid) - 1u);
+
+	let levelSize = textureDimensions(depthPyramid, level);
+	let minTexel = min(vec2u(minUv * depthSize) >> vec2u(level + 1u), levelSize - 1u);
+	let maxTexel = min(vec2u(maxUv * depthSize) >> vec2u(level + 1u), levelSize - 1u);
+	var occluderDepths = vec4f(
+		textureLoad(depthPyramid, minTexel, level).r, textureLoad(depthPyramid, vec2u(maxTexel.x, minTexel.y), level).r,
+		textureLoad(depthPyramid, vec2u(minTexel.x, maxTexel.y), level).r, textureLoad(depthPyramid, maxTexel, level).r
+	);
+	if (uCulling.reversedZ != 0u) {
+		occluderDepths = 1.0 - occluderDepths;
+	}
+	let occluderDepth = max(max(occluderDepths.x, occluderDepths.y), max(occluderDepths.z, occluderDepths.w));
+	return minDepth > occluderDepth;
+}
+
+// Tuned per adapter by the WorkgroupTuner
+override workgroupSize: u32 = 64;
+
+// One instance per invocation, visible ones being appended to the range of their batch
+// in no particular order
+@compute @workgroup_size(workgroupSize)
+fn cullInstances(@builtin(global_invocation_id) id: vec3u) {
+	// The instance count is left to the atomics of the other invocations
+	if (id.x < uCulling.batchCount) {
+		drawArgs[id.x].indexCount = batches[id.x].indexCount;
+		drawArgs[id.x].firstIndex = batches[id.x].firstIndex;
+		drawArgs[id.x].baseVertex = batches[id.x].baseVertex;
+		drawArgs[id.x].firstInstance = select(0u, batches[id.x].firstVisibleInstance * uCulling.eyeCount, uCulling.firstInstances != 0u);
+	}
+	if (id.x >= uCulling.instanceCount) {
+		return;
+	}
+
+	// Bounding sphere of the instance, conservative when its scale is not uniform
+	let instance = instances[id.x];
+	let batch = batches[instance.batch];
+	let modelMatrix = instance.modelMatrix;
+	let center = (modelMatrix * vec4f(batch.boundingSphere.xyz, 1.0)).xyz;
+	let scale = max(length(modelMatrix[0].xyz), max(length(modelMatrix[1].xyz), length(modelMatrix[2].xyz)));
+	let radius = batch.boundingSphere.w * scale;
+	if (batch.imposterRatio > 0.0 && radius < batch.imposterRatio * length(center - uCulling.camera.xyz)) {
+		return;
+	}
+	for (var i = 0u; i < 6u; i++) {
+		let plane = uCulling.planes[i];
+		if (dot(plane.xyz, center) + plane.w < -radius) {
+			return;
+		}
+	}
+
+	if (uCulling.occlusionCulling != 0u && isOccluded(center, radius)) {
+		return;
+	}
+
+	let slot = atomicAdd(&drawArgs[instance.batch].instanceCount, uCulling.eyeCount);
+	visibleInstances[batch.firstVisibleInstance + slot / uCulling.eyeCount] = id.x;
+}
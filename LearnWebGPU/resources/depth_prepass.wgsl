@@ -0,0 +1,37 @@
+/**
+ * Depth-only pass filling the depth buffer before the main pass, which then shades
+ * only the fragments that pass an Equal depth test. The PositionInput structure and
+ * decodePosition() are generated by VertexLayout::wgslPositionDeclarations() and
+ * prepended to this file.
+ *
+ * Positions must be computed exactly as in shader.wgsl, with the same operations in
+ * the same order, for both passes to produce the same depths: both go through
+ * clipPosition() of shaders/camera.wgsl.
+ *
+ * Shadow passes draw the same vertex stage from each cascade of the shadow maps, with
+ * the projection and view of the cascade as view uniforms.
+ */
+
+// The bind groups of shader.wgsl, but the material
+#include "shaders/scene.wgsl"
+#ifdef VERTEX_ANIMATION
+#include "shaders/vertex_animation.wgsl"
+#endif
+
+@vertex
+#ifdef VERTEX_ANIMATION
+fn vs_depth(encoded: PositionInput, @builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) instanceIndex: u32) -> @invariant @builtin(position) vec4f {
+#else
+fn vs_depth(encoded: PositionInput, @builtin(instance_index) instanceIndex: u32) -> @invariant @builtin(position) vec4f {
+#endif
+	let instance = instances[visibleInstance(instanceIndex)];
+	let draw = drawUniformsOf(instance);
+	var position = decodePosition(encoded, draw.quantization);
+#ifdef VERTEX_ANIMATION
+	if (draw.vertexAnimation != 0u) {
+		position = animatedPosition(vertexIndex - draw.baseVertex, uFrame.time + instance.animationOffset);
+	}
+#endif
+	let modelMatrix = uFrame.modelMatrix * instance.modelMatrix;
+	return clipPosition(modelMatrix, position);
+}
@@ -1,13 +1,47 @@
 /**
- * A structure with fields labeled with vertex attribute locations can be used
- * as input to the entry point of a shader.
+ * The VertexInput structure, with fields labeled with vertex attribute locations,
+ * is generated by VertexLayout::wgslDeclarations() to match the encoding of the
+ * vertex buffer, together with a decodeVertex() function returning a DecodedVertex
+ * with full precision position, normal, color and uv. Both are prepended to this file.
+ *
+ * The source goes through the ShaderPreprocessor, whose #ifdef blocks select
+ * features at compile time:
+ *  - LIGHTING: shade the texture color with two directional lights
+ *  - SHADOWS: with LIGHTING, the first light casts shadows from the cascaded
+ *    shadow maps of ShadowMaps.h, bound with the view
+ *  - BAKED_LIGHTING: with LIGHTING, the two lights, shadowed, and an occluded sky
+ *    come from the vertex colors, baked into them by LightBaker.h, instead
+ *  - CLUSTERED_LIGHTS: with LIGHTING, add the point lights listed for the cluster
+ *    of the fragment by the binning pass of ClusteredLights.h, bound with the view
+ *  - OBJECT_IDS: also write the instance of each fragment to the ID attachment of
+ *    ObjectPicker.h
+ *  - TEXTURE_FEEDBACK: declare fs_feedback, which records the texture resolution
+ *    each fragment needs for TextureFeedback.h
+ *  - REVERSED_Z: depths decrease with distance, see DepthConvention.h
+ *  - SHADING_RATE: fs_main only shades the pixels of coarse tiles that the
+ *    upsampling pass of ShadingRate.h reads, the rates being bound with the view
+ *  - TEMPORAL_REUSE: fs_main only shades the pixels of the frame's pattern, the
+ *    others being reprojected from the history by the resolve of TemporalAA.h
+ *  - STEREO: each instance is drawn once per eye, into the left and right halves
+ *    of the targets, with the cameras of the stereo uniforms bound with the view
+ *  - VERTEX_PULLING: vs_main reads its vertex from the vertex pages bound as storage
+ *    buffers with the draw, through the pullVertex() function that
+ *    VertexLayout::wgslPullDeclarations() adds to the prelude, rather than from
+ *    vertex buffers. The index buffer still selects the vertices.
+ *  - DEFERRED: declare fs_gbuffer, which writes the normal, albedo and material of
+ *    opaque fragments to the G-buffer of DeferredShading.h instead of shading them
+ *  - DEFERRED_LIGHTING: with DEFERRED, declare cs_lighting, the tiled compute pass
+ *    shading the G-buffer with the lights of the variant
+ *  - VIRTUAL_TEXTURES: materials of a virtual texture sample the tiles of the cache
+ *    of VirtualTextures.h through its page table, bound with the materials, and
+ *    fs_feedback requests the pages it needs
  */
-struct VertexInput {
-	@location(0) position: vec3f,
-	@location(1) normal: vec3f,
-	@location(2) color: vec3f,
-	@location(3) uv: vec2f,
-};
+
+/**
+ * Whether the texture is sampled through an sRGB view that already decodes colors
+ * to linear space. Set when creating the pipeline, which compiles out the branch.
+ */
+override srgbTexture: bool = true;
 
 /**
  * A structure with fields labeled with builtins and locations can also be used
@@ -15,58 +49,855 @@ struct VertexInput {
  * shader.
  */
 struct VertexOutput {
-	@builtin(position) position: vec4f,
+	// Invariant so that depths match those of depth_prepass.wgsl, which the main pass
+	// tests with an Equal depth compare function after a depth pre-pass
+	@invariant @builtin(position) position: vec4f,
 	@location(0) color: vec3f,
 	@location(1) normal: vec3f,
 	@location(2) uv: vec2f,
+	// Index in materials
+	@location(3) @interpolate(flat) material: u32,
+#ifdef LIGHTING
+	// After the model matrix of the frame, where shadow maps and point lights are looked up
+	@location(4) worldPosition: vec3f,
+#endif
+#ifdef OBJECT_IDS
+	// Position of the instance in the draw order, plus one
+	@location(5) @interpolate(flat) objectId: u32,
+#endif
+#ifdef STEREO
+	// 0 for the left eye, 1 for the right one
+	@location(7) @interpolate(flat) eye: u32,
+#endif
+#ifdef MULTI_DRAW
+	// Of the batch, for fs_feedback, the fragment stage of a multi-draw not knowing its batch
+	@location(8) @interpolate(flat) textureId: u32,
+#endif
+};
+
+/**
+ * Outputs of the fragment shader, one per color attachment of the main pass
+ */
+struct FragmentOutput {
+	@location(0) color: vec4f,
+#ifdef OBJECT_IDS
+	// 0 is left where no instance is drawn
+	@location(1) objectId: u32,
+#endif
+};
+
+/**
+ * Outputs of fs_weighted, to the targets of WeightedBlendedOit.h
+ */
+struct WeightedOutput {
+	@location(0) accumulation: vec4f,
+	@location(1) revealage: f32,
 };
 
+// Frame, camera and draw groups, shared with depth_prepass.wgsl
+#include "shaders/scene.wgsl"
+#ifdef VERTEX_ANIMATION
+#include "shaders/vertex_animation.wgsl"
+#endif
+
+#ifdef SHADOWS
 /**
- * A structure holding the value of our uniforms
+ * Cascades of the shadow maps, each one as last rendered (ShadowMaps::Uniforms)
  */
-struct BasicShaderUniforms {
-    projectionMatrix: mat4x4f,
-    viewMatrix: mat4x4f,
-    modelMatrix: mat4x4f,
-    color: vec4f,
-    time: f32,
+struct ShadowUniforms {
+	// From world space to the clip space of each cascade
+	lightMatrices: array<mat4x4f, 3>,
+	// View space distance up to which each cascade is used, 0 until rendered
+	cascadeEnds: vec4f,
+	// World space size of a texel of each cascade
+	texelSizes: vec4f,
+	// Towards the light
+	lightDirection: vec4f,
 };
 
-@group(0) @binding(0) var<uniform> uUniforms: BasicShaderUniforms; // A uniform struct variable that we can set from the CPU
-@group(0) @binding(1) var gradientTexture: texture_2d<f32>;
-@group(0) @binding(2) var textureSampler: sampler;
+@group(1) @binding(1) var shadowMaps: texture_depth_2d_array;
+@group(1) @binding(2) var shadowSampler: sampler_comparison;
+@group(1) @binding(3) var<uniform> uShadows: ShadowUniforms;
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+/**
+ * Point lights and their lists by cluster, see ClusteredLights.h
+ */
+struct PointLight {
+	// World space
+	position: vec3f,
+	radius: f32,
+	color: vec3f,
+	intensity: f32,
+};
+
+struct ClusterUniforms {
+	viewMatrix: mat4x4f,
+	projectionScale: vec2f,
+	// In pixels, as the position builtin of fragments
+	tileSize: vec2f,
+	targetSize: vec2f,
+	near: f32,
+	far: f32,
+	gridSize: vec3u,
+	lightCount: u32,
+	// Slice of a view depth d: log(d) * sliceScale + sliceBias
+	sliceScale: f32,
+	sliceBias: f32,
+};
+
+struct Cluster {
+	count: u32,
+	lights: array<u32, 63>,
+};
+
+@group(1) @binding(4) var<uniform> uClusters: ClusterUniforms;
+@group(1) @binding(5) var<storage, read> pointLights: array<PointLight>;
+@group(1) @binding(6) var<storage, read> clusters: array<Cluster>;
+#endif
+
+#ifdef SHADING_RATE
+/**
+ * Same as ShadingRate::Uniforms, of which fragments only use the tile stride
+ */
+struct ShadingRateUniforms {
+	reprojection: mat4x4f,
+	sceneSize: vec2u,
+	tileStride: u32,
+	threshold: f32,
+	motionScale: f32,
+};
+
+@group(1) @binding(7) var<uniform> uShadingRate: ShadingRateUniforms;
+// Full, half or quarter rate (0, 1 or 2) by 16x16 tile, as classified from the previous frame
+@group(1) @binding(8) var<storage, read> shadingRates: array<u32>;
+
+/**
+ * Whether the pixel is left for the upsampling pass to fill: every other one in a checkerboard
+ * at half rate, and all but one of each 2x2 quad at quarter rate
+ */
+fn skippedByShadingRate(fragCoord: vec2f) -> bool {
+	let pixel = vec2u(fragCoord);
+	let tile = pixel / 16u;
+	let rate = shadingRates[tile.y * uShadingRate.tileStride + tile.x];
+	if (rate == 1u) {
+		return ((pixel.x + pixel.y) & 1u) != 0u;
+	}
+	if (rate == 2u) {
+		return ((pixel.x | pixel.y) & 1u) != 0u;
+	}
+	return false;
+}
+#endif
+
+#ifdef TEMPORAL_REUSE
+/**
+ * Same as TemporalAA::Uniforms, of which fragments only use the pattern and its phase
+ */
+struct TemporalUniforms {
+	reprojection: mat4x4f,
+	jitter: vec2f,
+	depthParameters: vec2f,
+	sceneSize: vec2u,
+	historySize: vec2u,
+	mode: u32,
+	pattern: u32,
+	phase: u32,
+	blend: f32,
+};
+
+@group(1) @binding(9) var<uniform> uTemporal: TemporalUniforms;
+
+/**
+ * Whether the pixel is left for the temporal resolve to reproject: every other one in a
+ * checkerboard (pattern 1), or all but one of each 2x2 quad (pattern 2)
+ */
+fn skippedByTemporalReuse(fragCoord: vec2f) -> bool {
+	let pixel = vec2u(fragCoord);
+	if (uTemporal.pattern == 1u) {
+		return ((pixel.x + pixel.y + uTemporal.phase) & 1u) != 0u;
+	}
+	if (uTemporal.pattern == 2u) {
+		return (pixel.x & 1u) + 2u * (pixel.y & 1u) != uTemporal.phase;
+	}
+	return false;
+}
+#endif
+#ifdef STEREO
+/**
+ * Cameras of the eyes, each drawing to its half of the target (Application::StereoUniforms)
+ */
+struct StereoUniforms {
+	viewProjections: array<mat4x4f, 2>,
+	// In pixels
+	eyeWidth: f32,
+};
+
+@group(1) @binding(10) var<uniform> uStereo: StereoUniforms;
+
+/**
+ * Clip space position from an eye, squeezed into its half of the target: x in [-1, 0] for
+ * the left eye, [0, 1] for the right one. Triangles reaching over the middle are kept from
+ * the other half by outsideEye() rather than clipped.
+ */
+fn stereoClipPosition(modelMatrix: mat4x4f, position: vec3f, eye: u32) -> vec4f {
+	let clip = uStereo.viewProjections[eye] * modelMatrix * vec4f(position, 1.0);
+	return vec4f(clip.x * 0.5 + (f32(eye) - 0.5) * clip.w, clip.yzw);
+}
+
+fn outsideEye(fragCoord: vec2f, eye: u32) -> bool {
+	return (fragCoord.x >= uStereo.eyeWidth) != (eye == 1u);
+}
+#endif
+#ifdef IMAGE_BASED_LIGHTING
+/**
+ * Lighting of the environment, preprocessed by EnvironmentLighting
+ */
+struct EnvironmentUniforms {
+	// Spherical harmonics coefficients of the irradiance over pi
+	irradiance: array<vec4f, 9>,
+	// Of environmentRadiance, the last one being prefiltered for a roughness of 1
+	levelCount: f32,
+};
+
+@group(1) @binding(11) var environmentRadiance: texture_cube<f32>;
+// Scale and bias of F0 by N.V and roughness
+@group(1) @binding(12) var brdfLut: texture_2d<f32>;
+@group(1) @binding(13) var environmentSampler: sampler;
+@group(1) @binding(14) var<uniform> uEnvironment: EnvironmentUniforms;
+
+/**
+ * Diffuse and specular light of the environment on a dielectric of the given roughness, with
+ * the split sum approximation for the specular part
+ */
+fn environmentLighting(worldPosition: vec3f, normal: vec3f, baseColor: vec3f, roughness: f32) -> vec3f {
+	let n = normal;
+	let c = &uEnvironment.irradiance;
+	let irradiance = (*c)[0].rgb * 0.282095
+		+ ((*c)[1].rgb * n.y + (*c)[2].rgb * n.z + (*c)[3].rgb * n.x) * 0.488603
+		+ ((*c)[4].rgb * (n.x * n.y) + (*c)[5].rgb * (n.y * n.z) + (*c)[7].rgb * (n.x * n.z)) * 1.092548
+		+ (*c)[6].rgb * (0.315392 * (3.0 * n.z * n.z - 1.0))
+		+ (*c)[8].rgb * (0.546274 * (n.x * n.x - n.y * n.y));
+
+	let viewRotation = mat3x3f(uView.viewMatrix[0].xyz, uView.viewMatrix[1].xyz, uView.viewMatrix[2].xyz);
+	let cameraPosition = -(transpose(viewRotation) * uView.viewMatrix[3].xyz);
+	let v = normalize(cameraPosition - worldPosition);
+	let nDotV = max(dot(n, v), 1e-4);
+	let lod = roughness * max(uEnvironment.levelCount - 1.0, 0.0);
+	let radiance = textureSampleLevel(environmentRadiance, environmentSampler, reflect(-v, n), lod).rgb;
+	let brdf = textureSampleLevel(brdfLut, environmentSampler, vec2f(nDotV, roughness), 0.0).rg;
+	let f0 = 0.04;
+	return baseColor * max(irradiance, vec3f(0.0)) + radiance * (f0 * brdf.x + brdf.y);
+}
+#endif
+
+/**
+ * Parameters of a material, as Application::MaterialData, all those of the scene being
+ * in one buffer that every material bind group shares
+ */
+struct Material {
+	// Multiplies the color of the texture
+	color: vec4f,
+	// Layer of the texture array bound with the instances of the material
+	textureLayer: u32,
+	// Blended over what is behind when below 1
+	opacity: f32,
+	// Index in virtualTextures, or noVirtualTexture for a regular texture
+	virtualTexture: u32,
+};
+
+const noVirtualTexture = 0xffffffffu;
+
+// One layer per material, single textures being bound as 1-layer arrays, and the tile cache
+// for virtual textures
+@group(2) @binding(0) var gradientTexture: texture_2d_array<f32>;
+@group(2) @binding(1) var textureSampler: sampler;
+@group(2) @binding(2) var<storage, read> materials: array<Material>;
+
+#ifdef VIRTUAL_TEXTURES
+/**
+ * Same as VirtualTextures::Descriptor
+ */
+struct VirtualTexture {
+	// Texels of level 0
+	size: vec2u,
+	// Pages of level 0 on each side
+	pageCount: vec2u,
+	levelCount: u32,
+	// First entry of each level in pageTable, finest first
+	levelOffsets: array<u32, 16>,
+};
+
+// Same as VirtualTextures::TileSize and VirtualTextures::Border
+const virtualTileSize = 128u;
+const virtualTileBorder = 4u;
+
+// Per page, the slot of the tile to sample in x and y, and its level
+@group(2) @binding(3) var<storage, read> pageTable: array<u32>;
+@group(2) @binding(4) var<storage, read> virtualTextures: array<VirtualTexture>;
+
+fn virtualLevelSize(virtualTexture: VirtualTexture, level: u32) -> vec2u {
+	return max(virtualTexture.size >> vec2u(level), vec2u(1u));
+}
+
+// Level of the texture whose texels match the footprint of a pixel, the finer one when between two
+fn virtualTextureLevel(virtualTexture: VirtualTexture, uvDx: vec2f, uvDy: vec2f) -> u32 {
+	let size = vec2f(virtualTexture.size);
+	let footprint = max(length(uvDx * size), length(uvDy * size));
+	return u32(clamp(floor(log2(max(footprint, 1.0))), 0.0, f32(virtualTexture.levelCount - 1u)));
+}
+
+// Entry of pageTable of the page holding `uv`, wrapped like the sampler does, at `level`
+fn virtualPage(virtualTexture: VirtualTexture, uv: vec2f, level: u32) -> u32 {
+	let levelSize = virtualLevelSize(virtualTexture, level);
+	let pageCount = (levelSize + virtualTileSize - 1u) / virtualTileSize;
+	let page = min(vec2u(fract(uv) * vec2f(levelSize)) / virtualTileSize, pageCount - 1u);
+	return virtualTexture.levelOffsets[level] + page.y * pageCount.x + page.x;
+}
+
+/**
+ * Bilinear sample of the finest resident tile at or above the level that the footprint asks for,
+ * the border of the tile holding the texels around it
+ */
+fn sampleVirtualTexture(virtualTexture: VirtualTexture, uv: vec2f, uvDx: vec2f, uvDy: vec2f) -> vec4f {
+	let entry = pageTable[virtualPage(virtualTexture, uv, virtualTextureLevel(virtualTexture, uvDx, uvDy))];
+	let slot = vec2u(entry & 0xffu, (entry >> 8u) & 0xffu);
+	let level = entry >> 16u;
+	let texel = fract(uv) * vec2f(virtualLevelSize(virtualTexture, level));
+	let inTile = texel - floor(texel / f32(virtualTileSize)) * f32(virtualTileSize);
+	let cacheTexel = vec2f(slot * (virtualTileSize + 2u * virtualTileBorder) + virtualTileBorder) + inTile;
+	return textureSampleLevel(gradientTexture, textureSampler, cacheTexel / vec2f(textureDimensions(gradientTexture)), 0, 0.0);
+}
+#endif
+
+/**
+ * Color of the texture of `material` at `uv`, the derivatives being taken by the caller
+ */
+fn sampleBaseColor(material: Material, uv: vec2f, uvDx: vec2f, uvDy: vec2f) -> vec4f {
+#ifdef VIRTUAL_TEXTURES
+	if (material.virtualTexture != noVirtualTexture) {
+		return sampleVirtualTexture(virtualTextures[material.virtualTexture], uv, uvDx, uvDy);
+	}
+#endif
+	return textureSampleGrad(gradientTexture, textureSampler, uv, material.textureLayer, uvDx, uvDy);
+}
 
 const pi = 3.14159265359;
 
 @vertex
-fn vs_main(in: VertexInput) -> VertexOutput {
+#ifdef VERTEX_PULLING
+// Indexed draws give the vertex within its page, the index plus the base vertex of the mesh
+fn vs_main(@builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) instanceIndex: u32) -> VertexOutput {
+#else
+#ifdef VERTEX_ANIMATION
+fn vs_main(encoded: VertexInput, @builtin(vertex_index) vertexIndex: u32, @builtin(instance_index) instanceIndex: u32) -> VertexOutput {
+#else
+fn vs_main(encoded: VertexInput, @builtin(instance_index) instanceIndex: u32) -> VertexOutput {
+#endif
+#endif
+#ifdef STEREO
+	// Even instance indices for the left eye, odd ones for the right one
+	let eye = instanceIndex & 1u;
+	let instanceId = visibleInstance(instanceIndex / 2u);
+#else
+	let instanceId = visibleInstance(instanceIndex);
+#endif
+	let instance = instances[instanceId];
+	let draw = drawUniformsOf(instance);
+#ifdef VERTEX_PULLING
+	var in = pullVertex(vertexIndex, draw.quantization);
+#else
+	var in = decodeVertex(encoded, draw.quantization);
+#endif
+#ifdef VERTEX_ANIMATION
+	// The vertex index counts from the base vertex, of the page or the buffer of the mesh
+	if (draw.vertexAnimation != 0u) {
+		let time = uFrame.time + instance.animationOffset;
+		in.position = animatedPosition(vertexIndex - draw.baseVertex, time);
+		in.normal = animatedNormal(vertexIndex - draw.baseVertex, time);
+	}
+#endif
+	let modelMatrix = uFrame.modelMatrix * instance.modelMatrix;
 	var out: VertexOutput;
-	out.position = uUniforms.projectionMatrix * uUniforms.viewMatrix * uUniforms.modelMatrix * vec4f(in.position, 1.0);
+#ifdef STEREO
+	// Without a depth pre-pass to match
+	out.position = stereoClipPosition(modelMatrix, in.position, eye);
+	out.eye = eye;
+#else
+	// Same as vs_depth of depth_prepass.wgsl, for the depths to match
+	out.position = clipPosition(modelMatrix, in.position);
+#endif
 	// Forward the normal
-  out.normal = (uUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
+  out.normal = (modelMatrix * vec4f(in.normal, 0.0)).xyz;
 	out.color = in.color;
 	out.uv = in.uv; // Map from [-1, 1] to [0, 1]
+	out.material = instance.material;
+#ifdef MULTI_DRAW
+	out.textureId = draw.textureId;
+#endif
+#ifdef LIGHTING
+	out.worldPosition = (modelMatrix * vec4f(in.position, 1.0)).xyz;
+#endif
+#ifdef OBJECT_IDS
+	out.objectId = instanceId + 1u;
+#endif
 
 	return out;
 }
 
-@fragment
-fn fs_main(in: VertexOutput) -> @location(0) vec4f {
-	let normal = normalize(in.normal);
+#ifdef SHADOWS
+/**
+ * Fraction of the first light that reaches a point, from the first cascade that covers it,
+ * filtered over 3x3 taps of 2x2 bilinear comparisons. Points beyond the last cascade are lit.
+ */
+fn shadowFactor(worldPosition: vec3f, normal: vec3f) -> f32 {
+	let viewDepth = -(uView.viewMatrix * vec4f(worldPosition, 1.0)).z;
+	let texelUv = 1.0 / vec2f(textureDimensions(shadowMaps));
+	for (var cascade = 0u; cascade < 3u; cascade++) {
+		if (viewDepth > uShadows.cascadeEnds[cascade]) {
+			continue;
+		}
+		// Looked up a bit off the surface, more so where the light grazes it, for surfaces
+		// not to shadow themselves
+		let grazing = 1.0 - max(0.0, dot(normal, uShadows.lightDirection.xyz));
+		let position = worldPosition + normal * (uShadows.texelSizes[cascade] * (0.5 + 1.5 * grazing));
+		let clip = uShadows.lightMatrices[cascade] * vec4f(position, 1.0);
+		let uv = clip.xy * vec2f(0.5, -0.5) + 0.5;
+		// A cascade updated in turns may lag behind the camera, the next one covering what it misses
+		if (any(uv < texelUv) || any(uv > 1.0 - texelUv)) {
+			continue;
+		}
+		var light = 0.0;
+		for (var y = -1; y <= 1; y++) {
+			for (var x = -1; x <= 1; x++) {
+				let offset = vec2f(f32(x), f32(y)) * texelUv;
+				light += textureSampleCompareLevel(shadowMaps, shadowSampler, uv + offset, cascade, clip.z);
+			}
+		}
+		return light / 9.0;
+	}
+	return 1.0;
+}
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+/**
+ * Diffuse light of a point light on a surface, fading out smoothly up to its radius
+ */
+fn pointLightShading(pointLight: PointLight, worldPosition: vec3f, normal: vec3f) -> vec3f {
+	let toLight = pointLight.position - worldPosition;
+	let distance2 = dot(toLight, toLight);
+	let falloff = saturate(1.0 - distance2 / (pointLight.radius * pointLight.radius));
+	let shading = max(0.0, dot(normal, toLight * inverseSqrt(max(distance2, 1e-8))));
+	return pointLight.color * (pointLight.intensity * falloff * falloff * shading);
+}
+
+/**
+ * Diffuse light of the point lights of the cluster holding a fragment
+ */
+fn pointLighting(fragCoord: vec2f, worldPosition: vec3f, normal: vec3f) -> vec3f {
+	let grid = uClusters.gridSize;
+	let viewDepth = -(uClusters.viewMatrix * vec4f(worldPosition, 1.0)).z;
+	let slice = u32(clamp(log(max(viewDepth, uClusters.near)) * uClusters.sliceScale + uClusters.sliceBias, 0.0, f32(grid.z - 1u)));
+	let tile = min(vec2u(fragCoord / uClusters.tileSize), grid.xy - 1u);
+	let clusterIndex = (slice * grid.y + tile.y) * grid.x + tile.x;
+
+	var light = vec3f(0.0);
+	let count = clusters[clusterIndex].count;
+	for (var i = 0u; i < count; i++) {
+		light += pointLightShading(pointLights[clusters[clusterIndex].lights[i]], worldPosition, normal);
+	}
+	return light;
+}
+#endif
 
-	//let lightColor1 = vec3f(1.0, 0.9, 0.6);
-	//let lightColor2 = vec3f(0.6, 0.9, 1.0);
-	//let lightDirection1 = vec3f(0.5, -0.9, 0.1);
-	//let lightDirection2 = vec3f(0.2, 0.4, 0.3);
-	//let shading1 = max(0.0, dot(lightDirection1, normal));
-	//let shading2 = max(0.0, dot(lightDirection2, normal));
-	//let shading = shading1 * lightColor1 + shading2 * lightColor2;
-	//let color = in.color * shading;
+#ifdef LIGHTING
+#ifndef BAKED_LIGHTING
+/**
+ * Diffuse light of the two directional lights on a surface, the first one casting shadows
+ * with SHADOWS
+ */
+fn directionalLighting(worldPosition: vec3f, normal: vec3f) -> vec3f {
+	let lightColor1 = vec3f(1.0, 0.9, 0.6);
+	let lightColor2 = vec3f(0.6, 0.9, 1.0);
+	let lightDirection1 = vec3f(0.5, -0.9, 0.1);
+	let lightDirection2 = vec3f(0.2, 0.4, 0.3);
+#ifdef SHADOWS
+	let shading1 = max(0.0, dot(lightDirection1, normal)) * shadowFactor(worldPosition, normal);
+#else
+	let shading1 = max(0.0, dot(lightDirection1, normal));
+#endif
+	let shading2 = max(0.0, dot(lightDirection2, normal));
+	return shading1 * lightColor1 + shading2 * lightColor2;
+}
+#endif
+#endif
+
+/**
+ * Color of a fragment in linear space, lit by the lights of the variant. The derivatives of
+ * the uv are taken by the caller, before any branch that is not uniform.
+ */
+fn shade(in: VertexOutput, uvDx: vec2f, uvDy: vec2f) -> vec3f {
+	let normal = normalize(in.normal);
 
 	//let texCoords = vec2i(in.uv * vec2f(textureDimensions(gradientTexture)));
-	let color = textureSample(gradientTexture, textureSampler, in.uv).rgb;
+	let material = materials[in.material];
+	let baseColor = material.color.rgb * sampleBaseColor(material, in.uv, uvDx, uvDy).rgb;
+
+#ifdef LIGHTING
+#ifdef BAKED_LIGHTING
+	// Same as LightBaker::LightingScale
+	let directLighting = in.color * 2.0;
+#else
+	let directLighting = directionalLighting(in.worldPosition, normal);
+#endif
+#ifdef CLUSTERED_LIGHTS
+	let shading = directLighting + pointLighting(in.position.xy, in.worldPosition, normal);
+#else
+	let shading = directLighting;
+#endif
+#ifdef IMAGE_BASED_LIGHTING
+	// Materials have no roughness, all taking that of a rough plastic
+	let color = baseColor * shading + environmentLighting(in.worldPosition, normal, baseColor, 0.5);
+#else
+	let color = baseColor * shading;
+#endif
+#else
+	let color = baseColor;
+#endif
+
+	// Gamma-correction, only needed when the texture is not decoded by the sampler
+	var linear_color = color;
+	if (!srgbTexture) {
+		linear_color = pow(color, vec3f(2.2));
+	}
+	return linear_color;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> FragmentOutput {
+	var out: FragmentOutput;
+	// Of the material, 1 for opaque ones
+	let opacity = materials[in.material].opacity;
+#ifdef OBJECT_IDS
+	out.objectId = in.objectId;
+#endif
+	let uvDx = dpdx(in.uv);
+	let uvDy = dpdy(in.uv);
+#ifdef STEREO
+	// After the derivatives, which the discarded fragments still help compute
+	if (outsideEye(in.position.xy, in.eye)) {
+		discard;
+	}
+#endif
+#ifdef SHADING_RATE
+	// Depth is written all the same, for the upsampling and the passes after it
+	if (skippedByShadingRate(in.position.xy)) {
+		out.color = vec4f(0.0, 0.0, 0.0, opacity);
+		return out;
+	}
+#endif
+#ifdef TEMPORAL_REUSE
+	// Depth is written all the same, for the resolve to reproject the pixel
+	if (skippedByTemporalReuse(in.position.xy)) {
+		out.color = vec4f(0.0, 0.0, 0.0, opacity);
+		return out;
+	}
+#endif
+	// Blended by the pipelines of transparent draws only
+	out.color = vec4f(shade(in, uvDx, uvDy), opacity);
+	return out;
+}
+
+/**
+ * Transparent fragments in any order, for weighted blended order-independent transparency:
+ * premultiplied color and alpha added up with a weight that decreases with depth (equation 9
+ * of McGuire and Bavoil), and alpha to multiply the revealage by 1 - alpha
+ */
+@fragment
+fn fs_weighted(in: VertexOutput) -> WeightedOutput {
+	let alpha = materials[in.material].opacity;
+#ifdef REVERSED_Z
+	let depth = 1.0 - in.position.z;
+#else
+	let depth = in.position.z;
+#endif
+	let weight = clamp(alpha * max(1e-2, 3e3 * pow(1.0 - depth, 3.0)), 1e-2, 3e3);
+	let uvDx = dpdx(in.uv);
+	let uvDy = dpdy(in.uv);
+#ifdef STEREO
+	if (outsideEye(in.position.xy, in.eye)) {
+		discard;
+	}
+#endif
+	var out: WeightedOutput;
+	out.accumulation = vec4f(shade(in, uvDx, uvDy) * alpha, alpha) * weight;
+	out.revealage = alpha;
+	return out;
+}
+
+#ifdef TEXTURE_FEEDBACK
+/**
+ * Same as TextureFeedback::Uniforms
+ */
+struct FeedbackUniforms {
+	// Full resolution pixels per pixel of the feedback pass
+	resolutionScale: f32,
+};
+
+// Same as TextureFeedback::MaxTextureCount
+const feedbackTextureCount = 4096u;
+
+@group(4) @binding(0) var<uniform> uFeedback: FeedbackUniforms;
+// Bits of the largest texel density requested of each texture, positive floats ordering like their
+// bits, then one bit per page of the virtual textures
+@group(4) @binding(1) var<storage, read_write> textureFeedback: array<atomic<u32>>;
+
+/**
+ * No color, only the texels per unit of uv that the finest mip level sampled at full resolution
+ * should have for the fragment, from the footprint of its pixel in the texture, and the pages of a
+ * virtual texture that the pixels it stands for sample
+ */
+@fragment
+fn fs_feedback(in: VertexOutput) {
+	let uvDx = dpdx(in.uv);
+	let uvDy = dpdy(in.uv);
+	let footprint = max(length(uvDx), length(uvDy));
+	let density = min(uFeedback.resolutionScale / max(footprint, 1e-8), 65536.0);
+#ifdef MULTI_DRAW
+	let textureId = in.textureId;
+#else
+	let textureId = uDraw.textureId;
+#endif
+	if (textureId < feedbackTextureCount) {
+		atomicMax(&textureFeedback[textureId], bitcast<u32>(density));
+	}
+#ifdef VIRTUAL_TEXTURES
+	let material = materials[in.material];
+	if (material.virtualTexture != noVirtualTexture) {
+		// At the level of full resolution pixels, over the corners of the pixel of the pass
+		let virtualTexture = virtualTextures[material.virtualTexture];
+		let level = virtualTextureLevel(virtualTexture, uvDx / uFeedback.resolutionScale, uvDy / uFeedback.resolutionScale);
+		let extent = 0.5 * (abs(uvDx) + abs(uvDy));
+		for (var corner = 0u; corner < 4u; corner++) {
+			let offset = select(-extent, extent, vec2<bool>((corner & 1u) != 0u, (corner & 2u) != 0u));
+			let bit = virtualPage(virtualTexture, in.uv + offset, level);
+			let word = feedbackTextureCount + bit / 32u;
+			if (word < arrayLength(&textureFeedback)) {
+				atomicOr(&textureFeedback[word], 1u << (bit % 32u));
+			}
+		}
+	}
+#endif
+}
+#endif
+
+#ifdef DEFERRED
+/**
+ * Outputs of fs_gbuffer, one per color attachment of the G-buffer pass, in the formats of
+ * DeferredShading
+ */
+struct GBufferOutput {
+	// Octahedral encoding of the world space normal, 16 bits per coordinate
+	@location(0) normal: vec2u,
+	// Linear base color, through an sRGB target, and packMaterial() in alpha
+	@location(1) albedo: vec4f,
+#ifdef OBJECT_IDS
+	@location(2) objectId: u32,
+#endif
+};
+
+/**
+ * A unit vector folded onto the octahedron, then unfolded onto the square [-1, 1]^2
+ */
+fn octahedralEncode(n: vec3f) -> vec2f {
+	let p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+	if (n.z >= 0.0) {
+		return p;
+	}
+	return (1.0 - abs(p.yx)) * select(vec2f(-1.0), vec2f(1.0), p >= vec2f(0.0));
+}
+
+fn octahedralDecode(e: vec2f) -> vec3f {
+	var n = vec3f(e, 1.0 - abs(e.x) - abs(e.y));
+	let t = max(-n.z, 0.0);
+	n.x += select(t, -t, n.x >= 0.0);
+	n.y += select(t, -t, n.y >= 0.0);
+	return normalize(n);
+}
+
+fn packNormal(normal: vec3f) -> vec2u {
+	return vec2u(round((octahedralEncode(normal) * 0.5 + 0.5) * 65535.0));
+}
+
+fn unpackNormal(packed: vec2u) -> vec3f {
+	return octahedralDecode(vec2f(packed) / 65535.0 * 2.0 - 1.0);
+}
+
+// Roughness and metalness on 4 bits each, in the 8 bits of the alpha of the albedo
+fn packMaterial(roughness: f32, metalness: f32) -> f32 {
+	let bits = u32(round(saturate(roughness) * 15.0)) * 16u + u32(round(saturate(metalness) * 15.0));
+	return f32(bits) / 255.0;
+}
+
+fn unpackMaterial(alpha: f32) -> vec2f {
+	let bits = u32(round(alpha * 255.0));
+	return vec2f(f32(bits >> 4u), f32(bits & 15u)) / 15.0;
+}
+
+/**
+ * What the lighting pass needs of an opaque fragment, the rest of shade() being left to it
+ */
+@fragment
+fn fs_gbuffer(in: VertexOutput) -> GBufferOutput {
+	let material = materials[in.material];
+	var baseColor = material.color.rgb * sampleBaseColor(material, in.uv, dpdx(in.uv), dpdy(in.uv)).rgb;
+	// Decoded before lighting rather than after, the target encoding it again
+	if (!srgbTexture) {
+		baseColor = pow(baseColor, vec3f(2.2));
+	}
+	var out: GBufferOutput;
+	out.normal = packNormal(normalize(in.normal));
+	// Materials have no roughness nor metalness, all taking those of a rough plastic as in shade()
+	out.albedo = vec4f(baseColor, packMaterial(0.5, 0.0));
+#ifdef OBJECT_IDS
+	out.objectId = in.objectId;
+#endif
+	return out;
+}
+#endif
+
+#ifdef DEFERRED_LIGHTING
+/**
+ * Same as DeferredShading::Uniforms
+ */
+struct DeferredUniforms {
+	// From NDC to view space, and from view space to the space of worldPosition
+	inverseProjection: mat4x4f,
+	inverseView: mat4x4f,
+	// Where no opaque surface was drawn, the clear color of the forward main pass
+	background: vec4f,
+	// Region of the targets the scene covers
+	sceneSize: vec2u,
+};
+
+// After the bindings of the texture feedback, which takes the same group in its own variant
+@group(4) @binding(2) var<uniform> uDeferred: DeferredUniforms;
+@group(4) @binding(3) var gbufferNormal: texture_2d<u32>;
+@group(4) @binding(4) var gbufferAlbedo: texture_2d<f32>;
+@group(4) @binding(5) var depthTexture: texture_depth_2d;
+@group(4) @binding(6) var litScene: texture_storage_2d<rgba16float, write>;
+
+// Same as DeferredShading::TileSize
+const TileSize = 16u;
+// Point lights beyond this many in a tile are left out of it
+const MaxTileLights = 256u;
+
+// View distances of the tile as the bits of positive floats, which order like them
+var<workgroup> tileMinDistance: atomic<u32>;
+var<workgroup> tileMaxDistance: atomic<u32>;
+var<workgroup> tileLightCount: atomic<u32>;
+var<workgroup> tileLights: array<u32, MaxTileLights>;
+
+// View space position of `pixel`, unjittered as the matrices are, at `depth`
+fn viewPositionAt(pixel: vec2f, depth: f32) -> vec3f {
+	let uv = pixel / vec2f(uDeferred.sceneSize);
+	let ndc = vec2f(2.0 * uv.x - 1.0, 1.0 - 2.0 * uv.y) - uView.jitter;
+	let position = uDeferred.inverseProjection * vec4f(ndc, depth, 1.0);
+	return position.xyz / position.w;
+}
+
+/**
+ * One invocation per pixel of the scene, the workgroups of a tile first bounding its depths,
+ * then listing the point lights whose spheres reach the box around them, the pixels of the
+ * tile then looping over those only
+ */
+@compute @workgroup_size(TileSize, TileSize, 1)
+fn cs_lighting(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) localIndex: u32, @builtin(workgroup_id) tile: vec3u) {
+	if (localIndex == 0u) {
+		atomicStore(&tileMinDistance, 0x7f7fffffu);
+		atomicStore(&tileMaxDistance, 0u);
+		atomicStore(&tileLightCount, 0u);
+	}
+	workgroupBarrier();
+
+	// Barriers being reached by every invocation, those outside the scene return at the end
+	let inside = all(id.xy < uDeferred.sceneSize);
+	let pixel = min(id.xy, uDeferred.sceneSize - 1u);
+	let depth = textureLoad(depthTexture, pixel, 0);
+#ifdef REVERSED_Z
+	let background = depth <= 0.0;
+#else
+	let background = depth >= 1.0;
+#endif
+	let viewPosition = viewPositionAt(vec2f(pixel) + 0.5, depth);
+	if (inside && !background) {
+		atomicMin(&tileMinDistance, bitcast<u32>(max(-viewPosition.z, 0.0)));
+		atomicMax(&tileMaxDistance, bitcast<u32>(max(-viewPosition.z, 0.0)));
+	}
+	workgroupBarrier();
+
+#ifdef CLUSTERED_LIGHTS
+	let minDistance = bitcast<f32>(atomicLoad(&tileMinDistance));
+	let maxDistance = bitcast<f32>(atomicLoad(&tileMaxDistance));
+	if (minDistance <= maxDistance) {
+		// Box of the frustum of the tile between its distances, from its corners at a distance of 1
+		var boxMin = vec3f(1e30);
+		var boxMax = vec3f(-1e30);
+		for (var corner = 0u; corner < 4u; corner++) {
+			let cornerPixel = vec2f(tile.xy * TileSize + vec2u(corner & 1u, corner >> 1u) * TileSize);
+			let direction = viewPositionAt(cornerPixel, 0.5);
+			let unitDirection = direction / max(-direction.z, 1e-8);
+			boxMin = min(boxMin, min(unitDirection * minDistance, unitDirection * maxDistance));
+			boxMax = max(boxMax, max(unitDirection * minDistance, unitDirection * maxDistance));
+		}
+		for (var i = localIndex; i < uClusters.lightCount; i += TileSize * TileSize) {
+			let pointLight = pointLights[i];
+			let center = (uView.viewMatrix * vec4f(pointLight.position, 1.0)).xyz;
+			let offset = center - clamp(center, boxMin, boxMax);
+			if (dot(offset, offset) <= pointLight.radius * pointLight.radius) {
+				let slot = atomicAdd(&tileLightCount, 1u);
+				if (slot < MaxTileLights) {
+					tileLights[slot] = i;
+				}
+			}
+		}
+	}
+	workgroupBarrier();
+	let lightCount = min(atomicLoad(&tileLightCount), MaxTileLights);
+#endif
+
+	if (!inside) {
+		return;
+	}
+	if (background) {
+		textureStore(litScene, pixel, uDeferred.background);
+		return;
+	}
+	let normal = unpackNormal(textureLoad(gbufferNormal, pixel, 0).rg);
+	let albedo = textureLoad(gbufferAlbedo, pixel, 0);
+	let material = unpackMaterial(albedo.a);
+	let roughness = material.x;
+	// Metals reflect no diffuse light, the environment lighting taking every surface for a dielectric
+	let baseColor = albedo.rgb * (1.0 - material.y);
+	let worldPosition = (uDeferred.inverseView * vec4f(viewPosition, 1.0)).xyz;
 
-	// Gamma-correction
-	let linear_color = pow(color, vec3f(2.2));
-	return vec4f(linear_color, 1.0); // use the interpolated color coming from the vertex shader
+#ifdef LIGHTING
+	var shading = directionalLighting(worldPosition, normal);
+#ifdef CLUSTERED_LIGHTS
+	for (var i = 0u; i < lightCount; i++) {
+		shading += pointLightShading(pointLights[tileLights[i]], worldPosition, normal);
+	}
+#endif
+#ifdef IMAGE_BASED_LIGHTING
+	let color = baseColor * shading + environmentLighting(worldPosition, normal, baseColor, roughness);
+#else
+	let color = baseColor * shading;
+#endif
+#else
+	let color = baseColor;
+#endif
+	textureStore(litScene, pixel, vec4f(color, 1.0));
 }
+#endif
@@ -0,0 +1,25 @@
+/**
+ * Camera of the view group, shared by the passes that draw the scene from it
+ */
+
+/**
+ * Uniforms of the camera
+ */
+struct ViewUniforms {
+    projectionMatrix: mat4x4f,
+    viewMatrix: mat4x4f,
+    // Offset of the samples within their pixel, in NDC, for temporal anti-aliasing
+    jitter: vec2f,
+};
+
+@group(1) @binding(0) var<uniform> uView: ViewUniforms;
+
+/**
+ * Clip space position of a model space one, jittered. Every pass testing depths against
+ * another one's must go through here, for the operations to be the same and in the same
+ * order, hence the same depths (along with @invariant positions).
+ */
+fn clipPosition(modelMatrix: mat4x4f, position: vec3f) -> vec4f {
+	let clip = uView.projectionMatrix * uView.viewMatrix * modelMatrix * vec4f(position, 1.0);
+	return vec4f(clip.xy + uView.jitter * clip.w, clip.zw);
+}
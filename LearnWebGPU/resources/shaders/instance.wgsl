@@ -0,0 +1,13 @@
+/**
+ * Per instance data, the instances of a batch being drawn with a single draw call,
+ * as Application::InstanceData, also read by the culling pass
+ */
+struct Instance {
+	modelMatrix: mat4x4f,
+	// Index in the materials of the scene, the instance's only material data
+	material: u32,
+	// Only read by the culling pass
+	batch: u32,
+	// Added to the frame time for the vertex animation of the instance, if its mesh has one
+	animationOffset: f32,
+};
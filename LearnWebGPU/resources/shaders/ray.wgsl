@@ -0,0 +1,11 @@
+/**
+ * Ray queries of the shaders, the same as those of Bvh.h on the CPU
+ */
+
+/**
+ * 1 / direction for slab tests, zero components made tiny rather than giving NaN slab
+ * distances for boxes starting at the origin
+ */
+fn rayInverseDirection(direction: vec3f) -> vec3f {
+	return 1.0 / select(vec3f(1e-30), direction, abs(direction) > vec3f(1e-30));
+}
@@ -0,0 +1,72 @@
+/**
+ * Frame and draw groups of the passes drawing the scene's instances, which bind
+ * them with the camera. DrawUniforms depends on the VertexQuantization declared
+ * by VertexLayout, prepended to the including source.
+ *
+ * Bind groups go from the least to the most frequently changed: frame, view,
+ * material, then draw, so that each draw binds again only what differs from the
+ * previous one.
+ */
+
+#include "camera.wgsl"
+#include "instance.wgsl"
+
+/**
+ * Uniforms that change with the animation, once per frame
+ */
+struct FrameUniforms {
+    // Transform of the whole scene
+    modelMatrix: mat4x4f,
+    time: f32,
+};
+
+/**
+ * Uniforms of the batch being drawn, all of whose instances share a mesh
+ */
+struct DrawUniforms {
+	quantization: VertexQuantization,
+	// Start of the batch's range of visible instances
+	firstVisibleInstance: u32,
+	// Index of the texture in the scene, whose slot fs_feedback writes to
+	textureId: u32,
+	// Base vertex of the draw, which vertex indices count from
+	baseVertex: u32,
+	// Whether the mesh is animated by the vertex animation textures bound with the view
+	vertexAnimation: u32,
+};
+
+@group(0) @binding(0) var<uniform> uFrame: FrameUniforms;
+
+@group(3) @binding(0) var<storage, read> instances: array<Instance>;
+// Indices of the instances left after frustum culling, the draw call being issued for them only
+@group(3) @binding(1) var<storage, read> visibleInstances: array<u32>;
+#ifdef MULTI_DRAW
+// Of every batch, the draws of a multi-draw call sharing the binding (see MultiDraw.h)
+@group(3) @binding(2) var<storage, read> drawUniforms: array<DrawUniforms>;
+#else
+#ifdef PUSH_CONSTANTS
+// Set with each draw, see DrawConstants.h
+var<push_constant> uDraw: DrawUniforms;
+#else
+@group(3) @binding(2) var<uniform> uDraw: DrawUniforms;
+#endif
+#endif
+
+// Index in instances of the visible instance `index` of the batch being drawn
+fn visibleInstance(index: u32) -> u32 {
+#ifdef MULTI_DRAW
+	// The instance indices of multi-draws start at the first visible instance of their batch
+	return visibleInstances[index];
+#else
+	return visibleInstances[uDraw.firstVisibleInstance + index];
+#endif
+}
+
+// Uniforms of the batch drawing `instance`
+fn drawUniformsOf(instance: Instance) -> DrawUniforms {
+#ifdef MULTI_DRAW
+	return drawUniforms[instance.batch];
+#else
+	return uDraw;
+#endif
+}
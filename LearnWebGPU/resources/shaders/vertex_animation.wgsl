@@ -0,0 +1,62 @@
+/**
+ * Vertices animated by the textures VertexAnimationTexture bakes, bound with the
+ * view: the position and normal of each vertex at each frame of the animation,
+ * vertex v of frame f being the texel (v % width, f * rowsPerFrame + v / width).
+ * Draws whose DrawUniforms set vertexAnimation read their positions and normals
+ * from them, each instance playing the animation from its own animationOffset,
+ * which keeps crowds of animated instances at the cost of a static instanced draw.
+ *
+ * Included by shader.wgsl and depth_prepass.wgsl after shaders/scene.wgsl, both
+ * reading positions through animatedPosition() for their depths to match.
+ */
+
+struct VertexAnimationUniforms {
+	frameCount: u32,
+	// Frames per second of animation time
+	frameRate: f32,
+	width: u32,
+	rowsPerFrame: u32,
+};
+
+@group(1) @binding(15) var<uniform> uVertexAnimation: VertexAnimationUniforms;
+@group(1) @binding(16) var animationPositions: texture_2d<f32>;
+@group(1) @binding(17) var animationNormals: texture_2d<f32>;
+
+/**
+ * The two frames around a time of the animation, which loops, and the weight of the second
+ */
+struct AnimationFrames {
+	first: u32,
+	second: u32,
+	blend: f32,
+};
+
+fn animationFrames(time: f32) -> AnimationFrames {
+	let frameCount = f32(uVertexAnimation.frameCount);
+	let frame = time * uVertexAnimation.frameRate;
+	let looped = frame - floor(frame / frameCount) * frameCount;
+	let first = min(u32(looped), uVertexAnimation.frameCount - 1u);
+	return AnimationFrames(first, (first + 1u) % uVertexAnimation.frameCount, fract(looped));
+}
+
+fn animationTexel(vertexIndex: u32, frame: u32) -> vec2u {
+	return vec2u(
+		vertexIndex % uVertexAnimation.width,
+		frame * uVertexAnimation.rowsPerFrame + vertexIndex / uVertexAnimation.width
+	);
+}
+
+// Position of vertex `vertexIndex` of the animated mesh at `time`
+fn animatedPosition(vertexIndex: u32, time: f32) -> vec3f {
+	let frames = animationFrames(time);
+	let first = textureLoad(animationPositions, animationTexel(vertexIndex, frames.first), 0).xyz;
+	let second = textureLoad(animationPositions, animationTexel(vertexIndex, frames.second), 0).xyz;
+	return mix(first, second, frames.blend);
+}
+
+fn animatedNormal(vertexIndex: u32, time: f32) -> vec3f {
+	let frames = animationFrames(time);
+	let first = textureLoad(animationNormals, animationTexel(vertexIndex, frames.first), 0).xyz;
+	let second = textureLoad(animationNormals, animationTexel(vertexIndex, frames.second), 0).xyz;
+	return normalize(mix(first, second, frames.blend));
+}
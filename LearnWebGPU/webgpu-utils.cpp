@@ -26,13 +26,55 @@
 
 #include "webgpu-utils.h"
 
+#ifdef WEBGPU_BACKEND_WGPU
+#  include <webgpu/wgpu.h>
+#endif // WEBGPU_BACKEND_WGPU
+
 #ifdef __EMSCRIPTEN__
 #  include <emscripten.h>
 #endif // __EMSCRIPTEN__
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+namespace {
+
+const char* adapterTypeName(WGPUAdapterType type) {
+	switch (type) {
+	case WGPUAdapterType_DiscreteGPU: return "discrete GPU";
+	case WGPUAdapterType_IntegratedGPU: return "integrated GPU";
+	case WGPUAdapterType_CPU: return "CPU";
+	default: return "unknown type";
+	}
+}
+
+const char* backendTypeName(WGPUBackendType type) {
+	switch (type) {
+	case WGPUBackendType_WebGPU: return "WebGPU";
+	case WGPUBackendType_D3D11: return "D3D11";
+	case WGPUBackendType_D3D12: return "D3D12";
+	case WGPUBackendType_Metal: return "Metal";
+	case WGPUBackendType_Vulkan: return "Vulkan";
+	case WGPUBackendType_OpenGL: return "OpenGL";
+	case WGPUBackendType_OpenGLES: return "OpenGLES";
+	default: return "unknown backend";
+	}
+}
+
+// Software rasterizers that some drivers report as GPUs: Microsoft Basic Render
+// Driver (WARP) and Mesa's llvmpipe
+bool isSoftwareRasterizer(const WGPUAdapterProperties& properties) {
+	if (properties.vendorID == 0x1414 && properties.deviceID == 0x8c) return true;
+	if (properties.vendorID == 0x10005) return true;
+	return properties.name && std::strstr(properties.name, "llvmpipe") != nullptr;
+}
+
+} // anonymous namespace
 
 WGPUAdapter requestAdapterSync(WGPUInstance instance, WGPURequestAdapterOptions const* options) {
 	// A simple structure holding the local information shared with the
@@ -143,6 +185,188 @@ void inspectAdapter(WGPUAdapter adapter) {
 	std::cout << std::dec; // Restore decimal numbers
 }
 
+int scoreAdapter(WGPUAdapter adapter, WGPUSurface compatibleSurface, WGPUPowerPreference powerPreference) {
+	WGPUAdapterProperties properties = {};
+	properties.nextInChain = nullptr;
+	wgpuAdapterGetProperties(adapter, &properties);
+
+#ifndef __EMSCRIPTEN__
+	if (compatibleSurface) {
+		WGPUSurfaceCapabilities capabilities = {};
+		capabilities.nextInChain = nullptr;
+		wgpuSurfaceGetCapabilities(compatibleSurface, adapter, &capabilities);
+		bool canPresent = capabilities.formatCount > 0;
+		wgpuSurfaceCapabilitiesFreeMembers(capabilities);
+		if (!canPresent) return -1;
+	}
+#else
+	(void)compatibleSurface;
+#endif // NOT __EMSCRIPTEN__
+
+	// The adapter type dominates the score, the rest only breaks ties
+	WGPUAdapterType type = isSoftwareRasterizer(properties) ? WGPUAdapterType_CPU : properties.adapterType;
+	bool lowPower = powerPreference == WGPUPowerPreference_LowPower;
+	int score = 0;
+	switch (type) {
+	case WGPUAdapterType_DiscreteGPU: score = lowPower ? 2000 : 3000; break;
+	case WGPUAdapterType_IntegratedGPU: score = lowPower ? 3000 : 2000; break;
+	case WGPUAdapterType_CPU: score = 0; break;
+	default: score = 1000; break;
+	}
+
+	// GL adapters are the fallback of the native backends, for the same GPU
+	if (properties.backendType == WGPUBackendType_OpenGL || properties.backendType == WGPUBackendType_OpenGLES) {
+		score -= 500;
+	}
+
+#ifndef __EMSCRIPTEN__
+	WGPUSupportedLimits supportedLimits = {};
+	supportedLimits.nextInChain = nullptr;
+#ifdef WEBGPU_BACKEND_DAWN
+	bool success = wgpuAdapterGetLimits(adapter, &supportedLimits) == WGPUStatus_Success;
+#else
+	bool success = wgpuAdapterGetLimits(adapter, &supportedLimits);
+#endif
+	if (success) {
+		// At most a few hundred points, less than the gap between two adapter types
+		const WGPULimits& limits = supportedLimits.limits;
+		score += 10 * static_cast<int>(std::log2(std::max<uint32_t>(limits.maxTextureDimension2D, 1)));
+		score += 5 * static_cast<int>(std::log2(static_cast<double>(std::max<uint64_t>(limits.maxBufferSize, 1))));
+		score += 5 * static_cast<int>(std::log2(static_cast<double>(std::max<uint64_t>(limits.maxStorageBufferBindingSize, 1))));
+	}
+#endif // NOT __EMSCRIPTEN__
+
+	// Optional features that the renderer uses when available
+	if (wgpuAdapterHasFeature(adapter, WGPUFeatureName_TimestampQuery)) score += 50;
+	if (wgpuAdapterHasFeature(adapter, WGPUFeatureName_TextureCompressionBC)
+		|| wgpuAdapterHasFeature(adapter, WGPUFeatureName_TextureCompressionETC2)
+		|| wgpuAdapterHasFeature(adapter, WGPUFeatureName_TextureCompressionASTC)) {
+		score += 20;
+	}
+
+	return std::max(score, 0);
+}
+
+namespace {
+
+// Keep the candidate with the best score, releasing the others
+WGPUAdapter pickBestAdapter(const std::vector<WGPUAdapter>& candidates, const WGPURequestAdapterOptions& options) {
+	WGPUAdapter best = nullptr;
+	int bestScore = -1;
+	std::cout << "Adapter candidates:" << std::endl;
+	for (WGPUAdapter adapter : candidates) {
+		int score = scoreAdapter(adapter, options.compatibleSurface, options.powerPreference);
+
+		WGPUAdapterProperties properties = {};
+		properties.nextInChain = nullptr;
+		wgpuAdapterGetProperties(adapter, &properties);
+		std::cout << " - " << (properties.name ? properties.name : "unnamed adapter")
+			<< " (" << adapterTypeName(properties.adapterType) << ", " << backendTypeName(properties.backendType)
+			<< ", vendor 0x" << std::hex << properties.vendorID << std::dec << "): ";
+		if (score < 0) std::cout << "unsuitable" << std::endl;
+		else std::cout << "score " << score << std::endl;
+
+		// Keep the first of equal candidates, which the system lists in its own order of preference
+		if (score > bestScore) {
+			if (best) wgpuAdapterRelease(best);
+			best = adapter;
+			bestScore = score;
+		}
+		else {
+			wgpuAdapterRelease(adapter);
+		}
+	}
+	return best;
+}
+
+#ifndef WEBGPU_BACKEND_WGPU
+// The standard API only hands out one adapter per request, so candidates are the
+// ones that the system sees as the most powerful and as the one that saves the most power
+constexpr WGPUPowerPreference candidatePreferences[] = { WGPUPowerPreference_HighPerformance, WGPUPowerPreference_LowPower };
+
+/**
+ * State of an asynchronous selection, alive until its callback is called
+ */
+struct AdapterSelection {
+	WGPUInstance instance;
+	WGPURequestAdapterOptions options;
+	std::function<void(WGPUAdapter)> callback;
+	std::vector<WGPUAdapter> candidates;
+	size_t nextPreference = 0;
+};
+
+// Request the candidate of the next power preference, or pick the best one when all answered
+void requestNextCandidate(AdapterSelection* selection) {
+	if (selection->nextPreference == std::size(candidatePreferences)) {
+		WGPUAdapter best = pickBestAdapter(selection->candidates, selection->options);
+		std::function<void(WGPUAdapter)> callback = std::move(selection->callback);
+		delete selection;
+		callback(best);
+		return;
+	}
+
+	WGPURequestAdapterOptions candidateOptions = selection->options;
+	candidateOptions.powerPreference = candidatePreferences[selection->nextPreference++];
+	auto onAdapterRequestEnded = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, char const* message, void* pUserData) {
+		AdapterSelection* selection = reinterpret_cast<AdapterSelection*>(pUserData);
+		if (status == WGPURequestAdapterStatus_Success) {
+			selection->candidates.push_back(adapter);
+		}
+		else {
+			std::cout << "Could not get WebGPU adapter: " << (message ? message : "unknown error") << std::endl;
+		}
+		requestNextCandidate(selection);
+		};
+	wgpuInstanceRequestAdapter(selection->instance, &candidateOptions, onAdapterRequestEnded, (void*)selection);
+}
+#endif // ! WEBGPU_BACKEND_WGPU
+
+} // anonymous namespace
+
+WGPUAdapter selectAdapterSync(WGPUInstance instance, WGPURequestAdapterOptions const* options) {
+	std::vector<WGPUAdapter> candidates;
+#ifdef WEBGPU_BACKEND_WGPU
+	size_t adapterCount = wgpuInstanceEnumerateAdapters(instance, nullptr, nullptr);
+	candidates.resize(adapterCount);
+	wgpuInstanceEnumerateAdapters(instance, nullptr, candidates.data());
+#else
+	for (WGPUPowerPreference preference : candidatePreferences) {
+		WGPURequestAdapterOptions candidateOptions = *options;
+		candidateOptions.powerPreference = preference;
+		WGPUAdapter adapter = requestAdapterSync(instance, &candidateOptions);
+		if (adapter) candidates.push_back(adapter);
+	}
+#endif // WEBGPU_BACKEND_WGPU
+
+	WGPUAdapter best = pickBestAdapter(candidates, *options);
+	if (!best) {
+		std::cout << "No suitable adapter among the candidates, requesting the default one" << std::endl;
+		best = requestAdapterSync(instance, options);
+	}
+	return best;
+}
+
+void selectAdapterAsync(WGPUInstance instance, WGPURequestAdapterOptions const* options, std::function<void(WGPUAdapter)> callback) {
+#ifdef WEBGPU_BACKEND_WGPU
+	// Adapters are enumerated and requested synchronously anyway
+	callback(selectAdapterSync(instance, options));
+#else
+	AdapterSelection* selection = new AdapterSelection;
+	selection->instance = instance;
+	selection->options = *options;
+	selection->callback = std::move(callback);
+	requestNextCandidate(selection);
+#endif // WEBGPU_BACKEND_WGPU
+}
+
+bool parsePowerPreference(const char* str, WGPUPowerPreference& powerPreference) {
+	if (std::strcmp(str, "high-performance") == 0) powerPreference = WGPUPowerPreference_HighPerformance;
+	else if (std::strcmp(str, "low-power") == 0) powerPreference = WGPUPowerPreference_LowPower;
+	else if (std::strcmp(str, "default") == 0) powerPreference = WGPUPowerPreference_Undefined;
+	else return false;
+	return true;
+}
+
 WGPUDevice requestDeviceSync(WGPUAdapter adapter, WGPUDeviceDescriptor const* descriptor) {
 	struct UserData {
 		WGPUDevice device = nullptr;
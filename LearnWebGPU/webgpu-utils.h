@@ -28,6 +28,8 @@
 
 #include <webgpu/webgpu.h>
 
+#include <functional>
+
  /**
   * Utility function to get a WebGPU adapter, so that
   *     WGPUAdapter adapter = requestAdapter(options);
@@ -51,6 +53,38 @@ WGPUDevice requestDeviceSync(WGPUAdapter adapter, WGPUDeviceDescriptor const* de
  */
 void inspectAdapter(WGPUAdapter adapter);
 
+/**
+ * Rate how well an adapter suits the renderer, the higher the better, or return a
+ * negative score if it cannot be used, e.g. when it cannot present to
+ * `compatibleSurface` (if not null). The adapter type comes first, discrete GPUs
+ * winning unless `powerPreference` asks for low power, then larger limits and the
+ * optional features that the renderer uses break ties.
+ */
+int scoreAdapter(WGPUAdapter adapter, WGPUSurface compatibleSurface, WGPUPowerPreference powerPreference);
+
+/**
+ * Get the adapter with the best score among the ones that the instance exposes, so
+ * that machines with several GPUs run on the most capable one rather than on the
+ * first one that the system lists. Candidates are listed with their score.
+ * Backends that cannot enumerate adapters are asked for an adapter of each power
+ * preference instead. Returns nullptr if no adapter is suitable.
+ */
+WGPUAdapter selectAdapterSync(WGPUInstance instance, WGPURequestAdapterOptions const* options);
+
+/**
+ * Same as selectAdapterSync, without waiting for the adapter: `callback` receives
+ * it (or nullptr) on the calling thread once the requests complete, that is right
+ * away with wgpu-native, from wgpuInstanceProcessEvents with Dawn, and from the
+ * browser's event loop on the web.
+ */
+void selectAdapterAsync(WGPUInstance instance, WGPURequestAdapterOptions const* options, std::function<void(WGPUAdapter)> callback);
+
+/**
+ * Read a power preference, "high-performance", "low-power" or "default", returning
+ * false if the string is none of them
+ */
+bool parsePowerPreference(const char* str, WGPUPowerPreference& powerPreference);
+
 /**
  * Display information about a device
  */